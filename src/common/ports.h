@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 class ConsolePort {
@@ -29,23 +30,50 @@ public:
     virtual ~InputPort() = default;
     virtual bool PollKeyboard(KeyboardEvent* event) = 0;
     virtual bool PollPointer(PointerEvent* event) = 0;
+    // Blocks until events may be there to poll, or `timeout_ms` passes.
+    virtual void WaitForInput(uint32_t timeout_ms) = 0;
 };
 
+// Guest monitors a VM can have, one virtio-gpu scanout each.
+constexpr uint32_t kMaxDisplayScanouts = 4;
+
 struct DisplayFrame {
+    uint32_t scanout_id = 0;
     uint32_t width = 0;
     uint32_t height = 0;
     uint32_t stride = 0;
     uint32_t format = 0;
-    // Full resource dimensions (for dirty-rect mode)
+    // Full scanout dimensions (for dirty-rect mode)
     uint32_t resource_width = 0;
     uint32_t resource_height = 0;
-    // Dirty rectangle origin within the resource
+    // Dirty rectangle origin within the scanout
     uint32_t dirty_x = 0;
     uint32_t dirty_y = 0;
+    // The rectangle's 32bpp rows, `stride` apart: owned in `pixels`, or
+    // borrowed at `data` from a buffer that `source` keeps alive. With no
+    // source, borrowed rows last only as long as the call the frame is
+    // passed to.
     std::vector<uint8_t> pixels;
+    const uint8_t* data = nullptr;
+    std::shared_ptr<const void> source;
+
+    size_t Pitch() const { return stride ? stride : static_cast<size_t>(width) * 4; }
+    // Rows there are pixels for.
+    uint32_t Rows() const {
+        if (data) return height;
+        size_t have = pixels.size() >= static_cast<size_t>(width) * 4
+            ? (pixels.size() - static_cast<size_t>(width) * 4) / Pitch() + 1 : 0;
+        return have < height ? static_cast<uint32_t>(have) : height;
+    }
+    // Start of row `row`, or nullptr past the last one there are pixels for.
+    const uint8_t* Row(uint32_t row) const {
+        if (row >= Rows()) return nullptr;
+        return (data ? data : pixels.data()) + row * Pitch();
+    }
 };
 
 struct CursorInfo {
+    uint32_t scanout_id = 0;  // x and y are relative to this scanout
     int32_t x = 0;
     int32_t y = 0;
     uint32_t hot_x = 0;
@@ -54,15 +82,21 @@ struct CursorInfo {
     uint32_t height = 0;
     bool visible = false;
     bool image_updated = false;
+    uint64_t image_id = 0;        // content hash of the image, 0 when there is none
     std::vector<uint8_t> pixels;  // ARGB8888 format
 };
 
+// Cursor images both ends of the display channel remember, oldest evicted
+// first; an image among them is sent by image_id alone.
+constexpr size_t kCursorImageCacheSize = 16;
+
 class DisplayPort {
 public:
     virtual ~DisplayPort() = default;
     virtual void SubmitFrame(DisplayFrame frame) = 0;
     virtual void SubmitCursor(const CursorInfo& cursor) = 0;
-    virtual void SubmitScanoutState(bool active, uint32_t width, uint32_t height) = 0;
+    virtual void SubmitScanoutState(uint32_t scanout_id, bool active,
+                                    uint32_t width, uint32_t height) = 0;
 };
 
 struct AudioChunk {
@@ -71,10 +105,26 @@ struct AudioChunk {
     std::vector<int16_t> pcm;
 };
 
+// Where the host is in playing what was submitted, in frames.
+struct AudioClock {
+    uint32_t queued = 0;  // submitted, not played yet
+    uint32_t played = 0;  // played so far, wrapping
+    uint32_t target = 0;  // how much the host wants queued
+};
+
 class AudioPort {
 public:
     virtual ~AudioPort() = default;
     virtual void SubmitPcm(AudioChunk chunk) = 0;
+    // False when the host reports no playback clock.
+    virtual bool GetPlaybackClock(AudioClock* clock) = 0;
+
+    // Capture, S16 stereo 48000Hz. The host opens its microphone only
+    // while capture is active.
+    virtual void SetCaptureActive(bool active) = 0;
+    // Captured frames waiting to be read; false when there is no capture.
+    virtual bool GetCapturedFrames(size_t* frames) = 0;
+    virtual size_t ReadCapture(int16_t* samples, size_t frames) = 0;
 };
 
 enum class ControlCommandType : uint32_t {
@@ -99,11 +149,18 @@ struct ClipboardEvent {
         kRelease,   // Clipboard ownership released
     };
 
+    // kData comes in pieces of at most kPieceSize, in order: `data` holds
+    // the bytes at `offset`, and the last piece ends at `total_size`.
+    static constexpr size_t kPieceSize = 256 * 1024;
+    static constexpr uint64_t kMaxSize = 256ull * 1024 * 1024;
+
     Type type;
     uint8_t selection = 0;
     std::vector<uint32_t> available_types;  // For kGrab
     uint32_t data_type = 0;                 // For kData/kRequest
     std::vector<uint8_t> data;              // For kData
+    uint64_t offset = 0;                    // For kData
+    uint64_t total_size = 0;                // For kData
 };
 
 class ClipboardPort {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
 #include <optional>
 #include <string>
 #include <vector>
@@ -10,10 +11,30 @@ struct PortForward {
     uint16_t guest_port;
 };
 
+// A vsock port bridged to a TCP port on host loopback. By default the host
+// listens on 127.0.0.1:host_port and connects each client to the guest's
+// vsock_port; with guest_connects the guest reaches 127.0.0.1:host_port by
+// connecting to host CID 2 at vsock_port.
+struct VsockForward {
+    uint16_t host_port;
+    uint32_t vsock_port;
+    bool guest_connects = false;
+};
+
+// Bandwidth cap of a VM's NAT network, per direction, in Mbit/s; 0 means
+// unlimited. A burst of 0 picks one from the rate.
+struct NetRateLimit {
+    uint32_t rx_mbps = 0;   // to the guest
+    uint32_t tx_mbps = 0;   // from the guest
+    uint32_t burst_kb = 0;
+    bool operator==(const NetRateLimit&) const = default;
+};
+
 struct SharedFolder {
     std::string tag;        // virtiofs mount tag (e.g., "share")
     std::string host_path;  // host directory path
     bool readonly = false;
+    bool writeback = false; // guest write caching, coalesced on the host
 };
 
 enum class VmPowerState : uint8_t {
@@ -31,11 +52,45 @@ struct VmSpec {
     std::string kernel_path; // absolute at runtime, relative in vm.json
     std::string initrd_path;
     std::string disk_path;
+    bool disk_direct_io = false;  // unbuffered host I/O for raw disks
+    bool disk_mmap = false;       // raw disk reads from mapped views
+    uint64_t qcow2_l2_cache_mb = 0;  // 0 = sized to cover the whole image
+    uint64_t qcow2_compressed_cache_mb = 0;  // 0 = default (4 MB)
+    uint32_t disk_readahead_kb = 512;  // sequential readahead window, 0 = off
+    uint32_t disk_boot_profile_s = 30;  // boot reads recorded and prefetched, 0 = off
+    uint32_t disk_iops_limit = 0;   // disk requests per second, 0 = unlimited
+    uint32_t disk_iops_burst = 0;   // 0 = one second's worth
+    uint32_t disk_mbps_limit = 0;   // disk MB per second, 0 = unlimited
+    uint32_t disk_burst_mb = 0;     // 0 = one second's worth
+    uint32_t irq_coalesce_us = 50;      // disk/net interrupt moderation, 0 = off
+    uint32_t irq_coalesce_frames = 32;  // notifications per moderated interrupt
+    bool virtio_pci = false;  // disk and network on virtio-pci with per-queue MSI-X
+    uint32_t display_fps = 60;          // display updates sent per second
+    uint32_t display_count = 1;         // guest monitors, 1-4
     std::string cmdline;
+    bool hvc_console = false;  // kernel console on virtio hvc0, not ttyS0
     uint64_t memory_mb = 4096;
+    uint64_t max_memory_mb = 0;  // running guest can grow to this, 0 = fixed
+    bool lazy_memory = false;  // commit guest RAM on demand, not at start
+    bool large_pages = false;  // needs SeLockMemoryPrivilege, else 4 KiB pages
+    uint32_t page_dedup_interval_s = 0;  // scan for pages to share, 0 = off
+    std::string suspend_snapshot;  // file in vm_dir resumed from on next start
+    std::string template_snapshot; // file in vm_dir clones resume from; never boots again
+    std::string forked_from;       // template vm_id the disk overlay is based on
+    std::string fork_snapshot;     // template snapshot resumed from on first start
     uint32_t cpu_count = 4;
+    uint32_t max_cpu_count = 0;  // vCPUs hotpluggable up to this, 0 = fixed
+    std::string vcpu_placement;  // "performance", "spread", "numa"; empty = none
+    std::string numa_memory;     // "local", "split"; empty = none
+    bool x2apic = false;  // x2APIC + TSC-deadline where the hypervisor allows
+    bool pmu = false;     // guest performance counters where the hypervisor allows
+    uint32_t io_threads = 0;  // dedicated device I/O threads
+    std::map<std::string, uint32_t> device_io_threads;  // "blk" -> I/O thread index
     bool nat_enabled = false;
     std::vector<PortForward> port_forwards;
+    NetRateLimit net_rate_limit;
+    bool vsock = false;  // virtio-vsock device, bridged as vsock_forwards say
+    std::vector<VsockForward> vsock_forwards;
     std::vector<SharedFolder> shared_folders;
 };
 
@@ -43,8 +98,142 @@ struct VmMutablePatch {
     std::optional<std::string> name;
     std::optional<bool> nat_enabled;
     std::optional<std::vector<PortForward>> port_forwards;
+    std::optional<NetRateLimit> net_rate_limit;
     std::optional<std::vector<SharedFolder>> shared_folders;
     std::optional<uint64_t> memory_mb;
     std::optional<uint32_t> cpu_count;
     bool apply_on_next_boot = false;
 };
+
+// vCPU exit profile reported by a running VM (runtime.stats).
+struct VmExitStat {
+    uint32_t vcpu = 0;
+    std::string name;        // exit kind, "port 0x3F8" or "mmio virtio-blk"
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    // Bucket 0 holds exits under 256 ns; each later bucket doubles.
+    std::vector<uint64_t> histogram;
+};
+
+struct VmHaltStat {
+    uint64_t halts = 0;
+    uint64_t halted_ns = 0;
+    uint64_t poll_wakeups = 0;
+    uint32_t poll_us = 0;
+};
+
+// Traffic through one host port forward since it was (re)configured.
+struct VmPortForwardStat {
+    uint16_t host_port = 0;
+    uint16_t guest_port = 0;
+    uint64_t accepted = 0;        // connections accepted
+    uint32_t active = 0;          // connections open now
+    uint64_t bytes_to_guest = 0;
+    uint64_t bytes_to_host = 0;
+};
+
+// Memory balloon state; the byte counts are totals since boot.
+struct VmBalloonStat {
+    uint64_t target_bytes = 0;
+    uint64_t actual_bytes = 0;
+    uint64_t reported_bytes = 0;  // free pages the guest reported
+    uint64_t hinted_bytes = 0;    // free pages hinted on request
+};
+
+// Frames the NAT network dropped since boot.
+struct VmNetDropStat {
+    uint64_t tx_dropped = 0;      // from the guest, no TX buffer free
+    uint64_t shaper_dropped = 0;  // by the rate limit, its queue full
+};
+
+// Shareable page scan of a VM, in 4 KiB pages (runtime.dedup_pass).
+struct VmDedupStat {
+    uint64_t passes = 0;
+    uint64_t resident_pages = 0;
+    uint64_t stable_pages = 0;     // unchanged across the last two passes
+    uint64_t zero_pages = 0;
+    uint64_t duplicate_pages = 0;  // stable copies within this guest
+    uint64_t shared_pages = 0;     // backed by a combined page
+    uint64_t combined_pages = 0;   // merged by combines this runtime ran
+};
+
+// virtio-fs requests of one FUSE opcode since boot. The percentiles are
+// upper bounds of the histogram buckets holding them.
+struct VmFsOpStat {
+    std::string name;        // "LOOKUP", "READ", ...
+    uint64_t count = 0;
+    uint64_t errors = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+    uint64_t p50_us = 0;
+    uint64_t p99_us = 0;
+};
+
+// A milestone of the runtime's start, in microseconds since it began.
+struct VmStartupPhase {
+    std::string name;
+    uint64_t us = 0;
+};
+
+struct VmRuntimeStats {
+    std::vector<VmExitStat> exits;
+    std::vector<VmHaltStat> halts;   // indexed by vCPU
+    std::vector<VmPortForwardStat> port_forwards;
+    VmBalloonStat balloon;
+    VmNetDropStat net;
+    VmDedupStat dedup;
+    std::vector<VmFsOpStat> fs_ops;
+    std::vector<VmStartupPhase> startup;
+};
+
+// A guest file copy over the guest agent (runtime.file_transfer).
+struct VmFileTransferStatus {
+    uint64_t id = 0;
+    uint64_t bytes = 0;
+    uint64_t total = 0;   // 0 while the size is unknown (pulls)
+    bool done = false;
+    bool ok = false;      // once done
+    std::string error;
+};
+
+// Running totals a runtime keeps for the manager's metrics. Fixed-width
+// fields only: runtimes publish them in shared memory as they are.
+struct VmCounters {
+    uint64_t vcpu_halted_ns = 0;  // over all vCPUs
+    uint64_t exits = 0;
+    uint64_t disk_reads = 0;
+    uint64_t disk_writes = 0;
+    uint64_t disk_read_bytes = 0;
+    uint64_t disk_write_bytes = 0;
+    uint64_t net_rx_packets = 0;
+    uint64_t net_rx_bytes = 0;
+    uint64_t net_tx_packets = 0;
+    uint64_t net_tx_bytes = 0;
+    uint64_t display_frames = 0;
+    uint64_t dirty_pages = 0;  // guest RAM pages written, with checkpoints on
+};
+
+// One running VM in the manager's metrics: totals as of the runtime's
+// last sample, and rates over its sample interval.
+struct VmMetrics {
+    std::string vm_id;
+    std::string name;
+    uint32_t vcpu_count = 0;
+    uint64_t memory_committed_bytes = 0;
+    uint64_t uptime_us = 0;
+    VmCounters totals;
+
+    double vcpu_utilization = 0;  // 0..1, averaged over the vCPUs
+    double exits_per_sec = 0;
+    double disk_read_iops = 0;
+    double disk_write_iops = 0;
+    double disk_read_bytes_per_sec = 0;
+    double disk_write_bytes_per_sec = 0;
+    double net_rx_pps = 0;
+    double net_tx_pps = 0;
+    double net_rx_bytes_per_sec = 0;
+    double net_tx_bytes_per_sec = 0;
+    double display_fps = 0;
+    double dirty_pages_per_sec = 0;
+};
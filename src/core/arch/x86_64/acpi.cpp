@@ -1,5 +1,6 @@
 #include "core/arch/x86_64/acpi.h"
 #include <cstring>
+#include <initializer_list>
 
 namespace x86 {
 
@@ -67,6 +68,31 @@ struct MadtIntOverride {
 };
 static_assert(sizeof(MadtIntOverride) == 10);
 
+struct SratProcessorAffinity {
+    uint8_t  type;          // 0 = Processor Local APIC Affinity
+    uint8_t  length;        // 16
+    uint8_t  proximity_lo;  // bits 7:0 of the proximity domain
+    uint8_t  apic_id;
+    uint32_t flags;         // bit 0 = enabled
+    uint8_t  sapic_eid;
+    uint8_t  proximity_hi[3];
+    uint32_t clock_domain;
+};
+static_assert(sizeof(SratProcessorAffinity) == 16);
+
+struct SratMemoryAffinity {
+    uint8_t  type;          // 1 = Memory Affinity
+    uint8_t  length;        // 40
+    uint32_t proximity;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t size;
+    uint32_t reserved2;
+    uint32_t flags;         // bit 0 = enabled
+    uint64_t reserved3;
+};
+static_assert(sizeof(SratMemoryAffinity) == 40);
+
 #pragma pack(pop)
 
 static void FillHeader(AcpiHeader* h, const char sig[4], uint32_t len,
@@ -81,6 +107,197 @@ static void FillHeader(AcpiHeader* h, const char sig[4], uint32_t len,
     h->creator_revision = 1;
 }
 
+// ---------------------------------------------------------------------------
+// AML assembly for the processor objects
+// ---------------------------------------------------------------------------
+// The fixed devices above are few and laid out by hand. Processor objects
+// come in their hundreds and nest methods inside devices inside scopes, so
+// each term is assembled into its own buffer first: its package length is
+// then known when the enclosing term is written.
+
+namespace {
+
+class Aml {
+public:
+    const std::vector<uint8_t>& bytes() const { return bytes_; }
+
+    Aml& Op(std::initializer_list<uint8_t> ops) {
+        bytes_.insert(bytes_.end(), ops);
+        return *this;
+    }
+
+    // A path of 4-character segments, "\\_SB_.CSCN" or "CSEL".
+    Aml& Name(const char* path) {
+        if (*path == '\\') bytes_.push_back(*path++);
+        size_t segs = (strlen(path) + 1) / 5;
+        if (segs == 2) bytes_.push_back(0x2E);        // DualNamePrefix
+        if (segs > 2) Op({0x2F, static_cast<uint8_t>(segs)});  // MultiNamePrefix
+        for (; *path; path++) {
+            if (*path != '.') bytes_.push_back(static_cast<uint8_t>(*path));
+        }
+        return *this;
+    }
+
+    Aml& Int(uint64_t v) {
+        if (v <= 1) return Op({static_cast<uint8_t>(v)});  // ZeroOp, OneOp
+        uint32_t len = v <= 0xFF ? 1 : v <= 0xFFFF ? 2 : v <= 0xFFFFFFFF ? 4 : 8;
+        bytes_.push_back(len == 1 ? 0x0A : len == 2 ? 0x0B : len == 4 ? 0x0C : 0x0E);
+        for (uint32_t i = 0; i < len; i++) bytes_.push_back(static_cast<uint8_t>(v >> (8 * i)));
+        return *this;
+    }
+
+    Aml& String(const char* str) {
+        bytes_.push_back(0x0D);  // StringPrefix
+        bytes_.insert(bytes_.end(), str, str + strlen(str) + 1);
+        return *this;
+    }
+
+    Aml& Append(const Aml& term) {
+        bytes_.insert(bytes_.end(), term.bytes_.begin(), term.bytes_.end());
+        return *this;
+    }
+
+    // `ops`, then a PkgLength covering itself and `body`, then `body`.
+    Aml& Package(std::initializer_list<uint8_t> ops, const Aml& body) {
+        Op(ops);
+        size_t len = body.bytes_.size();
+        if (len + 1 <= 63) {
+            bytes_.push_back(static_cast<uint8_t>(len + 1));
+        } else {
+            uint32_t extra = len + 2 < (1u << 12) ? 1 : len + 3 < (1u << 20) ? 2 : 3;
+            size_t total = len + 1 + extra;
+            bytes_.push_back(static_cast<uint8_t>((extra << 6) | (total & 0x0F)));
+            for (uint32_t i = 0; i < extra; i++) {
+                bytes_.push_back(static_cast<uint8_t>(total >> (4 + 8 * i)));
+            }
+        }
+        return Append(body);
+    }
+
+    // A field unit entry: its name, then its width in bits.
+    Aml& FieldUnit(const char* name, uint32_t bits) {
+        if (name) Name(name); else bytes_.push_back(0x00);  // ReservedField
+        if (bits <= 63) return Op({static_cast<uint8_t>(bits)});
+        return Op({static_cast<uint8_t>(0x40 | (bits & 0x0F)), static_cast<uint8_t>(bits >> 4)});
+    }
+
+private:
+    std::vector<uint8_t> bytes_;
+};
+
+constexpr uint8_t kLocal0 = 0x60;
+constexpr uint8_t kArg0 = 0x68;
+constexpr uint8_t kArg1 = 0x69;
+
+void ProcessorName(uint32_t cpu, char name[5]) {
+    name[0] = 'C';
+    name[1] = "0123456789ABCDEF"[(cpu >> 8) & 0xF];
+    name[2] = "0123456789ABCDEF"[(cpu >> 4) & 0xF];
+    name[3] = "0123456789ABCDEF"[cpu & 0xF];
+    name[4] = '\0';
+}
+
+// CPU hotplug, after QEMU's: the OS selects a CPU by writing its index to
+// CSEL and then reads or acknowledges that CPU's flags.
+//
+//   Scope(\_SB) {
+//     OperationRegion(PRST, SystemIO, kCpuHotplugPort, 12)
+//     Field(PRST, DWordAcc, NoLock, Preserve) { CSEL, 32 }
+//     Field(PRST, ByteAcc, NoLock, WriteAsZeros) {
+//       Offset(4), CPEN, 1, CINS, 1, CRMV, 1, CEJF, 1 }
+//     Mutex(CPLK, 0)
+//     Method(CSTA, 1, Serialized)   // _STA of CPU Arg0
+//     Method(CEJ0, 1, Serialized)   // ejects CPU Arg0
+//     Method(CTFY, 2)               // Notify(CPU Arg0, Arg1)
+//     Method(CSCN, 0, Serialized)   // notifies and acks pending events
+//     Device(Cnnn) { _HID "ACPI0007", _UID n, _STA, _MAT, _EJ0 }
+//   }
+//   Scope(\_GPE) { Method(_E02) { \_SB.CSCN() } }
+std::vector<uint8_t> BuildCpuHotplugAml(uint32_t num_cpus, uint32_t max_cpus) {
+    auto acquire = [] { return Aml().Op({0x5B, 0x23}).Name("CPLK").Op({0xFF, 0xFF}); };
+    auto release = [] { return Aml().Op({0x5B, 0x27}).Name("CPLK"); };
+    auto if_set = [](const char* flag, const Aml& then) {
+        // If (LEqual(flag, One)) { then }
+        return Aml().Package({0xA0}, Aml().Op({0x93}).Name(flag).Int(1).Append(then));
+    };
+
+    Aml sb;
+    sb.Op({0x5B, 0x80}).Name("PRST").Op({0x01}).Int(kCpuHotplugPort).Int(12);
+    sb.Package({0x5B, 0x81}, Aml().Name("PRST").Op({0x03}).FieldUnit("CSEL", 32));
+    sb.Package({0x5B, 0x81}, Aml().Name("PRST").Op({0x41})
+                                 .FieldUnit(nullptr, 32).FieldUnit("CPEN", 1)
+                                 .FieldUnit("CINS", 1).FieldUnit("CRMV", 1)
+                                 .FieldUnit("CEJF", 1));
+    sb.Op({0x5B, 0x01}).Name("CPLK").Op({0x00});
+
+    sb.Package({0x14}, Aml().Name("CSTA").Op({0x09})
+        .Append(acquire())
+        .Op({0x70, kArg0}).Name("CSEL")
+        .Op({0x70, 0x00, kLocal0})
+        .Append(if_set("CPEN", Aml().Op({0x70}).Int(0x0F).Op({kLocal0})))
+        .Append(release())
+        .Op({0xA4, kLocal0}));
+
+    sb.Package({0x14}, Aml().Name("CEJ0").Op({0x09})
+        .Append(acquire())
+        .Op({0x70, kArg0}).Name("CSEL")
+        .Op({0x70, 0x01}).Name("CEJF")
+        .Append(release()));
+
+    char name[5];
+    Aml notify;
+    for (uint32_t i = 0; i < max_cpus; i++) {
+        ProcessorName(i, name);
+        notify.Package({0xA0}, Aml().Op({0x93, kArg0}).Int(i)
+                                    .Op({0x86}).Name(name).Op({kArg1}));
+    }
+    sb.Package({0x14}, Aml().Name("CTFY").Op({0x02}).Append(notify));
+
+    Aml scan_one;
+    scan_one.Op({0x70, kLocal0}).Name("CSEL")
+        .Append(if_set("CINS", Aml().Name("CTFY").Op({kLocal0}).Int(1)
+                                    .Op({0x70, 0x01}).Name("CINS")))
+        .Append(if_set("CRMV", Aml().Name("CTFY").Op({kLocal0}).Int(3)
+                                    .Op({0x70, 0x01}).Name("CRMV")))
+        .Op({0x75, kLocal0});
+    sb.Package({0x14}, Aml().Name("CSCN").Op({0x08})
+        .Append(acquire())
+        .Op({0x70, 0x00, kLocal0})
+        .Package({0xA2}, Aml().Op({0x95, kLocal0}).Int(max_cpus).Append(scan_one))
+        .Append(release()));
+
+    for (uint32_t i = 0; i < max_cpus; i++) {
+        ProcessorName(i, name);
+        Aml dev;
+        dev.Name(name);
+        dev.Op({0x08}).Name("_HID").String("ACPI0007");
+        dev.Op({0x08}).Name("_UID").Int(i);
+        dev.Package({0x14}, Aml().Name("_STA").Op({0x00}).Op({0xA4}).Name("CSTA").Int(i));
+        // Processor Local APIC, enabled: what the MADT would have said.
+        uint8_t id = static_cast<uint8_t>(i);
+        dev.Op({0x08}).Name("_MAT")
+           .Package({0x11}, Aml().Int(8).Op({0x00, 0x08, id, id, 0x01, 0x00, 0x00, 0x00}));
+        // The boot processor stays.
+        if (i != 0) {
+            dev.Package({0x14}, Aml().Name("_EJ0").Op({0x01}).Name("CEJ0").Int(i));
+        }
+        sb.Package({0x5B, 0x82}, dev);
+    }
+
+    char gpe_method[] = "_E0?";
+    gpe_method[3] = "0123456789ABCDEF"[kCpuHotplugGpe];
+    Aml gpe;
+    gpe.Name("\\_GPE").Package({0x14}, Aml().Name(gpe_method).Op({0x00}).Name("\\_SB_.CSCN"));
+
+    Aml out;
+    out.Package({0x10}, Aml().Name("\\_SB_").Append(sb));
+    out.Package({0x10}, gpe);
+    LOG_INFO("ACPI: %u of %u CPUs present, the rest hotpluggable", num_cpus, max_cpus);
+    return out.bytes();
+}
+
+}  // namespace
+
 // ---------------------------------------------------------------------------
 // DSDT builder — emit minimal AML with virtio-mmio device nodes
 // ---------------------------------------------------------------------------
@@ -89,23 +306,35 @@ static void FillHeader(AcpiHeader* h, const char sig[4], uint32_t len,
 //
 // Per-device body:  _HID(15) + _UID(7) + _CRS(32) = 54 bytes
 // Per-device entry: ExtOp(1) + DevOp(1) + PkgLen(1) + NameSeg(4) + body = 61
+//
+// A PCI root bridge adds:
+//   Device(PCI0) { Name(_HID,EisaId("PNP0A03")), Name(_UID,0), Name(_CRS,Buffer) }
+//
+// Body:  _HID(10) + _UID(6) + _CRS(61) = 77 bytes
+// Entry: ExtOp(1) + DevOp(1) + PkgLen(2) + NameSeg(4) + body = 85
 
 static uint32_t BuildDsdt(uint8_t* buf,
-                           const std::vector<VirtioMmioAcpiInfo>& devs) {
+                           const std::vector<VirtioMmioAcpiInfo>& devs,
+                           const PciRootAcpiInfo& pci_root,
+                           const std::vector<uint8_t>& extra_aml) {
     const uint32_t N = static_cast<uint32_t>(devs.size());
     const uint32_t kDevBody  = 54;
     const uint32_t kDevEntry = 61;
+    const uint32_t kPciBody  = 77;
+    const uint32_t kPciEntry = 85;
+    const bool has_pci = pci_root.mmio_size != 0;
 
     // Name(\_S5, Package(4){5,5,0,0}) — 16 bytes AML at DSDT root scope
     const uint32_t kS5Size = 16;
 
-    uint32_t scope_body = N * kDevEntry;
+    uint32_t scope_body = N * kDevEntry + (has_pci ? kPciEntry : 0);
     uint32_t scope_namelen = 5;   // \_SB_
     uint32_t scope_remaining = scope_namelen + scope_body;
     uint32_t scope_pkglen_sz = (scope_remaining + 1 <= 63) ? 1 : 2;
     uint32_t scope_pkglen_val = scope_pkglen_sz + scope_remaining;
     uint32_t scope_total = 1 + scope_pkglen_sz + scope_remaining;
-    uint32_t dsdt_total = sizeof(AcpiHeader) + kS5Size + scope_total;
+    uint32_t dsdt_total = sizeof(AcpiHeader) + kS5Size + scope_total +
+                          static_cast<uint32_t>(extra_aml.size());
 
     uint8_t* p = buf;
 
@@ -196,6 +425,76 @@ static uint32_t BuildDsdt(uint8_t* buf,
         *p++ = 0x79; *p++ = 0x00;
     }
 
+    if (has_pci) {
+        auto put16 = [&](uint16_t v) {
+            *p++ = static_cast<uint8_t>(v);
+            *p++ = static_cast<uint8_t>(v >> 8);
+        };
+        auto put32 = [&](uint32_t v) {
+            put16(static_cast<uint16_t>(v));
+            put16(static_cast<uint16_t>(v >> 16));
+        };
+
+        // Device(PCI0)
+        uint32_t pkglen = 2 + 4 + kPciBody;
+        *p++ = 0x5B; *p++ = 0x82;
+        *p++ = static_cast<uint8_t>((pkglen & 0x0F) | 0x40);
+        *p++ = static_cast<uint8_t>(pkglen >> 4);
+        *p++ = 'P'; *p++ = 'C'; *p++ = 'I'; *p++ = '0';
+
+        // Name(_HID, EisaId("PNP0A03"))  — 10 bytes
+        *p++ = 0x08;
+        *p++ = '_'; *p++ = 'H'; *p++ = 'I'; *p++ = 'D';
+        *p++ = 0x0C; // DWordPrefix
+        put32(0x030AD041);
+
+        // Name(_UID, Zero)  — 6 bytes
+        *p++ = 0x08;
+        *p++ = '_'; *p++ = 'U'; *p++ = 'I'; *p++ = 'D';
+        *p++ = 0x00; // ZeroOp
+
+        // Name(_CRS, Buffer(52) { WordBusNumber + IO + DWordMemory + EndTag })
+        // — 61 bytes
+        *p++ = 0x08;
+        *p++ = '_'; *p++ = 'C'; *p++ = 'R'; *p++ = 'S';
+        *p++ = 0x11; // BufferOp
+        *p++ = 0x37; // PkgLen = 55 (1+2+52)
+        *p++ = 0x0A; *p++ = 0x34; // BytePrefix + BufferSize=52
+
+        // WordBusNumber(ResourceProducer, MinFixed, MaxFixed, 0, 0, 0, 0, 1)
+        // — 16 bytes
+        *p++ = 0x88; put16(13);
+        *p++ = 0x02; // bus number range
+        *p++ = 0x0C; // MinFixed, MaxFixed
+        *p++ = 0x00;
+        put16(0); put16(0); put16(0); put16(0); put16(1);
+
+        // IO(Decode16, 0xCF8, 0xCF8, 1, 8) — the config mechanism, 8 bytes
+        *p++ = 0x47; *p++ = 0x01;
+        put16(0xCF8); put16(0xCF8);
+        *p++ = 0x01; *p++ = 0x08;
+
+        // DWordMemory(ResourceProducer, PosDecode, MinFixed, MaxFixed,
+        //             NonCacheable, ReadWrite, ...) — 26 bytes
+        *p++ = 0x87; put16(23);
+        *p++ = 0x00; // memory range
+        *p++ = 0x0C; // MinFixed, MaxFixed
+        *p++ = 0x01; // ReadWrite, NonCacheable
+        put32(0);
+        put32(pci_root.mmio_base);
+        put32(pci_root.mmio_base + pci_root.mmio_size - 1);
+        put32(0);
+        put32(pci_root.mmio_size);
+
+        // End tag — 2 bytes
+        *p++ = 0x79; *p++ = 0x00;
+    }
+
+    if (!extra_aml.empty()) {
+        memcpy(p, extra_aml.data(), extra_aml.size());
+        p += extra_aml.size();
+    }
+
     hdr->checksum = AcpiChecksum(buf, dsdt_total);
     return dsdt_total;
 }
@@ -214,6 +513,8 @@ static constexpr uint16_t kPm1aEvtPort = 0x600;
 static constexpr uint16_t kPm1aCntPort = 0x604;
 static constexpr uint16_t kResetPort   = 0x608;
 static constexpr uint8_t  kResetValue  = 0x01;
+static constexpr uint16_t kGpe0Port    = 0x60C;
+static constexpr uint8_t  kGpe0Len     = 4;
 
 static void BuildFadt(uint8_t* buf, GPA dsdt_addr) {
     memset(buf, 0, kFadtSize);
@@ -240,10 +541,16 @@ static void BuildFadt(uint8_t* buf, GPA dsdt_addr) {
     uint32_t pm1a_cnt = kPm1aCntPort;
     memcpy(buf + 64, &pm1a_cnt, 4);
 
+    // GPE0_BLK (offset 80, 4 bytes) — GPE0 Status + Enable registers
+    uint32_t gpe0 = kGpe0Port;
+    memcpy(buf + 80, &gpe0, 4);
+
     // PM1_EVT_LEN (offset 88) = 4
     buf[88] = 4;
     // PM1_CNT_LEN (offset 89) = 2
     buf[89] = 2;
+    // GPE0_BLK_LEN (offset 92) = 4: 16 GPEs
+    buf[92] = kGpe0Len;
 
     // Flags (offset 112, uint32_t):
     //   Bit 4 (PWR_BUTTON): 1 = no fixed-hardware power button
@@ -288,22 +595,100 @@ static void BuildFadt(uint8_t* buf, GPA dsdt_addr) {
     uint64_t cnt_addr = kPm1aCntPort;
     memcpy(buf + 176, &cnt_addr, 8);
 
+    // X_GPE0_BLK — Generic Address Structure (offset 220, 12 bytes)
+    buf[220] = 1;   // AddressSpaceId = System I/O
+    buf[221] = kGpe0Len * 8;  // RegisterBitWidth
+    buf[222] = 0;   // RegisterBitOffset
+    buf[223] = 1;   // AccessSize = Byte
+    uint64_t gpe0_addr = kGpe0Port;
+    memcpy(buf + 224, &gpe0_addr, 8);
+
     hdr->checksum = AcpiChecksum(buf, kFadtSize);
 }
 
+// ---------------------------------------------------------------------------
+// SRAT, SLIT — NUMA topology
+// ---------------------------------------------------------------------------
+// A proximity domain per guest node. Hotpluggable CPUs are listed too, so
+// they come up on their node.
+
+static void BuildSrat(uint8_t* buf, uint32_t max_cpus, const NumaAcpiInfo& numa) {
+    uint32_t size = sizeof(AcpiHeader) + 12 +
+                    max_cpus * sizeof(SratProcessorAffinity) +
+                    static_cast<uint32_t>(numa.memory.size()) * sizeof(SratMemoryAffinity);
+    memset(buf, 0, size);
+
+    AcpiHeader* hdr = reinterpret_cast<AcpiHeader*>(buf);
+    FillHeader(hdr, "SRAT", size, 3);
+    // Reserved, must be 1 for backward compatibility.
+    *reinterpret_cast<uint32_t*>(buf + sizeof(AcpiHeader)) = 1;
+
+    uint8_t* p = buf + sizeof(AcpiHeader) + 12;
+    for (uint32_t i = 0; i < max_cpus; i++) {
+        auto* cpu = reinterpret_cast<SratProcessorAffinity*>(p);
+        uint32_t node = i < numa.cpu_nodes.size() ? numa.cpu_nodes[i] : 0;
+        cpu->type = 0;
+        cpu->length = sizeof(SratProcessorAffinity);
+        cpu->proximity_lo = static_cast<uint8_t>(node);
+        cpu->apic_id = static_cast<uint8_t>(i);
+        cpu->flags = 1;
+        p += sizeof(SratProcessorAffinity);
+    }
+    for (const auto& range : numa.memory) {
+        auto* mem = reinterpret_cast<SratMemoryAffinity*>(p);
+        mem->type = 1;
+        mem->length = sizeof(SratMemoryAffinity);
+        mem->proximity = range.node;
+        mem->base = range.base;
+        mem->size = range.size;
+        mem->flags = 1;
+        p += sizeof(SratMemoryAffinity);
+    }
+
+    hdr->checksum = AcpiChecksum(buf, size);
+}
+
+// Windows does not tell the distances between its nodes, so the SLIT has
+// the conventional 10 within a node and 20 across.
+static void BuildSlit(uint8_t* buf, uint32_t nodes) {
+    uint32_t size = sizeof(AcpiHeader) + 8 + nodes * nodes;
+    memset(buf, 0, size);
+
+    AcpiHeader* hdr = reinterpret_cast<AcpiHeader*>(buf);
+    FillHeader(hdr, "SLIT", size, 1);
+    *reinterpret_cast<uint64_t*>(buf + sizeof(AcpiHeader)) = nodes;
+
+    uint8_t* matrix = buf + sizeof(AcpiHeader) + 8;
+    for (uint32_t from = 0; from < nodes; from++) {
+        for (uint32_t to = 0; to < nodes; to++) {
+            matrix[from * nodes + to] = from == to ? 10 : 20;
+        }
+    }
+
+    hdr->checksum = AcpiChecksum(buf, size);
+}
+
 // ---------------------------------------------------------------------------
 // Public entry point
 // ---------------------------------------------------------------------------
 
-GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus,
-                    const std::vector<VirtioMmioAcpiInfo>& virtio_devs) {
+GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus, uint32_t max_cpus,
+                    const std::vector<VirtioMmioAcpiInfo>& virtio_devs,
+                    const PciRootAcpiInfo& pci_root,
+                    const NumaAcpiInfo& numa) {
+    const bool hotplug = max_cpus > num_cpus;
+    if (!hotplug) max_cpus = num_cpus;
 
     // --- MADT ---
     uint8_t* madt_base = ram + AcpiLayout::kMadt;
-    memset(madt_base, 0, 256);
+    uint32_t madt_size = sizeof(AcpiHeader) + 8 + max_cpus * sizeof(MadtLocalApic) +
+                         sizeof(MadtIoApic) + sizeof(MadtIntOverride);
+    memset(madt_base, 0, madt_size);
 
+    // Revision 5 has the Online Capable flag, without which Linux takes a
+    // disabled processor for one that can never be brought up.
     AcpiHeader* madt = reinterpret_cast<AcpiHeader*>(madt_base);
-    FillHeader(madt, "APIC", 0, 3);
+    FillHeader(madt, "APIC", 0, hotplug ? 5 : 3);
 
     uint8_t* p = madt_base + sizeof(AcpiHeader);
 
@@ -313,20 +698,20 @@ GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus,
     *reinterpret_cast<uint32_t*>(p) = 0x00000001;  // Flags: PCAT_COMPAT
     p += 4;
 
-    for (uint32_t i = 0; i < num_cpus; i++) {
+    for (uint32_t i = 0; i < max_cpus; i++) {
         auto* entry = reinterpret_cast<MadtLocalApic*>(p);
         entry->type = 0;
         entry->length = sizeof(MadtLocalApic);
         entry->processor_id = static_cast<uint8_t>(i);
         entry->apic_id = static_cast<uint8_t>(i);
-        entry->flags = 1;
+        entry->flags = i < num_cpus ? 1 : 2;  // enabled : online capable
         p += sizeof(MadtLocalApic);
     }
 
     auto* ioapic = reinterpret_cast<MadtIoApic*>(p);
     ioapic->type = 1;
     ioapic->length = sizeof(MadtIoApic);
-    ioapic->io_apic_id = static_cast<uint8_t>(num_cpus);
+    ioapic->io_apic_id = static_cast<uint8_t>(max_cpus);
     ioapic->reserved = 0;
     ioapic->io_apic_address = 0xFEC00000;
     ioapic->gsi_base = 0;
@@ -346,12 +731,21 @@ GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus,
     madt->checksum = AcpiChecksum(madt_base, madt->length);
 
     // --- DSDT ---
-    uint32_t dsdt_size = BuildDsdt(ram + AcpiLayout::kDsdt, virtio_devs);
+    uint32_t dsdt_size = BuildDsdt(ram + AcpiLayout::kDsdt, virtio_devs, pci_root,
+                                   hotplug ? BuildCpuHotplugAml(num_cpus, max_cpus)
+                                           : std::vector<uint8_t>{});
 
     // --- FADT ---
     BuildFadt(ram + AcpiLayout::kFadt, AcpiLayout::kDsdt);
 
-    // --- XSDT (now carries FADT + MADT) ---
+    // --- SRAT + SLIT ---
+    const bool has_numa = numa.node_count > 1;
+    if (has_numa) {
+        BuildSrat(ram + AcpiLayout::kSrat, max_cpus, numa);
+        BuildSlit(ram + AcpiLayout::kSlit, numa.node_count);
+    }
+
+    // --- XSDT (now carries FADT + MADT, and SRAT + SLIT) ---
     uint8_t* xsdt_base = ram + AcpiLayout::kXsdt;
     memset(xsdt_base, 0, 128);
 
@@ -363,8 +757,13 @@ GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus,
         xsdt_base + sizeof(AcpiHeader));
     entries[0] = AcpiLayout::kFadt;
     entries[1] = AcpiLayout::kMadt;
+    uint32_t entry_count = 2;
+    if (has_numa) {
+        entries[entry_count++] = AcpiLayout::kSrat;
+        entries[entry_count++] = AcpiLayout::kSlit;
+    }
 
-    xsdt->length = sizeof(AcpiHeader) + 2 * sizeof(uint64_t);
+    xsdt->length = sizeof(AcpiHeader) + entry_count * sizeof(uint64_t);
     xsdt->checksum = AcpiChecksum(xsdt_base, xsdt->length);
 
     // --- RSDP ---
@@ -383,11 +782,16 @@ GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus,
     rsdp->extended_checksum = AcpiChecksum(rsdp_base, sizeof(AcpiRsdp));
 
     LOG_INFO("ACPI tables: RSDP@0x%llX XSDT@0x%llX MADT@0x%llX "
-             "FADT@0x%llX DSDT@0x%llX (%u virtio-mmio dev%s)",
+             "FADT@0x%llX DSDT@0x%llX (%u virtio-mmio dev%s%s)",
              AcpiLayout::kRsdp, AcpiLayout::kXsdt, AcpiLayout::kMadt,
              AcpiLayout::kFadt, AcpiLayout::kDsdt,
              (uint32_t)virtio_devs.size(),
-             virtio_devs.size() == 1 ? "" : "s");
+             virtio_devs.size() == 1 ? "" : "s",
+             pci_root.mmio_size ? ", PCI root" : "");
+    if (has_numa) {
+        LOG_INFO("ACPI tables: SRAT@0x%llX SLIT@0x%llX (%u NUMA nodes)",
+                 AcpiLayout::kSrat, AcpiLayout::kSlit, numa.node_count);
+    }
 
     return AcpiLayout::kRsdp;
 }
@@ -11,19 +11,60 @@ struct VirtioMmioAcpiInfo {
     uint32_t irq;
 };
 
+// PCI root bus 0 and the 32-bit memory window its BARs are assigned from.
+struct PciRootAcpiInfo {
+    uint32_t mmio_base = 0;
+    uint32_t mmio_size = 0;  // 0 = no PCI root bridge
+};
+
+// Guest NUMA topology, described by an SRAT and a SLIT. No nodes means
+// no such tables and one node to the guest.
+struct NumaAcpiInfo {
+    struct MemoryRange {
+        GPA base;
+        uint64_t size;
+        uint32_t node;
+    };
+    uint32_t node_count = 0;
+    std::vector<uint32_t> cpu_nodes;  // node of each CPU, hotpluggable ones too
+    std::vector<MemoryRange> memory;
+};
+
 namespace AcpiLayout {
     constexpr GPA kRsdp = 0x4000;
     constexpr GPA kXsdt = 0x4100;
-    constexpr GPA kMadt = 0x4200;
     constexpr GPA kFadt = 0x4300;
-    // FADT rev5 is 268 bytes → ends at 0x440C, so DSDT at 0x4500 is safe.
-    constexpr GPA kDsdt = 0x4500;
+    // FADT rev5 is 268 bytes → ends at 0x440C. The MADT takes 8 bytes per
+    // CPU, ending by 0x4942 with 128.
+    constexpr GPA kMadt = 0x4500;
+    // The SRAT takes 16 bytes per CPU and 40 per memory range, the SLIT one
+    // byte per pair of nodes; both end well before the zero page at 0x7000.
+    constexpr GPA kSrat = 0x5000;
+    constexpr GPA kSlit = 0x6000;
+    // Past the zero page; room for the processor objects of 128 CPUs below
+    // the command line at 0x10000.
+    constexpr GPA kDsdt = 0x8000;
 }
 
-// Build ACPI tables (RSDP, XSDT, MADT, FADT, DSDT) in guest RAM.
-// The DSDT includes device nodes for each virtio-mmio device in |virtio_devs|.
+// Guest NUMA nodes the SRAT and SLIT above have room for.
+constexpr uint32_t kMaxNumaNodes = 8;
+
+// ACPI CPU hotplug registers (must match CpuHotplug device in the VMM),
+// and the GPE0 bit that announces a change.
+constexpr uint16_t kCpuHotplugPort = 0x0CD8;
+constexpr uint8_t  kCpuHotplugGpe  = 2;
+
+// Build ACPI tables (RSDP, XSDT, MADT, FADT, DSDT, and SRAT and SLIT when
+// |numa| has nodes) in guest RAM.
+// The DSDT includes device nodes for each virtio-mmio device in |virtio_devs|,
+// and a PNP0A03 root bridge when |pci_root| has a window.
+// CPUs from |num_cpus| up to |max_cpus| are hotpluggable: the MADT lists
+// them disabled and the DSDT has processor objects for every CPU, present
+// as the CPU hotplug registers say.
 // Returns the GPA of the RSDP for boot_params.acpi_rsdp_addr.
-GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus,
-                    const std::vector<VirtioMmioAcpiInfo>& virtio_devs = {});
+GPA BuildAcpiTables(uint8_t* ram, uint32_t num_cpus, uint32_t max_cpus,
+                    const std::vector<VirtioMmioAcpiInfo>& virtio_devs = {},
+                    const PciRootAcpiInfo& pci_root = {},
+                    const NumaAcpiInfo& numa = {});
 
 } // namespace x86
@@ -1,27 +1,87 @@
 #include "core/arch/x86_64/boot.h"
 #include "core/arch/x86_64/acpi.h"
-#include <fstream>
+#include "core/vmm/guest_ram.h"
 #include <cstring>
 #include <algorithm>
 
 namespace x86 {
 
-static std::vector<uint8_t> ReadFile(const std::string& path) {
-    std::ifstream f(path, std::ios::binary | std::ios::ate);
-    if (!f) return {};
-    auto size = f.tellg();
-    f.seekg(0);
-    std::vector<uint8_t> buf(static_cast<size_t>(size));
-    f.read(reinterpret_cast<char*>(buf.data()), size);
-    return buf;
+// Largest single ReadFile; big enough that the disk streams.
+static constexpr uint64_t kReadChunk = 8ULL << 20;
+
+class BootFile {
+public:
+    explicit BootFile(const std::string& path) {
+        handle_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER size{};
+        if (handle_ != INVALID_HANDLE_VALUE && GetFileSizeEx(handle_, &size)) {
+            size_ = static_cast<uint64_t>(size.QuadPart);
+        }
+    }
+    ~BootFile() {
+        if (handle_ != INVALID_HANDLE_VALUE) CloseHandle(handle_);
+    }
+    BootFile(const BootFile&) = delete;
+    BootFile& operator=(const BootFile&) = delete;
+
+    bool ok() const { return handle_ != INVALID_HANDLE_VALUE; }
+    uint64_t size() const { return size_; }
+
+    // Reads [offset, offset+len) into `dst`, which may be guest RAM.
+    bool Read(uint64_t offset, uint8_t* dst, uint64_t len, const GuestMemMap& mem) {
+        // The kernel reports a fault on uncommitted on-demand RAM as an
+        // error instead of raising it, so commit the target up front.
+        if (mem.lazy && !mem.lazy->Commit(dst, len)) return false;
+        while (len) {
+            DWORD chunk = static_cast<DWORD>(std::min(len, kReadChunk));
+            OVERLAPPED ov{};
+            ov.Offset = static_cast<DWORD>(offset);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD read = 0;
+            if (!::ReadFile(handle_, dst, chunk, &read, &ov) || read != chunk) return false;
+            dst += chunk;
+            offset += chunk;
+            len -= chunk;
+        }
+        return true;
+    }
+
+private:
+    HANDLE handle_ = INVALID_HANDLE_VALUE;
+    uint64_t size_ = 0;
+};
+
+bool LoadInitrd(const std::string& path, const GuestMemMap& mem, InitrdImage* out) {
+    BootFile file(path);
+    if (!file.ok() || !file.size()) {
+        LOG_ERROR("Failed to read initrd: %s", path.c_str());
+        return false;
+    }
+    if (file.size() + Layout::kKernelBase >= mem.low_size) {
+        LOG_ERROR("Not enough RAM for initrd (%llu bytes)", file.size());
+        return false;
+    }
+    GPA addr = AlignDown(mem.low_size - file.size(), kPageSize);
+    if (!file.Read(0, mem.base + addr, file.size(), mem)) {
+        LOG_ERROR("Failed to read initrd: %s (%lu)", path.c_str(), GetLastError());
+        return false;
+    }
+    out->addr = addr;
+    out->size = file.size();
+    return true;
 }
 
 uint64_t LoadLinuxKernel(const BootConfig& config) {
     const auto& mem = config.mem;
     uint8_t* ram = mem.base;
 
-    auto kernel = ReadFile(config.kernel_path);
-    if (kernel.size() < 1024) {
+    // Only the real-mode setup goes through a host buffer; the rest is read
+    // straight to its place in guest RAM.
+    BootFile file(config.kernel_path);
+    std::vector<uint8_t> kernel(static_cast<size_t>(std::min<uint64_t>(file.size(), 1024)));
+    if (kernel.size() < 1024 ||
+        !file.Read(0, kernel.data(), kernel.size(), GuestMemMap{})) {
         LOG_ERROR("Kernel file too small or not found: %s",
                   config.kernel_path.c_str());
         return 0;
@@ -47,15 +107,24 @@ uint64_t LoadLinuxKernel(const BootConfig& config) {
     if (setup_sects == 0) setup_sects = 4;
 
     uint32_t setup_size = (1 + setup_sects) * 512;
-    uint32_t kernel_size = static_cast<uint32_t>(kernel.size()) - setup_size;
+    if (file.size() <= setup_size) {
+        LOG_ERROR("Invalid bzImage: truncated setup");
+        return 0;
+    }
+    uint32_t kernel_size = static_cast<uint32_t>(file.size() - setup_size);
 
     if (Layout::kKernelBase + kernel_size > mem.low_size) {
         LOG_ERROR("Kernel too large for guest RAM");
         return 0;
     }
 
-    // Copy protected-mode kernel to 1MB
-    memcpy(ram + Layout::kKernelBase, kernel.data() + setup_size, kernel_size);
+    kernel.resize(setup_size);
+    if (!file.Read(1024, kernel.data() + 1024, setup_size - 1024, GuestMemMap{}) ||
+        !file.Read(setup_size, ram + Layout::kKernelBase, kernel_size, mem)) {
+        LOG_ERROR("Failed to read kernel: %s (%lu)", config.kernel_path.c_str(),
+                  GetLastError());
+        return 0;
+    }
     LOG_INFO("Kernel loaded at GPA 0x%llX (%u bytes)",
              Layout::kKernelBase, kernel_size);
 
@@ -89,29 +158,21 @@ uint64_t LoadLinuxKernel(const BootConfig& config) {
     // Load initrd — always place in low RAM so the 32-bit ramdisk_image
     // field in boot_params can represent the address.
     if (!config.initrd_path.empty()) {
-        auto initrd = ReadFile(config.initrd_path);
-        if (initrd.empty()) {
-            LOG_ERROR("Failed to read initrd: %s", config.initrd_path.c_str());
-            return 0;
-        }
+        InitrdImage initrd = config.initrd;
+        if (!initrd.size && !LoadInitrd(config.initrd_path, mem, &initrd)) return 0;
 
-        uint64_t initrd_addr = AlignDown(
-            mem.low_size - initrd.size(), kPageSize);
-
-        if (initrd_addr <= Layout::kKernelBase + kernel_size) {
-            LOG_ERROR("Not enough RAM for initrd (%zu bytes)", initrd.size());
+        if (initrd.addr <= Layout::kKernelBase + kernel_size) {
+            LOG_ERROR("Not enough RAM for initrd (%llu bytes)", initrd.size);
             return 0;
         }
 
-        memcpy(ram + initrd_addr, initrd.data(), initrd.size());
-
         *reinterpret_cast<uint32_t*>(bp + BootOffset::kRamdiskImage) =
-            static_cast<uint32_t>(initrd_addr);
+            static_cast<uint32_t>(initrd.addr);
         *reinterpret_cast<uint32_t*>(bp + BootOffset::kRamdiskSize) =
-            static_cast<uint32_t>(initrd.size());
+            static_cast<uint32_t>(initrd.size);
 
-        LOG_INFO("Initrd loaded at GPA 0x%llX (%zu bytes)",
-                 initrd_addr, initrd.size());
+        LOG_INFO("Initrd loaded at GPA 0x%llX (%llu bytes)",
+                 initrd.addr, initrd.size);
     }
 
     // --- E820 memory map ---
@@ -136,8 +197,9 @@ uint64_t LoadLinuxKernel(const BootConfig& config) {
     }
     bp[BootOffset::kE820Entries] = e820_count;
 
-    // Build ACPI tables (RSDP, XSDT, MADT, FADT, DSDT) and store RSDP GPA
-    GPA rsdp_addr = BuildAcpiTables(ram, config.cpu_count, config.virtio_devs);
+    // Build ACPI tables (RSDP, XSDT, MADT, FADT, DSDT, SRAT, SLIT) and store RSDP GPA
+    GPA rsdp_addr = BuildAcpiTables(ram, config.cpu_count, config.max_cpu_count,
+                                    config.virtio_devs, config.pci_root, config.numa);
     *reinterpret_cast<uint64_t*>(bp + BootOffset::kAcpiRsdpAddr) = rsdp_addr;
 
     return kernel_size;
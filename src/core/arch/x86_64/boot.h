@@ -57,13 +57,23 @@ struct E820Entry {
 
 static_assert(sizeof(E820Entry) == 20);
 
+// An initrd already read into guest RAM.
+struct InitrdImage {
+    GPA addr = 0;
+    uint64_t size = 0;
+};
+
 struct BootConfig {
     std::string kernel_path;
     std::string initrd_path;
+    InitrdImage initrd;  // preloaded by LoadInitrd if size != 0
     std::string cmdline;
     GuestMemMap mem;
     uint32_t cpu_count = 1;
+    uint32_t max_cpu_count = 0;  // CPUs hotpluggable up to this; 0 = none
     std::vector<VirtioMmioAcpiInfo> virtio_devs;
+    PciRootAcpiInfo pci_root;
+    NumaAcpiInfo numa;
 };
 
 // Load kernel, initrd, set up boot_params in guest RAM.
@@ -71,6 +81,11 @@ struct BootConfig {
 // After success, caller should call SetupBootRegisters on the vCPU.
 uint64_t LoadLinuxKernel(const BootConfig& config);
 
+// Reads the initrd straight into the top of low guest RAM, where
+// LoadLinuxKernel would put it. Touches nothing else, so it can run while
+// devices are set up.
+bool LoadInitrd(const std::string& path, const GuestMemMap& mem, InitrdImage* out);
+
 // GDT layout written at kGdtBase
 struct GdtEntry {
     uint64_t null;      // selector 0x00
@@ -8,11 +8,17 @@ void AcpiPm::TriggerPowerButton() {
 }
 
 void AcpiPm::RaiseSci() {
-    if ((pm1_sts_ & pm1_en_) && sci_cb_) {
+    if (((pm1_sts_ & pm1_en_) || (gpe0_sts_ & gpe0_en_)) && sci_cb_) {
         sci_cb_();
     }
 }
 
+void AcpiPm::RaiseGpe(uint32_t gpe) {
+    std::lock_guard<std::mutex> lock(*IoLock());
+    gpe0_sts_ |= static_cast<uint16_t>(1u << gpe);
+    RaiseSci();
+}
+
 void AcpiPm::PioRead(uint16_t offset, uint8_t size, uint32_t* value) {
     switch (offset) {
     case 0:
@@ -32,6 +38,22 @@ void AcpiPm::PioRead(uint16_t offset, uint8_t size, uint32_t* value) {
         // RESET_REG read returns 0
         *value = 0;
         break;
+    case 12:
+        if (size == 4) {
+            *value = gpe0_sts_ | (static_cast<uint32_t>(gpe0_en_) << 16);
+        } else {
+            *value = size == 1 ? gpe0_sts_ & 0xFF : gpe0_sts_;
+        }
+        break;
+    case 13:
+        *value = gpe0_sts_ >> 8;
+        break;
+    case 14:
+        *value = size == 1 ? gpe0_en_ & 0xFF : gpe0_en_;
+        break;
+    case 15:
+        *value = gpe0_en_ >> 8;
+        break;
     default:
         *value = 0;
         break;
@@ -68,7 +90,41 @@ void AcpiPm::PioWrite(uint16_t offset, uint8_t size, uint32_t value) {
             reset_cb_();
         }
         break;
+    // ACPICA walks GPE blocks a byte at a time; wider accesses work too.
+    case 12:
+        gpe0_sts_ &= ~static_cast<uint16_t>(size == 1 ? value & 0xFF : value);
+        if (size == 4) gpe0_en_ = static_cast<uint16_t>(value >> 16);
+        break;
+    case 13:
+        gpe0_sts_ &= ~static_cast<uint16_t>((value & 0xFF) << 8);
+        break;
+    case 14:
+        gpe0_en_ = size == 1 ? static_cast<uint16_t>((gpe0_en_ & 0xFF00) | (value & 0xFF))
+                             : static_cast<uint16_t>(value);
+        RaiseSci();
+        break;
+    case 15:
+        gpe0_en_ = static_cast<uint16_t>((gpe0_en_ & 0x00FF) | ((value & 0xFF) << 8));
+        RaiseSci();
+        break;
     default:
         break;
     }
 }
+
+void AcpiPm::SaveState(StateWriter& out) {
+    out.Put(pm1_sts_);
+    out.Put(pm1_en_);
+    out.Put(pm1_cnt_);
+    out.Put(gpe0_sts_);
+    out.Put(gpe0_en_);
+}
+
+bool AcpiPm::LoadState(StateReader& in) {
+    in.Get(&pm1_sts_);
+    in.Get(&pm1_en_);
+    if (!in.Get(&pm1_cnt_)) return false;
+    // Snapshots from before the GPE0 block end here.
+    if (in.Get(&gpe0_sts_)) in.Get(&gpe0_en_);
+    return true;
+}
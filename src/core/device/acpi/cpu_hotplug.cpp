@@ -0,0 +1,89 @@
+#include "core/device/acpi/cpu_hotplug.h"
+
+void CpuHotplug::Init(uint32_t max_cpus, uint32_t present) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flags_.assign(max_cpus, 0);
+    for (uint32_t i = 0; i < present && i < max_cpus; i++) flags_[i] = kPresent;
+}
+
+bool CpuHotplug::Present(uint32_t cpu) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cpu < flags_.size() && (flags_[cpu] & kPresent);
+}
+
+void CpuHotplug::Insert(uint32_t cpu) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cpu >= flags_.size()) return;
+    flags_[cpu] = kPresent | kInsert;
+    changed_ = std::chrono::steady_clock::now();
+}
+
+void CpuHotplug::RequestRemove(uint32_t cpu) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cpu >= flags_.size() || !(flags_[cpu] & kPresent)) return;
+    flags_[cpu] |= kRemove | kRemoving;
+    changed_ = std::chrono::steady_clock::now();
+}
+
+bool CpuHotplug::Busy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::chrono::steady_clock::now() - changed_ >=
+        std::chrono::milliseconds(kGuestTimeoutMs)) {
+        return false;
+    }
+    for (uint8_t f : flags_) {
+        if (f & (kInsert | kRemove | kRemoving)) return true;
+    }
+    return false;
+}
+
+void CpuHotplug::Withdraw() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint32_t i = 0; i < flags_.size(); i++) {
+        if (!(flags_[i] & (kInsert | kRemove | kRemoving))) continue;
+        if (flags_[i] & kRemoving) {
+            LOG_WARN("ACPI: the guest did not eject CPU %u, keeping it", i);
+        }
+        flags_[i] &= kPresent;
+    }
+}
+
+void CpuHotplug::PioRead(uint16_t offset, uint8_t size, uint32_t* value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    switch (offset) {
+    case 0:
+        *value = selected_;
+        break;
+    case 4:
+        *value = selected_ < flags_.size() ? flags_[selected_] & (kPresent | kInsert | kRemove)
+                                           : 0;
+        break;
+    default:
+        *value = 0;
+        break;
+    }
+}
+
+void CpuHotplug::PioWrite(uint16_t offset, uint8_t size, uint32_t value) {
+    uint32_t ejected = UINT32_MAX;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (offset == 0) {
+            selected_ = value;
+            return;
+        }
+        if (offset != 4 || selected_ >= flags_.size()) return;
+        uint8_t& f = flags_[selected_];
+        f &= ~(value & (kInsert | kRemove));
+        // The boot processor stays. Others may go without being asked, as
+        // when the guest ejects one itself.
+        if ((value & kEject) && selected_ != 0 && (f & kPresent)) {
+            f = 0;
+            ejected = selected_;
+        }
+    }
+    if (ejected != UINT32_MAX) {
+        LOG_INFO("ACPI: CPU %u ejected", ejected);
+        if (eject_cb_) eject_cb_(ejected);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "core/device/device.h"
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// ACPI CPU hotplug registers, driven by the DSDT processor objects (see
+// x86::BuildAcpiTables). The OS writes a CPU index to CSEL, then reads that
+// CPU's flags or writes 1s to acknowledge its events or eject it:
+//
+//   0x00  CSEL   dword  selected CPU
+//   0x04  flags  byte   bit 0 present, bit 1 insert event, bit 2 remove
+//                       request, bit 3 eject (write only)
+//
+// Each change raises one GPE, after which the OS scans every CPU. The host
+// adds CPUs on its own; it can only ask for one to go, and the CPU is gone
+// once the guest has taken it offline and ejected it. A guest that leaves a
+// change alone for kGuestTimeoutMs, as one without ACPI CPU hotplug does,
+// no longer holds up the next one.
+class CpuHotplug : public Device {
+public:
+    static constexpr uint16_t kBasePort = 0x0CD8;  // x86::kCpuHotplugPort
+    static constexpr uint16_t kRegCount = 12;
+    static constexpr uint32_t kGuestTimeoutMs = 10000;
+
+    using EjectCallback = std::function<void(uint32_t cpu)>;
+
+    // `max_cpus` slots, the first `present` of them occupied.
+    void Init(uint32_t max_cpus, uint32_t present);
+    // Runs on the vCPU that ejected `cpu`, without the device lock.
+    void SetEjectCallback(EjectCallback cb) { eject_cb_ = std::move(cb); }
+
+    uint32_t MaxCpus() const { return static_cast<uint32_t>(flags_.size()); }
+    bool Present(uint32_t cpu) const;
+    // Marks `cpu` present, with an insert event for the guest.
+    void Insert(uint32_t cpu);
+    // Asks the guest to give `cpu` up.
+    void RequestRemove(uint32_t cpu);
+    // An event the guest has not acknowledged, or a removal it has not
+    // finished, for less than kGuestTimeoutMs.
+    bool Busy() const;
+    // Drops what the guest left past the timeout. A CPU it was asked to
+    // give up stays present.
+    void Withdraw();
+
+    void PioRead(uint16_t offset, uint8_t size, uint32_t* value) override;
+    void PioWrite(uint16_t offset, uint8_t size, uint32_t value) override;
+    std::mutex* IoLock() override { return nullptr; }
+
+private:
+    enum : uint8_t {
+        kPresent = 1 << 0,
+        kInsert = 1 << 1,
+        kRemove = 1 << 2,
+        kEject = 1 << 3,
+        kRemoving = 1 << 4,  // host side: asked to go, not ejected yet
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<uint8_t> flags_;
+    uint32_t selected_ = 0;
+    std::chrono::steady_clock::time_point changed_;  // last Insert or RequestRemove
+    EjectCallback eject_cb_;
+};
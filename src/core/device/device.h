@@ -1,6 +1,8 @@
 #pragma once
 
 #include "core/vmm/types.h"
+#include "core/vmm/snapshot.h"
+#include <mutex>
 
 class Device {
 public:
@@ -19,4 +21,28 @@ public:
 
     virtual void MmioWrite(uint64_t offset, uint8_t size, uint64_t value) {
     }
+
+    // Lock AddressSpace holds around this device's exit handlers. Exits to
+    // different devices run in parallel; devices that synchronize their own
+    // state return nullptr, devices sharing state return the same lock.
+    virtual std::mutex* IoLock() { return &io_mutex_; }
+
+    // Snapshot state. SaveState runs with every vCPU stopped; LoadState
+    // runs before any vCPU starts. Devices with nothing beyond their reset
+    // state keep the defaults.
+    virtual void SaveState(StateWriter& out) {}
+    virtual bool LoadState(StateReader& in) { return true; }
+
+private:
+    std::mutex io_mutex_;
+};
+
+// Doorbell registered with AddressSpace::AddIoEvent(). The vCPU exit handler
+// hands it the written value directly, without the instruction emulator or
+// the device lock, and resumes the guest at once; the sink only latches the
+// value and wakes whatever thread does the work (the KVM ioeventfd model).
+class IoEventSink {
+public:
+    virtual ~IoEventSink() = default;
+    virtual void SignalIoEvent(uint64_t value) = 0;
 };
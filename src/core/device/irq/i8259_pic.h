@@ -11,4 +11,6 @@ public:
     static constexpr uint16_t kMasterBase = 0x20;
     static constexpr uint16_t kSlaveBase  = 0xA0;
     static constexpr uint16_t kRegCount   = 2;
+
+    std::mutex* IoLock() override { return nullptr; }  // stateless
 };
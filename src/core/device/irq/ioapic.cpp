@@ -86,3 +86,17 @@ void IoApic::WriteRegister(uint32_t value) {
         break;
     }
 }
+
+void IoApic::SaveState(StateWriter& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.Put(index_);
+    out.Put(id_);
+    out.Put(redir_table_);
+}
+
+bool IoApic::LoadState(StateReader& in) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in.Get(&index_);
+    in.Get(&id_);
+    return in.Get(&redir_table_);
+}
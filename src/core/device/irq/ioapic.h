@@ -18,6 +18,9 @@ public:
 
     void MmioRead(uint64_t offset, uint8_t size, uint64_t* value) override;
     void MmioWrite(uint64_t offset, uint8_t size, uint64_t value) override;
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+    std::mutex* IoLock() override { return nullptr; }  // guarded by mutex_
 
     // Returns the 64-bit redirection table entry for a given IRQ pin.
     bool GetRedirEntry(uint8_t irq, uint64_t* entry) const;
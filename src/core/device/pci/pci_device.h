@@ -0,0 +1,81 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include "core/vmm/snapshot.h"
+#include <cstring>
+
+// A function on the root bus as the host bridge sees it. Accesses are
+// naturally aligned 1, 2 or 4 bytes within the 256-byte config space.
+class PciFunction {
+public:
+    virtual ~PciFunction() = default;
+    virtual uint32_t ConfigRead(uint32_t offset, uint8_t size) = 0;
+    virtual void ConfigWrite(uint32_t offset, uint8_t size, uint32_t value) = 0;
+};
+
+// Type 0 config header and capability area, with a mask of the bits the
+// guest may change. BARs are sized through the mask: writing all-ones
+// reads back ~(size - 1) and the type bits.
+class PciConfigSpace {
+public:
+    static constexpr uint32_t kSize = 256;
+
+    // Standard header offsets (PCI Local Bus spec 3.0, 6.1)
+    static constexpr uint32_t kVendorId     = 0x00;
+    static constexpr uint32_t kDeviceId     = 0x02;
+    static constexpr uint32_t kCommand      = 0x04;
+    static constexpr uint32_t kStatus       = 0x06;
+    static constexpr uint32_t kRevision     = 0x08;
+    static constexpr uint32_t kClassCode    = 0x09;
+    static constexpr uint32_t kHeaderType   = 0x0E;
+    static constexpr uint32_t kBar0         = 0x10;
+    static constexpr uint32_t kSubVendorId  = 0x2C;
+    static constexpr uint32_t kSubsystemId  = 0x2E;
+    static constexpr uint32_t kCapPointer   = 0x34;
+    static constexpr uint32_t kInterruptLine = 0x3C;
+    static constexpr uint32_t kInterruptPin = 0x3D;
+
+    static constexpr uint16_t kCommandMemory = 1 << 1;
+    static constexpr uint16_t kCommandMaster = 1 << 2;
+    static constexpr uint16_t kCommandIntxDisable = 1 << 10;
+    static constexpr uint16_t kStatusCapList = 1 << 4;
+
+    uint32_t Read(uint32_t offset, uint8_t size) const {
+        if (offset + size > kSize) return 0xFFFFFFFF;
+        uint32_t value = 0;
+        std::memcpy(&value, data_ + offset, size);
+        return value;
+    }
+
+    void Write(uint32_t offset, uint8_t size, uint32_t value) {
+        if (offset + size > kSize) return;
+        for (uint8_t i = 0; i < size; i++) {
+            uint8_t mask = wmask_[offset + i];
+            uint8_t byte = static_cast<uint8_t>(value >> (i * 8));
+            data_[offset + i] = (data_[offset + i] & ~mask) | (byte & mask);
+        }
+    }
+
+    // Builders; these ignore the write mask.
+    void Set8(uint32_t offset, uint8_t value) { data_[offset] = value; }
+    void Set16(uint32_t offset, uint16_t value) { std::memcpy(data_ + offset, &value, 2); }
+    void Set32(uint32_t offset, uint32_t value) { std::memcpy(data_ + offset, &value, 4); }
+    void SetWritable(uint32_t offset, uint8_t size, uint32_t mask) {
+        std::memcpy(wmask_ + offset, &mask, size);
+    }
+
+    // A 32-bit memory BAR of `size` bytes (a power of two) at `base`.
+    void SetMemoryBar(uint32_t index, uint32_t base, uint32_t size) {
+        Set32(kBar0 + index * 4, base);
+        SetWritable(kBar0 + index * 4, 4, ~(size - 1));
+    }
+
+    uint16_t Command() const { return static_cast<uint16_t>(Read(kCommand, 2)); }
+
+    void SaveState(StateWriter& out) const { out.PutBytes(data_, kSize); }
+    bool LoadState(StateReader& in) { return in.GetBytes(data_, kSize); }
+
+private:
+    uint8_t data_[kSize] = {};
+    uint8_t wmask_[kSize] = {};
+};
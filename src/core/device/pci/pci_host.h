@@ -1,16 +1,41 @@
 #pragma once
 
 #include "core/device/device.h"
+#include "core/device/pci/pci_device.h"
 
-// Minimal PCI Type 1 configuration mechanism stub (ports 0xCF8-0xCFF).
-// Only accepts 32-bit access to CONFIG_ADDRESS (offset 0); all byte/word
-// accesses return 0xFF so that the kernel's mechanism-#2 detection fails
-// (mechanism #2 relies on byte access to 0xCF8/0xCFA returning 0x00).
-// CONFIG_DATA (offset 4-7) always reads 0xFFFFFFFF (no device present).
+// PCI Type 1 configuration mechanism (ports 0xCF8-0xCFF) for bus 0.
+// Only 32-bit access reaches CONFIG_ADDRESS (offset 0); byte and word
+// accesses there return 0xFF so that the kernel's mechanism-#2 detection
+// fails (mechanism #2 relies on byte access to 0xCF8/0xCFA returning 0x00).
+// CONFIG_DATA (offset 4-7) takes any access within the selected dword.
+//
+// With no function added the bus is empty and every read is all-ones, as
+// before PCI devices existed. The first AddFunction() also brings up a
+// host bridge at 00:00.0, which the kernel's type 1 sanity check looks for.
 class PciHostBridge : public Device {
 public:
     static constexpr uint16_t kBasePort = 0xCF8;
     static constexpr uint16_t kRegCount = 8;
+    static constexpr uint8_t  kMaxSlots = 32;
+
+    PciHostBridge() {
+        // Intel 440FX, the host bridge guests know without a driver.
+        host_.Set16(PciConfigSpace::kVendorId, 0x8086);
+        host_.Set16(PciConfigSpace::kDeviceId, 0x1237);
+        host_.Set8(PciConfigSpace::kRevision, 0x02);
+        host_.Set8(PciConfigSpace::kClassCode + 1, 0x00);  // host bridge
+        host_.Set8(PciConfigSpace::kClassCode + 2, 0x06);  // bridge
+    }
+
+    // Puts `fn` at 00:slot.0. Slot 0 is the host bridge.
+    bool AddFunction(uint8_t slot, PciFunction* fn) {
+        if (slot == 0 || slot >= kMaxSlots || slots_[slot]) return false;
+        slots_[slot] = fn;
+        slots_[0] = &host_;
+        return true;
+    }
+
+    bool HasFunctions() const { return slots_[0] != nullptr; }
 
     void PioRead(uint16_t offset, uint8_t size, uint32_t* value) override {
         if (offset == 0 && size == 4) {
@@ -18,13 +43,53 @@ public:
             return;
         }
         *value = 0xFFFFFFFF;
+        if (offset < 4) return;
+        PciFunction* fn = Selected();
+        uint32_t reg = (config_addr_ & 0xFC) + (offset - 4);
+        if (fn && reg % size == 0) *value = fn->ConfigRead(reg, size);
     }
 
     void PioWrite(uint16_t offset, uint8_t size, uint32_t value) override {
-        if (offset == 0 && size == 4)
+        if (offset == 0 && size == 4) {
             config_addr_ = value;
+            return;
+        }
+        if (offset < 4) return;
+        PciFunction* fn = Selected();
+        uint32_t reg = (config_addr_ & 0xFC) + (offset - 4);
+        if (fn && reg % size == 0) fn->ConfigWrite(reg, size, value);
     }
 
+    // Functions save their own config space with their device state.
+    void SaveState(StateWriter& out) override { out.Put(config_addr_); }
+    bool LoadState(StateReader& in) override { return in.Get(&config_addr_); }
+
 private:
+    // Read-only apart from what a driver never needs to change.
+    class HostFunction : public PciFunction {
+    public:
+        uint32_t ConfigRead(uint32_t offset, uint8_t size) override {
+            return config_.Read(offset, size);
+        }
+        void ConfigWrite(uint32_t, uint8_t, uint32_t) override {}
+        void Set8(uint32_t offset, uint8_t v) { config_.Set8(offset, v); }
+        void Set16(uint32_t offset, uint16_t v) { config_.Set16(offset, v); }
+
+    private:
+        PciConfigSpace config_;
+    };
+
+    // Function at the bus/device/function in CONFIG_ADDRESS, if enabled.
+    PciFunction* Selected() const {
+        if (!(config_addr_ & 0x80000000)) return nullptr;
+        uint32_t bus = (config_addr_ >> 16) & 0xFF;
+        uint32_t slot = (config_addr_ >> 11) & 0x1F;
+        uint32_t func = (config_addr_ >> 8) & 0x07;
+        if (bus != 0 || func != 0) return nullptr;
+        return slots_[slot];
+    }
+
     uint32_t config_addr_ = 0;
+    HostFunction host_;
+    PciFunction* slots_[kMaxSlots] = {};
 };
@@ -12,6 +12,9 @@ public:
 
     void PioRead(uint16_t offset, uint8_t size, uint32_t* value) override;
     void PioWrite(uint16_t offset, uint8_t size, uint32_t value) override;
+    // The clock itself is read from the host, so only the index is state.
+    void SaveState(StateWriter& out) override { out.Put(index_); }
+    bool LoadState(StateReader& in) override { return in.Get(&index_); }
 
 private:
     uint8_t ReadRegister(uint8_t reg) const;
@@ -0,0 +1,78 @@
+#include "core/device/serial/console_tx_buffer.h"
+
+#include <algorithm>
+
+ConsoleTxBuffer::~ConsoleTxBuffer() {
+    Stop();
+}
+
+void ConsoleTxBuffer::Start(Sink sink) {
+    if (thread_.joinable() || !sink) return;
+    sink_ = std::move(sink);
+    stop_ = false;
+    thread_ = std::thread(&ConsoleTxBuffer::FlushThread, this);
+}
+
+void ConsoleTxBuffer::Stop() {
+    if (!thread_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    data_cv_.notify_one();
+    space_cv_.notify_all();
+    thread_.join();
+}
+
+void ConsoleTxBuffer::Write(const uint8_t* data, size_t size) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (size > 0) {
+        space_cv_.wait(lock, [this] { return stop_ || count_ < kRingSize; });
+        if (stop_) return;
+
+        bool was_empty = count_ == 0;
+        size_t n = std::min(size, kRingSize - count_);
+        for (size_t i = 0; i < n; i++) {
+            ring_[(head_ + count_ + i) % kRingSize] = data[i];
+        }
+        count_ += n;
+        if (std::find(data, data + n, '\n') != data + n ||
+            count_ >= kRingSize / 2) {
+            flush_now_ = true;
+        }
+        data += n;
+        size -= n;
+
+        if (was_empty || flush_now_) data_cv_.notify_one();
+    }
+}
+
+void ConsoleTxBuffer::FlushThread() {
+    std::array<uint8_t, kRingSize> chunk;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        data_cv_.wait(lock, [this] { return stop_ || count_ > 0; });
+        if (!stop_ && !flush_now_) {
+            // Let a burst of output collect into one write.
+            data_cv_.wait_for(lock, kFlushDelay,
+                              [this] { return stop_ || flush_now_; });
+        }
+        if (count_ == 0) {
+            if (stop_) return;
+            continue;
+        }
+
+        size_t n = count_;
+        for (size_t i = 0; i < n; i++) {
+            chunk[i] = ring_[(head_ + i) % kRingSize];
+        }
+        head_ = (head_ + n) % kRingSize;
+        count_ = 0;
+        flush_now_ = false;
+        space_cv_.notify_all();
+
+        lock.unlock();
+        sink_(chunk.data(), n);
+        lock.lock();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Collects console output from the guest and hands it to a sink in chunks
+// on its own thread, so a vCPU writing THR pays for a ring append instead
+// of a console port write per byte.
+//
+// A flush happens once `kFlushDelay` has passed since the first pending
+// byte, or at once when a line ends or the ring is half full. When the ring
+// is full, writers wait for the flusher rather than drop output.
+class ConsoleTxBuffer {
+public:
+    using Sink = std::function<void(const uint8_t* data, size_t size)>;
+
+    static constexpr size_t kRingSize = 16 * 1024;
+    static constexpr auto kFlushDelay = std::chrono::milliseconds(2);
+
+    ConsoleTxBuffer() = default;
+    ~ConsoleTxBuffer();
+
+    ConsoleTxBuffer(const ConsoleTxBuffer&) = delete;
+    ConsoleTxBuffer& operator=(const ConsoleTxBuffer&) = delete;
+
+    void Start(Sink sink);
+    // Flushes what is pending, then joins the flusher.
+    void Stop();
+
+    void Write(const uint8_t* data, size_t size);
+    void Put(uint8_t byte) { Write(&byte, 1); }
+
+private:
+    void FlushThread();
+
+    Sink sink_;
+    std::mutex mutex_;
+    std::condition_variable data_cv_;   // flusher waits for bytes
+    std::condition_variable space_cv_;  // writers wait for room
+    std::array<uint8_t, kRingSize> ring_{};
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool flush_now_ = false;
+    bool stop_ = false;
+    std::thread thread_;
+};
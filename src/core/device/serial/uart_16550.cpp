@@ -123,3 +123,37 @@ void Uart16550::PioWrite(uint16_t offset, uint8_t size, uint32_t value) {
         break;
     }
 }
+
+void Uart16550::SaveState(StateWriter& out) {
+    out.Put(ier_);
+    out.Put(lcr_);
+    out.Put(mcr_);
+    out.Put(scr_);
+    out.Put(dll_);
+    out.Put(dlh_);
+    out.Put(thre_pending_);
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    out.Put(static_cast<uint32_t>(rx_count_));
+    for (size_t i = 0; i < rx_count_; i++) {
+        out.Put(rx_buf_[(rx_head_ + i) % kFifoSize]);
+    }
+}
+
+bool Uart16550::LoadState(StateReader& in) {
+    in.Get(&ier_);
+    in.Get(&lcr_);
+    in.Get(&mcr_);
+    in.Get(&scr_);
+    in.Get(&dll_);
+    in.Get(&dlh_);
+    in.Get(&thre_pending_);
+    uint32_t count = 0;
+    in.Get(&count);
+    if (!in.ok() || count > kFifoSize) return false;
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    in.GetBytes(rx_buf_.data(), count);
+    rx_head_ = 0;
+    rx_tail_ = count % kFifoSize;
+    rx_count_ = count;
+    return in.ok();
+}
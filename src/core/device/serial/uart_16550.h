@@ -17,6 +17,8 @@ public:
 
     void PioRead(uint16_t offset, uint8_t size, uint32_t* value) override;
     void PioWrite(uint16_t offset, uint8_t size, uint32_t value) override;
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
 
     void PushInput(uint8_t byte);
     bool HasInput() const;
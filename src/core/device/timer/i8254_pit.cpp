@@ -1,8 +1,70 @@
 #include "core/device/timer/i8254_pit.h"
 
+#include <string>
+
 #define NOMINMAX
 #include <windows.h>
 
+namespace {
+
+// A measured frequency holds until the host reboots, so it is cached in a
+// file stamped with the boot time and only the first runtime after a boot
+// pays for the measurement.
+struct TscCacheEntry {
+    uint64_t boot_time_s;
+    uint64_t freq;
+};
+
+// Clock adjustments move the computed boot time a little.
+constexpr uint64_t kBootTimeSlackS = 60;
+
+uint64_t HostBootTimeSeconds() {
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t now = ((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) /
+                   10000000;
+    return now - GetTickCount64() / 1000;
+}
+
+std::wstring TscCachePath() {
+    wchar_t dir[MAX_PATH];
+    DWORD len = GetTempPathW(MAX_PATH, dir);
+    if (!len || len >= MAX_PATH) return {};
+    return std::wstring(dir, len) + L"tenbox_tsc_freq.bin";
+}
+
+uint64_t ReadCachedTscFrequency(uint64_t boot_time_s) {
+    std::wstring path = TscCachePath();
+    if (path.empty()) return 0;
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    TscCacheEntry entry{};
+    DWORD read = 0;
+    bool ok = ReadFile(file, &entry, sizeof(entry), &read, nullptr) && read == sizeof(entry);
+    CloseHandle(file);
+    uint64_t drift = entry.boot_time_s > boot_time_s ? entry.boot_time_s - boot_time_s
+                                                     : boot_time_s - entry.boot_time_s;
+    if (!ok || drift > kBootTimeSlackS) return 0;
+    // Anything outside 100 MHz - 10 GHz is not a TSC frequency.
+    if (entry.freq < 100000000ULL || entry.freq > 10000000000ULL) return 0;
+    return entry.freq;
+}
+
+void WriteCachedTscFrequency(uint64_t boot_time_s, uint64_t freq) {
+    std::wstring path = TscCachePath();
+    if (path.empty()) return;
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    TscCacheEntry entry{boot_time_s, freq};
+    DWORD written = 0;
+    WriteFile(file, &entry, sizeof(entry), &written, nullptr);
+    CloseHandle(file);
+}
+
+}  // namespace
+
 uint64_t I8254Pit::MeasureTscFrequency() {
     // Try CPUID 0x15 (TSC / Core Crystal Clock) first.
     int info[4]{};
@@ -16,6 +78,12 @@ uint64_t I8254Pit::MeasureTscFrequency() {
         return freq;
     }
 
+    uint64_t boot_time_s = HostBootTimeSeconds();
+    if (uint64_t cached = ReadCachedTscFrequency(boot_time_s)) {
+        LOG_INFO("TSC frequency from cache: %llu Hz", cached);
+        return cached;
+    }
+
     // Fallback: measure with QPC.
     LARGE_INTEGER qpf, qpc_start, qpc_end;
     QueryPerformanceFrequency(&qpf);
@@ -29,6 +97,7 @@ uint64_t I8254Pit::MeasureTscFrequency() {
                      / qpf.QuadPart;
     uint64_t freq = static_cast<uint64_t>((tsc_end - tsc_start) / elapsed);
     LOG_INFO("TSC frequency measured via QPC: %llu Hz", freq);
+    WriteCachedTscFrequency(boot_time_s, freq);
     return freq;
 }
 
@@ -176,3 +245,23 @@ void SystemControlB::PioRead(uint16_t offset, uint8_t size, uint32_t* value) {
 void SystemControlB::PioWrite(uint16_t offset, uint8_t size, uint32_t value) {
     value_ = static_cast<uint8_t>(value);
 }
+
+void I8254Pit::SaveState(StateWriter& out) {
+    // Counters are kept as TSC time since they were armed, so they carry
+    // on from where they were rather than jumping by the time suspended.
+    uint64_t now = __rdtsc();
+    for (const auto& c : channels_) {
+        Channel saved = c;
+        saved.start_tsc = now - c.start_tsc;
+        out.Put(saved);
+    }
+}
+
+bool I8254Pit::LoadState(StateReader& in) {
+    uint64_t now = __rdtsc();
+    for (auto& c : channels_) {
+        if (!in.Get(&c)) return false;
+        c.start_tsc = now - c.start_tsc;
+    }
+    return true;
+}
@@ -15,6 +15,8 @@ public:
 
     void PioRead(uint16_t offset, uint8_t size, uint32_t* value) override;
     void PioWrite(uint16_t offset, uint8_t size, uint32_t value) override;
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
 
     bool IsChannel2OutputHigh() const;
 
@@ -55,6 +57,12 @@ public:
     void PioRead(uint16_t offset, uint8_t size, uint32_t* value) override;
     void PioWrite(uint16_t offset, uint8_t size, uint32_t value) override;
 
+    // Port 0x61 drives PIT channel 2, so both share the PIT's lock.
+    void SaveState(StateWriter& out) override { out.Put(value_); }
+    bool LoadState(StateReader& in) override { return in.Get(&value_); }
+
+    std::mutex* IoLock() override { return pit_ ? pit_->IoLock() : Device::IoLock(); }
+
 private:
     I8254Pit* pit_ = nullptr;
     uint8_t value_ = 0;
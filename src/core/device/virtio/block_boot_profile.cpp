@@ -0,0 +1,345 @@
+#include "core/device/virtio/block_boot_profile.h"
+#include "core/vmm/utf8.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <windows.h>
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'B', 'X', 'B', 'O', 'O', 'T', 'P'};
+constexpr uint32_t kVersion = 1;
+
+// Sector aligned, so direct-I/O raw images read into the buffers without
+// bouncing.
+constexpr std::align_val_t kBufferAlign{4096};
+
+}  // namespace
+
+// Followed by `count` chunk numbers in the order the guest first read them.
+struct BootProfileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_bytes;
+    uint64_t disk_size;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+std::string BlockBootProfile::ProfilePath(const std::string& disk_path) {
+    return disk_path + ".bootprof";
+}
+
+BlockBootProfile::~BlockBootProfile() {
+    Stop();
+}
+
+bool BlockBootProfile::Start(DiskImage* disk, std::mutex* disk_mutex,
+                             const std::string& profile_path, uint32_t seconds) {
+    if (IsRunning()) return true;
+    if (!disk || seconds == 0) return false;
+    if (saver_.joinable()) saver_.join();
+
+    disk_ = disk;
+    disk_mutex_ = disk_mutex;
+    disk_size_ = disk->GetSize();
+    path_ = profile_path;
+
+    entries_.clear();
+    index_.clear();
+    next_fetch_ = 0;
+    guest_pos_ = 0;
+    drop_pos_ = 0;
+    stopping_ = false;
+    stats_ = {};
+    Load(path_);
+    stats_.replayed_chunks = static_cast<uint32_t>(entries_.size());
+
+    recorded_.clear();
+    recorded_set_.clear();
+    recording_ = true;
+    record_until_ = Clock::now() + std::chrono::seconds(seconds);
+    active_.store(true, std::memory_order_release);
+
+    if (!entries_.empty()) {
+        // Serialized backends (qcow2) would only queue extra workers on
+        // the disk lock.
+        uint32_t workers = disk->SupportsConcurrentIo() ? kMaxWorkers : 1;
+        for (uint32_t i = 0; i < workers; i++) {
+            workers_.emplace_back(&BlockBootProfile::WorkerThread, this);
+        }
+    }
+    LOG_INFO("BlockBootProfile: recording %u s of boot reads, replaying %zu chunk(s) "
+             "(%llu MB) from %s", seconds, entries_.size(),
+             static_cast<uint64_t>(entries_.size()) * kChunkBytes >> 20, path_.c_str());
+    return true;
+}
+
+void BlockBootProfile::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (recording_) FinishLocked();
+        stopping_ = true;
+        active_.store(false, std::memory_order_release);
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) t.join();
+    workers_.clear();
+    if (saver_.joinable()) saver_.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& e : entries_) DropLocked(e);
+    entries_.clear();
+    index_.clear();
+}
+
+bool BlockBootProfile::Load(const std::string& path) {
+    HANDLE file = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    // No profile yet: this is the boot that records one.
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    BootProfileHeader hdr{};
+    DWORD got = 0;
+    bool ok = ReadFile(file, &hdr, sizeof(hdr), &got, nullptr) && got == sizeof(hdr) &&
+              memcmp(hdr.magic, kMagic, sizeof(kMagic)) == 0 && hdr.version == kVersion;
+    std::vector<uint64_t> chunks;
+    if (ok && hdr.chunk_bytes == kChunkBytes && hdr.disk_size == disk_size_ &&
+        hdr.count <= kMaxProfileChunks) {
+        chunks.resize(hdr.count);
+        DWORD want = static_cast<DWORD>(chunks.size() * sizeof(uint64_t));
+        ok = ReadFile(file, chunks.data(), want, &got, nullptr) && got == want;
+    } else if (ok) {
+        LOG_INFO("BlockBootProfile: %s was recorded for another disk; ignoring it",
+                 path.c_str());
+        ok = false;
+    }
+    CloseHandle(file);
+    if (!ok) return false;
+
+    entries_.reserve(chunks.size());
+    for (uint64_t chunk : chunks) {
+        if (chunk >= (disk_size_ + kChunkBytes - 1) / kChunkBytes) continue;
+        if (!index_.emplace(chunk, static_cast<uint32_t>(entries_.size())).second) continue;
+        Entry e;
+        e.chunk = chunk;
+        entries_.push_back(e);
+    }
+    return true;
+}
+
+bool BlockBootProfile::Save(std::vector<uint64_t> chunks) {
+    if (chunks.empty()) return false;
+
+    BootProfileHeader hdr{};
+    memcpy(hdr.magic, kMagic, sizeof(kMagic));
+    hdr.version = kVersion;
+    hdr.chunk_bytes = kChunkBytes;
+    hdr.disk_size = disk_size_;
+    hdr.count = static_cast<uint32_t>(chunks.size());
+
+    // Written aside and renamed over, so a crash never leaves half a list.
+    std::wstring tmp = Utf8ToWide(path_ + ".tmp");
+    HANDLE file = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_WARN("BlockBootProfile: cannot create %s.tmp (%lu)", path_.c_str(), GetLastError());
+        return false;
+    }
+    DWORD done = 0;
+    DWORD body = static_cast<DWORD>(chunks.size() * sizeof(uint64_t));
+    bool ok = WriteFile(file, &hdr, sizeof(hdr), &done, nullptr) && done == sizeof(hdr) &&
+              WriteFile(file, chunks.data(), body, &done, nullptr) && done == body;
+    DWORD err = ok ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(file);
+    if (ok && !MoveFileExW(tmp.c_str(), Utf8ToWide(path_).c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        ok = false;
+        err = GetLastError();
+    }
+    if (!ok) {
+        LOG_WARN("BlockBootProfile: writing %s failed (%lu)", path_.c_str(), err);
+        DeleteFileW(tmp.c_str());
+        return false;
+    }
+    LOG_INFO("BlockBootProfile: %zu chunk(s) (%llu MB) of boot reads saved to %s",
+             chunks.size(),
+             static_cast<uint64_t>(chunks.size()) * kChunkBytes >> 20, path_.c_str());
+    return true;
+}
+
+void BlockBootProfile::RecordLocked(uint64_t first_chunk, uint64_t last_chunk) {
+    for (uint64_t c = first_chunk; c <= last_chunk; c++) {
+        if (recorded_.size() >= kMaxProfileChunks) return;
+        if (recorded_set_.insert(c).second) recorded_.push_back(c);
+    }
+}
+
+void BlockBootProfile::FinishLocked() {
+    recording_ = false;
+    stats_.recorded_chunks = static_cast<uint32_t>(recorded_.size());
+    if (!recorded_.empty()) {
+        saver_ = std::thread(&BlockBootProfile::Save, this, std::move(recorded_));
+    }
+    recorded_ = {};
+    recorded_set_ = {};
+
+    // The boot is over as far as the profile knows; what is left unread
+    // would only sit in memory.
+    next_fetch_ = static_cast<uint32_t>(entries_.size());
+    for (auto& e : entries_) {
+        if (e.state == EntryState::kReady || e.state == EntryState::kQueued) DropLocked(e);
+    }
+    active_.store(false, std::memory_order_release);
+    cv_.notify_all();
+
+    if (stats_.replayed_chunks) {
+        LOG_INFO("BlockBootProfile: %llu read(s) served during boot, prefetched %llu MB, "
+                 "wasted %llu MB", stats_.hits, stats_.prefetched_bytes >> 20,
+                 stats_.wasted_bytes >> 20);
+    }
+}
+
+void BlockBootProfile::DropLocked(Entry& e) {
+    if (e.state == EntryState::kReady && !e.used) stats_.wasted_bytes += ChunkLen(e.chunk);
+    if (e.data) ::operator delete(e.data, kBufferAlign);
+    e.data = nullptr;
+    // A pending read still owns its buffer; the worker sees kDone after.
+    e.state = EntryState::kDone;
+}
+
+uint32_t BlockBootProfile::ChunkLen(uint64_t chunk) const {
+    uint64_t offset = chunk * kChunkBytes;
+    return static_cast<uint32_t>(std::min<uint64_t>(kChunkBytes, disk_size_ - offset));
+}
+
+bool BlockBootProfile::Read(uint64_t offset, const DiskIoVec* iov, size_t count,
+                            uint32_t len) {
+    if (!IsRunning() || len == 0) return false;
+    uint64_t first = offset / kChunkBytes;
+    uint64_t last = (offset + len - 1) / kChunkBytes;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!recording_) return false;
+    if (Clock::now() >= record_until_) {
+        FinishLocked();
+        return false;
+    }
+    RecordLocked(first, last);
+    if (entries_.empty()) return false;
+
+    // Every byte must already be there; partial hits go to the disk whole.
+    // Either way the read moves the guest along the profile.
+    bool hit = true;
+    uint32_t furthest = guest_pos_;
+    for (uint64_t c = first; c <= last; c++) {
+        auto it = index_.find(c);
+        if (it == index_.end()) {
+            hit = false;
+            continue;
+        }
+        furthest = std::max(furthest, it->second + 1);
+        if (entries_[it->second].state != EntryState::kReady) hit = false;
+    }
+
+    if (hit) {
+        uint64_t pos = offset;
+        for (size_t i = 0; i < count; i++) {
+            auto* dst = static_cast<uint8_t*>(iov[i].base);
+            uint32_t remaining = iov[i].len;
+            while (remaining > 0) {
+                uint64_t chunk = pos / kChunkBytes;
+                Entry& e = entries_[index_[chunk]];
+                uint32_t in_chunk = static_cast<uint32_t>(pos - chunk * kChunkBytes);
+                uint32_t n = std::min(remaining, ChunkLen(chunk) - in_chunk);
+                memcpy(dst, e.data + in_chunk, n);
+                e.used = true;
+                dst += n;
+                pos += n;
+                remaining -= n;
+            }
+        }
+        stats_.hits++;
+    }
+
+    if (furthest > guest_pos_) {
+        guest_pos_ = furthest;
+        while (drop_pos_ + kMaxAheadChunks < guest_pos_) {
+            Entry& e = entries_[drop_pos_++];
+            if (e.state == EntryState::kReady || e.state == EntryState::kQueued) DropLocked(e);
+        }
+        cv_.notify_all();
+    }
+    return hit;
+}
+
+void BlockBootProfile::Invalidate(uint64_t offset, uint64_t len) {
+    if (!IsRunning() || len == 0) return;
+    uint64_t first = offset / kChunkBytes;
+    uint64_t last = (offset + len - 1) / kChunkBytes;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Queued chunks are read after the write and see its data.
+    for (uint64_t c = first; c <= last; c++) {
+        auto it = index_.find(c);
+        if (it == index_.end()) continue;
+        Entry& e = entries_[it->second];
+        if (e.state == EntryState::kPending) {
+            e.stale = true;
+        } else if (e.state == EntryState::kReady) {
+            DropLocked(e);
+        }
+    }
+}
+
+void BlockBootProfile::WorkerThread() {
+    for (;;) {
+        uint32_t pos;
+        uint64_t chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] {
+                return stopping_ || next_fetch_ >= entries_.size() ||
+                       next_fetch_ < guest_pos_ + kMaxAheadChunks;
+            });
+            if (stopping_ || next_fetch_ >= entries_.size()) return;
+            pos = next_fetch_++;
+            Entry& e = entries_[pos];
+            // Skipped by the guest, or given up already.
+            if (e.state != EntryState::kQueued) continue;
+            e.state = EntryState::kPending;
+            chunk = e.chunk;
+        }
+
+        uint32_t len = ChunkLen(chunk);
+        auto* data = static_cast<uint8_t*>(
+            ::operator new(kChunkBytes, kBufferAlign, std::nothrow));
+        bool ok = data != nullptr;
+        if (ok && disk_mutex_ && !disk_->SupportsConcurrentIo()) {
+            std::lock_guard<std::mutex> lock(*disk_mutex_);
+            ok = disk_->Read(chunk * kChunkBytes, data, len);
+        } else if (ok) {
+            ok = disk_->Read(chunk * kChunkBytes, data, len);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& e = entries_[pos];
+        if (ok && !e.stale && e.state == EntryState::kPending && pos >= drop_pos_ &&
+            IsRunning()) {
+            e.data = data;
+            e.state = EntryState::kReady;
+            stats_.prefetched_bytes += len;
+        } else {
+            if (data) ::operator delete(data, kBufferAlign);
+            e.state = EntryState::kDone;
+        }
+        e.stale = false;
+    }
+}
+
+BlockBootProfile::Stats BlockBootProfile::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    if (recording_) stats.recorded_chunks = static_cast<uint32_t>(recorded_.size());
+    return stats;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "core/device/virtio/disk_image.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Boot-time prefetch for virtio-blk.
+//
+// A cold boot reads much the same few hundred MB of the root filesystem
+// in the same order every time, one request after another. For the first
+// seconds after the disk is opened, the chunks the guest reads are logged
+// in first-touch order and then written to a profile next to the image.
+// The next open replays that list on background workers ahead of the
+// guest: chunks are read (and for qcow2, decompressed) into memory, and a
+// guest read that falls entirely in fetched chunks is served from there.
+// Every boot records a fresh list, so the profile follows the guest as
+// its disk changes.
+class BlockBootProfile {
+public:
+    // Recording and prefetch granularity; matches BlockReadahead's chunks.
+    static constexpr uint32_t kChunkBytes = 64 * 1024;
+    // How far prefetch may run ahead of the guest (32 MiB). Fetched chunks
+    // stay until the guest is as far past them, so partial reads of one
+    // chunk all hit; at most twice this much is held at once.
+    static constexpr uint32_t kMaxAheadChunks = 512;
+    // Longest profile recorded (1 GiB of boot reads).
+    static constexpr uint32_t kMaxProfileChunks = 16384;
+    // Workers for backends that take concurrent reads; others get one.
+    static constexpr uint32_t kMaxWorkers = 4;
+
+    struct Stats {
+        uint64_t hits = 0;              // reads served from prefetched data
+        uint64_t prefetched_bytes = 0;
+        uint64_t wasted_bytes = 0;      // prefetched, then dropped unread
+        uint32_t replayed_chunks = 0;   // in the profile found at start
+        uint32_t recorded_chunks = 0;
+    };
+
+    // The profile kept for `disk_path`.
+    static std::string ProfilePath(const std::string& disk_path);
+
+    BlockBootProfile() = default;
+    ~BlockBootProfile();
+
+    BlockBootProfile(const BlockBootProfile&) = delete;
+    BlockBootProfile& operator=(const BlockBootProfile&) = delete;
+
+    // Replays the profile at `profile_path` if there is one for a disk of
+    // this size, and records a new one over the next `seconds`.
+    // `disk_mutex` is taken around prefetch reads when the backend does not
+    // support concurrent I/O.
+    bool Start(DiskImage* disk, std::mutex* disk_mutex,
+               const std::string& profile_path, uint32_t seconds);
+    // Saves what was recorded if the window is still open and drops any
+    // prefetched data.
+    void Stop();
+    bool IsRunning() const { return active_.load(std::memory_order_acquire); }
+
+    // Logs a guest read and serves it from prefetched chunks if they cover
+    // all of it. Returns false on a miss, in which case the caller reads
+    // the disk itself.
+    bool Read(uint64_t offset, const DiskIoVec* iov, size_t count, uint32_t len);
+
+    // Drops prefetched data overlapping a modified range. Must be called
+    // after the modification completed.
+    void Invalidate(uint64_t offset, uint64_t len);
+
+    Stats GetStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class EntryState : uint8_t { kQueued, kPending, kReady, kDone };
+
+    struct Entry {
+        uint64_t chunk = 0;
+        EntryState state = EntryState::kQueued;
+        bool stale = false;     // invalidated while the read was in flight
+        bool used = false;      // served at least one read
+        uint8_t* data = nullptr;
+    };
+
+    bool Load(const std::string& path);
+    // Writes `chunks` as the profile; runs on saver_.
+    bool Save(std::vector<uint64_t> chunks);
+    void RecordLocked(uint64_t first_chunk, uint64_t last_chunk);
+    // Closes the recording window: hands the profile to saver_ and ends
+    // the replay.
+    void FinishLocked();
+    void DropLocked(Entry& e);
+    uint32_t ChunkLen(uint64_t chunk) const;
+    void WorkerThread();
+
+    DiskImage* disk_ = nullptr;
+    std::mutex* disk_mutex_ = nullptr;
+    uint64_t disk_size_ = 0;
+    std::string path_;
+
+    // Read() skips the lock entirely once there is nothing left to do.
+    std::atomic<bool> active_{false};
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;  // workers wait for the guest to catch up
+
+    // Replay, in profile order. The guest is "at" one past the furthest
+    // entry it has read; workers stay within kMaxAheadChunks of it, and
+    // entries it left that far behind are given up.
+    std::vector<Entry> entries_;
+    std::unordered_map<uint64_t, uint32_t> index_;  // chunk -> entry
+    uint32_t next_fetch_ = 0;
+    uint32_t guest_pos_ = 0;
+    uint32_t drop_pos_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+
+    // Recording.
+    bool recording_ = false;
+    Clock::time_point record_until_;
+    std::vector<uint64_t> recorded_;
+    std::unordered_set<uint64_t> recorded_set_;
+    // The window mostly closes inside a guest read, which should not wait
+    // for the file to be written.
+    std::thread saver_;
+
+    Stats stats_;
+};
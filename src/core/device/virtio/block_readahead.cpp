@@ -0,0 +1,289 @@
+#include "core/device/virtio/block_readahead.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace {
+
+// Chunk slabs are sector aligned so direct-I/O raw images read into them
+// without bouncing.
+constexpr std::align_val_t kSlabAlign{4096};
+
+// Fewest chunks kept ahead once a stream turns sequential.
+constexpr uint32_t kInitialWindowChunks = 2;
+
+}  // namespace
+
+BlockReadahead::~BlockReadahead() {
+    Stop();
+}
+
+bool BlockReadahead::Start(DiskImage* disk, std::mutex* disk_mutex,
+                           uint32_t streams, uint32_t max_window_bytes) {
+    if (IsRunning()) return true;
+    if (!disk || streams == 0 || max_window_bytes < kChunkBytes) return false;
+
+    disk_ = disk;
+    disk_mutex_ = disk_mutex;
+    disk_size_ = disk->GetSize();
+    max_window_chunks_ = max_window_bytes / kChunkBytes;
+
+    streams_.clear();
+    for (uint32_t i = 0; i < streams; i++) {
+        streams_.push_back(std::make_unique<Stream>());
+    }
+    stats_ = {};
+    stats_.max_window_bytes = max_window_chunks_ * kChunkBytes;
+
+    stopping_ = false;
+    worker_ = std::thread(&BlockReadahead::WorkerThread, this);
+    LOG_INFO("BlockReadahead: %u stream(s), window up to %u KB",
+             streams, stats_.max_window_bytes / 1024);
+    return true;
+}
+
+void BlockReadahead::Stop() {
+    if (!IsRunning()) return;
+    {
+        std::lock_guard<std::mutex> lock(job_mutex_);
+        stopping_ = true;
+        jobs_.clear();
+    }
+    job_cv_.notify_all();
+    worker_.join();
+    FreeSlabs();
+}
+
+void BlockReadahead::FreeSlabs() {
+    for (auto& s : streams_) {
+        if (s->slab) ::operator delete(s->slab, kSlabAlign);
+        s->slab = nullptr;
+        s->chunks.clear();
+    }
+}
+
+BlockReadahead::Chunk* BlockReadahead::FindChunkLocked(Stream& s,
+                                                       uint64_t chunk_offset) {
+    for (auto& c : s.chunks) {
+        if (c.state != ChunkState::kEmpty && c.offset == chunk_offset) return &c;
+    }
+    return nullptr;
+}
+
+bool BlockReadahead::Read(uint32_t stream, uint64_t offset, const DiskIoVec* iov,
+                          size_t count, uint32_t len) {
+    if (!IsRunning() || stream >= streams_.size() || len == 0) return false;
+    Stream& s = *streams_[stream];
+
+    bool hit;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        // Workers may run a queue's requests slightly out of order, so
+        // anything near the expected offset still continues the stream.
+        uint64_t slack = static_cast<uint64_t>(
+            std::max(s.window_chunks, kInitialWindowChunks)) * kChunkBytes;
+        bool near = offset + slack >= s.next_offset &&
+                    offset <= s.next_offset + slack;
+        if (s.sequential > 0 && near) {
+            s.sequential++;
+            s.next_offset = std::max(s.next_offset, offset + len);
+        } else {
+            s.sequential = 1;
+            s.window_chunks = 0;
+            s.next_offset = offset + len;
+        }
+
+        hit = ServeLocked(s, offset, iov, count, len);
+
+        if (s.sequential >= kMinSequentialReads) {
+            if (s.window_chunks == 0) {
+                s.window_chunks = std::min(kInitialWindowChunks, max_window_chunks_);
+            } else if (hit) {
+                s.window_chunks = std::min(s.window_chunks * 2, max_window_chunks_);
+            }
+            ScheduleLocked(stream, s, offset + len);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (hit) {
+        stats_.hits++;
+    } else {
+        stats_.misses++;
+    }
+    return hit;
+}
+
+bool BlockReadahead::ServeLocked(Stream& s, uint64_t offset, const DiskIoVec* iov,
+                                 size_t count, uint32_t len) {
+    uint64_t end = offset + len;
+    uint64_t first = offset - offset % kChunkBytes;
+
+    // Every byte must already be there; partial hits go to the disk whole.
+    for (uint64_t c = first; c < end; c += kChunkBytes) {
+        Chunk* chunk = FindChunkLocked(s, c);
+        if (!chunk || chunk->state != ChunkState::kReady ||
+            chunk->offset + chunk->len < std::min(end, c + kChunkBytes)) {
+            return false;
+        }
+    }
+
+    uint64_t pos = offset;
+    for (size_t i = 0; i < count; i++) {
+        auto* dst = static_cast<uint8_t*>(iov[i].base);
+        uint32_t remaining = iov[i].len;
+        while (remaining > 0) {
+            Chunk* chunk = FindChunkLocked(s, pos - pos % kChunkBytes);
+            uint32_t in_chunk = static_cast<uint32_t>(pos - chunk->offset);
+            uint32_t n = std::min(remaining, chunk->len - in_chunk);
+            memcpy(dst, chunk->data + in_chunk, n);
+            chunk->used = true;
+            dst += n;
+            pos += n;
+            remaining -= n;
+        }
+    }
+    return true;
+}
+
+void BlockReadahead::ScheduleLocked(uint32_t stream_idx, Stream& s, uint64_t from) {
+    if (!s.slab) {
+        // One slot per window chunk plus the one being consumed.
+        size_t slots = static_cast<size_t>(max_window_chunks_) + 1;
+        s.slab = static_cast<uint8_t*>(
+            ::operator new(slots * kChunkBytes, kSlabAlign, std::nothrow));
+        if (!s.slab) return;
+        s.chunks.resize(slots);
+        s.scheduled.reserve(slots);
+        for (size_t i = 0; i < slots; i++) s.chunks[i].data = s.slab + i * kChunkBytes;
+    }
+
+    uint64_t start = from - from % kChunkBytes;
+    uint64_t end = std::min(disk_size_,
+        start + static_cast<uint64_t>(s.window_chunks) * kChunkBytes);
+
+    std::vector<Job>& queued = s.scheduled;
+    queued.clear();
+    uint64_t wasted = 0;
+    for (uint64_t c = start; c < end; c += kChunkBytes) {
+        if (FindChunkLocked(s, c)) continue;
+
+        // Reuse an empty slot, or a ready one outside the new window.
+        Chunk* slot = nullptr;
+        for (auto& candidate : s.chunks) {
+            if (candidate.state == ChunkState::kEmpty) {
+                slot = &candidate;
+                break;
+            }
+            if (candidate.state == ChunkState::kReady &&
+                (candidate.offset < start || candidate.offset >= end)) {
+                slot = &candidate;
+            }
+        }
+        if (!slot) break;
+        if (slot->state == ChunkState::kReady && !slot->used) wasted += slot->len;
+
+        slot->offset = c;
+        slot->len = static_cast<uint32_t>(std::min<uint64_t>(kChunkBytes, disk_size_ - c));
+        slot->state = ChunkState::kPending;
+        slot->stale = false;
+        slot->used = false;
+        queued.push_back({stream_idx, static_cast<uint32_t>(slot - s.chunks.data())});
+    }
+
+    if (wasted) {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.wasted_bytes += wasted;
+    }
+    if (queued.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(job_mutex_);
+        jobs_.insert(jobs_.end(), queued.begin(), queued.end());
+    }
+    job_cv_.notify_one();
+}
+
+void BlockReadahead::Invalidate(uint64_t offset, uint64_t len) {
+    if (!IsRunning() || len == 0) return;
+    uint64_t end = offset + len;
+    uint64_t wasted = 0;
+
+    for (auto& sp : streams_) {
+        Stream& s = *sp;
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (auto& c : s.chunks) {
+            if (c.state == ChunkState::kEmpty) continue;
+            if (c.offset >= end || c.offset + c.len <= offset) continue;
+            if (c.state == ChunkState::kPending) {
+                c.stale = true;
+            } else {
+                if (!c.used) wasted += c.len;
+                c.state = ChunkState::kEmpty;
+            }
+        }
+    }
+
+    if (wasted) {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.wasted_bytes += wasted;
+    }
+}
+
+void BlockReadahead::WorkerThread() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(job_mutex_);
+            job_cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) return;
+            job = jobs_.front();
+            jobs_.pop_front();
+        }
+
+        Stream& s = *streams_[job.stream];
+        uint64_t offset;
+        uint32_t len;
+        uint8_t* data;
+        {
+            // A pending chunk is never reclaimed, so its fields stay put
+            // while the read runs unlocked.
+            std::lock_guard<std::mutex> lock(s.mutex);
+            Chunk& c = s.chunks[job.chunk];
+            offset = c.offset;
+            len = c.len;
+            data = c.data;
+        }
+
+        bool ok;
+        if (disk_mutex_ && !disk_->SupportsConcurrentIo()) {
+            std::lock_guard<std::mutex> lock(*disk_mutex_);
+            ok = disk_->Read(offset, data, len);
+        } else {
+            ok = disk_->Read(offset, data, len);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            Chunk& c = s.chunks[job.chunk];
+            c.state = ok && !c.stale ? ChunkState::kReady : ChunkState::kEmpty;
+        }
+        if (ok) {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.prefetched_bytes += len;
+        }
+    }
+}
+
+BlockReadahead::Stats BlockReadahead::GetStats() const {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats = stats_;
+    }
+    for (auto& s : streams_) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        stats.window_bytes = std::max(stats.window_bytes, s->window_chunks * kChunkBytes);
+    }
+    return stats;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "core/device/virtio/disk_image.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Sequential readahead for virtio-blk.
+//
+// Each request queue is one stream. Once a stream has issued a few
+// back-to-back reads, the next window of the disk is fetched in fixed-size
+// chunks on a background worker, so later guest reads are served from memory
+// and compressed qcow2 clusters are decompressed ahead of use. The window
+// doubles while the stream keeps hitting and collapses on a random read.
+class BlockReadahead {
+public:
+    // Prefetch granularity; matches the default qcow2 cluster size.
+    static constexpr uint32_t kChunkBytes = 64 * 1024;
+    // Back-to-back reads before a stream counts as sequential.
+    static constexpr uint32_t kMinSequentialReads = 2;
+
+    struct Stats {
+        uint64_t hits = 0;              // reads served from prefetched data
+        uint64_t misses = 0;            // reads that went to the disk
+        uint64_t prefetched_bytes = 0;
+        uint64_t wasted_bytes = 0;      // prefetched, then dropped unread
+        uint32_t window_bytes = 0;      // largest current stream window
+        uint32_t max_window_bytes = 0;
+    };
+
+    BlockReadahead() = default;
+    ~BlockReadahead();
+
+    BlockReadahead(const BlockReadahead&) = delete;
+    BlockReadahead& operator=(const BlockReadahead&) = delete;
+
+    // `disk_mutex` is taken around prefetch reads when the backend does not
+    // support concurrent I/O. A zero window disables readahead.
+    bool Start(DiskImage* disk, std::mutex* disk_mutex, uint32_t streams,
+               uint32_t max_window_bytes);
+    void Stop();
+    bool IsRunning() const { return worker_.joinable(); }
+
+    // Serves a read entirely from prefetched chunks. Returns false on a miss,
+    // in which case the caller reads the disk itself. Either way the access
+    // feeds the stream's sequential detection.
+    bool Read(uint32_t stream, uint64_t offset, const DiskIoVec* iov,
+              size_t count, uint32_t len);
+
+    // Drops prefetched data overlapping a modified range. Must be called
+    // after the modification completed.
+    void Invalidate(uint64_t offset, uint64_t len);
+
+    Stats GetStats() const;
+
+private:
+    enum class ChunkState : uint8_t { kEmpty, kPending, kReady };
+
+    struct Chunk {
+        uint64_t offset = 0;
+        uint32_t len = 0;
+        ChunkState state = ChunkState::kEmpty;
+        bool stale = false;     // invalidated while the read was in flight
+        bool used = false;      // served at least one read
+        uint8_t* data = nullptr;
+    };
+
+    struct Job {
+        uint32_t stream;
+        uint32_t chunk;
+    };
+
+    struct Stream {
+        std::mutex mutex;
+        uint64_t next_offset = 0;       // where a sequential read would start
+        uint32_t sequential = 0;        // back-to-back reads seen
+        uint32_t window_chunks = 0;
+        std::vector<Chunk> chunks;
+        uint8_t* slab = nullptr;        // chunks.size() * kChunkBytes, aligned
+        // ScheduleLocked's jobs before they are queued; kept so reads on
+        // the hot path do not allocate.
+        std::vector<Job> scheduled;
+    };
+
+    bool ServeLocked(Stream& s, uint64_t offset, const DiskIoVec* iov,
+                     size_t count, uint32_t len);
+    void ScheduleLocked(uint32_t stream_idx, Stream& s, uint64_t from);
+    Chunk* FindChunkLocked(Stream& s, uint64_t chunk_offset);
+    void WorkerThread();
+    void FreeSlabs();
+
+    DiskImage* disk_ = nullptr;
+    std::mutex* disk_mutex_ = nullptr;
+    uint64_t disk_size_ = 0;
+    uint32_t max_window_chunks_ = 0;
+    std::vector<std::unique_ptr<Stream>> streams_;
+
+    std::thread worker_;
+    std::mutex job_mutex_;
+    std::condition_variable job_cv_;
+    std::deque<Job> jobs_;
+    bool stopping_ = false;
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+};
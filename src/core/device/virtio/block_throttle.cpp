@@ -0,0 +1,83 @@
+#include "core/device/virtio/block_throttle.h"
+
+#include <algorithm>
+
+void BlockThrottle::Configure(Bucket& bucket, uint64_t rate, uint64_t burst) {
+    bucket.rate = static_cast<double>(rate);
+    bucket.capacity = static_cast<double>(burst ? burst : rate);
+    bucket.tokens = bucket.capacity;
+}
+
+void BlockThrottle::SetLimits(const BlockThrottleLimits& limits) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        limits_ = limits;
+        Configure(ops_, limits.iops, limits.iops_burst);
+        Configure(bytes_, limits.bytes_per_sec, limits.burst_bytes);
+        last_refill_ = Clock::now();
+    }
+    cv_.notify_all();
+}
+
+BlockThrottleLimits BlockThrottle::GetLimits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limits_;
+}
+
+void BlockThrottle::RefillLocked(Clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+    last_refill_ = now;
+    if (elapsed <= 0) return;
+    for (Bucket* bucket : {&ops_, &bytes_}) {
+        if (!bucket->rate) continue;
+        bucket->tokens = (std::min)(bucket->capacity, bucket->tokens + bucket->rate * elapsed);
+    }
+}
+
+BlockThrottle::Clock::duration BlockThrottle::WaitFor(const Bucket& bucket, double need) {
+    if (!bucket.rate || bucket.tokens >= need) return Clock::duration::zero();
+    auto wait = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>((need - bucket.tokens) / bucket.rate));
+    return (std::max)(wait, Clock::duration(std::chrono::microseconds(1)));
+}
+
+void BlockThrottle::Acquire(uint64_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Clock::time_point start{};
+    bool waited = false;
+    while (!cancelled_ && limits_.enabled()) {
+        Clock::time_point now = Clock::now();
+        RefillLocked(now);
+        // Only a full bucket's worth is required up front; the rest is debt.
+        double need_bytes = (std::min)(static_cast<double>(bytes), bytes_.capacity);
+        Clock::duration wait = (std::max)(WaitFor(ops_, 1), WaitFor(bytes_, need_bytes));
+        if (wait == Clock::duration::zero()) {
+            if (ops_.rate) ops_.tokens -= 1;
+            if (bytes_.rate) bytes_.tokens -= static_cast<double>(bytes);
+            break;
+        }
+        if (!waited) {
+            waited = true;
+            start = now;
+        }
+        cv_.wait_for(lock, wait);
+    }
+    if (waited) {
+        stats_.throttled++;
+        stats_.waited_us += std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start).count();
+    }
+}
+
+void BlockThrottle::Cancel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+    }
+    cv_.notify_all();
+}
+
+BlockThrottle::Stats BlockThrottle::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
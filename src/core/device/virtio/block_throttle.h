@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Per-disk I/O limits, 0 meaning unlimited. A burst lets an idle disk
+// run ahead of the rate for that many requests or bytes; 0 allows one
+// second's worth.
+struct BlockThrottleLimits {
+    uint32_t iops = 0;
+    uint32_t iops_burst = 0;
+    uint64_t bytes_per_sec = 0;
+    uint64_t burst_bytes = 0;
+
+    bool enabled() const { return iops || bytes_per_sec; }
+};
+
+// Token-bucket throttle in front of a virtio-blk backend.
+//
+// Each request takes one I/O token and a token per byte before it reaches
+// the disk; a worker that finds a bucket empty waits for the refill, which
+// holds back that request queue and so the guest's queue depth with it.
+// A request larger than the burst may run once the bucket is full and
+// leaves it in debt, so it is slowed but never starved.
+class BlockThrottle {
+public:
+    struct Stats {
+        uint64_t throttled = 0;   // requests that had to wait
+        uint64_t waited_us = 0;   // total time spent waiting
+    };
+
+    BlockThrottle() = default;
+
+    BlockThrottle(const BlockThrottle&) = delete;
+    BlockThrottle& operator=(const BlockThrottle&) = delete;
+
+    // Takes effect for requests still waiting too. Buckets start full.
+    void SetLimits(const BlockThrottleLimits& limits);
+    BlockThrottleLimits GetLimits() const;
+
+    // Blocks until a request of `bytes` may go ahead. Returns at once when
+    // unlimited or after Cancel().
+    void Acquire(uint64_t bytes);
+
+    // Lets every waiter and later request through, for shutdown.
+    void Cancel();
+
+    Stats GetStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Bucket {
+        double rate = 0;      // tokens per second, 0 = unlimited
+        double capacity = 0;
+        double tokens = 0;
+    };
+
+    static void Configure(Bucket& bucket, uint64_t rate, uint64_t burst);
+    void RefillLocked(Clock::time_point now);
+    // How long until both buckets hold enough for the request.
+    static Clock::duration WaitFor(const Bucket& bucket, double need);
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    BlockThrottleLimits limits_;
+    Bucket ops_;
+    Bucket bytes_;
+    Clock::time_point last_refill_{};
+    bool cancelled_ = false;
+    Stats stats_;
+};
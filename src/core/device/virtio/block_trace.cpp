@@ -0,0 +1,172 @@
+#include "core/device/virtio/block_trace.h"
+#include "core/vmm/utf8.h"
+#include "core/vmm/types.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <windows.h>
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'B', 'X', 'B', 'L', 'K', 'T', 'R'};
+constexpr uint32_t kVersion = 1;
+// Records start on their own page.
+constexpr size_t kHeaderSize = 4096;
+
+// The sequence number is the one field readers race with; it is written
+// last, so a slot with the expected number is complete. Slots are 40 bytes
+// from a page boundary, so it is always 8-byte aligned.
+std::atomic_ref<uint64_t> SlotSeq(BlockTraceRecord* rec) {
+    return std::atomic_ref<uint64_t>(*reinterpret_cast<uint64_t*>(rec));
+}
+
+}  // namespace
+
+struct BlockTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t reserved;
+    uint64_t disk_size;
+    uint64_t next;  // records claimed so far; updated atomically
+};
+static_assert(sizeof(BlockTraceHeader) <= kHeaderSize);
+
+BlockTraceWriter::~BlockTraceWriter() {
+    Close();
+}
+
+bool BlockTraceWriter::Open(const std::string& path, uint32_t capacity,
+                            uint64_t disk_size) {
+    Close();
+    if (capacity == 0) capacity = kDefaultRecords;
+    uint64_t size = kHeaderSize + static_cast<uint64_t>(capacity) * sizeof(BlockTraceRecord);
+
+    HANDLE file = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("Block trace: cannot create %s (%lu)", path.c_str(), GetLastError());
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                        static_cast<DWORD>(size >> 32),
+                                        static_cast<DWORD>(size), nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+    if (!view) {
+        LOG_ERROR("Block trace: cannot map %s (%lu)", path.c_str(), GetLastError());
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    // A new file reads as zeroes, so every slot starts out unwritten.
+    auto* header = static_cast<BlockTraceHeader*>(view);
+    header->version = kVersion;
+    header->record_size = sizeof(BlockTraceRecord);
+    header->capacity = capacity;
+    header->disk_size = disk_size;
+    header->next = 0;
+    std::memcpy(header->magic, kMagic, sizeof(kMagic));
+
+    file_ = file;
+    mapping_ = mapping;
+    header_ = header;
+    records_ = reinterpret_cast<BlockTraceRecord*>(static_cast<uint8_t*>(view) + kHeaderSize);
+    epoch_ = Clock::now();
+    LOG_INFO("Block trace: recording to %s (%u records)", path.c_str(), capacity);
+    return true;
+}
+
+void BlockTraceWriter::Close() {
+    if (header_) {
+        FlushViewOfFile(header_, 0);
+        UnmapViewOfFile(header_);
+    }
+    if (mapping_) CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+    if (file_) CloseHandle(reinterpret_cast<HANDLE>(file_));
+    header_ = nullptr;
+    records_ = nullptr;
+    mapping_ = nullptr;
+    file_ = nullptr;
+}
+
+void BlockTraceWriter::Record(Clock::time_point start, BlockTraceRecord rec) {
+    if (!header_) return;
+    auto now = Clock::now();
+    rec.start_us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(start - epoch_).count());
+    rec.latency_us = static_cast<uint32_t>(std::min<int64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - start).count(),
+        UINT32_MAX));
+
+    uint64_t index = std::atomic_ref<uint64_t>(header_->next).fetch_add(1, std::memory_order_relaxed);
+    BlockTraceRecord* slot = &records_[index % header_->capacity];
+    // Unwritten while the rest changes, in case this slot is being reused.
+    SlotSeq(slot).store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    constexpr size_t kSeqSize = sizeof(rec.seq);
+    std::memcpy(reinterpret_cast<uint8_t*>(slot) + kSeqSize,
+                reinterpret_cast<const uint8_t*>(&rec) + kSeqSize, sizeof(rec) - kSeqSize);
+    SlotSeq(slot).store(index + 1, std::memory_order_release);
+}
+
+bool ReadBlockTrace(const std::string& path, BlockTrace* trace, std::string* error) {
+    HANDLE file = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        *error = "cannot open " + path;
+        return false;
+    }
+    LARGE_INTEGER size{};
+    std::vector<uint8_t> data;
+    bool ok = GetFileSizeEx(file, &size) && size.QuadPart >= static_cast<LONGLONG>(kHeaderSize);
+    if (ok) {
+        data.resize(static_cast<size_t>(size.QuadPart));
+        for (size_t off = 0; ok && off < data.size();) {
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(data.size() - off, 1u << 30));
+            DWORD got = 0;
+            ok = ReadFile(file, data.data() + off, chunk, &got, nullptr) && got == chunk;
+            off += got;
+        }
+    }
+    CloseHandle(file);
+    if (!ok) {
+        *error = "cannot read " + path;
+        return false;
+    }
+
+    BlockTraceHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion || header.record_size != sizeof(BlockTraceRecord) ||
+        !header.capacity ||
+        data.size() < kHeaderSize + static_cast<uint64_t>(header.capacity) * sizeof(BlockTraceRecord)) {
+        *error = path + " is not a block trace";
+        return false;
+    }
+
+    uint64_t written = header.next;
+    uint64_t first = written > header.capacity ? written - header.capacity : 0;
+    trace->disk_size = header.disk_size;
+    trace->written = written;
+    trace->records.clear();
+    trace->records.reserve(static_cast<size_t>(written - first));
+    const auto* records = reinterpret_cast<const BlockTraceRecord*>(data.data() + kHeaderSize);
+    for (uint64_t i = first; i < written; i++) {
+        BlockTraceRecord rec;
+        std::memcpy(&rec, &records[i % header.capacity], sizeof(rec));
+        // Still being written, or already overwritten by a later one.
+        if (rec.seq != i + 1) continue;
+        trace->records.push_back(rec);
+    }
+    // Slots are claimed at completion; replay wants the order of arrival.
+    std::stable_sort(trace->records.begin(), trace->records.end(),
+                     [](const BlockTraceRecord& a, const BlockTraceRecord& b) {
+                         return a.start_us < b.start_us;
+                     });
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One completed virtio-blk request, as a block trace stores it.
+#pragma pack(push, 1)
+struct BlockTraceRecord {
+    uint64_t seq;          // 1-based position in the trace; 0 = slot unwritten
+    uint64_t start_us;     // since the trace was started
+    uint64_t sector;
+    uint32_t length;       // bytes of data (0 for flush)
+    uint32_t latency_us;
+    uint32_t type;         // VIRTIO_BLK_T_*
+    uint8_t queue;
+    uint8_t status;        // VIRTIO_BLK_S_*
+    uint16_t reserved;
+};
+#pragma pack(pop)
+static_assert(sizeof(BlockTraceRecord) == 40, "BlockTraceRecord is a file format");
+
+struct BlockTraceHeader;
+
+// Records virtio-blk requests into a ring in a memory-mapped file, so a
+// trace survives the runtime crashing and costs no system call per
+// request. Once the ring is full the oldest records are overwritten.
+// Writers claim slots with one atomic add, so request workers record
+// concurrently; a reader checks each slot's sequence number to skip the
+// ones still being written.
+class BlockTraceWriter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint32_t kDefaultRecords = 1u << 20;  // 40 MiB
+
+    BlockTraceWriter() = default;
+    ~BlockTraceWriter();
+
+    bool Open(const std::string& path, uint32_t capacity, uint64_t disk_size);
+    void Close();
+    bool IsOpen() const { return header_ != nullptr; }
+
+    // `rec.seq`, `start_us` and `latency_us` are filled in from `start`.
+    void Record(Clock::time_point start, BlockTraceRecord rec);
+
+    BlockTraceWriter(const BlockTraceWriter&) = delete;
+    BlockTraceWriter& operator=(const BlockTraceWriter&) = delete;
+
+private:
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+    BlockTraceHeader* header_ = nullptr;
+    BlockTraceRecord* records_ = nullptr;
+    Clock::time_point epoch_;
+};
+
+struct BlockTrace {
+    uint64_t disk_size = 0;
+    uint64_t written = 0;  // requests recorded, including any overwritten
+    std::vector<BlockTraceRecord> records;  // oldest first, by start_us
+};
+
+// Reads a trace file, which may still be open in a running VM.
+bool ReadBlockTrace(const std::string& path, BlockTrace* trace, std::string* error);
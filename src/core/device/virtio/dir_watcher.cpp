@@ -0,0 +1,87 @@
+#include "core/device/virtio/dir_watcher.h"
+#include "core/vmm/types.h"
+#include <vector>
+
+static constexpr DWORD kNotifyFilter =
+    FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+    FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
+    FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION;
+
+DirectoryWatcher::~DirectoryWatcher() {
+    Stop();
+}
+
+bool DirectoryWatcher::Start(const std::wstring& root, ChangeCallback cb) {
+    Stop();
+    dir_ = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+                       nullptr);
+    if (dir_ == INVALID_HANDLE_VALUE) return false;
+    io_event_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    stop_event_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!io_event_ || !stop_event_) {
+        Stop();
+        return false;
+    }
+    cb_ = std::move(cb);
+    thread_ = std::thread(&DirectoryWatcher::Run, this);
+    return true;
+}
+
+void DirectoryWatcher::Stop() {
+    if (thread_.joinable()) {
+        SetEvent(stop_event_);
+        thread_.join();
+    }
+    if (dir_ != INVALID_HANDLE_VALUE) CloseHandle(dir_);
+    if (io_event_) CloseHandle(io_event_);
+    if (stop_event_) CloseHandle(stop_event_);
+    dir_ = INVALID_HANDLE_VALUE;
+    io_event_ = nullptr;
+    stop_event_ = nullptr;
+}
+
+void DirectoryWatcher::Run() {
+    std::vector<DWORD> buf(kBufferSize / sizeof(DWORD));
+    OVERLAPPED ov{};
+    ov.hEvent = io_event_;
+
+    while (true) {
+        if (!ReadDirectoryChangesW(dir_, buf.data(), kBufferSize, TRUE, kNotifyFilter,
+                                   nullptr, &ov, nullptr)) {
+            LOG_WARN("DirectoryWatcher: ReadDirectoryChangesW failed (%lu)", GetLastError());
+            cb_(kStopped, {});
+            return;
+        }
+
+        HANDLE events[2] = {stop_event_, io_event_};
+        DWORD bytes = 0;
+        if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) {
+            CancelIoEx(dir_, &ov);
+            GetOverlappedResult(dir_, &ov, &bytes, TRUE);
+            return;
+        }
+        if (!GetOverlappedResult(dir_, &ov, &bytes, FALSE)) {
+            if (GetLastError() != ERROR_NOTIFY_ENUM_DIR) {
+                LOG_WARN("DirectoryWatcher: watch ended (%lu)", GetLastError());
+                cb_(kStopped, {});
+                return;
+            }
+            bytes = 0;
+        }
+        if (bytes == 0) {
+            cb_(kChangesLost, {});
+            continue;
+        }
+
+        auto* p = reinterpret_cast<const uint8_t*>(buf.data());
+        while (true) {
+            auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+            cb_(info->Action,
+                std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+            if (!info->NextEntryOffset) break;
+            p += info->NextEntryOffset;
+        }
+    }
+}
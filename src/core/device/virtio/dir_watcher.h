@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+
+#define NOMINMAX
+#include <windows.h>
+
+// Watches a directory tree with ReadDirectoryChangesW on a thread of its
+// own and reports each change by its path relative to the root.
+class DirectoryWatcher {
+public:
+    // Pseudo actions next to the FILE_ACTION_* codes.
+    static constexpr DWORD kChangesLost = 0;        // buffer overflowed
+    static constexpr DWORD kStopped = 0xFFFFFFFF;   // watching failed for good
+
+    using ChangeCallback = std::function<void(DWORD action, const std::wstring& name)>;
+
+    DirectoryWatcher() = default;
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // `cb` runs on the watcher thread.
+    bool Start(const std::wstring& root, ChangeCallback cb);
+    void Stop();
+
+private:
+    void Run();
+
+    HANDLE dir_ = INVALID_HANDLE_VALUE;
+    HANDLE io_event_ = nullptr;
+    HANDLE stop_event_ = nullptr;
+    std::thread thread_;
+    ChangeCallback cb_;
+
+    static constexpr DWORD kBufferSize = 64 * 1024;
+};
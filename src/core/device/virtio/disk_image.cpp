@@ -1,11 +1,44 @@
 #include "core/device/virtio/disk_image.h"
 #include "core/device/virtio/raw_image.h"
+#include "core/device/virtio/mapped_image.h"
 #include "core/device/virtio/qcow2.h"
 #include <cstdio>
+#include <algorithm>
+#include <vector>
 
 static constexpr uint32_t kQcow2Magic = 0x514649FB;
 
-std::unique_ptr<DiskImage> DiskImage::Create(const std::string& path) {
+bool DiskImage::ReadV(uint64_t offset, const DiskIoVec* iov, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!Read(offset, iov[i].base, iov[i].len)) return false;
+        offset += iov[i].len;
+    }
+    return true;
+}
+
+bool DiskImage::WriteV(uint64_t offset, const DiskIoVec* iov, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!Write(offset, iov[i].base, iov[i].len)) return false;
+        offset += iov[i].len;
+    }
+    return true;
+}
+
+bool DiskImage::WriteZeroes(uint64_t offset, uint64_t len, bool) {
+    std::vector<uint8_t> zeros(static_cast<size_t>(
+        std::min<uint64_t>(len, 1u << 20)), 0);
+    while (len > 0) {
+        uint32_t chunk = static_cast<uint32_t>(
+            std::min<uint64_t>(len, zeros.size()));
+        if (!Write(offset, zeros.data(), chunk)) return false;
+        offset += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+std::unique_ptr<DiskImage> DiskImage::Create(const std::string& path,
+                                             const DiskImageOptions& options) {
     FILE* f = fopen(path.c_str(), "rb");
     if (!f) {
         LOG_ERROR("DiskImage::Create: cannot open %s", path.c_str());
@@ -28,11 +61,15 @@ std::unique_ptr<DiskImage> DiskImage::Create(const std::string& path) {
     if (magic_be == kQcow2Magic) {
         LOG_INFO("DiskImage: detected qcow2 format");
         img = std::make_unique<Qcow2DiskImage>();
+    } else if (options.mmap_reads || (options.read_only && !options.direct_io)) {
+        // Read-only raw images are typically bases shared between VMs.
+        LOG_INFO("DiskImage: detected raw format, mapped reads");
+        img = std::make_unique<MappedDiskImage>();
     } else {
         LOG_INFO("DiskImage: detected raw format");
         img = std::make_unique<RawDiskImage>();
     }
 
-    if (!img->Open(path)) return nullptr;
+    if (!img->Open(path, options)) return nullptr;
     return img;
 }
@@ -4,16 +4,64 @@
 #include <string>
 #include <memory>
 
+// Per-VM knobs for how a disk image is opened on the host.
+struct DiskImageOptions {
+    // Bypass the host page cache (FILE_FLAG_NO_BUFFERING) for raw images.
+    bool direct_io = false;
+    // Serve raw image reads from mapped views of the file. Always on for
+    // read-only raw images without direct_io.
+    bool mmap_reads = false;
+    // qcow2 L2 table cache size in bytes; 0 sizes it to cover the image.
+    uint64_t qcow2_l2_cache_bytes = 0;
+    // qcow2 decompressed cluster cache size in bytes; 0 uses the default.
+    uint64_t qcow2_compressed_cache_bytes = 0;
+    // Open without write access (backing images shared between VMs).
+    bool read_only = false;
+    // Cap on the virtio-blk sequential readahead window; 0 disables it.
+    uint32_t readahead_window_bytes = 0;
+    // Seconds of boot whose reads are recorded next to the image and
+    // prefetched on the next open; 0 disables the boot profile.
+    uint32_t boot_profile_seconds = 0;
+    // Depth within a backing chain; guards against loops.
+    uint32_t chain_depth = 0;
+};
+
+// One guest buffer of a scatter-gather request.
+struct DiskIoVec {
+    void* base;
+    uint32_t len;
+};
+
 class DiskImage {
 public:
     virtual ~DiskImage() = default;
 
-    virtual bool Open(const std::string& path) = 0;
+    virtual bool Open(const std::string& path, const DiskImageOptions& options) = 0;
     virtual uint64_t GetSize() const = 0;
     virtual bool Read(uint64_t offset, void* buf, uint32_t len) = 0;
     virtual bool Write(uint64_t offset, const void* buf, uint32_t len) = 0;
     virtual bool Flush() = 0;
 
+    // Vectored I/O: the segments cover one contiguous range starting at
+    // `offset`. The default loops over Read/Write; backends override it to
+    // turn a whole request into as few host operations as possible.
+    virtual bool ReadV(uint64_t offset, const DiskIoVec* iov, size_t count);
+    virtual bool WriteV(uint64_t offset, const DiskIoVec* iov, size_t count);
+
+    // Deallocate a range. Contents afterwards are unspecified; backends may
+    // ignore parts they cannot release (e.g. partial clusters).
+    virtual bool Discard(uint64_t offset, uint64_t len) { return true; }
+    // Make a range read back as zeros. With `may_unmap` the backend may
+    // release the storage instead of writing zeros. The default writes zeros.
+    virtual bool WriteZeroes(uint64_t offset, uint64_t len, bool may_unmap);
+    virtual bool SupportsDiscard() const { return false; }
+    // Preferred alignment for Discard/WriteZeroes, in bytes.
+    virtual uint32_t GetDiscardGranularity() const { return 4096; }
+
+    // True if Read/Write/Flush may be called from several threads at once.
+    virtual bool SupportsConcurrentIo() const { return false; }
+
     // Auto-detect format by reading magic bytes and return the right backend.
-    static std::unique_ptr<DiskImage> Create(const std::string& path);
+    static std::unique_ptr<DiskImage> Create(const std::string& path,
+                                             const DiskImageOptions& options = {});
 };
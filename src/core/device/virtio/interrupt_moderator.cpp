@@ -0,0 +1,132 @@
+#include "core/device/virtio/interrupt_moderator.h"
+
+#include <windows.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+namespace {
+
+int64_t QpcNow() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+}  // namespace
+
+InterruptModerator::~InterruptModerator() {
+    Stop();
+}
+
+bool InterruptModerator::Start(uint32_t max_delay_us, uint32_t max_frames,
+                               FireHandler fire) {
+    if (IsRunning()) return true;
+    if (max_delay_us == 0 || !fire) return false;
+
+    // High-resolution timers (Windows 10 1803+) honour sub-millisecond
+    // delays; older hosts round up to the scheduler tick.
+    HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr,
+        CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer) timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+    if (!timer) {
+        LOG_ERROR("InterruptModerator: CreateWaitableTimer failed (%lu)",
+                  GetLastError());
+        return false;
+    }
+    HANDLE stop = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!stop) {
+        CloseHandle(timer);
+        return false;
+    }
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    qpc_freq_ = freq.QuadPart;
+    max_delay_us_ = max_delay_us;
+    max_delay_ticks_ = static_cast<uint64_t>(qpc_freq_) * max_delay_us / 1000000;
+    max_frames_ = max_frames ? max_frames : UINT32_MAX;
+    fire_ = std::move(fire);
+    pending_ = 0;
+    armed_ = false;
+    last_fire_ = 0;
+    stats_ = {};
+
+    timer_ = timer;
+    stop_event_ = stop;
+    thread_ = std::thread(&InterruptModerator::TimerThread, this);
+    return true;
+}
+
+void InterruptModerator::Stop() {
+    if (!IsRunning()) return;
+    SetEvent(reinterpret_cast<HANDLE>(stop_event_));
+    thread_.join();
+    CancelWaitableTimer(reinterpret_cast<HANDLE>(timer_));
+    CloseHandle(reinterpret_cast<HANDLE>(timer_));
+    CloseHandle(reinterpret_cast<HANDLE>(stop_event_));
+    timer_ = nullptr;
+    stop_event_ = nullptr;
+}
+
+void InterruptModerator::ArmTimer(uint64_t delay_us) {
+    // Relative due times are negative, in 100 ns units.
+    LARGE_INTEGER due;
+    due.QuadPart = -static_cast<int64_t>(delay_us * 10);
+    SetWaitableTimer(reinterpret_cast<HANDLE>(timer_), &due, 0, nullptr, nullptr, FALSE);
+}
+
+void InterruptModerator::Notify() {
+    int64_t now = QpcNow();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.notifications++;
+        pending_++;
+
+        bool quiet = !armed_ &&
+            static_cast<uint64_t>(now - last_fire_) >= max_delay_ticks_;
+        if (!quiet && pending_ < max_frames_) {
+            if (!armed_) {
+                armed_ = true;
+                ArmTimer(max_delay_us_);
+            }
+            return;
+        }
+
+        // A still-armed timer finds nothing pending and simply disarms.
+        pending_ = 0;
+        last_fire_ = now;
+        stats_.interrupts++;
+    }
+    fire_();
+}
+
+void InterruptModerator::TimerThread() {
+    HANDLE handles[] = {
+        reinterpret_cast<HANDLE>(stop_event_),
+        reinterpret_cast<HANDLE>(timer_),
+    };
+    for (;;) {
+        DWORD r = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        if (r != WAIT_OBJECT_0 + 1) return;
+
+        bool fire;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            armed_ = false;
+            fire = pending_ != 0;
+            if (fire) {
+                pending_ = 0;
+                last_fire_ = QpcNow();
+                stats_.interrupts++;
+            }
+        }
+        if (fire) fire_();
+    }
+}
+
+InterruptModerator::Stats InterruptModerator::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Interrupt moderation for one virtio device.
+//
+// The first notification after a quiet period fires at once, so a lightly
+// loaded device keeps its latency. Notifications arriving within
+// `max_delay_us` of the previous interrupt are held back until either
+// `max_frames` have accumulated or the delay expires on a high-resolution
+// timer, which bounds the interrupt rate under streaming load.
+class InterruptModerator {
+public:
+    using FireHandler = std::function<void()>;
+
+    struct Stats {
+        uint64_t notifications = 0;  // requests to interrupt
+        uint64_t interrupts = 0;     // interrupts actually raised
+    };
+
+    InterruptModerator() = default;
+    ~InterruptModerator();
+
+    InterruptModerator(const InterruptModerator&) = delete;
+    InterruptModerator& operator=(const InterruptModerator&) = delete;
+
+    // A zero delay disables moderation; Start() then fails and callers raise
+    // interrupts directly.
+    bool Start(uint32_t max_delay_us, uint32_t max_frames, FireHandler fire);
+    void Stop();
+    bool IsRunning() const { return thread_.joinable(); }
+
+    // Records one notification; may call the fire handler before returning.
+    void Notify();
+
+    Stats GetStats() const;
+
+private:
+    void TimerThread();
+    void ArmTimer(uint64_t delay_us);
+
+    uint64_t max_delay_ticks_ = 0;   // QPC ticks
+    uint32_t max_delay_us_ = 0;
+    uint32_t max_frames_ = 0;
+    int64_t qpc_freq_ = 0;
+    FireHandler fire_;
+
+    mutable std::mutex mutex_;
+    uint32_t pending_ = 0;
+    bool armed_ = false;
+    int64_t last_fire_ = 0;          // QPC timestamp of the last interrupt
+    Stats stats_;
+
+    void* timer_ = nullptr;          // HANDLE, waitable timer
+    void* stop_event_ = nullptr;     // HANDLE
+    std::thread thread_;
+};
@@ -0,0 +1,138 @@
+#include "core/device/virtio/mapped_image.h"
+#include <algorithm>
+#include <cstring>
+
+#include <windows.h>
+
+namespace {
+
+// A view of a file on a failing disk or a dropped share raises
+// EXCEPTION_IN_PAGE_ERROR instead of returning an error; turn that into a
+// failed read. Kept free of objects that need unwinding, as __try requires.
+bool CopyFromView(void* dst, const void* src, size_t len) {
+#ifdef _MSC_VER
+    __try {
+        memcpy(dst, src, len);
+    } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR
+                    ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+#else
+    memcpy(dst, src, len);
+#endif
+    return true;
+}
+
+}  // namespace
+
+MappedDiskImage::~MappedDiskImage() {
+    for (size_t i = 0; i < window_count_; i++) {
+        if (uint8_t* view = views_[i].load(std::memory_order_relaxed)) {
+            UnmapViewOfFile(view);
+        }
+    }
+    if (mapping_) CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+}
+
+bool MappedDiskImage::Open(const std::string& path, const DiskImageOptions& options) {
+    DiskImageOptions buffered = options;
+    buffered.direct_io = false;
+    if (!RawDiskImage::Open(path, buffered)) return false;
+
+    HANDLE mapping = CreateFileMappingW(reinterpret_cast<HANDLE>(handle()), nullptr,
+                                        PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        LOG_ERROR("MappedDiskImage: CreateFileMapping for %s failed (%lu)",
+                  path.c_str(), GetLastError());
+        return false;
+    }
+    mapping_ = mapping;
+    window_count_ = static_cast<size_t>((GetSize() + kWindowBytes - 1) / kWindowBytes);
+    views_ = std::make_unique<std::atomic<uint8_t*>[]>(window_count_);
+    for (size_t i = 0; i < window_count_; i++) {
+        views_[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    LOG_INFO("MappedDiskImage: %s, reads from %zu view(s) of up to %llu MB",
+             path.c_str(), window_count_, kWindowBytes >> 20);
+    return true;
+}
+
+const uint8_t* MappedDiskImage::ViewAt(uint64_t offset, uint64_t* avail) {
+    size_t index = static_cast<size_t>(offset / kWindowBytes);
+    uint64_t base = index * kWindowBytes;
+    uint64_t window_len = std::min(kWindowBytes, GetSize() - base);
+
+    uint8_t* view = views_[index].load(std::memory_order_acquire);
+    if (!view) {
+        std::lock_guard<std::mutex> lock(map_mutex_);
+        view = views_[index].load(std::memory_order_relaxed);
+        if (!view) {
+            view = static_cast<uint8_t*>(MapViewOfFile(
+                reinterpret_cast<HANDLE>(mapping_), FILE_MAP_READ,
+                static_cast<DWORD>(base >> 32), static_cast<DWORD>(base),
+                static_cast<SIZE_T>(window_len)));
+            if (!view) {
+                LOG_ERROR("MappedDiskImage: MapViewOfFile at 0x%llX failed (%lu)",
+                          base, GetLastError());
+                return nullptr;
+            }
+            views_[index].store(view, std::memory_order_release);
+        }
+    }
+    *avail = window_len - (offset - base);
+    return view + (offset - base);
+}
+
+bool MappedDiskImage::CopyOut(uint64_t offset, uint8_t* dst, uint32_t len) {
+    while (len > 0) {
+        uint64_t avail = 0;
+        const uint8_t* src = ViewAt(offset, &avail);
+        if (!src) return false;
+        uint32_t chunk = static_cast<uint32_t>(std::min<uint64_t>(len, avail));
+        if (!CopyFromView(dst, src, chunk)) {
+            LOG_ERROR("MappedDiskImage: page error reading 0x%llX (%u bytes)",
+                      offset, chunk);
+            return false;
+        }
+        offset += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+void MappedDiskImage::Prefetch(uint64_t offset, uint64_t len) {
+    if (len < kPrefetchBytes) return;
+    // One paging read for the whole range instead of a fault per page;
+    // advisory, so a failure changes nothing.
+    while (len > 0) {
+        uint64_t avail = 0;
+        const uint8_t* src = ViewAt(offset, &avail);
+        if (!src) return;
+        uint64_t chunk = std::min(len, avail);
+        WIN32_MEMORY_RANGE_ENTRY range{const_cast<uint8_t*>(src),
+                                       static_cast<SIZE_T>(chunk)};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+        offset += chunk;
+        len -= chunk;
+    }
+}
+
+bool MappedDiskImage::Read(uint64_t offset, void* buf, uint32_t len) {
+    if (offset + len > GetSize()) return false;
+    Prefetch(offset, len);
+    return CopyOut(offset, static_cast<uint8_t*>(buf), len);
+}
+
+bool MappedDiskImage::ReadV(uint64_t offset, const DiskIoVec* iov, size_t count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) total += iov[i].len;
+    if (offset + total > GetSize()) return false;
+    Prefetch(offset, total);
+    for (size_t i = 0; i < count; i++) {
+        if (!CopyOut(offset, static_cast<uint8_t*>(iov[i].base), iov[i].len)) return false;
+        offset += iov[i].len;
+    }
+    return true;
+}
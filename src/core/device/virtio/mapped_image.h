@@ -0,0 +1,43 @@
+#pragma once
+
+#include "core/device/virtio/raw_image.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+// Raw image whose reads are memcpy()s out of read-only views of the file,
+// for base images and data disks that are mostly read. A request costs no
+// system call once its pages are resident, and because every mapping of a
+// file is backed by the same section, all VMs reading one base image share
+// its physical pages with each other and with the host cache.
+//
+// Views cover kWindowBytes each and are mapped the first time a read
+// touches them, then stay until close. Writes, flushes and discards go
+// through RawDiskImage's handle; buffered file I/O and mapped views see
+// the same pages, so reads after a write return the new data.
+class MappedDiskImage : public RawDiskImage {
+public:
+    static constexpr uint64_t kWindowBytes = 1ULL << 30;
+    // Reads this large fault their pages in with one prefetch first.
+    static constexpr uint32_t kPrefetchBytes = 256 * 1024;
+
+    ~MappedDiskImage() override;
+
+    // Ignores options.direct_io; unbuffered handles cannot be mapped.
+    bool Open(const std::string& path, const DiskImageOptions& options) override;
+    bool Read(uint64_t offset, void* buf, uint32_t len) override;
+    bool ReadV(uint64_t offset, const DiskIoVec* iov, size_t count) override;
+
+private:
+    // Pointer to `offset` inside its view, mapping it if needed. `avail`
+    // gets the bytes left in the view from there.
+    const uint8_t* ViewAt(uint64_t offset, uint64_t* avail);
+    bool CopyOut(uint64_t offset, uint8_t* dst, uint32_t len);
+    void Prefetch(uint64_t offset, uint64_t len);
+
+    void* mapping_ = nullptr;  // HANDLE from CreateFileMapping
+    size_t window_count_ = 0;
+    // Published with release once mapped; readers never take the lock.
+    std::unique_ptr<std::atomic<uint8_t*>[]> views_;
+    std::mutex map_mutex_;
+};
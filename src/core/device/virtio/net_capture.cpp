@@ -0,0 +1,323 @@
+#include "core/device/virtio/net_capture.h"
+#include "core/vmm/utf8.h"
+#include "core/device/virtio/virtio_net.h"
+#include "core/vmm/types.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include <windows.h>
+
+namespace {
+
+// pcapng blocks (draft-ietf-opsawg-pcapng). The file is one section
+// header, one Ethernet interface, then the ring of slots.
+constexpr uint32_t kShbType = 0x0A0D0D0A;
+constexpr uint32_t kIdbType = 1;
+constexpr uint32_t kEpbType = 6;
+constexpr uint32_t kCustomType = 0x00000BAD;
+constexpr uint32_t kByteOrderMagic = 0x1A2B3C4D;
+constexpr uint16_t kLinkTypeEthernet = 1;
+constexpr uint16_t kOptEpbFlags = 2;
+constexpr uint32_t kEpbInbound = 1;
+constexpr uint32_t kEpbOutbound = 2;
+// IANA's example enterprise number, for the placeholder custom blocks.
+constexpr uint32_t kPlaceholderPen = 32473;
+
+constexpr uint32_t kShbSize = 28;
+constexpr uint32_t kIdbSize = 20;
+constexpr uint32_t kRingOffset = kShbSize + kIdbSize;
+// Type, length, interface, timestamp (2), captured and original length.
+constexpr uint32_t kEpbHeaderSize = 28;
+// epb_flags, opt_endofopt, trailing length.
+constexpr uint32_t kEpbTrailerSize = 8 + 4 + 4;
+
+constexpr uint32_t kMaxRingMb = 4096;
+constexpr uint64_t kMinSlots = 16;
+
+uint32_t Pad4(uint32_t n) { return (n + 3) & ~3u; }
+
+void Put16(uint8_t* p, uint16_t v) { std::memcpy(p, &v, sizeof(v)); }
+void Put32(uint8_t* p, uint32_t v) { std::memcpy(p, &v, sizeof(v)); }
+
+// Microseconds since 1970, pcapng's default timestamp resolution.
+uint64_t UnixMicros() {
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    uint64_t t = (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    return (t - 116444736000000000ULL) / 10;
+}
+
+// Readers skip a block they do not know by its length, so the type is the
+// one field that makes a slot a frame. It is written last.
+std::atomic_ref<uint32_t> SlotType(uint8_t* slot) {
+    return std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(slot));
+}
+
+void WritePlaceholder(uint8_t* slot, uint32_t size) {
+    Put32(slot, kCustomType);
+    Put32(slot + 4, size);
+    Put32(slot + 8, kPlaceholderPen);
+    Put32(slot + size - 4, size);
+}
+
+uint32_t Be16(const uint8_t* p) { return static_cast<uint32_t>(p[0] << 8 | p[1]); }
+uint32_t Be32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+}  // namespace
+
+NetCapture::~NetCapture() {
+    Stop();
+}
+
+bool NetCapture::ParseFilter(const std::string& text, Filter* filter, std::string* error) {
+    *filter = Filter{};
+    std::istringstream in(text);
+    std::string term;
+    auto set_ip_proto = [filter](uint8_t proto) {
+        filter->ethertype = 0x0800;
+        filter->proto = proto;
+    };
+    while (in >> term) {
+        if (term == "tcp") {
+            set_ip_proto(6);
+        } else if (term == "udp") {
+            set_ip_proto(17);
+        } else if (term == "icmp") {
+            set_ip_proto(1);
+        } else if (term == "ip") {
+            filter->ethertype = 0x0800;
+        } else if (term == "arp") {
+            filter->ethertype = 0x0806;
+        } else if (term == "rx") {
+            filter->from_guest = false;
+        } else if (term == "tx") {
+            filter->to_guest = false;
+        } else if (term == "host") {
+            std::string value;
+            unsigned a, b, c, d;
+            char extra;
+            if (!(in >> value) ||
+                std::sscanf(value.c_str(), "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 ||
+                a > 255 || b > 255 || c > 255 || d > 255) {
+                *error = "filter: host needs an IPv4 address";
+                return false;
+            }
+            filter->ethertype = 0x0800;
+            filter->host = a << 24 | b << 16 | c << 8 | d;
+        } else if (term == "port") {
+            std::string value;
+            char* end = nullptr;
+            unsigned long port = 0;
+            if (in >> value) port = std::strtoul(value.c_str(), &end, 10);
+            if (!end || *end || port == 0 || port > 65535) {
+                *error = "filter: port needs a number from 1 to 65535";
+                return false;
+            }
+            filter->ethertype = 0x0800;
+            filter->port = static_cast<uint16_t>(port);
+        } else {
+            *error = "filter: unknown term '" + term + "'";
+            return false;
+        }
+    }
+    if (!filter->to_guest && !filter->from_guest) {
+        *error = "filter: rx and tx exclude each other";
+        return false;
+    }
+    return true;
+}
+
+bool NetCapture::Matches(Direction dir, const uint8_t* frame, uint32_t len) const {
+    if (dir == Direction::kToGuest ? !filter_.to_guest : !filter_.from_guest) return false;
+    if (!filter_.ethertype) return true;
+    if (len < 14 || Be16(frame + 12) != filter_.ethertype) return false;
+    if (!filter_.proto && !filter_.host && !filter_.port) return true;
+
+    if (len < 14 + 20) return false;
+    const uint8_t* ip = frame + 14;
+    uint32_t ihl = (ip[0] & 0xF) * 4;
+    uint8_t proto = ip[9];
+    if (filter_.proto && proto != filter_.proto) return false;
+    if (filter_.host && Be32(ip + 12) != filter_.host && Be32(ip + 16) != filter_.host)
+        return false;
+    if (filter_.port) {
+        // Later fragments carry no ports.
+        if ((proto != 6 && proto != 17) || ihl < 20 || len < 14 + ihl + 4 ||
+            (Be16(ip + 6) & 0x1FFF) != 0) {
+            return false;
+        }
+        const uint8_t* l4 = ip + ihl;
+        if (Be16(l4) != filter_.port && Be16(l4 + 2) != filter_.port) return false;
+    }
+    return true;
+}
+
+bool NetCapture::Start(const NetCaptureOptions& options, std::string* error) {
+    Stop();
+
+    Filter filter;
+    if (!ParseFilter(options.filter, &filter, error)) return false;
+    uint32_t snaplen = options.snaplen ? std::min(options.snaplen, kMaxSnaplen) : kDefaultSnaplen;
+    uint32_t ring_mb = options.ring_mb ? std::min(options.ring_mb, kMaxRingMb) : kDefaultRingMb;
+    uint32_t slot_size = kEpbHeaderSize + Pad4(snaplen) + kEpbTrailerSize;
+    uint64_t slots = std::max((static_cast<uint64_t>(ring_mb) << 20) / slot_size, kMinSlots);
+    uint64_t size = kRingOffset + slots * slot_size;
+
+    HANDLE file = CreateFileW(Utf8ToWide(options.path).c_str(), GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        *error = "cannot create " + options.path;
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                        static_cast<DWORD>(size >> 32),
+                                        static_cast<DWORD>(size), nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+    if (!view) {
+        *error = "cannot map " + options.path;
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    auto* p = static_cast<uint8_t*>(view);
+    Put32(p, kShbType);
+    Put32(p + 4, kShbSize);
+    Put32(p + 8, kByteOrderMagic);
+    Put16(p + 12, 1);                  // major version
+    Put16(p + 14, 0);                  // minor version
+    std::memset(p + 16, 0xFF, 8);      // section length unknown
+    Put32(p + 24, kShbSize);
+    uint8_t* idb = p + kShbSize;
+    Put32(idb, kIdbType);
+    Put32(idb + 4, kIdbSize);
+    Put16(idb + 8, kLinkTypeEthernet);
+    Put16(idb + 10, 0);
+    Put32(idb + 12, snaplen);
+    Put32(idb + 16, kIdbSize);
+    uint8_t* ring = p + kRingOffset;
+    for (uint64_t i = 0; i < slots; i++) WritePlaceholder(ring + i * slot_size, slot_size);
+
+    file_ = file;
+    mapping_ = mapping;
+    view_ = p;
+    ring_ = ring;
+    path_ = options.path;
+    filter_ = filter;
+    snaplen_ = snaplen;
+    slot_size_ = slot_size;
+    slots_ = slots;
+    next_.store(0, std::memory_order_relaxed);
+    active_.store(true, std::memory_order_release);
+    LOG_INFO("Net capture: recording to %s (snaplen %u, %llu frames%s%s)",
+             path_.c_str(), snaplen, static_cast<unsigned long long>(slots),
+             options.filter.empty() ? "" : ", filter ", options.filter.c_str());
+    return true;
+}
+
+void NetCapture::Stop() {
+    if (!active_.exchange(false)) return;
+    while (writers_.load()) std::this_thread::yield();
+    Close();
+}
+
+void NetCapture::Close() {
+    uint64_t written = next_.load(std::memory_order_relaxed);
+    uint64_t used = std::min(written, slots_);
+    // After wrapping, the oldest frame sits where the next write would go.
+    if (written > slots_) {
+        uint64_t oldest = written % slots_;
+        std::rotate(ring_, ring_ + oldest * slot_size_, ring_ + slots_ * slot_size_);
+    }
+    FlushViewOfFile(view_, 0);
+    UnmapViewOfFile(view_);
+    CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+
+    // Drop the slots nothing was written to.
+    HANDLE file = reinterpret_cast<HANDLE>(file_);
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(kRingOffset + used * slot_size_);
+    if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+        LOG_WARN("Net capture: cannot trim %s (%lu)", path_.c_str(), GetLastError());
+    }
+    CloseHandle(file);
+    LOG_INFO("Net capture: %llu frames captured to %s%s",
+             static_cast<unsigned long long>(written), path_.c_str(),
+             written > slots_ ? " (oldest overwritten)" : "");
+
+    file_ = nullptr;
+    mapping_ = nullptr;
+    view_ = nullptr;
+    ring_ = nullptr;
+}
+
+void NetCapture::RecordSlow(Direction dir, const NetTxSegment* segs, size_t count,
+                            const uint8_t* frame, uint32_t len) {
+    writers_.fetch_add(1);
+    if (!active_.load()) {
+        writers_.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    // Gathers the start of a TX frame from its guest segments.
+    auto gather = [segs, count](uint8_t* out, uint32_t want) {
+        uint32_t got = 0;
+        for (size_t i = 0; i < count && got < want; i++) {
+            uint32_t n = std::min(segs[i].len, want - got);
+            std::memcpy(out + got, segs[i].addr, n);
+            got += n;
+        }
+    };
+    uint8_t headers[14 + 60 + 4];
+    const uint8_t* head = frame;
+    uint32_t head_len = len;
+    if (!frame) {
+        head_len = std::min<uint32_t>(len, sizeof(headers));
+        gather(headers, head_len);
+        head = headers;
+    }
+    if (!filter_.empty() && !Matches(dir, head, head_len)) {
+        writers_.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    uint64_t ts = UnixMicros();
+    uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    uint8_t* slot = ring_ + (index % slots_) * slot_size_;
+    // Back to a placeholder while the rest changes, in case the slot is
+    // being reused.
+    SlotType(slot).store(kCustomType, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t caplen = std::min(len, snaplen_);
+    Put32(slot + 8, 0);  // interface
+    Put32(slot + 12, static_cast<uint32_t>(ts >> 32));
+    Put32(slot + 16, static_cast<uint32_t>(ts));
+    Put32(slot + 20, caplen);
+    Put32(slot + 24, len);
+    uint8_t* data = slot + kEpbHeaderSize;
+    if (frame) {
+        std::memcpy(data, frame, caplen);
+    } else {
+        gather(data, caplen);
+    }
+    std::memset(data + caplen, 0, Pad4(caplen) - caplen);
+    // Options follow the padded data; the slot's remaining bytes come
+    // after opt_endofopt, where readers stop looking.
+    uint8_t* opt = data + Pad4(caplen);
+    Put16(opt, kOptEpbFlags);
+    Put16(opt + 2, 4);
+    Put32(opt + 4, dir == Direction::kToGuest ? kEpbInbound : kEpbOutbound);
+    Put32(opt + 8, 0);  // opt_endofopt
+    SlotType(slot).store(kEpbType, std::memory_order_release);
+
+    writers_.fetch_sub(1, std::memory_order_release);
+}
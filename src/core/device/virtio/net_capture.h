@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+struct NetTxSegment;
+
+struct NetCaptureOptions {
+    std::string path;
+    uint32_t snaplen = 0;  // bytes kept per frame; 0 = kDefaultSnaplen
+    uint32_t ring_mb = 0;  // file size; 0 = kDefaultRingMb
+    // Terms that must all match, e.g. "tcp port 22" or "rx udp host 1.1.1.1":
+    // tcp, udp, icmp, arp, host A.B.C.D, port N, and rx or tx for frames
+    // to or from the guest. Empty captures everything.
+    std::string filter;
+};
+
+// Copies virtio-net frames into a ring of fixed-size slots in a
+// memory-mapped pcapng file. Every slot is a complete pcapng block, so the
+// file opens in Wireshark at any time, even after the runtime crashed;
+// slots not yet written hold custom blocks that readers skip. Once the
+// ring is full the oldest frames are overwritten. Stop() puts the frames
+// in time order and trims unused slots.
+//
+// Writers claim a slot with one atomic add and never take a lock, so the
+// TX path of every queue pair and the RX path record concurrently. While
+// stopped, recording costs one relaxed load.
+class NetCapture {
+public:
+    static constexpr uint32_t kDefaultSnaplen = 256;
+    static constexpr uint32_t kMaxSnaplen = 65536;
+    static constexpr uint32_t kDefaultRingMb = 64;
+
+    enum class Direction { kToGuest, kFromGuest };
+
+    NetCapture() = default;
+    ~NetCapture();
+
+    NetCapture(const NetCapture&) = delete;
+    NetCapture& operator=(const NetCapture&) = delete;
+
+    // Replaces any capture in progress.
+    bool Start(const NetCaptureOptions& options, std::string* error);
+    // Waits for writers still copying a frame, then closes the file.
+    void Stop();
+    bool IsActive() const { return active_.load(std::memory_order_relaxed); }
+
+    // A frame the guest sent, still in guest memory.
+    void Record(const NetTxSegment* segs, size_t count, uint32_t len) {
+        if (IsActive()) RecordSlow(Direction::kFromGuest, segs, count, nullptr, len);
+    }
+    // A frame for the guest.
+    void Record(const uint8_t* frame, uint32_t len) {
+        if (IsActive()) RecordSlow(Direction::kToGuest, nullptr, 0, frame, len);
+    }
+
+private:
+    struct Filter {
+        bool to_guest = true;
+        bool from_guest = true;
+        uint16_t ethertype = 0;  // 0 = any
+        uint8_t proto = 0;       // IPv4 protocol, 0 = any
+        uint32_t host = 0;       // either address, host byte order; 0 = any
+        uint16_t port = 0;       // either TCP/UDP port; 0 = any
+        bool empty() const {
+            return to_guest && from_guest && !ethertype && !proto && !host && !port;
+        }
+    };
+    static bool ParseFilter(const std::string& text, Filter* filter, std::string* error);
+    bool Matches(Direction dir, const uint8_t* frame, uint32_t len) const;
+
+    void RecordSlow(Direction dir, const NetTxSegment* segs, size_t count,
+                    const uint8_t* frame, uint32_t len);
+    void Close();
+
+    // Writers announce themselves before rechecking active_, so Stop()
+    // can wait for the ones that saw it set.
+    std::atomic<bool> active_{false};
+    std::atomic<uint32_t> writers_{0};
+    std::atomic<uint64_t> next_{0};  // slots claimed so far
+
+    Filter filter_;
+    uint32_t snaplen_ = 0;
+    uint32_t slot_size_ = 0;
+    uint64_t slots_ = 0;
+    std::string path_;
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+    uint8_t* view_ = nullptr;
+    uint8_t* ring_ = nullptr;
+};
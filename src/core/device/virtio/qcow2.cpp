@@ -1,10 +1,16 @@
 #include "core/device/virtio/qcow2.h"
+#include "core/device/virtio/raw_image.h"
 #include <cstring>
 #include <algorithm>
 #include <cstdlib>
+#include <new>
+#include <bit>
 
 #ifdef _WIN32
 #include <intrin.h>
+#include <io.h>
+#include <windows.h>
+#include <winioctl.h>
 #else
 #include <byteswap.h>
 #endif
@@ -45,25 +51,42 @@ uint64_t Qcow2DiskImage::Be64(uint64_t v) {
 Qcow2DiskImage::~Qcow2DiskImage() {
     if (file_) {
         Flush();
+        LOG_INFO("Qcow2: L2 cache hits %llu, misses %llu, evictions %llu",
+                 l2_stats_.hits, l2_stats_.misses, l2_stats_.evictions);
+        if (zcache_stats_.misses) {
+            LOG_INFO("Qcow2: compressed cache hits %llu, misses %llu",
+                     zcache_stats_.hits, zcache_stats_.misses);
+        }
         fclose(file_);
         file_ = nullptr;
     }
+    if (inflate_) {
+        inflateEnd(inflate_);
+        delete inflate_;
+    }
+    if (zstd_dctx_) ZSTD_freeDCtx(zstd_dctx_);
 }
 
-bool Qcow2DiskImage::Open(const std::string& path) {
-    file_ = fopen(path.c_str(), "r+b");
+bool Qcow2DiskImage::Open(const std::string& path, const DiskImageOptions& options) {
+    if (options.direct_io) {
+        LOG_WARN("Qcow2: direct I/O not supported, using buffered I/O");
+    }
+
+    read_only_ = options.read_only;
+    file_ = fopen(path.c_str(), read_only_ ? "rb" : "r+b");
     if (!file_) {
         LOG_ERROR("Qcow2: failed to open %s", path.c_str());
         return false;
     }
 
-    if (!ReadHeader()) {
+    if (!ReadHeader() || !OpenBacking(path, options)) {
         fclose(file_);
         file_ = nullptr;
         return false;
     }
 
-    if (!ReadL1Table()) {
+    InitCompressedCache(options.qcow2_compressed_cache_bytes);
+    if (!ReadL1Table() || !InitL2Cache(options.qcow2_l2_cache_bytes)) {
         fclose(file_);
         file_ = nullptr;
         return false;
@@ -75,11 +98,18 @@ bool Qcow2DiskImage::Open(const std::string& path) {
     // Align to cluster boundary
     file_end_ = (file_end_ + cluster_size_ - 1) & ~(static_cast<uint64_t>(cluster_size_) - 1);
 
+    if (!read_only_ && !LoadRefcounts()) {
+        fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+
     LOG_INFO("Qcow2: %s, version %u, cluster_size %u, virtual_size %llu MB, "
-             "l1_size %u, file_end 0x%llX, compression %s",
+             "l1_size %u, file_end 0x%llX, compression %s, L2 cache %u tables%s",
              path.c_str(), version_, cluster_size_,
              virtual_size_ / (1024 * 1024), l1_size_, file_end_,
-             compression_type_ == 1 ? "zstd" : "zlib");
+             compression_type_ == 1 ? "zstd" : "zlib", l2_stats_.capacity,
+             read_only_ ? ", read-only" : "");
     return true;
 }
 
@@ -104,11 +134,6 @@ bool Qcow2DiskImage::ReadHeader() {
         return false;
     }
 
-    if (Be64(hdr.backing_file_offset) != 0) {
-        LOG_ERROR("Qcow2: backing files not supported");
-        return false;
-    }
-
     if (Be32(hdr.crypt_method) != 0) {
         LOG_ERROR("Qcow2: encrypted images not supported");
         return false;
@@ -125,6 +150,10 @@ bool Qcow2DiskImage::ReadHeader() {
     virtual_size_ = Be64(hdr.size);
     l1_size_ = Be32(hdr.l1_size);
     l1_table_offset_ = Be64(hdr.l1_table_offset);
+    refcount_table_offset_ = Be64(hdr.refcount_table_offset);
+    refcount_table_clusters_ = Be32(hdr.refcount_table_clusters);
+    nb_snapshots_ = Be32(hdr.nb_snapshots);
+    refcount_order_ = version_ == 3 ? Be32(hdr.refcount_order) : 4;
 
     // Read compression_type for qcow2 v3 (offset 104, requires header_length >= 108)
     compression_type_ = 0;  // default: zlib (DEFLATE)
@@ -143,6 +172,105 @@ bool Qcow2DiskImage::ReadHeader() {
         }
     }
 
+    uint64_t backing_off = Be64(hdr.backing_file_offset);
+    uint32_t backing_len = Be32(hdr.backing_file_size);
+    uint64_t ext_start = version_ == 3 ? Be32(hdr.header_length) : 72;
+    uint64_t ext_end = backing_off ? backing_off : cluster_size_;
+    if (!ReadHeaderExtensions(ext_start, ext_end)) return false;
+
+    if (backing_off != 0) {
+        if (backing_len == 0 || backing_len > 1023) {
+            LOG_ERROR("Qcow2: invalid backing file name length %u", backing_len);
+            return false;
+        }
+        backing_name_.resize(backing_len);
+        _fseeki64(file_, backing_off, SEEK_SET);
+        if (fread(backing_name_.data(), 1, backing_len, file_) != backing_len) {
+            LOG_ERROR("Qcow2: failed to read backing file name");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Qcow2DiskImage::ReadHeaderExtensions(uint64_t start, uint64_t end) {
+    uint64_t pos = start;
+    while (pos + 8 <= end) {
+        uint32_t ext[2] = {};
+        _fseeki64(file_, pos, SEEK_SET);
+        if (fread(ext, sizeof(uint32_t), 2, file_) != 2) break;
+        uint32_t type = Be32(ext[0]);
+        uint32_t len = Be32(ext[1]);
+        if (type == 0) break;  // end of extensions
+        if (pos + 8 + len > end) {
+            LOG_ERROR("Qcow2: header extension 0x%08X overruns header", type);
+            return false;
+        }
+
+        if (type == kExtBackingFormat && len > 0 && len < 16) {
+            backing_format_.resize(len);
+            if (fread(backing_format_.data(), 1, len, file_) != len) return false;
+        }
+        pos += 8 + ((static_cast<uint64_t>(len) + 7) & ~7ULL);
+    }
+    return true;
+}
+
+bool Qcow2DiskImage::OpenBacking(const std::string& path,
+                                 const DiskImageOptions& options) {
+    if (backing_name_.empty()) return true;
+
+    if (options.chain_depth + 1 >= kMaxBackingDepth) {
+        LOG_ERROR("Qcow2: backing chain deeper than %u images", kMaxBackingDepth);
+        return false;
+    }
+
+    // Relative names are relative to the directory of the overlay.
+    std::string backing_path = backing_name_;
+    bool absolute = backing_path[0] == '/' || backing_path[0] == '\\' ||
+                    (backing_path.size() > 1 && backing_path[1] == ':');
+    size_t slash = path.find_last_of("/\\");
+    if (!absolute && slash != std::string::npos) {
+        backing_path = path.substr(0, slash + 1) + backing_path;
+    }
+
+    DiskImageOptions backing_options;
+    backing_options.read_only = true;
+    backing_options.chain_depth = options.chain_depth + 1;
+    backing_options.qcow2_l2_cache_bytes = options.qcow2_l2_cache_bytes;
+    backing_options.qcow2_compressed_cache_bytes = options.qcow2_compressed_cache_bytes;
+
+    // A declared raw format is never probed: a guest could have written a
+    // qcow2 header into it.
+    if (backing_format_ == "raw") {
+        backing_ = std::make_unique<RawDiskImage>();
+        if (!backing_->Open(backing_path, backing_options)) backing_.reset();
+    } else if (backing_format_.empty() || backing_format_ == "qcow2") {
+        backing_ = DiskImage::Create(backing_path, backing_options);
+    } else {
+        LOG_ERROR("Qcow2: unsupported backing format '%s'", backing_format_.c_str());
+        return false;
+    }
+
+    if (!backing_) {
+        LOG_ERROR("Qcow2: failed to open backing file %s", backing_path.c_str());
+        return false;
+    }
+    backing_size_ = backing_->GetSize();
+    LOG_INFO("Qcow2: backing file %s (%llu MB)", backing_path.c_str(),
+             backing_size_ / (1024 * 1024));
+    return true;
+}
+
+bool Qcow2DiskImage::ReadBacking(uint64_t offset, void* buf, uint32_t len) {
+    uint32_t from_backing = 0;
+    if (backing_ && offset < backing_size_) {
+        from_backing = static_cast<uint32_t>(
+            std::min<uint64_t>(len, backing_size_ - offset));
+        if (!backing_->Read(offset, buf, from_backing)) return false;
+    }
+    memset(static_cast<uint8_t*>(buf) + from_backing, 0, len - from_backing);
     return true;
 }
 
@@ -160,73 +288,210 @@ bool Qcow2DiskImage::ReadL1Table() {
     for (uint32_t i = 0; i < l1_size_; i++) {
         l1_table_[i] = Be64(l1_table_[i]);
     }
+    l1_dirty_.assign(l1_size_, 0);
     return true;
 }
 
 // ---------- L2 cache ----------
 
-uint64_t* Qcow2DiskImage::GetL2Table(uint64_t l2_offset) {
-    auto it = l2_map_.find(l2_offset);
-    if (it != l2_map_.end()) {
-        // Move to front (most recently used)
-        l2_lru_.splice(l2_lru_.begin(), l2_lru_, it->second);
-        return it->second->data.data();
+bool Qcow2DiskImage::InitL2Cache(uint64_t cache_bytes) {
+    uint64_t table_bytes = static_cast<uint64_t>(l2_entries_) * sizeof(uint64_t);
+    if (cache_bytes == 0) {
+        uint64_t coverage = static_cast<uint64_t>(l2_entries_) * cluster_size_;
+        uint64_t tables = (virtual_size_ + coverage - 1) / coverage;
+        cache_bytes = std::min(tables * table_bytes, kL2CacheDefaultMaxBytes);
+    }
+
+    // Never more slots than there are L1 entries to point at tables.
+    uint64_t max_tables = std::max(l1_size_, kL2CacheMinTables);
+    uint32_t capacity = static_cast<uint32_t>(std::clamp<uint64_t>(
+        cache_bytes / table_bytes, kL2CacheMinTables, max_tables));
+
+    // Keep the index at most half full so probe chains stay short.
+    uint32_t index_size = 1;
+    while (index_size < capacity * 2) index_size <<= 1;
+
+    uint32_t chunks = l2_entries_ / kL2DirtyChunkEntries;
+    l2_dirty_words_ = (chunks + 63) / 64;
+    try {
+        l2_slab_.assign(static_cast<size_t>(capacity) * l2_entries_, 0);
+        l2_slots_.assign(capacity, L2Slot{});
+        l2_index_.assign(index_size, kNoSlot);
+        l2_dirty_bits_.assign(static_cast<size_t>(capacity) * l2_dirty_words_, 0);
+        l2_be_buf_.assign(l2_entries_, 0);
+    } catch (const std::bad_alloc&) {
+        LOG_ERROR("Qcow2: cannot allocate %u L2 cache tables", capacity);
+        return false;
+    }
+    l2_index_mask_ = index_size - 1;
+    l2_clock_hand_ = 0;
+    l2_stats_ = {};
+    l2_stats_.capacity = capacity;
+    return true;
+}
+
+Qcow2DiskImage::L2CacheStats Qcow2DiskImage::GetL2CacheStats() const {
+    return l2_stats_;
+}
+
+uint32_t Qcow2DiskImage::L2IndexHome(uint64_t l2_offset) const {
+    // L2 tables are cluster aligned; hash the cluster number (Fibonacci).
+    uint64_t key = (l2_offset >> cluster_bits_) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<uint32_t>(key >> 32) & l2_index_mask_;
+}
+
+uint32_t Qcow2DiskImage::FindL2Slot(uint64_t l2_offset) const {
+    for (uint32_t pos = L2IndexHome(l2_offset);; pos = (pos + 1) & l2_index_mask_) {
+        uint32_t slot = l2_index_[pos];
+        if (slot == kNoSlot) return kNoSlot;
+        if (l2_slots_[slot].l2_offset == l2_offset) return slot;
+    }
+}
+
+void Qcow2DiskImage::L2IndexInsert(uint64_t l2_offset, uint32_t slot) {
+    uint32_t pos = L2IndexHome(l2_offset);
+    while (l2_index_[pos] != kNoSlot) pos = (pos + 1) & l2_index_mask_;
+    l2_index_[pos] = slot;
+}
+
+void Qcow2DiskImage::L2IndexErase(uint64_t l2_offset) {
+    uint32_t pos = L2IndexHome(l2_offset);
+    while (l2_index_[pos] != kNoSlot &&
+           l2_slots_[l2_index_[pos]].l2_offset != l2_offset) {
+        pos = (pos + 1) & l2_index_mask_;
+    }
+    if (l2_index_[pos] == kNoSlot) return;
+
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole unless their home lies cyclically in (hole, candidate].
+    uint32_t hole = pos;
+    for (uint32_t next = (hole + 1) & l2_index_mask_;
+         l2_index_[next] != kNoSlot; next = (next + 1) & l2_index_mask_) {
+        uint32_t home = L2IndexHome(l2_slots_[l2_index_[next]].l2_offset);
+        bool stays = hole <= next ? (home > hole && home <= next)
+                                  : (home > hole || home <= next);
+        if (stays) continue;
+        l2_index_[hole] = l2_index_[next];
+        hole = next;
+    }
+    l2_index_[hole] = kNoSlot;
+}
+
+bool Qcow2DiskImage::WriteBackL2Slot(uint32_t slot) {
+    auto& s = l2_slots_[slot];
+    if (!s.valid || !s.dirty) return true;
+
+    const uint64_t* data = L2SlotData(slot);
+    uint64_t* bits = L2DirtyBits(slot);
+    uint32_t chunks = l2_entries_ / kL2DirtyChunkEntries;
+    auto dirty = [bits](uint32_t c) { return (bits[c / 64] >> (c % 64)) & 1; };
+    for (uint32_t c = 0; c < chunks;) {
+        if (!dirty(c)) {
+            c++;
+            continue;
+        }
+        uint32_t end = c + 1;
+        while (end < chunks && dirty(end)) end++;
+
+        uint32_t first = c * kL2DirtyChunkEntries;
+        uint32_t count = (end - c) * kL2DirtyChunkEntries;
+        for (uint32_t i = 0; i < count; i++) l2_be_buf_[i] = Be64(data[first + i]);
+        _fseeki64(file_, s.l2_offset + static_cast<uint64_t>(first) * sizeof(uint64_t),
+                  SEEK_SET);
+        if (fwrite(l2_be_buf_.data(), sizeof(uint64_t), count, file_) != count) {
+            LOG_ERROR("Qcow2: failed to write L2 table at 0x%llX", s.l2_offset);
+            return false;
+        }
+        c = end;
+    }
+    std::fill(bits, bits + l2_dirty_words_, 0);
+    s.dirty = false;
+    return true;
+}
+
+uint32_t Qcow2DiskImage::ClaimL2Slot() {
+    uint32_t capacity = static_cast<uint32_t>(l2_slots_.size());
+    if (capacity == 0) return kNoSlot;
+
+    // CLOCK: sweep, clearing reference bits, until an unreferenced victim
+    // turns up. Terminates within two revolutions.
+    for (;;) {
+        uint32_t slot = l2_clock_hand_;
+        l2_clock_hand_ = (l2_clock_hand_ + 1) % capacity;
+
+        auto& s = l2_slots_[slot];
+        if (!s.valid) return slot;
+        if (s.referenced) {
+            s.referenced = false;
+            continue;
+        }
+
+        // One dirty table going out takes all the others along, so the
+        // ordering barriers are paid once per batch.
+        if (s.dirty && !WriteMetadata()) return kNoSlot;
+        L2IndexErase(s.l2_offset);
+        s.valid = false;
+        l2_stats_.evictions++;
+        return slot;
     }
+}
 
-    // Evict if cache full
-    while (l2_lru_.size() >= kL2CacheMax) {
-        EvictL2Cache();
+uint64_t* Qcow2DiskImage::GetL2Table(uint64_t l2_offset) {
+    uint32_t slot = FindL2Slot(l2_offset);
+    if (slot != kNoSlot) {
+        l2_stats_.hits++;
+        l2_slots_[slot].referenced = true;
+        return L2SlotData(slot);
     }
 
-    // Read from disk
-    L2CacheEntry entry;
-    entry.l2_offset = l2_offset;
-    entry.data.resize(l2_entries_);
-    entry.dirty = false;
+    l2_stats_.misses++;
+    slot = ClaimL2Slot();
+    if (slot == kNoSlot) return nullptr;
 
+    // Read from disk straight into the slab
+    uint64_t* data = L2SlotData(slot);
     _fseeki64(file_, l2_offset, SEEK_SET);
     size_t bytes = l2_entries_ * sizeof(uint64_t);
-    if (fread(entry.data.data(), 1, bytes, file_) != bytes) {
+    if (fread(data, 1, bytes, file_) != bytes) {
         LOG_ERROR("Qcow2: failed to read L2 table at 0x%llX", l2_offset);
         return nullptr;
     }
 
     // Convert to host byte order
     for (uint32_t i = 0; i < l2_entries_; i++) {
-        entry.data[i] = Be64(entry.data[i]);
+        data[i] = Be64(data[i]);
     }
 
-    l2_lru_.push_front(std::move(entry));
-    l2_map_[l2_offset] = l2_lru_.begin();
-    return l2_lru_.front().data.data();
+    auto& s = l2_slots_[slot];
+    s.l2_offset = l2_offset;
+    s.valid = true;
+    s.dirty = false;
+    s.referenced = true;
+    L2IndexInsert(l2_offset, slot);
+    return data;
 }
 
-void Qcow2DiskImage::EvictL2Cache() {
-    if (l2_lru_.empty()) return;
-
-    auto& victim = l2_lru_.back();
-    if (victim.dirty) {
-        // Write back to disk in big-endian
-        std::vector<uint64_t> be_data(l2_entries_);
-        for (uint32_t i = 0; i < l2_entries_; i++) {
-            be_data[i] = Be64(victim.data[i]);
-        }
-        _fseeki64(file_, victim.l2_offset, SEEK_SET);
-        fwrite(be_data.data(), 1, l2_entries_ * sizeof(uint64_t), file_);
+void Qcow2DiskImage::MarkL2Dirty(uint64_t l2_offset, uint32_t first, uint32_t count) {
+    uint32_t slot = FindL2Slot(l2_offset);
+    if (slot == kNoSlot || count == 0) return;
+    l2_slots_[slot].dirty = true;
+    uint64_t* bits = L2DirtyBits(slot);
+    uint32_t last = (first + count - 1) / kL2DirtyChunkEntries;
+    for (uint32_t c = first / kL2DirtyChunkEntries; c <= last; c++) {
+        bits[c / 64] |= 1ULL << (c % 64);
     }
-
-    l2_map_.erase(victim.l2_offset);
-    l2_lru_.pop_back();
 }
 
 // ---------- offset resolution ----------
 
 uint64_t Qcow2DiskImage::ResolveOffset(uint64_t virt_offset, bool* compressed,
                                          uint64_t* comp_host_off,
-                                         uint32_t* comp_size) {
+                                         uint32_t* comp_size,
+                                         bool* unallocated) {
     *compressed = false;
     *comp_host_off = 0;
     *comp_size = 0;
+    if (unallocated) *unallocated = true;
 
     uint32_t l1_idx = static_cast<uint32_t>(
         virt_offset / (static_cast<uint64_t>(l2_entries_) * cluster_size_));
@@ -244,31 +509,36 @@ uint64_t Qcow2DiskImage::ResolveOffset(uint64_t virt_offset, bool* compressed,
 
     uint64_t l2_entry = l2[l2_idx];
     if (l2_entry == 0) return 0;
+    if (unallocated) *unallocated = false;
 
     if (l2_entry & kCompressedBit) {
         *compressed = true;
-        // For compressed clusters (QEMU qcow2 format):
-        // csize_shift = 62 - (cluster_bits - 8)
-        // Bits 0 to (csize_shift - 1): host offset
-        // Bits csize_shift to 61: compressed sectors - 1
-        // Bit 62: compressed flag
-        // Bit 63: copied flag (unused for compressed)
-        uint32_t csize_shift = 62 - (cluster_bits_ - 8);
-        uint64_t csize_mask = (1ULL << (cluster_bits_ - 8)) - 1;
-        uint64_t offset_mask = (1ULL << csize_shift) - 1;
-
-        uint32_t nb_csectors = static_cast<uint32_t>(
-            ((l2_entry >> csize_shift) & csize_mask) + 1);
-        uint64_t host_off = l2_entry & offset_mask;
-
-        *comp_host_off = host_off;
-        *comp_size = nb_csectors * 512;
+        DecodeCompressed(l2_entry, comp_host_off, comp_size);
         return 0;  // caller must use compressed path
     }
+    if (l2_entry & kZeroFlag) return 0;
 
     return l2_entry & kOffsetMask;
 }
 
+void Qcow2DiskImage::DecodeCompressed(uint64_t l2_entry, uint64_t* host_off,
+                                      uint32_t* size) const {
+    // For compressed clusters (QEMU qcow2 format):
+    // csize_shift = 62 - (cluster_bits - 8)
+    // Bits 0 to (csize_shift - 1): host offset
+    // Bits csize_shift to 61: compressed sectors - 1
+    // Bit 62: compressed flag
+    // Bit 63: copied flag (unused for compressed)
+    uint32_t csize_shift = 62 - (cluster_bits_ - 8);
+    uint64_t csize_mask = (1ULL << (cluster_bits_ - 8)) - 1;
+    uint64_t offset_mask = (1ULL << csize_shift) - 1;
+
+    uint32_t nb_csectors = static_cast<uint32_t>(
+        ((l2_entry >> csize_shift) & csize_mask) + 1);
+    *host_off = l2_entry & offset_mask;
+    *size = nb_csectors * 512;
+}
+
 // ---------- cluster I/O ----------
 
 bool Qcow2DiskImage::ReadCluster(uint64_t host_off, uint64_t in_cluster_off,
@@ -281,63 +551,125 @@ bool Qcow2DiskImage::ReadCompressedCluster(uint64_t comp_host_off,
                                              uint32_t comp_size,
                                              uint64_t in_cluster_off,
                                              void* buf, uint32_t len) {
+    if (in_cluster_off + len > cluster_size_) {
+        LOG_ERROR("Qcow2: read past cluster boundary");
+        return false;
+    }
+    const uint8_t* data = GetDecompressedCluster(comp_host_off, comp_size);
+    if (!data) return false;
+    memcpy(buf, data + in_cluster_off, len);
+    return true;
+}
+
+// ---------- decompressed cluster cache ----------
+
+void Qcow2DiskImage::InitCompressedCache(uint64_t cache_bytes) {
+    if (cache_bytes == 0) cache_bytes = kCompressedCacheDefaultBytes;
+    uint64_t entries = std::clamp<uint64_t>(cache_bytes / cluster_size_,
+                                            1, kCompressedCacheMaxEntries);
+    zcache_slab_.assign(entries * cluster_size_, 0);
+    zcache_entries_.assign(entries, {});
+    zcache_index_.clear();
+    zcache_index_.reserve(entries);
+}
+
+void Qcow2DiskImage::InvalidateCompressedCache(uint64_t comp_host_off) {
+    auto it = zcache_index_.find(comp_host_off);
+    if (it == zcache_index_.end()) return;
+    zcache_entries_[it->second] = {};
+    zcache_index_.erase(it);
+}
+
+const uint8_t* Qcow2DiskImage::GetDecompressedCluster(uint64_t comp_host_off,
+                                                      uint32_t comp_size) {
+    zcache_tick_++;
+    auto it = zcache_index_.find(comp_host_off);
+    if (it != zcache_index_.end()) {
+        zcache_stats_.hits++;
+        zcache_entries_[it->second].last_use = zcache_tick_;
+        return zcache_slab_.data() + static_cast<size_t>(it->second) * cluster_size_;
+    }
+    zcache_stats_.misses++;
+
+    // Least recently used entry; empty ones have last_use 0.
+    uint32_t victim = 0;
+    for (uint32_t i = 1; i < zcache_entries_.size(); i++) {
+        if (zcache_entries_[i].last_use < zcache_entries_[victim].last_use) victim = i;
+    }
+    if (zcache_entries_[victim].last_use != 0) {
+        zcache_index_.erase(zcache_entries_[victim].comp_host_off);
+        zcache_entries_[victim] = {};
+    }
+
+    uint8_t* out = zcache_slab_.data() + static_cast<size_t>(victim) * cluster_size_;
+    if (!Decompress(comp_host_off, comp_size, out)) return nullptr;
+
+    zcache_entries_[victim] = {comp_host_off, zcache_tick_};
+    zcache_index_.emplace(comp_host_off, victim);
+    return out;
+}
+
+bool Qcow2DiskImage::Decompress(uint64_t comp_host_off, uint32_t comp_size,
+                                uint8_t* out) {
     // Read compressed data
-    std::vector<uint8_t> comp_buf(comp_size);
+    comp_buf_.resize(comp_size);
     _fseeki64(file_, comp_host_off, SEEK_SET);
-    if (fread(comp_buf.data(), 1, comp_size, file_) != comp_size) {
+    if (fread(comp_buf_.data(), 1, comp_size, file_) != comp_size) {
         LOG_ERROR("Qcow2: failed to read compressed data at 0x%llX (%u bytes)",
                   comp_host_off, comp_size);
         return false;
     }
 
-    // Decompress full cluster
-    std::vector<uint8_t> decompressed(cluster_size_);
-
     if (compression_type_ == 1) {
-        // zstd streaming decompression (handles multiple frames)
-        ZSTD_DCtx* dctx = ZSTD_createDCtx();
-        if (!dctx) {
-            LOG_ERROR("Qcow2: ZSTD_createDCtx failed");
-            return false;
+        // zstd streaming decompression (handles multiple frames). The
+        // context is kept across clusters and only its session is reset.
+        if (!zstd_dctx_) {
+            zstd_dctx_ = ZSTD_createDCtx();
+            if (!zstd_dctx_) {
+                LOG_ERROR("Qcow2: ZSTD_createDCtx failed");
+                return false;
+            }
+        } else {
+            ZSTD_DCtx_reset(zstd_dctx_, ZSTD_reset_session_only);
         }
-        ZSTD_inBuffer input = { comp_buf.data(), comp_size, 0 };
-        ZSTD_outBuffer output = { decompressed.data(), cluster_size_, 0 };
+        ZSTD_inBuffer input = { comp_buf_.data(), comp_size, 0 };
+        ZSTD_outBuffer output = { out, cluster_size_, 0 };
 
         while (output.pos < output.size) {
-            size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+            size_t ret = ZSTD_decompressStream(zstd_dctx_, &output, &input);
             if (ZSTD_isError(ret)) {
                 LOG_ERROR("Qcow2: ZSTD_decompressStream failed: %s",
                           ZSTD_getErrorName(ret));
-                ZSTD_freeDCtx(dctx);
                 return false;
             }
             if (ret == 0 && output.pos < output.size) {
                 break;  // no more input data
             }
         }
-        ZSTD_freeDCtx(dctx);
     } else if (compression_type_ == 0) {
-        // zlib (DEFLATE) decompression
-        uLongf dest_len = cluster_size_;
-        int ret = uncompress(decompressed.data(), &dest_len,
-                             comp_buf.data(), comp_size);
-        if (ret != Z_OK) {
-            // Try raw inflate (no zlib header) as qcow2 uses raw deflate
-            z_stream strm{};
-            strm.avail_in = comp_size;
-            strm.next_in = comp_buf.data();
-            strm.avail_out = cluster_size_;
-            strm.next_out = decompressed.data();
-
-            ret = inflateInit2(&strm, -15);  // raw deflate
-            if (ret != Z_OK) {
-                LOG_ERROR("Qcow2: inflateInit2 failed (%d)", ret);
+        // qcow2 writes raw deflate; the persistent stream is reset per cluster.
+        if (!inflate_) {
+            inflate_ = new (std::nothrow) z_stream{};
+            if (!inflate_ || inflateInit2(inflate_, -15) != Z_OK) {
+                LOG_ERROR("Qcow2: inflateInit2 failed");
+                delete inflate_;
+                inflate_ = nullptr;
                 return false;
             }
-            ret = inflate(&strm, Z_FINISH);
-            inflateEnd(&strm);
-
-            if (ret != Z_STREAM_END && ret != Z_OK) {
+        } else {
+            inflateReset(inflate_);
+        }
+        inflate_->avail_in = comp_size;
+        inflate_->next_in = comp_buf_.data();
+        inflate_->avail_out = cluster_size_;
+        inflate_->next_out = out;
+
+        int ret = inflate(inflate_, Z_FINISH);
+        if (ret != Z_STREAM_END && inflate_->avail_out != 0) {
+            // Some writers wrap the data in a zlib header
+            uLongf dest_len = cluster_size_;
+            ret = uncompress(out, &dest_len, comp_buf_.data(), comp_size);
+            if (ret != Z_OK) {
                 LOG_ERROR("Qcow2: inflate failed (%d) for cluster at 0x%llX",
                           ret, comp_host_off);
                 return false;
@@ -347,16 +679,15 @@ bool Qcow2DiskImage::ReadCompressedCluster(uint64_t comp_host_off,
         LOG_ERROR("Qcow2: unknown compression_type %u", compression_type_);
         return false;
     }
-
-    if (in_cluster_off + len > cluster_size_) {
-        LOG_ERROR("Qcow2: read past cluster boundary");
-        return false;
-    }
-
-    memcpy(buf, decompressed.data() + in_cluster_off, len);
     return true;
 }
 
+Qcow2DiskImage::CompressedCacheStats Qcow2DiskImage::GetCompressedCacheStats() const {
+    CompressedCacheStats stats = zcache_stats_;
+    stats.capacity = static_cast<uint32_t>(zcache_entries_.size());
+    return stats;
+}
+
 bool Qcow2DiskImage::WriteCluster(uint64_t host_off, uint64_t in_cluster_off,
                                     const void* buf, uint32_t len) {
     _fseeki64(file_, host_off + in_cluster_off, SEEK_SET);
@@ -369,20 +700,65 @@ uint64_t Qcow2DiskImage::AllocateCluster() {
     return AllocateClusters(1);
 }
 
-uint64_t Qcow2DiskImage::AllocateClusters(uint32_t count) {
-    uint64_t offset = file_end_;
-    file_end_ += static_cast<uint64_t>(count) * cluster_size_;
-
-    // Extend file with zeros
-    std::vector<uint8_t> zeros(cluster_size_, 0);
-    for (uint32_t i = 0; i < count; i++) {
-        _fseeki64(file_, offset + static_cast<uint64_t>(i) * cluster_size_, SEEK_SET);
-        fwrite(zeros.data(), 1, cluster_size_, file_);
+uint64_t Qcow2DiskImage::AllocateClusters(uint32_t count, bool zero_fill) {
+    uint64_t first = refcounts_enabled_ ? FindFreeRun(count) : kNoCluster;
+    if (first == kNoCluster) first = file_end_ / cluster_size_;
+
+    uint64_t offset = first * cluster_size_;
+    uint64_t end = offset + static_cast<uint64_t>(count) * cluster_size_;
+
+    // Zero-fill: new L2 tables and partially written clusters rely on it.
+    // Nothing is counted or pointed at until it is written; errors stdio
+    // still buffers surface at the flush barrier in Flush().
+    if (zero_fill) {
+        std::vector<uint8_t> zeros(cluster_size_, 0);
+        _fseeki64(file_, offset, SEEK_SET);
+        for (uint32_t i = 0; i < count; i++) {
+            if (fwrite(zeros.data(), 1, cluster_size_, file_) != cluster_size_) {
+                LOG_ERROR("Qcow2: zero-filling cluster at 0x%llX failed",
+                          offset + static_cast<uint64_t>(i) * cluster_size_);
+                return 0;
+            }
+        }
     }
 
+    if (end > file_end_) file_end_ = end;
+    unsynced_allocs_ = true;
+    if (refcounts_enabled_) {
+        for (uint32_t i = 0; i < count; i++) AdjustRefcount(first + i, +1);
+    }
     return offset;
 }
 
+void Qcow2DiskImage::PreallocateRun(uint64_t offset, uint64_t len) {
+    // Whole clusters only: nothing of their old contents survives.
+    uint64_t start = AlignUp(offset, cluster_size_);
+    uint64_t end = AlignDown(offset + len, cluster_size_);
+    uint64_t table_span = static_cast<uint64_t>(l2_entries_) * cluster_size_;
+    end = std::min(end, AlignDown(start, table_span) + table_span);
+    if (end < start + 2 * static_cast<uint64_t>(cluster_size_)) return;
+
+    uint32_t l1_idx = static_cast<uint32_t>(start / table_span);
+    uint32_t l2_idx = static_cast<uint32_t>((start / cluster_size_) % l2_entries_);
+    uint64_t* l2 = EnsureL2Table(l1_idx);
+    if (!l2) return;
+
+    // Unallocated or zero-flagged entries hold no cluster to release.
+    uint32_t max = static_cast<uint32_t>((end - start) / cluster_size_);
+    uint32_t count = 0;
+    while (count < max && (l2[l2_idx + count] & (kOffsetMask | kCompressedBit)) == 0) {
+        count++;
+    }
+    if (count < 2) return;
+
+    uint64_t host = AllocateClusters(count, false);
+    if (!host) return;
+    for (uint32_t i = 0; i < count; i++) {
+        l2[l2_idx + i] = (host + static_cast<uint64_t>(i) * cluster_size_) | kCopiedBit;
+    }
+    MarkL2Dirty(l1_table_[l1_idx] & kOffsetMask, l2_idx, count);
+}
+
 uint64_t* Qcow2DiskImage::EnsureL2Table(uint32_t l1_idx) {
     if (l1_idx >= l1_size_) return nullptr;
 
@@ -394,155 +770,722 @@ uint64_t* Qcow2DiskImage::EnsureL2Table(uint32_t l1_idx) {
 
     // Allocate new L2 table
     uint64_t new_l2_off = AllocateCluster();
+    if (!new_l2_off) return nullptr;
 
-    // Update L1 entry (set COPIED bit)
+    // Update L1 entry (set COPIED bit). It reaches the disk after the
+    // table does, in WriteMetadata().
     l1_table_[l1_idx] = new_l2_off | kCopiedBit;
-
-    // Write L1 entry back to disk (big-endian)
-    uint64_t be_entry = Be64(l1_table_[l1_idx]);
-    _fseeki64(file_, l1_table_offset_ + l1_idx * sizeof(uint64_t), SEEK_SET);
-    fwrite(&be_entry, sizeof(be_entry), 1, file_);
+    l1_dirty_[l1_idx] = 1;
+    l1_dirty_any_ = true;
 
     return GetL2Table(new_l2_off);
 }
 
-// ---------- public Read/Write ----------
+// ---------- write preparation ----------
 
-bool Qcow2DiskImage::Read(uint64_t offset, void* buf, uint32_t len) {
-    uint8_t* dst = static_cast<uint8_t*>(buf);
+uint64_t Qcow2DiskImage::PrepareClusterWrite(uint64_t offset, uint32_t chunk) {
+    uint32_t l1_idx = static_cast<uint32_t>(
+        offset / (static_cast<uint64_t>(l2_entries_) * cluster_size_));
+    uint32_t l2_idx = static_cast<uint32_t>(
+        (offset / cluster_size_) % l2_entries_);
 
-    while (len > 0) {
-        uint64_t in_cluster_off = offset & (cluster_size_ - 1);
-        uint32_t chunk = std::min(len,
-            static_cast<uint32_t>(cluster_size_ - in_cluster_off));
+    uint64_t* l2 = EnsureL2Table(l1_idx);
+    if (!l2) return 0;
+
+    uint64_t l2_entry = l2[l2_idx];
+    if ((l2_entry & kOffsetMask) != 0 &&
+        !(l2_entry & (kCompressedBit | kZeroFlag))) {
+        return l2_entry & kOffsetMask;
+    }
 
-        if (offset + chunk > virtual_size_) {
-            LOG_ERROR("Qcow2: read past virtual disk end");
+    uint64_t data_off = AllocateCluster();
+    if (!data_off) return 0;
+
+    uint64_t cluster_start = offset & ~(static_cast<uint64_t>(cluster_size_) - 1);
+
+    // If writing a partial cluster, read old data first
+    if (chunk < cluster_size_ && l2_entry == 0 && backing_) {
+        std::vector<uint8_t> old_data(cluster_size_);
+        if (!ReadBacking(cluster_start, old_data.data(), cluster_size_) ||
+            !WriteCluster(data_off, 0, old_data.data(), cluster_size_)) {
+            ReleaseClusters(data_off, cluster_size_);
+            return 0;
+        }
+    } else if (chunk < cluster_size_ && l2_entry != 0) {
+        // Read existing cluster data (possibly compressed)
+        std::vector<uint8_t> old_data(cluster_size_, 0);
+        bool comp = false;
+        uint64_t comp_off = 0;
+        uint32_t comp_sz = 0;
+        uint64_t old_host = ResolveOffset(cluster_start, &comp, &comp_off, &comp_sz);
+
+        if (comp) {
+            ReadCompressedCluster(comp_off, comp_sz, 0,
+                                  old_data.data(), cluster_size_);
+        } else if (old_host != 0) {
+            ReadCluster(old_host, 0, old_data.data(), cluster_size_);
+        }
+
+        // Write old data to new cluster
+        if (!WriteCluster(data_off, 0, old_data.data(), cluster_size_)) {
+            ReleaseClusters(data_off, cluster_size_);
+            return 0;
+        }
+    }
+
+    // Update L2 entry (set COPIED bit)
+    l2[l2_idx] = data_off | kCopiedBit;
+
+    // A compressed or preallocated-zero predecessor is no longer referenced.
+    ReleaseEntry(l2_entry);
+
+    // Mark L2 cache entry dirty
+    MarkL2Dirty(l1_table_[l1_idx] & kOffsetMask, l2_idx);
+    return data_off;
+}
+
+// ---------- refcounts ----------
+
+bool Qcow2DiskImage::LoadRefcounts() {
+    if (nb_snapshots_ != 0 || refcount_order_ != 4) {
+        LOG_WARN("Qcow2: %s, refcounts not maintained (append-only allocation)",
+                 nb_snapshots_ ? "internal snapshots present"
+                               : "refcount width is not 16 bits");
+        return true;
+    }
+
+    refblock_entries_ = cluster_size_ / sizeof(uint16_t);
+    size_t table_entries = static_cast<size_t>(refcount_table_clusters_) *
+                           cluster_size_ / sizeof(uint64_t);
+    refcount_table_.assign(table_entries, 0);
+    _fseeki64(file_, refcount_table_offset_, SEEK_SET);
+    if (fread(refcount_table_.data(), sizeof(uint64_t), table_entries, file_) !=
+        table_entries) {
+        LOG_ERROR("Qcow2: failed to read refcount table at 0x%llX",
+                  refcount_table_offset_);
+        return false;
+    }
+    for (auto& e : refcount_table_) e = Be64(e) & kOffsetMask;
+
+    uint64_t clusters = file_end_ / cluster_size_;
+    refcounts_.assign(clusters, 0);
+    refblock_dirty_.assign(table_entries, 0);
+
+    std::vector<uint16_t> block(refblock_entries_);
+    for (size_t b = 0; b < table_entries; b++) {
+        if (refcount_table_[b] == 0) continue;
+        _fseeki64(file_, refcount_table_[b], SEEK_SET);
+        if (fread(block.data(), sizeof(uint16_t), refblock_entries_, file_) !=
+            refblock_entries_) {
+            LOG_ERROR("Qcow2: failed to read refcount block at 0x%llX",
+                      refcount_table_[b]);
             return false;
         }
+        uint64_t base = static_cast<uint64_t>(b) * refblock_entries_;
+        for (uint32_t i = 0; i < refblock_entries_ && base + i < clusters; i++) {
+            refcounts_[base + i] = Be16(block[i]);
+        }
+    }
 
-        bool compressed = false;
-        uint64_t comp_host_off = 0;
-        uint32_t comp_size = 0;
-        uint64_t host_off = ResolveOffset(offset, &compressed,
-                                           &comp_host_off, &comp_size);
+    // Images written by older builds never updated refcounts. Take the
+    // larger of stored and actual references: leaks are harmless, reusing
+    // a live cluster is not.
+    std::vector<uint16_t> refs(clusters, 0);
+    ScanReferences(refs);
+    uint64_t repaired = 0;
+    for (uint64_t c = 0; c < clusters; c++) {
+        if (refs[c] > refcounts_[c]) {
+            refcounts_[c] = refs[c];
+            refblock_dirty_[c / refblock_entries_] = 1;
+            repaired++;
+        }
+    }
+    if (repaired) {
+        LOG_WARN("Qcow2: repaired %llu missing refcount(s)", repaired);
+    }
 
-        if (compressed) {
-            if (!ReadCompressedCluster(comp_host_off, comp_size,
-                                        in_cluster_off, dst, chunk)) {
-                return false;
-            }
-        } else if (host_off == 0) {
-            memset(dst, 0, chunk);
-        } else {
-            if (!ReadCluster(host_off, in_cluster_off, dst, chunk)) {
-                return false;
+    free_bitmap_.assign((clusters + 63) / 64, 0);
+    alloc_hint_ = clusters;
+    uint64_t free_count = 0;
+    for (uint64_t c = 0; c < clusters; c++) {
+        if (refcounts_[c] != 0) continue;
+        free_bitmap_[c / 64] |= 1ULL << (c % 64);
+        alloc_hint_ = std::min(alloc_hint_, c);
+        free_count++;
+    }
+
+    refcounts_enabled_ = true;
+    LOG_INFO("Qcow2: %llu of %llu clusters free for reuse", free_count, clusters);
+    return true;
+}
+
+void Qcow2DiskImage::ScanReferences(std::vector<uint16_t>& refs) {
+    auto ref = [&](uint64_t host_off, uint64_t len) {
+        if (len == 0) return;
+        uint64_t first = host_off / cluster_size_;
+        uint64_t last = (host_off + len - 1) / cluster_size_;
+        for (uint64_t c = first; c <= last && c < refs.size(); c++) {
+            if (refs[c] < UINT16_MAX) refs[c]++;
+        }
+    };
+
+    ref(0, cluster_size_);  // header, extensions, backing file name
+    ref(l1_table_offset_, static_cast<uint64_t>(l1_size_) * sizeof(uint64_t));
+    ref(refcount_table_offset_,
+        static_cast<uint64_t>(refcount_table_clusters_) * cluster_size_);
+    for (uint64_t block_off : refcount_table_) {
+        if (block_off) ref(block_off, cluster_size_);
+    }
+
+    std::vector<uint64_t> l2(l2_entries_);
+    for (uint32_t i = 0; i < l1_size_; i++) {
+        uint64_t l2_off = l1_table_[i] & kOffsetMask;
+        if (l2_off == 0) continue;
+        ref(l2_off, cluster_size_);
+
+        _fseeki64(file_, l2_off, SEEK_SET);
+        if (fread(l2.data(), sizeof(uint64_t), l2_entries_, file_) != l2_entries_)
+            continue;
+        for (uint64_t raw : l2) {
+            uint64_t e = Be64(raw);
+            if (e & kCompressedBit) {
+                uint64_t host = 0;
+                uint32_t size = 0;
+                DecodeCompressed(e, &host, &size);
+                ref(host, size - (host & 511));
+            } else if (e & kOffsetMask) {
+                ref(e & kOffsetMask, cluster_size_);
             }
         }
+    }
+}
 
-        offset += chunk;
-        dst += chunk;
-        len -= chunk;
+void Qcow2DiskImage::TrackCluster(uint64_t cluster) {
+    if (cluster < refcounts_.size()) return;
+    refcounts_.resize(cluster + 1, 0);
+    free_bitmap_.resize((refcounts_.size() + 63) / 64, 0);
+}
+
+void Qcow2DiskImage::AdjustRefcount(uint64_t cluster, int delta) {
+    TrackCluster(cluster);
+    uint16_t& rc = refcounts_[cluster];
+    if (delta > 0) {
+        if (rc == UINT16_MAX) return;  // saturated; leaks rather than wraps
+        if (rc++ == 0) free_bitmap_[cluster / 64] &= ~(1ULL << (cluster % 64));
+    } else {
+        if (rc == 0) {
+            LOG_WARN("Qcow2: refcount underflow on cluster %llu", cluster);
+            return;
+        }
+        if (--rc == 0) pending_free_.push_back(cluster);
+    }
+
+    uint64_t block = cluster / refblock_entries_;
+    if (block >= refblock_dirty_.size()) refblock_dirty_.resize(block + 1, 0);
+    refblock_dirty_[block] = 1;
+}
+
+void Qcow2DiskImage::ReleaseClusters(uint64_t host_off, uint64_t len) {
+    if (!refcounts_enabled_ || len == 0) return;
+    uint64_t first = host_off / cluster_size_;
+    uint64_t last = (host_off + len - 1) / cluster_size_;
+    for (uint64_t c = first; c <= last; c++) AdjustRefcount(c, -1);
+}
+
+void Qcow2DiskImage::ReleaseEntry(uint64_t l2_entry) {
+    if (l2_entry & kCompressedBit) {
+        uint64_t comp_off = 0;
+        uint32_t comp_sz = 0;
+        DecodeCompressed(l2_entry, &comp_off, &comp_sz);
+        InvalidateCompressedCache(comp_off);
+        ReleaseClusters(comp_off, comp_sz - (comp_off & 511));
+    } else if (l2_entry & kOffsetMask) {
+        ReleaseClusters(l2_entry & kOffsetMask, cluster_size_);
+    }
+}
+
+void Qcow2DiskImage::ReleasePendingFrees() {
+    // Coalesce freed clusters into runs so the host can drop their storage.
+    std::sort(pending_free_.begin(), pending_free_.end());
+    uint64_t run_start = 0, run_len = 0;
+    for (uint64_t c : pending_free_) {
+        if (c >= refcounts_.size() || refcounts_[c] != 0) continue;
+        free_bitmap_[c / 64] |= 1ULL << (c % 64);
+        alloc_hint_ = std::min(alloc_hint_, c);
+
+        if (run_len && c == run_start + run_len) {
+            run_len++;
+            continue;
+        }
+        if (run_len) PunchHole(run_start * cluster_size_, run_len * cluster_size_);
+        run_start = c;
+        run_len = 1;
     }
+    if (run_len) PunchHole(run_start * cluster_size_, run_len * cluster_size_);
+    pending_free_.clear();
+}
+
+void Qcow2DiskImage::PunchHole(uint64_t host_off, uint64_t len) {
+#ifdef _WIN32
+    // Caller has flushed the stdio buffer, so the handle is in sync.
+    HANDLE h = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file_)));
+    if (h == INVALID_HANDLE_VALUE) return;
+
+    DWORD bytes = 0;
+    if (!sparse_) {
+        if (!DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0,
+                             &bytes, nullptr)) {
+            return;
+        }
+        sparse_ = true;
+    }
+    FILE_ZERO_DATA_INFORMATION info{};
+    info.FileOffset.QuadPart = static_cast<LONGLONG>(host_off);
+    info.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(host_off + len);
+    DeviceIoControl(h, FSCTL_SET_ZERO_DATA, &info, sizeof(info),
+                    nullptr, 0, &bytes, nullptr);
+#else
+    (void)host_off;
+    (void)len;
+#endif
+}
+
+uint64_t Qcow2DiskImage::FindFreeRun(uint32_t count) {
+    uint64_t total = refcounts_.size();
+    uint64_t run_start = 0;
+    uint32_t run_len = 0;
+    bool first_free_seen = false;
+
+    for (uint64_t c = alloc_hint_; c < total;) {
+        uint64_t word = free_bitmap_[c / 64] >> (c % 64);
+        if (word == 0) {
+            run_len = 0;
+            c = (c / 64 + 1) * 64;
+            continue;
+        }
+        if (!(word & 1)) {
+            run_len = 0;
+            c += std::countr_zero(word);
+            continue;
+        }
+        if (!first_free_seen) {
+            alloc_hint_ = c;
+            first_free_seen = true;
+        }
+        if (run_len++ == 0) run_start = c;
+        if (run_len == count) return run_start;
+        c++;
+    }
+    if (!first_free_seen) alloc_hint_ = total;
+    return kNoCluster;
+}
+
+bool Qcow2DiskImage::GrowRefcountTable(uint64_t min_blocks) {
+    // Leave headroom so growth stays rare as the image expands.
+    uint64_t entries = min_blocks + min_blocks / 2 + 1;
+    uint32_t new_clusters = static_cast<uint32_t>(
+        (entries * sizeof(uint64_t) + cluster_size_ - 1) / cluster_size_);
+    entries = static_cast<uint64_t>(new_clusters) * cluster_size_ / sizeof(uint64_t);
+
+    uint64_t old_offset = refcount_table_offset_;
+    uint32_t old_clusters = refcount_table_clusters_;
+
+    uint64_t new_offset = AllocateClusters(new_clusters);
+    if (!new_offset) return false;
+    refcount_table_.resize(entries, 0);
+    refblock_dirty_.resize(entries, 0);
+    refcount_table_offset_ = new_offset;
+    refcount_table_clusters_ = new_clusters;
+    refcount_table_dirty_ = true;
+
+    // Point the header at the new table before the old one can be reused.
+    std::vector<uint64_t> be_table(entries);
+    for (uint64_t i = 0; i < entries; i++) be_table[i] = Be64(refcount_table_[i]);
+    _fseeki64(file_, new_offset, SEEK_SET);
+    if (fwrite(be_table.data(), sizeof(uint64_t), entries, file_) != entries)
+        return false;
+
+    uint64_t be_off = Be64(new_offset);
+    uint32_t be_clusters = Be32(new_clusters);
+    _fseeki64(file_, offsetof(Qcow2Header, refcount_table_offset), SEEK_SET);
+    if (fwrite(&be_off, sizeof(be_off), 1, file_) != 1 ||
+        fwrite(&be_clusters, sizeof(be_clusters), 1, file_) != 1 || fflush(file_) != 0) {
+        LOG_ERROR("Qcow2: writing the new refcount table location failed");
+        return false;
+    }
+
+    ReleaseClusters(old_offset, static_cast<uint64_t>(old_clusters) * cluster_size_);
+    LOG_INFO("Qcow2: refcount table grown to %u cluster(s)", new_clusters);
     return true;
 }
 
-bool Qcow2DiskImage::Write(uint64_t offset, const void* buf, uint32_t len) {
-    const uint8_t* src = static_cast<const uint8_t*>(buf);
+bool Qcow2DiskImage::WriteRefcounts(bool hold_frees) {
+    if (!refcounts_enabled_) return true;
+
+    // Every range holding a non-zero refcount needs a block on disk. Giving
+    // it one allocates a cluster, which may itself need a block, so repeat
+    // until nothing changes.
+    for (;;) {
+        uint64_t blocks = (refcounts_.size() + refblock_entries_ - 1) / refblock_entries_;
+        if (blocks > refcount_table_.size()) {
+            if (!GrowRefcountTable(blocks)) return false;
+            continue;
+        }
 
-    while (len > 0) {
-        uint64_t in_cluster_off = offset & (cluster_size_ - 1);
-        uint32_t chunk = std::min(len,
-            static_cast<uint32_t>(cluster_size_ - in_cluster_off));
+        bool allocated = false;
+        for (uint64_t b = 0; b < blocks; b++) {
+            if (refcount_table_[b] != 0) continue;
+            uint64_t base = b * refblock_entries_;
+            uint64_t end = std::min<uint64_t>(base + refblock_entries_, refcounts_.size());
+            if (std::all_of(refcounts_.begin() + base, refcounts_.begin() + end,
+                            [](uint16_t rc) { return rc == 0; })) {
+                continue;
+            }
+            uint64_t block = AllocateCluster();
+            if (!block) return false;
+            refcount_table_[b] = block;
+            refcount_table_dirty_ = true;
+            refblock_dirty_[b] = 1;
+            allocated = true;
+        }
+        if (!allocated) break;
+    }
+
+    std::vector<uint64_t> held;
+    if (hold_frees) {
+        held = pending_free_;
+        std::sort(held.begin(), held.end());
+    }
+    std::vector<uint16_t> be_block(refblock_entries_);
+    for (uint64_t b = 0; b < refcount_table_.size(); b++) {
+        if (!refblock_dirty_[b] || refcount_table_[b] == 0) continue;
+        uint64_t base = b * refblock_entries_;
+        for (uint32_t i = 0; i < refblock_entries_; i++) {
+            uint64_t c = base + i;
+            be_block[i] = Be16(c < refcounts_.size() ? refcounts_[c] : 0);
+        }
+        // A held block stays dirty for the pass that writes the frees.
+        bool holds = false;
+        for (auto it = std::lower_bound(held.begin(), held.end(), base);
+             it != held.end() && *it < base + refblock_entries_; ++it) {
+            if (refcounts_[*it] != 0) continue;
+            be_block[*it - base] = Be16(1);
+            holds = true;
+        }
+        _fseeki64(file_, refcount_table_[b], SEEK_SET);
+        if (fwrite(be_block.data(), sizeof(uint16_t), refblock_entries_, file_) !=
+            refblock_entries_) {
+            return false;
+        }
+        refblock_dirty_[b] = holds ? 1 : 0;
+    }
 
-        if (offset + chunk > virtual_size_) {
-            LOG_ERROR("Qcow2: write past virtual disk end");
+    if (refcount_table_dirty_) {
+        std::vector<uint64_t> be_table(refcount_table_.size());
+        for (size_t i = 0; i < be_table.size(); i++) {
+            be_table[i] = Be64(refcount_table_[i]);
+        }
+        _fseeki64(file_, refcount_table_offset_, SEEK_SET);
+        if (fwrite(be_table.data(), sizeof(uint64_t), be_table.size(), file_) !=
+            be_table.size()) {
             return false;
         }
+        refcount_table_dirty_ = false;
+    }
+    return true;
+}
 
-        uint32_t l1_idx = static_cast<uint32_t>(
-            offset / (static_cast<uint64_t>(l2_entries_) * cluster_size_));
-        uint32_t l2_idx = static_cast<uint32_t>(
-            (offset / cluster_size_) % l2_entries_);
+// ---------- discard / write zeroes ----------
+
+bool Qcow2DiskImage::SetClusterEntry(uint64_t offset, uint64_t new_entry) {
+    uint32_t l1_idx = static_cast<uint32_t>(
+        offset / (static_cast<uint64_t>(l2_entries_) * cluster_size_));
+    uint32_t l2_idx = static_cast<uint32_t>(
+        (offset / cluster_size_) % l2_entries_);
+    if (l1_idx >= l1_size_) return false;
+
+    // No L2 table: already reads as zeros, nothing to release. Over a
+    // backing image only a plain unmap is a no-op.
+    uint64_t l2_table_off = l1_table_[l1_idx] & kOffsetMask;
+    if (l2_table_off == 0 && (new_entry & kOffsetMask) == 0 &&
+        (new_entry == 0 || !backing_)) {
+        return true;
+    }
 
-        uint64_t* l2 = EnsureL2Table(l1_idx);
-        if (!l2) return false;
+    uint64_t* l2 = l2_table_off ? GetL2Table(l2_table_off) : EnsureL2Table(l1_idx);
+    if (!l2) return false;
 
-        uint64_t l2_entry = l2[l2_idx];
-        uint64_t data_off = 0;
+    uint64_t old_entry = l2[l2_idx];
+    if (old_entry == new_entry) return true;
 
-        bool need_cow = false;
-        if (l2_entry == 0) {
-            need_cow = true;
-        } else if (l2_entry & kCompressedBit) {
-            need_cow = true;
-        }
+    l2[l2_idx] = new_entry;
+    MarkL2Dirty(l1_table_[l1_idx] & kOffsetMask, l2_idx);
+    if ((old_entry & kOffsetMask) != (new_entry & kOffsetMask) ||
+        (old_entry & kCompressedBit)) {
+        ReleaseEntry(old_entry);
+    }
+    return true;
+}
+
+bool Qcow2DiskImage::Discard(uint64_t offset, uint64_t len) {
+    if (read_only_ || offset + len > virtual_size_) return false;
+    if (!refcounts_enabled_) return true;
+
+    // Unmapping would expose stale backing data; v3 masks it with the zero
+    // flag, v2 keeps the clusters.
+    if (backing_ && version_ != 3) return true;
+    uint64_t entry = backing_ ? kZeroFlag : 0;
 
-        if (need_cow) {
-            data_off = AllocateCluster();
+    // Only whole clusters can be released; partial ones are left intact.
+    uint64_t start = AlignUp(offset, cluster_size_);
+    uint64_t end = AlignDown(offset + len, cluster_size_);
+    for (uint64_t off = start; off < end; off += cluster_size_) {
+        if (!SetClusterEntry(off, entry)) return false;
+    }
+    return true;
+}
+
+bool Qcow2DiskImage::WriteZeroes(uint64_t offset, uint64_t len, bool may_unmap) {
+    if (read_only_ || offset + len > virtual_size_) return false;
+    if (!refcounts_enabled_) return DiskImage::WriteZeroes(offset, len, may_unmap);
+
+    uint64_t start = std::min(AlignUp(offset, cluster_size_), offset + len);
+    uint64_t end = std::max(AlignDown(offset + len, cluster_size_), start);
+
+    // Partial head and tail clusters get real zeros.
+    if (start > offset && !DiskImage::WriteZeroes(offset, start - offset, false))
+        return false;
+    if (offset + len > end &&
+        !DiskImage::WriteZeroes(end, offset + len - end, false))
+        return false;
 
-            // If writing a partial cluster, read old data first
-            if (chunk < cluster_size_ && l2_entry != 0) {
-                // Read existing cluster data (possibly compressed)
-                std::vector<uint8_t> old_data(cluster_size_, 0);
+    for (uint64_t off = start; off < end; off += cluster_size_) {
+        uint64_t entry = 0;
+        if (version_ == 3) {
+            // The zero flag keeps reads zero whatever lies beneath; without
+            // may_unmap a standard cluster stays allocated under it.
+            entry = kZeroFlag;
+            if (!may_unmap) {
                 bool comp = false;
                 uint64_t comp_off = 0;
                 uint32_t comp_sz = 0;
-                uint64_t old_host = ResolveOffset(
-                    offset & ~(static_cast<uint64_t>(cluster_size_) - 1),
-                    &comp, &comp_off, &comp_sz);
-
-                if (comp) {
-                    ReadCompressedCluster(comp_off, comp_sz, 0,
-                                          old_data.data(), cluster_size_);
-                } else if (old_host != 0) {
-                    ReadCluster(old_host, 0, old_data.data(), cluster_size_);
-                }
-
-                // Write old data to new cluster
-                WriteCluster(data_off, 0, old_data.data(), cluster_size_);
+                uint64_t host = ResolveOffset(off, &comp, &comp_off, &comp_sz);
+                if (host) entry |= host | kCopiedBit;
             }
+        } else if (!may_unmap || backing_) {
+            if (!DiskImage::WriteZeroes(off, cluster_size_, false)) return false;
+            continue;
+        }
+        if (!SetClusterEntry(off, entry)) return false;
+    }
+    return true;
+}
+
+// ---------- public Read/Write ----------
 
-            // Update L2 entry (set COPIED bit)
-            l2[l2_idx] = data_off | kCopiedBit;
+namespace {
 
-            // Mark L2 cache entry dirty
-            uint64_t l2_table_off = l1_table_[l1_idx] & kOffsetMask;
-            auto it = l2_map_.find(l2_table_off);
-            if (it != l2_map_.end()) {
-                it->second->dirty = true;
+// Walks a segment list as one flat byte stream.
+struct IoVecCursor {
+    const DiskIoVec* iov;
+    size_t count;
+    size_t idx = 0;
+    uint32_t off = 0;
+
+    // Returns up to `max` bytes of the current segment and advances past them.
+    uint32_t Next(uint32_t max, uint8_t** ptr) {
+        while (idx < count && off == iov[idx].len) {
+            idx++;
+            off = 0;
+        }
+        if (idx >= count) return 0;
+        uint32_t n = std::min(max, iov[idx].len - off);
+        *ptr = static_cast<uint8_t*>(iov[idx].base) + off;
+        off += n;
+        return n;
+    }
+};
+
+uint64_t TotalLength(const DiskIoVec* iov, size_t count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) total += iov[i].len;
+    return total;
+}
+
+}  // namespace
+
+bool Qcow2DiskImage::Read(uint64_t offset, void* buf, uint32_t len) {
+    DiskIoVec iov{buf, len};
+    return ReadV(offset, &iov, 1);
+}
+
+bool Qcow2DiskImage::Write(uint64_t offset, const void* buf, uint32_t len) {
+    DiskIoVec iov{const_cast<void*>(buf), len};
+    return WriteV(offset, &iov, 1);
+}
+
+// Vectored paths resolve each cluster once, then stream every segment piece
+// that falls inside it: one seek per cluster, one decompression per
+// compressed cluster, regardless of how the guest split the buffer.
+bool Qcow2DiskImage::ReadV(uint64_t offset, const DiskIoVec* iov, size_t count) {
+    uint64_t remaining = TotalLength(iov, count);
+    if (offset + remaining > virtual_size_) {
+        LOG_ERROR("Qcow2: read past virtual disk end");
+        return false;
+    }
+
+    IoVecCursor cursor{iov, count};
+    const uint8_t* cluster_data = nullptr;
+
+    while (remaining > 0) {
+        uint64_t in_cluster_off = offset & (cluster_size_ - 1);
+        uint32_t chunk = static_cast<uint32_t>(std::min<uint64_t>(
+            remaining, cluster_size_ - in_cluster_off));
+
+        bool compressed = false;
+        uint64_t comp_host_off = 0;
+        uint32_t comp_size = 0;
+        bool unallocated = false;
+        uint64_t host_off = ResolveOffset(offset, &compressed, &comp_host_off,
+                                          &comp_size, &unallocated);
+        bool from_backing = unallocated && backing_;
+
+        if (compressed) {
+            cluster_data = GetDecompressedCluster(comp_host_off, comp_size);
+            if (!cluster_data) return false;
+        } else if (host_off != 0) {
+            _fseeki64(file_, host_off + in_cluster_off, SEEK_SET);
+        }
+
+        for (uint32_t done = 0; done < chunk;) {
+            uint8_t* dst = nullptr;
+            uint32_t n = cursor.Next(chunk - done, &dst);
+            if (n == 0) return false;
+
+            if (compressed) {
+                memcpy(dst, cluster_data + in_cluster_off + done, n);
+            } else if (from_backing) {
+                if (!ReadBacking(offset + done, dst, n)) return false;
+            } else if (host_off == 0) {
+                memset(dst, 0, n);
+            } else if (fread(dst, 1, n, file_) != n) {
+                return false;
             }
-        } else {
-            data_off = l2_entry & kOffsetMask;
+            done += n;
         }
 
-        if (!WriteCluster(data_off, in_cluster_off, src, chunk)) {
-            return false;
+        offset += chunk;
+        remaining -= chunk;
+    }
+    return true;
+}
+
+bool Qcow2DiskImage::WriteV(uint64_t offset, const DiskIoVec* iov, size_t count) {
+    if (read_only_) return false;
+    uint64_t remaining = TotalLength(iov, count);
+    if (offset + remaining > virtual_size_) {
+        LOG_ERROR("Qcow2: write past virtual disk end");
+        return false;
+    }
+
+    IoVecCursor cursor{iov, count};
+
+    while (remaining > 0) {
+        uint64_t in_cluster_off = offset & (cluster_size_ - 1);
+        uint32_t chunk = static_cast<uint32_t>(std::min<uint64_t>(
+            remaining, cluster_size_ - in_cluster_off));
+
+        // Sequential writes into unallocated space get their clusters in
+        // one contiguous run, without zero-filling what is overwritten.
+        if (in_cluster_off == 0 && remaining >= 2ULL * cluster_size_) {
+            PreallocateRun(offset, remaining);
+        }
+        uint64_t data_off = PrepareClusterWrite(offset, chunk);
+        if (data_off == 0) return false;
+
+        _fseeki64(file_, data_off + in_cluster_off, SEEK_SET);
+        for (uint32_t done = 0; done < chunk;) {
+            uint8_t* src = nullptr;
+            uint32_t n = cursor.Next(chunk - done, &src);
+            if (n == 0 || fwrite(src, 1, n, file_) != n) return false;
+            done += n;
         }
 
         offset += chunk;
-        src += chunk;
-        len -= chunk;
+        remaining -= chunk;
     }
     return true;
 }
 
-bool Qcow2DiskImage::Flush() {
-    if (!file_) return false;
+// Each step only goes out once what it depends on is durable, so a crash
+// anywhere leaks clusters at worst:
+//  1. refcounts, with clusters freed since the last flush still counted;
+//  2. barrier, if clusters were allocated: data, new L2 tables and
+//     refcount blocks are on disk before anything points at them;
+//  3. the dirty sectors of the L2 tables;
+//  4. barrier and L1 entries, if new L2 tables were linked in;
+//  5. barrier and refcounts again, if clusters were freed: nothing on
+//     disk points at them any more.
+// The barriers are skipped when their step has nothing to order.
+bool Qcow2DiskImage::WriteMetadata() {
+    if (!WriteRefcounts(true)) return false;
+
+    bool l2_dirty = std::any_of(l2_slots_.begin(), l2_slots_.end(),
+                                [](const L2Slot& s) { return s.valid && s.dirty; });
+    if (unsynced_allocs_ && (l2_dirty || l1_dirty_any_) && !SyncFile()) return false;
+    for (uint32_t slot = 0; slot < l2_slots_.size(); slot++) {
+        if (!WriteBackL2Slot(slot)) return false;
+    }
+    if (l1_dirty_any_ && !(SyncFile() && WriteL1Entries())) return false;
+    if (!pending_free_.empty() && !(SyncFile() && WriteRefcounts(false))) return false;
+    return true;
+}
 
-    // Flush all dirty L2 cache entries
-    for (auto& entry : l2_lru_) {
-        if (entry.dirty) {
-            std::vector<uint64_t> be_data(l2_entries_);
-            for (uint32_t i = 0; i < l2_entries_; i++) {
-                be_data[i] = Be64(entry.data[i]);
-            }
-            _fseeki64(file_, entry.l2_offset, SEEK_SET);
-            fwrite(be_data.data(), 1, l2_entries_ * sizeof(uint64_t), file_);
-            entry.dirty = false;
+bool Qcow2DiskImage::WriteL1Entries() {
+    for (uint32_t i = 0; i < l1_size_;) {
+        if (!l1_dirty_[i]) {
+            i++;
+            continue;
         }
+        uint32_t end = i + 1;
+        while (end < l1_size_ && l1_dirty_[end]) end++;
+        std::vector<uint64_t> be_entries(end - i);
+        for (uint32_t j = i; j < end; j++) {
+            be_entries[j - i] = Be64(l1_table_[j]);
+            l1_dirty_[j] = 0;
+        }
+        _fseeki64(file_, l1_table_offset_ + static_cast<uint64_t>(i) * sizeof(uint64_t),
+                  SEEK_SET);
+        if (fwrite(be_entries.data(), sizeof(uint64_t), be_entries.size(), file_) !=
+            be_entries.size()) {
+            LOG_ERROR("Qcow2: failed to write L1 table");
+            return false;
+        }
+        i = end;
+    }
+    l1_dirty_any_ = false;
+    return true;
+}
+
+bool Qcow2DiskImage::SyncFile() {
+    if (fflush(file_) != 0) return false;
+#ifdef _WIN32
+    HANDLE h = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file_)));
+    if (h == INVALID_HANDLE_VALUE || !FlushFileBuffers(h)) {
+        LOG_ERROR("Qcow2: FlushFileBuffers failed (%lu)", GetLastError());
+        return false;
     }
+#endif
+    unsynced_allocs_ = false;
+    return true;
+}
+
+bool Qcow2DiskImage::Flush() {
+    if (!file_) return false;
+    if (read_only_) return true;
 
-    fflush(file_);
+    // The last barrier also covers guest data written in place.
+    if (!WriteMetadata() || !SyncFile()) return false;
+    ReleasePendingFrees();
     return true;
 }
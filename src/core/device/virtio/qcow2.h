@@ -2,11 +2,15 @@
 
 #include "core/device/virtio/disk_image.h"
 #include <cstdio>
-#include <vector>
-#include <list>
+#include <memory>
+#include <string>
 #include <unordered_map>
+#include <vector>
 #include <mutex>
 
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
 #pragma pack(push, 1)
 struct Qcow2Header {
     uint32_t magic;
@@ -35,40 +39,129 @@ class Qcow2DiskImage : public DiskImage {
 public:
     ~Qcow2DiskImage() override;
 
-    bool Open(const std::string& path) override;
+    bool Open(const std::string& path, const DiskImageOptions& options) override;
     uint64_t GetSize() const override { return virtual_size_; }
     bool Read(uint64_t offset, void* buf, uint32_t len) override;
     bool Write(uint64_t offset, const void* buf, uint32_t len) override;
     bool Flush() override;
+    bool ReadV(uint64_t offset, const DiskIoVec* iov, size_t count) override;
+    bool WriteV(uint64_t offset, const DiskIoVec* iov, size_t count) override;
+    bool Discard(uint64_t offset, uint64_t len) override;
+    bool WriteZeroes(uint64_t offset, uint64_t len, bool may_unmap) override;
+    bool SupportsDiscard() const override { return refcounts_enabled_ && !read_only_; }
+    uint32_t GetDiscardGranularity() const override { return cluster_size_; }
+
+    struct L2CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint32_t capacity = 0;   // in L2 tables
+    };
+    L2CacheStats GetL2CacheStats() const;
+
+    struct CompressedCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint32_t capacity = 0;   // in clusters
+    };
+    CompressedCacheStats GetCompressedCacheStats() const;
 
 private:
     static constexpr uint32_t kQcow2Magic   = 0x514649FB;
     static constexpr uint64_t kCompressedBit = 1ULL << 62;
     static constexpr uint64_t kCopiedBit     = 1ULL << 63;
+    // v3: standard cluster reads as zeros (offset kept if preallocated)
+    static constexpr uint64_t kZeroFlag      = 1ULL << 0;
     // Mask to extract the host offset from L1/L2 entries (bits 9..55)
     static constexpr uint64_t kOffsetMask    = 0x00FFFFFFFFFFFE00ULL;
-    static constexpr size_t   kL2CacheMax    = 64;
+    // L2 cache bounds. The default covers the whole image up to the cap.
+    static constexpr uint32_t kL2CacheMinTables       = 4;
+    static constexpr uint64_t kL2CacheDefaultMaxBytes = 32ULL << 20;
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
+    // Dirty L2 entries are tracked, and written back, per 512-byte sector.
+    static constexpr uint32_t kL2DirtyChunkEntries = 64;
+    // Decompressed cluster cache: 4 MiB covers a sequential guest read
+    // pattern across a few clusters without pinning much memory.
+    static constexpr uint64_t kCompressedCacheDefaultBytes = 4ULL << 20;
+    static constexpr uint32_t kCompressedCacheMaxEntries   = 1024;
+    // Backing chains deeper than this are treated as a loop.
+    static constexpr uint32_t kMaxBackingDepth = 16;
+    static constexpr uint32_t kExtBackingFormat = 0xE2792ACA;
 
     static uint16_t Be16(uint16_t v);
     static uint32_t Be32(uint32_t v);
     static uint64_t Be64(uint64_t v);
 
     bool ReadHeader();
+    bool ReadHeaderExtensions(uint64_t start, uint64_t end);
     bool ReadL1Table();
+    bool OpenBacking(const std::string& path, const DiskImageOptions& options);
+
+    // Fill `buf` with what an unallocated cluster shows: backing image data,
+    // or zeros beyond its end (or without one).
+    bool ReadBacking(uint64_t offset, void* buf, uint32_t len);
 
     // L2 cache: returns pointer to cached L2 table entries (host byte order).
-    // The returned pointer is valid until the next L2 lookup (LRU eviction).
+    // The returned pointer is valid until the next L2 cache miss.
+    bool InitL2Cache(uint64_t cache_bytes);
     uint64_t* GetL2Table(uint64_t l2_offset);
-    void EvictL2Cache();
+    void MarkL2Dirty(uint64_t l2_offset, uint32_t first, uint32_t count = 1);
+    uint32_t FindL2Slot(uint64_t l2_offset) const;
+    uint32_t ClaimL2Slot();
+    // Writes the dirty sectors of a slot, each run of them in one write.
+    bool WriteBackL2Slot(uint32_t slot);
+    uint32_t L2IndexHome(uint64_t l2_offset) const;
+    void L2IndexInsert(uint64_t l2_offset, uint32_t slot);
+    void L2IndexErase(uint64_t l2_offset);
+    uint64_t* L2SlotData(uint32_t slot) {
+        return l2_slab_.data() + static_cast<size_t>(slot) * l2_entries_;
+    }
+    uint64_t* L2DirtyBits(uint32_t slot) {
+        return l2_dirty_bits_.data() + static_cast<size_t>(slot) * l2_dirty_words_;
+    }
+
+    // Writes every dirty piece of metadata in an order that leaves the
+    // image consistent, apart from leaked clusters, wherever a crash
+    // interrupts it. Used by Flush() and when a dirty L2 table is evicted.
+    bool WriteMetadata();
+    bool WriteL1Entries();
+    // Makes everything written so far durable.
+    bool SyncFile();
 
     // Resolve a virtual offset to a host file offset. Returns 0 if unallocated.
-    // Sets `compressed` and `comp_size` if the cluster is compressed.
+    // Sets `compressed` and `comp_size` if the cluster is compressed, and
+    // `unallocated` if the cluster is not mapped (reads fall through to the
+    // backing image) rather than zero-flagged.
     uint64_t ResolveOffset(uint64_t virt_offset, bool* compressed,
-                           uint64_t* comp_host_off, uint32_t* comp_size);
+                           uint64_t* comp_host_off, uint32_t* comp_size,
+                           bool* unallocated = nullptr);
+    void DecodeCompressed(uint64_t l2_entry, uint64_t* host_off,
+                          uint32_t* size) const;
 
-    // Allocate a new cluster at the end of the file.
+    // Allocate clusters, reusing freed ones before growing the file.
+    // Returned clusters hold one reference each and are zero-filled,
+    // unless the caller is about to overwrite all of them. Returns 0,
+    // allocating nothing, when the zero fill cannot be written.
     uint64_t AllocateCluster();
-    uint64_t AllocateClusters(uint32_t count);
+    uint64_t AllocateClusters(uint32_t count, bool zero_fill = true);
+    // Maps the unallocated whole clusters a write starts with, up to the
+    // end of their L2 table, to one run of new clusters.
+    void PreallocateRun(uint64_t offset, uint64_t len);
+
+    // Refcount maintenance. refcounts_ is authoritative in memory; blocks
+    // are written back on Flush().
+    bool LoadRefcounts();
+    void ScanReferences(std::vector<uint16_t>& refs);
+    void AdjustRefcount(uint64_t cluster, int delta);
+    void ReleaseClusters(uint64_t host_off, uint64_t len);
+    void TrackCluster(uint64_t cluster);
+    uint64_t FindFreeRun(uint32_t count);
+    bool GrowRefcountTable(uint64_t min_blocks);
+    // With `hold_frees`, clusters freed since the last flush are written
+    // as still in use, since metadata on disk may still point at them.
+    bool WriteRefcounts(bool hold_frees);
+    void ReleasePendingFrees();
+    void PunchHole(uint64_t host_off, uint64_t len);
 
     // Ensure L2 table is allocated for the given L1 index.
     uint64_t* EnsureL2Table(uint32_t l1_idx);
@@ -77,9 +170,25 @@ private:
                      void* buf, uint32_t len);
     bool ReadCompressedCluster(uint64_t comp_host_off, uint32_t comp_size,
                                uint64_t in_cluster_off, void* buf, uint32_t len);
+
+    // Decompressed cluster cache, keyed by the compressed data's host
+    // offset. The returned pointer is valid until the next cache miss.
+    void InitCompressedCache(uint64_t cache_bytes);
+    const uint8_t* GetDecompressedCluster(uint64_t comp_host_off, uint32_t comp_size);
+    void InvalidateCompressedCache(uint64_t comp_host_off);
+    bool Decompress(uint64_t comp_host_off, uint32_t comp_size, uint8_t* out);
     bool WriteCluster(uint64_t host_off, uint64_t in_cluster_off,
                       const void* buf, uint32_t len);
 
+    // Make the cluster holding `offset` writable in place (allocating and
+    // copying it on first write). Returns its host offset, or 0 on failure.
+    uint64_t PrepareClusterWrite(uint64_t offset, uint32_t chunk);
+
+    // Rewrite the L2 entry of the whole cluster at `offset` and drop the
+    // references the old entry held.
+    bool SetClusterEntry(uint64_t offset, uint64_t new_entry);
+    void ReleaseEntry(uint64_t l2_entry);
+
     FILE* file_ = nullptr;
     uint64_t virtual_size_ = 0;
     uint32_t cluster_bits_ = 0;
@@ -88,17 +197,73 @@ private:
     uint32_t l1_size_ = 0;
     uint64_t l1_table_offset_ = 0;
     uint32_t version_ = 0;
+    bool read_only_ = false;
+
+    // Backing image (read-only) for clusters this image does not map.
+    std::string backing_name_;
+    std::string backing_format_;     // from the header extension, may be empty
+    std::unique_ptr<DiskImage> backing_;
+    uint64_t backing_size_ = 0;
 
     std::vector<uint64_t> l1_table_;  // in host byte order
+    // L1 entries for new L2 tables, written once the tables are on disk.
+    std::vector<uint8_t> l1_dirty_;
+    bool l1_dirty_any_ = false;
+    // Clusters allocated since the last SyncFile(). Their contents must be
+    // durable before metadata pointing at them is written.
+    bool unsynced_allocs_ = false;
     uint64_t file_end_ = 0;          // current end of file (for append allocations)
+
+    // Refcounts (16-bit only; other widths or internal snapshots fall back
+    // to append-only allocation)
+    static constexpr uint64_t kNoCluster = UINT64_MAX;
+    bool refcounts_enabled_ = false;
+    uint32_t refcount_order_ = 4;
+    uint32_t nb_snapshots_ = 0;
+    uint64_t refcount_table_offset_ = 0;
+    uint32_t refcount_table_clusters_ = 0;
+    uint32_t refblock_entries_ = 0;  // refcounts per refcount block
+    std::vector<uint64_t> refcount_table_;   // host byte order
+    std::vector<uint16_t> refcounts_;        // per host cluster up to file_end_
+    std::vector<uint64_t> free_bitmap_;      // bit set = cluster reusable
+    std::vector<uint8_t> refblock_dirty_;    // per refcount table index
+    bool refcount_table_dirty_ = false;
+    uint64_t alloc_hint_ = 0;                // no free cluster below this
+    // Clusters freed since the last Flush; reused only once the metadata
+    // that stopped referencing them has reached the disk.
+    std::vector<uint64_t> pending_free_;
+    bool sparse_ = false;                    // host file marked sparse
     uint8_t compression_type_ = 0;   // 0=zlib (deflate), 1=zstd
 
-    // L2 LRU cache
-    struct L2CacheEntry {
-        uint64_t l2_offset;           // file offset of this L2 table
-        std::vector<uint64_t> data;   // entries in host byte order
-        bool dirty;
+    // L2 cache: every table lives in one contiguous slab, indexed by an
+    // open-addressed (linear probing) table and evicted with CLOCK.
+    struct L2Slot {
+        uint64_t l2_offset = 0;       // file offset of this L2 table
+        bool valid = false;
+        bool dirty = false;
+        bool referenced = false;      // CLOCK second-chance bit
+    };
+    std::vector<uint64_t> l2_slab_;   // capacity * l2_entries_, host byte order
+    std::vector<L2Slot> l2_slots_;
+    std::vector<uint32_t> l2_index_;  // slot numbers, kNoSlot when empty
+    std::vector<uint64_t> l2_dirty_bits_;  // per slot, one bit per sector
+    uint32_t l2_dirty_words_ = 0;
+    std::vector<uint64_t> l2_be_buf_;  // big-endian staging for writeback
+    uint32_t l2_index_mask_ = 0;
+    uint32_t l2_clock_hand_ = 0;
+    L2CacheStats l2_stats_;
+
+    struct CompressedCacheEntry {
+        uint64_t comp_host_off = 0;
+        uint64_t last_use = 0;        // 0 = empty
     };
-    std::list<L2CacheEntry> l2_lru_;
-    std::unordered_map<uint64_t, std::list<L2CacheEntry>::iterator> l2_map_;
+    std::vector<uint8_t> zcache_slab_;   // capacity * cluster_size_
+    std::vector<CompressedCacheEntry> zcache_entries_;
+    std::unordered_map<uint64_t, uint32_t> zcache_index_;
+    uint64_t zcache_tick_ = 0;
+    CompressedCacheStats zcache_stats_;
+    std::vector<uint8_t> comp_buf_;      // compressed input staging
+    // Decompression contexts, created on first use and reused.
+    z_stream_s* inflate_ = nullptr;
+    ZSTD_DCtx_s* zstd_dctx_ = nullptr;
 };
@@ -0,0 +1,134 @@
+#include "core/device/virtio/qcow2_create.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kQcow2Magic   = 0x514649FB;
+constexpr uint32_t kClusterBits  = 16;
+constexpr uint64_t kClusterSize  = 1ULL << kClusterBits;
+constexpr uint32_t kHeaderLength = 104;
+// Header extension carrying the backing image format
+constexpr uint32_t kExtBackingFormat = 0xE2792ACA;
+
+void PutBe32(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+void PutBe64(uint8_t* p, uint64_t v) {
+    PutBe32(p, static_cast<uint32_t>(v >> 32));
+    PutBe32(p + 4, static_cast<uint32_t>(v));
+}
+
+uint64_t GetBe64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+// Virtual size and format of the image that will back the overlay.
+bool ProbeBacking(const std::string& path, uint64_t* size, const char** format,
+                  std::string* error) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        if (error) *error = "cannot open base disk: " + path;
+        return false;
+    }
+
+    uint8_t hdr[32] = {};
+    size_t got = fread(hdr, 1, sizeof(hdr), f);
+    uint32_t magic = (static_cast<uint32_t>(hdr[0]) << 24) | (hdr[1] << 16) |
+                     (hdr[2] << 8) | hdr[3];
+    if (got >= sizeof(hdr) && magic == kQcow2Magic) {
+        *size = GetBe64(hdr + 24);
+        *format = "qcow2";
+    } else {
+        _fseeki64(f, 0, SEEK_END);
+        *size = static_cast<uint64_t>(_ftelli64(f));
+        *format = "raw";
+    }
+    fclose(f);
+
+    if (*size == 0) {
+        if (error) *error = "base disk is empty: " + path;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+bool CreateQcow2Overlay(const std::string& path, const std::string& backing_path,
+                        std::string* error) {
+    uint64_t virtual_size = 0;
+    const char* format = nullptr;
+    if (!ProbeBacking(backing_path, &virtual_size, &format, error)) return false;
+
+    if (backing_path.size() > 1023) {
+        if (error) *error = "base disk path too long";
+        return false;
+    }
+
+    // Layout: header | refcount table | refcount block | L1 table
+    uint64_t l2_coverage = (kClusterSize / 8) * kClusterSize;
+    uint64_t l1_size = (virtual_size + l2_coverage - 1) / l2_coverage;
+    uint64_t l1_clusters = (l1_size * 8 + kClusterSize - 1) / kClusterSize;
+    uint64_t total_clusters = 3 + l1_clusters;
+    if (total_clusters > kClusterSize / 2) {
+        if (error) *error = "base disk too large for overlay";
+        return false;
+    }
+
+    std::vector<uint8_t> image(static_cast<size_t>(total_clusters * kClusterSize), 0);
+    uint8_t* h = image.data();
+
+    // Header extensions start right after the v3 header; the backing file
+    // name follows the end-of-extensions marker.
+    size_t fmt_len = strlen(format);
+    size_t ext_pos = kHeaderLength;
+    PutBe32(h + ext_pos, kExtBackingFormat);
+    PutBe32(h + ext_pos + 4, static_cast<uint32_t>(fmt_len));
+    memcpy(h + ext_pos + 8, format, fmt_len);
+    ext_pos += 8 + ((fmt_len + 7) & ~static_cast<size_t>(7));
+    ext_pos += 8;  // end marker: type 0, length 0
+    size_t name_pos = ext_pos;
+    memcpy(h + name_pos, backing_path.data(), backing_path.size());
+
+    PutBe32(h + 0, kQcow2Magic);
+    PutBe32(h + 4, 3);                                   // version
+    PutBe64(h + 8, name_pos);                            // backing_file_offset
+    PutBe32(h + 16, static_cast<uint32_t>(backing_path.size()));
+    PutBe32(h + 20, kClusterBits);
+    PutBe64(h + 24, virtual_size);
+    PutBe32(h + 32, 0);                                  // crypt_method
+    PutBe32(h + 36, static_cast<uint32_t>(l1_size));
+    PutBe64(h + 40, 3 * kClusterSize);                   // l1_table_offset
+    PutBe64(h + 48, 1 * kClusterSize);                   // refcount_table_offset
+    PutBe32(h + 56, 1);                                  // refcount_table_clusters
+    PutBe32(h + 96, 4);                                  // refcount_order (16-bit)
+    PutBe32(h + 100, kHeaderLength);
+
+    PutBe64(image.data() + kClusterSize, 2 * kClusterSize);
+    uint8_t* refblock = image.data() + 2 * kClusterSize;
+    for (uint64_t c = 0; c < total_clusters; c++) {
+        refblock[c * 2 + 1] = 1;
+    }
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        if (error) *error = "cannot create overlay: " + path;
+        return false;
+    }
+    bool ok = fwrite(image.data(), 1, image.size(), f) == image.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        remove(path.c_str());
+        if (error) *error = "failed to write overlay: " + path;
+    }
+    return ok;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+// Create an empty qcow2 v3 overlay at `path` whose unallocated clusters read
+// through to `backing_path` (raw or qcow2). The overlay takes the backing
+// image's virtual size. Has no dependencies beyond the C runtime so the
+// manager can create linked clones without linking the device model.
+bool CreateQcow2Overlay(const std::string& path, const std::string& backing_path,
+                        std::string* error);
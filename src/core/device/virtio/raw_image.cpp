@@ -1,47 +1,417 @@
 #include "core/device/virtio/raw_image.h"
+#include "core/vmm/utf8.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <winioctl.h>
+
+namespace {
+
+HANDLE AsHandle(void* handle) {
+    return reinterpret_cast<HANDLE>(handle);
+}
+
+// Each I/O thread waits on its own manual-reset event so concurrent
+// requests on the shared handle never observe each other's completion.
+class ThreadIoEvent {
+public:
+    ThreadIoEvent() : event_(CreateEventW(nullptr, TRUE, FALSE, nullptr)) {}
+    ~ThreadIoEvent() { if (event_) CloseHandle(event_); }
+    HANDLE Get() const { return event_; }
+
+private:
+    HANDLE event_;
+};
+
+HANDLE CurrentThreadIoEvent() {
+    thread_local ThreadIoEvent event;
+    return event.Get();
+}
+
+// Page-aligned per-thread buffer used to coalesce vectored requests into a
+// single host transfer. Grows on demand and lives as long as the thread.
+class StagingBuffer {
+public:
+    ~StagingBuffer() { if (data_) VirtualFree(data_, 0, MEM_RELEASE); }
+
+    uint8_t* Get(uint32_t len) {
+        if (len <= capacity_) return data_;
+        if (data_) VirtualFree(data_, 0, MEM_RELEASE);
+        capacity_ = static_cast<uint32_t>(AlignUp(len, 64 * 1024));
+        data_ = static_cast<uint8_t*>(VirtualAlloc(
+            nullptr, capacity_, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        if (!data_) capacity_ = 0;
+        return data_;
+    }
+
+private:
+    uint8_t* data_ = nullptr;
+    uint32_t capacity_ = 0;
+};
+
+uint8_t* CurrentThreadStaging(uint32_t len) {
+    thread_local StagingBuffer staging;
+    return staging.Get(len);
+}
+
+}  // namespace
 
 RawDiskImage::~RawDiskImage() {
-    if (file_) {
-        fclose(file_);
-        file_ = nullptr;
+    if (handle_) {
+        CloseHandle(AsHandle(handle_));
+        handle_ = nullptr;
     }
 }
 
-bool RawDiskImage::Open(const std::string& path) {
-    file_ = fopen(path.c_str(), "r+b");
-    if (!file_) {
-        LOG_ERROR("RawDiskImage: failed to open %s", path.c_str());
+bool RawDiskImage::Open(const std::string& path, const DiskImageOptions& options) {
+    std::wstring wpath = Utf8ToWide(path);
+    DWORD flags = FILE_FLAG_OVERLAPPED;
+    if (options.direct_io) flags |= FILE_FLAG_NO_BUFFERING;
+    read_only_ = options.read_only;
+    DWORD access = read_only_ ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+
+    HANDLE h = CreateFileW(wpath.c_str(), access,
+                           FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           flags, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("RawDiskImage: failed to open %s (%lu)",
+                  path.c_str(), GetLastError());
         return false;
     }
 
-    _fseeki64(file_, 0, SEEK_END);
-    disk_size_ = static_cast<uint64_t>(_ftelli64(file_));
-    _fseeki64(file_, 0, SEEK_SET);
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(h, &size)) {
+        LOG_ERROR("RawDiskImage: cannot query size of %s", path.c_str());
+        CloseHandle(h);
+        return false;
+    }
+    disk_size_ = static_cast<uint64_t>(size.QuadPart);
 
     if (disk_size_ < 512) {
         LOG_ERROR("RawDiskImage: image too small (%llu bytes)", disk_size_);
-        fclose(file_);
-        file_ = nullptr;
+        CloseHandle(h);
         return false;
     }
 
-    LOG_INFO("RawDiskImage: %s, %llu bytes (%llu MB)",
-             path.c_str(), disk_size_, disk_size_ / (1024 * 1024));
+    direct_io_ = options.direct_io;
+    if (direct_io_ && (disk_size_ % kDirectIoAlign) != 0) {
+        // An unbuffered write to the tail sector would grow the file.
+        LOG_WARN("RawDiskImage: size not a multiple of %u, direct I/O disabled",
+                 kDirectIoAlign);
+        CloseHandle(h);
+        h = CreateFileW(wpath.c_str(), access,
+                        FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_FLAG_OVERLAPPED, nullptr);
+        if (h == INVALID_HANDLE_VALUE) {
+            LOG_ERROR("RawDiskImage: failed to reopen %s", path.c_str());
+            return false;
+        }
+        direct_io_ = false;
+    }
+    handle_ = h;
+
+    LOG_INFO("RawDiskImage: %s, %llu bytes (%llu MB)%s%s",
+             path.c_str(), disk_size_, disk_size_ / (1024 * 1024),
+             direct_io_ ? ", direct I/O" : "", read_only_ ? ", read-only" : "");
+    return true;
+}
+
+bool RawDiskImage::IsDirectAligned(uint64_t offset, const void* buf,
+                                   uint32_t len) const {
+    return (offset % kDirectIoAlign) == 0 &&
+           (len % kDirectIoAlign) == 0 &&
+           (reinterpret_cast<uintptr_t>(buf) % kDirectIoAlign) == 0;
+}
+
+bool RawDiskImage::TransferAt(bool write, uint64_t offset, void* buf,
+                              uint32_t len) {
+    HANDLE h = AsHandle(handle_);
+    HANDLE event = CurrentThreadIoEvent();
+    if (!event) return false;
+
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        // Low bit set: don't queue a completion packet if the handle is
+        // ever associated with a completion port.
+        ov.hEvent = reinterpret_cast<HANDLE>(
+            reinterpret_cast<uintptr_t>(event) | 1);
+
+        DWORD done = 0;
+        BOOL ok = write ? WriteFile(h, p, len, nullptr, &ov)
+                        : ReadFile(h, p, len, nullptr, &ov);
+        if (!ok && GetLastError() != ERROR_IO_PENDING) {
+            LOG_ERROR("RawDiskImage: %s at 0x%llX (%u bytes) failed (%lu)",
+                      write ? "write" : "read", offset, len, GetLastError());
+            return false;
+        }
+        if (!GetOverlappedResult(h, &ov, &done, TRUE)) {
+            LOG_ERROR("RawDiskImage: %s at 0x%llX completed with error %lu",
+                      write ? "write" : "read", offset, GetLastError());
+            return false;
+        }
+        if (done == 0) return false;
+
+        p += done;
+        offset += done;
+        len -= done;
+    }
     return true;
 }
 
+bool RawDiskImage::BouncedRead(uint64_t offset, void* buf, uint32_t len) {
+    uint64_t start = AlignDown(offset, kDirectIoAlign);
+    uint64_t end = AlignUp(offset + len, kDirectIoAlign);
+    uint32_t span = static_cast<uint32_t>(end - start);
+
+    void* bounce = VirtualAlloc(nullptr, span, MEM_COMMIT | MEM_RESERVE,
+                                PAGE_READWRITE);
+    if (!bounce) return false;
+
+    bool ok = TransferAt(false, start, bounce, span);
+    if (ok) {
+        memcpy(buf, static_cast<uint8_t*>(bounce) + (offset - start), len);
+    }
+    VirtualFree(bounce, 0, MEM_RELEASE);
+    return ok;
+}
+
+bool RawDiskImage::BouncedWrite(uint64_t offset, const void* buf, uint32_t len) {
+    uint64_t start = AlignDown(offset, kDirectIoAlign);
+    uint64_t end = AlignUp(offset + len, kDirectIoAlign);
+    uint32_t span = static_cast<uint32_t>(end - start);
+
+    void* bounce = VirtualAlloc(nullptr, span, MEM_COMMIT | MEM_RESERVE,
+                                PAGE_READWRITE);
+    if (!bounce) return false;
+
+    auto* bytes = static_cast<uint8_t*>(bounce);
+    bool ok = true;
+    {
+        std::lock_guard<std::mutex> lock(bounce_mutex_);
+        // Only the partially covered head and tail blocks need old data.
+        bool head_partial = offset != start;
+        bool tail_partial = offset + len != end;
+        if (head_partial) {
+            ok = TransferAt(false, start, bytes, kDirectIoAlign);
+        }
+        if (ok && tail_partial && !(head_partial && span == kDirectIoAlign)) {
+            ok = TransferAt(false, end - kDirectIoAlign,
+                            bytes + span - kDirectIoAlign, kDirectIoAlign);
+        }
+        if (ok) {
+            memcpy(bytes + (offset - start), buf, len);
+            ok = TransferAt(true, start, bytes, span);
+        }
+    }
+    VirtualFree(bounce, 0, MEM_RELEASE);
+    return ok;
+}
+
 bool RawDiskImage::Read(uint64_t offset, void* buf, uint32_t len) {
     if (offset + len > disk_size_) return false;
-    if (_fseeki64(file_, offset, SEEK_SET) != 0) return false;
-    return fread(buf, 1, len, file_) == len;
+    if (len == 0) return true;
+    if (direct_io_ && !IsDirectAligned(offset, buf, len)) {
+        return BouncedRead(offset, buf, len);
+    }
+    return TransferAt(false, offset, buf, len);
 }
 
 bool RawDiskImage::Write(uint64_t offset, const void* buf, uint32_t len) {
-    if (offset + len > disk_size_) return false;
-    if (_fseeki64(file_, offset, SEEK_SET) != 0) return false;
-    return fwrite(buf, 1, len, file_) == len;
+    if (read_only_ || offset + len > disk_size_) return false;
+    if (len == 0) return true;
+    if (direct_io_ && !IsDirectAligned(offset, buf, len)) {
+        return BouncedWrite(offset, buf, len);
+    }
+    return TransferAt(true, offset, const_cast<void*>(buf), len);
+}
+
+bool RawDiskImage::CanScatterGather(uint64_t offset, const DiskIoVec* iov,
+                                    size_t count) const {
+    // ReadFileScatter/WriteFileGather move whole, page-aligned pages only.
+    if (!direct_io_ || (offset % kDirectIoAlign) != 0) return false;
+    for (size_t i = 0; i < count; i++) {
+        if ((reinterpret_cast<uintptr_t>(iov[i].base) % kDirectIoAlign) != 0 ||
+            (iov[i].len % kDirectIoAlign) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RawDiskImage::ScatterGatherAt(bool write, uint64_t offset,
+                                   const DiskIoVec* iov, size_t count) {
+    HANDLE h = AsHandle(handle_);
+    HANDLE event = CurrentThreadIoEvent();
+    if (!event) return false;
+
+    thread_local std::vector<FILE_SEGMENT_ELEMENT> segments;
+    segments.clear();
+    uint32_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        auto* p = static_cast<uint8_t*>(iov[i].base);
+        for (uint32_t done = 0; done < iov[i].len; done += kDirectIoAlign) {
+            FILE_SEGMENT_ELEMENT seg{};
+            seg.Buffer = PtrToPtr64(p + done);
+            segments.push_back(seg);
+        }
+        total += iov[i].len;
+    }
+    segments.push_back(FILE_SEGMENT_ELEMENT{});  // array is null-terminated
+
+    OVERLAPPED ov{};
+    ov.Offset = static_cast<DWORD>(offset);
+    ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    ov.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<uintptr_t>(event) | 1);
+
+    BOOL ok = write ? WriteFileGather(h, segments.data(), total, nullptr, &ov)
+                    : ReadFileScatter(h, segments.data(), total, nullptr, &ov);
+    if (!ok && GetLastError() != ERROR_IO_PENDING) {
+        LOG_ERROR("RawDiskImage: %s at 0x%llX (%u bytes) failed (%lu)",
+                  write ? "gather write" : "scatter read", offset, total,
+                  GetLastError());
+        return false;
+    }
+    DWORD done = 0;
+    if (!GetOverlappedResult(h, &ov, &done, TRUE) || done != total) {
+        LOG_ERROR("RawDiskImage: %s at 0x%llX completed short (%lu/%u)",
+                  write ? "gather write" : "scatter read", offset, done, total);
+        return false;
+    }
+    return true;
+}
+
+bool RawDiskImage::VectoredTransfer(bool write, uint64_t offset,
+                                    const DiskIoVec* iov, size_t count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) total += iov[i].len;
+    if (offset + total > disk_size_) return false;
+
+    if (CanScatterGather(offset, iov, count)) {
+        return ScatterGatherAt(write, offset, iov, count);
+    }
+
+    // Otherwise copy through one staging buffer: a memcpy per segment is far
+    // cheaper than a host round trip per segment.
+    uint8_t* staging = total <= kMaxStagingBytes
+        ? CurrentThreadStaging(static_cast<uint32_t>(total)) : nullptr;
+    if (!staging) {
+        return write ? DiskImage::WriteV(offset, iov, count)
+                     : DiskImage::ReadV(offset, iov, count);
+    }
+
+    uint32_t len = static_cast<uint32_t>(total);
+    if (write) {
+        uint8_t* p = staging;
+        for (size_t i = 0; i < count; i++) {
+            memcpy(p, iov[i].base, iov[i].len);
+            p += iov[i].len;
+        }
+        return Write(offset, staging, len);
+    }
+
+    if (!Read(offset, staging, len)) return false;
+    const uint8_t* p = staging;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(iov[i].base, p, iov[i].len);
+        p += iov[i].len;
+    }
+    return true;
+}
+
+bool RawDiskImage::ReadV(uint64_t offset, const DiskIoVec* iov, size_t count) {
+    if (count == 1) return Read(offset, iov[0].base, iov[0].len);
+    return VectoredTransfer(false, offset, iov, count);
+}
+
+bool RawDiskImage::WriteV(uint64_t offset, const DiskIoVec* iov, size_t count) {
+    if (read_only_) return false;
+    if (count == 1) return Write(offset, iov[0].base, iov[0].len);
+    return VectoredTransfer(true, offset, iov, count);
+}
+
+bool RawDiskImage::EnsureSparse() {
+    if (sparse_.load(std::memory_order_acquire)) return true;
+
+    HANDLE h = AsHandle(handle_);
+    HANDLE event = CurrentThreadIoEvent();
+    if (!event) return false;
+
+    OVERLAPPED ov{};
+    ov.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<uintptr_t>(event) | 1);
+    DWORD bytes = 0;
+    if (!DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0,
+                         nullptr, &ov) &&
+        (GetLastError() != ERROR_IO_PENDING ||
+         !GetOverlappedResult(h, &ov, &bytes, TRUE))) {
+        LOG_WARN("RawDiskImage: FSCTL_SET_SPARSE failed (%lu)", GetLastError());
+        return false;
+    }
+    sparse_.store(true, std::memory_order_release);
+    return true;
+}
+
+bool RawDiskImage::ZeroRange(uint64_t offset, uint64_t len, bool* mapped) {
+    HANDLE h = AsHandle(handle_);
+    HANDLE event = CurrentThreadIoEvent();
+    if (!event) return false;
+
+    // On a sparse file this deallocates whole allocation units; elsewhere
+    // the file system zeros the range without us moving the data.
+    FILE_ZERO_DATA_INFORMATION info{};
+    info.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    info.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + len);
+
+    OVERLAPPED ov{};
+    ov.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<uintptr_t>(event) | 1);
+    DWORD bytes = 0;
+    if (!DeviceIoControl(h, FSCTL_SET_ZERO_DATA, &info, sizeof(info),
+                         nullptr, 0, nullptr, &ov) &&
+        (GetLastError() != ERROR_IO_PENDING ||
+         !GetOverlappedResult(h, &ov, &bytes, TRUE))) {
+        DWORD error = GetLastError();
+        // Views of the file (--disk-mmap) keep it from being zeroed in
+        // place for as long as they are mapped, which is until close.
+        if (error == ERROR_USER_MAPPED_FILE) {
+            if (mapped) *mapped = true;
+            if (!warned_mapped_.exchange(true, std::memory_order_relaxed)) {
+                LOG_WARN("RawDiskImage: the image is mapped, so discarded and "
+                         "zeroed ranges are written with zeros instead");
+            }
+            return false;
+        }
+        LOG_WARN("RawDiskImage: FSCTL_SET_ZERO_DATA at 0x%llX failed (%lu)",
+                 offset, error);
+        return false;
+    }
+    return true;
+}
+
+bool RawDiskImage::Discard(uint64_t offset, uint64_t len) {
+    if (read_only_ || offset + len > disk_size_) return false;
+    // Discard is advisory; failing to punch is not an I/O error. A mapped
+    // image frees no space either way, but the range reads back as zeros
+    // as it would unmapped.
+    bool mapped = false;
+    if (len && EnsureSparse() && !ZeroRange(offset, len, &mapped) && mapped) {
+        return DiskImage::WriteZeroes(offset, len, false);
+    }
+    return true;
+}
+
+bool RawDiskImage::WriteZeroes(uint64_t offset, uint64_t len, bool may_unmap) {
+    if (read_only_ || offset + len > disk_size_) return false;
+    if (len == 0) return true;
+    if (may_unmap) EnsureSparse();
+    if (ZeroRange(offset, len)) return true;
+    return DiskImage::WriteZeroes(offset, len, may_unmap);
 }
 
 bool RawDiskImage::Flush() {
-    return fflush(file_) == 0;
+    if (read_only_) return true;
+    return FlushFileBuffers(AsHandle(handle_)) != 0;
 }
@@ -1,19 +1,59 @@
 #pragma once
 
 #include "core/device/virtio/disk_image.h"
-#include <cstdio>
+#include <atomic>
+#include <mutex>
 
+// Raw image on a Win32 overlapped handle. All transfers are positional, so
+// any number of requests may be in flight at once. In direct I/O mode the
+// host page cache is bypassed and aligned guest buffers are DMA targets.
 class RawDiskImage : public DiskImage {
 public:
     ~RawDiskImage() override;
 
-    bool Open(const std::string& path) override;
+    bool Open(const std::string& path, const DiskImageOptions& options) override;
     uint64_t GetSize() const override { return disk_size_; }
     bool Read(uint64_t offset, void* buf, uint32_t len) override;
     bool Write(uint64_t offset, const void* buf, uint32_t len) override;
     bool Flush() override;
+    bool ReadV(uint64_t offset, const DiskIoVec* iov, size_t count) override;
+    bool WriteV(uint64_t offset, const DiskIoVec* iov, size_t count) override;
+    bool Discard(uint64_t offset, uint64_t len) override;
+    bool WriteZeroes(uint64_t offset, uint64_t len, bool may_unmap) override;
+    bool SupportsDiscard() const override { return !read_only_; }
+    bool SupportsConcurrentIo() const override { return true; }
+
+protected:
+    void* handle() const { return handle_; }
 
 private:
-    FILE* file_ = nullptr;
+    // FILE_FLAG_NO_BUFFERING needs sector-aligned offsets, lengths and
+    // buffers; 4 KiB covers both 512e and 4Kn host disks.
+    static constexpr uint32_t kDirectIoAlign = 4096;
+    // Larger vectored requests skip the staging copy and go per segment.
+    static constexpr uint32_t kMaxStagingBytes = 4u << 20;
+
+    bool IsDirectAligned(uint64_t offset, const void* buf, uint32_t len) const;
+    bool TransferAt(bool write, uint64_t offset, void* buf, uint32_t len);
+    bool BouncedRead(uint64_t offset, void* buf, uint32_t len);
+    bool BouncedWrite(uint64_t offset, const void* buf, uint32_t len);
+    bool CanScatterGather(uint64_t offset, const DiskIoVec* iov, size_t count) const;
+    bool ScatterGatherAt(bool write, uint64_t offset, const DiskIoVec* iov,
+                         size_t count);
+    bool EnsureSparse();
+    // Zeros the range in the file system. Fails on a file with mapped
+    // views, which makes `mapped` true; the caller then writes zeros.
+    bool ZeroRange(uint64_t offset, uint64_t len, bool* mapped = nullptr);
+    bool VectoredTransfer(bool write, uint64_t offset, const DiskIoVec* iov,
+                          size_t count);
+
+    void* handle_ = nullptr;  // HANDLE opened with FILE_FLAG_OVERLAPPED
     uint64_t disk_size_ = 0;
+    bool direct_io_ = false;
+    bool read_only_ = false;
+    std::atomic<bool> sparse_{false};  // FSCTL_SET_SPARSE applied
+    std::atomic<bool> warned_mapped_{false};
+
+    // Serializes read-modify-write of partially covered aligned blocks.
+    std::mutex bounce_mutex_;
 };
@@ -0,0 +1,250 @@
+#include "core/device/virtio/virtio_balloon.h"
+#include "core/vmm/guest_ram.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#define NOMINMAX
+#include <windows.h>
+
+uint64_t VirtioBalloonDevice::GetDeviceFeatures() const {
+    uint64_t features = VIRTIO_BALLOON_F_VERSION_1 | VIRTIO_BALLOON_F_DEFLATE_ON_OOM;
+    // Large pages cannot be discarded, so free pages would only cost the
+    // guest work for nothing.
+    if (!mem_.large_pages)
+        features |= VIRTIO_BALLOON_F_FREE_PAGE_HINT | VIRTIO_BALLOON_F_REPORTING;
+    return features;
+}
+
+VirtioBalloonDevice::Queue VirtioBalloonDevice::QueueAt(uint32_t queue_idx) const {
+    if (queue_idx == 0) return Queue::kInflate;
+    if (queue_idx == 1) return Queue::kDeflate;
+    uint64_t features = mmio_ ? mmio_->GetDriverFeatures() : 0;
+    uint32_t next = 2;
+    if (features & VIRTIO_BALLOON_F_FREE_PAGE_HINT) {
+        if (queue_idx == next) return Queue::kFreePage;
+        next++;
+    }
+    if ((features & VIRTIO_BALLOON_F_REPORTING) && queue_idx == next) {
+        return Queue::kReporting;
+    }
+    return Queue::kNone;
+}
+
+void VirtioBalloonDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
+    switch (QueueAt(queue_idx)) {
+    case Queue::kInflate:
+        ProcessPfnQueue(vq, true);
+        break;
+    case Queue::kDeflate:
+        ProcessPfnQueue(vq, false);
+        break;
+    case Queue::kFreePage:
+        ProcessFreePageQueue(vq);
+        break;
+    case Queue::kReporting:
+        ProcessReportingQueue(vq);
+        break;
+    case Queue::kNone:
+        break;
+    }
+}
+
+void VirtioBalloonDevice::ProcessPfnQueue(VirtQueue& vq, bool inflate) {
+    uint16_t head;
+    bool pushed = false;
+    while (vq.PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        if (!vq.WalkChain(head, &chain)) {
+            vq.PushUsed(head, 0);
+            pushed = true;
+            continue;
+        }
+
+        uint64_t pages = 0;
+        uint8_t* run = nullptr;
+        uint64_t run_len = 0;
+        for (auto& elem : chain) {
+            if (elem.writable) continue;
+            for (uint32_t off = 0; off + sizeof(uint32_t) <= elem.len;
+                 off += sizeof(uint32_t)) {
+                uint32_t pfn;
+                std::memcpy(&pfn, elem.addr + off, sizeof(pfn));
+                pages++;
+                if (!inflate) continue;
+
+                uint8_t* hva = mem_.GpaToHva(
+                    static_cast<uint64_t>(pfn) << VIRTIO_BALLOON_PFN_SHIFT);
+                if (!hva) continue;
+                // The driver hands pages over in PFN order, so runs are long.
+                if (run && hva == run + run_len) {
+                    run_len += kPageSize;
+                    continue;
+                }
+                if (run) ReleaseRange(run, run_len);
+                run = hva;
+                run_len = kPageSize;
+            }
+        }
+        if (run) ReleaseRange(run, run_len);
+
+        (inflate ? inflated_pages_ : deflated_pages_)
+            .fetch_add(pages, std::memory_order_relaxed);
+        vq.PushUsed(head, 0);
+        pushed = true;
+    }
+    if (pushed && mmio_) mmio_->NotifyUsedBuffer();
+}
+
+void VirtioBalloonDevice::ProcessFreePageQueue(VirtQueue& vq) {
+    uint16_t head;
+    bool pushed = false;
+    bool finished = false;
+    while (vq.PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        if (!vq.WalkChain(head, &chain)) {
+            vq.PushUsed(head, 0);
+            pushed = true;
+            continue;
+        }
+
+        for (auto& elem : chain) {
+            if (elem.writable) {
+                // A hinted block, held by the driver until we answer DONE.
+                ReleaseRange(elem.addr, elem.len);
+                hinted_bytes_.fetch_add(elem.len, std::memory_order_relaxed);
+            } else if (elem.len >= sizeof(uint32_t)) {
+                uint32_t cmd_id;
+                std::memcpy(&cmd_id, elem.addr, sizeof(cmd_id));
+                if (cmd_id == VIRTIO_BALLOON_CMD_ID_STOP) finished = true;
+            }
+        }
+        vq.PushUsed(head, 0);
+        pushed = true;
+    }
+    if (pushed && mmio_) mmio_->NotifyUsedBuffer();
+
+    if (finished) {
+        // Nothing is kept from the hints, so the driver can have its
+        // pages back as soon as it has sent them all.
+        {
+            std::lock_guard<std::mutex> lock(config_mutex_);
+            config_.free_page_hint_cmd_id = VIRTIO_BALLOON_CMD_ID_DONE;
+        }
+        if (mmio_) mmio_->NotifyConfigChange();
+    }
+}
+
+void VirtioBalloonDevice::ProcessReportingQueue(VirtQueue& vq) {
+    uint16_t head;
+    bool pushed = false;
+    while (vq.PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        if (vq.WalkChain(head, &chain)) {
+            for (auto& elem : chain) {
+                ReleaseRange(elem.addr, elem.len);
+                reported_bytes_.fetch_add(elem.len, std::memory_order_relaxed);
+            }
+        }
+        vq.PushUsed(head, 0);
+        pushed = true;
+    }
+    if (pushed && mmio_) mmio_->NotifyUsedBuffer();
+}
+
+void VirtioBalloonDevice::ReleaseRange(uint8_t* hva, uint64_t len) {
+    if (mem_.large_pages) return;
+    if (mem_.lazy) {
+        mem_.lazy->Release(hva, len);
+        return;
+    }
+    // Fully committed RAM keeps its commit; dropping the contents still
+    // gives the physical pages back.
+    auto start = AlignUp(reinterpret_cast<uintptr_t>(hva), kPageSize);
+    auto end = (reinterpret_cast<uintptr_t>(hva) + len) & kPageMask;
+    if (start >= end) return;
+    // RAM split between NUMA nodes is an allocation per node, and a discard
+    // cannot run from one allocation into the next.
+    const NodeGuestRam* numa = mem_.numa;
+    auto ram = numa ? reinterpret_cast<uintptr_t>(numa->base()) : 0;
+    if (!numa || start >= ram + mem_.alloc_size || end <= ram) {
+        DiscardVirtualMemory(reinterpret_cast<void*>(start), end - start);
+        return;
+    }
+    for (const auto& piece : numa->pieces()) {
+        uintptr_t lo = (std::max<uintptr_t>)(start, ram + piece.offset);
+        uintptr_t hi = (std::min<uintptr_t>)(end, ram + piece.offset + piece.size);
+        if (lo < hi) DiscardVirtualMemory(reinterpret_cast<void*>(lo), hi - lo);
+    }
+}
+
+void VirtioBalloonDevice::SetTargetPages(uint32_t pages) {
+    {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        if (config_.num_pages == pages) return;
+        config_.num_pages = pages;
+    }
+    if (mmio_) mmio_->NotifyConfigChange();
+}
+
+void VirtioBalloonDevice::RequestFreePageHints() {
+    if (!mmio_ || !(mmio_->GetDriverFeatures() & VIRTIO_BALLOON_F_FREE_PAGE_HINT))
+        return;
+    {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        config_.free_page_hint_cmd_id = next_cmd_id_;
+        if (++next_cmd_id_ < VIRTIO_BALLOON_CMD_ID_MIN)
+            next_cmd_id_ = VIRTIO_BALLOON_CMD_ID_MIN;
+    }
+    mmio_->NotifyConfigChange();
+}
+
+VirtioBalloonDevice::Stats VirtioBalloonDevice::GetStats() const {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        stats.target_pages = config_.num_pages;
+        stats.actual_pages = config_.actual;
+    }
+    stats.inflated_pages = inflated_pages_.load(std::memory_order_relaxed);
+    stats.deflated_pages = deflated_pages_.load(std::memory_order_relaxed);
+    stats.reported_bytes = reported_bytes_.load(std::memory_order_relaxed);
+    stats.hinted_bytes = hinted_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void VirtioBalloonDevice::ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) {
+    *value = 0;
+    if (offset + size > sizeof(config_)) return;
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    std::memcpy(value, reinterpret_cast<const uint8_t*>(&config_) + offset, size);
+}
+
+void VirtioBalloonDevice::WriteConfig(uint32_t offset, uint8_t size, uint32_t value) {
+    // Only `actual` is driver writable.
+    constexpr uint32_t kActual = offsetof(VirtioBalloonConfig, actual);
+    if (offset < kActual || offset + size > kActual + sizeof(uint32_t)) return;
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    std::memcpy(reinterpret_cast<uint8_t*>(&config_) + offset, &value, size);
+}
+
+void VirtioBalloonDevice::SaveState(StateWriter& out) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    out.Put(config_);
+    out.Put(next_cmd_id_);
+}
+
+bool VirtioBalloonDevice::LoadState(StateReader& in) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    in.Get(&config_);
+    return in.Get(&next_cmd_id_);
+}
+
+void VirtioBalloonDevice::OnStatusChange(uint32_t new_status) {
+    if (new_status == 0) {
+        // Reset: the driver starts over with an empty balloon.
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        config_.actual = 0;
+        config_.free_page_hint_cmd_id = VIRTIO_BALLOON_CMD_ID_STOP;
+    }
+}
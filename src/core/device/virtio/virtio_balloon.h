@@ -0,0 +1,100 @@
+#pragma once
+
+#include "core/device/virtio/virtio_mmio.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// virtio-balloon device ID (spec 5.5)
+constexpr uint32_t VIRTIO_BALLOON_DEVICE_ID = 5;
+
+// Feature bits
+constexpr uint64_t VIRTIO_BALLOON_F_DEFLATE_ON_OOM  = 1ULL << 2;
+constexpr uint64_t VIRTIO_BALLOON_F_FREE_PAGE_HINT  = 1ULL << 3;
+constexpr uint64_t VIRTIO_BALLOON_F_REPORTING       = 1ULL << 5;
+constexpr uint64_t VIRTIO_BALLOON_F_VERSION_1       = 1ULL << 32;
+
+// Free page hint command IDs; the host numbers real requests from kMin.
+constexpr uint32_t VIRTIO_BALLOON_CMD_ID_STOP = 0;
+constexpr uint32_t VIRTIO_BALLOON_CMD_ID_DONE = 1;
+constexpr uint32_t VIRTIO_BALLOON_CMD_ID_MIN  = 2;
+
+// Balloon PFNs are always in 4 KiB units, whatever the guest page size.
+constexpr uint32_t VIRTIO_BALLOON_PFN_SHIFT = 12;
+
+#pragma pack(push, 1)
+struct VirtioBalloonConfig {
+    uint32_t num_pages;              // balloon size the host asks for
+    uint32_t actual;                 // balloon size the guest reached
+    uint32_t free_page_hint_cmd_id;
+    uint32_t poison_val;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VirtioBalloonConfig) == 16);
+
+// Memory balloon. The host sets a target size; the guest inflates by
+// handing pages over (inflateq) and deflates by taking them back. Pages
+// handed over, and free pages the guest reports or hints, are released
+// from the host backing of guest RAM, so an idle guest shrinks without
+// the host asking.
+//
+// Queues are numbered in order of the features the driver accepted:
+// inflateq, deflateq, then free_page_vq and reporting_vq if negotiated.
+class VirtioBalloonDevice : public VirtioDeviceOps {
+public:
+    struct Stats {
+        uint64_t target_pages = 0;
+        uint64_t actual_pages = 0;       // as last written by the guest
+        uint64_t inflated_pages = 0;     // handed over through inflateq
+        uint64_t deflated_pages = 0;
+        uint64_t reported_bytes = 0;     // released through reporting_vq
+        uint64_t hinted_bytes = 0;       // released through free_page_vq
+    };
+
+    VirtioBalloonDevice() = default;
+    ~VirtioBalloonDevice() override = default;
+
+    void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
+    void SetMemMap(const GuestMemMap& mem) { mem_ = mem; }
+
+    // Asks the guest to hold `pages` 4 KiB pages in the balloon.
+    void SetTargetPages(uint32_t pages);
+    // Asks the guest to hint all of its free pages once. No-op unless the
+    // driver accepted FREE_PAGE_HINT.
+    void RequestFreePageHints();
+    Stats GetStats() const;
+
+    uint32_t GetDeviceId() const override { return VIRTIO_BALLOON_DEVICE_ID; }
+    uint64_t GetDeviceFeatures() const override;
+    uint32_t GetNumQueues() const override { return 4; }
+    uint32_t GetQueueMaxSize(uint32_t queue_idx) const override { return 128; }
+    void OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) override;
+    void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
+    void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
+    void OnStatusChange(uint32_t new_status) override;
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+
+private:
+    enum class Queue { kInflate, kDeflate, kFreePage, kReporting, kNone };
+    Queue QueueAt(uint32_t queue_idx) const;
+
+    void ProcessPfnQueue(VirtQueue& vq, bool inflate);
+    void ProcessFreePageQueue(VirtQueue& vq);
+    void ProcessReportingQueue(VirtQueue& vq);
+    // Drops the host pages behind the guest range at `hva`.
+    void ReleaseRange(uint8_t* hva, uint64_t len);
+
+    VirtioMmioDevice* mmio_ = nullptr;
+    GuestMemMap mem_{};
+
+    mutable std::mutex config_mutex_;
+    VirtioBalloonConfig config_{};
+    uint32_t next_cmd_id_ = VIRTIO_BALLOON_CMD_ID_MIN;
+
+    std::atomic<uint64_t> inflated_pages_{0};
+    std::atomic<uint64_t> deflated_pages_{0};
+    std::atomic<uint64_t> reported_bytes_{0};
+    std::atomic<uint64_t> hinted_bytes_{0};
+};
@@ -1,10 +1,26 @@
 #include "core/device/virtio/virtio_blk.h"
 #include <cstring>
 #include <algorithm>
+#include <bit>
 
-bool VirtioBlkDevice::Open(const std::string& path) {
-    disk_ = DiskImage::Create(path);
+VirtioBlkDevice::VirtioBlkDevice(uint32_t num_queues) {
+    num_queues = std::clamp(num_queues, 1u, kMaxQueues);
+    queues_.reserve(num_queues);
+    for (uint32_t i = 0; i < num_queues; i++) {
+        queues_.push_back(std::make_unique<RequestQueue>());
+        queues_.back()->merge_next.assign(kQueueSize, kNoMerge);
+    }
+}
+
+VirtioBlkDevice::~VirtioBlkDevice() {
+    Stop();
+}
+
+bool VirtioBlkDevice::Open(const std::string& path, const DiskImageOptions& options) {
+    disk_ = DiskImage::Create(path, options);
     if (!disk_) return false;
+    path_ = path;
+    options_ = options;
 
     uint64_t disk_size = disk_->GetSize();
 
@@ -13,18 +29,190 @@ bool VirtioBlkDevice::Open(const std::string& path) {
     config_.size_max = 1u << 20;
     config_.seg_max  = 126;
     config_.blk_size = 512;
+    config_.num_queues = static_cast<uint16_t>(queues_.size());
+    config_.max_discard_sectors = kMaxDiscardSectors;
+    config_.max_discard_seg = kMaxDiscardSegments;
+    config_.discard_sector_alignment = disk_->GetDiscardGranularity() / 512;
+    config_.max_write_zeroes_sectors = kMaxDiscardSectors;
+    config_.max_write_zeroes_seg = kMaxDiscardSegments;
+    config_.write_zeroes_may_unmap = disk_->SupportsDiscard() ? 1 : 0;
 
-    LOG_INFO("VirtIO block: %s, %llu sectors (%llu MB)",
+    LOG_INFO("VirtIO block: %s, %llu sectors (%llu MB), %zu queue(s)",
              path.c_str(), config_.capacity,
-             disk_size / (1024 * 1024));
+             disk_size / (1024 * 1024), queues_.size());
+
+    // A lone queue keeps a small pool so it can still overlap requests;
+    // with per-vCPU queues one worker each is enough.
+    uint32_t workers = std::max(1u,
+        BlockIoEngine::kDefaultWorkers / static_cast<uint32_t>(queues_.size()));
+    for (auto& q : queues_) {
+        bool started = q->io_engine.Start(
+            workers,
+            [this](uint32_t queue_idx, uint16_t head_idx) {
+                VirtQueue* vq = mmio_ ? mmio_->GetQueue(queue_idx) : nullptr;
+                if (vq) ProcessRequest(queue_idx, *vq, head_idx);
+            },
+            [this]() {
+                if (mmio_) mmio_->NotifyUsedBuffer();
+            });
+        if (!started) {
+            LOG_WARN("VirtIO block: I/O workers unavailable, using vCPU thread");
+        }
+    }
+
+    if (options.readahead_window_bytes) {
+        readahead_.Start(disk_.get(), &disk_mutex_,
+                         static_cast<uint32_t>(queues_.size()),
+                         options.readahead_window_bytes);
+    }
+    if (options.boot_profile_seconds) {
+        boot_profile_.Start(disk_.get(), &disk_mutex_,
+                            BlockBootProfile::ProfilePath(path),
+                            options.boot_profile_seconds);
+    }
     return true;
 }
 
+bool VirtioBlkDevice::StartTrace(const std::string& path, uint32_t records) {
+    if (!disk_) return false;
+    return trace_.Open(path, records, disk_->GetSize());
+}
+
+bool VirtioBlkDevice::ReadDisk(uint64_t offset, void* buf, uint32_t len) {
+    if (!disk_ || offset > disk_->GetSize() || len > disk_->GetSize() - offset)
+        return false;
+    std::unique_lock<std::mutex> lock(disk_mutex_, std::defer_lock);
+    if (!disk_->SupportsConcurrentIo()) lock.lock();
+    return disk_->Read(offset, buf, len);
+}
+
+bool VirtioBlkDevice::WriteDisk(uint64_t offset, const void* data, uint32_t len) {
+    if (!disk_ || offset > disk_->GetSize() || len > disk_->GetSize() - offset)
+        return false;
+    std::unique_lock<std::mutex> lock(disk_mutex_, std::defer_lock);
+    if (!disk_->SupportsConcurrentIo()) lock.lock();
+    bool ok = data ? disk_->Write(offset, data, len)
+                   : disk_->WriteZeroes(offset, len, false);
+    InvalidateCached(offset, len);
+    return ok;
+}
+
+void VirtioBlkDevice::StartWriteLog(uint32_t block_size) {
+    if (!disk_ || !block_size) return;
+    uint64_t blocks = (disk_->GetSize() + block_size - 1) / block_size;
+    write_log_block_ = block_size;
+    write_log_words_ = (blocks + 63) / 64;
+    write_log_ = std::make_unique<std::atomic<uint64_t>[]>(write_log_words_);
+    for (uint64_t i = 0; i < write_log_words_; i++) {
+        write_log_[i].store(0, std::memory_order_relaxed);
+    }
+    write_log_on_.store(true, std::memory_order_release);
+}
+
+void VirtioBlkDevice::StopWriteLog() {
+    write_log_on_.store(false, std::memory_order_release);
+}
+
+void VirtioBlkDevice::TakeWriteLog(std::vector<uint64_t>* bitmap) {
+    bitmap->assign(write_log_words_, 0);
+    for (uint64_t i = 0; i < write_log_words_; i++) {
+        (*bitmap)[i] = write_log_[i].exchange(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t VirtioBlkDevice::CountWriteLog() const {
+    uint64_t blocks = 0;
+    for (uint64_t i = 0; i < write_log_words_; i++) {
+        blocks += std::popcount(write_log_[i].load(std::memory_order_relaxed));
+    }
+    return blocks;
+}
+
+void VirtioBlkDevice::InvalidateCached(uint64_t offset, uint64_t len) {
+    readahead_.Invalidate(offset, len);
+    boot_profile_.Invalidate(offset, len);
+}
+
+// After the write has landed: a block taken from the log while the write
+// is still in flight is logged again and goes out once more.
+void VirtioBlkDevice::LogWrite(uint64_t offset, uint64_t len) {
+    if (!len || !write_log_on_.load(std::memory_order_acquire)) return;
+    uint64_t first = offset / write_log_block_;
+    uint64_t last = (offset + len - 1) / write_log_block_;
+    for (uint64_t block = first; block <= last && block / 64 < write_log_words_; block++) {
+        write_log_[block / 64].fetch_or(1ULL << (block % 64), std::memory_order_relaxed);
+    }
+}
+
+void VirtioBlkDevice::CloseDisk() {
+    if (!disk_) return;
+    readahead_.Stop();
+    boot_profile_.Stop();
+    disk_->Flush();
+    disk_.reset();
+    LOG_INFO("VirtIO block: %s closed", path_.c_str());
+}
+
+bool VirtioBlkDevice::ReopenDisk() {
+    if (disk_) return true;
+    disk_ = DiskImage::Create(path_, options_);
+    if (!disk_) {
+        LOG_ERROR("VirtIO block: cannot reopen %s", path_.c_str());
+        return false;
+    }
+    if (options_.readahead_window_bytes) {
+        readahead_.Start(disk_.get(), &disk_mutex_,
+                         static_cast<uint32_t>(queues_.size()),
+                         options_.readahead_window_bytes);
+    }
+    if (options_.boot_profile_seconds) {
+        boot_profile_.Start(disk_.get(), &disk_mutex_,
+                            BlockBootProfile::ProfilePath(path_),
+                            options_.boot_profile_seconds);
+    }
+    return true;
+}
+
+void VirtioBlkDevice::Stop() {
+    // Workers held back by the limits would keep the engines from stopping.
+    throttle_.Cancel();
+    for (auto& q : queues_) q->io_engine.Stop();
+    trace_.Close();
+
+    if (uint64_t runs = merged_runs_.load(std::memory_order_relaxed)) {
+        LOG_INFO("VirtIO block: merged %llu requests into %llu operations",
+                 merged_requests_.load(std::memory_order_relaxed), runs);
+    }
+
+    if (throttle_.GetLimits().enabled()) {
+        auto st = throttle_.GetStats();
+        LOG_INFO("VirtIO block: throttled %llu requests for %llu ms in total",
+                 st.throttled, st.waited_us / 1000);
+    }
+
+    if (readahead_.IsRunning()) {
+        auto st = readahead_.GetStats();
+        uint64_t reads = st.hits + st.misses;
+        LOG_INFO("VirtIO block: readahead %llu/%llu hits (%llu%%), window %u KB, "
+                 "prefetched %llu MB, wasted %llu MB",
+                 st.hits, reads, reads ? st.hits * 100 / reads : 0,
+                 st.window_bytes / 1024, st.prefetched_bytes >> 20,
+                 st.wasted_bytes >> 20);
+        readahead_.Stop();
+    }
+    boot_profile_.Stop();
+}
+
 uint64_t VirtioBlkDevice::GetDeviceFeatures() const {
     return VIRTIO_BLK_F_SIZE_MAX
          | VIRTIO_BLK_F_SEG_MAX
          | VIRTIO_BLK_F_BLK_SIZE
          | VIRTIO_BLK_F_FLUSH
+         | (queues_.size() > 1 ? VIRTIO_BLK_F_MQ : 0)
+         | (disk_ && disk_->SupportsDiscard() ? VIRTIO_BLK_F_DISCARD : 0)
+         | VIRTIO_BLK_F_WRITE_ZEROES
+         | VIRTIO_RING_F_INDIRECT_DESC
+         | VIRTIO_F_RING_PACKED
          | VIRTIO_F_VERSION_1;
 }
 
@@ -49,23 +237,233 @@ void VirtioBlkDevice::WriteConfig(uint32_t, uint8_t, uint32_t) {
 
 void VirtioBlkDevice::OnStatusChange(uint32_t new_status) {
     if (new_status == 0) {
+        // Requests still on the workers reference the old rings.
+        for (auto& q : queues_) q->io_engine.Drain();
         LOG_INFO("VirtIO block: device reset");
     }
 }
 
+void VirtioBlkDevice::SaveState(StateWriter& out) {
+    for (auto& q : queues_) q->io_engine.Drain();
+    // A template's disk becomes the base of its clones' overlays.
+    if (disk_) disk_->Flush();
+}
+
 void VirtioBlkDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
-    if (queue_idx != 0) return;
+    if (queue_idx >= queues_.size()) return;
+    auto& engine = queues_[queue_idx]->io_engine;
 
+    // Notifies of one device are serialized, so one batch per thread does.
+    thread_local std::vector<uint16_t> heads;
+    heads.clear();
     uint16_t head;
-    while (vq.PopAvail(&head)) {
-        ProcessRequest(vq, head);
+    while (vq.PopAvail(&head)) heads.push_back(head);
+    if (heads.size() > 1) MergeBatch(queue_idx, vq, &heads);
+
+    if (engine.IsRunning()) {
+        for (uint16_t h : heads) engine.Submit(queue_idx, h);
+        return;
     }
 
+    for (uint16_t h : heads) ProcessRequest(queue_idx, vq, h);
+
     if (mmio_) mmio_->NotifyUsedBuffer();
 }
 
-void VirtioBlkDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
-    std::vector<VirtqChainElem> chain;
+void VirtioBlkDevice::MergeBatch(uint32_t queue_idx, VirtQueue& vq,
+                                 std::vector<uint16_t>* heads) {
+    auto& merge_next = queues_[queue_idx]->merge_next;
+    struct Peek {
+        uint16_t head;
+        uint32_t type;      // kNoMergeType for anything but a read or write
+        uint64_t offset;
+        uint64_t len;
+    };
+    constexpr uint32_t kNoMergeType = ~0u;
+    thread_local VirtqChain chain;
+    thread_local std::vector<Peek> peeks;
+    peeks.clear();
+    for (uint16_t h : *heads) {
+        Peek p{h, kNoMergeType, 0, 0};
+        VirtioBlkReqHeader hdr;
+        if (h < merge_next.size() && vq.WalkChain(h, &chain) && chain.size() >= 3 &&
+            chain[0].len >= sizeof(hdr)) {
+            memcpy(&hdr, chain[0].addr, sizeof(hdr));
+            if (hdr.type == VIRTIO_BLK_T_IN || hdr.type == VIRTIO_BLK_T_OUT) {
+                bool is_read = hdr.type == VIRTIO_BLK_T_IN;
+                for (size_t i = 1; i + 1 < chain.size(); i++) {
+                    if (chain[i].writable == is_read) p.len += chain[i].len;
+                }
+                p.type = hdr.type;
+                p.offset = hdr.sector * 512;
+            }
+        }
+        peeks.push_back(p);
+    }
+
+    // Everything in a batch is in flight at once, so the guest cannot
+    // depend on the order reads and writes complete in. Flushes, discards
+    // and the rest keep their place and end a run of sortable requests.
+    heads->clear();
+    size_t begin = 0;
+    while (begin < peeks.size()) {
+        size_t end = begin;
+        while (end < peeks.size() && peeks[end].type != kNoMergeType) end++;
+        std::stable_sort(peeks.begin() + begin, peeks.begin() + end,
+                         [](const Peek& a, const Peek& b) {
+                             return a.type != b.type ? a.type < b.type : a.offset < b.offset;
+                         });
+        for (size_t i = begin; i < end;) {
+            size_t j = i + 1;
+            uint64_t len = peeks[i].len;
+            while (j < end && j - i < kMaxMergeRequests && peeks[j].type == peeks[i].type &&
+                   peeks[j].offset == peeks[i].offset + len &&
+                   len + peeks[j].len <= kMaxMergeBytes) {
+                len += peeks[j].len;
+                j++;
+            }
+            for (size_t k = i; k + 1 < j; k++) merge_next[peeks[k].head] = peeks[k + 1].head;
+            heads->push_back(peeks[i].head);
+            i = j;
+        }
+        if (end < peeks.size()) heads->push_back(peeks[end].head);
+        begin = end + 1;
+    }
+}
+
+void VirtioBlkDevice::ProcessMerged(uint32_t queue_idx, VirtQueue& vq,
+                                    uint16_t head_idx) {
+    auto& queue = *queues_[queue_idx];
+    thread_local std::vector<uint16_t> members;
+    thread_local std::vector<uint32_t> member_lens;
+    thread_local std::vector<VirtqChain> chains;
+    thread_local std::vector<DiskIoVec> iov;
+    members.clear();
+    member_lens.clear();
+    iov.clear();
+    for (uint16_t h = head_idx; h != kNoMerge;) {
+        members.push_back(h);
+        uint16_t next = queue.merge_next[h];
+        queue.merge_next[h] = kNoMerge;
+        h = next;
+    }
+    if (chains.size() < members.size()) chains.resize(members.size());
+
+    BlockTraceWriter::Clock::time_point start;
+    if (trace_.IsOpen()) start = BlockTraceWriter::Clock::now();
+
+    // The guest may have rewritten a chain since it was merged; a run that
+    // no longer lines up goes through one request at a time.
+    uint32_t type = 0;
+    uint64_t offset = 0;
+    uint64_t data_len = 0;
+    bool lined_up = true;
+    for (size_t m = 0; m < members.size() && lined_up; m++) {
+        VirtqChain& chain = chains[m];
+        VirtioBlkReqHeader hdr;
+        if (!vq.WalkChain(members[m], &chain) || chain.size() < 3 ||
+            chain[0].len < sizeof(hdr) || !chain.back().writable || chain.back().len < 1) {
+            lined_up = false;
+            break;
+        }
+        memcpy(&hdr, chain[0].addr, sizeof(hdr));
+        if (m == 0) {
+            type = hdr.type;
+            offset = hdr.sector * 512;
+        }
+        if ((hdr.type != VIRTIO_BLK_T_IN && hdr.type != VIRTIO_BLK_T_OUT) ||
+            hdr.type != type || hdr.sector * 512 != offset + data_len) {
+            lined_up = false;
+            break;
+        }
+        bool is_read = hdr.type == VIRTIO_BLK_T_IN;
+        uint32_t len = 0;
+        for (size_t i = 1; i + 1 < chain.size(); i++) {
+            if (chain[i].writable != is_read) continue;
+            iov.push_back({chain[i].addr, chain[i].len});
+            len += chain[i].len;
+        }
+        member_lens.push_back(len);
+        data_len += len;
+    }
+    if (!lined_up || data_len > kMaxMergeBytes) {
+        for (uint16_t h : members) ProcessRequest(queue_idx, vq, h);
+        return;
+    }
+
+    for (uint32_t len : member_lens) throttle_.Acquire(len);
+
+    bool is_read = type == VIRTIO_BLK_T_IN;
+    std::unique_lock<std::mutex> disk_lock(disk_mutex_, std::defer_lock);
+    bool serialize = !disk_->SupportsConcurrentIo();
+    uint32_t total = static_cast<uint32_t>(data_len);
+    bool ok;
+    if (is_read) {
+        ok = boot_profile_.Read(offset, iov.data(), iov.size(), total) ||
+             readahead_.Read(queue_idx, offset, iov.data(), iov.size(), total);
+        if (!ok) {
+            if (serialize) disk_lock.lock();
+            ok = disk_->ReadV(offset, iov.data(), iov.size());
+        }
+    } else {
+        if (serialize) disk_lock.lock();
+        ok = disk_->WriteV(offset, iov.data(), iov.size());
+        InvalidateCached(offset, data_len);
+        LogWrite(offset, data_len);
+    }
+    if (disk_lock.owns_lock()) disk_lock.unlock();
+
+    // Retried one by one, so each request gets its own status.
+    if (!ok) {
+        for (uint16_t h : members) ProcessRequest(queue_idx, vq, h);
+        return;
+    }
+
+    (is_read ? reads_ : writes_).fetch_add(members.size(), std::memory_order_relaxed);
+    (is_read ? read_bytes_ : write_bytes_).fetch_add(data_len, std::memory_order_relaxed);
+    merged_requests_.fetch_add(members.size(), std::memory_order_relaxed);
+    merged_runs_.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t sector = offset / 512;
+    for (size_t m = 0; m < members.size(); m++) {
+        chains[m].back().addr[0] = VIRTIO_BLK_S_OK;
+        if (trace_.IsOpen()) {
+            BlockTraceRecord rec{};
+            rec.sector = sector;
+            rec.length = member_lens[m];
+            rec.type = type;
+            rec.queue = static_cast<uint8_t>(queue_idx);
+            rec.status = VIRTIO_BLK_S_OK;
+            trace_.Record(start, rec);
+        }
+        sector += member_lens[m] / 512;
+    }
+    std::lock_guard<std::mutex> used_lock(queue.used_mutex);
+    for (size_t m = 0; m < members.size(); m++) {
+        vq.PushUsed(members[m], member_lens[m] + 1);
+    }
+}
+
+VirtioBlkDevice::IoStats VirtioBlkDevice::GetIoStats() const {
+    IoStats stats;
+    stats.reads = reads_.load(std::memory_order_relaxed);
+    stats.writes = writes_.load(std::memory_order_relaxed);
+    stats.read_bytes = read_bytes_.load(std::memory_order_relaxed);
+    stats.write_bytes = write_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void VirtioBlkDevice::ProcessRequest(uint32_t queue_idx, VirtQueue& vq,
+                                     uint16_t head_idx) {
+    if (head_idx < kQueueSize && queues_[queue_idx]->merge_next[head_idx] != kNoMerge) {
+        ProcessMerged(queue_idx, vq, head_idx);
+        return;
+    }
+
+    // Workers for one queue run concurrently, so each keeps its own chain.
+    thread_local VirtqChain chain;
+    BlockTraceWriter::Clock::time_point start;
+    if (trace_.IsOpen()) start = BlockTraceWriter::Clock::now();
     if (!vq.WalkChain(head_idx, &chain)) {
         LOG_ERROR("VirtIO block: failed to walk descriptor chain");
         return;
@@ -94,39 +492,77 @@ void VirtioBlkDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
     uint8_t status = VIRTIO_BLK_S_OK;
     uint32_t total_data_len = 0;
 
-    switch (hdr.type) {
-    case VIRTIO_BLK_T_IN: {
-        uint64_t byte_offset = hdr.sector * 512;
+    // Before the disk lock, so a throttled request holds up no one else.
+    if (hdr.type == VIRTIO_BLK_T_IN || hdr.type == VIRTIO_BLK_T_OUT) {
+        uint64_t bytes = 0;
+        for (size_t i = 1; i + 1 < chain.size(); i++) bytes += chain[i].len;
+        throttle_.Acquire(bytes);
+    } else if (hdr.type == VIRTIO_BLK_T_DISCARD || hdr.type == VIRTIO_BLK_T_WRITE_ZEROES) {
+        throttle_.Acquire(0);
+    }
+
+    std::unique_lock<std::mutex> disk_lock(disk_mutex_, std::defer_lock);
+    // Backends with positional I/O let workers hit the host file in parallel.
+    // Reads take the lock only once readahead has missed.
+    bool serialize = !disk_->SupportsConcurrentIo();
+    if (hdr.type != VIRTIO_BLK_T_GET_ID && hdr.type != VIRTIO_BLK_T_IN && serialize)
+        disk_lock.lock();
 
+    switch (hdr.type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT: {
+        // Gather the data segments so the backend sees the whole request
+        // at once instead of one call per descriptor. The transports keep
+        // the queue size within kQueueSize, but a chain longer than the
+        // array fails the request rather than overrunning it.
+        bool is_read = hdr.type == VIRTIO_BLK_T_IN;
+        DiskIoVec iov[kQueueSize];
+        size_t iov_count = 0;
+        uint32_t data_len = 0;
+        bool overlong = false;
         for (size_t i = 1; i + 1 < chain.size(); i++) {
             auto& elem = chain[i];
-            if (!elem.writable) continue;
-
-            if (!disk_->Read(byte_offset, elem.addr, elem.len)) {
-                status = VIRTIO_BLK_S_IOERR;
+            if (elem.writable != is_read) continue;
+            if (iov_count == kQueueSize) {
+                overlong = true;
                 break;
             }
-            byte_offset += elem.len;
-            total_data_len += elem.len;
+            iov[iov_count++] = {elem.addr, elem.len};
+            data_len += elem.len;
+        }
+        if (overlong) {
+            LOG_WARN("VirtIO block: request of over %u segments failed", kQueueSize);
+            status = VIRTIO_BLK_S_IOERR;
+            break;
         }
-        break;
-    }
-    case VIRTIO_BLK_T_OUT: {
-        uint64_t byte_offset = hdr.sector * 512;
-
-        for (size_t i = 1; i + 1 < chain.size(); i++) {
-            auto& elem = chain[i];
-            if (elem.writable) continue;
 
-            if (!disk_->Write(byte_offset, elem.addr, elem.len)) {
-                status = VIRTIO_BLK_S_IOERR;
-                break;
+        uint64_t byte_offset = hdr.sector * 512;
+        bool ok;
+        if (is_read) {
+            ok = boot_profile_.Read(byte_offset, iov, iov_count, data_len) ||
+                 readahead_.Read(queue_idx, byte_offset, iov, iov_count, data_len);
+            if (!ok) {
+                if (serialize) disk_lock.lock();
+                ok = disk_->ReadV(byte_offset, iov, iov_count);
             }
-            byte_offset += elem.len;
-            total_data_len += elem.len;
+        } else {
+            ok = disk_->WriteV(byte_offset, iov, iov_count);
+            InvalidateCached(byte_offset, data_len);
+            LogWrite(byte_offset, data_len);
+        }
+        if (ok) {
+            total_data_len = data_len;
+            (is_read ? reads_ : writes_).fetch_add(1, std::memory_order_relaxed);
+            (is_read ? read_bytes_ : write_bytes_).fetch_add(data_len, std::memory_order_relaxed);
+        } else {
+            status = VIRTIO_BLK_S_IOERR;
         }
         break;
     }
+    case VIRTIO_BLK_T_DISCARD:
+    case VIRTIO_BLK_T_WRITE_ZEROES:
+        status = ProcessDiscardWriteZeroes(hdr.type, chain);
+        break;
     case VIRTIO_BLK_T_FLUSH:
         disk_->Flush();
         break;
@@ -149,6 +585,67 @@ void VirtioBlkDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
         break;
     }
 
+    if (disk_lock.owns_lock()) disk_lock.unlock();
+
+    if (trace_.IsOpen()) {
+        BlockTraceRecord rec{};
+        rec.sector = hdr.sector;
+        rec.length = total_data_len;
+        rec.type = hdr.type;
+        rec.queue = static_cast<uint8_t>(queue_idx);
+        rec.status = status;
+        trace_.Record(start, rec);
+    }
+
     status_elem.addr[0] = status;
+    std::lock_guard<std::mutex> used_lock(queues_[queue_idx]->used_mutex);
     vq.PushUsed(head_idx, total_data_len + 1);
 }
+
+uint8_t VirtioBlkDevice::ProcessDiscardWriteZeroes(
+        uint32_t type, const VirtqChain& chain) {
+    bool is_discard = type == VIRTIO_BLK_T_DISCARD;
+    if (is_discard && !disk_->SupportsDiscard()) return VIRTIO_BLK_S_UNSUPP;
+
+    // Segments may be split across driver-readable descriptors; gather
+    // them, at most the advertised count.
+    VirtioBlkDiscardWriteZeroes segs[kMaxDiscardSegments];
+    auto* payload = reinterpret_cast<uint8_t*>(segs);
+    size_t payload_len = 0;
+    for (size_t i = 1; i + 1 < chain.size(); i++) {
+        const auto& elem = chain[i];
+        if (elem.writable) continue;
+        if (elem.len > sizeof(segs) - payload_len) return VIRTIO_BLK_S_UNSUPP;
+        memcpy(payload + payload_len, elem.addr, elem.len);
+        payload_len += elem.len;
+    }
+
+    size_t count = payload_len / sizeof(VirtioBlkDiscardWriteZeroes);
+    if (count == 0 || payload_len % sizeof(VirtioBlkDiscardWriteZeroes)) {
+        return VIRTIO_BLK_S_UNSUPP;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const VirtioBlkDiscardWriteZeroes& seg = segs[i];
+
+        // Discard takes no flags; write-zeroes only knows UNMAP.
+        uint32_t allowed = is_discard ? 0 : VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP;
+        if ((seg.flags & ~allowed) || seg.num_sectors > kMaxDiscardSectors)
+            return VIRTIO_BLK_S_UNSUPP;
+        if (seg.sector > config_.capacity ||
+            seg.num_sectors > config_.capacity - seg.sector) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+
+        uint64_t offset = seg.sector * 512;
+        uint64_t len = static_cast<uint64_t>(seg.num_sectors) * 512;
+        bool ok = is_discard
+            ? disk_->Discard(offset, len)
+            : disk_->WriteZeroes(offset, len,
+                  (seg.flags & VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP) != 0);
+        InvalidateCached(offset, len);
+        LogWrite(offset, len);
+        if (!ok) return VIRTIO_BLK_S_IOERR;
+    }
+    return VIRTIO_BLK_S_OK;
+}
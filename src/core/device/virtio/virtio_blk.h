@@ -2,14 +2,25 @@
 
 #include "core/device/virtio/virtio_mmio.h"
 #include "core/device/virtio/disk_image.h"
+#include "core/device/virtio/block_io_engine.h"
+#include "core/device/virtio/block_boot_profile.h"
+#include "core/device/virtio/block_readahead.h"
+#include "core/device/virtio/block_throttle.h"
+#include "core/device/virtio/block_trace.h"
+#include <atomic>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 // Feature bits
 constexpr uint64_t VIRTIO_BLK_F_SIZE_MAX = 1ULL << 1;
 constexpr uint64_t VIRTIO_BLK_F_SEG_MAX  = 1ULL << 2;
 constexpr uint64_t VIRTIO_BLK_F_BLK_SIZE = 1ULL << 6;
 constexpr uint64_t VIRTIO_BLK_F_FLUSH    = 1ULL << 9;
+constexpr uint64_t VIRTIO_BLK_F_MQ       = 1ULL << 12;
+constexpr uint64_t VIRTIO_BLK_F_DISCARD  = 1ULL << 13;
+constexpr uint64_t VIRTIO_BLK_F_WRITE_ZEROES = 1ULL << 14;
 #ifndef VIRTIO_F_VERSION_1_DEFINED
 #define VIRTIO_F_VERSION_1_DEFINED
 constexpr uint64_t VIRTIO_F_VERSION_1    = 1ULL << 32;
@@ -20,6 +31,11 @@ constexpr uint32_t VIRTIO_BLK_T_IN    = 0;
 constexpr uint32_t VIRTIO_BLK_T_OUT   = 1;
 constexpr uint32_t VIRTIO_BLK_T_FLUSH = 4;
 constexpr uint32_t VIRTIO_BLK_T_GET_ID = 8;
+constexpr uint32_t VIRTIO_BLK_T_DISCARD = 11;
+constexpr uint32_t VIRTIO_BLK_T_WRITE_ZEROES = 13;
+
+// Flags of a discard / write-zeroes segment
+constexpr uint32_t VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP = 1u << 0;
 
 // Status codes
 constexpr uint8_t VIRTIO_BLK_S_OK     = 0;
@@ -41,30 +57,161 @@ struct VirtioBlkConfig {
     uint8_t  heads;
     uint8_t  sectors;
     uint32_t blk_size;
+    // Topology (unused, must stay zero)
+    uint8_t  physical_block_exp;
+    uint8_t  alignment_offset;
+    uint16_t min_io_size;
+    uint32_t opt_io_size;
+    uint8_t  writeback;
+    uint8_t  unused0;
+    uint16_t num_queues;  // valid with VIRTIO_BLK_F_MQ
+    uint32_t max_discard_sectors;
+    uint32_t max_discard_seg;
+    uint32_t discard_sector_alignment;
+    uint32_t max_write_zeroes_sectors;
+    uint32_t max_write_zeroes_seg;
+    uint8_t  write_zeroes_may_unmap;
+    uint8_t  unused1[3];
+};
+
+struct VirtioBlkDiscardWriteZeroes {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
 };
 #pragma pack(pop)
 
 class VirtioBlkDevice : public VirtioDeviceOps {
 public:
-    ~VirtioBlkDevice() override = default;
+    // Upper bound on request queues; Linux caps at nr_cpu_ids anyway.
+    static constexpr uint32_t kMaxQueues = 64;
+    // Limits advertised for DISCARD / WRITE_ZEROES requests.
+    static constexpr uint32_t kMaxDiscardSectors = 1u << 22;  // 2 GiB
+    static constexpr uint32_t kMaxDiscardSegments = 32;
+    static constexpr uint32_t kQueueSize = 128;
+    // Bounds on one merged run of contiguous reads or writes.
+    static constexpr uint32_t kMaxMergeRequests = 32;
+    static constexpr uint32_t kMaxMergeBytes = 4u << 20;
+
+    // One request queue per vCPU lets each guest CPU submit without
+    // contending on a shared ring.
+    explicit VirtioBlkDevice(uint32_t num_queues = 1);
+    ~VirtioBlkDevice() override;
 
-    bool Open(const std::string& path);
+    bool Open(const std::string& path, const DiskImageOptions& options = {});
+
+    // Completes outstanding requests and stops the I/O workers. Must run
+    // before guest memory is released.
+    void Stop();
 
     void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
 
+    // Records every request into a trace file for tenbox-blk-replay. Call
+    // after Open() and before the guest starts; `records` of 0 picks the
+    // default ring size.
+    bool StartTrace(const std::string& path, uint32_t records = 0);
+
+    BlockReadahead::Stats GetReadaheadStats() const { return readahead_.GetStats(); }
+    BlockBootProfile::Stats GetBootProfileStats() const { return boot_profile_.GetStats(); }
+
+    // IOPS and bandwidth limits, changeable while the guest runs.
+    void SetIoLimits(const BlockThrottleLimits& limits) { throttle_.SetLimits(limits); }
+    BlockThrottle::Stats GetThrottleStats() const { return throttle_.GetStats(); }
+
+    // Live migration. The disk is read and written in guest offsets, next
+    // to (and serialized like) guest requests.
+    uint64_t DiskSize() const { return disk_ ? disk_->GetSize() : 0; }
+    bool ReadDisk(uint64_t offset, void* buf, uint32_t len);
+    // A null `data` zeroes the range.
+    bool WriteDisk(uint64_t offset, const void* data, uint32_t len);
+    // Guest writes from now on are logged, one bit per `block_size` bytes,
+    // until StopWriteLog(). TakeWriteLog() hands the bits out and clears
+    // them; CountWriteLog() only counts.
+    void StartWriteLog(uint32_t block_size);
+    void StopWriteLog();
+    void TakeWriteLog(std::vector<uint64_t>* bitmap);
+    uint64_t CountWriteLog() const;
+    // Lets go of the image, with the device quiet, so another host can open
+    // it; ReopenDisk() takes it back if that falls through.
+    void CloseDisk();
+    bool ReopenDisk();
+
+    // Completed reads and writes since the device was created.
+    struct IoStats {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        uint64_t read_bytes = 0;
+        uint64_t write_bytes = 0;
+    };
+    IoStats GetIoStats() const;
+
     uint32_t GetDeviceId() const override { return 2; }
     uint64_t GetDeviceFeatures() const override;
-    uint32_t GetNumQueues() const override { return 1; }
-    uint32_t GetQueueMaxSize(uint32_t queue_idx) const override { return 128; }
+    uint32_t GetNumQueues() const override {
+        return static_cast<uint32_t>(queues_.size());
+    }
+    uint32_t GetQueueMaxSize(uint32_t queue_idx) const override { return kQueueSize; }
     void OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) override;
     void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
     void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
     void OnStatusChange(uint32_t new_status) override;
+    // Nothing to save, but requests on the workers must land first.
+    void SaveState(StateWriter& out) override;
 
 private:
-    void ProcessRequest(VirtQueue& vq, uint16_t head_idx);
+    void ProcessRequest(uint32_t queue_idx, VirtQueue& vq, uint16_t head_idx);
+    // Sorts the reads and writes of one popped batch by sector and links
+    // contiguous ones through merge_next; `heads` keeps one head per run.
+    void MergeBatch(uint32_t queue_idx, VirtQueue& vq, std::vector<uint16_t>* heads);
+    // Runs a linked run as one backend operation, then completes each
+    // request on its own.
+    void ProcessMerged(uint32_t queue_idx, VirtQueue& vq, uint16_t head_idx);
+    uint8_t ProcessDiscardWriteZeroes(uint32_t type,
+                                      const VirtqChain& chain);
+    void LogWrite(uint64_t offset, uint64_t len);
+    // Prefetched copies of a range the guest or a migration just changed.
+    void InvalidateCached(uint64_t offset, uint64_t len);
 
     VirtioMmioDevice* mmio_ = nullptr;
     std::unique_ptr<DiskImage> disk_;
+    std::string path_;
+    DiskImageOptions options_;
     VirtioBlkConfig config_{};
+
+    // Each request queue has its own workers and used-ring lock, so queues
+    // never contend with one another on the completion path.
+    struct RequestQueue {
+        BlockIoEngine io_engine;
+        // Used ring updates come from several workers at once.
+        std::mutex used_mutex;
+        // Next request of a merged run per head, kNoMerge for the last one
+        // and for requests that run alone. Filled before Submit(), which
+        // hands the entries to a worker, and cleared by that worker.
+        std::vector<uint16_t> merge_next;
+    };
+    static constexpr uint16_t kNoMerge = 0xFFFF;
+    std::vector<std::unique_ptr<RequestQueue>> queues_;
+
+    // Disk backends keep a shared file position / metadata cache.
+    std::mutex disk_mutex_;
+
+    // One sequential stream per request queue.
+    BlockReadahead readahead_;
+    // Replays the previous boot's reads and records this one's.
+    BlockBootProfile boot_profile_;
+
+    BlockTraceWriter trace_;
+    BlockThrottle throttle_;
+
+    std::atomic<bool> write_log_on_{false};
+    uint32_t write_log_block_ = 0;
+    uint64_t write_log_words_ = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> write_log_;
+
+    std::atomic<uint64_t> reads_{0};
+    std::atomic<uint64_t> writes_{0};
+    std::atomic<uint64_t> read_bytes_{0};
+    std::atomic<uint64_t> write_bytes_{0};
+    std::atomic<uint64_t> merged_requests_{0};
+    std::atomic<uint64_t> merged_runs_{0};
 };
@@ -1,68 +1,252 @@
 #include "core/device/virtio/virtio_fs.h"
+#include "core/vmm/utf8.h"
 #include "core/vmm/types.h"
 #include <algorithm>
 #include <cstring>
 
-static std::wstring Utf8ToWide(const std::string& utf8) {
-    if (utf8.empty()) return {};
-    int len = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), nullptr, 0);
-    if (len <= 0) return {};
-    std::wstring wide(len, L'\0');
-    MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), wide.data(), len);
-    return wide;
-}
-
-static std::string WideToUtf8(const std::wstring& wide) {
-    if (wide.empty()) return {};
-    int len = WideCharToMultiByte(CP_UTF8, 0, wide.data(), (int)wide.size(), nullptr, 0, nullptr, nullptr);
-    if (len <= 0) return {};
-    std::string utf8(len, '\0');
-    WideCharToMultiByte(CP_UTF8, 0, wide.data(), (int)wide.size(), utf8.data(), len, nullptr, nullptr);
-    return utf8;
+// Cache key: Windows paths compare case-insensitively.
+static std::wstring AttrCacheKey(std::wstring path) {
+    return VirtioFsPathCache::Fold(std::move(path));
 }
 
 // Virtual root inode number
-constexpr uint64_t VIRTUAL_ROOT_INODE = 1;
+constexpr uint64_t VIRTUAL_ROOT_INODE = VirtioFsInodeTable::kRootInode;
+
+constexpr uint32_t kStatusDriverOk = 4;
 
 VirtioFsDevice::VirtioFsDevice(const std::string& mount_tag)
     : mount_tag_(mount_tag) {
     memset(&config_, 0, sizeof(config_));
     size_t tag_len = std::min(mount_tag_.size(), sizeof(config_.tag) - 1);
     memcpy(config_.tag, mount_tag_.c_str(), tag_len);
-    config_.num_request_queues = 1;
+    config_.num_request_queues = kNumRequestQueues;
+    // Room for the largest notification, INVAL_ENTRY with a 255-byte name.
+    config_.notify_buf_size = sizeof(FuseOutHeader) + sizeof(FuseNotifyInvalEntryOut) + 256;
     virtual_root_mtime_ = static_cast<uint64_t>(time(nullptr));
 
-    // Create virtual root inode (inode 1) - this is the virtual directory containing all shares
-    InodeInfo root;
-    root.inode = VIRTUAL_ROOT_INODE;
-    root.host_path = "";  // virtual, no host path
-    root.nlookup = 1;
-    root.is_dir = true;
-    root.share_tag = "";  // empty means virtual root
-    inodes_[VIRTUAL_ROOT_INODE] = root;
-
     LOG_INFO("VirtIO FS: mount_tag=%s (virtual root with dynamic shares)", mount_tag_.c_str());
 }
 
 VirtioFsDevice::~VirtioFsDevice() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto& [fh, handle] : file_handles_) {
-        if (handle.handle != INVALID_HANDLE_VALUE) {
-            CloseHandle(handle.handle);
+    StopWorkers();
+    LogOpStats();
+    // Their destructors write out pending data and count it off.
+    file_handles_.clear();
+    EvictCachedHandles("");
+    std::unordered_map<std::string, std::unique_ptr<DirectoryWatcher>> watchers;
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        watchers.swap(watchers_);
+    }
+}
+
+bool VirtioFsDevice::StartWorkers(uint32_t count) {
+    if (!workers_.empty()) return true;
+    workers_stop_ = false;
+    for (uint32_t i = 0; i < count; i++) {
+        try {
+            workers_.emplace_back(&VirtioFsDevice::WorkerThread, this);
+        } catch (const std::system_error&) {
+            LOG_WARN("VirtIO FS: started %u of %u worker threads", i, count);
+            break;
         }
     }
-    file_handles_.clear();
+    return !workers_.empty();
 }
 
-bool VirtioFsDevice::AddShare(const std::string& tag, const std::string& host_path, bool readonly) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Check for duplicate tag
-    if (shares_.find(tag) != shares_.end()) {
-        LOG_ERROR("VirtIO FS: share tag '%s' already exists", tag.c_str());
-        return false;
+void VirtioFsDevice::StopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(work_mutex_);
+        workers_stop_ = true;
+        work_.clear();
+    }
+    work_cv_.notify_all();
+    for (auto& t : workers_) {
+        if (t.joinable()) t.join();
+    }
+    workers_.clear();
+}
+
+void VirtioFsDevice::WorkerThread() {
+    std::unique_lock<std::mutex> lock(work_mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this] { return workers_stop_ || !work_.empty(); });
+        if (workers_stop_) return;
+        PendingRequest req = work_.front();
+        work_.pop_front();
+        busy_workers_++;
+        lock.unlock();
+        ProcessRequest(*req.vq, req.head);
+        lock.lock();
+        if (--busy_workers_ == 0 && work_.empty()) idle_cv_.notify_all();
+    }
+}
+
+void VirtioFsDevice::DrainWorkers() {
+    std::unique_lock<std::mutex> lock(work_mutex_);
+    work_.clear();
+    idle_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+}
+
+void VirtioFsDevice::WaitWorkersIdle() {
+    std::unique_lock<std::mutex> lock(work_mutex_);
+    idle_cv_.wait(lock, [this] { return work_.empty() && busy_workers_ == 0; });
+}
+
+void VirtioFsDevice::EnableDax(GPA base, uint64_t size, VirtioFsDaxWindow::MapCallback map,
+                               VirtioFsDaxWindow::UnmapCallback unmap) {
+    dax_ = std::make_unique<VirtioFsDaxWindow>(base, size, std::move(map), std::move(unmap));
+}
+
+void VirtioFsDevice::SaveState(StateWriter& out) {
+    if (!workers_.empty()) WaitWorkersIdle();
+    FlushPendingWrites("");
+    {
+        std::lock_guard<std::mutex> lock(used_mutex_);
+        notify_held_ = notify_enabled_;
+        notify_enabled_ = false;
+    }
+    out.Put(initialized_.load());
+    out.Put(writeback_cache_.load());
+
+    std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+    inodes_.SaveState(out);
+    out.Put(static_cast<uint32_t>(shares_.size()));
+    for (const auto& [tag, share] : shares_) {
+        out.PutString(tag);
+        out.Put(share.root_inode);
+    }
+
+    std::lock_guard<std::mutex> hlock(handle_mutex_);
+    out.Put(next_fh_);
+    out.Put(static_cast<uint32_t>(file_handles_.size()));
+    for (const auto& [fh, handle] : file_handles_) {
+        out.Put(fh);
+        out.Put(handle->is_dir);
+        out.Put(handle->access);
+        out.PutString(handle->path);
+        out.PutString(handle->share_tag);
+    }
+
+    auto mappings = dax_ ? dax_->GetMappings() : std::vector<VirtioFsDaxWindow::MappingInfo>{};
+    out.Put(static_cast<uint32_t>(mappings.size()));
+    for (const auto& m : mappings) {
+        out.Put(m.moffset);
+        out.Put(m.len);
+        out.Put(m.foffset);
+        out.Put(m.writable);
+        out.PutString(m.path);
     }
+}
 
+bool VirtioFsDevice::LoadState(StateReader& in) {
+    bool initialized = false;
+    bool writeback_cache = false;
+    in.Get(&initialized);
+    in.Get(&writeback_cache);
+    initialized_ = initialized;
+    writeback_cache_ = writeback_cache;
+
+    std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+    if (!inodes_.LoadState(in)) return false;
+    uint32_t count = 0;
+    in.Get(&count);
+    std::unordered_map<std::string, uint64_t> saved_roots;
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+        std::string tag;
+        uint64_t root = 0;
+        in.GetString(&tag);
+        in.Get(&root);
+        saved_roots[tag] = root;
+    }
+    if (!in.ok()) return false;
+    // Shares are the ones configured now; the guest sees any change as
+    // it would a share added or removed while running.
+    for (const auto& [tag, root] : saved_roots) {
+        auto it = shares_.find(tag);
+        if (it != shares_.end()) {
+            it->second.root_inode = root;
+        } else {
+            inodes_.RemoveShare(tag);
+        }
+    }
+    for (auto& [tag, share] : shares_) {
+        if (!saved_roots.count(tag)) share.root_inode = inodes_.AddShareRoot(tag);
+    }
+    shares_version_++;
+    lock.unlock();
+
+    uint64_t next_fh = 1;
+    in.Get(&next_fh);
+    in.Get(&count);
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+        uint64_t fh = 0;
+        auto handle = std::make_shared<FileHandle>();
+        in.Get(&fh);
+        in.Get(&handle->is_dir);
+        in.Get(&handle->access);
+        in.GetString(&handle->path);
+        in.GetString(&handle->share_tag);
+        if (!in.ok()) break;
+        // Directories are listed through paths, not the handle.
+        if (!handle->is_dir) {
+            handle->handle = CreateFileW(HostPathOf(handle->path)->wide.c_str(), handle->access,
+                                         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                         nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle->handle == INVALID_HANDLE_VALUE) {
+                LOG_WARN("VirtIO FS: cannot reopen '%s' (%lu)", handle->path.c_str(),
+                         GetLastError());
+            }
+        }
+        handle->writeback = !handle->is_dir && IsShareWriteback(handle->share_tag);
+        handle->pending_count = &pending_handles_;
+        std::lock_guard<std::mutex> hlock(handle_mutex_);
+        file_handles_[fh] = std::move(handle);
+    }
+    {
+        std::lock_guard<std::mutex> hlock(handle_mutex_);
+        next_fh_ = next_fh;
+    }
+
+    in.Get(&count);
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+        VirtioFsDaxWindow::MappingInfo m{};
+        in.Get(&m.moffset);
+        in.Get(&m.len);
+        in.Get(&m.foffset);
+        in.Get(&m.writable);
+        in.GetString(&m.path);
+        if (!in.ok()) break;
+        if (!dax_) continue;
+        HANDLE h = CreateFileW(HostPathOf(m.path)->wide.c_str(),
+                               GENERIC_READ | (m.writable ? GENERIC_WRITE : 0),
+                               FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        // Lost mappings read as zeros, as after the file was truncated.
+        if (h == INVALID_HANDLE_VALUE ||
+            dax_->Setup(h, m.path, m.foffset, m.len, m.moffset, m.writable) != FUSE_OK) {
+            LOG_WARN("VirtIO FS: cannot restore DAX mapping of '%s'", m.path.c_str());
+        }
+    }
+    LOG_INFO("VirtIO FS: restored %zu inodes, %zu open handles", inodes_.size(),
+             file_handles_.size());
+    return in.ok();
+}
+
+void VirtioFsDevice::ResumeAfterSave() {
+    std::lock_guard<std::mutex> lock(used_mutex_);
+    notify_enabled_ = notify_held_;
+}
+
+bool VirtioFsDevice::GetShmRegion(uint32_t id, uint64_t* base, uint64_t* size) const {
+    if (!dax_ || id != VIRTIO_FS_SHMCAP_ID_CACHE) return false;
+    *base = dax_->base();
+    *size = dax_->size();
+    return true;
+}
+
+bool VirtioFsDevice::AddShare(const std::string& tag, const std::string& host_path, bool readonly,
+                              bool writeback) {
     // Validate host path exists
     std::string path = host_path;
     DWORD attrs = GetFileAttributesW(Utf8ToWide(path).c_str());
@@ -76,63 +260,67 @@ bool VirtioFsDevice::AddShare(const std::string& tag, const std::string& host_pa
         path.pop_back();
     }
 
+    std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+
+    // Check for duplicate tag
+    if (shares_.find(tag) != shares_.end()) {
+        LOG_ERROR("VirtIO FS: share tag '%s' already exists", tag.c_str());
+        return false;
+    }
+
     // Allocate inode for this share's root
-    uint64_t share_root_inode = next_inode_++;
+    uint64_t share_root_inode = inodes_.AddShareRoot(tag);
     
     ShareInfo share;
     share.tag = tag;
     share.host_path = path;
     share.readonly = readonly;
+    share.writeback = writeback && !readonly;
     share.root_inode = share_root_inode;
     shares_[tag] = share;
 
-    // Create inode for share root
-    InodeInfo share_root;
-    share_root.inode = share_root_inode;
-    share_root.host_path = path;
-    share_root.nlookup = 1;
-    share_root.is_dir = true;
-    share_root.share_tag = tag;
-    inodes_[share_root_inode] = share_root;
-    path_to_inode_[path] = share_root_inode;
-
     shares_version_++;
     virtual_root_mtime_ = static_cast<uint64_t>(time(nullptr));
-    LOG_INFO("VirtIO FS: added share '%s' -> '%s' (readonly=%s, inode=%llu)", 
-             tag.c_str(), host_path.c_str(), readonly ? "true" : "false", share_root_inode);
+    LOG_INFO("VirtIO FS: added share '%s' -> '%s' (readonly=%s, writeback=%s, inode=%llu)",
+             tag.c_str(), host_path.c_str(), readonly ? "true" : "false",
+             share.writeback ? "true" : "false", share_root_inode);
+    lock.unlock();
+
+    StartWatcher(tag, path);
     return true;
 }
 
 bool VirtioFsDevice::RemoveShare(const std::string& tag) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    // Its callbacks take inode_mutex_.
+    StopWatcher(tag);
+
+    // Closed after the locks are dropped, or once in-flight requests finish.
+    std::vector<std::shared_ptr<FileHandle>> closed;
+    std::unique_lock<std::shared_mutex> lock(inode_mutex_);
     
     auto it = shares_.find(tag);
     if (it == shares_.end()) {
         LOG_ERROR("VirtIO FS: share tag '%s' not found", tag.c_str());
         return false;
     }
+    UnwatchRoot(it->second.host_path);
+    EvictCachedHandles(it->second.host_path, true);
 
     // Close all file handles belonging to this share
-    for (auto fh_it = file_handles_.begin(); fh_it != file_handles_.end(); ) {
-        if (fh_it->second.share_tag == tag) {
-            if (fh_it->second.handle != INVALID_HANDLE_VALUE) {
-                CloseHandle(fh_it->second.handle);
+    {
+        std::lock_guard<std::mutex> handle_lock(handle_mutex_);
+        for (auto fh_it = file_handles_.begin(); fh_it != file_handles_.end(); ) {
+            if (fh_it->second->share_tag == tag) {
+                closed.push_back(std::move(fh_it->second));
+                fh_it = file_handles_.erase(fh_it);
+            } else {
+                ++fh_it;
             }
-            fh_it = file_handles_.erase(fh_it);
-        } else {
-            ++fh_it;
         }
     }
 
     // Remove all inodes belonging to this share
-    for (auto inode_it = inodes_.begin(); inode_it != inodes_.end(); ) {
-        if (inode_it->second.share_tag == tag) {
-            path_to_inode_.erase(inode_it->second.host_path);
-            inode_it = inodes_.erase(inode_it);
-        } else {
-            ++inode_it;
-        }
-    }
+    inodes_.RemoveShare(tag);
 
     shares_.erase(it);
     shares_version_++;
@@ -142,7 +330,7 @@ bool VirtioFsDevice::RemoveShare(const std::string& tag) {
 }
 
 std::vector<std::string> VirtioFsDevice::GetShareTags() const {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_lock<std::shared_mutex> lock(inode_mutex_);
     std::vector<std::string> tags;
     for (const auto& [tag, _] : shares_) {
         tags.push_back(tag);
@@ -151,12 +339,12 @@ std::vector<std::string> VirtioFsDevice::GetShareTags() const {
 }
 
 bool VirtioFsDevice::HasShare(const std::string& tag) const {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_lock<std::shared_mutex> lock(inode_mutex_);
     return shares_.find(tag) != shares_.end();
 }
 
 uint64_t VirtioFsDevice::GetDeviceFeatures() const {
-    return VIRTIO_F_VERSION_1;
+    return VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_F_VERSION_1 | VIRTIO_FS_F_NOTIFICATION;
 }
 
 void VirtioFsDevice::ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) {
@@ -180,34 +368,61 @@ void VirtioFsDevice::WriteConfig(uint32_t, uint8_t, uint32_t) {
 void VirtioFsDevice::OnStatusChange(uint32_t new_status) {
     if (new_status == 0) {
         LOG_INFO("VirtIO FS: device reset");
-        std::lock_guard<std::mutex> lock(mutex_);
-        for (auto& [fh, handle] : file_handles_) {
-            if (handle.handle != INVALID_HANDLE_VALUE) {
-                CloseHandle(handle.handle);
-            }
+        // The queues are reset right after this; nothing may still use them.
+        DrainWorkers();
+        {
+            std::lock_guard<std::mutex> lock(used_mutex_);
+            notify_enabled_ = false;
+        }
+        std::unordered_map<uint64_t, std::shared_ptr<FileHandle>> closed;
+        {
+            std::lock_guard<std::mutex> lock(handle_mutex_);
+            closed.swap(file_handles_);
         }
-        file_handles_.clear();
+        if (dax_) dax_->RemoveAll();
+        EvictCachedHandles("");
         initialized_ = false;
+        writeback_cache_ = false;
+    } else if ((new_status & kStatusDriverOk) && mmio_ &&
+               (mmio_->GetDriverFeatures() & VIRTIO_FS_F_NOTIFICATION)) {
+        std::lock_guard<std::mutex> lock(used_mutex_);
+        notify_enabled_ = true;
     }
 }
 
 void VirtioFsDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
     // Virtiofs queues:
     //   Queue 0: hiprio queue (for FUSE_INTERRUPT, etc.)
-    //   Queue 1: request queue (for FUSE_INIT, FUSE_LOOKUP, etc.)
-    // We handle both queues the same way
-    if (queue_idx > 1) return;
+    //   Queue 1: notification queue, if negotiated (buffers for SendNotification)
+    //   Queue 1/2..N: request queues (for FUSE_INIT, FUSE_LOOKUP, etc.)
+    // We handle all request queues the same way
+    if (queue_idx >= GetNumQueues()) return;
+    if (queue_idx == kNotifyQueue && mmio_ &&
+        (mmio_->GetDriverFeatures() & VIRTIO_FS_F_NOTIFICATION)) {
+        return;
+    }
 
     uint16_t head;
-    while (vq.PopAvail(&head)) {
-        ProcessRequest(vq, head);
+    if (workers_.empty()) {
+        while (vq.PopAvail(&head)) {
+            ProcessRequest(vq, head);
+        }
+        return;
     }
 
-    if (mmio_) mmio_->NotifyUsedBuffer();
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(work_mutex_);
+        while (vq.PopAvail(&head)) {
+            work_.push_back({&vq, head});
+            queued = true;
+        }
+    }
+    if (queued) work_cv_.notify_all();
 }
 
 void VirtioFsDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
-    std::vector<VirtqChainElem> chain;
+    thread_local VirtqChain chain;
     if (!vq.WalkChain(head_idx, &chain)) {
         LOG_ERROR("VirtIO FS: failed to walk descriptor chain");
         return;
@@ -218,11 +433,38 @@ void VirtioFsDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
         return;
     }
 
+    // Only headers are copied out. A WRITE payload stays in guest memory
+    // and READ data lands there directly, past the reply header.
+    thread_local std::vector<VirtqChainElem> in_spans;
+    thread_local std::vector<VirtqChainElem> out_spans;
+    in_spans.clear();
+    out_spans.clear();
     std::vector<uint8_t> in_buf;
+    size_t in_limit = SIZE_MAX;
+    size_t out_skip = sizeof(FuseOutHeader);
     for (const auto& elem : chain) {
-        if (!elem.writable) {
-            in_buf.insert(in_buf.end(), elem.addr, elem.addr + elem.len);
+        uint8_t* addr = elem.addr;
+        uint32_t len = elem.len;
+        if (elem.writable) {
+            uint32_t skip = static_cast<uint32_t>(std::min<size_t>(out_skip, len));
+            out_skip -= skip;
+            if (len > skip) out_spans.push_back({addr + skip, len - skip, true});
+            continue;
         }
+        while (len > 0 && in_buf.size() < in_limit) {
+            bool have_hdr = in_buf.size() >= sizeof(FuseInHeader);
+            size_t want = have_hdr ? in_limit - in_buf.size()
+                                   : sizeof(FuseInHeader) - in_buf.size();
+            uint32_t take = static_cast<uint32_t>(std::min<size_t>(len, want));
+            in_buf.insert(in_buf.end(), addr, addr + take);
+            addr += take;
+            len -= take;
+            if (!have_hdr && in_buf.size() == sizeof(FuseInHeader) &&
+                reinterpret_cast<const FuseInHeader*>(in_buf.data())->opcode == FUSE_WRITE) {
+                in_limit = sizeof(FuseInHeader) + sizeof(FuseWriteIn);
+            }
+        }
+        if (len > 0) in_spans.push_back({addr, len, false});
     }
 
     if (in_buf.size() < sizeof(FuseInHeader)) {
@@ -235,6 +477,8 @@ void VirtioFsDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
     uint32_t in_len = static_cast<uint32_t>(in_buf.size() - sizeof(FuseInHeader));
 
     std::vector<uint8_t> out_buf;
+    uint32_t data_len = 0;  // reply bytes already in out_spans
+    auto start = VirtioFsOpStats::Clock::now();
 
     switch (in_hdr->opcode) {
     case FUSE_INIT:
@@ -256,10 +500,10 @@ void VirtioFsDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
         HandleOpen(in_hdr, in_data, out_buf);
         break;
     case FUSE_READ:
-        HandleRead(in_hdr, in_data, out_buf);
+        HandleRead(in_hdr, in_data, out_spans, out_buf, &data_len);
         break;
     case FUSE_WRITE:
-        HandleWrite(in_hdr, in_data, in_len, out_buf);
+        HandleWrite(in_hdr, in_data, in_len, in_spans, out_buf);
         break;
     case FUSE_RELEASE:
         HandleRelease(in_hdr, in_data);
@@ -298,13 +542,11 @@ void VirtioFsDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
         HandleRename(in_hdr, in_data, in_len, out_buf);
         break;
     case FUSE_FLUSH:
-        HandleFlush(in_hdr, in_data);
-        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_OK);
+        WriteErrorResponse(out_buf, in_hdr->unique, HandleFlush(in_hdr, in_data));
         break;
     case FUSE_FSYNC:
     case FUSE_FSYNCDIR:
-        HandleFsync(in_hdr, in_data);
-        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_OK);
+        WriteErrorResponse(out_buf, in_hdr->unique, HandleFsync(in_hdr, in_data));
         break;
     case FUSE_ACCESS:
         WriteErrorResponse(out_buf, in_hdr->unique, FUSE_OK);
@@ -312,6 +554,12 @@ void VirtioFsDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
     case FUSE_DESTROY:
         WriteErrorResponse(out_buf, in_hdr->unique, FUSE_OK);
         break;
+    case FUSE_SETUPMAPPING:
+        HandleSetupMapping(in_hdr, in_data, in_len, out_buf);
+        break;
+    case FUSE_REMOVEMAPPING:
+        HandleRemoveMapping(in_hdr, in_data, in_len, out_buf);
+        break;
     default:
         LOG_WARN("VirtIO FS: unsupported opcode %u", in_hdr->opcode);
         WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOSYS);
@@ -328,7 +576,31 @@ void VirtioFsDevice::ProcessRequest(VirtQueue& vq, uint16_t head_idx) {
         }
     }
 
-    vq.PushUsed(head_idx, static_cast<uint32_t>(out_buf.size()));
+    {
+        std::lock_guard<std::mutex> lock(used_mutex_);
+        vq.PushUsed(head_idx, static_cast<uint32_t>(out_buf.size()) + data_len);
+        if (mmio_) mmio_->NotifyUsedBuffer();
+    }
+
+    VirtioFsOpStats::TraceRecord rec;
+    rec.unique = in_hdr->unique;
+    rec.nodeid = in_hdr->nodeid;
+    rec.opcode = in_hdr->opcode;
+    rec.in_len = in_hdr->len;
+    rec.out_len = static_cast<uint32_t>(out_buf.size()) + data_len;
+    if (out_buf.size() >= sizeof(FuseOutHeader)) {
+        rec.error = reinterpret_cast<const FuseOutHeader*>(out_buf.data())->error;
+    }
+    op_stats_.Record(start, rec);
+}
+
+void VirtioFsDevice::LogOpStats() const {
+    auto ops = op_stats_.Snapshot();
+    for (const auto& op : ops) {
+        LOG_INFO("VirtIO FS: %-12s count=%llu errors=%llu avg=%lluus p50<%lluus p99<%lluus max=%lluus",
+                 VirtioFsOpStats::OpcodeName(op.opcode), op.count, op.errors,
+                 op.total_us / op.count, op.PercentileUs(0.5), op.PercentileUs(0.99), op.max_us);
+    }
 }
 
 void VirtioFsDevice::WriteErrorResponse(std::vector<uint8_t>& out_buf, 
@@ -356,11 +628,31 @@ void VirtioFsDevice::HandleInit(const FuseInHeader* in_hdr, const uint8_t* in_da
     init_out.minor = FUSE_KERNEL_MINOR_VERSION;
     init_out.max_readahead = init_in->max_readahead;
     init_out.flags = FUSE_BIG_WRITES | FUSE_PARALLEL_DIROPS;
+    init_out.flags |= init_in->flags & FUSE_ASYNC_READ;
+    // The guest turns writeback caching on for the whole mount, so one
+    // writeback share is enough; files of the others are opened for direct
+    // I/O (see OpenFlagsFor) and keep seeing the host's changes.
+    bool writeback_cache = false;
+    if (init_in->flags & FUSE_WRITEBACK_CACHE) {
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+        for (const auto& [tag, share] : shares_) {
+            if (share.writeback) {
+                init_out.flags |= FUSE_WRITEBACK_CACHE;
+                writeback_cache = true;
+                break;
+            }
+        }
+    }
+    writeback_cache_ = writeback_cache;
     init_out.max_write = 1024 * 1024;
     init_out.max_background = 16;
     init_out.congestion_threshold = 12;
     init_out.time_gran = 1;
     init_out.max_pages = 256;
+    if (dax_ && (init_in->flags & FUSE_MAP_ALIGNMENT)) {
+        init_out.flags |= FUSE_MAP_ALIGNMENT;
+        init_out.map_alignment = VirtioFsDaxWindow::kMapAlignmentShift;
+    }
 
     out_hdr.len = sizeof(FuseOutHeader) + sizeof(FuseInitOut);
     out_hdr.error = 0;
@@ -378,18 +670,19 @@ void VirtioFsDevice::HandleLookup(const FuseInHeader* in_hdr, const uint8_t* in_
     std::string name(reinterpret_cast<const char*>(in_data), 
                      strnlen(reinterpret_cast<const char*>(in_data), in_len));
     
-    std::lock_guard<std::mutex> lock(mutex_);
-
     // Special handling for virtual root directory
     if (in_hdr->nodeid == VIRTUAL_ROOT_INODE) {
         // Looking up a share tag in the virtual root
-        auto it = shares_.find(name);
-        if (it == shares_.end()) {
-            WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
-            return;
+        ShareInfo share;
+        {
+            std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+            auto it = shares_.find(name);
+            if (it == shares_.end()) {
+                WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+                return;
+            }
+            share = it->second;
         }
-
-        const ShareInfo& share = it->second;
         
         FuseOutHeader out_hdr;
         FuseEntryOut entry_out;
@@ -417,59 +710,47 @@ void VirtioFsDevice::HandleLookup(const FuseInHeader* in_hdr, const uint8_t* in_
     }
 
     // Normal lookup in a real directory
-    auto inode_it = inodes_.find(in_hdr->nodeid);
-    if (inode_it == inodes_.end()) {
-        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
-        return;
-    }
-
-    const InodeInfo& parent = inode_it->second;
-    std::string child_path = parent.host_path + "\\" + name;
-    
-    DWORD attrs = GetFileAttributesW(Utf8ToWide(child_path).c_str());
-    if (attrs == INVALID_FILE_ATTRIBUTES) {
-        WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
-        return;
+    std::string child_path;
+    std::string share_tag;
+    bool readonly = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+        std::string parent_path;
+        if (!ResolveLocked(in_hdr->nodeid, &parent_path, &share_tag)) {
+            WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+            return;
+        }
+        child_path = parent_path + "\\" + name;
+        auto sit = shares_.find(share_tag);
+        if (sit != shares_.end()) readonly = sit->second.readonly;
     }
-
-    bool is_dir = (attrs & FILE_ATTRIBUTE_DIRECTORY) != 0;
     
-    // Create or get inode
-    auto path_it = path_to_inode_.find(child_path);
-    uint64_t inode;
-    if (path_it != path_to_inode_.end()) {
-        inode = path_it->second;
-        inodes_[inode].nlookup++;
-    } else {
-        inode = next_inode_++;
-        InodeInfo info;
-        info.inode = inode;
-        info.host_path = child_path;
-        info.nlookup = 1;
-        info.is_dir = is_dir;
-        info.share_tag = parent.share_tag;
-        inodes_[inode] = info;
-        path_to_inode_[child_path] = inode;
-    }
-
     FuseOutHeader out_hdr;
     FuseEntryOut entry_out;
     memset(&entry_out, 0, sizeof(entry_out));
 
-    entry_out.nodeid = inode;
-    entry_out.generation = 1;
-    entry_out.entry_valid = 1;
-    entry_out.attr_valid = 1;
-
-    bool readonly = false;
-    {
-        auto sit = shares_.find(parent.share_tag);
-        if (sit != shares_.end()) readonly = sit->second.readonly;
-    }
-    int32_t err = FillAttr(child_path, &entry_out.attr, inode, readonly);
-    if (err != FUSE_OK) {
-        WriteErrorResponse(out_buf, in_hdr->unique, err);
+    FlushPendingWrites(child_path);
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    DWORD error = QueryAttributes(child_path, &fad);
+    if ((error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) && notify_enabled_) {
+        // Negative entry; the guest hears when the name appears.
+        entry_out.entry_valid = AttrTtl();
+    } else if (error != ERROR_SUCCESS) {
+        WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(error));
         return;
+    } else {
+        bool is_dir = (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        uint64_t inode = LookupInode(in_hdr->nodeid, name, child_path, is_dir);
+        if (!inode) {
+            WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+            return;
+        }
+
+        entry_out.nodeid = inode;
+        entry_out.generation = 1;
+        entry_out.entry_valid = AttrTtl();
+        entry_out.attr_valid = AttrTtl();
+        FillAttrFrom(fad, &entry_out.attr, inode, readonly);
     }
 
     out_hdr.len = sizeof(FuseOutHeader) + sizeof(FuseEntryOut);
@@ -484,76 +765,50 @@ void VirtioFsDevice::HandleLookup(const FuseInHeader* in_hdr, const uint8_t* in_
 void VirtioFsDevice::HandleForget(const FuseInHeader* in_hdr, const uint8_t* in_data) {
     auto* forget_in = reinterpret_cast<const FuseForgetIn*>(in_data);
     
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_lock<std::shared_mutex> lock(inode_mutex_);
     
-    // Don't forget virtual root or share roots
-    if (in_hdr->nodeid == VIRTUAL_ROOT_INODE) return;
-    for (const auto& [tag, share] : shares_) {
-        if (share.root_inode == in_hdr->nodeid) return;
-    }
-
-    auto it = inodes_.find(in_hdr->nodeid);
-    if (it != inodes_.end()) {
-        if (it->second.nlookup > forget_in->nlookup) {
-            it->second.nlookup -= forget_in->nlookup;
-        } else {
-            path_to_inode_.erase(it->second.host_path);
-            inodes_.erase(it);
-        }
-    }
+    // The virtual root and share roots are pinned
+    inodes_.Forget(in_hdr->nodeid, forget_in->nlookup);
 }
 
 void VirtioFsDevice::HandleGetAttr(const FuseInHeader* in_hdr, const uint8_t*,
                                     std::vector<uint8_t>& out_buf) {
-    std::lock_guard<std::mutex> lock(mutex_);
-
     FuseOutHeader out_hdr;
     FuseAttrOut attr_out;
     memset(&attr_out, 0, sizeof(attr_out));
-    attr_out.attr_valid = 1;
+    attr_out.attr_valid = AttrTtl();
 
     // Special handling for virtual root
     if (in_hdr->nodeid == VIRTUAL_ROOT_INODE) {
         attr_out.attr_valid = 0;
-        int32_t err = FillVirtualRootAttr(&attr_out.attr);
-        if (err != FUSE_OK) {
-            WriteErrorResponse(out_buf, in_hdr->unique, err);
-            return;
-        }
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+        FillVirtualRootAttr(&attr_out.attr);
     } else {
-        // Check if it's a share root
-        for (const auto& [tag, share] : shares_) {
-            if (share.root_inode == in_hdr->nodeid) {
-                attr_out.attr_valid = 0;
-                int32_t err = FillShareRootAttr(share, &attr_out.attr);
-                if (err != FUSE_OK) {
-                    WriteErrorResponse(out_buf, in_hdr->unique, err);
-                    return;
-                }
-                goto send_response;
-            }
-        }
-
-        // Normal file/directory
-        auto it = inodes_.find(in_hdr->nodeid);
-        if (it == inodes_.end()) {
-            WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
-            return;
-        }
-
+        std::string path;
         bool readonly = false;
         {
-            auto sit = shares_.find(it->second.share_tag);
-            if (sit != shares_.end()) readonly = sit->second.readonly;
+            std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+            std::string share_tag;
+            if (!ResolveLocked(in_hdr->nodeid, &path, &share_tag)) {
+                WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+                return;
+            }
+            auto sit = shares_.find(share_tag);
+            if (sit != shares_.end()) {
+                readonly = sit->second.readonly;
+                // Share roots are never cached
+                if (sit->second.root_inode == in_hdr->nodeid) attr_out.attr_valid = 0;
+            }
         }
-        int32_t err = FillAttr(it->second.host_path, &attr_out.attr, in_hdr->nodeid, readonly);
+
+        FlushPendingWrites(path);
+        int32_t err = FillAttr(path, &attr_out.attr, in_hdr->nodeid, readonly);
         if (err != FUSE_OK) {
             WriteErrorResponse(out_buf, in_hdr->unique, err);
             return;
         }
     }
 
-send_response:
     out_hdr.len = sizeof(FuseOutHeader) + sizeof(FuseAttrOut);
     out_hdr.error = 0;
     out_hdr.unique = in_hdr->unique;
@@ -585,22 +840,30 @@ void VirtioFsDevice::HandleSetAttr(const FuseInHeader* in_hdr, const uint8_t* in
         return;
     }
 
+    // Pending writes land before the new size and times.
+    FlushPendingWrites(path);
+
     // Handle size truncation
     if (setattr_in->valid & FATTR_SIZE) {
-        HANDLE h = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        HANDLE h = CreateFileW(HostPathOf(path)->wide.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
         if (h != INVALID_HANDLE_VALUE) {
             LARGE_INTEGER li;
             li.QuadPart = static_cast<LONGLONG>(setattr_in->size);
             SetFilePointerEx(h, li, nullptr, FILE_BEGIN);
-            SetEndOfFile(h);
+            // Windows won't truncate under a mapped view; DAX ranges of the
+            // file fall back to file I/O instead.
+            if (!SetEndOfFile(h) && GetLastError() == ERROR_USER_MAPPED_FILE &&
+                dax_ && dax_->DropViews(path)) {
+                SetEndOfFile(h);
+            }
             CloseHandle(h);
         }
     }
 
     // Handle time updates
     if ((setattr_in->valid & FATTR_ATIME) || (setattr_in->valid & FATTR_MTIME)) {
-        HANDLE h = CreateFileW(Utf8ToWide(path).c_str(), FILE_WRITE_ATTRIBUTES, 
+        HANDLE h = CreateFileW(HostPathOf(path)->wide.c_str(), FILE_WRITE_ATTRIBUTES, 
                                FILE_SHARE_READ | FILE_SHARE_WRITE,
                                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
         if (h != INVALID_HANDLE_VALUE) {
@@ -627,6 +890,7 @@ void VirtioFsDevice::HandleSetAttr(const FuseInHeader* in_hdr, const uint8_t* in
         }
     }
 
+    InvalidateAttr(path);
     HandleGetAttr(in_hdr, nullptr, out_buf);
 }
 
@@ -662,19 +926,23 @@ void VirtioFsDevice::HandleOpen(const FuseInHeader* in_hdr, const uint8_t* in_da
         access = GENERIC_READ | GENERIC_WRITE;
     }
 
-    HANDLE h = CreateFileW(Utf8ToWide(path).c_str(), access, share, nullptr, disposition,
-                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    HANDLE h = TakeCachedHandle(path, access, in_hdr->nodeid);
+    if (h == INVALID_HANDLE_VALUE) {
+        h = CreateFileW(HostPathOf(path)->wide.c_str(), access, share, nullptr, disposition,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
     if (h == INVALID_HANDLE_VALUE) {
         WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
         return;
     }
 
-    uint64_t fh = AllocFileHandle(h, false, path, share_tag);
+    uint64_t fh = AllocFileHandle(h, false, path, share_tag, access);
 
     FuseOutHeader out_hdr;
     FuseOpenOut open_out;
     memset(&open_out, 0, sizeof(open_out));
     open_out.fh = fh;
+    open_out.open_flags = OpenFlagsFor(share_tag);
 
     out_hdr.len = sizeof(FuseOutHeader) + sizeof(FuseOpenOut);
     out_hdr.error = 0;
@@ -686,31 +954,43 @@ void VirtioFsDevice::HandleOpen(const FuseInHeader* in_hdr, const uint8_t* in_da
 }
 
 void VirtioFsDevice::HandleRead(const FuseInHeader* in_hdr, const uint8_t* in_data,
-                                 std::vector<uint8_t>& out_buf) {
+                                 const std::vector<VirtqChainElem>& out_data,
+                                 std::vector<uint8_t>& out_buf, uint32_t* data_len) {
     auto* read_in = reinterpret_cast<const FuseReadIn*>(in_data);
     
-    FileHandle* fh = GetFileHandle(read_in->fh);
+    std::shared_ptr<FileHandle> fh = GetFileHandle(read_in->fh);
     if (!fh || fh->handle == INVALID_HANDLE_VALUE) {
         WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
         return;
     }
 
-    std::vector<uint8_t> data(read_in->size);
-    
-    LARGE_INTEGER offset;
-    offset.QuadPart = static_cast<LONGLONG>(read_in->offset);
-    
-    OVERLAPPED ov = {};
-    ov.Offset = offset.LowPart;
-    ov.OffsetHigh = offset.HighPart;
-    
-    DWORD bytes_read = 0;
-    if (!ReadFile(fh->handle, data.data(), read_in->size, &bytes_read, &ov)) {
-        DWORD err = GetLastError();
-        if (err != ERROR_HANDLE_EOF) {
+    FlushPendingWrites(fh->path);
+
+    // One ReadFile per guest buffer; a short read means end of file.
+    uint64_t offset = read_in->offset;
+    uint32_t remaining = read_in->size;
+    uint32_t bytes_read = 0;
+    for (const auto& span : out_data) {
+        if (remaining == 0) break;
+        DWORD want = std::min(span.len, remaining);
+
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        DWORD got = 0;
+        if (!ReadFile(fh->handle, span.addr, want, &got, &ov)) {
+            DWORD err = GetLastError();
+            if (err == ERROR_HANDLE_EOF) break;
+            // Report what was read so far as a short read
+            if (bytes_read > 0) break;
             WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(err));
             return;
         }
+        bytes_read += got;
+        offset += got;
+        remaining -= got;
+        if (got < want) break;
     }
 
     FuseOutHeader out_hdr;
@@ -718,18 +998,22 @@ void VirtioFsDevice::HandleRead(const FuseInHeader* in_hdr, const uint8_t* in_da
     out_hdr.error = 0;
     out_hdr.unique = in_hdr->unique;
 
-    out_buf.resize(out_hdr.len);
+    out_buf.resize(sizeof(out_hdr));
     memcpy(out_buf.data(), &out_hdr, sizeof(out_hdr));
-    if (bytes_read > 0) {
-        memcpy(out_buf.data() + sizeof(out_hdr), data.data(), bytes_read);
-    }
+    *data_len = bytes_read;
 }
 
 void VirtioFsDevice::HandleWrite(const FuseInHeader* in_hdr, const uint8_t* in_data,
-                                  uint32_t in_len, std::vector<uint8_t>& out_buf) {
+                                  uint32_t in_len,
+                                  const std::vector<VirtqChainElem>& in_data_spans,
+                                  std::vector<uint8_t>& out_buf) {
+    if (in_len < sizeof(FuseWriteIn)) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_EINVAL);
+        return;
+    }
     auto* write_in = reinterpret_cast<const FuseWriteIn*>(in_data);
     
-    FileHandle* fh = GetFileHandle(write_in->fh);
+    std::shared_ptr<FileHandle> fh = GetFileHandle(write_in->fh);
     if (!fh || fh->handle == INVALID_HANDLE_VALUE) {
         WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
         return;
@@ -740,25 +1024,55 @@ void VirtioFsDevice::HandleWrite(const FuseInHeader* in_hdr, const uint8_t* in_d
         return;
     }
 
-    const uint8_t* write_data = in_data + sizeof(FuseWriteIn);
-    uint32_t data_len = in_len - sizeof(FuseWriteIn);
-    
-    if (data_len < write_in->size) {
-        data_len = write_in->size;
+    uint64_t offset = write_in->offset;
+    uint32_t remaining = write_in->size;
+    uint32_t bytes_written = 0;
+    if (fh->writeback) {
+        // Small writes extending the pending run are held back and go out
+        // as one WriteFile; anything else writes the run out first.
+        std::lock_guard<std::mutex> wlock(fh->write_mutex);
+        bool contiguous = fh->pending_offset + fh->pending.size() == offset;
+        if (!fh->pending.empty() &&
+            (!contiguous || fh->pending.size() + remaining > kWriteCoalesceMax)) {
+            fh->WritePendingLocked();
+        }
+        if (remaining < kWriteCoalesceMax) {
+            if (fh->pending.empty()) {
+                fh->pending_offset = offset;
+                pending_handles_++;
+            }
+            for (const auto& span : in_data_spans) {
+                if (remaining == 0) break;
+                uint32_t take = std::min(span.len, remaining);
+                fh->pending.insert(fh->pending.end(), span.addr, span.addr + take);
+                bytes_written += take;
+                remaining -= take;
+            }
+            remaining = 0;
+        }
     }
 
-    LARGE_INTEGER offset;
-    offset.QuadPart = static_cast<LONGLONG>(write_in->offset);
-    
-    OVERLAPPED ov = {};
-    ov.Offset = offset.LowPart;
-    ov.OffsetHigh = offset.HighPart;
-    
-    DWORD bytes_written = 0;
-    if (!WriteFile(fh->handle, write_data, write_in->size, &bytes_written, &ov)) {
-        WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
-        return;
+    // One WriteFile per guest buffer, never past what the guest supplied.
+    for (const auto& span : in_data_spans) {
+        if (remaining == 0) break;
+        DWORD want = std::min(span.len, remaining);
+
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        DWORD put = 0;
+        if (!WriteFile(fh->handle, span.addr, want, &put, &ov)) {
+            if (bytes_written > 0) break;
+            WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
+            return;
+        }
+        bytes_written += put;
+        offset += put;
+        remaining -= put;
+        if (put < want) break;
     }
+    InvalidateAttr(fh->path);
 
     FuseOutHeader out_hdr;
     FuseWriteOut write_out;
@@ -781,37 +1095,32 @@ void VirtioFsDevice::HandleRelease(const FuseInHeader*, const uint8_t* in_data)
 
 void VirtioFsDevice::HandleOpenDir(const FuseInHeader* in_hdr, const uint8_t*,
                                     std::vector<uint8_t>& out_buf) {
-    std::lock_guard<std::mutex> lock(mutex_);
-
     std::string path;
     std::string share_tag;
 
     // Virtual root is always openable
-    if (in_hdr->nodeid == VIRTUAL_ROOT_INODE) {
-        path = "";
-        share_tag = "";
-    } else {
-        auto it = inodes_.find(in_hdr->nodeid);
-        if (it == inodes_.end()) {
-            WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
-            return;
+    if (in_hdr->nodeid != VIRTUAL_ROOT_INODE) {
+        {
+            std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+            if (!ResolveLocked(in_hdr->nodeid, &path, &share_tag)) {
+                WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+                return;
+            }
         }
-        path = it->second.host_path;
-        share_tag = it->second.share_tag;
 
-        DWORD attrs = GetFileAttributesW(Utf8ToWide(path).c_str());
-        if (attrs == INVALID_FILE_ATTRIBUTES) {
-            WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        DWORD error = QueryAttributes(path, &fad);
+        if (error != ERROR_SUCCESS) {
+            WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(error));
             return;
         }
-        if (!(attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+        if (!(fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
             WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOTDIR);
             return;
         }
     }
 
-    uint64_t fh = next_fh_++;
-    file_handles_[fh] = {INVALID_HANDLE_VALUE, true, path, share_tag};
+    uint64_t fh = AllocFileHandle(INVALID_HANDLE_VALUE, true, path, share_tag);
 
     FuseOutHeader out_hdr;
     FuseOpenOut open_out;
@@ -827,115 +1136,162 @@ void VirtioFsDevice::HandleOpenDir(const FuseInHeader* in_hdr, const uint8_t*,
     memcpy(out_buf.data() + sizeof(out_hdr), &open_out, sizeof(open_out));
 }
 
-void VirtioFsDevice::HandleReadDir(const FuseInHeader* in_hdr, const uint8_t* in_data,
-                                    std::vector<uint8_t>& out_buf) {
-    auto* read_in = reinterpret_cast<const FuseReadIn*>(in_data);
-    
-    std::lock_guard<std::mutex> lock(mutex_);
-
-    FileHandle* fh = GetFileHandle(read_in->fh);
-    if (!fh) {
-        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
-        return;
-    }
-
-    std::vector<uint8_t> dir_buf;
+int32_t VirtioFsDevice::ListDirectory(FileHandle& fh, uint64_t nodeid, uint64_t offset,
+                                      uint32_t size, size_t entry_header, bool plus,
+                                      std::vector<DirEntry>* entries) {
+    auto entry_size = [entry_header](size_t name_len) {
+        return (entry_header + name_len + 7) & ~size_t{7};
+    };
+    size_t used = 0;
     uint64_t entry_offset = 0;
 
     // Virtual root directory - list all shares
-    if (fh->path.empty() && fh->share_tag.empty()) {
+    if (fh.path.empty() && fh.share_tag.empty()) {
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
         for (const auto& [tag, share] : shares_) {
-            if (entry_offset < read_in->offset) {
+            if (entry_offset < offset) {
                 entry_offset++;
                 continue;
             }
+            if (used + entry_size(tag.size()) > size) break;
+            used += entry_size(tag.size());
+            entries->push_back({tag, true, share.root_inode, ++entry_offset});
+        }
+        return FUSE_OK;
+    }
 
-            uint32_t name_len = static_cast<uint32_t>(tag.size());
-            uint32_t entry_size = sizeof(FuseDirent) + name_len;
-            entry_size = (entry_size + 7) & ~7;
-
-            if (dir_buf.size() + entry_size > read_in->size) {
-                break;
+    // Real directory, read without holding inode_mutex_
+    {
+        std::lock_guard<std::mutex> dir_lock(fh.dir_mutex);
+        if (fh.handle == INVALID_HANDLE_VALUE) {
+            fh.handle = CreateFileW(HostPathOf(fh.path)->wide.c_str(), FILE_LIST_DIRECTORY,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                    nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+            if (fh.handle == INVALID_HANDLE_VALUE) {
+                return WindowsErrorToFuse(GetLastError());
             }
-
-            FuseDirent dirent;
-            memset(&dirent, 0, sizeof(dirent));
-            dirent.ino = share.root_inode;
-            dirent.off = entry_offset + 1;
-            dirent.namelen = name_len;
-            dirent.type = FUSE_S_IFDIR >> 12;
-
-            size_t old_size = dir_buf.size();
-            dir_buf.resize(old_size + entry_size);
-            memcpy(dir_buf.data() + old_size, &dirent, sizeof(dirent));
-            memcpy(dir_buf.data() + old_size + sizeof(dirent), tag.c_str(), name_len);
-
-            entry_offset++;
+            fh.dir_volume = QueryFileId(fh.handle).volume;
         }
-    } else {
-        // Real directory
-        std::wstring search_path = Utf8ToWide(fh->path + "\\*");
-        
-        WIN32_FIND_DATAW fdata;
-        HANDLE hFind = FindFirstFileW(search_path.c_str(), &fdata);
-        if (hFind == INVALID_HANDLE_VALUE) {
-            WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
-            return;
+        if (offset == 0) {
+            fh.dir_entries.clear();
+            fh.dir_eof = false;
         }
 
-        do {
-            std::string name = WideToUtf8(fdata.cFileName);
-            
-            if (entry_offset < read_in->offset) {
-                entry_offset++;
+        size_t index = static_cast<size_t>(offset);
+        while (true) {
+            if (index >= fh.dir_entries.size()) {
+                if (fh.dir_eof) break;
+                int32_t err = ReadDirBatch(fh);
+                if (err != FUSE_OK) {
+                    if (entries->empty()) return err;
+                    break;
+                }
                 continue;
             }
+            const HostDirEntry& host_entry = fh.dir_entries[index];
+            if (used + entry_size(host_entry.name.size()) > size) break;
+            used += entry_size(host_entry.name.size());
+            bool is_dir = (host_entry.attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            // `inode` holds the host file ID until numbered below.
+            entries->push_back({host_entry.name, is_dir, host_entry.file_id, ++index,
+                                host_entry.attr});
+        }
+    }
 
-            uint32_t name_len = static_cast<uint32_t>(name.size());
-            uint32_t entry_size = sizeof(FuseDirent) + name_len;
-            entry_size = (entry_size + 7) & ~7;
+    // Entry inodes, all under one lock. Plain READDIR entries only need
+    // a number, so they get no node of their own.
+    std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+    for (auto& entry : *entries) {
+        HostFileId id{fh.dir_volume, entry.inode, 0};
+        if (entry.name == "." || entry.name == "..") {
+            entry.inode = nodeid;
+        } else if (plus) {
+            entry.inode = inodes_.Lookup(nodeid, entry.name, id, entry.is_dir);
+        } else {
+            entry.inode = inodes_.Find(nodeid, entry.name);
+            if (!entry.inode) entry.inode = VirtioFsInodeTable::InodeForId(id);
+        }
+    }
+    return FUSE_OK;
+}
 
-            if (dir_buf.size() + entry_size > read_in->size) {
-                break;
-            }
+int32_t VirtioFsDevice::ReadDirBatch(FileHandle& fh) {
+    thread_local std::vector<uint64_t> buf(kDirBatchSize / sizeof(uint64_t));
+    // The first batch after a rewind starts over; the handle keeps its
+    // place otherwise.
+    FILE_INFO_BY_HANDLE_CLASS info_class = fh.dir_entries.empty()
+        ? FileIdBothDirectoryRestartInfo : FileIdBothDirectoryInfo;
+    if (!GetFileInformationByHandleEx(fh.handle, info_class, buf.data(),
+                                      static_cast<DWORD>(kDirBatchSize))) {
+        DWORD error = GetLastError();
+        if (error == ERROR_NO_MORE_FILES) {
+            fh.dir_eof = true;
+            return FUSE_OK;
+        }
+        return WindowsErrorToFuse(error);
+    }
 
-            FuseDirent dirent;
-            memset(&dirent, 0, sizeof(dirent));
-            
-            std::string full_path = fh->path + "\\" + name;
-            bool is_dir = (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-            
-            // Get or create inode
-            auto path_it = path_to_inode_.find(full_path);
-            uint64_t inode;
-            if (path_it != path_to_inode_.end()) {
-                inode = path_it->second;
-            } else {
-                inode = next_inode_++;
-                InodeInfo info;
-                info.inode = inode;
-                info.host_path = full_path;
-                info.nlookup = 0;
-                info.is_dir = is_dir;
-                info.share_tag = fh->share_tag;
-                inodes_[inode] = info;
-                path_to_inode_[full_path] = inode;
-            }
+    auto to_filetime = [](const LARGE_INTEGER& li) {
+        FILETIME ft;
+        ft.dwLowDateTime = static_cast<DWORD>(li.QuadPart);
+        ft.dwHighDateTime = static_cast<DWORD>(li.QuadPart >> 32);
+        return ft;
+    };
 
-            dirent.ino = inode;
-            dirent.off = entry_offset + 1;
-            dirent.namelen = name_len;
-            dirent.type = is_dir ? (FUSE_S_IFDIR >> 12) : (FUSE_S_IFREG >> 12);
+    auto* p = reinterpret_cast<const uint8_t*>(buf.data());
+    while (true) {
+        auto* info = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO*>(p);
+        HostDirEntry entry;
+        entry.name = WideToUtf8(std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+        entry.attr.dwFileAttributes = info->FileAttributes;
+        entry.attr.ftCreationTime = to_filetime(info->CreationTime);
+        entry.attr.ftLastAccessTime = to_filetime(info->LastAccessTime);
+        entry.attr.ftLastWriteTime = to_filetime(info->LastWriteTime);
+        entry.attr.nFileSizeHigh = static_cast<DWORD>(info->EndOfFile.QuadPart >> 32);
+        entry.attr.nFileSizeLow = static_cast<DWORD>(info->EndOfFile.QuadPart);
+        entry.file_id = static_cast<uint64_t>(info->FileId.QuadPart);
+        fh.dir_entries.push_back(std::move(entry));
+        if (!info->NextEntryOffset) break;
+        p += info->NextEntryOffset;
+    }
+    return FUSE_OK;
+}
+
+void VirtioFsDevice::HandleReadDir(const FuseInHeader* in_hdr, const uint8_t* in_data,
+                                    std::vector<uint8_t>& out_buf) {
+    auto* read_in = reinterpret_cast<const FuseReadIn*>(in_data);
+
+    std::shared_ptr<FileHandle> fh = GetFileHandle(read_in->fh);
+    if (!fh) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+        return;
+    }
+
+    std::vector<DirEntry> entries;
+    int32_t err = ListDirectory(*fh, in_hdr->nodeid, read_in->offset, read_in->size,
+                                sizeof(FuseDirent), false, &entries);
+    if (err != FUSE_OK) {
+        WriteErrorResponse(out_buf, in_hdr->unique, err);
+        return;
+    }
 
-            size_t old_size = dir_buf.size();
-            dir_buf.resize(old_size + entry_size);
-            memcpy(dir_buf.data() + old_size, &dirent, sizeof(dirent));
-            memcpy(dir_buf.data() + old_size + sizeof(dirent), name.c_str(), name_len);
+    std::vector<uint8_t> dir_buf;
+    for (const auto& entry : entries) {
+        uint32_t name_len = static_cast<uint32_t>(entry.name.size());
+        uint32_t entry_size = sizeof(FuseDirent) + name_len;
+        entry_size = (entry_size + 7) & ~7;
 
-            entry_offset++;
-        } while (FindNextFileW(hFind, &fdata));
+        FuseDirent dirent;
+        memset(&dirent, 0, sizeof(dirent));
+        dirent.ino = entry.inode;
+        dirent.off = entry.off;
+        dirent.namelen = name_len;
+        dirent.type = entry.is_dir ? (FUSE_S_IFDIR >> 12) : (FUSE_S_IFREG >> 12);
 
-        FindClose(hFind);
+        size_t old_size = dir_buf.size();
+        dir_buf.resize(old_size + entry_size);
+        memcpy(dir_buf.data() + old_size, &dirent, sizeof(dirent));
+        memcpy(dir_buf.data() + old_size + sizeof(dirent), entry.name.c_str(), name_len);
     }
 
     FuseOutHeader out_hdr;
@@ -953,131 +1309,71 @@ void VirtioFsDevice::HandleReadDir(const FuseInHeader* in_hdr, const uint8_t* in
 void VirtioFsDevice::HandleReadDirPlus(const FuseInHeader* in_hdr, const uint8_t* in_data,
                                         std::vector<uint8_t>& out_buf) {
     auto* read_in = reinterpret_cast<const FuseReadIn*>(in_data);
-    
-    std::lock_guard<std::mutex> lock(mutex_);
 
-    FileHandle* fh = GetFileHandle(read_in->fh);
+    std::shared_ptr<FileHandle> fh = GetFileHandle(read_in->fh);
     if (!fh) {
         WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
         return;
     }
 
-    std::vector<uint8_t> dir_buf;
-    uint64_t entry_offset = 0;
-
-    // Virtual root directory - list all shares
-    if (fh->path.empty() && fh->share_tag.empty()) {
-        for (const auto& [tag, share] : shares_) {
-            if (entry_offset < read_in->offset) {
-                entry_offset++;
-                continue;
-            }
-
-            uint32_t name_len = static_cast<uint32_t>(tag.size());
-            uint32_t entry_size = sizeof(FuseDirentplus) + name_len;
-            entry_size = (entry_size + 7) & ~7;
-
-            if (dir_buf.size() + entry_size > read_in->size) {
-                break;
-            }
-
-            FuseDirentplus direntplus;
-            memset(&direntplus, 0, sizeof(direntplus));
-            
-            direntplus.entry_out.nodeid = share.root_inode;
-            direntplus.entry_out.generation = 1;
-            direntplus.entry_out.entry_valid = 0;
-            direntplus.entry_out.attr_valid = 0;
-            FillShareRootAttr(share, &direntplus.entry_out.attr);
-
-            direntplus.dirent.ino = share.root_inode;
-            direntplus.dirent.off = entry_offset + 1;
-            direntplus.dirent.namelen = name_len;
-            direntplus.dirent.type = FUSE_S_IFDIR >> 12;
-
-            size_t old_size = dir_buf.size();
-            dir_buf.resize(old_size + entry_size);
-            memcpy(dir_buf.data() + old_size, &direntplus, sizeof(direntplus));
-            memcpy(dir_buf.data() + old_size + sizeof(direntplus), tag.c_str(), name_len);
+    std::vector<DirEntry> entries;
+    int32_t err = ListDirectory(*fh, in_hdr->nodeid, read_in->offset, read_in->size,
+                                sizeof(FuseDirentplus), true, &entries);
+    if (err != FUSE_OK) {
+        WriteErrorResponse(out_buf, in_hdr->unique, err);
+        return;
+    }
 
-            entry_offset++;
-        }
-    } else {
-        // Real directory
-        std::wstring search_path = Utf8ToWide(fh->path + "\\*");
+    // Sizes of the files listed must include writes still held here.
+    FlushPendingWrites("");
 
-        bool share_readonly = false;
-        {
+    bool virtual_root = fh->path.empty() && fh->share_tag.empty();
+    // Share roots are listed by tag; map them back to their host paths.
+    std::unordered_map<std::string, ShareInfo> shares;
+    bool share_readonly = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+        if (virtual_root) {
+            shares = shares_;
+        } else {
             auto sit = shares_.find(fh->share_tag);
             if (sit != shares_.end()) share_readonly = sit->second.readonly;
         }
-        
-        WIN32_FIND_DATAW fdata;
-        HANDLE hFind = FindFirstFileW(search_path.c_str(), &fdata);
-        if (hFind == INVALID_HANDLE_VALUE) {
-            WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
-            return;
-        }
-
-        do {
-            std::string name = WideToUtf8(fdata.cFileName);
-            
-            if (entry_offset < read_in->offset) {
-                entry_offset++;
-                continue;
-            }
-
-            uint32_t name_len = static_cast<uint32_t>(name.size());
-            uint32_t entry_size = sizeof(FuseDirentplus) + name_len;
-            entry_size = (entry_size + 7) & ~7;
-
-            if (dir_buf.size() + entry_size > read_in->size) {
-                break;
-            }
-
-            std::string full_path = fh->path + "\\" + name;
-            bool is_dir = (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-            
-            // Get or create inode
-            auto path_it = path_to_inode_.find(full_path);
-            uint64_t inode;
-            if (path_it != path_to_inode_.end()) {
-                inode = path_it->second;
-            } else {
-                inode = next_inode_++;
-                InodeInfo info;
-                info.inode = inode;
-                info.host_path = full_path;
-                info.nlookup = 0;
-                info.is_dir = is_dir;
-                info.share_tag = fh->share_tag;
-                inodes_[inode] = info;
-                path_to_inode_[full_path] = inode;
-            }
-
-            FuseDirentplus direntplus;
-            memset(&direntplus, 0, sizeof(direntplus));
-            
-            direntplus.entry_out.nodeid = inode;
-            direntplus.entry_out.generation = 1;
-            direntplus.entry_out.entry_valid = 1;
-            direntplus.entry_out.attr_valid = 1;
-            FillAttr(full_path, &direntplus.entry_out.attr, inode, share_readonly);
-
-            direntplus.dirent.ino = inode;
-            direntplus.dirent.off = entry_offset + 1;
-            direntplus.dirent.namelen = name_len;
-            direntplus.dirent.type = is_dir ? (FUSE_S_IFDIR >> 12) : (FUSE_S_IFREG >> 12);
+    }
 
-            size_t old_size = dir_buf.size();
-            dir_buf.resize(old_size + entry_size);
-            memcpy(dir_buf.data() + old_size, &direntplus, sizeof(direntplus));
-            memcpy(dir_buf.data() + old_size + sizeof(direntplus), name.c_str(), name_len);
+    std::vector<uint8_t> dir_buf;
+    for (const auto& entry : entries) {
+        uint32_t name_len = static_cast<uint32_t>(entry.name.size());
+        uint32_t entry_size = sizeof(FuseDirentplus) + name_len;
+        entry_size = (entry_size + 7) & ~7;
+
+        FuseDirentplus direntplus;
+        memset(&direntplus, 0, sizeof(direntplus));
+
+        // No node for "." and ".."; the guest skips them.
+        bool dot = entry.name == "." || entry.name == "..";
+        direntplus.entry_out.nodeid = dot ? 0 : entry.inode;
+        direntplus.entry_out.generation = 1;
+        if (virtual_root) {
+            direntplus.entry_out.entry_valid = 0;
+            direntplus.entry_out.attr_valid = 0;
+            auto sit = shares.find(entry.name);
+            if (sit != shares.end()) FillShareRootAttr(sit->second, &direntplus.entry_out.attr);
+        } else {
+            direntplus.entry_out.entry_valid = AttrTtl();
+            direntplus.entry_out.attr_valid = AttrTtl();
+            FillAttrFrom(entry.attr, &direntplus.entry_out.attr, entry.inode, share_readonly);
+        }
 
-            entry_offset++;
-        } while (FindNextFileW(hFind, &fdata));
+        direntplus.dirent.ino = entry.inode;
+        direntplus.dirent.off = entry.off;
+        direntplus.dirent.namelen = name_len;
+        direntplus.dirent.type = entry.is_dir ? (FUSE_S_IFDIR >> 12) : (FUSE_S_IFREG >> 12);
 
-        FindClose(hFind);
+        size_t old_size = dir_buf.size();
+        dir_buf.resize(old_size + entry_size);
+        memcpy(dir_buf.data() + old_size, &direntplus, sizeof(direntplus));
+        memcpy(dir_buf.data() + old_size + sizeof(direntplus), entry.name.c_str(), name_len);
     }
 
     FuseOutHeader out_hdr;
@@ -1103,7 +1399,13 @@ void VirtioFsDevice::HandleStatFs(const FuseInHeader* in_hdr, std::vector<uint8_
     memset(&statfs_out, 0, sizeof(statfs_out));
 
     // For virtual root, return aggregated stats or reasonable defaults
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> share_paths;
+    {
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+        for (const auto& [tag, share] : shares_) {
+            share_paths.push_back(share.host_path);
+        }
+    }
     
     uint64_t total_blocks = 0;
     uint64_t free_blocks = 0;
@@ -1112,9 +1414,9 @@ void VirtioFsDevice::HandleStatFs(const FuseInHeader* in_hdr, std::vector<uint8_
     bool got_stats = false;
 
     // Try to get stats from the first share, or aggregate
-    for (const auto& [tag, share] : shares_) {
+    for (const auto& host_path : share_paths) {
         ULARGE_INTEGER free_bytes, total_bytes, total_free;
-        if (GetDiskFreeSpaceExW(Utf8ToWide(share.host_path).c_str(), &free_bytes, &total_bytes, &total_free)) {
+        if (GetDiskFreeSpaceExW(Utf8ToWide(host_path).c_str(), &free_bytes, &total_bytes, &total_free)) {
             if (!got_stats) {
                 total_blocks = total_bytes.QuadPart / block_size;
                 free_blocks = total_free.QuadPart / block_size;
@@ -1179,15 +1481,21 @@ void VirtioFsDevice::HandleCreate(const FuseInHeader* in_hdr, const uint8_t* in_
     DWORD access = GENERIC_READ | GENERIC_WRITE;
     DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
     
-    HANDLE h = CreateFileW(Utf8ToWide(file_path).c_str(), access, share, nullptr, 
+    HANDLE h = CreateFileW(HostPathOf(file_path)->wide.c_str(), access, share, nullptr, 
                            CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
     if (h == INVALID_HANDLE_VALUE) {
         WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
         return;
     }
 
-    uint64_t inode = GetOrCreateInode(file_path, false, share_tag);
-    uint64_t fh = AllocFileHandle(h, false, file_path, share_tag);
+    InvalidateAttr(file_path);
+    uint64_t inode = LookupInode(in_hdr->nodeid, std::string(name, name_len), file_path, false, h);
+    if (!inode) {
+        CloseHandle(h);
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+        return;
+    }
+    uint64_t fh = AllocFileHandle(h, false, file_path, share_tag, access);
 
     FuseOutHeader out_hdr;
     FuseEntryOut entry_out;
@@ -1197,11 +1505,12 @@ void VirtioFsDevice::HandleCreate(const FuseInHeader* in_hdr, const uint8_t* in_
 
     entry_out.nodeid = inode;
     entry_out.generation = 1;
-    entry_out.entry_valid = 1;
-    entry_out.attr_valid = 1;
+    entry_out.entry_valid = AttrTtl();
+    entry_out.attr_valid = AttrTtl();
     FillAttr(file_path, &entry_out.attr, inode);
 
     open_out.fh = fh;
+    open_out.open_flags = OpenFlagsFor(share_tag);
 
     out_hdr.len = sizeof(FuseOutHeader) + sizeof(FuseEntryOut) + sizeof(FuseOpenOut);
     out_hdr.error = 0;
@@ -1238,12 +1547,17 @@ void VirtioFsDevice::HandleMkdir(const FuseInHeader* in_hdr, const uint8_t* in_d
 
     std::string dir_path = parent_path + "\\" + std::string(name, name_len);
 
-    if (!CreateDirectoryW(Utf8ToWide(dir_path).c_str(), nullptr)) {
+    if (!CreateDirectoryW(HostPathOf(dir_path)->wide.c_str(), nullptr)) {
         WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
         return;
     }
 
-    uint64_t inode = GetOrCreateInode(dir_path, true, share_tag);
+    InvalidateAttr(dir_path);
+    uint64_t inode = LookupInode(in_hdr->nodeid, std::string(name, name_len), dir_path, true);
+    if (!inode) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+        return;
+    }
 
     FuseOutHeader out_hdr;
     FuseEntryOut entry_out;
@@ -1251,8 +1565,8 @@ void VirtioFsDevice::HandleMkdir(const FuseInHeader* in_hdr, const uint8_t* in_d
 
     entry_out.nodeid = inode;
     entry_out.generation = 1;
-    entry_out.entry_valid = 1;
-    entry_out.attr_valid = 1;
+    entry_out.entry_valid = AttrTtl();
+    entry_out.attr_valid = AttrTtl();
     FillAttr(dir_path, &entry_out.attr, inode);
 
     out_hdr.len = sizeof(FuseOutHeader) + sizeof(FuseEntryOut);
@@ -1289,12 +1603,18 @@ void VirtioFsDevice::HandleUnlink(const FuseInHeader* in_hdr, const uint8_t* in_
 
     std::string file_path = parent_path + "\\" + name;
 
-    if (!DeleteFileW(Utf8ToWide(file_path).c_str())) {
+    EvictCachedHandles(file_path);
+    if (!DeleteFileW(HostPathOf(file_path)->wide.c_str()) &&
+        !(dax_ && dax_->DropViews(file_path) && DeleteFileW(HostPathOf(file_path)->wide.c_str()))) {
         WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
         return;
     }
 
-    RemoveInode(0);
+    InvalidateAttr(file_path);
+    {
+        std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+        inodes_.Unlink(in_hdr->nodeid, name);
+    }
     WriteErrorResponse(out_buf, in_hdr->unique, FUSE_OK);
 }
 
@@ -1323,10 +1643,16 @@ void VirtioFsDevice::HandleRmdir(const FuseInHeader* in_hdr, const uint8_t* in_d
 
     std::string dir_path = parent_path + "\\" + name;
 
-    if (!RemoveDirectoryW(Utf8ToWide(dir_path).c_str())) {
+    EvictCachedHandles(dir_path, true);
+    if (!RemoveDirectoryW(HostPathOf(dir_path)->wide.c_str())) {
         WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
         return;
     }
+    InvalidateAttr(dir_path, true);
+    {
+        std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+        inodes_.Unlink(in_hdr->nodeid, name);
+    }
 
     WriteErrorResponse(out_buf, in_hdr->unique, FUSE_OK);
 }
@@ -1374,36 +1700,121 @@ void VirtioFsDevice::HandleRename(const FuseInHeader* in_hdr, const uint8_t* in_
     std::string old_path = old_parent_path + "\\" + old_name;
     std::string new_path = new_parent_path + "\\" + new_name;
 
-    if (!MoveFileExW(Utf8ToWide(old_path).c_str(), Utf8ToWide(new_path).c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    EvictCachedHandles(old_path, true);
+    EvictCachedHandles(new_path, true);
+    if (!MoveFileExW(HostPathOf(old_path)->wide.c_str(), HostPathOf(new_path)->wide.c_str(), MOVEFILE_REPLACE_EXISTING)) {
         WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
         return;
     }
+    InvalidateAttr(old_path, true);
+    InvalidateAttr(new_path, true);
+    {
+        std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+        inodes_.Rename(in_hdr->nodeid, old_name, rename_in->newdir, new_name);
+    }
 
     WriteErrorResponse(out_buf, in_hdr->unique, FUSE_OK);
 }
 
-void VirtioFsDevice::HandleFlush(const FuseInHeader*, const uint8_t* in_data) {
+int32_t VirtioFsDevice::HandleFlush(const FuseInHeader*, const uint8_t* in_data) {
     auto* release_in = reinterpret_cast<const FuseReleaseIn*>(in_data);
-    FileHandle* fh = GetFileHandle(release_in->fh);
-    if (fh && fh->handle != INVALID_HANDLE_VALUE) {
-        FlushFileBuffers(fh->handle);
+    std::shared_ptr<FileHandle> fh = GetFileHandle(release_in->fh);
+    if (!fh || fh->handle == INVALID_HANDLE_VALUE) return FUSE_OK;
+
+    DWORD error = ERROR_SUCCESS;
+    if (fh->writeback) {
+        std::lock_guard<std::mutex> wlock(fh->write_mutex);
+        fh->WritePendingLocked();
+        std::swap(error, fh->write_error);
+    }
+    InvalidateAttr(fh->path);
+    FlushFileBuffers(fh->handle);
+    return error == ERROR_SUCCESS ? FUSE_OK : WindowsErrorToFuse(error);
+}
+
+int32_t VirtioFsDevice::HandleFsync(const FuseInHeader* in_hdr, const uint8_t* in_data) {
+    // Same work as FLUSH: push pending data out, then to disk.
+    return HandleFlush(in_hdr, in_data);
+}
+
+void VirtioFsDevice::HandleSetupMapping(const FuseInHeader* in_hdr, const uint8_t* in_data,
+                                        uint32_t in_len, std::vector<uint8_t>& out_buf) {
+    if (!dax_) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOSYS);
+        return;
     }
+    if (in_len < sizeof(FuseSetupMappingIn)) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_EINVAL);
+        return;
+    }
+    auto* setup_in = reinterpret_cast<const FuseSetupMappingIn*>(in_data);
+
+    // The kernel passes no file handle (fh is -1), only the inode.
+    std::string path = NodeIdToPath(in_hdr->nodeid);
+    if (path.empty()) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOENT);
+        return;
+    }
+    // The view must see what was written through FUSE_WRITE.
+    FlushPendingWrites(path);
+
+    bool writable = (setup_in->flags & FUSE_SETUPMAPPING_FLAG_WRITE) != 0;
+    if (writable && IsShareReadonly(NodeIdToShareTag(in_hdr->nodeid))) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_EROFS);
+        return;
+    }
+
+    // The mapping holds a handle of its own and outlives the guest's.
+    DWORD access = GENERIC_READ | (writable ? GENERIC_WRITE : 0);
+    HANDLE h = CreateFileW(HostPathOf(path)->wide.c_str(), access,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        WriteErrorResponse(out_buf, in_hdr->unique, WindowsErrorToFuse(GetLastError()));
+        return;
+    }
+
+    int32_t err = dax_->Setup(h, path, setup_in->foffset, setup_in->len,
+                              setup_in->moffset, writable);
+    WriteErrorResponse(out_buf, in_hdr->unique, err);
 }
 
-void VirtioFsDevice::HandleFsync(const FuseInHeader*, const uint8_t* in_data) {
-    auto* release_in = reinterpret_cast<const FuseReleaseIn*>(in_data);
-    FileHandle* fh = GetFileHandle(release_in->fh);
-    if (fh && fh->handle != INVALID_HANDLE_VALUE) {
-        FlushFileBuffers(fh->handle);
+void VirtioFsDevice::HandleRemoveMapping(const FuseInHeader* in_hdr, const uint8_t* in_data,
+                                         uint32_t in_len, std::vector<uint8_t>& out_buf) {
+    if (!dax_) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_ENOSYS);
+        return;
     }
+    if (in_len < sizeof(FuseRemoveMappingIn)) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_EINVAL);
+        return;
+    }
+    auto* remove_in = reinterpret_cast<const FuseRemoveMappingIn*>(in_data);
+    auto* ranges = reinterpret_cast<const FuseRemoveMappingOne*>(in_data + sizeof(FuseRemoveMappingIn));
+    if (remove_in->count > (in_len - sizeof(FuseRemoveMappingIn)) / sizeof(FuseRemoveMappingOne)) {
+        WriteErrorResponse(out_buf, in_hdr->unique, FUSE_EINVAL);
+        return;
+    }
+
+    int32_t err = FUSE_OK;
+    for (uint32_t i = 0; i < remove_in->count; i++) {
+        int32_t r = dax_->Remove(ranges[i].moffset, ranges[i].len);
+        if (r != FUSE_OK) err = r;
+    }
+    WriteErrorResponse(out_buf, in_hdr->unique, err);
 }
 
 int32_t VirtioFsDevice::FillAttr(const std::string& path, FuseAttr* attr, uint64_t inode, bool share_readonly) {
     WIN32_FILE_ATTRIBUTE_DATA fad;
-    if (!GetFileAttributesExW(Utf8ToWide(path).c_str(), GetFileExInfoStandard, &fad)) {
-        return WindowsErrorToFuse(GetLastError());
+    DWORD error = QueryAttributes(path, &fad);
+    if (error != ERROR_SUCCESS) {
+        return WindowsErrorToFuse(error);
     }
+    return FillAttrFrom(fad, attr, inode, share_readonly);
+}
 
+int32_t VirtioFsDevice::FillAttrFrom(const WIN32_FILE_ATTRIBUTE_DATA& fad, FuseAttr* attr,
+                                     uint64_t inode, bool share_readonly) {
     memset(attr, 0, sizeof(*attr));
     attr->ino = inode;
     
@@ -1443,6 +1854,218 @@ int32_t VirtioFsDevice::FillAttr(const std::string& path, FuseAttr* attr, uint64
     return FUSE_OK;
 }
 
+DWORD VirtioFsDevice::QueryAttributes(const std::string& path, WIN32_FILE_ATTRIBUTE_DATA* fad) {
+    std::shared_ptr<const HostPath> host = HostPathOf(path);
+    const std::wstring& key = host->key;
+    uint64_t generation;
+    bool cacheable;
+    {
+        std::lock_guard<std::mutex> lock(attr_mutex_);
+        auto it = attr_cache_.find(key);
+        if (it != attr_cache_.end()) {
+            *fad = it->second.data;
+            return it->second.error;
+        }
+        generation = attr_generation_;
+        cacheable = IsWatchedLocked(key);
+    }
+
+    DWORD error = ERROR_SUCCESS;
+    if (!GetFileAttributesExW(host->wide.c_str(), GetFileExInfoStandard, fad)) {
+        error = GetLastError();
+    }
+
+    // Sharing violations and the like are transient; don't remember them.
+    if (cacheable && (error == ERROR_SUCCESS || error == ERROR_FILE_NOT_FOUND ||
+                      error == ERROR_PATH_NOT_FOUND)) {
+        std::lock_guard<std::mutex> lock(attr_mutex_);
+        // An invalidation raced with the query; the result may be stale.
+        if (attr_generation_ == generation) {
+            if (attr_cache_.size() >= kAttrCacheMax) attr_cache_.clear();
+            CachedAttr& cached = attr_cache_[key];
+            cached.error = error;
+            cached.data = error == ERROR_SUCCESS ? *fad : WIN32_FILE_ATTRIBUTE_DATA{};
+        }
+    }
+    return error;
+}
+
+void VirtioFsDevice::InvalidateAttr(const std::string& path, bool subtree) {
+    InvalidateAttrKey(HostPathOf(path)->key, subtree);
+}
+
+void VirtioFsDevice::InvalidateAttrKey(const std::wstring& key, bool subtree) {
+    std::lock_guard<std::mutex> lock(attr_mutex_);
+    attr_generation_++;
+    attr_cache_.erase(key);
+    // The parent's mtime moves with its entries.
+    size_t slash = key.rfind(L'\\');
+    if (slash != std::wstring::npos) attr_cache_.erase(key.substr(0, slash));
+
+    if (subtree) {
+        std::wstring prefix = key + L"\\";
+        for (auto it = attr_cache_.begin(); it != attr_cache_.end();) {
+            if (it->first.compare(0, prefix.size(), prefix) == 0) {
+                it = attr_cache_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+bool VirtioFsDevice::IsWatchedLocked(const std::wstring& key) const {
+    for (const auto& root : watched_roots_) {
+        if (key.compare(0, root.size(), root) == 0) return true;
+        if (key.size() + 1 == root.size() && root.compare(0, key.size(), key) == 0) return true;
+    }
+    return false;
+}
+
+uint64_t VirtioFsDevice::AttrTtl() const {
+    // Without notifications the guest can only notice host changes by
+    // asking again.
+    return notify_enabled_ ? kNotifiedTtl : 1;
+}
+
+void VirtioFsDevice::StartWatcher(const std::string& tag, const std::string& host_path) {
+    std::wstring root = AttrCacheKey(Utf8ToWide(host_path));
+    if (root.empty() || root.back() != L'\\') root += L'\\';
+    {
+        std::lock_guard<std::mutex> lock(attr_mutex_);
+        watched_roots_.push_back(root);
+    }
+
+    auto watcher = std::make_unique<DirectoryWatcher>();
+    bool started = watcher->Start(Utf8ToWide(host_path),
+        [this, tag, host_path](DWORD action, const std::wstring& name) {
+            OnHostChange(tag, host_path, action, name);
+        });
+    if (!started) {
+        LOG_WARN("VirtIO FS: cannot watch share '%s' (%lu), attributes will not be cached",
+                 tag.c_str(), GetLastError());
+        UnwatchRoot(host_path);
+        return;
+    }
+    // Anything cached before the watch was armed may have missed a change.
+    InvalidateAttr(host_path, true);
+
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    watchers_[tag] = std::move(watcher);
+}
+
+void VirtioFsDevice::StopWatcher(const std::string& tag) {
+    std::unique_ptr<DirectoryWatcher> watcher;
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        auto it = watchers_.find(tag);
+        if (it == watchers_.end()) return;
+        watcher = std::move(it->second);
+        watchers_.erase(it);
+    }
+    watcher->Stop();
+}
+
+void VirtioFsDevice::UnwatchRoot(const std::string& host_path) {
+    std::wstring key = AttrCacheKey(Utf8ToWide(host_path));
+    std::wstring root = key;
+    if (root.empty() || root.back() != L'\\') root += L'\\';
+    {
+        std::lock_guard<std::mutex> lock(attr_mutex_);
+        watched_roots_.erase(std::remove(watched_roots_.begin(), watched_roots_.end(), root),
+                             watched_roots_.end());
+    }
+    InvalidateAttrKey(key, true);
+}
+
+void VirtioFsDevice::OnHostChange(const std::string& share_tag, const std::string& host_path,
+                                  DWORD action, const std::wstring& name) {
+    if (action == DirectoryWatcher::kStopped) {
+        LOG_WARN("VirtIO FS: share '%s' is no longer watched", share_tag.c_str());
+        UnwatchRoot(host_path);
+        return;
+    }
+    if (action == DirectoryWatcher::kChangesLost) {
+        InvalidateAttr(host_path, true);
+        return;
+    }
+
+    std::string rel = WideToUtf8(name);
+    bool gone = action == FILE_ACTION_REMOVED || action == FILE_ACTION_RENAMED_OLD_NAME;
+    InvalidateAttr(host_path + "\\" + rel, gone);
+    // Let go of the name, or the host can't reuse it.
+    if (gone) EvictCachedHandles(host_path + "\\" + rel, true);
+
+    size_t slash = rel.rfind('\\');
+    std::string parent_rel = slash == std::string::npos ? "" : rel.substr(0, slash);
+    std::string leaf = slash == std::string::npos ? rel : rel.substr(slash + 1);
+    uint64_t inode = 0;
+    uint64_t parent_inode = 0;
+    {
+        std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+        auto sit = shares_.find(share_tag);
+        if (sit != shares_.end()) {
+            parent_inode = inodes_.FindPath(sit->second.root_inode, parent_rel);
+            if (parent_inode) inode = inodes_.Find(parent_inode, leaf);
+            // The node outlives the name; a new file there gets a new one.
+            if (gone && parent_inode) inodes_.Unlink(parent_inode, leaf);
+        }
+    }
+    if (!notify_enabled_) return;
+
+    if (inode) {
+        FuseNotifyInvalInodeOut inval = {};
+        inval.ino = inode;
+        SendNotification(FUSE_NOTIFY_INVAL_INODE, &inval, sizeof(inval));
+    }
+    // Names came or went: drop the dentry (positive or negative) and the
+    // parent's attributes.
+    if (action != FILE_ACTION_MODIFIED && parent_inode && !leaf.empty() && leaf.size() <= 255) {
+        std::vector<uint8_t> payload(sizeof(FuseNotifyInvalEntryOut) + leaf.size() + 1, 0);
+        FuseNotifyInvalEntryOut entry = {};
+        entry.parent = parent_inode;
+        entry.namelen = static_cast<uint32_t>(leaf.size());
+        memcpy(payload.data(), &entry, sizeof(entry));
+        memcpy(payload.data() + sizeof(entry), leaf.data(), leaf.size());
+        SendNotification(FUSE_NOTIFY_INVAL_ENTRY, payload.data(), payload.size());
+
+        FuseNotifyInvalInodeOut inval = {};
+        inval.ino = parent_inode;
+        inval.off = -1;
+        SendNotification(FUSE_NOTIFY_INVAL_INODE, &inval, sizeof(inval));
+    }
+}
+
+void VirtioFsDevice::SendNotification(int32_t code, const void* payload, size_t len) {
+    std::lock_guard<std::mutex> lock(used_mutex_);
+    if (!notify_enabled_ || !mmio_) return;
+    VirtQueue* vq = mmio_->GetQueue(kNotifyQueue);
+    uint16_t head;
+    // No buffer left: the guest falls back on its TTLs.
+    if (!vq || !vq->IsReady() || !vq->PopAvail(&head)) return;
+
+    thread_local VirtqChain chain;
+    uint32_t written = 0;
+    if (vq->WalkChain(head, &chain)) {
+        FuseOutHeader out_hdr;
+        out_hdr.len = static_cast<uint32_t>(sizeof(out_hdr) + len);
+        out_hdr.error = code;
+        out_hdr.unique = 0;
+
+        std::vector<uint8_t> msg(out_hdr.len);
+        memcpy(msg.data(), &out_hdr, sizeof(out_hdr));
+        memcpy(msg.data() + sizeof(out_hdr), payload, len);
+        for (const auto& elem : chain) {
+            if (!elem.writable || written >= msg.size()) continue;
+            uint32_t copy_len = std::min(elem.len, static_cast<uint32_t>(msg.size()) - written);
+            memcpy(elem.addr, msg.data() + written, copy_len);
+            written += copy_len;
+        }
+    }
+    vq->PushUsed(head, written);
+    mmio_->NotifyUsedBuffer();
+}
+
 int32_t VirtioFsDevice::FillVirtualRootAttr(FuseAttr* attr) {
     memset(attr, 0, sizeof(*attr));
     attr->ino = VIRTUAL_ROOT_INODE;
@@ -1488,87 +2111,221 @@ int32_t VirtioFsDevice::WindowsErrorToFuse(DWORD error) {
     }
 }
 
-uint64_t VirtioFsDevice::AllocInode() {
-    // Note: caller should already hold mutex_
-    return next_inode_++;
+bool VirtioFsDevice::ResolveLocked(uint64_t nodeid, std::string* path,
+                                   std::string* share_tag) const {
+    std::string rel;
+    if (!inodes_.GetPath(nodeid, share_tag, &rel)) return false;
+    auto it = shares_.find(*share_tag);
+    if (it == shares_.end()) return false;
+    *path = rel.empty() ? it->second.host_path : it->second.host_path + "\\" + rel;
+    return true;
+}
+
+uint64_t VirtioFsDevice::LookupInode(uint64_t parent, const std::string& name,
+                                     const std::string& path, bool is_dir, HANDLE h) {
+    // Known names skip the extra open for their file ID.
+    bool known;
+    {
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+        known = inodes_.HasFileId(parent, name);
+    }
+    HostFileId id;
+    if (!known) id = h != INVALID_HANDLE_VALUE ? QueryFileId(h) : QueryFileId(path);
+
+    std::unique_lock<std::shared_mutex> lock(inode_mutex_);
+    return inodes_.Lookup(parent, name, id, is_dir);
 }
 
-InodeInfo* VirtioFsDevice::GetInode(uint64_t inode) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = inodes_.find(inode);
-    return it != inodes_.end() ? &it->second : nullptr;
+HostFileId VirtioFsDevice::QueryFileId(HANDLE h) {
+    HostFileId id;
+    FILE_ID_INFO info;
+    if (GetFileInformationByHandleEx(h, FileIdInfo, &info, sizeof(info))) {
+        id.volume = info.VolumeSerialNumber;
+        memcpy(&id.id_low, info.FileId.Identifier, sizeof(id.id_low));
+        memcpy(&id.id_high, info.FileId.Identifier + sizeof(id.id_low), sizeof(id.id_high));
+        return id;
+    }
+    // File systems without 128-bit IDs (FAT)
+    BY_HANDLE_FILE_INFORMATION bhfi;
+    if (GetFileInformationByHandle(h, &bhfi)) {
+        id.volume = bhfi.dwVolumeSerialNumber;
+        id.id_low = (static_cast<uint64_t>(bhfi.nFileIndexHigh) << 32) | bhfi.nFileIndexLow;
+    }
+    return id;
 }
 
-uint64_t VirtioFsDevice::GetOrCreateInode(const std::string& path, bool is_dir, const std::string& share_tag) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = path_to_inode_.find(path);
-    if (it != path_to_inode_.end()) {
-        inodes_[it->second].nlookup++;
-        return it->second;
-    }
-
-    uint64_t inode = next_inode_++;
-    InodeInfo info;
-    info.inode = inode;
-    info.host_path = path;
-    info.nlookup = 1;
-    info.is_dir = is_dir;
-    info.share_tag = share_tag;
-    
-    inodes_[inode] = info;
-    path_to_inode_[path] = inode;
-    
-    return inode;
+HostFileId VirtioFsDevice::QueryFileId(const std::string& path) {
+    HANDLE h = CreateFileW(HostPathOf(path)->wide.c_str(), FILE_READ_ATTRIBUTES,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                           OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+                           nullptr);
+    if (h == INVALID_HANDLE_VALUE) return {};
+    HostFileId id = QueryFileId(h);
+    CloseHandle(h);
+    return id;
 }
 
-void VirtioFsDevice::RemoveInode(uint64_t inode) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = inodes_.find(inode);
-    if (it != inodes_.end()) {
-        path_to_inode_.erase(it->second.host_path);
-        inodes_.erase(it);
+FileHandle::~FileHandle() {
+    if (!pending.empty()) WritePendingLocked();
+    if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+}
+
+void FileHandle::WritePendingLocked() {
+    if (pending.empty()) return;
+    size_t done = 0;
+    while (done < pending.size()) {
+        uint64_t offset = pending_offset + done;
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD put = 0;
+        DWORD err = ERROR_SUCCESS;
+        if (!WriteFile(handle, pending.data() + done, static_cast<DWORD>(pending.size() - done),
+                       &put, &ov)) {
+            err = GetLastError();
+        } else if (put == 0) {
+            err = ERROR_WRITE_FAULT;
+        }
+        if (err != ERROR_SUCCESS) {
+            LOG_WARN("VirtIO FS: deferred write to '%s' failed (%lu)", path.c_str(), err);
+            if (write_error == ERROR_SUCCESS) write_error = err;
+            break;
+        }
+        done += put;
     }
+    pending.clear();
+    if (pending_count) (*pending_count)--;
 }
 
-uint64_t VirtioFsDevice::AllocFileHandle(HANDLE h, bool is_dir, const std::string& path, const std::string& share_tag) {
-    std::lock_guard<std::mutex> lock(mutex_);
+uint64_t VirtioFsDevice::AllocFileHandle(HANDLE h, bool is_dir, const std::string& path,
+                                         const std::string& share_tag, DWORD access) {
+    auto handle = std::make_shared<FileHandle>();
+    handle->handle = h;
+    handle->access = access;
+    handle->is_dir = is_dir;
+    handle->path = path;
+    handle->share_tag = share_tag;
+    handle->writeback = !is_dir && IsShareWriteback(share_tag);
+    handle->pending_count = &pending_handles_;
+    std::lock_guard<std::mutex> lock(handle_mutex_);
     uint64_t fh = next_fh_++;
-    file_handles_[fh] = {h, is_dir, path, share_tag};
+    file_handles_[fh] = std::move(handle);
     return fh;
 }
 
-FileHandle* VirtioFsDevice::GetFileHandle(uint64_t fh) {
-    // Note: caller should handle locking if needed
+std::shared_ptr<FileHandle> VirtioFsDevice::GetFileHandle(uint64_t fh) {
+    std::lock_guard<std::mutex> lock(handle_mutex_);
     auto it = file_handles_.find(fh);
-    return it != file_handles_.end() ? &it->second : nullptr;
+    return it != file_handles_.end() ? it->second : nullptr;
 }
 
 void VirtioFsDevice::CloseFileHandle(uint64_t fh) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = file_handles_.find(fh);
-    if (it != file_handles_.end()) {
-        if (it->second.handle != INVALID_HANDLE_VALUE) {
-            CloseHandle(it->second.handle);
-        }
+    std::shared_ptr<FileHandle> closed;
+    {
+        std::lock_guard<std::mutex> lock(handle_mutex_);
+        auto it = file_handles_.find(fh);
+        if (it == file_handles_.end()) return;
+        closed = std::move(it->second);
         file_handles_.erase(it);
     }
+    if (closed->writeback) {
+        std::lock_guard<std::mutex> wlock(closed->write_mutex);
+        closed->WritePendingLocked();
+    }
+    // Only once no request still uses it.
+    if (closed.use_count() == 1 && !closed->is_dir && closed->handle != INVALID_HANDLE_VALUE) {
+        CacheClosedHandle(*closed);
+    }
+}
+
+HANDLE VirtioFsDevice::TakeCachedHandle(const std::string& path, DWORD access, uint64_t nodeid) {
+    std::wstring key = HostPathOf(path)->key;
+    CachedHandle cached;
+    {
+        std::lock_guard<std::mutex> lock(handle_cache_mutex_);
+        auto it = std::find_if(handle_cache_.rbegin(), handle_cache_.rend(),
+            [&](const CachedHandle& c) { return c.access == access && c.key == key; });
+        if (it == handle_cache_.rend()) return INVALID_HANDLE_VALUE;
+        cached = std::move(*it);
+        handle_cache_.erase(std::next(it).base());
+    }
+
+    // Still the same file under that name, and not written since?
+    bool reuse = GetTickCount64() - cached.closed_at <= kHandleCacheTtlMs;
+    if (reuse) {
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        reuse = QueryAttributes(path, &fad) == ERROR_SUCCESS &&
+                CompareFileTime(&fad.ftLastWriteTime, &cached.last_write) == 0;
+    }
+    if (reuse) {
+        std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+        HostFileId id = inodes_.FileIdOf(nodeid);
+        reuse = !id.valid() || id == cached.file_id;
+    }
+    if (!reuse) {
+        CloseHandle(cached.handle);
+        return INVALID_HANDLE_VALUE;
+    }
+    return cached.handle;
+}
+
+void VirtioFsDevice::CacheClosedHandle(FileHandle& fh) {
+    CachedHandle cached;
+    if (!GetFileTime(fh.handle, nullptr, nullptr, &cached.last_write)) return;
+    cached.key = HostPathOf(fh.path)->key;
+    cached.access = fh.access;
+    cached.handle = fh.handle;
+    cached.file_id = QueryFileId(fh.handle);
+    cached.closed_at = GetTickCount64();
+    fh.handle = INVALID_HANDLE_VALUE;
+
+    std::vector<HANDLE> expired;
+    {
+        std::lock_guard<std::mutex> lock(handle_cache_mutex_);
+        auto live = std::find_if(handle_cache_.begin(), handle_cache_.end(),
+            [&](const CachedHandle& c) { return cached.closed_at - c.closed_at <= kHandleCacheTtlMs; });
+        size_t drop = std::max<size_t>(live - handle_cache_.begin(),
+                                       handle_cache_.size() + 1 > kHandleCacheMax
+                                           ? handle_cache_.size() + 1 - kHandleCacheMax : 0);
+        for (size_t i = 0; i < drop; i++) expired.push_back(handle_cache_[i].handle);
+        handle_cache_.erase(handle_cache_.begin(), handle_cache_.begin() + drop);
+        handle_cache_.push_back(std::move(cached));
+    }
+    for (HANDLE h : expired) CloseHandle(h);
+}
+
+void VirtioFsDevice::EvictCachedHandles(const std::string& path, bool subtree) {
+    std::wstring key = HostPathOf(path)->key;
+    std::wstring prefix = key + L"\\";
+    std::vector<HANDLE> evicted;
+    {
+        std::lock_guard<std::mutex> lock(handle_cache_mutex_);
+        auto keep = std::remove_if(handle_cache_.begin(), handle_cache_.end(),
+            [&](const CachedHandle& c) {
+                bool match = key.empty() || c.key == key ||
+                             (subtree && c.key.compare(0, prefix.size(), prefix) == 0);
+                if (match) evicted.push_back(c.handle);
+                return match;
+            });
+        handle_cache_.erase(keep, handle_cache_.end());
+    }
+    for (HANDLE h : evicted) CloseHandle(h);
 }
 
 std::string VirtioFsDevice::NodeIdToPath(uint64_t nodeid) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = inodes_.find(nodeid);
-    return it != inodes_.end() ? it->second.host_path : "";
+    std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+    std::string path, share_tag;
+    return ResolveLocked(nodeid, &path, &share_tag) ? path : "";
 }
 
 std::string VirtioFsDevice::NodeIdToShareTag(uint64_t nodeid) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = inodes_.find(nodeid);
-    return it != inodes_.end() ? it->second.share_tag : "";
+    std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+    std::string path, share_tag;
+    return ResolveLocked(nodeid, &path, &share_tag) ? share_tag : "";
 }
 
 bool VirtioFsDevice::IsShareReadonly(const std::string& share_tag) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_lock<std::shared_mutex> lock(inode_mutex_);
     
     // Empty share_tag means something is wrong, but don't block writes
     if (share_tag.empty()) {
@@ -1585,7 +2342,34 @@ bool VirtioFsDevice::IsShareReadonly(const std::string& share_tag) {
     return it->second.readonly;
 }
 
+bool VirtioFsDevice::IsShareWriteback(const std::string& share_tag) {
+    std::shared_lock<std::shared_mutex> lock(inode_mutex_);
+    auto it = shares_.find(share_tag);
+    return it != shares_.end() && it->second.writeback;
+}
+
+uint32_t VirtioFsDevice::OpenFlagsFor(const std::string& share_tag) {
+    return writeback_cache_ && !IsShareWriteback(share_tag) ? FOPEN_DIRECT_IO : 0;
+}
+
+void VirtioFsDevice::FlushPendingWrites(const std::string& path) {
+    if (pending_handles_ == 0) return;
+    std::vector<std::shared_ptr<FileHandle>> dirty;
+    {
+        std::lock_guard<std::mutex> lock(handle_mutex_);
+        for (const auto& [_, fh] : file_handles_) {
+            if (fh->writeback && (path.empty() || fh->path == path)) dirty.push_back(fh);
+        }
+    }
+    for (const auto& fh : dirty) {
+        std::lock_guard<std::mutex> wlock(fh->write_mutex);
+        if (fh->pending.empty()) continue;
+        fh->WritePendingLocked();
+        InvalidateAttr(fh->path);
+    }
+}
+
 uint32_t VirtioFsDevice::GetOpenHandleCount() const {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> lock(handle_mutex_);
     return static_cast<uint32_t>(file_handles_.size());
 }
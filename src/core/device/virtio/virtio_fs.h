@@ -1,9 +1,21 @@
 #pragma once
 
 #include "core/device/virtio/virtio_mmio.h"
+#include "core/device/virtio/virtio_fs_dax.h"
+#include "core/device/virtio/dir_watcher.h"
+#include "core/device/virtio/virtio_fs_inodes.h"
+#include "core/device/virtio/virtio_fs_paths.h"
+#include "core/device/virtio/virtio_fs_stats.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
-#include <mutex>
+#include <vector>
 
 #define NOMINMAX
 #include <windows.h>
@@ -76,6 +88,10 @@ enum FuseOpcode : uint32_t {
 };
 
 // FUSE error codes (negative errno values)
+// FUSE notification codes, sent in FuseOutHeader::error with unique 0
+constexpr int32_t FUSE_NOTIFY_INVAL_INODE = 2;
+constexpr int32_t FUSE_NOTIFY_INVAL_ENTRY = 3;
+
 constexpr int32_t FUSE_OK = 0;
 constexpr int32_t FUSE_ENOENT = -2;
 constexpr int32_t FUSE_EIO = -5;
@@ -109,8 +125,19 @@ constexpr uint32_t FUSE_NO_OPEN_SUPPORT  = 1 << 17;
 constexpr uint32_t FUSE_PARALLEL_DIROPS  = 1 << 18;
 constexpr uint32_t FUSE_HANDLE_KILLPRIV  = 1 << 19;
 constexpr uint32_t FUSE_POSIX_ACL        = 1 << 20;
+constexpr uint32_t FUSE_MAP_ALIGNMENT    = 1 << 26;
 constexpr uint32_t FUSE_READDIRPLUS_AUTO = 1 << 29;
 
+// FUSE open flags
+constexpr uint32_t FOPEN_DIRECT_IO       = 1 << 0;
+
+// FUSE_SETUPMAPPING flags
+constexpr uint64_t FUSE_SETUPMAPPING_FLAG_WRITE = 1 << 0;
+constexpr uint64_t FUSE_SETUPMAPPING_FLAG_READ  = 1 << 1;
+
+// Shared memory region id of the DAX cache window
+constexpr uint32_t VIRTIO_FS_SHMCAP_ID_CACHE = 0;
+
 // FUSE setattr valid bits
 constexpr uint32_t FATTR_MODE  = 1 << 0;
 constexpr uint32_t FATTR_UID   = 1 << 1;
@@ -275,6 +302,35 @@ struct FuseCreateIn {
     uint32_t padding;
 };
 
+struct FuseSetupMappingIn {
+    uint64_t fh;
+    uint64_t foffset;
+    uint64_t len;
+    uint64_t flags;
+    uint64_t moffset;
+};
+
+struct FuseRemoveMappingIn {
+    uint32_t count;
+};
+
+struct FuseRemoveMappingOne {
+    uint64_t moffset;
+    uint64_t len;
+};
+
+struct FuseNotifyInvalInodeOut {
+    uint64_t ino;
+    int64_t off;   // negative: attributes only
+    int64_t len;   // 0 or negative: to end of file
+};
+
+struct FuseNotifyInvalEntryOut {
+    uint64_t parent;
+    uint32_t namelen;
+    uint32_t flags;
+};
+
 struct FuseStatfsOut {
     uint64_t blocks;
     uint64_t bfree;
@@ -320,6 +376,7 @@ struct FuseForgetIn {
 struct VirtioFsConfig {
     char tag[36];
     uint32_t num_request_queues;
+    uint32_t notify_buf_size;  // with VIRTIO_FS_F_NOTIFICATION
 };
 
 #pragma pack(pop)
@@ -329,24 +386,52 @@ struct ShareInfo {
     std::string tag;
     std::string host_path;
     bool readonly;
+    bool writeback = false;  // FUSE_WRITEBACK_CACHE and write coalescing
     uint64_t root_inode;  // inode of the share's root directory
 };
 
-// Inode info cached on the host
-struct InodeInfo {
-    uint64_t inode;
-    std::string host_path;
-    uint64_t nlookup;
-    bool is_dir;
-    std::string share_tag;  // which share this inode belongs to (empty for virtual root)
+// Directory entry as listed by the host, attributes included.
+struct HostDirEntry {
+    std::string name;
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    uint64_t file_id;
 };
 
-// Open file handle
+// Open file handle. Shared with the requests using it, so a RELEASE
+// racing a READ closes the Windows handle only after the read is done.
 struct FileHandle {
-    HANDLE handle;
-    bool is_dir;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    DWORD access = 0;  // files: what `handle` was opened for
+    bool is_dir = false;
     std::string path;
     std::string share_tag;
+
+    // Directories: what has been listed so far, read in batches as the
+    // guest reads on. READDIR offset N resumes at dir_entries[N]; offset 0
+    // lists the directory afresh.
+    std::mutex dir_mutex;
+    std::vector<HostDirEntry> dir_entries;
+    bool dir_eof = false;
+    uint64_t dir_volume = 0;
+
+    // Files on writeback shares: contiguous WRITE data not yet on the
+    // host, starting at `pending_offset`. The first error writing it out
+    // goes to the next FLUSH or FSYNC.
+    bool writeback = false;
+    std::mutex write_mutex;
+    std::vector<uint8_t> pending;
+    uint64_t pending_offset = 0;
+    DWORD write_error = ERROR_SUCCESS;
+    std::atomic<uint32_t>* pending_count = nullptr;  // handles with pending data
+
+    FileHandle() = default;
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+    // Writes out anything still pending before closing.
+    ~FileHandle();
+
+    // Writes out `pending`. Caller holds write_mutex.
+    void WritePendingLocked();
 };
 
 class VirtioFsDevice : public VirtioDeviceOps {
@@ -358,8 +443,28 @@ public:
 
     void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
 
+    // Runs FUSE requests on a pool of worker threads, several at a time,
+    // so one slow host call holds up only its own request. Without it
+    // requests run inline. Stop before the device goes away.
+    bool StartWorkers(uint32_t count = kDefaultWorkers);
+    void StopWorkers();
+
+    // Offers a DAX cache window of `size` bytes at guest physical `base`.
+    // `map`/`unmap` place host file views into the guest; the window
+    // device covers the parts that have none.
+    void EnableDax(GPA base, uint64_t size, VirtioFsDaxWindow::MapCallback map,
+                   VirtioFsDaxWindow::UnmapCallback unmap);
+    VirtioFsDaxWindow* dax_window() const { return dax_.get(); }
+
+    // Per-opcode counts and latencies of the requests handled so far.
+    VirtioFsOpStats& op_stats() { return op_stats_; }
+    void LogOpStats() const;
+
     // Dynamic share management - can be called at runtime
-    bool AddShare(const std::string& tag, const std::string& host_path, bool readonly = false);
+    // `writeback` trades coherency with the host for write throughput:
+    // the guest caches writes, and small ones are coalesced here.
+    bool AddShare(const std::string& tag, const std::string& host_path, bool readonly = false,
+                  bool writeback = false);
     bool RemoveShare(const std::string& tag);
     std::vector<std::string> GetShareTags() const;
     bool HasShare(const std::string& tag) const;
@@ -367,18 +472,59 @@ public:
     // VirtioDeviceOps interface
     uint32_t GetDeviceId() const override { return VIRTIO_ID_FS; }
     uint64_t GetDeviceFeatures() const override;
-    uint32_t GetNumQueues() const override { return 2; }
+    // hiprio, notification (only once VIRTIO_FS_F_NOTIFICATION is
+    // negotiated; otherwise the first request queue), request queues
+    uint32_t GetNumQueues() const override { return 2 + kNumRequestQueues; }
     uint32_t GetQueueMaxSize(uint32_t queue_idx) const override { return 128; }
     void OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) override;
     void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
     void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
     void OnStatusChange(uint32_t new_status) override;
+    bool GetShmRegion(uint32_t id, uint64_t* base, uint64_t* size) const override;
+    // The inode table, open handles and DAX mappings. Handles and mappings
+    // are reopened by host path on load; shares keep the inodes they had
+    // if they are still configured. Change notifications are held from
+    // SaveState until ResumeAfterSave.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+    void ResumeAfterSave() override;
 
     // State query
     uint32_t GetOpenHandleCount() const;
 
+    static constexpr uint32_t kNumRequestQueues = 4;
+    static constexpr uint32_t kDefaultWorkers = 4;
+    static constexpr uint32_t kNotifyQueue = 1;
+    // Attribute and entry TTL given to guests that take change
+    // notifications; others get 1 second.
+    static constexpr uint64_t kNotifiedTtl = 60;
+    static constexpr size_t kAttrCacheMax = 64 * 1024;
+    static constexpr size_t kDirBatchSize = 64 * 1024;
+    static constexpr size_t kHandleCacheMax = 64;
+    static constexpr uint64_t kHandleCacheTtlMs = 5000;
+    static constexpr size_t kWriteCoalesceMax = 1024 * 1024;
+
 private:
+    struct PendingRequest {
+        VirtQueue* vq;
+        uint16_t head;
+    };
+
+    // One entry of a READDIR(PLUS) reply.
+    struct DirEntry {
+        std::string name;
+        bool is_dir;
+        uint64_t inode;
+        uint64_t off;
+        WIN32_FILE_ATTRIBUTE_DATA attr;  // not set for the virtual root
+    };
+
     void ProcessRequest(VirtQueue& vq, uint16_t head_idx);
+    void WorkerThread();
+    // Drops queued requests and waits for the running ones.
+    void DrainWorkers();
+    // Waits until queued and running requests are all done.
+    void WaitWorkersIdle();
     
     // FUSE request handlers
     void HandleInit(const FuseInHeader* in_hdr, const uint8_t* in_data,
@@ -392,9 +538,14 @@ private:
                        std::vector<uint8_t>& out_buf);
     void HandleOpen(const FuseInHeader* in_hdr, const uint8_t* in_data,
                     std::vector<uint8_t>& out_buf);
+    // READ fills `out_data` (the writable buffers past the reply header)
+    // straight from the file and reports how much of it it used; WRITE
+    // writes `in_data_spans` (the payload left in guest memory) as is.
     void HandleRead(const FuseInHeader* in_hdr, const uint8_t* in_data,
-                    std::vector<uint8_t>& out_buf);
+                    const std::vector<VirtqChainElem>& out_data,
+                    std::vector<uint8_t>& out_buf, uint32_t* data_len);
     void HandleWrite(const FuseInHeader* in_hdr, const uint8_t* in_data, uint32_t in_len,
+                     const std::vector<VirtqChainElem>& in_data_spans,
                      std::vector<uint8_t>& out_buf);
     void HandleRelease(const FuseInHeader* in_hdr, const uint8_t* in_data);
     void HandleOpenDir(const FuseInHeader* in_hdr, const uint8_t* in_data,
@@ -415,42 +566,161 @@ private:
                      std::vector<uint8_t>& out_buf);
     void HandleRename(const FuseInHeader* in_hdr, const uint8_t* in_data, uint32_t in_len,
                       std::vector<uint8_t>& out_buf);
-    void HandleFlush(const FuseInHeader* in_hdr, const uint8_t* in_data);
-    void HandleFsync(const FuseInHeader* in_hdr, const uint8_t* in_data);
+    int32_t HandleFlush(const FuseInHeader* in_hdr, const uint8_t* in_data);
+    int32_t HandleFsync(const FuseInHeader* in_hdr, const uint8_t* in_data);
+    void HandleSetupMapping(const FuseInHeader* in_hdr, const uint8_t* in_data, uint32_t in_len,
+                            std::vector<uint8_t>& out_buf);
+    void HandleRemoveMapping(const FuseInHeader* in_hdr, const uint8_t* in_data, uint32_t in_len,
+                             std::vector<uint8_t>& out_buf);
 
     // Helper functions
     void WriteErrorResponse(std::vector<uint8_t>& out_buf, uint64_t unique, int32_t error);
     int32_t FillAttr(const std::string& path, FuseAttr* attr, uint64_t inode, bool share_readonly = false);
+    static int32_t FillAttrFrom(const WIN32_FILE_ATTRIBUTE_DATA& fad, FuseAttr* attr,
+                                uint64_t inode, bool share_readonly);
+    // GetFileAttributesExW through the host attribute cache. Returns the
+    // Windows error, ERROR_SUCCESS when `fad` was filled.
+    DWORD QueryAttributes(const std::string& path, WIN32_FILE_ATTRIBUTE_DATA* fad);
+    // Drops cached attributes of `path` and its parent, and of everything
+    // below it when `subtree`.
+    void InvalidateAttr(const std::string& path, bool subtree = false);
+    void InvalidateAttrKey(const std::wstring& key, bool subtree);
+    // Caller holds attr_mutex_.
+    bool IsWatchedLocked(const std::wstring& key) const;
+    uint64_t AttrTtl() const;
+
+    void StartWatcher(const std::string& tag, const std::string& host_path);
+    void StopWatcher(const std::string& tag);
+    // Stops caching below `host_path` and drops what was cached there.
+    void UnwatchRoot(const std::string& host_path);
+    void OnHostChange(const std::string& share_tag, const std::string& host_path,
+                      DWORD action, const std::wstring& name);
+    // Sends a FUSE notification on the notification queue, when the
+    // driver took one and left a buffer there.
+    void SendNotification(int32_t code, const void* payload, size_t len);
+    // Caller holds inode_mutex_.
     int32_t FillVirtualRootAttr(FuseAttr* attr);
     int32_t FillShareRootAttr(const ShareInfo& share, FuseAttr* attr);
     int32_t WindowsErrorToFuse(DWORD error);
-    uint64_t AllocInode();
-    InodeInfo* GetInode(uint64_t inode);
-    uint64_t GetOrCreateInode(const std::string& path, bool is_dir, const std::string& share_tag);
-    void RemoveInode(uint64_t inode);
-    uint64_t AllocFileHandle(HANDLE h, bool is_dir, const std::string& path, const std::string& share_tag);
-    FileHandle* GetFileHandle(uint64_t fh);
+    // Host path and share of `nodeid`. False for the virtual root and for
+    // unknown or unlinked inodes. Caller holds inode_mutex_.
+    bool ResolveLocked(uint64_t nodeid, std::string* path, std::string* share_tag) const;
+    // Counts a lookup of `name` in `parent`, whose host path is `path`.
+    // `h`, if given, is an open handle to it. Returns 0 if `parent` is gone.
+    uint64_t LookupInode(uint64_t parent, const std::string& name, const std::string& path,
+                         bool is_dir, HANDLE h = INVALID_HANDLE_VALUE);
+    static HostFileId QueryFileId(HANDLE h);
+    HostFileId QueryFileId(const std::string& path);
+    uint64_t AllocFileHandle(HANDLE h, bool is_dir, const std::string& path,
+                             const std::string& share_tag, DWORD access = 0);
+    std::shared_ptr<FileHandle> GetFileHandle(uint64_t fh);
     void CloseFileHandle(uint64_t fh);
+    // A recently closed handle to `path` (inode `nodeid`) opened for
+    // `access`, if the file is still the same and unchanged since.
+    HANDLE TakeCachedHandle(const std::string& path, DWORD access, uint64_t nodeid);
+    // Takes over `fh`'s Windows handle for a later open.
+    void CacheClosedHandle(FileHandle& fh);
+    // Closes cached handles to `path`, and below it when `subtree`; all
+    // of them for an empty path. Windows keeps a deleted file's name
+    // until its last handle closes.
+    void EvictCachedHandles(const std::string& path, bool subtree = false);
+    // Lists the directory of `fh` (inode `nodeid`) from entry `offset` on,
+    // as many entries of `entry_header` plus name bytes as fit in `size`.
+    // With `plus` each entry counts as a lookup, as READDIRPLUS does.
+    int32_t ListDirectory(FileHandle& fh, uint64_t nodeid, uint64_t offset, uint32_t size,
+                          size_t entry_header, bool plus, std::vector<DirEntry>* entries);
+    // Appends the next batch of `fh`'s entries. Caller holds fh.dir_mutex.
+    int32_t ReadDirBatch(FileHandle& fh);
     std::string NodeIdToPath(uint64_t nodeid);
     std::string NodeIdToShareTag(uint64_t nodeid);
     bool IsShareReadonly(const std::string& share_tag);
+    bool IsShareWriteback(const std::string& share_tag);
+    // open_flags of a file opened on `share_tag`: with writeback caching
+    // granted to the mount, files of the other shares bypass the guest's
+    // page cache.
+    uint32_t OpenFlagsFor(const std::string& share_tag);
+    // Wide and case-folded forms of a host path, cached.
+    std::shared_ptr<const HostPath> HostPathOf(const std::string& path) {
+        return path_cache_.Resolve(path);
+    }
+    // Writes out coalesced data of every handle to `path`, or of all
+    // handles for an empty path, before anything looks at the file.
+    void FlushPendingWrites(const std::string& path);
 
     VirtioMmioDevice* mmio_ = nullptr;
     std::string mount_tag_;  // virtiofs mount tag (e.g., "shared")
     VirtioFsConfig config_{};
-    bool initialized_ = false;
+    std::atomic<bool> initialized_{false};
+    std::atomic<bool> writeback_cache_{false};  // FUSE_WRITEBACK_CACHE granted at INIT
 
-    mutable std::mutex mutex_;
-    uint64_t next_inode_ = 2;  // inode 1 is reserved for virtual root
+    // Shares and inodes. Host file system calls are made without it, so
+    // lookups only contend with each other for map updates. Taken before
+    // handle_mutex_ when both are needed.
+    mutable std::shared_mutex inode_mutex_;
     uint64_t shares_version_ = 0;  // bumped on AddShare/RemoveShare
     uint64_t virtual_root_mtime_ = 0;  // updated on share changes for cache invalidation
-    uint64_t next_fh_ = 1;
     
     // Shares: tag -> ShareInfo
     std::unordered_map<std::string, ShareInfo> shares_;
     
-    // Inode management
-    std::unordered_map<uint64_t, InodeInfo> inodes_;
-    std::unordered_map<std::string, uint64_t> path_to_inode_;
-    std::unordered_map<uint64_t, FileHandle> file_handles_;
+    // Inode 1 is the virtual root
+    VirtioFsInodeTable inodes_;
+
+    mutable std::mutex handle_mutex_;
+    uint64_t next_fh_ = 1;
+    std::unordered_map<uint64_t, std::shared_ptr<FileHandle>> file_handles_;
+
+    // Requests popped by the notifying thread, waiting for a worker.
+    std::vector<std::thread> workers_;
+    std::mutex work_mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<PendingRequest> work_;
+    uint32_t busy_workers_ = 0;
+    bool workers_stop_ = false;
+    // Workers finish out of order; used ring updates and the interrupt
+    // check go one at a time.
+    std::mutex used_mutex_;
+
+    std::unique_ptr<VirtioFsDaxWindow> dax_;
+    VirtioFsOpStats op_stats_;
+    VirtioFsPathCache path_cache_;
+
+    // Handles with coalesced data; lets FlushPendingWrites skip the scan.
+    std::atomic<uint32_t> pending_handles_{0};
+
+    // Guarded by used_mutex_; the notification queue is only touched
+    // between DRIVER_OK and reset.
+    std::atomic<bool> notify_enabled_{false};
+    bool notify_held_ = false;  // notify_enabled_ as of SaveState
+
+    // Host attributes (and misses) by lower-cased path. Only shares with
+    // a running watcher are cached, and the watcher invalidates them.
+    struct CachedAttr {
+        DWORD error;
+        WIN32_FILE_ATTRIBUTE_DATA data;
+    };
+    std::mutex attr_mutex_;
+    std::unordered_map<std::wstring, CachedAttr> attr_cache_;
+    std::vector<std::wstring> watched_roots_;  // lower-cased, with trailing '\\'
+    uint64_t attr_generation_ = 0;  // bumped on every invalidation
+
+    // Handles of files the guest closed, oldest first. The guest's
+    // toolchains open the same files over and over, and every Windows
+    // open goes through the filter drivers.
+    struct CachedHandle {
+        std::wstring key;  // AttrCacheKey of the path
+        DWORD access;
+        HANDLE handle;
+        HostFileId file_id;
+        FILETIME last_write;
+        uint64_t closed_at;  // GetTickCount64
+    };
+    std::mutex handle_cache_mutex_;
+    std::vector<CachedHandle> handle_cache_;
+
+    // One watcher per share; taken without inode_mutex_ held, since the
+    // callbacks take it.
+    std::mutex watch_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<DirectoryWatcher>> watchers_;
 };
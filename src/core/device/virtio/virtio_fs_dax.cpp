@@ -0,0 +1,163 @@
+#include "core/device/virtio/virtio_fs_dax.h"
+#include "core/device/virtio/virtio_fs.h"
+#include <algorithm>
+
+VirtioFsDaxWindow::VirtioFsDaxWindow(GPA base, uint64_t size, MapCallback map,
+                                     UnmapCallback unmap)
+    : base_(base), size_(size), map_(std::move(map)), unmap_(std::move(unmap)) {
+    LOG_INFO("VirtIO FS: DAX window %llu MB at 0x%llX", size_ / (1024 * 1024), base_);
+}
+
+VirtioFsDaxWindow::~VirtioFsDaxWindow() {
+    RemoveAll();
+}
+
+int32_t VirtioFsDaxWindow::Setup(HANDLE file, const std::string& path, uint64_t foffset,
+                                 uint64_t len, uint64_t moffset, bool writable) {
+    if (len == 0 || moffset >= size_ || len > size_ - moffset ||
+        (moffset | foffset) & (kMapAlignment - 1)) {
+        CloseHandle(file);
+        return FUSE_EINVAL;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    RemoveLocked(moffset, len);
+
+    Mapping m;
+    m.moffset = moffset;
+    m.len = len;
+    m.foffset = foffset;
+    m.writable = writable;
+    m.path = path;
+    m.file = file;
+
+    // Only the part of the range inside the file gets a view; a section
+    // can't extend a read-only file, and the rest is served by exits.
+    LARGE_INTEGER file_size{};
+    GetFileSizeEx(file, &file_size);
+    uint64_t in_file = static_cast<uint64_t>(file_size.QuadPart) > foffset
+                           ? std::min(len, static_cast<uint64_t>(file_size.QuadPart) - foffset)
+                           : 0;
+    if (in_file > 0) {
+        m.section = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                       0, 0, nullptr);
+        if (m.section) {
+            m.view = MapViewOfFile(m.section, FILE_MAP_READ | (writable ? FILE_MAP_WRITE : 0),
+                                   static_cast<DWORD>(foffset >> 32),
+                                   static_cast<DWORD>(foffset), static_cast<SIZE_T>(in_file));
+        }
+        if (m.view) {
+            m.view_len = AlignUp(in_file, kPageSize);
+            if (!map_(base_ + moffset, m.view, m.view_len, writable)) {
+                m.view_len = 0;
+            }
+        }
+        if (!m.view_len) {
+            LOG_WARN("VirtIO FS: DAX view of '%s' at 0x%llX failed (%lu), using file I/O",
+                     path.c_str(), foffset, GetLastError());
+            ReleaseView(m);
+        }
+    }
+
+    mappings_[moffset] = m;
+    return FUSE_OK;
+}
+
+std::vector<VirtioFsDaxWindow::MappingInfo> VirtioFsDaxWindow::GetMappings() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<MappingInfo> out;
+    out.reserve(mappings_.size());
+    for (const auto& [moffset, m] : mappings_) {
+        out.push_back({m.moffset, m.len, m.foffset, m.writable, m.path});
+    }
+    return out;
+}
+
+int32_t VirtioFsDaxWindow::Remove(uint64_t moffset, uint64_t len) {
+    if (moffset >= size_ || len > size_ - moffset) return FUSE_EINVAL;
+    std::lock_guard<std::mutex> lock(mutex_);
+    RemoveLocked(moffset, len);
+    return FUSE_OK;
+}
+
+void VirtioFsDaxWindow::RemoveAll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& [moffset, m] : mappings_) {
+        Release(m);
+    }
+    mappings_.clear();
+}
+
+bool VirtioFsDaxWindow::DropViews(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool dropped = false;
+    for (auto& [moffset, m] : mappings_) {
+        if (m.path == path && m.section) {
+            ReleaseView(m);
+            dropped = true;
+        }
+    }
+    return dropped;
+}
+
+void VirtioFsDaxWindow::RemoveLocked(uint64_t moffset, uint64_t len) {
+    auto it = mappings_.upper_bound(moffset);
+    if (it != mappings_.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second.moffset + prev->second.len > moffset) it = prev;
+    }
+    while (it != mappings_.end() && it->second.moffset < moffset + len) {
+        Release(it->second);
+        it = mappings_.erase(it);
+    }
+}
+
+void VirtioFsDaxWindow::ReleaseView(Mapping& m) {
+    if (m.view_len) unmap_(base_ + m.moffset, m.view_len);
+    if (m.view) UnmapViewOfFile(m.view);
+    if (m.section) CloseHandle(m.section);
+    m.view_len = 0;
+    m.view = nullptr;
+    m.section = nullptr;
+}
+
+void VirtioFsDaxWindow::Release(Mapping& m) {
+    ReleaseView(m);
+    if (m.file) CloseHandle(m.file);
+    m.file = nullptr;
+}
+
+VirtioFsDaxWindow::Mapping* VirtioFsDaxWindow::Find(uint64_t offset) {
+    auto it = mappings_.upper_bound(offset);
+    if (it == mappings_.begin()) return nullptr;
+    Mapping& m = std::prev(it)->second;
+    return offset - m.moffset < m.len ? &m : nullptr;
+}
+
+void VirtioFsDaxWindow::MmioRead(uint64_t offset, uint8_t size, uint64_t* value) {
+    *value = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Mapping* m = Find(offset);
+    if (!m) return;
+
+    uint64_t pos = m->foffset + (offset - m->moffset);
+    OVERLAPPED ov = {};
+    ov.Offset = static_cast<DWORD>(pos);
+    ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+    DWORD got = 0;
+    // Past end of file reads as zeros.
+    ReadFile(m->file, value, size, &got, &ov);
+}
+
+void VirtioFsDaxWindow::MmioWrite(uint64_t offset, uint8_t size, uint64_t value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Mapping* m = Find(offset);
+    if (!m || !m->writable) return;
+
+    uint64_t pos = m->foffset + (offset - m->moffset);
+    OVERLAPPED ov = {};
+    ov.Offset = static_cast<DWORD>(pos);
+    ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+    DWORD put = 0;
+    WriteFile(m->file, &value, size, &put, &ov);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "core/device/device.h"
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define NOMINMAX
+#include <windows.h>
+
+// The virtio-fs DAX cache window: a guest physical range into which the
+// driver asks (FUSE_SETUPMAPPING) for file ranges to be mapped. Each range
+// becomes a view of the host file mapped straight into the partition, so
+// guest loads and stores hit the host page cache without exits or copies.
+//
+// Parts of the window with no view behind them (past end of file, or a
+// view that had to be dropped) still exit to MmioRead/MmioWrite, which
+// serve them with plain file I/O.
+class VirtioFsDaxWindow : public Device {
+public:
+    using MapCallback = std::function<bool(GPA gpa, void* hva, uint64_t size, bool writable)>;
+    using UnmapCallback = std::function<void(GPA gpa, uint64_t size)>;
+
+    // MapViewOfFile offsets are multiples of the allocation granularity.
+    static constexpr uint32_t kMapAlignmentShift = 16;
+    static constexpr uint64_t kMapAlignment = 1ULL << kMapAlignmentShift;
+
+    VirtioFsDaxWindow(GPA base, uint64_t size, MapCallback map, UnmapCallback unmap);
+    ~VirtioFsDaxWindow() override;
+
+    VirtioFsDaxWindow(const VirtioFsDaxWindow&) = delete;
+    VirtioFsDaxWindow& operator=(const VirtioFsDaxWindow&) = delete;
+
+    GPA base() const { return base_; }
+    uint64_t size() const { return size_; }
+
+    // Maps [foffset, foffset + len) of `file` at window offset `moffset`,
+    // replacing any mapping it overlaps. Takes ownership of `file`, which
+    // must allow reading (and writing when `writable`). Returns a FUSE
+    // error code.
+    int32_t Setup(HANDLE file, const std::string& path, uint64_t foffset,
+                  uint64_t len, uint64_t moffset, bool writable);
+    // Drops every mapping overlapping [moffset, moffset + len).
+    int32_t Remove(uint64_t moffset, uint64_t len);
+    void RemoveAll();
+    // Unmaps the views of `path` but keeps its mappings, which fall back to
+    // file I/O. Windows refuses to truncate a file while a view is open.
+    bool DropViews(const std::string& path);
+
+    // What the guest has set up, for snapshots; Setup() recreates each.
+    struct MappingInfo {
+        uint64_t moffset;
+        uint64_t len;
+        uint64_t foffset;
+        bool writable;
+        std::string path;
+    };
+    std::vector<MappingInfo> GetMappings();
+
+    void MmioRead(uint64_t offset, uint8_t size, uint64_t* value) override;
+    void MmioWrite(uint64_t offset, uint8_t size, uint64_t value) override;
+    // Exits only reach here for unmapped parts; mutex_ covers them.
+    std::mutex* IoLock() override { return nullptr; }
+
+private:
+    struct Mapping {
+        uint64_t moffset = 0;
+        uint64_t len = 0;
+        uint64_t foffset = 0;
+        bool writable = false;
+        std::string path;
+        HANDLE file = nullptr;
+        HANDLE section = nullptr;
+        void* view = nullptr;
+        uint64_t view_len = 0;  // bytes mapped into the guest, page aligned
+    };
+
+    void RemoveLocked(uint64_t moffset, uint64_t len);
+    void ReleaseView(Mapping& m);
+    void Release(Mapping& m);
+    // Mapping covering window offset `offset`, or nullptr.
+    Mapping* Find(uint64_t offset);
+
+    GPA base_;
+    uint64_t size_;
+    MapCallback map_;
+    UnmapCallback unmap_;
+
+    std::mutex mutex_;
+    std::map<uint64_t, Mapping> mappings_;  // keyed by moffset
+};
@@ -0,0 +1,367 @@
+#include "core/device/virtio/virtio_fs_inodes.h"
+#include <algorithm>
+#include <cstring>
+
+// Derived inode numbers keep the top bit clear; anonymous ones set it.
+static constexpr uint64_t kAnonInodeBit = 1ULL << 63;
+
+// ASCII only; enough to tell a case variant from a real rename.
+static bool SameNameIgnoringCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? char(c + 32) : c; };
+               return lower(x) == lower(y);
+           });
+}
+
+std::string_view NameArena::Store(std::string_view name) {
+    if (name.empty()) return {};
+    if (name.size() > kBlockSize) {
+        // Gets a block of its own, kept behind the one being filled.
+        auto block = std::make_unique<char[]>(name.size());
+        memcpy(block.get(), name.data(), name.size());
+        std::string_view stored(block.get(), name.size());
+        blocks_.insert(blocks_.empty() ? blocks_.end() : blocks_.end() - 1, std::move(block));
+        total_bytes_ += name.size();
+        live_bytes_ += name.size();
+        return stored;
+    }
+    if (name.size() > kBlockSize - block_used_) {
+        blocks_.push_back(std::make_unique<char[]>(kBlockSize));
+        block_used_ = 0;
+        total_bytes_ += kBlockSize;
+    }
+    char* dst = blocks_.back().get() + block_used_;
+    memcpy(dst, name.data(), name.size());
+    block_used_ += name.size();
+    live_bytes_ += name.size();
+    return std::string_view(dst, name.size());
+}
+
+bool NameArena::ShouldCompact() const {
+    return total_bytes_ > 16 * kBlockSize && live_bytes_ < total_bytes_ / 4;
+}
+
+void NameArena::Clear() {
+    blocks_.clear();
+    block_used_ = kBlockSize;
+    live_bytes_ = 0;
+    total_bytes_ = 0;
+}
+
+VirtioFsInodeTable::VirtioFsInodeTable() {
+    Node root;
+    root.is_dir = true;
+    root.pinned = true;
+    root.nlookup = 1;
+    nodes_[kRootInode] = root;
+}
+
+uint64_t VirtioFsInodeTable::InodeForId(const HostFileId& id) {
+    // splitmix64 over the three words.
+    uint64_t x = id.volume;
+    for (uint64_t word : {id.id_low, id.id_high}) {
+        x ^= word + 0x9E3779B97F4A7C15ULL + (x << 6) + (x >> 2);
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+    }
+    return x & ~kAnonInodeBit;
+}
+
+uint64_t VirtioFsInodeTable::NewInode(const HostFileId& id) {
+    if (id.valid()) {
+        uint64_t inode = InodeForId(id);
+        if (inode > kRootInode && !nodes_.count(inode)) return inode;
+    }
+    return kAnonInodeBit | next_anon_inode_++;
+}
+
+uint64_t VirtioFsInodeTable::AddShareRoot(const std::string& tag) {
+    if (Find(kRootInode, tag)) return 0;
+    uint64_t inode = NewInode({});
+    Node& node = nodes_[inode];
+    node.is_dir = true;
+    node.pinned = true;
+    node.nlookup = 1;
+    Attach(inode, kRootInode, tag);
+    return inode;
+}
+
+void VirtioFsInodeTable::RemoveShare(const std::string& tag) {
+    uint64_t share_root = Find(kRootInode, tag);
+    if (!share_root) return;
+
+    std::vector<uint64_t> doomed;
+    for (const auto& [inode, node] : nodes_) {
+        uint64_t top = inode;
+        while (top && nodes_.at(top).parent != kRootInode) top = nodes_.at(top).parent;
+        if (top == share_root) doomed.push_back(inode);
+    }
+    // Leaves first does not matter: nothing is left to cascade to.
+    for (uint64_t inode : doomed) {
+        Node& node = nodes_.at(inode);
+        if (node.parent) children_.erase({node.parent, node.name});
+        if (node.file_id.valid()) {
+            auto it = by_file_id_.find(node.file_id);
+            if (it != by_file_id_.end() && it->second == inode) by_file_id_.erase(it);
+        }
+        names_.Release(node.name);
+        if (inode == share_root) nodes_.at(kRootInode).children--;
+    }
+    for (uint64_t inode : doomed) nodes_.erase(inode);
+}
+
+uint64_t VirtioFsInodeTable::Find(uint64_t parent, std::string_view name) const {
+    auto it = children_.find({parent, name});
+    return it != children_.end() ? it->second : 0;
+}
+
+uint64_t VirtioFsInodeTable::FindPath(uint64_t from, std::string_view rel) const {
+    uint64_t inode = from;
+    while (inode && !rel.empty()) {
+        size_t sep = rel.find('\\');
+        inode = Find(inode, rel.substr(0, sep));
+        rel = sep == std::string_view::npos ? std::string_view() : rel.substr(sep + 1);
+    }
+    return inode;
+}
+
+HostFileId VirtioFsInodeTable::FileIdOf(uint64_t inode) const {
+    auto it = nodes_.find(inode);
+    return it != nodes_.end() ? it->second.file_id : HostFileId{};
+}
+
+bool VirtioFsInodeTable::HasFileId(uint64_t parent, std::string_view name) const {
+    uint64_t inode = Find(parent, name);
+    return inode && nodes_.at(inode).file_id.valid();
+}
+
+uint64_t VirtioFsInodeTable::Lookup(uint64_t parent, std::string_view name,
+                                    const HostFileId& id, bool is_dir, bool count) {
+    auto parent_it = nodes_.find(parent);
+    if (parent_it == nodes_.end()) return 0;
+    // Keeps `parent` alive while nodes move off it below.
+    parent_it->second.nlookup++;
+
+    uint64_t inode = Find(parent, name);
+    if (inode) {
+        Node& node = nodes_.at(inode);
+        if (id.valid() && node.file_id.valid() && !(node.file_id == id)) {
+            // Replaced on the host; the old node stays for its references.
+            Detach(inode);
+            MaybeErase(inode);
+            inode = 0;
+        } else if (id.valid() && !node.file_id.valid() && !by_file_id_.count(id)) {
+            node.file_id = id;
+            by_file_id_[id] = inode;
+        }
+    }
+
+    if (!inode && id.valid()) {
+        auto it = by_file_id_.find(id);
+        if (it != by_file_id_.end() && !nodes_.at(it->second).pinned) {
+            inode = it->second;
+            const Node& found = nodes_.at(inode);
+            if (found.parent == parent && SameNameIgnoringCase(found.name, name)) {
+                // The host folds case, so this is the same entry under
+                // another spelling. The first spelling keeps the node,
+                // rather than the node flipping between them.
+            } else {
+                // Renamed on the host, or another link to it.
+                Detach(inode);
+                Attach(inode, parent, name);
+            }
+        }
+    }
+
+    if (!inode) {
+        inode = NewInode(id);
+        Node& node = nodes_[inode];
+        node.file_id = id;
+        if (id.valid() && !by_file_id_.count(id)) by_file_id_[id] = inode;
+        Attach(inode, parent, name);
+    }
+
+    Node& node = nodes_.at(inode);
+    node.is_dir = is_dir;
+    if (count) node.nlookup++;
+    nodes_.at(parent).nlookup--;
+    return inode;
+}
+
+void VirtioFsInodeTable::Forget(uint64_t inode, uint64_t nlookup) {
+    auto it = nodes_.find(inode);
+    if (it == nodes_.end() || it->second.pinned) return;
+    it->second.nlookup -= std::min(it->second.nlookup, nlookup);
+    MaybeErase(inode);
+}
+
+void VirtioFsInodeTable::Unlink(uint64_t parent, std::string_view name) {
+    uint64_t inode = Find(parent, name);
+    if (!inode || nodes_.at(inode).pinned) return;
+    Detach(inode);
+    MaybeErase(inode);
+}
+
+void VirtioFsInodeTable::Rename(uint64_t old_parent, std::string_view old_name,
+                                uint64_t new_parent, std::string_view new_name) {
+    uint64_t inode = Find(old_parent, old_name);
+    if (!inode || nodes_.at(inode).pinned || !nodes_.count(new_parent)) return;
+    uint64_t replaced = Find(new_parent, new_name);
+    if (replaced == inode) return;
+
+    // Neither parent may go away halfway through the move.
+    nodes_.at(old_parent).nlookup++;
+    nodes_.at(new_parent).nlookup++;
+    if (replaced) Unlink(new_parent, new_name);
+    Detach(inode);
+    Attach(inode, new_parent, new_name);
+    nodes_.at(new_parent).nlookup--;
+    nodes_.at(old_parent).nlookup--;
+    MaybeErase(old_parent);
+}
+
+bool VirtioFsInodeTable::GetPath(uint64_t inode, std::string* share_tag,
+                                 std::string* rel) const {
+    std::vector<std::string_view> parts;
+    while (inode != kRootInode) {
+        auto it = nodes_.find(inode);
+        if (it == nodes_.end() || !it->second.parent) return false;
+        parts.push_back(it->second.name);
+        inode = it->second.parent;
+    }
+    if (parts.empty()) return false;
+
+    share_tag->assign(parts.back());
+    rel->clear();
+    for (size_t i = parts.size() - 1; i-- > 0;) {
+        if (!rel->empty()) rel->push_back('\\');
+        rel->append(parts[i]);
+    }
+    return true;
+}
+
+void VirtioFsInodeTable::SaveState(StateWriter& out) const {
+    out.Put(next_anon_inode_);
+    out.Put(static_cast<uint64_t>(nodes_.size()));
+    for (const auto& [inode, node] : nodes_) {
+        out.Put(inode);
+        out.Put(node.parent);
+        out.PutString(node.name);
+        out.Put(node.nlookup);
+        out.Put(node.file_id);
+        out.Put(node.is_dir);
+        out.Put(node.pinned);
+    }
+    out.Put(static_cast<uint64_t>(by_file_id_.size()));
+    for (const auto& [id, inode] : by_file_id_) {
+        out.Put(id);
+        out.Put(inode);
+    }
+}
+
+bool VirtioFsInodeTable::LoadState(StateReader& in) {
+    nodes_.clear();
+    children_.clear();
+    by_file_id_.clear();
+    names_.Clear();
+
+    uint64_t count = 0;
+    in.Get(&next_anon_inode_);
+    in.Get(&count);
+    // Names are attached once every parent exists.
+    std::vector<std::pair<uint64_t, std::string>> names;
+    for (uint64_t i = 0; i < count && in.ok(); i++) {
+        uint64_t inode = 0;
+        Node node;
+        std::string name;
+        in.Get(&inode);
+        in.Get(&node.parent);
+        in.GetString(&name);
+        in.Get(&node.nlookup);
+        in.Get(&node.file_id);
+        in.Get(&node.is_dir);
+        in.Get(&node.pinned);
+        if (node.parent) names.emplace_back(inode, std::move(name));
+        nodes_[inode] = node;
+    }
+    in.Get(&count);
+    for (uint64_t i = 0; i < count && in.ok(); i++) {
+        HostFileId id;
+        uint64_t inode = 0;
+        in.Get(&id);
+        in.Get(&inode);
+        by_file_id_[id] = inode;
+    }
+    if (!in.ok() || !nodes_.count(kRootInode)) return false;
+
+    for (const auto& [inode, name] : names) {
+        if (!nodes_.count(nodes_.at(inode).parent)) return false;
+        Attach(inode, nodes_.at(inode).parent, name);
+    }
+    return true;
+}
+
+void VirtioFsInodeTable::Attach(uint64_t inode, uint64_t parent, std::string_view name) {
+    Node& node = nodes_.at(inode);
+    node.parent = parent;
+    node.name = names_.Store(name);
+    children_[{parent, node.name}] = inode;
+    nodes_.at(parent).children++;
+}
+
+void VirtioFsInodeTable::Detach(uint64_t inode) {
+    Node& node = nodes_.at(inode);
+    if (!node.parent) return;
+    uint64_t parent = node.parent;
+    children_.erase({parent, node.name});
+    names_.Release(node.name);
+    node.name = {};
+    node.parent = 0;
+    nodes_.at(parent).children--;
+    MaybeErase(parent);
+}
+
+void VirtioFsInodeTable::MaybeErase(uint64_t inode) {
+    auto it = nodes_.find(inode);
+    if (it == nodes_.end()) return;
+    const Node& node = it->second;
+    if (node.pinned || node.nlookup || node.children) return;
+    EraseNode(inode);
+    if (names_.ShouldCompact()) CompactNames();
+}
+
+void VirtioFsInodeTable::EraseNode(uint64_t inode) {
+    Node& node = nodes_.at(inode);
+    if (node.file_id.valid()) {
+        auto it = by_file_id_.find(node.file_id);
+        if (it != by_file_id_.end() && it->second == inode) by_file_id_.erase(it);
+    }
+    uint64_t parent = node.parent;
+    if (parent) {
+        children_.erase({parent, node.name});
+        names_.Release(node.name);
+    }
+    nodes_.erase(inode);
+    if (parent) {
+        nodes_.at(parent).children--;
+        MaybeErase(parent);
+    }
+}
+
+void VirtioFsInodeTable::CompactNames() {
+    // Copy the live names out, then back into a fresh arena.
+    std::vector<std::pair<uint64_t, std::string>> saved;
+    saved.reserve(nodes_.size());
+    for (const auto& [inode, node] : nodes_) {
+        if (node.parent) saved.emplace_back(inode, std::string(node.name));
+    }
+    names_.Clear();
+    children_.clear();
+    for (const auto& [inode, name] : saved) {
+        Node& node = nodes_.at(inode);
+        node.name = names_.Store(name);
+        children_[{node.parent, node.name}] = inode;
+    }
+}
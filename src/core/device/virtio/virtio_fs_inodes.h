@@ -0,0 +1,138 @@
+#pragma once
+
+#include "core/vmm/snapshot.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Identity of a host file: volume serial number plus the 128-bit file ID
+// (the 64-bit NTFS file reference, zero-extended, on NTFS).
+struct HostFileId {
+    uint64_t volume = 0;
+    uint64_t id_low = 0;
+    uint64_t id_high = 0;
+
+    bool valid() const { return volume || id_low || id_high; }
+    bool operator==(const HostFileId& o) const {
+        return volume == o.volume && id_low == o.id_low && id_high == o.id_high;
+    }
+};
+
+// Name bytes for the inode table, packed into large blocks. Freed names
+// are only counted; the owner compacts once most of the space is dead.
+class NameArena {
+public:
+    std::string_view Store(std::string_view name);
+    void Release(std::string_view name) { live_bytes_ -= name.size(); }
+    bool ShouldCompact() const;
+    void Clear();
+
+private:
+    static constexpr size_t kBlockSize = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    size_t block_used_ = kBlockSize;  // of blocks_.back()
+    size_t live_bytes_ = 0;
+    size_t total_bytes_ = 0;
+};
+
+// The virtio-fs inode table. Each node holds its parent and its own name,
+// not a full path, so a rename moves one entry whatever lies below it.
+// Share roots are the children of the virtual root, named by tag.
+//
+// Nodes are also indexed by host file ID. Inode numbers derive from it
+// where known, so a file keeps its number across FORGET and re-lookup,
+// and a file renamed on the host keeps its node.
+//
+// Not thread-safe; VirtioFsDevice guards it with inode_mutex_.
+class VirtioFsInodeTable {
+public:
+    static constexpr uint64_t kRootInode = 1;
+
+    VirtioFsInodeTable();
+
+    // Pinned node for a share root. Returns 0 if `tag` is taken.
+    uint64_t AddShareRoot(const std::string& tag);
+    // Drops a share root and everything below it.
+    void RemoveShare(const std::string& tag);
+
+    // Finds or creates the node for `name` in `parent` and, when `count`,
+    // records a lookup the guest will FORGET. A name found with a
+    // different file ID is treated as replaced; an ID found under another
+    // name is moved here, unless that name differs only in case. Returns 0
+    // if `parent` is unknown.
+    uint64_t Lookup(uint64_t parent, std::string_view name, const HostFileId& id,
+                    bool is_dir, bool count = true);
+    // Returns 0 if not found.
+    uint64_t Find(uint64_t parent, std::string_view name) const;
+    // `rel` is '\\'-separated, relative to `from`.
+    uint64_t FindPath(uint64_t from, std::string_view rel) const;
+    // Whether `name` in `parent` is known with its file ID.
+    bool HasFileId(uint64_t parent, std::string_view name) const;
+    // Inode number a file with `id` gets if it has no node yet.
+    static uint64_t InodeForId(const HostFileId& id);
+
+    void Forget(uint64_t inode, uint64_t nlookup);
+    // The name went away; its node lives on until forgotten.
+    void Unlink(uint64_t parent, std::string_view name);
+    void Rename(uint64_t old_parent, std::string_view old_name,
+                uint64_t new_parent, std::string_view new_name);
+
+    bool Contains(uint64_t inode) const { return nodes_.count(inode) != 0; }
+    // Invalid if unknown.
+    HostFileId FileIdOf(uint64_t inode) const;
+    // Share tag and '\\'-separated path below the share root. False for
+    // the virtual root, unknown inodes and unlinked ones.
+    bool GetPath(uint64_t inode, std::string* share_tag, std::string* rel) const;
+    size_t size() const { return nodes_.size(); }
+
+    // The whole table, for snapshots. LoadState replaces what is there.
+    void SaveState(StateWriter& out) const;
+    bool LoadState(StateReader& in);
+
+private:
+    struct Node {
+        uint64_t parent = 0;  // 0 once unlinked
+        std::string_view name;
+        uint64_t nlookup = 0;
+        HostFileId file_id;
+        uint32_t children = 0;  // attached nodes naming this one as parent
+        bool is_dir = false;
+        bool pinned = false;
+    };
+
+    struct ChildKey {
+        uint64_t parent;
+        std::string_view name;
+        bool operator==(const ChildKey& o) const { return parent == o.parent && name == o.name; }
+    };
+    struct ChildKeyHash {
+        size_t operator()(const ChildKey& k) const {
+            return std::hash<std::string_view>()(k.name) ^ (k.parent * 0x9E3779B97F4A7C15ULL);
+        }
+    };
+    struct FileIdHash {
+        size_t operator()(const HostFileId& id) const {
+            return static_cast<size_t>(InodeForId(id));
+        }
+    };
+
+    uint64_t NewInode(const HostFileId& id);
+    void Attach(uint64_t inode, uint64_t parent, std::string_view name);
+    // Takes the node off its parent; it stays in nodes_.
+    void Detach(uint64_t inode);
+    // Erases the node if nothing refers to it any more, then its parent.
+    void MaybeErase(uint64_t inode);
+    void EraseNode(uint64_t inode);
+    void CompactNames();
+
+    std::unordered_map<uint64_t, Node> nodes_;
+    std::unordered_map<ChildKey, uint64_t, ChildKeyHash> children_;
+    std::unordered_map<HostFileId, uint64_t, FileIdHash> by_file_id_;
+    NameArena names_;
+    // Inodes without a usable file ID, in a range file IDs never map to.
+    uint64_t next_anon_inode_ = 1;
+};
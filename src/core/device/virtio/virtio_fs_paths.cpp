@@ -0,0 +1,51 @@
+#include "core/device/virtio/virtio_fs_paths.h"
+#include "core/vmm/utf8.h"
+
+#define NOMINMAX
+#include <windows.h>
+
+std::wstring VirtioFsPathCache::Fold(std::wstring path) {
+    if (!path.empty()) CharLowerBuffW(path.data(), static_cast<DWORD>(path.size()));
+    return path;
+}
+
+std::shared_ptr<const HostPath> VirtioFsPathCache::Resolve(const std::string& path) {
+    std::shared_ptr<const HostPath> base;
+    size_t cut = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(path);
+        if (it != entries_.end()) return it->second;
+
+        std::string_view view(path);
+        size_t sep = view.size();
+        while (sep > 0 && (sep = view.rfind('\\', sep - 1)) != std::string_view::npos && sep > 0) {
+            auto parent = entries_.find(view.substr(0, sep));
+            if (parent != entries_.end()) {
+                base = parent->second;
+                cut = sep;
+                break;
+            }
+        }
+    }
+
+    auto result = std::make_shared<HostPath>();
+    std::wstring tail = Utf8ToWide(std::string_view(path).substr(cut));
+    if (base) {
+        result->wide = base->wide + tail;
+        result->key = base->key + Fold(tail);
+    } else {
+        result->key = Fold(tail);
+        result->wide = std::move(tail);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= kMaxEntries) entries_.clear();
+    entries_.emplace(path, result);
+    return result;
+}
+
+void VirtioFsPathCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
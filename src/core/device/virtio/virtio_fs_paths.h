@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// A host path in the two wide forms virtio-fs needs: as passed to Win32,
+// and case-folded, as the attribute and handle caches key it.
+struct HostPath {
+    std::wstring wide;
+    std::wstring key;
+};
+
+// Converts UTF-8 host paths to HostPath once and keeps the result. Entries
+// are keyed by the exact path, so names differing only in case get entries
+// of their own but share a `key`. A miss converts only the components below
+// the longest cached ancestor, which the lookups of parent directories have
+// usually left behind.
+//
+// The conversion does not depend on what is on disk, so entries never go
+// stale; the cache is only bounded.
+class VirtioFsPathCache {
+public:
+    static constexpr size_t kMaxEntries = 32 * 1024;
+
+    std::shared_ptr<const HostPath> Resolve(const std::string& path);
+    void Clear();
+
+    static std::wstring Fold(std::wstring path);
+
+private:
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const HostPath>, StringHash, std::equal_to<>>
+        entries_;
+};
@@ -0,0 +1,159 @@
+#include "core/device/virtio/virtio_fs_stats.h"
+#include "core/device/virtio/virtio_fs.h"
+#include <algorithm>
+#include <bit>
+
+static int64_t ClockMicros(VirtioFsOpStats::Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+static uint32_t LatencyBucket(uint64_t us) {
+    if (us < 2) return 0;
+    uint32_t bucket = static_cast<uint32_t>(std::bit_width(us)) - 1;
+    return std::min(bucket, VirtioFsOpStats::kLatencyBuckets - 1);
+}
+
+uint64_t VirtioFsOpStats::OpSnapshot::PercentileUs(double p) const {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kLatencyBuckets; i++) {
+        seen += buckets[i];
+        if (seen >= rank) return i + 1 < kLatencyBuckets ? std::min<uint64_t>(2ULL << i, max_us) : max_us;
+    }
+    return max_us;
+}
+
+VirtioFsOpStats::VirtioFsOpStats()
+    : epoch_us_(ClockMicros(Clock::now())) {
+}
+
+void VirtioFsOpStats::Record(Clock::time_point start, TraceRecord rec) {
+    int64_t start_us = ClockMicros(start);
+    uint64_t latency = static_cast<uint64_t>(std::max<int64_t>(ClockMicros(Clock::now()) - start_us, 0));
+
+    OpCounters& op = ops_[std::min(rec.opcode, kMaxOpcode)];
+    op.count.fetch_add(1, std::memory_order_relaxed);
+    if (rec.error) op.errors.fetch_add(1, std::memory_order_relaxed);
+    op.total_us.fetch_add(latency, std::memory_order_relaxed);
+    op.buckets[LatencyBucket(latency)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = op.max_us.load(std::memory_order_relaxed);
+    while (latency > max && !op.max_us.compare_exchange_weak(max, latency, std::memory_order_relaxed)) {
+    }
+
+    if (!tracing_.load(std::memory_order_relaxed)) return;
+    rec.start_us = static_cast<uint64_t>(std::max<int64_t>(start_us - epoch_us_.load(), 0));
+    rec.latency_us = static_cast<uint32_t>(std::min<uint64_t>(latency, UINT32_MAX));
+    std::lock_guard<std::mutex> lock(trace_mutex_);
+    if (trace_.empty()) return;
+    trace_[trace_next_] = rec;
+    if (++trace_next_ == trace_.size()) {
+        trace_next_ = 0;
+        trace_full_ = true;
+    }
+}
+
+std::vector<VirtioFsOpStats::OpSnapshot> VirtioFsOpStats::Snapshot() const {
+    std::vector<OpSnapshot> result;
+    for (uint32_t i = 0; i <= kMaxOpcode; i++) {
+        const OpCounters& op = ops_[i];
+        uint64_t count = op.count.load(std::memory_order_relaxed);
+        if (!count) continue;
+        OpSnapshot snap;
+        snap.opcode = i;
+        snap.count = count;
+        snap.errors = op.errors.load(std::memory_order_relaxed);
+        snap.total_us = op.total_us.load(std::memory_order_relaxed);
+        snap.max_us = op.max_us.load(std::memory_order_relaxed);
+        for (uint32_t b = 0; b < kLatencyBuckets; b++) {
+            snap.buckets[b] = op.buckets[b].load(std::memory_order_relaxed);
+        }
+        result.push_back(snap);
+    }
+    return result;
+}
+
+void VirtioFsOpStats::Reset() {
+    for (OpCounters& op : ops_) {
+        op.count = 0;
+        op.errors = 0;
+        op.total_us = 0;
+        op.max_us = 0;
+        for (auto& bucket : op.buckets) bucket = 0;
+    }
+    epoch_us_ = ClockMicros(Clock::now());
+    std::lock_guard<std::mutex> lock(trace_mutex_);
+    trace_next_ = 0;
+    trace_full_ = false;
+}
+
+void VirtioFsOpStats::SetTraceCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(trace_mutex_);
+    trace_.assign(capacity, TraceRecord{});
+    trace_next_ = 0;
+    trace_full_ = false;
+    tracing_ = capacity != 0;
+}
+
+std::vector<VirtioFsOpStats::TraceRecord> VirtioFsOpStats::GetTrace() const {
+    std::lock_guard<std::mutex> lock(trace_mutex_);
+    std::vector<TraceRecord> result;
+    if (trace_full_) {
+        result.assign(trace_.begin() + trace_next_, trace_.end());
+    }
+    result.insert(result.end(), trace_.begin(), trace_.begin() + trace_next_);
+    return result;
+}
+
+const char* VirtioFsOpStats::OpcodeName(uint32_t opcode) {
+    switch (opcode) {
+    case FUSE_LOOKUP:       return "LOOKUP";
+    case FUSE_FORGET:       return "FORGET";
+    case FUSE_GETATTR:      return "GETATTR";
+    case FUSE_SETATTR:      return "SETATTR";
+    case FUSE_READLINK:     return "READLINK";
+    case FUSE_SYMLINK:      return "SYMLINK";
+    case FUSE_MKNOD:        return "MKNOD";
+    case FUSE_MKDIR:        return "MKDIR";
+    case FUSE_UNLINK:       return "UNLINK";
+    case FUSE_RMDIR:        return "RMDIR";
+    case FUSE_RENAME:       return "RENAME";
+    case FUSE_LINK:         return "LINK";
+    case FUSE_OPEN:         return "OPEN";
+    case FUSE_READ:         return "READ";
+    case FUSE_WRITE:        return "WRITE";
+    case FUSE_STATFS:       return "STATFS";
+    case FUSE_RELEASE:      return "RELEASE";
+    case FUSE_FSYNC:        return "FSYNC";
+    case FUSE_SETXATTR:     return "SETXATTR";
+    case FUSE_GETXATTR:     return "GETXATTR";
+    case FUSE_LISTXATTR:    return "LISTXATTR";
+    case FUSE_REMOVEXATTR:  return "REMOVEXATTR";
+    case FUSE_FLUSH:        return "FLUSH";
+    case FUSE_INIT:         return "INIT";
+    case FUSE_OPENDIR:      return "OPENDIR";
+    case FUSE_READDIR:      return "READDIR";
+    case FUSE_RELEASEDIR:   return "RELEASEDIR";
+    case FUSE_FSYNCDIR:     return "FSYNCDIR";
+    case FUSE_GETLK:        return "GETLK";
+    case FUSE_SETLK:        return "SETLK";
+    case FUSE_SETLKW:       return "SETLKW";
+    case FUSE_ACCESS:       return "ACCESS";
+    case FUSE_CREATE:       return "CREATE";
+    case FUSE_INTERRUPT:    return "INTERRUPT";
+    case FUSE_BMAP:         return "BMAP";
+    case FUSE_DESTROY:      return "DESTROY";
+    case FUSE_IOCTL:        return "IOCTL";
+    case FUSE_POLL:         return "POLL";
+    case FUSE_NOTIFY_REPLY: return "NOTIFY_REPLY";
+    case FUSE_BATCH_FORGET: return "BATCH_FORGET";
+    case FUSE_FALLOCATE:    return "FALLOCATE";
+    case FUSE_READDIRPLUS:  return "READDIRPLUS";
+    case FUSE_RENAME2:      return "RENAME2";
+    case FUSE_LSEEK:        return "LSEEK";
+    case FUSE_COPY_FILE_RANGE: return "COPY_FILE_RANGE";
+    case FUSE_SETUPMAPPING: return "SETUPMAPPING";
+    case FUSE_REMOVEMAPPING: return "REMOVEMAPPING";
+    default:                return "UNKNOWN";
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Per-opcode request counts and latency histograms for virtio-fs, plus an
+// optional ring of the most recent requests. Counting is lock-free, so all
+// request workers record into one instance; the trace takes a lock, and
+// only while it is enabled.
+class VirtioFsOpStats {
+public:
+    // Opcodes at or above this share the last slot.
+    static constexpr uint32_t kMaxOpcode = 64;
+    // Bucket 0 holds latencies under 2 us, bucket i [2^i, 2^(i+1)) us, and
+    // the last one everything slower.
+    static constexpr uint32_t kLatencyBuckets = 24;
+
+    struct OpSnapshot {
+        uint32_t opcode = 0;
+        uint64_t count = 0;
+        uint64_t errors = 0;      // replies with a nonzero error
+        uint64_t total_us = 0;
+        uint64_t max_us = 0;
+        uint64_t buckets[kLatencyBuckets] = {};
+
+        // Upper bound of the bucket holding the `p`-th percentile (0..1).
+        uint64_t PercentileUs(double p) const;
+    };
+
+    struct TraceRecord {
+        uint64_t unique = 0;
+        uint64_t nodeid = 0;
+        uint64_t start_us = 0;    // since the stats were created or reset
+        uint32_t latency_us = 0;
+        uint32_t opcode = 0;
+        uint32_t in_len = 0;
+        uint32_t out_len = 0;
+        int32_t error = 0;
+    };
+
+    VirtioFsOpStats();
+
+    VirtioFsOpStats(const VirtioFsOpStats&) = delete;
+    VirtioFsOpStats& operator=(const VirtioFsOpStats&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    // `rec.start_us` and `rec.latency_us` are filled from `start` here.
+    void Record(Clock::time_point start, TraceRecord rec);
+
+    // Opcodes seen at least once, in opcode order.
+    std::vector<OpSnapshot> Snapshot() const;
+    void Reset();
+
+    // Keeps the last `capacity` requests; 0 turns tracing off.
+    void SetTraceCapacity(size_t capacity);
+    // Oldest first.
+    std::vector<TraceRecord> GetTrace() const;
+
+    static const char* OpcodeName(uint32_t opcode);
+
+private:
+    struct OpCounters {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> total_us{0};
+        std::atomic<uint64_t> max_us{0};
+        std::atomic<uint64_t> buckets[kLatencyBuckets] = {};
+    };
+
+    OpCounters ops_[kMaxOpcode + 1];
+    std::atomic<int64_t> epoch_us_;  // Clock time of creation or reset
+
+    std::atomic<bool> tracing_{false};
+    mutable std::mutex trace_mutex_;
+    std::vector<TraceRecord> trace_;
+    size_t trace_next_ = 0;   // slot the next record goes to
+    bool trace_full_ = false;
+};
@@ -1,5 +1,6 @@
 #include "core/device/virtio/virtio_gpu.h"
 #include "core/vmm/types.h"
+#include <intrin.h>
 #include <algorithm>
 #include <cstring>
 
@@ -26,19 +27,144 @@ static uint32_t FormatBpp(uint32_t format) {
     }
 }
 
-VirtioGpuDevice::VirtioGpuDevice(uint32_t width, uint32_t height)
-    : display_width_(width), display_height_(height) {
+// Flushes are diffed in squares of this many pixels.
+static constexpr uint32_t kDiffTile = 64;
+
+static bool CpuHasAvx2() {
+    static const bool has = [] {
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        // The OS must save YMM state as well.
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return has;
+}
+
+static bool SpanEqualAvx2(const uint8_t* a, const uint8_t* b, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i d = _mm256_xor_si256(x, y);
+        if (!_mm256_testz_si256(d, d)) return false;
+    }
+    return std::memcmp(a + i, b + i, len - i) == 0;
+}
+
+static bool SpanEqualSse2(const uint8_t* a, const uint8_t* b, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) return false;
+    }
+    return std::memcmp(a + i, b + i, len - i) == 0;
+}
+
+static bool SpanEqual(const uint8_t* a, const uint8_t* b, size_t len) {
+    static const bool avx2 = CpuHasAvx2();
+    return avx2 ? SpanEqualAvx2(a, b, len) : SpanEqualSse2(a, b, len);
+}
+
+// FNV-1a over the cursor image; identifies it across the IPC boundary.
+static uint64_t HashCursorImage(const uint8_t* pixels, size_t stride, size_t row_bytes,
+                                uint32_t rows, uint32_t hot_x, uint32_t hot_y) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](uint64_t v) {
+        h ^= v;
+        h *= 0x100000001b3ULL;
+    };
+    for (uint32_t y = 0; y < rows; ++y) {
+        const uint8_t* row = pixels + y * stride;
+        size_t i = 0;
+        for (; i + 8 <= row_bytes; i += 8) {
+            uint64_t v;
+            std::memcpy(&v, row + i, 8);
+            mix(v);
+        }
+        for (; i < row_bytes; ++i) mix(row[i]);
+    }
+    mix((static_cast<uint64_t>(hot_x) << 32) | hot_y);
+    // 0 means "no image"
+    return h ? h : 1;
+}
+
+VirtioGpuDevice::VirtioGpuDevice(uint32_t width, uint32_t height, uint32_t num_scanouts)
+    : num_scanouts_(std::clamp<uint32_t>(num_scanouts, 1, kMaxDisplayScanouts)) {
+    for (uint32_t i = 0; i < num_scanouts_; ++i) {
+        display_width_[i] = width;
+        display_height_[i] = height;
+    }
     gpu_config_.events_read = 0;
     gpu_config_.events_clear = 0;
-    gpu_config_.num_scanouts = 1;
+    gpu_config_.num_scanouts = num_scanouts_;
     gpu_config_.num_capsets = 0;
 }
 
+VirtioGpuDevice::~VirtioGpuDevice() {
+    StopWorker();
+}
+
+bool VirtioGpuDevice::StartWorker() {
+    if (worker_.joinable()) return true;
+    worker_stop_ = false;
+    worker_ = std::thread(&VirtioGpuDevice::WorkerThread, this);
+    return true;
+}
+
+void VirtioGpuDevice::StopWorker() {
+    if (!worker_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(work_mutex_);
+        worker_stop_ = true;
+    }
+    work_cv_.notify_one();
+    worker_.join();
+}
+
+void VirtioGpuDevice::WorkerThread() {
+    std::unique_lock<std::mutex> lock(work_mutex_);
+    for (;;) {
+        work_cv_.wait(lock, [this] { return worker_stop_ || !work_.empty(); });
+        // Whatever was queued before the stop still gets its response.
+        if (work_.empty()) break;
+        std::deque<uint16_t> batch;
+        batch.swap(work_);
+        VirtQueue* vq = ctrl_vq_;
+        worker_busy_ = true;
+        lock.unlock();
+
+        for (uint16_t head : batch) {
+            std::lock_guard<std::mutex> state_lock(state_mutex_);
+            ProcessControlCommand(*vq, head);
+        }
+        // Responses went out in queue order, so fences complete in order;
+        // one interrupt covers the whole batch.
+        if (mmio_) mmio_->NotifyUsedBuffer();
+
+        lock.lock();
+        worker_busy_ = false;
+        if (work_.empty()) idle_cv_.notify_all();
+    }
+}
+
+void VirtioGpuDevice::DrainWorker() {
+    std::unique_lock<std::mutex> lock(work_mutex_);
+    idle_cv_.wait(lock, [this] { return work_.empty() && !worker_busy_; });
+}
+
 uint64_t VirtioGpuDevice::GetDeviceFeatures() const {
-    return VIRTIO_GPU_VER1;
+    return VIRTIO_GPU_VER1 | VIRTIO_GPU_F_RESOURCE_BLOB;
 }
 
 void VirtioGpuDevice::ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
     const auto* cfg = reinterpret_cast<const uint8_t*>(&gpu_config_);
     if (offset + size > sizeof(gpu_config_)) {
         *value = 0;
@@ -51,19 +177,127 @@ void VirtioGpuDevice::ReadConfig(uint32_t offset, uint8_t size, uint32_t* value)
 void VirtioGpuDevice::WriteConfig(uint32_t offset, uint8_t size, uint32_t value) {
     // Only events_clear (offset 4) is writable
     if (offset == 4 && size == 4) {
+        std::lock_guard<std::mutex> lock(config_mutex_);
         gpu_config_.events_read &= ~value;
     }
 }
 
 void VirtioGpuDevice::OnStatusChange(uint32_t new_status) {
     if (new_status == 0) {
+        // Queued commands refer to the old rings and resources.
+        if (worker_.joinable()) DrainWorker();
+        std::lock_guard<std::mutex> lock(state_mutex_);
         resources_.clear();
-        scanout_resource_id_ = 0;
-        scanout_width_ = 0;
-        scanout_height_ = 0;
+        for (auto& scanout : scanouts_) {
+            scanout.resource_id = 0;
+            scanout.rect = {};
+            ResetShadow(scanout);
+        }
     }
 }
 
+void VirtioGpuDevice::SaveState(StateWriter& out) {
+    if (worker_.joinable()) DrainWorker();
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    out.Put(static_cast<uint32_t>(resources_.size()));
+    for (const auto& [id, res] : resources_) {
+        out.Put(res.id);
+        out.Put(res.width);
+        out.Put(res.height);
+        out.Put(res.format);
+        out.Put(res.stride);
+        out.Put(res.offset);
+        out.Put(res.blob);
+        out.Put(res.blob_size);
+        out.Put(res.direct != nullptr);
+        out.PutVector(res.host_pixels);
+        out.PutVector(res.backing);
+    }
+    for (uint32_t i = 0; i < num_scanouts_; i++) {
+        out.Put(scanouts_[i].resource_id);
+        out.Put(scanouts_[i].rect);
+    }
+    out.Put(cursor_resource_id_);
+    out.Put(cursor_scanout_id_);
+    out.Put(cursor_x_);
+    out.Put(cursor_y_);
+    out.Put(cursor_hot_x_);
+    out.Put(cursor_hot_y_);
+}
+
+bool VirtioGpuDevice::LoadState(StateReader& in) {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    uint32_t count = 0;
+    in.Get(&count);
+    resources_.clear();
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+        GpuResource res;
+        bool direct = false;
+        in.Get(&res.id);
+        in.Get(&res.width);
+        in.Get(&res.height);
+        in.Get(&res.format);
+        in.Get(&res.stride);
+        in.Get(&res.offset);
+        in.Get(&res.blob);
+        in.Get(&res.blob_size);
+        in.Get(&direct);
+        in.GetVector(&res.host_pixels);
+        in.GetVector(&res.backing);
+        if (direct) UpdateDirectBacking(res);
+        resources_[res.id] = std::move(res);
+    }
+    for (uint32_t i = 0; i < num_scanouts_; i++) {
+        in.Get(&scanouts_[i].resource_id);
+        in.Get(&scanouts_[i].rect);
+        ResetShadow(scanouts_[i]);
+    }
+    in.Get(&cursor_resource_id_);
+    in.Get(&cursor_scanout_id_);
+    in.Get(&cursor_x_);
+    in.Get(&cursor_y_);
+    in.Get(&cursor_hot_x_);
+    in.Get(&cursor_hot_y_);
+    cursor_image_id_ = 0;
+    if (!in.ok()) return false;
+
+    // The guest only flushes what changes, so nothing would be shown
+    // until it redraws on its own.
+    for (uint32_t i = 0; i < num_scanouts_; i++) {
+        Scanout& scanout = scanouts_[i];
+        if (!scanout.resource_id || !resources_.count(scanout.resource_id)) continue;
+        if (scanout_state_callback_) {
+            scanout_state_callback_(i, true, scanout.rect.width, scanout.rect.height);
+        }
+        RepaintScanout(i);
+    }
+    return true;
+}
+
+void VirtioGpuDevice::SetFramesWanted(bool wanted) {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    if (frames_wanted_ == wanted) return;
+    frames_wanted_ = wanted;
+    if (!wanted) return;
+
+    // Flushes while nobody watched left the shadows as last sent; diffing
+    // the whole scanout against them sends just what changed since.
+    for (uint32_t i = 0; i < num_scanouts_; i++) {
+        if (scanouts_[i].resource_id) RepaintScanout(i);
+    }
+}
+
+void VirtioGpuDevice::RepaintScanout(uint32_t scanout_id) {
+    const Scanout& scanout = scanouts_[scanout_id];
+    VirtioGpuResourceFlush flush{};
+    flush.r = scanout.rect;
+    flush.resource_id = scanout.resource_id;
+    uint8_t resp[sizeof(VirtioGpuCtrlHdr)];
+    uint32_t resp_len = 0;
+    CmdResourceFlush(reinterpret_cast<const uint8_t*>(&flush), sizeof(flush),
+                     resp, &resp_len);
+}
+
 void VirtioGpuDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
     if (queue_idx == 0) {
         ProcessControlQueue(vq);
@@ -109,116 +343,307 @@ void VirtioGpuDevice::CopyFromBacking(
     }
 }
 
-void VirtioGpuDevice::ProcessControlQueue(VirtQueue& vq) {
-    uint16_t head;
-    while (vq.PopAvail(&head)) {
-        std::vector<VirtqChainElem> chain;
-        if (!vq.WalkChain(head, &chain)) {
-            vq.PushUsed(head, 0);
-            continue;
-        }
+void VirtioGpuDevice::UpdateDirectBacking(GpuResource& res) const {
+    res.direct = nullptr;
+    if (res.backing.empty() || res.stride == 0) return;
+    uint64_t needed = res.offset + static_cast<uint64_t>(res.stride) * (res.height - 1) +
+                      static_cast<uint64_t>(res.width) * FormatBpp(res.format);
+    const uint8_t* start = GpaToHva(res.backing[0].gpa);
+    if (!start) return;
+
+    // Entries must follow each other in host memory, not just in GPA.
+    uint64_t covered = 0;
+    for (auto& page : res.backing) {
+        const uint8_t* hva = GpaToHva(page.gpa);
+        const uint8_t* last = GpaToHva(page.gpa + page.length - 1);
+        if (hva != start + covered || last != hva + page.length - 1) return;
+        covered += page.length;
+        if (covered >= needed) break;
+    }
+    if (covered >= needed) res.direct = start + res.offset;
+}
 
-        // Collect readable (request) and writable (response) buffers
-        std::vector<uint8_t> req_buf;
-        std::vector<VirtqChainElem> resp_elems;
+void VirtioGpuDevice::DropDirectBacking(GpuResource& res) const {
+    if (!res.direct) return;
+    size_t size = static_cast<size_t>(res.stride) * (res.height - 1) +
+                  static_cast<size_t>(res.width) * FormatBpp(res.format);
+    res.host_pixels.assign(static_cast<size_t>(res.stride) * res.height, 0);
+    std::memcpy(res.host_pixels.data(), res.direct, size);
+    res.direct = nullptr;
+}
 
-        for (auto& elem : chain) {
-            if (!elem.writable) {
-                req_buf.insert(req_buf.end(), elem.addr, elem.addr + elem.len);
-            } else {
-                resp_elems.push_back(elem);
+const uint8_t* VirtioGpuDevice::ResourcePixels(GpuResource& res) const {
+    if (res.direct) return res.direct;
+    if (res.host_pixels.empty()) {
+        res.host_pixels.resize(static_cast<size_t>(res.stride) * res.height, 0);
+    }
+    return res.host_pixels.data();
+}
+
+bool VirtioGpuDevice::SetBlobLayout(GpuResource& res, uint32_t width, uint32_t height,
+                                    uint32_t format, uint32_t stride, uint64_t offset) const {
+    uint32_t bpp = FormatBpp(format);
+    if (width == 0 || height == 0 || width > 16384 || height > 16384 ||
+        stride < width * bpp) {
+        return false;
+    }
+    uint64_t end = offset + static_cast<uint64_t>(stride) * (height - 1) +
+                   static_cast<uint64_t>(width) * bpp;
+    if (end > res.blob_size) return false;
+    if (res.width == width && res.height == height && res.format == format &&
+        res.stride == stride && res.offset == offset) {
+        return true;
+    }
+    res.width = width;
+    res.height = height;
+    res.format = format;
+    res.stride = stride;
+    res.offset = offset;
+    res.host_pixels.clear();
+    UpdateDirectBacking(res);
+    return true;
+}
+
+void VirtioGpuDevice::ReadBlobRows(GpuResource& res, uint32_t x0, uint32_t x1,
+                                   uint32_t y0, uint32_t y1) const {
+    if (res.direct || x0 >= x1) return;
+    uint32_t bpp = FormatBpp(res.format);
+    uint8_t* dst = const_cast<uint8_t*>(ResourcePixels(res));
+    for (uint32_t y = y0; y < y1; ++y) {
+        uint64_t row = static_cast<uint64_t>(y) * res.stride + static_cast<uint64_t>(x0) * bpp;
+        CopyFromBacking(res.backing, res.offset + row, (x1 - x0) * bpp, dst + row);
+    }
+}
+
+bool VirtioGpuDevice::IsScanoutResource(uint32_t resource_id) const {
+    for (const auto& scanout : scanouts_) {
+        if (scanout.resource_id != 0 && scanout.resource_id == resource_id) return true;
+    }
+    return false;
+}
+
+void VirtioGpuDevice::ResetShadow(Scanout& scanout) {
+    std::fill(scanout.shadow_synced.begin(), scanout.shadow_synced.end(), 0);
+}
+
+std::vector<VirtioGpuRect> VirtioGpuDevice::DiffScanout(Scanout& scanout,
+                                                        const uint8_t* pixels,
+                                                        size_t src_stride, uint32_t bpp,
+                                                        const VirtioGpuRect& rect) {
+    if (rect.width == 0 || rect.height == 0) return {};
+    uint32_t width = scanout.rect.width;
+    uint32_t height = scanout.rect.height;
+    size_t stride = static_cast<size_t>(width) * bpp;
+    uint32_t tiles_x = (width + kDiffTile - 1) / kDiffTile;
+    if (scanout.shadow_width != width || scanout.shadow_height != height) {
+        uint32_t tiles_y = (height + kDiffTile - 1) / kDiffTile;
+        scanout.shadow.assign(stride * height, 0);
+        scanout.shadow_synced.assign(static_cast<size_t>(tiles_x) * tiles_y, 0);
+        scanout.shadow_width = width;
+        scanout.shadow_height = height;
+    }
+    uint8_t* shadow = scanout.shadow.data();
+
+    // One rect per band of tile rows, spanning its first to last changed
+    // tile; bands with the same span stack into one rect.
+    std::vector<VirtioGpuRect> out;
+    uint32_t rect_right = rect.x + rect.width;
+    uint32_t rect_bottom = rect.y + rect.height;
+    for (uint32_t ty = rect.y / kDiffTile; ty * kDiffTile < rect_bottom; ++ty) {
+        uint32_t y0 = (std::max)(ty * kDiffTile, rect.y);
+        uint32_t y1 = (std::min)((ty + 1) * kDiffTile, rect_bottom);
+        uint32_t tile_bottom = (std::min)((ty + 1) * kDiffTile, height);
+        uint32_t first = UINT32_MAX, last = 0;
+
+        for (uint32_t tx = rect.x / kDiffTile; tx * kDiffTile < rect_right; ++tx) {
+            uint32_t x0 = (std::max)(tx * kDiffTile, rect.x);
+            uint32_t x1 = (std::min)((tx + 1) * kDiffTile, rect_right);
+            uint32_t tile_right = (std::min)((tx + 1) * kDiffTile, width);
+            size_t span = static_cast<size_t>(x1 - x0) * bpp;
+            size_t col = static_cast<size_t>(x0) * bpp;
+            uint8_t& synced = scanout.shadow_synced[static_cast<size_t>(ty) * tiles_x + tx];
+
+            // Rows before the first difference already match.
+            uint32_t y = y0;
+            if (synced) {
+                while (y < y1) {
+                    if (!SpanEqual(shadow + y * stride + col, pixels + y * src_stride + col,
+                                   span)) {
+                        break;
+                    }
+                    ++y;
+                }
+            }
+            bool changed = y < y1;
+            for (; y < y1; ++y) {
+                std::memcpy(shadow + y * stride + col, pixels + y * src_stride + col, span);
+            }
+            // A partly flushed tile still has stale shadow outside the rect.
+            if (x0 == tx * kDiffTile && x1 == tile_right &&
+                y0 == ty * kDiffTile && y1 == tile_bottom) {
+                synced = 1;
+            }
+            if (changed) {
+                first = (std::min)(first, tx);
+                last = tx;
             }
         }
 
-        if (req_buf.size() < sizeof(VirtioGpuCtrlHdr)) {
-            vq.PushUsed(head, 0);
-            continue;
+        if (first == UINT32_MAX) continue;
+        VirtioGpuRect band;
+        band.x = (std::max)(first * kDiffTile, rect.x);
+        band.y = y0;
+        band.width = (std::min)((last + 1) * kDiffTile, rect_right) - band.x;
+        band.height = y1 - y0;
+        if (!out.empty() && out.back().x == band.x && out.back().width == band.width &&
+            out.back().y + out.back().height == band.y) {
+            out.back().height += band.height;
+        } else {
+            out.push_back(band);
         }
+    }
+    return out;
+}
 
-        // Prepare response buffer (max typical size)
-        std::vector<uint8_t> resp(4096, 0);
-        uint32_t resp_len = 0;
-
-        auto* hdr = reinterpret_cast<const VirtioGpuCtrlHdr*>(req_buf.data());
-
-        switch (hdr->type) {
-        case VIRTIO_GPU_CMD_GET_DISPLAY_INFO:
-            CmdGetDisplayInfo(hdr, resp.data(), &resp_len);
-            break;
-        case VIRTIO_GPU_CMD_RESOURCE_CREATE_2D:
-            CmdResourceCreate2d(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
-                                resp.data(), &resp_len);
-            break;
-        case VIRTIO_GPU_CMD_RESOURCE_UNREF:
-            CmdResourceUnref(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
-                             resp.data(), &resp_len);
-            break;
-        case VIRTIO_GPU_CMD_SET_SCANOUT:
-            CmdSetScanout(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
-                          resp.data(), &resp_len);
-            break;
-        case VIRTIO_GPU_CMD_RESOURCE_FLUSH:
-            CmdResourceFlush(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
-                             resp.data(), &resp_len);
-            break;
-        case VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D:
-            CmdTransferToHost2d(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
-                                resp.data(), &resp_len);
-            break;
-        case VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING: {
-            // The attach backing command header is followed by mem entries
-            // which may span into subsequent readable descriptors (already
-            // concatenated into req_buf).
-            const uint8_t* extra = nullptr;
-            uint32_t extra_len = 0;
-            if (req_buf.size() > sizeof(VirtioGpuResourceAttachBacking)) {
-                extra = req_buf.data() + sizeof(VirtioGpuResourceAttachBacking);
-                extra_len = static_cast<uint32_t>(
-                    req_buf.size() - sizeof(VirtioGpuResourceAttachBacking));
+void VirtioGpuDevice::ProcessControlQueue(VirtQueue& vq) {
+    uint16_t head;
+    if (worker_.joinable()) {
+        // Only pop here; the vCPU goes straight back to the guest.
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> lock(work_mutex_);
+            ctrl_vq_ = &vq;
+            while (vq.PopAvail(&head)) {
+                work_.push_back(head);
+                queued = true;
             }
-            CmdAttachBacking(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
-                             extra, extra_len, resp.data(), &resp_len);
-            break;
-        }
-        case VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING:
-            CmdDetachBacking(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
-                             resp.data(), &resp_len);
-            break;
-        default:
-            WriteResponse(resp.data(), VIRTIO_GPU_RESP_ERR_UNSPEC, &resp_len);
-            break;
         }
+        if (queued) work_cv_.notify_one();
+        return;
+    }
+
+    while (vq.PopAvail(&head)) {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        ProcessControlCommand(vq, head);
+    }
+
+    if (mmio_) mmio_->NotifyUsedBuffer();
+}
+
+void VirtioGpuDevice::ProcessControlCommand(VirtQueue& vq, uint16_t head) {
+    thread_local VirtqChain chain;
+    if (!vq.WalkChain(head, &chain)) {
+        vq.PushUsed(head, 0);
+        return;
+    }
+
+    // Collect readable (request) and writable (response) buffers
+    std::vector<uint8_t> req_buf;
+    std::vector<VirtqChainElem> resp_elems;
 
-        // If the request had VIRTIO_GPU_FLAG_FENCE set, copy fence info to response.
-        // The guest driver waits on dma_fence which is signaled only when the
-        // response contains matching flags and fence_id.
-        if (resp_len >= sizeof(VirtioGpuCtrlHdr) &&
-            (hdr->flags & VIRTIO_GPU_FLAG_FENCE)) {
-            auto* resp_hdr = reinterpret_cast<VirtioGpuCtrlHdr*>(resp.data());
-            resp_hdr->flags |= VIRTIO_GPU_FLAG_FENCE;
-            resp_hdr->fence_id = hdr->fence_id;
-            resp_hdr->ctx_id = hdr->ctx_id;
+    for (auto& elem : chain) {
+        if (!elem.writable) {
+            req_buf.insert(req_buf.end(), elem.addr, elem.addr + elem.len);
+        } else {
+            resp_elems.push_back(elem);
         }
+    }
+
+    if (req_buf.size() < sizeof(VirtioGpuCtrlHdr)) {
+        vq.PushUsed(head, 0);
+        return;
+    }
 
-        // Copy response into writable descriptors
-        uint32_t written = 0;
-        for (auto& elem : resp_elems) {
-            if (written >= resp_len) break;
-            uint32_t to_copy = (std::min)(elem.len, resp_len - written);
-            std::memcpy(elem.addr, resp.data() + written, to_copy);
-            written += to_copy;
+    // Prepare response buffer (max typical size)
+    std::vector<uint8_t> resp(4096, 0);
+    uint32_t resp_len = 0;
+
+    auto* hdr = reinterpret_cast<const VirtioGpuCtrlHdr*>(req_buf.data());
+
+    switch (hdr->type) {
+    case VIRTIO_GPU_CMD_GET_DISPLAY_INFO:
+        CmdGetDisplayInfo(hdr, resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_CREATE_2D:
+        CmdResourceCreate2d(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                            resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_UNREF:
+        CmdResourceUnref(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                         resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_SET_SCANOUT:
+        CmdSetScanout(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                      resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_FLUSH:
+        CmdResourceFlush(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                         resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D:
+        CmdTransferToHost2d(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                            resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING: {
+        // The attach backing command header is followed by mem entries
+        // which may span into subsequent readable descriptors (already
+        // concatenated into req_buf).
+        const uint8_t* extra = nullptr;
+        uint32_t extra_len = 0;
+        if (req_buf.size() > sizeof(VirtioGpuResourceAttachBacking)) {
+            extra = req_buf.data() + sizeof(VirtioGpuResourceAttachBacking);
+            extra_len = static_cast<uint32_t>(
+                req_buf.size() - sizeof(VirtioGpuResourceAttachBacking));
         }
+        CmdAttachBacking(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                         extra, extra_len, resp.data(), &resp_len);
+        break;
+    }
+    case VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING:
+        CmdDetachBacking(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                         resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_CREATE_BLOB:
+        // Mem entries follow, as with attach backing.
+        CmdResourceCreateBlob(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                              resp.data(), &resp_len);
+        break;
+    case VIRTIO_GPU_CMD_SET_SCANOUT_BLOB:
+        CmdSetScanoutBlob(req_buf.data(), static_cast<uint32_t>(req_buf.size()),
+                          resp.data(), &resp_len);
+        break;
+    default:
+        WriteResponse(resp.data(), VIRTIO_GPU_RESP_ERR_UNSPEC, &resp_len);
+        break;
+    }
 
-        vq.PushUsed(head, written);
+    // If the request had VIRTIO_GPU_FLAG_FENCE set, copy fence info to response.
+    // The guest driver waits on dma_fence which is signaled only when the
+    // response contains matching flags and fence_id.
+    if (resp_len >= sizeof(VirtioGpuCtrlHdr) &&
+        (hdr->flags & VIRTIO_GPU_FLAG_FENCE)) {
+        auto* resp_hdr = reinterpret_cast<VirtioGpuCtrlHdr*>(resp.data());
+        resp_hdr->flags |= VIRTIO_GPU_FLAG_FENCE;
+        resp_hdr->fence_id = hdr->fence_id;
+        resp_hdr->ctx_id = hdr->ctx_id;
     }
 
-    if (mmio_) mmio_->NotifyUsedBuffer();
+    // Copy response into writable descriptors
+    uint32_t written = 0;
+    for (auto& elem : resp_elems) {
+        if (written >= resp_len) break;
+        uint32_t to_copy = (std::min)(elem.len, resp_len - written);
+        std::memcpy(elem.addr, resp.data() + written, to_copy);
+        written += to_copy;
+    }
+
+    vq.PushUsed(head, written);
 }
 
 void VirtioGpuDevice::ProcessCursorQueue(VirtQueue& vq) {
     uint16_t head;
     while (vq.PopAvail(&head)) {
-        std::vector<VirtqChainElem> chain;
+        thread_local VirtqChain chain;
         if (!vq.WalkChain(head, &chain)) {
             vq.PushUsed(head, 0);
             continue;
@@ -237,6 +662,10 @@ void VirtioGpuDevice::ProcessCursorQueue(VirtQueue& vq) {
             bool is_move = (cmd->hdr.type == VIRTIO_GPU_CMD_MOVE_CURSOR);
 
             if (is_update || is_move) {
+                bool moved = cmd->pos.scanout_id != cursor_scanout_id_ ||
+                             static_cast<int32_t>(cmd->pos.x) != cursor_x_ ||
+                             static_cast<int32_t>(cmd->pos.y) != cursor_y_;
+                cursor_scanout_id_ = cmd->pos.scanout_id;
                 cursor_x_ = static_cast<int32_t>(cmd->pos.x);
                 cursor_y_ = static_cast<int32_t>(cmd->pos.y);
 
@@ -246,25 +675,56 @@ void VirtioGpuDevice::ProcessCursorQueue(VirtQueue& vq) {
                     cursor_hot_y_ = cmd->hot_y;
                 }
 
-                if (cursor_callback_) {
-                    CursorInfo info;
-                    info.x = cursor_x_;
-                    info.y = cursor_y_;
-                    info.hot_x = cursor_hot_x_;
-                    info.hot_y = cursor_hot_y_;
-                    info.visible = (cursor_resource_id_ != 0);
-                    info.image_updated = is_update;
-
-                    if (is_update && cursor_resource_id_ != 0) {
-                        auto it = resources_.find(cursor_resource_id_);
-                        if (it != resources_.end()) {
-                            auto& res = it->second;
-                            info.width = res.width;
-                            info.height = res.height;
-                            info.pixels = res.host_pixels;
+                CursorInfo info;
+                info.scanout_id = cursor_scanout_id_;
+                info.x = cursor_x_;
+                info.y = cursor_y_;
+                info.hot_x = cursor_hot_x_;
+                info.hot_y = cursor_hot_y_;
+                info.visible = (cursor_resource_id_ != 0);
+
+                // Guests re-send the same image with UPDATE_CURSOR; only a
+                // different one is copied out.
+                if (is_update && cursor_callback_) {
+                    uint64_t image_id = 0;
+                    std::lock_guard<std::mutex> lock(state_mutex_);
+                    auto it = cursor_resource_id_ ? resources_.find(cursor_resource_id_)
+                                                  : resources_.end();
+                    const uint8_t* pixels = nullptr;
+                    size_t stride = 0, row_bytes = 0;
+                    // A cursor blob is never set on a scanout; guests
+                    // draw it 64x64 ARGB.
+                    if (it != resources_.end() && it->second.blob && it->second.stride == 0 &&
+                        !SetBlobLayout(it->second, 64, 64, VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM,
+                                       64 * 4, 0)) {
+                        it = resources_.end();
+                    }
+                    if (it != resources_.end()) {
+                        auto& res = it->second;
+                        if (res.blob) ReadBlobRows(res, 0, res.width, 0, res.height);
+                        info.width = res.width;
+                        info.height = res.height;
+                        pixels = ResourcePixels(res);
+                        stride = res.stride;
+                        row_bytes = static_cast<size_t>(res.width) * FormatBpp(res.format);
+                        image_id = HashCursorImage(pixels, stride, row_bytes, res.height,
+                                                   cursor_hot_x_, cursor_hot_y_);
+                    }
+                    if (image_id != cursor_image_id_) {
+                        cursor_image_id_ = image_id;
+                        info.image_updated = true;
+                        if (pixels) {
+                            info.pixels.resize(row_bytes * info.height);
+                            for (uint32_t y = 0; y < info.height; ++y) {
+                                std::memcpy(info.pixels.data() + y * row_bytes,
+                                            pixels + y * stride, row_bytes);
+                            }
                         }
                     }
+                }
+                info.image_id = cursor_image_id_;
 
+                if (cursor_callback_ && (moved || info.image_updated)) {
                     cursor_callback_(info);
                 }
             }
@@ -288,11 +748,18 @@ void VirtioGpuDevice::CmdGetDisplayInfo(const VirtioGpuCtrlHdr* hdr,
     auto* info = reinterpret_cast<VirtioGpuRespDisplayInfo*>(resp);
     std::memset(info, 0, sizeof(*info));
     info->hdr.type = VIRTIO_GPU_RESP_OK_DISPLAY_INFO;
-    info->pmodes[0].r.x = 0;
-    info->pmodes[0].r.y = 0;
-    info->pmodes[0].r.width = display_width_;
-    info->pmodes[0].r.height = display_height_;
-    info->pmodes[0].enabled = 1;
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    // Suggest the monitors side by side in scanout order, which is how
+    // the manager maps pointer input across them.
+    uint32_t x = 0;
+    for (uint32_t i = 0; i < num_scanouts_; ++i) {
+        info->pmodes[i].r.x = x;
+        info->pmodes[i].r.y = 0;
+        info->pmodes[i].r.width = display_width_[i];
+        info->pmodes[i].r.height = display_height_[i];
+        info->pmodes[i].enabled = 1;
+        x += display_width_[i];
+    }
     *resp_len = sizeof(VirtioGpuRespDisplayInfo);
 }
 
@@ -314,7 +781,50 @@ void VirtioGpuDevice::CmdResourceCreate2d(const uint8_t* req, uint32_t req_len,
     res.width = cmd->width;
     res.height = cmd->height;
     res.format = cmd->format;
-    res.host_pixels.resize(static_cast<size_t>(cmd->width) * cmd->height * FormatBpp(cmd->format), 0);
+    res.stride = cmd->width * FormatBpp(cmd->format);
+
+    resources_[cmd->resource_id] = std::move(res);
+    WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
+}
+
+void VirtioGpuDevice::CmdResourceCreateBlob(const uint8_t* req, uint32_t req_len,
+                                            uint8_t* resp, uint32_t* resp_len) {
+    if (req_len < sizeof(VirtioGpuResourceCreateBlob)) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
+        return;
+    }
+    auto* cmd = reinterpret_cast<const VirtioGpuResourceCreateBlob*>(req);
+    if (cmd->blob_mem != VIRTIO_GPU_BLOB_MEM_GUEST) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_ERR_UNSPEC, resp_len);
+        return;
+    }
+    uint32_t nr = cmd->nr_entries;
+    uint64_t extra_len = req_len - sizeof(VirtioGpuResourceCreateBlob);
+    if (cmd->resource_id == 0 || cmd->size == 0 || cmd->size > (1ULL << 30) ||
+        nr == 0 || nr > 16384 || extra_len < nr * sizeof(VirtioGpuMemEntry)) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
+        return;
+    }
+
+    GpuResource res;
+    res.id = cmd->resource_id;
+    res.blob = true;
+    res.blob_size = cmd->size;
+    auto* entries = reinterpret_cast<const VirtioGpuMemEntry*>(
+        req + sizeof(VirtioGpuResourceCreateBlob));
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < nr; ++i) {
+        if (entries[i].length == 0 || entries[i].length > 64 * 1024 * 1024) {
+            WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
+            return;
+        }
+        res.backing.push_back({entries[i].addr, entries[i].length});
+        total += entries[i].length;
+    }
+    if (total < cmd->size) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
+        return;
+    }
 
     resources_[cmd->resource_id] = std::move(res);
     WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
@@ -332,8 +842,11 @@ void VirtioGpuDevice::CmdResourceUnref(const uint8_t* req, uint32_t req_len,
         WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID, resp_len);
         return;
     }
-    if (scanout_resource_id_ == cmd->resource_id) {
-        scanout_resource_id_ = 0;
+    for (auto& scanout : scanouts_) {
+        if (scanout.resource_id == cmd->resource_id) {
+            scanout.resource_id = 0;
+            ResetShadow(scanout);
+        }
     }
     resources_.erase(it);
     WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
@@ -346,41 +859,98 @@ void VirtioGpuDevice::CmdSetScanout(const uint8_t* req, uint32_t req_len,
         return;
     }
     auto* cmd = reinterpret_cast<const VirtioGpuSetScanout*>(req);
-    if (cmd->scanout_id != 0) {
+    AssignScanout(cmd->scanout_id, cmd->resource_id, cmd->r, resp, resp_len);
+}
+
+void VirtioGpuDevice::CmdSetScanoutBlob(const uint8_t* req, uint32_t req_len,
+                                          uint8_t* resp, uint32_t* resp_len) {
+    if (req_len < sizeof(VirtioGpuSetScanoutBlob)) {
         WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
         return;
     }
+    auto* cmd = reinterpret_cast<const VirtioGpuSetScanoutBlob*>(req);
+    if (cmd->scanout_id < num_scanouts_ && cmd->resource_id != 0) {
+        auto it = resources_.find(cmd->resource_id);
+        if (it == resources_.end() || !it->second.blob) {
+            WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID, resp_len);
+            return;
+        }
+        // Other scanouts showing this blob hold rects checked against its
+        // current layout, and a rect that does not fit the new one would
+        // be refused only after the layout changed under this scanout.
+        const auto& res = it->second;
+        bool relayout = res.width != cmd->width || res.height != cmd->height ||
+                        res.format != cmd->format || res.stride != cmd->strides[0] ||
+                        res.offset != cmd->offsets[0];
+        bool shared = false;
+        for (uint32_t id = 0; id < num_scanouts_; ++id) {
+            if (id != cmd->scanout_id && scanouts_[id].resource_id == cmd->resource_id) {
+                shared = true;
+            }
+        }
+        if ((relayout && shared) ||
+            static_cast<uint64_t>(cmd->r.x) + cmd->r.width > cmd->width ||
+            static_cast<uint64_t>(cmd->r.y) + cmd->r.height > cmd->height) {
+            WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
+            return;
+        }
+        // Single-plane formats only.
+        if (!SetBlobLayout(it->second, cmd->width, cmd->height, cmd->format,
+                           cmd->strides[0], cmd->offsets[0])) {
+            WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
+            return;
+        }
+    }
+    AssignScanout(cmd->scanout_id, cmd->resource_id, cmd->r, resp, resp_len);
+}
 
-    uint32_t old_resource_id = scanout_resource_id_;
-    uint32_t old_width = scanout_width_;
-    uint32_t old_height = scanout_height_;
+void VirtioGpuDevice::AssignScanout(uint32_t scanout_id, uint32_t resource_id,
+                                    const VirtioGpuRect& r,
+                                    uint8_t* resp, uint32_t* resp_len) {
+    if (scanout_id >= num_scanouts_) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_SCANOUT_ID, resp_len);
+        return;
+    }
+    Scanout& scanout = scanouts_[scanout_id];
 
-    if (cmd->resource_id == 0) {
-        scanout_resource_id_ = 0;
-        scanout_width_ = 0;
-        scanout_height_ = 0;
+    uint32_t old_resource_id = scanout.resource_id;
+    VirtioGpuRect old_rect = scanout.rect;
+
+    if (resource_id == 0) {
+        scanout.resource_id = 0;
+        scanout.rect = {};
+        ResetShadow(scanout);
         WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
         if (old_resource_id != 0 && scanout_state_callback_) {
-            scanout_state_callback_(false, 0, 0);
+            scanout_state_callback_(scanout_id, false, 0, 0);
         }
         return;
     }
-    auto it = resources_.find(cmd->resource_id);
+    auto it = resources_.find(resource_id);
     if (it == resources_.end()) {
         WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID, resp_len);
         return;
     }
-    scanout_resource_id_ = cmd->resource_id;
-    scanout_width_ = it->second.width;
-    scanout_height_ = it->second.height;
+    // Several monitors may show parts of one large resource.
+    if (r.width == 0 || r.height == 0 ||
+        static_cast<uint64_t>(r.x) + r.width > it->second.width ||
+        static_cast<uint64_t>(r.y) + r.height > it->second.height) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER, resp_len);
+        return;
+    }
+    if (resource_id != old_resource_id || r.x != old_rect.x || r.y != old_rect.y) {
+        ResetShadow(scanout);
+    }
+    scanout.resource_id = resource_id;
+    scanout.rect = r;
     WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
 
     // Notify if scanout became active or resolution changed
     if (scanout_state_callback_) {
         bool was_active = (old_resource_id != 0);
-        bool size_changed = (scanout_width_ != old_width || scanout_height_ != old_height);
+        bool size_changed = (r.width != old_rect.width || r.height != old_rect.height);
         if (!was_active || size_changed) {
-            scanout_state_callback_(true, scanout_width_, scanout_height_);
+            scanout_state_callback_(scanout_id, true, r.width, r.height);
         }
     }
 }
@@ -399,6 +969,11 @@ void VirtioGpuDevice::CmdTransferToHost2d(const uint8_t* req, uint32_t req_len,
     }
 
     auto& res = it->second;
+    // Flushes read a blob's guest pages themselves.
+    if (res.blob) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
+        return;
+    }
     uint32_t bpp = FormatBpp(res.format);
     uint32_t stride = res.width * bpp;
 
@@ -415,6 +990,16 @@ void VirtioGpuDevice::CmdTransferToHost2d(const uint8_t* req, uint32_t req_len,
     if (rx + rw > res.width) rw = res.width - rx;
     if (ry + rh > res.height) rh = res.height - ry;
 
+    // Backing laid out like the resource is read in place at flush time.
+    uint64_t natural_offset = static_cast<uint64_t>(ry) * stride +
+                              static_cast<uint64_t>(rx) * bpp;
+    if (res.direct && cmd->offset == natural_offset) {
+        WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
+        return;
+    }
+    DropDirectBacking(res);
+    ResourcePixels(res);
+
     // Compute total backing size for bounds checking
     uint64_t total_backing = 0;
     for (auto& page : res.backing) total_backing += page.length;
@@ -451,52 +1036,54 @@ void VirtioGpuDevice::CmdResourceFlush(const uint8_t* req, uint32_t req_len,
         return;
     }
 
-    // Only flush if this resource is the active scanout
-    if (cmd->resource_id == scanout_resource_id_ && frame_callback_) {
-        auto& res = it->second;
-        uint32_t bpp = FormatBpp(res.format);
-        uint32_t full_stride = res.width * bpp;
-
-        uint32_t dx = cmd->r.x;
-        uint32_t dy = cmd->r.y;
-        uint32_t dw = cmd->r.width;
-        uint32_t dh = cmd->r.height;
-
-        if (dx >= res.width || dy >= res.height) {
-            WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
-            return;
-        }
-        if (dx + dw > res.width) dw = res.width - dx;
-        if (dy + dh > res.height) dh = res.height - dy;
-
-        DisplayFrame frame;
-        frame.format = res.format;
-        frame.resource_width = res.width;
-        frame.resource_height = res.height;
-        frame.dirty_x = dx;
-        frame.dirty_y = dy;
-        frame.width = dw;
-        frame.height = dh;
-        frame.stride = dw * bpp;
-
-        bool full_frame = (dx == 0 && dy == 0 &&
-                           dw == res.width && dh == res.height);
-        if (full_frame) {
-            frame.pixels = res.host_pixels;
-        } else {
-            frame.pixels.resize(static_cast<size_t>(dw) * dh * bpp);
-            for (uint32_t row = 0; row < dh; ++row) {
-                uint64_t src = (static_cast<uint64_t>(dy + row) * full_stride) +
-                               (static_cast<uint64_t>(dx) * bpp);
-                uint64_t dst = static_cast<uint64_t>(row) * dw * bpp;
-                if (src + dw * bpp > res.host_pixels.size()) break;
-                std::memcpy(frame.pixels.data() + dst,
-                            res.host_pixels.data() + src,
-                            dw * bpp);
-            }
+    // Each scanout showing this resource gets the part of the flush that
+    // falls inside it, in its own coordinates. Without a viewer the flush
+    // is only acknowledged; SetFramesWanted() catches up later.
+    auto& res = it->second;
+    for (uint32_t id = 0; id < num_scanouts_ && frame_callback_ && frames_wanted_; ++id) {
+        Scanout& scanout = scanouts_[id];
+        if (scanout.resource_id != cmd->resource_id) continue;
+        const VirtioGpuRect& so = scanout.rect;
+        uint64_t x0 = (std::max)(cmd->r.x, so.x);
+        uint64_t y0 = (std::max)(cmd->r.y, so.y);
+        uint64_t x1 = (std::min)(static_cast<uint64_t>(cmd->r.x) + cmd->r.width,
+                                 static_cast<uint64_t>(so.x) + so.width);
+        uint64_t y1 = (std::min)(static_cast<uint64_t>(cmd->r.y) + cmd->r.height,
+                                 static_cast<uint64_t>(so.y) + so.height);
+        if (x0 >= x1 || y0 >= y1) continue;
+        if (res.blob) {
+            ReadBlobRows(res, static_cast<uint32_t>(x0), static_cast<uint32_t>(x1),
+                         static_cast<uint32_t>(y0), static_cast<uint32_t>(y1));
         }
 
-        frame_callback_(std::move(frame));
+        uint32_t bpp = FormatBpp(res.format);
+        size_t res_stride = res.stride;
+        size_t shadow_stride = static_cast<size_t>(so.width) * bpp;
+        const uint8_t* origin = ResourcePixels(res) + so.y * res_stride +
+                                static_cast<size_t>(so.x) * bpp;
+        VirtioGpuRect dirty{static_cast<uint32_t>(x0 - so.x), static_cast<uint32_t>(y0 - so.y),
+                            static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0)};
+
+        // Drop the tiles the guest redrew unchanged. Frames borrow the
+        // shadow, which the diff has just brought up to date, so what is
+        // sent always matches what later flushes are compared against.
+        // The display port consumes each frame before the callback returns.
+        for (const auto& r : DiffScanout(scanout, origin, res_stride, bpp, dirty)) {
+            DisplayFrame frame;
+            frame.scanout_id = id;
+            frame.format = res.format;
+            frame.resource_width = so.width;
+            frame.resource_height = so.height;
+            frame.dirty_x = r.x;
+            frame.dirty_y = r.y;
+            frame.width = r.width;
+            frame.height = r.height;
+            frame.stride = static_cast<uint32_t>(shadow_stride);
+            frame.data = scanout.shadow.data() + r.y * shadow_stride +
+                         static_cast<size_t>(r.x) * bpp;
+
+            frame_callback_(std::move(frame));
+        }
     }
 
     WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
@@ -517,6 +1104,8 @@ void VirtioGpuDevice::CmdAttachBacking(const uint8_t* req, uint32_t req_len,
     }
 
     auto& res = it->second;
+    if (IsScanoutResource(cmd->resource_id)) DropDirectBacking(res);
+    res.direct = nullptr;
     res.backing.clear();
 
     uint32_t nr = cmd->nr_entries;
@@ -535,6 +1124,7 @@ void VirtioGpuDevice::CmdAttachBacking(const uint8_t* req, uint32_t req_len,
             res.backing.push_back({entries[i].addr, entries[i].length});
         }
     }
+    UpdateDirectBacking(res);
 
     WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
 }
@@ -551,23 +1141,31 @@ void VirtioGpuDevice::CmdDetachBacking(const uint8_t* req, uint32_t req_len,
         WriteResponse(resp, VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID, resp_len);
         return;
     }
+    // The scanout must keep its image once the guest pages go away.
+    if (IsScanoutResource(cmd->resource_id)) DropDirectBacking(it->second);
+    it->second.direct = nullptr;
     it->second.backing.clear();
     WriteResponse(resp, VIRTIO_GPU_RESP_OK_NODATA, resp_len);
 }
 
-void VirtioGpuDevice::SetDisplaySize(uint32_t width, uint32_t height) {
+void VirtioGpuDevice::SetDisplaySize(uint32_t scanout_id, uint32_t width, uint32_t height) {
+    if (scanout_id >= num_scanouts_) return;
     if (width == 0 || height == 0 || width > 16384 || height > 16384) return;
 
     // Align width to 8 pixels for compatibility with GPU and DRM drivers
     width = (width + 7) & ~7u;
 
-    if (width == display_width_ && height == display_height_) return;
+    {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        if (width == display_width_[scanout_id] && height == display_height_[scanout_id])
+            return;
 
-    display_width_ = width;
-    display_height_ = height;
+        display_width_[scanout_id] = width;
+        display_height_[scanout_id] = height;
 
-    // Set VIRTIO_GPU_EVENT_DISPLAY to notify guest that display config changed
-    gpu_config_.events_read |= VIRTIO_GPU_EVENT_DISPLAY;
+        // Set VIRTIO_GPU_EVENT_DISPLAY to notify guest that display config changed
+        gpu_config_.events_read |= VIRTIO_GPU_EVENT_DISPLAY;
+    }
 
     // Trigger config change interrupt so guest re-reads display info
     if (mmio_) {
@@ -2,9 +2,12 @@
 
 #include "common/ports.h"
 #include "core/device/virtio/virtio_mmio.h"
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -17,6 +20,8 @@ constexpr uint32_t VIRTIO_GPU_CMD_RESOURCE_FLUSH        = 0x0104;
 constexpr uint32_t VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D   = 0x0105;
 constexpr uint32_t VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING = 0x0106;
 constexpr uint32_t VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING = 0x0107;
+constexpr uint32_t VIRTIO_GPU_CMD_RESOURCE_CREATE_BLOB  = 0x010c;
+constexpr uint32_t VIRTIO_GPU_CMD_SET_SCANOUT_BLOB      = 0x010d;
 
 // Cursor commands (spec 5.7.6.8)
 constexpr uint32_t VIRTIO_GPU_CMD_UPDATE_CURSOR = 0x0300;
@@ -26,6 +31,7 @@ constexpr uint32_t VIRTIO_GPU_CMD_MOVE_CURSOR   = 0x0301;
 constexpr uint32_t VIRTIO_GPU_RESP_OK_NODATA            = 0x1100;
 constexpr uint32_t VIRTIO_GPU_RESP_OK_DISPLAY_INFO      = 0x1101;
 constexpr uint32_t VIRTIO_GPU_RESP_ERR_UNSPEC           = 0x1200;
+constexpr uint32_t VIRTIO_GPU_RESP_ERR_INVALID_SCANOUT_ID = 0x1201;
 constexpr uint32_t VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID = 0x1202;
 constexpr uint32_t VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER  = 0x1203;
 
@@ -41,6 +47,10 @@ constexpr uint32_t VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM = 134;
 
 // Feature bits
 constexpr uint64_t VIRTIO_GPU_F_EDID = 1ULL << 1;
+constexpr uint64_t VIRTIO_GPU_F_RESOURCE_BLOB = 1ULL << 3;
+
+// Blob memory types; only guest memory is supported
+constexpr uint32_t VIRTIO_GPU_BLOB_MEM_GUEST = 1;
 
 // Config events (spec 5.7.6.1)
 constexpr uint32_t VIRTIO_GPU_EVENT_DISPLAY = 1;
@@ -129,6 +139,29 @@ struct VirtioGpuResourceDetachBacking {
     uint32_t padding;
 };
 
+struct VirtioGpuResourceCreateBlob {
+    VirtioGpuCtrlHdr hdr;
+    uint32_t resource_id;
+    uint32_t blob_mem;
+    uint32_t blob_flags;
+    uint32_t nr_entries;
+    uint64_t blob_id;
+    uint64_t size;
+};
+
+struct VirtioGpuSetScanoutBlob {
+    VirtioGpuCtrlHdr hdr;
+    VirtioGpuRect r;
+    uint32_t scanout_id;
+    uint32_t resource_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t padding;
+    uint32_t strides[4];
+    uint32_t offsets[4];
+};
+
 struct VirtioGpuCursorPos {
     uint32_t scanout_id;
     uint32_t x;
@@ -159,10 +192,13 @@ class VirtioGpuDevice : public VirtioDeviceOps {
 public:
     using FrameCallback = std::function<void(DisplayFrame)>;
     using CursorCallback = std::function<void(const CursorInfo&)>;
-    using ScanoutStateCallback = std::function<void(bool active, uint32_t width, uint32_t height)>;
+    using ScanoutStateCallback = std::function<void(uint32_t scanout_id, bool active,
+                                                    uint32_t width, uint32_t height)>;
 
-    VirtioGpuDevice(uint32_t width, uint32_t height);
-    ~VirtioGpuDevice() override = default;
+    // `num_scanouts` monitors, up to kMaxDisplayScanouts, all starting at
+    // `width` x `height`.
+    VirtioGpuDevice(uint32_t width, uint32_t height, uint32_t num_scanouts = 1);
+    ~VirtioGpuDevice() override;
 
     void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
     void SetMemMap(const GuestMemMap& mem) { mem_ = mem; }
@@ -170,8 +206,19 @@ public:
     void SetCursorCallback(CursorCallback cb) { cursor_callback_ = std::move(cb); }
     void SetScanoutStateCallback(ScanoutStateCallback cb) { scanout_state_callback_ = std::move(cb); }
 
-    // Update display resolution and notify guest to re-query display info
-    void SetDisplaySize(uint32_t width, uint32_t height);
+    // Update a scanout's resolution and notify guest to re-query display info
+    void SetDisplaySize(uint32_t scanout_id, uint32_t width, uint32_t height);
+
+    // Whether anyone is looking at the display. While not, flushes skip the
+    // shadow diff and frame building; turning it back on sends every active
+    // scanout's changes since in one go.
+    void SetFramesWanted(bool wanted);
+
+    // Runs control queue commands on a worker thread, in the order they
+    // were queued, so transfers never hold up the notifying vCPU. Without
+    // it commands run inline. Stop before the callbacks' targets go away.
+    bool StartWorker();
+    void StopWorker();
 
     uint32_t GetDeviceId() const override { return 16; }
     uint64_t GetDeviceFeatures() const override;
@@ -181,6 +228,10 @@ public:
     void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
     void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
     void OnStatusChange(uint32_t new_status) override;
+    // Resources, scanouts and the cursor. Loading announces the active
+    // scanouts and repaints them from the restored resources.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
 
 private:
     struct GpuResource {
@@ -188,25 +239,64 @@ private:
         uint32_t width = 0;
         uint32_t height = 0;
         uint32_t format = 0;
+        // Bytes per row, and where the first row starts in the backing.
+        // 2D resources are packed; a blob gets its layout from the
+        // scanout it is set on.
+        uint32_t stride = 0;
+        uint64_t offset = 0;
+        // Guest memory blob: the backing is the resource, so transfers
+        // are no-ops and flushes read the guest pages.
+        bool blob = false;
+        uint64_t blob_size = 0;
+        // Host copy of the pixels, allocated on the first transfer that
+        // cannot be served from `direct`.
         std::vector<uint8_t> host_pixels;
         struct BackingPage {
             uint64_t gpa;
             uint32_t length;
         };
         std::vector<BackingPage> backing;
+        // Backing that is one contiguous host range laid out like the
+        // resource: pixels are read from guest memory in place and
+        // transfers only have to be validated.
+        const uint8_t* direct = nullptr;
+    };
+
+    // One guest monitor: the part of a resource it shows and what was last
+    // sent of it. A shadow tile is only compared once it is synced, i.e.
+    // its pixels are known to match what was sent.
+    struct Scanout {
+        uint32_t resource_id = 0;
+        VirtioGpuRect rect{};
+        std::vector<uint8_t> shadow;
+        std::vector<uint8_t> shadow_synced;
+        uint32_t shadow_width = 0;
+        uint32_t shadow_height = 0;
     };
 
     void ProcessControlQueue(VirtQueue& vq);
+    // Under state_mutex_. Runs one command chain and pushes its response.
+    void ProcessControlCommand(VirtQueue& vq, uint16_t head);
+    void WorkerThread();
+    // Waits until every queued command has been answered.
+    void DrainWorker();
     void ProcessCursorQueue(VirtQueue& vq);
 
     void CmdGetDisplayInfo(const VirtioGpuCtrlHdr* hdr,
                            uint8_t* resp, uint32_t* resp_len);
     void CmdResourceCreate2d(const uint8_t* req, uint32_t req_len,
                              uint8_t* resp, uint32_t* resp_len);
+    void CmdResourceCreateBlob(const uint8_t* req, uint32_t req_len,
+                               uint8_t* resp, uint32_t* resp_len);
     void CmdResourceUnref(const uint8_t* req, uint32_t req_len,
                           uint8_t* resp, uint32_t* resp_len);
     void CmdSetScanout(const uint8_t* req, uint32_t req_len,
                        uint8_t* resp, uint32_t* resp_len);
+    void CmdSetScanoutBlob(const uint8_t* req, uint32_t req_len,
+                           uint8_t* resp, uint32_t* resp_len);
+    // Points a scanout at `rect` of a resource, or disables it for id 0.
+    void AssignScanout(uint32_t scanout_id, uint32_t resource_id, const VirtioGpuRect& rect,
+                       uint8_t* resp, uint32_t* resp_len);
     void CmdResourceFlush(const uint8_t* req, uint32_t req_len,
                           uint8_t* resp, uint32_t* resp_len);
     void CmdTransferToHost2d(const uint8_t* req, uint32_t req_len,
@@ -221,6 +311,30 @@ private:
     uint8_t* GpaToHva(uint64_t gpa) const;
     void CopyFromBacking(const std::vector<GpuResource::BackingPage>& backing,
                          uint64_t offset, uint32_t length, uint8_t* dst) const;
+    void UpdateDirectBacking(GpuResource& res) const;
+    // Leaves direct mode, keeping the current image in host_pixels.
+    void DropDirectBacking(GpuResource& res) const;
+    // Current pixels of `res`, `stride` bytes per row.
+    const uint8_t* ResourcePixels(GpuResource& res) const;
+    // Gives a blob the layout it is shown with. False if it does not fit.
+    bool SetBlobLayout(GpuResource& res, uint32_t width, uint32_t height, uint32_t format,
+                       uint32_t stride, uint64_t offset) const;
+    // Brings rows [y0, y1), columns [x0, x1) of a blob without direct
+    // backing into host_pixels.
+    void ReadBlobRows(GpuResource& res, uint32_t x0, uint32_t x1,
+                      uint32_t y0, uint32_t y1) const;
+    bool IsScanoutResource(uint32_t resource_id) const;
+    // Compares a flushed rect of the scanout, in scanout coordinates,
+    // against its shadow tile by tile, brings the shadow up to date and
+    // returns the parts that changed. `pixels` is the scanout origin
+    // within a `src_stride`-pitched resource.
+    std::vector<VirtioGpuRect> DiffScanout(Scanout& scanout, const uint8_t* pixels,
+                                           size_t src_stride, uint32_t bpp,
+                                           const VirtioGpuRect& rect);
+    // Forget what was sent, so the next flush goes out whole.
+    static void ResetShadow(Scanout& scanout);
+    // Under state_mutex_. Flushes the whole scanout from its resource.
+    void RepaintScanout(uint32_t scanout_id);
 
     VirtioMmioDevice* mmio_ = nullptr;
     GuestMemMap mem_{};
@@ -228,17 +342,36 @@ private:
     CursorCallback cursor_callback_;
     ScanoutStateCallback scanout_state_callback_;
 
-    uint32_t display_width_;
-    uint32_t display_height_;
+    // Guards the display size and config space, which the runtime
+    // changes from its own thread.
+    std::mutex config_mutex_;
+    const uint32_t num_scanouts_;
+    uint32_t display_width_[kMaxDisplayScanouts]{};
+    uint32_t display_height_[kMaxDisplayScanouts]{};
     VirtioGpuConfig gpu_config_{};
 
-    std::unordered_map<uint32_t, GpuResource> resources_;
-    uint32_t scanout_resource_id_ = 0;
-    uint32_t scanout_width_ = 0;
-    uint32_t scanout_height_ = 0;
+    // Resources and scanout state below, shared by the control queue
+    // worker and cursor updates on the vCPU.
+    std::mutex state_mutex_;
 
-    // Cursor state
+    std::unordered_map<uint32_t, GpuResource> resources_;
+    Scanout scanouts_[kMaxDisplayScanouts];
+    bool frames_wanted_ = true;
+
+    // Control queue heads popped by the vCPU, waiting for the worker.
+    std::thread worker_;
+    std::mutex work_mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<uint16_t> work_;
+    VirtQueue* ctrl_vq_ = nullptr;
+    bool worker_busy_ = false;
+    bool worker_stop_ = false;
+
+    // Cursor state, cursor queue only
     uint32_t cursor_resource_id_ = 0;
+    uint64_t cursor_image_id_ = 0;  // last image handed to cursor_callback_
+    uint32_t cursor_scanout_id_ = 0;
     int32_t cursor_x_ = 0;
     int32_t cursor_y_ = 0;
     uint32_t cursor_hot_x_ = 0;
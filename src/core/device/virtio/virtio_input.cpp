@@ -1,5 +1,6 @@
 #include "core/device/virtio/virtio_input.h"
 #include "core/vmm/types.h"
+#include <algorithm>
 #include <cstring>
 
 #ifndef VIRTIO_F_VERSION_1_DEFINED
@@ -151,7 +152,13 @@ void VirtioInputDevice::WriteConfig(uint32_t offset, uint8_t size, uint32_t valu
 }
 
 void VirtioInputDevice::OnStatusChange(uint32_t new_status) {
-    // Nothing to do
+    if (new_status == 0) {
+        // Reset: the queue and whatever was waiting for it are gone.
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        pending_.clear();
+        last_report_start_ = 0;
+        last_report_motion_ = false;
+    }
 }
 
 void VirtioInputDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
@@ -163,51 +170,105 @@ void VirtioInputDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
         }
     }
     // Queue 0 (eventq): guest provides empty buffers for us to fill.
-    // We don't consume them here; InjectEvent will use them.
+    // Events that were waiting for them go out now; InjectEvents uses the
+    // rest.
+    if (queue_idx == 0) {
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        if (!pending_.empty() && !paused_ && FlushPending(vq)) {
+            mmio_->NotifyUsedBuffer();
+        }
+    }
 }
 
-void VirtioInputDevice::InjectEvent(uint16_t type, uint16_t code,
-                                     uint32_t value, bool notify) {
+void VirtioInputDevice::SaveState(StateWriter& out) {
     std::lock_guard<std::mutex> lock(inject_mutex_);
-    if (!mmio_) return;
+    paused_ = true;
+}
 
-    VirtQueue* vq = mmio_->GetQueue(0);
-    if (!vq || !vq->IsReady()) return;
+void VirtioInputDevice::ResumeAfterSave() {
+    std::lock_guard<std::mutex> lock(inject_mutex_);
+    paused_ = false;
+}
 
-    uint16_t head;
-    if (!vq->PopAvail(&head)) {
-        // Available ring exhausted. If this was the notifying event
-        // (typically SYN_REPORT), still fire the interrupt so the guest
-        // processes already-pushed used buffers and replenishes the ring.
-        // Without this, previously pushed entries sit un-notified and the
-        // guest never recycles buffers -- permanent deadlock.
-        if (notify) {
-            mmio_->NotifyUsedBuffer();
-        }
+namespace {
+
+bool IsMotionReport(std::span<const VirtioInputEvent> report) {
+    for (size_t i = 0; i + 1 < report.size(); i++) {
+        if (report[i].type != EV_ABS) return false;
+    }
+    return report.size() > 1;
+}
+
+}  // namespace
+
+void VirtioInputDevice::QueueReport(std::span<const VirtioInputEvent> report) {
+    bool motion = IsMotionReport(report);
+    if (motion && last_report_motion_ && last_report_start_ < pending_.size()) {
+        // The guest never saw the previous position; skip straight here.
+        pending_.resize(last_report_start_);
+    } else if (pending_.size() + report.size() > kMaxPendingEvents) {
         return;
     }
+    last_report_start_ = pending_.size();
+    last_report_motion_ = motion;
+    pending_.insert(pending_.end(), report.begin(), report.end());
+}
 
-    std::vector<VirtqChainElem> chain;
-    if (!vq->WalkChain(head, &chain)) {
-        vq->PushUsed(head, 0);
-        if (notify) {
-            mmio_->NotifyUsedBuffer();
+bool VirtioInputDevice::FlushPending(VirtQueue& vq) {
+    size_t sent = 0;
+    while (sent < pending_.size()) {
+        uint16_t head;
+        if (!vq.PopAvail(&head)) break;
+
+        thread_local VirtqChain chain;
+        if (!vq.WalkChain(head, &chain)) {
+            vq.PushUsed(head, 0);
+            continue;
         }
-        return;
+
+        const VirtioInputEvent& ev = pending_[sent++];
+        uint32_t written = 0;
+        for (auto& elem : chain) {
+            if (!elem.writable) continue;
+            uint32_t to_copy = (std::min)(elem.len, static_cast<uint32_t>(sizeof(ev) - written));
+            std::memcpy(elem.addr, reinterpret_cast<const uint8_t*>(&ev) + written, to_copy);
+            written += to_copy;
+            if (written >= sizeof(ev)) break;
+        }
+        vq.PushUsed(head, written);
     }
 
-    VirtioInputEvent ev{type, code, value};
-    uint32_t written = 0;
-    for (auto& elem : chain) {
-        if (!elem.writable) continue;
-        uint32_t to_copy = (std::min)(elem.len, static_cast<uint32_t>(sizeof(ev) - written));
-        std::memcpy(elem.addr, reinterpret_cast<const uint8_t*>(&ev) + written, to_copy);
-        written += to_copy;
-        if (written >= sizeof(ev)) break;
+    pending_.erase(pending_.begin(), pending_.begin() + sent);
+    if (last_report_start_ >= sent) {
+        last_report_start_ -= sent;
+    } else {
+        // Part of the last report is with the guest already, so the rest
+        // must follow as it is.
+        last_report_start_ = pending_.size();
+        last_report_motion_ = false;
     }
+    return sent > 0;
+}
+
+void VirtioInputDevice::InjectEvents(std::span<const VirtioInputEvent> events) {
+    std::lock_guard<std::mutex> lock(inject_mutex_);
+    if (!mmio_ || paused_ || events.empty()) return;
+
+    VirtQueue* vq = mmio_->GetQueue(0);
+    if (!vq || !vq->IsReady()) return;
 
-    vq->PushUsed(head, written);
-    if (notify) {
-        mmio_->NotifyUsedBuffer();
+    // Report by report, so motion only coalesces once the guest is behind.
+    size_t start = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        if (i + 1 == events.size() ||
+            (events[i].type == EV_SYN && events[i].code == SYN_REPORT)) {
+            QueueReport(events.subspan(start, i + 1 - start));
+            FlushPending(*vq);
+            start = i + 1;
+        }
     }
+
+    // Interrupt even when the ring is exhausted, so the guest processes
+    // what it already has and hands the buffers back.
+    mmio_->NotifyUsedBuffer();
 }
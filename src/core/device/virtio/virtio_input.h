@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <functional>
 #include <mutex>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -89,13 +90,11 @@ public:
 
     void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
 
-    // Inject a single evdev event. Caller should follow a group of events
-    // with InjectEvent(EV_SYN, SYN_REPORT, 0).
-    // When |notify| is false the used-buffer interrupt is deferred; the caller
-    // must eventually call InjectEvent with notify=true (typically for
-    // SYN_REPORT) to deliver the batched interrupt to the guest.
-    void InjectEvent(uint16_t type, uint16_t code, uint32_t value,
-                     bool notify = true);
+    // Injects one or more evdev reports, each ending in SYN_REPORT, under
+    // one lock and with one interrupt. Events the guest has no buffers for
+    // wait until it adds some; while they wait, a pointer report that only
+    // moves replaces the previous one instead of queueing behind it.
+    void InjectEvents(std::span<const VirtioInputEvent> events);
 
     uint32_t GetDeviceId() const override { return 18; }
     uint64_t GetDeviceFeatures() const override;
@@ -105,12 +104,27 @@ public:
     void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
     void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
     void OnStatusChange(uint32_t new_status) override;
+    // No state of its own; events injected while saving are dropped.
+    void SaveState(StateWriter& out) override;
+    void ResumeAfterSave() override;
 
 private:
+    // Waiting events beyond this are dropped, whole reports at a time.
+    static constexpr size_t kMaxPendingEvents = 1024;
+
     void UpdateConfigData();
+    // Appends one report to pending_, coalescing motion. Needs inject_mutex_.
+    void QueueReport(std::span<const VirtioInputEvent> report);
+    // Fills guest buffers from pending_. Needs inject_mutex_. Returns
+    // whether any buffer was used.
+    bool FlushPending(VirtQueue& vq);
 
     SubType sub_type_;
     VirtioMmioDevice* mmio_ = nullptr;
     VirtioInputConfig config_{};
     std::mutex inject_mutex_;
+    std::vector<VirtioInputEvent> pending_;
+    size_t last_report_start_ = 0;    // in pending_
+    bool last_report_motion_ = false;  // only EV_ABS before its SYN_REPORT
+    bool paused_ = false;
 };
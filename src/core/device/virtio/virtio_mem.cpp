@@ -0,0 +1,255 @@
+#include "core/device/virtio/virtio_mem.h"
+#include <algorithm>
+#include <cstring>
+
+#define NOMINMAX
+#include <windows.h>
+
+namespace {
+
+constexpr uint64_t kBitsPerWord = 64;
+
+}  // namespace
+
+VirtioMemDevice::~VirtioMemDevice() {
+    if (hva_) VirtualFree(hva_, 0, MEM_RELEASE);
+}
+
+bool VirtioMemDevice::Reserve(GPA base, uint64_t size, MapCallback map,
+                              UnmapCallback unmap) {
+    if (!size || (base | size) & (kHotplugBlockSize - 1)) {
+        LOG_ERROR("virtio-mem: region 0x%llX+0x%llX is not block aligned", base, size);
+        return false;
+    }
+    hva_ = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE,
+                                              PAGE_READWRITE));
+    if (!hva_) {
+        LOG_ERROR("virtio-mem: failed to reserve %llu MB (%lu)", size >> 20,
+                  GetLastError());
+        return false;
+    }
+    base_ = base;
+    region_size_ = size;
+    block_count_ = size / kHotplugBlockSize;
+    map_ = std::move(map);
+    unmap_ = std::move(unmap);
+
+    uint64_t words = (block_count_ + kBitsPerWord - 1) / kBitsPerWord;
+    plugged_ = std::make_unique<std::atomic<uint64_t>[]>(words);
+    for (uint64_t i = 0; i < words; i++) {
+        plugged_[i].store(0, std::memory_order_relaxed);
+    }
+
+    config_.block_size = kHotplugBlockSize;
+    config_.addr = base;
+    config_.region_size = size;
+    config_.usable_region_size = size;
+    LOG_INFO("virtio-mem: %llu MB hotpluggable at 0x%llX", size >> 20, base);
+    return true;
+}
+
+void VirtioMemDevice::DescribeRegion(GuestMemMap* mem) const {
+    mem->hotplug_base = base_;
+    mem->hotplug_size = region_size_;
+    mem->hotplug_hva = hva_;
+    mem->hotplug_plugged = plugged_.get();
+}
+
+uint64_t VirtioMemDevice::GetDeviceFeatures() const {
+    return VIRTIO_MEM_F_VERSION_1 | VIRTIO_MEM_F_UNPLUGGED_INACCESSIBLE;
+}
+
+void VirtioMemDevice::SetRequestedSize(uint64_t bytes) {
+    bytes = std::min(AlignDown(bytes, kHotplugBlockSize), region_size_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (config_.requested_size == bytes) return;
+        config_.requested_size = bytes;
+    }
+    if (mmio_) mmio_->NotifyConfigChange();
+}
+
+uint64_t VirtioMemDevice::RequestedSize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_.requested_size;
+}
+
+uint64_t VirtioMemDevice::PluggedSize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_.plugged_size;
+}
+
+bool VirtioMemDevice::BlockRange(uint64_t addr, uint64_t nb_blocks,
+                                 uint64_t* first) const {
+    if (!nb_blocks || addr < base_ || (addr - base_) % kHotplugBlockSize) return false;
+    uint64_t block = (addr - base_) / kHotplugBlockSize;
+    if (block >= block_count_ || nb_blocks > block_count_ - block) return false;
+    *first = block;
+    return true;
+}
+
+bool VirtioMemDevice::BlockPlugged(uint64_t block) const {
+    uint64_t word = plugged_[block / kBitsPerWord].load(std::memory_order_relaxed);
+    return (word >> (block % kBitsPerWord)) & 1;
+}
+
+uint64_t VirtioMemDevice::CountPlugged(uint64_t first, uint64_t count) const {
+    uint64_t plugged = 0;
+    for (uint64_t b = first; b < first + count; b++) {
+        if (BlockPlugged(b)) plugged++;
+    }
+    return plugged;
+}
+
+uint16_t VirtioMemDevice::Plug(uint64_t first, uint64_t count) {
+    uint64_t bytes = count * kHotplugBlockSize;
+    if (CountPlugged(first, count) != 0 ||
+        config_.plugged_size + bytes > config_.requested_size) {
+        return VIRTIO_MEM_RESP_NACK;
+    }
+
+    GPA gpa = base_ + first * kHotplugBlockSize;
+    uint8_t* hva = hva_ + first * kHotplugBlockSize;
+    if (!VirtualAlloc(hva, bytes, MEM_COMMIT, PAGE_READWRITE)) {
+        LOG_WARN("virtio-mem: commit of %llu MB failed (%lu)", bytes >> 20,
+                 GetLastError());
+        return VIRTIO_MEM_RESP_BUSY;
+    }
+    if (map_ && !map_(gpa, hva, bytes)) {
+        VirtualFree(hva, bytes, MEM_DECOMMIT);
+        return VIRTIO_MEM_RESP_ERROR;
+    }
+    for (uint64_t b = first; b < first + count; b++) {
+        plugged_[b / kBitsPerWord].fetch_or(1ULL << (b % kBitsPerWord),
+                                            std::memory_order_release);
+    }
+    config_.plugged_size += bytes;
+    return VIRTIO_MEM_RESP_ACK;
+}
+
+void VirtioMemDevice::Unplug(uint64_t first, uint64_t count) {
+    // Runs of plugged blocks go out of the partition and the commit
+    // together. Bits are cleared first so devices stop translating them.
+    uint64_t b = first;
+    while (b < first + count) {
+        if (!BlockPlugged(b)) {
+            b++;
+            continue;
+        }
+        uint64_t run = b;
+        while (b < first + count && BlockPlugged(b)) {
+            plugged_[b / kBitsPerWord].fetch_and(~(1ULL << (b % kBitsPerWord)),
+                                                 std::memory_order_release);
+            b++;
+        }
+        uint64_t bytes = (b - run) * kHotplugBlockSize;
+        if (unmap_) unmap_(base_ + run * kHotplugBlockSize, bytes);
+        VirtualFree(hva_ + run * kHotplugBlockSize, bytes, MEM_DECOMMIT);
+        config_.plugged_size -= bytes;
+    }
+}
+
+VirtioMemResp VirtioMemDevice::HandleRequest(const VirtioMemReq& req) {
+    VirtioMemResp resp{};
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t first = 0;
+    switch (req.type) {
+    case VIRTIO_MEM_REQ_PLUG:
+        resp.type = BlockRange(req.addr, req.nb_blocks, &first)
+            ? Plug(first, req.nb_blocks) : VIRTIO_MEM_RESP_ERROR;
+        break;
+    case VIRTIO_MEM_REQ_UNPLUG:
+        if (!BlockRange(req.addr, req.nb_blocks, &first)) {
+            resp.type = VIRTIO_MEM_RESP_ERROR;
+        } else if (CountPlugged(first, req.nb_blocks) != req.nb_blocks) {
+            resp.type = VIRTIO_MEM_RESP_ERROR;
+        } else {
+            Unplug(first, req.nb_blocks);
+            resp.type = VIRTIO_MEM_RESP_ACK;
+        }
+        break;
+    case VIRTIO_MEM_REQ_UNPLUG_ALL:
+        Unplug(0, block_count_);
+        resp.type = VIRTIO_MEM_RESP_ACK;
+        break;
+    case VIRTIO_MEM_REQ_STATE:
+        if (!BlockRange(req.addr, req.nb_blocks, &first)) {
+            resp.type = VIRTIO_MEM_RESP_ERROR;
+            break;
+        }
+        {
+            uint64_t plugged = CountPlugged(first, req.nb_blocks);
+            resp.type = VIRTIO_MEM_RESP_ACK;
+            resp.state = plugged == 0 ? VIRTIO_MEM_STATE_UNPLUGGED
+                : plugged == req.nb_blocks ? VIRTIO_MEM_STATE_PLUGGED
+                : VIRTIO_MEM_STATE_MIXED;
+        }
+        break;
+    default:
+        resp.type = VIRTIO_MEM_RESP_ERROR;
+        break;
+    }
+    return resp;
+}
+
+void VirtioMemDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
+    if (queue_idx != 0) return;
+    uint16_t head;
+    bool pushed = false;
+    bool changed = false;
+    while (vq.PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        uint32_t written = 0;
+        if (vq.WalkChain(head, &chain)) {
+            VirtioMemReq req{};
+            uint32_t have = 0;
+            VirtqChainElem* status = nullptr;
+            for (auto& elem : chain) {
+                if (elem.writable) {
+                    if (!status) status = &elem;
+                    continue;
+                }
+                uint32_t n = std::min<uint32_t>(elem.len, sizeof(req) - have);
+                std::memcpy(reinterpret_cast<uint8_t*>(&req) + have, elem.addr, n);
+                have += n;
+            }
+            if (have == sizeof(req) && status && status->len >= sizeof(VirtioMemResp)) {
+                VirtioMemResp resp = HandleRequest(req);
+                std::memcpy(status->addr, &resp, sizeof(resp));
+                written = sizeof(resp);
+                changed |= resp.type == VIRTIO_MEM_RESP_ACK &&
+                           req.type != VIRTIO_MEM_REQ_STATE;
+            }
+        }
+        vq.PushUsed(head, written);
+        pushed = true;
+    }
+    if (pushed && mmio_) mmio_->NotifyUsedBuffer();
+    if (changed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        LOG_INFO("virtio-mem: %llu of %llu MB plugged", config_.plugged_size >> 20,
+                 config_.requested_size >> 20);
+    }
+}
+
+void VirtioMemDevice::ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) {
+    *value = 0;
+    if (offset + size > sizeof(config_)) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::memcpy(value, reinterpret_cast<const uint8_t*>(&config_) + offset, size);
+}
+
+void VirtioMemDevice::SaveState(StateWriter& out) {
+    // The VM only snapshots with nothing plugged, so the request is all
+    // there is to keep.
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.Put(config_.requested_size);
+}
+
+bool VirtioMemDevice::LoadState(StateReader& in) {
+    uint64_t requested = 0;
+    if (!in.Get(&requested)) return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_.requested_size = std::min(requested, region_size_);
+    return true;
+}
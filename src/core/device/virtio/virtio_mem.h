@@ -0,0 +1,134 @@
+#pragma once
+
+#include "core/device/virtio/virtio_mmio.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// virtio-mem device ID (spec 5.15)
+constexpr uint32_t VIRTIO_MEM_DEVICE_ID = 24;
+
+// Feature bits
+constexpr uint64_t VIRTIO_MEM_F_UNPLUGGED_INACCESSIBLE = 1ULL << 1;
+constexpr uint64_t VIRTIO_MEM_F_VERSION_1              = 1ULL << 32;
+
+// Request types
+constexpr uint16_t VIRTIO_MEM_REQ_PLUG       = 0;
+constexpr uint16_t VIRTIO_MEM_REQ_UNPLUG     = 1;
+constexpr uint16_t VIRTIO_MEM_REQ_UNPLUG_ALL = 2;
+constexpr uint16_t VIRTIO_MEM_REQ_STATE      = 3;
+
+// Response types
+constexpr uint16_t VIRTIO_MEM_RESP_ACK   = 0;
+constexpr uint16_t VIRTIO_MEM_RESP_NACK  = 1;
+constexpr uint16_t VIRTIO_MEM_RESP_BUSY  = 2;
+constexpr uint16_t VIRTIO_MEM_RESP_ERROR = 3;
+
+// VIRTIO_MEM_REQ_STATE results
+constexpr uint16_t VIRTIO_MEM_STATE_PLUGGED   = 0;
+constexpr uint16_t VIRTIO_MEM_STATE_UNPLUGGED = 1;
+constexpr uint16_t VIRTIO_MEM_STATE_MIXED     = 2;
+
+#pragma pack(push, 1)
+struct VirtioMemConfig {
+    uint64_t block_size;
+    uint16_t node_id;
+    uint8_t  padding[6];
+    uint64_t addr;
+    uint64_t region_size;
+    uint64_t usable_region_size;
+    uint64_t plugged_size;
+    uint64_t requested_size;
+};
+
+struct VirtioMemReq {
+    uint16_t type;
+    uint16_t padding[3];
+    uint64_t addr;       // PLUG, UNPLUG and STATE
+    uint16_t nb_blocks;
+    uint16_t padding2[3];
+};
+
+struct VirtioMemResp {
+    uint16_t type;
+    uint16_t padding[3];
+    uint16_t state;      // STATE
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VirtioMemConfig) == 56);
+static_assert(sizeof(VirtioMemReq) == 24);
+static_assert(sizeof(VirtioMemResp) == 10);
+
+// Memory hotplug. The device owns a guest physical region above RAM whose
+// host address space is reserved up front but not committed. The host sets
+// how much of it the guest should use; the guest plugs and unplugs
+// kHotplugBlockSize blocks through the one request queue to match. A block
+// is committed and mapped into the partition when plugged, unmapped and
+// decommitted when unplugged, so the host pays only for what is plugged,
+// and the guest cannot touch anything else.
+//
+// Plugged memory is not part of guest RAM as snapshots and migrations
+// copy it, so the VM refuses those while any is plugged.
+class VirtioMemDevice : public VirtioDeviceOps {
+public:
+    using MapCallback = std::function<bool(GPA gpa, void* hva, uint64_t size)>;
+    using UnmapCallback = std::function<void(GPA gpa, uint64_t size)>;
+
+    VirtioMemDevice() = default;
+    ~VirtioMemDevice() override;
+
+    // Reserves host address space for [base, base + size), which must be
+    // block aligned. `map` and `unmap` put blocks in and out of the
+    // partition.
+    bool Reserve(GPA base, uint64_t size, MapCallback map, UnmapCallback unmap);
+    // Makes `mem` translate plugged blocks of the region.
+    void DescribeRegion(GuestMemMap* mem) const;
+    void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
+
+    // Asks the guest to have `bytes` plugged, rounded down to whole blocks
+    // and capped at the region.
+    void SetRequestedSize(uint64_t bytes);
+    uint64_t RequestedSize() const;
+    uint64_t PluggedSize() const;
+    uint64_t RegionSize() const { return region_size_; }
+
+    uint32_t GetDeviceId() const override { return VIRTIO_MEM_DEVICE_ID; }
+    uint64_t GetDeviceFeatures() const override;
+    uint32_t GetNumQueues() const override { return 1; }
+    uint32_t GetQueueMaxSize(uint32_t queue_idx) const override { return 128; }
+    void OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) override;
+    void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
+    void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override {}
+    void OnStatusChange(uint32_t new_status) override {}
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+
+private:
+    // Block index of `addr` if [addr, addr + nb_blocks blocks) lies in the
+    // region, block aligned.
+    bool BlockRange(uint64_t addr, uint64_t nb_blocks, uint64_t* first) const;
+    bool BlockPlugged(uint64_t block) const;
+    // Plugged blocks in [first, first + count).
+    uint64_t CountPlugged(uint64_t first, uint64_t count) const;
+    VirtioMemResp HandleRequest(const VirtioMemReq& req);
+    uint16_t Plug(uint64_t first, uint64_t count);
+    void Unplug(uint64_t first, uint64_t count);
+
+    VirtioMmioDevice* mmio_ = nullptr;
+    MapCallback map_;
+    UnmapCallback unmap_;
+    GPA base_ = 0;
+    uint64_t region_size_ = 0;
+    uint64_t block_count_ = 0;
+    uint8_t* hva_ = nullptr;
+    // One bit per block; set once the block is usable, cleared before it
+    // goes. GuestMemMap::GpaToHva reads it from the device threads.
+    std::unique_ptr<std::atomic<uint64_t>[]> plugged_;
+
+    // Requests run one at a time; the host changes requested_size.
+    mutable std::mutex mutex_;
+    VirtioMemConfig config_{};
+};
@@ -1,4 +1,13 @@
 #include "core/device/virtio/virtio_mmio.h"
+#include "core/vmm/etw.h"
+#include <bit>
+
+#include <windows.h>
+
+VirtioMmioDevice::~VirtioMmioDevice() {
+    StopNotifyThread();
+    StopInterruptModeration();
+}
 
 void VirtioMmioDevice::Init(VirtioDeviceOps* ops, const GuestMemMap& mem) {
     ops_ = ops;
@@ -28,6 +37,40 @@ void VirtioMmioDevice::DoReset() {
     }
 }
 
+uint64_t VirtioMmioDevice::OfferedFeatures() const {
+    // EVENT_IDX lives entirely in the rings, so every device gets it.
+    return ops_->GetDeviceFeatures() | VIRTIO_RING_F_EVENT_IDX;
+}
+
+void VirtioMmioDevice::SetQueueNum(uint32_t queue_idx, uint32_t num) {
+    uint32_t max = ops_->GetQueueMaxSize(queue_idx);
+    if (num > max) {
+        LOG_WARN("VirtIO queue %u: size %u exceeds the maximum %u, ignored",
+                 queue_idx, num, max);
+        return;
+    }
+    queue_configs_[queue_idx].num = num;
+}
+
+void VirtioMmioDevice::EnableQueue(uint32_t queue_idx) {
+    auto& cfg = queue_configs_[queue_idx];
+    auto& vq = queues_[queue_idx];
+    uint32_t qs = cfg.num ? cfg.num : ops_->GetQueueMaxSize(queue_idx);
+    vq.Setup(qs, mem_);
+    vq.SetDescAddr(cfg.desc_addr);
+    vq.SetDriverAddr(cfg.driver_addr);
+    vq.SetDeviceAddr(cfg.device_addr);
+    vq.SetEventIdx((driver_features_ & VIRTIO_RING_F_EVENT_IDX) != 0);
+    vq.SetPacked((driver_features_ & VIRTIO_F_RING_PACKED) != 0);
+    vq.SetReady(true);
+    LOG_INFO("VirtIO queue %u ready: size=%u%s desc=0x%llX "
+             "driver=0x%llX device=0x%llX",
+             queue_idx, qs,
+             (driver_features_ & VIRTIO_F_RING_PACKED) ? " packed" : "",
+             cfg.desc_addr,
+             cfg.driver_addr, cfg.device_addr);
+}
+
 void VirtioMmioDevice::MmioRead(uint64_t offset, uint8_t size,
                                   uint64_t* value) {
     uint32_t val = 0;
@@ -51,11 +94,9 @@ void VirtioMmioDevice::MmioRead(uint64_t offset, uint8_t size,
     case kVendorID:
         val = kVendorId;
         break;
-    case kDeviceFeatures: {
-        uint64_t features = ops_->GetDeviceFeatures();
-        val = static_cast<uint32_t>(features >> (device_features_sel_ * 32));
+    case kDeviceFeatures:
+        val = static_cast<uint32_t>(OfferedFeatures() >> (device_features_sel_ * 32));
         break;
-    }
     case kQueueNumMax:
         if (queue_sel_ < queues_.size())
             val = ops_->GetQueueMaxSize(queue_sel_);
@@ -76,11 +117,20 @@ void VirtioMmioDevice::MmioRead(uint64_t offset, uint8_t size,
     case kSHMLenLow:
     case kSHMLenHigh:
     case kSHMBaseLow:
-    case kSHMBaseHigh:
-        // No shared memory regions supported — return all-ones so the
-        // kernel's virtio_get_shm_region() interprets this as "not present".
-        val = 0xFFFFFFFF;
+    case kSHMBaseHigh: {
+        // All-ones makes the kernel's virtio_get_shm_region() treat the
+        // selected region as not present.
+        uint64_t base = 0, len = 0;
+        if (!ops_->GetShmRegion(shm_sel_, &base, &len)) {
+            val = 0xFFFFFFFF;
+            break;
+        }
+        bool is_len = offset == kSHMLenLow || offset == kSHMLenHigh;
+        bool high = offset == kSHMLenHigh || offset == kSHMBaseHigh;
+        uint64_t v = is_len ? len : base;
+        val = static_cast<uint32_t>(high ? v >> 32 : v);
         break;
+    }
     default:
         LOG_DEBUG("VirtIO MMIO: unhandled read offset=0x%03X", (uint32_t)offset);
         break;
@@ -116,42 +166,29 @@ void VirtioMmioDevice::MmioWrite(uint64_t offset, uint8_t size,
         queue_sel_ = val;
         break;
     case kQueueNum:
-        if (queue_sel_ < queue_configs_.size())
-            queue_configs_[queue_sel_].num = val;
+        if (queue_sel_ < queue_configs_.size()) SetQueueNum(queue_sel_, val);
         break;
     case kQueueReady:
         if (queue_sel_ < queues_.size()) {
             if (val == 1) {
-                auto& cfg = queue_configs_[queue_sel_];
-                auto& vq = queues_[queue_sel_];
-                uint32_t qs = cfg.num ? cfg.num
-                                      : ops_->GetQueueMaxSize(queue_sel_);
-                vq.Setup(qs, mem_);
-                vq.SetDescAddr(cfg.desc_addr);
-                vq.SetDriverAddr(cfg.driver_addr);
-                vq.SetDeviceAddr(cfg.device_addr);
-                vq.SetReady(true);
-                LOG_INFO("VirtIO queue %u ready: size=%u desc=0x%llX "
-                         "driver=0x%llX device=0x%llX",
-                         queue_sel_, qs, cfg.desc_addr,
-                         cfg.driver_addr, cfg.device_addr);
+                EnableQueue(queue_sel_);
             } else {
                 queues_[queue_sel_].SetReady(false);
             }
         }
         break;
     case kQueueNotify:
-        if (val < queues_.size() && queues_[val].IsReady()) {
-            ops_->OnQueueNotify(val, queues_[val]);
-        }
+        NotifyQueue(val);
         break;
     case kInterruptACK:
         interrupt_status_.fetch_and(~val, std::memory_order_acq_rel);
         break;
     case kStatus:
         if (val == 0) {
-            DoReset();
+            // Let the device quiesce background work that still touches
+            // the rings before the transport forgets their addresses.
             ops_->OnStatusChange(0);
+            DoReset();
         } else {
             status_ = val;
             ops_->OnStatusChange(val);
@@ -200,13 +237,211 @@ void VirtioMmioDevice::MmioWrite(uint64_t offset, uint8_t size,
     }
 }
 
+void VirtioMmioDevice::SaveState(StateWriter& out) {
+    // Doorbells latched before the vCPUs stopped are handled now; taking
+    // the lock also waits out the notify thread if it is running one.
+    {
+        std::lock_guard<std::mutex> lock(*IoLock());
+        uint64_t pending = pending_notify_.exchange(0, std::memory_order_acq_rel);
+        while (pending) {
+            uint32_t idx = static_cast<uint32_t>(std::countr_zero(pending));
+            pending &= pending - 1;
+            NotifyQueue(idx);
+        }
+    }
+    // The device finishes what is in flight before the rings are saved,
+    // and is loaded after them.
+    StateWriter device;
+    ops_->SaveState(device);
+
+    out.Put(status_);
+    out.Put(device_features_sel_);
+    out.Put(driver_features_sel_);
+    out.Put(driver_features_);
+    out.Put(queue_sel_);
+    out.Put(interrupt_status_.load(std::memory_order_acquire));
+    out.Put(config_generation_);
+    out.Put(shm_sel_);
+    out.Put(static_cast<uint32_t>(queues_.size()));
+    for (uint32_t i = 0; i < queues_.size(); i++) {
+        out.Put(queue_configs_[i]);
+        queues_[i].SaveState(out);
+    }
+    out.PutVector(device.data());
+}
+
+bool VirtioMmioDevice::LoadState(StateReader& in) {
+    uint32_t interrupt_status = 0, num_queues = 0;
+    in.Get(&status_);
+    in.Get(&device_features_sel_);
+    in.Get(&driver_features_sel_);
+    in.Get(&driver_features_);
+    in.Get(&queue_sel_);
+    in.Get(&interrupt_status);
+    in.Get(&config_generation_);
+    in.Get(&shm_sel_);
+    in.Get(&num_queues);
+    if (!in.ok() || num_queues != queues_.size()) return false;
+    interrupt_status_.store(interrupt_status, std::memory_order_relaxed);
+
+    for (uint32_t i = 0; i < num_queues; i++) {
+        in.Get(&queue_configs_[i]);
+        if (!queues_[i].LoadState(in, mem_)) return false;
+    }
+    std::vector<uint8_t> device;
+    if (!in.GetVector(&device)) return false;
+    // Lets the device arm what the driver enabled, as on a first boot.
+    if (status_) ops_->OnStatusChange(status_);
+    StateReader device_in(device);
+    if (!ops_->LoadState(device_in)) return false;
+
+    // A doorbell latched but not yet handled at save time is gone, and so
+    // is an interrupt the moderator was holding. Kicking each ready queue
+    // and repeating a pending interrupt covers both; spurious ones are
+    // harmless to virtio drivers.
+    for (uint32_t i = 0; i < num_queues; i++) NotifyQueue(i);
+    RepeatInterrupts();
+    return true;
+}
+
+void VirtioMmioDevice::RepeatInterrupts() {
+    if (interrupt_status_.load(std::memory_order_acquire) && irq_callback_) irq_callback_();
+}
+
+void VirtioMmioDevice::NotifyQueue(uint32_t queue_idx) {
+    if (queue_idx < queues_.size() && queues_[queue_idx].IsReady()) {
+        if (etw::VmmEnabled(etw::kKeywordVirtqueue)) etw::QueueKick(ops_->GetDeviceId(), queue_idx);
+        ops_->OnQueueNotify(queue_idx, queues_[queue_idx]);
+    }
+}
+
+bool VirtioMmioDevice::StartNotifyThread() {
+    if (notify_thread_.joinable()) return true;
+    if (queues_.size() > 64) return false;
+
+    HANDLE event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!event) {
+        LOG_ERROR("VirtIO MMIO: CreateEvent failed (%lu)", GetLastError());
+        return false;
+    }
+    notify_event_ = event;
+    notify_stop_.store(false, std::memory_order_relaxed);
+    notify_thread_ = std::thread(&VirtioMmioDevice::NotifyThreadFunc, this);
+    return true;
+}
+
+bool VirtioMmioDevice::AttachIoThread(IoThread* io_thread) {
+    if (io_thread_ || notify_thread_.joinable()) return io_thread_ == io_thread;
+    if (queues_.size() > 64) return false;
+    int source = io_thread->AddSource([this]() { DrainNotifies(); });
+    if (source < 0) return false;
+    io_source_ = static_cast<uint32_t>(source);
+    io_thread_ = io_thread;
+    return true;
+}
+
+void VirtioMmioDevice::StopNotifyThread() {
+    if (!notify_thread_.joinable()) return;
+    notify_stop_.store(true, std::memory_order_release);
+    SetEvent(reinterpret_cast<HANDLE>(notify_event_));
+    notify_thread_.join();
+    CloseHandle(reinterpret_cast<HANDLE>(notify_event_));
+    notify_event_ = nullptr;
+}
+
+void VirtioMmioDevice::SignalIoEvent(uint64_t value) {
+    // Out-of-range writes are dropped, exactly as MmioWrite() would.
+    if (value >= queues_.size()) return;
+    uint64_t bit = 1ULL << value;
+    // Only the first doorbell since the thread last looked needs a wake-up.
+    if (!(pending_notify_.fetch_or(bit, std::memory_order_acq_rel) & bit)) {
+        if (io_thread_) {
+            io_thread_->Kick(io_source_);
+        } else {
+            SetEvent(reinterpret_cast<HANDLE>(notify_event_));
+        }
+    }
+}
+
+void VirtioMmioDevice::NotifyThreadFunc() {
+    HANDLE event = reinterpret_cast<HANDLE>(notify_event_);
+    while (!notify_stop_.load(std::memory_order_acquire)) {
+        WaitForSingleObject(event, INFINITE);
+        DrainNotifies();
+    }
+}
+
+void VirtioMmioDevice::DrainNotifies() {
+    uint64_t pending = pending_notify_.exchange(0, std::memory_order_acq_rel);
+    if (!pending) return;
+
+    // Same lock the vCPU path holds, so transport state stays coherent
+    // with concurrent register accesses and resets.
+    std::lock_guard<std::mutex> lock(*IoLock());
+    while (pending) {
+        uint32_t idx = static_cast<uint32_t>(std::countr_zero(pending));
+        pending &= pending - 1;
+        NotifyQueue(idx);
+    }
+}
+
 void VirtioMmioDevice::NotifyUsedBuffer() {
+    // Packed rings always carry driver event suppression flags.
+    bool suppressed = (driver_features_ & (VIRTIO_RING_F_EVENT_IDX | VIRTIO_F_RING_PACKED)) != 0;
+    // Every queue must be checked so each one records what it signalled.
+    uint64_t queues = 0;
+    for (uint32_t i = 0; i < queues_.size() && i < 64; i++) {
+        auto& vq = queues_[i];
+        if (vq.IsReady() && (suppressed ? vq.ShouldNotify() : vq.UsedSinceSignal())) {
+            queues |= 1ULL << i;
+        }
+    }
+    // Without suppression the line is raised regardless, as it always was.
+    if (!queues && suppressed) return;
+    if (etw::VmmEnabled(etw::kKeywordVirtqueue)) etw::QueueComplete(ops_->GetDeviceId(), queues);
+    pending_used_.fetch_or(queues, std::memory_order_acq_rel);
+
+    if (moderator_.IsRunning()) {
+        moderator_.Notify();
+        return;
+    }
+    RaiseUsedInterrupt();
+}
+
+void VirtioMmioDevice::RaiseUsedInterrupt() {
+    SignalUsed(pending_used_.exchange(0, std::memory_order_acq_rel));
+}
+
+void VirtioMmioDevice::SignalUsed(uint64_t /*queues*/) {
     interrupt_status_.fetch_or(1, std::memory_order_release);  // VIRTIO_MMIO_INT_VRING
     if (irq_callback_) irq_callback_();
 }
 
-void VirtioMmioDevice::NotifyConfigChange() {
-    config_generation_++;
+void VirtioMmioDevice::SignalConfig() {
     interrupt_status_.fetch_or(2, std::memory_order_release);  // VIRTIO_MMIO_INT_CONFIG
     if (irq_callback_) irq_callback_();
 }
+
+void VirtioMmioDevice::SetInterruptModeration(uint32_t max_delay_us,
+                                              uint32_t max_frames) {
+    StopInterruptModeration();
+    if (max_delay_us == 0) return;
+    if (moderator_.Start(max_delay_us, max_frames,
+                         [this]() { RaiseUsedInterrupt(); })) {
+        LOG_INFO("VirtIO MMIO: device %u interrupt moderation %u us / %u frames",
+                 ops_ ? ops_->GetDeviceId() : 0, max_delay_us, max_frames);
+    }
+}
+
+void VirtioMmioDevice::StopInterruptModeration() {
+    if (!moderator_.IsRunning()) return;
+    moderator_.Stop();
+    auto st = moderator_.GetStats();
+    LOG_INFO("VirtIO MMIO: device %u raised %llu interrupts for %llu notifications",
+             ops_ ? ops_->GetDeviceId() : 0, st.interrupts, st.notifications);
+}
+
+void VirtioMmioDevice::NotifyConfigChange() {
+    config_generation_++;
+    SignalConfig();
+}
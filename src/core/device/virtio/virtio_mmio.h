@@ -2,8 +2,11 @@
 
 #include "core/device/device.h"
 #include "core/device/virtio/virtqueue.h"
+#include "core/device/virtio/interrupt_moderator.h"
+#include "core/vmm/io_thread.h"
 #include <atomic>
 #include <functional>
+#include <thread>
 #include <vector>
 
 // Abstract interface for virtio device-specific behavior.
@@ -18,24 +21,70 @@ public:
     virtual void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) = 0;
     virtual void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) = 0;
     virtual void OnStatusChange(uint32_t new_status) = 0;
+    // Shared memory region `id` (spec 2.10), as a guest physical range.
+    virtual bool GetShmRegion(uint32_t id, uint64_t* base, uint64_t* size) const {
+        return false;
+    }
+    // Device state beyond the rings, for snapshots. SaveState runs with the
+    // vCPUs stopped. It finishes any request in flight and holds back work
+    // the host starts on its own until ResumeAfterSave(), so guest RAM
+    // stays as saved while it is written out.
+    virtual void SaveState(StateWriter& out) {}
+    virtual bool LoadState(StateReader& in) { return true; }
+    virtual void ResumeAfterSave() {}
 };
 
 // VirtIO MMIO transport device (spec v1.2, section 4.2).
 // Register layout occupies 0x200 bytes at a fixed MMIO address.
-class VirtioMmioDevice : public Device {
+// VirtioPciDevice builds the PCI transport on the same queue and feature
+// state, so devices hold either through this type.
+class VirtioMmioDevice : public Device, public IoEventSink {
 public:
     static constexpr uint64_t kMmioSize = 0x200;
+    // QueueNotify, the doorbell register offered to AddressSpace::AddIoEvent().
+    static constexpr uint64_t kQueueNotifyOffset = 0x050;
     static constexpr uint32_t kMagic    = 0x74726976; // "virt"
     static constexpr uint32_t kVersion  = 2;
     static constexpr uint32_t kVendorId = 0x554D4551; // "QEMU" (conventional)
 
     using IrqCallback = std::function<void()>;
 
+    ~VirtioMmioDevice() override;
+
     void Init(VirtioDeviceOps* ops, const GuestMemMap& mem);
     void SetIrqCallback(IrqCallback cb) { irq_callback_ = std::move(cb); }
 
     void MmioRead(uint64_t offset, uint8_t size, uint64_t* value) override;
     void MmioWrite(uint64_t offset, uint8_t size, uint64_t value) override;
+    // Transport registers and queues, followed by the device's own state.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+    // Lets the device carry on after SaveState() when the VM keeps running.
+    void ResumeAfterSave() { ops_->ResumeAfterSave(); }
+    // For a checkpoint: the ring fields the device wrote, which no chain
+    // walk has reported dirty.
+    void MarkRingsDirty() const {
+        for (const auto& vq : queues_) vq.MarkRingsDirty();
+    }
+
+    // Starts the thread that runs OnQueueNotify() for doorbells latched by
+    // SignalIoEvent(). The QueueNotify register must then be registered as an
+    // ioevent; until it is, notifies keep running inline on the vCPU.
+    bool StartNotifyThread();
+    void StopNotifyThread();
+    // Same, but the notifies run on a shared I/O thread instead of one of
+    // the device's own. Before the I/O thread starts; it must outlive the
+    // ioevent registration.
+    bool AttachIoThread(IoThread* io_thread);
+    void SignalIoEvent(uint64_t value) override;
+
+    // Holds used-buffer interrupts back by up to `max_delay_us`, or until
+    // `max_frames` notifications have accumulated. 0 leaves it off.
+    void SetInterruptModeration(uint32_t max_delay_us, uint32_t max_frames);
+    void StopInterruptModeration();
+    InterruptModerator::Stats GetInterruptStats() const {
+        return moderator_.GetStats();
+    }
 
     // Called by the backend device to signal a used buffer notification.
     void NotifyUsedBuffer();
@@ -44,12 +93,38 @@ public:
     // Sets VIRTIO_MMIO_INT_CONFIG (bit 1) and raises IRQ.
     void NotifyConfigChange();
 
+    // Offset of the doorbell within the device's MMIO range.
+    virtual uint64_t QueueNotifyOffset() const { return kQueueNotifyOffset; }
+
+    uint64_t GetDriverFeatures() const { return driver_features_; }
+
     VirtQueue* GetQueue(uint32_t idx) {
         return idx < queues_.size() ? &queues_[idx] : nullptr;
     }
 
-private:
+protected:
     void DoReset();
+    void NotifyQueue(uint32_t queue_idx);
+    // Sets the selected queue up from its staged configuration.
+    void EnableQueue(uint32_t queue_idx);
+    // Stages the size the driver picked. Sizes past GetQueueMaxSize() are
+    // refused, since devices size per-request arrays by that maximum.
+    void SetQueueNum(uint32_t queue_idx, uint32_t num);
+    uint64_t OfferedFeatures() const;
+
+    // Delivers a used-buffer interrupt for `queues`, one bit per queue that
+    // has new used entries (all of them when the driver suppresses none).
+    // MMIO has a single line, so it only latches VIRTIO_MMIO_INT_VRING.
+    virtual void SignalUsed(uint64_t queues);
+    virtual void SignalConfig();
+    // Repeats whatever interrupt may have been lost across a snapshot.
+    virtual void RepeatInterrupts();
+
+private:
+    void RaiseUsedInterrupt();
+    void NotifyThreadFunc();
+    // Runs OnQueueNotify() for every latched doorbell.
+    void DrainNotifies();
 
     // MMIO register offsets (spec 4.2.2, Table 4.1)
     enum Reg : uint32_t {
@@ -84,6 +159,7 @@ private:
         kConfig           = 0x100,
     };
 
+protected:
     VirtioDeviceOps* ops_ = nullptr;
     GuestMemMap mem_;
     IrqCallback irq_callback_;
@@ -108,4 +184,18 @@ private:
     };
     std::vector<QueueConfig> queue_configs_;
     uint32_t shm_sel_ = 0;
+
+private:
+    // Queues with used entries not yet signalled, one bit per queue.
+    std::atomic<uint64_t> pending_used_{0};
+
+    // Doorbells latched by SignalIoEvent(), one bit per queue.
+    std::atomic<uint64_t> pending_notify_{0};
+    void* notify_event_ = nullptr;  // HANDLE, auto-reset
+    std::atomic<bool> notify_stop_{false};
+    std::thread notify_thread_;
+    IoThread* io_thread_ = nullptr;
+    uint32_t io_source_ = 0;
+
+    InterruptModerator moderator_;
 };
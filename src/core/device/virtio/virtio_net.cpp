@@ -4,13 +4,83 @@
 
 static constexpr uint8_t kDefaultMac[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
 
-VirtioNetDevice::VirtioNetDevice(bool link_up) {
+// Hashes a TCP/UDP flow by its guest port and remote endpoint, so frames
+// in both directions land on the same slot.
+static bool FlowHash(const uint8_t* frame, uint32_t len, bool from_guest,
+                     uint32_t* hash) {
+    if (len < 14 + 20 + 4) return false;
+    if (frame[12] != 0x08 || frame[13] != 0x00) return false;
+    const uint8_t* ip = frame + 14;
+    uint32_t ihl = (ip[0] & 0xF) * 4;
+    uint8_t proto = ip[9];
+    if (ihl < 20 || len < 14 + ihl + 4 || (proto != 6 && proto != 17)) return false;
+    // Later fragments carry no ports.
+    if (((ip[6] & 0x1F) << 8 | ip[7]) != 0) return false;
+
+    auto be16 = [](const uint8_t* p) { return static_cast<uint32_t>(p[0] << 8 | p[1]); };
+    auto be32 = [](const uint8_t* p) {
+        return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    };
+    const uint8_t* l4 = ip + ihl;
+    uint32_t guest_port  = from_guest ? be16(l4) : be16(l4 + 2);
+    uint32_t remote_port = from_guest ? be16(l4 + 2) : be16(l4);
+    uint32_t remote_ip   = from_guest ? be32(ip + 16) : be32(ip + 12);
+
+    uint32_t h = remote_ip * 0x9E3779B1u;
+    h ^= (guest_port << 16 | remote_port) * 0x85EBCA6Bu;
+    h ^= proto;
+    h ^= h >> 15;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 13;
+    *hash = h;
+    return true;
+}
+
+VirtioNetDevice::VirtioNetDevice(bool link_up, uint32_t num_queue_pairs) {
     memcpy(config_.mac, kDefaultMac, 6);
     config_.status = link_up ? 1 : 0;
+
+    num_queue_pairs = std::clamp(num_queue_pairs, 1u, kMaxQueuePairs);
+    config_.max_virtqueue_pairs = static_cast<uint16_t>(num_queue_pairs);
+    for (auto& slot : flow_pair_) slot.store(kNoPair, std::memory_order_relaxed);
+
+    for (uint32_t i = 0; i < num_queue_pairs; i++) {
+        rx_queues_.push_back(std::make_unique<RxQueue>());
+    }
+    for (uint32_t i = 0; i < num_queue_pairs; i++) {
+        rx_queues_[i]->worker = std::thread(&VirtioNetDevice::RxWorker, this, i);
+    }
+}
+
+VirtioNetDevice::~VirtioNetDevice() {
+    Stop();
+}
+
+void VirtioNetDevice::Stop() {
+    stopping_ = true;
+    for (auto& q : rx_queues_) {
+        {
+            std::lock_guard<std::mutex> lock(q->wake_mutex);
+            q->wake = true;
+        }
+        q->wake_cv.notify_one();
+    }
+    for (auto& q : rx_queues_) {
+        if (q->worker.joinable()) q->worker.join();
+    }
 }
 
 uint64_t VirtioNetDevice::GetDeviceFeatures() const {
-    return VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_NET_F_VERSION_1;
+    // Guest TSO frames are never segmented here: lwIP terminates the TCP
+    // connection and the NAT hands the whole payload to the host socket.
+    // Partial checksums on guest frames are fine too, since lwIP does not
+    // verify incoming checksums and UDP relays only forward the payload.
+    return VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_HOST_TSO4 |
+           VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_NET_F_MRG_RXBUF |
+           (rx_queues_.size() > 1 ? VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ : 0) |
+           VIRTIO_RING_F_INDIRECT_DESC |
+           VIRTIO_F_RING_PACKED |
+           VIRTIO_NET_F_VERSION_1;
 }
 
 void VirtioNetDevice::SetLinkUp(bool up) {
@@ -22,91 +92,348 @@ void VirtioNetDevice::SetLinkUp(bool up) {
 }
 
 void VirtioNetDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
-    if (queue_idx == 0) {
-        // RX queue: guest provided new receive buffers — nothing to do now,
-        // packets are injected via InjectRx() from the network thread.
+    uint32_t pairs = static_cast<uint32_t>(rx_queues_.size());
+    if (queue_idx == pairs * 2 && pairs > 1) {
+        ProcessControl(vq);
         return;
     }
+    if (queue_idx >= pairs * 2) return;
 
-    if (queue_idx != 1) return;
+    if (queue_idx % 2 == 0) {
+        // RX queue: guest provided new receive buffers for frames waiting
+        // in the ring.
+        KickRx(queue_idx / 2);
+        return;
+    }
+    ProcessTx(queue_idx / 2, vq);
+}
 
-    // TX queue: guest wants to send packets
+void VirtioNetDevice::ProcessTx(uint32_t pair, VirtQueue& vq) {
+    bool multi = active_pairs_.load(std::memory_order_relaxed) > 1;
+    uint64_t sent = 0, sent_bytes = 0;
     uint16_t head;
     while (vq.PopAvail(&head)) {
-        std::vector<VirtqChainElem> chain;
+        thread_local VirtqChain chain;
         if (!vq.WalkChain(head, &chain) || chain.empty()) {
             vq.PushUsed(head, 0);
             continue;
         }
 
-        // Gather the full TX buffer (virtio_net_hdr + Ethernet frame)
-        uint32_t total = 0;
-        for (auto& e : chain) total += e.len;
+        // Describe the Ethernet frame in place, skipping virtio_net_hdr,
+        // which may itself span descriptors.
+        thread_local std::vector<NetTxSegment> segs;
+        segs.clear();
+        uint32_t skip = sizeof(VirtioNetHdr);
+        uint32_t frame_len = 0;
+        for (auto& e : chain) {
+            uint32_t cut = std::min(skip, e.len);
+            skip -= cut;
+            if (e.len > cut) {
+                segs.push_back({e.addr + cut, e.len - cut});
+                frame_len += e.len - cut;
+            }
+        }
+
+        if (multi) {
+            // Remember the pair so replies on this flow come back on it.
+            uint8_t headers[64];
+            uint32_t got = 0;
+            for (auto& seg : segs) {
+                uint32_t n = std::min<uint32_t>(seg.len, sizeof(headers) - got);
+                memcpy(headers + got, seg.addr, n);
+                got += n;
+                if (got == sizeof(headers)) break;
+            }
+            uint32_t hash;
+            if (FlowHash(headers, got, true, &hash)) {
+                flow_pair_[hash % kFlowSlots].store(static_cast<uint8_t>(pair),
+                                                    std::memory_order_relaxed);
+            }
+        }
+
+        if (tx_callback_ && frame_len >= 14) {
+            capture_.Record(segs.data(), segs.size(), frame_len);
+            tx_callback_(segs.data(), segs.size(), frame_len);
+            sent++;
+            sent_bytes += frame_len;
+        }
+
+        vq.PushUsed(head, 0);
+    }
+    tx_frames_.fetch_add(sent, std::memory_order_relaxed);
+    tx_bytes_.fetch_add(sent_bytes, std::memory_order_relaxed);
+    mmio_->NotifyUsedBuffer();
+}
 
-        if (total <= sizeof(VirtioNetHdr)) {
+void VirtioNetDevice::ProcessControl(VirtQueue& vq) {
+    uint16_t head;
+    while (vq.PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        if (!vq.WalkChain(head, &chain) || chain.empty()) {
             vq.PushUsed(head, 0);
             continue;
         }
 
-        // Linearize into a contiguous buffer
-        std::vector<uint8_t> buf(total);
-        uint32_t off = 0;
+        // Readable class/command/data, then the writable ack byte.
+        uint8_t cmd[8] = {};
+        uint32_t got = 0;
+        uint8_t* ack = nullptr;
         for (auto& e : chain) {
-            memcpy(buf.data() + off, e.addr, e.len);
-            off += e.len;
+            if (e.writable) {
+                if (!ack && e.len) ack = e.addr;
+                continue;
+            }
+            uint32_t n = std::min<uint32_t>(e.len, sizeof(cmd) - got);
+            memcpy(cmd + got, e.addr, n);
+            got += n;
         }
 
-        // Skip the virtio_net_hdr, pass raw Ethernet frame to backend
-        const uint8_t* frame = buf.data() + sizeof(VirtioNetHdr);
-        uint32_t frame_len = total - sizeof(VirtioNetHdr);
-
-        if (tx_callback_ && frame_len >= 14) {
-            tx_callback_(frame, frame_len);
+        uint8_t status = VIRTIO_NET_ERR;
+        if (got >= 4 && cmd[0] == VIRTIO_NET_CTRL_MQ &&
+            cmd[1] == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+            uint16_t pairs;
+            memcpy(&pairs, cmd + 2, sizeof(pairs));
+            if (pairs >= 1 && pairs <= rx_queues_.size()) {
+                active_pairs_ = pairs;
+                status = VIRTIO_NET_OK;
+                LOG_INFO("VirtIO net: %u queue pair(s) active", pairs);
+            }
         }
-
-        vq.PushUsed(head, 0);
+        if (ack) *ack = status;
+        vq.PushUsed(head, ack ? 1 : 0);
     }
     mmio_->NotifyUsedBuffer();
 }
 
-bool VirtioNetDevice::InjectRx(const uint8_t* frame, uint32_t len) {
-    std::lock_guard<std::mutex> lock(rx_mutex_);
-    if (!mmio_) return false;
+uint32_t VirtioNetDevice::SteerRx(const uint8_t* frame, uint32_t len) const {
+    uint32_t active = active_pairs_.load(std::memory_order_relaxed);
+    if (active <= 1) return 0;
+    uint32_t hash;
+    if (!FlowHash(frame, len, false, &hash)) return 0;
+    uint8_t pair = flow_pair_[hash % kFlowSlots].load(std::memory_order_relaxed);
+    return pair < active ? pair : hash % active;
+}
 
-    VirtQueue* vq = mmio_->GetQueue(0);
-    if (!vq || !vq->IsReady()) return false;
+size_t VirtioNetDevice::InjectRxBatch(const NetRxFrame* frames, size_t count) {
+    size_t queued = 0;
+    uint64_t queued_bytes = 0;
+    uint32_t kick = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (frames[i].len > kRxSlotBytes) {
+            rx_dropped_oversize_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        uint32_t pair = SteerRx(frames[i].data, frames[i].len);
+        auto& ring = rx_queues_[pair]->ring;
+        RxSlot* slot = ring.Reserve();
+        if (!slot) {
+            rx_dropped_full_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        memcpy(slot->data, frames[i].data, frames[i].len);
+        slot->len = frames[i].len;
+        slot->csum_start = frames[i].csum_start;
+        slot->csum_offset = frames[i].csum_offset;
+        ring.Commit();
+        capture_.Record(frames[i].data, frames[i].len);
+        kick |= 1u << pair;
+        queued++;
+        queued_bytes += frames[i].len;
+    }
+    rx_queued_.fetch_add(queued, std::memory_order_relaxed);
+    rx_queued_bytes_.fetch_add(queued_bytes, std::memory_order_relaxed);
 
-    uint16_t head;
-    if (!vq->PopAvail(&head)) return false;
+    for (uint32_t pair = 0; kick; pair++, kick >>= 1) {
+        if (kick & 1) KickRx(pair);
+    }
+    return queued;
+}
 
-    std::vector<VirtqChainElem> chain;
-    if (!vq->WalkChain(head, &chain) || chain.empty()) {
-        vq->PushUsed(head, 0);
-        return false;
+void VirtioNetDevice::KickRx(uint32_t pair) {
+    auto& q = *rx_queues_[pair];
+    {
+        std::lock_guard<std::mutex> lock(q.wake_mutex);
+        q.wake = true;
     }
+    q.wake_cv.notify_one();
+}
 
-    VirtioNetHdr hdr{};
-    uint32_t total = sizeof(hdr) + len;
-    uint32_t written = 0;
+void VirtioNetDevice::RxWorker(uint32_t pair) {
+    auto& q = *rx_queues_[pair];
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(q.wake_mutex);
+            q.wake_cv.wait(lock, [&q] { return q.wake; });
+            q.wake = false;
+        }
+        if (stopping_) return;
+        DrainRx(q, pair);
+    }
+}
 
+// Copies `hdr_len` bytes of `hdr` followed by `len` bytes of `data` into
+// the chain's writable descriptors. Returns the bytes written.
+static uint32_t FillChain(const VirtqChain& chain, const uint8_t* hdr,
+                          uint32_t hdr_len, const uint8_t* data, uint32_t len) {
+    uint32_t total = hdr_len + len;
+    uint32_t written = 0;
     for (auto& elem : chain) {
-        if (!elem.writable || written >= total) continue;
-        uint32_t to_copy = std::min(elem.len, total - written);
-        for (uint32_t i = 0; i < to_copy; i++) {
-            uint32_t pos = written + i;
-            if (pos < sizeof(hdr))
-                elem.addr[i] = reinterpret_cast<const uint8_t*>(&hdr)[pos];
-            else
-                elem.addr[i] = frame[pos - sizeof(hdr)];
+        if (written >= total) break;
+        if (!elem.writable) continue;
+        uint32_t pos = 0;
+        if (written < hdr_len) {
+            uint32_t n = std::min(elem.len, hdr_len - written);
+            memcpy(elem.addr, hdr + written, n);
+            pos = n;
+            written += n;
+        }
+        if (written >= hdr_len && pos < elem.len) {
+            uint32_t n = std::min(elem.len - pos, total - written);
+            memcpy(elem.addr + pos, data + (written - hdr_len), n);
+            written += n;
         }
-        written += to_copy;
     }
+    return written;
+}
 
-    vq->PushUsed(head, written);
-    mmio_->NotifyUsedBuffer();
+// Completes a checksum left as the pseudo-header sum, for drivers that
+// did not negotiate VIRTIO_NET_F_GUEST_CSUM.
+static void FinishChecksum(uint8_t* frame, uint32_t len, uint16_t start,
+                           uint16_t offset) {
+    if (start >= len || offset + 2u > len - start) return;
+    uint32_t sum = 0;
+    for (uint32_t i = start; i + 1 < len; i += 2)
+        sum += (frame[i] << 8) | frame[i + 1];
+    if ((len - start) & 1) sum += frame[len - 1] << 8;
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    uint16_t csum = static_cast<uint16_t>(~sum);
+    frame[start + offset] = static_cast<uint8_t>(csum >> 8);
+    frame[start + offset + 1] = static_cast<uint8_t>(csum);
+}
+
+bool VirtioNetDevice::HoldRxBuffers(RxQueue& q, VirtQueue& vq, uint32_t need,
+                                    bool* completed) {
+    thread_local VirtqChain chain;
+    while (q.held_capacity < need) {
+        uint16_t head;
+        if (!vq.PopAvail(&head)) return false;
+
+        uint32_t capacity = 0;
+        if (vq.WalkChain(head, &chain)) {
+            for (auto& elem : chain) {
+                if (elem.writable) capacity += elem.len;
+            }
+        }
+        // The first buffer must at least hold the header.
+        uint32_t min_len = q.held.empty() ? sizeof(VirtioNetHdr) : 1;
+        if (capacity < min_len) {
+            vq.PushUsed(head, 0);
+            *completed = true;
+            continue;
+        }
+        q.held.push_back({head, capacity});
+        q.held_capacity += capacity;
+    }
     return true;
 }
 
+void VirtioNetDevice::DrainRx(RxQueue& q, uint32_t pair) {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (!mmio_ || rx_paused_) return;
+
+    VirtQueue* vq = mmio_->GetQueue(pair * 2);
+    if (!vq || !vq->IsReady()) return;
+
+    uint64_t features = mmio_->GetDriverFeatures();
+    bool mergeable = (features & VIRTIO_NET_F_MRG_RXBUF) != 0;
+    bool guest_csum = (features & VIRTIO_NET_F_GUEST_CSUM) != 0;
+    thread_local VirtqChain chain;
+    bool delivered = false;
+
+    while (RxSlot* slot = q.ring.Front()) {
+        VirtioNetHdr hdr{};
+        hdr.num_buffers = 1;
+        if (slot->csum_start) {
+            if (guest_csum) {
+                hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+                hdr.csum_start = slot->csum_start;
+                hdr.csum_offset = slot->csum_offset;
+            } else {
+                FinishChecksum(slot->data, slot->len, slot->csum_start,
+                               slot->csum_offset);
+            }
+        }
+        const auto* hdr_bytes = reinterpret_cast<const uint8_t*>(&hdr);
+
+        if (!mergeable) {
+            // One buffer per frame; a short buffer truncates the frame.
+            uint16_t head;
+            if (!vq->PopAvail(&head)) {
+                rx_deferred_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            uint32_t written = 0;
+            if (vq->WalkChain(head, &chain)) {
+                written = FillChain(chain, hdr_bytes, sizeof(hdr),
+                                    slot->data, slot->len);
+            }
+            vq->PushUsed(head, written);
+            q.ring.Pop();
+            delivered = true;
+            continue;
+        }
+
+        // Mergeable: spread the frame over as many buffers as it takes,
+        // holding popped buffers over until enough are posted.
+        uint32_t need = sizeof(hdr) + slot->len;
+        if (!HoldRxBuffers(q, *vq, need, &delivered)) {
+            rx_deferred_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+
+        uint16_t buffers = 0;
+        for (uint32_t room = 0; room < need; buffers++) room += q.held[buffers].capacity;
+        hdr.num_buffers = buffers;
+
+        uint32_t data_off = 0;
+        for (uint16_t i = 0; i < buffers; i++) {
+            const RxHeld& held = q.held[i];
+            uint32_t written = 0;
+            if (vq->WalkChain(held.head, &chain)) {
+                written = i == 0
+                    ? FillChain(chain, hdr_bytes, sizeof(hdr), slot->data, slot->len)
+                    : FillChain(chain, nullptr, 0, slot->data + data_off,
+                                slot->len - data_off);
+            }
+            data_off += i == 0 ? written - std::min<uint32_t>(written, sizeof(hdr))
+                               : written;
+            vq->PushUsed(held.head, written);
+            q.held_capacity -= held.capacity;
+        }
+        q.held.erase(q.held.begin(), q.held.begin() + buffers);
+        q.ring.Pop();
+        delivered = true;
+    }
+    if (delivered) mmio_->NotifyUsedBuffer();
+}
+
+VirtioNetDevice::RxStats VirtioNetDevice::GetRxStats() const {
+    RxStats stats;
+    stats.queued = rx_queued_.load(std::memory_order_relaxed);
+    stats.queued_bytes = rx_queued_bytes_.load(std::memory_order_relaxed);
+    stats.deferred = rx_deferred_.load(std::memory_order_relaxed);
+    stats.dropped_full = rx_dropped_full_.load(std::memory_order_relaxed);
+    stats.dropped_oversize = rx_dropped_oversize_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+VirtioNetDevice::TxStats VirtioNetDevice::GetTxStats() const {
+    TxStats stats;
+    stats.frames = tx_frames_.load(std::memory_order_relaxed);
+    stats.bytes = tx_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
 void VirtioNetDevice::ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) {
     const uint8_t* cfg = reinterpret_cast<const uint8_t*>(&config_);
     uint32_t cfg_size = sizeof(config_);
@@ -120,8 +447,46 @@ void VirtioNetDevice::WriteConfig(uint32_t offset, uint8_t size, uint32_t value)
     // Config is read-only for net device
 }
 
+void VirtioNetDevice::SaveState(StateWriter& out) {
+    out.Put(active_pairs_.load());
+    for (auto& q : rx_queues_) {
+        // Taking the lock waits out a delivery already under way.
+        std::lock_guard<std::mutex> lock(q->mutex);
+        rx_paused_ = true;
+        out.PutVector(q->held);
+        out.Put(q->held_capacity);
+    }
+}
+
+void VirtioNetDevice::ResumeAfterSave() {
+    rx_paused_ = false;
+    for (uint32_t pair = 0; pair < rx_queues_.size(); pair++) KickRx(pair);
+}
+
+bool VirtioNetDevice::LoadState(StateReader& in) {
+    uint32_t pairs = 1;
+    in.Get(&pairs);
+    if (!in.ok() || pairs == 0 || pairs > rx_queues_.size()) return false;
+    active_pairs_ = pairs;
+    for (auto& q : rx_queues_) {
+        std::lock_guard<std::mutex> lock(q->mutex);
+        in.GetVector(&q->held);
+        in.Get(&q->held_capacity);
+    }
+    return in.ok();
+}
+
 void VirtioNetDevice::OnStatusChange(uint32_t new_status) {
     if (new_status == 0) {
+        // Frames queued for the old rings are dropped with them.
+        for (auto& q : rx_queues_) {
+            std::lock_guard<std::mutex> lock(q->mutex);
+            while (q->ring.Front()) q->ring.Pop();
+            q->held.clear();
+            q->held_capacity = 0;
+        }
+        active_pairs_ = 1;
+        for (auto& slot : flow_pair_) slot.store(kNoPair, std::memory_order_relaxed);
         LOG_INFO("VirtIO net: device reset");
     }
 }
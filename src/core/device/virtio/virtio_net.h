@@ -1,19 +1,41 @@
 #pragma once
 
+#include "core/device/virtio/net_capture.h"
 #include "core/device/virtio/virtio_mmio.h"
+#include "core/net/frame_ring.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
+constexpr uint64_t VIRTIO_NET_F_CSUM       = 1ULL << 0;
+constexpr uint64_t VIRTIO_NET_F_GUEST_CSUM = 1ULL << 1;
 constexpr uint64_t VIRTIO_NET_F_MAC    = 1ULL << 5;
+constexpr uint64_t VIRTIO_NET_F_HOST_TSO4  = 1ULL << 11;
+constexpr uint64_t VIRTIO_NET_F_MRG_RXBUF = 1ULL << 15;
 constexpr uint64_t VIRTIO_NET_F_STATUS = 1ULL << 16;
+constexpr uint64_t VIRTIO_NET_F_CTRL_VQ = 1ULL << 17;
+constexpr uint64_t VIRTIO_NET_F_MQ     = 1ULL << 22;
 // VIRTIO_F_VERSION_1 is defined in virtio_blk.h; redeclare here
 #ifndef VIRTIO_F_VERSION_1_DEFINED
 #define VIRTIO_F_VERSION_1_DEFINED
 constexpr uint64_t VIRTIO_NET_F_VERSION_1 = 1ULL << 32;
 #endif
 
+constexpr uint8_t VIRTIO_NET_HDR_F_NEEDS_CSUM = 1;
+
+// Control queue (spec 5.1.6.5)
+constexpr uint8_t  VIRTIO_NET_OK  = 0;
+constexpr uint8_t  VIRTIO_NET_ERR = 1;
+constexpr uint8_t  VIRTIO_NET_CTRL_MQ = 4;
+constexpr uint8_t  VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET = 0;
+
 #pragma pack(push, 1)
 // virtio 1.x (VIRTIO_F_VERSION_1) always includes num_buffers
 struct VirtioNetHdr {
@@ -29,17 +51,44 @@ struct VirtioNetHdr {
 struct VirtioNetConfig {
     uint8_t  mac[6];
     uint16_t status;
+    uint16_t max_virtqueue_pairs;
 };
 #pragma pack(pop)
 
 static_assert(sizeof(VirtioNetHdr) == 12);
 
+// A received Ethernet frame handed to InjectRxBatch().
+struct NetRxFrame {
+    const uint8_t* data;
+    uint32_t len;
+    // Nonzero when the L4 checksum at csum_start + csum_offset only holds
+    // the pseudo-header sum; the guest or the device completes it.
+    uint16_t csum_start = 0;
+    uint16_t csum_offset = 0;
+};
+
+// One guest-memory piece of a transmitted Ethernet frame.
+struct NetTxSegment {
+    const uint8_t* addr;
+    uint32_t len;
+};
+
 class VirtioNetDevice : public VirtioDeviceOps {
 public:
-    using TxCallback = std::function<void(const uint8_t* frame, uint32_t len)>;
+    // The frame stays in guest memory; segments are only valid for the call.
+    using TxCallback = std::function<void(const NetTxSegment* segs, size_t count,
+                                          uint32_t len)>;
+
+    static constexpr uint32_t kMaxQueuePairs = 8;
+
+    // More than one queue pair offers VIRTIO_NET_F_MQ; received frames
+    // follow their flow to the pair the guest last sent it on.
+    explicit VirtioNetDevice(bool link_up = true, uint32_t num_queue_pairs = 1);
+    ~VirtioNetDevice() override;
 
-    explicit VirtioNetDevice(bool link_up = true);
-    ~VirtioNetDevice() override = default;
+    // Joins the RX delivery workers. The network backend must already be
+    // stopped.
+    void Stop();
 
     void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
     void SetTxCallback(TxCallback cb) { tx_callback_ = std::move(cb); }
@@ -47,22 +96,126 @@ public:
     void SetLinkUp(bool up);
     bool IsLinkUp() const { return (config_.status & 1) != 0; }
 
-    // Inject a received Ethernet frame into the guest RX queue.
-    // Thread-safe: called from the network thread.
-    bool InjectRx(const uint8_t* frame, uint32_t len);
+    struct RxStats {
+        uint64_t queued = 0;            // frames accepted into the RX ring
+        uint64_t queued_bytes = 0;
+        uint64_t deferred = 0;          // times the ring waited for guest buffers
+        uint64_t dropped_full = 0;      // ring full
+        uint64_t dropped_oversize = 0;  // larger than an RX slot
+    };
+
+    // RX ring slots; covers an MTU frame since no receive offloads are offered.
+    static constexpr uint32_t kRxSlotBytes = 2048;
+    static constexpr size_t kRxRingSlots = 256;
+
+    // Queue received Ethernet frames for the guest. Each frame goes to its
+    // flow's queue pair, whose worker delivers as much of the ring as the
+    // posted RX buffers allow under one lock and one interrupt. Frames
+    // that find no buffer wait in the ring until the guest posts more.
+    // Single producer: only the network thread calls these. Returns how
+    // many frames were queued; the rest were dropped.
+    size_t InjectRxBatch(const NetRxFrame* frames, size_t count);
+    bool InjectRx(const uint8_t* frame, uint32_t len) {
+        NetRxFrame f{frame, len};
+        return InjectRxBatch(&f, 1) == 1;
+    }
+
+    RxStats GetRxStats() const;
+
+    // Frames the guest sent, handed to the TX callback.
+    struct TxStats {
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+    };
+    TxStats GetTxStats() const;
+
+    // Copies frames in both directions into a pcapng ring file; see
+    // NetCapture. Called from the control thread.
+    bool StartCapture(const NetCaptureOptions& options, std::string* error) {
+        return capture_.Start(options, error);
+    }
+    void StopCapture() { capture_.Stop(); }
 
     uint32_t GetDeviceId() const override { return 1; }
     uint64_t GetDeviceFeatures() const override;
-    uint32_t GetNumQueues() const override { return 2; }
+    // RX/TX pairs, then the control queue when there are several pairs.
+    uint32_t GetNumQueues() const override {
+        uint32_t pairs = static_cast<uint32_t>(rx_queues_.size());
+        return pairs * 2 + (pairs > 1 ? 1 : 0);
+    }
     uint32_t GetQueueMaxSize(uint32_t queue_idx) const override { return 256; }
     void OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) override;
     void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
     void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
     void OnStatusChange(uint32_t new_status) override;
+    // Keeps the RX buffers held for a partial frame; frames still in the
+    // rings are dropped like any lost packet. Delivery pauses from
+    // SaveState until ResumeAfterSave.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+    void ResumeAfterSave() override;
 
 private:
+    struct RxSlot {
+        uint32_t len;
+        uint16_t csum_start;
+        uint16_t csum_offset;
+        uint8_t data[kRxSlotBytes];
+    };
+
+    // A guest RX buffer popped ahead of use while gathering enough room
+    // for a mergeable frame.
+    struct RxHeld {
+        uint16_t head;
+        uint32_t capacity;
+    };
+
+    // Per queue pair RX state. The network thread fills the ring; the
+    // pair's worker is its only consumer, so delivery into guest memory
+    // stays off the network thread.
+    struct RxQueue {
+        std::mutex mutex;               // delivery vs. device reset
+        SpscRing<RxSlot> ring{kRxRingSlots};
+        std::vector<RxHeld> held;
+        uint32_t held_capacity = 0;
+
+        std::thread worker;
+        std::mutex wake_mutex;
+        std::condition_variable wake_cv;
+        bool wake = false;
+    };
+
+    // Flow hash → queue pair the guest last transmitted the flow on.
+    static constexpr size_t kFlowSlots = 1024;
+    static constexpr uint8_t kNoPair = 0xFF;
+
+    void ProcessTx(uint32_t pair, VirtQueue& vq);
+    void ProcessControl(VirtQueue& vq);
+    uint32_t SteerRx(const uint8_t* frame, uint32_t len) const;
+
+    void KickRx(uint32_t pair);
+    void RxWorker(uint32_t pair);
+    // Moves ring frames into guest RX buffers on the pair's RX queue.
+    void DrainRx(RxQueue& q, uint32_t pair);
+    // Pops guest buffers into q.held until they can take `need` bytes.
+    // Returns whether they can. Sets *completed if it returned unusable
+    // chains to the guest.
+    bool HoldRxBuffers(RxQueue& q, VirtQueue& vq, uint32_t need, bool* completed);
+
     VirtioMmioDevice* mmio_ = nullptr;
     VirtioNetConfig config_{};
     TxCallback tx_callback_;
-    std::mutex rx_mutex_;
+    std::vector<std::unique_ptr<RxQueue>> rx_queues_;
+    std::atomic<uint32_t> active_pairs_{1};
+    std::array<std::atomic<uint8_t>, kFlowSlots> flow_pair_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> rx_paused_{false};
+    std::atomic<uint64_t> rx_queued_{0};
+    std::atomic<uint64_t> rx_queued_bytes_{0};
+    std::atomic<uint64_t> rx_deferred_{0};
+    std::atomic<uint64_t> rx_dropped_full_{0};
+    std::atomic<uint64_t> rx_dropped_oversize_{0};
+    std::atomic<uint64_t> tx_frames_{0};
+    std::atomic<uint64_t> tx_bytes_{0};
+    NetCapture capture_;
 };
@@ -0,0 +1,427 @@
+#include "core/device/virtio/virtio_pci.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// virtio_pci_cap cfg_type values (spec 4.1.4)
+constexpr uint8_t kCapVendor      = 0x09;
+constexpr uint8_t kCapMsixId      = 0x11;
+constexpr uint8_t kCfgTypeCommon  = 1;
+constexpr uint8_t kCfgTypeNotify  = 2;
+constexpr uint8_t kCfgTypeIsr     = 3;
+constexpr uint8_t kCfgTypeDevice  = 4;
+
+// Common configuration structure (spec 4.1.4.3)
+enum CommonReg : uint32_t {
+    kDeviceFeatureSelect = 0x00,
+    kDeviceFeature       = 0x04,
+    kDriverFeatureSelect = 0x08,
+    kDriverFeature       = 0x0C,
+    kConfigMsixVector    = 0x10,
+    kNumQueues           = 0x12,
+    kDeviceStatus        = 0x14,
+    kConfigGen           = 0x15,
+    kQueueSelect         = 0x16,
+    kQueueSize           = 0x18,
+    kQueueMsixVector     = 0x1A,
+    kQueueEnable         = 0x1C,
+    kQueueNotifyOff      = 0x1E,
+    kQueueDesc           = 0x20,
+    kQueueDriver         = 0x28,
+    kQueueDevice         = 0x30,
+};
+
+// Merges a 32-bit half (or the whole of a 64-bit write) into `field`.
+void Write64(uint64_t* field, uint32_t offset, uint8_t size, uint64_t value) {
+    if (size == 8) {
+        *field = value;
+    } else if (offset & 4) {
+        *field = (*field & 0x00000000FFFFFFFFULL) | (value << 32);
+    } else {
+        *field = (*field & 0xFFFFFFFF00000000ULL) | static_cast<uint32_t>(value);
+    }
+}
+
+uint64_t Read64(uint64_t field, uint32_t offset, uint8_t size) {
+    if (size == 8) return field;
+    return static_cast<uint32_t>(offset & 4 ? field >> 32 : field);
+}
+
+// PCI class code for a virtio device id: base class, subclass.
+std::pair<uint8_t, uint8_t> ClassFor(uint32_t device_id) {
+    switch (device_id) {
+    case 1:  return {0x02, 0x00};  // network, Ethernet
+    case 2:  return {0x01, 0x80};  // mass storage, other
+    default: return {0xFF, 0x00};
+    }
+}
+
+} // namespace
+
+void VirtioPciDevice::Init(VirtioDeviceOps* ops, const GuestMemMap& mem,
+                           uint32_t bar_base, uint8_t intx_irq) {
+    VirtioMmioDevice::Init(ops, mem);
+    bar_base_ = bar_base;
+
+    uint32_t id = ops->GetDeviceId();
+    auto [base_class, sub_class] = ClassFor(id);
+    config_.Set16(PciConfigSpace::kVendorId, kVendorId);
+    config_.Set16(PciConfigSpace::kDeviceId, static_cast<uint16_t>(kDeviceIdBase + id));
+    config_.Set8(PciConfigSpace::kRevision, 1);
+    config_.Set8(PciConfigSpace::kClassCode + 1, sub_class);
+    config_.Set8(PciConfigSpace::kClassCode + 2, base_class);
+    config_.Set16(PciConfigSpace::kSubVendorId, kVendorId);
+    config_.Set16(PciConfigSpace::kSubsystemId, 0x1100);
+    config_.Set16(PciConfigSpace::kStatus, PciConfigSpace::kStatusCapList);
+    config_.Set8(PciConfigSpace::kCapPointer, kCapCommon);
+    config_.Set8(PciConfigSpace::kInterruptLine, intx_irq);
+    config_.SetWritable(PciConfigSpace::kInterruptLine, 1, 0xFF);
+    config_.Set8(PciConfigSpace::kInterruptPin, 1);  // INTA#, until MSI-X is on
+    // Memory decode, bus master and INTx disable.
+    config_.SetWritable(PciConfigSpace::kCommand, 2, 0x0406);
+    config_.SetMemoryBar(0, bar_base, kBarSize);
+
+    AddVirtioCap(kCapCommon, kCapNotify, kCfgTypeCommon, kCommonOffset, kCommonSize);
+    AddVirtioCap(kCapNotify, kCapIsr, kCfgTypeNotify, kNotifyOffset, 4, 20);
+    config_.Set32(kCapNotify + 16, 0);  // notify_off_multiplier
+    AddVirtioCap(kCapIsr, kCapDevice, kCfgTypeIsr, kIsrOffset, 4);
+    AddVirtioCap(kCapDevice, kCapMsix, kCfgTypeDevice, kDeviceOffset, kDeviceSize);
+
+    uint32_t vectors = static_cast<uint32_t>(queues_.size()) + 1;
+    config_.Set8(kCapMsix, kCapMsixId);
+    config_.Set8(kCapMsix + 1, 0);
+    config_.Set16(kCapMsix + 2, static_cast<uint16_t>(vectors - 1));
+    config_.SetWritable(kCapMsix + 2, 2, kMsixEnable | kMsixFunctionMask);
+    config_.Set32(kCapMsix + 4, kMsixTableOffset);  // BIR 0
+    config_.Set32(kCapMsix + 8, kMsixPbaOffset);
+
+    msix_table_.assign(vectors, MsixEntry{});
+    msix_pending_.assign((vectors + 63) / 64, 0);
+    queue_vectors_.assign(queues_.size(), kNoVector);
+}
+
+void VirtioPciDevice::AddVirtioCap(uint32_t offset, uint32_t next, uint8_t type,
+                                   uint32_t bar_offset, uint32_t length,
+                                   uint8_t cap_len) {
+    config_.Set8(offset, kCapVendor);
+    config_.Set8(offset + 1, static_cast<uint8_t>(next));
+    config_.Set8(offset + 2, cap_len);
+    config_.Set8(offset + 3, type);
+    config_.Set8(offset + 4, 0);  // BAR 0
+    config_.Set32(offset + 8, bar_offset);
+    config_.Set32(offset + 12, length);
+}
+
+uint32_t VirtioPciDevice::ConfigRead(uint32_t offset, uint8_t size) {
+    std::lock_guard<std::mutex> lock(msix_mutex_);
+    return config_.Read(offset, size);
+}
+
+void VirtioPciDevice::ConfigWrite(uint32_t offset, uint8_t size, uint32_t value) {
+    std::lock_guard<std::mutex> lock(msix_mutex_);
+    bool was_masked = MsixControl() & kMsixFunctionMask;
+    config_.Write(offset, size, value);
+
+    // Sizing writes all-ones and restores the base; anything else would
+    // need the BAR remapped, which this device does not do.
+    uint32_t bar = config_.Read(PciConfigSpace::kBar0, 4);
+    if (bar != bar_base_ && bar != ~(kBarSize - 1) && !warned_bar_move_) {
+        warned_bar_move_ = true;
+        LOG_WARN("VirtIO PCI: device %u BAR0 moved to 0x%X, stays at 0x%X",
+                 ops_->GetDeviceId(), bar, bar_base_);
+    }
+    if (was_masked && !(MsixControl() & kMsixFunctionMask)) DeliverUnmasked();
+}
+
+uint16_t VirtioPciDevice::MsixControl() const {
+    return static_cast<uint16_t>(config_.Read(kCapMsix + 2, 2));
+}
+
+bool VirtioPciDevice::VectorMasked(uint16_t vector) const {
+    return (MsixControl() & kMsixFunctionMask) || (msix_table_[vector].control & 1);
+}
+
+void VirtioPciDevice::Deliver(uint16_t vector) {
+    if (vector >= msix_table_.size() || !(MsixControl() & kMsixEnable)) return;
+    if (VectorMasked(vector)) {
+        msix_pending_[vector / 64] |= 1ULL << (vector % 64);
+        return;
+    }
+    const MsixEntry& e = msix_table_[vector];
+    if (msi_callback_) {
+        msi_callback_((static_cast<uint64_t>(e.addr_hi) << 32) | e.addr_lo, e.data);
+    }
+}
+
+void VirtioPciDevice::DeliverUnmasked() {
+    for (uint16_t v = 0; v < msix_table_.size(); v++) {
+        uint64_t bit = 1ULL << (v % 64);
+        if ((msix_pending_[v / 64] & bit) && !VectorMasked(v)) {
+            msix_pending_[v / 64] &= ~bit;
+            Deliver(v);
+        }
+    }
+}
+
+bool VirtioPciDevice::SignalIntx(uint32_t isr) {
+    if (MsixControl() & kMsixEnable) return false;
+    interrupt_status_.fetch_or(isr, std::memory_order_release);
+    uint16_t command = static_cast<uint16_t>(config_.Read(PciConfigSpace::kCommand, 2));
+    if (!(command & PciConfigSpace::kCommandIntxDisable) && irq_callback_) irq_callback_();
+    return true;
+}
+
+void VirtioPciDevice::ResetVectors() {
+    std::lock_guard<std::mutex> lock(msix_mutex_);
+    config_vector_ = kNoVector;
+    queue_vectors_.assign(queues_.size(), kNoVector);
+}
+
+void VirtioPciDevice::SignalUsed(uint64_t queues) {
+    std::lock_guard<std::mutex> lock(msix_mutex_);
+    if (!queues || SignalIntx(1)) return;
+    // Queues sharing a vector get one message between them.
+    uint16_t sent[64];
+    size_t sent_count = 0;
+    while (queues) {
+        uint32_t idx = static_cast<uint32_t>(std::countr_zero(queues));
+        queues &= queues - 1;
+        if (idx >= queue_vectors_.size()) break;
+        uint16_t vector = queue_vectors_[idx];
+        if (vector == kNoVector) continue;
+        if (std::find(sent, sent + sent_count, vector) != sent + sent_count) continue;
+        sent[sent_count++] = vector;
+        Deliver(vector);
+    }
+}
+
+void VirtioPciDevice::SignalConfig() {
+    interrupt_status_.fetch_or(2, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(msix_mutex_);
+    if (SignalIntx(2)) return;
+    if (config_vector_ != kNoVector) Deliver(config_vector_);
+}
+
+void VirtioPciDevice::RepeatInterrupts() {
+    uint64_t queues = 0;
+    for (uint32_t i = 0; i < queues_.size() && i < 64; i++) {
+        if (queues_[i].IsReady()) queues |= 1ULL << i;
+    }
+    SignalUsed(queues);
+}
+
+void VirtioPciDevice::MmioRead(uint64_t offset, uint8_t size, uint64_t* value) {
+    *value = 0;
+    uint32_t off = static_cast<uint32_t>(offset);
+    if (off < kCommonOffset + kCommonSize) {
+        CommonRead(off - kCommonOffset, size, value);
+    } else if (off == kIsrOffset) {
+        // Read-to-clear; only a driver without MSI-X has a use for it.
+        *value = interrupt_status_.exchange(0, std::memory_order_acq_rel);
+    } else if (off >= kDeviceOffset && off < kDeviceOffset + kDeviceSize) {
+        uint32_t val = 0;
+        ops_->ReadConfig(off - kDeviceOffset, size, &val);
+        *value = val;
+    } else if (off >= kMsixTableOffset && off < kMsixPbaOffset) {
+        uint32_t index = (off - kMsixTableOffset) / sizeof(MsixEntry);
+        uint32_t field = (off - kMsixTableOffset) % sizeof(MsixEntry);
+        std::lock_guard<std::mutex> lock(msix_mutex_);
+        if (index < msix_table_.size() && (size == 4 || size == 8) && field % size == 0) {
+            std::memcpy(value, reinterpret_cast<const uint8_t*>(&msix_table_[index]) + field, size);
+        }
+    } else if (off >= kMsixPbaOffset && off < kMsixPbaOffset + 8 * msix_pending_.size()) {
+        std::lock_guard<std::mutex> lock(msix_mutex_);
+        uint64_t word = msix_pending_[(off - kMsixPbaOffset) / 8];
+        *value = size == 8 ? word : static_cast<uint32_t>(off & 4 ? word >> 32 : word);
+    }
+}
+
+void VirtioPciDevice::MmioWrite(uint64_t offset, uint8_t size, uint64_t value) {
+    uint32_t off = static_cast<uint32_t>(offset);
+    if (off < kCommonOffset + kCommonSize) {
+        CommonWrite(off - kCommonOffset, size, value);
+    } else if (off == kNotifyOffset) {
+        NotifyQueue(static_cast<uint16_t>(value));
+    } else if (off >= kDeviceOffset && off < kDeviceOffset + kDeviceSize) {
+        ops_->WriteConfig(off - kDeviceOffset, size, static_cast<uint32_t>(value));
+    } else if (off >= kMsixTableOffset && off < kMsixPbaOffset) {
+        uint32_t index = (off - kMsixTableOffset) / sizeof(MsixEntry);
+        uint32_t field = (off - kMsixTableOffset) % sizeof(MsixEntry);
+        std::lock_guard<std::mutex> lock(msix_mutex_);
+        if (index >= msix_table_.size() || (size != 4 && size != 8) || field % size) return;
+        auto* entry = reinterpret_cast<uint8_t*>(&msix_table_[index]);
+        std::memcpy(entry + field, &value, size);
+        if (!VectorMasked(static_cast<uint16_t>(index))) DeliverUnmasked();
+    }
+}
+
+void VirtioPciDevice::CommonRead(uint32_t offset, uint8_t size, uint64_t* value) {
+    bool has_queue = queue_sel_ < queues_.size();
+    switch (offset & ~4u) {
+    case kDeviceFeatureSelect:
+        *value = offset == kDeviceFeatureSelect ? device_features_sel_
+               : device_features_sel_ < 2
+                   ? static_cast<uint32_t>(OfferedFeatures() >> (device_features_sel_ * 32))
+                   : 0;
+        return;
+    case kDriverFeatureSelect:
+        *value = offset == kDriverFeatureSelect ? driver_features_sel_
+               : driver_features_sel_ < 2
+                   ? static_cast<uint32_t>(driver_features_ >> (driver_features_sel_ * 32))
+                   : 0;
+        return;
+    case kQueueDesc:
+        if (has_queue) *value = Read64(queue_configs_[queue_sel_].desc_addr, offset, size);
+        return;
+    case kQueueDriver:
+        if (has_queue) *value = Read64(queue_configs_[queue_sel_].driver_addr, offset, size);
+        return;
+    case kQueueDevice:
+        if (has_queue) *value = Read64(queue_configs_[queue_sel_].device_addr, offset, size);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(msix_mutex_);
+    switch (offset) {
+    case kConfigMsixVector:
+        *value = config_vector_;
+        break;
+    case kNumQueues:
+        *value = queues_.size();
+        break;
+    case kDeviceStatus:
+        *value = status_ & 0xFF;
+        break;
+    case kConfigGen:
+        *value = config_generation_ & 0xFF;
+        break;
+    case kQueueSelect:
+        *value = queue_sel_;
+        break;
+    case kQueueSize:
+        // Zero tells the driver the queue does not exist.
+        if (has_queue) {
+            uint32_t num = queue_configs_[queue_sel_].num;
+            *value = num ? num : ops_->GetQueueMaxSize(queue_sel_);
+        }
+        break;
+    case kQueueMsixVector:
+        *value = has_queue ? queue_vectors_[queue_sel_] : kNoVector;
+        break;
+    case kQueueEnable:
+        *value = has_queue && queues_[queue_sel_].IsReady() ? 1 : 0;
+        break;
+    case kQueueNotifyOff:
+        *value = 0;
+        break;
+    default:
+        LOG_DEBUG("VirtIO PCI: unhandled common read offset=0x%02X", offset);
+        break;
+    }
+}
+
+void VirtioPciDevice::CommonWrite(uint32_t offset, uint8_t size, uint64_t value) {
+    uint32_t val = static_cast<uint32_t>(value);
+    bool has_queue = queue_sel_ < queues_.size();
+    switch (offset) {
+    case kDeviceFeatureSelect:
+        device_features_sel_ = val;
+        return;
+    case kDriverFeatureSelect:
+        driver_features_sel_ = val;
+        return;
+    case kDriverFeature:
+        if (driver_features_sel_ == 0)
+            driver_features_ = (driver_features_ & 0xFFFFFFFF00000000ULL) | val;
+        else if (driver_features_sel_ == 1)
+            driver_features_ = (driver_features_ & 0x00000000FFFFFFFFULL) |
+                               (static_cast<uint64_t>(val) << 32);
+        return;
+    case kDeviceStatus:
+        if ((val & 0xFF) == 0) {
+            ops_->OnStatusChange(0);
+            DoReset();
+            ResetVectors();
+        } else {
+            status_ = val & 0xFF;
+            ops_->OnStatusChange(status_);
+        }
+        return;
+    case kQueueSelect:
+        queue_sel_ = val & 0xFFFF;
+        return;
+    case kQueueSize:
+        if (has_queue) SetQueueNum(queue_sel_, val & 0xFFFF);
+        return;
+    case kQueueEnable:
+        // Only a reset turns a queue off again.
+        if (has_queue && (val & 1)) EnableQueue(queue_sel_);
+        return;
+    case kConfigMsixVector:
+    case kQueueMsixVector: {
+        std::lock_guard<std::mutex> lock(msix_mutex_);
+        // A vector past the table reads back as NO_VECTOR, which is how
+        // the driver learns the mapping failed.
+        uint16_t vector = val < msix_table_.size() ? static_cast<uint16_t>(val) : kNoVector;
+        if (offset == kConfigMsixVector) {
+            config_vector_ = vector;
+        } else if (has_queue) {
+            queue_vectors_[queue_sel_] = vector;
+        }
+        return;
+    }
+    }
+
+    if (!has_queue) return;
+    auto& cfg = queue_configs_[queue_sel_];
+    switch (offset & ~4u) {
+    case kQueueDesc:
+        Write64(&cfg.desc_addr, offset, size, value);
+        break;
+    case kQueueDriver:
+        Write64(&cfg.driver_addr, offset, size, value);
+        break;
+    case kQueueDevice:
+        Write64(&cfg.device_addr, offset, size, value);
+        break;
+    default:
+        LOG_DEBUG("VirtIO PCI: unhandled common write offset=0x%02X val=0x%X",
+                  offset, val);
+        break;
+    }
+}
+
+void VirtioPciDevice::SaveState(StateWriter& out) {
+    {
+        std::lock_guard<std::mutex> lock(msix_mutex_);
+        config_.SaveState(out);
+        out.Put(config_vector_);
+        out.PutVector(queue_vectors_);
+        out.PutVector(msix_table_);
+        out.PutVector(msix_pending_);
+    }
+    VirtioMmioDevice::SaveState(out);
+}
+
+bool VirtioPciDevice::LoadState(StateReader& in) {
+    {
+        std::lock_guard<std::mutex> lock(msix_mutex_);
+        size_t vectors = msix_table_.size();
+        size_t queues = queue_vectors_.size();
+        size_t pending = msix_pending_.size();
+        config_.LoadState(in);
+        in.Get(&config_vector_);
+        in.GetVector(&queue_vectors_);
+        in.GetVector(&msix_table_);
+        in.GetVector(&msix_pending_);
+        if (!in.ok() || msix_table_.size() != vectors ||
+            queue_vectors_.size() != queues || msix_pending_.size() != pending) {
+            return false;
+        }
+    }
+    // The table is back before the transport repeats any interrupt.
+    return VirtioMmioDevice::LoadState(in);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "core/device/virtio/virtio_mmio.h"
+#include "core/device/pci/pci_device.h"
+#include <mutex>
+
+// VirtIO PCI transport, modern interface only (spec v1.2, section 4.1).
+// All structures sit in one 32-bit memory BAR at a preassigned address;
+// the device never moves it. Interrupts are MSI-X only, with a vector per
+// queue, so a completion lands on the vCPU the driver steered that queue
+// to and nothing reads an interrupt status register. A driver that does
+// not enable MSI-X gets INTx on pin A and reads the ISR instead; the line
+// goes through the IRQ callback, as on the MMIO transport.
+class VirtioPciDevice : public VirtioMmioDevice, public PciFunction {
+public:
+    static constexpr uint16_t kVendorId     = 0x1AF4;
+    static constexpr uint16_t kDeviceIdBase = 0x1040;  // + virtio device id
+
+    // BAR0 layout
+    static constexpr uint32_t kBarSize         = 0x8000;
+    static constexpr uint32_t kCommonOffset    = 0x0000;
+    static constexpr uint32_t kCommonSize      = 0x003C;
+    static constexpr uint32_t kIsrOffset       = 0x1000;
+    static constexpr uint32_t kDeviceOffset    = 0x2000;
+    static constexpr uint32_t kDeviceSize      = 0x1000;
+    // One doorbell for every queue: notify_off_multiplier is 0 and the
+    // driver writes the queue index, as QueueNotify takes it on MMIO.
+    static constexpr uint32_t kNotifyOffset    = 0x3000;
+    static constexpr uint32_t kMsixTableOffset = 0x4000;
+    static constexpr uint32_t kMsixPbaOffset   = 0x6000;
+
+    static constexpr uint16_t kNoVector = 0xFFFF;
+
+    using MsiCallback = std::function<void(uint64_t address, uint32_t data)>;
+
+    // Sets the transport up over `ops` and builds config space for a BAR
+    // at `bar_base`. One MSI-X vector is offered per queue plus one for
+    // config changes; `intx_irq` is the interrupt line reported for INTx.
+    void Init(VirtioDeviceOps* ops, const GuestMemMap& mem, uint32_t bar_base,
+              uint8_t intx_irq);
+    void SetMsiCallback(MsiCallback cb) { msi_callback_ = std::move(cb); }
+
+    uint32_t BarBase() const { return bar_base_; }
+    uint64_t QueueNotifyOffset() const override { return kNotifyOffset; }
+
+    uint32_t ConfigRead(uint32_t offset, uint8_t size) override;
+    void ConfigWrite(uint32_t offset, uint8_t size, uint32_t value) override;
+
+    void MmioRead(uint64_t offset, uint8_t size, uint64_t* value) override;
+    void MmioWrite(uint64_t offset, uint8_t size, uint64_t value) override;
+    // PCI config, vectors and the MSI-X table, then the transport state.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+
+protected:
+    void SignalUsed(uint64_t queues) override;
+    void SignalConfig() override;
+    void RepeatInterrupts() override;
+
+private:
+    // Capability offsets in config space
+    static constexpr uint32_t kCapCommon = 0x40;
+    static constexpr uint32_t kCapNotify = 0x50;
+    static constexpr uint32_t kCapIsr    = 0x64;
+    static constexpr uint32_t kCapDevice = 0x74;
+    static constexpr uint32_t kCapMsix   = 0x84;
+
+    static constexpr uint16_t kMsixEnable       = 1 << 15;
+    static constexpr uint16_t kMsixFunctionMask = 1 << 14;
+
+    struct MsixEntry {
+        uint32_t addr_lo = 0;
+        uint32_t addr_hi = 0;
+        uint32_t data = 0;
+        uint32_t control = 1;  // masked until the driver programs it
+    };
+
+    void AddVirtioCap(uint32_t offset, uint32_t next, uint8_t type,
+                      uint32_t bar_offset, uint32_t length, uint8_t cap_len = 16);
+    void CommonRead(uint32_t offset, uint8_t size, uint64_t* value);
+    void CommonWrite(uint32_t offset, uint8_t size, uint64_t value);
+    void ResetVectors();
+    // Sends `vector`, or latches it in the PBA while it is masked.
+    // Callers hold msix_mutex_.
+    void Deliver(uint16_t vector);
+    // Sends what the PBA holds for vectors no longer masked.
+    void DeliverUnmasked();
+    // With MSI-X disabled, sets `isr` in the ISR and raises INTx unless the
+    // driver disabled it. Returns false while MSI-X is enabled.
+    // Callers hold msix_mutex_.
+    bool SignalIntx(uint32_t isr);
+    bool VectorMasked(uint16_t vector) const;
+    uint16_t MsixControl() const;
+
+    uint32_t bar_base_ = 0;
+    MsiCallback msi_callback_;
+
+    // Config space, vectors, the table and the PBA. Config writes come in
+    // under the host bridge's lock, BAR accesses under this device's, and
+    // interrupts from device threads.
+    mutable std::mutex msix_mutex_;
+    PciConfigSpace config_;
+    uint16_t config_vector_ = kNoVector;
+    std::vector<uint16_t> queue_vectors_;
+    std::vector<MsixEntry> msix_table_;
+    std::vector<uint64_t> msix_pending_;
+    bool warned_bar_move_ = false;
+};
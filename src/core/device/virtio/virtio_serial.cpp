@@ -7,7 +7,9 @@ VirtioSerialDevice::VirtioSerialDevice(uint32_t max_ports)
     : max_ports_(max_ports) {
     std::memset(&config_, 0, sizeof(config_));
     config_.max_nr_ports = max_ports;
-    ports_.resize(max_ports);
+    for (uint32_t i = 0; i < max_ports; i++) {
+        ports_.push_back(std::make_unique<PortState>());
+    }
 }
 
 uint64_t VirtioSerialDevice::GetDeviceFeatures() const {
@@ -25,15 +27,19 @@ uint32_t VirtioSerialDevice::GetNumQueues() const {
 }
 
 bool VirtioSerialDevice::IsPortConnected(uint32_t port_id) const {
-    std::lock_guard<std::recursive_mutex> lock(const_cast<std::recursive_mutex&>(mutex_));
     if (port_id >= ports_.size()) return false;
-    return ports_[port_id].guest_connected;
+    return ports_[port_id]->guest_connected.load();
 }
 
 void VirtioSerialDevice::SetPortName(uint32_t port_id, const std::string& name) {
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (port_id < ports_.size()) {
-        ports_[port_id].name = name;
+        ports_[port_id]->name = name;
+    }
+}
+
+void VirtioSerialDevice::SetConsolePort(uint32_t port_id) {
+    if (port_id < ports_.size()) {
+        ports_[port_id]->console = true;
     }
 }
 
@@ -52,21 +58,68 @@ void VirtioSerialDevice::WriteConfig(uint32_t offset, uint8_t size, uint32_t val
 }
 
 void VirtioSerialDevice::OnStatusChange(uint32_t new_status) {
+    std::lock_guard<std::mutex> lock(control_mutex_);
     if ((new_status & 0x4) && !driver_ready_) {
         driver_ready_ = true;
         LOG_INFO("VirtIO Serial: driver ready");
     }
 }
 
-void VirtioSerialDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
+void VirtioSerialDevice::SaveState(StateWriter& out) {
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    paused_ = true;
+    // A SendData already past its paused_ check finishes before the save.
+    for (auto& port : ports_) {
+        std::lock_guard<std::mutex> port_lock(port->rx_mutex);
+    }
+    out.Put(driver_ready_);
+    out.Put(static_cast<uint32_t>(ports_.size()));
+    for (const auto& port : ports_) out.Put(port->guest_connected.load());
+}
+
+void VirtioSerialDevice::ResumeAfterSave() {
+    paused_ = false;
+    for (uint32_t i = 0; i < ports_.size(); i++) FlushQueued(i);
+}
+
+bool VirtioSerialDevice::LoadState(StateReader& in) {
+    std::vector<uint32_t> opened;
+    {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        uint32_t count = 0;
+        in.Get(&driver_ready_);
+        in.Get(&count);
+        if (!in.ok() || count != ports_.size()) return false;
+        for (uint32_t i = 0; i < count; i++) {
+            bool connected = false;
+            in.Get(&connected);
+            ports_[i]->guest_connected = connected;
+            if (connected) opened.push_back(i);
+        }
+        if (!in.ok()) return false;
+    }
+    if (port_open_callback_) {
+        for (uint32_t id : opened) port_open_callback_(id, true);
+    }
+    return true;
+}
 
+void VirtioSerialDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
     if (queue_idx == 2) {
         // Control receiveq - guest provides buffers for us to fill
         return;
     } else if (queue_idx == 3) {
         // Control transmitq - guest sends control messages
-        HandleControlMessage(vq);
+        std::vector<std::pair<uint32_t, bool>> changes;
+        {
+            std::lock_guard<std::mutex> lock(control_mutex_);
+            HandleControlMessage(vq, &changes);
+        }
+        if (port_open_callback_) {
+            for (const auto& [port_id, opened] : changes) {
+                port_open_callback_(port_id, opened);
+            }
+        }
     } else if (queue_idx == 1) {
         // Port 0 transmitq
         HandlePortTx(0, vq);
@@ -76,14 +129,22 @@ void VirtioSerialDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
         if (port_id < max_ports_) {
             HandlePortTx(port_id, vq);
         }
+    } else if (queue_idx == 0) {
+        // Port 0 receiveq: the guest added buffers
+        FlushQueued(0);
+    } else if (queue_idx >= 4 && ((queue_idx - 4) % 2 == 0)) {
+        uint32_t port_id = 1 + (queue_idx - 4) / 2;
+        if (port_id < max_ports_) {
+            FlushQueued(port_id);
+        }
     }
-    // Receiveq notifications (0, 4, 6, ...) are for guest providing buffers
 }
 
-void VirtioSerialDevice::HandleControlMessage(VirtQueue& vq) {
+void VirtioSerialDevice::HandleControlMessage(
+        VirtQueue& vq, std::vector<std::pair<uint32_t, bool>>* changes) {
     uint16_t head;
     while (vq.PopAvail(&head)) {
-        std::vector<VirtqChainElem> chain;
+        thread_local VirtqChain chain;
         if (!vq.WalkChain(head, &chain)) {
             vq.PushUsed(head, 0);
             continue;
@@ -117,7 +178,10 @@ void VirtioSerialDevice::HandleControlMessage(VirtQueue& vq) {
 
         case VIRTIO_CONSOLE_PORT_READY:
             if (ctrl.id < ports_.size() && ctrl.value == 1) {
-                if (!ports_[ctrl.id].name.empty()) {
+                if (ports_[ctrl.id]->console) {
+                    // The guest binds an hvc to it and opens it itself.
+                    SendControlMessage(ctrl.id, VIRTIO_CONSOLE_CONSOLE_PORT, 1);
+                } else if (!ports_[ctrl.id]->name.empty()) {
                     SendPortName(ctrl.id);
                 }
                 SendControlMessage(ctrl.id, VIRTIO_CONSOLE_PORT_OPEN, 1);
@@ -127,12 +191,16 @@ void VirtioSerialDevice::HandleControlMessage(VirtQueue& vq) {
         case VIRTIO_CONSOLE_PORT_OPEN:
             if (ctrl.id < ports_.size()) {
                 bool opened = (ctrl.value == 1);
-                ports_[ctrl.id].guest_connected = opened;
+                PortState& port = *ports_[ctrl.id];
+                {
+                    std::lock_guard<std::mutex> port_lock(port.rx_mutex);
+                    port.guest_connected = opened;
+                    port.queued.clear();
+                    port.queued_offset = 0;
+                }
                 LOG_INFO("VirtIO Serial port %u: guest %s",
                          ctrl.id, ctrl.value ? "opened" : "closed");
-                if (port_open_callback_) {
-                    port_open_callback_(ctrl.id, opened);
-                }
+                changes->emplace_back(ctrl.id, opened);
             }
             break;
 
@@ -147,16 +215,20 @@ void VirtioSerialDevice::HandleControlMessage(VirtQueue& vq) {
 }
 
 void VirtioSerialDevice::HandlePortTx(uint32_t port_id, VirtQueue& vq) {
+    PortState& port = *ports_[port_id];
+    std::lock_guard<std::mutex> lock(port.tx_mutex);
+
     uint16_t head;
     while (vq.PopAvail(&head)) {
-        std::vector<VirtqChainElem> chain;
+        thread_local VirtqChain chain;
         if (!vq.WalkChain(head, &chain)) {
             vq.PushUsed(head, 0);
             continue;
         }
 
         // Collect data from chain
-        std::vector<uint8_t> data;
+        std::vector<uint8_t>& data = port.tx_buffer;
+        data.clear();
         for (const auto& elem : chain) {
             if (elem.writable) continue;
             data.insert(data.end(), elem.addr, elem.addr + elem.len);
@@ -186,7 +258,7 @@ void VirtioSerialDevice::SendControlMessage(uint32_t port_id, uint16_t event, ui
         return;
     }
 
-    std::vector<VirtqChainElem> chain;
+    thread_local VirtqChain chain;
     if (!vq->WalkChain(head, &chain)) {
         vq->PushUsed(head, 0);
         mmio_->NotifyUsedBuffer();
@@ -216,7 +288,7 @@ void VirtioSerialDevice::SendControlMessage(uint32_t port_id, uint16_t event, ui
 
 void VirtioSerialDevice::SendPortName(uint32_t port_id) {
     if (!mmio_ || port_id >= ports_.size()) return;
-    const std::string& name = ports_[port_id].name;
+    const std::string& name = ports_[port_id]->name;
     if (name.empty()) return;
 
     VirtQueue* vq = mmio_->GetQueue(2);  // Control receiveq
@@ -225,7 +297,7 @@ void VirtioSerialDevice::SendPortName(uint32_t port_id) {
     uint16_t head;
     if (!vq->PopAvail(&head)) return;
 
-    std::vector<VirtqChainElem> chain;
+    thread_local VirtqChain chain;
     if (!vq->WalkChain(head, &chain)) {
         vq->PushUsed(head, 0);
         mmio_->NotifyUsedBuffer();
@@ -256,35 +328,30 @@ void VirtioSerialDevice::SendPortName(uint32_t port_id) {
     LOG_INFO("VirtIO Serial: sent port name '%s' for port %u", name.c_str(), port_id);
 }
 
-bool VirtioSerialDevice::SendData(uint32_t port_id, const uint8_t* data, size_t len) {
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
-
-    if (!mmio_ || port_id >= ports_.size() || !data || len == 0) {
-        return false;
-    }
-
-    if (!ports_[port_id].guest_connected) {
-        LOG_DEBUG("VirtIO Serial: port %u not connected, dropping data", port_id);
-        return false;
-    }
+size_t VirtioSerialDevice::QueuedBytes(uint32_t port_id) const {
+    if (port_id >= ports_.size()) return 0;
+    PortState& port = *ports_[port_id];
+    std::lock_guard<std::mutex> lock(port.rx_mutex);
+    return port.queued.size() - port.queued_offset;
+}
 
+size_t VirtioSerialDevice::FillRxBuffers(uint32_t port_id, const uint8_t* data, size_t len) {
     // Determine receive queue index for this port
     uint32_t rx_queue = (port_id == 0) ? 0 : (4 + (port_id - 1) * 2);
 
     VirtQueue* vq = mmio_->GetQueue(rx_queue);
     if (!vq || !vq->IsReady()) {
-        return false;
+        return 0;
     }
 
     size_t offset = 0;
     while (offset < len) {
         uint16_t head;
         if (!vq->PopAvail(&head)) {
-            LOG_DEBUG("VirtIO Serial: no buffers for port %u data", port_id);
             break;
         }
 
-        std::vector<VirtqChainElem> chain;
+        thread_local VirtqChain chain;
         if (!vq->WalkChain(head, &chain)) {
             vq->PushUsed(head, 0);
             continue;
@@ -293,7 +360,7 @@ bool VirtioSerialDevice::SendData(uint32_t port_id, const uint8_t* data, size_t
         uint32_t written = 0;
         for (auto& elem : chain) {
             if (!elem.writable) continue;
-            uint32_t to_copy = std::min(elem.len, static_cast<uint32_t>(len - offset));
+            uint32_t to_copy = std::min(elem.len, static_cast<uint32_t>(std::min<size_t>(len - offset, UINT32_MAX)));
             std::memcpy(elem.addr, data + offset, to_copy);
             written += to_copy;
             offset += to_copy;
@@ -302,7 +369,65 @@ bool VirtioSerialDevice::SendData(uint32_t port_id, const uint8_t* data, size_t
 
         vq->PushUsed(head, written);
     }
+    return offset;
+}
 
+void VirtioSerialDevice::FlushQueued(uint32_t port_id) {
+    PortState& port = *ports_[port_id];
+    {
+        std::lock_guard<std::mutex> lock(port.rx_mutex);
+        FlushQueuedLocked(port_id, port);
+    }
+    if (drain_callback_ && !paused_) drain_callback_(port_id);
+}
+
+void VirtioSerialDevice::FlushQueuedLocked(uint32_t port_id, PortState& port) {
+    size_t pending = port.queued.size() - port.queued_offset;
+    if (!mmio_ || paused_ || pending == 0 || !port.guest_connected) return;
+
+    size_t sent = FillRxBuffers(port_id, port.queued.data() + port.queued_offset, pending);
+    if (sent == 0) return;
+    port.queued_offset += sent;
+    if (port.queued_offset == port.queued.size()) {
+        port.queued.clear();
+        port.queued_offset = 0;
+    }
     mmio_->NotifyUsedBuffer();
-    return offset == len;
+}
+
+bool VirtioSerialDevice::SendData(uint32_t port_id, const uint8_t* data, size_t len) {
+    if (!mmio_ || port_id >= ports_.size() || !data || len == 0) {
+        return false;
+    }
+
+    PortState& port = *ports_[port_id];
+    std::lock_guard<std::mutex> lock(port.rx_mutex);
+    if (paused_) return false;
+    if (!port.guest_connected) {
+        LOG_DEBUG("VirtIO Serial: port %u not connected, dropping data", port_id);
+        return false;
+    }
+
+    // Checked before any of it goes out: a part of a message would leave
+    // the port's stream out of step with whatever follows.
+    size_t pending = port.queued.size() - port.queued_offset;
+    if (pending + len > kMaxQueuedBytes) {
+        LOG_WARN("VirtIO Serial: port %u queue full, dropping %zu bytes", port_id, len);
+        return false;
+    }
+
+    // Behind queued data, so it goes out in order.
+    size_t sent = 0;
+    if (pending == 0) {
+        sent = FillRxBuffers(port_id, data, len);
+        if (sent) mmio_->NotifyUsedBuffer();
+        if (sent == len) return true;
+    }
+
+    if (port.queued_offset > 0 && port.queued_offset >= port.queued.size() / 2) {
+        port.queued.erase(port.queued.begin(), port.queued.begin() + port.queued_offset);
+        port.queued_offset = 0;
+    }
+    port.queued.insert(port.queued.end(), data + sent, data + len);
+    return true;
 }
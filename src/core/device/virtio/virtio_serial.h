@@ -1,8 +1,10 @@
 #pragma once
 
 #include "core/device/virtio/virtio_mmio.h"
+#include <atomic>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -50,6 +52,7 @@ class VirtioSerialDevice : public VirtioDeviceOps {
 public:
     using DataCallback = std::function<void(uint32_t port_id, const uint8_t* data, size_t len)>;
     using PortOpenCallback = std::function<void(uint32_t port_id, bool opened)>;
+    using DrainCallback = std::function<void(uint32_t port_id)>;
 
     explicit VirtioSerialDevice(uint32_t max_ports = 1);
     ~VirtioSerialDevice() override = default;
@@ -62,13 +65,29 @@ public:
     // Set callback for port open/close events
     void SetPortOpenCallback(PortOpenCallback cb) { port_open_callback_ = std::move(cb); }
 
+    // Set callback for a port's queue having moved on to the guest (or
+    // the guest having added receive buffers), so a sender holding data
+    // back can queue more. Runs with no device lock held.
+    void SetDrainCallback(DrainCallback cb) { drain_callback_ = std::move(cb); }
+
     bool IsPortConnected(uint32_t port_id) const;
 
     // Configure port name (must be called before guest driver initialization)
     void SetPortName(uint32_t port_id, const std::string& name);
 
-    // Send data to guest on specified port
+    // Offers the port to the guest as a console (hvc) instead of a named
+    // port. Same timing rule as SetPortName.
+    void SetConsolePort(uint32_t port_id);
+
+    // Send data to guest on specified port. What the guest has no buffers
+    // for yet is queued, up to kMaxQueuedBytes per port, and delivered in
+    // order as it adds some. Takes all of `data` or none of it, so a
+    // message is never cut; returns false if it was dropped.
     bool SendData(uint32_t port_id, const uint8_t* data, size_t len);
+    // Bytes accepted by SendData that the guest has not received yet.
+    size_t QueuedBytes(uint32_t port_id) const;
+
+    static constexpr size_t kMaxQueuedBytes = 16 * 1024 * 1024;
 
     // VirtioDeviceOps interface
     uint32_t GetDeviceId() const override { return 3; }
@@ -79,25 +98,56 @@ public:
     void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
     void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
     void OnStatusChange(uint32_t new_status) override;
+    // Ports the guest had open are reported open again on load, so the
+    // host side handlers (vdagent, guest agent) start over as on connect.
+    // SendData fails from SaveState until ResumeAfterSave.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+    void ResumeAfterSave() override;
 
 private:
-    void HandleControlMessage(VirtQueue& vq);
+    // Each port has its own locks, so a busy port (vdagent moving clipboard
+    // data) never holds up another (guest agent, console). Lock order:
+    // control_mutex_, then a port's rx_mutex. The data callback runs under
+    // the port's tx_mutex only, which keeps that port's data in order; the
+    // port open callback runs with no device lock held. Both may call
+    // SendData on any port.
+    struct PortState {
+        std::string name;       // fixed before the driver starts
+        bool console = false;   // likewise
+        std::atomic<bool> guest_connected{false};
+
+        std::mutex rx_mutex;    // the port's receiveq and its queue
+        std::vector<uint8_t> queued;  // waiting for guest buffers
+        size_t queued_offset = 0;     // delivered prefix of `queued`
+
+        std::mutex tx_mutex;    // the port's transmitq
+        std::vector<uint8_t> tx_buffer;
+    };
+
+    // Under control_mutex_. Appends ports the guest opened or closed to
+    // `changes`, for the callback once the lock is released.
+    void HandleControlMessage(VirtQueue& vq,
+                              std::vector<std::pair<uint32_t, bool>>* changes);
     void HandlePortTx(uint32_t port_id, VirtQueue& vq);
+    // Under control_mutex_.
     void SendControlMessage(uint32_t port_id, uint16_t event, uint16_t value);
     void SendPortName(uint32_t port_id);
-
-    struct PortState {
-        std::string name;
-        bool guest_connected = false;
-        bool host_connected = true;
-    };
+    // Under the port's rx_mutex. Copies into its receive buffers; returns
+    // the bytes taken.
+    size_t FillRxBuffers(uint32_t port_id, const uint8_t* data, size_t len);
+    // Delivers what SendData queued, as far as buffers allow.
+    void FlushQueued(uint32_t port_id);
+    void FlushQueuedLocked(uint32_t port_id, PortState& port);
 
     VirtioMmioDevice* mmio_ = nullptr;
     VirtioConsoleConfig config_{};
     uint32_t max_ports_ = 1;
-    std::vector<PortState> ports_;
+    std::vector<std::unique_ptr<PortState>> ports_;
     DataCallback data_callback_;
     PortOpenCallback port_open_callback_;
-    std::recursive_mutex mutex_;
+    DrainCallback drain_callback_;
+    std::mutex control_mutex_;  // the control queues and driver_ready_
     bool driver_ready_ = false;
+    std::atomic<bool> paused_{false};
 };
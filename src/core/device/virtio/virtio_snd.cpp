@@ -12,14 +12,43 @@ constexpr uint64_t VIRTIO_SND_VER1 = 1ULL << 32;
 static constexpr uint64_t VIRTIO_SND_VER1 = 1ULL << 32;
 #endif
 
+namespace {
+
+// A host clock that has not moved for this long no longer paces a stream.
+constexpr auto kHostClockTimeout = std::chrono::milliseconds(200);
+// Captured audio beyond this many RX buffers is cut back to two, so a
+// guest reading slower than the microphone does not fall behind it.
+constexpr size_t kMaxCaptureBacklog = 4;
+
+// Copies `len` bytes into the device-writable part of `chain`, starting
+// `offset` bytes into it.
+void CopyToWritable(VirtqChain& chain, size_t offset, const void* data, size_t len) {
+    auto* src = static_cast<const uint8_t*>(data);
+    for (auto& elem : chain) {
+        if (!elem.writable || !len) continue;
+        if (offset >= elem.len) {
+            offset -= elem.len;
+            continue;
+        }
+        size_t n = (std::min)(static_cast<size_t>(elem.len) - offset, len);
+        std::memcpy(elem.addr + offset, src, n);
+        src += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+} // namespace
+
 VirtioSndDevice::VirtioSndDevice() {
     snd_config_.jacks = 0;
-    snd_config_.streams = 1;
-    snd_config_.chmaps = 1;
+    snd_config_.streams = kNumStreams;
+    snd_config_.chmaps = kNumStreams;
 }
 
 VirtioSndDevice::~VirtioSndDevice() {
     StopPeriodTimer();
+    StopCapture();
 }
 
 uint64_t VirtioSndDevice::GetDeviceFeatures() const {
@@ -43,16 +72,92 @@ void VirtioSndDevice::WriteConfig(uint32_t offset, uint8_t size, uint32_t value)
 void VirtioSndDevice::OnStatusChange(uint32_t new_status) {
     if (new_status == 0) {
         StopPeriodTimer();
-        stream_state_ = StreamState::kIdle;
-        pcm_sample_rate_ = 48000;
-        pcm_channels_ = 2;
-        pcm_format_ = VIRTIO_SND_PCM_FMT_S16;
+        StopCapture();
+        if (audio_port_ && streams_[kRxStream].state == StreamState::kRunning) {
+            audio_port_->SetCaptureActive(false);
+        }
+        {
+            std::lock_guard<std::mutex> lock(period_mutex_);
+            for (auto& stream : streams_) stream = PcmStream{};
+        }
         event_buf_heads_.clear();
         {
             std::lock_guard<std::mutex> lock(tx_mutex_);
             pending_tx_buffers_.clear();
         }
+        {
+            std::lock_guard<std::mutex> lock(rx_mutex_);
+            pending_rx_heads_.clear();
+        }
+    }
+}
+
+void VirtioSndDevice::SaveState(StateWriter& out) {
+    StopPeriodTimer();
+    StopCapture();
+    for (const auto& stream : streams_) {
+        out.Put(stream.state);
+        out.Put(stream.sample_rate);
+        out.Put(stream.channels);
+        out.Put(stream.format);
+        out.Put(stream.buffer_bytes);
+        out.Put(stream.period_bytes);
     }
+    out.PutVector(event_buf_heads_);
+    {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        out.Put(static_cast<uint32_t>(pending_tx_buffers_.size()));
+        for (const auto& buf : pending_tx_buffers_) {
+            out.Put(buf.head);
+            out.Put(buf.status_len);
+            out.PutVector(buf.pcm_data);
+        }
+    }
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    out.PutVector(std::vector<uint16_t>(pending_rx_heads_.begin(), pending_rx_heads_.end()));
+}
+
+bool VirtioSndDevice::LoadState(StateReader& in) {
+    uint32_t count = 0;
+    for (auto& stream : streams_) {
+        in.Get(&stream.state);
+        in.Get(&stream.sample_rate);
+        in.Get(&stream.channels);
+        in.Get(&stream.format);
+        in.Get(&stream.buffer_bytes);
+        in.Get(&stream.period_bytes);
+    }
+    in.GetVector(&event_buf_heads_);
+    in.Get(&count);
+    {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        pending_tx_buffers_.clear();
+        for (uint32_t i = 0; i < count && in.ok(); i++) {
+            PendingTxBuffer buf;
+            in.Get(&buf.head);
+            in.Get(&buf.status_len);
+            in.GetVector(&buf.pcm_data);
+            pending_tx_buffers_.push_back(std::move(buf));
+        }
+    }
+    std::vector<uint16_t> rx_heads;
+    in.GetVector(&rx_heads);
+    {
+        std::lock_guard<std::mutex> lock(rx_mutex_);
+        pending_rx_heads_.assign(rx_heads.begin(), rx_heads.end());
+    }
+    if (!in.ok()) return false;
+    // The host of a restored VM has to open its microphone afresh.
+    if (audio_port_ && streams_[kRxStream].state == StreamState::kRunning) {
+        audio_port_->SetCaptureActive(true);
+    }
+    ResumeAfterSave();
+    return true;
+}
+
+void VirtioSndDevice::ResumeAfterSave() {
+    if (streams_[kTxStream].state == StreamState::kRunning) StartPeriodTimer();
+    if (streams_[kRxStream].state == StreamState::kRunning) StartCapture();
 }
 
 void VirtioSndDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
@@ -67,6 +172,7 @@ void VirtioSndDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
         ProcessTxQueue(vq);
         break;
     case VIRTIO_SND_VQ_RX:
+        ProcessRxQueue(vq);
         break;
     }
 }
@@ -74,7 +180,7 @@ void VirtioSndDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
 void VirtioSndDevice::ProcessControlQueue(VirtQueue& vq) {
     uint16_t head;
     while (vq.PopAvail(&head)) {
-        std::vector<VirtqChainElem> chain;
+        thread_local VirtqChain chain;
         if (!vq.WalkChain(head, &chain)) {
             vq.PushUsed(head, 0);
             continue;
@@ -188,7 +294,7 @@ void VirtioSndDevice::ProcessEventQueue(VirtQueue& vq) {
 void VirtioSndDevice::ProcessTxQueue(VirtQueue& vq) {
     uint16_t head;
     while (vq.PopAvail(&head)) {
-        std::vector<VirtqChainElem> chain;
+        thread_local VirtqChain chain;
         if (!vq.WalkChain(head, &chain)) {
             vq.PushUsed(head, 0);
             continue;
@@ -220,7 +326,7 @@ void VirtioSndDevice::ProcessTxQueue(VirtQueue& vq) {
 
         // Copy PCM data directly from descriptor chain, skipping the xfer header
         if (total_readable > sizeof(VirtioSndPcmXfer) &&
-            pcm_format_ == VIRTIO_SND_PCM_FMT_S16) {
+            streams_[kTxStream].format == VIRTIO_SND_PCM_FMT_S16) {
             size_t pcm_bytes = total_readable - sizeof(VirtioSndPcmXfer);
             pending.pcm_data.resize(pcm_bytes / sizeof(int16_t));
             auto* dst = reinterpret_cast<uint8_t*>(pending.pcm_data.data());
@@ -245,6 +351,15 @@ void VirtioSndDevice::ProcessTxQueue(VirtQueue& vq) {
     }
 }
 
+void VirtioSndDevice::ProcessRxQueue(VirtQueue& vq) {
+    // Filled by the capture thread as audio comes in.
+    uint16_t head;
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    while (vq.PopAvail(&head)) {
+        pending_rx_heads_.push_back(head);
+    }
+}
+
 void VirtioSndDevice::HandlePcmInfo(const VirtioSndQueryInfo* query,
                                      uint8_t* resp, uint32_t* resp_len) {
     auto* status = reinterpret_cast<VirtioSndHdr*>(resp);
@@ -268,7 +383,8 @@ void VirtioSndDevice::HandlePcmInfo(const VirtioSndQueryInfo* query,
         info->formats = (1ULL << VIRTIO_SND_PCM_FMT_S16);
         // Only 48000 Hz - matches typical WASAPI mix format, avoids resampling
         info->rates = (1ULL << VIRTIO_SND_PCM_RATE_48000);
-        info->direction = VIRTIO_SND_D_OUTPUT;
+        info->direction = query->start_id + i == kRxStream ? VIRTIO_SND_D_INPUT
+                                                           : VIRTIO_SND_D_OUTPUT;
         info->channels_min = 2;
         info->channels_max = 2;
         info_ptr += sizeof(VirtioSndPcmInfo);
@@ -287,15 +403,21 @@ void VirtioSndDevice::HandlePcmSetParams(const VirtioSndPcmSetParams* params,
         return;
     }
 
-    pcm_channels_ = params->channels;
-    pcm_format_ = params->format;
-    pcm_buffer_bytes_ = params->buffer_bytes;
-    pcm_period_bytes_ = params->period_bytes;
-    pcm_sample_rate_ = RateEnumToHz(params->rate);
+    PcmStream stream;
+    {
+        std::lock_guard<std::mutex> lock(period_mutex_);
+        PcmStream& s = streams_[params->hdr.stream_id];
+        s.channels = params->channels;
+        s.format = params->format;
+        s.buffer_bytes = params->buffer_bytes;
+        s.period_bytes = params->period_bytes;
+        s.sample_rate = RateEnumToHz(params->rate);
+        stream = s;
+    }
 
-    LOG_INFO("virtio-snd SET_PARAMS: rate=%uHz ch=%u fmt=%u buf=%u period=%u",
-             pcm_sample_rate_, pcm_channels_, pcm_format_,
-             pcm_buffer_bytes_, pcm_period_bytes_);
+    LOG_INFO("virtio-snd SET_PARAMS: stream=%u rate=%uHz ch=%u fmt=%u buf=%u period=%u",
+             params->hdr.stream_id, stream.sample_rate, stream.channels, stream.format,
+             stream.buffer_bytes, stream.period_bytes);
 
     status->code = VIRTIO_SND_S_OK;
     *resp_len = sizeof(VirtioSndHdr);
@@ -311,25 +433,49 @@ void VirtioSndDevice::HandlePcmStreamCmd(uint32_t code, uint32_t stream_id,
         return;
     }
 
-    switch (code) {
-    case VIRTIO_SND_R_PCM_PREPARE:
-        StopPeriodTimer();
-        stream_state_ = StreamState::kPrepared;
-        break;
-    case VIRTIO_SND_R_PCM_START:
-        stream_state_ = StreamState::kRunning;
-        StartPeriodTimer();
-        break;
-    case VIRTIO_SND_R_PCM_STOP:
-        StopPeriodTimer();
-        FlushPendingTxBuffers();
-        stream_state_ = StreamState::kPrepared;
-        break;
-    case VIRTIO_SND_R_PCM_RELEASE:
-        StopPeriodTimer();
-        FlushPendingTxBuffers();
-        stream_state_ = StreamState::kIdle;
-        break;
+    StreamState& state = streams_[stream_id].state;
+    if (stream_id == kRxStream) {
+        bool was_running = state == StreamState::kRunning;
+        switch (code) {
+        case VIRTIO_SND_R_PCM_PREPARE:
+            StopCapture();
+            state = StreamState::kPrepared;
+            break;
+        case VIRTIO_SND_R_PCM_START:
+            state = StreamState::kRunning;
+            StartCapture();
+            break;
+        case VIRTIO_SND_R_PCM_STOP:
+        case VIRTIO_SND_R_PCM_RELEASE:
+            StopCapture();
+            FlushPendingRxBuffers();
+            state = code == VIRTIO_SND_R_PCM_STOP ? StreamState::kPrepared
+                                                  : StreamState::kIdle;
+            break;
+        }
+        bool running = state == StreamState::kRunning;
+        if (audio_port_ && running != was_running) audio_port_->SetCaptureActive(running);
+    } else {
+        switch (code) {
+        case VIRTIO_SND_R_PCM_PREPARE:
+            StopPeriodTimer();
+            state = StreamState::kPrepared;
+            break;
+        case VIRTIO_SND_R_PCM_START:
+            state = StreamState::kRunning;
+            StartPeriodTimer();
+            break;
+        case VIRTIO_SND_R_PCM_STOP:
+            StopPeriodTimer();
+            FlushPendingTxBuffers();
+            state = StreamState::kPrepared;
+            break;
+        case VIRTIO_SND_R_PCM_RELEASE:
+            StopPeriodTimer();
+            FlushPendingTxBuffers();
+            state = StreamState::kIdle;
+            break;
+        }
     }
 
     status->code = VIRTIO_SND_S_OK;
@@ -354,7 +500,8 @@ void VirtioSndDevice::HandleChmapInfo(const VirtioSndQueryInfo* query,
         auto* info = reinterpret_cast<VirtioSndChmapInfo*>(info_ptr);
         std::memset(info, 0, sizeof(*info));
         info->hdr.hda_fn_nid = 0;
-        info->direction = VIRTIO_SND_D_OUTPUT;
+        info->direction = query->start_id + i == kRxStream ? VIRTIO_SND_D_INPUT
+                                                           : VIRTIO_SND_D_OUTPUT;
         info->channels = 2;
         info->positions[0] = VIRTIO_SND_CHMAP_FL;
         info->positions[1] = VIRTIO_SND_CHMAP_FR;
@@ -401,9 +548,44 @@ void VirtioSndDevice::StopPeriodTimer() {
     }
 }
 
+bool VirtioSndDevice::SubmitTxFrames(size_t max_frames, uint32_t sample_rate,
+                                     uint8_t channels) {
+    AudioChunk chunk;
+    chunk.sample_rate = sample_rate;
+    chunk.channels = channels;
+    PendingTxBuffer done{};
+    bool complete = false;
+    {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        if (pending_tx_buffers_.empty()) return false;
+        auto& buf = pending_tx_buffers_.front();
+        size_t samples = (std::min)(max_frames * channels, buf.pcm_data.size());
+        chunk.pcm.assign(buf.pcm_data.begin(), buf.pcm_data.begin() + samples);
+        buf.pcm_data.erase(buf.pcm_data.begin(), buf.pcm_data.begin() + samples);
+        if (buf.pcm_data.empty()) {
+            done = std::move(buf);
+            pending_tx_buffers_.pop_front();
+            complete = true;
+        }
+    }
+
+    if (!chunk.pcm.empty() && audio_port_) audio_port_->SubmitPcm(std::move(chunk));
+    if (complete && mmio_) {
+        auto* txq = mmio_->GetQueue(VIRTIO_SND_VQ_TX);
+        if (txq) {
+            txq->PushUsed(done.head, done.status_len);
+            mmio_->NotifyUsedBuffer();
+        }
+    }
+    return true;
+}
+
 void VirtioSndDevice::PeriodTimerThread() {
     auto start_time = std::chrono::steady_clock::now();
     uint64_t bytes_processed = 0;  // Track audio position in bytes
+    // Host player position, and when it last moved.
+    uint32_t last_played = 0;
+    auto last_progress = start_time;
 
     while (period_running_) {
         // Get current stream parameters
@@ -411,9 +593,9 @@ void VirtioSndDevice::PeriodTimerThread() {
         uint8_t channels;
         {
             std::lock_guard<std::mutex> lock(period_mutex_);
-            sample_rate = pcm_sample_rate_;
-            period_bytes = pcm_period_bytes_;
-            channels = pcm_channels_;
+            sample_rate = streams_[kTxStream].sample_rate;
+            period_bytes = streams_[kTxStream].period_bytes;
+            channels = streams_[kTxStream].channels;
         }
 
         if (sample_rate == 0 || period_bytes == 0 || channels == 0) {
@@ -423,10 +605,35 @@ void VirtioSndDevice::PeriodTimerThread() {
             continue;
         }
 
+        auto now = std::chrono::steady_clock::now();
+        AudioClock clock;
+        bool host_clock = audio_port_ && audio_port_->GetPlaybackClock(&clock);
+        if (host_clock) {
+            if (clock.played != last_played || clock.queued == 0) {
+                last_played = clock.played;
+                last_progress = now;
+            }
+            // A player that stopped reading no longer sets the pace.
+            host_clock = now - last_progress < kHostClockTimeout;
+        }
+        if (host_clock) {
+            // Top the player up to its target as it plays, so the guest
+            // gets its buffers back on the host's clock.
+            size_t room = clock.target > clock.queued ? clock.target - clock.queued : 0;
+            if (!room || !SubmitTxFrames(room, sample_rate, channels)) {
+                std::unique_lock<std::mutex> lock(period_mutex_);
+                period_cv_.wait_for(lock, std::chrono::milliseconds(1),
+                                    [this]() { return !period_running_.load(); });
+            }
+            // The wall clock takes over from here if the player goes.
+            start_time = now;
+            bytes_processed = 0;
+            continue;
+        }
+
         uint32_t bytes_per_second = sample_rate * channels * 2; // S16
 
         // Calculate timing: how far ahead/behind are we?
-        auto now = std::chrono::steady_clock::now();
         auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count();
         int64_t audio_ms = static_cast<int64_t>(bytes_processed) * 1000 / bytes_per_second;
         int64_t drift_ms = audio_ms - elapsed_ms;  // positive = ahead, negative = behind
@@ -494,6 +701,146 @@ void VirtioSndDevice::PeriodTimerThread() {
     }
 }
 
+void VirtioSndDevice::StartCapture() {
+    StopCapture();
+    capture_running_ = true;
+    capture_thread_ = std::thread(&VirtioSndDevice::CaptureThread, this);
+}
+
+void VirtioSndDevice::StopCapture() {
+    if (capture_running_) {
+        capture_running_ = false;
+        period_cv_.notify_all();
+        if (capture_thread_.joinable()) {
+            capture_thread_.join();
+        }
+    }
+}
+
+void VirtioSndDevice::CompleteRxBuffer(VirtQueue& rxq, uint16_t head,
+                                       const std::vector<int16_t>& pcm) {
+    thread_local VirtqChain chain;
+    if (!rxq.WalkChain(head, &chain)) {
+        rxq.PushUsed(head, 0);
+        return;
+    }
+    size_t writable = 0;
+    for (auto& elem : chain) {
+        if (elem.writable) writable += elem.len;
+    }
+    if (writable < sizeof(VirtioSndPcmStatus)) {
+        rxq.PushUsed(head, 0);
+        return;
+    }
+
+    // Frames first, then the status in the last bytes.
+    size_t capacity = writable - sizeof(VirtioSndPcmStatus);
+    size_t pcm_bytes = (std::min)(capacity, pcm.size() * sizeof(int16_t));
+    CopyToWritable(chain, 0, pcm.data(), pcm_bytes);
+    VirtioSndPcmStatus status{};
+    status.status = VIRTIO_SND_S_OK;
+    status.latency_bytes = 0;
+    CopyToWritable(chain, capacity, &status, sizeof(status));
+    rxq.PushUsed(head, static_cast<uint32_t>(pcm_bytes + sizeof(status)));
+}
+
+void VirtioSndDevice::FlushPendingRxBuffers() {
+    std::deque<uint16_t> heads;
+    {
+        std::lock_guard<std::mutex> lock(rx_mutex_);
+        heads = std::move(pending_rx_heads_);
+        pending_rx_heads_.clear();
+    }
+
+    if (heads.empty() || !mmio_) return;
+    auto* rxq = mmio_->GetQueue(VIRTIO_SND_VQ_RX);
+    if (!rxq) return;
+    for (uint16_t head : heads) {
+        CompleteRxBuffer(*rxq, head, {});
+    }
+    mmio_->NotifyUsedBuffer();
+}
+
+void VirtioSndDevice::CaptureThread() {
+    auto now = std::chrono::steady_clock::now();
+    auto last_data = now;     // when the host last delivered frames
+    auto next_silence = now;  // wall-clock pace without host capture
+    size_t last_captured = 0;
+    std::vector<int16_t> pcm;
+
+    auto wait = [this](std::chrono::milliseconds ms) {
+        std::unique_lock<std::mutex> lock(period_mutex_);
+        period_cv_.wait_for(lock, ms, [this]() { return !capture_running_.load(); });
+    };
+
+    while (capture_running_) {
+        uint32_t sample_rate, period_bytes;
+        uint8_t channels;
+        {
+            std::lock_guard<std::mutex> lock(period_mutex_);
+            sample_rate = streams_[kRxStream].sample_rate;
+            period_bytes = streams_[kRxStream].period_bytes;
+            channels = streams_[kRxStream].channels;
+        }
+        auto* rxq = mmio_ ? mmio_->GetQueue(VIRTIO_SND_VQ_RX) : nullptr;
+        uint16_t head = 0;
+        bool have_buf = false;
+        {
+            std::lock_guard<std::mutex> lock(rx_mutex_);
+            if (!pending_rx_heads_.empty()) {
+                head = pending_rx_heads_.front();
+                have_buf = true;
+            }
+        }
+        if (!rxq || !have_buf || !sample_rate || !period_bytes || !channels) {
+            wait(std::chrono::milliseconds(have_buf ? 10 : 1));
+            continue;
+        }
+
+        // The guest posts a period per buffer.
+        size_t frames = period_bytes / (channels * sizeof(int16_t));
+        auto period = std::chrono::microseconds(frames * 1000000 / sample_rate);
+        now = std::chrono::steady_clock::now();
+
+        size_t captured = 0;
+        bool host = sample_rate == 48000 && channels == 2 && audio_port_ &&
+                    audio_port_->GetCapturedFrames(&captured);
+        if (host && captured > last_captured) last_data = now;
+        last_captured = captured;
+
+        if (host && now - last_data < kHostClockTimeout) {
+            if (captured < frames) {
+                wait(std::chrono::milliseconds(1));
+                continue;
+            }
+            if (captured > frames * kMaxCaptureBacklog) {
+                pcm.resize((captured - 2 * frames) * channels);
+                audio_port_->ReadCapture(pcm.data(), captured - 2 * frames);
+                captured = 2 * frames;
+            }
+            pcm.resize(frames * channels);
+            audio_port_->ReadCapture(pcm.data(), frames);
+            last_captured = captured - frames;
+            next_silence = now + period;
+        } else {
+            // Nothing captures on the host: silence, at the audio rate.
+            if (now < next_silence) {
+                wait(std::chrono::milliseconds(1));
+                continue;
+            }
+            pcm.assign(frames * channels, 0);
+            next_silence = (std::max)(next_silence + period, now - period);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(rx_mutex_);
+            pending_rx_heads_.pop_front();
+        }
+        CompleteRxBuffer(*rxq, head, pcm);
+        mmio_->NotifyUsedBuffer();
+    }
+}
+
 uint32_t VirtioSndDevice::RateEnumToHz(uint8_t rate_enum) {
     switch (rate_enum) {
     case VIRTIO_SND_PCM_RATE_8000:   return 8000;
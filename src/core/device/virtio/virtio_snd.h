@@ -158,11 +158,17 @@ public:
     void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
     void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override;
     void OnStatusChange(uint32_t new_status) override;
+    // The stream threads stop from SaveState until ResumeAfterSave, and
+    // restart on load for the streams that were running.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+    void ResumeAfterSave() override;
 
 private:
     void ProcessControlQueue(VirtQueue& vq);
     void ProcessEventQueue(VirtQueue& vq);
     void ProcessTxQueue(VirtQueue& vq);
+    void ProcessRxQueue(VirtQueue& vq);
 
     void HandlePcmInfo(const VirtioSndQueryInfo* query,
                        uint8_t* resp, uint32_t* resp_len);
@@ -177,6 +183,17 @@ private:
     void StartPeriodTimer();
     void StopPeriodTimer();
     void FlushPendingTxBuffers();
+    // Period thread. Hands the host up to `max_frames` of the oldest TX
+    // buffer and returns the buffer once all of it is handed over. False
+    // when no buffer is pending.
+    bool SubmitTxFrames(size_t max_frames, uint32_t sample_rate, uint8_t channels);
+
+    void CaptureThread();
+    void StartCapture();
+    void StopCapture();
+    void FlushPendingRxBuffers();
+    // Fills RX buffer `head` with `pcm` and returns it to the guest.
+    void CompleteRxBuffer(VirtQueue& rxq, uint16_t head, const std::vector<int16_t>& pcm);
 
     static uint32_t RateEnumToHz(uint8_t rate_enum);
 
@@ -188,16 +205,23 @@ private:
     // Event queue: guest pre-posts writable buffers; we fill them with events.
     std::vector<uint16_t> event_buf_heads_;
 
-    // PCM stream state
+    // PCM streams: the guest plays on the first and captures on the second.
+    static constexpr uint32_t kTxStream = 0;
+    static constexpr uint32_t kRxStream = 1;
+    static constexpr uint32_t kNumStreams = 2;
     enum class StreamState { kIdle, kPrepared, kRunning };
-    StreamState stream_state_ = StreamState::kIdle;
-    uint32_t pcm_sample_rate_ = 48000;
-    uint8_t  pcm_channels_ = 2;
-    uint8_t  pcm_format_ = VIRTIO_SND_PCM_FMT_S16;
-    uint32_t pcm_buffer_bytes_ = 0;
-    uint32_t pcm_period_bytes_ = 0;
-
-    // Period timer: releases TX buffers at real audio rate to throttle guest
+    struct PcmStream {
+        StreamState state = StreamState::kIdle;
+        uint32_t sample_rate = 48000;
+        uint8_t  channels = 2;
+        uint8_t  format = VIRTIO_SND_PCM_FMT_S16;
+        uint32_t buffer_bytes = 0;
+        uint32_t period_bytes = 0;
+    };
+    PcmStream streams_[kNumStreams];  // parameters under period_mutex_
+
+    // Period timer: returns TX buffers as the host player consumes them,
+    // or at the real audio rate when the host reports no playback clock.
     std::thread period_thread_;
     std::mutex period_mutex_;
     std::condition_variable period_cv_;
@@ -211,4 +235,11 @@ private:
     };
     std::deque<PendingTxBuffer> pending_tx_buffers_;
     std::mutex tx_mutex_;
+
+    // Capture: fills RX buffers as the host captures, or with silence at
+    // the real audio rate when the host captures nothing.
+    std::thread capture_thread_;
+    std::atomic<bool> capture_running_{false};
+    std::deque<uint16_t> pending_rx_heads_;
+    std::mutex rx_mutex_;
 };
@@ -0,0 +1,643 @@
+#include "core/device/virtio/virtio_vsock.h"
+#include "core/vmm/types.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <algorithm>
+#include <cstring>
+
+#pragma comment(lib, "ws2_32.lib")
+
+namespace {
+
+constexpr size_t kMaxIoSpans = 16;
+
+size_t WritableBytes(const VirtqChain& chain) {
+    size_t total = 0;
+    for (const auto& elem : chain) {
+        if (elem.writable) total += elem.len;
+    }
+    return total;
+}
+
+// Copies `len` bytes to the writable part of the chain, `offset` in.
+void ScatterToChain(VirtqChain& chain, size_t offset, const void* data, size_t len) {
+    auto* src = static_cast<const uint8_t*>(data);
+    for (auto& elem : chain) {
+        if (!elem.writable || !len) continue;
+        if (offset >= elem.len) {
+            offset -= elem.len;
+            continue;
+        }
+        size_t n = std::min<size_t>(elem.len - offset, len);
+        std::memcpy(elem.addr + offset, src, n);
+        src += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+// Copies up to `len` bytes from the readable part of the chain, `offset`
+// in. Returns the bytes copied.
+size_t GatherFromChain(const VirtqChain& chain, size_t offset, void* data, size_t len) {
+    auto* dst = static_cast<uint8_t*>(data);
+    size_t copied = 0;
+    for (const auto& elem : chain) {
+        if (elem.writable || copied == len) continue;
+        if (offset >= elem.len) {
+            offset -= elem.len;
+            continue;
+        }
+        size_t n = std::min<size_t>(elem.len - offset, len - copied);
+        std::memcpy(dst + copied, elem.addr + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+// The writable part of the chain past `offset`, at most `max_bytes`, as
+// WSABUFs for a receive straight into guest memory. Returns the count.
+size_t WritableSpans(VirtqChain& chain, size_t offset, size_t max_bytes,
+                     WSABUF* bufs, size_t max_bufs) {
+    size_t count = 0;
+    for (auto& elem : chain) {
+        if (!elem.writable || !max_bytes || count == max_bufs) continue;
+        if (offset >= elem.len) {
+            offset -= elem.len;
+            continue;
+        }
+        size_t n = std::min<size_t>(elem.len - offset, max_bytes);
+        bufs[count].buf = reinterpret_cast<char*>(elem.addr + offset);
+        bufs[count].len = static_cast<ULONG>(n);
+        count++;
+        max_bytes -= n;
+        offset = 0;
+    }
+    return count;
+}
+
+} // namespace
+
+VirtioVsockDevice::VirtioVsockDevice() {
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+}
+
+VirtioVsockDevice::~VirtioVsockDevice() {
+    Stop();
+    WSACleanup();
+}
+
+bool VirtioVsockDevice::Start(const std::vector<VsockForward>& forwards) {
+    forwards_ = forwards;
+
+    WSAEVENT event = WSACreateEvent();
+    if (event == WSA_INVALID_EVENT) {
+        LOG_ERROR("VirtIO vsock: WSACreateEvent failed (%d)", WSAGetLastError());
+        return false;
+    }
+    wake_event_ = event;
+
+    for (const auto& f : forwards_) {
+        if (f.guest_connects) {
+            LOG_INFO("VirtIO vsock: guest vsock:%u -> host 127.0.0.1:%u",
+                     f.vsock_port, f.host_port);
+            continue;
+        }
+        SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s == INVALID_SOCKET) {
+            LOG_ERROR("VirtIO vsock: failed to create listener for port %u", f.host_port);
+            continue;
+        }
+        WatchSocket(static_cast<uintptr_t>(s));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(f.host_port);
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR ||
+            listen(s, SOMAXCONN) == SOCKET_ERROR) {
+            LOG_ERROR("VirtIO vsock: failed to bind/listen on 127.0.0.1:%u (%d)",
+                      f.host_port, WSAGetLastError());
+            closesocket(s);
+            continue;
+        }
+        listeners_.push_back({static_cast<uintptr_t>(s), f.host_port, f.vsock_port});
+        LOG_INFO("VirtIO vsock: host 127.0.0.1:%u -> guest vsock:%u",
+                 f.host_port, f.vsock_port);
+    }
+
+    running_ = true;
+    worker_ = std::thread(&VirtioVsockDevice::WorkerThread, this);
+    return true;
+}
+
+void VirtioVsockDevice::Stop() {
+    running_ = false;
+    Wake();
+    if (worker_.joinable()) worker_.join();
+
+    CloseAll();
+    for (auto& l : listeners_) closesocket(static_cast<SOCKET>(l.sock));
+    listeners_.clear();
+    if (wake_event_) {
+        WSACloseEvent(static_cast<WSAEVENT>(wake_event_));
+        wake_event_ = nullptr;
+    }
+}
+
+void VirtioVsockDevice::Wake() {
+    if (wake_event_) WSASetEvent(static_cast<WSAEVENT>(wake_event_));
+}
+
+void VirtioVsockDevice::WatchSocket(uintptr_t s) {
+    // Also makes the socket non-blocking.
+    if (WSAEventSelect(static_cast<SOCKET>(s), static_cast<WSAEVENT>(wake_event_),
+                       FD_READ | FD_WRITE | FD_ACCEPT | FD_CONNECT | FD_CLOSE)
+            == SOCKET_ERROR) {
+        LOG_WARN("VirtIO vsock: WSAEventSelect failed (%d)", WSAGetLastError());
+    }
+}
+
+void VirtioVsockDevice::OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) {
+    // New packets on tx, fresh buffers on rx or event: all worker business.
+    Wake();
+}
+
+void VirtioVsockDevice::ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) {
+    // struct virtio_vsock_config { le64 guest_cid; }
+    uint64_t cid = VIRTIO_VSOCK_GUEST_CID;
+    *value = 0;
+    if (offset + size <= sizeof(cid)) {
+        std::memcpy(value, reinterpret_cast<const uint8_t*>(&cid) + offset, size);
+    }
+}
+
+void VirtioVsockDevice::OnStatusChange(uint32_t new_status) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        driver_ok_ = (new_status & 0x4) != 0;
+        if (!driver_ok_) {
+            // The queues are about to go; so are the guest's sockets.
+            CloseAll();
+            reset_pending_ = false;
+        }
+    }
+    if (driver_ok_) Wake();
+}
+
+void VirtioVsockDevice::SaveState(StateWriter& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paused_ = true;
+}
+
+void VirtioVsockDevice::ResumeAfterSave() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        paused_ = false;
+    }
+    Wake();
+}
+
+bool VirtioVsockDevice::LoadState(StateReader& in) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        CloseAll();
+        reset_pending_ = true;
+    }
+    Wake();
+    return true;
+}
+
+void VirtioVsockDevice::WorkerThread() {
+    while (running_) {
+        // Reset first, so anything arriving during this pass wakes us again.
+        WSAResetEvent(static_cast<WSAEVENT>(wake_event_));
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (driver_ok_ && !paused_) {
+                if (VirtQueue* tx = mmio_->GetQueue(kTxQueue); tx && tx->IsReady())
+                    ProcessTx(*tx);
+                for (auto& l : listeners_) AcceptConnections(l);
+                PollSockets();
+                for (auto& [key, c] : conns_) FlushToHost(c);
+                Reap();
+                FillRx();
+                if (reset_pending_) SendTransportReset();
+            }
+        }
+        WSAEVENT event = static_cast<WSAEVENT>(wake_event_);
+        WSAWaitForMultipleEvents(1, &event, FALSE, WSA_INFINITE, FALSE);
+    }
+}
+
+void VirtioVsockDevice::ProcessTx(VirtQueue& vq) {
+    bool consumed = false;
+    uint16_t head;
+    while (vq.PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        if (vq.WalkChain(head, &chain)) {
+            VirtioVsockHdr hdr{};
+            if (GatherFromChain(chain, 0, &hdr, sizeof(hdr)) == sizeof(hdr))
+                HandlePacket(hdr, chain);
+        }
+        vq.PushUsed(head, 0);
+        consumed = true;
+    }
+    if (consumed) mmio_->NotifyUsedBuffer();
+}
+
+void VirtioVsockDevice::HandlePacket(const VirtioVsockHdr& hdr, const VirtqChain& chain) {
+    if (hdr.src_cid != VIRTIO_VSOCK_GUEST_CID || hdr.dst_cid != VIRTIO_VSOCK_HOST_CID ||
+        hdr.type != VIRTIO_VSOCK_TYPE_STREAM) {
+        if (hdr.op != VIRTIO_VSOCK_OP_RST) QueueReset(hdr.dst_port, hdr.src_port);
+        return;
+    }
+
+    auto it = conns_.find({hdr.dst_port, hdr.src_port});
+    if (it == conns_.end()) {
+        if (hdr.op == VIRTIO_VSOCK_OP_REQUEST) {
+            HandleRequest(hdr);
+        } else if (hdr.op != VIRTIO_VSOCK_OP_RST) {
+            QueueReset(hdr.dst_port, hdr.src_port);
+        }
+        return;
+    }
+
+    Connection& c = it->second;
+    c.peer_buf_alloc = hdr.buf_alloc;
+    c.peer_fwd_cnt = hdr.fwd_cnt;
+    c.credit_requested = false;
+
+    switch (hdr.op) {
+    case VIRTIO_VSOCK_OP_RESPONSE:
+        if (c.state != ConnState::kRequested) {
+            c.broken = true;
+            break;
+        }
+        c.state = ConnState::kConnected;
+        LOG_DEBUG("VirtIO vsock: host:%u -> guest:%u connected", c.host_port, c.guest_port);
+        break;
+
+    case VIRTIO_VSOCK_OP_RW: {
+        // The guest sends no more than the credit we gave; a guest that
+        // does anyway loses the connection rather than our memory.
+        if (c.state != ConnState::kConnected || c.guest_shut_send ||
+            c.to_host.size() + hdr.len > kBufAlloc) {
+            c.broken = true;
+            break;
+        }
+        size_t offset = sizeof(hdr);
+        size_t left = hdr.len;
+        bool short_chain = false;
+        while (left > 0 && !short_chain) {
+            StreamSpan spans[kMaxIoSpans];
+            size_t count = c.to_host.PrepareWrite(spans, kMaxIoSpans, left);
+            size_t filled = 0;
+            for (size_t i = 0; i < count && !short_chain; i++) {
+                size_t n = GatherFromChain(chain, offset, spans[i].data, spans[i].len);
+                filled += n;
+                offset += n;
+                short_chain = n < spans[i].len;
+            }
+            c.to_host.Commit(filled);
+            left -= filled;
+        }
+        break;
+    }
+
+    case VIRTIO_VSOCK_OP_CREDIT_UPDATE:
+        break;
+
+    case VIRTIO_VSOCK_OP_CREDIT_REQUEST:
+        QueueControl(c, VIRTIO_VSOCK_OP_CREDIT_UPDATE);
+        break;
+
+    case VIRTIO_VSOCK_OP_SHUTDOWN:
+        if (hdr.flags & VIRTIO_VSOCK_SHUTDOWN_RCV) c.guest_shut_rcv = true;
+        if (hdr.flags & VIRTIO_VSOCK_SHUTDOWN_SEND) c.guest_shut_send = true;
+        break;
+
+    case VIRTIO_VSOCK_OP_RST:
+        Close(it, false);
+        break;
+
+    default:
+        c.broken = true;
+        break;
+    }
+}
+
+void VirtioVsockDevice::HandleRequest(const VirtioVsockHdr& hdr) {
+    auto f = std::find_if(forwards_.begin(), forwards_.end(), [&](const VsockForward& f) {
+        return f.guest_connects && f.vsock_port == hdr.dst_port;
+    });
+    if (f == forwards_.end()) {
+        LOG_DEBUG("VirtIO vsock: guest connect to port %u refused", hdr.dst_port);
+        QueueReset(hdr.dst_port, hdr.src_port);
+        return;
+    }
+
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) {
+        QueueReset(hdr.dst_port, hdr.src_port);
+        return;
+    }
+    int nodelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&nodelay),
+               sizeof(nodelay));
+    WatchSocket(static_cast<uintptr_t>(s));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(f->host_port);
+    if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR &&
+        WSAGetLastError() != WSAEWOULDBLOCK) {
+        closesocket(s);
+        QueueReset(hdr.dst_port, hdr.src_port);
+        return;
+    }
+
+    Connection& c = conns_[{hdr.dst_port, hdr.src_port}];
+    c.sock = static_cast<uintptr_t>(s);
+    c.host_port = hdr.dst_port;
+    c.guest_port = hdr.src_port;
+    c.state = ConnState::kConnecting;
+    c.peer_buf_alloc = hdr.buf_alloc;
+    c.peer_fwd_cnt = hdr.fwd_cnt;
+    c.to_host.SetPool(&pool_);
+}
+
+void VirtioVsockDevice::AcceptConnections(Listener& l) {
+    for (;;) {
+        SOCKET s = accept(static_cast<SOCKET>(l.sock), nullptr, nullptr);
+        if (s == INVALID_SOCKET) break;
+        int nodelay = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&nodelay),
+                   sizeof(nodelay));
+        WatchSocket(static_cast<uintptr_t>(s));
+
+        uint32_t port = NextEphemeralPort(l.guest_port);
+        Connection& c = conns_[{port, l.guest_port}];
+        c.sock = static_cast<uintptr_t>(s);
+        c.host_port = port;
+        c.guest_port = l.guest_port;
+        c.state = ConnState::kRequested;
+        c.writable = true;
+        c.to_host.SetPool(&pool_);
+        QueueControl(c, VIRTIO_VSOCK_OP_REQUEST);
+    }
+}
+
+uint32_t VirtioVsockDevice::NextEphemeralPort(uint32_t guest_port) {
+    for (;;) {
+        uint32_t port = next_port_++;
+        if (next_port_ > 0xFFFF) next_port_ = kFirstEphemeralPort;
+        if (!conns_.count({port, guest_port})) return port;
+    }
+}
+
+void VirtioVsockDevice::PollSockets() {
+    for (auto& [key, c] : conns_) {
+        WSANETWORKEVENTS ne{};
+        if (WSAEnumNetworkEvents(static_cast<SOCKET>(c.sock), nullptr, &ne) == SOCKET_ERROR)
+            continue;
+        if (ne.lNetworkEvents & FD_CONNECT) {
+            if (ne.iErrorCode[FD_CONNECT_BIT] || c.state != ConnState::kConnecting) {
+                LOG_DEBUG("VirtIO vsock: connect to 127.0.0.1 for port %u failed (%d)",
+                          c.host_port, ne.iErrorCode[FD_CONNECT_BIT]);
+                c.broken = true;
+                continue;
+            }
+            c.state = ConnState::kConnected;
+            c.writable = true;
+            QueueControl(c, VIRTIO_VSOCK_OP_RESPONSE);
+        }
+        if (ne.lNetworkEvents & FD_READ) c.readable = true;
+        if (ne.lNetworkEvents & FD_WRITE) c.writable = true;
+        // Whatever is still queued is read before the EOF is passed on.
+        if (ne.lNetworkEvents & FD_CLOSE) {
+            c.readable = true;
+            c.host_eof = true;
+        }
+    }
+}
+
+void VirtioVsockDevice::FlushToHost(Connection& c) {
+    if (c.broken || c.state != ConnState::kConnected) return;
+    SOCKET s = static_cast<SOCKET>(c.sock);
+    while (c.writable && !c.to_host.empty()) {
+        StreamSpan spans[kMaxIoSpans];
+        WSABUF bufs[kMaxIoSpans];
+        size_t count = c.to_host.Peek(0, spans, kMaxIoSpans, c.to_host.size());
+        for (size_t i = 0; i < count; i++) {
+            bufs[i].buf = reinterpret_cast<char*>(spans[i].data);
+            bufs[i].len = static_cast<ULONG>(spans[i].len);
+        }
+        DWORD sent = 0;
+        if (WSASend(s, bufs, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) ==
+            SOCKET_ERROR) {
+            // FD_WRITE comes back once the socket drains.
+            if (WSAGetLastError() == WSAEWOULDBLOCK) {
+                c.writable = false;
+            } else {
+                c.broken = true;
+            }
+            return;
+        }
+        c.to_host.Consume(sent);
+        c.fwd_cnt += sent;
+    }
+    if (c.fwd_cnt - c.fwd_reported >= kBufAlloc / 4)
+        QueueControl(c, VIRTIO_VSOCK_OP_CREDIT_UPDATE);
+    if (c.guest_shut_send && c.to_host.empty() && !c.host_shut_send) {
+        shutdown(s, SD_SEND);
+        c.host_shut_send = true;
+    }
+}
+
+void VirtioVsockDevice::Reap() {
+    for (auto it = conns_.begin(); it != conns_.end();) {
+        auto cur = it++;
+        const Connection& c = cur->second;
+        // Neither side has anything left to say: the guest waits for our
+        // RST to free its socket.
+        bool guest_done = c.guest_shut_send && c.to_host.empty() &&
+                          (c.guest_shut_rcv || c.sent_shutdown);
+        if (c.broken || guest_done) Close(cur, true);
+    }
+}
+
+void VirtioVsockDevice::FillRx() {
+    VirtQueue* vq = mmio_->GetQueue(kRxQueue);
+    if (!vq || !vq->IsReady()) return;
+
+    bool pushed = false;
+    for (;;) {
+        while (!control_.empty() && SendControl(*vq, control_.front())) {
+            control_.pop_front();
+            pushed = true;
+        }
+        // Data never overtakes a control packet, a RESPONSE least of all.
+        if (!control_.empty()) break;
+
+        bool progress = false;
+        for (auto& [key, c] : conns_) {
+            if (SendData(*vq, c)) progress = pushed = true;
+        }
+        Reap();
+        if (!progress && control_.empty()) break;
+    }
+    if (pushed) mmio_->NotifyUsedBuffer();
+}
+
+bool VirtioVsockDevice::SendControl(VirtQueue& vq, const VirtioVsockHdr& hdr) {
+    uint16_t head;
+    while (vq.PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        if (!vq.WalkChain(head, &chain) || WritableBytes(chain) < sizeof(hdr)) {
+            vq.PushUsed(head, 0);
+            continue;
+        }
+        ScatterToChain(chain, 0, &hdr, sizeof(hdr));
+        vq.PushUsed(head, sizeof(hdr));
+        return true;
+    }
+    return false;
+}
+
+bool VirtioVsockDevice::SendData(VirtQueue& vq, Connection& c) {
+    if (c.broken || c.state != ConnState::kConnected || !c.readable || c.guest_shut_rcv)
+        return false;
+
+    SOCKET s = static_cast<SOCKET>(c.sock);
+    u_long avail = 0;
+    if (ioctlsocket(s, FIONREAD, &avail) == SOCKET_ERROR) {
+        c.broken = true;
+        return false;
+    }
+    if (avail == 0) {
+        c.readable = false;
+        if (c.host_eof && !c.sent_shutdown) {
+            QueueControl(c, VIRTIO_VSOCK_OP_SHUTDOWN, VIRTIO_VSOCK_SHUTDOWN_SEND);
+            c.sent_shutdown = true;
+        }
+        return false;
+    }
+
+    uint32_t credit = c.peer_buf_alloc - (c.tx_cnt - c.peer_fwd_cnt);
+    if (credit == 0 || credit > c.peer_buf_alloc) {
+        if (!c.credit_requested) {
+            QueueControl(c, VIRTIO_VSOCK_OP_CREDIT_REQUEST);
+            c.credit_requested = true;
+        }
+        return false;
+    }
+
+    uint16_t head;
+    if (!vq.PopAvail(&head)) return false;
+    thread_local VirtqChain chain;
+    if (!vq.WalkChain(head, &chain) || WritableBytes(chain) <= sizeof(VirtioVsockHdr)) {
+        vq.PushUsed(head, 0);
+        return true;
+    }
+
+    // Received into the guest buffer behind the header. FIONREAD said
+    // this much is there, so the receive cannot block.
+    size_t limit = std::min<size_t>({avail, credit, WritableBytes(chain) - sizeof(VirtioVsockHdr)});
+    WSABUF bufs[kMaxIoSpans];
+    size_t count = WritableSpans(chain, sizeof(VirtioVsockHdr), limit, bufs, kMaxIoSpans);
+    DWORD received = 0;
+    DWORD flags = 0;
+    if (WSARecv(s, bufs, static_cast<DWORD>(count), &received, &flags, nullptr, nullptr) ==
+        SOCKET_ERROR) {
+        received = 0;
+        if (WSAGetLastError() != WSAEWOULDBLOCK) c.broken = true;
+    }
+
+    // A buffer popped for nothing still goes back, as a credit update.
+    VirtioVsockHdr hdr{};
+    hdr.src_cid = VIRTIO_VSOCK_HOST_CID;
+    hdr.dst_cid = VIRTIO_VSOCK_GUEST_CID;
+    hdr.src_port = c.host_port;
+    hdr.dst_port = c.guest_port;
+    hdr.len = received;
+    hdr.type = VIRTIO_VSOCK_TYPE_STREAM;
+    hdr.op = received ? VIRTIO_VSOCK_OP_RW : VIRTIO_VSOCK_OP_CREDIT_UPDATE;
+    hdr.buf_alloc = kBufAlloc;
+    hdr.fwd_cnt = c.fwd_cnt;
+    ScatterToChain(chain, 0, &hdr, sizeof(hdr));
+    vq.PushUsed(head, static_cast<uint32_t>(sizeof(hdr) + received));
+    c.tx_cnt += received;
+    c.fwd_reported = c.fwd_cnt;
+    return true;
+}
+
+void VirtioVsockDevice::SendTransportReset() {
+    VirtQueue* vq = mmio_->GetQueue(kEventQueue);
+    if (!vq || !vq->IsReady()) return;
+
+    uint16_t head;
+    while (vq->PopAvail(&head)) {
+        thread_local VirtqChain chain;
+        uint32_t id = VIRTIO_VSOCK_EVENT_TRANSPORT_RESET;
+        if (!vq->WalkChain(head, &chain) || WritableBytes(chain) < sizeof(id)) {
+            vq->PushUsed(head, 0);
+            continue;
+        }
+        ScatterToChain(chain, 0, &id, sizeof(id));
+        vq->PushUsed(head, sizeof(id));
+        reset_pending_ = false;
+        LOG_INFO("VirtIO vsock: transport reset after restore");
+        break;
+    }
+    mmio_->NotifyUsedBuffer();
+}
+
+void VirtioVsockDevice::QueueControl(Connection& c, uint16_t op, uint32_t flags) {
+    if (control_.size() >= kMaxPendingControl) {
+        LOG_WARN("VirtIO vsock: guest posts no receive buffers, connection reset");
+        c.broken = true;
+        return;
+    }
+    VirtioVsockHdr hdr{};
+    hdr.src_cid = VIRTIO_VSOCK_HOST_CID;
+    hdr.dst_cid = VIRTIO_VSOCK_GUEST_CID;
+    hdr.src_port = c.host_port;
+    hdr.dst_port = c.guest_port;
+    hdr.type = VIRTIO_VSOCK_TYPE_STREAM;
+    hdr.op = op;
+    hdr.flags = flags;
+    hdr.buf_alloc = kBufAlloc;
+    hdr.fwd_cnt = c.fwd_cnt;
+    control_.push_back(hdr);
+    c.fwd_reported = c.fwd_cnt;
+}
+
+void VirtioVsockDevice::QueueReset(uint32_t host_port, uint32_t guest_port) {
+    if (control_.size() >= kMaxPendingControl) return;
+    VirtioVsockHdr hdr{};
+    hdr.src_cid = VIRTIO_VSOCK_HOST_CID;
+    hdr.dst_cid = VIRTIO_VSOCK_GUEST_CID;
+    hdr.src_port = host_port;
+    hdr.dst_port = guest_port;
+    hdr.type = VIRTIO_VSOCK_TYPE_STREAM;
+    hdr.op = VIRTIO_VSOCK_OP_RST;
+    control_.push_back(hdr);
+}
+
+void VirtioVsockDevice::Close(std::map<ConnKey, Connection>::iterator it, bool send_rst) {
+    const Connection& c = it->second;
+    if (send_rst) QueueReset(c.host_port, c.guest_port);
+    closesocket(static_cast<SOCKET>(c.sock));
+    conns_.erase(it);
+}
+
+void VirtioVsockDevice::CloseAll() {
+    for (auto& [key, c] : conns_) closesocket(static_cast<SOCKET>(c.sock));
+    conns_.clear();
+    control_.clear();
+}
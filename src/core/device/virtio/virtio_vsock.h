@@ -0,0 +1,187 @@
+#pragma once
+
+#include "common/vm_model.h"
+#include "core/device/virtio/virtio_mmio.h"
+#include "core/net/stream_buffer.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// virtio-vsock device ID (spec 5.10)
+constexpr uint32_t VIRTIO_VSOCK_DEVICE_ID = 19;
+constexpr uint64_t VIRTIO_VSOCK_F_VERSION_1 = 1ULL << 32;
+
+// Well-known CIDs; the guest is always 3.
+constexpr uint64_t VIRTIO_VSOCK_HOST_CID  = 2;
+constexpr uint64_t VIRTIO_VSOCK_GUEST_CID = 3;
+
+constexpr uint16_t VIRTIO_VSOCK_TYPE_STREAM = 1;
+
+constexpr uint16_t VIRTIO_VSOCK_OP_REQUEST        = 1;
+constexpr uint16_t VIRTIO_VSOCK_OP_RESPONSE       = 2;
+constexpr uint16_t VIRTIO_VSOCK_OP_RST            = 3;
+constexpr uint16_t VIRTIO_VSOCK_OP_SHUTDOWN       = 4;
+constexpr uint16_t VIRTIO_VSOCK_OP_RW             = 5;
+constexpr uint16_t VIRTIO_VSOCK_OP_CREDIT_UPDATE  = 6;
+constexpr uint16_t VIRTIO_VSOCK_OP_CREDIT_REQUEST = 7;
+
+// SHUTDOWN flags: the sender will receive / send no more.
+constexpr uint32_t VIRTIO_VSOCK_SHUTDOWN_RCV  = 1;
+constexpr uint32_t VIRTIO_VSOCK_SHUTDOWN_SEND = 2;
+
+constexpr uint32_t VIRTIO_VSOCK_EVENT_TRANSPORT_RESET = 0;
+
+#pragma pack(push, 1)
+struct VirtioVsockHdr {
+    uint64_t src_cid;
+    uint64_t dst_cid;
+    uint32_t src_port;
+    uint32_t dst_port;
+    uint32_t len;
+    uint16_t type;
+    uint16_t op;
+    uint32_t flags;
+    uint32_t buf_alloc;
+    uint32_t fwd_cnt;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VirtioVsockHdr) == 44);
+
+// Host<->guest stream sockets without the network stack in between. Each
+// VsockForward bridges a vsock port to a TCP socket on host loopback, so
+// host agents talk to the guest through plain sockets with no NAT, no
+// guest IP configuration and no lwIP in the data path:
+//  - listen: connections accepted on 127.0.0.1:host_port are connected
+//    to the guest's vsock_port;
+//  - connect: the guest connecting to CID 2 at vsock_port reaches
+//    127.0.0.1:host_port. Other host ports are refused.
+//
+// One worker thread owns the sockets and all queue work; guest kicks only
+// wake it. Data from the host is received straight into guest buffers,
+// bounded by the credit the guest advertised. Host sockets do not survive
+// a snapshot: a restored device resets the transport, which closes every
+// guest socket.
+class VirtioVsockDevice : public VirtioDeviceOps {
+public:
+    VirtioVsockDevice();
+    ~VirtioVsockDevice() override;
+
+    void SetMmioDevice(VirtioMmioDevice* mmio) { mmio_ = mmio; }
+
+    // Opens the listeners and starts the worker.
+    bool Start(const std::vector<VsockForward>& forwards);
+    void Stop();
+
+    uint32_t GetDeviceId() const override { return VIRTIO_VSOCK_DEVICE_ID; }
+    uint64_t GetDeviceFeatures() const override { return VIRTIO_VSOCK_F_VERSION_1; }
+    uint32_t GetNumQueues() const override { return 3; }
+    uint32_t GetQueueMaxSize(uint32_t queue_idx) const override { return 256; }
+    void OnQueueNotify(uint32_t queue_idx, VirtQueue& vq) override;
+    void ReadConfig(uint32_t offset, uint8_t size, uint32_t* value) override;
+    void WriteConfig(uint32_t offset, uint8_t size, uint32_t value) override {}
+    void OnStatusChange(uint32_t new_status) override;
+    // Nothing is saved; LoadState drops the connections and has the guest
+    // reset its sockets. The worker leaves the rings alone from SaveState
+    // until ResumeAfterSave.
+    void SaveState(StateWriter& out) override;
+    bool LoadState(StateReader& in) override;
+    void ResumeAfterSave() override;
+
+private:
+    static constexpr uint32_t kRxQueue = 0;
+    static constexpr uint32_t kTxQueue = 1;
+    static constexpr uint32_t kEventQueue = 2;
+
+    // Bytes from the guest buffered per connection, as advertised in
+    // buf_alloc. A credit update goes out each quarter forwarded.
+    static constexpr uint32_t kBufAlloc = 256 * 1024;
+    // Control packets waiting for guest receive buffers.
+    static constexpr size_t kMaxPendingControl = 1024;
+    static constexpr uint32_t kFirstEphemeralPort = 49152;
+
+    enum class ConnState {
+        kConnecting,  // guest request, host connect in progress
+        kRequested,   // host accept, waiting for the guest's response
+        kConnected,
+    };
+
+    struct Connection {
+        uintptr_t sock = ~(uintptr_t)0;
+        uint32_t host_port = 0;   // vsock port on CID 2
+        uint32_t guest_port = 0;
+        ConnState state = ConnState::kConnecting;
+        bool broken = false;      // reset on the next sweep
+        // Toward the guest
+        uint32_t peer_buf_alloc = 0;
+        uint32_t peer_fwd_cnt = 0;
+        uint32_t tx_cnt = 0;
+        bool readable = false;
+        bool host_eof = false;        // socket closed its send side
+        bool guest_shut_rcv = false;
+        // Toward the host
+        StreamBuffer to_host;
+        uint32_t fwd_cnt = 0;
+        uint32_t fwd_reported = 0;
+        bool writable = false;
+        bool guest_shut_send = false;
+        bool host_shut_send = false;
+        bool sent_shutdown = false;
+        bool credit_requested = false;
+    };
+    using ConnKey = std::pair<uint32_t, uint32_t>;  // host port, guest port
+
+    struct Listener {
+        uintptr_t sock;
+        uint16_t host_port;
+        uint32_t guest_port;
+    };
+
+    void WorkerThread();
+    void Wake();
+    void WatchSocket(uintptr_t s);
+
+    // Worker, under mutex_
+    void ProcessTx(VirtQueue& vq);
+    void HandlePacket(const VirtioVsockHdr& hdr, const VirtqChain& chain);
+    void HandleRequest(const VirtioVsockHdr& hdr);
+    void AcceptConnections(Listener& l);
+    void PollSockets();
+    void FlushToHost(Connection& c);
+    // Fills guest receive buffers: control packets first, then data from
+    // every connection with credit for it, a buffer each in turn.
+    void FillRx();
+    bool SendControl(VirtQueue& vq, const VirtioVsockHdr& hdr);
+    // Whether a receive buffer was used.
+    bool SendData(VirtQueue& vq, Connection& c);
+    void SendTransportReset();
+    // Closes broken connections and those both sides have shut down.
+    void Reap();
+    void QueueControl(Connection& c, uint16_t op, uint32_t flags = 0);
+    void QueueReset(uint32_t host_port, uint32_t guest_port);
+    uint32_t NextEphemeralPort(uint32_t guest_port);
+    void Close(std::map<ConnKey, Connection>::iterator it, bool send_rst);
+    void CloseAll();
+
+    VirtioMmioDevice* mmio_ = nullptr;
+
+    std::vector<VsockForward> forwards_;
+    std::vector<Listener> listeners_;
+
+    std::mutex mutex_;
+    std::thread worker_;
+    std::atomic<bool> running_{false};
+    void* wake_event_ = nullptr;
+    bool driver_ok_ = false;
+    bool paused_ = false;
+    bool reset_pending_ = false;
+
+    StreamChunkPool pool_;
+    std::map<ConnKey, Connection> conns_;
+    std::deque<VirtioVsockHdr> control_;
+    uint32_t next_port_ = kFirstEphemeralPort;
+};
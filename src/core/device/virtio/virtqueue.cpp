@@ -1,10 +1,41 @@
 #include "core/device/virtio/virtqueue.h"
+#include "core/vmm/dirty_tracker.h"
+#include "core/vmm/guest_ram.h"
+#include <atomic>
 #include <cstring>
 
+void VirtqChain::Reset(uint32_t capacity) {
+    if (capacity > capacity_) {
+        elems_ = std::make_unique_for_overwrite<VirtqChainElem[]>(capacity);
+        capacity_ = capacity;
+    }
+    size_ = 0;
+}
+
+bool VirtqChain::Push(const VirtqChainElem& elem) {
+    if (size_ >= capacity_) {
+        LOG_ERROR("VirtQueue: descriptor chain longer than %u", capacity_);
+        return false;
+    }
+    elems_[size_++] = elem;
+    return true;
+}
+
 void VirtQueue::Setup(uint32_t queue_size, const GuestMemMap& mem) {
     queue_size_ = queue_size;
     mem_ = mem;
     last_avail_idx_ = 0;
+    signalled_used_ = 0;
+    packed_ = false;
+    avail_wrap_ = true;
+    used_idx_ = 0;
+    used_wrap_ = true;
+}
+
+void VirtQueue::SetPacked(bool enabled) {
+    packed_ = enabled;
+    packed_bufs_.clear();
+    if (enabled) packed_bufs_.resize(queue_size_);
 }
 
 void VirtQueue::Reset() {
@@ -13,12 +44,97 @@ void VirtQueue::Reset() {
     device_gpa_ = 0;
     last_avail_idx_ = 0;
     ready_ = false;
+    event_idx_ = false;
+    signalled_used_ = 0;
+    packed_ = false;
+    avail_wrap_ = true;
+    used_idx_ = 0;
+    used_wrap_ = true;
+    packed_bufs_.clear();
+}
+
+void VirtQueue::SaveState(StateWriter& out) const {
+    out.Put(queue_size_);
+    out.Put(desc_gpa_);
+    out.Put(driver_gpa_);
+    out.Put(device_gpa_);
+    out.Put(last_avail_idx_);
+    out.Put(ready_);
+    out.Put(event_idx_);
+    out.Put(signalled_used_);
+    out.Put(packed_);
+    out.Put(avail_wrap_);
+    out.Put(used_idx_);
+    out.Put(used_wrap_);
+    if (!packed_) return;
+    for (const auto& buf : packed_bufs_) {
+        out.PutVector(buf.descs);
+        out.Put(buf.ring_slots);
+    }
+}
+
+bool VirtQueue::LoadState(StateReader& in, const GuestMemMap& mem) {
+    uint32_t size = 0;
+    if (!in.Get(&size)) return false;
+    Setup(size, mem);
+    in.Get(&desc_gpa_);
+    in.Get(&driver_gpa_);
+    in.Get(&device_gpa_);
+    in.Get(&last_avail_idx_);
+    in.Get(&ready_);
+    in.Get(&event_idx_);
+    in.Get(&signalled_used_);
+    bool packed = false;
+    in.Get(&packed);
+    in.Get(&avail_wrap_);
+    in.Get(&used_idx_);
+    in.Get(&used_wrap_);
+    if (!in.ok()) return false;
+
+    packed_ = packed;
+    packed_bufs_.clear();
+    if (!packed_) return true;
+    packed_bufs_.resize(queue_size_);
+    for (auto& buf : packed_bufs_) {
+        in.GetVector(&buf.descs);
+        in.Get(&buf.ring_slots);
+    }
+    return in.ok();
 }
 
 uint8_t* VirtQueue::GpaToHva(uint64_t gpa) const {
     return mem_.GpaToHva(gpa);
 }
 
+uint8_t* VirtQueue::GpaRangeToHva(uint64_t gpa, uint64_t len) const {
+    if (len == 0 || gpa + len < gpa) return nullptr;
+    uint8_t* first = GpaToHva(gpa);
+    uint8_t* last = GpaToHva(gpa + len - 1);
+    if (!first || last != first + (len - 1)) return nullptr;
+    return first;
+}
+
+uint8_t* VirtQueue::BufferToHva(uint64_t gpa, uint32_t len, bool writable) const {
+    uint8_t* hva = GpaToHva(gpa);
+    if (hva && mem_.lazy && !mem_.lazy->Commit(hva, len)) return nullptr;
+    if (hva && writable && mem_.dirty) mem_.dirty->MarkGpa(gpa, len);
+    return hva;
+}
+
+void VirtQueue::MarkRingsDirty() const {
+    if (!mem_.dirty || !ready_) return;
+    if (packed_) {
+        // Used descriptors go back into the one ring.
+        mem_.dirty->MarkGpa(desc_gpa_, uint64_t(queue_size_) * sizeof(VirtqPackedDesc));
+        mem_.dirty->MarkGpa(device_gpa_, sizeof(VirtqEventSuppress));
+    } else {
+        // The used ring with avail_event after it.
+        mem_.dirty->MarkGpa(device_gpa_, sizeof(VirtqUsed) +
+                                         uint64_t(queue_size_) * sizeof(VirtqUsedElem) +
+                                         sizeof(uint16_t));
+    }
+}
+
 VirtqDesc* VirtQueue::DescAt(uint16_t idx) const {
     if (idx >= queue_size_) return nullptr;
     auto* base = reinterpret_cast<VirtqDesc*>(GpaToHva(desc_gpa_));
@@ -48,15 +164,37 @@ VirtqUsedElem* VirtQueue::UsedRing() const {
         reinterpret_cast<uint8_t*>(used) + sizeof(VirtqUsed));
 }
 
+// The event fields trail each ring (spec 2.7.7 / 2.7.10).
+uint16_t* VirtQueue::UsedEvent() const {
+    auto* ring = AvailRing();
+    return ring ? ring + queue_size_ : nullptr;
+}
+
+uint16_t* VirtQueue::AvailEvent() const {
+    auto* ring = UsedRing();
+    return ring ? reinterpret_cast<uint16_t*>(ring + queue_size_) : nullptr;
+}
+
 bool VirtQueue::HasAvailable() const {
     if (!ready_) return false;
+    if (packed_) return PackedHasAvailable();
     auto* avail = Avail();
     if (!avail) return false;
     return last_avail_idx_ != avail->idx;
 }
 
 bool VirtQueue::PopAvail(uint16_t* head_idx) {
-    if (!HasAvailable()) return false;
+    if (packed_) return PackedPopAvail(head_idx);
+    if (!HasAvailable()) {
+        if (!ready_ || !event_idx_) return false;
+        // Ask for a kick on the next buffer, then look again in case the
+        // driver published one before it could see the new avail_event.
+        auto* avail_event = AvailEvent();
+        if (!avail_event) return false;
+        *avail_event = last_avail_idx_;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!HasAvailable()) return false;
+    }
 
     auto* ring = AvailRing();
     if (!ring) return false;
@@ -67,8 +205,9 @@ bool VirtQueue::PopAvail(uint16_t* head_idx) {
 }
 
 bool VirtQueue::WalkChain(uint16_t head_idx,
-                           std::vector<VirtqChainElem>* chain) {
-    chain->clear();
+                           VirtqChain* chain) {
+    if (packed_) return PackedWalkChain(head_idx, chain);
+    chain->Reset(queue_size_);
     uint16_t idx = head_idx;
     uint32_t count = 0;
 
@@ -79,18 +218,31 @@ bool VirtQueue::WalkChain(uint16_t head_idx,
             return false;
         }
 
-        uint8_t* hva = GpaToHva(desc->addr);
+        if (desc->flags & VIRTQ_DESC_F_INDIRECT) {
+            // The spec forbids chaining past an indirect descriptor.
+            if (desc->flags & VIRTQ_DESC_F_NEXT) {
+                LOG_ERROR("VirtQueue: indirect descriptor %u has NEXT set", idx);
+                return false;
+            }
+            if (!WalkIndirect(*desc, chain)) return false;
+            break;
+        }
+
+        uint8_t* hva = BufferToHva(desc->addr, desc->len,
+                                   (desc->flags & VIRTQ_DESC_F_WRITE) != 0);
         if (!hva) {
             LOG_ERROR("VirtQueue: bad GPA 0x%llX in descriptor %u",
                       desc->addr, idx);
             return false;
         }
 
-        chain->push_back({
-            hva,
-            desc->len,
-            (desc->flags & VIRTQ_DESC_F_WRITE) != 0
-        });
+        if (!chain->Push({
+                hva,
+                desc->len,
+                (desc->flags & VIRTQ_DESC_F_WRITE) != 0
+            })) {
+            return false;
+        }
 
         if (!(desc->flags & VIRTQ_DESC_F_NEXT))
             break;
@@ -102,7 +254,72 @@ bool VirtQueue::WalkChain(uint16_t head_idx,
     return !chain->empty();
 }
 
+bool VirtQueue::WalkIndirect(const VirtqDesc& desc,
+                              VirtqChain* chain) {
+    if (desc.len == 0 || desc.len % sizeof(VirtqDesc) != 0) {
+        LOG_ERROR("VirtQueue: bad indirect table length %u", desc.len);
+        return false;
+    }
+
+    auto* table = reinterpret_cast<const VirtqDesc*>(
+        GpaRangeToHva(desc.addr, desc.len));
+    if (!table) {
+        LOG_ERROR("VirtQueue: bad indirect table GPA 0x%llX (len %u)",
+                  desc.addr, desc.len);
+        return false;
+    }
+
+    uint32_t num = desc.len / sizeof(VirtqDesc);
+    uint32_t idx = 0;
+    for (uint32_t count = 0; count < num; count++) {
+        // Copy the entry; the guest may rewrite the table under us.
+        VirtqDesc d;
+        if (packed_) {
+            // Packed tables are consumed in order and carry no NEXT links.
+            VirtqPackedDesc pd;
+            memcpy(&pd, &table[idx], sizeof(pd));
+            bool last = count + 1 == num;
+            d = {pd.addr, pd.len,
+                 static_cast<uint16_t>(last ? pd.flags & ~VIRTQ_DESC_F_NEXT
+                                            : pd.flags | VIRTQ_DESC_F_NEXT),
+                 static_cast<uint16_t>(count + 1)};
+        } else {
+            memcpy(&d, &table[idx], sizeof(d));
+        }
+
+        if (d.flags & VIRTQ_DESC_F_INDIRECT) {
+            LOG_ERROR("VirtQueue: nested indirect descriptor");
+            return false;
+        }
+
+        uint8_t* hva = BufferToHva(d.addr, d.len, (d.flags & VIRTQ_DESC_F_WRITE) != 0);
+        if (!hva) {
+            LOG_ERROR("VirtQueue: bad GPA 0x%llX in indirect descriptor %u",
+                      d.addr, idx);
+            return false;
+        }
+
+        if (!chain->Push({hva, d.len, (d.flags & VIRTQ_DESC_F_WRITE) != 0}))
+            return false;
+
+        if (!(d.flags & VIRTQ_DESC_F_NEXT)) return true;
+        if (d.next >= num) {
+            LOG_ERROR("VirtQueue: indirect next %u out of range (%u)",
+                      d.next, num);
+            return false;
+        }
+        idx = d.next;
+    }
+
+    LOG_ERROR("VirtQueue: indirect descriptor loop");
+    return false;
+}
+
 void VirtQueue::PushUsed(uint16_t head_idx, uint32_t total_len) {
+    if (packed_) {
+        PackedPushUsed(head_idx, total_len);
+        return;
+    }
     auto* used = Used();
     if (!used) return;
 
@@ -118,3 +335,178 @@ void VirtQueue::PushUsed(uint16_t head_idx, uint32_t total_len) {
 
     used->idx++;
 }
+
+bool VirtQueue::ShouldNotify() {
+    if (packed_) return PackedShouldNotify();
+    if (!event_idx_) return true;
+    auto* used = Used();
+    auto* used_event = UsedEvent();
+    if (!used || !used_event) return true;
+
+    // used->idx must be visible before the driver's used_event is sampled.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint16_t new_idx = used->idx;
+    uint16_t old_idx = std::atomic_ref<uint16_t>(signalled_used_)
+        .exchange(new_idx, std::memory_order_acq_rel);
+    uint16_t event = *used_event;
+    // vring_need_event(): did [old_idx, new_idx) cross used_event?
+    return static_cast<uint16_t>(new_idx - event - 1) <
+           static_cast<uint16_t>(new_idx - old_idx);
+}
+
+bool VirtQueue::UsedSinceSignal() {
+    uint16_t new_idx = 0;
+    if (packed_) {
+        new_idx = std::atomic_ref<uint16_t>(used_idx_).load(std::memory_order_acquire);
+    } else {
+        auto* used = Used();
+        if (!used) return true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        new_idx = used->idx;
+    }
+    uint16_t old_idx = std::atomic_ref<uint16_t>(signalled_used_)
+        .exchange(new_idx, std::memory_order_acq_rel);
+    return new_idx != old_idx;
+}
+
+// ---- Packed ring (spec 2.8) ----
+
+VirtqPackedDesc* VirtQueue::PackedRing() const {
+    return reinterpret_cast<VirtqPackedDesc*>(GpaToHva(desc_gpa_));
+}
+
+VirtqEventSuppress* VirtQueue::DriverEvent() const {
+    return reinterpret_cast<VirtqEventSuppress*>(GpaToHva(driver_gpa_));
+}
+
+VirtqEventSuppress* VirtQueue::DeviceEvent() const {
+    return reinterpret_cast<VirtqEventSuppress*>(GpaToHva(device_gpa_));
+}
+
+bool VirtQueue::PackedHasAvailable() const {
+    auto* ring = PackedRing();
+    if (!ring || last_avail_idx_ >= queue_size_) return false;
+    uint16_t flags = std::atomic_ref<uint16_t>(ring[last_avail_idx_].flags)
+        .load(std::memory_order_acquire);
+    bool avail = (flags & VIRTQ_DESC_F_AVAIL) != 0;
+    bool used = (flags & VIRTQ_DESC_F_USED) != 0;
+    return avail == avail_wrap_ && used != avail_wrap_;
+}
+
+bool VirtQueue::PackedPopAvail(uint16_t* head_idx) {
+    if (!PackedHasAvailable()) {
+        if (!ready_ || !event_idx_) return false;
+        auto* dev_event = DeviceEvent();
+        if (!dev_event) return false;
+        dev_event->off_wrap = static_cast<uint16_t>(
+            last_avail_idx_ | (avail_wrap_ ? 0x8000 : 0));
+        dev_event->flags = VIRTQ_EVENT_F_DESC;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!PackedHasAvailable()) return false;
+    }
+
+    // Find the buffer id in the last descriptor before copying anything.
+    auto* ring = PackedRing();
+    uint16_t idx = last_avail_idx_;
+    uint16_t slots = 0;
+    for (;;) {
+        slots++;
+        if (ring[idx].flags & VIRTQ_DESC_F_NEXT) {
+            if (slots >= queue_size_) {
+                LOG_ERROR("VirtQueue: packed chain longer than the ring");
+                return false;
+            }
+            idx = static_cast<uint16_t>((idx + 1) % queue_size_);
+            continue;
+        }
+        break;
+    }
+
+    uint16_t id = ring[idx].id;
+    if (id >= packed_bufs_.size()) {
+        LOG_ERROR("VirtQueue: packed buffer id %u out of range", id);
+        return false;
+    }
+
+    auto& buf = packed_bufs_[id];
+    buf.descs.clear();
+    buf.ring_slots = slots;
+    idx = last_avail_idx_;
+    for (uint16_t i = 0; i < slots; i++) {
+        const auto& pd = ring[idx];
+        buf.descs.push_back({pd.addr, pd.len, pd.flags, 0});
+        if (++idx == queue_size_) {
+            idx = 0;
+            avail_wrap_ = !avail_wrap_;
+        }
+    }
+    last_avail_idx_ = idx;
+    *head_idx = id;
+    return true;
+}
+
+bool VirtQueue::PackedWalkChain(uint16_t id, VirtqChain* chain) {
+    chain->Reset(queue_size_);
+    if (id >= packed_bufs_.size()) return false;
+
+    for (const auto& desc : packed_bufs_[id].descs) {
+        if (desc.flags & VIRTQ_DESC_F_INDIRECT) {
+            if (!WalkIndirect(desc, chain)) return false;
+            continue;
+        }
+        uint8_t* hva = BufferToHva(desc.addr, desc.len,
+                                   (desc.flags & VIRTQ_DESC_F_WRITE) != 0);
+        if (!hva) {
+            LOG_ERROR("VirtQueue: bad GPA 0x%llX in packed buffer %u",
+                      desc.addr, id);
+            return false;
+        }
+        if (!chain->Push({hva, desc.len, (desc.flags & VIRTQ_DESC_F_WRITE) != 0}))
+            return false;
+    }
+    return !chain->empty();
+}
+
+void VirtQueue::PackedPushUsed(uint16_t id, uint32_t total_len) {
+    auto* ring = PackedRing();
+    if (!ring || id >= packed_bufs_.size()) return;
+
+    auto& slot = ring[used_idx_];
+    slot.id = id;
+    slot.len = total_len;
+    // The flags store hands the slot back; id and len must land first.
+    uint16_t flags = used_wrap_ ? (VIRTQ_DESC_F_AVAIL | VIRTQ_DESC_F_USED) : 0;
+    std::atomic_ref<uint16_t>(slot.flags).store(flags, std::memory_order_release);
+
+    // The next used entry goes after every slot this buffer consumed.
+    uint32_t next = used_idx_ + packed_bufs_[id].ring_slots;
+    if (next >= queue_size_) {
+        next -= queue_size_;
+        used_wrap_ = !used_wrap_;
+    }
+    std::atomic_ref<uint16_t>(used_idx_).store(static_cast<uint16_t>(next),
+                                               std::memory_order_release);
+}
+
+bool VirtQueue::PackedShouldNotify() {
+    auto* drv_event = DriverEvent();
+    if (!drv_event) return true;
+
+    // Pushes on another thread may be advancing used_idx_ meanwhile.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint16_t new_idx = std::atomic_ref<uint16_t>(used_idx_)
+        .load(std::memory_order_acquire);
+    uint16_t old_idx = std::atomic_ref<uint16_t>(signalled_used_)
+        .exchange(new_idx, std::memory_order_acq_rel);
+    uint16_t flags = drv_event->flags;
+    if (flags == VIRTQ_EVENT_F_DISABLE) return false;
+    if (flags != VIRTQ_EVENT_F_DESC || !event_idx_) return new_idx != old_idx;
+
+    // Like vring_need_event(), with the event offset rebased when it sits
+    // on the other side of a wrap.
+    uint16_t off_wrap = drv_event->off_wrap;
+    int event = off_wrap & 0x7FFF;
+    if (((off_wrap >> 15) != 0) != used_wrap_) event -= static_cast<int>(queue_size_);
+    return static_cast<uint16_t>(new_idx - event - 1) <
+           static_cast<uint16_t>(new_idx - old_idx);
+}
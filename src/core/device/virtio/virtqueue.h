@@ -1,7 +1,9 @@
 #pragma once
 
 #include "core/vmm/types.h"
+#include "core/vmm/snapshot.h"
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 // VirtIO split virtqueue descriptor (16 bytes each, in guest memory).
@@ -21,6 +23,11 @@ constexpr uint16_t VIRTQ_DESC_F_NEXT     = 1;
 constexpr uint16_t VIRTQ_DESC_F_WRITE    = 2;
 constexpr uint16_t VIRTQ_DESC_F_INDIRECT = 4;
 
+// Transport feature bits handled by VirtQueue itself.
+constexpr uint64_t VIRTIO_RING_F_INDIRECT_DESC = 1ULL << 28;
+constexpr uint64_t VIRTIO_RING_F_EVENT_IDX     = 1ULL << 29;
+constexpr uint64_t VIRTIO_F_RING_PACKED        = 1ULL << 34;
+
 // Available ring header (in guest memory).
 #pragma pack(push, 1)
 struct VirtqAvail {
@@ -47,6 +54,31 @@ struct VirtqUsed {
 };
 #pragma pack(pop)
 
+// VirtIO packed virtqueue descriptor (spec 2.8.13). The ring holds these
+// in place of the split desc/avail/used triple; naturally 16 bytes.
+struct VirtqPackedDesc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+};
+
+static_assert(sizeof(VirtqPackedDesc) == 16);
+
+// Packed descriptor ownership flags
+constexpr uint16_t VIRTQ_DESC_F_AVAIL = 1 << 7;
+constexpr uint16_t VIRTQ_DESC_F_USED  = 1 << 15;
+
+// Packed ring event suppression structure (driver and device areas).
+struct VirtqEventSuppress {
+    uint16_t off_wrap;   // descriptor offset, wrap counter in bit 15
+    uint16_t flags;
+};
+
+constexpr uint16_t VIRTQ_EVENT_F_ENABLE  = 0;
+constexpr uint16_t VIRTQ_EVENT_F_DISABLE = 1;
+constexpr uint16_t VIRTQ_EVENT_F_DESC    = 2;
+
 // One element of a descriptor chain, already translated to HVA.
 struct VirtqChainElem {
     uint8_t* addr;
@@ -54,6 +86,36 @@ struct VirtqChainElem {
     bool     writable;
 };
 
+// Descriptor chain filled by VirtQueue::WalkChain(). Storage is allocated
+// once at the queue size and reused by later walks, so callers that keep a
+// chain around (per thread or per queue) walk without touching the heap.
+class VirtqChain {
+public:
+    size_t size() const  { return size_; }
+    bool empty() const   { return size_ == 0; }
+
+    VirtqChainElem& operator[](size_t i)             { return elems_[i]; }
+    const VirtqChainElem& operator[](size_t i) const { return elems_[i]; }
+    VirtqChainElem& front()                          { return elems_[0]; }
+    VirtqChainElem& back()                           { return elems_[size_ - 1]; }
+
+    VirtqChainElem* begin()             { return elems_.get(); }
+    VirtqChainElem* end()               { return elems_.get() + size_; }
+    const VirtqChainElem* begin() const { return elems_.get(); }
+    const VirtqChainElem* end() const   { return elems_.get() + size_; }
+
+private:
+    friend class VirtQueue;
+
+    // Empties the chain, growing storage only if `capacity` exceeds it.
+    void Reset(uint32_t capacity);
+    bool Push(const VirtqChainElem& elem);
+
+    std::unique_ptr<VirtqChainElem[]> elems_;
+    uint32_t capacity_ = 0;
+    uint32_t size_ = 0;
+};
+
 class VirtQueue {
 public:
     void Setup(uint32_t queue_size, const GuestMemMap& mem);
@@ -62,6 +124,11 @@ public:
     void SetDriverAddr(uint64_t gpa) { driver_gpa_ = gpa; }
     void SetDeviceAddr(uint64_t gpa) { device_gpa_ = gpa; }
     void SetReady(bool ready)        { ready_ = ready; }
+    // Enables used_event/avail_event suppression (VIRTIO_RING_F_EVENT_IDX).
+    void SetEventIdx(bool enabled)   { event_idx_ = enabled; }
+    // Switches to the packed ring layout (VIRTIO_F_RING_PACKED). Call after
+    // Setup() and before SetReady().
+    void SetPacked(bool enabled);
     bool IsReady() const             { return ready_; }
     uint32_t Size() const            { return queue_size_; }
 
@@ -70,23 +137,63 @@ public:
     bool HasAvailable() const;
 
     // Pop the next available descriptor chain head index.
-    // Returns false if no buffers are available.
+    // Returns false if no buffers are available. With EVENT_IDX an empty
+    // ring re-arms the guest's kick before reporting empty.
+    // On a packed ring the head is the buffer id, and the chain is copied out
+    // of the ring here since the driver may reuse those slots before the
+    // buffer completes.
     bool PopAvail(uint16_t* head_idx);
 
     // Walk a descriptor chain starting at head_idx, collecting all elements.
-    bool WalkChain(uint16_t head_idx, std::vector<VirtqChainElem>* chain);
+    // Indirect descriptor tables are expanded in place. A chain longer than
+    // the queue is rejected, as the spec forbids it.
+    bool WalkChain(uint16_t head_idx, VirtqChain* chain);
 
     // Push a completed buffer to the used ring.
     void PushUsed(uint16_t head_idx, uint32_t total_len);
 
+    // Whether used entries pushed since the last call need an interrupt.
+    // Always true without EVENT_IDX.
+    bool ShouldNotify();
+    // Whether used entries were pushed since the last ShouldNotify() or
+    // UsedSinceSignal(), suppression aside. Lets a transport with an
+    // interrupt per queue skip the queues that have nothing new.
+    bool UsedSinceSignal();
+
+    // Ring addresses, positions and in-flight packed buffers. LoadState
+    // sets the queue up over `mem` first.
+    void SaveState(StateWriter& out) const;
+    bool LoadState(StateReader& in, const GuestMemMap& mem);
+    // Reports the parts of the rings the device writes to mem_.dirty, for
+    // a checkpoint. Buffers are reported as their chains are walked.
+    void MarkRingsDirty() const;
+
 private:
     uint8_t* GpaToHva(uint64_t gpa) const;
+    // Translates [gpa, gpa + len) only if it is contiguous in host memory.
+    uint8_t* GpaRangeToHva(uint64_t gpa, uint64_t len) const;
+    // GpaToHva for a descriptor's buffer. Lazily committed RAM under it is
+    // committed, since devices may hand it straight to host kernel I/O, and
+    // a `writable` one is marked dirty for checkpoints.
+    uint8_t* BufferToHva(uint64_t gpa, uint32_t len, bool writable) const;
+    bool WalkIndirect(const VirtqDesc& desc, VirtqChain* chain);
+
+    bool PackedHasAvailable() const;
+    bool PackedPopAvail(uint16_t* head_idx);
+    bool PackedWalkChain(uint16_t id, VirtqChain* chain);
+    void PackedPushUsed(uint16_t id, uint32_t total_len);
+    bool PackedShouldNotify();
+    VirtqPackedDesc* PackedRing() const;
+    VirtqEventSuppress* DriverEvent() const;
+    VirtqEventSuppress* DeviceEvent() const;
 
     VirtqDesc* DescAt(uint16_t idx) const;
     uint16_t* AvailRing() const;
     VirtqUsedElem* UsedRing() const;
     VirtqAvail* Avail() const;
     VirtqUsed* Used() const;
+    uint16_t* UsedEvent() const;
+    uint16_t* AvailEvent() const;
 
     uint32_t queue_size_ = 0;
     GuestMemMap mem_;
@@ -97,4 +204,20 @@ private:
 
     uint16_t last_avail_idx_ = 0;
     bool ready_ = false;
+    bool event_idx_ = false;
+    // used->idx as of the last interrupt. Notifiers on different threads
+    // race on it, so it is updated through std::atomic_ref.
+    uint16_t signalled_used_ = 0;
+
+    // Packed ring state. Buffers in flight are indexed by their id and keep
+    // the descriptors copied out of the ring at pop time.
+    struct PackedBuffer {
+        std::vector<VirtqDesc> descs;
+        uint16_t ring_slots = 0;    // ring entries the buffer occupied
+    };
+    bool packed_ = false;
+    bool avail_wrap_ = true;
+    uint16_t used_idx_ = 0;
+    bool used_wrap_ = true;
+    std::vector<PackedBuffer> packed_bufs_;
 };
@@ -9,7 +9,7 @@
 // Minimal JSON helpers to avoid pulling nlohmann/json into the core library.
 // The QGA protocol uses simple one-line JSON objects terminated by \n.
 
-static std::string JsonEscape(const std::string& s) {
+std::string GuestAgentHandler::JsonEscape(const std::string& s) {
     std::string out;
     out.reserve(s.size() + 4);
     for (char c : s) {
@@ -38,6 +38,17 @@ static bool JsonHasKey(const std::string& json, const std::string& key) {
     return json.find("\"" + key + "\"") != std::string::npos;
 }
 
+// The response id is the envelope's last member, after any payload.
+static bool JsonGetTrailingId(const std::string& json, uint64_t* id) {
+    auto pos = json.rfind("\"id\":");
+    if (pos == std::string::npos) return false;
+    pos += 5;
+    while (pos < json.size() && json[pos] == ' ') ++pos;
+    char* end = nullptr;
+    *id = std::strtoull(json.c_str() + pos, &end, 10);
+    return end != json.c_str() + pos;
+}
+
 static int64_t JsonGetInt(const std::string& json, const std::string& key) {
     std::string needle = "\"" + key + "\":";
     auto pos = json.find(needle);
@@ -74,13 +85,25 @@ void GuestAgentHandler::OnPortOpen(bool opened) {
             recv_buffer_.clear();
             sync_pending_ = false;
         }
+        FailPendingReplies();
         if (was_connected && cb) {
             cb(false);
         }
     }
 }
 
+void GuestAgentHandler::FailPendingReplies() {
+    std::unordered_map<uint64_t, ReplyCallback> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending.swap(pending_replies_);
+    }
+    for (auto& [id, cb] : pending) cb(std::string());
+}
+
 void GuestAgentHandler::StartSyncHandshake() {
+    // A reopened port is a restarted agent; nothing in flight comes back.
+    FailPendingReplies();
     int64_t id;
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -91,7 +114,7 @@ void GuestAgentHandler::StartSyncHandshake() {
     }
 
     // Per QGA spec: send 0xFF sentinel to flush parser, then guest-sync-delimited.
-    // Send outside the lock to avoid lock-ordering issues with VirtioSerialDevice.
+    // Sent outside the lock; the port's own lock orders the bytes.
     uint8_t sentinel = 0xFF;
     if (serial_device_) {
         serial_device_->SendData(port_id_, &sentinel, 1);
@@ -107,30 +130,29 @@ void GuestAgentHandler::StartSyncHandshake() {
 }
 
 void GuestAgentHandler::OnDataReceived(const uint8_t* data, size_t len) {
-    // Collect complete lines under lock, then process callbacks outside the lock
-    // to avoid deadlock with VirtioSerialDevice's recursive_mutex.
+    // Collect complete lines under lock, then process them outside it, so
+    // reply callbacks are free to send the next command.
     std::vector<std::string> complete_lines;
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
 
-        for (size_t i = 0; i < len; ++i) {
-            uint8_t ch = data[i];
+        // File reads bring megabyte lines, so copy runs, not bytes.
+        size_t i = 0;
+        while (i < len) {
+            size_t run = i;
+            while (run < len && data[run] != 0xFF && data[run] != '\n' && data[run] != '\r')
+                ++run;
+            recv_buffer_.append(reinterpret_cast<const char*>(data + i), run - i);
+            if (run == len) break;
 
-            if (ch == 0xFF) {
+            if (data[run] == 0xFF) {
+                recv_buffer_.clear();
+            } else if (!recv_buffer_.empty()) {
+                complete_lines.push_back(std::move(recv_buffer_));
                 recv_buffer_.clear();
-                continue;
-            }
-
-            if (ch == '\n' || ch == '\r') {
-                if (!recv_buffer_.empty()) {
-                    complete_lines.push_back(std::move(recv_buffer_));
-                    recv_buffer_.clear();
-                }
-                continue;
             }
-
-            recv_buffer_ += static_cast<char>(ch);
+            i = run + 1;
         }
     }
 
@@ -140,13 +162,23 @@ void GuestAgentHandler::OnDataReceived(const uint8_t* data, size_t len) {
 }
 
 void GuestAgentHandler::ProcessLine(const std::string& line) {
-    LOG_DEBUG("GuestAgent: recv: %s", line.c_str());
+    LOG_DEBUG("GuestAgent: recv: %.200s", line.c_str());
 
     ConnectedCallback cb_to_fire;
+    ReplyCallback reply_to_fire;
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
 
+        uint64_t id = 0;
+        if (!pending_replies_.empty() && JsonGetTrailingId(line, &id)) {
+            auto it = pending_replies_.find(id);
+            if (it != pending_replies_.end()) {
+                reply_to_fire = std::move(it->second);
+                pending_replies_.erase(it);
+            }
+        }
+
         if (sync_pending_ && JsonHasKey(line, "return")) {
             int64_t returned = JsonGetInt(line, "return");
             if (returned == sync_id_) {
@@ -160,19 +192,22 @@ void GuestAgentHandler::ProcessLine(const std::string& line) {
             }
         }
 
-        if (JsonHasKey(line, "error")) {
+        if (!reply_to_fire && JsonHasKey(line, "error")) {
             LOG_WARN("GuestAgent: error response: %s", line.c_str());
         }
     }
 
+    if (reply_to_fire) {
+        reply_to_fire(line);
+    }
     if (cb_to_fire) {
         cb_to_fire(true);
     }
 }
 
-void GuestAgentHandler::SendRaw(const std::string& json_line) {
-    if (!serial_device_) return;
-    serial_device_->SendData(port_id_,
+bool GuestAgentHandler::SendRaw(const std::string& json_line) {
+    if (!serial_device_) return false;
+    return serial_device_->SendData(port_id_,
         reinterpret_cast<const uint8_t*>(json_line.data()),
         json_line.size());
 }
@@ -217,3 +252,31 @@ void GuestAgentHandler::Shutdown(const std::string& mode) {
 void GuestAgentHandler::Ping() {
     SendCommand("guest-ping");
 }
+
+bool GuestAgentHandler::Execute(const std::string& command,
+                                const std::string& arguments_json,
+                                ReplyCallback on_reply) {
+    if (!connected_.load()) return false;
+
+    std::ostringstream oss;
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = next_id_++;
+        pending_replies_[id] = std::move(on_reply);
+    }
+    oss << R"({"execute":")" << JsonEscape(command) << '"';
+    if (!arguments_json.empty()) oss << R"(,"arguments":)" << arguments_json;
+    oss << R"(,"id":)" << id << "}\n";
+
+    if (!SendRaw(oss.str())) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_replies_.erase(id);
+        return false;
+    }
+    return true;
+}
+
+size_t GuestAgentHandler::QueuedBytes() const {
+    return serial_device_ ? serial_device_->QueuedBytes(port_id_) : 0;
+}
@@ -13,6 +13,9 @@ class VirtioSerialDevice;
 class GuestAgentHandler {
 public:
     using ConnectedCallback = std::function<void(bool connected)>;
+    // The agent's whole response line, or an empty one if the port closed
+    // before it came. Runs on the thread that delivers guest data.
+    using ReplyCallback = std::function<void(const std::string& response)>;
 
     GuestAgentHandler();
     ~GuestAgentHandler();
@@ -34,13 +37,27 @@ public:
     // Send a guest-ping command; returns true if the request was sent
     void Ping();
 
+    // Sends `command` with `arguments_json` (an object, or empty for none)
+    // and calls `on_reply` with the response. Any number may be in flight;
+    // the agent answers them in order. Returns false if not connected.
+    bool Execute(const std::string& command, const std::string& arguments_json,
+                 ReplyCallback on_reply);
+    // Bytes sent but not yet taken by the guest, for senders that pace
+    // themselves.
+    size_t QueuedBytes() const;
+
+    // Escapes `s` for use inside a JSON string literal.
+    static std::string JsonEscape(const std::string& s);
+
 private:
     void SendCommand(const std::string& command);
     void SendCommand(const std::string& command,
                      const std::string& arguments_json);
-    void SendRaw(const std::string& json_line);
+    bool SendRaw(const std::string& json_line);
     void ProcessLine(const std::string& line);
     void StartSyncHandshake();
+    // Hands every outstanding Execute an empty reply.
+    void FailPendingReplies();
 
     VirtioSerialDevice* serial_device_ = nullptr;
     uint32_t port_id_ = 0;
@@ -51,5 +68,6 @@ private:
     bool sync_pending_ = false;
     int64_t sync_id_ = 0;
     uint64_t next_id_ = 1;
+    std::unordered_map<uint64_t, ReplyCallback> pending_replies_;
     ConnectedCallback connected_callback_;
 };
@@ -0,0 +1,338 @@
+#include "core/guest_agent/guest_file_transfer.h"
+#include "core/vmm/utf8.h"
+#include "core/guest_agent/guest_agent_handler.h"
+#include "core/vmm/types.h"
+#include <windows.h>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+static const char kBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void Base64Encode(const uint8_t* data, size_t len, std::string* out) {
+    out->clear();
+    out->reserve((len + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out->push_back(kBase64Chars[(v >> 18) & 63]);
+        out->push_back(kBase64Chars[(v >> 12) & 63]);
+        out->push_back(kBase64Chars[(v >> 6) & 63]);
+        out->push_back(kBase64Chars[v & 63]);
+    }
+    if (i < len) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < len) v |= data[i + 1] << 8;
+        out->push_back(kBase64Chars[(v >> 18) & 63]);
+        out->push_back(kBase64Chars[(v >> 12) & 63]);
+        out->push_back(i + 1 < len ? kBase64Chars[(v >> 6) & 63] : '=');
+        out->push_back('=');
+    }
+}
+
+// Decodes up to the closing quote or padding. False on a bad character.
+static bool Base64Decode(const char* in, size_t len, std::vector<uint8_t>* out) {
+    static const auto kTable = [] {
+        std::array<int8_t, 256> t;
+        t.fill(-1);
+        for (int i = 0; i < 64; ++i) t[static_cast<uint8_t>(kBase64Chars[i])] = int8_t(i);
+        return t;
+    }();
+    out->clear();
+    out->reserve(len / 4 * 3);
+    uint32_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = in[i];
+        if (c == '=') break;
+        if (c == '\\' && i + 1 < len && in[i + 1] == '/') continue;  // escaped '/'
+        int8_t v = kTable[static_cast<uint8_t>(c)];
+        if (v < 0) return false;
+        acc = (acc << 6) | uint32_t(v);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out->push_back(uint8_t(acc >> bits));
+        }
+    }
+    return true;
+}
+
+// Where the value of the first "key" in `json` starts, or npos.
+static size_t JsonFindValue(const std::string& json, const char* key) {
+    std::string needle = std::string("\"") + key + "\":";
+    auto pos = json.find(needle);
+    if (pos == std::string::npos) return pos;
+    pos += needle.size();
+    while (pos < json.size() && json[pos] == ' ') ++pos;
+    return pos;
+}
+
+static bool JsonGetInt(const std::string& json, const char* key, int64_t* value) {
+    auto pos = JsonFindValue(json, key);
+    if (pos == std::string::npos) return false;
+    char* end = nullptr;
+    *value = std::strtoll(json.c_str() + pos, &end, 10);
+    return end != json.c_str() + pos;
+}
+
+static bool JsonGetBool(const std::string& json, const char* key) {
+    auto pos = JsonFindValue(json, key);
+    return pos != std::string::npos && json.compare(pos, 4, "true") == 0;
+}
+
+// The raw characters of a string value, escapes left in.
+static bool JsonGetRawString(const std::string& json, const char* key,
+                             size_t* start, size_t* len) {
+    auto pos = JsonFindValue(json, key);
+    if (pos == std::string::npos || pos >= json.size() || json[pos] != '"') return false;
+    size_t end = pos + 1;
+    while (end < json.size() && json[end] != '"') {
+        end += json[end] == '\\' ? 2 : 1;
+    }
+    if (end >= json.size()) return false;
+    *start = pos + 1;
+    *len = end - pos - 1;
+    return true;
+}
+
+GuestFileTransfer::GuestFileTransfer(GuestAgentHandler* agent, Direction direction,
+                                     std::string host_path, std::string guest_path)
+    : agent_(agent), direction_(direction),
+      host_path_(std::move(host_path)), guest_path_(std::move(guest_path)) {}
+
+GuestFileTransfer::~GuestFileTransfer() {
+    Cancel();
+    if (thread_.joinable()) thread_.join();
+}
+
+void GuestFileTransfer::Start(ProgressCallback on_progress, DoneCallback on_done) {
+    on_progress_ = std::move(on_progress);
+    on_done_ = std::move(on_done);
+    thread_ = std::thread(&GuestFileTransfer::Run, this);
+}
+
+void GuestFileTransfer::Cancel() {
+    {
+        std::lock_guard<std::mutex> lock(replies_->mutex);
+        replies_->canceled = true;
+    }
+    replies_->cv.notify_all();
+}
+
+void GuestFileTransfer::Run() {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t bytes = 0;
+    bool ok = direction_ == Direction::kPush ? Push(&bytes) : Pull(&bytes);
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    if (ok) {
+        LOG_INFO("GuestFile: %s %s (%llu bytes, %.1f MiB/s)",
+                 direction_ == Direction::kPush ? "pushed" : "pulled",
+                 guest_path_.c_str(), (unsigned long long)bytes,
+                 secs > 0 ? bytes / secs / (1024.0 * 1024.0) : 0.0);
+    } else {
+        LOG_WARN("GuestFile: %s %s failed after %llu bytes: %s",
+                 direction_ == Direction::kPush ? "push to" : "pull from",
+                 guest_path_.c_str(), (unsigned long long)bytes, error_.c_str());
+    }
+    if (on_done_) on_done_(ok, error_, bytes);
+    finished_ = true;
+}
+
+void GuestFileTransfer::ReportProgress(uint64_t bytes, uint64_t total) {
+    auto now = std::chrono::steady_clock::now();
+    if (!on_progress_ || now < next_progress_) return;
+    next_progress_ = now + std::chrono::milliseconds(kProgressIntervalMs);
+    on_progress_(bytes, total);
+}
+
+bool GuestFileTransfer::Send(const std::string& command,
+                             const std::string& arguments_json) {
+    std::weak_ptr<Replies> weak = replies_;
+    bool sent = agent_->Execute(command, arguments_json,
+        [weak](const std::string& response) {
+            auto replies = weak.lock();
+            if (!replies) return;
+            {
+                std::lock_guard<std::mutex> lock(replies->mutex);
+                replies->lines.push_back(response);
+            }
+            replies->cv.notify_all();
+        });
+    if (!sent) error_ = "guest agent not connected";
+    return sent;
+}
+
+bool GuestFileTransfer::WaitReply(std::string* reply) {
+    {
+        std::unique_lock<std::mutex> lock(replies_->mutex);
+        bool ready = replies_->cv.wait_for(lock,
+            std::chrono::milliseconds(kReplyTimeoutMs), [this] {
+                return replies_->canceled || !replies_->lines.empty();
+            });
+        if (replies_->canceled) {
+            error_ = "canceled";
+            return false;
+        }
+        if (!ready) {
+            error_ = "guest agent timed out";
+            return false;
+        }
+        *reply = std::move(replies_->lines.front());
+        replies_->lines.pop_front();
+    }
+    if (reply->empty()) {
+        error_ = "guest agent disconnected";
+        return false;
+    }
+    if (JsonFindValue(*reply, "error") != std::string::npos) {
+        size_t start, len;
+        error_ = JsonGetRawString(*reply, "desc", &start, &len)
+            ? reply->substr(start, len) : "guest agent error";
+        return false;
+    }
+    return true;
+}
+
+bool GuestFileTransfer::OpenGuest(const char* mode, int64_t* handle) {
+    std::string args = R"({"path":")" + GuestAgentHandler::JsonEscape(guest_path_) +
+                       R"(","mode":")" + mode + R"("})";
+    std::string reply;
+    if (!Send("guest-file-open", args) || !WaitReply(&reply)) return false;
+    if (!JsonGetInt(reply, "return", handle)) {
+        error_ = "bad guest-file-open reply";
+        return false;
+    }
+    return true;
+}
+
+void GuestFileTransfer::CloseGuest(int64_t handle) {
+    agent_->Execute("guest-file-close",
+                    R"({"handle":)" + std::to_string(handle) + "}",
+                    [](const std::string&) {});
+}
+
+bool GuestFileTransfer::Pull(uint64_t* bytes) {
+    std::wstring wide = Utf8ToWide(host_path_);
+    HANDLE file = CreateFileW(wide.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error_ = "cannot create host file (error " + std::to_string(GetLastError()) + ")";
+        return false;
+    }
+
+    int64_t handle = 0;
+    bool ok = OpenGuest("rb", &handle);
+    if (ok) {
+        // Reads continue from the handle's position, so the agent hands
+        // back consecutive chunks in the order they were asked for.
+        std::string read_args = R"({"handle":)" + std::to_string(handle) +
+                                R"(,"count":)" + std::to_string(kChunkSize) + "}";
+        std::string reply;
+        std::vector<uint8_t> chunk;
+        size_t in_flight = 0;
+        bool eof = false;
+        while (ok && (!eof || in_flight > 0)) {
+            while (!eof && in_flight < kWindow) {
+                if (!Send("guest-file-read", read_args)) { ok = false; break; }
+                ++in_flight;
+            }
+            if (!ok || !WaitReply(&reply)) { ok = false; break; }
+            --in_flight;
+
+            size_t start, len;
+            if (!JsonGetRawString(reply, "buf-b64", &start, &len) ||
+                !Base64Decode(reply.data() + start, len, &chunk)) {
+                error_ = "bad guest-file-read reply";
+                ok = false;
+                break;
+            }
+            if (JsonGetBool(reply, "eof")) eof = true;
+            if (chunk.empty()) continue;
+
+            DWORD written = 0;
+            if (!WriteFile(file, chunk.data(), (DWORD)chunk.size(), &written, nullptr) ||
+                written != chunk.size()) {
+                error_ = "host write failed (error " + std::to_string(GetLastError()) + ")";
+                ok = false;
+                break;
+            }
+            *bytes += chunk.size();
+            ReportProgress(*bytes, 0);
+        }
+        CloseGuest(handle);
+    }
+
+    CloseHandle(file);
+    if (!ok) DeleteFileW(wide.c_str());
+    return ok;
+}
+
+bool GuestFileTransfer::Push(uint64_t* bytes) {
+    HANDLE file = CreateFileW(Utf8ToWide(host_path_).c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error_ = "cannot open host file (error " + std::to_string(GetLastError()) + ")";
+        return false;
+    }
+    LARGE_INTEGER size{};
+    GetFileSizeEx(file, &size);
+    uint64_t total = static_cast<uint64_t>(size.QuadPart);
+
+    int64_t handle = 0;
+    bool ok = OpenGuest("wb", &handle);
+    if (ok) {
+        std::string prefix = R"({"handle":)" + std::to_string(handle) + R"(,"buf-b64":")";
+        std::vector<uint8_t> chunk(kChunkSize);
+        std::string encoded;
+        std::string args;
+        std::string reply;
+        std::deque<size_t> in_flight;  // sizes of the unanswered writes
+        bool host_eof = false;
+        while (ok && (!host_eof || !in_flight.empty())) {
+            while (!host_eof && in_flight.size() < kWindow) {
+                DWORD got = 0;
+                if (!ReadFile(file, chunk.data(), (DWORD)chunk.size(), &got, nullptr)) {
+                    error_ = "host read failed (error " + std::to_string(GetLastError()) + ")";
+                    ok = false;
+                    break;
+                }
+                if (got == 0) { host_eof = true; break; }
+                Base64Encode(chunk.data(), got, &encoded);
+                args.clear();
+                args.reserve(prefix.size() + encoded.size() + 2);
+                args.append(prefix).append(encoded).append("\"}");
+                if (!Send("guest-file-write", args)) { ok = false; break; }
+                in_flight.push_back(got);
+            }
+            if (!ok || in_flight.empty()) continue;
+            if (!WaitReply(&reply)) { ok = false; break; }
+
+            int64_t count = 0;
+            if (!JsonGetInt(reply, "count", &count) ||
+                static_cast<uint64_t>(count) != in_flight.front()) {
+                error_ = "short guest-file-write";
+                ok = false;
+                break;
+            }
+            in_flight.pop_front();
+            *bytes += static_cast<uint64_t>(count);
+            ReportProgress(*bytes, total);
+        }
+
+        if (ok) {
+            std::string reply_flush;
+            ok = Send("guest-file-flush", R"({"handle":)" + std::to_string(handle) + "}") &&
+                 WaitReply(&reply_flush);
+        }
+        CloseGuest(handle);
+    }
+
+    CloseHandle(file);
+    return ok;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class GuestAgentHandler;
+
+// Copies one file between the host and the guest with guest-file-open,
+// -read/-write and -close. Chunks are large and several are in flight at
+// once, so a transfer is not one agent round trip per chunk; data goes
+// straight between the host file and the agent, never held whole.
+class GuestFileTransfer {
+public:
+    enum class Direction { kPush, kPull };  // push: host to guest
+
+    // Bytes copied so far, of `total` (0 while a pull's size is unknown).
+    using ProgressCallback = std::function<void(uint64_t bytes, uint64_t total)>;
+    using DoneCallback = std::function<void(bool ok, const std::string& error,
+                                            uint64_t bytes)>;
+
+    static constexpr size_t kChunkSize = 1024 * 1024;
+    static constexpr size_t kWindow = 4;  // chunks in flight
+    static constexpr uint32_t kReplyTimeoutMs = 30000;
+    static constexpr uint32_t kProgressIntervalMs = 250;
+
+    GuestFileTransfer(GuestAgentHandler* agent, Direction direction,
+                      std::string host_path, std::string guest_path);
+    // Cancels a transfer still running and waits for its thread.
+    ~GuestFileTransfer();
+
+    // Runs the transfer on its own thread. The callbacks run there too;
+    // `on_done` is the last, and comes exactly once.
+    void Start(ProgressCallback on_progress, DoneCallback on_done);
+    void Cancel();
+    bool Finished() const { return finished_.load(); }
+
+    GuestFileTransfer(const GuestFileTransfer&) = delete;
+    GuestFileTransfer& operator=(const GuestFileTransfer&) = delete;
+
+private:
+    // Replies in the order the agent sends them, which is the order the
+    // commands went out. Shared with the reply callbacks, which can
+    // outlive the transfer when it gives up early.
+    struct Replies {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::string> lines;
+        bool canceled = false;
+    };
+
+    void Run();
+    bool Pull(uint64_t* bytes);
+    bool Push(uint64_t* bytes);
+    // Calls on_progress_ at most every kProgressIntervalMs.
+    void ReportProgress(uint64_t bytes, uint64_t total);
+    bool Send(const std::string& command, const std::string& arguments_json);
+    // The next reply, or false on timeout, cancel, lost agent or an error
+    // response, with error_ set.
+    bool WaitReply(std::string* reply);
+    bool OpenGuest(const char* mode, int64_t* handle);
+    // Best effort: nothing waits for the reply.
+    void CloseGuest(int64_t handle);
+
+    GuestAgentHandler* agent_;
+    Direction direction_;
+    std::string host_path_;
+    std::string guest_path_;
+    ProgressCallback on_progress_;
+    DoneCallback on_done_;
+    std::shared_ptr<Replies> replies_ = std::make_shared<Replies>();
+    // Transfer thread only.
+    std::string error_;
+    std::chrono::steady_clock::time_point next_progress_{};
+    std::atomic<bool> finished_{false};
+    std::thread thread_;
+};
@@ -0,0 +1,295 @@
+#include "core/net/dns_resolver.h"
+#include "core/vmm/types.h"
+
+#include <winsock2.h>
+#include <windns.h>
+
+#include <algorithm>
+#include <cstring>
+
+#pragma comment(lib, "dnsapi.lib")
+
+static constexpr size_t kDnsHeaderBytes = 12;
+static constexpr uint16_t kTypeA = 1;
+static constexpr uint16_t kTypeAAAA = 28;
+static constexpr uint8_t kRcodeServFail = 2;
+static constexpr uint8_t kRcodeNxDomain = 3;
+
+static uint16_t ReadU16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static void AppendU16(std::vector<uint8_t>* out, uint16_t v) {
+    out->push_back(static_cast<uint8_t>(v >> 8));
+    out->push_back(static_cast<uint8_t>(v));
+}
+
+static void AppendU32(std::vector<uint8_t>* out, uint32_t v) {
+    AppendU16(out, static_cast<uint16_t>(v >> 16));
+    AppendU16(out, static_cast<uint16_t>(v));
+}
+
+// Parses a standard query with one IN-class question. Returns the offset
+// just past the question, or 0 if the message is anything else. The name
+// comes back lower-cased, without the trailing dot.
+static size_t ParseQuestion(const uint8_t* msg, size_t len,
+                            std::string* name, uint16_t* qtype) {
+    if (len < kDnsHeaderBytes) return 0;
+    if (msg[2] & 0x80) return 0;            // a response
+    if ((msg[2] >> 3) & 0xF) return 0;      // opcode other than QUERY
+    if (ReadU16(msg + 4) != 1) return 0;    // QDCOUNT
+
+    name->clear();
+    size_t pos = kDnsHeaderBytes;
+    for (;;) {
+        if (pos >= len) return 0;
+        uint8_t label = msg[pos++];
+        if (label == 0) break;
+        // Also rejects compression pointers, which a question never needs.
+        if (label > 63 || pos + label > len) return 0;
+        if (!name->empty()) name->push_back('.');
+        for (size_t i = 0; i < label; i++) {
+            char c = static_cast<char>(msg[pos + i]);
+            if (c <= ' ' || c >= 0x7F || c == '.') return 0;
+            if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+            name->push_back(c);
+        }
+        pos += label;
+        if (name->size() > 253) return 0;
+    }
+    if (name->empty() || pos + 4 > len) return 0;
+    *qtype = ReadU16(msg + pos);
+    if (ReadU16(msg + pos + 2) != 1) return 0;  // QCLASS IN
+    return pos + 4;
+}
+
+// Reply to `query` (its header and question) with A records for `addrs`.
+static void BuildReply(const uint8_t* query, size_t question_end, uint8_t rcode,
+                       const std::vector<uint32_t>& addrs, uint32_t ttl,
+                       std::vector<uint8_t>* out) {
+    out->assign(query, query + question_end);
+    uint8_t* hdr = out->data();
+    hdr[2] = 0x80 | (query[2] & 0x01);  // QR, keep RD
+    hdr[3] = 0x80 | rcode;              // RA
+    hdr[4] = 0; hdr[5] = 1;             // QDCOUNT
+    hdr[6] = 0; hdr[7] = static_cast<uint8_t>(addrs.size());
+    memset(hdr + 8, 0, 4);              // NSCOUNT, ARCOUNT
+
+    for (uint32_t addr : addrs) {
+        AppendU16(out, 0xC000 | kDnsHeaderBytes);  // name: pointer to question
+        AppendU16(out, kTypeA);
+        AppendU16(out, 1);  // IN
+        AppendU32(out, ttl);
+        AppendU16(out, 4);
+        AppendU32(out, addr);
+    }
+}
+
+// One DnsQueryEx call for a name's A records.
+struct DnsResolver::Lookup {
+    DnsResolver* owner = nullptr;
+    std::string key;
+    std::wstring name;
+    DNS_QUERY_RESULT result{};
+    DNS_QUERY_CANCEL cancel{};
+    bool done = false;  // under owner->mutex_
+    std::vector<Waiter> waiters;
+};
+
+static void FreeRecords(DNS_QUERY_RESULT* result) {
+    if (result->pQueryRecords) {
+        DnsRecordListFree(result->pQueryRecords, DnsFreeRecordList);
+        result->pQueryRecords = nullptr;
+    }
+}
+
+DnsResolver::DnsResolver() = default;
+
+DnsResolver::~DnsResolver() {
+    Stop();
+}
+
+void DnsResolver::Start(std::function<void()> wake) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_ = std::move(wake);
+}
+
+void DnsResolver::Stop() {
+    std::vector<DNS_QUERY_CANCEL*> cancels;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [key, lookup] : lookups_) {
+            if (!lookup->done) cancels.push_back(&lookup->cancel);
+        }
+    }
+    // Outside the lock: a cancelled lookup may complete on this thread.
+    for (DNS_QUERY_CANCEL* cancel : cancels) DnsCancelQuery(cancel);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_cv_.wait(lock, [this] { return in_flight_ == 0; });
+        completed_.clear();
+        wake_ = nullptr;
+    }
+
+    for (auto& [key, lookup] : lookups_) FreeRecords(&lookup->result);
+    lookups_.clear();
+    cache_.clear();
+}
+
+DnsResolver::Result DnsResolver::HandleQuery(const DnsClient& client,
+                                             const uint8_t* msg, size_t len,
+                                             std::vector<uint8_t>* reply) {
+    std::string name;
+    uint16_t qtype = 0;
+    size_t question_end = ParseQuestion(msg, len, &name, &qtype);
+    if (!question_end || (qtype != kTypeA && qtype != kTypeAAAA))
+        return Result::kNotHandled;
+
+    uint64_t now = GetTickCount64();
+    auto it = cache_.find(name);
+    if (it != cache_.end() && it->second.expires_ms <= now) {
+        cache_.erase(it);
+        it = cache_.end();
+    }
+
+    if (qtype == kTypeAAAA) {
+        uint8_t rcode = it != cache_.end() ? it->second.rcode : 0;
+        BuildReply(msg, question_end, rcode, {}, 0, reply);
+        return Result::kAnswered;
+    }
+
+    if (it != cache_.end()) {
+        // Hand out what is left of our lifetime so the guest's own cache
+        // does not outlast it.
+        auto ttl = static_cast<uint32_t>((it->second.expires_ms - now + 999) / 1000);
+        BuildReply(msg, question_end, it->second.rcode, it->second.addrs, ttl, reply);
+        return Result::kAnswered;
+    }
+
+    Lookup* lookup;
+    auto pending = lookups_.find(name);
+    if (pending != lookups_.end()) {
+        lookup = pending->second.get();
+        if (lookup->waiters.size() >= kMaxWaiters) return Result::kNotHandled;
+        lookup->waiters.push_back({client, {msg, msg + question_end}});
+        return Result::kPending;
+    }
+    if (lookups_.size() >= kMaxLookups) return Result::kNotHandled;
+
+    auto owned = std::make_unique<Lookup>();
+    lookup = owned.get();
+    lookup->owner = this;
+    lookup->key = name;
+    lookup->name.assign(name.begin(), name.end());
+    lookup->waiters.push_back({client, {msg, msg + question_end}});
+    lookups_.emplace(name, std::move(owned));
+
+    DNS_QUERY_REQUEST request{};
+    request.Version = DNS_QUERY_REQUEST_VERSION1;
+    request.QueryName = lookup->name.c_str();
+    request.QueryType = DNS_TYPE_A;
+    request.QueryOptions = DNS_QUERY_STANDARD;
+    request.pQueryContext = lookup;
+    request.pQueryCompletionCallback = [](PVOID context, PDNS_QUERY_RESULT) {
+        CompleteLookup(static_cast<Lookup*>(context));
+    };
+    lookup->result.Version = DNS_QUERY_REQUEST_VERSION1;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_++;
+    }
+    DNS_STATUS status = DnsQueryEx(&request, &lookup->result, &lookup->cancel);
+    if (status != DNS_REQUEST_PENDING) {
+        // Finished (or failed) without going asynchronous.
+        lookup->result.QueryStatus = status;
+        CompleteLookup(lookup);
+    }
+    return Result::kPending;
+}
+
+void DnsResolver::CompleteLookup(Lookup* lookup) {
+    DnsResolver* self = lookup->owner;
+    std::lock_guard<std::mutex> lock(self->mutex_);
+    lookup->done = true;
+    self->completed_.push_back(lookup);
+    if (self->wake_) self->wake_();
+    if (--self->in_flight_ == 0) self->idle_cv_.notify_all();
+}
+
+void DnsResolver::DeliverCompleted(const SendFn& send) {
+    std::vector<Lookup*> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (completed_.empty()) return;
+        done.swap(completed_);
+    }
+    for (Lookup* lookup : done) {
+        FinishLookup(lookup, send);
+        lookups_.erase(lookup->key);
+    }
+}
+
+void DnsResolver::FinishLookup(Lookup* lookup, const SendFn& send) {
+    CacheEntry entry{0, {}, 0};
+    uint32_t ttl = kNegativeTtlSec;
+    bool cacheable = true;
+
+    switch (lookup->result.QueryStatus) {
+    case ERROR_SUCCESS: {
+        // The answer lives as long as the shortest-lived record of it,
+        // CNAMEs on the way included.
+        uint32_t answer_ttl = UINT32_MAX;
+        for (auto* r = lookup->result.pQueryRecords; r; r = r->pNext) {
+            if (r->Flags.S.Section != DnsSectionAnswer) continue;
+            if (r->wType != DNS_TYPE_A && r->wType != DNS_TYPE_CNAME) continue;
+            answer_ttl = std::min<uint32_t>(answer_ttl, r->dwTtl);
+            if (r->wType != DNS_TYPE_A || entry.addrs.size() == kMaxAnswers) continue;
+            uint32_t addr = ntohl(r->Data.A.IpAddress);
+            if (std::find(entry.addrs.begin(), entry.addrs.end(), addr) != entry.addrs.end())
+                continue;
+            entry.addrs.push_back(addr);
+        }
+        if (!entry.addrs.empty()) ttl = answer_ttl;
+        break;
+    }
+    case DNS_ERROR_RCODE_NAME_ERROR:
+        entry.rcode = kRcodeNxDomain;
+        break;
+    case DNS_INFO_NO_RECORDS:
+        break;
+    case ERROR_CANCELLED:
+        cacheable = false;
+        lookup->waiters.clear();
+        break;
+    default:
+        LOG_WARN("DNS: lookup of %s failed (%ld)", lookup->key.c_str(),
+                 static_cast<long>(lookup->result.QueryStatus));
+        entry.rcode = kRcodeServFail;
+        cacheable = false;
+        ttl = 0;
+        break;
+    }
+
+    FreeRecords(&lookup->result);
+
+    std::vector<uint8_t> reply;
+    for (auto& w : lookup->waiters) {
+        BuildReply(w.query.data(), w.query.size(), entry.rcode, entry.addrs, ttl, &reply);
+        send(w.client, reply.data(), reply.size());
+    }
+
+    if (cacheable) {
+        uint64_t now = GetTickCount64();
+        entry.expires_ms = now + uint64_t(ttl) * 1000;
+        Insert(lookup->key, std::move(entry), now);
+    }
+}
+
+void DnsResolver::Insert(const std::string& key, CacheEntry entry, uint64_t now) {
+    if (cache_.size() >= kMaxCacheEntries) {
+        std::erase_if(cache_, [now](const auto& kv) { return kv.second.expires_ms <= now; });
+        while (cache_.size() >= kMaxCacheEntries) cache_.erase(cache_.begin());
+    }
+    cache_[key] = std::move(entry);
+}
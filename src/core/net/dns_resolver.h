@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Where a guest query came from and which server address it was sent to;
+// the reply has to come back from that address.
+struct DnsClient {
+    uint32_t ip;
+    uint16_t port;
+    uint32_t server_ip;
+};
+
+// DNS answering for the NAT gateway. A questions are answered from a cache
+// filled by asynchronous DnsQueryEx lookups, so repeated names cost
+// neither a host socket nor a lookup; concurrent misses for one name share
+// a lookup. Answers are kept, and handed out, for the records' own TTL.
+// The guest network is IPv4 only, so AAAA questions get an empty answer.
+// Everything but the lookup completions runs on the network thread.
+class DnsResolver {
+public:
+    enum class Result {
+        kAnswered,    // reply filled in
+        kPending,     // reply comes through DeliverCompleted()
+        kNotHandled,  // relay the query to a real DNS server
+    };
+
+    DnsResolver();
+    ~DnsResolver();
+
+    DnsResolver(const DnsResolver&) = delete;
+    DnsResolver& operator=(const DnsResolver&) = delete;
+
+    // `wake` is called from a lookup's completion thread.
+    void Start(std::function<void()> wake);
+    // Cancels in-flight lookups and waits for them to finish.
+    void Stop();
+
+    Result HandleQuery(const DnsClient& client, const uint8_t* msg, size_t len,
+                       std::vector<uint8_t>* reply);
+
+    // Caches finished lookups and sends the replies waiting on them.
+    using SendFn = std::function<void(const DnsClient&, const uint8_t*, size_t)>;
+    void DeliverCompleted(const SendFn& send);
+
+private:
+    // The host resolver does not pass on the SOA minimum of a negative
+    // answer, so those are kept this long.
+    static constexpr uint32_t kNegativeTtlSec = 30;
+    static constexpr size_t kMaxCacheEntries = 4096;
+    static constexpr size_t kMaxLookups = 256;
+    static constexpr size_t kMaxWaiters = 64;
+    static constexpr size_t kMaxAnswers = 16;
+
+    struct CacheEntry {
+        uint8_t rcode;
+        std::vector<uint32_t> addrs;  // host byte order
+        uint64_t expires_ms;
+    };
+
+    struct Waiter {
+        DnsClient client;
+        std::vector<uint8_t> query;  // header and question
+    };
+
+    struct Lookup;
+    static void CompleteLookup(Lookup* lookup);
+    void FinishLookup(Lookup* lookup, const SendFn& send);
+    void Insert(const std::string& key, CacheEntry entry, uint64_t now);
+
+    std::function<void()> wake_;
+    std::unordered_map<std::string, CacheEntry> cache_;
+    // Lookups by cache key, owned here until delivered.
+    std::unordered_map<std::string, std::unique_ptr<Lookup>> lookups_;
+
+    std::mutex mutex_;
+    std::condition_variable idle_cv_;
+    std::vector<Lookup*> completed_;  // under mutex_
+    size_t in_flight_ = 0;            // under mutex_
+};
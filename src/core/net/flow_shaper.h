@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Rate limit for one direction of a VM's traffic, with per-flow fair
+// queuing in front of it.
+//
+// Frames wait in one of kFlows queues picked by a hash of their flow and
+// leave through a token bucket. Queues are served deficit round robin, and
+// one that was empty goes ahead of those that stayed busy (as fq_codel
+// does), so a keystroke of an SSH session overtakes the backlog of a bulk
+// download instead of queuing behind it. When the queue is full the
+// longest flow loses its oldest frame.
+//
+// Not thread-safe; the network thread owns it.
+template <typename T>
+class FlowShaper {
+public:
+    // Bytes a flow may send per round, about one MTU frame.
+    static constexpr int64_t kQuantum = 1514;
+    static constexpr uint32_t kFlows = 256;
+
+    explicit FlowShaper(size_t limit_frames) : limit_frames_(limit_frames), flows_(kFlows) {}
+
+    FlowShaper(const FlowShaper&) = delete;
+    FlowShaper& operator=(const FlowShaper&) = delete;
+
+    // 0 lifts the limit; queued frames then drain at once. A burst of 0
+    // allows 50 ms worth, at least 64 KiB, which covers the network
+    // thread's timer granularity.
+    void SetRate(uint64_t bytes_per_sec, uint64_t burst_bytes) {
+        rate_ = static_cast<double>(bytes_per_sec);
+        if (!burst_bytes) burst_bytes = (std::max)(bytes_per_sec / 20, uint64_t(64 * 1024));
+        capacity_ = static_cast<double>(burst_bytes);
+        tokens_ = capacity_;
+        last_refill_ = Clock::now();
+    }
+    bool limited() const { return rate_ > 0; }
+    bool empty() const { return frames_ == 0; }
+
+    // Queues `value` for `flow`. If that overfills the queue, the frame
+    // dropped to make room is moved to `*dropped` and true returned.
+    bool Enqueue(uint32_t flow, T value, uint32_t len, T* dropped) {
+        uint32_t idx = flow % kFlows;
+        Flow& f = flows_[idx];
+        f.items.push_back({std::move(value), len});
+        f.bytes += len;
+        frames_++;
+        if (!f.listed) {
+            f.listed = true;
+            f.deficit = kQuantum;
+            new_flows_.push_back(idx);
+        }
+        if (frames_ <= limit_frames_) return false;
+
+        Flow* fattest = &f;
+        for (Flow& other : flows_) {
+            if (other.bytes > fattest->bytes) fattest = &other;
+        }
+        *dropped = std::move(fattest->items.front().value);
+        fattest->bytes -= fattest->items.front().len;
+        fattest->items.pop_front();
+        frames_--;
+        return true;
+    }
+
+    // Takes the next frame the bucket allows, if any.
+    bool Dequeue(T* value) {
+        if (!frames_) return false;
+        if (rate_ > 0) {
+            Refill();
+            // The bucket may go into debt by one frame, so frames larger
+            // than the burst still pass.
+            if (tokens_ < 0) return false;
+        }
+        for (;;) {
+            bool from_new = !new_flows_.empty();
+            std::deque<uint32_t>& list = from_new ? new_flows_ : old_flows_;
+            uint32_t idx = list.front();
+            Flow& f = flows_[idx];
+            if (f.deficit <= 0) {
+                f.deficit += kQuantum;
+                list.pop_front();
+                old_flows_.push_back(idx);
+                continue;
+            }
+            if (f.items.empty()) {
+                list.pop_front();
+                // A flow that just went quiet costs a new flow's priority
+                // only once; bouncing back would starve the old flows.
+                if (from_new && !old_flows_.empty()) {
+                    old_flows_.push_back(idx);
+                } else {
+                    f.listed = false;
+                }
+                continue;
+            }
+            Item& item = f.items.front();
+            *value = std::move(item.value);
+            f.deficit -= item.len;
+            f.bytes -= item.len;
+            if (rate_ > 0) tokens_ -= item.len;
+            f.items.pop_front();
+            frames_--;
+            return true;
+        }
+    }
+
+    // Milliseconds until Dequeue() can go on, or -1 with nothing queued.
+    int64_t NextSendMs() {
+        if (!frames_) return -1;
+        if (rate_ <= 0) return 0;
+        Refill();
+        if (tokens_ >= 0) return 0;
+        return static_cast<int64_t>(-tokens_ * 1000 / rate_) + 1;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Item {
+        T value;
+        uint32_t len;
+    };
+    struct Flow {
+        std::deque<Item> items;
+        uint64_t bytes = 0;
+        int64_t deficit = 0;
+        bool listed = false;  // in new_flows_ or old_flows_
+    };
+
+    void Refill() {
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+        last_refill_ = now;
+        tokens_ = (std::min)(capacity_, tokens_ + rate_ * elapsed);
+    }
+
+    size_t limit_frames_;
+    size_t frames_ = 0;
+    std::vector<Flow> flows_;
+    std::deque<uint32_t> new_flows_;
+    std::deque<uint32_t> old_flows_;
+    double rate_ = 0;
+    double capacity_ = 0;
+    double tokens_ = 0;
+    Clock::time_point last_refill_{};
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Lock-free queues used to hand network frames between threads.
+
+namespace frame_ring_detail {
+
+// Keeps the producer and consumer indices on separate cache lines.
+constexpr size_t kCacheLine = 64;
+
+inline size_t RoundUpPow2(size_t n) {
+    size_t cap = 1;
+    while (cap < n) cap <<= 1;
+    return cap;
+}
+
+}  // namespace frame_ring_detail
+
+// Bounded multi-producer multi-consumer queue (Vyukov's sequence-numbered
+// ring). Each cell's sequence tells a producer or consumer whether the
+// cell is free for the lap it is on, so neither side ever blocks.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : mask_(frame_ring_detail::RoundUpPow2(capacity) - 1),
+          cells_(std::make_unique<Cell[]>(mask_ + 1)) {
+        for (size_t i = 0; i <= mask_; i++)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Returns false when the queue is full.
+    bool TryPush(const T& value) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                                       std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false when the queue is empty.
+    bool TryPop(T* value) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                                       std::memory_order_relaxed)) {
+                    *value = cell.value;
+                    cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t Capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq{0};
+        T value{};
+    };
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(frame_ring_detail::kCacheLine) std::atomic<size_t> enqueue_pos_{0};
+    alignas(frame_ring_detail::kCacheLine) std::atomic<size_t> dequeue_pos_{0};
+};
+
+// Bounded single-producer single-consumer ring of preallocated slots.
+// The producer fills a slot in place between Reserve() and Commit(); the
+// consumer reads Front() in place until Pop().
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity)
+        : mask_(frame_ring_detail::RoundUpPow2(capacity) - 1),
+          slots_(std::make_unique<T[]>(mask_ + 1)) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer side. Returns nullptr when the ring is full.
+    T* Reserve() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) return nullptr;
+        return &slots_[tail & mask_];
+    }
+    void Commit() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+
+    // Consumer side. Returns nullptr when the ring is empty.
+    T* Front() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return nullptr;
+        return &slots_[head & mask_];
+    }
+    void Pop() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+
+    size_t Capacity() const { return mask_ + 1; }
+
+private:
+    const size_t mask_;
+    std::unique_ptr<T[]> slots_;
+    alignas(frame_ring_detail::kCacheLine) std::atomic<size_t> head_{0};
+    alignas(frame_ring_detail::kCacheLine) std::atomic<size_t> tail_{0};
+};
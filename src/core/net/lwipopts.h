@@ -29,7 +29,9 @@
 // Memory configuration
 #define MEM_ALIGNMENT               4
 #define MEM_SIZE                    (2 * 1024 * 1024)
-#define MEMP_NUM_PBUF               512
+// TCP data to the guest is written by reference: one ROM pbuf per
+// segment piece, up to a full send buffer per connection.
+#define MEMP_NUM_PBUF               4096
 #define MEMP_NUM_RAW_PCB            4
 #define MEMP_NUM_UDP_PCB            64
 #define MEMP_NUM_TCP_PCB            512
@@ -58,10 +60,12 @@
 #define TCP_MSL                     5000
 
 // Checksum — lwIP generates outgoing, skip incoming verification
-// (we do our own incremental checksum updates for NAT rewriting)
+// (we do our own incremental checksum updates for NAT rewriting).
+// TCP checksums are left to the guest's checksum offload, or to the
+// virtio-net device when the guest has none.
 #define CHECKSUM_GEN_IP             1
 #define CHECKSUM_GEN_UDP            1
-#define CHECKSUM_GEN_TCP            1
+#define CHECKSUM_GEN_TCP            0
 #define CHECKSUM_GEN_ICMP           1
 #define CHECKSUM_CHECK_IP           0
 #define CHECKSUM_CHECK_UDP          0
@@ -73,7 +77,15 @@
 #define LWIP_NETIF_LINK_CALLBACK    0
 #define LWIP_STATS                  0
 #define LWIP_STATS_DISPLAY          0
-#define LWIP_NETIF_TX_SINGLE_PBUF   1
+// Off: a single-pbuf netif makes tcp_write() copy every write. Output
+// frames are linearized into the RX batch anyway.
+#define LWIP_NETIF_TX_SINGLE_PBUF   0
+
+// Guest TX frames are fed to lwIP as custom pbufs over pooled buffers
+#define LWIP_SUPPORT_CUSTOM_PBUF    1
+
+// Closed PCBs own the stream chunks their unacked segments reference
+#define LWIP_TCP_PCB_NUM_EXT_ARGS   1
 
 // Don't check TCP checksum on incoming rewritten packets
 // since we do incremental checksum updates
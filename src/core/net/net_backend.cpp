@@ -21,8 +21,10 @@ extern "C" {
 #include "netif/ethernet.h"
 }
 
+#include <cstddef>
 #include <cstring>
 #include <memory>
+#include <span>
 #include <algorithm>
 
 #pragma comment(lib, "ws2_32.lib")
@@ -178,13 +180,14 @@ static err_t LwipNetifInit(struct netif* nif) {
 
 static err_t LwipLinkOutput(struct netif* nif, struct pbuf* p) {
     auto* backend = static_cast<NetBackend*>(nif->state);
-    // Linearize pbuf chain
-    std::vector<uint8_t> buf(p->tot_len);
-    pbuf_copy_partial(p, buf.data(), p->tot_len, 0);
+    // Linearize the pbuf chain straight into the RX batch
+    uint8_t* buf = backend->StageRxFrame(p->tot_len);
+    if (!buf) return ERR_OK;
+    pbuf_copy_partial(p, buf, p->tot_len, 0);
 
     // Reverse-rewrite NAT responses before injecting to guest
-    backend->ReverseRewrite(buf.data(), static_cast<uint32_t>(buf.size()));
-    backend->InjectFrame(buf.data(), static_cast<uint32_t>(buf.size()));
+    backend->ReverseRewrite(buf, p->tot_len);
+    backend->MarkStagedChecksumPartial(buf, p->tot_len);
     return ERR_OK;
 }
 
@@ -192,9 +195,37 @@ static err_t LwipLinkOutput(struct netif* nif, struct pbuf* p) {
 // NetBackend lifecycle
 // ============================================================
 
+// A guest frame staged for lwIP. The pbuf_custom header comes first so the
+// pbuf lwIP frees can be turned back into its frame.
+struct NetBackend::TxFrame {
+    struct pbuf_custom pbuf;
+    NetBackend* owner = nullptr;
+    uint32_t len = 0;
+    uint8_t* buf = nullptr;
+    uint8_t* oversize = nullptr;  // borrowed from tx_large_free_
+    uint8_t data[kTxFrameBytes];
+};
+
 NetBackend::NetBackend() {
     WSADATA wsa;
     WSAStartup(MAKEWORD(2, 2), &wsa);
+
+    tx_pool_.reserve(kTxPoolFrames);
+    for (size_t i = 0; i < kTxPoolFrames; i++) {
+        auto f = std::make_unique<TxFrame>();
+        f->owner = this;
+        f->pbuf.custom_free_function = [](struct pbuf* p) {
+            auto* frame = reinterpret_cast<TxFrame*>(p);
+            frame->owner->ReleaseTxFrame(frame);
+        };
+        tx_free_.TryPush(f.get());
+        tx_pool_.push_back(std::move(f));
+    }
+    tx_large_pool_.reserve(kTxLargeBuffers);
+    for (size_t i = 0; i < kTxLargeBuffers; i++) {
+        tx_large_pool_.push_back(std::make_unique<uint8_t[]>(kMaxTxFrameBytes));
+        tx_large_free_.TryPush(tx_large_pool_.back().get());
+    }
 }
 
 NetBackend::~NetBackend() {
@@ -210,6 +241,19 @@ bool NetBackend::Start(VirtioNetDevice* dev,
     for (auto& f : forwards)
         port_forwards_.push_back({f.host_port, f.guest_port});
 
+    WSAEVENT event = WSACreateEvent();
+    if (event == WSA_INVALID_EVENT) {
+        LOG_ERROR("Network backend: WSACreateEvent failed (%d)", WSAGetLastError());
+        return false;
+    }
+    wake_event_ = event;
+
+    rio_udp_.Init(wake_event_);
+
+    // Queries the DNS cache cannot answer go to the host's resolver.
+    host_dns_ip_ = GetHostDnsServer();
+    dns_.Start([this] { Wake(); });
+
     running_ = true;
     net_thread_ = std::thread(&NetBackend::NetworkThread, this);
     return true;
@@ -217,16 +261,23 @@ bool NetBackend::Start(VirtioNetDevice* dev,
 
 void NetBackend::Stop() {
     running_ = false;
+    Wake();
     if (net_thread_.joinable()) net_thread_.join();
 
+    // Before wake_event_ goes: lookup completions signal it.
+    dns_.Stop();
+
     // Clean up NAT sockets
     for (auto& e : nat_entries_) {
-        if (e->host_socket != INVALID_SOCKET)
-            closesocket(static_cast<SOCKET>(e->host_socket));
+        CloseNatSocket(e.get());
         if (e->listen_pcb) tcp_close(static_cast<struct tcp_pcb*>(e->listen_pcb));
         if (e->conn_pcb) tcp_abort(static_cast<struct tcp_pcb*>(e->conn_pcb));
     }
     nat_entries_.clear();
+    nat_flows_.clear();
+    std::fill(proxy_port_owner_.begin(), proxy_port_owner_.end(), nullptr);
+    std::fill(std::begin(expiry_wheel_), std::end(expiry_wheel_), nullptr);
+    rio_udp_.Shutdown();
 
     for (auto& pf : port_forwards_) {
         if (pf.listener != ~(uintptr_t)0)
@@ -242,21 +293,122 @@ void NetBackend::Stop() {
         delete static_cast<struct netif*>(netif_);
         netif_ = nullptr;
     }
+
+    if (wake_event_) {
+        WSACloseEvent(static_cast<WSAEVENT>(wake_event_));
+        wake_event_ = nullptr;
+    }
+
+    rx_staged_.clear();
+    rx_stage_.clear();
+
+    TxFrame* f;
+    while (tx_queue_.TryPop(&f)) ReleaseTxFrame(f);
+    tx_signaled_ = false;
+
+    uint64_t tx_dropped = tx_dropped_.exchange(0);
+    if (tx_dropped) {
+        LOG_WARN("Network backend: %llu TX frames dropped, buffer pool exhausted",
+                 tx_dropped);
+    }
+    if (virtio_net_) {
+        auto rx = virtio_net_->GetRxStats();
+        if (rx.dropped_full || rx.dropped_oversize || rx.deferred) {
+            LOG_WARN("Network backend: RX %llu queued, %llu deferred for guest "
+                     "buffers, %llu dropped (ring full), %llu dropped (oversize)",
+                     rx.queued, rx.deferred, rx.dropped_full, rx.dropped_oversize);
+        }
+    }
+}
+
+void NetBackend::Wake() {
+    if (wake_event_) WSASetEvent(static_cast<WSAEVENT>(wake_event_));
+}
+
+void NetBackend::WatchSocket(uintptr_t s) {
+    // Also makes the socket non-blocking. FD_READ and FD_WRITE re-arm only
+    // after a recv/send, so sockets held back for flow control stay quiet.
+    if (WSAEventSelect(static_cast<SOCKET>(s), static_cast<WSAEVENT>(wake_event_),
+                       FD_READ | FD_WRITE | FD_ACCEPT | FD_CONNECT | FD_CLOSE)
+            == SOCKET_ERROR) {
+        LOG_WARN("Network backend: WSAEventSelect failed (%d)", WSAGetLastError());
+    }
 }
 
 void NetBackend::SetLinkUp(bool up) {
     link_up_ = up;
 }
 
+void NetBackend::SetRateLimit(const NetRateLimit& limit) {
+    {
+        std::lock_guard<std::mutex> lock(pf_update_mutex_);
+        pending_rate_update_ = limit;
+    }
+    Wake();
+}
+
 void NetBackend::UpdatePortForwards(const std::vector<PortForward>& forwards) {
-    std::lock_guard<std::mutex> lock(pf_update_mutex_);
-    pending_pf_update_ = forwards;
+    {
+        std::lock_guard<std::mutex> lock(pf_update_mutex_);
+        pending_pf_update_ = forwards;
+    }
+    Wake();
+}
+
+void NetBackend::EnqueueTx(const NetTxSegment* segs, size_t count, uint32_t len) {
+    if (!link_up_ || len > kMaxTxFrameBytes) return;
+
+    TxFrame* f;
+    if (!tx_free_.TryPop(&f)) {
+        tx_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // The only copy on the way to lwIP: guest segments into the frame buffer.
+    if (len <= kTxFrameBytes) {
+        f->buf = f->data;
+    } else if (tx_large_free_.TryPop(&f->oversize)) {
+        f->buf = f->oversize;
+    } else {
+        tx_free_.TryPush(f);
+        tx_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t off = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(f->buf + off, segs[i].addr, segs[i].len);
+        off += segs[i].len;
+    }
+    f->len = off;
+
+    tx_queue_.TryPush(f);
+    if (!tx_signaled_.exchange(true)) Wake();
 }
 
-void NetBackend::EnqueueTx(const uint8_t* frame, uint32_t len) {
-    if (!link_up_) return;
-    std::lock_guard<std::mutex> lock(tx_mutex_);
-    tx_queue_.emplace_back(frame, frame + len);
+void NetBackend::ReleaseTxFrame(TxFrame* frame) {
+    if (frame->oversize) {
+        tx_large_free_.TryPush(frame->oversize);
+        frame->oversize = nullptr;
+    }
+    tx_free_.TryPush(frame);
+}
+
+void NetBackend::FeedToLwip(TxFrame* frame) {
+    // A TSO frame can exceed a pbuf's 16-bit length by its Ethernet header,
+    // so IPv4 frames that big skip the Ethernet layer.
+    bool ip_only = frame->len > 0xFFFF;
+    uint32_t skip = ip_only ? sizeof(EthHdr) : 0;
+    auto len = static_cast<u16_t>(frame->len - skip);
+    struct pbuf* p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &frame->pbuf,
+                                         frame->buf + skip, len);
+    if (!p) {
+        ReleaseTxFrame(frame);
+        return;
+    }
+    // Freeing the pbuf, now or once lwIP is done with it, recycles the frame.
+    auto* nif = static_cast<struct netif*>(netif_);
+    err_t err = ip_only ? ip4_input(p, nif) : nif->input(p, nif);
+    if (err != ERR_OK) pbuf_free(p);
 }
 
 // ============================================================
@@ -290,138 +442,206 @@ void NetBackend::NetworkThread() {
     LOG_INFO("Network backend started (gateway 10.0.2.2, guest 10.0.2.15)");
 
     uint64_t last_cleanup_ms = GetTickCount64();
+    expiry_tick_ = last_cleanup_ms / kCleanupIntervalMs;
 
     while (running_) {
+        // Reset before looking at any source, so anything that arrives
+        // during this pass signals the event again.
+        WSAResetEvent(static_cast<WSAEVENT>(wake_event_));
+
         CheckPendingUpdates();
         ProcessPendingTx();
+        dns_.DeliverCompleted([this](const DnsClient& c, const uint8_t* data, size_t len) {
+            SendUdpToGuest(c.server_ip, 53, c.ip, c.port, data, static_cast<uint32_t>(len));
+        });
 
         // Close listen PCBs that were deferred from accept callbacks.
         for (auto* pcb : deferred_listen_close_)
             tcp_close(static_cast<struct tcp_pcb*>(pcb));
         deferred_listen_close_.clear();
 
-        bool polled = PollSockets();
+        PollSockets();
+        rio_udp_.Poll(kMaxRioDatagramsPerPass,
+                      [this](void* context, const uint8_t* data, uint32_t len) {
+            HandleUdpDatagram(static_cast<NatEntry*>(context), data, len);
+        });
         PollIcmpSocket();
         PollPortForwards();
         sys_check_timeouts();
 
         uint64_t now = GetTickCount64();
-        if (now - last_cleanup_ms > 5000) {
+        if (now - last_cleanup_ms > kCleanupIntervalMs) {
             CleanupStaleEntries();
             last_cleanup_ms = now;
         }
 
-        if (!polled) Sleep(1);
+        // Everything this pass produced for the guest goes out in one batch.
+        FlushRx();
+
+        // Sleep until guest TX, a socket event, or the next lwIP or
+        // cleanup deadline.
+        uint64_t wait_ms = kCleanupIntervalMs - std::min<uint64_t>(
+            GetTickCount64() - last_cleanup_ms, kCleanupIntervalMs);
+        u32_t lwip_ms = sys_timeouts_sleeptime();
+        if (lwip_ms != SYS_TIMEOUTS_SLEEPTIME_INFINITE)
+            wait_ms = std::min<uint64_t>(wait_ms, lwip_ms);
+        // Frames held back by a rate limit go once the bucket refills.
+        for (int64_t shaper_ms : {egress_.NextSendMs(), ingress_.NextSendMs()}) {
+            if (shaper_ms >= 0) wait_ms = std::min<uint64_t>(wait_ms, shaper_ms);
+        }
+        WSAEVENT event = static_cast<WSAEVENT>(wake_event_);
+        WSAWaitForMultipleEvents(1, &event, FALSE, static_cast<DWORD>(wait_ms), FALSE);
     }
 }
 
 void NetBackend::ProcessPendingTx() {
-    std::vector<std::vector<uint8_t>> frames;
-    {
-        std::lock_guard<std::mutex> lock(tx_mutex_);
-        frames.swap(tx_queue_);
+    // Clear before draining: a frame pushed after this either gets drained
+    // below or signals a fresh wakeup.
+    tx_signaled_ = false;
+
+    TxFrame* f;
+    size_t n = 0;
+    for (; n < kTxPoolFrames && tx_queue_.TryPop(&f); n++) {
+        if (!egress_.limited() && egress_.empty()) {
+            HandleGuestFrame(f);
+            continue;
+        }
+        TxFrame* dropped;
+        if (egress_.Enqueue(FlowHash(f->buf, f->len), f, f->len, &dropped)) {
+            ReleaseTxFrame(dropped);
+            shaper_dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
     }
+    while (egress_.Dequeue(&f)) HandleGuestFrame(f);
 
-    for (auto& frame : frames) {
-        if (frame.size() < sizeof(EthHdr)) continue;
+    // Budget used up with frames possibly left; run another pass.
+    if (n == kTxPoolFrames) Wake();
+}
 
-        // Handle ARP and DHCP before lwIP
-        if (HandleArpOrDhcp(frame.data(), static_cast<uint32_t>(frame.size())))
-            continue;
+void NetBackend::HandleGuestFrame(TxFrame* f) {
+    auto release = [this](TxFrame* frame) { ReleaseTxFrame(frame); };
+    // Frames not handed to lwIP go straight back to the pool.
+    std::unique_ptr<TxFrame, decltype(release)> owned(f, release);
+    std::span<uint8_t> frame(f->buf, f->len);
+    if (frame.size() < sizeof(EthHdr)) return;
 
-        auto* eth = reinterpret_cast<EthHdr*>(frame.data());
-        uint16_t ethertype = ntohs(eth->type);
+    // Handle ARP and DHCP before lwIP
+    if (HandleArpOrDhcp(frame.data(), static_cast<uint32_t>(frame.size())))
+        return;
 
-        // Feed ARP frames to lwIP so it can reply with gateway MAC
-        if (ethertype == 0x0806) {
-            struct pbuf* p = pbuf_alloc(PBUF_RAW, static_cast<u16_t>(frame.size()), PBUF_RAM);
-            if (p) {
-                pbuf_take(p, frame.data(), static_cast<u16_t>(frame.size()));
-                auto* nif = static_cast<struct netif*>(netif_);
-                if (nif->input(p, nif) != ERR_OK) pbuf_free(p);
-            }
-            continue;
-        }
+    auto* eth = reinterpret_cast<EthHdr*>(frame.data());
+    uint16_t ethertype = ntohs(eth->type);
 
-        if (ethertype != 0x0800) continue; // Only IPv4 beyond this point
-        if (frame.size() < sizeof(EthHdr) + sizeof(IpHdr)) continue;
+    // Feed ARP frames to lwIP so it can reply with gateway MAC
+    if (ethertype == 0x0806) {
+        FeedToLwip(owned.release());
+        return;
+    }
 
-        auto* ip = reinterpret_cast<IpHdr*>(frame.data() + sizeof(EthHdr));
-        uint32_t dst = ntohl(ip->dst_ip);
+    if (ethertype != 0x0800) return; // Only IPv4 beyond this point
+    if (frame.size() < sizeof(EthHdr) + sizeof(IpHdr)) return;
 
-        // Packets to the gateway itself: feed directly to lwIP (ping, etc.)
-        if (dst == kGatewayIp) {
-            struct pbuf* p = pbuf_alloc(PBUF_RAW, static_cast<u16_t>(frame.size()), PBUF_RAM);
-            if (p) {
-                pbuf_take(p, frame.data(), static_cast<u16_t>(frame.size()));
-                auto* nif = static_cast<struct netif*>(netif_);
-                if (nif->input(p, nif) != ERR_OK) pbuf_free(p);
-            }
-            continue;
-        }
+    auto* ip = reinterpret_cast<IpHdr*>(frame.data() + sizeof(EthHdr));
+    uint32_t dst = ntohl(ip->dst_ip);
 
-        // External destination: NAT relay via Winsock
-        uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
-
-        if (ip->proto == IPPROTO_TCP) {
-            if (frame.size() < sizeof(EthHdr) + ip_hdr_len + sizeof(TcpHdr)) continue;
-            auto* tcp = reinterpret_cast<TcpHdr*>(
-                frame.data() + sizeof(EthHdr) + ip_hdr_len);
-
-            auto* entry = FindNatEntry(
-                ntohs(tcp->src_port), ntohl(ip->dst_ip), ntohs(tcp->dst_port), IPPROTO_TCP);
-            if (!entry) {
-                entry = CreateNatEntry(
-                    ntohl(ip->src_ip), ntohs(tcp->src_port),
-                    ntohl(ip->dst_ip), ntohs(tcp->dst_port), IPPROTO_TCP);
-                if (!entry) continue;
-            }
-            RewriteAndFeed(frame.data(), static_cast<uint32_t>(frame.size()), entry);
-
-        } else if (ip->proto == IPPROTO_UDP) {
-            if (frame.size() < sizeof(EthHdr) + ip_hdr_len + sizeof(UdpHdr)) continue;
-            auto* udp = reinterpret_cast<UdpHdr*>(
-                frame.data() + sizeof(EthHdr) + ip_hdr_len);
-
-            uint16_t g_sport = ntohs(udp->src_port);
-            uint16_t g_dport = ntohs(udp->dst_port);
-            uint32_t g_dip   = ntohl(ip->dst_ip);
-
-            // Direct relay: extract UDP payload and send via Winsock
-            uint32_t udp_off = sizeof(EthHdr) + ip_hdr_len + sizeof(UdpHdr);
-            uint32_t payload_len = static_cast<uint32_t>(frame.size()) - udp_off;
-
-            auto* entry = FindNatEntry(g_sport, g_dip, g_dport, IPPROTO_UDP);
-            if (!entry) {
-                entry = CreateNatEntry(
-                    ntohl(ip->src_ip), g_sport, g_dip, g_dport, IPPROTO_UDP);
-                if (!entry) continue;
-            }
+    // DNS is answered from the cache where possible; the rest is
+    // relayed to the host resolver by the UDP NAT below.
+    bool dns = IsDnsQuery(frame.data(), static_cast<uint32_t>(frame.size()));
+    if (dns && HandleDnsQuery(frame.data(), static_cast<uint32_t>(frame.size())))
+        return;
 
-            if (entry->host_socket != INVALID_SOCKET && payload_len > 0) {
-                struct sockaddr_in dest{};
-                dest.sin_family = AF_INET;
-                dest.sin_addr.s_addr = htonl(entry->real_dst_ip);
-                dest.sin_port = htons(entry->real_dst_port);
-                sendto(static_cast<SOCKET>(entry->host_socket),
-                       reinterpret_cast<const char*>(frame.data() + udp_off),
-                       static_cast<int>(payload_len), 0,
-                       reinterpret_cast<sockaddr*>(&dest), sizeof(dest));
-                entry->last_active_ms = GetTickCount64();
-            }
+    bool dns_stream = IsDnsStream(frame.data(), static_cast<uint32_t>(frame.size()));
 
-        } else if (ip->proto == IPPROTO_ICMP) {
-            // ICMP relay via raw socket
-            uint32_t icmp_off = sizeof(EthHdr) + ip_hdr_len;
-            uint32_t icmp_len = static_cast<uint32_t>(frame.size()) - icmp_off;
-            if (icmp_len < 8) continue;
+    // Packets to the gateway itself: feed directly to lwIP (ping, etc.)
+    if (dst == kGatewayIp && !dns && !dns_stream) {
+        FeedToLwip(owned.release());
+        return;
+    }
+
+    // External destination: NAT relay via Winsock
+    uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
+
+    if (ip->proto == IPPROTO_TCP) {
+        if (frame.size() < sizeof(EthHdr) + ip_hdr_len + sizeof(TcpHdr)) return;
+        auto* tcp = reinterpret_cast<TcpHdr*>(
+            frame.data() + sizeof(EthHdr) + ip_hdr_len);
+
+        auto* entry = FindNatEntry(
+            ntohs(tcp->src_port), ntohl(ip->dst_ip), ntohs(tcp->dst_port), IPPROTO_TCP);
+        if (!entry) {
+            entry = CreateNatEntry(
+                ntohl(ip->src_ip), ntohs(tcp->src_port),
+                ntohl(ip->dst_ip), ntohs(tcp->dst_port), IPPROTO_TCP);
+            if (!entry) return;
+            if (dns_stream) entry->relay_dst_ip = host_dns_ip_;
+        }
+        RewriteAndFeed(owned.release(), entry);
 
-            HandleIcmpOut(ntohl(ip->src_ip), ntohl(ip->dst_ip),
-                          frame.data() + icmp_off, icmp_len);
+    } else if (ip->proto == IPPROTO_UDP) {
+        if (frame.size() < sizeof(EthHdr) + ip_hdr_len + sizeof(UdpHdr)) return;
+        auto* udp = reinterpret_cast<UdpHdr*>(
+            frame.data() + sizeof(EthHdr) + ip_hdr_len);
+
+        uint16_t g_sport = ntohs(udp->src_port);
+        uint16_t g_dport = ntohs(udp->dst_port);
+        uint32_t g_dip   = ntohl(ip->dst_ip);
+
+        // Direct relay: extract UDP payload and send via Winsock
+        uint32_t udp_off = sizeof(EthHdr) + ip_hdr_len + sizeof(UdpHdr);
+        uint32_t payload_len = static_cast<uint32_t>(frame.size()) - udp_off;
+
+        auto* entry = FindNatEntry(g_sport, g_dip, g_dport, IPPROTO_UDP);
+        if (!entry) {
+            entry = CreateNatEntry(
+                ntohl(ip->src_ip), g_sport, g_dip, g_dport, IPPROTO_UDP);
+            if (!entry) return;
+            if (g_dip == kGatewayIp) entry->relay_dst_ip = host_dns_ip_;
         }
+
+        if (entry->host_socket != INVALID_SOCKET && payload_len > 0) {
+            struct sockaddr_in dest{};
+            dest.sin_family = AF_INET;
+            dest.sin_addr.s_addr = htonl(entry->relay_dst_ip ? entry->relay_dst_ip
+                                                             : entry->real_dst_ip);
+            dest.sin_port = htons(entry->real_dst_port);
+            sendto(static_cast<SOCKET>(entry->host_socket),
+                   reinterpret_cast<const char*>(frame.data() + udp_off),
+                   static_cast<int>(payload_len), 0,
+                   reinterpret_cast<sockaddr*>(&dest), sizeof(dest));
+            entry->last_active_ms = GetTickCount64();
+        }
+
+    } else if (ip->proto == IPPROTO_ICMP) {
+        // ICMP relay via raw socket
+        uint32_t icmp_off = sizeof(EthHdr) + ip_hdr_len;
+        uint32_t icmp_len = static_cast<uint32_t>(frame.size()) - icmp_off;
+        if (icmp_len < 8) return;
+
+        HandleIcmpOut(ntohl(ip->src_ip), ntohl(ip->dst_ip),
+                      frame.data() + icmp_off, icmp_len);
     }
 }
 
+uint32_t NetBackend::FlowHash(const uint8_t* frame, uint32_t len) {
+    if (len < sizeof(EthHdr) + sizeof(IpHdr)) return 0;
+    auto* eth = reinterpret_cast<const EthHdr*>(frame);
+    if (ntohs(eth->type) != 0x0800) return 0;
+    auto* ip = reinterpret_cast<const IpHdr*>(frame + sizeof(EthHdr));
+    uint64_t x = (uint64_t(ip->src_ip) << 32) ^ ip->dst_ip ^ (uint64_t(ip->proto) << 56);
+    uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
+    // Source and destination ports sit first in both TCP and UDP headers.
+    if ((ip->proto == IPPROTO_TCP || ip->proto == IPPROTO_UDP) &&
+        len >= sizeof(EthHdr) + ip_hdr_len + 4) {
+        uint32_t ports;
+        memcpy(&ports, frame + sizeof(EthHdr) + ip_hdr_len, sizeof(ports));
+        x ^= uint64_t(ports) << 16;
+    }
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    return static_cast<uint32_t>(x);
+}
+
 // ============================================================
 // ARP proxy + DHCP server (handled before lwIP)
 // ============================================================
@@ -538,10 +758,9 @@ void NetBackend::SendDhcpReply(uint8_t type, uint32_t xid,
     // Router (gateway)
     *opt++ = 3; *opt++ = 4;
     memcpy(opt, &gw_net, 4); opt += 4;
-    // DNS — prefer host system's DNS, fallback to 8.8.8.8
+    // DNS — the gateway, which answers from its cache
     *opt++ = 6; *opt++ = 4;
-    uint32_t dns = htonl(GetHostDnsServer());
-    memcpy(opt, &dns, 4); opt += 4;
+    memcpy(opt, &gw_net, 4); opt += 4;
     // End
     *opt++ = 255;
     off = static_cast<uint32_t>(opt - pkt);
@@ -556,42 +775,160 @@ void NetBackend::SendDhcpReply(uint8_t type, uint32_t xid,
     InjectFrame(pkt, off);
 }
 
+// ============================================================
+// DNS (answered by the gateway)
+// ============================================================
+
+bool NetBackend::IsDnsQuery(const uint8_t* frame, uint32_t len) const {
+    auto* ip = reinterpret_cast<const IpHdr*>(frame + sizeof(EthHdr));
+    if (ip->proto != IPPROTO_UDP) return false;
+    uint32_t dst = ntohl(ip->dst_ip);
+    // Guests still holding an older lease ask the host resolver directly.
+    if (dst != kGatewayIp && dst != host_dns_ip_) return false;
+    uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
+    if (len < sizeof(EthHdr) + ip_hdr_len + sizeof(UdpHdr)) return false;
+    auto* udp = reinterpret_cast<const UdpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
+    return ntohs(udp->dst_port) == 53;
+}
+
+bool NetBackend::IsDnsStream(const uint8_t* frame, uint32_t len) const {
+    auto* ip = reinterpret_cast<const IpHdr*>(frame + sizeof(EthHdr));
+    if (ip->proto != IPPROTO_TCP || ntohl(ip->dst_ip) != kGatewayIp || !host_dns_ip_)
+        return false;
+    uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
+    if (len < sizeof(EthHdr) + ip_hdr_len + sizeof(TcpHdr)) return false;
+    auto* tcp = reinterpret_cast<const TcpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
+    return ntohs(tcp->dst_port) == 53;
+}
+
+bool NetBackend::HandleDnsQuery(const uint8_t* frame, uint32_t len) {
+    auto* ip = reinterpret_cast<const IpHdr*>(frame + sizeof(EthHdr));
+    uint32_t udp_off = sizeof(EthHdr) + (ip->ver_ihl & 0xF) * 4;
+    auto* udp = reinterpret_cast<const UdpHdr*>(frame + udp_off);
+    uint32_t payload_off = udp_off + sizeof(UdpHdr);
+
+    DnsClient client{ntohl(ip->src_ip), ntohs(udp->src_port), ntohl(ip->dst_ip)};
+    std::vector<uint8_t> reply;
+    switch (dns_.HandleQuery(client, frame + payload_off, len - payload_off, &reply)) {
+    case DnsResolver::Result::kAnswered:
+        SendUdpToGuest(client.server_ip, 53, client.ip, client.port,
+                       reply.data(), static_cast<uint32_t>(reply.size()));
+        return true;
+    case DnsResolver::Result::kPending:
+        return true;
+    case DnsResolver::Result::kNotHandled:
+        break;
+    }
+    return false;
+}
+
 // ============================================================
 // Frame injection to guest RX queue
 // ============================================================
 
 void NetBackend::InjectFrame(const uint8_t* frame, uint32_t len) {
-    if (!link_up_) return;
-    // InjectRx() already calls mmio_->NotifyUsedBuffer() which fires the
-    // MMIO-level IRQ callback, so no additional irq_callback_() here.
-    virtio_net_->InjectRx(frame, len);
+    uint8_t* buf = StageRxFrame(len);
+    if (buf) memcpy(buf, frame, len);
+}
+
+uint8_t* NetBackend::StageRxFrame(uint32_t len) {
+    if (!link_up_) return nullptr;
+    if (rx_staged_.size() >= VirtioNetDevice::kRxRingSlots) FlushRx();
+    size_t offset = rx_stage_.size();
+    rx_stage_.resize(offset + len);
+    rx_staged_.push_back({offset, len, 0, 0});
+    return rx_stage_.data() + offset;
+}
+
+void NetBackend::MarkStagedChecksumPartial(uint8_t* frame, uint32_t len) {
+    if (len < sizeof(EthHdr) + sizeof(IpHdr)) return;
+    auto* eth = reinterpret_cast<EthHdr*>(frame);
+    if (ntohs(eth->type) != 0x0800) return;
+    auto* ip = reinterpret_cast<IpHdr*>(frame + sizeof(EthHdr));
+    uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
+    uint32_t ip_len = ntohs(ip->total_len);
+    if (ip->proto != IPPROTO_TCP || ip_len < ip_hdr_len + sizeof(TcpHdr) ||
+        len < sizeof(EthHdr) + ip_len) {
+        return;
+    }
+
+    // Pseudo-header sum, folded but not complemented.
+    uint32_t src = ntohl(ip->src_ip);
+    uint32_t dst = ntohl(ip->dst_ip);
+    uint32_t sum = (src >> 16) + (src & 0xFFFF) + (dst >> 16) + (dst & 0xFFFF) +
+                   IPPROTO_TCP + (ip_len - ip_hdr_len);
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+
+    auto* tcp = reinterpret_cast<TcpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
+    tcp->checksum = htons(static_cast<uint16_t>(sum));
+    auto& staged = rx_staged_.back();
+    staged.csum_start = static_cast<uint16_t>(sizeof(EthHdr) + ip_hdr_len);
+    staged.csum_offset = offsetof(TcpHdr, checksum);
+}
+
+void NetBackend::FlushRx() {
+    if (rx_staged_.empty() && ingress_.empty()) return;
+    thread_local std::vector<NetRxFrame> frames;
+    thread_local std::vector<QueuedRxFrame> released;
+    frames.clear();
+    released.clear();
+    if (!ingress_.limited() && ingress_.empty()) {
+        for (auto& f : rx_staged_)
+            frames.push_back({rx_stage_.data() + f.offset, f.len, f.csum_start, f.csum_offset});
+    } else {
+        // Staged frames join the queues, then as many leave as the limit
+        // allows, up to one ring's worth.
+        for (auto& f : rx_staged_) {
+            const uint8_t* data = rx_stage_.data() + f.offset;
+            QueuedRxFrame q{std::vector<uint8_t>(data, data + f.len), f.csum_start, f.csum_offset};
+            QueuedRxFrame dropped;
+            if (ingress_.Enqueue(FlowHash(data, f.len), std::move(q), f.len, &dropped))
+                shaper_dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        QueuedRxFrame q;
+        while (released.size() < VirtioNetDevice::kRxRingSlots && ingress_.Dequeue(&q))
+            released.push_back(std::move(q));
+        for (auto& q : released) {
+            frames.push_back({q.data.data(), static_cast<uint32_t>(q.data.size()),
+                              q.csum_start, q.csum_offset});
+        }
+    }
+    rx_staged_.clear();
+    rx_stage_.clear();
+    if (frames.empty()) return;
+    // The device's RX workers raise the used-buffer interrupt once the
+    // frames are in guest memory, so no additional irq_callback_() here.
+    virtio_net_->InjectRxBatch(frames.data(), frames.size());
 }
 
 // ============================================================
 // NAT table management
 // ============================================================
 
+// Idle timeouts, counted from last_active_ms
+static constexpr uint64_t kClosedEntryTimeoutMs = 5000;    // 5s after err/abort
+static constexpr uint64_t kUdpIdleTimeoutMs     = 120000;  // 2min idle for UDP
+static constexpr uint64_t kTcpDeadTimeoutMs     = 30000;   // 30s for fully dead TCP
+static constexpr uint64_t kTcpIdleTimeoutMs     = 300000;  // 5min catch-all for TCP
+
 NetBackend::NatEntry* NetBackend::FindNatEntry(
     uint32_t guest_port, uint32_t dst_ip, uint16_t dst_port, uint8_t proto) {
-    uint64_t now = GetTickCount64();
-    for (auto& e : nat_entries_) {
-        if (e->closed) continue;
-        // TCP entry with all resources released: still findable during
-        // TIME_WAIT (2*TCP_MSL = 10s) so the close handshake completes,
-        // then treated as dead so new connections can be created.
-        if (e->proto == IPPROTO_TCP &&
-            e->host_socket == INVALID_SOCKET &&
-            !e->conn_pcb && !e->listen_pcb &&
-            (now - e->last_active_ms) > 15000) {
-            continue;
-        }
-        if (e->proto == proto &&
-            e->guest_port == guest_port &&
-            e->real_dst_ip == dst_ip &&
-            e->real_dst_port == dst_port)
-            return e.get();
+    auto it = nat_flows_.find({proto, static_cast<uint16_t>(guest_port),
+                               dst_ip, dst_port});
+    if (it == nat_flows_.end()) return nullptr;
+
+    NatEntry* e = it->second;
+    if (e->closed) return nullptr;
+    // TCP entry with all resources released: still findable during
+    // TIME_WAIT (2*TCP_MSL = 10s) so the close handshake completes,
+    // then treated as dead so new connections can be created.
+    if (e->proto == IPPROTO_TCP &&
+        e->host_socket == INVALID_SOCKET &&
+        !e->conn_pcb && !e->listen_pcb &&
+        (GetTickCount64() - e->last_active_ms) > 15000) {
+        return nullptr;
     }
-    return nullptr;
+    return e;
 }
 
 NetBackend::NatEntry* NetBackend::CreateNatEntry(
@@ -606,6 +943,8 @@ NetBackend::NatEntry* NetBackend::CreateNatEntry(
     entry->real_dst_port = dst_port;
     entry->proxy_port = AllocProxyPort();
     entry->last_active_ms = GetTickCount64();
+    entry->pending_to_guest.SetPool(&stream_pool_);
+    entry->pending_to_host.SetPool(&stream_pool_);
 
     if (proto == IPPROTO_TCP) {
         // Create lwIP listener on proxy port for this connection
@@ -631,44 +970,56 @@ NetBackend::NatEntry* NetBackend::CreateNatEntry(
             return ERR_OK;
         });
     } else {
-        // UDP: Winsock socket only — no lwIP PCB needed
-        SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
-        if (s == INVALID_SOCKET) return nullptr;
-        u_long nonblock = 1;
-        ioctlsocket(s, FIONBIO, &nonblock);
+        // UDP: Winsock socket only — no lwIP PCB needed. Past the RIO
+        // slots, or without RIO, it is select()ed like the TCP sockets.
+        SOCKET s = static_cast<SOCKET>(rio_udp_.OpenSocket(entry.get()));
+        entry->rio = s != INVALID_SOCKET;
+        if (!entry->rio) {
+            s = socket(AF_INET, SOCK_DGRAM, 0);
+            if (s == INVALID_SOCKET) return nullptr;
+            WatchSocket(static_cast<uintptr_t>(s));
+        }
         entry->host_socket = static_cast<uintptr_t>(s);
     }
 
     auto* ptr = entry.get();
+    ptr->table_index = nat_entries_.size();
     nat_entries_.push_back(std::move(entry));
+    nat_flows_[{proto, guest_port, dst_ip, dst_port}] = ptr;
+    proxy_port_owner_[ptr->proxy_port - kMinProxyPort] = ptr;
+    ScheduleNatExpiry(ptr);
     return ptr;
 }
 
 uint16_t NetBackend::AllocProxyPort() {
-    const uint16_t kMinPort = 10000;
-    const uint16_t kMaxPort = 60000;
-    uint16_t attempts = 0;
-    while (attempts < (kMaxPort - kMinPort)) {
+    for (uint32_t attempts = 0; attempts <= kMaxProxyPort - kMinProxyPort; attempts++) {
         uint16_t port = next_proxy_port_++;
-        if (next_proxy_port_ > kMaxPort) next_proxy_port_ = kMinPort;
+        if (next_proxy_port_ > kMaxProxyPort) next_proxy_port_ = kMinProxyPort;
         if (!IsProxyPortInUse(port))
             return port;
-        attempts++;
     }
-    return next_proxy_port_++;
+    // Every port is held by a live entry; share one rather than fail.
+    uint16_t port = next_proxy_port_++;
+    if (next_proxy_port_ > kMaxProxyPort) next_proxy_port_ = kMinProxyPort;
+    return port;
 }
 
 bool NetBackend::IsProxyPortInUse(uint16_t port) const {
-    for (auto& e : nat_entries_) {
-        if (e->proxy_port == port && !e->closed)
-            return true;
-    }
-    return false;
+    const NatEntry* owner = proxy_port_owner_[port - kMinProxyPort];
+    return owner && !owner->closed;
 }
 
-void NetBackend::RemoveNatEntry(NatEntry* entry) {
-    if (entry->host_socket != INVALID_SOCKET)
+void NetBackend::CloseNatSocket(NatEntry* entry) {
+    if (entry->host_socket == INVALID_SOCKET) return;
+    if (entry->rio)
+        rio_udp_.CloseSocket(entry->host_socket);
+    else
         closesocket(static_cast<SOCKET>(entry->host_socket));
+    entry->host_socket = INVALID_SOCKET;
+}
+
+void NetBackend::RemoveNatEntry(NatEntry* entry) {
+    CloseNatSocket(entry);
     if (entry->listen_pcb)
         tcp_close(static_cast<struct tcp_pcb*>(entry->listen_pcb));
     if (entry->conn_pcb) {
@@ -678,54 +1029,89 @@ void NetBackend::RemoveNatEntry(NatEntry* entry) {
             udp_remove(static_cast<struct udp_pcb*>(entry->conn_pcb));
     }
 
-    nat_entries_.erase(
-        std::remove_if(nat_entries_.begin(), nat_entries_.end(),
-                        [entry](auto& e) { return e.get() == entry; }),
-        nat_entries_.end());
+    // tcp_abort() runs OnTcpErr, which reschedules; unlink afterwards.
+    UnlinkNatExpiry(entry);
+    auto flow = nat_flows_.find({entry->proto, entry->guest_port,
+                                 entry->real_dst_ip, entry->real_dst_port});
+    if (flow != nat_flows_.end() && flow->second == entry) nat_flows_.erase(flow);
+    auto& owner = proxy_port_owner_[entry->proxy_port - kMinProxyPort];
+    if (owner == entry) owner = nullptr;
+
+    // Swap with the last entry so removal doesn't shift the table.
+    size_t index = entry->table_index;
+    if (index + 1 != nat_entries_.size()) {
+        nat_entries_[index] = std::move(nat_entries_.back());
+        nat_entries_[index]->table_index = index;
+    }
+    nat_entries_.pop_back();
+}
+
+uint64_t NetBackend::NatExpiryDeadline(const NatEntry* e) {
+    if (e->closed)  // Already marked closed by OnTcpErr or connect failure
+        return e->last_active_ms + kClosedEntryTimeoutMs;
+    if (e->proto == IPPROTO_UDP)
+        return e->last_active_ms + kUdpIdleTimeoutMs;
+    bool all_released = (e->host_socket == INVALID_SOCKET &&
+                         !e->conn_pcb && !e->listen_pcb);
+    // Both sides closed, lwIP PCB freed — wait long enough for TIME_WAIT
+    // to expire (2*TCP_MSL=10s), then remove.
+    return e->last_active_ms + (all_released ? kTcpDeadTimeoutMs : kTcpIdleTimeoutMs);
+}
+
+void NetBackend::ScheduleNatExpiry(NatEntry* entry) {
+    UnlinkNatExpiry(entry);
+
+    // Round up to a tick; deadlines past the wheel's reach are re-checked
+    // on its last slot and moved on.
+    uint64_t tick = (NatExpiryDeadline(entry) + kCleanupIntervalMs - 1) /
+                    kCleanupIntervalMs;
+    tick = std::clamp<uint64_t>(tick, expiry_tick_ + 1,
+                                expiry_tick_ + kExpirySlots - 1);
+    auto slot = static_cast<int>(tick % kExpirySlots);
+
+    entry->expiry_slot = slot;
+    entry->expiry_prev = nullptr;
+    entry->expiry_next = expiry_wheel_[slot];
+    if (entry->expiry_next) entry->expiry_next->expiry_prev = entry;
+    expiry_wheel_[slot] = entry;
+}
+
+void NetBackend::UnlinkNatExpiry(NatEntry* entry) {
+    if (entry->expiry_slot < 0) return;
+    if (entry->expiry_prev)
+        entry->expiry_prev->expiry_next = entry->expiry_next;
+    else
+        expiry_wheel_[entry->expiry_slot] = entry->expiry_next;
+    if (entry->expiry_next) entry->expiry_next->expiry_prev = entry->expiry_prev;
+    entry->expiry_slot = -1;
+    entry->expiry_prev = entry->expiry_next = nullptr;
 }
 
 void NetBackend::CleanupStaleEntries() {
     uint64_t now = GetTickCount64();
-    constexpr uint64_t kClosedEntryTimeoutMs  = 5000;    // 5s after err/abort
-    constexpr uint64_t kUdpIdleTimeoutMs      = 120000;  // 2min idle for UDP
-    constexpr uint64_t kTcpDeadTimeoutMs      = 30000;   // 30s for fully dead TCP
-    constexpr uint64_t kTcpIdleTimeoutMs      = 300000;  // 5min catch-all for TCP
-
-    auto it = nat_entries_.begin();
-    while (it != nat_entries_.end()) {
-        auto& e = *it;
-        bool remove = false;
-        uint64_t age = now - e->last_active_ms;
-
-        if (e->closed) {
-            // Already marked closed by OnTcpErr or connect failure
-            remove = age > kClosedEntryTimeoutMs;
-        } else if (e->proto == IPPROTO_UDP) {
-            remove = age > kUdpIdleTimeoutMs;
-        } else if (e->proto == IPPROTO_TCP) {
-            bool all_released = (e->host_socket == INVALID_SOCKET &&
-                                 !e->conn_pcb && !e->listen_pcb);
-            if (all_released) {
-                // Both sides closed, lwIP PCB freed — wait long enough
-                // for TIME_WAIT to expire (2*TCP_MSL=10s), then remove.
-                remove = age > kTcpDeadTimeoutMs;
-            } else {
-                remove = age > kTcpIdleTimeoutMs;
-            }
-        }
-
-        if (remove) {
-            if (e->host_socket != INVALID_SOCKET)
-                closesocket(static_cast<SOCKET>(e->host_socket));
-            if (e->listen_pcb)
-                tcp_close(static_cast<struct tcp_pcb*>(e->listen_pcb));
-            if (e->conn_pcb) {
-                if (e->proto == IPPROTO_TCP)
-                    tcp_abort(static_cast<struct tcp_pcb*>(e->conn_pcb));
-            }
-            it = nat_entries_.erase(it);
-        } else {
-            ++it;
+    uint64_t now_tick = now / kCleanupIntervalMs;
+    // After a long stall every slot is due, but each only once.
+    uint64_t first = std::max(expiry_tick_ + 1, now_tick + 1 - std::min<uint64_t>(
+        now_tick + 1, kExpirySlots));
+    expiry_tick_ = now_tick;
+
+    for (uint64_t tick = first; tick <= now_tick; tick++) {
+        // Detach the slot: entries rescheduled below land in later ones
+        // (or in this slot's next lap).
+        size_t slot = tick % kExpirySlots;
+        NatEntry* e = expiry_wheel_[slot];
+        expiry_wheel_[slot] = nullptr;
+        while (e) {
+            NatEntry* next = e->expiry_next;
+            e->expiry_slot = -1;
+            e->expiry_prev = e->expiry_next = nullptr;
+            if (next) next->expiry_prev = nullptr;
+
+            if (now >= NatExpiryDeadline(e))
+                RemoveNatEntry(e);
+            else
+                ScheduleNatExpiry(e);
+            e = next;
         }
     }
 }
@@ -734,44 +1120,63 @@ void NetBackend::CleanupStaleEntries() {
 // NAT IP rewriting
 // ============================================================
 
-void NetBackend::RewriteAndFeed(uint8_t* frame, uint32_t len, NatEntry* entry) {
+void NetBackend::RewriteDestination(uint8_t* frame, uint32_t ip_addr, uint16_t port) {
     auto* ip = reinterpret_cast<IpHdr*>(frame + sizeof(EthHdr));
     uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
+    uint32_t new_dst_ip = htonl(ip_addr);
+    uint16_t new_port = htons(port);
 
-    uint32_t old_dst_ip = ip->dst_ip;
-
-    if (entry->proto == IPPROTO_TCP) {
+    if (ip->proto == IPPROTO_TCP) {
         auto* tcp = reinterpret_cast<TcpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
-        uint16_t old_port = tcp->dst_port;
-        uint16_t new_port = htons(entry->proxy_port);
-
         IncrementalCksumUpdate(&tcp->checksum,
-                               old_dst_ip, htonl(kGatewayIp),
-                               old_port, new_port);
+                               ip->dst_ip, new_dst_ip,
+                               tcp->dst_port, new_port);
         tcp->dst_port = new_port;
-    } else if (entry->proto == IPPROTO_UDP) {
+    } else if (ip->proto == IPPROTO_UDP) {
         auto* udp = reinterpret_cast<UdpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
-        uint16_t old_port = udp->dst_port;
-        uint16_t new_port = htons(entry->proxy_port);
-
         if (udp->checksum != 0) {
             IncrementalCksumUpdate(&udp->checksum,
-                                   old_dst_ip, htonl(kGatewayIp),
-                                   old_port, new_port);
+                                   ip->dst_ip, new_dst_ip,
+                                   udp->dst_port, new_port);
         }
         udp->dst_port = new_port;
     }
 
-    ip->dst_ip = htonl(kGatewayIp);
+    ip->dst_ip = new_dst_ip;
     RecalcIpChecksum(ip);
+}
+
+void NetBackend::RewriteSource(uint8_t* frame, uint32_t ip_addr, uint16_t port) {
+    auto* ip = reinterpret_cast<IpHdr*>(frame + sizeof(EthHdr));
+    uint32_t ip_hdr_len = (ip->ver_ihl & 0xF) * 4;
+    uint32_t new_src_ip = htonl(ip_addr);
+    uint16_t new_src_port = htons(port);
 
-    // Feed rewritten frame to lwIP
-    struct pbuf* p = pbuf_alloc(PBUF_RAW, static_cast<u16_t>(len), PBUF_RAM);
-    if (p) {
-        pbuf_take(p, frame, static_cast<u16_t>(len));
-        auto* nif = static_cast<struct netif*>(netif_);
-        if (nif->input(p, nif) != ERR_OK) pbuf_free(p);
+    if (ip->proto == IPPROTO_TCP) {
+        auto* tcp = reinterpret_cast<TcpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
+        IncrementalCksumUpdate(&tcp->checksum,
+                               ip->src_ip, new_src_ip,
+                               tcp->src_port, new_src_port);
+        tcp->src_port = new_src_port;
+    } else if (ip->proto == IPPROTO_UDP) {
+        auto* udp = reinterpret_cast<UdpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
+        if (udp->checksum != 0) {
+            IncrementalCksumUpdate(&udp->checksum,
+                                   ip->src_ip, new_src_ip,
+                                   udp->src_port, new_src_port);
+        }
+        udp->src_port = new_src_port;
     }
+
+    ip->src_ip = new_src_ip;
+    RecalcIpChecksum(ip);
+}
+
+void NetBackend::RewriteAndFeed(TxFrame* f, NatEntry* entry) {
+    RewriteDestination(f->buf, kGatewayIp, entry->proxy_port);
+
+    // Feed the frame, rewritten in place, to lwIP
+    FeedToLwip(f);
 }
 
 void NetBackend::ReverseRewrite(uint8_t* frame, uint32_t len) {
@@ -796,38 +1201,12 @@ void NetBackend::ReverseRewrite(uint8_t* frame, uint32_t len) {
 
     // Find NAT entry by proxy port (skip closed entries to avoid
     // matching stale entries when proxy ports get reused)
-    NatEntry* entry = nullptr;
-    for (auto& e : nat_entries_) {
-        if (e->closed) continue;
-        if (e->proxy_port == src_port && e->proto == ip->proto) {
-            entry = e.get();
-            break;
-        }
-    }
-    if (!entry) return;
+    if (src_port < kMinProxyPort || src_port > kMaxProxyPort) return;
+    NatEntry* entry = proxy_port_owner_[src_port - kMinProxyPort];
+    if (!entry || entry->closed || entry->proto != ip->proto) return;
 
     // Rewrite src back to real destination
-    uint32_t new_src_ip = htonl(entry->real_dst_ip);
-    uint16_t new_src_port = htons(entry->real_dst_port);
-
-    if (ip->proto == IPPROTO_TCP) {
-        auto* tcp = reinterpret_cast<TcpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
-        IncrementalCksumUpdate(&tcp->checksum,
-                               ip->src_ip, new_src_ip,
-                               tcp->src_port, new_src_port);
-        tcp->src_port = new_src_port;
-    } else if (ip->proto == IPPROTO_UDP) {
-        auto* udp = reinterpret_cast<UdpHdr*>(frame + sizeof(EthHdr) + ip_hdr_len);
-        if (udp->checksum != 0) {
-            IncrementalCksumUpdate(&udp->checksum,
-                                   ip->src_ip, new_src_ip,
-                                   udp->src_port, new_src_port);
-        }
-        udp->src_port = new_src_port;
-    }
-
-    ip->src_ip = new_src_ip;
-    RecalcIpChecksum(ip);
+    RewriteSource(frame, entry->real_dst_ip, entry->real_dst_port);
 }
 
 // ============================================================
@@ -837,6 +1216,134 @@ void NetBackend::ReverseRewrite(uint8_t* frame, uint32_t len) {
 // Global pointer for lwIP callbacks (single-instance, net-thread only)
 NetBackend* g_net_backend = nullptr;
 
+// ============================================================
+// TCP stream relay helpers
+// ============================================================
+
+// Spans handed to one WSASend/WSARecv call.
+static constexpr size_t kStreamIoSpans = 16;
+// Bytes read from a host socket per readable event.
+static constexpr size_t kStreamReadBytes = 2 * StreamChunkPool::kChunkBytes;
+
+// Memory lwIP still references after its PCB was closed; freed with the PCB.
+struct RetiredStream {
+    std::vector<StreamChunkPool::Chunk> chunks;
+};
+
+static void DestroyRetiredStream(u8_t, void* data) {
+    delete static_cast<RetiredStream*>(data);
+}
+
+static const struct tcp_ext_arg_callbacks kRetiredStreamCallbacks = {
+    DestroyRetiredStream, nullptr
+};
+
+// Queues bytes past `*queued` on the PCB by reference (no
+// TCP_WRITE_FLAG_COPY); they stay in the buffer until tcp_sent acks them.
+static void WriteStreamToGuest(struct tcp_pcb* pcb, StreamBuffer& buf,
+                               size_t* queued) {
+    size_t unsent = buf.size() - *queued;
+    size_t budget = std::min<size_t>(tcp_sndbuf(pcb), unsent);
+    if (budget == 0) return;
+
+    StreamSpan spans[kStreamIoSpans];
+    size_t count = buf.Peek(*queued, spans, kStreamIoSpans, budget);
+    bool wrote = false;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* data = spans[i].data;
+        size_t left = spans[i].len;
+        while (left > 0) {
+            // tcp_write() takes at most 64 KiB - 1 per call.
+            auto n = static_cast<u16_t>(std::min<size_t>(left, 0xFFFF));
+            budget -= n;
+            u8_t flags = budget > 0 ? TCP_WRITE_FLAG_MORE : 0;
+            if (tcp_write(pcb, data, n, flags) != ERR_OK) {
+                budget = 0;
+                break;
+            }
+            *queued += n;
+            data += n;
+            left -= n;
+            wrote = true;
+        }
+        if (budget == 0) break;
+    }
+    if (wrote) tcp_output(pcb);
+}
+
+// Bytes sent, 0 if the socket would block, or -1 on a connection error.
+static int SendStreamToHost(SOCKET s, StreamBuffer& buf) {
+    StreamSpan spans[kStreamIoSpans];
+    WSABUF wsa[kStreamIoSpans];
+    size_t count = buf.Peek(0, spans, kStreamIoSpans, buf.size());
+    for (size_t i = 0; i < count; i++) {
+        wsa[i].buf = reinterpret_cast<char*>(spans[i].data);
+        wsa[i].len = static_cast<ULONG>(spans[i].len);
+    }
+
+    DWORD sent = 0;
+    if (WSASend(s, wsa, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) ==
+        SOCKET_ERROR) {
+        return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+    }
+    buf.Consume(sent);
+    return static_cast<int>(sent);
+}
+
+// Scatters what the socket has into the buffer's free chunks. Returns the
+// bytes read, 0 on EOF, or -1 if nothing was read (would block or error;
+// *closed tells which).
+static int RecvStreamFromHost(SOCKET s, StreamBuffer& buf, bool* closed) {
+    StreamSpan spans[kStreamIoSpans];
+    WSABUF wsa[kStreamIoSpans];
+    size_t count = buf.PrepareWrite(spans, kStreamIoSpans, kStreamReadBytes);
+    for (size_t i = 0; i < count; i++) {
+        wsa[i].buf = reinterpret_cast<char*>(spans[i].data);
+        wsa[i].len = static_cast<ULONG>(spans[i].len);
+    }
+
+    DWORD received = 0;
+    DWORD flags = 0;
+    *closed = false;
+    if (WSARecv(s, wsa, static_cast<DWORD>(count), &received, &flags,
+                nullptr, nullptr) == SOCKET_ERROR) {
+        buf.Commit(0);
+        *closed = WSAGetLastError() != WSAEWOULDBLOCK;
+        return -1;
+    }
+    buf.Commit(received);
+    return static_cast<int>(received);
+}
+
+// Reopens the guest's receive window for data the host accepted.
+static void AckGuestData(struct tcp_pcb* pcb, size_t len) {
+    while (len > 0) {
+        auto n = static_cast<u16_t>(std::min<size_t>(len, 0xFFFF));
+        tcp_recved(pcb, n);
+        len -= n;
+    }
+}
+
+// Detaches every callback and closes the PCB. The PCB lives on in lwIP
+// during the close handshake while its owner may be freed, so bytes it
+// still references are handed over to it.
+static void CloseGuestPcb(struct tcp_pcb* pcb, StreamBuffer& to_guest,
+                          size_t* queued) {
+    tcp_arg(pcb, nullptr);
+    tcp_recv(pcb, nullptr);
+    tcp_sent(pcb, nullptr);
+    tcp_err(pcb, nullptr);
+    if (*queued > 0) {
+        static const u8_t ext_id = tcp_ext_arg_alloc_id();
+        auto* retired = new RetiredStream{to_guest.Detach()};
+        tcp_ext_arg_set_callbacks(pcb, ext_id, &kRetiredStreamCallbacks);
+        tcp_ext_arg_set(pcb, ext_id, retired);
+    }
+    to_guest.Clear();
+    *queued = 0;
+    tcp_close(pcb);
+}
+
 void NetBackend::OnTcpAccepted(NatEntry* entry, void* new_pcb_v) {
     auto* new_pcb = static_cast<struct tcp_pcb*>(new_pcb_v);
     entry->conn_pcb = new_pcb;
@@ -857,6 +1364,10 @@ void NetBackend::OnTcpAccepted(NatEntry* entry, void* new_pcb_v) {
         g_net_backend->OnTcpRecv(e, pcb, p);
         return ERR_OK;
     });
+    tcp_sent(new_pcb, [](void* arg, struct tcp_pcb*, u16_t len) -> err_t {
+        g_net_backend->OnTcpSent(static_cast<NatEntry*>(arg), len);
+        return ERR_OK;
+    });
     tcp_err(new_pcb, [](void* arg, err_t err) {
         auto* e = static_cast<NatEntry*>(arg);
         g_net_backend->OnTcpErr(e);
@@ -868,31 +1379,26 @@ void NetBackend::OnTcpAccepted(NatEntry* entry, void* new_pcb_v) {
     // the callback returns.  Gracefully close and let cleanup handle it.
     SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
     if (s == INVALID_SOCKET) {
-        tcp_arg(new_pcb, nullptr);
-        tcp_recv(new_pcb, nullptr);
-        tcp_err(new_pcb, nullptr);
-        tcp_close(new_pcb);
+        CloseGuestPcb(new_pcb, entry->pending_to_guest, &entry->to_guest_queued);
         entry->conn_pcb = nullptr;
         entry->closed = true;
+        ScheduleNatExpiry(entry);
         return;
     }
-    u_long nonblock = 1;
-    ioctlsocket(s, FIONBIO, &nonblock);
+    WatchSocket(static_cast<uintptr_t>(s));
 
     struct sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(entry->real_dst_ip);
+    addr.sin_addr.s_addr = htonl(entry->relay_dst_ip ? entry->relay_dst_ip : entry->real_dst_ip);
     addr.sin_port = htons(entry->real_dst_port);
 
     int ret = connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
     if (ret == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
         closesocket(s);
-        tcp_arg(new_pcb, nullptr);
-        tcp_recv(new_pcb, nullptr);
-        tcp_err(new_pcb, nullptr);
-        tcp_close(new_pcb);
+        CloseGuestPcb(new_pcb, entry->pending_to_guest, &entry->to_guest_queued);
         entry->conn_pcb = nullptr;
         entry->closed = true;
+        ScheduleNatExpiry(entry);
         return;
     }
 
@@ -909,44 +1415,43 @@ void NetBackend::OnTcpRecv(NatEntry* entry, void* pcb_v, void* p_v) {
             closesocket(static_cast<SOCKET>(entry->host_socket));
             entry->host_socket = INVALID_SOCKET;
         }
-        // Clear callbacks before tcp_close: the PCB survives in lwIP's
-        // internal lists during the close handshake, but the NatEntry
-        // may be freed by CleanupStaleEntries before the PCB is gone.
-        tcp_arg(pcb, nullptr);
-        tcp_recv(pcb, nullptr);
-        tcp_err(pcb, nullptr);
-        tcp_close(pcb);
+        // The NatEntry may be freed by CleanupStaleEntries before the
+        // PCB finishes its close handshake.
+        CloseGuestPcb(pcb, entry->pending_to_guest, &entry->to_guest_queued);
         entry->conn_pcb = nullptr;
         entry->last_active_ms = GetTickCount64();
+        ScheduleNatExpiry(entry);
         return;
     }
 
-    std::vector<uint8_t> data(p->tot_len);
-    pbuf_copy_partial(p, data.data(), p->tot_len, 0);
-    tcp_recved(pcb, p->tot_len);
+    // Window is reopened by DrainTcpToHost once the host takes the data.
+    for (struct pbuf* q = p; q; q = q->next)
+        entry->pending_to_host.Append(q->payload, q->len);
     pbuf_free(p);
 
     entry->last_active_ms = GetTickCount64();
-
-    if (entry->connecting) {
-        entry->pending_data.insert(entry->pending_data.end(),
-                                    data.begin(), data.end());
-        return;
-    }
-
-    // Buffer data and attempt to send
-    entry->pending_to_host.insert(entry->pending_to_host.end(),
-                                   data.begin(), data.end());
     DrainTcpToHost(entry);
 }
 
+void NetBackend::OnTcpSent(NatEntry* entry, uint32_t len) {
+    // Acked bytes are always the oldest queued ones.
+    entry->pending_to_guest.Consume(len);
+    entry->to_guest_queued -= std::min<size_t>(len, entry->to_guest_queued);
+    entry->last_active_ms = GetTickCount64();
+    DrainTcpToGuest(entry);
+}
+
 void NetBackend::OnTcpErr(NatEntry* entry) {
+    // lwIP has freed the PCB and every segment referencing our buffers.
     entry->conn_pcb = nullptr;
+    entry->pending_to_guest.Clear();
+    entry->to_guest_queued = 0;
     if (entry->host_socket != INVALID_SOCKET) {
         closesocket(static_cast<SOCKET>(entry->host_socket));
         entry->host_socket = INVALID_SOCKET;
     }
     entry->closed = true;
+    ScheduleNatExpiry(entry);
 }
 
 // ============================================================
@@ -987,15 +1492,17 @@ bool NetBackend::PollSockets() {
 
     for (auto& e : nat_entries_) {
         SOCKET s = static_cast<SOCKET>(e->host_socket);
-        if (s == INVALID_SOCKET) continue;
+        if (s == INVALID_SOCKET || e->rio) continue;
         if (e->connecting) {
             FD_SET(s, &wfds);
             count++;
         } else {
             if (e->proto == IPPROTO_TCP) {
                 DrainTcpToGuest(e.get());
-                if (!e->pending_to_guest.empty())
-                    continue; // back-pressure: don't read until drained
+                // Back-pressure: don't read while lwIP's send buffer is
+                // full. Bytes already queued on the PCB don't count.
+                if (e->pending_to_guest.size() > e->to_guest_queued)
+                    continue;
 
                 // Monitor for writability if we have pending data to host
                 if (!e->pending_to_host.empty()) {
@@ -1010,14 +1517,15 @@ bool NetBackend::PollSockets() {
 
     if (count == 0) return false;
 
-    struct timeval tv = {0, 1000}; // 1ms timeout
+    // Readiness check only; the wait happens on wake_event_.
+    struct timeval tv = {0, 0};
     int n = select(0, &rfds, &wfds, nullptr, &tv);
     if (n <= 0) return true;
 
     for (size_t i = 0; i < nat_entries_.size(); i++) {
         auto* e = nat_entries_[i].get();
         SOCKET s = static_cast<SOCKET>(e->host_socket);
-        if (s == INVALID_SOCKET) continue;
+        if (s == INVALID_SOCKET || e->rio) continue;
 
         if (e->connecting && FD_ISSET(s, &wfds)) {
             int sock_err = 0;
@@ -1029,18 +1537,13 @@ bool NetBackend::PollSockets() {
                 e->host_socket = INVALID_SOCKET;
                 e->connecting = false;
                 e->closed = true;
+                ScheduleNatExpiry(e);
                 continue;
             }
             e->connecting = false;
             e->last_active_ms = GetTickCount64();
-            // Move pending_data to pending_to_host for proper draining
-            if (!e->pending_data.empty()) {
-                e->pending_to_host.insert(e->pending_to_host.end(),
-                                          e->pending_data.begin(),
-                                          e->pending_data.end());
-                e->pending_data.clear();
-                DrainTcpToHost(e);
-            }
+            // Send what the guest wrote while we were connecting
+            DrainTcpToHost(e);
         }
 
         // Drain pending data to host when socket becomes writable
@@ -1060,177 +1563,152 @@ bool NetBackend::PollSockets() {
 }
 
 void NetBackend::DrainTcpToGuest(NatEntry* entry) {
-    if (entry->pending_to_guest.empty() || !entry->conn_pcb) return;
-
-    auto* pcb = static_cast<struct tcp_pcb*>(entry->conn_pcb);
-    uint16_t avail = tcp_sndbuf(pcb);
-    uint16_t to_write = static_cast<uint16_t>(
-        std::min<size_t>(avail, entry->pending_to_guest.size()));
-    if (to_write > 0) {
-        tcp_write(pcb, entry->pending_to_guest.data(), to_write, TCP_WRITE_FLAG_COPY);
-        tcp_output(pcb);
-        entry->pending_to_guest.erase(
-            entry->pending_to_guest.begin(),
-            entry->pending_to_guest.begin() + to_write);
-    }
+    if (!entry->conn_pcb) return;
+    WriteStreamToGuest(static_cast<struct tcp_pcb*>(entry->conn_pcb),
+                       entry->pending_to_guest, &entry->to_guest_queued);
 }
 
 void NetBackend::DrainTcpToHost(NatEntry* entry) {
-    if (entry->pending_to_host.empty()) return;
+    if (entry->pending_to_host.empty() || entry->connecting) return;
     if (entry->host_socket == INVALID_SOCKET) {
-        entry->pending_to_host.clear();
+        entry->pending_to_host.Clear();
         return;
     }
 
     SOCKET s = static_cast<SOCKET>(entry->host_socket);
-    int sent = send(s, reinterpret_cast<const char*>(entry->pending_to_host.data()),
-                    static_cast<int>(entry->pending_to_host.size()), 0);
+    int sent = SendStreamToHost(s, entry->pending_to_host);
 
     if (sent > 0) {
-        entry->pending_to_host.erase(
-            entry->pending_to_host.begin(),
-            entry->pending_to_host.begin() + sent);
-    } else if (sent == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err != WSAEWOULDBLOCK) {
-            // Real error, close the connection
-            closesocket(s);
-            entry->host_socket = INVALID_SOCKET;
-            entry->pending_to_host.clear();
-            if (entry->conn_pcb) {
-                auto* pcb = static_cast<struct tcp_pcb*>(entry->conn_pcb);
-                tcp_arg(pcb, nullptr);
-                tcp_recv(pcb, nullptr);
-                tcp_err(pcb, nullptr);
-                tcp_close(pcb);
-                entry->conn_pcb = nullptr;
-            }
-            entry->closed = true;
+        if (entry->conn_pcb)
+            AckGuestData(static_cast<struct tcp_pcb*>(entry->conn_pcb), sent);
+    } else if (sent < 0) {
+        // Real error, close the connection
+        closesocket(s);
+        entry->host_socket = INVALID_SOCKET;
+        entry->pending_to_host.Clear();
+        if (entry->conn_pcb) {
+            CloseGuestPcb(static_cast<struct tcp_pcb*>(entry->conn_pcb),
+                          entry->pending_to_guest, &entry->to_guest_queued);
+            entry->conn_pcb = nullptr;
         }
-        // WSAEWOULDBLOCK: will retry on next poll
+        entry->closed = true;
+        ScheduleNatExpiry(entry);
     }
+    // 0 (WSAEWOULDBLOCK): will retry on next poll
 }
 
 void NetBackend::HandleTcpReadable(NatEntry* entry) {
-    char buf[32768];
     SOCKET s = static_cast<SOCKET>(entry->host_socket);
-    int n = recv(s, buf, sizeof(buf), 0);
+    bool closed;
+    int n = RecvStreamFromHost(s, entry->pending_to_guest, &closed);
+    if (n < 0 && !closed) return;
 
     if (n <= 0) {
         DrainTcpToGuest(entry);
         if (entry->conn_pcb) {
-            auto* pcb = static_cast<struct tcp_pcb*>(entry->conn_pcb);
-            // Detach callbacks before tcp_close: the PCB lives on inside
-            // lwIP during the close handshake, but the NatEntry may be
-            // freed before the PCB is.
-            tcp_arg(pcb, nullptr);
-            tcp_recv(pcb, nullptr);
-            tcp_err(pcb, nullptr);
-            tcp_close(pcb);
+            // Bytes still queued on the PCB go with it; the NatEntry may be
+            // freed before the close handshake ends.
+            CloseGuestPcb(static_cast<struct tcp_pcb*>(entry->conn_pcb),
+                          entry->pending_to_guest, &entry->to_guest_queued);
             entry->conn_pcb = nullptr;
         }
         closesocket(s);
         entry->host_socket = INVALID_SOCKET;
         entry->last_active_ms = GetTickCount64();
+        ScheduleNatExpiry(entry);
         return;
     }
 
     entry->last_active_ms = GetTickCount64();
-    entry->pending_to_guest.insert(entry->pending_to_guest.end(), buf, buf + n);
     DrainTcpToGuest(entry);
 }
 
 void NetBackend::HandleUdpReadable(NatEntry* entry) {
     char buf[2048];
     SOCKET s = static_cast<SOCKET>(entry->host_socket);
-    struct sockaddr_in from{};
-    int fromlen = sizeof(from);
-    int n = recvfrom(s, buf, sizeof(buf), 0,
-                     reinterpret_cast<sockaddr*>(&from), &fromlen);
-    if (n <= 0) return;
+    // Drain a burst, not one datagram per select() round.
+    for (int i = 0; i < kMaxUdpReadsPerPass; i++) {
+        struct sockaddr_in from{};
+        int fromlen = sizeof(from);
+        int n = recvfrom(s, buf, sizeof(buf), 0,
+                         reinterpret_cast<sockaddr*>(&from), &fromlen);
+        if (n <= 0) return;
+        HandleUdpDatagram(entry, reinterpret_cast<const uint8_t*>(buf),
+                          static_cast<uint32_t>(n));
+    }
+}
 
+void NetBackend::HandleUdpDatagram(NatEntry* entry, const uint8_t* data, uint32_t len) {
     entry->last_active_ms = GetTickCount64();
+    SendUdpToGuest(entry->real_dst_ip, entry->real_dst_port,
+                   entry->guest_ip, entry->guest_port, data, len);
+}
 
+void NetBackend::SendUdpToGuest(uint32_t src_ip, uint16_t src_port,
+                                uint32_t dst_ip, uint16_t dst_port,
+                                const uint8_t* data, uint32_t len) {
     // Build Ethernet + IP + UDP frame directly (bypass lwIP for responses)
-    uint32_t frame_len = sizeof(EthHdr) + 20 + sizeof(UdpHdr) + n;
-    std::vector<uint8_t> frame(frame_len);
+    uint32_t frame_len = sizeof(EthHdr) + 20 + sizeof(UdpHdr) + len;
+    uint8_t* frame = StageRxFrame(frame_len);
+    if (!frame) return;
 
-    auto* eth = reinterpret_cast<EthHdr*>(frame.data());
+    auto* eth = reinterpret_cast<EthHdr*>(frame);
     memcpy(eth->dst, kGuestMac, 6);
     memcpy(eth->src, kGatewayMac, 6);
     eth->type = htons(0x0800);
 
-    auto* ip = reinterpret_cast<IpHdr*>(frame.data() + sizeof(EthHdr));
+    auto* ip = reinterpret_cast<IpHdr*>(frame + sizeof(EthHdr));
+    memset(ip, 0, 20);
     ip->ver_ihl = 0x45;
     ip->ttl = 64;
     ip->proto = IPPROTO_UDP;
-    ip->src_ip = htonl(entry->real_dst_ip);
-    ip->dst_ip = htonl(entry->guest_ip);
-    ip->total_len = htons(static_cast<uint16_t>(20 + sizeof(UdpHdr) + n));
+    ip->src_ip = htonl(src_ip);
+    ip->dst_ip = htonl(dst_ip);
+    ip->total_len = htons(static_cast<uint16_t>(20 + sizeof(UdpHdr) + len));
     ip->id = htons(static_cast<uint16_t>(rand()));
     RecalcIpChecksum(ip);
 
-    auto* udp = reinterpret_cast<UdpHdr*>(frame.data() + sizeof(EthHdr) + 20);
-    udp->src_port = htons(entry->real_dst_port);
-    udp->dst_port = htons(entry->guest_port);
-    udp->length = htons(static_cast<uint16_t>(sizeof(UdpHdr) + n));
+    auto* udp = reinterpret_cast<UdpHdr*>(frame + sizeof(EthHdr) + 20);
+    udp->src_port = htons(src_port);
+    udp->dst_port = htons(dst_port);
+    udp->length = htons(static_cast<uint16_t>(sizeof(UdpHdr) + len));
     udp->checksum = 0;
 
-    memcpy(frame.data() + sizeof(EthHdr) + 20 + sizeof(UdpHdr), buf, n);
-
-    InjectFrame(frame.data(), frame_len);
+    memcpy(frame + sizeof(EthHdr) + 20 + sizeof(UdpHdr), data, len);
 }
 
 void NetBackend::DrainPfToGuest(PfEntry::Conn& conn) {
-    if (conn.pending_to_guest.empty() || !conn.guest_pcb || !conn.guest_connected)
-        return;
-
-    auto* pcb = static_cast<struct tcp_pcb*>(conn.guest_pcb);
-    uint16_t avail = tcp_sndbuf(pcb);
-    uint16_t to_write = static_cast<uint16_t>(
-        std::min<size_t>(avail, conn.pending_to_guest.size()));
-    if (to_write > 0) {
-        tcp_write(pcb, conn.pending_to_guest.data(), to_write, TCP_WRITE_FLAG_COPY);
-        tcp_output(pcb);
-        conn.pending_to_guest.erase(
-            conn.pending_to_guest.begin(),
-            conn.pending_to_guest.begin() + to_write);
-    }
+    if (!conn.guest_pcb || !conn.guest_connected) return;
+    WriteStreamToGuest(static_cast<struct tcp_pcb*>(conn.guest_pcb),
+                       conn.pending_to_guest, &conn.to_guest_queued);
 }
 
 void NetBackend::DrainPfToHost(PfEntry::Conn& conn) {
     if (conn.pending_to_host.empty()) return;
     if (conn.host_sock == ~(uintptr_t)0) {
-        conn.pending_to_host.clear();
+        conn.pending_to_host.Clear();
         return;
     }
 
     SOCKET s = static_cast<SOCKET>(conn.host_sock);
-    int sent = send(s, reinterpret_cast<const char*>(conn.pending_to_host.data()),
-                    static_cast<int>(conn.pending_to_host.size()), 0);
+    int sent = SendStreamToHost(s, conn.pending_to_host);
 
     if (sent > 0) {
-        conn.pending_to_host.erase(
-            conn.pending_to_host.begin(),
-            conn.pending_to_host.begin() + sent);
-    } else if (sent == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err != WSAEWOULDBLOCK) {
-            // Real error, close the connection
-            closesocket(s);
-            conn.host_sock = ~(uintptr_t)0;
-            conn.pending_to_host.clear();
-            if (conn.guest_pcb) {
-                auto* pcb = static_cast<struct tcp_pcb*>(conn.guest_pcb);
-                tcp_arg(pcb, nullptr);
-                tcp_recv(pcb, nullptr);
-                tcp_err(pcb, nullptr);
-                tcp_close(pcb);
-                conn.guest_pcb = nullptr;
-            }
+        conn.counters->bytes_to_host.fetch_add(sent, std::memory_order_relaxed);
+        if (conn.guest_pcb)
+            AckGuestData(static_cast<struct tcp_pcb*>(conn.guest_pcb), sent);
+    } else if (sent < 0) {
+        // Real error, close the connection
+        closesocket(s);
+        conn.host_sock = ~(uintptr_t)0;
+        conn.pending_to_host.Clear();
+        if (conn.guest_pcb) {
+            CloseGuestPcb(static_cast<struct tcp_pcb*>(conn.guest_pcb),
+                          conn.pending_to_guest, &conn.to_guest_queued);
+            conn.guest_pcb = nullptr;
         }
-        // WSAEWOULDBLOCK: will retry on next poll
     }
+    // 0 (WSAEWOULDBLOCK): will retry on next poll
 }
 
 // ============================================================
@@ -1245,8 +1723,7 @@ void NetBackend::HandleIcmpOut(uint32_t src_ip, uint32_t dst_ip,
             LOG_ERROR("Failed to create ICMP socket (need admin?)");
             return;
         }
-        u_long nonblock = 1;
-        ioctlsocket(s, FIONBIO, &nonblock);
+        WatchSocket(static_cast<uintptr_t>(s));
         icmp_socket_ = static_cast<uintptr_t>(s);
     }
 
@@ -1338,12 +1815,23 @@ void NetBackend::TeardownPortForwards() {
 
 void NetBackend::CheckPendingUpdates() {
     std::optional<std::vector<PortForward>> update;
+    std::optional<NetRateLimit> rate;
     {
         std::lock_guard<std::mutex> lock(pf_update_mutex_);
         if (pending_pf_update_) {
             update = std::move(pending_pf_update_);
             pending_pf_update_.reset();
         }
+        rate = pending_rate_update_;
+        pending_rate_update_.reset();
+    }
+    if (rate) {
+        // Mbit/s to bytes per second.
+        uint64_t burst = static_cast<uint64_t>(rate->burst_kb) * 1024;
+        ingress_.SetRate(static_cast<uint64_t>(rate->rx_mbps) * 125000, burst);
+        egress_.SetRate(static_cast<uint64_t>(rate->tx_mbps) * 125000, burst);
+        LOG_INFO("Network rate limit: %u Mbit/s in, %u Mbit/s out",
+                 rate->rx_mbps, rate->tx_mbps);
     }
     if (update) {
         TeardownPortForwards();
@@ -1357,7 +1845,13 @@ void NetBackend::CheckPendingUpdates() {
 void NetBackend::SetupPortForwards() {
     g_net_backend = this;
 
+    std::vector<std::shared_ptr<PfCounters>> counters;
     for (auto& pf : port_forwards_) {
+        pf.counters = std::make_shared<PfCounters>();
+        pf.counters->host_port = pf.host_port;
+        pf.counters->guest_port = pf.guest_port;
+        counters.push_back(pf.counters);
+
         SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
         if (s == INVALID_SOCKET) {
             LOG_ERROR("Port forward: failed to create listener for port %u", pf.host_port);
@@ -1367,8 +1861,7 @@ void NetBackend::SetupPortForwards() {
         setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
                    reinterpret_cast<const char*>(&reuse), sizeof(reuse));
 
-        u_long nonblock = 1;
-        ioctlsocket(s, FIONBIO, &nonblock);
+        WatchSocket(static_cast<uintptr_t>(s));
 
         struct sockaddr_in addr{};
         addr.sin_family = AF_INET;
@@ -1376,7 +1869,7 @@ void NetBackend::SetupPortForwards() {
         addr.sin_port = htons(pf.host_port);
 
         if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR ||
-            listen(s, 5) == SOCKET_ERROR) {
+            listen(s, SOMAXCONN) == SOCKET_ERROR) {
             LOG_ERROR("Port forward: failed to bind/listen on port %u", pf.host_port);
             closesocket(s);
             continue;
@@ -1385,141 +1878,188 @@ void NetBackend::SetupPortForwards() {
         pf.listener = static_cast<uintptr_t>(s);
         LOG_INFO("Port forward: host:%u -> guest:%u", pf.host_port, pf.guest_port);
     }
+
+    std::lock_guard<std::mutex> lock(pf_update_mutex_);
+    pf_counters_ = std::move(counters);
 }
 
-void NetBackend::PollPortForwards() {
-    for (auto& pf : port_forwards_) {
-        if (pf.listener == ~(uintptr_t)0) continue;
-        SOCKET ls = static_cast<SOCKET>(pf.listener);
-
-        // Check for new connections
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(ls, &rfds);
-        struct timeval tv = {0, 0};
-        if (select(0, &rfds, nullptr, nullptr, &tv) > 0 && FD_ISSET(ls, &rfds)) {
-            SOCKET cs = accept(ls, nullptr, nullptr);
-            if (cs != INVALID_SOCKET) {
-                u_long nonblock = 1;
-                ioctlsocket(cs, FIONBIO, &nonblock);
-
-                // Create lwIP TCP connection to guest
-                struct tcp_pcb* pcb = tcp_new();
-                ip_addr_t guest_addr;
-                IP4_ADDR(ip_2_ip4(&guest_addr), 10, 0, 2, 15);
-
-                PfEntry::Conn conn;
-                conn.host_sock = static_cast<uintptr_t>(cs);
-                conn.guest_pcb = pcb;
-                pf.conns.push_back(conn);
-
-                auto* conn_ptr = &pf.conns.back();
-                tcp_arg(pcb, conn_ptr);
-                tcp_recv(pcb, [](void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err) -> err_t {
-                    auto* c = static_cast<PfEntry::Conn*>(arg);
-                    if (!c) {
-                        if (p) pbuf_free(p);
-                        return ERR_OK;
-                    }
-                    if (!p) {
-                        if (c->host_sock != ~(uintptr_t)0) {
-                            closesocket(static_cast<SOCKET>(c->host_sock));
-                            c->host_sock = ~(uintptr_t)0;
-                        }
-                        tcp_arg(pcb, nullptr);
-                        tcp_recv(pcb, nullptr);
-                        tcp_err(pcb, nullptr);
-                        tcp_close(pcb);
-                        c->guest_pcb = nullptr;
-                        return ERR_OK;
-                    }
-                    std::vector<uint8_t> data(p->tot_len);
-                    pbuf_copy_partial(p, data.data(), p->tot_len, 0);
-                    tcp_recved(pcb, p->tot_len);
-                    pbuf_free(p);
-                    // Buffer data and attempt to send via DrainPfToHost
-                    c->pending_to_host.insert(c->pending_to_host.end(),
-                                              data.begin(), data.end());
-                    g_net_backend->DrainPfToHost(*c);
-                    return ERR_OK;
-                });
-                tcp_err(pcb, [](void* arg, err_t err) {
-                    auto* c = static_cast<PfEntry::Conn*>(arg);
-                    if (!c) return;
-                    c->guest_pcb = nullptr;
-                    if (c->host_sock != ~(uintptr_t)0) {
-                        closesocket(static_cast<SOCKET>(c->host_sock));
-                        c->host_sock = ~(uintptr_t)0;
-                    }
-                });
-
-                tcp_connect(pcb, &guest_addr, pf.guest_port,
-                    [](void* arg, struct tcp_pcb* pcb, err_t err) -> err_t {
-                    auto* c = static_cast<PfEntry::Conn*>(arg);
-                    if (!c) return ERR_OK;
-                    c->guest_connected = true;
-                    if (!c->pending_to_guest.empty()) {
-                        tcp_write(pcb, c->pending_to_guest.data(),
-                                  static_cast<u16_t>(c->pending_to_guest.size()),
-                                  TCP_WRITE_FLAG_COPY);
-                        tcp_output(pcb);
-                        c->pending_to_guest.clear();
-                    }
-                    return ERR_OK;
-                });
+std::vector<VmPortForwardStat> NetBackend::GetPortForwardStats() const {
+    std::lock_guard<std::mutex> lock(pf_update_mutex_);
+    std::vector<VmPortForwardStat> stats;
+    stats.reserve(pf_counters_.size());
+    for (const auto& c : pf_counters_) {
+        VmPortForwardStat st;
+        st.host_port = c->host_port;
+        st.guest_port = c->guest_port;
+        st.accepted = c->accepted.load(std::memory_order_relaxed);
+        st.active = c->active.load(std::memory_order_relaxed);
+        st.bytes_to_guest = c->bytes_to_guest.load(std::memory_order_relaxed);
+        st.bytes_to_host = c->bytes_to_host.load(std::memory_order_relaxed);
+        stats.push_back(st);
+    }
+    return stats;
+}
+
+void NetBackend::AcceptPortForward(PfEntry& pf, uintptr_t s) {
+    SOCKET cs = static_cast<SOCKET>(s);
+
+    // Create lwIP TCP connection to guest
+    struct tcp_pcb* pcb = tcp_new();
+    if (!pcb) {
+        LOG_WARN("Port forward: out of lwIP PCBs, refusing connection on port %u",
+                 pf.host_port);
+        closesocket(cs);
+        return;
+    }
+    WatchSocket(s);
+    ip_addr_t guest_addr;
+    IP4_ADDR(ip_2_ip4(&guest_addr), 10, 0, 2, 15);
+
+    auto* conn_ptr = &pf.conns.emplace_back();
+    conn_ptr->host_sock = static_cast<uintptr_t>(cs);
+    conn_ptr->guest_pcb = pcb;
+    conn_ptr->pending_to_guest.SetPool(&stream_pool_);
+    conn_ptr->pending_to_host.SetPool(&stream_pool_);
+    conn_ptr->counters = pf.counters.get();
+    pf.counters->accepted.fetch_add(1, std::memory_order_relaxed);
+    pf.counters->active.fetch_add(1, std::memory_order_relaxed);
+    tcp_arg(pcb, conn_ptr);
+    tcp_recv(pcb, [](void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err) -> err_t {
+        auto* c = static_cast<PfEntry::Conn*>(arg);
+        if (!c) {
+            if (p) pbuf_free(p);
+            return ERR_OK;
+        }
+        if (!p) {
+            if (c->host_sock != ~(uintptr_t)0) {
+                closesocket(static_cast<SOCKET>(c->host_sock));
+                c->host_sock = ~(uintptr_t)0;
             }
+            CloseGuestPcb(pcb, c->pending_to_guest, &c->to_guest_queued);
+            c->guest_pcb = nullptr;
+            return ERR_OK;
+        }
+        // Buffer data; DrainPfToHost reopens the window
+        for (struct pbuf* q = p; q; q = q->next)
+            c->pending_to_host.Append(q->payload, q->len);
+        pbuf_free(p);
+        g_net_backend->DrainPfToHost(*c);
+        return ERR_OK;
+    });
+    tcp_sent(pcb, [](void* arg, struct tcp_pcb*, u16_t len) -> err_t {
+        auto* c = static_cast<PfEntry::Conn*>(arg);
+        if (!c) return ERR_OK;
+        c->counters->bytes_to_guest.fetch_add(len, std::memory_order_relaxed);
+        c->pending_to_guest.Consume(len);
+        c->to_guest_queued -= std::min<size_t>(len, c->to_guest_queued);
+        g_net_backend->DrainPfToGuest(*c);
+        return ERR_OK;
+    });
+    tcp_err(pcb, [](void* arg, err_t err) {
+        auto* c = static_cast<PfEntry::Conn*>(arg);
+        if (!c) return;
+        c->guest_pcb = nullptr;
+        c->pending_to_guest.Clear();
+        c->to_guest_queued = 0;
+        if (c->host_sock != ~(uintptr_t)0) {
+            closesocket(static_cast<SOCKET>(c->host_sock));
+            c->host_sock = ~(uintptr_t)0;
         }
+    });
+
+    tcp_connect(pcb, &guest_addr, pf.guest_port,
+        [](void* arg, struct tcp_pcb* pcb, err_t err) -> err_t {
+        auto* c = static_cast<PfEntry::Conn*>(arg);
+        if (!c) return ERR_OK;
+        c->guest_connected = true;
+        g_net_backend->DrainPfToGuest(*c);
+        return ERR_OK;
+    });
+}
 
-        // Poll active connections for data from host
+void NetBackend::PollPortForwards() {
+    if (port_forwards_.empty()) return;
+
+    // One readiness check covers every listener and connection, like
+    // PollSockets does for NAT. WSAPoll, since a forward may hold more
+    // connections than an fd_set (FD_SETSIZE) can take, and FD_SET drops
+    // the rest without a word. Entries are in the order walked below.
+    std::vector<WSAPOLLFD> fds;
+    for (auto& pf : port_forwards_) {
+        if (pf.listener != ~(uintptr_t)0) {
+            fds.push_back({static_cast<SOCKET>(pf.listener), POLLRDNORM, 0});
+        }
         for (auto& c : pf.conns) {
             if (c.host_sock == ~(uintptr_t)0) continue;
 
             DrainPfToGuest(c);
-            if (!c.pending_to_guest.empty())
-                continue; // back-pressure: don't read until drained
+            SHORT events = 0;
+            if (!c.pending_to_host.empty()) events |= POLLWRNORM;
+            // Back-pressure: don't read until queued on the PCB
+            if (c.pending_to_guest.size() <= c.to_guest_queued) events |= POLLRDNORM;
+            if (events) fds.push_back({static_cast<SOCKET>(c.host_sock), events, 0});
+        }
+    }
+    if (fds.empty()) return;
+
+    if (WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), 0) <= 0) return;
 
+    // A hang-up or error reads as readable so recv() reports it, but only
+    // on a socket that was asked for reads: back-pressure still holds.
+    constexpr SHORT kReadable = POLLRDNORM | POLLHUP | POLLERR;
+    size_t next = 0;
+    auto revents_of = [&](uintptr_t s) -> SHORT {
+        if (next == fds.size() || fds[next].fd != static_cast<SOCKET>(s)) return 0;
+        const WSAPOLLFD& fd = fds[next++];
+        return (fd.events & POLLRDNORM) ? fd.revents : (fd.revents & ~kReadable);
+    };
+
+    for (auto& pf : port_forwards_) {
+        bool accept_ready = pf.listener != ~(uintptr_t)0 &&
+                            (revents_of(pf.listener) & kReadable);
+        for (auto& c : pf.conns) {
+            if (c.host_sock == ~(uintptr_t)0) continue;
             SOCKET s = static_cast<SOCKET>(c.host_sock);
-            fd_set wfds;
-            FD_ZERO(&rfds);
-            FD_ZERO(&wfds);
-            FD_SET(s, &rfds);
-            if (!c.pending_to_host.empty()) {
-                FD_SET(s, &wfds);
-            }
-            tv = {0, 0};
-            int sel_result = select(0, &rfds, &wfds, nullptr, &tv);
-            if (sel_result <= 0) continue;
+            SHORT revents = revents_of(c.host_sock);
 
             // Drain pending data to host when socket becomes writable
-            if (!c.pending_to_host.empty() && FD_ISSET(s, &wfds)) {
+            if (!c.pending_to_host.empty() && (revents & POLLWRNORM)) {
                 DrainPfToHost(c);
+                if (c.host_sock == ~(uintptr_t)0) continue;
             }
 
-            if (FD_ISSET(s, &rfds)) {
-                char buf[4096];
-                int n = recv(s, buf, sizeof(buf), 0);
-                if (n <= 0) {
+            if (revents & kReadable) {
+                bool closed;
+                int n = RecvStreamFromHost(s, c.pending_to_guest, &closed);
+                if (n == 0 || closed) {
                     closesocket(s);
                     c.host_sock = ~(uintptr_t)0;
                     if (c.guest_pcb) {
-                        auto* p = static_cast<struct tcp_pcb*>(c.guest_pcb);
-                        tcp_arg(p, nullptr);
-                        tcp_recv(p, nullptr);
-                        tcp_err(p, nullptr);
-                        tcp_close(p);
+                        DrainPfToGuest(c);
+                        CloseGuestPcb(static_cast<struct tcp_pcb*>(c.guest_pcb),
+                                      c.pending_to_guest, &c.to_guest_queued);
                         c.guest_pcb = nullptr;
                     }
-                } else {
-                    c.pending_to_guest.insert(c.pending_to_guest.end(),
-                                              buf, buf + n);
+                } else if (n > 0) {
                     DrainPfToGuest(c);
                 }
             }
         }
 
         // Purge dead connections (both sides closed)
-        pf.conns.remove_if([](const PfEntry::Conn& c) {
-            return c.host_sock == ~(uintptr_t)0 && c.guest_pcb == nullptr;
+        pf.conns.remove_if([&pf](const PfEntry::Conn& c) {
+            if (c.host_sock != ~(uintptr_t)0 || c.guest_pcb) return false;
+            pf.counters->active.fetch_sub(1, std::memory_order_relaxed);
+            return true;
         });
+
+        // Take the accept backlog; the listener is non-blocking.
+        if (accept_ready) {
+            for (int i = 0; i < kMaxAcceptsPerPass; i++) {
+                SOCKET cs = accept(static_cast<SOCKET>(pf.listener), nullptr, nullptr);
+                if (cs == INVALID_SOCKET) break;
+                AcceptPortForward(pf, static_cast<uintptr_t>(cs));
+            }
+        }
     }
 }
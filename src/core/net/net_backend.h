@@ -1,11 +1,17 @@
 #pragma once
 
 #include "common/vm_model.h"
+#include "core/net/dns_resolver.h"
+#include "core/net/flow_shaper.h"
+#include "core/net/frame_ring.h"
+#include "core/net/rio_udp.h"
+#include "core/net/stream_buffer.h"
 
 #include <atomic>
 #include <cstdint>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
@@ -14,6 +20,7 @@
 #include <vector>
 
 class VirtioNetDevice;
+struct NetTxSegment;
 
 // User-mode network backend: lwIP + NAT + DHCP + port forwarding.
 // Runs a dedicated network thread for lwIP event loop and socket I/O.
@@ -29,19 +36,70 @@ public:
 
     void SetLinkUp(bool up);
     void UpdatePortForwards(const std::vector<PortForward>& forwards);
+    // Caps each direction, with fair queuing between flows; see
+    // FlowShaper. Safe from any thread, before Start() too.
+    void SetRateLimit(const NetRateLimit& limit);
 
-    // Called from vCPU thread when guest transmits an Ethernet frame.
-    void EnqueueTx(const uint8_t* frame, uint32_t len);
+    // Called from vCPU thread when guest transmits an Ethernet frame,
+    // given as the guest segments that hold it. The frame is gathered once
+    // into a pooled buffer that lwIP then references without copying.
+    void EnqueueTx(const NetTxSegment* segs, size_t count, uint32_t len);
+
+    // Guest frames dropped because every TX buffer was in flight.
+    uint64_t GetTxDropped() const { return tx_dropped_.load(std::memory_order_relaxed); }
+    // Frames the rate limit dropped from its full queues.
+    uint64_t GetShaperDropped() const {
+        return shaper_dropped_.load(std::memory_order_relaxed);
+    }
+
+    // Per-forward connection and byte counters; safe from any thread.
+    // Counters restart when the forwards are updated.
+    std::vector<VmPortForwardStat> GetPortForwardStats() const;
 
 private:
+    static constexpr uint64_t kCleanupIntervalMs = 5000;
+    // Pooled TX buffers: one per TX ring entry, each sized for an MTU
+    // frame. Larger frames borrow one of a few maximum-size buffers, and
+    // are dropped while all of those are in flight.
+    static constexpr size_t kTxPoolFrames = 256;
+    static constexpr uint32_t kTxFrameBytes = 2048;
+    static constexpr size_t kTxLargeBuffers = 32;
+    // A guest TSO frame: a full 64 KiB IPv4 packet plus the Ethernet header.
+    static constexpr uint32_t kMaxTxFrameBytes = 14 + 0xFFFF;
+
+    struct TxFrame;
+    void ReleaseTxFrame(TxFrame* frame);
+    // Hands the frame to lwIP by reference; it returns to the pool when
+    // lwIP frees the pbuf.
+    void FeedToLwip(TxFrame* frame);
+
     void NetworkThread();
     void ProcessPendingTx();
+    // Routes one guest frame: ARP/DHCP, DNS, lwIP or the NAT relays.
+    void HandleGuestFrame(TxFrame* frame);
+    // Hash of a frame's IPv4 flow, for the shapers' queues.
+    static uint32_t FlowHash(const uint8_t* frame, uint32_t len);
+    // Wakes the network thread; safe from any thread.
+    void Wake();
+    // Associates a host socket with wake_event_ (makes it non-blocking).
+    void WatchSocket(uintptr_t s);
 
     // ARP / DHCP handled at raw Ethernet level before lwIP
     bool HandleArpOrDhcp(const uint8_t* frame, uint32_t len);
     void SendDhcpReply(uint8_t type, uint32_t xid,
                        const uint8_t* chaddr, uint32_t req_ip);
 
+    // DNS to the gateway, or to the host resolver, answered by dns_.
+    // Returns false for queries to relay through the UDP NAT instead.
+    bool IsDnsQuery(const uint8_t* frame, uint32_t len) const;
+    // DNS over TCP to the gateway, which guests fall back to for answers
+    // too big for UDP; the TCP NAT relays it to the host resolver.
+    bool IsDnsStream(const uint8_t* frame, uint32_t len) const;
+    bool HandleDnsQuery(const uint8_t* frame, uint32_t len);
+    void SendUdpToGuest(uint32_t src_ip, uint16_t src_port,
+                        uint32_t dst_ip, uint16_t dst_port,
+                        const uint8_t* data, uint32_t len);
+
     // NAT rewriting
     struct NatEntry;
     NatEntry* FindNatEntry(uint32_t guest_port, uint32_t dst_ip,
@@ -54,12 +112,21 @@ private:
     uint16_t AllocProxyPort();
     bool IsProxyPortInUse(uint16_t port) const;
 
-    void RewriteAndFeed(uint8_t* frame, uint32_t len, NatEntry* entry);
+    // Idle expiry: a timer wheel of kCleanupIntervalMs ticks. Entries are
+    // slotted by their deadline and re-checked when the slot comes round,
+    // so activity only bumps last_active_ms; state changes that shorten
+    // the deadline reschedule.
+    void ScheduleNatExpiry(NatEntry* entry);
+    void UnlinkNatExpiry(NatEntry* entry);
+    static uint64_t NatExpiryDeadline(const NatEntry* entry);
+
+    void RewriteAndFeed(TxFrame* frame, NatEntry* entry);
 
     // TCP NAT callbacks (static so they can be registered with lwIP)
     static void* AsTcpArg(NatEntry* e);
     void OnTcpAccepted(NatEntry* entry, void* new_pcb);
     void OnTcpRecv(NatEntry* entry, void* pcb, void* p);
+    void OnTcpSent(NatEntry* entry, uint32_t len);
     void OnTcpErr(NatEntry* entry);
 
     // UDP NAT
@@ -69,6 +136,10 @@ private:
     bool PollSockets();
     void HandleTcpReadable(NatEntry* entry);
     void HandleUdpReadable(NatEntry* entry);
+    // A datagram from a UDP NAT socket, relayed to the guest.
+    void HandleUdpDatagram(NatEntry* entry, const uint8_t* data, uint32_t len);
+    // Closes a NAT entry's host socket, whichever kind it is.
+    void CloseNatSocket(NatEntry* entry);
     void DrainTcpToGuest(NatEntry* entry);
     void DrainTcpToHost(NatEntry* entry);
 
@@ -82,16 +153,53 @@ private:
     struct PfEntry;
     void SetupPortForwards();
     void PollPortForwards();
+    void AcceptPortForward(PfEntry& pf, uintptr_t s);
+    // Bounds the time one busy listener can hold the network thread.
+    static constexpr int kMaxAcceptsPerPass = 64;
 
     VirtioNetDevice* virtio_net_ = nullptr;
     std::function<void()> irq_callback_;
 
     std::thread net_thread_;
     std::atomic<bool> running_{false};
+    // WSAEVENT shared by every host socket and by Wake(). The net thread
+    // resets it at the top of each pass and blocks on it when idle.
+    void* wake_event_ = nullptr;
+
+    // UDP NAT sockets receive through Registered I/O where available.
+    // A pass dequeues at most kMaxRioDatagramsPerPass of their datagrams;
+    // select()ed ones read up to kMaxUdpReadsPerPass each.
+    RioUdp rio_udp_;
+    static constexpr size_t kMaxRioDatagramsPerPass = 1024;
+    static constexpr int kMaxUdpReadsPerPass = 64;
 
-    // TX queue (vCPU → net thread)
-    std::mutex tx_mutex_;
-    std::vector<std::vector<uint8_t>> tx_queue_;
+    // TX queue (vCPUs → net thread) and the free buffer list. Both hold
+    // pool frames and are sized for the whole pool, so neither overflows.
+    BoundedQueue<TxFrame*> tx_queue_{kTxPoolFrames};
+    BoundedQueue<TxFrame*> tx_free_{kTxPoolFrames};
+    std::vector<std::unique_ptr<TxFrame>> tx_pool_;
+    BoundedQueue<uint8_t*> tx_large_free_{kTxLargeBuffers};
+    std::vector<std::unique_ptr<uint8_t[]>> tx_large_pool_;
+    // Set by the first producer after the net thread last drained, so a
+    // burst of frames costs one wakeup.
+    std::atomic<bool> tx_signaled_{false};
+    std::atomic<uint64_t> tx_dropped_{0};
+
+    // Rate limits, applied on the network thread. Egress holds guest
+    // frames back in their pool buffers, leaving some buffers free so new
+    // flows still get in; ingress holds copies of staged RX frames.
+    struct QueuedRxFrame {
+        std::vector<uint8_t> data;
+        uint16_t csum_start = 0;
+        uint16_t csum_offset = 0;
+    };
+    static constexpr size_t kMaxQueuedRxFrames = 1024;
+    FlowShaper<TxFrame*> egress_{kTxPoolFrames * 3 / 4};
+    FlowShaper<QueuedRxFrame> ingress_{kMaxQueuedRxFrames};
+    std::atomic<uint64_t> shaper_dropped_{0};
+
+    DnsResolver dns_;
+    uint32_t host_dns_ip_ = 0;
 
     // lwIP netif (opaque pointer to avoid lwIP headers in .h)
     void* netif_ = nullptr;
@@ -100,6 +208,9 @@ private:
     // accept callback because lwIP still accesses pcb->listener afterward).
     std::vector<void*> deferred_listen_close_;
 
+    // Backs the TCP stream buffers below, so it is declared before them.
+    StreamChunkPool stream_pool_;
+
     // NAT table
     struct NatEntry {
         uint8_t  proto;
@@ -107,31 +218,89 @@ private:
         uint16_t guest_port;
         uint32_t real_dst_ip;
         uint16_t real_dst_port;
+        // UDP and TCP to the gateway's DNS port are sent here instead.
+        uint32_t relay_dst_ip = 0;
         uint16_t proxy_port;
         void*    listen_pcb = nullptr;
         void*    conn_pcb   = nullptr;
         uintptr_t host_socket = ~(uintptr_t)0;
+        bool     rio = false;  // host_socket belongs to rio_udp_
         bool     connecting  = false;
-        std::vector<uint8_t> pending_data;
-        std::vector<uint8_t> pending_to_guest;
-        std::vector<uint8_t> pending_to_host;  // buffered data from guest waiting to send to host
+        // Host data for the guest. The first to_guest_queued bytes are
+        // referenced by lwIP until the guest ACKs them.
+        StreamBuffer pending_to_guest;
+        size_t   to_guest_queued = 0;
+        // Guest data not yet accepted by the host socket (or still
+        // connecting). lwIP's receive window is opened as it drains.
+        StreamBuffer pending_to_host;
         uint64_t last_active_ms = 0;
         bool     closed = false; // both sides done, pending removal
+        // Slot in nat_entries_ and links in the expiry wheel
+        size_t    table_index = 0;
+        int       expiry_slot = -1;
+        NatEntry* expiry_prev = nullptr;
+        NatEntry* expiry_next = nullptr;
     };
     std::vector<std::unique_ptr<NatEntry>> nat_entries_;
-    uint16_t next_proxy_port_ = 10000;
 
-    // Port forwarding
+    // Guest flow -> newest entry for it. Closed entries linger in
+    // nat_entries_ until expiry, so a flow can be reopened meanwhile.
+    struct NatKey {
+        uint8_t  proto;
+        uint16_t guest_port;
+        uint32_t dst_ip;
+        uint16_t dst_port;
+        bool operator==(const NatKey&) const = default;
+    };
+    struct NatKeyHash {
+        size_t operator()(const NatKey& k) const {
+            uint64_t x = (uint64_t(k.dst_ip) << 32) | (uint32_t(k.dst_port) << 16) |
+                         k.guest_port;
+            x ^= uint64_t(k.proto) << 61;
+            x ^= x >> 33;
+            x *= 0xFF51AFD7ED558CCDull;
+            x ^= x >> 33;
+            return static_cast<size_t>(x);
+        }
+    };
+    std::unordered_map<NatKey, NatEntry*, NatKeyHash> nat_flows_;
+
+    // Proxy port -> entry that last took it; the port is free again once
+    // that entry is closed.
+    static constexpr uint16_t kMinProxyPort = 10000;
+    static constexpr uint16_t kMaxProxyPort = 60000;
+    std::vector<NatEntry*> proxy_port_owner_ =
+        std::vector<NatEntry*>(kMaxProxyPort - kMinProxyPort + 1, nullptr);
+    uint16_t next_proxy_port_ = kMinProxyPort;
+
+    // 64 ticks of 5 s cover the longest (5 min) idle timeout.
+    static constexpr size_t kExpirySlots = 64;
+    NatEntry* expiry_wheel_[kExpirySlots] = {};
+    uint64_t expiry_tick_ = 0;  // last tick CleanupStaleEntries processed
+
+    // Port forwarding. Counters are written by the network thread and
+    // read by GetPortForwardStats().
+    struct PfCounters {
+        uint16_t host_port = 0;
+        uint16_t guest_port = 0;
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint32_t> active{0};
+        std::atomic<uint64_t> bytes_to_guest{0};  // acked by the guest
+        std::atomic<uint64_t> bytes_to_host{0};
+    };
     struct PfEntry {
         uint16_t host_port;
         uint16_t guest_port;
         uintptr_t listener = ~(uintptr_t)0;
+        std::shared_ptr<PfCounters> counters;
         struct Conn {
             uintptr_t host_sock = ~(uintptr_t)0;
             void*     guest_pcb = nullptr;
             bool      guest_connected = false;
-            std::vector<uint8_t> pending_to_guest;
-            std::vector<uint8_t> pending_to_host;
+            StreamBuffer pending_to_guest;
+            size_t    to_guest_queued = 0;
+            StreamBuffer pending_to_host;
+            PfCounters* counters = nullptr;
         };
         std::list<Conn> conns;
     };
@@ -143,8 +312,11 @@ private:
 
     std::atomic<bool> link_up_{true};
 
-    std::mutex pf_update_mutex_;
+    mutable std::mutex pf_update_mutex_;
     std::optional<std::vector<PortForward>> pending_pf_update_;
+    std::optional<NetRateLimit> pending_rate_update_;  // under pf_update_mutex_
+    // Counters of the active forwards, under pf_update_mutex_.
+    std::vector<std::shared_ptr<PfCounters>> pf_counters_;
 
 public:
     // Network addresses (public for use by lwIP callbacks)
@@ -154,7 +326,34 @@ public:
     static constexpr uint8_t  kGatewayMac[6] = {0x52,0x54,0x00,0x12,0x34,0x57};
     static constexpr uint8_t  kGuestMac[6]   = {0x52,0x54,0x00,0x12,0x34,0x56};
 
+    // The header edits NAT makes to a checked IPv4 TCP or UDP frame: its
+    // destination (guest to host) or source (host to guest) becomes
+    // `ip`:`port`, both in host order, with checksums patched incrementally.
+    static void RewriteDestination(uint8_t* frame, uint32_t ip, uint16_t port);
+    static void RewriteSource(uint8_t* frame, uint32_t ip, uint16_t port);
+
     // Public for lwIP free-function callbacks
     void ReverseRewrite(uint8_t* frame, uint32_t len);
     void InjectFrame(const uint8_t* frame, uint32_t len);
+    // Space for a `len`-byte frame to the guest, sent with the rest of the
+    // pass's frames by FlushRx(). Valid until the next call; nullptr while
+    // the link is down.
+    uint8_t* StageRxFrame(uint32_t len);
+    // lwIP leaves TCP checksums to the guest: seeds the just-staged frame's
+    // checksum with the pseudo-header sum and marks it partial.
+    void MarkStagedChecksumPartial(uint8_t* frame, uint32_t len);
+
+private:
+    // Frames to the guest are staged over a network thread pass and
+    // injected as one batch: one RX lock and one interrupt.
+    void FlushRx();
+
+    struct StagedFrame {
+        size_t offset;
+        uint32_t len;
+        uint16_t csum_start;
+        uint16_t csum_offset;
+    };
+    std::vector<uint8_t> rx_stage_;
+    std::vector<StagedFrame> rx_staged_;
 };
@@ -0,0 +1,250 @@
+#include "core/net/rio_udp.h"
+#include "core/vmm/types.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+
+#include <algorithm>
+
+struct RioUdp::Functions {
+    RIO_EXTENSION_FUNCTION_TABLE table{};
+};
+
+namespace {
+
+// RequestContext of a receive: which slot and buffer, and the slot's
+// generation when it was posted.
+ULONG_PTR PackRequest(uint32_t slot, uint32_t buffer, uint32_t generation) {
+    return (static_cast<ULONG_PTR>(generation) << 32) | (slot << 16) | buffer;
+}
+
+} // namespace
+
+RioUdp::RioUdp() = default;
+
+RioUdp::~RioUdp() {
+    Shutdown();
+}
+
+bool RioUdp::Init(void* event) {
+    // The function table is fetched through any RIO-capable socket.
+    SOCKET probe = WSASocketW(AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0,
+                              WSA_FLAG_REGISTERED_IO);
+    if (probe == INVALID_SOCKET) {
+        LOG_INFO("Network backend: Registered I/O unavailable (%d), using select()",
+                 WSAGetLastError());
+        return false;
+    }
+    auto fn = std::make_unique<Functions>();
+    GUID guid = WSAID_MULTIPLE_RIO;
+    DWORD bytes = 0;
+    int rc = WSAIoctl(probe, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,
+                      &guid, sizeof(guid), &fn->table, sizeof(fn->table),
+                      &bytes, nullptr, nullptr);
+    closesocket(probe);
+    if (rc == SOCKET_ERROR) {
+        LOG_INFO("Network backend: Registered I/O unavailable (%d), using select()",
+                 WSAGetLastError());
+        return false;
+    }
+
+    size_t buffer_bytes = size_t(kMaxSockets) * kRecvsPerSocket * kRecvBytes;
+    buffer_ = static_cast<uint8_t*>(VirtualAlloc(nullptr, buffer_bytes,
+                                                 MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (!buffer_) {
+        LOG_WARN("Network backend: RIO buffer allocation failed");
+        return false;
+    }
+    RIO_BUFFERID id = fn->table.RIORegisterBuffer(reinterpret_cast<PCHAR>(buffer_),
+                                                  static_cast<DWORD>(buffer_bytes));
+    if (id == RIO_INVALID_BUFFERID) {
+        LOG_WARN("Network backend: RIORegisterBuffer failed (%d)", WSAGetLastError());
+        VirtualFree(buffer_, 0, MEM_RELEASE);
+        buffer_ = nullptr;
+        return false;
+    }
+
+    RIO_NOTIFICATION_COMPLETION notify{};
+    notify.Type = RIO_EVENT_COMPLETION;
+    notify.Event.EventHandle = static_cast<HANDLE>(event);
+    notify.Event.NotifyReset = FALSE;  // the network thread resets it
+    RIO_CQ cq = fn->table.RIOCreateCompletionQueue(kMaxSockets * kRecvsPerSocket, &notify);
+    if (cq == RIO_INVALID_CQ) {
+        LOG_WARN("Network backend: RIOCreateCompletionQueue failed (%d)", WSAGetLastError());
+        fn->table.RIODeregisterBuffer(id);
+        VirtualFree(buffer_, 0, MEM_RELEASE);
+        buffer_ = nullptr;
+        return false;
+    }
+
+    fn_ = std::move(fn);
+    buffer_id_ = id;
+    cq_ = cq;
+    slots_.assign(kMaxSockets, Slot{});
+    free_slots_.clear();
+    for (uint32_t i = kMaxSockets; i-- > 0;) free_slots_.push_back(i);
+    fn_->table.RIONotify(cq);
+    LOG_INFO("Network backend: UDP NAT on Registered I/O (%u sockets x %u receives)",
+             kMaxSockets, kRecvsPerSocket);
+    return true;
+}
+
+void RioUdp::Shutdown() {
+    if (!cq_) return;
+    for (auto& slot : slots_) {
+        if (slot.open) closesocket(static_cast<SOCKET>(slot.socket));
+    }
+    slots_.clear();
+    free_slots_.clear();
+    commit_slots_.clear();
+    // Closing the sockets aborted their receives, so nothing writes to
+    // the buffer any more.
+    fn_->table.RIOCloseCompletionQueue(static_cast<RIO_CQ>(cq_));
+    fn_->table.RIODeregisterBuffer(static_cast<RIO_BUFFERID>(buffer_id_));
+    VirtualFree(buffer_, 0, MEM_RELEASE);
+    cq_ = nullptr;
+    buffer_ = nullptr;
+    buffer_id_ = nullptr;
+    fn_.reset();
+}
+
+bool RioUdp::PostReceive(uint32_t slot_index, uint32_t buffer, bool defer) {
+    Slot& slot = slots_[slot_index];
+    RIO_BUF buf{};
+    buf.BufferId = static_cast<RIO_BUFFERID>(buffer_id_);
+    buf.Offset = (slot_index * kRecvsPerSocket + buffer) * kRecvBytes;
+    buf.Length = kRecvBytes;
+    if (!fn_->table.RIOReceive(static_cast<RIO_RQ>(slot.request_queue), &buf, 1,
+                               defer ? RIO_MSG_DEFER : 0,
+                               reinterpret_cast<PVOID>(
+                                   PackRequest(slot_index, buffer, slot.generation)))) {
+        return false;
+    }
+    slot.outstanding++;
+    return true;
+}
+
+uintptr_t RioUdp::OpenSocket(void* context) {
+    if (!cq_ || free_slots_.empty()) return ~(uintptr_t)0;
+
+    SOCKET s = WSASocketW(AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0,
+                          WSA_FLAG_REGISTERED_IO);
+    if (s == INVALID_SOCKET) return ~(uintptr_t)0;
+    // Receives need a local port, which sendto() would only pick later.
+    // Non-blocking like the select() sockets, so a full send buffer
+    // drops the datagram instead of stalling the network thread.
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    u_long nonblocking = 1;
+    if (bind(s, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == SOCKET_ERROR ||
+        ioctlsocket(s, FIONBIO, &nonblocking) == SOCKET_ERROR) {
+        closesocket(s);
+        return ~(uintptr_t)0;
+    }
+
+    uint32_t index = free_slots_.back();
+    Slot& slot = slots_[index];
+    RIO_RQ rq = fn_->table.RIOCreateRequestQueue(
+        s, kRecvsPerSocket, 1, 1, 1,
+        static_cast<RIO_CQ>(cq_), static_cast<RIO_CQ>(cq_), nullptr);
+    if (rq == RIO_INVALID_RQ) {
+        LOG_WARN("Network backend: RIOCreateRequestQueue failed (%d)", WSAGetLastError());
+        closesocket(s);
+        return ~(uintptr_t)0;
+    }
+    free_slots_.pop_back();
+    slot.listed = false;
+    slot.socket = static_cast<uintptr_t>(s);
+    slot.request_queue = rq;
+    slot.context = context;
+    slot.open = true;
+    for (uint32_t i = 0; i < kRecvsPerSocket; i++) {
+        if (!PostReceive(index, i, false)) {
+            // Runs on fewer buffers rather than failing the flow.
+            LOG_WARN("Network backend: RIOReceive failed (%d)", WSAGetLastError());
+            break;
+        }
+    }
+    return slot.socket;
+}
+
+void RioUdp::CloseSocket(uintptr_t s) {
+    for (uint32_t i = 0; i < slots_.size(); i++) {
+        Slot& slot = slots_[i];
+        if (!slot.open || slot.socket != s) continue;
+        closesocket(static_cast<SOCKET>(s));
+        slot.open = false;
+        slot.socket = ~(uintptr_t)0;
+        slot.request_queue = nullptr;
+        slot.context = nullptr;
+        slot.commit = false;
+        slot.generation++;
+        ReleaseSlot(i);
+        return;
+    }
+}
+
+void RioUdp::ReleaseSlot(uint32_t slot_index) {
+    Slot& slot = slots_[slot_index];
+    if (slot.open || slot.outstanding || slot.listed) return;
+    slot.listed = true;
+    free_slots_.push_back(slot_index);
+}
+
+size_t RioUdp::Poll(size_t max_datagrams, const DeliverFn& deliver) {
+    if (!cq_) return 0;
+    constexpr ULONG kBatch = 256;
+    RIORESULT results[kBatch];
+    size_t delivered = 0;
+    while (delivered < max_datagrams) {
+        ULONG want = static_cast<ULONG>((std::min)(size_t(kBatch), max_datagrams - delivered));
+        ULONG n = fn_->table.RIODequeueCompletion(static_cast<RIO_CQ>(cq_), results, want);
+        if (n == 0 || n == RIO_CORRUPT_CQ) break;
+        for (ULONG i = 0; i < n; i++) {
+            ULONG_PTR request = static_cast<ULONG_PTR>(results[i].RequestContext);
+            uint32_t index = static_cast<uint32_t>(request >> 16) & 0xFFFF;
+            uint32_t buffer = static_cast<uint32_t>(request) & 0xFFFF;
+            uint32_t generation = static_cast<uint32_t>(request >> 32);
+            if (index >= slots_.size()) continue;
+            Slot& slot = slots_[index];
+            slot.outstanding--;
+            if (!slot.open || slot.generation != generation) {
+                // Aborted by CloseSocket(); the slot frees with its last one.
+                ReleaseSlot(index);
+                continue;
+            }
+            // Errors are mostly ICMP port unreachable reported back, or a
+            // datagram larger than the buffer; either way only it is lost.
+            if (results[i].Status == 0 && results[i].BytesTransferred > 0) {
+                const uint8_t* data = buffer_ +
+                    size_t(index * kRecvsPerSocket + buffer) * kRecvBytes;
+                deliver(slot.context, data, results[i].BytesTransferred);
+                delivered++;
+            }
+            // deliver() may have closed this very socket.
+            if (!slot.open || slot.generation != generation) {
+                ReleaseSlot(index);
+                continue;
+            }
+            if (PostReceive(index, buffer, true) && !slot.commit) {
+                slot.commit = true;
+                commit_slots_.push_back(index);
+            }
+        }
+        if (n < want) break;
+    }
+
+    for (uint32_t index : commit_slots_) {
+        Slot& slot = slots_[index];
+        if (!slot.commit) continue;
+        slot.commit = false;
+        fn_->table.RIOReceive(static_cast<RIO_RQ>(slot.request_queue), nullptr, 0,
+                              RIO_MSG_COMMIT_ONLY, nullptr);
+    }
+    commit_slots_.clear();
+
+    // Sets the event straight away if completions are already waiting.
+    fn_->table.RIONotify(static_cast<RIO_CQ>(cq_));
+    return delivered;
+}
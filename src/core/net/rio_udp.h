@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Receive path for the UDP NAT sockets over Winsock Registered I/O.
+//
+// Each socket keeps kRecvsPerSocket receives posted into its own slices of
+// one registered buffer, and every completion lands in a shared completion
+// queue that signals the network thread's wake event. A pass then drains
+// hundreds of datagrams with one dequeue instead of a select() and a
+// recvfrom() each, and reposts the buffers in a batch per socket.
+//
+// Sends keep using sendto(), which RIO sockets accept too. Everything runs
+// on the network thread.
+class RioUdp {
+public:
+    static constexpr uint32_t kMaxSockets = 256;
+    static constexpr uint32_t kRecvsPerSocket = 16;
+    // As large as the recvfrom() buffer it replaces; longer datagrams are
+    // dropped.
+    static constexpr uint32_t kRecvBytes = 2048;
+
+    RioUdp();
+    ~RioUdp();
+
+    RioUdp(const RioUdp&) = delete;
+    RioUdp& operator=(const RioUdp&) = delete;
+
+    // Loads the RIO functions and sets up the buffer and completion queue,
+    // with `event` (a WSAEVENT) set when completions arrive. Returns false
+    // where RIO is unavailable; sockets then stay on select().
+    bool Init(void* event);
+    // Closes every socket and releases the queue and buffer.
+    void Shutdown();
+    bool available() const { return cq_ != nullptr; }
+
+    // Opens a bound, non-blocking UDP socket with its receives posted.
+    // `context` comes back with each of its datagrams. Returns ~0 when RIO
+    // is unavailable or every slot is in use.
+    uintptr_t OpenSocket(void* context);
+    // Closes a socket from OpenSocket(). No datagram for it is delivered
+    // afterwards, so `context` may be freed right away.
+    void CloseSocket(uintptr_t s);
+
+    // Hands out up to `max_datagrams` received datagrams, in arrival order,
+    // then re-arms the event. `data` is only valid during the call.
+    using DeliverFn = std::function<void(void* context, const uint8_t* data, uint32_t len)>;
+    size_t Poll(size_t max_datagrams, const DeliverFn& deliver);
+
+private:
+    struct Functions;
+    struct Slot {
+        uintptr_t socket = ~(uintptr_t)0;
+        void* request_queue = nullptr;
+        void* context = nullptr;
+        // Bumped on close; completions of an earlier socket are ignored.
+        uint32_t generation = 0;
+        // Receives the kernel still holds. A closed slot is reused only
+        // once they have all completed, so the queue never overfills.
+        uint32_t outstanding = 0;
+        bool open = false;
+        bool commit = false;  // reposted receives awaiting a commit
+        bool listed = true;   // in free_slots_
+    };
+
+    bool PostReceive(uint32_t slot_index, uint32_t buffer, bool defer);
+    // Lists a closed slot as free once its last receive has completed,
+    // and only once however many paths get there.
+    void ReleaseSlot(uint32_t slot_index);
+
+    std::unique_ptr<Functions> fn_;
+    void* cq_ = nullptr;
+    uint8_t* buffer_ = nullptr;
+    void* buffer_id_ = nullptr;
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_slots_;
+    std::vector<uint32_t> commit_slots_;
+};
@@ -0,0 +1,117 @@
+#include "core/net/stream_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+StreamChunkPool::Chunk StreamChunkPool::Get() {
+    if (free_.empty()) return std::make_unique<uint8_t[]>(kChunkBytes);
+    Chunk chunk = std::move(free_.back());
+    free_.pop_back();
+    return chunk;
+}
+
+void StreamChunkPool::Put(Chunk chunk) {
+    if (free_.size() < kMaxFreeChunks) free_.push_back(std::move(chunk));
+}
+
+StreamBuffer::StreamBuffer(StreamBuffer&& other) noexcept
+    : pool_(other.pool_), chunks_(std::move(other.chunks_)),
+      head_(other.head_), size_(other.size_) {
+    other.chunks_.clear();
+    other.head_ = 0;
+    other.size_ = 0;
+}
+
+StreamChunkPool::Chunk StreamBuffer::NewChunk() {
+    return pool_ ? pool_->Get()
+                 : std::make_unique<uint8_t[]>(StreamChunkPool::kChunkBytes);
+}
+
+void StreamBuffer::Append(const void* data, size_t len) {
+    auto* src = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        StreamSpan span;
+        PrepareWrite(&span, 1, len);
+        memcpy(span.data, src, span.len);
+        Commit(span.len);
+        src += span.len;
+        len -= span.len;
+    }
+}
+
+size_t StreamBuffer::PrepareWrite(StreamSpan* spans, size_t max_spans,
+                                  size_t max_bytes) {
+    constexpr size_t kChunk = StreamChunkPool::kChunkBytes;
+    size_t count = 0;
+    size_t total = 0;
+
+    // Room left in the last chunk, then fresh chunks.
+    size_t tail = (head_ + size_) % kChunk;
+    size_t index = (head_ + size_) / kChunk;
+    while (count < max_spans && total < max_bytes) {
+        if (index >= chunks_.size()) chunks_.push_back(NewChunk());
+        size_t n = std::min(kChunk - tail, max_bytes - total);
+        spans[count++] = {chunks_[index].get() + tail, n};
+        total += n;
+        tail = 0;
+        index++;
+    }
+    return count;
+}
+
+void StreamBuffer::Commit(size_t len) {
+    size_ += len;
+    // Drop spare chunks PrepareWrite() added but the write did not reach.
+    size_t used = (head_ + size_ + StreamChunkPool::kChunkBytes - 1) /
+                  StreamChunkPool::kChunkBytes;
+    while (chunks_.size() > used) {
+        if (pool_) pool_->Put(std::move(chunks_.back()));
+        chunks_.pop_back();
+    }
+}
+
+size_t StreamBuffer::Peek(size_t offset, StreamSpan* spans, size_t max_spans,
+                          size_t max_bytes) const {
+    constexpr size_t kChunk = StreamChunkPool::kChunkBytes;
+    if (offset >= size_) return 0;
+    size_t remaining = std::min(size_ - offset, max_bytes);
+    size_t pos = head_ + offset;
+    size_t count = 0;
+    while (remaining > 0 && count < max_spans) {
+        size_t in_chunk = pos % kChunk;
+        size_t n = std::min(kChunk - in_chunk, remaining);
+        spans[count++] = {chunks_[pos / kChunk].get() + in_chunk, n};
+        pos += n;
+        remaining -= n;
+    }
+    return count;
+}
+
+void StreamBuffer::Consume(size_t len) {
+    len = std::min(len, size_);
+    head_ += len;
+    size_ -= len;
+    while (head_ >= StreamChunkPool::kChunkBytes ||
+           (size_ == 0 && !chunks_.empty())) {
+        if (pool_) pool_->Put(std::move(chunks_.front()));
+        chunks_.pop_front();
+        head_ = size_ == 0 ? 0 : head_ - StreamChunkPool::kChunkBytes;
+    }
+}
+
+void StreamBuffer::Clear() {
+    for (auto& chunk : chunks_) {
+        if (pool_) pool_->Put(std::move(chunk));
+    }
+    chunks_.clear();
+    head_ = 0;
+    size_ = 0;
+}
+
+std::vector<StreamChunkPool::Chunk> StreamBuffer::Detach() {
+    std::vector<StreamChunkPool::Chunk> out;
+    for (auto& chunk : chunks_) out.push_back(std::move(chunk));
+    chunks_.clear();
+    head_ = 0;
+    size_ = 0;
+    return out;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Fixed-size buffers recycled between the stream buffers of one thread.
+class StreamChunkPool {
+public:
+    static constexpr size_t kChunkBytes = 64 * 1024;
+    // Free chunks kept for reuse; the rest go back to the heap.
+    static constexpr size_t kMaxFreeChunks = 64;
+
+    using Chunk = std::unique_ptr<uint8_t[]>;
+
+    Chunk Get();
+    void Put(Chunk chunk);
+
+private:
+    std::vector<Chunk> free_;
+};
+
+// A contiguous piece of a StreamBuffer.
+struct StreamSpan {
+    uint8_t* data;
+    size_t len;
+};
+
+// Byte stream kept in pooled chunks. Appending never moves existing data
+// and consuming from the front only advances an offset, so bulk transfers
+// skip the reallocation and head compaction of a flat vector. Buffers are
+// exposed as spans for scatter/gather socket I/O and for handing memory to
+// lwIP by reference.
+class StreamBuffer {
+public:
+    explicit StreamBuffer(StreamChunkPool* pool = nullptr) : pool_(pool) {}
+    ~StreamBuffer() { Clear(); }
+
+    StreamBuffer(StreamBuffer&& other) noexcept;
+    StreamBuffer& operator=(StreamBuffer&&) = delete;
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    void SetPool(StreamChunkPool* pool) { pool_ = pool; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    void Append(const void* data, size_t len);
+
+    // Free space at the tail, at most `max_bytes` over up to `max_spans`
+    // spans, for a scatter read. Commit() then appends what was filled.
+    size_t PrepareWrite(StreamSpan* spans, size_t max_spans, size_t max_bytes);
+    void Commit(size_t len);
+
+    // Stored bytes starting `offset` into the stream, at most `max_bytes`
+    // over up to `max_spans` spans. Returns the span count.
+    size_t Peek(size_t offset, StreamSpan* spans, size_t max_spans,
+                size_t max_bytes) const;
+
+    void Consume(size_t len);
+    void Clear();
+
+    // Hands over the chunks without recycling them; for memory that must
+    // outlive this buffer.
+    std::vector<StreamChunkPool::Chunk> Detach();
+
+private:
+    StreamChunkPool::Chunk NewChunk();
+
+    StreamChunkPool* pool_;
+    std::deque<StreamChunkPool::Chunk> chunks_;
+    size_t head_ = 0;   // read offset into chunks_.front()
+    size_t size_ = 0;
+};
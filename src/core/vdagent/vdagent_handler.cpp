@@ -1,8 +1,8 @@
 #include "core/vdagent/vdagent_handler.h"
 #include "core/device/virtio/virtio_serial.h"
 #include "core/vmm/types.h"
-#include <cstring>
 #include <algorithm>
+#include <cstring>
 
 VDAgentHandler::VDAgentHandler() {
     // Initialize our capabilities
@@ -33,54 +33,172 @@ void VDAgentHandler::SetCapability(uint32_t* caps, VDAgentCap cap) {
     caps[word] |= (1u << bit);
 }
 
+void VDAgentHandler::OnPortOpen(bool opened) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A restarted agent starts a fresh stream both ways.
+    ResetReceiveLocked();
+    out_left_ = 0;
+    out_offset_ = 0;
+    deferred_.clear();
+    out_queue_.clear();
+    if (!opened) {
+        guest_caps_.clear();
+        guest_caps_received_ = false;
+    }
+}
+
+void VDAgentHandler::ResetReceiveLocked() {
+    chunk_header_got_ = 0;
+    chunk_left_ = 0;
+    msg_header_got_ = 0;
+    msg_left_ = 0;
+    msg_data_.clear();
+    clip_streaming_ = false;
+}
+
 void VDAgentHandler::OnDataReceived(const uint8_t* data, size_t len) {
     bool need_send_caps = false;
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
 
-        recv_buffer_.insert(recv_buffer_.end(), data, data + len);
-
-        while (true) {
-            if (recv_buffer_.size() < sizeof(VDAgentChunkHeader)) {
-                break;
+        while (len > 0) {
+            if (chunk_left_ == 0) {
+                size_t n = (std::min)(len, sizeof(chunk_header_) - chunk_header_got_);
+                std::memcpy(chunk_header_ + chunk_header_got_, data, n);
+                chunk_header_got_ += n;
+                data += n;
+                len -= n;
+                if (chunk_header_got_ < sizeof(chunk_header_)) break;
+
+                VDAgentChunkHeader chunk;
+                std::memcpy(&chunk, chunk_header_, sizeof(chunk));
+                chunk_header_got_ = 0;
+                chunk_left_ = chunk.size;
+                continue;
             }
 
-            VDAgentChunkHeader chunk;
-            std::memcpy(&chunk, recv_buffer_.data(), sizeof(chunk));
+            size_t n = (std::min)(len, static_cast<size_t>(chunk_left_));
+            ConsumeMessageBytesLocked(data, n, &need_send_caps);
+            chunk_left_ -= static_cast<uint32_t>(n);
+            data += n;
+            len -= n;
+        }
+    }
+
+    if (need_send_caps) {
+        SendAnnounceCapabilities();
+    }
+}
 
-            size_t total_size = sizeof(VDAgentChunkHeader) + chunk.size;
-            if (recv_buffer_.size() < total_size) {
-                break;
+void VDAgentHandler::ConsumeMessageBytesLocked(const uint8_t* data, size_t len,
+                                               bool* need_send_caps) {
+    while (len > 0) {
+        if (msg_header_got_ < sizeof(msg_header_)) {
+            size_t n = (std::min)(len, sizeof(msg_header_) - msg_header_got_);
+            std::memcpy(msg_header_ + msg_header_got_, data, n);
+            msg_header_got_ += n;
+            data += n;
+            len -= n;
+            if (msg_header_got_ < sizeof(msg_header_)) return;
+
+            std::memcpy(&msg_, msg_header_, sizeof(msg_));
+            msg_left_ = msg_.size;
+            msg_data_.clear();
+            clip_streaming_ = false;
+            clip_prefix_ = HasCapability(VD_AGENT_CAP_CLIPBOARD_SELECTION) ? 8 : 4;
+            msg_skip_ = msg_.type != VD_AGENT_CLIPBOARD && msg_.size > kMaxMessageSize;
+            if (msg_skip_) {
+                LOG_WARN("VDAgent: skipping %u-byte message type=%u", msg_.size, msg_.type);
             }
+            if (msg_left_ == 0) EndMessageLocked(need_send_caps);
+            continue;
+        }
+
+        size_t n = (std::min)(len, static_cast<size_t>(msg_left_));
+        if (msg_.type == VD_AGENT_CLIPBOARD) {
+            StreamClipboardLocked(data, n);
+        } else if (!msg_skip_) {
+            msg_data_.insert(msg_data_.end(), data, data + n);
+        }
+        msg_left_ -= static_cast<uint32_t>(n);
+        data += n;
+        len -= n;
+        if (msg_left_ == 0) EndMessageLocked(need_send_caps);
+    }
+}
+
+void VDAgentHandler::EndMessageLocked(bool* need_send_caps) {
+    msg_header_got_ = 0;
 
-            if (chunk.size >= sizeof(VDAgentMessage)) {
-                VDAgentMessage msg;
-                std::memcpy(&msg, recv_buffer_.data() + sizeof(VDAgentChunkHeader), sizeof(msg));
-
-                const uint8_t* msg_data = recv_buffer_.data() + sizeof(VDAgentChunkHeader) + sizeof(VDAgentMessage);
-
-                if (msg.type == VD_AGENT_ANNOUNCE_CAPABILITIES) {
-                    uint32_t request = 0;
-                    if (msg.size >= sizeof(uint32_t)) {
-                        std::memcpy(&request, msg_data, sizeof(request));
-                    }
-                    HandleAnnounceCapabilitiesLocked(msg_data, msg.size);
-                    if (request) {
-                        need_send_caps = true;
-                    }
-                } else {
-                    ProcessMessage(msg, msg_data);
-                }
+    if (msg_.type == VD_AGENT_CLIPBOARD) {
+        // The last piece, or the only one of an empty payload.
+        if (clip_streaming_ && (!msg_data_.empty() || clip_event_.total_size == 0)) {
+            FlushClipboardPieceLocked();
+        }
+        clip_streaming_ = false;
+    } else if (msg_skip_) {
+        // Nothing kept.
+    } else if (msg_.type == VD_AGENT_ANNOUNCE_CAPABILITIES) {
+        uint32_t request = 0;
+        if (msg_data_.size() >= sizeof(uint32_t)) {
+            std::memcpy(&request, msg_data_.data(), sizeof(request));
+        }
+        HandleAnnounceCapabilitiesLocked(msg_data_.data(), msg_.size);
+        if (request) {
+            *need_send_caps = true;
+        }
+    } else {
+        ProcessMessage(msg_, msg_data_.data());
+    }
+    msg_data_.clear();
+}
+
+void VDAgentHandler::StreamClipboardLocked(const uint8_t* data, size_t len) {
+    while (len > 0) {
+        if (!clip_streaming_) {
+            size_t n = (std::min)(len, clip_prefix_ - msg_data_.size());
+            msg_data_.insert(msg_data_.end(), data, data + n);
+            data += n;
+            len -= n;
+            if (msg_data_.size() < clip_prefix_) return;
+
+            clip_event_ = ClipboardEvent{};
+            clip_event_.type = ClipboardEvent::Type::kData;
+            if (clip_prefix_ == 8) {
+                clip_event_.selection = msg_data_[0];
+                std::memcpy(&clip_event_.data_type, msg_data_.data() + 4, sizeof(uint32_t));
+            } else {
+                clip_event_.selection = VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD;
+                std::memcpy(&clip_event_.data_type, msg_data_.data(), sizeof(uint32_t));
             }
+            clip_event_.total_size = msg_.size - clip_prefix_;
+            clip_streaming_ = true;
+            msg_data_.clear();
+
+            LOG_INFO("VDAgent: clipboard data, selection=%u, type=%u, size=%llu",
+                     clip_event_.selection, clip_event_.data_type,
+                     (unsigned long long)clip_event_.total_size);
+            continue;
+        }
 
-            recv_buffer_.erase(recv_buffer_.begin(), recv_buffer_.begin() + total_size);
+        size_t n = (std::min)(len, ClipboardEvent::kPieceSize - msg_data_.size());
+        msg_data_.insert(msg_data_.end(), data, data + n);
+        data += n;
+        len -= n;
+        if (msg_data_.size() == ClipboardEvent::kPieceSize) {
+            FlushClipboardPieceLocked();
         }
     }
+}
 
-    if (need_send_caps) {
-        SendAnnounceCapabilities();
+void VDAgentHandler::FlushClipboardPieceLocked() {
+    clip_event_.data.swap(msg_data_);
+    if (clipboard_callback_) {
+        clipboard_callback_(clip_event_);
     }
+    clip_event_.offset += clip_event_.data.size();
+    msg_data_.clear();
 }
 
 void VDAgentHandler::ProcessMessage(const VDAgentMessage& msg, const uint8_t* data) {
@@ -93,9 +211,6 @@ void VDAgentHandler::ProcessMessage(const VDAgentMessage& msg, const uint8_t* da
     case VD_AGENT_CLIPBOARD_GRAB:
         HandleClipboardGrab(data, msg.size);
         break;
-    case VD_AGENT_CLIPBOARD:
-        HandleClipboardData(data, msg.size);
-        break;
     case VD_AGENT_CLIPBOARD_REQUEST:
         HandleClipboardRequest(data, msg.size);
         break;
@@ -164,30 +279,6 @@ void VDAgentHandler::HandleClipboardGrab(const uint8_t* data, uint32_t size) {
     }
 }
 
-void VDAgentHandler::HandleClipboardData(const uint8_t* data, uint32_t size) {
-    ClipboardEvent event;
-    event.type = ClipboardEvent::Type::kData;
-
-    if (HasCapability(VD_AGENT_CAP_CLIPBOARD_SELECTION) && size >= 8) {
-        event.selection = data[0];
-        std::memcpy(&event.data_type, data + 4, sizeof(uint32_t));
-        event.data.assign(data + 8, data + size);
-    } else if (size >= 4) {
-        event.selection = VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD;
-        std::memcpy(&event.data_type, data, sizeof(uint32_t));
-        event.data.assign(data + 4, data + size);
-    } else {
-        return;
-    }
-
-    LOG_INFO("VDAgent: clipboard data, selection=%u, type=%u, size=%zu",
-             event.selection, event.data_type, event.data.size());
-
-    if (clipboard_callback_) {
-        clipboard_callback_(event);
-    }
-}
-
 void VDAgentHandler::HandleClipboardRequest(const uint8_t* data, uint32_t size) {
     ClipboardEvent event;
     event.type = ClipboardEvent::Type::kRequest;
@@ -230,12 +321,7 @@ void VDAgentHandler::HandleClipboardRelease(const uint8_t* data, uint32_t size)
 void VDAgentHandler::SendMessage(uint32_t type, const uint8_t* data, size_t len) {
     if (!serial_device_) return;
 
-    std::vector<uint8_t> buffer;
-    buffer.resize(sizeof(VDAgentChunkHeader) + sizeof(VDAgentMessage) + len);
-
-    VDAgentChunkHeader chunk;
-    chunk.port = 1;
-    chunk.size = static_cast<uint32_t>(sizeof(VDAgentMessage) + len);
+    std::vector<uint8_t> buffer(sizeof(VDAgentMessage) + len);
 
     VDAgentMessage msg;
     msg.protocol = VD_AGENT_PROTOCOL;
@@ -243,13 +329,62 @@ void VDAgentHandler::SendMessage(uint32_t type, const uint8_t* data, size_t len)
     msg.opaque = 0;
     msg.size = static_cast<uint32_t>(len);
 
-    std::memcpy(buffer.data(), &chunk, sizeof(chunk));
-    std::memcpy(buffer.data() + sizeof(chunk), &msg, sizeof(msg));
+    std::memcpy(buffer.data(), &msg, sizeof(msg));
     if (len > 0 && data) {
-        std::memcpy(buffer.data() + sizeof(chunk) + sizeof(msg), data, len);
+        std::memcpy(buffer.data() + sizeof(msg), data, len);
+    }
+
+    if (out_left_ > 0) {
+        deferred_.push_back(std::move(buffer));
+        return;
+    }
+    WriteStreamLocked(buffer.data(), buffer.size());
+}
+
+void VDAgentHandler::WriteStreamLocked(const uint8_t* data, size_t len) {
+    if (!serial_device_ || len == 0) return;
+
+    size_t chunks = (len + VD_AGENT_MAX_DATA_SIZE - 1) / VD_AGENT_MAX_DATA_SIZE;
+    std::vector<uint8_t> buffer;
+    buffer.reserve(len + chunks * sizeof(VDAgentChunkHeader));
+    while (len > 0) {
+        VDAgentChunkHeader chunk;
+        chunk.port = 1;
+        chunk.size = static_cast<uint32_t>((std::min)(len, static_cast<size_t>(VD_AGENT_MAX_DATA_SIZE)));
+        const uint8_t* header = reinterpret_cast<const uint8_t*>(&chunk);
+        buffer.insert(buffer.end(), header, header + sizeof(chunk));
+        buffer.insert(buffer.end(), data, data + chunk.size);
+        data += chunk.size;
+        len -= chunk.size;
+    }
+
+    out_queue_.push_back(std::move(buffer));
+    PumpLocked();
+}
+
+void VDAgentHandler::PumpLocked() {
+    // A little ahead of the guest at a time, so a big payload does not pile
+    // up in the port, and never more than the port takes whole.
+    while (serial_device_ && !out_queue_.empty() &&
+           serial_device_->QueuedBytes(port_id_) < kMaxGuestBacklog) {
+        const auto& buffer = out_queue_.front();
+        // Closed (OnPortOpen drops the rest) or paused for a snapshot
+        // (the drain callback comes on resume).
+        if (!serial_device_->SendData(port_id_, buffer.data(), buffer.size())) break;
+        out_queue_.pop_front();
     }
+}
 
-    serial_device_->SendData(port_id_, buffer.data(), buffer.size());
+void VDAgentHandler::OnPortDrained() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PumpLocked();
+}
+
+void VDAgentHandler::FlushDeferredLocked() {
+    for (const auto& message : deferred_) {
+        WriteStreamLocked(message.data(), message.size());
+    }
+    deferred_.clear();
 }
 
 void VDAgentHandler::SendAnnounceCapabilities() {
@@ -293,31 +428,72 @@ void VDAgentHandler::SendClipboardGrab(uint8_t selection,
 }
 
 void VDAgentHandler::SendClipboardData(uint8_t selection, uint32_t type,
-                                        const uint8_t* data_ptr, size_t len) {
+                                       uint64_t offset, uint64_t total,
+                                       const uint8_t* data_ptr, size_t len) {
     std::lock_guard<std::mutex> lock(mutex_);
 
     if (!guest_caps_received_) return;
 
-    std::vector<uint8_t> data;
+    if (offset == 0) {
+        if (out_left_ > 0) {
+            // The last payload was never finished; pad it out, the
+            // stream cannot skip it.
+            LOG_WARN("VDAgent: clipboard data cut short, %llu bytes padded",
+                     (unsigned long long)out_left_);
+            std::vector<uint8_t> zeros((std::min)(out_left_, uint64_t(ClipboardEvent::kPieceSize)));
+            while (out_left_ > 0) {
+                size_t n = static_cast<size_t>((std::min)(out_left_, uint64_t(zeros.size())));
+                WriteStreamLocked(zeros.data(), n);
+                out_left_ -= n;
+            }
+            FlushDeferredLocked();
+        }
+        if (total > ClipboardEvent::kMaxSize || len > total) {
+            LOG_WARN("VDAgent: clipboard data of %llu bytes not sent",
+                     (unsigned long long)total);
+            return;
+        }
 
-    if (HasCapability(VD_AGENT_CAP_CLIPBOARD_SELECTION)) {
-        data.resize(8 + len);
-        data[0] = selection;
-        data[1] = data[2] = data[3] = 0;
-        std::memcpy(data.data() + 4, &type, sizeof(type));
+        size_t prefix = HasCapability(VD_AGENT_CAP_CLIPBOARD_SELECTION) ? 8 : 4;
+        std::vector<uint8_t> head(sizeof(VDAgentMessage) + prefix + len);
+
+        VDAgentMessage msg;
+        msg.protocol = VD_AGENT_PROTOCOL;
+        msg.type = VD_AGENT_CLIPBOARD;
+        msg.opaque = 0;
+        msg.size = static_cast<uint32_t>(prefix + total);
+        std::memcpy(head.data(), &msg, sizeof(msg));
+
+        uint8_t* p = head.data() + sizeof(msg);
+        if (prefix == 8) {
+            p[0] = selection;
+            p[1] = p[2] = p[3] = 0;
+            std::memcpy(p + 4, &type, sizeof(type));
+        } else {
+            std::memcpy(p, &type, sizeof(type));
+        }
         if (len > 0 && data_ptr) {
-            std::memcpy(data.data() + 8, data_ptr, len);
+            std::memcpy(p + prefix, data_ptr, len);
         }
+
+        WriteStreamLocked(head.data(), head.size());
+        out_left_ = total - len;
+        LOG_INFO("VDAgent: sending clipboard data type=%u size=%llu",
+                 type, (unsigned long long)total);
     } else {
-        data.resize(4 + len);
-        std::memcpy(data.data(), &type, sizeof(type));
-        if (len > 0 && data_ptr) {
-            std::memcpy(data.data() + 4, data_ptr, len);
+        if (offset != out_offset_ || len > out_left_) {
+            LOG_WARN("VDAgent: clipboard piece at %llu out of order, dropped",
+                     (unsigned long long)offset);
+            return;
         }
+        WriteStreamLocked(data_ptr, len);
+        out_left_ -= len;
     }
+    out_offset_ = offset + len;
 
-    SendMessage(VD_AGENT_CLIPBOARD, data.data(), data.size());
-    LOG_INFO("VDAgent: sent clipboard data type=%u size=%zu", type, len);
+    if (out_left_ == 0) {
+        FlushDeferredLocked();
+    }
 }
 
 void VDAgentHandler::SendClipboardRequest(uint8_t selection, uint32_t type) {
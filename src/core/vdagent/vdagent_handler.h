@@ -3,6 +3,7 @@
 #include "common/ports.h"
 #include "core/vdagent/vdagent_protocol.h"
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -21,15 +22,24 @@ public:
     void SetSerialDevice(VirtioSerialDevice* device, uint32_t port_id);
     void SetClipboardCallback(ClipboardCallback cb) { clipboard_callback_ = std::move(cb); }
 
+    // Called when the guest opens/closes the port
+    void OnPortOpen(bool opened);
+
     // Process data received from guest
     void OnDataReceived(const uint8_t* data, size_t len);
 
+    // The port's queue to the guest moved on; sends what was held back.
+    void OnPortDrained();
+
     // Send clipboard grab to guest (notify of available types)
     void SendClipboardGrab(uint8_t selection, const std::vector<uint32_t>& types);
 
-    // Send clipboard data to guest
-    void SendClipboardData(uint8_t selection, uint32_t type,
-                           const uint8_t* data, size_t len);
+    // Send clipboard data to guest: the `len` bytes at `offset` of a
+    // `total`-byte payload. Pieces must come in order; offset 0 starts a
+    // new payload. Never waits: what the guest is not ready for yet is
+    // held here and goes out as it drains the port.
+    void SendClipboardData(uint8_t selection, uint32_t type, uint64_t offset,
+                           uint64_t total, const uint8_t* data, size_t len);
 
     // Request clipboard data from guest
     void SendClipboardRequest(uint8_t selection, uint32_t type);
@@ -45,11 +55,27 @@ private:
     void HandleAnnounceCapabilities(const uint8_t* data, uint32_t size);
     void HandleAnnounceCapabilitiesLocked(const uint8_t* data, uint32_t size);
     void HandleClipboardGrab(const uint8_t* data, uint32_t size);
-    void HandleClipboardData(const uint8_t* data, uint32_t size);
     void HandleClipboardRequest(const uint8_t* data, uint32_t size);
     void HandleClipboardRelease(const uint8_t* data, uint32_t size);
 
+    // Under mutex_. Chunk payloads make a byte stream of messages, each
+    // of which may span any number of chunks.
+    void ConsumeMessageBytesLocked(const uint8_t* data, size_t len, bool* need_send_caps);
+    void EndMessageLocked(bool* need_send_caps);
+    // VD_AGENT_CLIPBOARD is never held whole: its data goes to the
+    // callback a piece at a time.
+    void StreamClipboardLocked(const uint8_t* data, size_t len);
+    void FlushClipboardPieceLocked();
+    void ResetReceiveLocked();
+
     void SendMessage(uint32_t type, const uint8_t* data, size_t len);
+    // Under mutex_. Writes part of the message stream in chunks of at most
+    // VD_AGENT_MAX_DATA_SIZE.
+    void WriteStreamLocked(const uint8_t* data, size_t len);
+    // Under mutex_. Hands out_queue_ to the port while it is not too far
+    // behind.
+    void PumpLocked();
+    void FlushDeferredLocked();
 
     bool HasCapability(VDAgentCap cap) const;
     void SetCapability(uint32_t* caps, VDAgentCap cap);
@@ -58,9 +84,33 @@ private:
     uint32_t port_id_ = 0;
     ClipboardCallback clipboard_callback_;
 
-    // Message reassembly buffer
-    std::vector<uint8_t> recv_buffer_;
-    uint32_t expected_size_ = 0;
+    // Receive state: the chunk being read and the message inside it.
+    // Messages other than clipboard data are small and kept whole, up to
+    // kMaxMessageSize; bigger ones are skipped.
+    static constexpr uint32_t kMaxMessageSize = 64 * 1024;
+    uint8_t chunk_header_[sizeof(VDAgentChunkHeader)] = {};
+    size_t chunk_header_got_ = 0;
+    uint32_t chunk_left_ = 0;
+    uint8_t msg_header_[sizeof(VDAgentMessage)] = {};
+    size_t msg_header_got_ = 0;
+    VDAgentMessage msg_{};
+    uint32_t msg_left_ = 0;
+    bool msg_skip_ = false;
+    std::vector<uint8_t> msg_data_;
+    size_t clip_prefix_ = 0;       // selection and type, before the data
+    bool clip_streaming_ = false;  // prefix read, pieces going out
+    ClipboardEvent clip_event_;
+
+    // Send state: bytes of the clipboard payload being sent still to
+    // come. Other messages wait in deferred_ until it is done, as they
+    // cannot go in the middle of it.
+    // out_queue_ holds the chunked stream the port is not given yet while
+    // the guest has kMaxGuestBacklog of it to read.
+    static constexpr size_t kMaxGuestBacklog = 4 * 1024 * 1024;
+    uint64_t out_left_ = 0;
+    uint64_t out_offset_ = 0;
+    std::vector<std::vector<uint8_t>> deferred_;
+    std::deque<std::vector<uint8_t>> out_queue_;
 
     // Peer capabilities
     std::vector<uint32_t> guest_caps_;
@@ -69,7 +69,7 @@ enum VDAgentCap : uint32_t {
 // Chunk header for VD Agent protocol over virtio-serial
 struct VDAgentChunkHeader {
     uint32_t port;      // Always 1 for vdagent
-    uint32_t size;      // Size of the message (including VDAgentMessage header)
+    uint32_t size;      // Bytes of the message stream that follow
 };
 
 // VD Agent message header
@@ -133,4 +133,5 @@ struct VDAgentClipboardRelease {
 #pragma pack(pop)
 
 constexpr uint32_t VD_AGENT_PROTOCOL = 1;
-constexpr uint32_t VD_AGENT_MAX_DATA_SIZE = 1024 * 1024;  // 1MB max clipboard size
+// Largest chunk payload; longer messages span several chunks.
+constexpr uint32_t VD_AGENT_MAX_DATA_SIZE = 2048;
@@ -1,39 +1,130 @@
 #include "core/vmm/address_space.h"
+#include <algorithm>
+
+namespace {
+
+// Call `fn` with the device lock held, unless the device locks itself.
+template <typename Fn>
+void WithDeviceLock(Device* dev, Fn&& fn) {
+    std::mutex* lock = dev->IoLock();
+    if (!lock) {
+        fn();
+        return;
+    }
+    std::lock_guard<std::mutex> guard(*lock);
+    fn();
+}
+
+// Last entry whose base is <= addr, or end.
+template <typename Entry, typename Addr>
+const Entry* FindEntry(const std::vector<Entry>& entries, Addr addr) {
+    auto it = std::upper_bound(entries.begin(), entries.end(), addr,
+        [](Addr a, const Entry& e) { return a < e.base; });
+    if (it == entries.begin()) return nullptr;
+    --it;
+    if (static_cast<uint64_t>(addr) - it->base >= it->size) return nullptr;
+    return &*it;
+}
+
+template <typename Entry>
+bool InsertSorted(std::vector<Entry>& entries, const Entry& entry) {
+    auto it = std::lower_bound(entries.begin(), entries.end(), entry,
+        [](const Entry& a, const Entry& b) { return a.base < b.base; });
+    uint64_t end = static_cast<uint64_t>(entry.base) + entry.size;
+    if (it != entries.end() && it->base < end) return false;
+    if (it != entries.begin()) {
+        auto prev = std::prev(it);
+        if (static_cast<uint64_t>(prev->base) + prev->size > entry.base) return false;
+    }
+    entries.insert(it, entry);
+    return true;
+}
+
+}  // namespace
+
+AddressSpace::AddressSpace() {
+    Publish(std::make_unique<DeviceMap>());
+}
+
+void AddressSpace::Publish(std::unique_ptr<DeviceMap> map) {
+    map_.store(map.get(), std::memory_order_release);
+    maps_.push_back(std::move(map));
+}
 
 void AddressSpace::AddPioDevice(uint16_t base, uint16_t size, Device* device) {
-    pio_devices_.push_back({base, size, device});
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    auto map = std::make_unique<DeviceMap>(*map_.load(std::memory_order_acquire));
+    if (!InsertSorted(map->pio, PioEntry{base, size, device})) {
+        LOG_WARN("AddressSpace: PIO 0x%X+0x%X overlaps an existing device",
+                 base, size);
+        return;
+    }
+    Publish(std::move(map));
 }
 
 void AddressSpace::AddMmioDevice(uint64_t base, uint64_t size, Device* device) {
-    mmio_devices_.push_back({base, size, device});
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    auto map = std::make_unique<DeviceMap>(*map_.load(std::memory_order_acquire));
+    if (!InsertSorted(map->mmio, MmioEntry{base, size, device})) {
+        LOG_WARN("AddressSpace: MMIO 0x%llX+0x%llX overlaps an existing device",
+                 base, size);
+        return;
+    }
+    Publish(std::move(map));
 }
 
-Device* AddressSpace::FindPioDevice(uint16_t port, uint16_t* offset) const {
-    for (auto& entry : pio_devices_) {
-        if (port >= entry.base && port < entry.base + entry.size) {
-            *offset = port - entry.base;
-            return entry.device;
-        }
+void AddressSpace::AddIoEvent(uint64_t addr, IoEventSink* sink) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    auto map = std::make_unique<DeviceMap>(*map_.load(std::memory_order_acquire));
+    auto& events = map->ioevents;
+    auto it = std::lower_bound(events.begin(), events.end(), addr,
+        [](const IoEventEntry& e, uint64_t a) { return e.base < a; });
+    if (it != events.end() && it->base == addr) {
+        LOG_WARN("AddressSpace: ioevent at 0x%llX already registered", addr);
+        return;
     }
-    return nullptr;
+    events.insert(it, IoEventEntry{addr, sink});
+    Publish(std::move(map));
+}
+
+IoEventSink* AddressSpace::FindIoEvent(uint64_t addr) const {
+    const DeviceMap* map = map_.load(std::memory_order_acquire);
+    const auto& events = map->ioevents;
+    auto it = std::lower_bound(events.begin(), events.end(), addr,
+        [](const IoEventEntry& e, uint64_t a) { return e.base < a; });
+    if (it == events.end() || it->base != addr) return nullptr;
+    return it->sink;
+}
+
+Device* AddressSpace::FindPioDevice(uint16_t port, uint16_t* offset) const {
+    const DeviceMap* map = map_.load(std::memory_order_acquire);
+    const PioEntry* entry = FindEntry(map->pio, port);
+    if (!entry) return nullptr;
+    *offset = port - entry->base;
+    return entry->device;
 }
 
 Device* AddressSpace::FindMmioDevice(uint64_t addr, uint64_t* offset) const {
-    for (auto& entry : mmio_devices_) {
-        if (addr >= entry.base && addr < entry.base + entry.size) {
-            *offset = addr - entry.base;
-            return entry.device;
-        }
-    }
-    return nullptr;
+    const DeviceMap* map = map_.load(std::memory_order_acquire);
+    const MmioEntry* entry = FindEntry(map->mmio, addr);
+    if (!entry) return nullptr;
+    *offset = addr - entry->base;
+    return entry->device;
+}
+
+bool AddressSpace::FindMmioRegion(uint64_t addr, uint64_t* base) const {
+    const DeviceMap* map = map_.load(std::memory_order_acquire);
+    const MmioEntry* entry = FindEntry(map->mmio, addr);
+    if (!entry) return false;
+    *base = entry->base;
+    return true;
 }
 
 bool AddressSpace::HandlePortIn(uint16_t port, uint8_t size, uint32_t* value) {
-    std::lock_guard<std::mutex> lock(io_mutex_);
     uint16_t offset = 0;
     Device* dev = FindPioDevice(port, &offset);
     if (dev) {
-        dev->PioRead(offset, size, value);
+        WithDeviceLock(dev, [&] { dev->PioRead(offset, size, value); });
         return true;
     }
     *value = 0xFFFFFFFF;
@@ -42,11 +133,10 @@ bool AddressSpace::HandlePortIn(uint16_t port, uint8_t size, uint32_t* value) {
 }
 
 bool AddressSpace::HandlePortOut(uint16_t port, uint8_t size, uint32_t value) {
-    std::lock_guard<std::mutex> lock(io_mutex_);
     uint16_t offset = 0;
     Device* dev = FindPioDevice(port, &offset);
     if (dev) {
-        dev->PioWrite(offset, size, value);
+        WithDeviceLock(dev, [&] { dev->PioWrite(offset, size, value); });
         return true;
     }
     LOG_DEBUG("Unhandled PIO write: port=0x%X size=%u val=0x%X",
@@ -55,12 +145,12 @@ bool AddressSpace::HandlePortOut(uint16_t port, uint8_t size, uint32_t value) {
 }
 
 bool AddressSpace::HandleMmioRead(uint64_t addr, uint8_t size,
-                                   uint64_t* value) {
-    std::lock_guard<std::mutex> lock(io_mutex_);
+                                   uint64_t* value, uint64_t* base) {
     uint64_t offset = 0;
     Device* dev = FindMmioDevice(addr, &offset);
     if (dev) {
-        dev->MmioRead(offset, size, value);
+        if (base) *base = addr - offset;
+        WithDeviceLock(dev, [&] { dev->MmioRead(offset, size, value); });
         return true;
     }
     *value = 0;
@@ -69,12 +159,12 @@ bool AddressSpace::HandleMmioRead(uint64_t addr, uint8_t size,
 }
 
 bool AddressSpace::HandleMmioWrite(uint64_t addr, uint8_t size,
-                                    uint64_t value) {
-    std::lock_guard<std::mutex> lock(io_mutex_);
+                                    uint64_t value, uint64_t* base) {
     uint64_t offset = 0;
     Device* dev = FindMmioDevice(addr, &offset);
     if (dev) {
-        dev->MmioWrite(offset, size, value);
+        if (base) *base = addr - offset;
+        WithDeviceLock(dev, [&] { dev->MmioWrite(offset, size, value); });
         return true;
     }
     LOG_DEBUG("Unhandled MMIO write: addr=0x%llX size=%u val=0x%llX",
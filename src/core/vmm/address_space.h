@@ -1,7 +1,10 @@
 #pragma once
 
 #include "core/vmm/types.h"
+#include "core/vmm/guest_ram.h"
 #include "core/device/device.h"
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <mutex>
 
@@ -17,21 +20,58 @@ struct MmioEntry {
     Device*  device;
 };
 
+struct IoEventEntry {
+    uint64_t     base;   // exact GPA of the doorbell register
+    IoEventSink* sink;
+};
+
+// Exit dispatch takes no global lock. Lookups read an immutable snapshot of
+// the device map through one atomic pointer; registration builds a new
+// snapshot and swaps it in. Each device is serialized on its own IoLock().
 class AddressSpace {
 public:
+    AddressSpace();
+
     void AddPioDevice(uint16_t base, uint16_t size, Device* device);
     void AddMmioDevice(uint64_t base, uint64_t size, Device* device);
+    // Routes guest writes to `addr` to `sink` instead of the MMIO device
+    // covering it. Only the exit fast path consults this table.
+    void AddIoEvent(uint64_t addr, IoEventSink* sink);
+    IoEventSink* FindIoEvent(uint64_t addr) const;
+    // Base of the MMIO device covering `addr`, for attributing exits.
+    bool FindMmioRegion(uint64_t addr, uint64_t* base) const;
+
+    // Guest RAM committed on demand, if any. Set before any vCPU runs.
+    void SetLazyRam(LazyGuestRam* ram) { lazy_ram_ = ram; }
+    RamFault HandleRamFault(uint64_t gpa) {
+        return lazy_ram_ ? lazy_ram_->HandleGuestFault(gpa) : RamFault::kNotRam;
+    }
 
     bool HandlePortIn(uint16_t port, uint8_t size, uint32_t* value);
     bool HandlePortOut(uint16_t port, uint8_t size, uint32_t value);
-    bool HandleMmioRead(uint64_t addr, uint8_t size, uint64_t* value);
-    bool HandleMmioWrite(uint64_t addr, uint8_t size, uint64_t value);
+    // |base|, if given, gets the base of the device that took the access.
+    bool HandleMmioRead(uint64_t addr, uint8_t size, uint64_t* value,
+                        uint64_t* base = nullptr);
+    bool HandleMmioWrite(uint64_t addr, uint8_t size, uint64_t value,
+                         uint64_t* base = nullptr);
 
 private:
+    // One published version of the device map. Entries are sorted by base
+    // and never overlap.
+    struct DeviceMap {
+        std::vector<PioEntry>  pio;
+        std::vector<MmioEntry> mmio;
+        std::vector<IoEventEntry> ioevents;
+    };
+
     Device* FindPioDevice(uint16_t port, uint16_t* offset) const;
     Device* FindMmioDevice(uint64_t addr, uint64_t* offset) const;
+    void Publish(std::unique_ptr<DeviceMap> map);
 
-    mutable std::mutex io_mutex_;
-    std::vector<PioEntry>  pio_devices_;
-    std::vector<MmioEntry> mmio_devices_;
+    std::atomic<const DeviceMap*> map_{nullptr};
+    LazyGuestRam* lazy_ram_ = nullptr;
+    // Writers only. Superseded maps are kept until destruction since a vCPU
+    // may still be reading one; registration happens a few dozen times per VM.
+    std::mutex update_mutex_;
+    std::vector<std::unique_ptr<DeviceMap>> maps_;
 };
@@ -0,0 +1,296 @@
+#include "core/vmm/cpu_placement.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <utility>
+
+#define NOMINMAX
+#include <windows.h>
+
+namespace {
+
+struct HostCpu {
+    uint32_t id;          // CPU set id
+    uint16_t group;
+    uint8_t core;         // physical core within the group
+    uint8_t node;
+    uint8_t efficiency;   // higher is faster
+};
+
+std::vector<HostCpu> QueryHostCpus() {
+    ULONG len = 0;
+    GetSystemCpuSetInformation(nullptr, 0, &len, GetCurrentProcess(), 0);
+    std::vector<uint8_t> buf(len);
+    if (!len || !GetSystemCpuSetInformation(
+            reinterpret_cast<PSYSTEM_CPU_SET_INFORMATION>(buf.data()), len, &len,
+            GetCurrentProcess(), 0)) {
+        return {};
+    }
+
+    std::vector<HostCpu> cpus;
+    for (ULONG offset = 0; offset < len;) {
+        auto* info = reinterpret_cast<const SYSTEM_CPU_SET_INFORMATION*>(buf.data() + offset);
+        if (!info->Size) break;
+        offset += info->Size;
+        if (info->Type != CpuSetInformation) continue;
+        const auto& set = info->CpuSet;
+        // Sets reserved for real-time work are not ours to use.
+        if (set.RealTime) continue;
+        cpus.push_back({static_cast<uint32_t>(set.Id), set.Group, set.CoreIndex,
+                        set.NumaNodeIndex, set.EfficiencyClass});
+    }
+    // Fastest first; within a class, by node and core so siblings sit together.
+    std::stable_sort(cpus.begin(), cpus.end(), [](const HostCpu& a, const HostCpu& b) {
+        if (a.efficiency != b.efficiency) return a.efficiency > b.efficiency;
+        if (a.node != b.node) return a.node < b.node;
+        if (a.group != b.group) return a.group < b.group;
+        return a.core < b.core;
+    });
+    return cpus;
+}
+
+std::vector<uint32_t> Ids(const std::vector<HostCpu>& cpus) {
+    std::vector<uint32_t> ids;
+    ids.reserve(cpus.size());
+    for (const auto& c : cpus) ids.push_back(c.id);
+    return ids;
+}
+
+} // namespace
+
+bool ParseVCpuPlacement(const std::string& name, VCpuPlacement* out) {
+    static const std::pair<const char*, VCpuPlacement> kNames[] = {
+        {"none", VCpuPlacement::kNone},
+        {"performance", VCpuPlacement::kPerformance},
+        {"spread", VCpuPlacement::kSpread},
+        {"numa", VCpuPlacement::kNumaNode},
+    };
+    for (const auto& [n, p] : kNames) {
+        if (name == n) {
+            *out = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* VCpuPlacementName(VCpuPlacement placement) {
+    switch (placement) {
+    case VCpuPlacement::kPerformance: return "performance";
+    case VCpuPlacement::kSpread:      return "spread";
+    case VCpuPlacement::kNumaNode:    return "numa";
+    default:                          return "none";
+    }
+}
+
+bool ParseNumaMemory(const std::string& name, NumaMemory* out) {
+    static const std::pair<const char*, NumaMemory> kNames[] = {
+        {"none", NumaMemory::kNone},
+        {"local", NumaMemory::kLocal},
+        {"split", NumaMemory::kSplit},
+    };
+    for (const auto& [n, p] : kNames) {
+        if (name == n) {
+            *out = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* NumaMemoryName(NumaMemory numa) {
+    switch (numa) {
+    case NumaMemory::kLocal: return "local";
+    case NumaMemory::kSplit: return "split";
+    default:                 return "none";
+    }
+}
+
+bool CpuPlacement::Plan(VCpuPlacement policy, uint32_t vcpu_count,
+                        uint32_t io_thread_count) {
+    vcpu_sets_.clear();
+    io_thread_sets_.clear();
+    vm_set_.clear();
+    host_nodes_.clear();
+    if (policy == VCpuPlacement::kNone) return false;
+
+    std::vector<HostCpu> cpus = QueryHostCpus();
+    if (cpus.empty()) {
+        LOG_WARN("vCPU placement: host CPU sets unavailable");
+        return false;
+    }
+    uint8_t best = cpus.front().efficiency;
+    std::vector<HostCpu> fast;
+    for (const auto& c : cpus) {
+        if (c.efficiency == best) fast.push_back(c);
+    }
+
+    switch (policy) {
+    case VCpuPlacement::kPerformance:
+        if (fast.size() == cpus.size()) {
+            LOG_INFO("vCPU placement: host has a single core class, nothing to avoid");
+            return false;
+        }
+        vm_set_ = Ids(fast);
+        vcpu_sets_.assign(vcpu_count, vm_set_);
+        break;
+
+    case VCpuPlacement::kSpread: {
+        // First logical processor of every physical core, in sorted order.
+        std::set<std::pair<uint16_t, uint8_t>> seen;
+        std::vector<HostCpu> cores;
+        for (const auto& c : cpus) {
+            if (seen.insert({c.group, c.core}).second) cores.push_back(c);
+        }
+        std::set<std::pair<uint16_t, uint8_t>> used;
+        for (uint32_t i = 0; i < vcpu_count; i++) {
+            const HostCpu& c = cores[i % cores.size()];
+            vcpu_sets_.push_back({c.id});
+            used.insert({c.group, c.core});
+        }
+        // Other threads share the cores the vCPUs run on, siblings included.
+        for (const auto& c : cpus) {
+            if (used.count({c.group, c.core})) vm_set_.push_back(c.id);
+        }
+        if (vcpu_count > cores.size()) {
+            LOG_WARN("vCPU placement: %u vCPUs on %zu cores, some share a core",
+                     vcpu_count, cores.size());
+        }
+        // I/O threads next, one core each while free ones last, siblings
+        // included so nothing else of the VM lands there.
+        for (uint32_t i = 0; i < io_thread_count; i++) {
+            std::vector<uint32_t> set;
+            size_t core = vcpu_count + static_cast<size_t>(i);
+            if (core < cores.size()) {
+                for (const auto& c : cpus) {
+                    if (c.group == cores[core].group && c.core == cores[core].core) {
+                        set.push_back(c.id);
+                    }
+                }
+            }
+            io_thread_sets_.push_back(std::move(set));
+        }
+        if (io_thread_count && vcpu_count + io_thread_count > cores.size()) {
+            LOG_INFO("vCPU placement: not enough free cores, some I/O threads "
+                     "share the vCPUs' cores");
+        }
+        break;
+    }
+
+    case VCpuPlacement::kNumaNode: {
+        // The node with the most of the fastest cores.
+        std::set<uint8_t> nodes;
+        for (const auto& c : cpus) nodes.insert(c.node);
+        if (nodes.size() == 1) {
+            LOG_INFO("vCPU placement: host has a single NUMA node");
+            return false;
+        }
+        std::map<uint8_t, size_t> fast_per_node;
+        for (const auto& c : fast) fast_per_node[c.node]++;
+        auto node = std::max_element(fast_per_node.begin(), fast_per_node.end(),
+            [](const auto& a, const auto& b) { return a.second < b.second; })->first;
+        for (const auto& c : cpus) {
+            if (c.node == node) vm_set_.push_back(c.id);
+        }
+        vcpu_sets_.assign(vcpu_count, vm_set_);
+        host_nodes_.push_back(node);
+        LOG_INFO("vCPU placement: NUMA node %u (%zu logical processors)", node,
+                 vm_set_.size());
+        break;
+    }
+
+    default:
+        return false;
+    }
+
+    LOG_INFO("vCPU placement: %s, %zu of %zu logical processors",
+             VCpuPlacementName(policy), vm_set_.size(), cpus.size());
+    return true;
+}
+
+bool CpuPlacement::PlanNodes(uint32_t max_nodes, uint32_t vcpu_count,
+                             uint32_t io_thread_count) {
+    vcpu_sets_.clear();
+    io_thread_sets_.clear();
+    vm_set_.clear();
+    host_nodes_.clear();
+
+    std::vector<HostCpu> cpus = QueryHostCpus();
+    if (cpus.empty()) {
+        LOG_WARN("NUMA placement: host CPU sets unavailable");
+        return false;
+    }
+    // Nodes by their count of the fastest cores, then by number.
+    uint8_t best = cpus.front().efficiency;
+    std::map<uint8_t, size_t> fast_per_node;
+    for (const auto& c : cpus) {
+        fast_per_node.emplace(c.node, 0);
+        if (c.efficiency == best) fast_per_node[c.node]++;
+    }
+    if (fast_per_node.size() == 1) {
+        LOG_INFO("NUMA placement: host has a single NUMA node");
+        return false;
+    }
+    std::vector<std::pair<uint8_t, size_t>> nodes(fast_per_node.begin(), fast_per_node.end());
+    std::stable_sort(nodes.begin(), nodes.end(),
+        [](const auto& a, const auto& b) { return a.second > b.second; });
+    nodes.resize(std::min<size_t>(nodes.size(), std::max(max_nodes, 1u)));
+    if (nodes.size() == 1) {
+        LOG_INFO("NUMA placement: room for one guest node only");
+        return false;
+    }
+
+    std::vector<std::vector<uint32_t>> node_sets;
+    for (const auto& [node, fast_count] : nodes) {
+        std::vector<uint32_t> set;
+        for (const auto& c : cpus) {
+            if (c.node == node) set.push_back(c.id);
+        }
+        vm_set_.insert(vm_set_.end(), set.begin(), set.end());
+        node_sets.push_back(std::move(set));
+        host_nodes_.push_back(node);
+    }
+    for (uint32_t i = 0; i < vcpu_count; i++) {
+        vcpu_sets_.push_back(node_sets[i % node_sets.size()]);
+    }
+    for (uint32_t i = 0; i < io_thread_count; i++) {
+        io_thread_sets_.push_back(node_sets[i % node_sets.size()]);
+    }
+
+    LOG_INFO("NUMA placement: %zu guest nodes", host_nodes_.size());
+    for (size_t i = 0; i < host_nodes_.size(); i++) {
+        LOG_INFO("  guest node %zu: host node %u (%zu logical processors)", i,
+                 host_nodes_[i], node_sets[i].size());
+    }
+    return true;
+}
+
+void CpuPlacement::ApplyToProcess() const {
+    if (vm_set_.empty()) return;
+    std::vector<ULONG> ids(vm_set_.begin(), vm_set_.end());
+    if (!SetProcessDefaultCpuSets(GetCurrentProcess(), ids.data(),
+                                  static_cast<ULONG>(ids.size()))) {
+        LOG_WARN("vCPU placement: SetProcessDefaultCpuSets failed (%lu)", GetLastError());
+    }
+}
+
+void CpuPlacement::ApplyToVCpu(uint32_t index) const {
+    if (index >= vcpu_sets_.size()) return;
+    std::vector<ULONG> ids(vcpu_sets_[index].begin(), vcpu_sets_[index].end());
+    if (!SetThreadSelectedCpuSets(GetCurrentThread(), ids.data(),
+                                  static_cast<ULONG>(ids.size()))) {
+        LOG_WARN("vCPU %u: SetThreadSelectedCpuSets failed (%lu)", index, GetLastError());
+    }
+}
+
+void CpuPlacement::ApplyToIoThread(uint32_t index) const {
+    if (index >= io_thread_sets_.size() || io_thread_sets_[index].empty()) return;
+    const auto& set = io_thread_sets_[index];
+    std::vector<ULONG> ids(set.begin(), set.end());
+    if (!SetThreadSelectedCpuSets(GetCurrentThread(), ids.data(),
+                                  static_cast<ULONG>(ids.size()))) {
+        LOG_WARN("I/O thread %u: SetThreadSelectedCpuSets failed (%lu)", index,
+                 GetLastError());
+    }
+}
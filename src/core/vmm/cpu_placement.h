@@ -0,0 +1,70 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where the threads of a VM may run on the host.
+enum class VCpuPlacement : uint8_t {
+    kNone,         // wherever the scheduler likes
+    kPerformance,  // only the most performant core class (P-cores on hybrid CPUs)
+    kSpread,       // each vCPU pinned to its own physical core, best cores first
+    kNumaNode,     // everything on the one NUMA node with the best cores
+};
+
+// Parses "none", "performance", "spread" or "numa".
+bool ParseVCpuPlacement(const std::string& name, VCpuPlacement* out);
+const char* VCpuPlacementName(VCpuPlacement placement);
+
+// Which host NUMA nodes guest RAM comes from.
+enum class NumaMemory : uint8_t {
+    kNone,   // wherever the allocating thread happens to run
+    kLocal,  // the node the VM's threads are placed on (implies numa placement)
+    kSplit,  // a guest node per host node, each with its share of RAM and vCPUs
+};
+
+// Parses "none", "local" or "split".
+bool ParseNumaMemory(const std::string& name, NumaMemory* out);
+const char* NumaMemoryName(NumaMemory numa);
+
+// Turns a placement policy into Windows CPU sets, which span processor
+// groups and leave the scheduler free to move threads within the set.
+// vCPU threads get a set each; every other thread of the runtime (network,
+// block I/O, device workers) gets the VM's whole set through the process
+// default, so it follows the vCPUs without knowing about placement.
+// Under spread, I/O threads get a physical core each from those the vCPUs
+// left over, and share the VM's set when there are none.
+class CpuPlacement {
+public:
+    // Plans `policy` for `vcpu_count` vCPUs and `io_thread_count` I/O
+    // threads on this host. False if the host offers nothing to choose
+    // between; the threads are then left alone.
+    bool Plan(VCpuPlacement policy, uint32_t vcpu_count, uint32_t io_thread_count = 0);
+    // Plans a guest node for each of up to `max_nodes` host nodes, the
+    // nodes with the fastest cores first. vCPU and I/O thread `i` run on
+    // guest node i % node_count(). False on a single-node host.
+    bool PlanNodes(uint32_t max_nodes, uint32_t vcpu_count, uint32_t io_thread_count = 0);
+
+    // Host NUMA node behind each guest node: one under kNumaNode, one per
+    // guest node after PlanNodes, none otherwise.
+    uint32_t node_count() const { return static_cast<uint32_t>(host_nodes_.size()); }
+    uint32_t HostNode(uint32_t guest_node) const { return host_nodes_[guest_node]; }
+    // Guest node of vCPU `index`; 0 when nodes were not planned.
+    uint32_t VCpuNode(uint32_t index) const {
+        return host_nodes_.size() > 1 ? index % node_count() : 0;
+    }
+
+    // Restricts all threads of the process that have no set of their own.
+    void ApplyToProcess() const;
+    // Restricts the calling thread, which runs vCPU `index`.
+    void ApplyToVCpu(uint32_t index) const;
+    // Restricts the calling thread, which is I/O thread `index`.
+    void ApplyToIoThread(uint32_t index) const;
+
+private:
+    std::vector<std::vector<uint32_t>> vcpu_sets_;
+    std::vector<std::vector<uint32_t>> io_thread_sets_;  // empty = VM's set
+    std::vector<uint32_t> vm_set_;
+    std::vector<uint32_t> host_nodes_;
+};
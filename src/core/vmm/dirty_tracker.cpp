@@ -0,0 +1,142 @@
+#include "core/vmm/dirty_tracker.h"
+#include "core/vmm/guest_ram.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+
+constexpr uint64_t kPagesPerWord = 64;
+
+} // namespace
+
+void DirtyTracker::Init(const GuestMemMap& mem, QueryCallback query) {
+    mem_ = mem;
+    query_ = std::move(query);
+    uint64_t pages = mem.alloc_size / kPageSize;
+    words_count_ = (pages + kPagesPerWord - 1) / kPagesPerWord;
+    words_ = std::make_unique<std::atomic<uint64_t>[]>(words_count_);
+    host_words_ = std::make_unique<std::atomic<uint64_t>[]>(words_count_);
+    for (uint64_t i = 0; i < words_count_; i++) {
+        words_[i].store(~0ULL, std::memory_order_relaxed);
+        host_words_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void DirtyTracker::MarkGpa(GPA gpa, uint64_t len) {
+    if (!len) return;
+    if (gpa < mem_.low_size) {
+        MarkOffset(gpa, std::min(len, mem_.low_size - gpa));
+    } else if (mem_.high_size && gpa >= mem_.high_base &&
+               gpa - mem_.high_base < mem_.high_size) {
+        uint64_t offset = mem_.low_size + (gpa - mem_.high_base);
+        MarkOffset(offset, std::min(len, mem_.alloc_size - offset));
+    }
+}
+
+void DirtyTracker::MarkOffset(uint64_t offset, uint64_t len) {
+    if (!len || offset >= mem_.alloc_size) return;
+    uint64_t first = offset / kPageSize;
+    uint64_t last = (std::min(offset + len, mem_.alloc_size) - 1) / kPageSize;
+    uint64_t added = 0;
+    bool log = log_host_writes_.load(std::memory_order_acquire);
+    for (uint64_t page = first; page <= last;) {
+        uint64_t word = page / kPagesPerWord;
+        uint64_t bit = page % kPagesPerWord;
+        uint64_t count = std::min(kPagesPerWord - bit, last - page + 1);
+        uint64_t mask = count == kPagesPerWord ? ~0ULL : ((1ULL << count) - 1) << bit;
+        // Buffers are mostly remarked while still dirty; skip the RMW then.
+        uint64_t old = words_[word].load(std::memory_order_relaxed);
+        if ((old & mask) != mask) {
+            old = words_[word].fetch_or(mask, std::memory_order_relaxed);
+            added += std::popcount(mask & ~old);
+        }
+        if (log) host_words_[word].fetch_or(mask, std::memory_order_relaxed);
+        page += count;
+    }
+    if (added) dirtied_pages_.fetch_add(added, std::memory_order_relaxed);
+}
+
+bool DirtyTracker::QueryRange(uint64_t offset, uint64_t len) {
+    // Ranges start on a region or chunk boundary, both whole words of
+    // pages, so the returned bitmap lines up with words_.
+    uint64_t first = offset / kPageSize / kPagesPerWord;
+    uint64_t count = (len / kPageSize + kPagesPerWord - 1) / kPagesPerWord;
+    scratch_.assign(count, 0);
+    if (!query_(OffsetToGpa(offset), len, scratch_.data(),
+                static_cast<uint32_t>(count * sizeof(uint64_t)))) {
+        return false;
+    }
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (!scratch_[i]) continue;
+        words_[first + i].fetch_or(scratch_[i], std::memory_order_relaxed);
+        found += std::popcount(scratch_[i]);
+    }
+    if (found) dirtied_pages_.fetch_add(found, std::memory_order_relaxed);
+    return true;
+}
+
+bool DirtyTracker::Collect() {
+    if (!words_) return true;
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    bool ok = true;
+    if (!mem_.lazy) {
+        ok = QueryRange(0, mem_.low_size);
+        if (mem_.high_size) ok = QueryRange(mem_.low_size, mem_.high_size) && ok;
+        return ok;
+    }
+
+    // Only committed chunks are mapped. Runs of them are queried together,
+    // but never across the MMIO gap.
+    constexpr uint64_t kChunk = LazyGuestRam::kChunkSize;
+    uint64_t run = 0, run_len = 0;
+    for (uint64_t offset = 0; offset < mem_.alloc_size; offset += kChunk) {
+        uint64_t len = std::min(kChunk, mem_.alloc_size - offset);
+        bool mapped = mem_.lazy->IsCommitted(offset);
+        if (run_len && (!mapped || offset == mem_.low_size)) {
+            ok = QueryRange(run, run_len) && ok;
+            run_len = 0;
+        }
+        if (!mapped) continue;
+        if (!run_len) run = offset;
+        run_len += len;
+    }
+    if (run_len) ok = QueryRange(run, run_len) && ok;
+    return ok;
+}
+
+bool DirtyTracker::Take(std::vector<uint64_t>* bitmap) {
+    if (!Collect()) return false;
+    bitmap->resize(words_count_);
+    for (uint64_t i = 0; i < words_count_; i++) {
+        (*bitmap)[i] = words_[i].exchange(0, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+uint64_t DirtyTracker::DirtyCount() {
+    if (!Collect()) return UINT64_MAX;
+    uint64_t pages = 0;
+    for (uint64_t i = 0; i < words_count_; i++) {
+        pages += std::popcount(words_[i].load(std::memory_order_relaxed));
+    }
+    return pages;
+}
+
+void DirtyTracker::LogHostWrites(bool on) {
+    if (!words_) return;
+    if (on) {
+        for (uint64_t i = 0; i < words_count_; i++) {
+            host_words_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    log_host_writes_.store(on, std::memory_order_release);
+}
+
+void DirtyTracker::TakeHostWrites(std::vector<uint64_t>* bitmap) {
+    bitmap->resize(words_count_);
+    for (uint64_t i = 0; i < words_count_; i++) {
+        (*bitmap)[i] |= host_words_ ? host_words_[i].exchange(0, std::memory_order_relaxed) : 0;
+    }
+}
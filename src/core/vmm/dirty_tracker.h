@@ -0,0 +1,84 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Guest RAM pages written since the last checkpoint, one bit per page,
+// indexed by offset into the RAM allocation as GuestMemMap lays it out.
+// Incremental snapshots write only these.
+//
+// Guest writes are tracked by the hypervisor and pulled in by Collect().
+// It does not see the host's own stores, so code writing guest RAM on the
+// guest's behalf (virtqueue buffers, rings, kvmclock) reports them with
+// MarkGpa().
+class DirtyTracker {
+public:
+    // Reads and clears the hypervisor's dirty bits for [gpa, gpa+size), one
+    // bit per page from bit 0 of bitmap[0]. Only called on mapped RAM.
+    using QueryCallback = std::function<bool(GPA gpa, uint64_t size, uint64_t* bitmap,
+                                             uint32_t bitmap_bytes)>;
+
+    DirtyTracker() = default;
+
+    DirtyTracker(const DirtyTracker&) = delete;
+    DirtyTracker& operator=(const DirtyTracker&) = delete;
+
+    // `mem` gives the RAM layout, and for lazy RAM which chunks are mapped.
+    // Every page starts out dirty: nothing has been saved yet.
+    void Init(const GuestMemMap& mem, QueryCallback query);
+
+    void MarkGpa(GPA gpa, uint64_t len);
+    void MarkOffset(uint64_t offset, uint64_t len);
+
+    // Pulls in the guest's writes since the previous call. Fails if a
+    // range could not be queried; its bits stay with the hypervisor.
+    bool Collect();
+
+    // Collect()s, then moves every page dirtied since the previous Take()
+    // into `bitmap` and starts over. Call with the vCPUs stopped and the
+    // devices quiet, or writes in between may land in neither checkpoint.
+    // Fails like Collect(), without clearing anything.
+    bool Take(std::vector<uint64_t>* bitmap);
+
+    // Collect()s and counts the pages a Take() would hand out now, without
+    // clearing them. Returns UINT64_MAX if Collect() failed.
+    uint64_t DirtyCount();
+
+    // While on, host writes (MarkGpa/MarkOffset) also go into a second
+    // bitmap that only TakeHostWrites() clears. Live migration sends pages
+    // while the VM runs, and a buffer is marked when its chain is walked,
+    // before the device fills it: a Take() in between hands the page out
+    // early and the write that follows is never seen. The final pass also
+    // resends every page in this log.
+    void LogHostWrites(bool on);
+    // ORs the host write log into `bitmap` (sized like Take()'s) and clears it.
+    void TakeHostWrites(std::vector<uint64_t>* bitmap);
+
+    // Pages seen dirty so far; a page rewritten between two Collect()s
+    // counts once, so the rate is the guest's dirtying rate.
+    uint64_t dirtied_pages() const {
+        return dirtied_pages_.load(std::memory_order_relaxed);
+    }
+
+private:
+    GPA OffsetToGpa(uint64_t offset) const {
+        return offset < mem_.low_size ? offset : mem_.high_base + (offset - mem_.low_size);
+    }
+    bool QueryRange(uint64_t offset, uint64_t len);
+
+    GuestMemMap mem_;
+    QueryCallback query_;
+    uint64_t words_count_ = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    std::unique_ptr<std::atomic<uint64_t>[]> host_words_;
+    std::atomic<bool> log_host_writes_{false};
+    std::atomic<uint64_t> dirtied_pages_{0};
+    // Serializes queries, which share scratch_.
+    std::mutex collect_mutex_;
+    std::vector<uint64_t> scratch_;
+};
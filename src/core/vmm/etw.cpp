@@ -0,0 +1,79 @@
+#include "core/vmm/etw.h"
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+
+// {f7570520-facc-4abe-a7e0-8926d1628f29}
+TRACELOGGING_DEFINE_PROVIDER(
+    g_vmm_provider, "TenBox.Vmm",
+    (0xf7570520, 0xfacc, 0x4abe, 0xa7, 0xe0, 0x89, 0x26, 0xd1, 0x62, 0x8f, 0x29));
+
+namespace etw {
+
+std::atomic<uint64_t> g_vmm_keywords{0};
+
+namespace {
+
+void NTAPI OnEnable(LPCGUID, ULONG control_code, UCHAR, ULONGLONG match_any,
+                    ULONGLONG, PEVENT_FILTER_DESCRIPTOR, PVOID) {
+    switch (control_code) {
+    case EVENT_CONTROL_CODE_ENABLE_PROVIDER:
+        g_vmm_keywords.store(match_any ? match_any : ~0ULL, std::memory_order_relaxed);
+        break;
+    case EVENT_CONTROL_CODE_DISABLE_PROVIDER:
+        g_vmm_keywords.store(0, std::memory_order_relaxed);
+        break;
+    default:  // capture state: nothing to rundown
+        break;
+    }
+}
+
+}  // namespace
+
+void RegisterVmmProvider() {
+    TraceLoggingRegisterEx(g_vmm_provider, OnEnable, nullptr);
+}
+
+void UnregisterVmmProvider() {
+    TraceLoggingUnregister(g_vmm_provider);
+    g_vmm_keywords.store(0, std::memory_order_relaxed);
+}
+
+void VcpuExit(uint32_t vcpu, uint32_t reason, const char* kind, uint64_t rip,
+              uint64_t duration_ns) {
+    TraceLoggingWrite(g_vmm_provider, "VcpuExit",
+        TraceLoggingKeyword(kKeywordVcpu),
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingUInt32(vcpu, "Vcpu"),
+        TraceLoggingHexUInt32(reason, "Reason"),
+        TraceLoggingString(kind, "Kind"),
+        TraceLoggingHexUInt64(rip, "Rip"),
+        TraceLoggingUInt64(duration_ns, "DurationNs"));
+}
+
+void QueueKick(uint32_t device_id, uint32_t queue) {
+    TraceLoggingWrite(g_vmm_provider, "QueueKick",
+        TraceLoggingKeyword(kKeywordVirtqueue),
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingUInt32(device_id, "Device"),
+        TraceLoggingUInt32(queue, "Queue"));
+}
+
+void QueueComplete(uint32_t device_id, uint64_t queues) {
+    TraceLoggingWrite(g_vmm_provider, "QueueComplete",
+        TraceLoggingKeyword(kKeywordVirtqueue),
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingUInt32(device_id, "Device"),
+        TraceLoggingHexUInt64(queues, "Queues"));
+}
+
+void InterruptInject(const char* source, uint32_t vector, uint32_t destination) {
+    TraceLoggingWrite(g_vmm_provider, "InterruptInject",
+        TraceLoggingKeyword(kKeywordInterrupt),
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingString(source, "Source"),
+        TraceLoggingUInt32(vector, "Vector"),
+        TraceLoggingUInt32(destination, "Destination"));
+}
+
+}  // namespace etw
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// ETW (TraceLogging) provider "TenBox.Vmm" for the VMM hot paths, to line
+// guest stalls up against host activity in WPA, e.g.
+//   xperf -on base -start tenbox -on f7570520-facc-4abe-a7e0-8926d1628f29
+// Nothing is written unless a session has the provider enabled; until then
+// each call site costs one relaxed load, so they stay in release builds.
+namespace etw {
+
+// Event groups a session enables by keyword (0 or all bits = everything).
+constexpr uint64_t kKeywordVcpu = 0x1;       // VcpuExit
+constexpr uint64_t kKeywordVirtqueue = 0x2;  // QueueKick, QueueComplete
+constexpr uint64_t kKeywordInterrupt = 0x4;  // InterruptInject
+
+extern std::atomic<uint64_t> g_vmm_keywords;
+
+inline bool VmmEnabled(uint64_t keyword) {
+    return (g_vmm_keywords.load(std::memory_order_relaxed) & keyword) != 0;
+}
+
+// Once per process, before the VM is created; Unregister before exit.
+void RegisterVmmProvider();
+void UnregisterVmmProvider();
+
+// Call only when VmmEnabled() says so.
+
+// One exit handled by `vcpu`: the WHV exit reason, the kind it was
+// counted as (ExitKindName) and the time to handle it.
+void VcpuExit(uint32_t vcpu, uint32_t reason, const char* kind, uint64_t rip,
+              uint64_t duration_ns);
+// The guest kicked `queue` of virtio device type `device_id`.
+void QueueKick(uint32_t device_id, uint32_t queue);
+// The device published used buffers on `queues` (a bitmask) and is about
+// to signal the guest, unless moderation holds the interrupt back.
+void QueueComplete(uint32_t device_id, uint64_t queues);
+// An interrupt request to the hypervisor; `source` is "ioapic" or "msi".
+void InterruptInject(const char* source, uint32_t vector, uint32_t destination);
+
+}  // namespace etw
@@ -0,0 +1,246 @@
+#include "core/vmm/guest_ram.h"
+
+#include <algorithm>
+#include <vector>
+
+#define NOMINMAX
+#include <windows.h>
+
+namespace {
+
+// Every live reservation, for the process-wide exception handler.
+std::mutex g_registry_mutex;
+std::vector<LazyGuestRam*> g_registry;
+PVOID g_handler = nullptr;
+
+LONG CALLBACK OnAccessViolation(EXCEPTION_POINTERS* info) {
+    const EXCEPTION_RECORD* rec = info->ExceptionRecord;
+    if (rec->ExceptionCode != EXCEPTION_ACCESS_VIOLATION ||
+        rec->NumberParameters < 2) {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+    auto* addr = reinterpret_cast<const uint8_t*>(rec->ExceptionInformation[1]);
+
+    LazyGuestRam* owner = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+        for (LazyGuestRam* ram : g_registry) {
+            if (ram->Contains(addr)) {
+                owner = ram;
+                break;
+            }
+        }
+    }
+    if (!owner || !owner->Commit(addr, 1)) return EXCEPTION_CONTINUE_SEARCH;
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+void Register(LazyGuestRam* ram) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    if (g_registry.empty()) {
+        g_handler = AddVectoredExceptionHandler(1, OnAccessViolation);
+    }
+    g_registry.push_back(ram);
+}
+
+void Unregister(LazyGuestRam* ram) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    auto it = std::find(g_registry.begin(), g_registry.end(), ram);
+    if (it == g_registry.end()) return;
+    g_registry.erase(it);
+    if (g_registry.empty() && g_handler) {
+        RemoveVectoredExceptionHandler(g_handler);
+        g_handler = nullptr;
+    }
+}
+
+} // namespace
+
+bool EnableProcessPrivilege(const wchar_t* name) {
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token))
+        return false;
+    TOKEN_PRIVILEGES tp{};
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    // AdjustTokenPrivileges succeeds without assigning a privilege the
+    // account lacks; only GetLastError tells.
+    bool ok = LookupPrivilegeValueW(nullptr, name, &tp.Privileges[0].Luid) &&
+              AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr) &&
+              GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return ok;
+}
+
+std::vector<NodeGuestRam::Piece> NodeGuestRam::Split(
+        uint64_t size, const std::vector<uint32_t>& host_nodes, uint64_t align) {
+    std::vector<Piece> pieces;
+    uint64_t share = host_nodes.empty() ? 0 : size / host_nodes.size() / align * align;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < host_nodes.size(); i++) {
+        uint64_t len = (i + 1 == host_nodes.size()) ? size - offset : share;
+        if (!len) break;
+        pieces.push_back({offset, len, host_nodes[i]});
+        offset += len;
+    }
+    return pieces;
+}
+
+NodeGuestRam::~NodeGuestRam() {
+    Free();
+}
+
+void NodeGuestRam::Free() {
+    for (size_t i = 0; i < allocated_; i++) {
+        VirtualFree(base_ + pieces_[i].offset, 0, MEM_RELEASE);
+    }
+    allocated_ = 0;
+    base_ = nullptr;
+}
+
+bool NodeGuestRam::Allocate(const std::vector<Piece>& pieces, bool large_pages) {
+    if (pieces.empty()) return false;
+    pieces_ = pieces;
+    uint64_t size = pieces.back().offset + pieces.back().size;
+    uint64_t align = large_pages ? GetLargePageMinimum() : 0;
+    DWORD type = MEM_RESERVE | MEM_COMMIT | (large_pages ? MEM_LARGE_PAGES : 0);
+
+    // VirtualAllocExNuma picks the node of a new allocation only, so each
+    // piece is allocated at its place in an address range found free just
+    // before. Another thread can take part of that range in between; the
+    // pieces are then dropped and another range is tried.
+    constexpr int kAttempts = 8;
+    for (int attempt = 0; attempt < kAttempts; attempt++) {
+        auto* probe = static_cast<uint8_t*>(
+            VirtualAlloc(nullptr, size + align, MEM_RESERVE, PAGE_NOACCESS));
+        if (!probe) {
+            LOG_ERROR("VirtualAlloc(MEM_RESERVE, %llu MB) failed", size >> 20);
+            return false;
+        }
+        VirtualFree(probe, 0, MEM_RELEASE);
+        base_ = align ? reinterpret_cast<uint8_t*>(
+                            AlignUp(reinterpret_cast<uintptr_t>(probe), align))
+                      : probe;
+
+        for (allocated_ = 0; allocated_ < pieces_.size(); allocated_++) {
+            const Piece& piece = pieces_[allocated_];
+            void* want = base_ + piece.offset;
+            void* got = VirtualAllocExNuma(GetCurrentProcess(), want, piece.size, type,
+                                           PAGE_READWRITE, piece.host_node);
+            if (got == want) continue;
+            DWORD error = GetLastError();
+            if (got) VirtualFree(got, 0, MEM_RELEASE);
+            if (error != ERROR_INVALID_ADDRESS) {
+                LOG_ERROR("Guest RAM: %llu MB on NUMA node %u failed (%lu)",
+                          piece.size >> 20, piece.host_node, error);
+                Free();
+                return false;
+            }
+            break;
+        }
+        if (allocated_ == pieces_.size()) return true;
+        Free();
+    }
+    LOG_ERROR("Guest RAM: no free range of %llu MB for the NUMA pieces", size >> 20);
+    return false;
+}
+
+LazyGuestRam::~LazyGuestRam() {
+    if (!base_) return;
+    Unregister(this);
+    LOG_INFO("Guest RAM: %llu of %llu MB committed",
+             committed_bytes() >> 20, size_ >> 20);
+    VirtualFree(base_, 0, MEM_RELEASE);
+}
+
+bool LazyGuestRam::Reserve(uint64_t size, uint64_t low_size, GPA high_base,
+                           MapCallback map, UnmapCallback unmap) {
+    base_ = static_cast<uint8_t*>(
+        VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_READWRITE));
+    if (!base_) {
+        LOG_ERROR("VirtualAlloc(MEM_RESERVE, %llu MB) failed", size >> 20);
+        return false;
+    }
+    size_ = size;
+    low_size_ = low_size;
+    high_base_ = high_base;
+    map_ = std::move(map);
+    unmap_ = std::move(unmap);
+
+    uint64_t chunks = AlignUp(size, kChunkSize) / kChunkSize;
+    committed_ = std::make_unique<std::atomic<uint8_t>[]>(chunks);
+    for (uint64_t i = 0; i < chunks; i++) committed_[i] = 0;
+
+    Register(this);
+    return true;
+}
+
+bool LazyGuestRam::Commit(const uint8_t* hva, uint64_t len) {
+    if (!len || hva >= base_ + size_ || hva + len <= base_) return true;
+    uint64_t start = hva > base_ ? static_cast<uint64_t>(hva - base_) : 0;
+    uint64_t end = std::min<uint64_t>(hva + len - base_, size_);
+    for (uint64_t i = start / kChunkSize; i * kChunkSize < end; i++) {
+        if (!EnsureChunk(i)) return false;
+    }
+    return true;
+}
+
+RamFault LazyGuestRam::HandleGuestFault(GPA gpa) {
+    uint64_t offset;
+    if (gpa < low_size_) {
+        offset = gpa;
+    } else if (low_size_ < size_ && gpa >= high_base_ &&
+               gpa - high_base_ < size_ - low_size_) {
+        offset = low_size_ + (gpa - high_base_);
+    } else {
+        return RamFault::kNotRam;
+    }
+    // A chunk another vCPU just committed is mapped already; the retry
+    // goes through.
+    return EnsureChunk(offset / kChunkSize) ? RamFault::kCommitted
+                                            : RamFault::kFailed;
+}
+
+bool LazyGuestRam::CommitChunk(uint64_t index) {
+    std::lock_guard<std::mutex> lock(commit_mutex_);
+    if (committed_[index].load(std::memory_order_relaxed)) return true;
+
+    // kMmioGapStart is chunk aligned, so no chunk spans both regions.
+    uint64_t offset = index * kChunkSize;
+    uint64_t len = std::min(kChunkSize, size_ - offset);
+    if (!VirtualAlloc(base_ + offset, len, MEM_COMMIT, PAGE_READWRITE)) {
+        LOG_ERROR("Guest RAM: committing %llu KB at offset 0x%llX failed (%lu)",
+                  len >> 10, offset, GetLastError());
+        return false;
+    }
+    if (!map_(ChunkGpa(offset), base_ + offset, len)) return false;
+
+    committed_bytes_.fetch_add(len, std::memory_order_relaxed);
+    committed_[index].store(1, std::memory_order_release);
+    return true;
+}
+
+void LazyGuestRam::Release(uint8_t* hva, uint64_t len) {
+    if (!len || hva < base_ || hva >= base_ + size_) return;
+    uint64_t start = AlignUp(hva - base_, kPageSize);
+    uint64_t end = std::min<uint64_t>(hva + len - base_, size_) & kPageMask;
+
+    std::lock_guard<std::mutex> lock(commit_mutex_);
+    for (uint64_t i = start / kChunkSize; i * kChunkSize < end; i++) {
+        if (!committed_[i].load(std::memory_order_relaxed)) continue;
+        uint64_t chunk = i * kChunkSize;
+        uint64_t chunk_len = std::min(kChunkSize, size_ - chunk);
+        uint64_t from = std::max(start, chunk);
+        uint64_t to = std::min(end, chunk + chunk_len);
+
+        if (from == chunk && to == chunk + chunk_len) {
+            // Unmap first so the guest exits instead of touching a hole.
+            committed_[i].store(0, std::memory_order_relaxed);
+            unmap_(ChunkGpa(chunk), chunk_len);
+            VirtualFree(base_ + chunk, chunk_len, MEM_DECOMMIT);
+            committed_bytes_.fetch_sub(chunk_len, std::memory_order_relaxed);
+        } else if (from < to) {
+            DiscardVirtualMemory(base_ + from, to - from);
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Enables `name` (e.g. L"SeLockMemoryPrivilege") in the process token.
+// Fails if the account does not hold it.
+bool EnableProcessPrivilege(const wchar_t* name);
+
+enum class RamFault : uint8_t {
+    kNotRam,      // not guest RAM; handle the access as MMIO
+    kCommitted,   // now backed and mapped, retry the access
+    kFailed,      // RAM, but the host could not commit it
+};
+
+// Guest RAM in one host allocation per NUMA node, placed back to back so
+// it reads as one range from base(). Each piece's pages come from its
+// node. The pieces are separate allocations, so each is mapped into the
+// partition on its own.
+class NodeGuestRam {
+public:
+    struct Piece {
+        uint64_t offset = 0;  // from the start of guest RAM; 64 KiB aligned
+        uint64_t size = 0;
+        uint32_t host_node = 0;
+    };
+
+    // `size` bytes of guest RAM split between `host_nodes` in equal,
+    // `align` sized shares; the last takes what is left.
+    static std::vector<Piece> Split(uint64_t size, const std::vector<uint32_t>& host_nodes,
+                                    uint64_t align);
+
+    NodeGuestRam() = default;
+    ~NodeGuestRam();
+
+    NodeGuestRam(const NodeGuestRam&) = delete;
+    NodeGuestRam& operator=(const NodeGuestRam&) = delete;
+
+    // Commits every piece on its node. `large_pages` needs the pieces
+    // aligned to the large page size and SeLockMemoryPrivilege enabled.
+    bool Allocate(const std::vector<Piece>& pieces, bool large_pages);
+
+    uint8_t* base() const { return base_; }
+    const std::vector<Piece>& pieces() const { return pieces_; }
+
+private:
+    void Free();
+
+    uint8_t* base_ = nullptr;
+    std::vector<Piece> pieces_;
+    size_t allocated_ = 0;  // leading pieces that hold an allocation
+};
+
+// Guest RAM that is only reserved up front and committed in kChunkSize
+// pieces the first time they are touched, so host commit follows the
+// guest's working set instead of its configured size.
+//
+// A guest access to an uncommitted chunk exits as an unmapped GPA access
+// (HandleGuestFault). Host code touching one faults into a vectored
+// exception handler. Kernel-mode I/O into guest memory, such as ReadFile
+// into a virtqueue buffer, fails with ERROR_NOACCESS instead of faulting,
+// so such buffers must go through Commit() first.
+//
+// Release() hands chunks back, e.g. for pages the guest reported free; the
+// next touch commits them again, zero filled.
+class LazyGuestRam {
+public:
+    static constexpr uint64_t kChunkSize = 2ULL << 20;
+
+    // Maps a committed chunk at its GPA.
+    using MapCallback = std::function<bool(GPA gpa, void* hva, uint64_t size)>;
+    using UnmapCallback = std::function<void(GPA gpa, uint64_t size)>;
+
+    LazyGuestRam() = default;
+    ~LazyGuestRam();
+
+    LazyGuestRam(const LazyGuestRam&) = delete;
+    LazyGuestRam& operator=(const LazyGuestRam&) = delete;
+
+    // Reserves `size` bytes (page aligned) laid out like GuestMemMap: the
+    // first `low_size` bytes at GPA 0, the rest at `high_base`.
+    bool Reserve(uint64_t size, uint64_t low_size, GPA high_base,
+                 MapCallback map, UnmapCallback unmap);
+
+    uint8_t* base() const { return base_; }
+    uint64_t committed_bytes() const {
+        return committed_bytes_.load(std::memory_order_relaxed);
+    }
+
+    // Whether the chunk holding byte `offset` of guest RAM is committed.
+    bool IsCommitted(uint64_t offset) const {
+        return offset < size_ &&
+               committed_[offset / kChunkSize].load(std::memory_order_acquire);
+    }
+
+    bool Contains(const void* addr) const {
+        auto* p = static_cast<const uint8_t*>(addr);
+        return p >= base_ && p < base_ + size_;
+    }
+
+    // Commits the chunks covering [hva, hva+len). Ranges outside the
+    // reservation are ignored.
+    bool Commit(const uint8_t* hva, uint64_t len);
+    RamFault HandleGuestFault(GPA gpa);
+
+    // Decommits the chunks wholly inside [hva, hva+len) and discards the
+    // contents of the pages around them. The guest must not be using the
+    // range.
+    void Release(uint8_t* hva, uint64_t len);
+
+private:
+    bool EnsureChunk(uint64_t index) {
+        return committed_[index].load(std::memory_order_acquire) ||
+               CommitChunk(index);
+    }
+    bool CommitChunk(uint64_t index);
+    GPA ChunkGpa(uint64_t offset) const {
+        return offset < low_size_ ? offset : high_base_ + (offset - low_size_);
+    }
+
+    uint8_t* base_ = nullptr;
+    uint64_t size_ = 0;
+    uint64_t low_size_ = 0;
+    GPA high_base_ = 0;
+    MapCallback map_;
+    UnmapCallback unmap_;
+
+    // Set once a chunk is committed and mapped; commits are serialized.
+    std::unique_ptr<std::atomic<uint8_t>[]> committed_;
+    std::mutex commit_mutex_;
+    std::atomic<uint64_t> committed_bytes_{0};
+};
@@ -0,0 +1,76 @@
+#include "core/vmm/io_thread.h"
+#include "core/vmm/cpu_placement.h"
+
+#include <bit>
+#include <string>
+
+#include <windows.h>
+
+bool IsIoThreadDevice(const std::string& name) {
+    static const char* const kDevices[] = {
+        "blk", "net", "input", "gpu", "serial", "fs", "snd", "balloon", "vsock",
+        "mem",
+    };
+    for (const char* device : kDevices) {
+        if (name == device) return true;
+    }
+    return false;
+}
+
+IoThread::~IoThread() {
+    Stop();
+}
+
+int IoThread::AddSource(Handler handler) {
+    if (thread_.joinable() || handlers_.size() >= kMaxSources) return -1;
+    handlers_.push_back(std::move(handler));
+    return static_cast<int>(handlers_.size() - 1);
+}
+
+bool IoThread::Start(const CpuPlacement* placement) {
+    if (thread_.joinable()) return true;
+    HANDLE event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!event) {
+        LOG_ERROR("I/O thread %u: CreateEvent failed (%lu)", index_, GetLastError());
+        return false;
+    }
+    event_ = event;
+    stop_.store(false, std::memory_order_relaxed);
+    thread_ = std::thread(&IoThread::ThreadFunc, this, placement);
+    return true;
+}
+
+void IoThread::Stop() {
+    if (!thread_.joinable()) return;
+    stop_.store(true, std::memory_order_release);
+    SetEvent(reinterpret_cast<HANDLE>(event_));
+    thread_.join();
+    CloseHandle(reinterpret_cast<HANDLE>(event_));
+    event_ = nullptr;
+}
+
+void IoThread::Kick(uint32_t source) {
+    if (source >= handlers_.size()) return;
+    uint64_t bit = 1ULL << source;
+    // Only the first kick since the loop last looked needs a wake-up.
+    if (!(pending_.fetch_or(bit, std::memory_order_acq_rel) & bit)) {
+        SetEvent(reinterpret_cast<HANDLE>(event_));
+    }
+}
+
+void IoThread::ThreadFunc(const CpuPlacement* placement) {
+    std::wstring name = L"iothread" + std::to_wstring(index_);
+    SetThreadDescription(GetCurrentThread(), name.c_str());
+    if (placement) placement->ApplyToIoThread(index_);
+
+    HANDLE event = reinterpret_cast<HANDLE>(event_);
+    while (!stop_.load(std::memory_order_acquire)) {
+        WaitForSingleObject(event, INFINITE);
+        uint64_t pending = pending_.exchange(0, std::memory_order_acq_rel);
+        while (pending) {
+            uint32_t idx = static_cast<uint32_t>(std::countr_zero(pending));
+            pending &= pending - 1;
+            handlers_[idx]();
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CpuPlacement;
+
+constexpr uint32_t kMaxIoThreads = 16;
+
+// Whether `name` is a device an I/O thread can serve: blk, net, input, gpu,
+// serial, fs, snd, balloon, vsock or mem.
+bool IsIoThreadDevice(const std::string& name);
+
+// A thread with its own event loop that devices hand their queue work to,
+// so several devices can share one thread, or a busy one can have a thread
+// (and with spread placement a core) to itself. Each device registers a
+// source; Kick() marks it pending and the loop runs every pending source's
+// handler in turn. Kicks that arrive before the handler runs fold into one.
+class IoThread {
+public:
+    static constexpr uint32_t kMaxSources = 64;
+    using Handler = std::function<void()>;
+
+    explicit IoThread(uint32_t index) : index_(index) {}
+    ~IoThread();
+
+    // Returns the id to Kick() with, or -1 once kMaxSources are taken.
+    // Only before Start().
+    int AddSource(Handler handler);
+
+    // `placement` may be null; otherwise the thread takes its CPU set.
+    bool Start(const CpuPlacement* placement);
+    // Handlers have all returned once this does.
+    void Stop();
+    bool IsRunning() const { return thread_.joinable(); }
+
+    // Callable from any thread, typically a vCPU on a doorbell write.
+    void Kick(uint32_t source);
+
+    uint32_t Index() const { return index_; }
+    size_t SourceCount() const { return handlers_.size(); }
+
+    IoThread(const IoThread&) = delete;
+    IoThread& operator=(const IoThread&) = delete;
+
+private:
+    void ThreadFunc(const CpuPlacement* placement);
+
+    uint32_t index_;
+    std::vector<Handler> handlers_;
+    std::atomic<uint64_t> pending_{0};
+    void* event_ = nullptr;  // HANDLE, auto-reset
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
@@ -0,0 +1,519 @@
+#include "core/vmm/migration.h"
+#include "core/vmm/guest_ram.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'B', 'X', 'M', 'I', 'G', 'R', '\0'};
+constexpr uint32_t kVersion = 3;
+// Data records carry at most this much, compressed as one zstd frame.
+constexpr uint32_t kBatchSize = 1u << 20;
+// Zero runs carry no data, only their length.
+constexpr uint64_t kMaxZeroRun = 1ULL << 30;
+// Neither side waits longer than this for the other.
+constexpr DWORD kIoTimeoutMs = 60 * 1000;
+
+enum RecordType : uint32_t {
+    kRecordHello = 1,
+    kRecordControl,
+    kRecordRam,
+    kRecordRamZero,
+    kRecordDisk,
+    kRecordDiskZero,
+    kRecordPassEnd,
+    kRecordState,
+};
+
+constexpr uint32_t kRecordCompressed = 0x1;
+constexpr uint32_t kHelloMirrorDisk = 0x1;
+constexpr uint32_t kHelloX2Apic = 0x2;
+
+#pragma pack(push, 1)
+struct RecordHeader {
+    uint32_t type;
+    uint32_t flags;     // kRecordCompressed
+    uint32_t raw_len;   // bytes covered; for data records, before compression
+    uint32_t wire_len;  // bytes of payload that follow
+    uint64_t offset;    // into guest RAM or the disk
+};
+
+struct WireHello {
+    char magic[8];
+    uint32_t version;
+    uint32_t cpu_count;
+    uint64_t ram_size;
+    uint64_t disk_size;
+    uint32_t flags;  // kHello*
+};
+
+struct WireControl {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t value;
+};
+#pragma pack(pop)
+
+bool IsZero(const uint8_t* p, size_t len) {
+    const auto* words = reinterpret_cast<const uint64_t*>(p);
+    for (size_t i = 0; i < len / sizeof(uint64_t); i++) {
+        if (words[i]) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// Gathers consecutive pages or blocks into records: data runs up to
+// kBatchSize, zero runs up to kMaxZeroRun.
+class MigrationStream::RunBatcher {
+public:
+    RunBatcher(MigrationStream* stream, uint32_t data_type, uint32_t zero_type,
+               bool skip_zero)
+        : stream_(stream), data_type_(data_type), zero_type_(zero_type),
+          skip_zero_(skip_zero) {}
+
+    // `data` is null for a zero range.
+    bool Add(uint64_t offset, const uint8_t* data, uint32_t len) {
+        bool zero = data == nullptr;
+        if (run_len_ && (offset != run_offset_ + run_len_ || zero != run_zero_ ||
+                         (zero ? run_len_ + len > kMaxZeroRun
+                               : run_len_ + len > kBatchSize))) {
+            if (!Flush()) return false;
+        }
+        if (zero && skip_zero_) return true;
+        if (!run_len_) {
+            run_offset_ = offset;
+            run_zero_ = zero;
+            run_data_.clear();
+        }
+        if (!zero) run_data_.insert(run_data_.end(), data, data + len);
+        run_len_ += len;
+        return true;
+    }
+
+    bool Flush() {
+        if (!run_len_) return true;
+        bool ok = stream_->SendRecord(run_zero_ ? zero_type_ : data_type_, run_offset_,
+                                      run_zero_ ? nullptr : run_data_.data(),
+                                      static_cast<uint32_t>(run_len_));
+        if (!run_zero_) stream_->payload_bytes_ += run_len_;
+        run_len_ = 0;
+        return ok;
+    }
+
+private:
+    MigrationStream* stream_;
+    uint32_t data_type_;
+    uint32_t zero_type_;
+    bool skip_zero_;
+    uint64_t run_offset_ = 0;
+    uint64_t run_len_ = 0;
+    bool run_zero_ = false;
+    std::vector<uint8_t> run_data_;
+};
+
+MigrationStream::~MigrationStream() {
+    if (socket_ != ~uintptr_t(0)) closesocket(static_cast<SOCKET>(socket_));
+    if (cctx_) ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(cctx_));
+    if (dctx_) ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(dctx_));
+    if (wsa_started_) WSACleanup();
+}
+
+static void SetIoTimeouts(SOCKET s) {
+    DWORD timeout = kIoTimeoutMs;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout),
+               sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout),
+               sizeof(timeout));
+}
+
+std::unique_ptr<MigrationStream> MigrationStream::Connect(const std::string& host,
+                                                          uint16_t port,
+                                                          int compression_level) {
+    auto stream = std::unique_ptr<MigrationStream>(new MigrationStream());
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        LOG_ERROR("Migration: WSAStartup failed");
+        return nullptr;
+    }
+    stream->wsa_started_ = true;
+    stream->level_ = compression_level;
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    addrinfo* result = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &result) != 0 || !result) {
+        LOG_ERROR("Migration: cannot resolve %s (%d)", host.c_str(), WSAGetLastError());
+        return nullptr;
+    }
+    SOCKET s = INVALID_SOCKET;
+    for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == INVALID_SOCKET) continue;
+        if (connect(s, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0) break;
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+    if (s == INVALID_SOCKET) {
+        LOG_ERROR("Migration: cannot connect to %s:%u (%d)", host.c_str(), port,
+                  WSAGetLastError());
+        return nullptr;
+    }
+    SetIoTimeouts(s);
+    stream->socket_ = static_cast<uintptr_t>(s);
+    LOG_INFO("Migration: connected to %s:%u", host.c_str(), port);
+    return stream;
+}
+
+std::unique_ptr<MigrationStream> MigrationStream::Accept(uint16_t port, uint32_t timeout_s) {
+    auto stream = std::unique_ptr<MigrationStream>(new MigrationStream());
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        LOG_ERROR("Migration: WSAStartup failed");
+        return nullptr;
+    }
+    stream->wsa_started_ = true;
+
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) {
+        LOG_ERROR("Migration: socket failed (%d)", WSAGetLastError());
+        return nullptr;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR ||
+        listen(listener, 1) == SOCKET_ERROR) {
+        LOG_ERROR("Migration: cannot listen on port %u (%d)", port, WSAGetLastError());
+        closesocket(listener);
+        return nullptr;
+    }
+    // Anyone who reaches the port can hand this process a VM.
+    LOG_WARN("Migration: waiting on port %u for the source VM; the stream is not "
+             "authenticated", port);
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(listener, &readable);
+    timeval tv{static_cast<long>(timeout_s), 0};
+    SOCKET s = INVALID_SOCKET;
+    if (select(0, &readable, nullptr, nullptr, &tv) == 1) {
+        sockaddr_in peer{};
+        int peer_len = sizeof(peer);
+        s = accept(listener, reinterpret_cast<sockaddr*>(&peer), &peer_len);
+        if (s != INVALID_SOCKET) {
+            char name[INET_ADDRSTRLEN] = {};
+            inet_ntop(AF_INET, &peer.sin_addr, name, sizeof(name));
+            LOG_INFO("Migration: source connected from %s", name);
+        }
+    }
+    closesocket(listener);
+    if (s == INVALID_SOCKET) {
+        LOG_ERROR("Migration: no source connected within %u s", timeout_s);
+        return nullptr;
+    }
+    SetIoTimeouts(s);
+    stream->socket_ = static_cast<uintptr_t>(s);
+    return stream;
+}
+
+bool MigrationStream::SendAll(const void* data, size_t len) {
+    auto* p = static_cast<const char*>(data);
+    while (len) {
+        int chunk = static_cast<int>(std::min<size_t>(len, 1u << 30));
+        int sent = send(static_cast<SOCKET>(socket_), p, chunk, 0);
+        if (sent <= 0) {
+            LOG_ERROR("Migration: send failed (%d)", WSAGetLastError());
+            return false;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+bool MigrationStream::RecvAll(void* data, size_t len) {
+    auto* p = static_cast<char*>(data);
+    while (len) {
+        int chunk = static_cast<int>(std::min<size_t>(len, 1u << 30));
+        int got = recv(static_cast<SOCKET>(socket_), p, chunk, 0);
+        if (got <= 0) {
+            if (got == 0) LOG_ERROR("Migration: the other side closed the stream");
+            else LOG_ERROR("Migration: receive failed (%d)", WSAGetLastError());
+            return false;
+        }
+        p += got;
+        len -= got;
+    }
+    return true;
+}
+
+bool MigrationStream::SendRecord(uint32_t type, uint64_t offset, const void* data,
+                                 uint32_t len) {
+    RecordHeader hdr{};
+    hdr.type = type;
+    hdr.raw_len = len;
+    hdr.offset = offset;
+    const void* payload = data;
+    if (data) {
+        hdr.wire_len = len;
+        if (!cctx_) cctx_ = ZSTD_createCCtx();
+        if (cctx_ && len >= 512) {
+            buffer_.resize(ZSTD_compressBound(len));
+            size_t n = ZSTD_compressCCtx(static_cast<ZSTD_CCtx*>(cctx_), buffer_.data(),
+                                         buffer_.size(), data, len, level_);
+            // Already compressed data goes as is.
+            if (!ZSTD_isError(n) && n < len) {
+                hdr.flags |= kRecordCompressed;
+                hdr.wire_len = static_cast<uint32_t>(n);
+                payload = buffer_.data();
+            }
+        }
+    }
+    wire_bytes_ += sizeof(hdr) + hdr.wire_len;
+    return SendAll(&hdr, sizeof(hdr)) && (!hdr.wire_len || SendAll(payload, hdr.wire_len));
+}
+
+bool MigrationStream::SendHello(const Hello& hello) {
+    WireHello wire{};
+    std::memcpy(wire.magic, kMagic, sizeof(kMagic));
+    wire.version = kVersion;
+    wire.cpu_count = hello.cpu_count;
+    wire.ram_size = hello.ram_size;
+    wire.disk_size = hello.disk_size;
+    wire.flags = (hello.mirror_disk ? kHelloMirrorDisk : 0) |
+                 (hello.x2apic ? kHelloX2Apic : 0);
+    RecordHeader hdr{kRecordHello, 0, sizeof(wire), sizeof(wire), 0};
+    return SendAll(&hdr, sizeof(hdr)) && SendAll(&wire, sizeof(wire));
+}
+
+bool MigrationStream::ReadHello(Hello* hello) {
+    RecordHeader hdr{};
+    WireHello wire{};
+    if (!RecvAll(&hdr, sizeof(hdr))) return false;
+    if (hdr.type != kRecordHello || hdr.wire_len != sizeof(wire) ||
+        !RecvAll(&wire, sizeof(wire)) || std::memcmp(wire.magic, kMagic, sizeof(kMagic)) != 0) {
+        LOG_ERROR("Migration: the source is not a TenBox VM");
+        return false;
+    }
+    if (wire.version != kVersion) {
+        LOG_ERROR("Migration: the source speaks version %u, expected %u", wire.version,
+                  kVersion);
+        return false;
+    }
+    hello->cpu_count = wire.cpu_count;
+    hello->ram_size = wire.ram_size;
+    hello->disk_size = wire.disk_size;
+    hello->mirror_disk = (wire.flags & kHelloMirrorDisk) != 0;
+    hello->x2apic = (wire.flags & kHelloX2Apic) != 0;
+    return true;
+}
+
+bool MigrationStream::SendControl(MigrationControl type, uint64_t value) {
+    WireControl wire{static_cast<uint32_t>(type), 0, value};
+    RecordHeader hdr{kRecordControl, 0, sizeof(wire), sizeof(wire), 0};
+    return SendAll(&hdr, sizeof(hdr)) && SendAll(&wire, sizeof(wire));
+}
+
+bool MigrationStream::ReadControl(MigrationControl* type, uint64_t* value) {
+    RecordHeader hdr{};
+    WireControl wire{};
+    if (!RecvAll(&hdr, sizeof(hdr))) return false;
+    if (hdr.type != kRecordControl || hdr.wire_len != sizeof(wire) ||
+        !RecvAll(&wire, sizeof(wire))) {
+        LOG_ERROR("Migration: unexpected record %u", hdr.type);
+        return false;
+    }
+    *type = static_cast<MigrationControl>(wire.type);
+    *value = wire.value;
+    return true;
+}
+
+bool MigrationStream::SendRam(const GuestMemMap& mem, const std::vector<uint64_t>* dirty,
+                              bool target_fresh) {
+    RunBatcher out(this, kRecordRam, kRecordRamZero, target_fresh);
+    // Reading RAM that was never committed would commit it; it is zero.
+    auto committed = [&](uint64_t offset) {
+        return !mem.lazy || mem.lazy->IsCommitted(offset);
+    };
+    auto add_page = [&](uint64_t offset) {
+        const uint8_t* page = mem.base + offset;
+        bool zero = !committed(offset) || IsZero(page, kPageSize);
+        return out.Add(offset, zero ? nullptr : page, static_cast<uint32_t>(kPageSize));
+    };
+
+    if (dirty) {
+        uint64_t pages = mem.alloc_size / kPageSize;
+        for (uint64_t word = 0; word < dirty->size(); word++) {
+            for (uint64_t bits = (*dirty)[word]; bits; bits &= bits - 1) {
+                uint64_t page = word * 64 + std::countr_zero(bits);
+                if (page >= pages) break;
+                if (!add_page(page * kPageSize)) return false;
+            }
+        }
+        return out.Flush();
+    }
+
+    for (uint64_t offset = 0; offset < mem.alloc_size;) {
+        if (!committed(offset)) {
+            uint64_t end = std::min(AlignDown(offset, LazyGuestRam::kChunkSize) +
+                                    LazyGuestRam::kChunkSize, mem.alloc_size);
+            if (!out.Add(offset, nullptr, static_cast<uint32_t>(end - offset))) return false;
+            offset = end;
+            continue;
+        }
+        if (!add_page(offset)) return false;
+        offset += kPageSize;
+    }
+    return out.Flush();
+}
+
+bool MigrationStream::SendDisk(uint64_t disk_size, const std::vector<uint64_t>* dirty,
+                               const DiskReader& read) {
+    RunBatcher out(this, kRecordDisk, kRecordDiskZero, false);
+    std::vector<uint8_t> block(kDiskBlockSize);
+    auto add_block = [&](uint64_t index) {
+        uint64_t offset = index * kDiskBlockSize;
+        uint32_t len = static_cast<uint32_t>(std::min<uint64_t>(kDiskBlockSize,
+                                                                disk_size - offset));
+        if (!read(offset, block.data(), len)) {
+            LOG_ERROR("Migration: reading the disk at %llu failed", offset);
+            return false;
+        }
+        bool zero = IsZero(block.data(), len);
+        return out.Add(offset, zero ? nullptr : block.data(), len);
+    };
+
+    uint64_t blocks = (disk_size + kDiskBlockSize - 1) / kDiskBlockSize;
+    if (dirty) {
+        for (uint64_t word = 0; word < dirty->size(); word++) {
+            for (uint64_t bits = (*dirty)[word]; bits; bits &= bits - 1) {
+                uint64_t index = word * 64 + std::countr_zero(bits);
+                if (index >= blocks) break;
+                if (!add_block(index)) return false;
+            }
+        }
+    } else {
+        for (uint64_t index = 0; index < blocks; index++) {
+            if (!add_block(index)) return false;
+        }
+    }
+    return out.Flush();
+}
+
+bool MigrationStream::SendPassEnd() {
+    return SendRecord(kRecordPassEnd, 0, nullptr, 0);
+}
+
+bool MigrationStream::SendState(const SnapshotFile::Sections& sections) {
+    std::vector<uint8_t> state = SnapshotFile::EncodeSections(sections);
+    return SendRecord(kRecordState, 0, state.data(), static_cast<uint32_t>(state.size()));
+}
+
+bool MigrationStream::Receive(const GuestMemMap& mem, const DiskWriter& write_disk,
+                              SnapshotFile::Sections* state) {
+    std::vector<uint8_t> raw;
+    uint32_t passes = 0;
+    uint64_t ram_bytes = 0, disk_bytes = 0;
+    for (;;) {
+        RecordHeader hdr{};
+        if (!RecvAll(&hdr, sizeof(hdr))) return false;
+        bool zero_run = hdr.type == kRecordRamZero || hdr.type == kRecordDiskZero;
+        uint64_t limit = hdr.type == kRecordState ? UINT32_MAX
+                         : zero_run               ? kMaxZeroRun
+                                                  : kBatchSize;
+        if (hdr.raw_len > limit || hdr.wire_len > ZSTD_compressBound(hdr.raw_len) ||
+            (zero_run && hdr.wire_len) ||
+            (!(hdr.flags & kRecordCompressed) && !zero_run && hdr.wire_len != hdr.raw_len)) {
+            LOG_ERROR("Migration: corrupt record (type %u, %u bytes)", hdr.type, hdr.raw_len);
+            return false;
+        }
+
+        const uint8_t* data = nullptr;
+        if (hdr.wire_len) {
+            buffer_.resize(hdr.wire_len);
+            if (!RecvAll(buffer_.data(), hdr.wire_len)) return false;
+            data = buffer_.data();
+            if (hdr.flags & kRecordCompressed) {
+                if (!dctx_) dctx_ = ZSTD_createDCtx();
+                raw.resize(hdr.raw_len);
+                size_t n = dctx_ ? ZSTD_decompressDCtx(static_cast<ZSTD_DCtx*>(dctx_),
+                                                       raw.data(), raw.size(),
+                                                       buffer_.data(), hdr.wire_len)
+                                 : 0;
+                if (!dctx_ || ZSTD_isError(n) || n != hdr.raw_len) {
+                    LOG_ERROR("Migration: corrupt compressed record at %llu", hdr.offset);
+                    return false;
+                }
+                data = raw.data();
+            }
+        }
+
+        switch (hdr.type) {
+        case kRecordRam:
+        case kRecordRamZero: {
+            if (hdr.offset > mem.alloc_size || hdr.raw_len > mem.alloc_size - hdr.offset) {
+                LOG_ERROR("Migration: RAM record at %llu is out of range", hdr.offset);
+                return false;
+            }
+            uint8_t* hva = mem.base + hdr.offset;
+            if (hdr.type == kRecordRam) {
+                if (mem.lazy && !mem.lazy->Commit(hva, hdr.raw_len)) return false;
+                std::memcpy(hva, data, hdr.raw_len);
+                ram_bytes += hdr.raw_len;
+                break;
+            }
+            // Uncommitted RAM is zero already; leave it that way.
+            for (uint64_t done = 0; done < hdr.raw_len;) {
+                uint64_t offset = hdr.offset + done;
+                uint64_t len = hdr.raw_len - done;
+                if (mem.lazy) {
+                    len = std::min(len, AlignDown(offset, LazyGuestRam::kChunkSize) +
+                                        LazyGuestRam::kChunkSize - offset);
+                }
+                if (!mem.lazy || mem.lazy->IsCommitted(offset)) {
+                    std::memset(mem.base + offset, 0, len);
+                }
+                done += len;
+            }
+            break;
+        }
+        case kRecordDisk:
+        case kRecordDiskZero:
+            if (!write_disk || !write_disk(hdr.offset, data, hdr.raw_len)) {
+                LOG_ERROR("Migration: writing the disk at %llu failed", hdr.offset);
+                return false;
+            }
+            if (data) disk_bytes += hdr.raw_len;
+            break;
+        case kRecordPassEnd:
+            passes++;
+            break;
+        case kRecordState: {
+            std::vector<uint8_t> blob(data, data + hdr.raw_len);
+            if (!SnapshotFile::DecodeSections(blob, state)) {
+                LOG_ERROR("Migration: corrupt device state");
+                return false;
+            }
+            LOG_INFO("Migration: received %u passes, %llu MB of RAM and %llu MB of disk",
+                     passes + 1, ram_bytes >> 20, disk_bytes >> 20);
+            return true;
+        }
+        default:
+            LOG_ERROR("Migration: unexpected record %u", hdr.type);
+            return false;
+        }
+    }
+}
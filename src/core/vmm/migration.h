@@ -0,0 +1,109 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include "core/vmm/snapshot.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Knobs of an outgoing live migration (Vm::Migrate).
+struct MigrationOptions {
+    // Pre-copy passes before the VM is stopped regardless of convergence.
+    uint32_t max_passes = 30;
+    // Pre-copy ends once what is left should move in this long.
+    uint32_t max_downtime_ms = 300;
+    int compression_level = 1;  // zstd
+    // Stream the disk along with RAM, into the target's own image of the
+    // same size. Otherwise both hosts open the same image (shared storage)
+    // and the source lets go of it just before the target takes over.
+    bool mirror_disk = false;
+};
+
+// Control records, either way, around the transfer.
+enum class MigrationControl : uint32_t {
+    kResult = 1,    // target: hello accepted / VM taken over (value 1) or not
+    kReleaseDisk,   // target: close the shared disk so it can be opened here
+    kDiskReleased,  // source: done
+};
+
+// One end of a live migration: a TCP connection carrying guest RAM pages,
+// disk blocks and finally the vCPU and device state, each batch zstd
+// compressed. The stream is neither authenticated nor encrypted; it is
+// meant for a trusted host-to-host network.
+class MigrationStream {
+public:
+    // Disk mirroring moves the image in blocks of this size.
+    static constexpr uint32_t kDiskBlockSize = 64 * 1024;
+
+    struct Hello {
+        uint32_t cpu_count = 0;
+        uint64_t ram_size = 0;
+        uint64_t disk_size = 0;    // 0 without a disk
+        bool mirror_disk = false;  // disk blocks follow; see MigrationOptions
+        bool x2apic = false;       // local APICs in x2APIC mode
+    };
+
+    // Reads from or writes to the disk, in guest offsets. A write with null
+    // `data` zeroes the range.
+    using DiskReader = std::function<bool(uint64_t offset, void* buf, uint32_t len)>;
+    using DiskWriter = std::function<bool(uint64_t offset, const void* data, uint32_t len)>;
+
+    ~MigrationStream();
+
+    MigrationStream(const MigrationStream&) = delete;
+    MigrationStream& operator=(const MigrationStream&) = delete;
+
+    static std::unique_ptr<MigrationStream> Connect(const std::string& host, uint16_t port,
+                                                    int compression_level = 1);
+    // Waits up to `timeout_s` for one source to connect on `port`.
+    static std::unique_ptr<MigrationStream> Accept(uint16_t port, uint32_t timeout_s);
+
+    bool SendHello(const Hello& hello);
+    bool ReadHello(Hello* hello);
+    bool SendControl(MigrationControl type, uint64_t value);
+    bool ReadControl(MigrationControl* type, uint64_t* value);
+
+    // Source side. SendRam sends the pages set in `dirty` (one bit per page,
+    // as DirtyTracker hands them out), or all of RAM if null. Zero pages go
+    // as zero records, or not at all with `target_fresh`, when the target's
+    // RAM is known to be untouched.
+    bool SendRam(const GuestMemMap& mem, const std::vector<uint64_t>* dirty,
+                 bool target_fresh = false);
+    // Same for the disk, with one bit per kDiskBlockSize block. The target
+    // image is not assumed to be blank, so zero blocks are always sent.
+    bool SendDisk(uint64_t disk_size, const std::vector<uint64_t>* dirty,
+                  const DiskReader& read);
+    bool SendPassEnd();
+    bool SendState(const SnapshotFile::Sections& sections);
+
+    // Target side: applies RAM and disk records until the state arrives.
+    bool Receive(const GuestMemMap& mem, const DiskWriter& write_disk,
+                 SnapshotFile::Sections* state);
+
+    // Uncompressed bytes of RAM and disk data sent so far, zero runs aside;
+    // the source paces pre-copy by it.
+    uint64_t payload_bytes() const { return payload_bytes_; }
+    uint64_t wire_bytes() const { return wire_bytes_; }
+
+private:
+    class RunBatcher;
+
+    MigrationStream() = default;
+
+    bool SendAll(const void* data, size_t len);
+    bool RecvAll(void* data, size_t len);
+    // A record of `type` for [offset, offset+len), its data compressed when
+    // that makes it smaller; `data` is null for zero runs and control.
+    bool SendRecord(uint32_t type, uint64_t offset, const void* data, uint32_t len);
+
+    bool wsa_started_ = false;
+    uintptr_t socket_ = ~uintptr_t(0);  // SOCKET
+    int level_ = 1;
+    void* cctx_ = nullptr;  // ZSTD_CCtx
+    void* dctx_ = nullptr;  // ZSTD_DCtx
+    std::vector<uint8_t> buffer_;
+    uint64_t payload_bytes_ = 0;
+    uint64_t wire_bytes_ = 0;
+};
@@ -0,0 +1,181 @@
+#include "core/vmm/page_dedup.h"
+#include "core/vmm/guest_ram.h"
+
+#include <algorithm>
+#include <vector>
+
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+
+namespace {
+
+// Pages queried per QueryWorkingSetEx call; one LazyGuestRam chunk.
+constexpr uint64_t kBatchPages = LazyGuestRam::kChunkSize / kPageSize;
+
+// NtSetSystemInformation(SystemCombinePhysicalMemoryInformation). A null
+// handle combines across the whole system.
+constexpr ULONG kSystemCombinePhysicalMemoryInformation = 130;
+
+struct MemoryCombineInformationEx {
+    HANDLE handle;
+    ULONG_PTR pages_combined;
+    ULONG flags;
+};
+
+using NtSetSystemInformationFn = LONG(NTAPI*)(ULONG, PVOID, ULONG);
+
+uint32_t HashPage(const uint8_t* page) {
+    const auto* words = reinterpret_cast<const uint64_t*>(page);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint64_t i = 0; i < kPageSize / sizeof(uint64_t); i++) {
+        h = (h ^ words[i]) * 0x100000001b3ULL;
+    }
+    auto folded = static_cast<uint32_t>(h ^ (h >> 32));
+    return folded ? folded : 1;  // 0 marks "not resident"
+}
+
+bool IsZeroPage(const uint8_t* page) {
+    const auto* words = reinterpret_cast<const uint64_t*>(page);
+    for (uint64_t i = 0; i < kPageSize / sizeof(uint64_t); i++) {
+        if (words[i]) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+PageDedupScanner::PageDedupScanner(const GuestMemMap& mem)
+    : mem_(mem), num_pages_(mem.alloc_size / kPageSize) {
+    static const uint8_t kZeroPage[kPageSize] = {};
+    zero_hash_ = HashPage(kZeroPage);
+}
+
+PageDedupScanner::~PageDedupScanner() {
+    Stop();
+}
+
+bool PageDedupScanner::Start(uint32_t interval_ms, PassCallback on_pass) {
+    if (thread_.joinable() || !mem_.base) return false;
+    hashes_ = std::make_unique<uint32_t[]>(num_pages_);
+    interval_ms_ = std::max<uint32_t>(interval_ms, 1000);
+    on_pass_ = std::move(on_pass);
+    stop_ = false;
+    thread_ = std::thread(&PageDedupScanner::ThreadFunc, this);
+    LOG_INFO("Page dedup: scanning %llu MB every %u s",
+             mem_.alloc_size >> 20, interval_ms_ / 1000);
+    return true;
+}
+
+void PageDedupScanner::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        stop_ = true;
+    }
+    wait_cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+PageDedupScanner::Stats PageDedupScanner::GetStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void PageDedupScanner::ThreadFunc() {
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            wait_cv_.wait_for(lock, std::chrono::milliseconds(interval_ms_),
+                              [this] { return stop_.load(); });
+        }
+        if (stop_) return;
+        RunPass();
+        if (stop_) return;
+        if (on_pass_) on_pass_(GetStats());
+    }
+}
+
+void PageDedupScanner::RunPass() {
+    Stats pass;
+    std::vector<uint32_t> stable;
+    PSAPI_WORKING_SET_EX_INFORMATION ws[kBatchPages];
+    HANDLE process = GetCurrentProcess();
+
+    for (uint64_t first = 0; first < num_pages_; first += kBatchPages) {
+        if (stop_) return;
+        uint64_t count = std::min(kBatchPages, num_pages_ - first);
+        uint8_t* base = mem_.base + first * kPageSize;
+        uint32_t* hashes = &hashes_[first];
+
+        // Reading uncommitted on-demand RAM would commit it.
+        if (mem_.lazy && !mem_.lazy->IsCommitted(first * kPageSize)) {
+            std::fill(hashes, hashes + count, 0u);
+            continue;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            ws[i].VirtualAddress = base + i * kPageSize;
+        }
+        // Pages not hashed this pass forget their old hash, so stable
+        // always means seen unchanged in two passes in a row.
+        if (!QueryWorkingSetEx(process, ws,
+                               static_cast<DWORD>(count * sizeof(ws[0])))) {
+            std::fill(hashes, hashes + count, 0u);
+            continue;
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            const auto& attr = ws[i].VirtualAttributes;
+            if (!attr.Valid) {
+                hashes[i] = 0;
+                continue;
+            }
+            pass.resident_pages++;
+            if (attr.Shared) pass.shared_pages++;
+
+            const uint8_t* page = base + i * kPageSize;
+            uint32_t hash = HashPage(page);
+            if (hash == hashes[i]) {
+                stable.push_back(hash);
+                if (hash == zero_hash_ && IsZeroPage(page)) pass.zero_pages++;
+            }
+            hashes[i] = hash;
+        }
+    }
+
+    pass.stable_pages = stable.size();
+    std::sort(stable.begin(), stable.end());
+    pass.duplicate_pages = stable.size() -
+        (std::unique(stable.begin(), stable.end()) - stable.begin());
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    pass.passes = stats_.passes + 1;
+    pass.combined_pages = stats_.combined_pages;
+    stats_ = pass;
+}
+
+bool PageDedupScanner::Combine(uint64_t* pages_combined) {
+    static auto set_info = reinterpret_cast<NtSetSystemInformationFn>(
+        GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtSetSystemInformation"));
+    if (!set_info) return false;
+    if (!EnableProcessPrivilege(L"SeProfileSingleProcessPrivilege")) {
+        LOG_WARN("Page dedup: SeProfileSingleProcessPrivilege not held");
+        return false;
+    }
+
+    MemoryCombineInformationEx info{};
+    LONG status = set_info(kSystemCombinePhysicalMemoryInformation, &info,
+                           sizeof(info));
+    if (status < 0) {
+        LOG_WARN("Page dedup: combining failed (0x%08lX)", status);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.combined_pages += info.pages_combined;
+    }
+    if (pages_combined) *pages_combined = info.pages_combined;
+    LOG_INFO("Page dedup: %llu pages combined",
+             static_cast<unsigned long long>(info.pages_combined));
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Background scan for guest pages worth sharing with other VMs.
+//
+// Each pass hashes the guest pages that are resident (QueryWorkingSetEx,
+// so the scan never faults in discarded or uncommitted memory) and
+// compares them with the previous pass. A page whose hash held across two
+// passes is stable, i.e. read-mostly, and worth merging.
+//
+// The merging itself is Windows memory combining: the kernel keeps one
+// tree of identical private pages for the whole system and backs each set
+// with a single copy-on-write page, so guests of other runtimes booted
+// from the same images are merged as well. A combine walks all of memory,
+// so it only runs when the manager asks (Combine()); passes just report
+// how much there is to gain.
+class PageDedupScanner {
+public:
+    struct Stats {
+        uint64_t passes = 0;
+        // From the last full pass:
+        uint64_t resident_pages = 0;   // hashed
+        uint64_t stable_pages = 0;     // same contents as the pass before
+        uint64_t zero_pages = 0;       // stable and all zero
+        uint64_t duplicate_pages = 0;  // stable copies of another page here
+        uint64_t shared_pages = 0;     // already backed by a shared page
+        // Across all Combine() calls:
+        uint64_t combined_pages = 0;
+    };
+
+    using PassCallback = std::function<void(const Stats& stats)>;
+
+    explicit PageDedupScanner(const GuestMemMap& mem);
+    ~PageDedupScanner();
+
+    PageDedupScanner(const PageDedupScanner&) = delete;
+    PageDedupScanner& operator=(const PageDedupScanner&) = delete;
+
+    // Runs a pass every `interval_ms`; `on_pass` is called from the scan
+    // thread after each one.
+    bool Start(uint32_t interval_ms, PassCallback on_pass);
+    void Stop();
+
+    Stats GetStats() const;
+
+    // Asks the kernel to combine identical pages system-wide. Needs
+    // SeProfileSingleProcessPrivilege.
+    bool Combine(uint64_t* pages_combined);
+
+private:
+    void ThreadFunc();
+    void RunPass();
+
+    GuestMemMap mem_;
+    uint64_t num_pages_ = 0;
+    // Hash of each page as of the last pass, 0 if that pass did not hash it.
+    std::unique_ptr<uint32_t[]> hashes_;
+    uint32_t zero_hash_ = 0;
+
+    PassCallback on_pass_;
+    uint32_t interval_ms_ = 0;
+    std::thread thread_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+    std::atomic<bool> stop_{false};
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+};
@@ -0,0 +1,369 @@
+#include "core/vmm/snapshot.h"
+#include "core/vmm/utf8.h"
+#include "core/vmm/guest_ram.h"
+
+#include <algorithm>
+#include <bit>
+
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'B', 'X', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint64_t kStateOffset = 4096;
+// MapViewOfFile offsets are multiples of the allocation granularity.
+constexpr uint64_t kRamAlignment = 64 * 1024;
+// Largest single ReadFile/WriteFile.
+constexpr uint64_t kMaxIo = 64ULL << 20;
+// Room left after the state, a hole until used, so an incremental update
+// can rewrite state that grew a little.
+constexpr uint64_t kStateReserve = 1ULL << 20;
+// Set while an incremental update rewrites the file in place.
+constexpr uint32_t kFlagIncomplete = 0x1;
+// Taken with the local APICs in x2APIC mode.
+constexpr uint32_t kFlagX2Apic = 0x2;
+
+#pragma pack(push, 1)
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cpu_count;
+    uint64_t state_offset;
+    uint64_t state_size;
+    uint64_t ram_offset;
+    uint64_t ram_size;
+    uint32_t flags;  // kFlag*; zero in files written before it existed
+};
+#pragma pack(pop)
+
+bool WriteAt(HANDLE file, uint64_t offset, const void* data, uint64_t len) {
+    auto* p = static_cast<const uint8_t*>(data);
+    while (len) {
+        DWORD chunk = static_cast<DWORD>(std::min(len, kMaxIo));
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written = 0;
+        if (!WriteFile(file, p, chunk, &written, &ov) || written != chunk) return false;
+        p += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool ReadAt(HANDLE file, uint64_t offset, void* data, uint64_t len) {
+    auto* p = static_cast<uint8_t*>(data);
+    while (len) {
+        DWORD chunk = static_cast<DWORD>(std::min(len, kMaxIo));
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD read = 0;
+        if (!ReadFile(file, p, chunk, &read, &ov) || read != chunk) return false;
+        p += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+// Zeroes [offset, offset+len), deallocating it where the file is sparse.
+bool ZeroAt(HANDLE file, uint64_t offset, uint64_t len) {
+    FILE_ZERO_DATA_INFORMATION zero{};
+    zero.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    zero.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(offset + len);
+    DWORD ret = 0;
+    return DeviceIoControl(file, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), nullptr, 0,
+                           &ret, nullptr) != 0;
+}
+
+bool IsZeroPage(const uint8_t* page) {
+    const auto* words = reinterpret_cast<const uint64_t*>(page);
+    for (uint64_t i = 0; i < kPageSize / sizeof(uint64_t); i++) {
+        if (words[i]) return false;
+    }
+    return true;
+}
+
+// Writes the non-zero pages of guest RAM; the rest stay holes. Returns the
+// bytes written, or UINT64_MAX on failure.
+uint64_t WriteRam(HANDLE file, uint64_t file_offset, const GuestMemMap& mem) {
+    uint64_t written = 0;
+    uint64_t run = 0, run_len = 0;
+    auto flush = [&]() {
+        if (!run_len) return true;
+        if (!WriteAt(file, file_offset + run, mem.base + run, run_len)) return false;
+        written += run_len;
+        run_len = 0;
+        return true;
+    };
+
+    for (uint64_t offset = 0; offset < mem.alloc_size;) {
+        // Reading RAM that was never committed would commit it; it is zero.
+        if (mem.lazy && !mem.lazy->IsCommitted(offset)) {
+            if (!flush()) return UINT64_MAX;
+            offset = AlignDown(offset, LazyGuestRam::kChunkSize) + LazyGuestRam::kChunkSize;
+            continue;
+        }
+        if (IsZeroPage(mem.base + offset)) {
+            if (!flush()) return UINT64_MAX;
+        } else {
+            if (run_len == kMaxIo && !flush()) return UINT64_MAX;
+            if (!run_len) run = offset;
+            run_len += kPageSize;
+        }
+        offset += kPageSize;
+    }
+    return flush() ? written : UINT64_MAX;
+}
+
+// Rewrites the pages set in `dirty`: non-zero ones are written and the
+// rest zeroed. Returns the bytes written, or UINT64_MAX on failure.
+uint64_t WriteDirtyRam(HANDLE file, uint64_t file_offset, const GuestMemMap& mem,
+                       const std::vector<uint64_t>& dirty) {
+    uint64_t written = 0;
+    uint64_t run = 0, run_len = 0;
+    bool run_zero = false;
+    auto flush = [&]() {
+        if (!run_len) return true;
+        if (run_zero ? !ZeroAt(file, file_offset + run, run_len)
+                     : !WriteAt(file, file_offset + run, mem.base + run, run_len)) {
+            return false;
+        }
+        if (!run_zero) written += run_len;
+        run_len = 0;
+        return true;
+    };
+
+    uint64_t pages = mem.alloc_size / kPageSize;
+    for (uint64_t word = 0; word < dirty.size(); word++) {
+        for (uint64_t bits = dirty[word]; bits; bits &= bits - 1) {
+            uint64_t page = word * 64 + std::countr_zero(bits);
+            if (page >= pages) break;
+            uint64_t offset = page * kPageSize;
+            // As in WriteRam, uncommitted RAM is zero and must not be read.
+            bool zero = (mem.lazy && !mem.lazy->IsCommitted(offset)) ||
+                        IsZeroPage(mem.base + offset);
+            if (run_len && (offset != run + run_len || zero != run_zero ||
+                            run_len == kMaxIo)) {
+                if (!flush()) return UINT64_MAX;
+            }
+            if (!run_len) {
+                run = offset;
+                run_zero = zero;
+            }
+            run_len += kPageSize;
+        }
+    }
+    return flush() ? written : UINT64_MAX;
+}
+
+} // namespace
+
+std::vector<uint8_t> SnapshotFile::EncodeSections(const Sections& sections) {
+    StateWriter state;
+    state.Put(static_cast<uint32_t>(sections.size()));
+    for (const auto& [name, data] : sections) {
+        state.PutString(name);
+        state.PutVector(data);
+    }
+    return state.Take();
+}
+
+bool SnapshotFile::DecodeSections(const std::vector<uint8_t>& state, Sections* sections) {
+    StateReader in(state);
+    uint32_t count = 0;
+    in.Get(&count);
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+        std::string name;
+        std::vector<uint8_t> data;
+        in.GetString(&name);
+        in.GetVector(&data);
+        (*sections)[name] = std::move(data);
+    }
+    return in.ok();
+}
+
+SnapshotFile::~SnapshotFile() {
+    if (view_) UnmapViewOfFile(view_);
+    if (mapping_) CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+    if (file_) CloseHandle(reinterpret_cast<HANDLE>(file_));
+}
+
+bool SnapshotFile::Write(const std::string& path, uint32_t cpu_count, bool x2apic,
+                         const Sections& sections, const GuestMemMap& mem) {
+    std::vector<uint8_t> state = EncodeSections(sections);
+
+    SnapshotHeader hdr{};
+    std::memcpy(hdr.magic, kMagic, sizeof(kMagic));
+    hdr.version = kVersion;
+    hdr.cpu_count = cpu_count;
+    hdr.state_offset = kStateOffset;
+    hdr.state_size = state.size();
+    hdr.ram_offset = AlignUp(kStateOffset + hdr.state_size + kStateReserve, kRamAlignment);
+    hdr.ram_size = mem.alloc_size;
+    hdr.flags = x2apic ? kFlagX2Apic : 0;
+
+    std::wstring tmp = Utf8ToWide(path + ".tmp");
+    HANDLE file = CreateFileW(tmp.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("Snapshot: cannot create %s.tmp (%lu)", path.c_str(), GetLastError());
+        return false;
+    }
+    // Without it (FAT, some network shares) zero pages are written out.
+    DWORD ret = 0;
+    DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &ret, nullptr);
+
+    uint64_t ram_written = 0;
+    bool ok = WriteAt(file, 0, &hdr, sizeof(hdr)) &&
+              WriteAt(file, hdr.state_offset, state.data(), hdr.state_size);
+    if (ok) {
+        ram_written = WriteRam(file, hdr.ram_offset, mem);
+        ok = ram_written != UINT64_MAX;
+    }
+    if (ok) {
+        // Trailing zero pages are holes as well; the size covers them.
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(hdr.ram_offset + hdr.ram_size);
+        ok = SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file) &&
+             FlushFileBuffers(file);
+    }
+    DWORD err = ok ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(file);
+    if (ok && !MoveFileExW(tmp.c_str(), Utf8ToWide(path).c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        ok = false;
+        err = GetLastError();
+    }
+    if (!ok) {
+        LOG_ERROR("Snapshot: writing %s failed (%lu)", path.c_str(), err);
+        DeleteFileW(tmp.c_str());
+        return false;
+    }
+    LOG_INFO("Snapshot: %s saved, %llu KB of state, %llu of %llu MB of RAM written",
+             path.c_str(), hdr.state_size >> 10, ram_written >> 20, hdr.ram_size >> 20);
+    return true;
+}
+
+bool SnapshotFile::WriteIncremental(const std::string& path, uint32_t cpu_count, bool x2apic,
+                                    const Sections& sections, const GuestMemMap& mem,
+                                    const std::vector<uint64_t>& dirty) {
+    std::vector<uint8_t> state = EncodeSections(sections);
+
+    HANDLE file = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_WARN("Snapshot: cannot update %s (%lu)", path.c_str(), GetLastError());
+        return false;
+    }
+    SnapshotHeader hdr{};
+    if (!ReadAt(file, 0, &hdr, sizeof(hdr)) ||
+        std::memcmp(hdr.magic, kMagic, sizeof(kMagic)) != 0 || hdr.version != kVersion ||
+        (hdr.flags & kFlagIncomplete) || hdr.cpu_count != cpu_count ||
+        ((hdr.flags & kFlagX2Apic) != 0) != x2apic ||
+        hdr.ram_size != mem.alloc_size || hdr.state_offset + state.size() > hdr.ram_offset) {
+        CloseHandle(file);
+        LOG_INFO("Snapshot: %s does not take this update, writing it in full", path.c_str());
+        return false;
+    }
+
+    // Until the flag is cleared again the file is neither snapshot, and
+    // Open() turns it down.
+    hdr.flags |= kFlagIncomplete;
+    bool ok = WriteAt(file, 0, &hdr, sizeof(hdr)) && FlushFileBuffers(file);
+    hdr.state_size = state.size();
+    ok = ok && WriteAt(file, hdr.state_offset, state.data(), hdr.state_size);
+    uint64_t ram_written = ok ? WriteDirtyRam(file, hdr.ram_offset, mem, dirty) : 0;
+    ok = ok && ram_written != UINT64_MAX && FlushFileBuffers(file);
+    hdr.flags &= ~kFlagIncomplete;
+    ok = ok && WriteAt(file, 0, &hdr, sizeof(hdr)) && FlushFileBuffers(file);
+    DWORD err = ok ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(file);
+    if (!ok) {
+        LOG_ERROR("Snapshot: updating %s failed (%lu)", path.c_str(), err);
+        return false;
+    }
+    LOG_INFO("Snapshot: %s updated, %llu KB of state, %llu MB of dirty RAM written",
+             path.c_str(), hdr.state_size >> 10, ram_written >> 20);
+    return true;
+}
+
+std::unique_ptr<SnapshotFile> SnapshotFile::Open(const std::string& path) {
+    HANDLE file = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("Snapshot: cannot open %s (%lu)", path.c_str(), GetLastError());
+        return nullptr;
+    }
+    auto snap = std::unique_ptr<SnapshotFile>(new SnapshotFile());
+    snap->file_ = file;
+
+    SnapshotHeader hdr{};
+    if (!ReadAt(file, 0, &hdr, sizeof(hdr)) ||
+        std::memcmp(hdr.magic, kMagic, sizeof(kMagic)) != 0) {
+        LOG_ERROR("Snapshot: %s is not a snapshot", path.c_str());
+        return nullptr;
+    }
+    if (hdr.version != kVersion) {
+        LOG_ERROR("Snapshot: %s is version %u, expected %u", path.c_str(),
+                  hdr.version, kVersion);
+        return nullptr;
+    }
+    if (hdr.flags & kFlagIncomplete) {
+        LOG_ERROR("Snapshot: %s was cut off while being updated", path.c_str());
+        return nullptr;
+    }
+    LARGE_INTEGER size{};
+    GetFileSizeEx(file, &size);
+    if (hdr.state_offset + hdr.state_size > hdr.ram_offset ||
+        hdr.ram_offset % kRamAlignment ||
+        static_cast<uint64_t>(size.QuadPart) < hdr.ram_offset + hdr.ram_size) {
+        LOG_ERROR("Snapshot: %s is truncated", path.c_str());
+        return nullptr;
+    }
+
+    std::vector<uint8_t> state(hdr.state_size);
+    if (!ReadAt(file, hdr.state_offset, state.data(), state.size())) {
+        LOG_ERROR("Snapshot: reading %s failed (%lu)", path.c_str(), GetLastError());
+        return nullptr;
+    }
+    if (!DecodeSections(state, &snap->sections_)) {
+        LOG_ERROR("Snapshot: %s has corrupt device state", path.c_str());
+        return nullptr;
+    }
+
+    snap->ram_offset_ = hdr.ram_offset;
+    snap->ram_size_ = hdr.ram_size;
+    snap->cpu_count_ = hdr.cpu_count;
+    snap->x2apic_ = (hdr.flags & kFlagX2Apic) != 0;
+    return snap;
+}
+
+const std::vector<uint8_t>* SnapshotFile::Section(const std::string& name) const {
+    auto it = sections_.find(name);
+    return it != sections_.end() ? &it->second : nullptr;
+}
+
+uint8_t* SnapshotFile::MapRam() {
+    if (view_) return view_;
+    mapping_ = CreateFileMappingW(reinterpret_cast<HANDLE>(file_), nullptr,
+                                  PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!mapping_) {
+        LOG_ERROR("Snapshot: CreateFileMapping failed (%lu)", GetLastError());
+        return nullptr;
+    }
+    view_ = static_cast<uint8_t*>(MapViewOfFile(
+        reinterpret_cast<HANDLE>(mapping_), FILE_MAP_COPY,
+        static_cast<DWORD>(ram_offset_ >> 32), static_cast<DWORD>(ram_offset_),
+        static_cast<SIZE_T>(ram_size_)));
+    if (!view_) {
+        LOG_ERROR("Snapshot: mapping %llu MB of RAM failed (%lu)", ram_size_ >> 20,
+                  GetLastError());
+        return nullptr;
+    }
+    return view_;
+}
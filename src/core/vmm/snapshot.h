@@ -0,0 +1,165 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Device state for a snapshot, as a flat byte stream. Each device writes
+// its fields in a fixed order and reads them back the same way; the file
+// version covers the layout of all of them.
+class StateWriter {
+public:
+    void PutBytes(const void* data, size_t len) {
+        auto* p = static_cast<const uint8_t*>(data);
+        data_.insert(data_.end(), p, p + len);
+    }
+
+    template <typename T>
+    void Put(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        PutBytes(&value, sizeof(T));
+    }
+
+    void PutString(std::string_view s) {
+        Put(static_cast<uint32_t>(s.size()));
+        PutBytes(s.data(), s.size());
+    }
+
+    template <typename T>
+    void PutVector(const std::vector<T>& v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Put(static_cast<uint64_t>(v.size()));
+        PutBytes(v.data(), v.size() * sizeof(T));
+    }
+
+    const std::vector<uint8_t>& data() const { return data_; }
+    std::vector<uint8_t> Take() { return std::move(data_); }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+// Reads what a StateWriter wrote. A read past the end fails, as does every
+// read after it, so a device can read all its fields and check ok() once.
+class StateReader {
+public:
+    StateReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+    explicit StateReader(const std::vector<uint8_t>& data)
+        : StateReader(data.data(), data.size()) {}
+
+    bool GetBytes(void* out, size_t len) {
+        if (!ok_ || len > size_ - pos_) {
+            ok_ = false;
+            std::memset(out, 0, len);
+            return false;
+        }
+        std::memcpy(out, data_ + pos_, len);
+        pos_ += len;
+        return true;
+    }
+
+    template <typename T>
+    bool Get(T* out) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return GetBytes(out, sizeof(T));
+    }
+
+    bool GetString(std::string* out) {
+        uint32_t len = 0;
+        if (!Get(&len) || len > size_ - pos_) return Fail();
+        out->assign(reinterpret_cast<const char*>(data_ + pos_), len);
+        pos_ += len;
+        return true;
+    }
+
+    template <typename T>
+    bool GetVector(std::vector<T>* out) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        uint64_t count = 0;
+        if (!Get(&count) || count > (size_ - pos_) / sizeof(T)) return Fail();
+        out->resize(count);
+        return GetBytes(out->data(), count * sizeof(T));
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    bool Fail() {
+        ok_ = false;
+        return false;
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+// A suspended VM on disk: named device state sections followed by guest
+// RAM. RAM starts on an allocation granularity boundary so it maps as one
+// view, and is written sparse: all-zero pages are left as holes.
+class SnapshotFile {
+public:
+    static constexpr uint32_t kVersion = 5;
+
+    using Sections = std::map<std::string, std::vector<uint8_t>>;
+
+    ~SnapshotFile();
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    // Writes `sections` and the RAM in `mem` to `path`. Goes through a
+    // temporary file, so `path` only ever holds a complete snapshot.
+    // `x2apic` is the mode the local APICs ran in.
+    static bool Write(const std::string& path, uint32_t cpu_count, bool x2apic,
+                      const Sections& sections, const GuestMemMap& mem);
+    // Updates the snapshot at `path`, left by Write() or an earlier update
+    // for this same VM, in place: new state, plus the RAM pages set in
+    // `dirty` (one bit per page, as DirtyTracker hands them out). Fails
+    // without touching the file if it does not fit, e.g. the state
+    // outgrew its slot; a failure past that leaves a file Open() refuses.
+    static bool WriteIncremental(const std::string& path, uint32_t cpu_count, bool x2apic,
+                                 const Sections& sections, const GuestMemMap& mem,
+                                 const std::vector<uint64_t>& dirty);
+
+    // The state sections as one blob, as the file holds them; also how
+    // live migration sends them.
+    static std::vector<uint8_t> EncodeSections(const Sections& sections);
+    static bool DecodeSections(const std::vector<uint8_t>& state, Sections* sections);
+
+    // Reads the header and state sections of `path`; RAM stays on disk.
+    static std::unique_ptr<SnapshotFile> Open(const std::string& path);
+
+    uint64_t ram_size() const { return ram_size_; }
+    uint32_t cpu_count() const { return cpu_count_; }
+    // Taken with the local APICs in x2APIC mode; it resumes only in that
+    // mode.
+    bool x2apic() const { return x2apic_; }
+    // Contents of section `name`, or nullptr if the snapshot has none.
+    const std::vector<uint8_t>* Section(const std::string& name) const;
+    const Sections& sections() const { return sections_; }
+
+    // Maps the saved RAM copy-on-write: pages are read in from the file as
+    // the guest touches them, and its writes stay private to this process.
+    // The view lives as long as this object.
+    uint8_t* MapRam();
+
+private:
+    SnapshotFile() = default;
+
+    void* file_ = nullptr;     // HANDLE
+    void* mapping_ = nullptr;  // HANDLE
+    uint8_t* view_ = nullptr;
+    uint64_t ram_offset_ = 0;
+    uint64_t ram_size_ = 0;
+    uint32_t cpu_count_ = 0;
+    bool x2apic_ = false;
+    Sections sections_;
+};
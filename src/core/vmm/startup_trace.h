@@ -0,0 +1,40 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Milestones of one VM start, as offsets from when the trace was created.
+// Marks come from the thread doing each step, so the trace is locked.
+class StartupTrace {
+public:
+    struct Phase {
+        std::string name;
+        uint64_t us = 0;
+    };
+
+    StartupTrace() : start_(std::chrono::steady_clock::now()) {}
+
+    void Mark(const std::string& name) {
+        auto us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            phases_.push_back({name, us});
+        }
+        LOG_INFO("Startup: %s at %llu.%03llu ms", name.c_str(), us / 1000, us % 1000);
+    }
+
+    std::vector<Phase> Phases() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return phases_;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+    mutable std::mutex mutex_;
+    std::vector<Phase> phases_;
+};
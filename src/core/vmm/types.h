@@ -2,6 +2,7 @@
 
 #define NOMINMAX
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
 #include <string>
@@ -31,18 +32,41 @@ inline uint64_t AlignDown(uint64_t val, uint64_t align) {
 constexpr GPA kMmioGapStart = 0xC0000000;  // 3 GiB
 constexpr GPA kMmioGapEnd   = 0x100000000; // 4 GiB
 
+// Granule of hotplugged memory: plugged and unplugged in whole blocks.
+constexpr uint64_t kHotplugBlockSize = 2ULL << 20;
+
+class LazyGuestRam;
+class NodeGuestRam;
+class DirtyTracker;
+
 struct GuestMemMap {
     uint8_t* base = nullptr;
     uint64_t alloc_size = 0;   // total bytes of the host VirtualAlloc
     uint64_t low_size   = 0;   // guest RAM in [0, low_size)
     GPA      high_base  = 0;   // GPA where high RAM begins (kMmioGapEnd)
     uint64_t high_size  = 0;   // guest RAM in [high_base, high_base+high_size)
+    LazyGuestRam* lazy  = nullptr;  // set when RAM is committed on demand
+    const NodeGuestRam* numa = nullptr;  // set when RAM is one allocation per node
+    bool large_pages    = false;    // RAM on large pages, which are never given back
+    DirtyTracker* dirty = nullptr;  // set when writes are tracked for checkpoints
+    // Hotplug region (virtio-mem), reserved at hotplug_hva. Only the blocks
+    // set in hotplug_plugged, one bit per kHotplugBlockSize, have memory.
+    GPA      hotplug_base = 0;
+    uint64_t hotplug_size = 0;
+    uint8_t* hotplug_hva  = nullptr;
+    const std::atomic<uint64_t>* hotplug_plugged = nullptr;
 
     uint8_t* GpaToHva(GPA gpa) const {
         if (gpa < low_size)
             return base + gpa;
         if (high_size && gpa >= high_base && gpa - high_base < high_size)
             return base + low_size + (gpa - high_base);
+        if (hotplug_size && gpa >= hotplug_base && gpa - hotplug_base < hotplug_size) {
+            uint64_t block = (gpa - hotplug_base) / kHotplugBlockSize;
+            uint64_t word = hotplug_plugged[block / 64].load(std::memory_order_acquire);
+            if (word & (1ULL << (block % 64)))
+                return hotplug_hva + (gpa - hotplug_base);
+        }
         return nullptr;
     }
 
@@ -0,0 +1,24 @@
+#include "core/vmm/utf8.h"
+
+#define NOMINMAX
+#include <windows.h>
+
+std::wstring Utf8ToWide(std::string_view utf8) {
+    if (utf8.empty()) return {};
+    int len = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), nullptr, 0);
+    if (len <= 0) return {};
+    std::wstring wide(len, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), wide.data(), len);
+    return wide;
+}
+
+std::string WideToUtf8(std::wstring_view wide) {
+    if (wide.empty()) return {};
+    int len = WideCharToMultiByte(CP_UTF8, 0, wide.data(), (int)wide.size(),
+                                  nullptr, 0, nullptr, nullptr);
+    if (len <= 0) return {};
+    std::string utf8(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wide.data(), (int)wide.size(), utf8.data(), len,
+                        nullptr, nullptr);
+    return utf8;
+}
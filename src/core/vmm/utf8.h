@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// UTF-8 paths and names to and from the UTF-16 the wide Win32 calls take.
+// Invalid input converts to an empty string.
+std::wstring Utf8ToWide(std::string_view utf8);
+std::string WideToUtf8(std::wstring_view wide);
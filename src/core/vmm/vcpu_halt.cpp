@@ -0,0 +1,113 @@
+#include "core/vmm/vcpu_halt.h"
+
+#include <algorithm>
+
+#include <windows.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+namespace {
+
+int64_t QpcNow() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+// First window once polling would have caught a wakeup.
+constexpr uint32_t kInitialPollUs = 10;
+
+}  // namespace
+
+VCpuHalt::~VCpuHalt() {
+    if (timer_) CloseHandle(reinterpret_cast<HANDLE>(timer_));
+    if (wake_event_) CloseHandle(reinterpret_cast<HANDLE>(wake_event_));
+}
+
+bool VCpuHalt::Init() {
+    HANDLE event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!event) {
+        LOG_ERROR("VCpuHalt: CreateEvent failed (%lu)", GetLastError());
+        return false;
+    }
+    // The default timer resolution would turn the bounded sleep into a
+    // full scheduler tick.
+    HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr,
+        CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer) timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+    if (!timer) {
+        LOG_ERROR("VCpuHalt: CreateWaitableTimer failed (%lu)", GetLastError());
+        CloseHandle(event);
+        return false;
+    }
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    qpc_freq_ = freq.QuadPart;
+    wake_event_ = event;
+    timer_ = timer;
+    return true;
+}
+
+void VCpuHalt::Kick() {
+    pending_.store(true);
+    if (sleeping_.load()) SetEvent(reinterpret_cast<HANDLE>(wake_event_));
+}
+
+void VCpuHalt::Wait() {
+    int64_t start = QpcNow();
+    int64_t poll_end = start + qpc_freq_ * poll_us_ / 1000000;
+
+    bool polled = false;
+    while (QpcNow() < poll_end) {
+        if (pending_.load(std::memory_order_relaxed)) {
+            polled = true;
+            break;
+        }
+        YieldProcessor();
+    }
+
+    if (polled) {
+        pending_.store(false);
+    } else {
+        // Publish `sleeping_` before the last check so a Kick() racing with
+        // us either sees it and signals, or lands before the check.
+        sleeping_.store(true);
+        if (!pending_.exchange(false)) {
+            LARGE_INTEGER due;
+            due.QuadPart = -static_cast<LONGLONG>(kMaxSleepUs) * 10;
+            SetWaitableTimer(reinterpret_cast<HANDLE>(timer_), &due, 0,
+                             nullptr, nullptr, FALSE);
+            HANDLE handles[2] = {reinterpret_cast<HANDLE>(wake_event_),
+                                 reinterpret_cast<HANDLE>(timer_)};
+            WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+            CancelWaitableTimer(reinterpret_cast<HANDLE>(timer_));
+        }
+        sleeping_.store(false);
+        pending_.store(false);
+    }
+
+    uint64_t halted_us = static_cast<uint64_t>(QpcNow() - start) * 1000000 /
+                         static_cast<uint64_t>(qpc_freq_);
+
+    if (!polled && halted_us < kMaxPollUs) {
+        // Woken soon after the window closed: a longer poll would have
+        // avoided the sleep.
+        poll_us_ = poll_us_ ? std::min(poll_us_ * 2, kMaxPollUs) : kInitialPollUs;
+    } else if (halted_us >= kMaxPollUs) {
+        poll_us_ = poll_us_ > kInitialPollUs ? poll_us_ / 2 : 0;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.halts++;
+    if (polled) stats_.poll_wakeups++;
+    stats_.halted_ns += halted_us * 1000;
+    stats_.poll_us = poll_us_;
+}
+
+VCpuHalt::Stats VCpuHalt::GetStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
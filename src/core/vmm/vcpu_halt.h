@@ -0,0 +1,55 @@
+#pragma once
+
+#include "core/vmm/types.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Blocks a halted vCPU thread until something may have made an interrupt
+// deliverable.
+//
+// Interrupts the VMM injects call Kick(). The local APIC timer and IPIs are
+// handled inside the hypervisor and never reach us, so a sleep is also
+// bounded by kMaxSleepUs; the vCPU then re-enters the guest, which halts
+// again if nothing is pending. Before sleeping the thread polls for a short,
+// adaptive window: it grows while wakeups keep arriving just after the
+// window closes and shrinks when halts run long, so busy guests skip the
+// sleep/wake latency and idle ones stop polling.
+class VCpuHalt {
+public:
+    static constexpr uint32_t kMaxPollUs = 200;
+    static constexpr uint32_t kMaxSleepUs = 1000;
+
+    struct Stats {
+        uint64_t halts = 0;
+        uint64_t poll_wakeups = 0;   // halts that ended while polling
+        uint64_t halted_ns = 0;      // time spent in Wait()
+        uint32_t poll_us = 0;        // current poll window
+    };
+
+    VCpuHalt() = default;
+    ~VCpuHalt();
+
+    VCpuHalt(const VCpuHalt&) = delete;
+    VCpuHalt& operator=(const VCpuHalt&) = delete;
+
+    bool Init();
+
+    // Called on the vCPU thread after a HLT exit.
+    void Wait();
+    // Wakes the vCPU if it is in Wait(), otherwise makes the next Wait()
+    // return at once. Safe from any thread.
+    void Kick();
+
+    Stats GetStats() const;
+
+private:
+    void* wake_event_ = nullptr;
+    void* timer_ = nullptr;
+    int64_t qpc_freq_ = 1;
+    std::atomic<bool> pending_{false};
+    std::atomic<bool> sleeping_{false};
+    uint32_t poll_us_ = 0;
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+};
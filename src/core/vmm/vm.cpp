@@ -1,7 +1,9 @@
 #include "core/vmm/vm.h"
 #include "core/arch/x86_64/boot.h"
+#include "core/vmm/etw.h"
 #include "platform/windows/console/std_console_port.h"
 #include <algorithm>
+#include <future>
 
 static constexpr uint64_t kVirtioMmioBase       = 0xd0000000;
 static constexpr uint8_t  kVirtioBlkIrq         = 5;
@@ -19,16 +21,94 @@ static constexpr uint64_t kVirtioFsMmioBase     = 0xd0000c00;
 static constexpr uint8_t  kVirtioFsBaseIrq      = 16;
 static constexpr uint64_t kVirtioSndMmioBase    = 0xd0000e00;
 static constexpr uint8_t  kVirtioSndIrq         = 17;
+static constexpr uint64_t kVirtioBalloonMmioBase = 0xd0001000;
+static constexpr uint8_t  kVirtioBalloonIrq     = 18;
+static constexpr uint64_t kVirtioVsockMmioBase  = 0xd0001200;
+static constexpr uint8_t  kVirtioVsockIrq       = 19;
+static constexpr uint64_t kVirtioMemMmioBase    = 0xd0001400;
+static constexpr uint8_t  kVirtioMemIrq         = 20;
+// 32-bit window for PCI BARs, which are assigned here and never moved.
+static constexpr uint32_t kPciMmioWindowBase    = 0xe0000000;
+static constexpr uint32_t kPciMmioWindowSize    = 0x01000000;
+static constexpr uint8_t  kVirtioBlkPciSlot     = 1;
+static constexpr uint32_t kVirtioBlkPciBar      = kPciMmioWindowBase;
+static constexpr uint8_t  kVirtioNetPciSlot     = 2;
+static constexpr uint32_t kVirtioNetPciBar      = kPciMmioWindowBase + VirtioPciDevice::kBarSize;
+// virtio-fs DAX window, placed above guest RAM on a 1 GiB boundary.
+static constexpr uint64_t kVirtioFsDaxWindowSize = 1ULL << 30;
+// virtio-mem region, between RAM and the DAX window on the same boundary.
+// Its size is rounded to what Linux hotplugs as one memory block.
+static constexpr uint64_t kVirtioMemAlign       = 1ULL << 30;
+static constexpr uint64_t kVirtioMemSizeAlign   = 128ULL << 20;
+// How long SetCpuCount() waits for an ejected vCPU's thread to end before
+// plugging the vCPU back in.
+static constexpr uint32_t kVCpuThreadExitWaitMs = 500;
+// virtio-serial port offered as hvc0 with VmConfig::hvc_console.
+static constexpr uint32_t kHvcConsolePort       = 2;
+// How long a migration target waits for its source to connect.
+static constexpr uint32_t kMigrateAcceptTimeoutS = 600;
+// Guest NUMA nodes split RAM on 2 MiB boundaries, so no large page or
+// on-demand chunk spans two, and get at least kMinNumaNodeRam each.
+static constexpr uint64_t kNumaNodeAlign        = 2ULL << 20;
+static constexpr uint64_t kMinNumaNodeRam       = 128ULL << 20;
+
+// Points the kernel console at hvc0: console=ttyS0 becomes console=hvc0
+// and earlyprintk=serial goes, since hvc0 replays the log buffer once it
+// registers. Adds console=hvc0 if no console= is given.
+static std::string HvcConsoleCmdline(const std::string& cmdline) {
+    std::string out;
+    bool has_console = false;
+    size_t pos = 0;
+    while (pos < cmdline.size()) {
+        size_t end = cmdline.find(' ', pos);
+        if (end == std::string::npos) end = cmdline.size();
+        std::string token = cmdline.substr(pos, end - pos);
+        pos = end + 1;
+        if (token.empty() || token.rfind("earlyprintk=serial", 0) == 0) continue;
+        if (token.rfind("console=ttyS", 0) == 0) token = "console=hvc0";
+        if (token.rfind("console=", 0) == 0) has_console = true;
+        if (!out.empty()) out += ' ';
+        out += token;
+    }
+    if (!has_console) out += out.empty() ? "console=hvc0" : " console=hvc0";
+    return out;
+}
+
+static void AppendKeyReport(std::vector<VirtioInputEvent>* out,
+                            uint32_t evdev_code, bool pressed) {
+    out->push_back({EV_KEY, static_cast<uint16_t>(evdev_code), pressed ? 1u : 0u});
+    out->push_back({EV_SYN, SYN_REPORT, 0});
+}
+
+// Position, then any button that changed since `prev_buttons`.
+static void AppendPointerReport(std::vector<VirtioInputEvent>* out,
+                                int32_t x, int32_t y, uint32_t buttons,
+                                uint32_t* prev_buttons) {
+    out->push_back({EV_ABS, ABS_X, static_cast<uint32_t>(x)});
+    out->push_back({EV_ABS, ABS_Y, static_cast<uint32_t>(y)});
+    static constexpr uint16_t kButtons[] = {BTN_LEFT, BTN_RIGHT, BTN_MIDDLE};
+    for (uint32_t i = 0; i < 3; i++) {
+        uint32_t bit = 1u << i;
+        if ((buttons & bit) != (*prev_buttons & bit)) {
+            out->push_back({EV_KEY, kButtons[i], (buttons & bit) ? 1u : 0u});
+        }
+    }
+    *prev_buttons = buttons;
+    out->push_back({EV_SYN, SYN_REPORT, 0});
+}
 
 Vm::~Vm() {
     running_ = false;
+    // The scan reads guest memory and calls back into the runtime.
+    page_dedup_.reset();
+    if (checkpoint_thread_.joinable())
+        checkpoint_thread_.join();
     if (input_thread_.joinable())
         input_thread_.join();
     if (hid_input_thread_.joinable())
         hid_input_thread_.join();
-    for (auto& t : vcpu_threads_) {
-        if (t.joinable()) t.join();
-    }
+    JoinVCpuThreads();
+    console_tx_.Stop();
 
     // Clear callbacks before destroying objects they reference.
     // This prevents use-after-free when unique_ptrs are destroyed
@@ -38,21 +118,66 @@ Vm::~Vm() {
     }
     if (virtio_serial_) {
         virtio_serial_->SetDataCallback(nullptr);
+        virtio_serial_->SetDrainCallback(nullptr);
     }
     if (virtio_gpu_) {
+        // The worker calls these from its own thread.
+        virtio_gpu_->StopWorker();
         virtio_gpu_->SetFrameCallback(nullptr);
         virtio_gpu_->SetCursorCallback(nullptr);
         virtio_gpu_->SetScanoutStateCallback(nullptr);
     }
+    if (virtio_fs_) {
+        virtio_fs_->StopWorkers();
+        // DAX views are mapped into the partition.
+        if (auto* dax = virtio_fs_->dax_window()) dax->RemoveAll();
+    }
+
+    // Notify and I/O threads run device work against the rings and the
+    // backends; moderation timers inject interrupts into the partition.
+    for (auto* mmio : {virtio_mmio_.get(), virtio_mmio_net_.get(),
+                       virtio_mmio_fs_.get(), virtio_mmio_balloon_.get(),
+                       virtio_mmio_mem_.get()}) {
+        if (mmio) mmio->StopNotifyThread();
+    }
+    for (auto& io_thread : io_threads_) io_thread->Stop();
+    for (auto* mmio : {virtio_mmio_.get(), virtio_mmio_net_.get()}) {
+        if (mmio) mmio->StopInterruptModeration();
+    }
 
     // Stop network backend before releasing guest memory, as its
     // thread may still be accessing virtio_net_ and mem_.
     if (net_backend_) {
         net_backend_->Stop();
     }
+    // RX workers copy received frames into guest memory.
+    if (virtio_net_) {
+        virtio_net_->Stop();
+    }
+    // Block I/O workers write completions straight into guest memory.
+    if (virtio_blk_) {
+        virtio_blk_->Stop();
+    }
+    // The vsock worker receives host socket data into guest buffers.
+    if (virtio_vsock_) {
+        virtio_vsock_->Stop();
+    }
 
     vcpus_.clear();
     whvp_vm_.reset();
+    if (lazy_ram_) {
+        lazy_ram_.reset();
+        mem_.base = nullptr;
+    }
+    if (node_ram_) {
+        node_ram_.reset();
+        mem_.numa = nullptr;
+        mem_.base = nullptr;
+    }
+    if (snapshot_) {
+        snapshot_.reset();
+        mem_.base = nullptr;
+    }
     if (mem_.base) {
         VirtualFree(mem_.base, 0, MEM_RELEASE);
         mem_.base = nullptr;
@@ -67,54 +192,313 @@ std::unique_ptr<Vm> Vm::Create(const VmConfig& config) {
     }
 
     auto vm = std::unique_ptr<Vm>(new Vm());
+    vm->virtio_pci_ = config.virtio_pci;
+    vm->hvc_console_ = config.hvc_console;
     vm->console_port_ = config.console_port;
     vm->input_port_ = config.input_port;
     vm->display_port_ = config.display_port;
     vm->clipboard_port_ = config.clipboard_port;
     vm->audio_port_ = config.audio_port;
+    vm->checkpoint_path_ = config.checkpoint_path;
+    vm->checkpoint_interval_s_ = config.checkpoint_path.empty() ? 0 : config.checkpoint_interval_s;
     if (!vm->console_port_ && config.interactive) {
         vm->console_port_ = std::make_shared<StdConsolePort>();
     }
     uint64_t ram_bytes = config.memory_mb * 1024 * 1024;
+    vm->cpu_count_ = config.cpu_count;
+    vm->max_cpu_count_ = std::max(config.cpu_count, config.max_cpu_count);
 
-    vm->whvp_vm_ = whvp::WhvpVm::Create(config.cpu_count);
-    if (!vm->whvp_vm_) return nullptr;
+    // Devices attach to their I/O threads as they are set up; the threads
+    // start once all of them have.
+    for (uint32_t i = 0; i < std::min(config.io_threads, kMaxIoThreads); i++) {
+        vm->io_threads_.push_back(std::make_unique<IoThread>(i));
+    }
+    for (const auto& [device, index] : config.device_io_threads) {
+        if (!IsIoThreadDevice(device) || index >= vm->io_threads_.size()) {
+            LOG_WARN("I/O thread %u for virtio-%s does not exist, ignored", index,
+                     device.c_str());
+            continue;
+        }
+        vm->device_io_threads_[device] = index;
+    }
 
-    if (!vm->AllocateMemory(ram_bytes)) return nullptr;
+    // Before any worker thread starts, so all of them inherit the VM's CPUs.
+    // NUMA memory brings its own placement: the VM on the node its RAM is
+    // on, or each vCPU and I/O thread on the node of its guest node.
+    uint32_t io_thread_count = static_cast<uint32_t>(vm->io_threads_.size());
+    VCpuPlacement placement = config.vcpu_placement;
+    if (config.numa_memory != NumaMemory::kNone) {
+        if (placement != VCpuPlacement::kNone && placement != VCpuPlacement::kNumaNode) {
+            LOG_WARN("vCPU placement %s ignored with %s NUMA memory",
+                     VCpuPlacementName(placement), NumaMemoryName(config.numa_memory));
+        }
+        placement = VCpuPlacement::kNumaNode;
+    }
+    bool placed = false;
+    if (config.numa_memory == NumaMemory::kSplit) {
+        uint64_t max_nodes = std::min<uint64_t>({x86::kMaxNumaNodes, vm->max_cpu_count_,
+                                                 ram_bytes / kMinNumaNodeRam});
+        placed = vm->cpu_placement_.PlanNodes(static_cast<uint32_t>(max_nodes),
+                                              vm->max_cpu_count_, io_thread_count);
+    }
+    if (!placed) {
+        placed = vm->cpu_placement_.Plan(placement, vm->max_cpu_count_, io_thread_count);
+    }
+    if (placed) vm->cpu_placement_.ApplyToProcess();
+
+    // Opening the disk (qcow2 tables, host file) needs nothing else from
+    // the VM, so it runs alongside everything up to SetupVirtioBlk.
+    // Declared after `vm`, so an early return waits for it.
+    std::future<bool> disk_opened;
+    auto open_disk = [&disk_opened, self = vm.get(), &config] {
+        DiskImageOptions disk_options;
+        disk_options.direct_io = config.disk_direct_io;
+        disk_options.mmap_reads = config.disk_mmap;
+        disk_options.qcow2_l2_cache_bytes = config.qcow2_l2_cache_mb << 20;
+        disk_options.qcow2_compressed_cache_bytes =
+            config.qcow2_compressed_cache_mb << 20;
+        disk_options.readahead_window_bytes = config.disk_readahead_kb * 1024;
+        // Resumed and migrated guests are past their boot.
+        if (config.restore_path.empty() && !config.migrate_listen_port) {
+            disk_options.boot_profile_seconds = config.disk_boot_profile_s;
+        }
+        disk_opened = std::async(std::launch::async,
+            [self, &config, disk_options] {
+                bool ok = self->virtio_blk_->Open(config.disk_path, disk_options);
+                if (ok && config.disk_limits.enabled()) {
+                    self->virtio_blk_->SetIoLimits(config.disk_limits);
+                }
+                // A trace is a diagnostic; the VM runs without one.
+                if (ok && !config.disk_trace_path.empty() &&
+                    !self->virtio_blk_->StartTrace(config.disk_trace_path)) {
+                    LOG_WARN("Block trace disabled");
+                }
+                self->startup_trace_.Mark("disk opened");
+                return ok;
+            });
+    };
+    // A migrated VM's disk waits until the source says how it comes over.
+    bool incoming = config.migrate_listen_port && config.restore_path.empty();
+    if (!config.disk_path.empty()) {
+        vm->virtio_blk_ = std::make_unique<VirtioBlkDevice>(config.cpu_count);
+        if (!incoming) open_disk();
+    }
 
-    if (!vm->SetupDevices()) return nullptr;
+    vm->whvp_vm_ = whvp::WhvpVm::Create(vm->max_cpu_count_, config.x2apic, config.pmu);
+    if (!vm->whvp_vm_) return nullptr;
+    vm->startup_trace_.Mark("partition created");
+
+    // Checkpoints and migrations still work without it, but every
+    // checkpoint is written in full and a migration copies all of RAM with
+    // the VM stopped.
+    if (!config.checkpoint_path.empty() || config.migratable) {
+        if (vm->whvp_vm_->DirtyPageTracking()) {
+            vm->dirty_tracker_ = std::make_unique<DirtyTracker>();
+        } else {
+            LOG_WARN("Dirty page tracking unavailable, checkpoints are written in full and "
+                     "migrations stop the VM");
+        }
+    }
 
-    if (!config.disk_path.empty()) {
-        if (!vm->SetupVirtioBlk(config.disk_path)) return nullptr;
+    if (!config.restore_path.empty()) {
+        vm->snapshot_ = SnapshotFile::Open(config.restore_path);
+        if (!vm->snapshot_) return nullptr;
+        // Large pages round RAM up to 2 MiB.
+        uint64_t saved_ram = vm->snapshot_->ram_size();
+        if (vm->snapshot_->cpu_count() != config.cpu_count ||
+            saved_ram < ram_bytes || saved_ram > AlignUp(ram_bytes, 2ULL << 20)) {
+            LOG_ERROR("Snapshot was taken with %u vCPUs and %llu MB of RAM, not %u and %llu",
+                      vm->snapshot_->cpu_count(), saved_ram >> 20, config.cpu_count,
+                      config.memory_mb);
+            return nullptr;
+        }
+        if (vm->snapshot_->x2apic() != vm->whvp_vm_->X2Apic()) {
+            LOG_ERROR("Snapshot was taken in %s mode, this VM runs its APICs in %s mode",
+                      vm->snapshot_->x2apic() ? "x2APIC" : "xAPIC",
+                      vm->whvp_vm_->X2Apic() ? "x2APIC" : "xAPIC");
+            return nullptr;
+        }
+        // Pages come in from the file as the guest touches them, so
+        // on-demand commit and large pages do not apply.
+        uint8_t* base = vm->snapshot_->MapRam();
+        if (!base || !vm->MapGuestRam(base, saved_ram)) return nullptr;
+    } else if (!vm->AllocateMemory(ram_bytes, config.lazy_memory, config.large_pages,
+                                   config.numa_memory != NumaMemory::kNone)) {
+        return nullptr;
+    }
+    if (vm->dirty_tracker_) {
+        vm->dirty_tracker_->Init(vm->mem_,
+            [whvp_vm = vm->whvp_vm_.get()](GPA gpa, uint64_t size, uint64_t* bitmap,
+                                           uint32_t bitmap_bytes) {
+                return whvp_vm->QueryDirtyBitmap(gpa, size, bitmap, bitmap_bytes);
+            });
+        // Before the devices and the loaders take their copies of mem_.
+        vm->mem_.dirty = vm->dirty_tracker_.get();
+    }
+    if (config.max_memory_mb > config.memory_mb &&
+        !vm->ReserveHotplugMemory((config.max_memory_mb - config.memory_mb) << 20))
+        return nullptr;
+    vm->startup_trace_.Mark("guest RAM mapped");
+
+    // Migrated in: RAM and state come from the source, sent as the devices
+    // below are set up. A mirrored disk is written as it comes in; a shared
+    // one opens once the source has let go of it. Declared after the disk
+    // future, so an early return drops the connection first and the source
+    // carries on.
+    std::unique_ptr<MigrationStream> migration;
+    MigrationStream::Hello hello;
+    if (incoming) {
+        migration = MigrationStream::Accept(config.migrate_listen_port, kMigrateAcceptTimeoutS);
+        if (!migration || !migration->ReadHello(&hello)) return nullptr;
+        if (hello.cpu_count != config.cpu_count || hello.ram_size != vm->mem_.alloc_size ||
+            (hello.disk_size != 0) != !config.disk_path.empty()) {
+            LOG_ERROR("Migration: the source has %u vCPUs, %llu MB of RAM and %s disk, "
+                      "not %u, %llu and %s", hello.cpu_count, hello.ram_size >> 20,
+                      hello.disk_size ? "a" : "no", config.cpu_count,
+                      vm->mem_.alloc_size >> 20, config.disk_path.empty() ? "none" : "one");
+            migration->SendControl(MigrationControl::kResult, 0);
+            return nullptr;
+        }
+        if (hello.x2apic != vm->whvp_vm_->X2Apic()) {
+            LOG_ERROR("Migration: the source runs its APICs in %s mode, this VM in %s mode",
+                      hello.x2apic ? "x2APIC" : "xAPIC",
+                      vm->whvp_vm_->X2Apic() ? "x2APIC" : "xAPIC");
+            migration->SendControl(MigrationControl::kResult, 0);
+            return nullptr;
+        }
+        if (!migration->SendControl(MigrationControl::kResult, 1)) return nullptr;
+        if (hello.mirror_disk) open_disk();
+        vm->startup_trace_.Mark("migration accepted");
+    }
+    bool resuming = vm->snapshot_ || migration;
+
+    // The initrd is most of what a boot reads. It goes to the top of low
+    // RAM, which nothing else touches before LoadKernel, so read it while
+    // the devices are set up. Declared after `vm`, so an early return waits
+    // for it before guest RAM goes away.
+    x86::InitrdImage initrd;
+    std::future<bool> initrd_loaded;
+    if (!resuming && !config.initrd_path.empty()) {
+        initrd_loaded = std::async(std::launch::async,
+            [&initrd, &config, self = vm.get(), mem = vm->mem_] {
+                bool ok = x86::LoadInitrd(config.initrd_path, mem, &initrd);
+                self->startup_trace_.Mark("initrd read");
+                return ok;
+            });
+    }
+
+    // Devices may start injecting interrupts during setup, so the halt
+    // states they kick must already exist.
+    for (uint32_t i = 0; i < vm->max_cpu_count_; i++) {
+        auto halt = std::make_unique<VCpuHalt>();
+        if (!halt->Init()) return nullptr;
+        vm->halts_.push_back(std::move(halt));
     }
 
-    if (!vm->SetupVirtioNet(config.net_link_up, config.port_forwards))
+    if (!vm->SetupDevices()) return nullptr;
+    vm->startup_trace_.Mark("platform devices");
+
+    if (!vm->SetupVirtioNet(config.net_link_up, config.port_forwards,
+                            config.cpu_count))
         return nullptr;
+    if (config.net_rate_limit.rx_mbps || config.net_rate_limit.tx_mbps)
+        vm->SetNetRateLimit(config.net_rate_limit);
+    vm->startup_trace_.Mark("virtio-net");
+
 
     if (!vm->SetupVirtioInput()) return nullptr;
+    vm->startup_trace_.Mark("virtio-input");
 
-    if (!vm->SetupVirtioGpu(config.display_width, config.display_height))
+    if (!vm->SetupVirtioGpu(config.display_width, config.display_height,
+                            config.display_count))
         return nullptr;
+    vm->startup_trace_.Mark("virtio-gpu");
 
     if (!vm->SetupVirtioSerial())
         return nullptr;
+    vm->startup_trace_.Mark("virtio-serial");
 
     // Always create virtiofs device for dynamic share management
     if (!vm->SetupVirtioFs(config.shared_folders))
         return nullptr;
+    vm->startup_trace_.Mark("virtio-fs");
 
     if (!vm->SetupVirtioSnd())
         return nullptr;
+    vm->startup_trace_.Mark("virtio-snd");
+
+    if (!vm->SetupVirtioBalloon())
+        return nullptr;
+    vm->startup_trace_.Mark("virtio-balloon");
+
+    if (vm->virtio_mem_) {
+        if (!vm->SetupVirtioMem())
+            return nullptr;
+        vm->startup_trace_.Mark("virtio-mem");
+    }
+
+    if (config.vsock) {
+        if (!vm->SetupVirtioVsock(config.vsock_forwards))
+            return nullptr;
+        vm->startup_trace_.Mark("virtio-vsock");
+    }
+
+    SnapshotFile::Sections migrated_state;
+    if (migration) {
+        auto write_disk = [&disk_opened, self = vm.get(), &hello](
+                              uint64_t offset, const void* data, uint32_t len) {
+            if (!disk_opened.valid()) return false;
+            disk_opened.wait();
+            return self->virtio_blk_->DiskSize() == hello.disk_size &&
+                   self->virtio_blk_->WriteDisk(offset, data, len);
+        };
+        if (!migration->Receive(vm->mem_, write_disk, &migrated_state)) return nullptr;
+        vm->startup_trace_.Mark("migration received");
+        if (vm->virtio_blk_ && !hello.mirror_disk) {
+            MigrationControl type{};
+            uint64_t value = 0;
+            if (!migration->SendControl(MigrationControl::kReleaseDisk, 0) ||
+                !migration->ReadControl(&type, &value) ||
+                type != MigrationControl::kDiskReleased) {
+                LOG_ERROR("Migration: the source did not release the disk");
+                return nullptr;
+            }
+            open_disk();
+        }
+    }
+
+    // Last, to give the disk the longest head start.
+    if (disk_opened.valid()) {
+        if (!disk_opened.get() || !vm->SetupVirtioBlk()) return nullptr;
+        vm->startup_trace_.Mark("virtio-blk");
+    }
+
+    // Disk completions and received frames arrive in bursts worth batching.
+    // After SetupVirtioBlk, which creates the disk's transport.
+    for (auto* mmio : {vm->virtio_mmio_.get(), vm->virtio_mmio_net_.get()}) {
+        if (mmio) {
+            mmio->SetInterruptModeration(config.irq_coalesce_us,
+                                         config.irq_coalesce_frames);
+        }
+    }
+
+    for (auto& io_thread : vm->io_threads_) {
+        if (!io_thread->Start(&vm->cpu_placement_)) return nullptr;
+        if (!io_thread->SourceCount()) {
+            LOG_WARN("I/O thread %u has no devices", io_thread->Index());
+        }
+    }
 
     // Register virtio-mmio devices for ACPI DSDT so the kernel discovers
-    // them via the "LNRO0005" HID in the virtio_mmio driver.
-    if (vm->virtio_mmio_) {
+    // them via the "LNRO0005" HID in the virtio_mmio driver. Devices on
+    // virtio-pci are found by scanning the bus instead.
+    if (vm->virtio_mmio_ && !vm->virtio_pci_) {
         vm->virtio_acpi_devs_.push_back({
             kVirtioMmioBase,
             static_cast<uint32_t>(VirtioMmioDevice::kMmioSize),
             kVirtioBlkIrq});
     }
-    if (vm->virtio_mmio_net_) {
+    if (vm->virtio_mmio_net_ && !vm->virtio_pci_) {
         vm->virtio_acpi_devs_.push_back({
             kVirtioNetMmioBase,
             static_cast<uint32_t>(VirtioMmioDevice::kMmioSize),
@@ -156,64 +540,269 @@ std::unique_ptr<Vm> Vm::Create(const VmConfig& config) {
             static_cast<uint32_t>(VirtioMmioDevice::kMmioSize),
             kVirtioSndIrq});
     }
+    if (vm->virtio_mmio_balloon_) {
+        vm->virtio_acpi_devs_.push_back({
+            kVirtioBalloonMmioBase,
+            static_cast<uint32_t>(VirtioMmioDevice::kMmioSize),
+            kVirtioBalloonIrq});
+    }
+    if (vm->virtio_mmio_vsock_) {
+        vm->virtio_acpi_devs_.push_back({
+            kVirtioVsockMmioBase,
+            static_cast<uint32_t>(VirtioMmioDevice::kMmioSize),
+            kVirtioVsockIrq});
+    }
+    if (vm->virtio_mmio_mem_) {
+        vm->virtio_acpi_devs_.push_back({
+            kVirtioMemMmioBase,
+            static_cast<uint32_t>(VirtioMmioDevice::kMmioSize),
+            kVirtioMemIrq});
+    }
 
-    if (!vm->LoadKernel(config)) return nullptr;
+    // A resumed guest has its kernel, and its boot tables, in RAM already.
+    if (initrd_loaded.valid() && !initrd_loaded.get()) return nullptr;
+    if (!resuming && !vm->LoadKernel(config, initrd)) return nullptr;
+    if (!resuming) vm->startup_trace_.Mark("kernel loaded");
 
-    vm->cpu_count_ = config.cpu_count;
+    // Hotpluggable vCPUs are created as they are first plugged in.
+    vm->vcpus_.resize(vm->max_cpu_count_);
+    vm->vcpu_slots_ = std::make_unique<VCpuSlot[]>(vm->max_cpu_count_);
     for (uint32_t i = 0; i < config.cpu_count; i++) {
-        auto vcpu = whvp::WhvpVCpu::Create(
-            *vm->whvp_vm_, i, &vm->addr_space_);
-        if (!vcpu) return nullptr;
-        vm->vcpus_.push_back(std::move(vcpu));
+        vm->vcpus_[i] = whvp::WhvpVCpu::Create(
+            *vm->whvp_vm_, i, &vm->addr_space_, &vm->mem_);
+        if (!vm->vcpus_[i]) return nullptr;
+        vm->vcpu_slots_[i].online = true;
+    }
+    vm->vcpus_created_ = config.cpu_count;
+
+    if (resuming) {
+        if (!vm->LoadSnapshot(vm->snapshot_ ? vm->snapshot_->sections() : migrated_state))
+            return nullptr;
+        if (vm->snapshot_) {
+            LOG_INFO("VM state restored, %llu MB of RAM paged in on demand",
+                     vm->snapshot_->ram_size() >> 20);
+        }
+        vm->startup_trace_.Mark("state restored");
+    } else {
+        // Only BSP (vCPU 0) gets initial registers; APs wait for SIPI.
+        WHV_REGISTER_NAME names[64]{};
+        WHV_REGISTER_VALUE values[64]{};
+        uint32_t count = 0;
+        x86::BuildInitialRegisters(vm->mem_.base, names, values, &count);
+
+        if (!vm->vcpus_[0]->SetRegisters(names, values, count)) {
+            LOG_ERROR("Failed to set initial vCPU registers");
+            return nullptr;
+        }
     }
 
-    // Only BSP (vCPU 0) gets initial registers; APs wait for SIPI.
-    WHV_REGISTER_NAME names[64]{};
-    WHV_REGISTER_VALUE values[64]{};
-    uint32_t count = 0;
-    x86::BuildInitialRegisters(vm->mem_.base, names, values, &count);
-
-    if (!vm->vcpus_[0]->SetRegisters(names, values, count)) {
-        LOG_ERROR("Failed to set initial vCPU registers");
-        return nullptr;
+    if (config.page_dedup_interval_s) {
+        vm->page_dedup_ = std::make_unique<PageDedupScanner>(vm->mem_);
+        Vm* self = vm.get();
+        vm->page_dedup_->Start(config.page_dedup_interval_s * 1000,
+            [self](const PageDedupScanner::Stats& stats) {
+                std::lock_guard<std::mutex> lock(self->page_dedup_mutex_);
+                if (self->page_dedup_callback_) self->page_dedup_callback_(stats);
+            });
     }
 
-    LOG_INFO("VM created successfully (%u vCPUs)", config.cpu_count);
+    // The source stops for good once it has this.
+    if (migration && !migration->SendControl(MigrationControl::kResult, 1)) return nullptr;
+
+    if (vm->max_cpu_count_ > config.cpu_count) {
+        LOG_INFO("VM created successfully (%u vCPUs, up to %u)", config.cpu_count,
+                 vm->max_cpu_count_);
+    } else {
+        LOG_INFO("VM created successfully (%u vCPUs)", config.cpu_count);
+    }
     return vm;
 }
 
-bool Vm::AllocateMemory(uint64_t size) {
+bool Vm::AllocateMemory(uint64_t size, bool lazy, bool large_pages, bool numa) {
     uint64_t alloc = AlignUp(size, kPageSize);
 
-    uint8_t* base = static_cast<uint8_t*>(
-        VirtualAlloc(nullptr, alloc,
-                     MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
-    if (!base) {
-        LOG_ERROR("VirtualAlloc(%llu MB) failed", alloc / (1024 * 1024));
-        return false;
+    // A piece per planned node, each allocated on that node.
+    std::vector<uint32_t> host_nodes;
+    if (numa) {
+        for (uint32_t i = 0; i < cpu_placement_.node_count(); i++) {
+            host_nodes.push_back(cpu_placement_.HostNode(i));
+        }
+    }
+    auto allocate_on_nodes = [this, &host_nodes](uint64_t bytes, uint64_t align,
+                                                 bool large) -> uint8_t* {
+        auto ram = std::make_unique<NodeGuestRam>();
+        if (!ram->Allocate(NodeGuestRam::Split(bytes, host_nodes, align), large)) {
+            return nullptr;
+        }
+        node_ram_ = std::move(ram);
+        mem_.numa = node_ram_.get();
+        return node_ram_->base();
+    };
+
+    // Large pages cannot be decommitted, so on-demand commit wins.
+    if (large_pages && lazy) {
+        LOG_WARN("Large pages are ignored with on-demand guest RAM");
+        large_pages = false;
+    }
+    uint8_t* base = nullptr;
+    if (large_pages) {
+        // kMmioGapStart is 2 MiB aligned, so rounding the total keeps both
+        // regions in whole large pages.
+        uint64_t large = GetLargePageMinimum();
+        if (!large) {
+            LOG_WARN("Large pages are not supported, using 4 KiB pages");
+        } else if (!EnableProcessPrivilege(L"SeLockMemoryPrivilege")) {
+            LOG_WARN("SeLockMemoryPrivilege not held, using 4 KiB pages");
+        } else {
+            uint64_t large_alloc = AlignUp(size, large);
+            if (!host_nodes.empty()) {
+                base = allocate_on_nodes(large_alloc, std::max(large, kNumaNodeAlign), true);
+            } else {
+                base = static_cast<uint8_t*>(VirtualAlloc(
+                    nullptr, large_alloc,
+                    MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE));
+            }
+            if (base) {
+                if (large_alloc != alloc) {
+                    LOG_INFO("Guest RAM rounded up from %llu to %llu KB for large pages",
+                             size / 1024, large_alloc / 1024);
+                }
+                alloc = large_alloc;
+                mem_.large_pages = true;
+            } else {
+                LOG_WARN("Large page allocation of %llu MB failed (%lu), "
+                         "using 4 KiB pages",
+                         large_alloc / (1024 * 1024), GetLastError());
+            }
+        }
     }
 
-    mem_.base = base;
+    // If total RAM fits below the MMIO gap there is no split needed.
     mem_.alloc_size = alloc;
+    mem_.low_size  = std::min(alloc, kMmioGapStart);
+    mem_.high_size = (alloc > kMmioGapStart) ? (alloc - kMmioGapStart) : 0;
+    mem_.high_base = mem_.high_size ? kMmioGapEnd : 0;
+
+    WHV_MAP_GPA_RANGE_FLAGS flags =
+        WHvMapGpaRangeFlagRead | WHvMapGpaRangeFlagWrite |
+        WHvMapGpaRangeFlagExecute;
+    if (dirty_tracker_) flags |= WHvMapGpaRangeFlagTrackDirtyPages;
+
+    if (lazy) {
+        // Chunks are mapped as they are committed; until then guest
+        // accesses exit as unmapped GPAs. A chunk committed or released
+        // reads as zero, whatever the last checkpoint holds for it.
+        lazy_ram_ = std::make_unique<LazyGuestRam>();
+        if (!lazy_ram_->Reserve(alloc, mem_.low_size, kMmioGapEnd,
+                [this, flags](GPA gpa, void* hva, uint64_t len) {
+                    if (!whvp_vm_->MapMemory(gpa, hva, len, flags)) return false;
+                    if (dirty_tracker_) dirty_tracker_->MarkGpa(gpa, len);
+                    return true;
+                },
+                [this](GPA gpa, uint64_t len) {
+                    whvp_vm_->UnmapMemory(gpa, len);
+                    if (dirty_tracker_) dirty_tracker_->MarkGpa(gpa, len);
+                })) {
+            lazy_ram_.reset();
+            return false;
+        }
+        mem_.base = lazy_ram_->base();
+        mem_.lazy = lazy_ram_.get();
+        addr_space_.SetLazyRam(lazy_ram_.get());
+        if (!host_nodes.empty()) {
+            // Committing into the reservation cannot pick a node, so pages
+            // come from the node of the vCPU that first touches them; with
+            // the vCPUs placed that is mostly theirs.
+            LOG_INFO("Guest RAM: on-demand pages come from the node that first touches them");
+            SetNumaLayout(NodeGuestRam::Split(alloc, host_nodes, kNumaNodeAlign));
+        }
+        LOG_INFO("Guest RAM: %llu MB reserved at HVA %p, committed on demand",
+                 alloc / (1024 * 1024), mem_.base);
+        return true;
+    }
+
+    if (!base && !host_nodes.empty()) {
+        base = allocate_on_nodes(alloc, kNumaNodeAlign, false);
+        if (!base) return false;
+    } else if (!base) {
+        base = static_cast<uint8_t*>(
+            VirtualAlloc(nullptr, alloc,
+                         MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        if (!base) {
+            LOG_ERROR("VirtualAlloc(%llu MB) failed", alloc / (1024 * 1024));
+            return false;
+        }
+    } else {
+        LOG_INFO("Guest RAM backed by large pages");
+    }
+    if (!node_ram_) return MapGuestRam(base, alloc);
+
+    for (const auto& piece : node_ram_->pieces()) {
+        LOG_INFO("Guest RAM: %llu MB at offset 0x%llX on host node %u",
+                 piece.size >> 20, piece.offset, piece.host_node);
+    }
+    SetNumaLayout(node_ram_->pieces());
+    return MapGuestRam(base, alloc, node_ram_->pieces());
+}
 
+void Vm::SetNumaLayout(const std::vector<NodeGuestRam::Piece>& pieces) {
+    numa_acpi_ = {};
+    if (pieces.size() < 2) return;
+    numa_acpi_.node_count = static_cast<uint32_t>(pieces.size());
+    for (uint32_t i = 0; i < max_cpu_count_; i++) {
+        numa_acpi_.cpu_nodes.push_back(cpu_placement_.VCpuNode(i));
+    }
+    // Guest node i is piece i; a piece across the MMIO gap is two ranges.
+    for (uint32_t node = 0; node < pieces.size(); node++) {
+        uint64_t from = pieces[node].offset;
+        uint64_t to = from + pieces[node].size;
+        if (from < mem_.low_size) {
+            uint64_t end = std::min(to, mem_.low_size);
+            numa_acpi_.memory.push_back({from, end - from, node});
+            from = end;
+        }
+        if (from < to) {
+            numa_acpi_.memory.push_back(
+                {mem_.high_base + (from - mem_.low_size), to - from, node});
+        }
+    }
+}
+
+bool Vm::MapGuestRam(uint8_t* base, uint64_t alloc,
+                     const std::vector<NodeGuestRam::Piece>& pieces) {
     // If total RAM fits below the MMIO gap there is no split needed.
+    mem_.alloc_size = alloc;
     mem_.low_size  = std::min(alloc, kMmioGapStart);
     mem_.high_size = (alloc > kMmioGapStart) ? (alloc - kMmioGapStart) : 0;
     mem_.high_base = mem_.high_size ? kMmioGapEnd : 0;
+    mem_.base = base;
 
     WHV_MAP_GPA_RANGE_FLAGS flags =
         WHvMapGpaRangeFlagRead | WHvMapGpaRangeFlagWrite |
         WHvMapGpaRangeFlagExecute;
+    if (dirty_tracker_) flags |= WHvMapGpaRangeFlagTrackDirtyPages;
+
+    // Each host allocation is mapped on its own, as a mapping cannot span
+    // two; without pieces all of RAM is one. The part of a range below
+    // low_size maps at the same GPA, the rest above the 4 GiB boundary.
+    std::vector<NodeGuestRam::Piece> ranges = pieces;
+    if (ranges.empty()) ranges.push_back({0, alloc, 0});
+    for (const auto& range : ranges) {
+        uint64_t from = range.offset;
+        uint64_t to = range.offset + range.size;
+        if (from < mem_.low_size) {
+            uint64_t end = std::min(to, mem_.low_size);
+            if (!whvp_vm_->MapMemory(from, base + from, end - from, flags))
+                return false;
+            from = end;
+        }
+        if (from < to &&
+            !whvp_vm_->MapMemory(kMmioGapEnd + (from - mem_.low_size), base + from,
+                                 to - from, flags))
+            return false;
+    }
 
-    // Map the low region: GPA [0, low_size) -> HVA [base, base+low_size)
-    if (!whvp_vm_->MapMemory(0, base, mem_.low_size, flags))
-        return false;
-
-    // Map the high region above the 4 GiB boundary if present.
     if (mem_.high_size) {
-        if (!whvp_vm_->MapMemory(kMmioGapEnd, base + mem_.low_size,
-                                  mem_.high_size, flags))
-            return false;
         LOG_INFO("Guest RAM: %llu MB  [0-0x%llX] + [0x%llX-0x%llX] at HVA %p",
                  alloc / (1024 * 1024),
                  mem_.low_size - 1,
@@ -228,10 +817,12 @@ bool Vm::AllocateMemory(uint64_t size) {
 
 bool Vm::SetupDevices() {
     uart_.SetIrqCallback([this]() { InjectIrq(4); });
-    uart_.SetTxCallback([this](uint8_t byte) {
-        if (!console_port_) return;
-        console_port_->Write(&byte, 1);
-    });
+    if (console_port_) {
+        console_tx_.Start([this](const uint8_t* data, size_t size) {
+            console_port_->Write(data, size);
+        });
+        uart_.SetTxCallback([this](uint8_t byte) { console_tx_.Put(byte); });
+    }
     addr_space_.AddPioDevice(
         Uart16550::kCom1Base, Uart16550::kRegCount, &uart_);
     addr_space_.AddPioDevice(
@@ -248,6 +839,12 @@ bool Vm::SetupDevices() {
     acpi_pm_.SetSciCallback([this]() { InjectIrq(9); });
     addr_space_.AddPioDevice(
         AcpiPm::kBasePort, AcpiPm::kRegCount, &acpi_pm_);
+    if (max_cpu_count_ > cpu_count_) {
+        cpu_hotplug_.Init(max_cpu_count_, cpu_count_);
+        cpu_hotplug_.SetEjectCallback([this](uint32_t cpu) { OnCpuEjected(cpu); });
+        addr_space_.AddPioDevice(
+            CpuHotplug::kBasePort, CpuHotplug::kRegCount, &cpu_hotplug_);
+    }
 
     addr_space_.AddPioDevice(
         I8259Pic::kMasterBase, I8259Pic::kRegCount, &pic_master_);
@@ -269,36 +866,72 @@ bool Vm::SetupDevices() {
     return true;
 }
 
-bool Vm::SetupVirtioBlk(const std::string& disk_path) {
-    virtio_blk_ = std::make_unique<VirtioBlkDevice>();
-    if (!virtio_blk_->Open(disk_path)) return false;
-
-    virtio_mmio_ = std::make_unique<VirtioMmioDevice>();
-    virtio_mmio_->Init(virtio_blk_.get(), mem_);
-    virtio_mmio_->SetIrqCallback([this]() { InjectIrq(kVirtioBlkIrq); });
+bool Vm::SetupVirtioBlk() {
+    if (virtio_pci_) {
+        auto pci = std::make_unique<VirtioPciDevice>();
+        pci->Init(virtio_blk_.get(), mem_, kVirtioBlkPciBar, kVirtioBlkIrq);
+        pci->SetMsiCallback([this](uint64_t addr, uint32_t data) { InjectMsi(addr, data); });
+        pci->SetIrqCallback([this]() { InjectIrq(kVirtioBlkIrq); });
+        pci_host_.AddFunction(kVirtioBlkPciSlot, pci.get());
+        virtio_mmio_ = std::move(pci);
+        addr_space_.AddMmioDevice(
+            kVirtioBlkPciBar, VirtioPciDevice::kBarSize, virtio_mmio_.get());
+        EnableNotifyIoEvent("blk", virtio_mmio_.get(), kVirtioBlkPciBar);
+    } else {
+        virtio_mmio_ = std::make_unique<VirtioMmioDevice>();
+        virtio_mmio_->Init(virtio_blk_.get(), mem_);
+        virtio_mmio_->SetIrqCallback([this]() { InjectIrq(kVirtioBlkIrq); });
+        addr_space_.AddMmioDevice(
+            kVirtioMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_.get());
+        EnableNotifyIoEvent("blk", virtio_mmio_.get(), kVirtioMmioBase);
+    }
     virtio_blk_->SetMmioDevice(virtio_mmio_.get());
-
-    addr_space_.AddMmioDevice(
-        kVirtioMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_.get());
     return true;
 }
 
-bool Vm::SetupVirtioNet(bool link_up, const std::vector<PortForward>& forwards) {
+void Vm::EnableNotifyIoEvent(const char* device, VirtioMmioDevice* mmio,
+                             uint64_t base, bool own_thread) {
+    // Without a thread, notifies simply stay on the vCPU path.
+    auto it = device_io_threads_.find(device);
+    if (it != device_io_threads_.end()) {
+        if (!mmio->AttachIoThread(io_threads_[it->second].get())) return;
+        LOG_INFO("virtio-%s: queue notifies on I/O thread %u", device, it->second);
+    } else if (!own_thread || !mmio->StartNotifyThread()) {
+        return;
+    }
+    addr_space_.AddIoEvent(base + mmio->QueueNotifyOffset(), mmio);
+}
+
+bool Vm::SetupVirtioNet(bool link_up, const std::vector<PortForward>& forwards,
+                        uint32_t num_queue_pairs) {
     net_backend_ = std::make_unique<NetBackend>();
-    virtio_net_ = std::make_unique<VirtioNetDevice>(link_up);
+    virtio_net_ = std::make_unique<VirtioNetDevice>(link_up, num_queue_pairs);
     net_backend_->SetLinkUp(link_up);
 
-    virtio_mmio_net_ = std::make_unique<VirtioMmioDevice>();
-    virtio_mmio_net_->Init(virtio_net_.get(), mem_);
-    virtio_mmio_net_->SetIrqCallback([this]() { InjectIrq(kVirtioNetIrq); });
+    if (virtio_pci_) {
+        auto pci = std::make_unique<VirtioPciDevice>();
+        pci->Init(virtio_net_.get(), mem_, kVirtioNetPciBar, kVirtioNetIrq);
+        pci->SetMsiCallback([this](uint64_t addr, uint32_t data) { InjectMsi(addr, data); });
+        pci->SetIrqCallback([this]() { InjectIrq(kVirtioNetIrq); });
+        pci_host_.AddFunction(kVirtioNetPciSlot, pci.get());
+        virtio_mmio_net_ = std::move(pci);
+        addr_space_.AddMmioDevice(
+            kVirtioNetPciBar, VirtioPciDevice::kBarSize, virtio_mmio_net_.get());
+        EnableNotifyIoEvent("net", virtio_mmio_net_.get(), kVirtioNetPciBar);
+    } else {
+        virtio_mmio_net_ = std::make_unique<VirtioMmioDevice>();
+        virtio_mmio_net_->Init(virtio_net_.get(), mem_);
+        virtio_mmio_net_->SetIrqCallback([this]() { InjectIrq(kVirtioNetIrq); });
+        addr_space_.AddMmioDevice(
+            kVirtioNetMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_net_.get());
+        EnableNotifyIoEvent("net", virtio_mmio_net_.get(), kVirtioNetMmioBase);
+    }
     virtio_net_->SetMmioDevice(virtio_mmio_net_.get());
 
-    virtio_net_->SetTxCallback([this](const uint8_t* frame, uint32_t len) {
-        net_backend_->EnqueueTx(frame, len);
-    });
-
-    addr_space_.AddMmioDevice(
-        kVirtioNetMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_net_.get());
+    virtio_net_->SetTxCallback(
+        [this](const NetTxSegment* segs, size_t count, uint32_t len) {
+            net_backend_->EnqueueTx(segs, count, len);
+        });
 
     if (!net_backend_->Start(virtio_net_.get(),
                               [this]() { InjectIrq(kVirtioNetIrq); },
@@ -317,6 +950,7 @@ bool Vm::SetupVirtioInput() {
     virtio_kbd_->SetMmioDevice(virtio_mmio_kbd_.get());
     addr_space_.AddMmioDevice(
         kVirtioKbdMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_kbd_.get());
+    EnableNotifyIoEvent("input", virtio_mmio_kbd_.get(), kVirtioKbdMmioBase, false);
 
     virtio_tablet_ = std::make_unique<VirtioInputDevice>(VirtioInputDevice::SubType::kTablet);
     virtio_mmio_tablet_ = std::make_unique<VirtioMmioDevice>();
@@ -325,41 +959,48 @@ bool Vm::SetupVirtioInput() {
     virtio_tablet_->SetMmioDevice(virtio_mmio_tablet_.get());
     addr_space_.AddMmioDevice(
         kVirtioTabletMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_tablet_.get());
+    EnableNotifyIoEvent("input", virtio_mmio_tablet_.get(), kVirtioTabletMmioBase, false);
 
     return true;
 }
 
-bool Vm::SetupVirtioGpu(uint32_t width, uint32_t height) {
-    virtio_gpu_ = std::make_unique<VirtioGpuDevice>(width, height);
+bool Vm::SetupVirtioGpu(uint32_t width, uint32_t height, uint32_t num_scanouts) {
+    virtio_gpu_ = std::make_unique<VirtioGpuDevice>(width, height, num_scanouts);
     virtio_gpu_->SetMemMap(mem_);
 
     if (display_port_) {
         virtio_gpu_->SetFrameCallback([this](DisplayFrame frame) {
+            if (!first_frame_.exchange(true)) startup_trace_.Mark("first display frame");
             display_port_->SubmitFrame(std::move(frame));
         });
         virtio_gpu_->SetCursorCallback([this](const CursorInfo& cursor) {
             display_port_->SubmitCursor(cursor);
         });
-        virtio_gpu_->SetScanoutStateCallback([this](bool active, uint32_t width, uint32_t height) {
-            display_port_->SubmitScanoutState(active, width, height);
-        });
+        virtio_gpu_->SetScanoutStateCallback(
+            [this](uint32_t scanout_id, bool active, uint32_t width, uint32_t height) {
+                display_port_->SubmitScanoutState(scanout_id, active, width, height);
+            });
     }
 
     virtio_mmio_gpu_ = std::make_unique<VirtioMmioDevice>();
     virtio_mmio_gpu_->Init(virtio_gpu_.get(), mem_);
     virtio_mmio_gpu_->SetIrqCallback([this]() { InjectIrq(kVirtioGpuIrq); });
     virtio_gpu_->SetMmioDevice(virtio_mmio_gpu_.get());
+    virtio_gpu_->StartWorker();
     addr_space_.AddMmioDevice(
         kVirtioGpuMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_gpu_.get());
+    EnableNotifyIoEvent("gpu", virtio_mmio_gpu_.get(), kVirtioGpuMmioBase, false);
 
     return true;
 }
 
 bool Vm::SetupVirtioSerial() {
-    // 2 ports: port 0 = vdagent (clipboard), port 1 = QEMU Guest Agent
-    virtio_serial_ = std::make_unique<VirtioSerialDevice>(2);
+    // 2 ports: port 0 = vdagent (clipboard), port 1 = QEMU Guest Agent,
+    // plus port 2 = hvc0 if the kernel console goes there
+    virtio_serial_ = std::make_unique<VirtioSerialDevice>(hvc_console_ ? 3 : 2);
     virtio_serial_->SetPortName(0, "com.redhat.spice.0");
     virtio_serial_->SetPortName(1, "org.qemu.guest_agent.0");
+    if (hvc_console_) virtio_serial_->SetConsolePort(kHvcConsolePort);
 
     vdagent_handler_ = std::make_unique<VDAgentHandler>();
     vdagent_handler_->SetSerialDevice(virtio_serial_.get(), 0);
@@ -380,22 +1021,34 @@ bool Vm::SetupVirtioSerial() {
         if (guest_agent_handler_ && port_id == 1) {
             guest_agent_handler_->OnDataReceived(data, len);
         }
+        if (port_id == kHvcConsolePort && console_port_) {
+            console_tx_.Write(data, len);
+        }
     });
 
     virtio_serial_->SetPortOpenCallback([this](uint32_t port_id, bool opened) {
+        if (vdagent_handler_ && port_id == 0) {
+            vdagent_handler_->OnPortOpen(opened);
+        }
         if (guest_agent_handler_ && port_id == 1) {
             guest_agent_handler_->OnPortOpen(opened);
         }
     });
 
+    virtio_serial_->SetDrainCallback([this](uint32_t port_id) {
+        if (vdagent_handler_ && port_id == 0) vdagent_handler_->OnPortDrained();
+    });
+
     virtio_mmio_serial_ = std::make_unique<VirtioMmioDevice>();
     virtio_mmio_serial_->Init(virtio_serial_.get(), mem_);
     virtio_mmio_serial_->SetIrqCallback([this]() { InjectIrq(kVirtioSerialIrq); });
     virtio_serial_->SetMmioDevice(virtio_mmio_serial_.get());
     addr_space_.AddMmioDevice(
         kVirtioSerialMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_serial_.get());
+    EnableNotifyIoEvent("serial", virtio_mmio_serial_.get(), kVirtioSerialMmioBase, false);
 
-    LOG_INFO("VirtIO Serial device initialized (vdagent + guest-agent)");
+    LOG_INFO("VirtIO Serial device initialized (vdagent + guest-agent%s)",
+             hvc_console_ ? " + hvc0" : "");
     return true;
 }
 
@@ -407,12 +1060,28 @@ bool Vm::SetupVirtioFs(const std::vector<VmSharedFolder>& initial_folders) {
     virtio_mmio_fs_->Init(virtio_fs_.get(), mem_);
     virtio_mmio_fs_->SetIrqCallback([this]() { InjectIrq(kVirtioFsBaseIrq); });
     virtio_fs_->SetMmioDevice(virtio_mmio_fs_.get());
+    virtio_fs_->StartWorkers();
     
     addr_space_.AddMmioDevice(kVirtioFsMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_fs_.get());
+    EnableNotifyIoEvent("fs", virtio_mmio_fs_.get(), kVirtioFsMmioBase);
+
+    GPA ram_end = mem_.high_size ? mem_.high_base + mem_.high_size : kMmioGapEnd;
+    if (mem_.hotplug_size) ram_end = mem_.hotplug_base + mem_.hotplug_size;
+    GPA dax_base = AlignUp(ram_end, kVirtioFsDaxWindowSize);
+    virtio_fs_->EnableDax(
+        dax_base, kVirtioFsDaxWindowSize,
+        [this](GPA gpa, void* hva, uint64_t size, bool writable) {
+            WHV_MAP_GPA_RANGE_FLAGS flags = WHvMapGpaRangeFlagRead;
+            if (writable) flags |= WHvMapGpaRangeFlagWrite;
+            return whvp_vm_->MapMemory(gpa, hva, size, flags);
+        },
+        [this](GPA gpa, uint64_t size) { whvp_vm_->UnmapMemory(gpa, size); });
+    addr_space_.AddMmioDevice(dax_base, kVirtioFsDaxWindowSize, virtio_fs_->dax_window());
     
     // Add initial shares
     for (const auto& folder : initial_folders) {
-        if (!virtio_fs_->AddShare(folder.tag, folder.host_path, folder.readonly)) {
+        if (!virtio_fs_->AddShare(folder.tag, folder.host_path, folder.readonly,
+                                  folder.writeback)) {
             LOG_WARN("Failed to add initial share: %s -> %s", folder.tag.c_str(), folder.host_path.c_str());
         }
     }
@@ -435,19 +1104,102 @@ bool Vm::SetupVirtioSnd() {
     virtio_snd_->SetMmioDevice(virtio_mmio_snd_.get());
     addr_space_.AddMmioDevice(
         kVirtioSndMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_snd_.get());
+    EnableNotifyIoEvent("snd", virtio_mmio_snd_.get(), kVirtioSndMmioBase, false);
 
     LOG_INFO("VirtIO Sound device initialized (playback)");
     return true;
 }
 
-bool Vm::LoadKernel(const VmConfig& config) {
+bool Vm::SetupVirtioBalloon() {
+    virtio_balloon_ = std::make_unique<VirtioBalloonDevice>();
+    virtio_balloon_->SetMemMap(mem_);
+
+    virtio_mmio_balloon_ = std::make_unique<VirtioMmioDevice>();
+    virtio_mmio_balloon_->Init(virtio_balloon_.get(), mem_);
+    virtio_mmio_balloon_->SetIrqCallback([this]() { InjectIrq(kVirtioBalloonIrq); });
+    virtio_balloon_->SetMmioDevice(virtio_mmio_balloon_.get());
+    addr_space_.AddMmioDevice(
+        kVirtioBalloonMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_balloon_.get());
+    // Releasing reported pages takes a syscall per range; keep it off the vCPU.
+    EnableNotifyIoEvent("balloon", virtio_mmio_balloon_.get(), kVirtioBalloonMmioBase);
+
+    if (mem_.large_pages) {
+        LOG_WARN("VirtIO Balloon: guest RAM is on large pages, which cannot be given back; "
+                 "the balloon only limits the guest, and free page reporting is off");
+    } else {
+        LOG_INFO("VirtIO Balloon device initialized (free page reporting)");
+    }
+    return true;
+}
+
+bool Vm::ReserveHotplugMemory(uint64_t size) {
+    GPA ram_end = mem_.high_size ? mem_.high_base + mem_.high_size : kMmioGapEnd;
+    GPA base = AlignUp(ram_end, kVirtioMemAlign);
+    size = AlignUp(size, kVirtioMemSizeAlign);
+    virtio_mem_ = std::make_unique<VirtioMemDevice>();
+    // Not dirty tracked: the VM refuses to save while any block is plugged.
+    WHV_MAP_GPA_RANGE_FLAGS flags =
+        WHvMapGpaRangeFlagRead | WHvMapGpaRangeFlagWrite |
+        WHvMapGpaRangeFlagExecute;
+    if (!virtio_mem_->Reserve(base, size,
+            [this, flags](GPA gpa, void* hva, uint64_t len) {
+                return whvp_vm_->MapMemory(gpa, hva, len, flags);
+            },
+            [this](GPA gpa, uint64_t len) { whvp_vm_->UnmapMemory(gpa, len); })) {
+        virtio_mem_.reset();
+        return false;
+    }
+    virtio_mem_->DescribeRegion(&mem_);
+    return true;
+}
+
+bool Vm::SetupVirtioMem() {
+    virtio_mmio_mem_ = std::make_unique<VirtioMmioDevice>();
+    virtio_mmio_mem_->Init(virtio_mem_.get(), mem_);
+    virtio_mmio_mem_->SetIrqCallback([this]() { InjectIrq(kVirtioMemIrq); });
+    virtio_mem_->SetMmioDevice(virtio_mmio_mem_.get());
+    addr_space_.AddMmioDevice(
+        kVirtioMemMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_mem_.get());
+    // Plugging commits and maps memory; keep it off the vCPU.
+    EnableNotifyIoEvent("mem", virtio_mmio_mem_.get(), kVirtioMemMmioBase);
+
+    LOG_INFO("VirtIO Mem device initialized (%llu MB hotpluggable)",
+             virtio_mem_->RegionSize() >> 20);
+    return true;
+}
+
+bool Vm::SetupVirtioVsock(const std::vector<VsockForward>& forwards) {
+    virtio_vsock_ = std::make_unique<VirtioVsockDevice>();
+
+    virtio_mmio_vsock_ = std::make_unique<VirtioMmioDevice>();
+    virtio_mmio_vsock_->Init(virtio_vsock_.get(), mem_);
+    virtio_mmio_vsock_->SetIrqCallback([this]() { InjectIrq(kVirtioVsockIrq); });
+    virtio_vsock_->SetMmioDevice(virtio_mmio_vsock_.get());
+    addr_space_.AddMmioDevice(
+        kVirtioVsockMmioBase, VirtioMmioDevice::kMmioSize, virtio_mmio_vsock_.get());
+    EnableNotifyIoEvent("vsock", virtio_mmio_vsock_.get(), kVirtioVsockMmioBase, false);
+
+    if (!virtio_vsock_->Start(forwards)) return false;
+    LOG_INFO("VirtIO vsock device initialized (guest CID %llu, %zu forwards)",
+             static_cast<unsigned long long>(VIRTIO_VSOCK_GUEST_CID), forwards.size());
+    return true;
+}
+
+bool Vm::LoadKernel(const VmConfig& config, const x86::InitrdImage& initrd) {
     x86::BootConfig boot_cfg;
     boot_cfg.kernel_path = config.kernel_path;
     boot_cfg.initrd_path = config.initrd_path;
-    boot_cfg.cmdline = config.cmdline;
+    boot_cfg.initrd = initrd;
+    boot_cfg.cmdline = config.hvc_console ? HvcConsoleCmdline(config.cmdline)
+                                          : config.cmdline;
     boot_cfg.mem = mem_;
     boot_cfg.cpu_count = config.cpu_count;
+    boot_cfg.max_cpu_count = max_cpu_count_;
     boot_cfg.virtio_devs = virtio_acpi_devs_;
+    boot_cfg.numa = numa_acpi_;
+    if (pci_host_.HasFunctions()) {
+        boot_cfg.pci_root = {kPciMmioWindowBase, kPciMmioWindowSize};
+    }
 
     uint64_t kernel_size = x86::LoadLinuxKernel(boot_cfg);
     if (kernel_size == 0) {
@@ -465,13 +1217,22 @@ void Vm::InputThreadFunc() {
         if (read == 0) {
             continue;
         }
-        for (size_t i = 0; i < read; ++i) {
-            uart_.PushInput(buf[i]);
-        }
-        uart_.CheckAndRaiseIrq();
+        PushConsoleInput(buf, read);
     }
 }
 
+void Vm::PushConsoleInput(const uint8_t* data, size_t size) {
+    if (hvc_console_ && virtio_serial_ &&
+        virtio_serial_->IsPortConnected(kHvcConsolePort) &&
+        virtio_serial_->SendData(kHvcConsolePort, data, size)) {
+        return;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        uart_.PushInput(data[i]);
+    }
+    uart_.CheckAndRaiseIrq();
+}
+
 void Vm::InjectIrq(uint8_t irq) {
     uint64_t rte = 0;
     if (!ioapic_.GetRedirEntry(irq, &rte)) return;
@@ -493,14 +1254,66 @@ void Vm::InjectIrq(uint8_t irq) {
     ctrl.Destination = static_cast<uint32_t>(rte >> 56);
     ctrl.Vector = vector;
 
+    if (etw::VmmEnabled(etw::kKeywordInterrupt)) {
+        etw::InterruptInject("ioapic", vector, ctrl.Destination);
+    }
     WHvRequestInterrupt(whvp_vm_->Handle(), &ctrl, sizeof(ctrl));
+
+    // The destination may be a logical set; waking every halted vCPU is
+    // cheaper than decoding it, and ones with nothing pending halt again.
+    for (auto& halt : halts_) halt->Kick();
+}
+
+void Vm::InjectMsi(uint64_t address, uint32_t data) {
+    // Intel SDM 11.11: destination and its mode in the address, vector,
+    // delivery and trigger mode in the data.
+    if ((address & 0xFFF00000) != 0xFEE00000) {
+        LOG_WARN("MSI to 0x%llX is not an interrupt message", address);
+        return;
+    }
+    uint32_t vector = data & 0xFF;
+    uint32_t delivery = (data >> 8) & 0x7;
+    WHV_INTERRUPT_CONTROL ctrl{};
+    switch (delivery) {
+    case 0: ctrl.Type = WHvX64InterruptTypeFixed; break;
+    case 1: ctrl.Type = WHvX64InterruptTypeLowestPriority; break;
+    case 4: ctrl.Type = WHvX64InterruptTypeNmi; break;
+    default:
+        LOG_WARN("MSI delivery mode %u not supported", delivery);
+        return;
+    }
+    if (delivery != 4 && vector < 16) return;
+
+    bool logical = (address >> 2) & 1;
+    uint32_t dest = static_cast<uint32_t>(address >> 12) & 0xFF;
+    ctrl.DestinationMode = logical
+        ? WHvX64InterruptDestinationModeLogical
+        : WHvX64InterruptDestinationModePhysical;
+    ctrl.TriggerMode = ((data >> 15) & 1)
+        ? WHvX64InterruptTriggerModeLevel
+        : WHvX64InterruptTriggerModeEdge;
+    ctrl.Destination = dest;
+    ctrl.Vector = vector;
+
+    if (etw::VmmEnabled(etw::kKeywordInterrupt)) etw::InterruptInject("msi", vector, dest);
+    WHvRequestInterrupt(whvp_vm_->Handle(), &ctrl, sizeof(ctrl));
+
+    // APIC ids match vCPU indices, so a physical destination wakes only
+    // the vCPU the driver steered this vector to.
+    if (!logical && dest < halts_.size()) {
+        halts_[dest]->Kick();
+        return;
+    }
+    for (auto& halt : halts_) halt->Kick();
 }
 
 void Vm::VCpuThreadFunc(uint32_t vcpu_index) {
     auto& vcpu = vcpus_[vcpu_index];
     uint64_t exit_count = 0;
+    cpu_placement_.ApplyToVCpu(vcpu_index);
 
-    while (running_) {
+    auto& slot = vcpu_slots_[vcpu_index];
+    while (running_ && !pausing_ && slot.online) {
         auto action = vcpu->RunOnce();
         exit_count++;
 
@@ -509,66 +1322,179 @@ void Vm::VCpuThreadFunc(uint32_t vcpu_index) {
             break;
 
         case whvp::VCpuExitAction::kHalt:
-            SwitchToThread();
+            halts_[vcpu_index]->Wait();
             break;
 
         case whvp::VCpuExitAction::kShutdown:
             LOG_INFO("vCPU %u: shutdown (after %llu exits)", vcpu_index, exit_count);
+            LogExitStats(vcpu_index);
             RequestStop();
+            slot.thread_running = false;
             return;
 
         case whvp::VCpuExitAction::kError:
             LOG_ERROR("vCPU %u: error (after %llu exits)", vcpu_index, exit_count);
+            LogExitStats(vcpu_index);
             exit_code_.store(1);
             RequestStop();
+            slot.thread_running = false;
             return;
         }
     }
 
     LOG_INFO("vCPU %u stopped (total exits: %llu)", vcpu_index, exit_count);
+    LogExitStats(vcpu_index);
+    slot.thread_running = false;
+}
+
+void Vm::StartVCpuThreadLocked(uint32_t vcpu_index) {
+    vcpu_slots_[vcpu_index].thread_running = true;
+    vcpu_threads_.emplace_back(&Vm::VCpuThreadFunc, this, vcpu_index);
+}
+
+void Vm::JoinVCpuThreads() {
+    for (;;) {
+        std::thread t;
+        {
+            std::lock_guard<std::mutex> lock(vcpu_mutex_);
+            if (vcpu_threads_.empty()) {
+                vcpus_running_ = false;
+                return;
+            }
+            t = std::move(vcpu_threads_.back());
+            vcpu_threads_.pop_back();
+        }
+        if (t.joinable()) t.join();
+    }
+}
+
+void Vm::KickAllVCpus() {
+    uint32_t created = vcpus_created_.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < created; i++) {
+        WHvCancelRunVirtualProcessor(
+            whvp_vm_->Handle(), vcpus_[i]->VpIndex(), 0);
+    }
+    for (auto& halt : halts_) halt->Kick();
+}
+
+std::vector<VCpuStats> Vm::GetVCpuStats() const {
+    std::vector<VCpuStats> stats;
+    uint32_t created = vcpus_created_.load(std::memory_order_acquire);
+    stats.reserve(created);
+    for (uint32_t i = 0; i < created; i++) {
+        stats.push_back({vcpus_[i]->GetExitStats(), halts_[i]->GetStats()});
+    }
+    return stats;
+}
+
+std::vector<VmPortForwardStat> Vm::GetPortForwardStats() const {
+    if (!net_backend_) return {};
+    return net_backend_->GetPortForwardStats();
+}
+
+VmCounters Vm::GetCounters() const {
+    VmCounters c;
+    uint32_t created = vcpus_created_.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < created; i++) {
+        c.exits += vcpus_[i]->ExitCount();
+        c.vcpu_halted_ns += halts_[i]->GetStats().halted_ns;
+    }
+    if (virtio_blk_) {
+        auto io = virtio_blk_->GetIoStats();
+        c.disk_reads = io.reads;
+        c.disk_writes = io.writes;
+        c.disk_read_bytes = io.read_bytes;
+        c.disk_write_bytes = io.write_bytes;
+    }
+    if (virtio_net_) {
+        auto rx = virtio_net_->GetRxStats();
+        auto tx = virtio_net_->GetTxStats();
+        c.net_rx_packets = rx.queued;
+        c.net_rx_bytes = rx.queued_bytes;
+        c.net_tx_packets = tx.frames;
+        c.net_tx_bytes = tx.bytes;
+    }
+    if (dirty_tracker_) {
+        dirty_tracker_->Collect();
+        c.dirty_pages = dirty_tracker_->dirtied_pages();
+    }
+    return c;
+}
+
+uint64_t Vm::CommittedRamBytes() const {
+    uint64_t plugged = virtio_mem_ ? virtio_mem_->PluggedSize() : 0;
+    return (mem_.lazy ? mem_.lazy->committed_bytes() : mem_.alloc_size) + plugged;
+}
+
+const char* Vm::MmioDeviceName(uint64_t base) {
+    switch (base) {
+    case IoApic::kBaseAddress:    return "ioapic";
+    case kVirtioMmioBase:         return "virtio-blk";
+    case kVirtioNetMmioBase:      return "virtio-net";
+    case kVirtioKbdMmioBase:      return "virtio-kbd";
+    case kVirtioTabletMmioBase:   return "virtio-tablet";
+    case kVirtioGpuMmioBase:      return "virtio-gpu";
+    case kVirtioSerialMmioBase:   return "virtio-serial";
+    case kVirtioFsMmioBase:       return "virtio-fs";
+    case kVirtioSndMmioBase:      return "virtio-snd";
+    case kVirtioBalloonMmioBase:  return "virtio-balloon";
+    case kVirtioVsockMmioBase:    return "virtio-vsock";
+    case kVirtioMemMmioBase:      return "virtio-mem";
+    case kVirtioBlkPciBar:        return "virtio-blk-pci";
+    case kVirtioNetPciBar:        return "virtio-net-pci";
+    default:                      return nullptr;
+    }
+}
+
+void Vm::LogExitStats(uint32_t vcpu_index) {
+    auto stats = vcpus_[vcpu_index]->GetExitStats();
+    for (size_t i = 0; i < static_cast<size_t>(whvp::ExitKind::kCount); i++) {
+        const auto& c = stats.by_kind[i];
+        if (!c.count) continue;
+        LOG_INFO("vCPU %u:   %-14s %10llu exits, avg %llu ns, max %llu us",
+                 vcpu_index, whvp::ExitKindName(static_cast<whvp::ExitKind>(i)),
+                 c.count, c.total_ns / c.count, c.max_ns / 1000);
+    }
+    for (const auto& [msr, c] : stats.by_msr) {
+        LOG_INFO("vCPU %u:   msr 0x%-8X %10llu exits, avg %llu ns", vcpu_index,
+                 msr, c.count, c.total_ns / c.count);
+    }
+
+    auto halt = halts_[vcpu_index]->GetStats();
+    LOG_INFO("vCPU %u: halted %llu ms over %llu halts (%llu woken while polling, "
+             "poll window %u us)", vcpu_index, halt.halted_ns / 1000000,
+             halt.halts, halt.poll_wakeups, halt.poll_us);
 }
 
 void Vm::HidInputThreadFunc() {
     if (!input_port_) return;
 
     uint32_t prev_buttons = 0;
+    std::vector<VirtioInputEvent> events;
 
     while (running_) {
+        // Woken as events arrive; the timeout only notices running_.
+        input_port_->WaitForInput(50);
+
+        // Everything queued since the last wakeup goes in as one batch.
+        events.clear();
         KeyboardEvent kev;
         while (input_port_->PollKeyboard(&kev)) {
-            if (virtio_kbd_) {
-                virtio_kbd_->InjectEvent(EV_KEY, static_cast<uint16_t>(kev.key_code),
-                                         kev.pressed ? 1 : 0, /*notify=*/false);
-                virtio_kbd_->InjectEvent(EV_SYN, SYN_REPORT, 0, /*notify=*/true);
-            }
+            AppendKeyReport(&events, kev.key_code, kev.pressed);
         }
+        if (virtio_kbd_ && !events.empty()) virtio_kbd_->InjectEvents(events);
 
+        events.clear();
         PointerEvent pev;
         while (input_port_->PollPointer(&pev)) {
-            if (virtio_tablet_) {
-                virtio_tablet_->InjectEvent(EV_ABS, ABS_X,
-                    static_cast<uint32_t>(pev.x), /*notify=*/false);
-                virtio_tablet_->InjectEvent(EV_ABS, ABS_Y,
-                    static_cast<uint32_t>(pev.y), /*notify=*/false);
-
-                uint32_t btns = pev.buttons;
-                if ((btns & 1) != (prev_buttons & 1))
-                    virtio_tablet_->InjectEvent(EV_KEY, BTN_LEFT,
-                        (btns & 1) ? 1 : 0, /*notify=*/false);
-                if ((btns & 2) != (prev_buttons & 2))
-                    virtio_tablet_->InjectEvent(EV_KEY, BTN_RIGHT,
-                        (btns & 2) ? 1 : 0, /*notify=*/false);
-                if ((btns & 4) != (prev_buttons & 4))
-                    virtio_tablet_->InjectEvent(EV_KEY, BTN_MIDDLE,
-                        (btns & 4) ? 1 : 0, /*notify=*/false);
-                prev_buttons = btns;
-
-                virtio_tablet_->InjectEvent(EV_SYN, SYN_REPORT, 0,
-                                            /*notify=*/true);
+            AppendPointerReport(&events, pev.x, pev.y, pev.buttons, &prev_buttons);
+            if (pev.wheel_delta) {
+                // Same report as the move, before its SYN_REPORT.
+                events.insert(events.end() - 1, VirtioInputEvent{
+                    EV_REL, REL_WHEEL, static_cast<uint32_t>(pev.wheel_delta)});
             }
         }
-
-        Sleep(2);
+        if (virtio_tablet_ && !events.empty()) virtio_tablet_->InjectEvents(events);
     }
 }
 
@@ -584,23 +1510,423 @@ int Vm::Run() {
         hid_input_thread_ = std::thread(&Vm::HidInputThreadFunc, this);
     }
 
-    for (uint32_t i = 0; i < cpu_count_; i++) {
-        vcpu_threads_.emplace_back(&Vm::VCpuThreadFunc, this, i);
+    if (checkpoint_interval_s_) {
+        checkpoint_thread_ = std::thread(&Vm::CheckpointThreadFunc, this);
     }
 
-    for (auto& t : vcpu_threads_) {
-        t.join();
+    startup_trace_.Mark("vCPUs started");
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(vcpu_mutex_);
+            for (uint32_t i = 0; i < max_cpu_count_; i++) {
+                if (vcpu_slots_[i].online) StartVCpuThreadLocked(i);
+            }
+            vcpus_running_ = true;
+        }
+        JoinVCpuThreads();
+        if (!pausing_) break;
+
+        // Stopped for Suspend(), Checkpoint() or Migrate(), unless the
+        // guest also went away.
+        PauseFor reason = pause_for_;
+        bool saved = false;
+        if (running_) {
+            switch (reason) {
+            case PauseFor::kSuspend: saved = SaveSnapshot(suspend_path_); break;
+            case PauseFor::kCheckpoint: saved = SaveCheckpoint(suspend_path_); break;
+            case PauseFor::kMigrate: saved = FinishMigration(); break;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(suspend_mutex_);
+            suspend_ok_ = saved;
+            suspend_done_ = true;
+            pausing_ = false;
+        }
+        suspend_cv_.notify_all();
+        if (saved && reason != PauseFor::kCheckpoint) {
+            (reason == PauseFor::kSuspend ? suspended_ : migrated_) = true;
+            running_ = false;
+        }
+        if (!running_) break;
+        if (!saved) {
+            LOG_WARN("%s failed, resuming the VM",
+                     reason == PauseFor::kSuspend      ? "Suspend"
+                     : reason == PauseFor::kCheckpoint ? "Checkpoint"
+                                                       : "Migration");
+        }
     }
 
+    {
+        std::lock_guard<std::mutex> lock(suspend_mutex_);
+        run_finished_ = true;
+    }
+    // A Suspend(), Checkpoint() or Migrate() that came in as the guest
+    // stopped.
+    suspend_cv_.notify_all();
+    if (checkpoint_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+            checkpoint_stop_ = true;
+        }
+        checkpoint_cv_.notify_all();
+        checkpoint_thread_.join();
+    }
     return exit_code_.load();
 }
 
+bool Vm::Suspend(const std::string& path) {
+    return PauseAndSave(path, PauseFor::kSuspend);
+}
+
+bool Vm::Checkpoint(const std::string& path) {
+    const std::string& target = path.empty() ? checkpoint_path_ : path;
+    if (target.empty()) return false;
+    std::unique_lock<std::mutex> save_lock(save_mutex_, std::try_to_lock);
+    if (!save_lock.owns_lock()) {
+        LOG_WARN("Checkpoint skipped, a migration is under way");
+        return false;
+    }
+    return PauseAndSave(target, PauseFor::kCheckpoint);
+}
+
+bool Vm::PauseAndSave(const std::string& path, PauseFor reason) {
+    std::unique_lock<std::mutex> lock(suspend_mutex_);
+    if (!running_ || run_finished_ || pausing_) return false;
+    if (const char* blocker = HotplugSaveBlocker()) {
+        LOG_WARN("Cannot save the VM while %s", blocker);
+        return false;
+    }
+    suspend_path_ = path;
+    pause_for_ = reason;
+    suspend_done_ = false;
+    pausing_ = true;
+    KickAllVCpus();
+    suspend_cv_.wait(lock, [this] { return suspend_done_ || run_finished_; });
+    return suspend_done_ && suspend_ok_;
+}
+
+void Vm::CheckpointThreadFunc() {
+    std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+    while (!checkpoint_cv_.wait_for(lock, std::chrono::seconds(checkpoint_interval_s_),
+                                    [this] { return checkpoint_stop_; })) {
+        lock.unlock();
+        Checkpoint();
+        lock.lock();
+    }
+}
+
+std::vector<std::pair<std::string, Device*>> Vm::SnapshotDevices() {
+    std::vector<std::pair<std::string, Device*>> devices = {
+        {"uart", &uart_},
+        {"pit", &pit_},
+        {"system-control-b", &sys_ctrl_b_},
+        {"rtc", &rtc_},
+        {"ioapic", &ioapic_},
+        {"acpi-pm", &acpi_pm_},
+        {"pci-host", &pci_host_},
+        // The two transports save different state, so a snapshot taken on
+        // one does not load on the other.
+        {virtio_pci_ ? "virtio-blk-pci" : "virtio-blk", virtio_mmio_.get()},
+        {virtio_pci_ ? "virtio-net-pci" : "virtio-net", virtio_mmio_net_.get()},
+        {"virtio-kbd", virtio_mmio_kbd_.get()},
+        {"virtio-tablet", virtio_mmio_tablet_.get()},
+        {"virtio-gpu", virtio_mmio_gpu_.get()},
+        {"virtio-serial", virtio_mmio_serial_.get()},
+        {"virtio-fs", virtio_mmio_fs_.get()},
+        {"virtio-snd", virtio_mmio_snd_.get()},
+        {"virtio-balloon", virtio_mmio_balloon_.get()},
+        {"virtio-vsock", virtio_mmio_vsock_.get()},
+        {"virtio-mem", virtio_mmio_mem_.get()},
+    };
+    devices.erase(std::remove_if(devices.begin(), devices.end(),
+                                 [](const auto& d) { return !d.second; }),
+                  devices.end());
+    return devices;
+}
+
+bool Vm::CaptureState(SnapshotFile::Sections* sections) {
+    // Checked again with the vCPUs stopped: a CPU can go, or a block be
+    // plugged, between PauseAndSave() and here.
+    if (const char* blocker = HotplugSaveBlocker()) {
+        LOG_WARN("Cannot save the VM while %s", blocker);
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i < cpu_count_ && ok; i++) {
+        StateWriter out;
+        ok = vcpus_[i]->SaveState(out);
+        (*sections)["vcpu" + std::to_string(i)] = out.Take();
+    }
+    // Devices stop touching guest RAM here until the file is written.
+    for (auto& [name, dev] : SnapshotDevices()) {
+        StateWriter out;
+        dev->SaveState(out);
+        (*sections)[name] = out.Take();
+    }
+    return ok;
+}
+
+std::vector<VirtioMmioDevice*> Vm::VirtioTransports() {
+    std::vector<VirtioMmioDevice*> transports;
+    for (auto* mmio : {virtio_mmio_.get(), virtio_mmio_net_.get(),
+                       virtio_mmio_kbd_.get(), virtio_mmio_tablet_.get(),
+                       virtio_mmio_gpu_.get(), virtio_mmio_serial_.get(),
+                       virtio_mmio_fs_.get(), virtio_mmio_snd_.get(),
+                       virtio_mmio_balloon_.get(), virtio_mmio_vsock_.get(),
+                       virtio_mmio_mem_.get()}) {
+        if (mmio) transports.push_back(mmio);
+    }
+    return transports;
+}
+
+void Vm::ResumeDevicesAfterSave() {
+    for (auto* mmio : VirtioTransports()) mmio->ResumeAfterSave();
+}
+
+bool Vm::SaveSnapshot(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    SnapshotFile::Sections sections;
+    bool ok = CaptureState(&sections);
+    ok = ok && SnapshotFile::Write(path, cpu_count_, whvp_vm_->X2Apic(), sections, mem_);
+    if (!ok) {
+        ResumeDevicesAfterSave();
+        return false;
+    }
+    LOG_INFO("VM suspended to %s in %lld ms", path.c_str(),
+             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start).count()));
+    return true;
+}
+
+bool Vm::SaveCheckpoint(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    SnapshotFile::Sections sections;
+    bool ok = CaptureState(&sections);
+
+    // With the devices quiet, every page written since the last checkpoint
+    // is marked, but for the rings: the host updates those without
+    // walking a chain.
+    bool incremental = false;
+    if (ok && dirty_tracker_) {
+        for (auto* mmio : VirtioTransports()) mmio->MarkRingsDirty();
+        // Taken either way: a full write is the new base just the same.
+        std::vector<uint64_t> dirty;
+        incremental = dirty_tracker_->Take(&dirty) && path == checkpoint_base_ &&
+                      SnapshotFile::WriteIncremental(path, cpu_count_, whvp_vm_->X2Apic(),
+                                                     sections, mem_, dirty);
+    }
+    ok = ok && (incremental ||
+                SnapshotFile::Write(path, cpu_count_, whvp_vm_->X2Apic(), sections, mem_));
+    ResumeDevicesAfterSave();
+    checkpoint_base_ = ok ? path : std::string();
+    if (!ok) return false;
+    LOG_INFO("VM checkpoint %s to %s in %lld ms", incremental ? "updated" : "written",
+             path.c_str(),
+             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start).count()));
+    return true;
+}
+
+bool Vm::Migrate(const std::string& host, uint16_t port, const MigrationOptions& options) {
+    std::unique_lock<std::mutex> save_lock(save_mutex_, std::try_to_lock);
+    if (!save_lock.owns_lock()) {
+        LOG_WARN("Migration: a checkpoint or another migration is under way");
+        return false;
+    }
+    if (!running_ || run_finished_) return false;
+    if (const char* blocker = HotplugSaveBlocker()) {
+        LOG_WARN("Migration: cannot migrate while %s", blocker);
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto stream = MigrationStream::Connect(host, port, options.compression_level);
+    if (!stream) return false;
+
+    bool mirror = options.mirror_disk && virtio_blk_;
+    MigrationStream::Hello hello;
+    hello.cpu_count = cpu_count_;
+    hello.ram_size = mem_.alloc_size;
+    hello.disk_size = virtio_blk_ ? virtio_blk_->DiskSize() : 0;
+    hello.mirror_disk = mirror;
+    hello.x2apic = whvp_vm_->X2Apic();
+    MigrationControl type{};
+    uint64_t value = 0;
+    if (!stream->SendHello(hello) || !stream->ReadControl(&type, &value)) return false;
+    if (type != MigrationControl::kResult || !value) {
+        LOG_ERROR("Migration: %s:%u turned the VM down", host.c_str(), port);
+        return false;
+    }
+
+    bool ok = !dirty_tracker_ || PreCopy(*stream, options, mirror);
+    if (ok) {
+        migration_ = stream.get();
+        migration_mirror_ = mirror;
+        ok = PauseAndSave({}, PauseFor::kMigrate);
+        migration_ = nullptr;
+    }
+    if (dirty_tracker_) dirty_tracker_->LogHostWrites(false);
+    if (mirror) virtio_blk_->StopWriteLog();
+    if (!ok) {
+        LOG_ERROR("Migration to %s:%u failed", host.c_str(), port);
+        return false;
+    }
+    LOG_INFO("VM migrated to %s:%u in %lld ms, %llu MB sent (%llu MB on the wire)",
+             host.c_str(), port,
+             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start).count()),
+             stream->payload_bytes() >> 20, stream->wire_bytes() >> 20);
+    return true;
+}
+
+bool Vm::PreCopy(MigrationStream& stream, const MigrationOptions& options, bool mirror) {
+    auto read_disk = [this](uint64_t offset, void* buf, uint32_t len) {
+        return virtio_blk_->ReadDisk(offset, buf, len);
+    };
+    uint64_t disk_size = mirror ? virtio_blk_->DiskSize() : 0;
+
+    // The first pass sends everything, so only writes from here on count.
+    dirty_tracker_->LogHostWrites(true);
+    if (mirror) virtio_blk_->StartWriteLog(MigrationStream::kDiskBlockSize);
+    std::vector<uint64_t> dirty, blocks;
+    if (!dirty_tracker_->Take(&dirty)) return false;
+    // The pages just taken were never written to the checkpoint.
+    checkpoint_base_.clear();
+
+    for (uint32_t pass = 1;; pass++) {
+        if (!running_) return false;
+        auto pass_start = std::chrono::steady_clock::now();
+        uint64_t sent_before = stream.payload_bytes();
+        bool ok;
+        if (pass == 1) {
+            ok = stream.SendRam(mem_, nullptr, true) &&
+                 (!mirror || stream.SendDisk(disk_size, nullptr, read_disk));
+        } else {
+            ok = dirty_tracker_->Take(&dirty) && stream.SendRam(mem_, &dirty);
+            if (ok && mirror) {
+                virtio_blk_->TakeWriteLog(&blocks);
+                ok = stream.SendDisk(disk_size, &blocks, read_disk);
+            }
+        }
+        if (!ok || !stream.SendPassEnd()) return false;
+
+        // What is left goes with the VM stopped, at this pass's rate.
+        uint64_t ms = std::max<int64_t>(1,
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - pass_start).count());
+        uint64_t bytes_per_ms = std::max<uint64_t>(1, (stream.payload_bytes() - sent_before) / ms);
+        uint64_t pages = dirty_tracker_->DirtyCount();
+        if (pages == UINT64_MAX) return false;
+        uint64_t left = pages * kPageSize +
+                        (mirror ? virtio_blk_->CountWriteLog() * MigrationStream::kDiskBlockSize
+                                : 0);
+        LOG_INFO("Migration: pass %u took %llu ms, %llu MB dirtied meanwhile", pass, ms,
+                 left >> 20);
+        if (left / bytes_per_ms <= options.max_downtime_ms) break;
+        if (pass >= options.max_passes) {
+            LOG_WARN("Migration: no convergence after %u passes, stopping the VM with "
+                     "%llu MB left", pass, left >> 20);
+            break;
+        }
+    }
+    return true;
+}
+
+bool Vm::FinishMigration() {
+    auto start = std::chrono::steady_clock::now();
+    MigrationStream& stream = *migration_;
+    SnapshotFile::Sections sections;
+    bool ok = CaptureState(&sections);
+
+    // As for a checkpoint, plus the pages host writes may have been taken
+    // too early in a pass.
+    if (ok && dirty_tracker_) {
+        for (auto* mmio : VirtioTransports()) mmio->MarkRingsDirty();
+        std::vector<uint64_t> dirty;
+        if (dirty_tracker_->Take(&dirty)) {
+            dirty_tracker_->TakeHostWrites(&dirty);
+            ok = stream.SendRam(mem_, &dirty);
+        } else {
+            ok = stream.SendRam(mem_, nullptr);
+        }
+    } else if (ok) {
+        ok = stream.SendRam(mem_, nullptr, true);
+    }
+    if (ok && migration_mirror_) {
+        std::vector<uint64_t> blocks;
+        virtio_blk_->TakeWriteLog(&blocks);
+        ok = stream.SendDisk(virtio_blk_->DiskSize(), &blocks,
+            [this](uint64_t offset, void* buf, uint32_t len) {
+                return virtio_blk_->ReadDisk(offset, buf, len);
+            });
+    }
+    ok = ok && stream.SendState(sections);
+
+    // The target asks for a shared disk, then says whether it took over.
+    bool released = false;
+    while (ok) {
+        MigrationControl type{};
+        uint64_t value = 0;
+        if (!stream.ReadControl(&type, &value)) {
+            ok = false;
+        } else if (type == MigrationControl::kReleaseDisk && virtio_blk_ && !released) {
+            virtio_blk_->CloseDisk();
+            released = true;
+            ok = stream.SendControl(MigrationControl::kDiskReleased, 1);
+        } else if (type == MigrationControl::kResult) {
+            ok = value != 0;
+            break;
+        } else {
+            ok = false;
+        }
+    }
+    checkpoint_base_.clear();
+    if (!ok) {
+        // Without its disk the guest cannot go on here either.
+        if (released && !virtio_blk_->ReopenDisk()) {
+            LOG_ERROR("Migration: the disk is gone, stopping the VM");
+            RequestStop();
+        }
+        ResumeDevicesAfterSave();
+        return false;
+    }
+    LOG_INFO("Migration: VM stopped for %lld ms",
+             static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start).count()));
+    return true;
+}
+
+bool Vm::LoadSnapshot(const SnapshotFile::Sections& sections) {
+    auto section = [&sections](const std::string& name) -> const std::vector<uint8_t>* {
+        auto it = sections.find(name);
+        return it != sections.end() ? &it->second : nullptr;
+    };
+    for (uint32_t i = 0; i < cpu_count_; i++) {
+        const auto* data = section("vcpu" + std::to_string(i));
+        StateReader in(data ? *data : std::vector<uint8_t>{});
+        if (!data || !vcpus_[i]->LoadState(in)) {
+            LOG_ERROR("Snapshot: cannot restore vCPU %u", i);
+            return false;
+        }
+    }
+    for (auto& [name, dev] : SnapshotDevices()) {
+        const auto* data = section(name);
+        if (!data) {
+            LOG_ERROR("Snapshot: no state for %s", name.c_str());
+            return false;
+        }
+        StateReader in(*data);
+        if (!dev->LoadState(in)) {
+            LOG_ERROR("Snapshot: cannot restore %s", name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
 void Vm::RequestStop() {
     running_ = false;
-    for (auto& vcpu : vcpus_) {
-        WHvCancelRunVirtualProcessor(
-            whvp_vm_->Handle(), vcpu->VpIndex(), 0);
-    }
+    KickAllVCpus();
 }
 
 void Vm::RequestReboot() {
@@ -615,10 +1941,7 @@ void Vm::TriggerPowerButton() {
 
 void Vm::InjectConsoleBytes(const uint8_t* data, size_t size) {
     if (!data || size == 0) return;
-    for (size_t i = 0; i < size; ++i) {
-        uart_.PushInput(data[i]);
-    }
-    uart_.CheckAndRaiseIrq();
+    PushConsoleInput(data, size);
 }
 
 void Vm::SetNetLinkUp(bool up) {
@@ -630,45 +1953,211 @@ void Vm::UpdatePortForwards(const std::vector<PortForward>& forwards) {
     if (net_backend_) net_backend_->UpdatePortForwards(forwards);
 }
 
+void Vm::SetNetRateLimit(const NetRateLimit& limit) {
+    if (net_backend_) net_backend_->SetRateLimit(limit);
+}
+
+uint64_t Vm::GetNetTxDropped() const {
+    return net_backend_ ? net_backend_->GetTxDropped() : 0;
+}
+
+uint64_t Vm::GetNetShaperDropped() const {
+    return net_backend_ ? net_backend_->GetShaperDropped() : 0;
+}
+
+bool Vm::StartNetCapture(const NetCaptureOptions& options, std::string* error) {
+    if (!virtio_net_) {
+        *error = "vm has no network device";
+        return false;
+    }
+    return virtio_net_->StartCapture(options, error);
+}
+
+void Vm::StopNetCapture() {
+    if (virtio_net_) virtio_net_->StopCapture();
+}
+
+void Vm::SetBalloonSize(uint64_t size_mb) {
+    if (!virtio_balloon_) return;
+    uint64_t pages = std::min(size_mb << 20, mem_.TotalRam()) >> VIRTIO_BALLOON_PFN_SHIFT;
+    virtio_balloon_->SetTargetPages(static_cast<uint32_t>(pages));
+}
+
+void Vm::RequestFreePageHints() {
+    if (virtio_balloon_) virtio_balloon_->RequestFreePageHints();
+}
+
+VirtioBalloonDevice::Stats Vm::GetBalloonStats() const {
+    return virtio_balloon_ ? virtio_balloon_->GetStats() : VirtioBalloonDevice::Stats{};
+}
+
+std::vector<VirtioFsOpStats::OpSnapshot> Vm::GetFsOpStats() const {
+    if (!virtio_fs_) return {};
+    return virtio_fs_->op_stats().Snapshot();
+}
+
+bool Vm::SetDiskLimits(const BlockThrottleLimits& limits) {
+    if (!virtio_blk_) return false;
+    virtio_blk_->SetIoLimits(limits);
+    LOG_INFO("Disk limits: %u IOPS (burst %u), %llu bytes/s (burst %llu)",
+             limits.iops, limits.iops_burst, limits.bytes_per_sec, limits.burst_bytes);
+    return true;
+}
+
+bool Vm::SetCpuCount(uint32_t count, std::string* error) {
+    if (!cpu_hotplug_.MaxCpus()) {
+        *error = "vCPU hotplug is not enabled";
+        return false;
+    }
+    if (count < 1 || count > max_cpu_count_) {
+        *error = "vCPU count must be 1 to " + std::to_string(max_cpu_count_);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(vcpu_mutex_);
+    if (!running_ || !vcpus_running_ || pausing_) {
+        *error = "vm is not running";
+        return false;
+    }
+    // One change at a time, so a CPU asked to go is not plugged back in
+    // before the guest has let go of it.
+    if (cpu_hotplug_.Busy()) {
+        *error = "the guest has not finished the last vCPU change";
+        return false;
+    }
+    cpu_hotplug_.Withdraw();
+
+    uint32_t present = 0;
+    for (uint32_t i = 0; i < max_cpu_count_; i++) {
+        if (cpu_hotplug_.Present(i)) present++;
+    }
+    bool changed = false;
+    // New vCPUs take the lowest free slots and go back from the highest,
+    // so the ones present stay the first cpu_count_ as far as the host
+    // decides it.
+    for (uint32_t i = 0; i < max_cpu_count_ && present < count; i++) {
+        if (cpu_hotplug_.Present(i)) continue;
+        auto& slot = vcpu_slots_[i];
+        for (uint32_t waited = 0; slot.thread_running && waited < kVCpuThreadExitWaitMs;
+             waited += 10) {
+            Sleep(10);
+        }
+        if (slot.thread_running) {
+            *error = "vCPU " + std::to_string(i) + " is still stopping";
+            break;
+        }
+        if (!vcpus_[i]) {
+            vcpus_[i] = whvp::WhvpVCpu::Create(*whvp_vm_, i, &addr_space_, &mem_);
+            if (!vcpus_[i]) {
+                *error = "cannot create vCPU " + std::to_string(i);
+                break;
+            }
+            vcpus_created_.store(i + 1, std::memory_order_release);
+        }
+        slot.online = true;
+        StartVCpuThreadLocked(i);
+        cpu_hotplug_.Insert(i);
+        cpu_count_++;
+        present++;
+        changed = true;
+        LOG_INFO("vCPU %u plugged in", i);
+    }
+    // The boot processor never goes.
+    for (uint32_t i = max_cpu_count_; i-- > 1 && present > count;) {
+        if (!cpu_hotplug_.Present(i)) continue;
+        cpu_hotplug_.RequestRemove(i);
+        present--;
+        changed = true;
+        LOG_INFO("vCPU %u: asked the guest to remove it", i);
+    }
+    if (changed) acpi_pm_.RaiseGpe(x86::kCpuHotplugGpe);
+    return error->empty();
+}
+
+void Vm::OnCpuEjected(uint32_t vcpu_index) {
+    std::lock_guard<std::mutex> lock(vcpu_mutex_);
+    vcpu_slots_[vcpu_index].online = false;
+    cpu_count_--;
+    WHvCancelRunVirtualProcessor(whvp_vm_->Handle(), vcpus_[vcpu_index]->VpIndex(), 0);
+    halts_[vcpu_index]->Kick();
+    LOG_INFO("vCPU %u ejected by the guest, %u left", vcpu_index, cpu_count_.load());
+}
+
+bool Vm::SetMemorySize(uint64_t total_mb, std::string* error) {
+    if (!virtio_mem_) {
+        *error = "memory hotplug is not enabled";
+        return false;
+    }
+    uint64_t boot_mb = mem_.alloc_size >> 20;
+    uint64_t max_mb = boot_mb + (virtio_mem_->RegionSize() >> 20);
+    if (total_mb < boot_mb || total_mb > max_mb) {
+        *error = "memory must be " + std::to_string(boot_mb) + " to " +
+                 std::to_string(max_mb) + " MB";
+        return false;
+    }
+    uint64_t total = total_mb << 20;
+    virtio_mem_->SetRequestedSize(total > mem_.alloc_size ? total - mem_.alloc_size : 0);
+    LOG_INFO("Memory: asked the guest for %llu MB in all (%llu MB hotplugged)", total_mb,
+             virtio_mem_->RequestedSize() >> 20);
+    return true;
+}
+
+uint64_t Vm::MemorySizeBytes() const {
+    return mem_.alloc_size + (virtio_mem_ ? virtio_mem_->PluggedSize() : 0);
+}
+
+const char* Vm::HotplugSaveBlocker() const {
+    if (virtio_mem_ && virtio_mem_->PluggedSize()) {
+        return "hotplugged memory is plugged in";
+    }
+    if (!cpu_hotplug_.MaxCpus()) return nullptr;
+    if (cpu_hotplug_.Busy()) return "a vCPU is being plugged in or removed";
+    // A snapshot holds vCPUs 0 to cpu_count_ - 1 and resumes with those.
+    for (uint32_t i = 0; i < cpu_hotplug_.MaxCpus(); i++) {
+        if (cpu_hotplug_.Present(i) != (i < cpu_count_)) {
+            return "the guest has ejected a vCPU out of order";
+        }
+    }
+    return nullptr;
+}
+
+void Vm::SetPageDedupPassCallback(PageDedupScanner::PassCallback cb) {
+    std::lock_guard<std::mutex> lock(page_dedup_mutex_);
+    page_dedup_callback_ = std::move(cb);
+}
+
+PageDedupScanner::Stats Vm::GetPageDedupStats() const {
+    return page_dedup_ ? page_dedup_->GetStats() : PageDedupScanner::Stats{};
+}
+
+bool Vm::CombineGuestPages(uint64_t* pages_combined) {
+    return page_dedup_ && page_dedup_->Combine(pages_combined);
+}
+
 void Vm::InjectKeyEvent(uint32_t evdev_code, bool pressed) {
     if (virtio_kbd_) {
-        virtio_kbd_->InjectEvent(EV_KEY, static_cast<uint16_t>(evdev_code),
-                                 pressed ? 1 : 0, /*notify=*/false);
-        virtio_kbd_->InjectEvent(EV_SYN, SYN_REPORT, 0, /*notify=*/true);
+        std::vector<VirtioInputEvent> events;
+        AppendKeyReport(&events, evdev_code, pressed);
+        virtio_kbd_->InjectEvents(events);
     }
 }
 
 void Vm::InjectPointerEvent(int32_t x, int32_t y, uint32_t buttons) {
     if (virtio_tablet_) {
-        virtio_tablet_->InjectEvent(EV_ABS, ABS_X,
-            static_cast<uint32_t>(x), /*notify=*/false);
-        virtio_tablet_->InjectEvent(EV_ABS, ABS_Y,
-            static_cast<uint32_t>(y), /*notify=*/false);
-        if ((buttons & 1) != (inject_prev_buttons_ & 1))
-            virtio_tablet_->InjectEvent(EV_KEY, BTN_LEFT,
-                (buttons & 1) ? 1 : 0, /*notify=*/false);
-        if ((buttons & 2) != (inject_prev_buttons_ & 2))
-            virtio_tablet_->InjectEvent(EV_KEY, BTN_RIGHT,
-                (buttons & 2) ? 1 : 0, /*notify=*/false);
-        if ((buttons & 4) != (inject_prev_buttons_ & 4))
-            virtio_tablet_->InjectEvent(EV_KEY, BTN_MIDDLE,
-                (buttons & 4) ? 1 : 0, /*notify=*/false);
-        inject_prev_buttons_ = buttons;
-        virtio_tablet_->InjectEvent(EV_SYN, SYN_REPORT, 0, /*notify=*/true);
+        std::vector<VirtioInputEvent> events;
+        AppendPointerReport(&events, x, y, buttons, &inject_prev_buttons_);
+        virtio_tablet_->InjectEvents(events);
     }
 }
 
-void Vm::InjectWheelEvent(int32_t delta) {
-    if (virtio_tablet_ && delta != 0) {
-        virtio_tablet_->InjectEvent(EV_REL, REL_WHEEL,
-            static_cast<uint32_t>(delta), /*notify=*/false);
-        virtio_tablet_->InjectEvent(EV_SYN, SYN_REPORT, 0, /*notify=*/true);
+void Vm::SetDisplaySize(uint32_t scanout_id, uint32_t width, uint32_t height) {
+    if (virtio_gpu_) {
+        virtio_gpu_->SetDisplaySize(scanout_id, width, height);
     }
 }
 
-void Vm::SetDisplaySize(uint32_t width, uint32_t height) {
+void Vm::SetDisplayViewer(bool attached) {
     if (virtio_gpu_) {
-        virtio_gpu_->SetDisplaySize(width, height);
+        virtio_gpu_->SetFramesWanted(attached);
     }
 }
 
@@ -679,10 +2168,11 @@ void Vm::SendClipboardGrab(const std::vector<uint32_t>& types) {
     }
 }
 
-void Vm::SendClipboardData(uint32_t type, const uint8_t* data, size_t len) {
+void Vm::SendClipboardData(uint32_t type, uint64_t offset, uint64_t total,
+                           const uint8_t* data, size_t len) {
     if (vdagent_handler_) {
         vdagent_handler_->SendClipboardData(
-            VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD, type, data, len);
+            VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD, type, offset, total, data, len);
     }
 }
 
@@ -700,12 +2190,13 @@ void Vm::SendClipboardRelease() {
     }
 }
 
-bool Vm::AddSharedFolder(const std::string& tag, const std::string& host_path, bool readonly) {
+bool Vm::AddSharedFolder(const std::string& tag, const std::string& host_path, bool readonly,
+                         bool writeback) {
     if (!virtio_fs_) {
         LOG_ERROR("VirtIO FS device not initialized");
         return false;
     }
-    return virtio_fs_->AddShare(tag, host_path, readonly);
+    return virtio_fs_->AddShare(tag, host_path, readonly, writeback);
 }
 
 bool Vm::RemoveSharedFolder(const std::string& tag) {
@@ -2,16 +2,29 @@
 
 #include "core/vmm/types.h"
 #include "core/vmm/address_space.h"
+#include "core/vmm/cpu_placement.h"
+#include "core/vmm/dirty_tracker.h"
+#include "core/vmm/guest_ram.h"
+#include "core/vmm/io_thread.h"
+#include "core/vmm/migration.h"
+#include "core/vmm/page_dedup.h"
+#include "core/vmm/snapshot.h"
+#include "core/vmm/startup_trace.h"
+#include "core/vmm/vcpu_halt.h"
+#include "core/arch/x86_64/boot.h"
 #include "hypervisor/whvp_vm.h"
 #include "hypervisor/whvp_vcpu.h"
 #include "core/device/serial/uart_16550.h"
+#include "core/device/serial/console_tx_buffer.h"
 #include "core/device/timer/i8254_pit.h"
 #include "core/device/rtc/cmos_rtc.h"
 #include "core/device/irq/ioapic.h"
 #include "core/device/irq/i8259_pic.h"
 #include "core/device/pci/pci_host.h"
 #include "core/device/acpi/acpi_pm.h"
+#include "core/device/acpi/cpu_hotplug.h"
 #include "core/device/virtio/virtio_mmio.h"
+#include "core/device/virtio/virtio_pci.h"
 #include "core/device/virtio/virtio_blk.h"
 #include "core/device/virtio/virtio_net.h"
 #include "core/device/virtio/virtio_input.h"
@@ -19,6 +32,9 @@
 #include "core/device/virtio/virtio_serial.h"
 #include "core/device/virtio/virtio_fs.h"
 #include "core/device/virtio/virtio_snd.h"
+#include "core/device/virtio/virtio_balloon.h"
+#include "core/device/virtio/virtio_mem.h"
+#include "core/device/virtio/virtio_vsock.h"
 #include "core/vdagent/vdagent_handler.h"
 #include "core/guest_agent/guest_agent_handler.h"
 #include "core/net/net_backend.h"
@@ -27,6 +43,9 @@
 #include <memory>
 #include <string>
 #include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -34,18 +53,67 @@ struct VmSharedFolder {
     std::string tag;
     std::string host_path;
     bool readonly = false;
+    bool writeback = false;
 };
 
 struct VmConfig {
     std::string kernel_path;
     std::string initrd_path;
     std::string disk_path;
+    bool disk_direct_io = false;
+    bool disk_mmap = false;
+    uint64_t qcow2_l2_cache_mb = 0;  // 0 = cover the whole image
+    uint64_t qcow2_compressed_cache_mb = 0;  // 0 = default
+    uint32_t disk_readahead_kb = 512;        // 0 = no readahead
+    uint32_t disk_boot_profile_s = 30;       // 0 = no boot read profile
+    std::string disk_trace_path;             // empty = no block trace
+    BlockThrottleLimits disk_limits;         // IOPS / bandwidth, 0 = unlimited
+    uint32_t irq_coalesce_us = 0;            // 0 = no interrupt moderation
+    uint32_t irq_coalesce_frames = 32;
+    // Disk and network on virtio-pci, with an MSI-X vector per queue.
+    bool virtio_pci = false;
     std::string cmdline = "console=ttyS0 earlyprintk=serial lapic no_timer_check tsc=reliable i8042.noprobe";
     uint64_t memory_mb = 256;
+    bool lazy_memory = false;  // commit guest RAM on first touch
+    bool large_pages = false;  // back guest RAM with large pages if allowed
+    uint32_t page_dedup_interval_s = 0;  // 0 = no shareable page scan
+    VCpuPlacement vcpu_placement = VCpuPlacement::kNone;
+    // Host nodes guest RAM is taken from. Local and split place the VM's
+    // threads themselves and override vcpu_placement; split also shows the
+    // guest its nodes through ACPI SRAT/SLIT.
+    NumaMemory numa_memory = NumaMemory::kNone;
     uint32_t cpu_count = 1;
+    // Ceilings for SetCpuCount() and SetMemorySize() on the running VM; 0
+    // (or no more than cpu_count / memory_mb) leaves the size fixed. The
+    // guest sees hotpluggable CPUs through ACPI and the memory above
+    // memory_mb through virtio-mem.
+    uint32_t max_cpu_count = 0;
+    uint64_t max_memory_mb = 0;
+    // Dedicated I/O threads, up to kMaxIoThreads, and which of them each
+    // device ("blk", "net", ...) runs its queue notifies on. Devices left
+    // out keep their default: a notify thread of their own for blk, net,
+    // fs and balloon, the vCPU for the rest.
+    uint32_t io_threads = 0;
+    std::map<std::string, uint32_t> device_io_threads;
+    // x2APIC emulation and TSC-deadline timers, if the hypervisor has them.
+    // A snapshot or migration resumes only under the APIC mode it was taken
+    // in; see SnapshotFile::x2apic().
+    bool x2apic = false;
+    // Performance counters and their interrupt for in-guest perf, if the
+    // hypervisor virtualizes them. Counter values are not in snapshots,
+    // and a guest that found a PMU expects one when it resumes.
+    bool pmu = false;
     bool net_link_up = false;
     std::vector<PortForward> port_forwards;
+    NetRateLimit net_rate_limit;  // 0 = unlimited
+    // virtio-vsock, bridged to host loopback TCP.
+    bool vsock = false;
+    std::vector<VsockForward> vsock_forwards;
     std::vector<VmSharedFolder> shared_folders;  // Initial shared folders
+    // Kernel console on hvc0 (a virtio-serial console port) instead of
+    // ttyS0, which costs an exit per character. Rewrites console= in
+    // cmdline; the UART stays for anything that still uses it.
+    bool hvc_console = false;
     bool interactive = true;
     std::shared_ptr<ConsolePort> console_port;
     std::shared_ptr<InputPort> input_port;
@@ -54,6 +122,29 @@ struct VmConfig {
     std::shared_ptr<AudioPort> audio_port;
     uint32_t display_width = 1024;
     uint32_t display_height = 768;
+    uint32_t display_count = 1;  // scanouts, clamped to kMaxDisplayScanouts
+    // Resume from this snapshot instead of booting. RAM size and vCPU
+    // count must match it; the kernel and initrd go unused.
+    std::string restore_path;
+    // Default target of Vm::Checkpoint(), which the runtime takes every
+    // checkpoint_interval_s if set. Setting a path turns on dirty page
+    // tracking, so checkpoints after the first write only what changed.
+    std::string checkpoint_path;
+    uint32_t checkpoint_interval_s = 0;  // 0 = on request only
+    // Tracks dirty pages from the start so Vm::Migrate() can copy RAM
+    // while the guest runs; otherwise a migration stops it for the copy.
+    bool migratable = false;
+    // Take over a VM migrated from another host instead of booting: waits
+    // for the source on this TCP port. vCPU count and RAM size must match
+    // the source, and the disk must be its image on shared storage or, if
+    // the source mirrors it, an image of the same size to copy into.
+    uint16_t migrate_listen_port = 0;
+};
+
+// Profiling snapshot of one vCPU.
+struct VCpuStats {
+    whvp::ExitStats exits;
+    VCpuHalt::Stats halt;
 };
 
 class Vm {
@@ -66,24 +157,81 @@ public:
 
     void RequestStop();
     void RequestReboot();
+    // Stops the vCPUs, writes the VM to a snapshot at `path` and, if that
+    // worked, lets Run() return. Otherwise the VM carries on. Blocks until
+    // the snapshot is written; call from any thread but Run()'s.
+    bool Suspend(const std::string& path);
+    bool Suspended() const { return suspended_; }
+    // Stops the vCPUs, writes the VM to `path` (the configured checkpoint
+    // path if empty) and lets it carry on. Repeated checkpoints to one path
+    // rewrite only the pages dirtied since the previous one, when the
+    // hypervisor tracks them. Blocks like Suspend().
+    bool Checkpoint(const std::string& path = {});
+    // Moves the running VM to a runtime waiting with migrate_listen_port on
+    // `host`:`port`. RAM is copied while the guest runs, then again for the
+    // pages it dirtied, until what is left fits options.max_downtime_ms;
+    // then the vCPUs stop for the rest and the device state. On success
+    // Run() returns and Migrated() is true; otherwise the VM carries on.
+    // Blocks until done; call from any thread but Run()'s.
+    bool Migrate(const std::string& host, uint16_t port, const MigrationOptions& options);
+    bool Migrated() const { return migrated_; }
+    std::vector<StartupTrace::Phase> GetStartupTrace() const {
+        return startup_trace_.Phases();
+    }
     bool RebootRequested() const { return reboot_requested_.load(); }
     void TriggerPowerButton();
     void InjectConsoleBytes(const uint8_t* data, size_t size);
     void SetNetLinkUp(bool up);
     void UpdatePortForwards(const std::vector<PortForward>& forwards);
+    void SetNetRateLimit(const NetRateLimit& limit);
+    // Guest frames dropped for want of a TX buffer, and by the rate limit.
+    uint64_t GetNetTxDropped() const;
+    uint64_t GetNetShaperDropped() const;
+    // pcapng capture of the guest's network traffic; see NetCapture.
+    bool StartNetCapture(const NetCaptureOptions& options, std::string* error);
+    void StopNetCapture();
+    // Memory balloon: asks the guest to give `size_mb` of its RAM back.
+    void SetBalloonSize(uint64_t size_mb);
+    // Has the guest hint its free pages once so the host can drop them.
+    void RequestFreePageHints();
+    VirtioBalloonDevice::Stats GetBalloonStats() const;
+    // virtio-fs requests per opcode since boot; empty without shared folders.
+    std::vector<VirtioFsOpStats::OpSnapshot> GetFsOpStats() const;
+    // Disk IOPS and bandwidth limits, for a running guest too.
+    bool SetDiskLimits(const BlockThrottleLimits& limits);
+    // Brings vCPUs up or asks the guest to give them back, down to one and
+    // up to max_cpu_count. Removal finishes when the guest ejects the CPU.
+    bool SetCpuCount(uint32_t count, std::string* error);
+    // Asks the guest to plug or unplug virtio-mem blocks until it has
+    // `total_mb` in all, between memory_mb and max_memory_mb.
+    bool SetMemorySize(uint64_t total_mb, std::string* error);
+    uint32_t MaxCpuCount() const { return max_cpu_count_; }
+    // Boot RAM plus what the guest has plugged.
+    uint64_t MemorySizeBytes() const;
+
+    // Shareable page scan, if enabled. The callback runs on the scan
+    // thread after each pass.
+    void SetPageDedupPassCallback(PageDedupScanner::PassCallback cb);
+    PageDedupScanner::Stats GetPageDedupStats() const;
+    bool CombineGuestPages(uint64_t* pages_combined);
     void InjectKeyEvent(uint32_t evdev_code, bool pressed);
     void InjectPointerEvent(int32_t x, int32_t y, uint32_t buttons);
-    void InjectWheelEvent(int32_t delta);
-    void SetDisplaySize(uint32_t width, uint32_t height);
+    void SetDisplaySize(uint32_t scanout_id, uint32_t width, uint32_t height);
+    // Without a viewer the GPU stops producing frames; see
+    // VirtioGpuDevice::SetFramesWanted.
+    void SetDisplayViewer(bool attached);
 
     // Clipboard operations
     void SendClipboardGrab(const std::vector<uint32_t>& types);
-    void SendClipboardData(uint32_t type, const uint8_t* data, size_t len);
+    // `len` bytes at `offset` of a `total`-byte payload, pieces in order.
+    void SendClipboardData(uint32_t type, uint64_t offset, uint64_t total,
+                           const uint8_t* data, size_t len);
     void SendClipboardRequest(uint32_t type);
     void SendClipboardRelease();
 
     // Dynamic shared folder management (runtime)
-    bool AddSharedFolder(const std::string& tag, const std::string& host_path, bool readonly = false);
+    bool AddSharedFolder(const std::string& tag, const std::string& host_path, bool readonly = false,
+                         bool writeback = false);
     bool RemoveSharedFolder(const std::string& tag);
     std::vector<std::string> GetSharedFolderTags() const;
 
@@ -92,32 +240,122 @@ public:
     bool IsGuestAgentConnected() const;
     void GuestAgentShutdown(const std::string& mode = "powerdown");
 
+    // Profiling
+    std::vector<VCpuStats> GetVCpuStats() const;
+    std::vector<VmPortForwardStat> GetPortForwardStats() const;
+    // Device and vCPU totals for metrics, cheap enough to sample often.
+    // display_frames is left to the caller.
+    VmCounters GetCounters() const;
+    uint32_t VCpuCount() const { return cpu_count_.load(); }
+    uint64_t CommittedRamBytes() const;
+    // Name of the device mapped at an MMIO base, or nullptr if unknown.
+    static const char* MmioDeviceName(uint64_t base);
+
 private:
     Vm() = default;
 
-    bool AllocateMemory(uint64_t size);
+    // With `numa`, RAM comes from the nodes cpu_placement_ planned.
+    bool AllocateMemory(uint64_t size, bool lazy, bool large_pages, bool numa);
+    // Lays guest RAM out over `base` and maps it into the partition, each
+    // of `pieces` (separate host allocations) on its own.
+    bool MapGuestRam(uint8_t* base, uint64_t alloc,
+                     const std::vector<NodeGuestRam::Piece>& pieces = {});
+    // Describes the guest nodes of `pieces` for the SRAT.
+    void SetNumaLayout(const std::vector<NodeGuestRam::Piece>& pieces);
+    // Devices with state in a snapshot, under their section names.
+    std::vector<std::pair<std::string, Device*>> SnapshotDevices();
+    bool SaveSnapshot(const std::string& path);
+    bool SaveCheckpoint(const std::string& path);
+    // vCPU and device state for a snapshot. The devices stop touching
+    // guest RAM until ResumeDevicesAfterSave().
+    bool CaptureState(SnapshotFile::Sections* sections);
+    void ResumeDevicesAfterSave();
+    std::vector<VirtioMmioDevice*> VirtioTransports();
+    // What Run() does with the vCPUs stopped; Suspend() and Migrate() end
+    // the VM if it works, Checkpoint() lets it carry on.
+    enum class PauseFor { kSuspend, kCheckpoint, kMigrate };
+    // Has Run() stop the vCPUs and save to `path` (or migration_).
+    bool PauseAndSave(const std::string& path, PauseFor reason);
+    void CheckpointThreadFunc();
+    // Migrate() with the VM running: RAM, and the disk if mirrored, until
+    // the dirtied rest is small enough to send with it stopped.
+    bool PreCopy(MigrationStream& stream, const MigrationOptions& options, bool mirror);
+    // Migrate() with the vCPUs stopped, on Run()'s thread.
+    bool FinishMigration();
+    bool LoadSnapshot(const SnapshotFile::Sections& sections);
     bool SetupDevices();
-    bool SetupVirtioBlk(const std::string& disk_path);
-    bool SetupVirtioNet(bool link_up, const std::vector<PortForward>& forwards);
+    // Wires up virtio_blk_, which Create has opened already.
+    bool SetupVirtioBlk();
+    bool SetupVirtioNet(bool link_up, const std::vector<PortForward>& forwards,
+                        uint32_t num_queue_pairs);
     bool SetupVirtioInput();
-    bool SetupVirtioGpu(uint32_t width, uint32_t height);
+    bool SetupVirtioGpu(uint32_t width, uint32_t height, uint32_t num_scanouts);
     bool SetupVirtioSerial();
     bool SetupVirtioFs(const std::vector<VmSharedFolder>& initial_folders);
     bool SetupVirtioSnd();
-    bool LoadKernel(const VmConfig& config);
+    bool SetupVirtioBalloon();
+    bool SetupVirtioVsock(const std::vector<VsockForward>& forwards);
+    // Reserves the virtio-mem region above RAM, before anything copies mem_.
+    bool ReserveHotplugMemory(uint64_t size);
+    bool SetupVirtioMem();
+    // Moves a device's queue notifies off the vCPU, onto the I/O thread
+    // `device` is assigned to, or else (`own_thread`) a thread of its own.
+    void EnableNotifyIoEvent(const char* device, VirtioMmioDevice* mmio,
+                             uint64_t base, bool own_thread = true);
+    bool LoadKernel(const VmConfig& config, const x86::InitrdImage& initrd);
 
+    // Guest console input goes to hvc0 once the guest has it open.
+    void PushConsoleInput(const uint8_t* data, size_t size);
     void InputThreadFunc();
     void HidInputThreadFunc();
     void VCpuThreadFunc(uint32_t vcpu_index);
+    // Starts the thread of an online vCPU. Call with vcpu_mutex_ held.
+    void StartVCpuThreadLocked(uint32_t vcpu_index);
+    // Joins vCPU threads, those SetCpuCount() starts meanwhile included.
+    void JoinVCpuThreads();
+    // Gets every vCPU out of the hypervisor and out of halt.
+    void KickAllVCpus();
+    // Why a snapshot or migration cannot be taken now, or nullptr.
+    const char* HotplugSaveBlocker() const;
+    // The guest ejected `vcpu_index`; its thread winds down.
+    void OnCpuEjected(uint32_t vcpu_index);
+    void LogExitStats(uint32_t vcpu_index);
     void InjectIrq(uint8_t irq);
+    // Delivers an MSI as the message's address and data describe it.
+    void InjectMsi(uint64_t address, uint32_t data);
 
-    uint32_t cpu_count_ = 1;
+    // vCPUs the guest has. With CPU hotplug, vcpus_ and halts_ have a
+    // slot for each of max_cpu_count_; the first vcpus_created_ are set.
+    std::atomic<uint32_t> cpu_count_{1};
+    uint32_t max_cpu_count_ = 1;
     std::unique_ptr<whvp::WhvpVm> whvp_vm_;
     std::vector<std::unique_ptr<whvp::WhvpVCpu>> vcpus_;
+    std::atomic<uint32_t> vcpus_created_{0};
+    struct VCpuSlot {
+        std::atomic<bool> online{false};
+        std::atomic<bool> thread_running{false};
+    };
+    std::unique_ptr<VCpuSlot[]> vcpu_slots_;
+    // Guards vcpu_threads_, which SetCpuCount() adds to while Run() joins.
+    std::mutex vcpu_mutex_;
     std::vector<std::thread> vcpu_threads_;
+    bool vcpus_running_ = false;
+    // One per vCPU; sized before any device can inject an interrupt.
+    std::vector<std::unique_ptr<VCpuHalt>> halts_;
     std::atomic<int> exit_code_{0};
 
     GuestMemMap mem_;
+    // Owns mem_.base when RAM is committed on demand.
+    std::unique_ptr<LazyGuestRam> lazy_ram_;
+    // Owns mem_.base when RAM is allocated per NUMA node.
+    std::unique_ptr<NodeGuestRam> node_ram_;
+    // Owns mem_.base when resumed from a snapshot.
+    std::unique_ptr<SnapshotFile> snapshot_;
+    // Guest RAM writes since the last checkpoint, if tracked (mem_.dirty).
+    std::unique_ptr<DirtyTracker> dirty_tracker_;
+    std::unique_ptr<PageDedupScanner> page_dedup_;
+    std::mutex page_dedup_mutex_;
+    PageDedupScanner::PassCallback page_dedup_callback_;
 
     AddressSpace addr_space_;
     Uart16550 uart_;
@@ -129,8 +367,12 @@ private:
     I8259Pic pic_slave_;
     PciHostBridge pci_host_;
     AcpiPm acpi_pm_;
+    CpuHotplug cpu_hotplug_;     // registered only with max_cpu_count_ > 1
     Device port_sink_;
 
+    // Disk and network use virtio-pci instead of virtio-mmio.
+    bool virtio_pci_ = false;
+
     // VirtIO block device (optional)
     std::unique_ptr<VirtioBlkDevice> virtio_blk_;
     std::unique_ptr<VirtioMmioDevice> virtio_mmio_;
@@ -155,6 +397,7 @@ private:
     std::unique_ptr<VirtioMmioDevice> virtio_mmio_serial_;
     std::unique_ptr<VDAgentHandler> vdagent_handler_;
     std::unique_ptr<GuestAgentHandler> guest_agent_handler_;
+    bool hvc_console_ = false;
 
     // VirtIO FS (shared folders) - single device with multiple shares
     std::unique_ptr<VirtioFsDevice> virtio_fs_;
@@ -164,13 +407,58 @@ private:
     std::unique_ptr<VirtioSndDevice> virtio_snd_;
     std::unique_ptr<VirtioMmioDevice> virtio_mmio_snd_;
 
+    // VirtIO Balloon (inflate/deflate, free page reporting)
+    std::unique_ptr<VirtioBalloonDevice> virtio_balloon_;
+    std::unique_ptr<VirtioMmioDevice> virtio_mmio_balloon_;
+
+    // VirtIO Mem (memory hotplug above boot RAM, optional)
+    std::unique_ptr<VirtioMemDevice> virtio_mem_;
+    std::unique_ptr<VirtioMmioDevice> virtio_mmio_mem_;
+
+    // VirtIO vsock (host loopback TCP bridge)
+    std::unique_ptr<VirtioVsockDevice> virtio_vsock_;
+    std::unique_ptr<VirtioMmioDevice> virtio_mmio_vsock_;
+
     std::vector<x86::VirtioMmioAcpiInfo> virtio_acpi_devs_;
+    x86::NumaAcpiInfo numa_acpi_;  // no nodes unless RAM is split
 
+    StartupTrace startup_trace_;
+    CpuPlacement cpu_placement_;
+    std::vector<std::unique_ptr<IoThread>> io_threads_;
+    std::map<std::string, uint32_t> device_io_threads_;
+    std::atomic<bool> first_frame_{false};
     std::atomic<bool> running_{false};
     std::atomic<bool> reboot_requested_{false};
+    // Suspend() hands Run() the path and waits for the outcome.
+    std::mutex suspend_mutex_;
+    std::condition_variable suspend_cv_;
+    std::atomic<bool> pausing_{false};
+    std::string suspend_path_;
+    PauseFor pause_for_ = PauseFor::kSuspend;
+    bool suspend_done_ = false;
+    bool suspend_ok_ = false;
+    bool run_finished_ = false;
+    std::atomic<bool> suspended_{false};
+    std::string checkpoint_path_;
+    // Path of the last checkpoint written, in full or on top of the one
+    // before; only that file can take the next incremental update.
+    std::string checkpoint_base_;
+    uint32_t checkpoint_interval_s_ = 0;
+    std::thread checkpoint_thread_;
+    std::mutex checkpoint_mutex_;
+    std::condition_variable checkpoint_cv_;
+    bool checkpoint_stop_ = false;
+    // Held by Checkpoint() and Migrate(), which both Take() the dirty pages.
+    std::mutex save_mutex_;
+    // Handed to FinishMigration() for the duration of a Migrate().
+    MigrationStream* migration_ = nullptr;
+    bool migration_mirror_ = false;
+    std::atomic<bool> migrated_{false};
     std::thread input_thread_;
     std::thread hid_input_thread_;
     std::shared_ptr<ConsolePort> console_port_;
+    // UART and hvc0 output on its way to console_port_.
+    ConsoleTxBuffer console_tx_;
     std::shared_ptr<InputPort> input_port_;
     std::shared_ptr<DisplayPort> display_port_;
     std::shared_ptr<ClipboardPort> clipboard_port_;
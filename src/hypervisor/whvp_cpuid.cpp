@@ -0,0 +1,94 @@
+#include "hypervisor/whvp_cpuid.h"
+#include <intrin.h>
+#include <bit>
+
+namespace whvp {
+
+namespace {
+
+constexpr uint32_t kKvmSignature = 0x40000000;
+constexpr uint32_t kKvmFeatures  = 0x40000001;
+constexpr uint32_t kKvmFeatureClocksource2     = 1u << 3;
+constexpr uint32_t kKvmFeatureClocksourceStable = 1u << 24;
+
+constexpr uint32_t kLeaf1EcxMonitor     = 1u << 3;
+constexpr uint32_t kLeaf1EcxX2Apic      = 1u << 21;
+constexpr uint32_t kLeaf1EcxTscDeadline = 1u << 24;
+
+// Level types of leaves 0xB/0x1F.
+constexpr uint32_t kLevelSmt  = 1;
+constexpr uint32_t kLevelCore = 2;
+
+bool HostIsAmd() {
+    static const bool amd = [] {
+        int r[4]{};
+        __cpuid(r, 0);
+        return r[1] == 0x68747541;  // "Auth"enticAMD
+    }();
+    return amd;
+}
+
+} // namespace
+
+uint32_t Leaf1Ecx(uint32_t host_ecx, bool x2apic) {
+    uint32_t ecx = host_ecx & ~kLeaf1EcxMonitor;
+    if (x2apic) return ecx | kLeaf1EcxX2Apic;
+    return ecx & ~(kLeaf1EcxX2Apic | kLeaf1EcxTscDeadline);
+}
+
+std::vector<uint32_t> CpuidExitLeaves() {
+    return {1, 4, 0xB, 0x1F, kKvmSignature, kKvmFeatures, 0x80000008};
+}
+
+void GuestCpuid(uint32_t leaf, uint32_t subleaf, uint32_t vp_index,
+                uint32_t cpu_count, bool kvm_clock, bool x2apic, CpuidResult* r) {
+    // Bits of the APIC ID that number the cores of the package.
+    uint32_t core_bits = static_cast<uint32_t>(std::bit_width(cpu_count - 1));
+
+    switch (leaf) {
+    case 1:
+        // Same as the partition-wide override. The hypervisor bit makes
+        // Linux look at 0x40000000.
+        r->ecx = Leaf1Ecx(r->ecx, x2apic) | (1u << 31);
+        r->ebx = (r->ebx & 0x0000FFFF) | ((1u << core_bits) << 16) | (vp_index << 24);
+        if (cpu_count > 1) r->edx |= 1u << 28;  // HTT: EBX[23:16] is valid
+        break;
+
+    case 4:
+        // Deterministic cache parameters; type 0 ends the list.
+        if (r->eax & 0x1F) {
+            uint32_t level = (r->eax >> 5) & 7;
+            uint32_t sharing = level >= 3 ? (1u << core_bits) - 1 : 0;
+            r->eax = (r->eax & 0x3FFF) | (sharing << 14) | (((1u << core_bits) - 1) << 26);
+        }
+        break;
+
+    case 0xB:
+    case 0x1F:
+        if (subleaf == 0) {
+            *r = {0, 1, kLevelSmt << 8, vp_index};
+        } else if (subleaf == 1) {
+            *r = {core_bits, cpu_count, (kLevelCore << 8) | 1, vp_index};
+        } else {
+            *r = {0, 0, subleaf & 0xFF, vp_index};
+        }
+        break;
+
+    case kKvmSignature:
+        if (kvm_clock) *r = {kKvmFeatures, 0x4B4D564B, 0x564B4D56, 0x0000004D};  // "KVMKVMKVM"
+        break;
+
+    case kKvmFeatures:
+        if (kvm_clock) *r = {kKvmFeatureClocksource2 | kKvmFeatureClocksourceStable, 0, 0, 0};
+        break;
+
+    case 0x80000008:
+        // Core count and APIC ID core bits; reserved on Intel.
+        if (HostIsAmd()) {
+            r->ecx = (r->ecx & ~0xF0FFu) | (core_bits << 12) | (cpu_count - 1);
+        }
+        break;
+    }
+}
+
+} // namespace whvp
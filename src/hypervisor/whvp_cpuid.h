@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace whvp {
+
+// kvmclock MSRs (the "new" pair, KVM_FEATURE_CLOCKSOURCE2).
+constexpr uint32_t kMsrKvmWallClock  = 0x4B564D00;
+constexpr uint32_t kMsrKvmSystemTime = 0x4B564D01;
+
+struct CpuidResult {
+    uint32_t eax, ebx, ecx, edx;
+};
+
+// CPUID.1:ECX as the guest sees it, from the host's value. MONITOR/MWAIT
+// is always masked (#UD in WHVP). x2APIC and TSC-deadline are offered only
+// with x2APIC emulation, where the hypervisor handles both through MSRs;
+// the xAPIC emulation may not fire TSC-deadline timers.
+uint32_t Leaf1Ecx(uint32_t host_ecx, bool x2apic);
+
+// Leaves the partition exits on, so each vCPU can be given its own answer.
+std::vector<uint32_t> CpuidExitLeaves();
+
+// Adjusts the hypervisor's default result for `leaf`/`subleaf` as seen by
+// vCPU `vp_index`: one package of `cpu_count` single-threaded cores, APIC
+// ID = vCPU index, and, with `kvm_clock`, the KVM signature leaves that
+// advertise kvmclock. `x2apic` as for Leaf1Ecx.
+void GuestCpuid(uint32_t leaf, uint32_t subleaf, uint32_t vp_index,
+                uint32_t cpu_count, bool kvm_clock, bool x2apic, CpuidResult* r);
+
+} // namespace whvp
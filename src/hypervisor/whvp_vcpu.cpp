@@ -1,7 +1,166 @@
 #include "hypervisor/whvp_vcpu.h"
+#include "hypervisor/whvp_cpuid.h"
+#include "core/vmm/dirty_tracker.h"
+#include "core/vmm/etw.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
 
 namespace whvp {
 
+namespace {
+
+constexpr WHV_REGISTER_NAME kGprNames[16] = {
+    WHvX64RegisterRax, WHvX64RegisterRcx, WHvX64RegisterRdx, WHvX64RegisterRbx,
+    WHvX64RegisterRsp, WHvX64RegisterRbp, WHvX64RegisterRsi, WHvX64RegisterRdi,
+    WHvX64RegisterR8,  WHvX64RegisterR9,  WHvX64RegisterR10, WHvX64RegisterR11,
+    WHvX64RegisterR12, WHvX64RegisterR13, WHvX64RegisterR14, WHvX64RegisterR15,
+};
+
+int64_t QpcNow() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+// Opcode bytes DecodeMmioMove accepts.
+constexpr uint8_t kPrefixOpSize  = 0x66;  // operand size override
+constexpr uint8_t kPrefixRex     = 0x40;  // 0100WRXB
+constexpr uint8_t kRexW          = 0x08;  // 64-bit operand
+constexpr uint8_t kRexR          = 0x04;  // high bit of ModRM.reg
+constexpr uint8_t kOpTwoByte     = 0x0F;  // escape to the 0F xx opcodes
+constexpr uint8_t kOpMovStore8   = 0x88;  // mov r/m8, r8
+constexpr uint8_t kOpMovStore    = 0x89;  // mov r/m, r
+constexpr uint8_t kOpMovLoad     = 0x8B;  // mov r, r/m
+constexpr uint8_t kOpMovImm8     = 0xC6;  // mov r/m8, imm8
+constexpr uint8_t kOpMovImm      = 0xC7;  // mov r/m, imm
+constexpr uint8_t kOpMovzx8      = 0xB6;  // 0F B6: movzx r, r/m8
+constexpr uint8_t kOpMovzx16     = 0xB7;  // 0F B7: movzx r, r/m16
+
+// One decoded MMIO `mov`. Covers what Linux's MMIO accessors and the virtio
+// drivers emit; anything else goes to the emulator.
+struct MmioMove {
+    bool write;
+    uint8_t size;      // access width in bytes
+    uint8_t reg;       // source GPR for stores, destination for loads
+    bool has_imm;      // store of `imm` instead of `reg`
+    uint64_t imm;
+    uint8_t length;    // instruction length
+};
+
+// Skips a memory ModRM operand (SIB, displacement) starting at p[i].
+// Returns the index after it, or 0 for a register operand or short buffer.
+uint32_t SkipMemOperand(const uint8_t* p, uint32_t n, uint32_t i, uint8_t* modrm) {
+    if (i >= n) return 0;
+    *modrm = p[i++];
+    uint8_t mod = *modrm >> 6;
+    uint8_t rm = *modrm & 7;
+    if (mod == 3) return 0;
+    if (rm == 4) {
+        if (i >= n) return 0;
+        uint8_t sib = p[i++];
+        if (mod == 0 && (sib & 7) == 5) i += 4;
+    } else if (mod == 0 && rm == 5) {
+        i += 4;  // RIP-relative disp32
+    }
+    if (mod == 1) i += 1;
+    if (mod == 2) i += 4;
+    return i <= n ? i : 0;
+}
+
+// 64-bit mode only. Accepts an optional 66 prefix followed by an optional
+// REX, then one of:
+//   88/89 /r      mov r/m, r            (8/16/32/64-bit stores)
+//   C6/C7 /0 imm  mov r/m, imm          (immediate stores)
+//   8B /r         mov r, r/m            (32/64-bit loads, zero-extending)
+//   0F B6/B7 /r   movzx r, r/m8|r/m16   (narrow loads, zero-extending)
+// Narrow loads into a register's low bits need its old value and are left
+// to the emulator.
+bool DecodeMmioMove(const WHV_MEMORY_ACCESS_CONTEXT& mem, MmioMove* out) {
+    const uint8_t* p = mem.InstructionBytes;
+    uint32_t n = mem.InstructionByteCount;
+    uint32_t i = 0;
+
+    bool opsize16 = false;
+    if (i < n && p[i] == kPrefixOpSize) {
+        opsize16 = true;
+        i++;
+    }
+    uint8_t rex = 0;
+    if (i < n && (p[i] & 0xF0) == kPrefixRex) rex = p[i++];
+    if (i >= n) return false;
+    uint8_t wide = (rex & kRexW) ? 8 : (opsize16 ? 2 : 4);
+
+    bool two_byte = false;
+    uint8_t op = p[i++];
+    if (op == kOpTwoByte) {
+        if (i >= n) return false;
+        op = p[i++];
+        two_byte = true;
+    }
+
+    uint8_t modrm = 0;
+    uint32_t end = SkipMemOperand(p, n, i, &modrm);
+    if (!end) return false;
+    uint8_t reg = static_cast<uint8_t>(((rex & kRexR) << 1) | ((modrm >> 3) & 7));
+
+    MmioMove m{};
+    m.reg = reg;
+    if (two_byte) {
+        if ((op != kOpMovzx8 && op != kOpMovzx16) || opsize16) return false;
+        m.write = false;
+        m.size = op == kOpMovzx8 ? 1 : 2;
+    } else {
+        switch (op) {
+        case kOpMovStore:
+            m.write = true;
+            m.size = wide;
+            break;
+        case kOpMovStore8:
+            // Without REX, registers 4-7 are AH/CH/DH/BH.
+            if (!rex && reg >= 4) return false;
+            m.write = true;
+            m.size = 1;
+            break;
+        case kOpMovLoad:
+            if (opsize16) return false;
+            m.write = false;
+            m.size = wide;
+            break;
+        case kOpMovImm8:
+        case kOpMovImm: {
+            if ((modrm >> 3) & 7) return false;
+            uint32_t imm_len = op == kOpMovImm8 ? 1 : (opsize16 ? 2 : 4);
+            if (end + imm_len > n) return false;
+            uint64_t imm = 0;
+            memcpy(&imm, p + end, imm_len);
+            if (op == kOpMovImm && wide == 8) {
+                imm = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(imm)));
+            }
+            end += imm_len;
+            m.write = true;
+            m.size = op == kOpMovImm8 ? 1 : wide;
+            m.has_imm = true;
+            m.imm = imm;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    m.length = static_cast<uint8_t>(end);
+    *out = m;
+    return true;
+}
+
+uint64_t TruncateToSize(uint64_t value, uint8_t size) {
+    return size >= 8 ? value : value & ((1ULL << (size * 8)) - 1);
+}
+
+}  // namespace
+
 WhvpVCpu::~WhvpVCpu() {
     if (emulator_) {
         WHvEmulatorDestroyEmulator(emulator_);
@@ -13,11 +172,21 @@ WhvpVCpu::~WhvpVCpu() {
 }
 
 std::unique_ptr<WhvpVCpu> WhvpVCpu::Create(WhvpVm& vm, uint32_t vp_index,
-                                             AddressSpace* addr_space) {
+                                             AddressSpace* addr_space,
+                                             const GuestMemMap* mem) {
     auto vcpu = std::unique_ptr<WhvpVCpu>(new WhvpVCpu());
     vcpu->partition_ = vm.Handle();
     vcpu->vp_index_ = vp_index;
     vcpu->addr_space_ = addr_space;
+    vcpu->mem_ = mem;
+    vcpu->cpu_count_ = vm.CpuCount();
+    vcpu->cpuid_exits_ = vm.CpuidExits();
+    vcpu->x2apic_ = vm.X2Apic();
+    vcpu->tsc_freq_ = vm.CpuidExits() ? vm.TscFrequency() : 0;
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    vcpu->qpc_freq_ = freq.QuadPart;
 
     HRESULT hr = WHvCreateVirtualProcessor(vm.Handle(), vp_index, 0);
     if (FAILED(hr)) {
@@ -72,6 +241,149 @@ bool WhvpVCpu::GetRegisters(const WHV_REGISTER_NAME* names,
     return true;
 }
 
+namespace {
+
+// Registers a snapshot carries, in the order they are restored. APIC base
+// goes before the APIC page, which LoadState sets afterwards.
+constexpr WHV_REGISTER_NAME kStateRegisters[] = {
+    WHvX64RegisterRax, WHvX64RegisterRcx, WHvX64RegisterRdx, WHvX64RegisterRbx,
+    WHvX64RegisterRsp, WHvX64RegisterRbp, WHvX64RegisterRsi, WHvX64RegisterRdi,
+    WHvX64RegisterR8,  WHvX64RegisterR9,  WHvX64RegisterR10, WHvX64RegisterR11,
+    WHvX64RegisterR12, WHvX64RegisterR13, WHvX64RegisterR14, WHvX64RegisterR15,
+    WHvX64RegisterRip, WHvX64RegisterRflags,
+
+    WHvX64RegisterEs, WHvX64RegisterCs, WHvX64RegisterSs, WHvX64RegisterDs,
+    WHvX64RegisterFs, WHvX64RegisterGs, WHvX64RegisterLdtr, WHvX64RegisterTr,
+    WHvX64RegisterIdtr, WHvX64RegisterGdtr,
+
+    WHvX64RegisterCr0, WHvX64RegisterCr2, WHvX64RegisterCr3, WHvX64RegisterCr4,
+    WHvX64RegisterCr8,
+    WHvX64RegisterDr0, WHvX64RegisterDr1, WHvX64RegisterDr2, WHvX64RegisterDr3,
+    WHvX64RegisterDr6, WHvX64RegisterDr7,
+    WHvX64RegisterXCr0,
+
+    WHvX64RegisterEfer, WHvX64RegisterKernelGsBase, WHvX64RegisterApicBase,
+    WHvX64RegisterPat, WHvX64RegisterSysenterCs, WHvX64RegisterSysenterEip,
+    WHvX64RegisterSysenterEsp, WHvX64RegisterStar, WHvX64RegisterLstar,
+    WHvX64RegisterCstar, WHvX64RegisterSfmask, WHvX64RegisterTscAux,
+    WHvX64RegisterTsc,
+
+    WHvRegisterPendingInterruption, WHvRegisterInterruptState,
+    WHvX64RegisterPendingEvent,
+};
+
+constexpr uint32_t kNumStateRegisters =
+    sizeof(kStateRegisters) / sizeof(kStateRegisters[0]);
+// Where the TSC is among them.
+constexpr uint32_t kTscStateIndex = [] {
+    uint32_t i = 0;
+    while (kStateRegisters[i] != WHvX64RegisterTsc) i++;
+    return i;
+}();
+
+// Local APIC register page, as WHvGetVirtualProcessorInterruptControllerState2
+// returns it.
+constexpr uint32_t kLapicStateSize = 4096;
+
+} // namespace
+
+bool WhvpVCpu::SaveState(StateWriter& out) {
+    WHV_REGISTER_VALUE values[kNumStateRegisters] = {};
+    if (!GetRegisters(kStateRegisters, values, kNumStateRegisters)) return false;
+    out.Put(kNumStateRegisters);
+    out.PutBytes(values, sizeof(values));
+
+    // FP and vector state; its size depends on the features XCR0 enables.
+    UINT32 size = 0;
+    HRESULT hr = WHvGetVirtualProcessorXsaveState(partition_, vp_index_, nullptr, 0, &size);
+    std::vector<uint8_t> xsave(size);
+    if (size) {
+        hr = WHvGetVirtualProcessorXsaveState(partition_, vp_index_, xsave.data(), size, &size);
+    }
+    if (FAILED(hr)) {
+        LOG_ERROR("WHvGetVirtualProcessorXsaveState failed: 0x%08lX", hr);
+        return false;
+    }
+    out.PutVector(xsave);
+
+    std::vector<uint8_t> lapic(kLapicStateSize);
+    UINT32 written = 0;
+    hr = WHvGetVirtualProcessorInterruptControllerState2(
+        partition_, vp_index_, lapic.data(), kLapicStateSize, &written);
+    if (FAILED(hr)) {
+        LOG_ERROR("WHvGetVirtualProcessorInterruptControllerState2 failed: 0x%08lX", hr);
+        return false;
+    }
+    lapic.resize(written);
+    out.PutVector(lapic);
+    out.Put(kvm_system_time_);
+    // The TSC among the registers above, and kvmclock's reading at it.
+    uint64_t tsc = values[kTscStateIndex].Reg64;
+    out.Put(tsc);
+    out.Put(PvClockNs(tsc));
+    return true;
+}
+
+bool WhvpVCpu::LoadState(StateReader& in) {
+    uint32_t count = 0;
+    WHV_REGISTER_VALUE values[kNumStateRegisters] = {};
+    std::vector<uint8_t> xsave, lapic;
+    in.Get(&count);
+    if (count != kNumStateRegisters) return false;
+    in.GetBytes(values, sizeof(values));
+    in.GetVector(&xsave);
+    in.GetVector(&lapic);
+    in.Get(&kvm_system_time_);
+    uint64_t saved_tsc = 0, saved_ns = 0;
+    in.Get(&saved_tsc);
+    in.Get(&saved_ns);
+    if (!in.ok()) return false;
+
+    if (!SetRegisters(kStateRegisters, values, kNumStateRegisters)) return false;
+    HRESULT hr = WHvSetVirtualProcessorXsaveState(
+        partition_, vp_index_, xsave.data(), static_cast<UINT32>(xsave.size()));
+    if (FAILED(hr)) {
+        LOG_ERROR("WHvSetVirtualProcessorXsaveState failed: 0x%08lX", hr);
+        return false;
+    }
+    hr = WHvSetVirtualProcessorInterruptControllerState2(
+        partition_, vp_index_, lapic.data(), static_cast<UINT32>(lapic.size()));
+    if (FAILED(hr)) {
+        LOG_ERROR("WHvSetVirtualProcessorInterruptControllerState2 failed: 0x%08lX", hr);
+        return false;
+    }
+    // The page is in the restored RAM; rewrite it for this host's TSC rate,
+    // counting on from where the clock stood when saved so it never jumps,
+    // whatever the rate of the host it was saved on.
+    pvclock_tsc_ = saved_tsc;
+    pvclock_ns_ = saved_ns;
+    if (tsc_freq_ && (kvm_system_time_ & 1)) WritePvClock(kvm_system_time_ & ~1ULL);
+    return true;
+}
+
+void ExitCounter::Record(uint64_t ns) {
+    count++;
+    total_ns += ns;
+    if (ns > max_ns) max_ns = ns;
+    size_t bucket = static_cast<size_t>(std::bit_width(ns >> 8));
+    histogram[std::min(bucket, kBuckets - 1)]++;
+}
+
+const char* ExitKindName(ExitKind kind) {
+    switch (kind) {
+    case ExitKind::kIoPort:       return "io-port";
+    case ExitKind::kMmioFast:     return "mmio-fast";
+    case ExitKind::kMmioEmulated: return "mmio-emulated";
+    case ExitKind::kIoEvent:      return "ioevent";
+    case ExitKind::kHalt:         return "halt";
+    case ExitKind::kCpuid:        return "cpuid";
+    case ExitKind::kMsr:          return "msr";
+    case ExitKind::kCanceled:     return "canceled";
+    case ExitKind::kRamCommit:    return "ram-commit";
+    default:                      return "other";
+    }
+}
+
 VCpuExitAction WhvpVCpu::RunOnce() {
     WHV_RUN_VP_EXIT_CONTEXT exit_ctx{};
     HRESULT hr = WHvRunVirtualProcessor(
@@ -81,14 +393,65 @@ VCpuExitAction WhvpVCpu::RunOnce() {
         return VCpuExitAction::kError;
     }
 
+    int64_t start = QpcNow();
+    ExitKind kind = ExitKind::kOther;
+    exit_mmio_base_ = kNoMmioBase;
+    VCpuExitAction action = DispatchExit(exit_ctx, &kind);
+
+    uint64_t ns = static_cast<uint64_t>(QpcNow() - start) * 1000000000ULL /
+                  static_cast<uint64_t>(qpc_freq_);
+    if (etw::VmmEnabled(etw::kKeywordVcpu)) {
+        etw::VcpuExit(vp_index_, exit_ctx.ExitReason, ExitKindName(kind),
+                      exit_ctx.VpContext.Rip, ns);
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    exit_stats_.by_kind[static_cast<size_t>(kind)].Record(ns);
+    if (exit_ctx.ExitReason == WHvRunVpExitReasonX64IoPortAccess) {
+        exit_stats_.by_port[exit_ctx.IoPortAccess.PortNumber].Record(ns);
+    } else if (exit_mmio_base_ != kNoMmioBase) {
+        exit_stats_.by_mmio[exit_mmio_base_].Record(ns);
+    } else if (exit_ctx.ExitReason == WHvRunVpExitReasonX64MsrAccess) {
+        exit_stats_.by_msr[exit_ctx.MsrAccess.MsrNumber].Record(ns);
+    }
+    return action;
+}
+
+ExitStats WhvpVCpu::GetExitStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return exit_stats_;
+}
+
+uint64_t WhvpVCpu::ExitCount() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    uint64_t count = 0;
+    for (const auto& c : exit_stats_.by_kind) count += c.count;
+    return count;
+}
+
+VCpuExitAction WhvpVCpu::DispatchExit(const WHV_RUN_VP_EXIT_CONTEXT& exit_ctx,
+                                      ExitKind* kind) {
     switch (exit_ctx.ExitReason) {
     case WHvRunVpExitReasonX64IoPortAccess:
+        *kind = ExitKind::kIoPort;
         return HandleIoPort(exit_ctx.VpContext, exit_ctx.IoPortAccess);
 
     case WHvRunVpExitReasonMemoryAccess:
-        return HandleMmio(exit_ctx.VpContext, exit_ctx.MemoryAccess);
+        switch (addr_space_->HandleRamFault(exit_ctx.MemoryAccess.Gpa)) {
+        case RamFault::kCommitted:
+            *kind = ExitKind::kRamCommit;
+            return VCpuExitAction::kContinue;
+        case RamFault::kFailed:
+            LOG_ERROR("vCPU %u: no host memory for GPA 0x%llX",
+                      vp_index_, exit_ctx.MemoryAccess.Gpa);
+            return VCpuExitAction::kError;
+        case RamFault::kNotRam:
+            break;
+        }
+        return HandleMmio(exit_ctx.VpContext, exit_ctx.MemoryAccess, kind);
 
     case WHvRunVpExitReasonX64Halt: {
+        *kind = ExitKind::kHalt;
         WHV_REGISTER_NAME rfl_name = WHvX64RegisterRflags;
         WHV_REGISTER_VALUE rfl_val{};
         GetRegisters(&rfl_name, &rfl_val, 1);
@@ -100,6 +463,7 @@ VCpuExitAction WhvpVCpu::RunOnce() {
     }
 
     case WHvRunVpExitReasonCanceled:
+        *kind = ExitKind::kCanceled;
         return VCpuExitAction::kContinue;
 
     case WHvRunVpExitReasonX64ApicEoi:
@@ -124,54 +488,259 @@ VCpuExitAction WhvpVCpu::RunOnce() {
                   exit_ctx.VpContext.Rip);
         return VCpuExitAction::kError;
 
-    case WHvRunVpExitReasonX64Cpuid: {
-        auto& cpuid = exit_ctx.CpuidAccess;
-        WHV_REGISTER_NAME names[] = {
-            WHvX64RegisterRax, WHvX64RegisterRbx,
-            WHvX64RegisterRcx, WHvX64RegisterRdx,
-            WHvX64RegisterRip,
-        };
-        WHV_REGISTER_VALUE vals[5]{};
-        vals[0].Reg64 = cpuid.DefaultResultRax;
-        vals[1].Reg64 = cpuid.DefaultResultRbx;
-        vals[2].Reg64 = cpuid.DefaultResultRcx;
-        vals[3].Reg64 = cpuid.DefaultResultRdx;
-        vals[4].Reg64 = exit_ctx.VpContext.Rip +
-                         exit_ctx.VpContext.InstructionLength;
-        SetRegisters(names, vals, 5);
-        return VCpuExitAction::kContinue;
+    case WHvRunVpExitReasonX64Cpuid:
+        *kind = ExitKind::kCpuid;
+        return HandleCpuid(exit_ctx);
+
+    case WHvRunVpExitReasonX64MsrAccess:
+        *kind = ExitKind::kMsr;
+        return HandleMsr(exit_ctx);
+
+    default:
+        LOG_WARN("Unhandled VM exit reason: 0x%X at RIP=0x%llX",
+                 exit_ctx.ExitReason, exit_ctx.VpContext.Rip);
+        return VCpuExitAction::kError;
+    }
+}
+
+VCpuExitAction WhvpVCpu::HandleCpuid(const WHV_RUN_VP_EXIT_CONTEXT& exit_ctx) {
+    auto& cpuid = exit_ctx.CpuidAccess;
+    CpuidResult r{
+        static_cast<uint32_t>(cpuid.DefaultResultRax),
+        static_cast<uint32_t>(cpuid.DefaultResultRbx),
+        static_cast<uint32_t>(cpuid.DefaultResultRcx),
+        static_cast<uint32_t>(cpuid.DefaultResultRdx),
+    };
+    if (cpuid_exits_) {
+        GuestCpuid(static_cast<uint32_t>(cpuid.Rax), static_cast<uint32_t>(cpuid.Rcx),
+                   vp_index_, cpu_count_, tsc_freq_ != 0, x2apic_, &r);
+    }
+    WHV_REGISTER_NAME names[] = {
+        WHvX64RegisterRax, WHvX64RegisterRbx,
+        WHvX64RegisterRcx, WHvX64RegisterRdx,
+        WHvX64RegisterRip,
+    };
+    WHV_REGISTER_VALUE vals[5]{};
+    vals[0].Reg64 = r.eax;
+    vals[1].Reg64 = r.ebx;
+    vals[2].Reg64 = r.ecx;
+    vals[3].Reg64 = r.edx;
+    vals[4].Reg64 = exit_ctx.VpContext.Rip +
+                     exit_ctx.VpContext.InstructionLength;
+    SetRegisters(names, vals, 5);
+    return VCpuExitAction::kContinue;
+}
+
+namespace {
+
+// MSRs Linux reads during boot or polls afterwards that the hypervisor
+// leaves to us. The values are what a VM without the feature shows.
+constexpr uint32_t kMsrSmiCount          = 0x34;   // SMIs since reset
+constexpr uint32_t kMsrFeatureControl    = 0x3A;   // locked, VMX off
+constexpr uint32_t kMsrBiosSignId        = 0x8B;   // microcode revision
+constexpr uint32_t kMsrPlatformInfo      = 0xCE;
+constexpr uint32_t kMsrArchCapabilities  = 0x10A;
+constexpr uint32_t kMsrMiscFeaturesEnables = 0x140;  // CPUID faulting
+constexpr uint32_t kMsrMcgCap            = 0x179;  // no machine check banks
+constexpr uint32_t kMsrMcgStatus         = 0x17A;
+constexpr uint32_t kMsrPerfStatus        = 0x198;
+constexpr uint32_t kMsrThermStatus       = 0x19C;
+constexpr uint32_t kMsrEnergyPerfBias    = 0x1B0;
+constexpr uint32_t kMsrPkgThermStatus    = 0x1B1;
+
+constexpr uint64_t kFeatureControlLocked = 1;
+
+}  // namespace
+
+const WhvpVCpu::MsrHandler WhvpVCpu::kMsrHandlers[] = {
+    {kMsrSmiCount,            &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrFeatureControl,      &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrBiosSignId,          &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrPlatformInfo,        &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrArchCapabilities,    &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrMiscFeaturesEnables, &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrMcgCap,              &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrMcgStatus,           &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrPerfStatus,          &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrThermStatus,         &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrEnergyPerfBias,      &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrPkgThermStatus,      &WhvpVCpu::ReadMsrConstant, nullptr},
+    {kMsrKvmWallClock,        &WhvpVCpu::ReadMsrConstant, &WhvpVCpu::WriteKvmWallClock},
+    {kMsrKvmSystemTime,       &WhvpVCpu::ReadKvmSystemTime, &WhvpVCpu::WriteKvmSystemTime},
+};
+
+const WhvpVCpu::MsrHandler* WhvpVCpu::FindMsrHandler(uint32_t msr) {
+    for (const auto& h : kMsrHandlers) {
+        if (h.msr == msr) return &h;
     }
+    return nullptr;
+}
+
+bool WhvpVCpu::ReadMsrConstant(uint32_t msr, uint64_t* value) {
+    *value = msr == kMsrFeatureControl ? kFeatureControlLocked : 0;
+    return true;
+}
+
+bool WhvpVCpu::ReadKvmSystemTime(uint32_t, uint64_t* value) {
+    if (!tsc_freq_) return false;
+    *value = kvm_system_time_;
+    return true;
+}
 
-    case WHvRunVpExitReasonX64MsrAccess: {
-        auto& msr = exit_ctx.MsrAccess;
+bool WhvpVCpu::WriteKvmSystemTime(uint32_t, uint64_t value) {
+    if (!tsc_freq_) return false;
+    // Bit 0 enables the page; it is only written here, so time reads
+    // never exit.
+    kvm_system_time_ = value;
+    if (value & 1) WritePvClock(value & ~1ULL);
+    return true;
+}
+
+bool WhvpVCpu::WriteKvmWallClock(uint32_t, uint64_t value) {
+    if (!tsc_freq_) return false;
+    WriteWallClock(value);
+    return true;
+}
+
+VCpuExitAction WhvpVCpu::HandleMsr(const WHV_RUN_VP_EXIT_CONTEXT& exit_ctx) {
+    auto& msr = exit_ctx.MsrAccess;
+    const MsrHandler* handler = FindMsrHandler(msr.MsrNumber);
+    uint64_t next_rip = exit_ctx.VpContext.Rip +
+                        exit_ctx.VpContext.InstructionLength;
+
+    // Completed with one register set either way.
+    if (!msr.AccessInfo.IsWrite) {
+        uint64_t value = 0;
+        if (!handler || !(this->*handler->read)(msr.MsrNumber, &value)) {
+            value = 0;
+            LOG_DEBUG("MSR read: 0x%X unhandled, reads as 0", msr.MsrNumber);
+        }
+        WHV_REGISTER_NAME names[] = {
+            WHvX64RegisterRax, WHvX64RegisterRdx, WHvX64RegisterRip
+        };
+        WHV_REGISTER_VALUE vals[3]{};
+        vals[0].Reg64 = value & 0xFFFFFFFF;
+        vals[1].Reg64 = value >> 32;
+        vals[2].Reg64 = next_rip;
+        SetRegisters(names, vals, 3);
+    } else {
+        uint64_t value = (msr.Rdx << 32) | (msr.Rax & 0xFFFFFFFF);
+        if (!handler || !handler->write ||
+            !(this->*handler->write)(msr.MsrNumber, value)) {
+            LOG_DEBUG("MSR write: 0x%X = 0x%llX ignored", msr.MsrNumber, value);
+        }
         WHV_REGISTER_NAME rip_name = WHvX64RegisterRip;
         WHV_REGISTER_VALUE rip_val{};
-        rip_val.Reg64 = exit_ctx.VpContext.Rip +
-                        exit_ctx.VpContext.InstructionLength;
+        rip_val.Reg64 = next_rip;
+        SetRegisters(&rip_name, &rip_val, 1);
+    }
+    return VCpuExitAction::kContinue;
+}
 
-        if (!msr.AccessInfo.IsWrite) {
-            WHV_REGISTER_NAME names[] = {
-                WHvX64RegisterRax, WHvX64RegisterRdx, WHvX64RegisterRip
-            };
-            WHV_REGISTER_VALUE vals[3]{};
-            vals[0].Reg64 = 0;
-            vals[1].Reg64 = 0;
-            vals[2] = rip_val;
-            SetRegisters(names, vals, 3);
-            LOG_DEBUG("MSR read: 0x%X -> 0", msr.MsrNumber);
+namespace {
+
+#pragma pack(push, 1)
+struct PvClockTimeInfo {
+    uint32_t version;
+    uint32_t pad0;
+    uint64_t tsc_timestamp;
+    uint64_t system_time;
+    uint32_t tsc_to_system_mul;
+    int8_t tsc_shift;
+    uint8_t flags;
+    uint8_t pad[2];
+};
+
+struct PvClockWallClock {
+    uint32_t version;
+    uint32_t sec;
+    uint32_t nsec;
+};
+#pragma pack(pop)
+
+constexpr uint8_t kPvClockTscStable = 1 << 0;
+
+// ns = ((tsc << shift, or >> -shift) * mul) >> 32, as KVM computes it.
+void TscToNsScale(uint64_t tsc_hz, uint32_t* mul, int8_t* shift) {
+    uint64_t scaled = 1000000000ULL;
+    uint64_t tps64 = tsc_hz;
+    int s = 0;
+    while (tps64 > scaled * 2 || (tps64 >> 32)) {
+        tps64 >>= 1;
+        s--;
+    }
+    uint32_t tps32 = static_cast<uint32_t>(tps64);
+    while (tps32 <= scaled || (scaled >> 32)) {
+        if ((scaled >> 32) || (tps32 & 0x80000000)) {
+            scaled >>= 1;
         } else {
-            LOG_DEBUG("MSR write: 0x%X = 0x%llX", msr.MsrNumber,
-                      (msr.Rdx << 32) | (msr.Rax & 0xFFFFFFFF));
-            SetRegisters(&rip_name, &rip_val, 1);
+            tps32 <<= 1;
         }
-        return VCpuExitAction::kContinue;
+        s++;
     }
+    *mul = static_cast<uint32_t>((scaled << 32) / tps32);
+    *shift = static_cast<int8_t>(s);
+}
 
-    default:
-        LOG_WARN("Unhandled VM exit reason: 0x%X at RIP=0x%llX",
-                 exit_ctx.ExitReason, exit_ctx.VpContext.Rip);
-        return VCpuExitAction::kError;
+} // namespace
+
+void WhvpVCpu::WritePvClock(uint64_t gpa) {
+    uint8_t* hva = mem_ ? mem_->GpaToHva(gpa) : nullptr;
+    if (!hva || !mem_->GpaToHva(gpa + sizeof(PvClockTimeInfo) - 1)) {
+        LOG_WARN("vCPU %u: kvmclock page 0x%llX is not RAM", vp_index_, gpa);
+        return;
+    }
+    // A frequency conversion from the baseline, which changes only when the
+    // VM resumes, so the page never needs refreshing while it runs.
+    if (mem_->dirty) mem_->dirty->MarkGpa(gpa, sizeof(PvClockTimeInfo));
+    auto* info = reinterpret_cast<volatile PvClockTimeInfo*>(hva);
+    uint32_t mul = 0;
+    int8_t shift = 0;
+    TscToNsScale(tsc_freq_, &mul, &shift);
+    uint32_t version = (info->version | 1) + 1;
+    info->version = version - 1;  // odd: update in progress
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    info->tsc_timestamp = pvclock_tsc_;
+    info->system_time = pvclock_ns_;
+    info->tsc_to_system_mul = mul;
+    info->tsc_shift = shift;
+    info->flags = kPvClockTscStable;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    info->version = version;
+}
+
+uint64_t WhvpVCpu::PvClockNs(uint64_t tsc) const {
+    if (!tsc_freq_ || tsc < pvclock_tsc_) return pvclock_ns_;
+    uint64_t delta = tsc - pvclock_tsc_;
+    return pvclock_ns_ + delta / tsc_freq_ * 1000000000ULL +
+           delta % tsc_freq_ * 1000000000ULL / tsc_freq_;
+}
+
+void WhvpVCpu::WriteWallClock(uint64_t gpa) {
+    uint8_t* hva = mem_ ? mem_->GpaToHva(gpa) : nullptr;
+    if (!hva || !mem_->GpaToHva(gpa + sizeof(PvClockWallClock) - 1)) {
+        LOG_WARN("vCPU %u: kvmclock wall clock 0x%llX is not RAM", vp_index_, gpa);
+        return;
     }
+    // Wall time at kvmclock zero; the guest adds kvmclock to it.
+    WHV_REGISTER_NAME tsc_name = WHvX64RegisterTsc;
+    WHV_REGISTER_VALUE tsc_val{};
+    if (!GetRegisters(&tsc_name, &tsc_val, 1)) return;
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    uint64_t now_100ns = ((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) -
+                         116444736000000000ULL;  // 1601 -> 1970
+    uint64_t boot_100ns = now_100ns - PvClockNs(tsc_val.Reg64) / 100;
+
+    if (mem_->dirty) mem_->dirty->MarkGpa(gpa, sizeof(PvClockWallClock));
+    auto* wc = reinterpret_cast<volatile PvClockWallClock*>(hva);
+    uint32_t version = (wc->version | 1) + 1;
+    wc->version = version - 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wc->sec = static_cast<uint32_t>(boot_100ns / 10000000ULL);
+    wc->nsec = static_cast<uint32_t>(boot_100ns % 10000000ULL * 100);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wc->version = version;
 }
 
 VCpuExitAction WhvpVCpu::HandleIoPort(
@@ -195,8 +764,16 @@ VCpuExitAction WhvpVCpu::HandleIoPort(
 
 VCpuExitAction WhvpVCpu::HandleMmio(
     const WHV_VP_EXIT_CONTEXT& vp_ctx,
-    const WHV_MEMORY_ACCESS_CONTEXT& mem) {
+    const WHV_MEMORY_ACCESS_CONTEXT& mem, ExitKind* kind) {
+
+    MmioMove mv;
+    bool is_write = mem.AccessInfo.AccessType == WHvMemoryAccessWrite;
+    if (vp_ctx.Cs.Long && DecodeMmioMove(mem, &mv) && mv.write == is_write &&
+        CompleteMmioMove(vp_ctx, mem, mv, kind)) {
+        return VCpuExitAction::kContinue;
+    }
 
+    *kind = ExitKind::kMmioEmulated;
     WHV_EMULATOR_STATUS status{};
     HRESULT hr = WHvEmulatorTryMmioEmulation(
         emulator_, this, &vp_ctx, &mem, &status);
@@ -212,6 +789,59 @@ VCpuExitAction WhvpVCpu::HandleMmio(
     return VCpuExitAction::kContinue;
 }
 
+bool WhvpVCpu::CompleteMmioMove(const WHV_VP_EXIT_CONTEXT& vp_ctx,
+                                const WHV_MEMORY_ACCESS_CONTEXT& mem,
+                                const MmioMove& mv, ExitKind* kind) {
+    WHV_REGISTER_NAME names[2] = {kGprNames[mv.reg], WHvX64RegisterRip};
+    WHV_REGISTER_VALUE vals[2]{};
+    vals[1].Reg64 = vp_ctx.Rip + mv.length;
+
+    if (mv.write) {
+        uint64_t value = mv.imm;
+        if (!mv.has_imm) {
+            if (FAILED(WHvGetVirtualProcessorRegisters(
+                    partition_, vp_index_, &names[0], 1, &vals[0]))) {
+                return false;
+            }
+            value = vals[0].Reg64;
+        }
+        value = TruncateToSize(value, mv.size);
+
+        // Retire the instruction before the write lands so a failure can
+        // still fall back to the emulator without repeating the access.
+        if (FAILED(WHvSetVirtualProcessorRegisters(
+                partition_, vp_index_, &names[1], 1, &vals[1]))) {
+            return false;
+        }
+
+        // virtio-pci doorbells are 16-bit, virtio-mmio ones 32-bit.
+        IoEventSink* sink = mv.size == 2 || mv.size == 4
+            ? addr_space_->FindIoEvent(mem.Gpa) : nullptr;
+        if (sink) {
+            sink->SignalIoEvent(value);
+            addr_space_->FindMmioRegion(mem.Gpa, &exit_mmio_base_);
+            *kind = ExitKind::kIoEvent;
+        } else {
+            addr_space_->HandleMmioWrite(mem.Gpa, mv.size, value, &exit_mmio_base_);
+            *kind = ExitKind::kMmioFast;
+        }
+        return true;
+    }
+
+    // Loads write the whole register: 32-bit moves and movzx zero-extend.
+    uint64_t value = 0;
+    addr_space_->HandleMmioRead(mem.Gpa, mv.size, &value, &exit_mmio_base_);
+    vals[0].Reg64 = TruncateToSize(value, mv.size);
+    HRESULT hr = WHvSetVirtualProcessorRegisters(
+        partition_, vp_index_, names, 2, vals);
+    if (FAILED(hr)) {
+        LOG_WARN("MMIO fast load: register set failed (0x%08lX)", hr);
+        return false;
+    }
+    *kind = ExitKind::kMmioFast;
+    return true;
+}
+
 // --- Emulator Callbacks ---
 
 HRESULT CALLBACK WhvpVCpu::OnIoPort(
@@ -234,13 +864,13 @@ HRESULT CALLBACK WhvpVCpu::OnMemory(
     if (mem->Direction == 0) {
         uint64_t val = 0;
         vcpu->addr_space_->HandleMmioRead(
-            mem->GpaAddress, mem->AccessSize, &val);
+            mem->GpaAddress, mem->AccessSize, &val, &vcpu->exit_mmio_base_);
         memcpy(mem->Data, &val, mem->AccessSize);
     } else {
         uint64_t val = 0;
         memcpy(&val, mem->Data, mem->AccessSize);
         vcpu->addr_space_->HandleMmioWrite(
-            mem->GpaAddress, mem->AccessSize, val);
+            mem->GpaAddress, mem->AccessSize, val, &vcpu->exit_mmio_base_);
     }
     return S_OK;
 }
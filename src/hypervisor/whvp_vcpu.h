@@ -2,6 +2,9 @@
 
 #include "hypervisor/whvp_vm.h"
 #include "core/vmm/address_space.h"
+#include "core/vmm/snapshot.h"
+#include <map>
+#include <mutex>
 
 namespace whvp {
 
@@ -12,12 +15,53 @@ enum class VCpuExitAction {
     kError,
 };
 
+// How an exit was handled, for the per-vCPU counters.
+enum class ExitKind : uint8_t {
+    kIoPort,
+    kMmioFast,       // decoded mov, no emulator round trip
+    kMmioEmulated,
+    kIoEvent,        // doorbell handed to an IoEventSink
+    kHalt,
+    kCpuid,
+    kMsr,
+    kCanceled,
+    kRamCommit,      // first guest touch of lazily committed RAM
+    kOther,
+    kCount,
+};
+
+const char* ExitKindName(ExitKind kind);
+
+struct ExitCounter {
+    // Bucket 0 holds exits under 256 ns, each later bucket doubles the
+    // bound, and the last one is open-ended (>= 4 ms).
+    static constexpr size_t kBuckets = 16;
+
+    uint64_t count = 0;
+    uint64_t total_ns = 0;   // host time spent handling the exits
+    uint64_t max_ns = 0;
+    uint64_t histogram[kBuckets] = {};
+
+    void Record(uint64_t ns);
+};
+
+struct ExitStats {
+    ExitCounter by_kind[static_cast<size_t>(ExitKind::kCount)];
+    std::map<uint16_t, ExitCounter> by_port;
+    std::map<uint64_t, ExitCounter> by_mmio;   // keyed by device base GPA
+    std::map<uint32_t, ExitCounter> by_msr;    // keyed by MSR number
+};
+
+struct MmioMove;
+
 class WhvpVCpu {
 public:
     ~WhvpVCpu();
 
+    // `mem` is where kvmclock pages are written.
     static std::unique_ptr<WhvpVCpu> Create(WhvpVm& vm, uint32_t vp_index,
-                                             AddressSpace* addr_space);
+                                             AddressSpace* addr_space,
+                                             const GuestMemMap* mem);
 
     VCpuExitAction RunOnce();
 
@@ -26,6 +70,16 @@ public:
     bool GetRegisters(const WHV_REGISTER_NAME* names,
                       WHV_REGISTER_VALUE* values, uint32_t count);
 
+    // Architectural state: registers, MSRs, pending events, XSAVE area and
+    // the local APIC. Only while the vCPU is not running.
+    bool SaveState(StateWriter& out);
+    bool LoadState(StateReader& in);
+
+    // Snapshot of the counters RunOnce() keeps; callable from any thread.
+    ExitStats GetExitStats() const;
+    // All exits so far, without copying the breakdowns.
+    uint64_t ExitCount() const;
+
     WHV_PARTITION_HANDLE Partition() const { return partition_; }
     uint32_t VpIndex() const { return vp_index_; }
 
@@ -39,8 +93,37 @@ private:
 
     VCpuExitAction HandleIoPort(const WHV_VP_EXIT_CONTEXT& vp_ctx,
                                  const WHV_X64_IO_PORT_ACCESS_CONTEXT& io);
+    VCpuExitAction DispatchExit(const WHV_RUN_VP_EXIT_CONTEXT& exit_ctx,
+                                ExitKind* kind);
+    VCpuExitAction HandleCpuid(const WHV_RUN_VP_EXIT_CONTEXT& exit_ctx);
+    VCpuExitAction HandleMsr(const WHV_RUN_VP_EXIT_CONTEXT& exit_ctx);
+
+    // MSRs the partition exits on that get more than read-as-zero,
+    // write-ignored. A handler returns false to fall back to that.
+    struct MsrHandler {
+        uint32_t msr;
+        bool (WhvpVCpu::*read)(uint32_t msr, uint64_t* value);
+        bool (WhvpVCpu::*write)(uint32_t msr, uint64_t value);  // null = ignored
+    };
+    static const MsrHandler kMsrHandlers[];
+    static const MsrHandler* FindMsrHandler(uint32_t msr);
+    bool ReadMsrConstant(uint32_t msr, uint64_t* value);
+    bool ReadKvmSystemTime(uint32_t msr, uint64_t* value);
+    bool WriteKvmSystemTime(uint32_t msr, uint64_t value);
+    bool WriteKvmWallClock(uint32_t msr, uint64_t value);
+    // kvmclock: the per-vCPU time page at `gpa`, and the boot wall clock.
+    void WritePvClock(uint64_t gpa);
+    // kvmclock nanoseconds at guest TSC `tsc`, from the baseline below.
+    uint64_t PvClockNs(uint64_t tsc) const;
+    void WriteWallClock(uint64_t gpa);
     VCpuExitAction HandleMmio(const WHV_VP_EXIT_CONTEXT& vp_ctx,
-                               const WHV_MEMORY_ACCESS_CONTEXT& mem);
+                               const WHV_MEMORY_ACCESS_CONTEXT& mem,
+                               ExitKind* kind);
+    // Completes a decoded mov with one register get or set. Returns false
+    // to leave the access to the emulator.
+    bool CompleteMmioMove(const WHV_VP_EXIT_CONTEXT& vp_ctx,
+                          const WHV_MEMORY_ACCESS_CONTEXT& mem,
+                          const MmioMove& mv, ExitKind* kind);
 
     static HRESULT CALLBACK OnIoPort(
         VOID* ctx, WHV_EMULATOR_IO_ACCESS_INFO* io);
@@ -61,7 +144,26 @@ private:
     WHV_PARTITION_HANDLE partition_ = nullptr;
     uint32_t vp_index_ = 0;
     AddressSpace* addr_space_ = nullptr;
+    const GuestMemMap* mem_ = nullptr;
+    uint32_t cpu_count_ = 1;
+    bool cpuid_exits_ = false;
+    bool x2apic_ = false;
+    uint64_t tsc_freq_ = 0;           // 0 = kvmclock not offered
+    uint64_t kvm_system_time_ = 0;    // last MSR_KVM_SYSTEM_TIME_NEW write
+    // kvmclock reads pvclock_ns_ at guest TSC pvclock_tsc_. Both start at
+    // zero with the partition and move on only when a VM resumes, where
+    // the clock picks up from what it read when it was saved.
+    uint64_t pvclock_tsc_ = 0;
+    uint64_t pvclock_ns_ = 0;
     WHV_EMULATOR_HANDLE emulator_ = nullptr;
+    int64_t qpc_freq_ = 1;
+    // Device the current exit's MMIO access went to, found by the access
+    // itself so the exit counters need no lookup of their own.
+    static constexpr uint64_t kNoMmioBase = ~0ULL;
+    uint64_t exit_mmio_base_ = kNoMmioBase;
+    // Uncontended except while a snapshot is taken.
+    mutable std::mutex stats_mutex_;
+    ExitStats exit_stats_;
 };
 
 } // namespace whvp
@@ -1,4 +1,5 @@
 #include "hypervisor/whvp_vm.h"
+#include "hypervisor/whvp_cpuid.h"
 #include <intrin.h>
 
 namespace whvp {
@@ -10,8 +11,9 @@ WhvpVm::~WhvpVm() {
     }
 }
 
-std::unique_ptr<WhvpVm> WhvpVm::Create(uint32_t cpu_count) {
+std::unique_ptr<WhvpVm> WhvpVm::Create(uint32_t cpu_count, bool x2apic, bool pmu) {
     auto vm = std::unique_ptr<WhvpVm>(new WhvpVm());
+    vm->cpu_count_ = cpu_count;
 
     HRESULT hr = WHvCreatePartition(&vm->partition_);
     if (FAILED(hr)) {
@@ -29,13 +31,29 @@ std::unique_ptr<WhvpVm> WhvpVm::Create(uint32_t cpu_count) {
         return nullptr;
     }
 
-    memset(&prop, 0, sizeof(prop));
-    prop.LocalApicEmulationMode = WHvX64LocalApicEmulationModeXApic;
-    hr = WHvSetPartitionProperty(vm->partition_,
-        WHvPartitionPropertyCodeLocalApicEmulationMode,
-        &prop, sizeof(prop.LocalApicEmulationMode));
-    if (FAILED(hr)) {
-        LOG_WARN("Set APIC emulation failed: 0x%08lX (non-fatal)", hr);
+    // In x2APIC mode the guest programs its timer through MSRs the
+    // hypervisor handles, TSC-deadline included, not through the APIC page.
+    if (x2apic) {
+        memset(&prop, 0, sizeof(prop));
+        prop.LocalApicEmulationMode = WHvX64LocalApicEmulationModeX2Apic;
+        hr = WHvSetPartitionProperty(vm->partition_,
+            WHvPartitionPropertyCodeLocalApicEmulationMode,
+            &prop, sizeof(prop.LocalApicEmulationMode));
+        if (SUCCEEDED(hr)) {
+            vm->x2apic_ = true;
+        } else {
+            LOG_WARN("x2APIC emulation unavailable: 0x%08lX (using xAPIC)", hr);
+        }
+    }
+    if (!vm->x2apic_) {
+        memset(&prop, 0, sizeof(prop));
+        prop.LocalApicEmulationMode = WHvX64LocalApicEmulationModeXApic;
+        hr = WHvSetPartitionProperty(vm->partition_,
+            WHvPartitionPropertyCodeLocalApicEmulationMode,
+            &prop, sizeof(prop.LocalApicEmulationMode));
+        if (FAILED(hr)) {
+            LOG_WARN("Set APIC emulation failed: 0x%08lX (non-fatal)", hr);
+        }
     }
 
     // Query WHVP clock frequencies for diagnostics.
@@ -44,6 +62,7 @@ std::unique_ptr<WhvpVm> WhvpVm::Create(uint32_t cpu_count) {
                           &proc_freq, sizeof(proc_freq), nullptr);
     if (SUCCEEDED(hr) && proc_freq) {
         LOG_INFO("WHVP ProcessorClockFrequency: %llu Hz", proc_freq);
+        vm->tsc_freq_ = proc_freq;
     }
     hr = WHvGetCapability(WHvCapabilityCodeInterruptClockFrequency,
                           &intr_freq, sizeof(intr_freq), nullptr);
@@ -51,6 +70,36 @@ std::unique_ptr<WhvpVm> WhvpVm::Create(uint32_t cpu_count) {
         LOG_INFO("WHVP InterruptClockFrequency: %llu Hz", intr_freq);
     }
 
+    WHV_CAPABILITY_FEATURES features{};
+    hr = WHvGetCapability(WHvCapabilityCodeFeatures, &features, sizeof(features), nullptr);
+    vm->dirty_tracking_ = SUCCEEDED(hr) && features.DirtyPageTracking;
+
+    // Without this the counter MSRs exit as unhandled and read as zero,
+    // and CPUID leaf 0xA reports no counters. The hypervisor switches the
+    // counters on every entry and exit, so it is off unless asked for.
+    if (pmu) {
+        WHV_PROCESSOR_PERFMON_FEATURES perfmon{};
+        hr = WHvGetCapability(WHvCapabilityCodeProcessorPerfmonFeatures,
+                              &perfmon, sizeof(perfmon), nullptr);
+        if (SUCCEEDED(hr) && perfmon.PmuSupport) {
+            memset(&prop, 0, sizeof(prop));
+            prop.ProcessorPerfmonFeatures.PmuSupport = 1;
+            prop.ProcessorPerfmonFeatures.LbrSupport = perfmon.LbrSupport;
+            hr = WHvSetPartitionProperty(vm->partition_,
+                WHvPartitionPropertyCodeProcessorPerfmonFeatures,
+                &prop, sizeof(prop.ProcessorPerfmonFeatures));
+            if (SUCCEEDED(hr)) {
+                vm->pmu_ = true;
+                LOG_INFO("Guest PMU enabled%s", perfmon.LbrSupport ? " (with LBR)" : "");
+            } else {
+                LOG_WARN("Guest PMU unavailable: 0x%08lX", hr);
+            }
+        } else {
+            LOG_WARN("Guest PMU unavailable: the hypervisor does not virtualize "
+                     "performance counters on this host");
+        }
+    }
+
     // Build CPUID override list: leaf 0x15 (TSC freq) + leaf 1 (features).
     WHV_X64_CPUID_RESULT cpuid_overrides[2]{};
     int num_overrides = 0;
@@ -72,25 +121,24 @@ std::unique_ptr<WhvpVm> WhvpVm::Create(uint32_t cpu_count) {
         o.Ecx = crystal;
         o.Edx = 0;
         uint64_t tsc_freq = static_cast<uint64_t>(crystal) * numer / denom;
+        if (!vm->tsc_freq_) vm->tsc_freq_ = tsc_freq;
         LOG_INFO("CPUID 0x15 override: crystal=%u Hz, TSC=%llu Hz",
                  crystal, tsc_freq);
     }
 
-    // Override CPUID leaf 1 to mask features WHVP doesn't support:
-    //   ECX bit  3: MONITOR/MWAIT  — causes #UD in WHVP
-    //   ECX bit 24: TSC-Deadline   — WHVP xAPIC may not fire these
+    // Override CPUID leaf 1 to match the APIC mode (see Leaf1Ecx).
     int cpuid1[4]{};
     __cpuidex(cpuid1, 1, 0);
     {
-        constexpr uint32_t kMaskOutEcx = (1u << 3) | (1u << 24);
         auto& o = cpuid_overrides[num_overrides++];
         o.Function = 1;
         o.Eax = static_cast<uint32_t>(cpuid1[0]);
         o.Ebx = static_cast<uint32_t>(cpuid1[1]);
-        o.Ecx = static_cast<uint32_t>(cpuid1[2]) & ~kMaskOutEcx;
+        o.Ecx = Leaf1Ecx(static_cast<uint32_t>(cpuid1[2]), vm->x2apic_);
         o.Edx = static_cast<uint32_t>(cpuid1[3]);
-        LOG_INFO("CPUID 1 override: ECX 0x%08X -> 0x%08X (masked MWAIT+TSC-deadline)",
-                 static_cast<uint32_t>(cpuid1[2]), o.Ecx);
+        LOG_INFO("CPUID 1 override: ECX 0x%08X -> 0x%08X (%s)",
+                 static_cast<uint32_t>(cpuid1[2]), o.Ecx,
+                 vm->x2apic_ ? "x2APIC+TSC-deadline" : "masked MWAIT+TSC-deadline");
     }
 
     if (num_overrides > 0) {
@@ -103,13 +151,47 @@ std::unique_ptr<WhvpVm> WhvpVm::Create(uint32_t cpu_count) {
         }
     }
 
+    // Topology and kvmclock leaves differ per vCPU, so those exit and are
+    // answered by the vCPU (GuestCpuid). Unknown MSRs exit too, which is
+    // where kvmclock is enabled (WhvpVCpu::kMsrHandlers); the rest read as
+    // zero.
+    memset(&prop, 0, sizeof(prop));
+    prop.ExtendedVmExits.X64CpuidExit = 1;
+    prop.ExtendedVmExits.X64MsrExit = 1;
+    hr = WHvSetPartitionProperty(vm->partition_,
+        WHvPartitionPropertyCodeExtendedVmExits,
+        &prop, sizeof(prop.ExtendedVmExits));
+    if (SUCCEEDED(hr)) {
+        std::vector<uint32_t> leaves = CpuidExitLeaves();
+        hr = WHvSetPartitionProperty(vm->partition_,
+            WHvPartitionPropertyCodeCpuidExitList,
+            leaves.data(), static_cast<UINT32>(leaves.size() * sizeof(uint32_t)));
+    }
+    if (SUCCEEDED(hr)) {
+        vm->cpuid_exits_ = true;
+        // Only MSRs the hypervisor cannot handle exit; TSC, APIC base and
+        // MISC_ENABLE stay inside it.
+        memset(&prop, 0, sizeof(prop));
+        prop.X64MsrExitBitmap.UnhandledMsrs = 1;
+        HRESULT bitmap_hr = WHvSetPartitionProperty(vm->partition_,
+            WHvPartitionPropertyCodeX64MsrExitBitmap,
+            &prop, sizeof(prop.X64MsrExitBitmap));
+        if (FAILED(bitmap_hr)) {
+            LOG_WARN("MSR exit bitmap failed: 0x%08lX (non-fatal)", bitmap_hr);
+        }
+    } else {
+        LOG_WARN("CPUID/MSR exits unavailable: 0x%08lX (no topology or kvmclock)", hr);
+    }
+
     hr = WHvSetupPartition(vm->partition_);
     if (FAILED(hr)) {
         LOG_ERROR("WHvSetupPartition failed: 0x%08lX", hr);
         return nullptr;
     }
 
-    LOG_INFO("WHVP partition created (cpus=%u)", cpu_count);
+    LOG_INFO("WHVP partition created (cpus=%u, kvmclock %s, %s, PMU %s)", cpu_count,
+             vm->cpuid_exits_ && vm->tsc_freq_ ? "on" : "off",
+             vm->x2apic_ ? "x2APIC" : "xAPIC", vm->pmu_ ? "on" : "off");
     return vm;
 }
 
@@ -133,4 +215,15 @@ bool WhvpVm::UnmapMemory(GPA gpa, uint64_t size) {
     return true;
 }
 
+bool WhvpVm::QueryDirtyBitmap(GPA gpa, uint64_t size, uint64_t* bitmap,
+                              uint32_t bitmap_bytes) {
+    HRESULT hr = WHvQueryGpaRangeDirtyBitmap(partition_, gpa, size, bitmap, bitmap_bytes);
+    if (FAILED(hr)) {
+        LOG_ERROR("WHvQueryGpaRangeDirtyBitmap(gpa=0x%llX, size=0x%llX) failed: 0x%08lX",
+                  gpa, size, hr);
+        return false;
+    }
+    return true;
+}
+
 } // namespace whvp
@@ -10,13 +10,33 @@ class WhvpVm {
 public:
     ~WhvpVm();
 
-    static std::unique_ptr<WhvpVm> Create(uint32_t cpu_count);
+    // With `x2apic`, the local APICs are emulated in x2APIC mode if the
+    // hypervisor allows it, xAPIC otherwise. With `pmu`, the guest gets the
+    // host's performance counters if the hypervisor can virtualize them.
+    static std::unique_ptr<WhvpVm> Create(uint32_t cpu_count, bool x2apic = false,
+                                          bool pmu = false);
 
     WHV_PARTITION_HANDLE Handle() const { return partition_; }
+    uint32_t CpuCount() const { return cpu_count_; }
+    // Guest TSC frequency in Hz; 0 if unknown, in which case no kvmclock.
+    uint64_t TscFrequency() const { return tsc_freq_; }
+    // CPUID exits are on, so vCPUs answer the topology and KVM leaves.
+    bool CpuidExits() const { return cpuid_exits_; }
+    // x2APIC emulation is on, so the guest sees x2APIC and TSC-deadline.
+    bool X2Apic() const { return x2apic_; }
+    // RAM can be mapped with WHvMapGpaRangeFlagTrackDirtyPages.
+    bool DirtyPageTracking() const { return dirty_tracking_; }
+    // The guest has a PMU: the counter MSRs and CPUID leaf 0xA are the
+    // hypervisor's, and counter overflow interrupts reach the guest APIC.
+    bool Pmu() const { return pmu_; }
 
     bool MapMemory(GPA gpa, void* hva, uint64_t size,
                    WHV_MAP_GPA_RANGE_FLAGS flags);
     bool UnmapMemory(GPA gpa, uint64_t size);
+    // Reads and resets the dirty bits of a range mapped with dirty
+    // tracking, one bit per page.
+    bool QueryDirtyBitmap(GPA gpa, uint64_t size, uint64_t* bitmap,
+                          uint32_t bitmap_bytes);
 
     WhvpVm(const WhvpVm&) = delete;
     WhvpVm& operator=(const WhvpVm&) = delete;
@@ -24,6 +44,12 @@ public:
 private:
     WhvpVm() = default;
     WHV_PARTITION_HANDLE partition_ = nullptr;
+    uint32_t cpu_count_ = 0;
+    uint64_t tsc_freq_ = 0;
+    bool cpuid_exits_ = false;
+    bool x2apic_ = false;
+    bool dirty_tracking_ = false;
+    bool pmu_ = false;
 };
 
 } // namespace whvp
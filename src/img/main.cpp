@@ -0,0 +1,847 @@
+// tenbox-img: converts disk images between raw and qcow2, and rewrites
+// qcow2 images compacted and recompressed.
+//
+// One thread reads the input in order, every core checks batches for zeros
+// and compresses them, and one thread appends the results to the output in
+// order. Only --window batches are in flight at a time, so memory stays
+// bounded however large the image is; the qcow2 tables the output needs
+// (8 bytes per cluster) are the only part that grows with it.
+//
+// Clusters that read as zeros are left out of the output. For a qcow2
+// input that is what compacting amounts to: clusters no table refers to,
+// discarded ones and zero-filled ones all disappear. The input is read
+// through its backing chain, so converting an overlay flattens it.
+
+#include "core/device/virtio/disk_image.h"
+#include "version.h"
+
+#include <zlib.h>
+#include <zstd.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kQcow2Magic = 0x514649FB;
+// v3 header with the compression type byte, padded to 8 bytes.
+constexpr uint32_t kHeaderLength = 112;
+constexpr uint64_t kIncompatCompressionType = 1ULL << 3;
+constexpr uint64_t kCompressedBit = 1ULL << 62;
+constexpr uint64_t kCopiedBit = 1ULL << 63;
+// Input read per batch; a batch holds at least one cluster.
+constexpr uint32_t kBatchBytes = 1 << 20;
+// Compressed clusters collected before they go out as one run.
+constexpr uint32_t kCompressedRunBytes = 4 << 20;
+
+enum class Format { kRaw, kQcow2 };
+enum class Compression { kNone, kZlib, kZstd };
+
+struct Options {
+    std::string command;
+    std::string input;
+    std::string output;
+    Format format = Format::kQcow2;
+    Compression compression = Compression::kNone;
+    bool compression_set = false;
+    int level = 0;              // 0 = the codec's default
+    uint32_t cluster_bits = 16;
+    bool cluster_bits_set = false;
+    uint32_t threads = 0;       // 0 = one per core
+    uint32_t window = 0;        // batches in flight; 0 = two per thread
+    bool quiet = false;
+};
+
+void PutBe32(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+void PutBe64(uint8_t* p, uint64_t v) {
+    PutBe32(p, static_cast<uint32_t>(v >> 32));
+    PutBe32(p + 4, static_cast<uint32_t>(v));
+}
+
+uint64_t GetBe64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+bool IsZero(const uint8_t* p, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, p + i, 8);
+        if (v) return false;
+    }
+    for (; i < len; i++) {
+        if (p[i]) return false;
+    }
+    return true;
+}
+
+// One run of clusters on its way through the pipeline.
+struct Batch {
+    uint64_t first_cluster = 0;
+    uint32_t clusters = 0;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> packed;     // compressed clusters, back to back
+    // Per cluster: 0 if it reads as zeros, the cluster size if it is
+    // stored as is, otherwise its compressed length in `packed`.
+    std::vector<uint32_t> sizes;
+    bool claimed = false;
+    bool ready = false;
+};
+
+// Per worker, so the codec contexts are reused across clusters.
+class Compressor {
+public:
+    Compressor(Compression compression, int level, uint32_t cluster_size)
+        : compression_(compression), level_(level), cluster_size_(cluster_size) {}
+
+    ~Compressor() {
+        if (deflate_) {
+            deflateEnd(deflate_.get());
+        }
+        if (zstd_) ZSTD_freeCCtx(zstd_);
+    }
+
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    // Compresses one cluster into `out`. Returns its length, or 0 when it
+    // would not save at least one sector.
+    uint32_t Compress(const uint8_t* in, uint8_t* out) {
+        uint32_t limit = cluster_size_ - 512;
+        if (compression_ == Compression::kZstd) {
+            if (!zstd_ && !(zstd_ = ZSTD_createCCtx())) return 0;
+            size_t n = ZSTD_compressCCtx(zstd_, out, limit, in, cluster_size_,
+                                         level_ ? level_ : ZSTD_CLEVEL_DEFAULT);
+            return ZSTD_isError(n) ? 0 : static_cast<uint32_t>(n);
+        }
+        if (compression_ == Compression::kZlib) {
+            if (!deflate_) {
+                // Raw deflate with a 4 KiB window, as qemu writes it.
+                deflate_ = std::make_unique<z_stream>();
+                if (deflateInit2(deflate_.get(), level_ ? level_ : Z_DEFAULT_COMPRESSION,
+                                 Z_DEFLATED, -12, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    deflate_.reset();
+                    return 0;
+                }
+            } else {
+                deflateReset(deflate_.get());
+            }
+            deflate_->next_in = const_cast<uint8_t*>(in);
+            deflate_->avail_in = cluster_size_;
+            deflate_->next_out = out;
+            deflate_->avail_out = limit;
+            if (deflate(deflate_.get(), Z_FINISH) != Z_STREAM_END) return 0;
+            return limit - deflate_->avail_out;
+        }
+        return 0;
+    }
+
+private:
+    Compression compression_;
+    int level_;
+    uint32_t cluster_size_;
+    std::unique_ptr<z_stream> deflate_;
+    ZSTD_CCtx* zstd_ = nullptr;
+};
+
+// Receives the clusters that are not all zeros, in ascending order.
+class ImageWriter {
+public:
+    virtual ~ImageWriter() = default;
+    virtual bool PutCluster(uint64_t cluster, const uint8_t* data, uint32_t size,
+                            bool compressed) = 0;
+    // Writes whatever the format keeps at the end and closes the file.
+    virtual bool Finish() = 0;
+    uint64_t bytes_written() const { return bytes_written_; }
+
+protected:
+    uint64_t bytes_written_ = 0;
+};
+
+class RawWriter : public ImageWriter {
+public:
+    ~RawWriter() override {
+        if (file_) fclose(file_);
+    }
+
+    bool Open(const std::string& path, uint64_t virtual_size, uint32_t cluster_size) {
+        file_ = fopen(path.c_str(), "wb");
+        if (!file_) return false;
+        setvbuf(file_, nullptr, _IOFBF, kBatchBytes);
+        virtual_size_ = virtual_size;
+        cluster_size_ = cluster_size;
+#ifdef _WIN32
+        // Zero clusters are skipped, so they should not take space either.
+        DWORD bytes = 0;
+        HANDLE h = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file_)));
+        DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytes, nullptr);
+#endif
+        return true;
+    }
+
+    bool PutCluster(uint64_t cluster, const uint8_t* data, uint32_t size,
+                    bool compressed) override {
+        uint64_t offset = cluster * cluster_size_;
+        // The last cluster may reach past the end of the disk.
+        uint32_t len = static_cast<uint32_t>(
+            std::min<uint64_t>(cluster_size_, virtual_size_ - offset));
+        if (offset != position_ && _fseeki64(file_, offset, SEEK_SET) != 0) return false;
+        if (fwrite(data, 1, len, file_) != len) return false;
+        position_ = offset + len;
+        bytes_written_ += len;
+        return true;
+    }
+
+    bool Finish() override {
+        bool ok = fflush(file_) == 0;
+#ifdef _WIN32
+        ok = ok && _chsize_s(_fileno(file_), static_cast<__int64>(virtual_size_)) == 0;
+#else
+        ok = ok && ftruncate(fileno(file_), static_cast<off_t>(virtual_size_)) == 0;
+#endif
+        ok = fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        return ok;
+    }
+
+private:
+    FILE* file_ = nullptr;
+    uint64_t virtual_size_ = 0;
+    uint32_t cluster_size_ = 0;
+    uint64_t position_ = 0;
+};
+
+// Writes a fresh qcow2 v3 image front to back: data clusters after the
+// header, then the L2 tables, the L1 table and the refcounts. The header
+// goes in last, so an interrupted run never leaves a valid image.
+//
+// Compressed clusters are held back and written as runs packed byte to
+// byte, so only the end of each run is padded to a cluster boundary and
+// the uncompressed clusters in between stay aligned.
+class Qcow2Writer : public ImageWriter {
+public:
+    ~Qcow2Writer() override {
+        if (file_) fclose(file_);
+    }
+
+    bool Open(const std::string& path, uint64_t virtual_size, uint32_t cluster_bits,
+              Compression compression) {
+        file_ = fopen(path.c_str(), "wb");
+        if (!file_) return false;
+        setvbuf(file_, nullptr, _IOFBF, kBatchBytes);
+        virtual_size_ = virtual_size;
+        cluster_bits_ = cluster_bits;
+        cluster_size_ = 1u << cluster_bits;
+        compression_ = compression;
+        uint64_t clusters = (virtual_size + cluster_size_ - 1) / cluster_size_;
+        l2_entries_.assign(clusters, 0);
+        // Cluster 0 is the header.
+        refcounts_.assign(1, 1);
+        end_ = cluster_size_;
+        return _fseeki64(file_, end_, SEEK_SET) == 0;
+    }
+
+    bool PutCluster(uint64_t cluster, const uint8_t* data, uint32_t size,
+                    bool compressed) override {
+        if (compressed) {
+            run_clusters_.push_back({cluster, static_cast<uint32_t>(run_.size()), size});
+            run_.insert(run_.end(), data, data + size);
+            return run_.size() < kCompressedRunBytes || FlushCompressedRun();
+        }
+        uint64_t host = end_;
+        if (!WriteMetadata(data, size)) return false;
+        bytes_written_ += size;
+        l2_entries_[cluster] = host | kCopiedBit;
+        return true;
+    }
+
+    bool Finish() override {
+        if (!FlushCompressedRun()) return false;
+
+        uint64_t table_entries = cluster_size_ / 8;
+        uint32_t l1_size = static_cast<uint32_t>(
+            (l2_entries_.size() + table_entries - 1) / table_entries);
+        std::vector<uint64_t> l1(l1_size, 0);
+        std::vector<uint8_t> buf(cluster_size_);
+        for (uint32_t i = 0; i < l1_size; i++) {
+            uint64_t first = i * table_entries;
+            uint64_t last = std::min<uint64_t>(first + table_entries, l2_entries_.size());
+            if (std::all_of(l2_entries_.begin() + first, l2_entries_.begin() + last,
+                            [](uint64_t e) { return e == 0; })) {
+                continue;
+            }
+            std::fill(buf.begin(), buf.end(), 0);
+            for (uint64_t c = first; c < last; c++) {
+                PutBe64(buf.data() + (c - first) * 8, l2_entries_[c]);
+            }
+            l1[i] = end_ | kCopiedBit;
+            if (!WriteMetadata(buf.data(), cluster_size_)) return false;
+        }
+
+        uint64_t l1_offset = end_;
+        uint64_t l1_bytes = AlignUp(static_cast<uint64_t>(l1_size) * 8, cluster_size_);
+        buf.assign(l1_bytes, 0);
+        for (uint32_t i = 0; i < l1_size; i++) PutBe64(buf.data() + i * 8, l1[i]);
+        if (!WriteMetadata(buf.data(), l1_bytes)) return false;
+
+        // The refcount table and blocks count themselves too.
+        uint64_t refblock_entries = cluster_size_ / 2;
+        uint64_t used = end_ / cluster_size_;
+        uint64_t blocks = 0, table = 0;
+        for (;;) {
+            uint64_t total = used + table + blocks;
+            uint64_t need_blocks = (total + refblock_entries - 1) / refblock_entries;
+            uint64_t need_table = (need_blocks * 8 + cluster_size_ - 1) / cluster_size_;
+            if (need_blocks == blocks && need_table == table) break;
+            blocks = need_blocks;
+            table = need_table;
+        }
+        uint64_t table_offset = end_;
+        uint64_t end_cluster = used + table + blocks;
+        refcounts_.resize(end_cluster, 0);
+        for (uint64_t c = used; c < end_cluster; c++) refcounts_[c] = 1;
+
+        // Counted above already, so written without Reference().
+        buf.assign(table * cluster_size_, 0);
+        for (uint64_t b = 0; b < blocks; b++) {
+            PutBe64(buf.data() + b * 8, (used + table + b) * cluster_size_);
+        }
+        if (!Write(buf.data(), buf.size())) return false;
+        buf.assign(cluster_size_, 0);
+        for (uint64_t b = 0; b < blocks; b++) {
+            std::fill(buf.begin(), buf.end(), 0);
+            for (uint64_t i = 0; i < refblock_entries; i++) {
+                uint64_t c = b * refblock_entries + i;
+                if (c >= refcounts_.size()) break;
+                buf[i * 2] = static_cast<uint8_t>(refcounts_[c] >> 8);
+                buf[i * 2 + 1] = static_cast<uint8_t>(refcounts_[c]);
+            }
+            if (!Write(buf.data(), cluster_size_)) return false;
+        }
+
+        // The extensions area right after the header stays zero, which is
+        // the end marker.
+        uint8_t h[kHeaderLength] = {};
+        PutBe32(h + 0, kQcow2Magic);
+        PutBe32(h + 4, 3);
+        PutBe32(h + 20, cluster_bits_);
+        PutBe64(h + 24, virtual_size_);
+        PutBe32(h + 36, l1_size);
+        PutBe64(h + 40, l1_offset);
+        PutBe64(h + 48, table_offset);
+        PutBe32(h + 56, static_cast<uint32_t>(table));
+        if (compression_ == Compression::kZstd) PutBe64(h + 72, kIncompatCompressionType);
+        PutBe32(h + 96, 4);                  // refcount_order: 16-bit
+        PutBe32(h + 100, kHeaderLength);
+        h[104] = compression_ == Compression::kZstd ? 1 : 0;
+        bool ok = fflush(file_) == 0 && _fseeki64(file_, 0, SEEK_SET) == 0 &&
+                  fwrite(h, 1, sizeof(h), file_) == sizeof(h);
+        ok = fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        return ok;
+    }
+
+private:
+    struct RunCluster {
+        uint64_t cluster;
+        uint32_t offset;    // into run_
+        uint32_t size;
+    };
+
+    bool Write(const uint8_t* data, uint64_t len) {
+        if (fwrite(data, 1, len, file_) != len) return false;
+        end_ += len;
+        return true;
+    }
+
+    // Whole clusters at the current end, which is always cluster-aligned.
+    bool WriteMetadata(const uint8_t* data, uint64_t len) {
+        uint64_t host = end_;
+        if (!Write(data, len)) return false;
+        Reference(host, len);
+        return true;
+    }
+
+    bool FlushCompressedRun() {
+        if (run_.empty()) return true;
+        uint64_t base = end_;
+        uint64_t len = run_.size();
+        run_.resize(AlignUp(len, static_cast<uint64_t>(cluster_size_)), 0);
+        if (!Write(run_.data(), run_.size())) return false;
+        bytes_written_ += len;
+        // Sector count beyond the first, above the host offset.
+        uint32_t csize_shift = 62 - (cluster_bits_ - 8);
+        for (const auto& rc : run_clusters_) {
+            uint64_t host = base + rc.offset;
+            uint64_t sectors = ((host + rc.size - 1) >> 9) - (host >> 9);
+            l2_entries_[rc.cluster] = kCompressedBit | (sectors << csize_shift) | host;
+            Reference(host, rc.size);
+        }
+        run_.clear();
+        run_clusters_.clear();
+        return true;
+    }
+
+    // One reference per host cluster the range touches; compressed
+    // clusters sharing a host cluster each hold one.
+    void Reference(uint64_t host, uint64_t len) {
+        uint64_t first = host >> cluster_bits_;
+        uint64_t last = (host + len - 1) >> cluster_bits_;
+        if (last >= refcounts_.size()) refcounts_.resize(last + 1, 0);
+        for (uint64_t c = first; c <= last; c++) {
+            if (refcounts_[c] < UINT16_MAX) refcounts_[c]++;
+        }
+    }
+
+    FILE* file_ = nullptr;
+    uint64_t virtual_size_ = 0;
+    uint32_t cluster_bits_ = 0;
+    uint32_t cluster_size_ = 0;
+    Compression compression_ = Compression::kNone;
+    uint64_t end_ = 0;
+    std::vector<uint64_t> l2_entries_;   // per guest cluster, host byte order
+    std::vector<uint16_t> refcounts_;    // per host cluster
+    std::vector<uint8_t> run_;
+    std::vector<RunCluster> run_clusters_;
+};
+
+bool Convert(const Options& opt, const std::string& input, const std::string& output) {
+    DiskImageOptions disk_options;
+    disk_options.read_only = true;
+    auto disk = DiskImage::Create(input, disk_options);
+    if (!disk) {
+        fprintf(stderr, "Cannot open %s\n", input.c_str());
+        return false;
+    }
+    uint64_t virtual_size = disk->GetSize();
+    uint32_t cluster_size = 1u << opt.cluster_bits;
+    uint64_t total_clusters = (virtual_size + cluster_size - 1) / cluster_size;
+
+    std::unique_ptr<ImageWriter> writer;
+    if (opt.format == Format::kQcow2) {
+        auto qcow2 = std::make_unique<Qcow2Writer>();
+        if (!qcow2->Open(output, virtual_size, opt.cluster_bits, opt.compression)) {
+            fprintf(stderr, "Cannot create %s\n", output.c_str());
+            return false;
+        }
+        writer = std::move(qcow2);
+    } else {
+        auto raw = std::make_unique<RawWriter>();
+        if (!raw->Open(output, virtual_size, cluster_size)) {
+            fprintf(stderr, "Cannot create %s\n", output.c_str());
+            return false;
+        }
+        writer = std::move(raw);
+    }
+
+    uint32_t threads = opt.threads ? opt.threads
+                                   : (std::max)(1u, std::thread::hardware_concurrency());
+    size_t window = opt.window ? opt.window : threads * 2;
+    uint32_t batch_clusters = (std::max)(1u, kBatchBytes / cluster_size);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<Batch>> queue;   // in disk order
+    bool reading_done = false;
+    bool failed = false;
+    auto fail = [&](const char* what, uint64_t cluster) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failed) {
+            fprintf(stderr, "\n%s failed at offset %llu\n", what,
+                    static_cast<unsigned long long>(cluster * cluster_size));
+        }
+        failed = true;
+        cv.notify_all();
+    };
+
+    // The disk image is not thread-safe; only this thread touches it.
+    std::thread reader([&] {
+        for (uint64_t c = 0; c < total_clusters; c += batch_clusters) {
+            auto batch = std::make_unique<Batch>();
+            batch->first_cluster = c;
+            batch->clusters = static_cast<uint32_t>(
+                std::min<uint64_t>(batch_clusters, total_clusters - c));
+            batch->data.assign(static_cast<size_t>(batch->clusters) * cluster_size, 0);
+            uint64_t offset = c * cluster_size;
+            uint32_t len = static_cast<uint32_t>(
+                std::min<uint64_t>(batch->data.size(), virtual_size - offset));
+            if (!disk->Read(offset, batch->data.data(), len)) {
+                fail("Read", c);
+                break;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return failed || queue.size() < window; });
+            if (failed) break;
+            queue.push_back(std::move(batch));
+            cv.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        reading_done = true;
+        cv.notify_all();
+    });
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            Compressor compressor(opt.compression, opt.level, cluster_size);
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                Batch* batch = nullptr;
+                cv.wait(lock, [&] {
+                    if (failed) return true;
+                    for (auto& b : queue) {
+                        if (!b->claimed) {
+                            batch = b.get();
+                            return true;
+                        }
+                    }
+                    return reading_done;
+                });
+                if (!batch) break;
+                batch->claimed = true;
+                lock.unlock();
+
+                batch->sizes.assign(batch->clusters, 0);
+                if (opt.compression != Compression::kNone) {
+                    batch->packed.resize(static_cast<size_t>(batch->clusters) * cluster_size);
+                }
+                size_t packed = 0;
+                for (uint32_t i = 0; i < batch->clusters; i++) {
+                    const uint8_t* in = batch->data.data() + static_cast<size_t>(i) * cluster_size;
+                    if (IsZero(in, cluster_size)) continue;
+                    uint32_t n = opt.compression != Compression::kNone
+                        ? compressor.Compress(in, batch->packed.data() + packed) : 0;
+                    batch->sizes[i] = n ? n : cluster_size;
+                    packed += n;
+                }
+
+                lock.lock();
+                batch->ready = true;
+                cv.notify_all();
+            }
+        });
+    }
+
+    // Writes batches in disk order as they become ready.
+    auto start = Clock::now();
+    uint64_t stored = 0, compressed = 0;
+    int last_percent = -1;
+    bool ok = true;
+    for (;;) {
+        std::unique_ptr<Batch> batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] {
+                return failed || (!queue.empty() && queue.front()->ready) ||
+                       (queue.empty() && reading_done);
+            });
+            if (failed || queue.empty()) break;
+            batch = std::move(queue.front());
+            queue.pop_front();
+            cv.notify_all();
+        }
+        size_t packed = 0;
+        for (uint32_t i = 0; i < batch->clusters && ok; i++) {
+            uint32_t size = batch->sizes[i];
+            if (!size) continue;
+            uint64_t cluster = batch->first_cluster + i;
+            bool is_compressed = size != cluster_size;
+            const uint8_t* data = is_compressed
+                ? batch->packed.data() + packed
+                : batch->data.data() + static_cast<size_t>(i) * cluster_size;
+            if (!writer->PutCluster(cluster, data, size, is_compressed)) {
+                fail("Write", cluster);
+                ok = false;
+            }
+            if (is_compressed) {
+                packed += size;
+                compressed++;
+            }
+            stored++;
+        }
+        if (!ok) break;
+        int percent = static_cast<int>(
+            (batch->first_cluster + batch->clusters) * 100 / total_clusters);
+        if (!opt.quiet && percent != last_percent) {
+            fprintf(stderr, "\r  %3d%%", percent);
+            last_percent = percent;
+        }
+    }
+
+    reader.join();
+    for (auto& w : workers) w.join();
+    if (failed) return false;
+    if (!writer->Finish()) {
+        fprintf(stderr, "\nFailed to finish %s\n", output.c_str());
+        return false;
+    }
+
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    if (!opt.quiet) {
+        fprintf(stderr, "\r%llu of %llu clusters stored (%llu compressed), "
+                "%.1f MB written in %.1f s with %u threads\n",
+                static_cast<unsigned long long>(stored),
+                static_cast<unsigned long long>(total_clusters),
+                static_cast<unsigned long long>(compressed),
+                writer->bytes_written() / (1024.0 * 1024.0), secs, threads);
+    }
+    return true;
+}
+
+uint32_t GetBe32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// The codec of the image's compressed clusters, or kNone if no L2 entry is
+// compressed. In v3 headers long enough to have it, byte 104 is 1 for zstd.
+Compression ImageCompression(FILE* f, const uint8_t* hdr, size_t hdr_len,
+                             uint32_t cluster_bits) {
+    uint32_t l1_size = GetBe32(hdr + 36);
+    uint64_t l1_offset = GetBe64(hdr + 40);
+    std::vector<uint8_t> l1(static_cast<size_t>(l1_size) * 8);
+    if (l1.empty() || _fseeki64(f, l1_offset, SEEK_SET) != 0 ||
+        fread(l1.data(), 1, l1.size(), f) != l1.size()) {
+        return Compression::kNone;
+    }
+    std::vector<uint8_t> l2(size_t{1} << cluster_bits);
+    for (uint32_t i = 0; i < l1_size; i++) {
+        uint64_t l2_offset = GetBe64(&l1[size_t{i} * 8]) & 0x00FFFFFFFFFFFE00ULL;
+        if (!l2_offset || _fseeki64(f, l2_offset, SEEK_SET) != 0 ||
+            fread(l2.data(), 1, l2.size(), f) != l2.size()) {
+            continue;
+        }
+        for (size_t e = 0; e < l2.size(); e += 8) {
+            if (!(GetBe64(&l2[e]) & kCompressedBit)) continue;
+            bool zstd = GetBe32(hdr + 4) >= 3 && hdr_len > 104 &&
+                        GetBe32(hdr + 100) > 104 && hdr[104] == 1;
+            return zstd ? Compression::kZstd : Compression::kZlib;
+        }
+    }
+    return Compression::kNone;
+}
+
+// Checks that `path` is a qcow2 image that can be compacted in place and
+// returns its cluster size and the codec it is compressed with. A compacted
+// overlay would lose its link to the base image.
+bool CheckCompactable(const std::string& path, uint32_t* cluster_bits,
+                      Compression* compression) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path.c_str());
+        return false;
+    }
+    uint8_t hdr[kHeaderLength] = {};
+    size_t got = fread(hdr, 1, sizeof(hdr), f);
+    // A v2 header ends at the snapshot table offset, 72 bytes in.
+    if (got < 72 || GetBe32(hdr) != kQcow2Magic) {
+        fclose(f);
+        fprintf(stderr, "%s is not a qcow2 image\n", path.c_str());
+        return false;
+    }
+    if (GetBe64(hdr + 8) != 0) {
+        fclose(f);
+        fprintf(stderr, "%s has a backing file; compacting would flatten it "
+                "(use convert to do that on purpose)\n", path.c_str());
+        return false;
+    }
+    *cluster_bits = GetBe32(hdr + 20);
+    *compression = *cluster_bits >= 9 && *cluster_bits <= 21
+                       ? ImageCompression(f, hdr, got, *cluster_bits)
+                       : Compression::kNone;
+    fclose(f);
+    return true;
+}
+
+int Run(const Options& opt) {
+    if (opt.command == "convert") {
+        if (std::filesystem::path(opt.input) == std::filesystem::path(opt.output)) {
+            fprintf(stderr, "Input and output must differ; use compact to rewrite in place\n");
+            return 1;
+        }
+        return Convert(opt, opt.input, opt.output) ? 0 : 1;
+    }
+
+    // compact and recompress rewrite the image next to itself and swap it
+    // in only once the copy is complete.
+    Options rewrite = opt;
+    uint32_t cluster_bits = 0;
+    Compression compression = Compression::kNone;
+    if (!CheckCompactable(opt.input, &cluster_bits, &compression)) return 1;
+    if (!opt.cluster_bits_set) rewrite.cluster_bits = cluster_bits;
+    if (opt.command == "compact" && !opt.compression_set) rewrite.compression = compression;
+    std::string temp = opt.input + ".tenbox-img.tmp";
+    if (!Convert(rewrite, opt.input, temp)) {
+        std::remove(temp.c_str());
+        return 1;
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp, opt.input, ec);
+    if (ec) {
+        fprintf(stderr, "Cannot replace %s: %s\n", opt.input.c_str(), ec.message().c_str());
+        std::remove(temp.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+void PrintUsage(const char* prog) {
+    fprintf(stderr,
+        "TenBox image tool v" TENBOX_VERSION "\n"
+        "\n"
+        "Usage: %s convert [options] <input> <output>\n"
+        "       %s compact [options] <image>\n"
+        "       %s recompress [options] <image>\n"
+        "\n"
+        "  convert     Copy a raw or qcow2 image (read through its backing\n"
+        "              chain) to a new raw or qcow2 image\n"
+        "  compact     Rewrite a qcow2 image without unreferenced or zero clusters\n"
+        "  recompress  compact with zstd compression\n"
+        "\n"
+        "Options:\n"
+        "  -O raw|qcow2        Output format for convert (default: qcow2)\n"
+        "  -c none|zlib|zstd   Compress qcow2 clusters (default: none for convert,\n"
+        "                      the image's own for compact, zstd for recompress)\n"
+        "  --level <N>         Compression level (default: codec default)\n"
+        "  --cluster-size <KB> qcow2 cluster size, 4-2048 (default: 64, or the\n"
+        "                      image's own for compact and recompress)\n"
+        "  --threads <N>       Compression threads (default: one per core)\n"
+        "  --window <N>        Batches of %u KB in flight (default: 2 per thread)\n"
+        "  --quiet             No progress output\n"
+        "  --help              Show this help\n",
+        prog, prog, prog, kBatchBytes / 1024);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        auto Arg = [&](const char* flag) {
+            return std::strcmp(argv[i], flag) == 0;
+        };
+        auto NextArg = [&]() -> const char* {
+            if (i + 1 < argc) return argv[++i];
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return nullptr;
+        };
+
+        if (Arg("-O")) {
+            auto v = NextArg(); if (!v) return 1;
+            if (std::strcmp(v, "raw") == 0) {
+                opt.format = Format::kRaw;
+            } else if (std::strcmp(v, "qcow2") == 0) {
+                opt.format = Format::kQcow2;
+            } else {
+                fprintf(stderr, "-O must be raw or qcow2\n");
+                return 1;
+            }
+        } else if (Arg("-c")) {
+            auto v = NextArg(); if (!v) return 1;
+            if (std::strcmp(v, "none") == 0) {
+                opt.compression = Compression::kNone;
+            } else if (std::strcmp(v, "zlib") == 0) {
+                opt.compression = Compression::kZlib;
+            } else if (std::strcmp(v, "zstd") == 0) {
+                opt.compression = Compression::kZstd;
+            } else {
+                fprintf(stderr, "-c must be none, zlib or zstd\n");
+                return 1;
+            }
+            opt.compression_set = true;
+        } else if (Arg("--level")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.level = std::atoi(v);
+        } else if (Arg("--cluster-size")) {
+            auto v = NextArg(); if (!v) return 1;
+            unsigned long kb = std::strtoul(v, nullptr, 10);
+            uint32_t bits = 0;
+            while (bits < 32 && (1ul << bits) < kb * 1024) bits++;
+            if (kb < 4 || kb > 2048 || (1ul << bits) != kb * 1024) {
+                fprintf(stderr, "--cluster-size must be a power of two, 4-2048\n");
+                return 1;
+            }
+            opt.cluster_bits = bits;
+            opt.cluster_bits_set = true;
+        } else if (Arg("--threads")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.threads = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+            if (opt.threads == 0 || opt.threads > 256) {
+                fprintf(stderr, "--threads must be 1..256\n");
+                return 1;
+            }
+        } else if (Arg("--window")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.window = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+            if (opt.window == 0) {
+                fprintf(stderr, "--window must be at least 1\n");
+                return 1;
+            }
+        } else if (Arg("--quiet")) {
+            opt.quiet = true;
+        } else if (Arg("--help") || Arg("-h")) {
+            PrintUsage(argv[0]);
+            return 0;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            PrintUsage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    if (positional.empty()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    opt.command = positional[0];
+    if (opt.command == "convert" && positional.size() == 3) {
+        opt.input = positional[1];
+        opt.output = positional[2];
+    } else if ((opt.command == "compact" || opt.command == "recompress") &&
+               positional.size() == 2) {
+        opt.input = opt.output = positional[1];
+        opt.format = Format::kQcow2;
+        if (opt.command == "recompress" && !opt.compression_set) {
+            opt.compression = Compression::kZstd;
+        }
+    } else {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (opt.format == Format::kRaw && opt.compression != Compression::kNone) {
+        fprintf(stderr, "Raw output cannot be compressed\n");
+        return 1;
+    }
+    return Run(opt);
+}
@@ -0,0 +1,81 @@
+#include "ipc/etw.h"
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+
+// {0b824794-9bb6-4605-9eca-8b2b0a80b422}
+TRACELOGGING_DEFINE_PROVIDER(
+    g_ipc_provider, "TenBox.Ipc",
+    (0x0b824794, 0x9bb6, 0x4605, 0x9e, 0xca, 0x8b, 0x2b, 0x0a, 0x80, 0xb4, 0x22));
+
+namespace ipc::etw {
+
+std::atomic<uint64_t> g_keywords{0};
+
+namespace {
+
+void NTAPI OnEnable(LPCGUID, ULONG control_code, UCHAR, ULONGLONG match_any,
+                    ULONGLONG, PEVENT_FILTER_DESCRIPTOR, PVOID) {
+    switch (control_code) {
+    case EVENT_CONTROL_CODE_ENABLE_PROVIDER:
+        g_keywords.store(match_any ? match_any : ~0ULL, std::memory_order_relaxed);
+        break;
+    case EVENT_CONTROL_CODE_DISABLE_PROVIDER:
+        g_keywords.store(0, std::memory_order_relaxed);
+        break;
+    default:
+        break;
+    }
+}
+
+}  // namespace
+
+void RegisterProvider() {
+    TraceLoggingRegisterEx(g_ipc_provider, OnEnable, nullptr);
+}
+
+void UnregisterProvider() {
+    TraceLoggingUnregister(g_ipc_provider);
+    g_keywords.store(0, std::memory_order_relaxed);
+}
+
+void MessageSent(uint8_t channel, const std::string& type, size_t bytes) {
+    TraceLoggingWrite(g_ipc_provider, "MessageSent",
+        TraceLoggingKeyword(kKeywordMessage),
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingUInt8(channel, "Channel"),
+        TraceLoggingCountedString(type.data(), static_cast<USHORT>(type.size()), "Type"),
+        TraceLoggingUInt64(bytes, "Bytes"));
+}
+
+void MessageReceived(uint8_t channel, const std::string& type, size_t payload_bytes) {
+    TraceLoggingWrite(g_ipc_provider, "MessageReceived",
+        TraceLoggingKeyword(kKeywordMessage),
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingUInt8(channel, "Channel"),
+        TraceLoggingCountedString(type.data(), static_cast<USHORT>(type.size()), "Type"),
+        TraceLoggingUInt64(payload_bytes, "PayloadBytes"));
+}
+
+void FrameSent(uint32_t scanout, uint32_t width, uint32_t height, size_t bytes,
+               uint64_t latency_us) {
+    TraceLoggingWrite(g_ipc_provider, "FrameSent",
+        TraceLoggingKeyword(kKeywordDisplay),
+        TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+        TraceLoggingUInt32(scanout, "Scanout"),
+        TraceLoggingUInt32(width, "Width"),
+        TraceLoggingUInt32(height, "Height"),
+        TraceLoggingUInt64(bytes, "Bytes"),
+        TraceLoggingUInt64(latency_us, "LatencyUs"));
+}
+
+void FrameHandled(const std::string& vm_id, uint32_t scanout, uint64_t duration_us) {
+    TraceLoggingWrite(g_ipc_provider, "FrameHandled",
+        TraceLoggingKeyword(kKeywordDisplay),
+        TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+        TraceLoggingString(vm_id.c_str(), "VmId"),
+        TraceLoggingUInt32(scanout, "Scanout"),
+        TraceLoggingUInt64(duration_us, "DurationUs"));
+}
+
+}  // namespace ipc::etw
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ipc::etw {
+
+// ETW (TraceLogging) provider "TenBox.Ipc", registered by both the
+// runtime and the manager, for the traffic between them; enable it next to
+// TenBox.Vmm to follow a frame from the guest to the screen:
+//   xperf -start tenbox -on 0b824794-9bb6-4605-9eca-8b2b0a80b422
+// Call sites cost one relaxed load while no session has it enabled.
+
+constexpr uint64_t kKeywordMessage = 0x1;  // MessageSent, MessageReceived
+constexpr uint64_t kKeywordDisplay = 0x2;  // FrameSent, FrameHandled
+
+extern std::atomic<uint64_t> g_keywords;
+
+inline bool Enabled(uint64_t keyword) {
+    return (g_keywords.load(std::memory_order_relaxed) & keyword) != 0;
+}
+
+void RegisterProvider();
+void UnregisterProvider();
+
+// Call only when Enabled() says so.
+
+// A message encoded for the pipe (`bytes` on the wire) or taken off it.
+void MessageSent(uint8_t channel, const std::string& type, size_t bytes);
+void MessageReceived(uint8_t channel, const std::string& type, size_t payload_bytes);
+// Runtime: a display.frame written to the pipe, `latency_us` after the
+// first damage it carries.
+void FrameSent(uint32_t scanout, uint32_t width, uint32_t height, size_t bytes,
+               uint64_t latency_us);
+// Manager: a display.frame decoded and handed to the display, taking
+// `duration_us`.
+void FrameHandled(const std::string& vm_id, uint32_t scanout, uint64_t duration_us);
+
+}  // namespace ipc::etw
@@ -0,0 +1,61 @@
+#include "ipc/frame_codec.h"
+
+#include <zstd.h>
+
+namespace ipc {
+
+// Frames are sent as they come, so favour speed over ratio.
+static constexpr int kZstdLevel = 1;
+
+const char* FrameEncodingToString(FrameEncoding encoding) {
+    switch (encoding) {
+    case FrameEncoding::kRaw: return "raw";
+    case FrameEncoding::kZstd: return "zstd";
+    }
+    return "raw";
+}
+
+std::optional<FrameEncoding> FrameEncodingFromString(const std::string& value) {
+    if (value == "raw") return FrameEncoding::kRaw;
+    if (value == "zstd") return FrameEncoding::kZstd;
+    return std::nullopt;
+}
+
+FrameCodec::~FrameCodec() {
+    if (cctx_) ZSTD_freeCCtx(cctx_);
+    if (dctx_) ZSTD_freeDCtx(dctx_);
+}
+
+bool FrameCodec::Compress(const uint8_t* src, size_t len, std::vector<uint8_t>* out) {
+    if (!cctx_) {
+        cctx_ = ZSTD_createCCtx();
+        if (!cctx_) return false;
+    }
+    std::vector<uint8_t> buf(ZSTD_compressBound(len));
+    size_t ret = ZSTD_compressCCtx(cctx_, buf.data(), buf.size(), src, len, kZstdLevel);
+    if (ZSTD_isError(ret) || ret >= len) return false;
+    buf.resize(ret);
+    out->swap(buf);
+    return true;
+}
+
+bool FrameCodec::Decompress(const uint8_t* src, size_t len, size_t expected,
+                            std::vector<uint8_t>* out) {
+    if (!dctx_) {
+        dctx_ = ZSTD_createDCtx();
+        if (!dctx_) return false;
+    }
+    // The frame header states the content size; refuse anything else
+    // before allocating for it.
+    unsigned long long size = ZSTD_getFrameContentSize(src, len);
+    if (size != expected) return false;
+    out->resize(expected);
+    size_t ret = ZSTD_decompressDCtx(dctx_, out->data(), out->size(), src, len);
+    if (ZSTD_isError(ret) || ret != expected) {
+        out->clear();
+        return false;
+    }
+    return true;
+}
+
+}  // namespace ipc
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+namespace ipc {
+
+// How a display.frame payload is coded, named by its "encoding" field.
+// Frames without the field carry raw pixels, so older peers keep working.
+// The manager asks for anything other than raw with display.configure.
+enum class FrameEncoding : uint8_t {
+    kRaw = 0,
+    kZstd = 1,
+};
+
+const char* FrameEncodingToString(FrameEncoding encoding);
+std::optional<FrameEncoding> FrameEncodingFromString(const std::string& value);
+
+// Compresses and decompresses frame payloads, keeping its zstd contexts
+// between frames. Not thread-safe; use one per thread.
+class FrameCodec {
+public:
+    FrameCodec() = default;
+    ~FrameCodec();
+
+    FrameCodec(const FrameCodec&) = delete;
+    FrameCodec& operator=(const FrameCodec&) = delete;
+
+    // Returns false if the pixels do not compress, leaving `out` as is.
+    bool Compress(const uint8_t* src, size_t len, std::vector<uint8_t>* out);
+    // Fails unless the payload decodes to exactly `expected` bytes.
+    bool Decompress(const uint8_t* src, size_t len, size_t expected,
+                    std::vector<uint8_t>* out);
+
+private:
+    ZSTD_CCtx_s* cctx_ = nullptr;
+    ZSTD_DCtx_s* dctx_ = nullptr;
+};
+
+}  // namespace ipc
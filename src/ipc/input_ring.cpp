@@ -0,0 +1,134 @@
+#include "ipc/input_ring.h"
+
+#include <windows.h>
+
+namespace ipc {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x474E5249;  // "IRNG"
+constexpr size_t kSlotsOffset = 256;
+constexpr size_t kMappingSize = kSlotsOffset + InputRing::kCapacity * sizeof(InputRingEvent);
+
+}  // namespace
+
+// The indices run freely and are masked on use; each sits on its own
+// cache line so the two sides do not share one.
+struct InputRing::Header {
+    uint32_t magic;
+    uint32_t capacity;
+    alignas(64) std::atomic<uint32_t> head;     // written by the producer
+    alignas(64) std::atomic<uint32_t> tail;     // written by the consumer
+    alignas(64) std::atomic<uint32_t> waiting;  // consumer is about to sleep
+};
+
+InputRing::~InputRing() {
+    Close();
+}
+
+bool InputRing::Create(const std::string& name) {
+    Close();
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                        static_cast<DWORD>(kMappingSize), name.c_str());
+    if (!mapping) return false;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return false;
+    }
+    HANDLE doorbell = CreateEventA(nullptr, FALSE, FALSE, (name + "_doorbell").c_str());
+    if (!doorbell) {
+        CloseHandle(mapping);
+        return false;
+    }
+    return Map(mapping, doorbell, name, true);
+}
+
+bool InputRing::Open(const std::string& name) {
+    Close();
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name.c_str());
+    if (!mapping) return false;
+    HANDLE doorbell = OpenEventA(EVENT_MODIFY_STATE, FALSE, (name + "_doorbell").c_str());
+    if (!doorbell) {
+        CloseHandle(mapping);
+        return false;
+    }
+    return Map(mapping, doorbell, name, false);
+}
+
+bool InputRing::Map(void* mapping, void* doorbell, const std::string& name, bool create) {
+    static_assert(sizeof(Header) <= kSlotsOffset, "slots overlap the header");
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, kMappingSize);
+    auto* header = static_cast<Header*>(view);
+    // A section opened by name may be smaller than this build expects.
+    MEMORY_BASIC_INFORMATION info{};
+    if (!view || !VirtualQuery(view, &info, sizeof(info)) || info.RegionSize < kMappingSize ||
+        (!create && (header->magic != kMagic || header->capacity != kCapacity))) {
+        if (view) UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        CloseHandle(doorbell);
+        return false;
+    }
+    if (create) {
+        // A fresh section is zeroed, so the indices start at 0.
+        header->capacity = kCapacity;
+        header->magic = kMagic;
+    }
+    mapping_ = mapping;
+    doorbell_ = doorbell;
+    header_ = header;
+    slots_ = reinterpret_cast<InputRingEvent*>(static_cast<uint8_t*>(view) + kSlotsOffset);
+    name_ = name;
+    return true;
+}
+
+void InputRing::Close() {
+    if (header_) UnmapViewOfFile(header_);
+    if (mapping_) CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+    if (doorbell_) CloseHandle(reinterpret_cast<HANDLE>(doorbell_));
+    header_ = nullptr;
+    slots_ = nullptr;
+    mapping_ = nullptr;
+    doorbell_ = nullptr;
+    name_.clear();
+}
+
+bool InputRing::Push(const InputRingEvent& event) {
+    if (!header_) return false;
+    uint32_t head = header_->head.load(std::memory_order_relaxed);
+    uint32_t tail = header_->tail.load(std::memory_order_acquire);
+    if (head - tail >= kCapacity) return false;
+    slots_[head & (kCapacity - 1)] = event;
+    // Sequentially consistent with the consumer's waiting flag: either it
+    // sees the event before sleeping, or it has said so and gets woken.
+    header_->head.store(head + 1, std::memory_order_seq_cst);
+    if (header_->waiting.exchange(0, std::memory_order_seq_cst)) {
+        SetEvent(reinterpret_cast<HANDLE>(doorbell_));
+    }
+    return true;
+}
+
+bool InputRing::Pop(InputRingEvent* event) {
+    if (!header_) return false;
+    uint32_t tail = header_->tail.load(std::memory_order_relaxed);
+    if (header_->head.load(std::memory_order_acquire) == tail) return false;
+    *event = slots_[tail & (kCapacity - 1)];
+    header_->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void InputRing::Wait(uint32_t timeout_ms, void* extra) {
+    if (!header_) return;
+    header_->waiting.store(1, std::memory_order_seq_cst);
+    if (header_->head.load(std::memory_order_seq_cst) ==
+        header_->tail.load(std::memory_order_relaxed)) {
+        HANDLE handles[2] = {reinterpret_cast<HANDLE>(doorbell_), reinterpret_cast<HANDLE>(extra)};
+        WaitForMultipleObjects(extra ? 2 : 1, handles, FALSE, timeout_ms);
+    }
+    header_->waiting.store(0, std::memory_order_relaxed);
+}
+
+std::string InputRingName(const std::string& vm_id, uint32_t process_id) {
+    return "Local\\tenbox_input_" + vm_id + "_" + std::to_string(process_id);
+}
+
+}  // namespace ipc
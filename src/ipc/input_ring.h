@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ipc {
+
+// One keyboard, pointer or wheel event in the ring.
+struct InputRingEvent {
+    enum Type : uint8_t { kKey = 1, kPointer = 2, kWheel = 3 };
+
+    uint8_t type = 0;
+    uint8_t pressed = 0;
+    uint16_t reserved = 0;
+    uint32_t key_code = 0;
+    int32_t x = 0;
+    int32_t y = 0;
+    uint32_t buttons = 0;
+    int32_t wheel_delta = 0;
+};
+static_assert(sizeof(InputRingEvent) == 24, "InputRingEvent is shared between processes");
+
+// Single-producer, single-consumer ring of input events in a named file
+// mapping, with a named event as doorbell. The runtime creates it and
+// consumes; the manager opens it and is the one producer, so an event
+// reaches the guest without going through the pipe. The doorbell is only
+// rung when the consumer has said it is about to sleep.
+class InputRing {
+public:
+    static constexpr uint32_t kCapacity = 1024;  // power of two
+
+    InputRing() = default;
+    ~InputRing();
+
+    InputRing(const InputRing&) = delete;
+    InputRing& operator=(const InputRing&) = delete;
+
+    // Runtime side.
+    bool Create(const std::string& name);
+    // Manager side.
+    bool Open(const std::string& name);
+    void Close();
+
+    bool IsOpen() const { return header_ != nullptr; }
+    const std::string& name() const { return name_; }
+    // Event handle signaled when events arrive for a waiting consumer.
+    void* doorbell() const { return doorbell_; }
+
+    // Producer. False when the ring is full.
+    bool Push(const InputRingEvent& event);
+    // Consumer.
+    bool Pop(InputRingEvent* event);
+    // Consumer. Sleeps up to `timeout_ms` unless events are queued;
+    // `extra`, if given, is another event that ends the wait.
+    void Wait(uint32_t timeout_ms, void* extra = nullptr);
+
+private:
+    struct Header;
+
+    bool Map(void* mapping, void* doorbell, const std::string& name, bool create);
+
+    void* mapping_ = nullptr;
+    void* doorbell_ = nullptr;
+    Header* header_ = nullptr;
+    InputRingEvent* slots_ = nullptr;
+    std::string name_;
+};
+
+// Ring name for one runtime process of a VM.
+std::string InputRingName(const std::string& vm_id, uint32_t process_id);
+
+}  // namespace ipc
@@ -0,0 +1,233 @@
+#include "ipc/message_body.h"
+#include "ipc/frame_codec.h"
+
+#include <cstdlib>
+#include <type_traits>
+
+namespace ipc {
+namespace {
+
+struct MessageTypeInfo {
+    const char* name;
+    size_t body;   // MessageBody alternative index
+};
+
+template <typename T, size_t I = 0>
+constexpr size_t BodyIndex() {
+    if constexpr (std::is_same_v<std::variant_alternative_t<I, MessageBody>, T>) {
+        return I;
+    } else {
+        return BodyIndex<T, I + 1>();
+    }
+}
+
+// Wire ids are the index + 1. Append only.
+const MessageTypeInfo kMessageTypes[] = {
+    {"display.frame", BodyIndex<DisplayFrameBody>()},
+    {"display.cursor", BodyIndex<DisplayCursorBody>()},
+    {"audio.pcm", BodyIndex<AudioPcmBody>()},
+    {"input.key_event", BodyIndex<KeyEventBody>()},
+    {"input.pointer_event", BodyIndex<PointerEventBody>()},
+    {"input.wheel_event", BodyIndex<WheelEventBody>()},
+    {"display.state", 0},
+    {"display.set_size", 0},
+    {"display.configure", 0},
+    {"console.data", 0},
+    {"console.input", 0},
+    {"clipboard.grab", 0},
+    {"clipboard.data", 0},
+    {"clipboard.request", 0},
+    {"clipboard.release", 0},
+    {"guest_agent.state", 0},
+    {"runtime.state", 0},
+    {"runtime.command", 0},
+    {"runtime.command.result", 0},
+    {"runtime.stats", 0},
+    {"runtime.stats.result", 0},
+    {"runtime.ping", 0},
+    {"runtime.pong", 0},
+    {"runtime.dedup_pass", 0},
+    {"runtime.combine_pages", 0},
+    {"runtime.combine_pages.result", 0},
+    {"runtime.set_balloon", 0},
+    {"runtime.set_balloon.result", 0},
+    {"runtime.update_network", 0},
+    {"runtime.update_network.result", 0},
+    {"runtime.update_shared_folders", 0},
+    {"runtime.update_shared_folders.result", 0},
+    {"runtime.set_protocol", 0},
+    {"display.ack", 0},
+    {"audio.capture", 0},
+    {"display.viewer", 0},
+    {"runtime.set_disk_limits", 0},
+    {"runtime.set_disk_limits.result", 0},
+    {"runtime.net_capture", 0},
+    {"runtime.net_capture.result", 0},
+    {"runtime.set_resources", 0},
+    {"runtime.set_resources.result", 0},
+    {"runtime.resources", 0},
+};
+constexpr uint16_t kMessageTypeCount =
+    static_cast<uint16_t>(sizeof(kMessageTypes) / sizeof(kMessageTypes[0]));
+
+uint32_t TakeU32(MessageFields* fields, const char* key) {
+    auto it = fields->find(key);
+    if (it == fields->end()) return 0;
+    auto value = static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10));
+    fields->erase(it);
+    return value;
+}
+
+int32_t TakeI32(MessageFields* fields, const char* key) {
+    auto it = fields->find(key);
+    if (it == fields->end()) return 0;
+    auto value = static_cast<int32_t>(std::strtol(it->second.c_str(), nullptr, 10));
+    fields->erase(it);
+    return value;
+}
+
+bool TakeBool(MessageFields* fields, const char* key) {
+    auto it = fields->find(key);
+    if (it == fields->end()) return false;
+    bool value = it->second == "1" || it->second == "true";
+    fields->erase(it);
+    return value;
+}
+
+}  // namespace
+
+uint16_t MessageTypeId(const std::string& type) {
+    for (uint16_t i = 0; i < kMessageTypeCount; ++i) {
+        if (type == kMessageTypes[i].name) return i + 1;
+    }
+    return 0;
+}
+
+const char* MessageTypeName(uint16_t id) {
+    return id && id <= kMessageTypeCount ? kMessageTypes[id - 1].name : nullptr;
+}
+
+void ResetBody(uint16_t type_id, MessageBody* body) {
+    size_t index = type_id && type_id <= kMessageTypeCount ? kMessageTypes[type_id - 1].body : 0;
+    switch (index) {
+    case BodyIndex<DisplayFrameBody>(): body->emplace<DisplayFrameBody>(); break;
+    case BodyIndex<DisplayCursorBody>(): body->emplace<DisplayCursorBody>(); break;
+    case BodyIndex<AudioPcmBody>(): body->emplace<AudioPcmBody>(); break;
+    case BodyIndex<KeyEventBody>(): body->emplace<KeyEventBody>(); break;
+    case BodyIndex<PointerEventBody>(): body->emplace<PointerEventBody>(); break;
+    case BodyIndex<WheelEventBody>(): body->emplace<WheelEventBody>(); break;
+    default: body->emplace<std::monostate>(); break;
+    }
+}
+
+void BodyBytes(const MessageBody& body, const void** data, size_t* size) {
+    std::visit([&](const auto& b) {
+        using T = std::decay_t<decltype(b)>;
+        if constexpr (std::is_same_v<T, std::monostate>) {
+            *data = nullptr;
+            *size = 0;
+        } else {
+            *data = &b;
+            *size = sizeof(T);
+        }
+    }, body);
+}
+
+void* MutableBodyBytes(MessageBody* body, size_t* size) {
+    const void* data = nullptr;
+    BodyBytes(*body, &data, size);
+    return const_cast<void*>(data);
+}
+
+void BodyFromFields(const std::string& type, MessageFields* fields, MessageBody* body) {
+    ResetBody(MessageTypeId(type), body);
+    if (auto* f = std::get_if<DisplayFrameBody>(body)) {
+        f->scanout = TakeU32(fields, "scanout");
+        f->width = TakeU32(fields, "width");
+        f->height = TakeU32(fields, "height");
+        f->stride = TakeU32(fields, "stride");
+        f->format = TakeU32(fields, "format");
+        f->resource_width = TakeU32(fields, "resource_width");
+        f->resource_height = TakeU32(fields, "resource_height");
+        f->dirty_x = TakeU32(fields, "dirty_x");
+        f->dirty_y = TakeU32(fields, "dirty_y");
+        auto it = fields->find("encoding");
+        if (it != fields->end()) {
+            // An encoding we do not know must not pass for raw pixels.
+            auto encoding = FrameEncodingFromString(it->second);
+            f->encoding = encoding ? static_cast<uint8_t>(*encoding) : 0xFF;
+            fields->erase(it);
+        }
+    } else if (auto* c = std::get_if<DisplayCursorBody>(body)) {
+        c->scanout = TakeU32(fields, "scanout");
+        c->x = TakeI32(fields, "x");
+        c->y = TakeI32(fields, "y");
+        c->hot_x = TakeU32(fields, "hot_x");
+        c->hot_y = TakeU32(fields, "hot_y");
+        c->width = TakeU32(fields, "width");
+        c->height = TakeU32(fields, "height");
+        c->visible = TakeBool(fields, "visible");
+        c->image_updated = TakeBool(fields, "image_updated");
+        auto it = fields->find("image_id");
+        if (it != fields->end()) {
+            c->image_id = std::strtoull(it->second.c_str(), nullptr, 10);
+            fields->erase(it);
+        }
+    } else if (auto* a = std::get_if<AudioPcmBody>(body)) {
+        a->sample_rate = TakeU32(fields, "sample_rate");
+        a->channels = static_cast<uint16_t>(TakeU32(fields, "channels"));
+    } else if (auto* k = std::get_if<KeyEventBody>(body)) {
+        k->key_code = TakeU32(fields, "key_code");
+        k->pressed = TakeBool(fields, "pressed");
+    } else if (auto* p = std::get_if<PointerEventBody>(body)) {
+        p->x = TakeI32(fields, "x");
+        p->y = TakeI32(fields, "y");
+        p->buttons = TakeU32(fields, "buttons");
+    } else if (auto* w = std::get_if<WheelEventBody>(body)) {
+        w->delta = TakeI32(fields, "delta");
+    }
+}
+
+void BodyToFields(const MessageBody& body, MessageFields* fields) {
+    auto& out = *fields;
+    if (auto* f = std::get_if<DisplayFrameBody>(&body)) {
+        out["scanout"] = std::to_string(f->scanout);
+        out["width"] = std::to_string(f->width);
+        out["height"] = std::to_string(f->height);
+        out["stride"] = std::to_string(f->stride);
+        out["format"] = std::to_string(f->format);
+        out["resource_width"] = std::to_string(f->resource_width);
+        out["resource_height"] = std::to_string(f->resource_height);
+        out["dirty_x"] = std::to_string(f->dirty_x);
+        out["dirty_y"] = std::to_string(f->dirty_y);
+        // Raw frames go without it, as they always have.
+        if (f->encoding != static_cast<uint8_t>(FrameEncoding::kRaw)) {
+            out["encoding"] = FrameEncodingToString(static_cast<FrameEncoding>(f->encoding));
+        }
+    } else if (auto* c = std::get_if<DisplayCursorBody>(&body)) {
+        out["scanout"] = std::to_string(c->scanout);
+        out["x"] = std::to_string(c->x);
+        out["y"] = std::to_string(c->y);
+        out["hot_x"] = std::to_string(c->hot_x);
+        out["hot_y"] = std::to_string(c->hot_y);
+        out["width"] = std::to_string(c->width);
+        out["height"] = std::to_string(c->height);
+        out["visible"] = c->visible ? "1" : "0";
+        out["image_updated"] = c->image_updated ? "1" : "0";
+        out["image_id"] = std::to_string(c->image_id);
+    } else if (auto* a = std::get_if<AudioPcmBody>(&body)) {
+        out["sample_rate"] = std::to_string(a->sample_rate);
+        out["channels"] = std::to_string(a->channels);
+    } else if (auto* k = std::get_if<KeyEventBody>(&body)) {
+        out["key_code"] = std::to_string(k->key_code);
+        out["pressed"] = k->pressed ? "1" : "0";
+    } else if (auto* p = std::get_if<PointerEventBody>(&body)) {
+        out["x"] = std::to_string(p->x);
+        out["y"] = std::to_string(p->y);
+        out["buttons"] = std::to_string(p->buttons);
+    } else if (auto* w = std::get_if<WheelEventBody>(&body)) {
+        out["delta"] = std::to_string(w->delta);
+    }
+}
+
+}  // namespace ipc
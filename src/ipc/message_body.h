@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <variant>
+
+namespace ipc {
+
+// Typed bodies of the message types sent per frame or per input event.
+// Protocol v2 carries them as these packed structs; v1 as the key=value
+// fields they replace, converted when encoding and decoding, so handlers
+// only deal with the struct whichever version the peer speaks.
+#pragma pack(push, 1)
+struct DisplayFrameBody {     // display.frame
+    uint32_t scanout = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;
+    uint32_t format = 0;
+    uint32_t resource_width = 0;
+    uint32_t resource_height = 0;
+    uint32_t dirty_x = 0;
+    uint32_t dirty_y = 0;
+    uint8_t encoding = 0;     // FrameEncoding of the payload
+};
+
+struct DisplayCursorBody {    // display.cursor
+    uint32_t scanout = 0;
+    int32_t x = 0;
+    int32_t y = 0;
+    uint32_t hot_x = 0;
+    uint32_t hot_y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint8_t visible = 0;
+    uint8_t image_updated = 0;
+    uint64_t image_id = 0;
+};
+
+struct AudioPcmBody {         // audio.pcm
+    uint32_t sample_rate = 0;
+    uint16_t channels = 0;
+};
+
+struct KeyEventBody {         // input.key_event
+    uint32_t key_code = 0;
+    uint8_t pressed = 0;
+};
+
+struct PointerEventBody {     // input.pointer_event
+    int32_t x = 0;
+    int32_t y = 0;
+    uint32_t buttons = 0;
+};
+
+struct WheelEventBody {       // input.wheel_event
+    int32_t delta = 0;
+};
+#pragma pack(pop)
+
+using MessageBody = std::variant<std::monostate, DisplayFrameBody, DisplayCursorBody,
+                                 AudioPcmBody, KeyEventBody, PointerEventBody,
+                                 WheelEventBody>;
+using MessageFields = std::unordered_map<std::string, std::string>;
+
+// Message types by wire id. Ids only ever get appended; 0 means the type
+// is sent by name.
+uint16_t MessageTypeId(const std::string& type);
+const char* MessageTypeName(uint16_t id);
+
+// Sets `body` to the (zeroed) struct messages of `type_id` carry, leaving
+// it empty for types without one.
+void ResetBody(uint16_t type_id, MessageBody* body);
+// The struct's bytes as they go on the wire; size 0 for no body.
+void BodyBytes(const MessageBody& body, const void** data, size_t* size);
+void* MutableBodyBytes(MessageBody* body, size_t* size);
+
+// v1 compatibility: moves the fields of a typed body into it, and back.
+void BodyFromFields(const std::string& type, MessageFields* fields, MessageBody* body);
+void BodyToFields(const MessageBody& body, MessageFields* fields);
+
+}  // namespace ipc
@@ -0,0 +1,108 @@
+#include "ipc/metrics_block.h"
+
+#include <windows.h>
+
+#include <atomic>
+#include <cstring>
+
+namespace ipc {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x5254454D;  // "METR"
+constexpr size_t kMappingSize = 4096;
+constexpr int kReadAttempts = 8;
+
+}  // namespace
+
+// The sequence is odd while a sample is being written.
+struct MetricsBlock::Header {
+    uint32_t magic;
+    uint32_t sample_size;
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+    MetricsSample sample;
+};
+
+MetricsBlock::~MetricsBlock() {
+    Close();
+}
+
+bool MetricsBlock::Create(const std::string& name) {
+    Close();
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                        static_cast<DWORD>(kMappingSize), name.c_str());
+    if (!mapping) return false;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return false;
+    }
+    return Map(mapping, name, true);
+}
+
+bool MetricsBlock::Open(const std::string& name) {
+    Close();
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    if (!mapping) return false;
+    return Map(mapping, name, false);
+}
+
+bool MetricsBlock::Map(void* mapping, const std::string& name, bool create) {
+    static_assert(sizeof(Header) <= kMappingSize, "metrics outgrew the mapping");
+    void* view = MapViewOfFile(mapping, create ? FILE_MAP_READ | FILE_MAP_WRITE : FILE_MAP_READ,
+                               0, 0, kMappingSize);
+    auto* header = static_cast<Header*>(view);
+    if (!view || (!create && (header->magic != kMagic ||
+                              header->sample_size != sizeof(MetricsSample)))) {
+        if (view) UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        return false;
+    }
+    if (create) {
+        header->sample_size = sizeof(MetricsSample);
+        header->magic = kMagic;
+    }
+    mapping_ = mapping;
+    header_ = header;
+    name_ = name;
+    return true;
+}
+
+void MetricsBlock::Close() {
+    if (header_) UnmapViewOfFile(header_);
+    if (mapping_) CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+    header_ = nullptr;
+    mapping_ = nullptr;
+    name_.clear();
+}
+
+void MetricsBlock::Publish(const MetricsSample& sample) {
+    if (!header_) return;
+    uint32_t seq = header_->sequence.load(std::memory_order_relaxed);
+    header_->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&header_->sample, &sample, sizeof(sample));
+    header_->sequence.store(seq + 2, std::memory_order_release);
+}
+
+bool MetricsBlock::Read(MetricsSample* sample) const {
+    if (!header_) return false;
+    for (int i = 0; i < kReadAttempts; i++) {
+        uint32_t before = header_->sequence.load(std::memory_order_acquire);
+        if (before == 0) return false;
+        if (before & 1) {
+            YieldProcessor();
+            continue;
+        }
+        std::memcpy(sample, &header_->sample, sizeof(*sample));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header_->sequence.load(std::memory_order_relaxed) == before) return true;
+    }
+    return false;
+}
+
+std::string MetricsBlockName(const std::string& vm_id, uint32_t process_id) {
+    return "Local\\tenbox_metrics_" + vm_id + "_" + std::to_string(process_id);
+}
+
+}  // namespace ipc
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common/vm_model.h"
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace ipc {
+
+// The latest metrics sample of one runtime.
+struct MetricsSample {
+    uint64_t sample_us = 0;  // runtime uptime when taken
+    uint32_t vcpu_count = 0;
+    uint32_t reserved = 0;
+    uint64_t memory_committed_bytes = 0;
+    VmCounters counters;
+};
+static_assert(std::is_trivially_copyable_v<MetricsSample>,
+              "MetricsSample is shared between processes");
+
+// A runtime's metrics in a named file mapping. The runtime creates it and
+// publishes a sample of its running totals every kIntervalMs; the manager
+// opens it and reads whenever it likes. A sequence count makes a read that
+// overlapped a publish try again, so neither side waits for the other and
+// no message crosses the pipe.
+class MetricsBlock {
+public:
+    static constexpr uint32_t kIntervalMs = 1000;
+
+    MetricsBlock() = default;
+    ~MetricsBlock();
+
+    MetricsBlock(const MetricsBlock&) = delete;
+    MetricsBlock& operator=(const MetricsBlock&) = delete;
+
+    // Runtime side.
+    bool Create(const std::string& name);
+    // Manager side.
+    bool Open(const std::string& name);
+    void Close();
+
+    bool IsOpen() const { return header_ != nullptr; }
+    const std::string& name() const { return name_; }
+
+    // Single writer.
+    void Publish(const MetricsSample& sample);
+    // False before the first sample, or if publishes kept overlapping.
+    bool Read(MetricsSample* sample) const;
+
+private:
+    struct Header;
+
+    bool Map(void* mapping, const std::string& name, bool create);
+
+    void* mapping_ = nullptr;
+    Header* header_ = nullptr;
+    std::string name_;
+};
+
+// Block name for one runtime process of a VM.
+std::string MetricsBlockName(const std::string& vm_id, uint32_t process_id);
+
+}  // namespace ipc
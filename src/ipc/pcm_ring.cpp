@@ -0,0 +1,185 @@
+#include "ipc/pcm_ring.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace ipc {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x474E5250;  // "PRNG"
+constexpr size_t kSamplesOffset = 256;
+constexpr size_t kFrameBytes = PcmRing::kChannels * sizeof(int16_t);
+constexpr size_t kMappingSize = kSamplesOffset + PcmRing::kCapacityFrames * kFrameBytes;
+
+}  // namespace
+
+// Frame indices run freely and are masked on use.
+struct PcmRing::Header {
+    uint32_t magic;
+    uint32_t capacity_frames;
+    uint32_t sample_rate;
+    uint32_t channels;
+    std::atomic<uint32_t> target_frames;  // written by the consumer
+    alignas(64) std::atomic<uint32_t> head;  // written by the producer
+    alignas(64) std::atomic<uint32_t> tail;  // written by the consumer
+    alignas(64) std::atomic<uint32_t> waiting;  // consumer is about to sleep
+};
+
+PcmRing::~PcmRing() {
+    Close();
+}
+
+bool PcmRing::Create(const std::string& name) {
+    Close();
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                        static_cast<DWORD>(kMappingSize), name.c_str());
+    if (!mapping) return false;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return false;
+    }
+    HANDLE doorbell = CreateEventA(nullptr, FALSE, FALSE, (name + "_doorbell").c_str());
+    if (!doorbell) {
+        CloseHandle(mapping);
+        return false;
+    }
+    return Map(mapping, doorbell, name, true);
+}
+
+bool PcmRing::Open(const std::string& name) {
+    Close();
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name.c_str());
+    if (!mapping) return false;
+    // Either side may be the consumer, so it may wait on the doorbell too.
+    HANDLE doorbell = OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE,
+                                 (name + "_doorbell").c_str());
+    if (!doorbell) {
+        CloseHandle(mapping);
+        return false;
+    }
+    return Map(mapping, doorbell, name, false);
+}
+
+bool PcmRing::Map(void* mapping, void* doorbell, const std::string& name, bool create) {
+    static_assert(sizeof(Header) <= kSamplesOffset, "samples overlap the header");
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, kMappingSize);
+    auto* header = static_cast<Header*>(view);
+    // A section opened by name may be smaller than this build expects.
+    MEMORY_BASIC_INFORMATION info{};
+    if (!view || !VirtualQuery(view, &info, sizeof(info)) || info.RegionSize < kMappingSize ||
+        (!create && (header->magic != kMagic || header->capacity_frames != kCapacityFrames ||
+                     header->sample_rate != kSampleRate || header->channels != kChannels))) {
+        if (view) UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        CloseHandle(doorbell);
+        return false;
+    }
+    if (create) {
+        header->capacity_frames = kCapacityFrames;
+        header->sample_rate = kSampleRate;
+        header->channels = kChannels;
+        header->magic = kMagic;
+    }
+    mapping_ = mapping;
+    doorbell_ = doorbell;
+    header_ = header;
+    samples_ = reinterpret_cast<int16_t*>(static_cast<uint8_t*>(view) + kSamplesOffset);
+    name_ = name;
+    return true;
+}
+
+void PcmRing::Close() {
+    if (header_) UnmapViewOfFile(header_);
+    if (mapping_) CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+    if (doorbell_) CloseHandle(reinterpret_cast<HANDLE>(doorbell_));
+    header_ = nullptr;
+    samples_ = nullptr;
+    mapping_ = nullptr;
+    doorbell_ = nullptr;
+    name_.clear();
+}
+
+size_t PcmRing::Write(const int16_t* samples, size_t frames) {
+    if (!header_) return 0;
+    uint32_t head = header_->head.load(std::memory_order_relaxed);
+    uint32_t tail = header_->tail.load(std::memory_order_acquire);
+    size_t count = (std::min)(frames, static_cast<size_t>(kCapacityFrames - (head - tail)));
+    for (size_t done = 0; done < count;) {
+        uint32_t at = (head + static_cast<uint32_t>(done)) & (kCapacityFrames - 1);
+        size_t run = (std::min)(count - done, static_cast<size_t>(kCapacityFrames - at));
+        std::memcpy(samples_ + at * kChannels, samples + done * kChannels, run * kFrameBytes);
+        done += run;
+    }
+    // Sequentially consistent with the consumer's waiting flag: either it
+    // sees the frames before sleeping, or it has said so and gets woken.
+    header_->head.store(head + static_cast<uint32_t>(count), std::memory_order_seq_cst);
+    if (header_->waiting.exchange(0, std::memory_order_seq_cst)) {
+        SetEvent(reinterpret_cast<HANDLE>(doorbell_));
+    }
+    return count;
+}
+
+size_t PcmRing::Available() const {
+    if (!header_) return 0;
+    return header_->head.load(std::memory_order_acquire) -
+           header_->tail.load(std::memory_order_relaxed);
+}
+
+size_t PcmRing::Read(int16_t* samples, size_t frames) {
+    if (!header_) return 0;
+    uint32_t tail = header_->tail.load(std::memory_order_relaxed);
+    size_t count = (std::min)(frames, Available());
+    for (size_t done = 0; done < count;) {
+        uint32_t at = (tail + static_cast<uint32_t>(done)) & (kCapacityFrames - 1);
+        size_t run = (std::min)(count - done, static_cast<size_t>(kCapacityFrames - at));
+        std::memcpy(samples + done * kChannels, samples_ + at * kChannels, run * kFrameBytes);
+        done += run;
+    }
+    header_->tail.store(tail + static_cast<uint32_t>(count), std::memory_order_release);
+    return count;
+}
+
+size_t PcmRing::Skip(size_t frames) {
+    if (!header_) return 0;
+    size_t count = (std::min)(frames, Available());
+    header_->tail.fetch_add(static_cast<uint32_t>(count), std::memory_order_release);
+    return count;
+}
+
+void PcmRing::Wait(size_t frames, uint32_t timeout_ms, void* extra) {
+    if (!header_) return;
+    header_->waiting.store(1, std::memory_order_seq_cst);
+    if (header_->head.load(std::memory_order_seq_cst) -
+        header_->tail.load(std::memory_order_relaxed) < frames) {
+        HANDLE handles[2] = {reinterpret_cast<HANDLE>(doorbell_), reinterpret_cast<HANDLE>(extra)};
+        WaitForMultipleObjects(extra ? 2 : 1, handles, FALSE, timeout_ms);
+    }
+    header_->waiting.store(0, std::memory_order_relaxed);
+}
+
+uint32_t PcmRing::ReadPosition() const {
+    if (!header_) return 0;
+    return header_->tail.load(std::memory_order_acquire);
+}
+
+void PcmRing::SetTargetFrames(uint32_t frames) {
+    if (header_) header_->target_frames.store(frames, std::memory_order_relaxed);
+}
+
+uint32_t PcmRing::TargetFrames() const {
+    if (!header_) return 0;
+    return header_->target_frames.load(std::memory_order_relaxed);
+}
+
+std::string PcmRingName(const std::string& vm_id, uint32_t process_id) {
+    return "Local\\tenbox_audio_" + vm_id + "_" + std::to_string(process_id);
+}
+
+std::string CaptureRingName(const std::string& vm_id, uint32_t process_id) {
+    return "Local\\tenbox_capture_" + vm_id + "_" + std::to_string(process_id);
+}
+
+}  // namespace ipc
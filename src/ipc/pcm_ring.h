@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ipc {
+
+// Single-producer, single-consumer ring of S16 stereo 48 kHz frames (the
+// virtio-snd stream format) in a named file mapping. The runtime creates
+// one per direction: for playback it writes what the guest plays and the
+// manager's audio player reads on the device's clock; for capture the
+// manager writes the microphone and the runtime reads. PCM never crosses
+// the pipe. A named event serves as doorbell, rung only while the consumer
+// waits for frames; once both ends play they run on an audio clock.
+class PcmRing {
+public:
+    static constexpr uint32_t kSampleRate = 48000;
+    static constexpr uint16_t kChannels = 2;
+    static constexpr uint32_t kCapacityFrames = 16384;  // ~340 ms, power of two
+
+    PcmRing() = default;
+    ~PcmRing();
+
+    PcmRing(const PcmRing&) = delete;
+    PcmRing& operator=(const PcmRing&) = delete;
+
+    // Runtime side.
+    bool Create(const std::string& name);
+    // Manager side.
+    bool Open(const std::string& name);
+    void Close();
+
+    bool IsOpen() const { return header_ != nullptr; }
+    const std::string& name() const { return name_; }
+    // Event handle signaled when frames arrive for a waiting consumer.
+    void* doorbell() const { return doorbell_; }
+
+    // Producer. Writes as many of `frames` interleaved frames as fit and
+    // returns how many; the rest is dropped.
+    size_t Write(const int16_t* samples, size_t frames);
+
+    // Consumer.
+    size_t Available() const;
+    size_t Read(int16_t* samples, size_t frames);
+    // Drops up to `frames` of the oldest frames.
+    size_t Skip(size_t frames);
+    // Sleeps up to `timeout_ms` while fewer than `frames` are queued,
+    // waking at each write; `extra`, if given, is another event that ends
+    // the wait.
+    void Wait(size_t frames, uint32_t timeout_ms, void* extra = nullptr);
+
+    // Frames consumed so far, wrapping; the producer paces itself on it.
+    uint32_t ReadPosition() const;
+    // How much the consumer wants queued ahead of it, 0 while nobody
+    // consumes. Set by the consumer, read by the producer.
+    void SetTargetFrames(uint32_t frames);
+    uint32_t TargetFrames() const;
+
+private:
+    struct Header;
+
+    bool Map(void* mapping, void* doorbell, const std::string& name, bool create);
+
+    void* mapping_ = nullptr;
+    void* doorbell_ = nullptr;
+    Header* header_ = nullptr;
+    int16_t* samples_ = nullptr;
+    std::string name_;
+};
+
+// Ring names for one runtime process of a VM.
+std::string PcmRingName(const std::string& vm_id, uint32_t process_id);
+std::string CaptureRingName(const std::string& vm_id, uint32_t process_id);
+
+}  // namespace ipc
@@ -0,0 +1,97 @@
+#include "ipc/pipe_io.h"
+
+#include <windows.h>
+
+namespace ipc {
+namespace {
+
+// One manual-reset event per thread, reused by every call on it.
+class ThreadEvent {
+public:
+    ThreadEvent() : event_(CreateEventW(nullptr, TRUE, FALSE, nullptr)) {}
+    ~ThreadEvent() {
+        if (event_) CloseHandle(event_);
+    }
+    HANDLE get() const { return event_; }
+
+private:
+    HANDLE event_;
+};
+
+HANDLE IoEvent() {
+    static thread_local ThreadEvent event;
+    ResetEvent(event.get());
+    return event.get();
+}
+
+// Finishes an overlapped call that returned `started`. With `stop`
+// signaled first the I/O is cancelled and the call fails.
+bool Finish(HANDLE pipe, OVERLAPPED* ov, HANDLE event, BOOL started, DWORD* transferred,
+            HANDLE stop) {
+    if (!started && GetLastError() != ERROR_IO_PENDING) return false;
+    if (stop) {
+        HANDLE handles[2] = {event, stop};
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+            CancelIoEx(pipe, ov);
+            GetOverlappedResult(pipe, ov, transferred, TRUE);
+            return false;
+        }
+    }
+    return GetOverlappedResult(pipe, ov, transferred, TRUE) != FALSE;
+}
+
+OVERLAPPED MakeOverlapped(HANDLE event) {
+    OVERLAPPED ov{};
+    // The low bit keeps the completion off any completion port.
+    ov.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<uintptr_t>(event) | 1);
+    return ov;
+}
+
+}  // namespace
+
+bool PipeConnect(void* pipe, void* stop) {
+    HANDLE h = reinterpret_cast<HANDLE>(pipe);
+    HANDLE event = IoEvent();
+    OVERLAPPED ov = MakeOverlapped(event);
+    if (ConnectNamedPipe(h, &ov)) return true;
+    DWORD err = GetLastError();
+    if (err == ERROR_PIPE_CONNECTED) return true;
+    DWORD unused = 0;
+    return Finish(h, &ov, event, FALSE, &unused, reinterpret_cast<HANDLE>(stop));
+}
+
+bool PipeWrite(void* pipe, const void* data, size_t size, void* stop) {
+    HANDLE h = reinterpret_cast<HANDLE>(pipe);
+    const auto* p = static_cast<const char*>(data);
+    while (size > 0) {
+        HANDLE event = IoEvent();
+        OVERLAPPED ov = MakeOverlapped(event);
+        DWORD chunk = static_cast<DWORD>(size > 0x40000000 ? 0x40000000 : size);
+        DWORD written = 0;
+        BOOL started = WriteFile(h, p, chunk, nullptr, &ov);
+        if (!Finish(h, &ov, event, started, &written, reinterpret_cast<HANDLE>(stop)) ||
+            written == 0) {
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool PipeRead(void* pipe, void* buffer, uint32_t size, uint32_t* read, void* stop) {
+    HANDLE h = reinterpret_cast<HANDLE>(pipe);
+    HANDLE event = IoEvent();
+    OVERLAPPED ov = MakeOverlapped(event);
+    DWORD got = 0;
+    BOOL started = ReadFile(h, buffer, size, nullptr, &ov);
+    bool ok = Finish(h, &ov, event, started, &got, reinterpret_cast<HANDLE>(stop));
+    *read = got;
+    return ok;
+}
+
+std::string RuntimeReadyEventName(const std::string& vm_id, uint32_t process_id) {
+    return "Local\\tenbox_ready_" + vm_id + "_" + std::to_string(process_id);
+}
+
+}  // namespace ipc
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ipc {
+
+// Blocking I/O on a pipe opened with FILE_FLAG_OVERLAPPED, which does not
+// accept the synchronous forms. `stop`, if given, is an event that cancels
+// the I/O and fails the call once signaled. Completions of these calls
+// are never queued to a completion port the pipe is associated with.
+
+// Waits for a client on a server pipe.
+bool PipeConnect(void* pipe, void* stop = nullptr);
+// Writes all of `data`.
+bool PipeWrite(void* pipe, const void* data, size_t size, void* stop = nullptr);
+// Reads what is available, waiting for at least one byte. False once the
+// pipe is broken or `stop` is signaled.
+bool PipeRead(void* pipe, void* buffer, uint32_t size, uint32_t* read, void* stop = nullptr);
+
+// Event a runtime sets once its control pipe exists and a client can
+// open it. The manager creates it before the process runs and waits on it,
+// with the process handle, instead of polling for the pipe.
+std::string RuntimeReadyEventName(const std::string& vm_id, uint32_t process_id);
+
+}  // namespace ipc
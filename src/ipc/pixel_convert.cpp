@@ -0,0 +1,108 @@
+#include "ipc/pixel_convert.h"
+
+#include <intrin.h>
+
+#include <cstring>
+
+namespace ipc {
+
+namespace {
+
+// Source byte for each destination byte B, G, R, A, per order.
+constexpr uint8_t kSwizzle[][4] = {
+    {0, 1, 2, 3},  // kBgra
+    {3, 2, 1, 0},  // kArgb
+    {2, 1, 0, 3},  // kRgba
+    {1, 2, 3, 0},  // kAbgr
+};
+
+struct CpuFeatures {
+    bool ssse3 = false;
+    bool avx2 = false;
+};
+
+const CpuFeatures& Cpu() {
+    static const CpuFeatures features = [] {
+        CpuFeatures f;
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        f.ssse3 = (info[2] & (1 << 9)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        // The OS must save YMM state as well.
+        if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            f.avx2 = (info[1] & (1 << 5)) != 0;
+        }
+        return f;
+    }();
+    return features;
+}
+
+// The pshufb control for four pixels; AVX2 repeats it in both lanes, as
+// its shuffle never crosses one.
+__m128i ShuffleMask(PixelOrder order) {
+    alignas(16) uint8_t mask[16];
+    const uint8_t* s = kSwizzle[static_cast<size_t>(order)];
+    for (int px = 0; px < 4; ++px) {
+        for (int b = 0; b < 4; ++b) mask[px * 4 + b] = static_cast<uint8_t>(px * 4 + s[b]);
+    }
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+}
+
+size_t ConvertAvx2(__m128i mask128, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    __m256i mask = _mm256_broadcastsi128_si256(mask128);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4),
+                            _mm256_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+size_t ConvertSsse3(__m128i mask, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+}  // namespace
+
+void ConvertToBgra(PixelOrder order, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    if (order == PixelOrder::kBgra) {
+        if (src != dst) std::memmove(dst, src, pixels * 4);
+        return;
+    }
+
+    size_t done = 0;
+    const CpuFeatures& cpu = Cpu();
+    if (cpu.ssse3) {
+        __m128i mask = ShuffleMask(order);
+        if (cpu.avx2) done = ConvertAvx2(mask, src, dst, pixels);
+        done += ConvertSsse3(mask, src + done * 4, dst + done * 4, pixels - done);
+    }
+
+    // The tail, and CPUs without SSSE3.
+    ConvertToBgraScalar(order, src + done * 4, dst + done * 4, pixels - done);
+}
+
+void ConvertToBgraScalar(PixelOrder order, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    const uint8_t* s = kSwizzle[static_cast<size_t>(order)];
+    for (size_t i = 0; i < pixels; ++i) {
+        uint8_t px[4];
+        std::memcpy(px, src + i * 4, 4);
+        uint8_t* out = dst + i * 4;
+        out[0] = px[s[0]];
+        out[1] = px[s[1]];
+        out[2] = px[s[2]];
+        out[3] = px[s[3]];
+    }
+}
+
+}  // namespace ipc
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ipc {
+
+// Byte order of a 32bpp guest pixel in memory. Shared framebuffers hold
+// kBgra, which both GDI's 32-bit BI_RGB and the presenter's B8G8R8A8
+// texture take as they are. For the X formats the padding byte lands in
+// the alpha slot, where neither looks at it.
+enum class PixelOrder : uint8_t {
+    kBgra,
+    kArgb,
+    kRgba,
+    kAbgr,
+};
+
+// Converts `pixels` pixels from `order` to kBgra with one byte shuffle per
+// 16 or 32 bytes (SSSE3 / AVX2, by what the CPU has). `src` and `dst` may
+// be the same buffer; kBgra is a plain copy.
+void ConvertToBgra(PixelOrder order, const uint8_t* src, uint8_t* dst, size_t pixels);
+
+// The same one pixel at a time; ConvertToBgra's tail, and what tests hold
+// the vector paths to.
+void ConvertToBgraScalar(PixelOrder order, const uint8_t* src, uint8_t* dst, size_t pixels);
+
+}  // namespace ipc
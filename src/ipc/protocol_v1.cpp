@@ -127,6 +127,13 @@ std::string EncodeHeader(const Message& message) {
     for (const auto& [key, value] : message.fields) {
         oss << '\t' << Escape(key) << '=' << Escape(value);
     }
+    if (!std::holds_alternative<std::monostate>(message.body)) {
+        MessageFields body_fields;
+        BodyToFields(message.body, &body_fields);
+        for (const auto& [key, value] : body_fields) {
+            oss << '\t' << Escape(key) << '=' << Escape(value);
+        }
+    }
 
     if (!message.payload.empty()) {
         oss << '\t' << "payload_size=" << message.payload.size();
@@ -191,12 +198,13 @@ std::optional<Message> Decode(const std::string& raw) {
         }
     }
 
-    if (message.version != kProtocolVersion) {
+    if (message.version != kTextProtocolVersion) {
         return std::nullopt;
     }
     if (message.type.empty()) {
         return std::nullopt;
     }
+    BodyFromFields(message.type, &message.fields, &message.body);
     return message;
 }
 
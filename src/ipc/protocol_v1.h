@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ipc/message_body.h"
+
 #include <cstdint>
 #include <optional>
 #include <string>
@@ -8,7 +10,12 @@
 
 namespace ipc {
 
-static constexpr uint32_t kProtocolVersion = 1;
+// Version 1 is the text format below, version 2 the binary one in
+// protocol_v2.h. kProtocolVersion is the newest this build speaks; peers
+// start in text and move up once both have said they can (see
+// runtime.state and runtime.set_protocol). Decoding accepts either.
+static constexpr uint32_t kProtocolVersion = 2;
+static constexpr uint32_t kTextProtocolVersion = 1;
 
 enum class Channel : uint8_t {
     kControl = 0,
@@ -26,13 +33,15 @@ enum class Kind : uint8_t {
 };
 
 struct Message {
-    uint32_t version = kProtocolVersion;
+    uint32_t version = kTextProtocolVersion;
     Channel channel = Channel::kControl;
     Kind kind = Kind::kRequest;
     std::string type;
     std::string vm_id;
     uint64_t request_id = 0;
-    std::unordered_map<std::string, std::string> fields;
+    MessageFields fields;
+    // Typed body of the types that have one (message_body.h).
+    MessageBody body;
     std::vector<uint8_t> payload;
 };
 
@@ -0,0 +1,218 @@
+#include "ipc/protocol_v2.h"
+#include "ipc/etw.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace ipc {
+namespace {
+
+// Buffers are dropped from the front once this much has been consumed.
+constexpr size_t kCompactThreshold = 64 * 1024;
+
+template <typename T>
+void Append(std::string* out, T value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+class BodyReader {
+public:
+    BodyReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+    bool Read(void* out, size_t len) {
+        if (size_ - pos_ < len) return false;
+        std::memcpy(out, data_ + pos_, len);
+        pos_ += len;
+        return true;
+    }
+    bool ReadString(size_t len, std::string* out) {
+        if (size_ - pos_ < len) return false;
+        out->assign(data_ + pos_, len);
+        pos_ += len;
+        return true;
+    }
+    bool AtEnd() const { return pos_ == size_; }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+std::string EncodeBinary(const Message& message, uint16_t type_id) {
+    const void* body = nullptr;
+    size_t body_bytes = 0;
+    BodyBytes(message.body, &body, &body_bytes);
+
+    BinaryHeader hdr{};
+    hdr.magic = kBinaryMagic;
+    hdr.version = 2;
+    hdr.channel = static_cast<uint8_t>(message.channel);
+    hdr.kind = static_cast<uint8_t>(message.kind);
+    hdr.type_id = type_id;
+    hdr.type_name_size = type_id ? 0 : static_cast<uint8_t>(message.type.size());
+    hdr.vm_id_size = static_cast<uint8_t>(message.vm_id.size());
+    hdr.request_id = message.request_id;
+
+    size_t fields_bytes = sizeof(uint16_t);
+    for (const auto& [key, value] : message.fields) {
+        fields_bytes += sizeof(uint16_t) + key.size() + sizeof(uint32_t) + value.size();
+    }
+    hdr.body_size = static_cast<uint32_t>(hdr.type_name_size + hdr.vm_id_size +
+                                          body_bytes + fields_bytes);
+    hdr.payload_size = static_cast<uint32_t>(message.payload.size());
+
+    std::string out;
+    out.reserve(sizeof(hdr) + hdr.body_size + hdr.payload_size);
+    Append(&out, hdr);
+    if (!type_id) out.append(message.type);
+    out.append(message.vm_id);
+    out.append(static_cast<const char*>(body), body_bytes);
+    Append(&out, static_cast<uint16_t>(message.fields.size()));
+    for (const auto& [key, value] : message.fields) {
+        Append(&out, static_cast<uint16_t>(key.size()));
+        out.append(key);
+        Append(&out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+    out.append(reinterpret_cast<const char*>(message.payload.data()), message.payload.size());
+    return out;
+}
+
+bool DecodeBinary(const BinaryHeader& hdr, const char* data, Message* out) {
+    if (hdr.version != 2 ||
+        hdr.channel > static_cast<uint8_t>(Channel::kClipboard) ||
+        hdr.kind > static_cast<uint8_t>(Kind::kEvent)) {
+        return false;
+    }
+    out->version = hdr.version;
+    out->channel = static_cast<Channel>(hdr.channel);
+    out->kind = static_cast<Kind>(hdr.kind);
+    out->request_id = hdr.request_id;
+
+    BodyReader in(data, hdr.body_size);
+    if (hdr.type_id) {
+        const char* name = MessageTypeName(hdr.type_id);
+        if (!name) return false;
+        out->type = name;
+    } else if (!in.ReadString(hdr.type_name_size, &out->type) || out->type.empty()) {
+        return false;
+    }
+    if (!in.ReadString(hdr.vm_id_size, &out->vm_id)) return false;
+
+    ResetBody(hdr.type_id, &out->body);
+    size_t body_bytes = 0;
+    void* body = MutableBodyBytes(&out->body, &body_bytes);
+    if (body_bytes && !in.Read(body, body_bytes)) return false;
+
+    out->fields.clear();
+    uint16_t count = 0;
+    if (!in.Read(&count, sizeof(count))) return false;
+    for (uint16_t i = 0; i < count; ++i) {
+        uint16_t key_size = 0;
+        uint32_t value_size = 0;
+        std::string key, value;
+        if (!in.Read(&key_size, sizeof(key_size)) || !in.ReadString(key_size, &key) ||
+            !in.Read(&value_size, sizeof(value_size)) || !in.ReadString(value_size, &value)) {
+            return false;
+        }
+        out->fields.emplace(std::move(key), std::move(value));
+    }
+    if (!in.AtEnd()) return false;
+
+    const auto* payload = reinterpret_cast<const uint8_t*>(data + hdr.body_size);
+    out->payload.assign(payload, payload + hdr.payload_size);
+    return true;
+}
+
+}  // namespace
+
+std::string Encode(const Message& message, uint32_t version) {
+    std::string out;
+    if (version < 2 || message.type.size() > 0xFF || message.vm_id.size() > 0xFF) {
+        out = Encode(message);
+    } else {
+        // A body that does not belong to the type could not be told apart
+        // on the other end; the text form spells it out instead.
+        uint16_t type_id = MessageTypeId(message.type);
+        MessageBody expected;
+        ResetBody(type_id, &expected);
+        out = expected.index() == message.body.index() ? EncodeBinary(message, type_id)
+                                                       : Encode(message);
+    }
+    if (etw::Enabled(etw::kKeywordMessage)) {
+        etw::MessageSent(static_cast<uint8_t>(message.channel), message.type, out.size());
+    }
+    return out;
+}
+
+void StreamDecoder::Append(const char* data, size_t size) {
+    if (pos_ == buffer_.size()) {
+        buffer_.clear();
+        pos_ = 0;
+    } else if (pos_ >= kCompactThreshold) {
+        buffer_.erase(0, pos_);
+        pos_ = 0;
+    }
+    buffer_.append(data, size);
+}
+
+bool StreamDecoder::Next(Message* out) {
+    if (!TakeNext(out)) return false;
+    if (etw::Enabled(etw::kKeywordMessage)) {
+        etw::MessageReceived(static_cast<uint8_t>(out->channel), out->type, out->payload.size());
+    }
+    return true;
+}
+
+bool StreamDecoder::TakeNext(Message* out) {
+    while (pos_ < buffer_.size()) {
+        const char* p = buffer_.data() + pos_;
+        size_t avail = buffer_.size() - pos_;
+
+        if (have_pending_) {
+            if (avail < pending_payload_) return false;
+            pending_.payload.assign(reinterpret_cast<const uint8_t*>(p),
+                                    reinterpret_cast<const uint8_t*>(p) + pending_payload_);
+            pos_ += pending_payload_;
+            have_pending_ = false;
+            *out = std::move(pending_);
+            return true;
+        }
+
+        if (static_cast<uint8_t>(p[0]) == kBinaryMagic) {
+            if (avail < sizeof(BinaryHeader)) return false;
+            BinaryHeader hdr;
+            std::memcpy(&hdr, p, sizeof(hdr));
+            size_t total = sizeof(hdr) + static_cast<size_t>(hdr.body_size) + hdr.payload_size;
+            if (avail < total) return false;
+            pos_ += total;
+            if (DecodeBinary(hdr, p + sizeof(hdr), out)) return true;
+            continue;
+        }
+
+        // Version 1: a header line, then payload_size raw bytes.
+        const void* nl = std::memchr(p, '\n', avail);
+        if (!nl) return false;
+        size_t line_size = static_cast<const char*>(nl) - p + 1;
+        auto decoded = Decode(std::string(p, line_size));
+        pos_ += line_size;
+        if (!decoded) continue;
+
+        auto ps_it = decoded->fields.find("payload_size");
+        if (ps_it != decoded->fields.end()) {
+            pending_payload_ = std::strtoull(ps_it->second.c_str(), nullptr, 10);
+            decoded->fields.erase(ps_it);
+            if (pending_payload_ > 0) {
+                pending_ = std::move(*decoded);
+                have_pending_ = true;
+                continue;
+            }
+        }
+        *out = std::move(*decoded);
+        return true;
+    }
+    return false;
+}
+
+}  // namespace ipc
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ipc/protocol_v1.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ipc {
+
+// Protocol v2: one fixed binary header, then
+//   type name         (type_name_size bytes, only when type_id is 0)
+//   vm_id             (vm_id_size bytes)
+//   typed body        (the MessageBody struct of type_id, if it has one)
+//   fields            u16 count, then u16 key size, key, u32 value size, value
+//   payload           (payload_size bytes)
+// All integers little-endian. Decoding a frame or input event is a header
+// copy and a struct copy; there is nothing to scan for or convert.
+#pragma pack(push, 1)
+struct BinaryHeader {
+    uint8_t magic;           // kBinaryMagic, which never starts a v1 header line
+    uint8_t version;         // 2
+    uint8_t channel;
+    uint8_t kind;
+    uint16_t type_id;        // MessageTypeId(); 0 = sent by name
+    uint8_t type_name_size;
+    uint8_t vm_id_size;
+    uint64_t request_id;
+    uint32_t body_size;      // everything between the header and the payload
+    uint32_t payload_size;
+};
+#pragma pack(pop)
+static_assert(sizeof(BinaryHeader) == 24, "BinaryHeader is part of the wire format");
+
+static constexpr uint8_t kBinaryMagic = 0xB2;
+
+// Encodes `message` as `version` (1 or 2). Messages v2 cannot carry (names
+// over 255 bytes) go out as v1, which the peer decodes all the same.
+std::string Encode(const Message& message, uint32_t version);
+
+// Splits a pipe's byte stream into messages of either version.
+class StreamDecoder {
+public:
+    void Append(const char* data, size_t size);
+    // Takes the next complete message into `out`, reusing its buffers.
+    // Malformed messages are skipped. False once more bytes are needed.
+    bool Next(Message* out);
+
+private:
+    bool TakeNext(Message* out);
+
+    std::string buffer_;
+    size_t pos_ = 0;              // bytes of buffer_ already consumed
+    // A v1 header whose payload_size bytes have not all arrived.
+    bool have_pending_ = false;
+    size_t pending_payload_ = 0;
+    Message pending_;
+};
+
+}  // namespace ipc
@@ -0,0 +1,120 @@
+#include "ipc/shared_framebuffer.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace ipc {
+
+SharedFramebuffer::~SharedFramebuffer() {
+    Close();
+}
+
+bool SharedFramebuffer::Create(const std::string& name, uint32_t width, uint32_t height) {
+    Close();
+    if (width == 0 || height == 0) return false;
+    uint64_t size = static_cast<uint64_t>(width) * height * kBytesPerPixel;
+    HANDLE mapping = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name.c_str());
+    if (!mapping) return false;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return false;
+    }
+    return Map(mapping, name, width, height, true);
+}
+
+bool SharedFramebuffer::Open(const std::string& name, uint32_t width, uint32_t height) {
+    Close();
+    if (width == 0 || height == 0) return false;
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    if (!mapping) return false;
+    return Map(mapping, name, width, height, false);
+}
+
+void SharedFramebuffer::CreatePrivate(uint32_t width, uint32_t height) {
+    Close();
+    if (width == 0 || height == 0) return;
+    private_ = std::make_unique<uint8_t[]>(static_cast<size_t>(width) * height * kBytesPerPixel);
+    view_ = private_.get();
+    width_ = width;
+    height_ = height;
+}
+
+bool SharedFramebuffer::Map(void* mapping, const std::string& name, uint32_t width,
+                            uint32_t height, bool writable) {
+    size_t size = static_cast<size_t>(width) * height * kBytesPerPixel;
+    void* view = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                               0, 0, size);
+    if (!view) {
+        CloseHandle(mapping);
+        return false;
+    }
+    // A section opened by name may be smaller than the caller expects.
+    MEMORY_BASIC_INFORMATION info{};
+    if (!VirtualQuery(view, &info, sizeof(info)) || info.RegionSize < size) {
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        return false;
+    }
+    mapping_ = mapping;
+    view_ = static_cast<uint8_t*>(view);
+    name_ = name;
+    width_ = width;
+    height_ = height;
+    return true;
+}
+
+void SharedFramebuffer::Close() {
+    if (mapping_) {
+        UnmapViewOfFile(view_);
+        CloseHandle(reinterpret_cast<HANDLE>(mapping_));
+    }
+    private_.reset();
+    view_ = nullptr;
+    mapping_ = nullptr;
+    name_.clear();
+    width_ = 0;
+    height_ = 0;
+}
+
+void SharedFramebuffer::WriteRect(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                                  const uint8_t* src, size_t src_stride, PixelOrder order) {
+    if (!view_ || x >= width_ || y >= height_) return;
+    size_t row_bytes = static_cast<size_t>(std::min(w, width_ - x)) * kBytesPerPixel;
+    h = std::min(h, height_ - y);
+    for (uint32_t row = 0; row < h; ++row) {
+        size_t src_off = row * src_stride;
+        uint8_t* dst = view_ + static_cast<size_t>(y + row) * stride() + x * kBytesPerPixel;
+        if (order == PixelOrder::kBgra) {
+            std::memcpy(dst, src + src_off, row_bytes);
+        } else {
+            ConvertToBgra(order, src + src_off, dst, row_bytes / kBytesPerPixel);
+        }
+    }
+}
+
+void SharedFramebuffer::ReadRect(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                                 uint8_t* dst, size_t dst_len) const {
+    if (!view_ || x >= width_ || y >= height_) return;
+    size_t dst_stride = static_cast<size_t>(w) * kBytesPerPixel;
+    size_t row_bytes = static_cast<size_t>(std::min(w, width_ - x)) * kBytesPerPixel;
+    h = std::min(h, height_ - y);
+    for (uint32_t row = 0; row < h; ++row) {
+        size_t dst_off = row * dst_stride;
+        if (dst_off + row_bytes > dst_len) break;
+        std::memcpy(dst + dst_off,
+                    view_ + static_cast<size_t>(y + row) * stride() + x * kBytesPerPixel,
+                    row_bytes);
+    }
+}
+
+std::string SharedFramebufferName(const std::string& vm_id, uint32_t scanout_id,
+                                  uint32_t generation) {
+    return "Local\\tenbox_fb_" + vm_id + "_" + std::to_string(scanout_id) + "_" +
+           std::to_string(generation);
+}
+
+}  // namespace ipc
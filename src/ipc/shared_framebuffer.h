@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ipc/pixel_convert.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace ipc {
+
+// A 32bpp scanout surface in a named file mapping. The runtime creates it
+// and writes guest pixels in place; display.frame events then carry only
+// the dirty rectangle and the section name, and the manager reads the
+// rectangle straight out of its read-only view.
+class SharedFramebuffer {
+public:
+    static constexpr uint32_t kBytesPerPixel = 4;
+
+    SharedFramebuffer() = default;
+    ~SharedFramebuffer();
+
+    SharedFramebuffer(const SharedFramebuffer&) = delete;
+    SharedFramebuffer& operator=(const SharedFramebuffer&) = delete;
+
+    // Runtime side: creates a new section.
+    bool Create(const std::string& name, uint32_t width, uint32_t height);
+    // Manager side: maps an existing section read-only.
+    bool Open(const std::string& name, uint32_t width, uint32_t height);
+    // Process-private surface with the same interface, for when no
+    // section can be created.
+    void CreatePrivate(uint32_t width, uint32_t height);
+    void Close();
+
+    bool IsOpen() const { return view_ != nullptr; }
+    bool IsShared() const { return mapping_ != nullptr; }
+    const std::string& name() const { return name_; }
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    uint32_t stride() const { return width_ * kBytesPerPixel; }
+    uint8_t* data() const { return view_; }
+
+    // Copies a `w` x `h` rectangle with rows `src_stride` apart in at
+    // (x, y), clipped to the surface, converting it from `order` on the way.
+    void WriteRect(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                   const uint8_t* src, size_t src_stride,
+                   PixelOrder order = PixelOrder::kBgra);
+    // Copies the rectangle at (x, y) out, tightly packed; clipped likewise.
+    void ReadRect(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                  uint8_t* dst, size_t dst_len) const;
+
+private:
+    bool Map(void* mapping, const std::string& name, uint32_t width,
+             uint32_t height, bool writable);
+
+    void* mapping_ = nullptr;
+    uint8_t* view_ = nullptr;
+    std::unique_ptr<uint8_t[]> private_;
+    std::string name_;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+};
+
+// Section name for one scanout surface of a VM. The generation changes
+// with the surface size, so a resize never reuses a section still mapped
+// at the old size.
+std::string SharedFramebufferName(const std::string& vm_id, uint32_t scanout_id,
+                                  uint32_t generation);
+
+}  // namespace ipc
@@ -93,6 +93,13 @@ AppSettings LoadSettings(const std::string& data_dir) {
         if (j.contains("show_toolbar") && j["show_toolbar"].is_boolean()) {
             s.show_toolbar = j["show_toolbar"].get<bool>();
         }
+        if (j.contains("audio_latency_ms") && j["audio_latency_ms"].is_number_unsigned()) {
+            s.audio_latency_ms = j["audio_latency_ms"].get<uint32_t>();
+        }
+        if (j.contains("max_concurrent_starts") &&
+            j["max_concurrent_starts"].is_number_unsigned()) {
+            s.max_concurrent_starts = j["max_concurrent_starts"].get<uint32_t>();
+        }
         if (j.contains("vm_paths") && j["vm_paths"].is_array()) {
             auto default_storage = DefaultVmStorageDir();
             for (auto& item : j["vm_paths"]) {
@@ -135,6 +142,8 @@ void SaveSettings(const std::string& data_dir, const AppSettings& s) {
     json j;
     j["window"]       = w;
     j["show_toolbar"] = s.show_toolbar;
+    j["audio_latency_ms"] = s.audio_latency_ms;
+    j["max_concurrent_starts"] = s.max_concurrent_starts;
     j["vm_paths"]     = vm_paths_json;
 
     auto path = fs::path(data_dir) / "settings.json";
@@ -160,8 +169,45 @@ bool LoadVmManifest(const std::string& vm_dir, VmSpec& spec) {
         if (j.contains("name"))      spec.name      = j["name"].get<std::string>();
         if (j.contains("cmdline"))   spec.cmdline   = j["cmdline"].get<std::string>();
         if (j.contains("memory_mb")) spec.memory_mb = j["memory_mb"].get<uint64_t>();
+        if (j.contains("max_memory_mb")) spec.max_memory_mb = j["max_memory_mb"].get<uint64_t>();
+        if (j.contains("lazy_memory")) spec.lazy_memory = j["lazy_memory"].get<bool>();
+        if (j.contains("large_pages")) spec.large_pages = j["large_pages"].get<bool>();
+        if (j.contains("page_dedup_interval_s")) spec.page_dedup_interval_s = j["page_dedup_interval_s"].get<uint32_t>();
+        if (j.contains("suspend_snapshot")) spec.suspend_snapshot = j["suspend_snapshot"].get<std::string>();
+        if (j.contains("template_snapshot")) spec.template_snapshot = j["template_snapshot"].get<std::string>();
+        if (j.contains("forked_from")) spec.forked_from = j["forked_from"].get<std::string>();
+        if (j.contains("fork_snapshot")) spec.fork_snapshot = j["fork_snapshot"].get<std::string>();
         if (j.contains("cpu_count")) spec.cpu_count = j["cpu_count"].get<uint32_t>();
+        if (j.contains("max_cpu_count")) spec.max_cpu_count = j["max_cpu_count"].get<uint32_t>();
+        if (j.contains("vcpu_placement")) spec.vcpu_placement = j["vcpu_placement"].get<std::string>();
+        if (j.contains("numa_memory")) spec.numa_memory = j["numa_memory"].get<std::string>();
+        if (j.contains("x2apic")) spec.x2apic = j["x2apic"].get<bool>();
+        if (j.contains("pmu")) spec.pmu = j["pmu"].get<bool>();
+        if (j.contains("io_threads")) spec.io_threads = j["io_threads"].get<uint32_t>();
+        if (j.contains("device_io_threads") && j["device_io_threads"].is_object()) {
+            for (auto& [device, index] : j["device_io_threads"].items()) {
+                if (index.is_number_unsigned()) {
+                    spec.device_io_threads[device] = index.get<uint32_t>();
+                }
+            }
+        }
         if (j.contains("nat_enabled")) spec.nat_enabled = j["nat_enabled"].get<bool>();
+        if (j.contains("disk_direct_io")) spec.disk_direct_io = j["disk_direct_io"].get<bool>();
+        if (j.contains("disk_mmap")) spec.disk_mmap = j["disk_mmap"].get<bool>();
+        if (j.contains("qcow2_l2_cache_mb")) spec.qcow2_l2_cache_mb = j["qcow2_l2_cache_mb"].get<uint64_t>();
+        if (j.contains("qcow2_compressed_cache_mb")) spec.qcow2_compressed_cache_mb = j["qcow2_compressed_cache_mb"].get<uint64_t>();
+        if (j.contains("disk_readahead_kb")) spec.disk_readahead_kb = j["disk_readahead_kb"].get<uint32_t>();
+        if (j.contains("disk_boot_profile_s")) spec.disk_boot_profile_s = j["disk_boot_profile_s"].get<uint32_t>();
+        if (j.contains("disk_iops_limit")) spec.disk_iops_limit = j["disk_iops_limit"].get<uint32_t>();
+        if (j.contains("disk_iops_burst")) spec.disk_iops_burst = j["disk_iops_burst"].get<uint32_t>();
+        if (j.contains("disk_mbps_limit")) spec.disk_mbps_limit = j["disk_mbps_limit"].get<uint32_t>();
+        if (j.contains("disk_burst_mb")) spec.disk_burst_mb = j["disk_burst_mb"].get<uint32_t>();
+        if (j.contains("irq_coalesce_us")) spec.irq_coalesce_us = j["irq_coalesce_us"].get<uint32_t>();
+        if (j.contains("irq_coalesce_frames")) spec.irq_coalesce_frames = j["irq_coalesce_frames"].get<uint32_t>();
+        if (j.contains("virtio_pci")) spec.virtio_pci = j["virtio_pci"].get<bool>();
+        if (j.contains("hvc_console")) spec.hvc_console = j["hvc_console"].get<bool>();
+        if (j.contains("display_fps")) spec.display_fps = j["display_fps"].get<uint32_t>();
+        if (j.contains("display_count")) spec.display_count = j["display_count"].get<uint32_t>();
 
         // Resolve relative paths to absolute
         auto Resolve = [&](const char* key) -> std::string {
@@ -185,6 +231,28 @@ bool LoadVmManifest(const std::string& vm_dir, VmSpec& spec) {
             }
         }
 
+        if (j.contains("net_rate_limit") && j["net_rate_limit"].is_object()) {
+            const auto& limit = j["net_rate_limit"];
+            spec.net_rate_limit.rx_mbps = limit.value("rx_mbps", 0u);
+            spec.net_rate_limit.tx_mbps = limit.value("tx_mbps", 0u);
+            spec.net_rate_limit.burst_kb = limit.value("burst_kb", 0u);
+        }
+
+        if (j.contains("vsock")) spec.vsock = j["vsock"].get<bool>();
+        if (j.contains("vsock_forwards") && j["vsock_forwards"].is_array()) {
+            for (auto& item : j["vsock_forwards"]) {
+                if (item.contains("host_port") && item.contains("vsock_port")) {
+                    VsockForward f{};
+                    f.host_port = item["host_port"].get<uint16_t>();
+                    f.vsock_port = item["vsock_port"].get<uint32_t>();
+                    if (item.contains("guest_connects")) {
+                        f.guest_connects = item["guest_connects"].get<bool>();
+                    }
+                    spec.vsock_forwards.push_back(f);
+                }
+            }
+        }
+
         if (j.contains("shared_folders") && j["shared_folders"].is_array()) {
             for (auto& item : j["shared_folders"]) {
                 if (item.contains("tag") && item.contains("host_path")) {
@@ -194,6 +262,9 @@ bool LoadVmManifest(const std::string& vm_dir, VmSpec& spec) {
                     if (item.contains("readonly")) {
                         sf.readonly = item["readonly"].get<bool>();
                     }
+                    if (item.contains("writeback")) {
+                        sf.writeback = item["writeback"].get<bool>();
+                    }
                     spec.shared_folders.push_back(std::move(sf));
                 }
             }
@@ -222,9 +293,40 @@ void SaveVmManifest(const VmSpec& spec) {
     j["kernel"]      = MakeRelative(spec.kernel_path);
     j["initrd"]      = MakeRelative(spec.initrd_path);
     j["disk"]        = MakeRelative(spec.disk_path);
+    j["disk_direct_io"] = spec.disk_direct_io;
+    j["disk_mmap"] = spec.disk_mmap;
+    j["qcow2_l2_cache_mb"] = spec.qcow2_l2_cache_mb;
+    j["qcow2_compressed_cache_mb"] = spec.qcow2_compressed_cache_mb;
+    j["disk_readahead_kb"] = spec.disk_readahead_kb;
+    j["disk_boot_profile_s"] = spec.disk_boot_profile_s;
+    j["disk_iops_limit"] = spec.disk_iops_limit;
+    j["disk_iops_burst"] = spec.disk_iops_burst;
+    j["disk_mbps_limit"] = spec.disk_mbps_limit;
+    j["disk_burst_mb"] = spec.disk_burst_mb;
+    j["irq_coalesce_us"] = spec.irq_coalesce_us;
+    j["irq_coalesce_frames"] = spec.irq_coalesce_frames;
+    j["virtio_pci"] = spec.virtio_pci;
+    j["hvc_console"] = spec.hvc_console;
+    j["display_fps"] = spec.display_fps;
+    j["display_count"] = spec.display_count;
     j["cmdline"]     = spec.cmdline;
     j["memory_mb"]   = spec.memory_mb;
+    if (spec.max_memory_mb) j["max_memory_mb"] = spec.max_memory_mb;
+    j["lazy_memory"] = spec.lazy_memory;
+    j["large_pages"] = spec.large_pages;
+    j["page_dedup_interval_s"] = spec.page_dedup_interval_s;
+    if (!spec.suspend_snapshot.empty()) j["suspend_snapshot"] = spec.suspend_snapshot;
+    if (!spec.template_snapshot.empty()) j["template_snapshot"] = spec.template_snapshot;
+    if (!spec.forked_from.empty()) j["forked_from"] = spec.forked_from;
+    if (!spec.fork_snapshot.empty()) j["fork_snapshot"] = spec.fork_snapshot;
     j["cpu_count"]   = spec.cpu_count;
+    if (spec.max_cpu_count) j["max_cpu_count"] = spec.max_cpu_count;
+    if (!spec.vcpu_placement.empty()) j["vcpu_placement"] = spec.vcpu_placement;
+    if (!spec.numa_memory.empty()) j["numa_memory"] = spec.numa_memory;
+    j["x2apic"] = spec.x2apic;
+    j["pmu"] = spec.pmu;
+    j["io_threads"] = spec.io_threads;
+    if (!spec.device_io_threads.empty()) j["device_io_threads"] = spec.device_io_threads;
     j["nat_enabled"] = spec.nat_enabled;
 
     json fwds = json::array();
@@ -233,12 +335,27 @@ void SaveVmManifest(const VmSpec& spec) {
     }
     j["port_forwards"] = fwds;
 
+    j["net_rate_limit"] = {
+        {"rx_mbps", spec.net_rate_limit.rx_mbps},
+        {"tx_mbps", spec.net_rate_limit.tx_mbps},
+        {"burst_kb", spec.net_rate_limit.burst_kb}
+    };
+
+    j["vsock"] = spec.vsock;
+    json vsock_fwds = json::array();
+    for (const auto& f : spec.vsock_forwards) {
+        vsock_fwds.push_back({{"host_port", f.host_port}, {"vsock_port", f.vsock_port},
+                              {"guest_connects", f.guest_connects}});
+    }
+    j["vsock_forwards"] = vsock_fwds;
+
     json shared = json::array();
     for (const auto& sf : spec.shared_folders) {
         shared.push_back({
             {"tag", sf.tag},
             {"host_path", sf.host_path},
-            {"readonly", sf.readonly}
+            {"readonly", sf.readonly},
+            {"writeback", sf.writeback}
         });
     }
     j["shared_folders"] = shared;
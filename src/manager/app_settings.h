@@ -20,6 +20,10 @@ struct AppSettings {
     WindowGeometry window;
     std::vector<std::string> vm_paths;
     bool show_toolbar = true;
+    // Audio latency aimed for end to end, device buffer included.
+    uint32_t audio_latency_ms = 40;
+    // VMs StartVms launches at once; more would all be reading disk to boot.
+    uint32_t max_concurrent_starts = 4;
 };
 
 AppSettings LoadSettings(const std::string& data_dir);
@@ -1,14 +1,17 @@
 #include "manager/manager_service.h"
 #include "manager/app_settings.h"
+#include "ipc/etw.h"
 #include "version.h"
 
 #include "ui/win32/win32_ui_shell.h"
 using UiShell = Win32UiShell;
 
 #include <windows.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <string>
+#include <thread>
 #include <vector>
 
 static std::string ResolveDefaultRuntimeExePath() {
@@ -30,13 +33,17 @@ static std::string ResolveDefaultRuntimeExePath() {
 static void PrintUsage(const char* prog, const char* default_runtime) {
     fprintf(stderr,
         "TenBox manager v" TENBOX_VERSION "\n"
-        "Usage: %s [--runtime-exe <path>]\n"
-        "  --runtime-exe is optional. Default: %s\n",
+        "Usage: %s [--runtime-exe <path>] [--start <vm>]... [--start-all]\n"
+        "  --runtime-exe is optional. Default: %s\n"
+        "  --start starts a VM, by name or id, once the window is up; repeatable.\n"
+        "  --start-all starts every VM that is not a template.\n",
         prog, default_runtime);
 }
 
 int main(int argc, char* argv[]) {
     std::string runtime_exe = ResolveDefaultRuntimeExePath();
+    std::vector<std::string> start_vms;
+    bool start_all = false;
 
     for (int i = 1; i < argc; ++i) {
         auto Arg = [&](const char* flag) { return std::strcmp(argv[i], flag) == 0; };
@@ -47,6 +54,11 @@ int main(int argc, char* argv[]) {
         if (Arg("--runtime-exe")) {
             auto v = NextArg(); if (!v) return 1;
             runtime_exe = v;
+        } else if (Arg("--start")) {
+            auto v = NextArg(); if (!v) return 1;
+            start_vms.push_back(v);
+        } else if (Arg("--start-all")) {
+            start_all = true;
         } else if (Arg("--help") || Arg("-h")) {
             PrintUsage(argv[0], runtime_exe.c_str());
             return 0;
@@ -62,13 +74,14 @@ int main(int argc, char* argv[]) {
 
     std::string data_dir = settings::GetDataDir();
 
+    ipc::etw::RegisterProvider();
     ManagerService manager(runtime_exe, data_dir);
 
     // Set up clipboard callbacks for VM <-> Host clipboard sharing
     manager.SetClipboardGrabCallback([&](const std::string& vm_id, const std::vector<uint32_t>& types) {
         for (uint32_t type : types) {
             if (type == 1) {  // VD_AGENT_CLIPBOARD_UTF8_TEXT
-                manager.SendClipboardRequest(vm_id, type);
+                UiShell::OfferVmClipboard(vm_id);
                 break;
             }
         }
@@ -76,29 +89,8 @@ int main(int argc, char* argv[]) {
 
     manager.SetClipboardDataCallback([&](const std::string& vm_id, uint32_t type,
                                          const std::vector<uint8_t>& data) {
-        if (type == 1 && !data.empty()) {  // VD_AGENT_CLIPBOARD_UTF8_TEXT
-            UiShell::SetClipboardFromVm(true);
-            if (OpenClipboard(nullptr)) {
-                EmptyClipboard();
-                int wlen = MultiByteToWideChar(CP_UTF8, 0,
-                    reinterpret_cast<const char*>(data.data()),
-                    static_cast<int>(data.size()), nullptr, 0);
-                if (wlen > 0) {
-                    HGLOBAL hMem = GlobalAlloc(GMEM_MOVEABLE, (wlen + 1) * sizeof(wchar_t));
-                    if (hMem) {
-                        wchar_t* pMem = static_cast<wchar_t*>(GlobalLock(hMem));
-                        if (pMem) {
-                            MultiByteToWideChar(CP_UTF8, 0,
-                                reinterpret_cast<const char*>(data.data()),
-                                static_cast<int>(data.size()), pMem, wlen);
-                            pMem[wlen] = L'\0';
-                            GlobalUnlock(hMem);
-                            SetClipboardData(CF_UNICODETEXT, hMem);
-                        }
-                    }
-                }
-                CloseClipboard();
-            }
+        if (type == 1) {  // VD_AGENT_CLIPBOARD_UTF8_TEXT
+            UiShell::DeliverVmClipboard(vm_id, data);
         }
     });
 
@@ -127,11 +119,29 @@ int main(int argc, char* argv[]) {
         }
     });
 
+    std::vector<std::string> start_ids;
+    for (const auto& rec : manager.ListVms()) {
+        bool named = std::find_if(start_vms.begin(), start_vms.end(), [&](const std::string& v) {
+            return v == rec.spec.vm_id || v == rec.spec.name;
+        }) != start_vms.end();
+        if (named || (start_all && rec.spec.template_snapshot.empty())) {
+            start_ids.push_back(rec.spec.vm_id);
+        }
+    }
+
     UiShell ui(manager);
 
     ui.Show();
+    // In the background, so the window shows the VMs coming up. A jthread
+    // joins however this scope is left, before ui and manager go away.
+    std::jthread starter;
+    if (!start_ids.empty()) {
+        starter = std::jthread([&manager, start_ids]() { manager.StartVms(start_ids); });
+    }
     ui.Run();
 
+    if (starter.joinable()) starter.join();
     manager.ShutdownAll();
+    ipc::etw::UnregisterProvider();
     return 0;
 }
@@ -1,11 +1,15 @@
 #include "manager/manager_service.h"
 
 #include "core/vmm/types.h"
+#include "core/device/virtio/qcow2_create.h"
+#include "ipc/etw.h"
+#include "ipc/pipe_io.h"
 
 #include <windows.h>
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdio>
 #include <filesystem>
 #include <sstream>
@@ -15,37 +19,9 @@ namespace {
 
 namespace fs = std::filesystem;
 
-std::string EncodeHex(const uint8_t* data, size_t size) {
-    static constexpr char kDigits[] = "0123456789abcdef";
-    std::string out;
-    out.resize(size * 2);
-    for (size_t i = 0; i < size; ++i) {
-        out[2 * i]     = kDigits[(data[i] >> 4) & 0x0F];
-        out[2 * i + 1] = kDigits[data[i] & 0x0F];
-    }
-    return out;
-}
-
-std::string EncodeHex(const std::string& str) {
-    return EncodeHex(reinterpret_cast<const uint8_t*>(str.data()), str.size());
-}
-
-std::string DecodeHex(const std::string& value) {
-    auto hex = [](char ch) -> int {
-        if (ch >= '0' && ch <= '9') return ch - '0';
-        if (ch >= 'a' && ch <= 'f') return 10 + (ch - 'a');
-        if (ch >= 'A' && ch <= 'F') return 10 + (ch - 'A');
-        return -1;
-    };
-    if ((value.size() % 2) != 0) return {};
-    std::string out(value.size() / 2, '\0');
-    for (size_t i = 0; i < out.size(); ++i) {
-        int hi = hex(value[2 * i]);
-        int lo = hex(value[2 * i + 1]);
-        if (hi < 0 || lo < 0) return {};
-        out[i] = static_cast<char>((hi << 4) | lo);
-    }
-    return out;
+// Threads reading the runtime pipes; a handful serves dozens of VMs.
+uint32_t PipeIoThreads() {
+    return std::clamp(std::thread::hardware_concurrency() / 4, 2u, 4u);
 }
 
 std::string BuildRuntimeCommand(const std::string& exe, const VmSpec& spec, const std::string& pipe) {
@@ -60,21 +36,77 @@ std::string BuildRuntimeCommand(const std::string& exe, const VmSpec& spec, cons
     }
     if (!spec.disk_path.empty()) {
         cmd << " --disk \"" << spec.disk_path << '"';
+        if (spec.disk_direct_io) cmd << " --disk-direct-io";
+        if (spec.disk_mmap) cmd << " --disk-mmap";
+        if (spec.qcow2_l2_cache_mb) {
+            cmd << " --qcow2-l2-cache " << spec.qcow2_l2_cache_mb;
+        }
+        if (spec.qcow2_compressed_cache_mb) {
+            cmd << " --qcow2-compressed-cache " << spec.qcow2_compressed_cache_mb;
+        }
+        cmd << " --disk-readahead " << spec.disk_readahead_kb;
+        cmd << " --disk-boot-profile " << spec.disk_boot_profile_s;
+        if (spec.disk_iops_limit) {
+            cmd << " --disk-iops " << spec.disk_iops_limit << ':' << spec.disk_iops_burst;
+        }
+        if (spec.disk_mbps_limit) {
+            cmd << " --disk-mbps " << spec.disk_mbps_limit << ':' << spec.disk_burst_mb;
+        }
     }
     if (!spec.cmdline.empty()) {
         cmd << " --cmdline \"" << spec.cmdline << '"';
     }
     cmd << " --memory " << spec.memory_mb
-        << " --cpus " << spec.cpu_count;
+        << " --cpus " << spec.cpu_count
+        << " --irq-coalesce " << spec.irq_coalesce_us << ':' << spec.irq_coalesce_frames
+        << " --display-fps " << spec.display_fps
+        << " --displays " << spec.display_count;
+    if (spec.virtio_pci) cmd << " --virtio-pci";
+    if (spec.hvc_console) cmd << " --hvc-console";
+    if (spec.lazy_memory) cmd << " --lazy-memory";
+    if (spec.large_pages) cmd << " --large-pages";
+    if (spec.max_memory_mb > spec.memory_mb) cmd << " --max-memory " << spec.max_memory_mb;
+    if (spec.max_cpu_count > spec.cpu_count) cmd << " --max-cpus " << spec.max_cpu_count;
+    if (spec.page_dedup_interval_s) cmd << " --page-dedup " << spec.page_dedup_interval_s;
+    if (!spec.vcpu_placement.empty()) cmd << " --vcpu-placement " << spec.vcpu_placement;
+    if (!spec.numa_memory.empty()) cmd << " --numa-memory " << spec.numa_memory;
+    if (spec.x2apic) cmd << " --x2apic";
+    if (spec.pmu) cmd << " --pmu";
+    if (spec.io_threads) {
+        cmd << " --io-threads " << spec.io_threads;
+        for (const auto& [device, index] : spec.device_io_threads) {
+            cmd << " --io-thread " << device << '=' << index;
+        }
+    }
+    if (!spec.suspend_snapshot.empty()) {
+        cmd << " --restore \"" << (fs::path(spec.vm_dir) / spec.suspend_snapshot).string() << '"';
+    } else if (!spec.fork_snapshot.empty()) {
+        cmd << " --restore \"" << spec.fork_snapshot << '"';
+    }
     if (spec.nat_enabled) {
         cmd << " --net";
     }
     for (const auto& forward : spec.port_forwards) {
         cmd << " --forward " << forward.host_port << ':' << forward.guest_port;
     }
+    const NetRateLimit& limit = spec.net_rate_limit;
+    if (limit.rx_mbps || limit.tx_mbps) {
+        cmd << " --net-limit " << limit.rx_mbps << ':' << limit.tx_mbps << ':' << limit.burst_kb;
+    }
+    if (spec.vsock) {
+        cmd << " --vsock";
+        for (const auto& f : spec.vsock_forwards) {
+            if (f.guest_connects) {
+                cmd << " --vsock-connect " << f.vsock_port << ':' << f.host_port;
+            } else {
+                cmd << " --vsock-listen " << f.host_port << ':' << f.vsock_port;
+            }
+        }
+    }
     for (const auto& sf : spec.shared_folders) {
         cmd << " --share \"" << sf.tag << ':' << sf.host_path;
         if (sf.readonly) cmd << ":ro";
+        if (sf.writeback) cmd << ":wb";
         cmd << '"';
     }
     return cmd.str();
@@ -95,11 +127,52 @@ bool CopyFileChecked(const std::string& src, const std::string& dst, std::string
     return true;
 }
 
+// Longest a launched runtime may take to open its pipe. Waits end early
+// if it exits, so this only bounds a runtime that hangs while starting.
+constexpr DWORD kRuntimeReadyTimeoutMs = 30000;
+
+// Waits for a launched runtime to signal `ready`. False if it exited or
+// timed out first. Without an event EnsurePipeConnected polls as before.
+bool WaitRuntimeReady(HANDLE ready, HANDLE process) {
+    if (!ready) return true;
+    HANDLE handles[2] = {ready, process};
+    return WaitForMultipleObjects(process ? 2 : 1, handles, FALSE, kRuntimeReadyTimeoutMs) ==
+           WAIT_OBJECT_0;
+}
+
+// Host-wide page combines walk all of memory; one per interval is plenty.
+constexpr uint64_t kPageCombineIntervalMs = 5 * 60 * 1000;
+
+// "passes|resident|stable|zero|duplicate|shared|combined"
+bool ParseDedupStat(const std::string& value, VmDedupStat* out) {
+    unsigned long long v[7] = {};
+    if (std::sscanf(value.c_str(), "%llu|%llu|%llu|%llu|%llu|%llu|%llu",
+                    &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) != 7) {
+        return false;
+    }
+    *out = {v[0], v[1], v[2], v[3], v[4], v[5], v[6]};
+    return true;
+}
+
 }  // namespace
 
+bool ResizesLive(const VmRecord& vm, const VmMutablePatch& patch) {
+    if (patch.cpu_count &&
+        (!vm.max_cpu_count || *patch.cpu_count < 1 || *patch.cpu_count > vm.max_cpu_count)) {
+        return false;
+    }
+    if (patch.memory_mb &&
+        (!vm.max_memory_mb || *patch.memory_mb < vm.boot_memory_mb ||
+         *patch.memory_mb > vm.max_memory_mb)) {
+        return false;
+    }
+    return patch.cpu_count || patch.memory_mb;
+}
+
 ManagerService::ManagerService(std::string runtime_exe_path, std::string data_dir)
     : runtime_exe_path_(std::move(runtime_exe_path)),
-      data_dir_(std::move(data_dir)) {
+      data_dir_(std::move(data_dir)),
+      pipe_io_(PipeIoThreads()) {
     InitJobObject();
     settings_ = settings::LoadSettings(data_dir_);
     LoadVms();
@@ -125,7 +198,8 @@ void ManagerService::InitJobObject() {
 
 // ── VM lifecycle ─────────────────────────────────────────────────────
 
-bool ManagerService::CreateVm(const VmCreateRequest& req, std::string* error) {
+bool ManagerService::CreateVm(const VmCreateRequest& req, std::string* error,
+                              std::string* vm_id) {
     if (req.source_kernel.empty()) {
         if (error) *error = "kernel path is required";
         return false;
@@ -154,7 +228,16 @@ bool ManagerService::CreateVm(const VmCreateRequest& req, std::string* error) {
 
     if (!CopyFileChecked(req.source_kernel, dst_kernel, error)) return false;
     if (!CopyFileChecked(req.source_initrd, dst_initrd, error)) return false;
-    if (!CopyFileChecked(req.source_disk,   dst_disk,   error)) return false;
+    if (req.linked_clone && !req.source_disk.empty()) {
+        // The overlay names its base by absolute path, so the VM directory
+        // can live on any volume.
+        dst_disk = (fs::path(vm_dir) / "disk.qcow2").string();
+        std::string base = fs::absolute(req.source_disk, ec).string();
+        if (ec) base = req.source_disk;
+        if (!CreateQcow2Overlay(dst_disk, base, error)) return false;
+    } else if (!CopyFileChecked(req.source_disk, dst_disk, error)) {
+        return false;
+    }
 
     VmSpec spec;
     spec.name        = req.name.empty() ? uuid : req.name;
@@ -171,14 +254,24 @@ bool ManagerService::CreateVm(const VmCreateRequest& req, std::string* error) {
     spec.nat_enabled = req.nat_enabled;
 
     settings::SaveVmManifest(spec);
-    vms_.emplace(uuid, VmRecord{spec});
+    MarkChanged(vms_.emplace(uuid, VmRecord{spec}).first->second);
     SaveVmPaths();
+    if (vm_id) *vm_id = uuid;
     return true;
 }
 
 bool ManagerService::DeleteVm(const std::string& vm_id, std::string* error) {
     std::string vm_dir;
-    std::thread read_thread_to_join;
+
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        for (const auto& [id, other] : vms_) {
+            if (other.spec.forked_from == vm_id) {
+                if (error) *error = "template still has clones (" + other.spec.name + ")";
+                return false;
+            }
+        }
+    }
     
     // Step 1: Stop VM if running (this acquires lock internally)
     {
@@ -186,7 +279,7 @@ bool ManagerService::DeleteVm(const std::string& vm_id, std::string* error) {
         StopVm(vm_id, &stop_err);
     }
 
-    // Step 2: Get VM directory and ensure read thread is stopped
+    // Step 2: Get VM directory and ensure the pipe is no longer read
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
@@ -197,28 +290,20 @@ bool ManagerService::DeleteVm(const std::string& vm_id, std::string* error) {
         
         vm_dir = it->second.spec.vm_dir;
         
-        // Stop read thread if still running
-        if (it->second.runtime.read_thread.joinable()) {
-            it->second.runtime.read_running.store(false);
-            if (it->second.runtime.pipe_handle) {
-                CancelIoEx(reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle), nullptr);
-            }
-            // Move thread out to join outside the lock
-            read_thread_to_join = std::move(it->second.runtime.read_thread);
-        }
+        StopReading(it->second);
         
         // Erase VM record
         vms_.erase(it);
-    }
-    
-    // Step 3: Join read thread outside the lock (if needed)
-    if (read_thread_to_join.joinable()) {
-        read_thread_to_join.join();
+        removed_vms_.emplace_back(++revision_, vm_id);
+        if (removed_vms_.size() > kMaxRemovedVms) {
+            forgotten_revision_ = removed_vms_.front().first;
+            removed_vms_.pop_front();
+        }
     }
 
     SaveVmPaths();
 
-    // Step 4: Delete VM directory
+    // Step 3: Delete VM directory
     if (!vm_dir.empty()) {
         std::error_code ec;
         fs::remove_all(vm_dir, ec);
@@ -239,11 +324,20 @@ bool ManagerService::EditVm(const std::string& vm_id, const VmMutablePatch& patc
     VmRecord& vm = it->second;
     const bool running = vm.state == VmPowerState::kRunning || vm.state == VmPowerState::kStarting;
     const bool has_offline_fields = patch.memory_mb.has_value() || patch.cpu_count.has_value();
+    const bool live_resize = running && has_offline_fields && !patch.apply_on_next_boot &&
+                             ResizesLive(vm, patch);
 
-    if (running && has_offline_fields && !patch.apply_on_next_boot) {
+    if (running && has_offline_fields && !patch.apply_on_next_boot && !live_resize) {
         if (error) *error = "cpu_count/memory_mb require powered off state";
         return false;
     }
+    const bool has_snapshot = !vm.spec.suspend_snapshot.empty() ||
+                              !vm.spec.template_snapshot.empty() ||
+                              !vm.spec.fork_snapshot.empty();
+    if (has_snapshot && has_offline_fields) {
+        if (error) *error = "cpu_count/memory_mb cannot change while the VM is suspended";
+        return false;
+    }
     if (running && has_offline_fields && patch.apply_on_next_boot) {
         vm.pending_patch = patch;
     }
@@ -251,16 +345,35 @@ bool ManagerService::EditVm(const std::string& vm_id, const VmMutablePatch& patc
     if (patch.name) vm.spec.name = *patch.name;
     if (patch.nat_enabled) vm.spec.nat_enabled = *patch.nat_enabled;
     if (patch.port_forwards) vm.spec.port_forwards = *patch.port_forwards;
+    if (patch.net_rate_limit) vm.spec.net_rate_limit = *patch.net_rate_limit;
     if (patch.shared_folders) vm.spec.shared_folders = *patch.shared_folders;
 
+    // A live resize stays out of the spec until the runtime reports how far
+    // the guest went; see the runtime.set_resources.result handler.
     if (!running || patch.apply_on_next_boot) {
         if (patch.memory_mb) vm.spec.memory_mb = *patch.memory_mb;
         if (patch.cpu_count) vm.spec.cpu_count = *patch.cpu_count;
     }
 
     settings::SaveVmManifest(vm.spec);
+    MarkChanged(vm);
 
-    if (running && (patch.nat_enabled || patch.port_forwards)) {
+    // The guest finishes it later: it plugs memory and brings CPUs online
+    // in its own time, and gives CPUs back only once it takes them offline.
+    // runtime.resources reports each step.
+    if (live_resize) {
+        ipc::Message msg;
+        msg.channel = ipc::Channel::kControl;
+        msg.kind = ipc::Kind::kRequest;
+        msg.type = "runtime.set_resources";
+        msg.vm_id = vm_id;
+        msg.request_id = GetTickCount64();
+        if (patch.cpu_count) msg.fields["cpu_count"] = std::to_string(*patch.cpu_count);
+        if (patch.memory_mb) msg.fields["memory_mb"] = std::to_string(*patch.memory_mb);
+        SendRuntimeMessage(vm, msg);
+    }
+
+    if (running && (patch.nat_enabled || patch.port_forwards || patch.net_rate_limit)) {
         ipc::Message msg;
         msg.channel = ipc::Channel::kControl;
         msg.kind = ipc::Kind::kRequest;
@@ -274,6 +387,9 @@ bool ManagerService::EditVm(const std::string& vm_id, const VmMutablePatch& patc
                 std::to_string(vm.spec.port_forwards[i].host_port) + ":" +
                 std::to_string(vm.spec.port_forwards[i].guest_port);
         }
+        msg.fields["rx_mbps"] = std::to_string(vm.spec.net_rate_limit.rx_mbps);
+        msg.fields["tx_mbps"] = std::to_string(vm.spec.net_rate_limit.tx_mbps);
+        msg.fields["burst_kb"] = std::to_string(vm.spec.net_rate_limit.burst_kb);
         SendRuntimeMessage(vm, msg);
     }
 
@@ -288,7 +404,8 @@ bool ManagerService::EditVm(const std::string& vm_id, const VmMutablePatch& patc
         for (size_t i = 0; i < vm.spec.shared_folders.size(); ++i) {
             const auto& f = vm.spec.shared_folders[i];
             msg.fields["folder_" + std::to_string(i)] =
-                f.tag + "|" + f.host_path + "|" + (f.readonly ? "1" : "0");
+                f.tag + "|" + f.host_path + "|" + (f.readonly ? "1" : "0") + "|" +
+                (f.writeback ? "1" : "0");
         }
         SendRuntimeMessage(vm, msg);
     }
@@ -306,9 +423,102 @@ bool ManagerService::StartVm(const std::string& vm_id, std::string* error) {
     if (vm.state == VmPowerState::kRunning || vm.state == VmPowerState::kStarting) {
         return true;
     }
+    void* ready = nullptr;
+    if (!LaunchRuntime(vm, &ready, error)) return false;
+    bool listening = WaitRuntimeReady(reinterpret_cast<HANDLE>(ready),
+                                      reinterpret_cast<HANDLE>(vm.runtime.process_handle));
+    if (ready) CloseHandle(reinterpret_cast<HANDLE>(ready));
+    return ConnectRuntime(vm_id, vm, listening, error);
+}
+
+bool ManagerService::StartVms(const std::vector<std::string>& vm_ids,
+                              std::unordered_map<std::string, std::string>* errors) {
+    size_t workers = std::min<size_t>(std::max(settings_.max_concurrent_starts, 1u),
+                                      vm_ids.size());
+    std::atomic<size_t> next{0};
+    std::mutex errors_mutex;
+    bool all_started = true;
+    auto work = [&]() {
+        for (size_t i; (i = next++) < vm_ids.size();) {
+            std::string error;
+            if (StartVmConcurrently(vm_ids[i], &error)) continue;
+            LOG_WARN("VM %s: start failed: %s", vm_ids[i].c_str(), error.c_str());
+            std::lock_guard<std::mutex> lock(errors_mutex);
+            all_started = false;
+            if (errors) (*errors)[vm_ids[i]] = error;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) threads.emplace_back(work);
+    work();
+    for (auto& t : threads) t.join();
+    return all_started;
+}
+
+bool ManagerService::StartVmConcurrently(const std::string& vm_id, std::string* error) {
+    void* ready = nullptr;
+    HANDLE process = nullptr;
+    uint32_t process_id = 0;
+    StateChangeCallback cb;
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end()) {
+            if (error) *error = "vm not found";
+            return false;
+        }
+        VmRecord& vm = it->second;
+        if (vm.state == VmPowerState::kRunning || vm.state == VmPowerState::kStarting) {
+            return true;
+        }
+        if (!LaunchRuntime(vm, &ready, error)) return false;
+        // The record's handle is closed if the VM is stopped meanwhile.
+        DuplicateHandle(GetCurrentProcess(), reinterpret_cast<HANDLE>(vm.runtime.process_handle),
+                        GetCurrentProcess(), &process, SYNCHRONIZE, FALSE, 0);
+        process_id = vm.runtime.process_id;
+        cb = state_change_callback_;
+    }
+    if (cb) cb(vm_id);
+
+    // The slow part, unlocked so the other launches proceed alongside.
+    bool listening = WaitRuntimeReady(reinterpret_cast<HANDLE>(ready), process);
+    if (ready) CloseHandle(reinterpret_cast<HANDLE>(ready));
+    if (process) CloseHandle(process);
+
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end() || it->second.state != VmPowerState::kStarting ||
+            it->second.runtime.process_id != process_id) {
+            if (error) *error = "vm was stopped while starting";
+            return false;
+        }
+        ok = ConnectRuntime(vm_id, it->second, listening, error);
+        cb = state_change_callback_;
+    }
+    if (cb) cb(vm_id);
+    return ok;
+}
+
+bool ManagerService::LaunchRuntime(VmRecord& vm, void** ready, std::string* error) {
+    *ready = nullptr;
+    // Clones write on top of the template disk; booting it would change
+    // what they see.
+    if (!vm.spec.template_snapshot.empty()) {
+        if (error) *error = "vm is a template; fork it instead";
+        return false;
+    }
 
     vm.runtime.pipe_name = "tenbox_vm_" + vm.spec.vm_id;
     const std::string cmd = BuildRuntimeCommand(runtime_exe_path_, vm.spec, vm.runtime.pipe_name);
+    vm.boot_memory_mb = vm.spec.memory_mb;
+    vm.max_memory_mb = vm.spec.max_memory_mb > vm.spec.memory_mb ? vm.spec.max_memory_mb : 0;
+    vm.max_cpu_count = vm.spec.max_cpu_count > vm.spec.cpu_count ? vm.spec.max_cpu_count : 0;
+    vm.live_cpu_count = vm.spec.cpu_count;
+    vm.live_memory_mb = vm.spec.memory_mb;
+    vm.resized_live = false;
+    vm.net_capturing = false;
 
     // Convert UTF-8 command line to wide string (UTF-16) for CreateProcessW.
     // Manager process has activeCodePage=UTF-8 manifest, so all std::string
@@ -362,6 +572,9 @@ bool ManagerService::StartVm(const std::string& vm_id, std::string* error) {
     if (job_object_) {
         AssignProcessToJobObject(reinterpret_cast<HANDLE>(job_object_), pi.hProcess);
     }
+    // Exists before the runtime runs, so it cannot look for it too early.
+    *ready = CreateEventA(nullptr, TRUE, FALSE,
+        ipc::RuntimeReadyEventName(vm.spec.vm_id, pi.dwProcessId).c_str());
     ResumeThread(pi.hThread);
 
     vm.runtime.process_handle = pi.hProcess;
@@ -369,20 +582,36 @@ bool ManagerService::StartVm(const std::string& vm_id, std::string* error) {
     CloseHandle(pi.hThread);
     vm.state = VmPowerState::kStarting;
 
-    if (EnsurePipeConnected(vm)) {
+    // A snapshot resumes once: the guest moves on from it, or the runtime
+    // falls back to a cold boot.
+    if (!vm.spec.suspend_snapshot.empty()) {
+        vm.consumed_snapshot = vm.spec.suspend_snapshot;
+        vm.spec.suspend_snapshot.clear();
+        settings::SaveVmManifest(vm.spec);
+    } else if (!vm.spec.fork_snapshot.empty()) {
+        // The template keeps its snapshot for the next clone.
+        vm.spec.fork_snapshot.clear();
+        settings::SaveVmManifest(vm.spec);
+    }
+    MarkChanged(vm);
+    return true;
+}
+
+bool ManagerService::ConnectRuntime(const std::string& vm_id, VmRecord& vm, bool listening,
+                                    std::string* error) {
+    if (listening && EnsurePipeConnected(vm)) {
         vm.state = VmPowerState::kRunning;
-        StartReadThread(vm_id, vm);
+        StartReading(vm_id, vm);
     } else {
         vm.state = VmPowerState::kCrashed;
         if (error) *error = "runtime process started but IPC connection failed (check runtime.log in VM directory)";
     }
+    MarkChanged(vm);
     return vm.state == VmPowerState::kRunning;
 }
 
 bool ManagerService::StopVm(const std::string& vm_id, std::string* error) {
     HANDLE process_handle = nullptr;
-    std::thread read_thread_to_join;
-    HANDLE pipe_handle = nullptr;
     
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
@@ -395,8 +624,8 @@ bool ManagerService::StopVm(const std::string& vm_id, std::string* error) {
         if (vm.state == VmPowerState::kStopped) return true;
 
         vm.state = VmPowerState::kStopping;
+        MarkChanged(vm);
         process_handle = reinterpret_cast<HANDLE>(vm.runtime.process_handle);
-        pipe_handle = reinterpret_cast<HANDLE>(vm.runtime.pipe_handle);
         
         ipc::Message msg;
         msg.channel = ipc::Channel::kControl;
@@ -407,24 +636,14 @@ bool ManagerService::StopVm(const std::string& vm_id, std::string* error) {
         msg.fields["command"] = "stop";
         SendRuntimeMessage(vm, msg);
 
-        // Stop read thread: set flag and cancel IO (inside lock)
-        if (vm.runtime.read_thread.joinable()) {
-            vm.runtime.read_running.store(false);
-            if (pipe_handle) {
-                CancelIoEx(pipe_handle, nullptr);
-            }
-            // Move thread out to join outside the lock
-            read_thread_to_join = std::move(vm.runtime.read_thread);
-        }
+        // The exit is handled here, not by the pipe breaking.
+        StopReading(vm);
     }
 
-    // Wait for process and join read thread outside the lock
+    // Wait for process outside the lock
     if (process_handle) {
         WaitForSingleObject(process_handle, 3000);
     }
-    if (read_thread_to_join.joinable()) {
-        read_thread_to_join.join();
-    }
 
     // Cleanup handles and update state (inside lock)
     {
@@ -436,6 +655,7 @@ bool ManagerService::StopVm(const std::string& vm_id, std::string* error) {
         }
         CleanupRuntimeHandles(it->second);
         it->second.state = VmPowerState::kStopped;
+        MarkChanged(it->second);
     }
     return true;
 }
@@ -453,6 +673,7 @@ bool ManagerService::RebootVm(const std::string& vm_id, std::string* error) {
 
     vm.state = VmPowerState::kStopping;
     vm.reboot_pending = true;
+    MarkChanged(vm);
     ipc::Message msg;
     msg.channel = ipc::Channel::kControl;
     msg.kind = ipc::Kind::kRequest;
@@ -464,6 +685,202 @@ bool ManagerService::RebootVm(const std::string& vm_id, std::string* error) {
     return true;
 }
 
+bool ManagerService::SaveRuntimeSnapshot(const std::string& vm_id,
+                                         const std::string& file_name,
+                                         std::string* error) {
+    HANDLE process_handle = nullptr;
+    bool resized_live = false;
+    fs::path snapshot_path;
+
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end()) {
+            if (error) *error = "vm not found";
+            return false;
+        }
+        VmRecord& vm = it->second;
+        if (vm.state != VmPowerState::kRunning || !vm.runtime.process_handle) {
+            if (error) *error = "vm is not running";
+            return false;
+        }
+        // The pipe reader closes the runtime's handle when it exits.
+        DuplicateHandle(GetCurrentProcess(), reinterpret_cast<HANDLE>(vm.runtime.process_handle),
+                        GetCurrentProcess(), &process_handle, SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION,
+                        FALSE, 0);
+        snapshot_path = fs::path(vm.spec.vm_dir) / file_name;
+
+        ipc::Message msg;
+        msg.channel = ipc::Channel::kControl;
+        msg.kind = ipc::Kind::kRequest;
+        msg.type = "runtime.command";
+        msg.vm_id = vm_id;
+        msg.request_id = GetTickCount64();
+        msg.fields["command"] = "suspend";
+        msg.fields["path"] = snapshot_path.string();
+        if (!process_handle || !SendRuntimeMessage(vm, msg)) {
+            if (process_handle) CloseHandle(process_handle);
+            if (error) *error = "runtime not reachable";
+            return false;
+        }
+        vm.state = VmPowerState::kStopping;
+        resized_live = vm.resized_live;
+        vm.resized_live = false;
+        MarkChanged(vm);
+    }
+
+    // Writing out guest RAM takes a while; the runtime exits once it is
+    // done, or reports "running" again if the save failed.
+    bool exited = false;
+    for (int waited_ms = 0; waited_ms < 120000; waited_ms += 100) {
+        if (WaitForSingleObject(process_handle, 100) == WAIT_OBJECT_0) {
+            exited = true;
+            break;
+        }
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end() || it->second.state == VmPowerState::kRunning) break;
+    }
+    DWORD exit_code = 1;
+    if (exited) GetExitCodeProcess(process_handle, &exit_code);
+    CloseHandle(process_handle);
+
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) {
+        if (error) *error = "vm not found";
+        return false;
+    }
+    std::error_code ec;
+    if (!exited || exit_code != 0 || !fs::exists(snapshot_path, ec)) {
+        // Still running: a later shutdown keeps the live resize.
+        if (!exited) it->second.resized_live = resized_live;
+        if (error) *error = "snapshot failed (check runtime.log in VM directory)";
+        return false;
+    }
+    return true;
+}
+
+bool ManagerService::SuspendVm(const std::string& vm_id, std::string* error) {
+    std::string file_name = "suspend-" + std::to_string(GetTickCount64()) + ".snap";
+    if (!SaveRuntimeSnapshot(vm_id, file_name, error)) return false;
+
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) return false;
+    it->second.spec.suspend_snapshot = file_name;
+    settings::SaveVmManifest(it->second.spec);
+    MarkChanged(it->second);
+    return true;
+}
+
+bool ManagerService::MakeTemplate(const std::string& vm_id, std::string* error) {
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end()) {
+            if (error) *error = "vm not found";
+            return false;
+        }
+        // Clones get an overlay of the disk, so there has to be one.
+        if (it->second.spec.disk_path.empty()) {
+            if (error) *error = "a template needs a disk";
+            return false;
+        }
+    }
+    if (!SaveRuntimeSnapshot(vm_id, "template.snap", error)) return false;
+
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) return false;
+    it->second.spec.template_snapshot = "template.snap";
+    settings::SaveVmManifest(it->second.spec);
+    MarkChanged(it->second);
+    return true;
+}
+
+bool ManagerService::ForkVm(const std::string& template_id, std::string* clone_id,
+                            std::string* error) {
+    VmSpec tmpl;
+    size_t clones = 0;
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(template_id);
+        if (it == vms_.end()) {
+            if (error) *error = "vm not found";
+            return false;
+        }
+        if (it->second.spec.template_snapshot.empty()) {
+            if (error) *error = "vm is not a template";
+            return false;
+        }
+        tmpl = it->second.spec;
+        for (const auto& [id, other] : vms_) {
+            if (other.spec.forked_from == template_id) clones++;
+        }
+    }
+
+    VmCreateRequest req;
+    req.name = tmpl.name + " #" + std::to_string(clones + 1);
+    req.source_kernel = tmpl.kernel_path;
+    req.source_initrd = tmpl.initrd_path;
+    req.source_disk = tmpl.disk_path;
+    req.cmdline = tmpl.cmdline;
+    req.storage_dir = fs::path(tmpl.vm_dir).parent_path().string();
+    req.memory_mb = tmpl.memory_mb;
+    req.cpu_count = tmpl.cpu_count;
+    req.nat_enabled = tmpl.nat_enabled;
+    req.linked_clone = true;
+
+    std::string id;
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        if (!CreateVm(req, error, &id)) return false;
+
+        // Everything the snapshot's device state depends on must match.
+        // Host port forwards would collide between clones, so none are kept;
+        // vsock ports the guest connects out on can be shared.
+        VmSpec& spec = vms_.at(id).spec;
+        spec.disk_direct_io = tmpl.disk_direct_io;
+        spec.disk_mmap = tmpl.disk_mmap;
+        spec.qcow2_l2_cache_mb = tmpl.qcow2_l2_cache_mb;
+        spec.qcow2_compressed_cache_mb = tmpl.qcow2_compressed_cache_mb;
+        spec.disk_readahead_kb = tmpl.disk_readahead_kb;
+        spec.disk_boot_profile_s = tmpl.disk_boot_profile_s;
+        spec.disk_iops_limit = tmpl.disk_iops_limit;
+        spec.disk_iops_burst = tmpl.disk_iops_burst;
+        spec.disk_mbps_limit = tmpl.disk_mbps_limit;
+        spec.disk_burst_mb = tmpl.disk_burst_mb;
+        spec.net_rate_limit = tmpl.net_rate_limit;
+        spec.irq_coalesce_us = tmpl.irq_coalesce_us;
+        spec.irq_coalesce_frames = tmpl.irq_coalesce_frames;
+        spec.virtio_pci = tmpl.virtio_pci;
+        spec.hvc_console = tmpl.hvc_console;
+        spec.vsock = tmpl.vsock;
+        for (const auto& f : tmpl.vsock_forwards) {
+            if (f.guest_connects) spec.vsock_forwards.push_back(f);
+        }
+        spec.display_fps = tmpl.display_fps;
+        spec.display_count = tmpl.display_count;
+        spec.page_dedup_interval_s = tmpl.page_dedup_interval_s;
+        spec.vcpu_placement = tmpl.vcpu_placement;
+        spec.numa_memory = tmpl.numa_memory;
+        spec.max_cpu_count = tmpl.max_cpu_count;
+        spec.max_memory_mb = tmpl.max_memory_mb;
+        spec.x2apic = tmpl.x2apic;
+        spec.pmu = tmpl.pmu;
+        spec.io_threads = tmpl.io_threads;
+        spec.device_io_threads = tmpl.device_io_threads;
+        spec.shared_folders = tmpl.shared_folders;
+        spec.forked_from = template_id;
+        spec.fork_snapshot = (fs::path(tmpl.vm_dir) / tmpl.template_snapshot).string();
+        settings::SaveVmManifest(spec);
+        MarkChanged(vms_.at(id));
+    }
+    if (clone_id) *clone_id = id;
+    return StartVm(id, error);
+}
+
 bool ManagerService::ShutdownVm(const std::string& vm_id, std::string* error) {
     auto it = vms_.find(vm_id);
     if (it == vms_.end()) {
@@ -474,6 +891,7 @@ bool ManagerService::ShutdownVm(const std::string& vm_id, std::string* error) {
     if (vm.state == VmPowerState::kStopped) return true;
 
     vm.state = VmPowerState::kStopping;
+    MarkChanged(vm);
     ipc::Message msg;
     msg.channel = ipc::Channel::kControl;
     msg.kind = ipc::Kind::kRequest;
@@ -490,9 +908,6 @@ void ManagerService::ShutdownAll() {
         (void)id;
         std::string ignored;
         StopVm(vm.spec.vm_id, &ignored);
-        if (vm.runtime.read_thread.joinable()) {
-            vm.runtime.read_thread.join();
-        }
     }
 }
 
@@ -508,6 +923,77 @@ std::vector<VmRecord> ManagerService::ListVms() const {
     return out;
 }
 
+VmListDelta ManagerService::GetVmChanges(uint64_t since) const {
+    std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(vms_mutex_));
+    VmListDelta delta;
+    delta.revision = revision_.load();
+    delta.reset = since < forgotten_revision_ || since == 0;
+    for (const auto& [id, vm] : vms_) {
+        (void)id;
+        if (delta.reset || vm.revision > since) delta.changed.push_back(vm);
+    }
+    if (!delta.reset) {
+        for (const auto& [revision, vm_id] : removed_vms_) {
+            if (revision > since) delta.removed.push_back(vm_id);
+        }
+    }
+    return delta;
+}
+
+std::vector<VmMetrics> ManagerService::CollectMetrics() {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    std::vector<VmMetrics> out;
+    out.reserve(metrics_.size());
+    for (auto& [vm_id, channel] : metrics_) {
+        ipc::MetricsSample sample;
+        if (channel->block.Read(&sample) && sample.sample_us != channel->last.sample_us) {
+            channel->prev = channel->last;
+            channel->last = sample;
+        }
+        const auto& cur = channel->last;
+        const auto& prev = channel->prev;
+        if (!cur.sample_us) continue;
+
+        VmMetrics m;
+        m.vm_id = vm_id;
+        auto vm_it = vms_.find(vm_id);
+        if (vm_it != vms_.end()) m.name = vm_it->second.spec.name;
+        m.vcpu_count = cur.vcpu_count;
+        m.memory_committed_bytes = cur.memory_committed_bytes;
+        m.uptime_us = cur.sample_us;
+        m.totals = cur.counters;
+
+        // Rates need two samples; the first one only gives totals.
+        if (prev.sample_us && cur.sample_us > prev.sample_us) {
+            double secs = (cur.sample_us - prev.sample_us) / 1e6;
+            auto rate = [&](uint64_t now, uint64_t then) {
+                return now >= then ? (now - then) / secs : 0.0;
+            };
+            const auto& a = cur.counters;
+            const auto& b = prev.counters;
+            m.exits_per_sec = rate(a.exits, b.exits);
+            m.disk_read_iops = rate(a.disk_reads, b.disk_reads);
+            m.disk_write_iops = rate(a.disk_writes, b.disk_writes);
+            m.disk_read_bytes_per_sec = rate(a.disk_read_bytes, b.disk_read_bytes);
+            m.disk_write_bytes_per_sec = rate(a.disk_write_bytes, b.disk_write_bytes);
+            m.net_rx_pps = rate(a.net_rx_packets, b.net_rx_packets);
+            m.net_tx_pps = rate(a.net_tx_packets, b.net_tx_packets);
+            m.net_rx_bytes_per_sec = rate(a.net_rx_bytes, b.net_rx_bytes);
+            m.net_tx_bytes_per_sec = rate(a.net_tx_bytes, b.net_tx_bytes);
+            m.display_fps = rate(a.display_frames, b.display_frames);
+            m.dirty_pages_per_sec = rate(a.dirty_pages, b.dirty_pages);
+            // A vCPU is busy whenever it is not halted.
+            if (cur.vcpu_count) {
+                double halted = rate(a.vcpu_halted_ns, b.vcpu_halted_ns) / 1e9;
+                m.vcpu_utilization =
+                    std::clamp(1.0 - halted / cur.vcpu_count, 0.0, 1.0);
+            }
+        }
+        out.push_back(std::move(m));
+    }
+    return out;
+}
+
 std::optional<VmRecord> ManagerService::GetVm(const std::string& vm_id) const {
     auto it = vms_.find(vm_id);
     if (it == vms_.end()) return std::nullopt;
@@ -535,7 +1021,7 @@ void ManagerService::LoadVms() {
         if (settings::LoadVmManifest(vm_path, spec) && !spec.vm_id.empty()) {
             // Avoid relying on argument evaluation order when moving `spec`.
             const auto vm_id = spec.vm_id;
-            vms_.emplace(vm_id, VmRecord{std::move(spec)});
+            MarkChanged(vms_.emplace(vm_id, VmRecord{std::move(spec)}).first->second);
         }
     }
 }
@@ -555,12 +1041,13 @@ bool ManagerService::EnsurePipeConnected(VmRecord& vm) {
                 0,
                 nullptr,
                 OPEN_EXISTING,
-                0,
+                FILE_FLAG_OVERLAPPED,
                 nullptr);
             if (pipe != INVALID_HANDLE_VALUE) {
                 DWORD mode = PIPE_READMODE_BYTE;
                 SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr);
                 vm.runtime.pipe_handle = pipe;
+                vm.runtime.protocol = ipc::kTextProtocolVersion;
                 return true;
             }
         }
@@ -569,15 +1056,32 @@ bool ManagerService::EnsurePipeConnected(VmRecord& vm) {
     return false;
 }
 
+void ManagerService::NegotiateProtocolLocked(VmRecord& vm, const ipc::Message& state) {
+    auto it = state.fields.find("protocol");
+    if (it == state.fields.end()) return;
+    uint32_t version = static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10));
+    version = (std::min)(version, ipc::kProtocolVersion);
+    if (version <= vm.runtime.protocol) return;
+
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kControl;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "runtime.set_protocol";
+    msg.vm_id = vm.spec.vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["version"] = std::to_string(version);
+    // Either version decodes on both ends, so switching here is safe.
+    if (SendRuntimeMessage(vm, msg)) {
+        vm.runtime.protocol = version;
+        LOG_INFO("VM %s: IPC protocol version %u", vm.spec.vm_id.c_str(), version);
+    }
+}
+
 bool ManagerService::SendRuntimeMessage(VmRecord& vm, const ipc::Message& msg) {
     if (!EnsurePipeConnected(vm)) return false;
     HANDLE pipe = reinterpret_cast<HANDLE>(vm.runtime.pipe_handle);
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    if (!WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)) {
-        return false;
-    }
-    return written == encoded.size();
+    std::string encoded = ipc::Encode(msg, vm.runtime.protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
 void ManagerService::ApplyPendingPatchLocked(VmRecord& vm) {
@@ -589,6 +1093,20 @@ void ManagerService::ApplyPendingPatchLocked(VmRecord& vm) {
 }
 
 void ManagerService::CleanupRuntimeHandles(VmRecord& vm) {
+    {
+        std::lock_guard<std::mutex> lock(fb_views_mutex_);
+        fb_views_.erase(vm.spec.vm_id);
+        fb_pipe_only_.erase(vm.spec.vm_id);
+        cursor_images_.erase(vm.spec.vm_id);
+    }
+    {
+        std::lock_guard<std::mutex> lock(input_mutex_);
+        input_rings_.erase(vm.spec.vm_id);
+    }
+    capture_rings_.erase(vm.spec.vm_id);
+    metrics_.erase(vm.spec.vm_id);
+    clipboard_incoming_.erase(vm.spec.vm_id);
+    StopReading(vm);
     if (vm.runtime.pipe_handle) {
         CloseHandle(reinterpret_cast<HANDLE>(vm.runtime.pipe_handle));
         vm.runtime.pipe_handle = nullptr;
@@ -602,14 +1120,27 @@ void ManagerService::CleanupRuntimeHandles(VmRecord& vm) {
         CloseHandle(proc);
         vm.runtime.process_handle = nullptr;
     }
-    vm.runtime.read_running.store(false);
+    // A snapshot resumes with the sizes the runtime was launched with, so
+    // SaveRuntimeSnapshot clears resized_live before the runtime exits.
+    vm.net_capturing = false;
+    bool resized = vm.resized_live;
+    if (resized) {
+        vm.spec.cpu_count = vm.live_cpu_count;
+        vm.spec.memory_mb = vm.live_memory_mb;
+        vm.resized_live = false;
+    }
     bool had_patch = vm.pending_patch.has_value();
     ApplyPendingPatchLocked(vm);
-    if (had_patch) settings::SaveVmManifest(vm.spec);
+    if (had_patch || resized) settings::SaveVmManifest(vm.spec);
+    if (!vm.consumed_snapshot.empty()) {
+        std::error_code ec;
+        fs::remove(fs::path(vm.spec.vm_dir) / vm.consumed_snapshot, ec);
+        vm.consumed_snapshot.clear();
+    }
 }
 
 void ManagerService::CloseRuntime(VmRecord& vm) {
-    StopReadThread(vm);
+    StopReading(vm);
     CleanupRuntimeHandles(vm);
 }
 
@@ -658,6 +1189,16 @@ void ManagerService::SetAudioPcmCallback(AudioPcmCallback cb) {
     audio_pcm_callback_ = std::move(cb);
 }
 
+void ManagerService::SetAudioRingCallback(AudioRingCallback cb) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    audio_ring_callback_ = std::move(cb);
+}
+
+void ManagerService::SetAudioCaptureCallback(AudioCaptureCallback cb) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    audio_capture_callback_ = std::move(cb);
+}
+
 void ManagerService::SetGuestAgentStateCallback(GuestAgentStateCallback cb) {
     std::lock_guard<std::mutex> lock(vms_mutex_);
     guest_agent_state_callback_ = std::move(cb);
@@ -669,65 +1210,181 @@ bool ManagerService::IsGuestAgentConnected(const std::string& vm_id) const {
     return it->second.guest_agent_connected;
 }
 
-bool ManagerService::SendKeyEvent(const std::string& vm_id, uint32_t key_code, bool pressed) {
+void ManagerService::SetRuntimeStatsCallback(RuntimeStatsCallback cb) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    runtime_stats_callback_ = std::move(cb);
+}
+
+bool ManagerService::RequestRuntimeStats(const std::string& vm_id) {
     HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
     ipc::Message msg;
-    msg.channel = ipc::Channel::kInput;
+    msg.channel = ipc::Channel::kControl;
     msg.kind = ipc::Kind::kRequest;
-    msg.type = "input.key_event";
+    msg.type = "runtime.stats";
     msg.vm_id = vm_id;
     msg.request_id = GetTickCount64();
-    msg.fields["key_code"] = std::to_string(key_code);
-    msg.fields["pressed"] = pressed ? "1" : "0";
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
-bool ManagerService::SendPointerEvent(const std::string& vm_id,
-                                       int32_t x, int32_t y, uint32_t buttons) {
-    HANDLE pipe = INVALID_HANDLE_VALUE;
-    {
-        std::lock_guard<std::mutex> lock(vms_mutex_);
-        auto it = vms_.find(vm_id);
-        if (it == vms_.end()) return false;
-        pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+void ManagerService::SetFileTransferCallback(FileTransferCallback cb) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    file_transfer_callback_ = std::move(cb);
+}
+
+bool ManagerService::StartFileTransfer(const std::string& vm_id, bool push,
+                                       const std::string& host_path,
+                                       const std::string& guest_path,
+                                       uint64_t* transfer_id, std::string* error) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) {
+        if (error) *error = "vm not found";
+        return false;
+    }
+    VmRecord& vm = it->second;
+    if (vm.state != VmPowerState::kRunning) {
+        if (error) *error = "vm is not running";
+        return false;
+    }
+    if (!vm.guest_agent_connected) {
+        if (error) *error = "guest agent not connected";
+        return false;
     }
-    if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
+    uint64_t id = next_transfer_id_++;
     ipc::Message msg;
-    msg.channel = ipc::Channel::kInput;
+    msg.channel = ipc::Channel::kControl;
     msg.kind = ipc::Kind::kRequest;
-    msg.type = "input.pointer_event";
+    msg.type = "runtime.file_transfer";
     msg.vm_id = vm_id;
     msg.request_id = GetTickCount64();
-    msg.fields["x"] = std::to_string(x);
-    msg.fields["y"] = std::to_string(y);
-    msg.fields["buttons"] = std::to_string(buttons);
-
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    msg.fields["id"] = std::to_string(id);
+    msg.fields["direction"] = push ? "push" : "pull";
+    msg.fields["host_path"] = host_path;
+    msg.fields["guest_path"] = guest_path;
+    if (!SendRuntimeMessage(vm, msg)) {
+        if (error) *error = "runtime not reachable";
+        return false;
+    }
+    if (transfer_id) *transfer_id = id;
+    return true;
 }
 
-bool ManagerService::SendWheelEvent(const std::string& vm_id, int32_t delta) {
-    HANDLE pipe = INVALID_HANDLE_VALUE;
-    {
+bool ManagerService::CancelFileTransfer(const std::string& vm_id, uint64_t transfer_id) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) return false;
+
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kControl;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "runtime.file_transfer.cancel";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["id"] = std::to_string(transfer_id);
+    return SendRuntimeMessage(it->second, msg);
+}
+
+bool ManagerService::PushInputEvent(const std::string& vm_id,
+                                    const ipc::InputRingEvent& event) {
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    auto it = input_rings_.find(vm_id);
+    return it != input_rings_.end() && it->second->Push(event);
+}
+
+bool ManagerService::SendKeyEvent(const std::string& vm_id, uint32_t key_code, bool pressed) {
+    ipc::InputRingEvent event;
+    event.type = ipc::InputRingEvent::kKey;
+    event.key_code = key_code;
+    event.pressed = pressed ? 1 : 0;
+    if (PushInputEvent(vm_id, event)) return true;
+
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end()) return false;
+        pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
+    }
+    if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
+
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kInput;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "input.key_event";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    auto& body = msg.body.emplace<ipc::KeyEventBody>();
+    body.key_code = key_code;
+    body.pressed = pressed;
+
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
+}
+
+bool ManagerService::SendPointerEvent(const std::string& vm_id,
+                                       int32_t x, int32_t y, uint32_t buttons) {
+    ipc::InputRingEvent event;
+    event.type = ipc::InputRingEvent::kPointer;
+    event.x = x;
+    event.y = y;
+    event.buttons = buttons;
+    if (PushInputEvent(vm_id, event)) return true;
+
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end()) return false;
+        pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
+    }
+    if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
+
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kInput;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "input.pointer_event";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    auto& body = msg.body.emplace<ipc::PointerEventBody>();
+    body.x = x;
+    body.y = y;
+    body.buttons = buttons;
+
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
+}
+
+bool ManagerService::SendWheelEvent(const std::string& vm_id, int32_t delta) {
+    ipc::InputRingEvent event;
+    event.type = ipc::InputRingEvent::kWheel;
+    event.wheel_delta = delta;
+    if (PushInputEvent(vm_id, event)) return true;
+
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
+    {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
@@ -737,21 +1394,22 @@ bool ManagerService::SendWheelEvent(const std::string& vm_id, int32_t delta) {
     msg.type = "input.wheel_event";
     msg.vm_id = vm_id;
     msg.request_id = GetTickCount64();
-    msg.fields["delta"] = std::to_string(delta);
+    msg.body.emplace<ipc::WheelEventBody>().delta = delta;
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
-bool ManagerService::SetDisplaySize(const std::string& vm_id, uint32_t width, uint32_t height) {
+bool ManagerService::SetDisplaySize(const std::string& vm_id, uint32_t width, uint32_t height,
+                                    uint32_t scanout_id) {
     HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
@@ -761,23 +1419,72 @@ bool ManagerService::SetDisplaySize(const std::string& vm_id, uint32_t width, ui
     msg.type = "display.set_size";
     msg.vm_id = vm_id;
     msg.request_id = GetTickCount64();
+    msg.fields["scanout"] = std::to_string(scanout_id);
     msg.fields["width"] = std::to_string(width);
     msg.fields["height"] = std::to_string(height);
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
+}
+
+bool ManagerService::SetDisplayViewer(const std::string& vm_id, bool attached) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) return false;
+    if (it->second.display_viewer == attached) return true;
+    it->second.display_viewer = attached;
+    // A stopped VM is told once its runtime reports in.
+    if (!it->second.runtime.pipe_handle) return true;
+    return SendDisplayViewerLocked(it->second);
+}
+
+bool ManagerService::SendDisplayViewerLocked(VmRecord& vm) {
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kDisplay;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "display.viewer";
+    msg.vm_id = vm.spec.vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["attached"] = vm.display_viewer ? "1" : "0";
+    return SendRuntimeMessage(vm, msg);
+}
+
+bool ManagerService::RequestPipeDisplay(const std::string& vm_id) {
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
+    {
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto it = vms_.find(vm_id);
+        if (it == vms_.end()) return false;
+        pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
+    }
+    if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
+
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kDisplay;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "display.configure";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["shared_surface"] = "0";
+    msg.fields["encodings"] = std::string(ipc::FrameEncodingToString(ipc::FrameEncoding::kZstd)) +
+                              "," + ipc::FrameEncodingToString(ipc::FrameEncoding::kRaw);
+
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
 bool ManagerService::SendClipboardGrab(const std::string& vm_id,
                                        const std::vector<uint32_t>& types) {
     HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
@@ -795,47 +1502,59 @@ bool ManagerService::SendClipboardGrab(const std::string& vm_id,
     }
     msg.fields["types"] = types_str;
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
 bool ManagerService::SendClipboardData(const std::string& vm_id, uint32_t type,
                                        const uint8_t* data, size_t len) {
     HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
-    ipc::Message msg;
-    msg.channel = ipc::Channel::kClipboard;
-    msg.kind = ipc::Kind::kRequest;
-    msg.type = "clipboard.data";
-    msg.vm_id = vm_id;
-    msg.request_id = GetTickCount64();
-    msg.fields["data_type"] = std::to_string(type);
-    if (data && len > 0) {
-        msg.payload.assign(data, data + len);
-    }
+    if (len > ClipboardEvent::kMaxSize) return false;
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    // In pieces, so other messages to the runtime are not stuck behind a
+    // big payload and neither side needs a second copy of it.
+    size_t offset = 0;
+    do {
+        size_t n = (std::min)(len - offset, ClipboardEvent::kPieceSize);
+        ipc::Message msg;
+        msg.channel = ipc::Channel::kClipboard;
+        msg.kind = ipc::Kind::kRequest;
+        msg.type = "clipboard.data";
+        msg.vm_id = vm_id;
+        msg.request_id = GetTickCount64();
+        msg.fields["data_type"] = std::to_string(type);
+        msg.fields["offset"] = std::to_string(offset);
+        msg.fields["total"] = std::to_string(len);
+        if (data && n > 0) {
+            msg.payload.assign(data + offset, data + offset + n);
+        }
+
+        std::string encoded = ipc::Encode(msg, protocol);
+        if (!ipc::PipeWrite(pipe, encoded.data(), encoded.size())) return false;
+        offset += n;
+    } while (offset < len);
+    return true;
 }
 
 bool ManagerService::SendClipboardRequest(const std::string& vm_id, uint32_t type) {
     HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
@@ -847,19 +1566,19 @@ bool ManagerService::SendClipboardRequest(const std::string& vm_id, uint32_t typ
     msg.request_id = GetTickCount64();
     msg.fields["data_type"] = std::to_string(type);
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
 bool ManagerService::SendClipboardRelease(const std::string& vm_id) {
     HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
@@ -870,10 +1589,8 @@ bool ManagerService::SendClipboardRelease(const std::string& vm_id) {
     msg.vm_id = vm_id;
     msg.request_id = GetTickCount64();
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
 bool ManagerService::AddSharedFolder(const std::string& vm_id, const SharedFolder& folder, 
@@ -903,6 +1620,7 @@ bool ManagerService::AddSharedFolder(const std::string& vm_id, const SharedFolde
     
     vm.spec.shared_folders.push_back(folder);
     settings::SaveVmManifest(vm.spec);
+    MarkChanged(vm);
     
     if (vm.state == VmPowerState::kRunning) {
         ipc::Message msg;
@@ -915,7 +1633,8 @@ bool ManagerService::AddSharedFolder(const std::string& vm_id, const SharedFolde
         for (size_t i = 0; i < vm.spec.shared_folders.size(); ++i) {
             const auto& f = vm.spec.shared_folders[i];
             msg.fields["folder_" + std::to_string(i)] =
-                f.tag + "|" + f.host_path + "|" + (f.readonly ? "1" : "0");
+                f.tag + "|" + f.host_path + "|" + (f.readonly ? "1" : "0") + "|" +
+                (f.writeback ? "1" : "0");
         }
         SendRuntimeMessage(vm, msg);
     }
@@ -942,6 +1661,7 @@ bool ManagerService::RemoveSharedFolder(const std::string& vm_id, const std::str
     
     vm.spec.shared_folders.erase(sf_it);
     settings::SaveVmManifest(vm.spec);
+    MarkChanged(vm);
     
     if (vm.state == VmPowerState::kRunning) {
         ipc::Message msg;
@@ -954,7 +1674,8 @@ bool ManagerService::RemoveSharedFolder(const std::string& vm_id, const std::str
         for (size_t i = 0; i < vm.spec.shared_folders.size(); ++i) {
             const auto& f = vm.spec.shared_folders[i];
             msg.fields["folder_" + std::to_string(i)] =
-                f.tag + "|" + f.host_path + "|" + (f.readonly ? "1" : "0");
+                f.tag + "|" + f.host_path + "|" + (f.readonly ? "1" : "0") + "|" +
+                (f.writeback ? "1" : "0");
         }
         SendRuntimeMessage(vm, msg);
     }
@@ -971,13 +1692,137 @@ std::vector<SharedFolder> ManagerService::GetSharedFolders(const std::string& vm
     return it->second.spec.shared_folders;
 }
 
+bool ManagerService::SetBalloon(const std::string& vm_id, uint64_t size_mb,
+                                bool hint_free_pages, std::string* error) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) {
+        if (error) *error = "vm not found";
+        return false;
+    }
+    VmRecord& vm = it->second;
+    if (vm.state != VmPowerState::kRunning) {
+        if (error) *error = "vm is not running";
+        return false;
+    }
+    if (size_mb >= vm.spec.memory_mb) {
+        if (error) *error = "balloon must be smaller than guest memory";
+        return false;
+    }
+
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kControl;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "runtime.set_balloon";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["size_mb"] = std::to_string(size_mb);
+    if (hint_free_pages) msg.fields["hint_free_pages"] = "true";
+    if (!SendRuntimeMessage(vm, msg)) {
+        if (error) *error = "runtime not reachable";
+        return false;
+    }
+    return true;
+}
+
+bool ManagerService::StartNetCapture(const std::string& vm_id, const std::string& path,
+                                     uint32_t snaplen, uint32_t ring_mb,
+                                     const std::string& filter, std::string* error) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) {
+        if (error) *error = "vm not found";
+        return false;
+    }
+    VmRecord& vm = it->second;
+    if (vm.state != VmPowerState::kRunning) {
+        if (error) *error = "vm is not running";
+        return false;
+    }
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kControl;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "runtime.net_capture";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["action"] = "start";
+    msg.fields["path"] = path;
+    msg.fields["snaplen"] = std::to_string(snaplen);
+    msg.fields["ring_mb"] = std::to_string(ring_mb);
+    msg.fields["filter"] = filter;
+    if (!SendRuntimeMessage(vm, msg)) {
+        if (error) *error = "runtime not reachable";
+        return false;
+    }
+    return true;
+}
+
+bool ManagerService::StopNetCapture(const std::string& vm_id, std::string* error) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) {
+        if (error) *error = "vm not found";
+        return false;
+    }
+    VmRecord& vm = it->second;
+    if (vm.state != VmPowerState::kRunning) return true;
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kControl;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "runtime.net_capture";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["action"] = "stop";
+    if (!SendRuntimeMessage(vm, msg)) {
+        if (error) *error = "runtime not reachable";
+        return false;
+    }
+    return true;
+}
+
+bool ManagerService::SetDiskLimits(const std::string& vm_id, uint32_t iops, uint32_t iops_burst,
+                                   uint32_t mbps, uint32_t burst_mb, std::string* error) {
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it == vms_.end()) {
+        if (error) *error = "vm not found";
+        return false;
+    }
+    VmRecord& vm = it->second;
+    vm.spec.disk_iops_limit = iops;
+    vm.spec.disk_iops_burst = iops_burst;
+    vm.spec.disk_mbps_limit = mbps;
+    vm.spec.disk_burst_mb = burst_mb;
+    settings::SaveVmManifest(vm.spec);
+    MarkChanged(vm);
+
+    if (vm.state != VmPowerState::kRunning) return true;
+    ipc::Message msg;
+    msg.channel = ipc::Channel::kControl;
+    msg.kind = ipc::Kind::kRequest;
+    msg.type = "runtime.set_disk_limits";
+    msg.vm_id = vm_id;
+    msg.request_id = GetTickCount64();
+    msg.fields["iops"] = std::to_string(iops);
+    msg.fields["iops_burst"] = std::to_string(iops_burst);
+    msg.fields["mbps"] = std::to_string(mbps);
+    msg.fields["burst_mb"] = std::to_string(burst_mb);
+    if (!SendRuntimeMessage(vm, msg)) {
+        if (error) *error = "runtime not reachable";
+        return false;
+    }
+    return true;
+}
+
 bool ManagerService::SendConsoleInput(const std::string& vm_id, const std::string& input) {
     HANDLE pipe = INVALID_HANDLE_VALUE;
+    uint32_t protocol = ipc::kTextProtocolVersion;
     {
         std::lock_guard<std::mutex> lock(vms_mutex_);
         auto it = vms_.find(vm_id);
         if (it == vms_.end()) return false;
         pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
+        protocol = it->second.runtime.protocol;
     }
     if (!pipe || pipe == INVALID_HANDLE_VALUE) return false;
 
@@ -987,64 +1832,55 @@ bool ManagerService::SendConsoleInput(const std::string& vm_id, const std::strin
     msg.type = "console.input";
     msg.vm_id = vm_id;
     msg.request_id = GetTickCount64();
-    msg.fields["data_hex"] = EncodeHex(input);
+    msg.payload.assign(input.begin(), input.end());
 
-    std::string encoded = ipc::Encode(msg);
-    DWORD written = 0;
-    return WriteFile(pipe, encoded.data(), static_cast<DWORD>(encoded.size()), &written, nullptr)
-        && written == encoded.size();
+    std::string encoded = ipc::Encode(msg, protocol);
+    return ipc::PipeWrite(pipe, encoded.data(), encoded.size());
 }
 
-void ManagerService::StartReadThread(const std::string& vm_id, VmRecord& vm) {
-    if (vm.runtime.read_running.load()) return;
-    if (vm.runtime.read_thread.joinable()) {
-        vm.runtime.read_thread.join();
-    }
-    vm.runtime.read_running.store(true);
-    vm.runtime.read_thread = std::thread(&ManagerService::PipeReadThreadFunc, this, vm_id);
+void ManagerService::StartReading(const std::string& vm_id, VmRecord& vm) {
+    if (vm.runtime.reader || !vm.runtime.pipe_handle) return;
+    // Only one read of a pipe is in flight, so its decoder needs no lock.
+    auto decoder = std::make_shared<ipc::StreamDecoder>();
+    vm.runtime.reader = pipe_io_.Add(
+        vm.runtime.pipe_handle,
+        [this, vm_id, decoder](const char* data, size_t size) {
+            decoder->Append(data, size);
+            DispatchPipeData(*decoder, vm_id);
+        },
+        // The pipe breaks when the runtime exits.
+        [this, vm_id]() { HandleProcessExit(vm_id); });
 }
 
-void ManagerService::StopReadThread(VmRecord& vm) {
-    vm.runtime.read_running.store(false);
-    if (vm.runtime.pipe_handle) {
-        CancelIoEx(reinterpret_cast<HANDLE>(vm.runtime.pipe_handle), nullptr);
-    }
-    if (vm.runtime.read_thread.joinable()) {
-        vm.runtime.read_thread.join();
-    }
-}
-
-void ManagerService::DispatchPipeData(std::string& pending, PipeParseState& parse,
-                                      const std::string& vm_id) {
-    while (!pending.empty()) {
-        if (parse.payload_needed > 0) {
-            if (pending.size() < parse.payload_needed) return;
-            parse.pending_msg.payload.assign(
-                reinterpret_cast<const uint8_t*>(pending.data()),
-                reinterpret_cast<const uint8_t*>(pending.data()) + parse.payload_needed);
-            pending.erase(0, parse.payload_needed);
-            parse.payload_needed = 0;
-            HandleIncomingMessage(vm_id, parse.pending_msg);
-            continue;
-        }
-
-        size_t nl = pending.find('\n');
-        if (nl == std::string::npos) return;
-        std::string line = pending.substr(0, nl + 1);
-        pending.erase(0, nl + 1);
-        auto decoded = ipc::Decode(line);
-        if (!decoded) continue;
-
-        auto ps_it = decoded->fields.find("payload_size");
-        if (ps_it != decoded->fields.end()) {
-            parse.payload_needed = std::strtoull(ps_it->second.c_str(), nullptr, 10);
-            decoded->fields.erase(ps_it);
-            if (parse.payload_needed > 0) {
-                parse.pending_msg = std::move(*decoded);
-                continue;
-            }
+void ManagerService::StopReading(VmRecord& vm) {
+    if (!vm.runtime.reader) return;
+    pipe_io_.Remove(vm.runtime.reader);
+    vm.runtime.reader = 0;
+}
+
+void ManagerService::DispatchPipeData(ipc::StreamDecoder& decoder, const std::string& vm_id) {
+    ipc::Message msg;
+    uint32_t frames = 0;
+    while (decoder.Next(&msg)) {
+        if (msg.type == "display.frame") frames++;
+        HandleIncomingMessage(vm_id, msg);
+    }
+    if (!frames) return;
+
+    // One ack per read returns the runtime's frame credits.
+    ipc::Message ack;
+    ack.channel = ipc::Channel::kDisplay;
+    ack.kind = ipc::Kind::kRequest;
+    ack.type = "display.ack";
+    ack.vm_id = vm_id;
+    ack.request_id = GetTickCount64();
+    ack.fields["frames"] = std::to_string(frames);
+    std::lock_guard<std::mutex> lock(vms_mutex_);
+    auto it = vms_.find(vm_id);
+    if (it != vms_.end() && it->second.runtime.pipe_handle) {
+        if (!SendRuntimeMessage(it->second, ack)) {
+            LOG_WARN("VM %s: display ack failed, frames stay in flight", vm_id.c_str());
         }
-        HandleIncomingMessage(vm_id, *decoded);
     }
 }
 
@@ -1064,14 +1900,15 @@ void ManagerService::HandleProcessExit(const std::string& vm_id) {
         vm.reboot_pending = false;
         vm.guest_agent_connected = false;
         vm.state = VmPowerState::kStopped;
+        MarkChanged(vm);
         cb = state_change_callback_;
     }
     if (cb) cb(vm_id);
 
     if (needs_reboot) {
         LOG_INFO("VM %s requested reboot, restarting...", vm_id.c_str());
-        // Must spawn a new thread because we're currently in the read_thread
-        // and StartVm will try to join it (can't join self).
+        // StartVm waits for the new runtime's pipe, which must not hold up
+        // a pipe I/O thread.
         std::thread([this, vm_id]() {
             StateChangeCallback cb_after;
             {
@@ -1088,79 +1925,12 @@ void ManagerService::HandleProcessExit(const std::string& vm_id) {
     }
 }
 
-void ManagerService::PipeReadThreadFunc(const std::string& vm_id) {
-    HANDLE pipe = INVALID_HANDLE_VALUE;
-    HANDLE process = INVALID_HANDLE_VALUE;
-    std::atomic<bool>* running_flag = nullptr;
-    {
-        std::lock_guard<std::mutex> lock(vms_mutex_);
-        auto it = vms_.find(vm_id);
-        if (it == vms_.end()) return;
-        pipe = reinterpret_cast<HANDLE>(it->second.runtime.pipe_handle);
-        process = reinterpret_cast<HANDLE>(it->second.runtime.process_handle);
-        running_flag = &it->second.runtime.read_running;
-    }
-    if (!pipe || pipe == INVALID_HANDLE_VALUE || !running_flag) return;
-
-    std::array<char, 65536> buf{};
-    std::string pending;
-    PipeParseState parse;
-    bool process_exited = false;
-    DWORD idle_count = 0;
-
-    while (running_flag->load()) {
-        DWORD available = 0;
-        if (!PeekNamedPipe(pipe, nullptr, 0, nullptr, &available, nullptr)) {
-            DWORD err = GetLastError();
-            if (err == ERROR_BROKEN_PIPE || err == ERROR_INVALID_HANDLE) {
-                process_exited = true;
-                break;
-            }
-            Sleep(10);
-            idle_count++;
-        } else if (available == 0) {
-            Sleep(10);
-            idle_count++;
-        } else {
-            idle_count = 0;
-            DWORD to_read = (std::min)(available, static_cast<DWORD>(buf.size()));
-            DWORD bytes_read = 0;
-            if (!ReadFile(pipe, buf.data(), to_read, &bytes_read, nullptr)) {
-                DWORD err = GetLastError();
-                if (err == ERROR_BROKEN_PIPE || err == ERROR_OPERATION_ABORTED) {
-                    process_exited = true;
-                    break;
-                }
-                continue;
-            }
-            if (bytes_read > 0) {
-                pending.append(buf.data(), bytes_read);
-                DispatchPipeData(pending, parse, vm_id);
-            }
-        }
-
-        if (idle_count >= 50 && process && process != INVALID_HANDLE_VALUE) {
-            DWORD exit_code = 0;
-            if (GetExitCodeProcess(process, &exit_code) && exit_code != STILL_ACTIVE) {
-                process_exited = true;
-                break;
-            }
-            idle_count = 0;
-        }
-    }
-
-    if (process_exited) {
-        HandleProcessExit(vm_id);
-    }
-}
-
 void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::Message& msg) {
     if (msg.channel == ipc::Channel::kConsole &&
         msg.kind == ipc::Kind::kEvent &&
         msg.type == "console.data") {
-        auto it = msg.fields.find("data_hex");
-        if (it != msg.fields.end()) {
-            std::string data = DecodeHex(it->second);
+        if (!msg.payload.empty()) {
+            std::string data(msg.payload.begin(), msg.payload.end());
             ConsoleCallback cb;
             {
                 std::lock_guard<std::mutex> lock(vms_mutex_);
@@ -1174,52 +1944,110 @@ void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::
     if (msg.channel == ipc::Channel::kDisplay &&
         msg.kind == ipc::Kind::kEvent &&
         msg.type == "display.frame") {
+        const auto* body = std::get_if<ipc::DisplayFrameBody>(&msg.body);
+        if (!body || body->scanout >= kMaxDisplayScanouts) return;
+        auto handle_start = std::chrono::steady_clock::now();
         DisplayFrame frame;
-        auto get = [&](const char* key) -> uint32_t {
-            auto it = msg.fields.find(key);
-            return (it != msg.fields.end()) ? static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10)) : 0;
-        };
-        frame.width = get("width");
-        frame.height = get("height");
-        frame.stride = get("stride");
-        frame.format = get("format");
-        frame.resource_width = get("resource_width");
-        frame.resource_height = get("resource_height");
-        frame.dirty_x = get("dirty_x");
-        frame.dirty_y = get("dirty_y");
-        frame.pixels = std::move(msg.payload);
+        frame.scanout_id = body->scanout;
+        frame.width = body->width;
+        frame.height = body->height;
+        frame.stride = body->stride;
+        frame.format = body->format;
+        frame.resource_width = body->resource_width;
+        frame.resource_height = body->resource_height;
+        frame.dirty_x = body->dirty_x;
+        frame.dirty_y = body->dirty_y;
+        size_t frame_bytes = static_cast<size_t>(frame.width) * frame.height *
+                             ipc::SharedFramebuffer::kBytesPerPixel;
+        auto shm = msg.fields.find("shm_name");
+        if (shm != msg.fields.end()) {
+            // Pixels are in the runtime's shared surface; the frame reads
+            // the rect straight out of our view of it.
+            bool unmappable = false;
+            {
+                std::lock_guard<std::mutex> lock(fb_views_mutex_);
+                auto& view = fb_views_[vm_id][frame.scanout_id];
+                if (!view || view->name() != shm->second ||
+                    view->width() != frame.resource_width ||
+                    view->height() != frame.resource_height) {
+                    auto fresh = std::make_shared<ipc::SharedFramebuffer>();
+                    if (!fresh->Open(shm->second, frame.resource_width, frame.resource_height))
+                        unmappable = fb_pipe_only_.insert(vm_id).second;
+                    view = std::move(fresh);
+                }
+                if (view->IsOpen() && frame.dirty_x < view->width() &&
+                    frame.dirty_y < view->height()) {
+                    frame.width = (std::min)(frame.width, view->width() - frame.dirty_x);
+                    frame.height = (std::min)(frame.height, view->height() - frame.dirty_y);
+                    frame.stride = view->stride();
+                    frame.data = view->data() + static_cast<size_t>(frame.dirty_y) * view->stride() +
+                                 static_cast<size_t>(frame.dirty_x) *
+                                     ipc::SharedFramebuffer::kBytesPerPixel;
+                    frame.source = view;
+                }
+            }
+            // A section we cannot open usually means the runtime is on
+            // another host; it resends the screen once switched over.
+            if (unmappable) {
+                LOG_INFO("VM %s: shared framebuffer not mappable, using compressed frames",
+                         vm_id.c_str());
+                RequestPipeDisplay(vm_id);
+            }
+            if (!frame.data) return;
+        } else if (body->encoding != static_cast<uint8_t>(ipc::FrameEncoding::kRaw)) {
+            static thread_local ipc::FrameCodec codec;
+            if (body->encoding != static_cast<uint8_t>(ipc::FrameEncoding::kZstd) ||
+                !codec.Decompress(msg.payload.data(), msg.payload.size(), frame_bytes,
+                                  &frame.pixels)) {
+                return;
+            }
+        } else {
+            frame.pixels = std::move(msg.payload);
+        }
 
         DisplayCallback cb;
         {
             std::lock_guard<std::mutex> lock(vms_mutex_);
             cb = display_callback_;
         }
+        uint32_t scanout = frame.scanout_id;
         if (cb) cb(vm_id, std::move(frame));
+        if (ipc::etw::Enabled(ipc::etw::kKeywordDisplay)) {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - handle_start).count();
+            ipc::etw::FrameHandled(vm_id, scanout, static_cast<uint64_t>(us));
+        }
         return;
     }
 
     if (msg.channel == ipc::Channel::kDisplay &&
         msg.kind == ipc::Kind::kEvent &&
         msg.type == "display.cursor") {
+        const auto* body = std::get_if<ipc::DisplayCursorBody>(&msg.body);
+        if (!body) return;
         CursorInfo cursor;
-        auto get = [&](const char* key) -> uint32_t {
-            auto it = msg.fields.find(key);
-            return (it != msg.fields.end()) ? static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10)) : 0;
-        };
-        auto get_signed = [&](const char* key) -> int32_t {
-            auto it = msg.fields.find(key);
-            return (it != msg.fields.end()) ? static_cast<int32_t>(std::strtol(it->second.c_str(), nullptr, 10)) : 0;
-        };
-        cursor.x = get_signed("x");
-        cursor.y = get_signed("y");
-        cursor.hot_x = get("hot_x");
-        cursor.hot_y = get("hot_y");
-        cursor.width = get("width");
-        cursor.height = get("height");
-        cursor.visible = (get("visible") != 0);
-        cursor.image_updated = (get("image_updated") != 0);
-        if (cursor.image_updated) {
-            cursor.pixels = msg.payload;
+        cursor.scanout_id = body->scanout;
+        cursor.x = body->x;
+        cursor.y = body->y;
+        cursor.hot_x = body->hot_x;
+        cursor.hot_y = body->hot_y;
+        cursor.width = body->width;
+        cursor.height = body->height;
+        cursor.visible = body->visible != 0;
+        cursor.image_updated = body->image_updated != 0;
+        cursor.image_id = body->image_id;
+        if (cursor.image_updated && cursor.image_id != 0) {
+            std::lock_guard<std::mutex> lock(fb_views_mutex_);
+            auto& images = cursor_images_[vm_id];
+            if (!msg.payload.empty()) {
+                cursor.pixels = msg.payload;
+                images.push_back({cursor.image_id, msg.payload});
+                if (images.size() > kCursorImageCacheSize) images.pop_front();
+            } else {
+                auto it = std::find_if(images.begin(), images.end(),
+                    [&](const CursorImage& image) { return image.id == cursor.image_id; });
+                if (it != images.end()) cursor.pixels = it->pixels;
+            }
         }
 
         CursorCallback cb;
@@ -1240,21 +2068,25 @@ void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::
         };
         auto it = msg.fields.find("active");
         bool active = (it != msg.fields.end() && it->second == "1");
+        uint32_t scanout_id = get("scanout");
         uint32_t width = get("width");
         uint32_t height = get("height");
+        if (scanout_id >= kMaxDisplayScanouts) return;
 
         DisplayStateCallback cb;
         {
             std::lock_guard<std::mutex> lock(vms_mutex_);
             cb = display_state_callback_;
         }
-        if (cb) cb(vm_id, active, width, height);
+        if (cb) cb(vm_id, scanout_id, active, width, height);
         return;
     }
 
     if (msg.channel == ipc::Channel::kControl &&
         msg.kind == ipc::Kind::kEvent &&
         msg.type == "runtime.state") {
+        std::shared_ptr<ipc::PcmRing> audio_ring;
+        AudioRingCallback audio_ring_cb;
         auto it = msg.fields.find("state");
         if (it != msg.fields.end()) {
             std::lock_guard<std::mutex> lock(vms_mutex_);
@@ -1271,9 +2103,296 @@ void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::
                     vm_it->second.state = VmPowerState::kCrashed;
                 } else if (state_str == "rebooting") {
                     vm_it->second.reboot_pending = true;
+
+                }
+                MarkChanged(vm_it->second);
+                NegotiateProtocolLocked(vm_it->second, msg);
+                // Runtimes start out with a viewer.
+                if (!vm_it->second.display_viewer) SendDisplayViewerLocked(vm_it->second);
+
+                auto ring_it = msg.fields.find("input_ring");
+                if (ring_it != msg.fields.end()) {
+                    std::lock_guard<std::mutex> input_lock(input_mutex_);
+                    auto& ring = input_rings_[vm_id];
+                    if (!ring || ring->name() != ring_it->second) {
+                        ring = std::make_unique<ipc::InputRing>();
+                        if (!ring->Open(ring_it->second)) {
+                            LOG_WARN("VM %s: cannot open input ring %s", vm_id.c_str(),
+                                     ring_it->second.c_str());
+                            input_rings_.erase(vm_id);
+                        }
+                    }
+                }
+
+                auto audio_it = msg.fields.find("audio_ring");
+                if (audio_it != msg.fields.end() && audio_ring_callback_) {
+                    audio_ring = std::make_shared<ipc::PcmRing>();
+                    if (audio_ring->Open(audio_it->second)) {
+                        audio_ring_cb = audio_ring_callback_;
+                    } else {
+                        LOG_WARN("VM %s: cannot open audio ring %s", vm_id.c_str(),
+                                 audio_it->second.c_str());
+                    }
+                }
+
+                auto capture_it = msg.fields.find("capture_ring");
+                if (capture_it != msg.fields.end()) {
+                    auto& ring = capture_rings_[vm_id];
+                    if (!ring || ring->name() != capture_it->second) {
+                        ring = std::make_shared<ipc::PcmRing>();
+                        if (!ring->Open(capture_it->second)) {
+                            LOG_WARN("VM %s: cannot open capture ring %s", vm_id.c_str(),
+                                     capture_it->second.c_str());
+                            capture_rings_.erase(vm_id);
+                        }
+                    }
+                }
+
+                auto metrics_it = msg.fields.find("metrics");
+                if (metrics_it != msg.fields.end()) {
+                    auto& channel = metrics_[vm_id];
+                    if (!channel || channel->block.name() != metrics_it->second) {
+                        channel = std::make_unique<MetricsChannel>();
+                        if (!channel->block.Open(metrics_it->second)) {
+                            LOG_WARN("VM %s: cannot open metrics block %s", vm_id.c_str(),
+                                     metrics_it->second.c_str());
+                            metrics_.erase(vm_id);
+                        }
+                    }
                 }
             }
         }
+        if (audio_ring_cb) audio_ring_cb(vm_id, std::move(audio_ring));
+        return;
+    }
+
+    if (msg.channel == ipc::Channel::kControl &&
+        msg.kind == ipc::Kind::kResponse &&
+        msg.type == "runtime.stats.result") {
+        auto field = [&](const std::string& key) -> std::string {
+            auto it = msg.fields.find(key);
+            return it != msg.fields.end() ? it->second : std::string();
+        };
+        if (field("ok") != "true") return;
+
+        VmRuntimeStats stats;
+        unsigned vcpus = 0, count = 0;
+        std::sscanf(field("vcpu_count").c_str(), "%u", &vcpus);
+        std::sscanf(field("stat_count").c_str(), "%u", &count);
+        for (unsigned v = 0; v < vcpus; ++v) {
+            VmHaltStat halt;
+            unsigned long long halts = 0, halted_ns = 0, polled = 0;
+            unsigned poll_us = 0;
+            if (std::sscanf(field("halt_" + std::to_string(v)).c_str(),
+                            "%llu|%llu|%llu|%u", &halts, &halted_ns, &polled,
+                            &poll_us) == 4) {
+                halt = {halts, halted_ns, polled, poll_us};
+            }
+            stats.halts.push_back(halt);
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            // vcpu|name|count|total_ns|max_ns|h0,h1,...
+            std::string val = field("stat_" + std::to_string(i));
+            size_t p1 = val.find('|');
+            size_t p2 = p1 == std::string::npos ? p1 : val.find('|', p1 + 1);
+            if (p2 == std::string::npos) continue;
+
+            VmExitStat stat;
+            unsigned long long n = 0, total = 0, max = 0;
+            int consumed = 0;
+            stat.vcpu = static_cast<uint32_t>(std::strtoul(val.c_str(), nullptr, 10));
+            stat.name = val.substr(p1 + 1, p2 - p1 - 1);
+            if (std::sscanf(val.c_str() + p2 + 1, "%llu|%llu|%llu|%n",
+                            &n, &total, &max, &consumed) != 3 || !consumed) {
+                continue;
+            }
+            stat.count = n;
+            stat.total_ns = total;
+            stat.max_ns = max;
+            const char* h = val.c_str() + p2 + 1 + consumed;
+            while (*h) {
+                char* end = nullptr;
+                stat.histogram.push_back(std::strtoull(h, &end, 10));
+                if (end == h) break;
+                h = *end == ',' ? end + 1 : end;
+            }
+            stats.exits.push_back(std::move(stat));
+        }
+        ParseDedupStat(field("dedup"), &stats.dedup);
+
+        // target|actual|reported|hinted, in bytes
+        unsigned long long target = 0, actual = 0, reported = 0, hinted = 0;
+        if (std::sscanf(field("balloon").c_str(), "%llu|%llu|%llu|%llu",
+                        &target, &actual, &reported, &hinted) == 4) {
+            stats.balloon = {target, actual, reported, hinted};
+        }
+        // tx_dropped|shaper_dropped, in frames
+        unsigned long long tx_dropped = 0, shaper_dropped = 0;
+        if (std::sscanf(field("net_dropped").c_str(), "%llu|%llu",
+                        &tx_dropped, &shaper_dropped) == 2) {
+            stats.net = {tx_dropped, shaper_dropped};
+        }
+        unsigned forwards = 0;
+        std::sscanf(field("pf_count").c_str(), "%u", &forwards);
+        for (unsigned i = 0; i < forwards; ++i) {
+            // host_port|guest_port|accepted|active|bytes_to_guest|bytes_to_host
+            unsigned hp = 0, gp = 0, active = 0;
+            unsigned long long accepted = 0, to_guest = 0, to_host = 0;
+            if (std::sscanf(field("pf_" + std::to_string(i)).c_str(),
+                            "%u|%u|%llu|%u|%llu|%llu", &hp, &gp, &accepted,
+                            &active, &to_guest, &to_host) != 6) {
+                continue;
+            }
+            stats.port_forwards.push_back({static_cast<uint16_t>(hp),
+                                           static_cast<uint16_t>(gp), accepted,
+                                           active, to_guest, to_host});
+        }
+        unsigned fs_ops = 0;
+        std::sscanf(field("fsop_count").c_str(), "%u", &fs_ops);
+        for (unsigned i = 0; i < fs_ops; ++i) {
+            // name|count|errors|total_us|max_us|p50_us|p99_us
+            std::string val = field("fsop_" + std::to_string(i));
+            size_t bar = val.find('|');
+            if (bar == std::string::npos) continue;
+            VmFsOpStat op;
+            op.name = val.substr(0, bar);
+            unsigned long long n = 0, errors = 0, total = 0, max = 0, p50 = 0, p99 = 0;
+            if (std::sscanf(val.c_str() + bar + 1, "%llu|%llu|%llu|%llu|%llu|%llu",
+                            &n, &errors, &total, &max, &p50, &p99) != 6) {
+                continue;
+            }
+            op.count = n;
+            op.errors = errors;
+            op.total_us = total;
+            op.max_us = max;
+            op.p50_us = p50;
+            op.p99_us = p99;
+            stats.fs_ops.push_back(std::move(op));
+        }
+        unsigned phases = 0;
+        std::sscanf(field("startup_count").c_str(), "%u", &phases);
+        for (unsigned i = 0; i < phases; ++i) {
+            std::string val = field("startup_" + std::to_string(i));
+            size_t bar = val.find('|');
+            if (bar == std::string::npos) continue;
+            stats.startup.push_back({val.substr(bar + 1),
+                                     std::strtoull(val.c_str(), nullptr, 10)});
+        }
+
+        RuntimeStatsCallback cb;
+        {
+            std::lock_guard<std::mutex> lock(vms_mutex_);
+            cb = runtime_stats_callback_;
+        }
+        if (cb) cb(vm_id, stats);
+        return;
+    }
+
+    // A transfer the runtime refused ends here; one it started ends with
+    // runtime.file_transfer.done.
+    if (msg.channel == ipc::Channel::kControl &&
+        (msg.type == "runtime.file_transfer.result" ||
+         msg.type == "runtime.file_transfer.progress" ||
+         msg.type == "runtime.file_transfer.done")) {
+        auto field = [&](const std::string& key) -> std::string {
+            auto it = msg.fields.find(key);
+            return it != msg.fields.end() ? it->second : std::string();
+        };
+        VmFileTransferStatus status;
+        status.id = std::strtoull(field("id").c_str(), nullptr, 10);
+        status.bytes = std::strtoull(field("bytes").c_str(), nullptr, 10);
+        status.total = std::strtoull(field("total").c_str(), nullptr, 10);
+        if (msg.type == "runtime.file_transfer.result") {
+            if (field("ok") == "true") return;
+            status.done = true;
+        } else {
+            status.done = msg.type == "runtime.file_transfer.done";
+            status.ok = status.done && field("ok") == "true";
+        }
+        status.error = field("error");
+
+        FileTransferCallback cb;
+        {
+            std::lock_guard<std::mutex> lock(vms_mutex_);
+            cb = file_transfer_callback_;
+        }
+        if (cb) cb(vm_id, status);
+        return;
+    }
+
+    // A runtime finished a shareable page scan. Combining merges identical
+    // pages of every process at once, so only one runtime is asked per
+    // interval, and only once some guest has stable pages not yet shared.
+    if (msg.channel == ipc::Channel::kControl &&
+        msg.kind == ipc::Kind::kEvent &&
+        msg.type == "runtime.dedup_pass") {
+        auto it = msg.fields.find("dedup");
+        VmDedupStat dedup;
+        if (it == msg.fields.end() || !ParseDedupStat(it->second, &dedup)) return;
+        if (dedup.stable_pages <= dedup.shared_pages) return;
+
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        uint64_t now = GetTickCount64();
+        if (last_page_combine_ms_ && now - last_page_combine_ms_ < kPageCombineIntervalMs)
+            return;
+        auto vm_it = vms_.find(vm_id);
+        if (vm_it == vms_.end() || vm_it->second.state != VmPowerState::kRunning) return;
+        last_page_combine_ms_ = now;
+
+        ipc::Message req;
+        req.channel = ipc::Channel::kControl;
+        req.kind = ipc::Kind::kRequest;
+        req.type = "runtime.combine_pages";
+        req.vm_id = vm_id;
+        req.request_id = now;
+        SendRuntimeMessage(vm_it->second, req);
+        return;
+    }
+
+    // A live resize the runtime took or refused, and the sizes the guest
+    // reached since. Only one the runtime took reaches the manifest, and
+    // then with what the guest really has once the runtime exits.
+    if (msg.channel == ipc::Channel::kControl &&
+        (msg.type == "runtime.set_resources.result" || msg.type == "runtime.resources")) {
+        auto field = [&](const std::string& key) -> std::string {
+            auto it = msg.fields.find(key);
+            return it != msg.fields.end() ? it->second : std::string();
+        };
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto vm_it = vms_.find(vm_id);
+        if (vm_it == vms_.end()) return;
+        VmRecord& vm = vm_it->second;
+        uint32_t cpus = static_cast<uint32_t>(std::strtoul(field("cpu_count").c_str(), nullptr, 10));
+        uint64_t memory_mb = std::strtoull(field("memory_mb").c_str(), nullptr, 10);
+        if (cpus) vm.live_cpu_count = cpus;
+        if (memory_mb) vm.live_memory_mb = memory_mb;
+        if (msg.type == "runtime.set_resources.result") {
+            if (field("ok") == "true") {
+                vm.resized_live = true;
+            } else {
+                LOG_WARN("VM %s: live resize refused: %s", vm_id.c_str(),
+                         field("error").c_str());
+            }
+        }
+        MarkChanged(vm);
+        return;
+    }
+
+    if (msg.channel == ipc::Channel::kControl && msg.type == "runtime.net_capture.result") {
+        auto field = [&](const std::string& key) -> std::string {
+            auto it = msg.fields.find(key);
+            return it != msg.fields.end() ? it->second : std::string();
+        };
+        std::lock_guard<std::mutex> lock(vms_mutex_);
+        auto vm_it = vms_.find(vm_id);
+        if (vm_it == vms_.end()) return;
+        VmRecord& vm = vm_it->second;
+        if (field("ok") == "true") {
+            vm.net_capturing = field("action") == "start";
+        } else {
+            LOG_WARN("VM %s: net capture failed: %s", vm_id.c_str(), field("error").c_str());
+        }
+        MarkChanged(vm);
         return;
     }
 
@@ -1290,6 +2409,7 @@ void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::
                 auto vm_it = vms_.find(vm_id);
                 if (vm_it != vms_.end()) {
                     vm_it->second.guest_agent_connected = connected;
+                    MarkChanged(vm_it->second);
                 }
                 cb = guest_agent_state_callback_;
             }
@@ -1302,13 +2422,11 @@ void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::
     if (msg.channel == ipc::Channel::kAudio &&
         msg.kind == ipc::Kind::kEvent &&
         msg.type == "audio.pcm") {
+        const auto* body = std::get_if<ipc::AudioPcmBody>(&msg.body);
+        if (!body) return;
         AudioChunk chunk;
-        auto get = [&](const char* key) -> uint32_t {
-            auto it = msg.fields.find(key);
-            return (it != msg.fields.end()) ? static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10)) : 0;
-        };
-        chunk.sample_rate = get("sample_rate");
-        chunk.channels = static_cast<uint16_t>(get("channels"));
+        chunk.sample_rate = body->sample_rate;
+        chunk.channels = body->channels;
         if (!msg.payload.empty()) {
             size_t sample_count = msg.payload.size() / sizeof(int16_t);
             chunk.pcm.resize(sample_count);
@@ -1325,6 +2443,23 @@ void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::
         return;
     }
 
+    if (msg.channel == ipc::Channel::kAudio &&
+        msg.kind == ipc::Kind::kEvent &&
+        msg.type == "audio.capture") {
+        auto it = msg.fields.find("active");
+        bool active = it != msg.fields.end() && it->second == "true";
+        std::shared_ptr<ipc::PcmRing> ring;
+        AudioCaptureCallback cb;
+        {
+            std::lock_guard<std::mutex> lock(vms_mutex_);
+            auto ring_it = capture_rings_.find(vm_id);
+            if (active && ring_it != capture_rings_.end()) ring = ring_it->second;
+            cb = audio_capture_callback_;
+        }
+        if (cb) cb(vm_id, std::move(ring));
+        return;
+    }
+
     // Clipboard events from VM
     if (msg.channel == ipc::Channel::kClipboard &&
         msg.kind == ipc::Kind::kEvent) {
@@ -1358,17 +2493,47 @@ void ManagerService::HandleIncomingMessage(const std::string& vm_id, const ipc::
         }
 
         if (msg.type == "clipboard.data") {
-            auto it_type = msg.fields.find("data_type");
-            if (it_type != msg.fields.end()) {
-                uint32_t data_type = static_cast<uint32_t>(std::strtoul(it_type->second.c_str(), nullptr, 10));
-
-                ClipboardDataCallback cb;
-                {
-                    std::lock_guard<std::mutex> lock(vms_mutex_);
-                    cb = clipboard_data_callback_;
+            auto field = [&](const std::string& key) -> std::string {
+                auto it = msg.fields.find(key);
+                return it != msg.fields.end() ? it->second : std::string();
+            };
+            std::string type_str = field("data_type");
+            if (type_str.empty()) return;
+            uint32_t data_type = static_cast<uint32_t>(std::strtoul(type_str.c_str(), nullptr, 10));
+            // Pieces in order; without a total the payload is all of it.
+            uint64_t offset = std::strtoull(field("offset").c_str(), nullptr, 10);
+            std::string total_str = field("total");
+            uint64_t total = total_str.empty() ? msg.payload.size()
+                                               : std::strtoull(total_str.c_str(), nullptr, 10);
+
+            std::vector<uint8_t> data;
+            ClipboardDataCallback cb;
+            {
+                std::lock_guard<std::mutex> lock(vms_mutex_);
+                auto& in = clipboard_incoming_[vm_id];
+                if (offset == 0) {
+                    in.data.clear();
+                    in.type = data_type;
+                    in.total = total;
+                    if (total > ClipboardEvent::kMaxSize) {
+                        LOG_WARN("VM %s: clipboard data of %llu bytes dropped",
+                                 vm_id.c_str(), (unsigned long long)total);
+                        clipboard_incoming_.erase(vm_id);
+                        return;
+                    }
+                    in.data.reserve(static_cast<size_t>(total));
+                } else if (offset != in.data.size() || in.type != data_type ||
+                           in.data.size() + msg.payload.size() > in.total) {
+                    clipboard_incoming_.erase(vm_id);
+                    return;
                 }
-                if (cb) cb(vm_id, data_type, msg.payload);
+                in.data.insert(in.data.end(), msg.payload.begin(), msg.payload.end());
+                if (in.data.size() < in.total) return;
+                data = std::move(in.data);
+                clipboard_incoming_.erase(vm_id);
+                cb = clipboard_data_callback_;
             }
+            if (cb) cb(vm_id, data_type, data);
             return;
         }
 
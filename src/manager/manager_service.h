@@ -2,31 +2,38 @@
 
 #include "common/ports.h"
 #include "common/vm_model.h"
-#include "ipc/protocol_v1.h"
+#include "ipc/frame_codec.h"
+#include "ipc/input_ring.h"
+#include "ipc/metrics_block.h"
+#include "ipc/pcm_ring.h"
+#include "ipc/protocol_v2.h"
+#include "ipc/shared_framebuffer.h"
 #include "manager/app_settings.h"
+#include "manager/pipe_io_pool.h"
 #include "core/vdagent/vdagent_protocol.h"
 
+#include <array>
 #include <atomic>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-struct PipeParseState {
-    size_t payload_needed = 0;
-    ipc::Message pending_msg;
-};
-
 struct VmRuntimeHandle {
     void* process_handle = nullptr;
     uint32_t process_id = 0;
     void* pipe_handle = nullptr;
     std::string pipe_name;
-    std::thread read_thread;
-    std::atomic<bool> read_running{false};
+    // Version the runtime is sent; raised once it says it can take more.
+    uint32_t protocol = ipc::kTextProtocolVersion;
+    // Pipe reader in the pool, 0 when not reading.
+    uint64_t reader = 0;
 
     VmRuntimeHandle() = default;
     VmRuntimeHandle(const VmRuntimeHandle& o)
@@ -34,14 +41,16 @@ struct VmRuntimeHandle {
           process_id(o.process_id),
           pipe_handle(o.pipe_handle),
           pipe_name(o.pipe_name),
-          read_running(o.read_running.load()) {}
+          protocol(o.protocol),
+          reader(o.reader) {}
     VmRuntimeHandle& operator=(const VmRuntimeHandle& o) {
         if (this != &o) {
             process_handle = o.process_handle;
             process_id = o.process_id;
             pipe_handle = o.pipe_handle;
             pipe_name = o.pipe_name;
-            read_running.store(o.read_running.load());
+            protocol = o.protocol;
+            reader = o.reader;
         }
         return *this;
     }
@@ -57,6 +66,28 @@ struct VmRecord {
     int last_exit_code = 0;
     bool reboot_pending = false;
     bool guest_agent_connected = false;
+    // Whether the UI shows this VM's display; the runtime stops making
+    // frames while it does not. See SetDisplayViewer.
+    bool display_viewer = true;
+    // Snapshot the running runtime resumed from; deleted once it exits.
+    std::string consumed_snapshot;
+    // What the running runtime was launched with. cpu_count and memory_mb
+    // change live within these; see EditVm. The spec keeps the launch sizes
+    // while it runs.
+    uint64_t boot_memory_mb = 0;
+    uint64_t max_memory_mb = 0;
+    uint32_t max_cpu_count = 0;
+    // What the guest has, as the runtime last reported it.
+    uint32_t live_cpu_count = 0;
+    uint64_t live_memory_mb = 0;
+    // The runtime took a live resize; the next boot uses the live sizes
+    // unless the runtime exits into a snapshot.
+    bool resized_live = false;
+    // The runtime writes the guest's traffic to a capture file; see
+    // StartNetCapture.
+    bool net_capturing = false;
+    // Manager revision of the last change to the record; see GetVmChanges.
+    uint64_t revision = 0;
 
     VmRecord() = default;
     VmRecord(VmSpec s) : spec(std::move(s)) {}
@@ -66,6 +97,20 @@ struct VmRecord {
     VmRecord& operator=(VmRecord&&) = default;
 };
 
+// Whether a running VM takes the patch's cpu_count and memory_mb without a
+// reboot: it was launched with room to hotplug them and both fit.
+bool ResizesLive(const VmRecord& vm, const VmMutablePatch& patch);
+
+// The VM list as changed since a revision the caller has seen.
+struct VmListDelta {
+    uint64_t revision = 0;  // pass back as `since` next time
+    // `since` predates what the manager remembers of removals: `changed`
+    // then holds every VM and anything not in it is gone.
+    bool reset = false;
+    std::vector<VmRecord> changed;  // added or modified, in no order
+    std::vector<std::string> removed;
+};
+
 // Source paths the user picked in the "Create VM" dialog.
 // These files will be copied into the new VM directory.
 struct VmCreateRequest {
@@ -78,6 +123,9 @@ struct VmCreateRequest {
     uint64_t memory_mb = 4096;
     uint32_t cpu_count = 4;
     bool nat_enabled = false;
+    // Create a qcow2 overlay on top of source_disk instead of copying it.
+    // The base disk is referenced in place and must stay unmodified.
+    bool linked_clone = false;
 };
 
 class ManagerService {
@@ -85,17 +133,39 @@ public:
     ManagerService(std::string runtime_exe_path, std::string data_dir);
     ~ManagerService();
 
-    bool CreateVm(const VmCreateRequest& req, std::string* error);
+    bool CreateVm(const VmCreateRequest& req, std::string* error,
+                  std::string* vm_id = nullptr);
     bool DeleteVm(const std::string& vm_id, std::string* error);
     bool EditVm(const std::string& vm_id, const VmMutablePatch& patch, std::string* error);
     bool StartVm(const std::string& vm_id, std::string* error);
+    // Starts several VMs at once, at most max_concurrent_starts of them
+    // launching at a time, and returns when each is running or has failed.
+    // Takes the lock itself, unlike StartVm; `errors` gets a message per
+    // VM that did not start.
+    bool StartVms(const std::vector<std::string>& vm_ids,
+                  std::unordered_map<std::string, std::string>* errors = nullptr);
     bool StopVm(const std::string& vm_id, std::string* error);
     bool RebootVm(const std::string& vm_id, std::string* error);
+    // Saves the VM to a snapshot in its directory and stops the runtime;
+    // the next StartVm resumes from it.
+    bool SuspendVm(const std::string& vm_id, std::string* error);
+    // Saves a running VM as a template: a snapshot clones resume from, with
+    // its disk as their overlays' base. The template itself never boots again.
+    bool MakeTemplate(const std::string& vm_id, std::string* error);
+    // Creates and starts a clone of a template. The clone maps the template
+    // RAM copy-on-write and writes to a qcow2 overlay of the template disk.
+    bool ForkVm(const std::string& template_id, std::string* clone_id, std::string* error);
     bool ShutdownVm(const std::string& vm_id, std::string* error);
     void ShutdownAll();
 
     std::vector<VmRecord> ListVms() const;
+    // Copies only the records changed after `since`, so a list can be kept
+    // up to date without copying every spec on each event. 0 gets all.
+    VmListDelta GetVmChanges(uint64_t since) const;
     std::optional<VmRecord> GetVm(const std::string& vm_id) const;
+    // Latest metrics of every running VM that publishes them, with rates
+    // over its last two samples. Reads shared memory only; any thread.
+    std::vector<VmMetrics> CollectMetrics();
 
     const std::string& data_dir() const { return data_dir_; }
     settings::AppSettings& app_settings() { return settings_; }
@@ -115,7 +185,8 @@ public:
     using CursorCallback = std::function<void(const std::string& vm_id, const CursorInfo& cursor)>;
     void SetCursorCallback(CursorCallback cb);
 
-    using DisplayStateCallback = std::function<void(const std::string& vm_id, bool active, uint32_t width, uint32_t height)>;
+    using DisplayStateCallback = std::function<void(const std::string& vm_id, uint32_t scanout_id,
+                                                    bool active, uint32_t width, uint32_t height)>;
     void SetDisplayStateCallback(DisplayStateCallback cb);
 
     // Clipboard callbacks: events from VM to host
@@ -134,16 +205,48 @@ public:
     using AudioPcmCallback = std::function<void(const std::string& vm_id,
         AudioChunk chunk)>;
     void SetAudioPcmCallback(AudioPcmCallback cb);
+    // A runtime that shares a PCM ring sends no audio.pcm; the player
+    // reads the ring, handed over with each runtime.state that names it.
+    using AudioRingCallback = std::function<void(const std::string& vm_id,
+        std::shared_ptr<ipc::PcmRing> ring)>;
+    void SetAudioRingCallback(AudioRingCallback cb);
+    // The guest started capturing into `ring`, or stopped when it is null.
+    // The microphone should only be open in between.
+    using AudioCaptureCallback = std::function<void(const std::string& vm_id,
+        std::shared_ptr<ipc::PcmRing> ring)>;
+    void SetAudioCaptureCallback(AudioCaptureCallback cb);
 
     // Guest Agent state callback
     using GuestAgentStateCallback = std::function<void(const std::string& vm_id, bool connected)>;
     void SetGuestAgentStateCallback(GuestAgentStateCallback cb);
     bool IsGuestAgentConnected(const std::string& vm_id) const;
 
+    // Profiling: the reply to RequestRuntimeStats() arrives on the callback.
+    using RuntimeStatsCallback = std::function<void(const std::string& vm_id,
+                                                    const VmRuntimeStats& stats)>;
+    void SetRuntimeStatsCallback(RuntimeStatsCallback cb);
+    bool RequestRuntimeStats(const std::string& vm_id);
+
+    // Copies a file between the host and a running guest over its guest
+    // agent, push meaning host to guest. Progress and the end arrive on
+    // the callback under the id handed back here.
+    using FileTransferCallback = std::function<void(const std::string& vm_id,
+                                                    const VmFileTransferStatus& status)>;
+    void SetFileTransferCallback(FileTransferCallback cb);
+    bool StartFileTransfer(const std::string& vm_id, bool push, const std::string& host_path,
+                           const std::string& guest_path, uint64_t* transfer_id,
+                           std::string* error);
+    bool CancelFileTransfer(const std::string& vm_id, uint64_t transfer_id);
+
     bool SendKeyEvent(const std::string& vm_id, uint32_t key_code, bool pressed);
     bool SendPointerEvent(const std::string& vm_id, int32_t x, int32_t y, uint32_t buttons);
     bool SendWheelEvent(const std::string& vm_id, int32_t delta);
-    bool SetDisplaySize(const std::string& vm_id, uint32_t width, uint32_t height);
+    bool SetDisplaySize(const std::string& vm_id, uint32_t width, uint32_t height,
+                        uint32_t scanout_id = 0);
+    // Tells the runtime whether anyone looks at the VM's display. Kept
+    // across runtime restarts; when it comes back on, the runtime resends
+    // its screens whole.
+    bool SetDisplayViewer(const std::string& vm_id, bool attached);
 
     // Clipboard operations: host to VM
     bool SendClipboardGrab(const std::string& vm_id, const std::vector<uint32_t>& types);
@@ -157,21 +260,65 @@ public:
     bool RemoveSharedFolder(const std::string& vm_id, const std::string& tag, std::string* error);
     std::vector<SharedFolder> GetSharedFolders(const std::string& vm_id) const;
 
+    // Memory balloon: asks a running guest to give `size_mb` of RAM back
+    // (0 deflates fully). With `hint_free_pages` the guest also hints its
+    // free pages once, which the host drops.
+    bool SetBalloon(const std::string& vm_id, uint64_t size_mb, bool hint_free_pages,
+                    std::string* error);
+
+    // Disk IOPS and MB/s limits with their bursts, 0 meaning unlimited (or
+    // one second's worth of burst). Saved with the VM and applied to a
+    // running one at once.
+    bool SetDiskLimits(const std::string& vm_id, uint32_t iops, uint32_t iops_burst,
+                       uint32_t mbps, uint32_t burst_mb, std::string* error);
+
+    // Records the running VM's network traffic into a pcapng ring file at
+    // `path`: `snaplen` bytes of each frame matching `filter` (see
+    // NetCaptureOptions), `ring_mb` at most. 0 takes the defaults.
+    // Stopping leaves the file in time order.
+    bool StartNetCapture(const std::string& vm_id, const std::string& path,
+                         uint32_t snaplen, uint32_t ring_mb, const std::string& filter,
+                         std::string* error);
+    bool StopNetCapture(const std::string& vm_id, std::string* error);
+
 private:
     bool SendRuntimeMessage(VmRecord& vm, const ipc::Message& msg);
+    // Queues an input event in the VM's shared ring. False if there is no
+    // ring or it is full; the event then goes over the pipe.
+    bool PushInputEvent(const std::string& vm_id, const ipc::InputRingEvent& event);
+    // Moves the pipe to the newest protocol the runtime's state event
+    // offers that this build speaks too.
+    void NegotiateProtocolLocked(VmRecord& vm, const ipc::Message& state);
     bool EnsurePipeConnected(VmRecord& vm);
+    // StartVm in steps. LaunchRuntime creates the process and the event it
+    // sets once its pipe is open (`ready`, null if none could be made);
+    // ConnectRuntime opens the pipe once the wait for it is over.
+    bool LaunchRuntime(VmRecord& vm, void** ready, std::string* error);
+    bool ConnectRuntime(const std::string& vm_id, VmRecord& vm, bool listening,
+                        std::string* error);
+    // One VM of StartVms: launches and connects under the lock, waits
+    // for the runtime without it.
+    bool StartVmConcurrently(const std::string& vm_id, std::string* error);
     void CloseRuntime(VmRecord& vm);
     void ApplyPendingPatchLocked(VmRecord& vm);
+    // Has the runtime write a snapshot to `file_name` in the VM directory
+    // and waits for it to exit.
+    bool SaveRuntimeSnapshot(const std::string& vm_id, const std::string& file_name,
+                             std::string* error);
     void LoadVms();
     void SaveVmPaths();
-    void StartReadThread(const std::string& vm_id, VmRecord& vm);
-    void StopReadThread(VmRecord& vm);
-    void PipeReadThreadFunc(const std::string& vm_id);
-    void DispatchPipeData(std::string& pending, PipeParseState& parse,
-                         const std::string& vm_id);
+    void StartReading(const std::string& vm_id, VmRecord& vm);
+    void StopReading(VmRecord& vm);
+    void DispatchPipeData(ipc::StreamDecoder& decoder, const std::string& vm_id);
     void HandleProcessExit(const std::string& vm_id);
     void CleanupRuntimeHandles(VmRecord& vm);
+    // Stamps the record as changed for GetVmChanges.
+    void MarkChanged(VmRecord& vm) { vm.revision = ++revision_; }
     void HandleIncomingMessage(const std::string& vm_id, const ipc::Message& msg);
+    // Asks the runtime to send pixels in the payload, compressed, for
+    // when its shared surface cannot be mapped.
+    bool RequestPipeDisplay(const std::string& vm_id);
+    bool SendDisplayViewerLocked(VmRecord& vm);
 
     void InitJobObject();
 
@@ -180,6 +327,34 @@ private:
     settings::AppSettings settings_;
     std::unordered_map<std::string, VmRecord> vms_;
     std::mutex vms_mutex_;
+    // Last revision handed out. Removals are kept, newest last, so a
+    // delta can name them; past kMaxRemovedVms the oldest is forgotten
+    // and a caller that has not seen it gets a reset.
+    static constexpr size_t kMaxRemovedVms = 64;
+    std::atomic<uint64_t> revision_{0};
+    std::deque<std::pair<uint64_t, std::string>> removed_vms_;  // under vms_mutex_
+    uint64_t forgotten_revision_ = 0;  // under vms_mutex_
+    // Views of each running VM's shared scanout surfaces, opened on the
+    // first display.frame that names one. Frames passed on borrow their
+    // rows from a view and share its ownership, so a view is replaced,
+    // never reopened.
+    using ScanoutViews =
+        std::array<std::shared_ptr<ipc::SharedFramebuffer>, kMaxDisplayScanouts>;
+    std::mutex fb_views_mutex_;
+    std::unordered_map<std::string, ScanoutViews> fb_views_;
+    // VMs already switched to pipe display by RequestPipeDisplay.
+    std::unordered_set<std::string> fb_pipe_only_;
+    // Mirrors the runtime's sent cursor images, so a display.cursor that
+    // names a known image_id needs no payload.
+    struct CursorImage {
+        uint64_t id = 0;
+        std::vector<uint8_t> pixels;
+    };
+    std::unordered_map<std::string, std::deque<CursorImage>> cursor_images_;  // under fb_views_mutex_
+    // Each running VM's input ring, opened from the runtime.state that
+    // names it. The lock also makes this the ring's single producer.
+    std::mutex input_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<ipc::InputRing>> input_rings_;
     ConsoleCallback console_callback_;
     StateChangeCallback state_change_callback_;
     DisplayCallback display_callback_;
@@ -189,6 +364,33 @@ private:
     ClipboardDataCallback clipboard_data_callback_;
     ClipboardRequestCallback clipboard_request_callback_;
     AudioPcmCallback audio_pcm_callback_;
+    AudioRingCallback audio_ring_callback_;
+    AudioCaptureCallback audio_capture_callback_;
+    // Guest clipboard data being put together from its pieces, by VM,
+    // under vms_mutex_.
+    struct ClipboardIncoming {
+        uint32_t type = 0;
+        uint64_t total = 0;
+        std::vector<uint8_t> data;
+    };
+    std::unordered_map<std::string, ClipboardIncoming> clipboard_incoming_;
+    // Each running VM's capture ring, under vms_mutex_.
+    std::unordered_map<std::string, std::shared_ptr<ipc::PcmRing>> capture_rings_;
+    // Each running VM's metrics block and the two newest samples read from
+    // it, under vms_mutex_.
+    struct MetricsChannel {
+        ipc::MetricsBlock block;
+        ipc::MetricsSample last;
+        ipc::MetricsSample prev;
+    };
+    std::unordered_map<std::string, std::unique_ptr<MetricsChannel>> metrics_;
     GuestAgentStateCallback guest_agent_state_callback_;
+    RuntimeStatsCallback runtime_stats_callback_;
+    FileTransferCallback file_transfer_callback_;
+    std::atomic<uint64_t> next_transfer_id_{1};
+    // Last host-wide page combine asked of a runtime, under vms_mutex_.
+    uint64_t last_page_combine_ms_ = 0;
     void* job_object_ = nullptr;
+    // Last, so its callbacks are done before anything they use goes away.
+    PipeIoPool pipe_io_;
 };
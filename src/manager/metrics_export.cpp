@@ -0,0 +1,115 @@
+#include "manager/metrics_export.h"
+
+#include <cstdio>
+
+namespace {
+
+std::string PrometheusLabel(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string CsvField(const std::string& value) {
+    if (value.find_first_of(",\"\r\n") == std::string::npos) return value;
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    return out + "\"";
+}
+
+void AppendSeries(std::string* out, const char* name, const char* type, const char* help,
+                  const std::vector<VmMetrics>& metrics, double (*value)(const VmMetrics&)) {
+    char line[512];
+    std::snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    *out += line;
+    for (const auto& m : metrics) {
+        *out += name;
+        *out += "{vm=\"" + PrometheusLabel(m.vm_id) + "\",name=\"" +
+                PrometheusLabel(m.name) + "\"} ";
+        std::snprintf(line, sizeof(line), "%.17g\n", value(m));
+        *out += line;
+    }
+}
+
+} // namespace
+
+std::string FormatMetricsPrometheus(const std::vector<VmMetrics>& metrics) {
+    struct Series {
+        const char* name;
+        const char* type;
+        const char* help;
+        double (*value)(const VmMetrics&);
+    };
+    static const Series kSeries[] = {
+        {"tenbox_vm_vcpus", "gauge", "vCPUs of the VM.",
+         [](const VmMetrics& m) { return double(m.vcpu_count); }},
+        {"tenbox_vm_vcpu_utilization", "gauge", "Share of vCPU time not halted, 0 to 1.",
+         [](const VmMetrics& m) { return m.vcpu_utilization; }},
+        {"tenbox_vm_vcpu_halted_seconds_total", "counter", "vCPU time spent halted.",
+         [](const VmMetrics& m) { return m.totals.vcpu_halted_ns / 1e9; }},
+        {"tenbox_vm_exits_total", "counter", "vCPU exits to the hypervisor.",
+         [](const VmMetrics& m) { return double(m.totals.exits); }},
+        {"tenbox_vm_disk_reads_total", "counter", "Disk read requests.",
+         [](const VmMetrics& m) { return double(m.totals.disk_reads); }},
+        {"tenbox_vm_disk_writes_total", "counter", "Disk write requests.",
+         [](const VmMetrics& m) { return double(m.totals.disk_writes); }},
+        {"tenbox_vm_disk_read_bytes_total", "counter", "Bytes read from disk.",
+         [](const VmMetrics& m) { return double(m.totals.disk_read_bytes); }},
+        {"tenbox_vm_disk_written_bytes_total", "counter", "Bytes written to disk.",
+         [](const VmMetrics& m) { return double(m.totals.disk_write_bytes); }},
+        {"tenbox_vm_net_rx_packets_total", "counter", "Packets delivered to the guest.",
+         [](const VmMetrics& m) { return double(m.totals.net_rx_packets); }},
+        {"tenbox_vm_net_rx_bytes_total", "counter", "Bytes delivered to the guest.",
+         [](const VmMetrics& m) { return double(m.totals.net_rx_bytes); }},
+        {"tenbox_vm_net_tx_packets_total", "counter", "Packets sent by the guest.",
+         [](const VmMetrics& m) { return double(m.totals.net_tx_packets); }},
+        {"tenbox_vm_net_tx_bytes_total", "counter", "Bytes sent by the guest.",
+         [](const VmMetrics& m) { return double(m.totals.net_tx_bytes); }},
+        {"tenbox_vm_display_frames_total", "counter", "Display frames sent to the manager.",
+         [](const VmMetrics& m) { return double(m.totals.display_frames); }},
+        {"tenbox_vm_dirty_pages_total", "counter",
+         "Guest RAM pages written, while checkpoints track them.",
+         [](const VmMetrics& m) { return double(m.totals.dirty_pages); }},
+        {"tenbox_vm_memory_committed_bytes", "gauge", "Guest RAM backed by host memory.",
+         [](const VmMetrics& m) { return double(m.memory_committed_bytes); }},
+        {"tenbox_vm_uptime_seconds", "gauge", "Time since the runtime started.",
+         [](const VmMetrics& m) { return m.uptime_us / 1e6; }},
+    };
+    std::string out;
+    for (const auto& s : kSeries) AppendSeries(&out, s.name, s.type, s.help, metrics, s.value);
+    return out;
+}
+
+std::string FormatMetricsCsv(const std::vector<VmMetrics>& metrics) {
+    std::string out =
+        "vm_id,name,vcpus,vcpu_utilization,exits_per_sec,disk_read_iops,disk_write_iops,"
+        "disk_read_bytes_per_sec,disk_write_bytes_per_sec,net_rx_pps,net_tx_pps,"
+        "net_rx_bytes_per_sec,net_tx_bytes_per_sec,display_fps,memory_committed_bytes,"
+        "uptime_sec,dirty_pages_per_sec\r\n";
+    char row[512];
+    for (const auto& m : metrics) {
+        std::snprintf(row, sizeof(row),
+                      ",%u,%.4f,%.1f,%.1f,%.1f,%.0f,%.0f,%.1f,%.1f,%.0f,%.0f,%.1f,%llu,%.1f,%.1f\r\n",
+                      m.vcpu_count, m.vcpu_utilization, m.exits_per_sec, m.disk_read_iops,
+                      m.disk_write_iops, m.disk_read_bytes_per_sec, m.disk_write_bytes_per_sec,
+                      m.net_rx_pps, m.net_tx_pps, m.net_rx_bytes_per_sec,
+                      m.net_tx_bytes_per_sec, m.display_fps,
+                      static_cast<unsigned long long>(m.memory_committed_bytes),
+                      m.uptime_us / 1e6, m.dirty_pages_per_sec);
+        out += CsvField(m.vm_id) + "," + CsvField(m.name) + row;
+    }
+    return out;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "common/vm_model.h"
+
+#include <string>
+#include <vector>
+
+// Prometheus text exposition format: totals as counters, rates that have
+// no total (utilization, memory) as gauges, one series per VM.
+std::string FormatMetricsPrometheus(const std::vector<VmMetrics>& metrics);
+// A header row and one row of rates per VM.
+std::string FormatMetricsCsv(const std::vector<VmMetrics>& metrics);
@@ -0,0 +1,139 @@
+#include "manager/pipe_io_pool.h"
+
+#include "core/vmm/types.h"
+
+#include <windows.h>
+
+namespace {
+
+// Completion key of the packets that end a worker.
+constexpr ULONG_PTR kQuitKey = 0;
+
+} // namespace
+
+struct PipeIoPool::Connection {
+    OVERLAPPED ov{};
+    uint64_t id = 0;
+    HANDLE pipe = nullptr;
+    DataCallback on_data;
+    CloseCallback on_close;
+    bool removing = false;
+    std::array<char, 65536> buffer{};
+};
+
+PipeIoPool::PipeIoPool(uint32_t threads) {
+    port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, threads);
+    if (!port_) {
+        LOG_ERROR("CreateIoCompletionPort failed: %lu", GetLastError());
+        return;
+    }
+    for (uint32_t i = 0; i < threads; ++i) {
+        workers_.emplace_back(&PipeIoPool::WorkerLoop, this);
+    }
+}
+
+PipeIoPool::~PipeIoPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto& [id, conn] : connections_) {
+            (void)id;
+            // Removed pipes may be closed already; their reads are ending.
+            if (conn->removing) continue;
+            conn->removing = true;
+            CancelIoEx(conn->pipe, &conn->ov);
+        }
+        // Reads in flight own their buffers until they complete.
+        drained_cv_.wait(lock, [this]() { return connections_.empty(); });
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        PostQueuedCompletionStatus(port_, 0, kQuitKey, nullptr);
+    }
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    if (port_) CloseHandle(port_);
+}
+
+uint64_t PipeIoPool::Add(void* pipe, DataCallback on_data, CloseCallback on_close) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto conn = std::make_unique<Connection>();
+    conn->id = next_id_++;
+    conn->pipe = reinterpret_cast<HANDLE>(pipe);
+    conn->on_data = std::move(on_data);
+    conn->on_close = std::move(on_close);
+    Connection* raw = conn.get();
+    uint64_t id = raw->id;
+    connections_.emplace(id, std::move(conn));
+
+    if (!CreateIoCompletionPort(raw->pipe, port_, reinterpret_cast<ULONG_PTR>(raw), 0)) {
+        LOG_ERROR("Associating runtime pipe with the completion port failed: %lu",
+                  GetLastError());
+    }
+    // A pipe that is already broken gets its close reported all the same.
+    if (!IssueRead(raw)) {
+        PostQueuedCompletionStatus(port_, 0, reinterpret_cast<ULONG_PTR>(raw), &raw->ov);
+    }
+    return id;
+}
+
+void PipeIoPool::Remove(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = connections_.find(id);
+    if (it == connections_.end()) return;
+    // The connection lives on until its read completes, cancelled here or
+    // by the pipe closing.
+    it->second->removing = true;
+    CancelIoEx(it->second->pipe, &it->second->ov);
+}
+
+bool PipeIoPool::IssueRead(Connection* conn) {
+    conn->ov = OVERLAPPED{};
+    if (ReadFile(conn->pipe, conn->buffer.data(), static_cast<DWORD>(conn->buffer.size()),
+                 nullptr, &conn->ov)) {
+        return true;  // completes through the port as well
+    }
+    return GetLastError() == ERROR_IO_PENDING;
+}
+
+void PipeIoPool::WorkerLoop() {
+    for (;;) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* ov = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(port_, &bytes, &key, &ov, INFINITE);
+        if (!ov) {
+            if (key == kQuitKey) return;
+            continue;
+        }
+        auto* conn = reinterpret_cast<Connection*>(key);
+
+        bool alive = ok != FALSE;
+        if (alive) {
+            bool removing;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                removing = conn->removing;
+            }
+            if (!removing && bytes > 0) {
+                conn->on_data(conn->buffer.data(), bytes);
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Issued under the lock, so a Remove either sees it in flight
+            // and cancels it, or is seen here.
+            if (!conn->removing && IssueRead(conn)) continue;
+        }
+
+        // Nothing is in flight any more: drop the connection.
+        CloseCallback on_close;
+        std::unique_ptr<Connection> owned;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!conn->removing) on_close = std::move(conn->on_close);
+            auto it = connections_.find(conn->id);
+            owned = std::move(it->second);
+            connections_.erase(it);
+        }
+        drained_cv_.notify_all();
+        if (on_close) on_close();
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Reads all runtime pipes through one I/O completion port serviced by a
+// few threads, instead of a polling thread per VM. Each pipe has a single
+// read in flight, so its callbacks never run concurrently and see the
+// stream in order. Pipes must be opened with FILE_FLAG_OVERLAPPED; write
+// to them with ipc::PipeWrite.
+class PipeIoPool {
+public:
+    using DataCallback = std::function<void(const char* data, size_t size)>;
+    using CloseCallback = std::function<void()>;
+
+    explicit PipeIoPool(uint32_t threads);
+    ~PipeIoPool();
+
+    PipeIoPool(const PipeIoPool&) = delete;
+    PipeIoPool& operator=(const PipeIoPool&) = delete;
+
+    // Starts reading `pipe`. `on_close` runs once, on a pool thread, when
+    // the pipe breaks; the handle is no longer in use by then.
+    uint64_t Add(void* pipe, DataCallback on_data, CloseCallback on_close);
+    // Stops reading without calling `on_close`; the pipe may be closed
+    // right after. Does not wait, so a callback already running finishes.
+    void Remove(uint64_t id);
+
+private:
+    struct Connection;
+
+    void WorkerLoop();
+    // Under mutex_. False if the pipe is broken.
+    bool IssueRead(Connection* conn);
+
+    void* port_ = nullptr;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable drained_cv_;
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections_;
+    uint64_t next_id_ = 1;
+};
@@ -0,0 +1,104 @@
+#include "platform/windows/audio/wasapi_audio_capture.h"
+#include "ipc/pcm_ring.h"
+
+#include <windows.h>
+#include <mmdeviceapi.h>
+#include <audioclient.h>
+
+#include <vector>
+
+static const CLSID kCLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
+static const IID kIID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
+static const IID kIID_IAudioClient = __uuidof(IAudioClient);
+static const IID kIID_IAudioCaptureClient = __uuidof(IAudioCaptureClient);
+
+// Device buffer, in 100 ns units.
+static constexpr REFERENCE_TIME kBufferDuration = 20 * 10000;
+
+WasapiAudioCapture::~WasapiAudioCapture() {
+    Stop();
+}
+
+void WasapiAudioCapture::Start(std::shared_ptr<ipc::PcmRing> ring) {
+    Stop();
+    if (!ring) return;
+    running_ = true;
+    capture_thread_ = std::thread(&WasapiAudioCapture::CaptureThread, this, std::move(ring));
+}
+
+void WasapiAudioCapture::Stop() {
+    running_ = false;
+    if (capture_thread_.joinable()) {
+        capture_thread_.join();
+    }
+}
+
+void WasapiAudioCapture::CaptureThread(std::shared_ptr<ipc::PcmRing> ring) {
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    bool need_uninit = SUCCEEDED(hr);
+
+    IMMDeviceEnumerator* enumerator = nullptr;
+    IMMDevice* device = nullptr;
+    IAudioClient* audio_client = nullptr;
+    IAudioCaptureClient* capture_client = nullptr;
+    HANDLE event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    WAVEFORMATEX format{};
+    format.wFormatTag = WAVE_FORMAT_PCM;
+    format.nChannels = ipc::PcmRing::kChannels;
+    format.nSamplesPerSec = ipc::PcmRing::kSampleRate;
+    format.wBitsPerSample = 16;
+    format.nBlockAlign = format.nChannels * format.wBitsPerSample / 8;
+    format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+
+    bool ok = event &&
+        SUCCEEDED(CoCreateInstance(kCLSID_MMDeviceEnumerator, nullptr, CLSCTX_ALL,
+                                   kIID_IMMDeviceEnumerator,
+                                   reinterpret_cast<void**>(&enumerator))) &&
+        SUCCEEDED(enumerator->GetDefaultAudioEndpoint(eCapture, eConsole, &device)) &&
+        SUCCEEDED(device->Activate(kIID_IAudioClient, CLSCTX_ALL, nullptr,
+                                   reinterpret_cast<void**>(&audio_client))) &&
+        SUCCEEDED(audio_client->Initialize(
+            AUDCLNT_SHAREMODE_SHARED,
+            AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+                AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
+            kBufferDuration, 0, &format, nullptr)) &&
+        SUCCEEDED(audio_client->SetEventHandle(event)) &&
+        SUCCEEDED(audio_client->GetService(kIID_IAudioCaptureClient,
+                                           reinterpret_cast<void**>(&capture_client))) &&
+        SUCCEEDED(audio_client->Start());
+
+    std::vector<int16_t> silence;
+    while (ok && running_) {
+        // Signaled once per device period; silence means the device went.
+        if (WaitForSingleObject(event, 200) != WAIT_OBJECT_0) break;
+
+        UINT32 packet = 0;
+        while (running_ && SUCCEEDED(capture_client->GetNextPacketSize(&packet)) && packet) {
+            BYTE* data = nullptr;
+            UINT32 frames = 0;
+            DWORD flags = 0;
+            if (FAILED(capture_client->GetBuffer(&data, &frames, &flags, nullptr, nullptr))) {
+                ok = false;
+                break;
+            }
+            const auto* samples = reinterpret_cast<const int16_t*>(data);
+            if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+                silence.assign(static_cast<size_t>(frames) * ipc::PcmRing::kChannels, 0);
+                samples = silence.data();
+            }
+            // The guest reads on the same clock; a full ring means it has
+            // stopped reading, and the overflow is dropped.
+            ring->Write(samples, frames);
+            capture_client->ReleaseBuffer(frames);
+        }
+    }
+
+    if (audio_client) audio_client->Stop();
+    if (capture_client) capture_client->Release();
+    if (audio_client) audio_client->Release();
+    if (device) device->Release();
+    if (enumerator) enumerator->Release();
+    if (event) CloseHandle(event);
+    if (need_uninit) CoUninitialize();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace ipc {
+class PcmRing;
+}
+
+// Records the default microphone into one VM's capture ring while the
+// guest captures. The stream is event-driven shared mode in the ring's
+// format (S16 stereo 48000Hz); the audio engine converts from the mix
+// format, so the microphone's own clock paces the guest.
+class WasapiAudioCapture {
+public:
+    WasapiAudioCapture() = default;
+    ~WasapiAudioCapture();
+
+    WasapiAudioCapture(const WasapiAudioCapture&) = delete;
+    WasapiAudioCapture& operator=(const WasapiAudioCapture&) = delete;
+
+    // Starts recording into `ring`, replacing any earlier one.
+    void Start(std::shared_ptr<ipc::PcmRing> ring);
+    void Stop();
+
+private:
+    void CaptureThread(std::shared_ptr<ipc::PcmRing> ring);
+
+    std::atomic<bool> running_{false};
+    std::thread capture_thread_;
+};
@@ -1,10 +1,12 @@
 #include "platform/windows/audio/wasapi_audio_player.h"
+#include "ipc/pcm_ring.h"
 
 #include <windows.h>
 #include <mmdeviceapi.h>
 #include <audioclient.h>
 #include <functiondiscoverykeys_devpkey.h>
 
+#include <algorithm>
 #include <cstring>
 
 static const CLSID kCLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
@@ -12,16 +14,21 @@ static const IID kIID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
 static const IID kIID_IAudioClient = __uuidof(IAudioClient);
 static const IID kIID_IAudioRenderClient = __uuidof(IAudioRenderClient);
 
-WasapiAudioPlayer::WasapiAudioPlayer() = default;
+// Device periods without audio before the stream is stopped.
+static constexpr uint32_t kIdlePeriods = 50;
+
+WasapiAudioPlayer::WasapiAudioPlayer()
+    : wake_event_(CreateEventW(nullptr, FALSE, FALSE, nullptr)) {}
 
 WasapiAudioPlayer::~WasapiAudioPlayer() {
     Stop();
+    if (wake_event_) CloseHandle(reinterpret_cast<HANDLE>(wake_event_));
 }
 
 void WasapiAudioPlayer::Stop() {
     if (running_) {
         running_ = false;
-        cv_.notify_all();
+        SetEvent(reinterpret_cast<HANDLE>(wake_event_));
         if (render_thread_.joinable()) {
             render_thread_.join();
         }
@@ -41,14 +48,78 @@ void WasapiAudioPlayer::SubmitPcm(uint32_t sample_rate, uint16_t channels,
             pcm_buffer_.pop_front();
         }
     }
-    cv_.notify_one();
+    SetEvent(reinterpret_cast<HANDLE>(wake_event_));
+    StartRenderThread();
+}
+
+void WasapiAudioPlayer::AttachRing(std::shared_ptr<ipc::PcmRing> ring) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring_ = std::move(ring);
+        // The guest side keeps the ring filled to this, on our clock.
+        if (ring_) ring_->SetTargetFrames(TargetFrames());
+        pcm_buffer_.clear();
+    }
+    SetEvent(reinterpret_cast<HANDLE>(wake_event_));
+    StartRenderThread();
+}
+
+void WasapiAudioPlayer::SetTargetLatency(uint32_t ms) {
+    latency_ms_ = (std::clamp)(ms, 10u, 500u);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ring_) ring_->SetTargetFrames(TargetFrames());
+}
 
-    if (!running_) {
-        running_ = true;
+void WasapiAudioPlayer::StartRenderThread() {
+    if (!running_.exchange(true)) {
         render_thread_ = std::thread(&WasapiAudioPlayer::RenderThread, this);
     }
 }
 
+uint32_t WasapiAudioPlayer::TargetFrames() const {
+    return latency_ms_.load() * 48 / 2;
+}
+
+size_t WasapiAudioPlayer::QueuedFrames() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ring_) return ring_->Available();
+    return pcm_buffer_.size() / 2;
+}
+
+size_t WasapiAudioPlayer::ReadFrames(int16_t* out, size_t frames) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ring_) return ring_->Read(out, frames);
+    frames = (std::min)(frames, pcm_buffer_.size() / 2);
+    std::copy_n(pcm_buffer_.begin(), frames * 2, out);
+    pcm_buffer_.erase(pcm_buffer_.begin(), pcm_buffer_.begin() + frames * 2);
+    return frames;
+}
+
+void WasapiAudioPlayer::SkipFrames(size_t frames) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ring_) {
+        ring_->Skip(frames);
+        return;
+    }
+    frames = (std::min)(frames, pcm_buffer_.size() / 2);
+    pcm_buffer_.erase(pcm_buffer_.begin(), pcm_buffer_.begin() + frames * 2);
+}
+
+void WasapiAudioPlayer::WaitForFrames(size_t frames) {
+    std::shared_ptr<ipc::PcmRing> ring;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring = ring_;
+    }
+    // The ring rings its doorbell on each write while we wait; PCM over
+    // the pipe sets wake_event_.
+    if (ring) {
+        ring->Wait(frames, INFINITE, wake_event_);
+    } else {
+        WaitForSingleObject(reinterpret_cast<HANDLE>(wake_event_), INFINITE);
+    }
+}
+
 void WasapiAudioPlayer::ReleaseDevice() {
     if (audio_client_) {
         audio_client_->Stop();
@@ -63,6 +134,10 @@ void WasapiAudioPlayer::ReleaseDevice() {
         device_->Release();
         device_ = nullptr;
     }
+    if (render_event_) {
+        CloseHandle(reinterpret_cast<HANDLE>(render_event_));
+        render_event_ = nullptr;
+    }
     if (enumerator_) {
         enumerator_->Release();
         enumerator_ = nullptr;
@@ -105,13 +180,20 @@ bool WasapiAudioPlayer::EnsureInitialized() {
         device_is_float_ = (ext->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
     }
 
-    REFERENCE_TIME buffer_duration = 2000000; // 200ms
+    // Half the target latency, in 100 ns units; the engine may round up.
+    REFERENCE_TIME buffer_duration = static_cast<REFERENCE_TIME>(latency_ms_.load()) * 10000 / 2;
     hr = audio_client_->Initialize(AUDCLNT_SHAREMODE_SHARED,
-                                    0, buffer_duration, 0, mix_format, nullptr);
+                                    AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                    buffer_duration, 0, mix_format, nullptr);
     CoTaskMemFree(mix_format);
 
     if (FAILED(hr)) { ReleaseDevice(); return false; }
 
+    render_event_ = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!render_event_) { ReleaseDevice(); return false; }
+    hr = audio_client_->SetEventHandle(reinterpret_cast<HANDLE>(render_event_));
+    if (FAILED(hr)) { ReleaseDevice(); return false; }
+
     hr = audio_client_->GetBufferSize(&buffer_frames_);
     if (FAILED(hr)) { ReleaseDevice(); return false; }
 
@@ -119,71 +201,112 @@ bool WasapiAudioPlayer::EnsureInitialized() {
                                     reinterpret_cast<void**>(&render_client_));
     if (FAILED(hr)) { ReleaseDevice(); return false; }
 
-    hr = audio_client_->Start();
-    if (FAILED(hr)) { ReleaseDevice(); return false; }
-
     return true;
 }
 
+void WasapiAudioPlayer::WriteDeviceFrames(const int16_t* src, uint32_t frames) {
+    BYTE* buffer_data = nullptr;
+    if (FAILED(render_client_->GetBuffer(frames, &buffer_data))) return;
+
+    // Input is always S16 stereo (2ch); read L/R per frame
+    for (UINT32 f = 0; f < frames; ++f) {
+        const int16_t* frame = src + f * 2;
+        if (device_is_float_ && device_bits_ == 32) {
+            auto* out = reinterpret_cast<float*>(buffer_data);
+            for (uint16_t c = 0; c < device_channels_; ++c) {
+                out[f * device_channels_ + c] = frame[c < 2 ? c : 1] / 32768.0f;
+            }
+        } else {
+            auto* out = reinterpret_cast<int16_t*>(buffer_data);
+            for (uint16_t c = 0; c < device_channels_; ++c) {
+                out[f * device_channels_ + c] = frame[c < 2 ? c : 1];
+            }
+        }
+    }
+
+    render_client_->ReleaseBuffer(frames, 0);
+}
+
 void WasapiAudioPlayer::RenderThread() {
     HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
     bool need_uninit = SUCCEEDED(hr);
 
+    std::vector<int16_t> pcm;
+    bool playing = false;   // stream started
+    bool priming = true;    // filling up to the target before playing on
+    uint32_t idle_periods = 0;
+
     while (running_) {
-        {
-            std::unique_lock<std::mutex> lock(mutex_);
-            cv_.wait_for(lock, std::chrono::milliseconds(5), [this]() {
-                return !running_ || !pcm_buffer_.empty();
-            });
-            if (!running_) break;
-            if (pcm_buffer_.empty()) continue;
+        if (!playing) {
+            // Nothing plays until a target's worth of audio is queued.
+            if (QueuedFrames() < TargetFrames()) {
+                WaitForFrames(TargetFrames());
+                continue;
+            }
+            if (!EnsureInitialized()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                continue;
+            }
+            if (FAILED(audio_client_->Start())) { ReleaseDevice(); continue; }
+            playing = true;
+            priming = false;
+            idle_periods = 0;
         }
 
-        if (!EnsureInitialized()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        // Signaled once per device period; silence means the device went.
+        if (WaitForSingleObject(reinterpret_cast<HANDLE>(render_event_), 200) != WAIT_OBJECT_0) {
+            ReleaseDevice();
+            playing = false;
             continue;
         }
 
         UINT32 padding = 0;
         hr = audio_client_->GetCurrentPadding(&padding);
-        if (FAILED(hr)) { ReleaseDevice(); continue; }
-
-        UINT32 available_frames = buffer_frames_ - padding;
-        if (available_frames == 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        if (FAILED(hr)) { ReleaseDevice(); playing = false; continue; }
+        UINT32 space = buffer_frames_ - padding;
+
+        size_t queued = QueuedFrames();
+        size_t target = TargetFrames();
+        if (queued == 0) {
+            // Ran dry: after a pause, or a guest slower than the device.
+            priming = true;
+            if (padding == 0 && ++idle_periods >= kIdlePeriods) {
+                audio_client_->Stop();
+                audio_client_->Reset();
+                playing = false;
+            }
             continue;
         }
+        idle_periods = 0;
+        if (priming) {
+            if (queued < target) continue;
+            priming = false;
+        }
 
-        std::lock_guard<std::mutex> lock(mutex_);
-        // Input is always stereo; each frame = 2 samples
-        UINT32 src_frames = static_cast<UINT32>(pcm_buffer_.size() / 2);
-        UINT32 out_frames = (std::min)(available_frames, src_frames);
-        if (out_frames == 0) continue;
-
-        BYTE* buffer_data = nullptr;
-        hr = render_client_->GetBuffer(out_frames, &buffer_data);
-        if (FAILED(hr)) continue;
-
-        // Input is always S16 stereo (2ch); read L/R per frame
-        for (UINT32 f = 0; f < out_frames; ++f) {
-            int16_t left  = pcm_buffer_.front(); pcm_buffer_.pop_front();
-            int16_t right = pcm_buffer_.front(); pcm_buffer_.pop_front();
-            const int16_t src[2] = { left, right };
-
-            if (device_is_float_ && device_bits_ == 32) {
-                auto* out = reinterpret_cast<float*>(buffer_data);
-                for (uint16_t c = 0; c < device_channels_; ++c) {
-                    out[f * device_channels_ + c] = src[c < 2 ? c : 1] / 32768.0f;
-                }
-            } else {
-                auto* out = reinterpret_cast<int16_t*>(buffer_data);
-                for (uint16_t c = 0; c < device_channels_; ++c) {
-                    out[f * device_channels_ + c] = src[c < 2 ? c : 1];
-                }
-            }
+        // Drift: a stall leaves a backlog that is cut back to the target
+        // at once; smaller offsets are worked off a frame per period.
+        bool stretch = false;
+        if (queued > 2 * target) {
+            SkipFrames(queued - target);
+            queued = target;
+        } else if (queued > target + target / 2) {
+            SkipFrames(1);
+            queued--;
+        } else if (queued < target / 2) {
+            stretch = true;
         }
 
-        render_client_->ReleaseBuffer(out_frames, 0);
+        UINT32 frames = static_cast<UINT32>((std::min)(static_cast<size_t>(space), queued));
+        if (frames == 0) continue;
+        pcm.resize(static_cast<size_t>(frames) * 2);
+        frames = static_cast<UINT32>(ReadFrames(pcm.data(), frames));
+        if (stretch && frames > 0 && frames < space) {
+            pcm.resize(static_cast<size_t>(frames + 1) * 2);
+            pcm[frames * 2] = pcm[(frames - 1) * 2];
+            pcm[frames * 2 + 1] = pcm[(frames - 1) * 2 + 1];
+            frames++;
+        }
+        if (frames > 0) WriteDeviceFrames(pcm.data(), frames);
     }
 
     ReleaseDevice();
@@ -2,10 +2,10 @@
 
 #include <cstdint>
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <atomic>
-#include <condition_variable>
 #include <vector>
 
 struct IAudioClient;
@@ -13,8 +13,21 @@ struct IAudioRenderClient;
 struct IMMDevice;
 struct IMMDeviceEnumerator;
 
+namespace ipc {
+class PcmRing;
+}
+
+// Plays one VM's audio on the default device. The render thread runs on
+// the device's period (event-driven shared mode) and keeps about the
+// target latency of audio queued, and sleeps until audio arrives while
+// the stream is stopped. A ring is filled to the target the
+// player publishes in it, so the guest plays on the device clock; for PCM
+// over the pipe it drops the odd frame when the guest runs ahead of the
+// device clock and repeats one when it falls behind.
 class WasapiAudioPlayer {
 public:
+    static constexpr uint32_t kDefaultLatencyMs = 40;
+
     WasapiAudioPlayer();
     ~WasapiAudioPlayer();
 
@@ -24,23 +37,42 @@ public:
     // Input: S16 stereo 48000Hz (fixed format matching virtio-snd config)
     void SubmitPcm(uint32_t sample_rate, uint16_t channels,
                    std::vector<int16_t> samples);
+    // Plays from the runtime's shared ring instead of submitted PCM.
+    void AttachRing(std::shared_ptr<ipc::PcmRing> ring);
+    // End-to-end latency aimed for: half in the device buffer, half
+    // queued ahead of it. Takes effect when the device is next opened.
+    void SetTargetLatency(uint32_t ms);
 
     void Stop();
 
 private:
     bool EnsureInitialized();
     void ReleaseDevice();
+    void StartRenderThread();
     void RenderThread();
+    // Render thread, stream stopped. Returns once `frames` are queued,
+    // more audio arrives, or the source changes.
+    void WaitForFrames(size_t frames);
+    // Render thread. Frames queued ahead of the device, and reading or
+    // dropping them, from whichever source is in use.
+    size_t QueuedFrames();
+    size_t ReadFrames(int16_t* out, size_t frames);
+    void SkipFrames(size_t frames);
+    uint32_t TargetFrames() const;
+    void WriteDeviceFrames(const int16_t* src, uint32_t frames);
 
     std::mutex mutex_;
-    std::condition_variable cv_;
+    void* wake_event_ = nullptr;  // new PCM, a new ring, or Stop()
     std::atomic<bool> running_{false};
     std::thread render_thread_;
+    std::shared_ptr<ipc::PcmRing> ring_;  // under mutex_
+    std::atomic<uint32_t> latency_ms_{kDefaultLatencyMs};
 
     IMMDeviceEnumerator* enumerator_ = nullptr;
     IMMDevice* device_ = nullptr;
     IAudioClient* audio_client_ = nullptr;
     IAudioRenderClient* render_client_ = nullptr;
+    void* render_event_ = nullptr;
     uint32_t buffer_frames_ = 0;
 
     // WASAPI device mix format (typically float32 48000Hz stereo)
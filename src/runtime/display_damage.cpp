@@ -0,0 +1,71 @@
+#include "runtime/display_damage.h"
+
+#include <algorithm>
+
+namespace {
+
+uint64_t Area(const DamageRect& r) {
+    return static_cast<uint64_t>(r.width) * r.height;
+}
+
+DamageRect Union(const DamageRect& a, const DamageRect& b) {
+    uint32_t x0 = std::min(a.x, b.x);
+    uint32_t y0 = std::min(a.y, b.y);
+    uint32_t x1 = std::max(a.x + a.width, b.x + b.width);
+    uint32_t y1 = std::max(a.y + a.height, b.y + b.height);
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+bool Overlaps(const DamageRect& a, const DamageRect& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width &&
+           a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+}  // namespace
+
+void DamageRegion::Add(const DamageRect& rect) {
+    if (rect.width == 0 || rect.height == 0) return;
+
+    // Fold in every rect the new one overlaps; the union can overlap
+    // further rects, so repeat until it stands alone.
+    DamageRect merged = rect;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < rects_.size(); ++i) {
+            if (Overlaps(merged, rects_[i])) {
+                merged = Union(merged, rects_[i]);
+                rects_[i] = rects_.back();
+                rects_.pop_back();
+                changed = true;
+                break;
+            }
+        }
+    }
+    rects_.push_back(merged);
+
+    while (rects_.size() > kMaxRects) {
+        size_t best_i = 0, best_j = 1;
+        uint64_t best_waste = UINT64_MAX;
+        for (size_t i = 0; i < rects_.size(); ++i) {
+            for (size_t j = i + 1; j < rects_.size(); ++j) {
+                uint64_t total = Area(Union(rects_[i], rects_[j]));
+                uint64_t parts = Area(rects_[i]) + Area(rects_[j]);
+                uint64_t waste = total > parts ? total - parts : 0;
+                if (waste < best_waste) {
+                    best_waste = waste;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+        rects_[best_i] = Union(rects_[best_i], rects_[best_j]);
+        rects_[best_j] = rects_.back();
+        rects_.pop_back();
+    }
+}
+
+std::vector<DamageRect> DamageRegion::Take() {
+    std::vector<DamageRect> out;
+    out.swap(rects_);
+    return out;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct DamageRect {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+// Screen damage collected between two display frames. Rects are merged as
+// they arrive: overlapping ones always, and beyond kMaxRects the pair
+// whose union wastes the least area. Damage is only ever grown, never
+// dropped, so every changed pixel is covered by some rect.
+class DamageRegion {
+public:
+    static constexpr size_t kMaxRects = 8;
+
+    void Add(const DamageRect& rect);
+    bool empty() const { return rects_.empty(); }
+    void Clear() { rects_.clear(); }
+
+    // Hands over the collected rects and clears the region.
+    std::vector<DamageRect> Take();
+
+private:
+    std::vector<DamageRect> rects_;
+};
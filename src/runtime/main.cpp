@@ -1,6 +1,8 @@
 #include "runtime/runtime_service.h"
 #include "version.h"
 #include "core/vmm/vm.h"
+#include "core/vmm/etw.h"
+#include "ipc/etw.h"
 
 #include <cstdlib>
 #include <cstring>
@@ -24,12 +26,53 @@ static void PrintUsage(const char* prog) {
         "  --kernel <path>      Path to vmlinuz (required)\n"
         "  --initrd <path>      Path to initramfs\n"
         "  --disk <path>        Path to raw / qcow2 disk image\n"
+        "  --disk-direct-io     Bypass host page cache for raw disks\n"
+        "  --disk-mmap          Serve raw disk reads from mapped views\n"
+        "  --qcow2-l2-cache <MB> qcow2 L2 table cache (default: whole image)\n"
+        "  --qcow2-compressed-cache <MB> Decompressed cluster cache (default: 4)\n"
+        "  --disk-readahead <KB> Sequential readahead window, 0 = off (default: 512)\n"
+        "  --disk-boot-profile <S> Record the first S seconds of boot reads next to the\n"
+        "                       disk and prefetch them on the next boot, 0 = off (default: 30)\n"
+        "  --disk-trace <path>  Record block requests for tenbox-blk-replay\n"
+        "  --disk-iops N[:BURST] Limit disk requests per second (default: unlimited)\n"
+        "  --disk-mbps N[:BURST] Limit disk bandwidth in MB/s, burst in MB (default: unlimited)\n"
         "  --cmdline <str>      Kernel command line\n"
+        "  --hvc-console        Kernel console on virtio hvc0 instead of ttyS0\n"
         "  --memory <MB>        Guest RAM in MB (default: 256)\n"
+        "  --max-memory <MB>    Let the running guest grow to this much RAM (virtio-mem)\n"
+        "  --lazy-memory        Commit guest RAM as the guest touches it\n"
+        "  --large-pages        Back guest RAM with large pages (needs SeLockMemoryPrivilege)\n"
+        "  --page-dedup <S>     Scan for pages shareable with other VMs every S seconds\n"
+        "  --restore <path>     Resume from a suspend snapshot (cold boot if unusable)\n"
+        "  --checkpoint <path>  Checkpoint target; later checkpoints write only dirty pages\n"
+        "  --checkpoint-interval <S> Checkpoint every S seconds (default: on request)\n"
+        "  --migratable         Track dirty pages so migrations copy RAM while running\n"
+        "  --migrate-listen <port> Take over a VM migrated in on this TCP port\n"
         "  --cpus <N>           Number of vCPUs (default: 1, max: 128)\n"
+        "  --max-cpus <N>       Let the running guest hotplug vCPUs up to N\n"
+        "  --vcpu-placement <P> none, performance (avoid E-cores), spread (one core\n"
+        "                       per vCPU) or numa (one NUMA node) (default: none)\n"
+        "  --numa-memory <M>    none, local (RAM and threads on one NUMA node) or split\n"
+        "                       (a guest node per host node, up to 8) (default: none)\n"
+        "  --io-threads <N>     Dedicated device I/O threads, 0-16 (default: 0)\n"
+        "  --io-thread DEV=N    Run device DEV's queues on I/O thread N (repeatable);\n"
+        "                       DEV: blk, net, input, gpu, serial, fs, snd, balloon, vsock, mem\n"
+        "  --x2apic             x2APIC and TSC-deadline timer, if the host has them\n"
+        "  --pmu                Hardware performance counters for in-guest perf, if the host has them\n"
+        "  --irq-coalesce US[:FRAMES] Disk/net interrupt moderation, US 0 = off\n"
+        "                       (default: 0:32; VMs the manager starts get 50:32)\n"
+        "  --virtio-pci         Disk and network on virtio-pci with MSI-X\n"
+        "  --display-fps <N>    Display updates per second, 1-240 (default: 60)\n"
+        "  --displays <N>       Guest monitors, 1-4 (default: 1)\n"
         "  --net                Start with network link up (default: link down)\n"
         "  --forward H:G        Port forward host:H -> guest:G (repeatable)\n"
-        "  --share TAG:PATH[:ro] Share host directory (repeatable)\n"
+        "  --net-limit RX:TX[:BURST] Cap NAT traffic to/from the guest in Mbit/s,\n"
+        "                       0 = unlimited, burst in KB (default: unlimited)\n"
+        "  --vsock              Add a virtio-vsock device (guest CID 3)\n"
+        "  --vsock-listen H:P   Connect 127.0.0.1:H clients to guest vsock port P (repeatable)\n"
+        "  --vsock-connect P:H  Guest connects to CID 2 port P reach 127.0.0.1:H (repeatable)\n"
+        "  --share TAG:PATH[:ro][:wb]\n"
+        "                       Share host directory, :wb = writeback cache (repeatable)\n"
         "  --version            Show version\n"
         "  --help               Show this help\n",
         prog);
@@ -43,6 +86,7 @@ int main(int argc, char* argv[]) {
     VmConfig config;
     std::string vm_id = "default";
     std::string control_endpoint;
+    uint32_t display_fps = 60;
 
     for (int i = 1; i < argc; i++) {
         auto Arg = [&](const char* flag) {
@@ -79,15 +123,132 @@ int main(int argc, char* argv[]) {
         } else if (Arg("--disk")) {
             auto v = NextArg(); if (!v) return 1;
             config.disk_path = v;
+        } else if (Arg("--disk-direct-io")) {
+            config.disk_direct_io = true;
+        } else if (Arg("--disk-mmap")) {
+            config.disk_mmap = true;
+        } else if (Arg("--qcow2-l2-cache")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.qcow2_l2_cache_mb = std::strtoull(v, nullptr, 10);
+        } else if (Arg("--qcow2-compressed-cache")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.qcow2_compressed_cache_mb = std::strtoull(v, nullptr, 10);
+        } else if (Arg("--disk-readahead")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.disk_readahead_kb = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--disk-boot-profile")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.disk_boot_profile_s = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--disk-iops")) {
+            auto v = NextArg(); if (!v) return 1;
+            unsigned iops = 0, burst = 0;
+            if (std::sscanf(v, "%u:%u", &iops, &burst) < 1) {
+                fprintf(stderr, "Invalid --disk-iops format: %s (expected N[:BURST])\n", v);
+                return 1;
+            }
+            config.disk_limits.iops = iops;
+            config.disk_limits.iops_burst = burst;
+        } else if (Arg("--disk-mbps")) {
+            auto v = NextArg(); if (!v) return 1;
+            unsigned long long mbps = 0, burst = 0;
+            if (std::sscanf(v, "%llu:%llu", &mbps, &burst) < 1) {
+                fprintf(stderr, "Invalid --disk-mbps format: %s (expected N[:BURST])\n", v);
+                return 1;
+            }
+            config.disk_limits.bytes_per_sec = mbps << 20;
+            config.disk_limits.burst_bytes = burst << 20;
+        } else if (Arg("--disk-trace")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.disk_trace_path = v;
         } else if (Arg("--cmdline")) {
             auto v = NextArg(); if (!v) return 1;
             config.cmdline = v;
+        } else if (Arg("--hvc-console")) {
+            config.hvc_console = true;
         } else if (Arg("--memory")) {
             auto v = NextArg(); if (!v) return 1;
             config.memory_mb = std::atoi(v);
+        } else if (Arg("--max-memory")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.max_memory_mb = std::strtoull(v, nullptr, 10);
+        } else if (Arg("--lazy-memory")) {
+            config.lazy_memory = true;
+        } else if (Arg("--large-pages")) {
+            config.large_pages = true;
+        } else if (Arg("--page-dedup")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.page_dedup_interval_s = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--restore")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.restore_path = v;
+        } else if (Arg("--checkpoint")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.checkpoint_path = v;
+        } else if (Arg("--checkpoint-interval")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.checkpoint_interval_s = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--migratable")) {
+            config.migratable = true;
+        } else if (Arg("--migrate-listen")) {
+            auto v = NextArg(); if (!v) return 1;
+            unsigned long port = std::strtoul(v, nullptr, 10);
+            if (!port || port > 65535) {
+                fprintf(stderr, "Invalid --migrate-listen: %s\n", v);
+                return 1;
+            }
+            config.migrate_listen_port = static_cast<uint16_t>(port);
         } else if (Arg("--cpus")) {
             auto v = NextArg(); if (!v) return 1;
             config.cpu_count = std::atoi(v);
+        } else if (Arg("--max-cpus")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.max_cpu_count = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--vcpu-placement")) {
+            auto v = NextArg(); if (!v) return 1;
+            if (!ParseVCpuPlacement(v, &config.vcpu_placement)) {
+                fprintf(stderr, "Invalid --vcpu-placement: %s\n", v);
+                return 1;
+            }
+        } else if (Arg("--numa-memory")) {
+            auto v = NextArg(); if (!v) return 1;
+            if (!ParseNumaMemory(v, &config.numa_memory)) {
+                fprintf(stderr, "Invalid --numa-memory: %s\n", v);
+                return 1;
+            }
+        } else if (Arg("--io-threads")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.io_threads = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--io-thread")) {
+            auto v = NextArg(); if (!v) return 1;
+            const char* eq = std::strchr(v, '=');
+            std::string device = eq ? std::string(v, eq - v) : std::string();
+            if (!eq || !IsIoThreadDevice(device) || !*(eq + 1)) {
+                fprintf(stderr, "Invalid --io-thread format: %s (expected DEV=N)\n", v);
+                return 1;
+            }
+            config.device_io_threads[device] =
+                static_cast<uint32_t>(std::strtoul(eq + 1, nullptr, 10));
+        } else if (Arg("--x2apic")) {
+            config.x2apic = true;
+        } else if (Arg("--pmu")) {
+            config.pmu = true;
+        } else if (Arg("--irq-coalesce")) {
+            auto v = NextArg(); if (!v) return 1;
+            unsigned us = 0, frames = config.irq_coalesce_frames;
+            if (std::sscanf(v, "%u:%u", &us, &frames) < 1) {
+                fprintf(stderr, "Invalid --irq-coalesce format: %s (expected US[:FRAMES])\n", v);
+                return 1;
+            }
+            config.irq_coalesce_us = us;
+            config.irq_coalesce_frames = frames;
+        } else if (Arg("--virtio-pci")) {
+            config.virtio_pci = true;
+        } else if (Arg("--display-fps")) {
+            auto v = NextArg(); if (!v) return 1;
+            display_fps = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--displays")) {
+            auto v = NextArg(); if (!v) return 1;
+            config.display_count = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
         } else if (Arg("--net")) {
             config.net_link_up = true;
         } else if (Arg("--forward")) {
@@ -101,22 +262,58 @@ int main(int argc, char* argv[]) {
                 fprintf(stderr, "Invalid --forward format: %s (expected H:G)\n", v);
                 return 1;
             }
+        } else if (Arg("--net-limit")) {
+            auto v = NextArg(); if (!v) return 1;
+            unsigned rx = 0, tx = 0, burst = 0;
+            if (std::sscanf(v, "%u:%u:%u", &rx, &tx, &burst) < 2) {
+                fprintf(stderr, "Invalid --net-limit format: %s (expected RX:TX[:BURST])\n", v);
+                return 1;
+            }
+            config.net_rate_limit = {rx, tx, burst};
+        } else if (Arg("--vsock")) {
+            config.vsock = true;
+        } else if (Arg("--vsock-listen") || Arg("--vsock-connect")) {
+            bool listen = Arg("--vsock-listen");
+            auto flag = argv[i];
+            auto v = NextArg(); if (!v) return 1;
+            unsigned a = 0, b = 0;
+            if (std::sscanf(v, "%u:%u", &a, &b) != 2 || !a || !b ||
+                (listen ? a : b) > 0xFFFF) {
+                fprintf(stderr, "Invalid %s format: %s (expected %s)\n", flag, v,
+                        listen ? "H:P" : "P:H");
+                return 1;
+            }
+            VsockForward f{};
+            f.host_port = static_cast<uint16_t>(listen ? a : b);
+            f.vsock_port = listen ? b : a;
+            f.guest_connects = !listen;
+            config.vsock = true;
+            config.vsock_forwards.push_back(f);
         } else if (Arg("--share")) {
             auto v = NextArg(); if (!v) return 1;
             std::string arg(v);
             VmSharedFolder sf;
             sf.readonly = false;
+            sf.writeback = false;
             
             size_t first_colon = arg.find(':');
             if (first_colon == std::string::npos) {
-                fprintf(stderr, "Invalid --share format: %s (expected TAG:PATH[:ro])\n", v);
+                fprintf(stderr, "Invalid --share format: %s (expected TAG:PATH[:ro][:wb])\n", v);
                 return 1;
             }
             sf.tag = arg.substr(0, first_colon);
             std::string rest = arg.substr(first_colon + 1);
             
-            if (rest.size() >= 3 && rest.substr(rest.size() - 3) == ":ro") {
-                sf.readonly = true;
+            // Trailing options, in either order.
+            while (rest.size() >= 3) {
+                std::string opt = rest.substr(rest.size() - 3);
+                if (opt == ":ro") {
+                    sf.readonly = true;
+                } else if (opt == ":wb") {
+                    sf.writeback = true;
+                } else {
+                    break;
+                }
                 rest = rest.substr(0, rest.size() - 3);
             }
             sf.host_path = rest;
@@ -152,10 +349,48 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "Error: --cpus must be between 1 and 128\n");
         return 1;
     }
+    if (config.max_cpu_count && (config.max_cpu_count < config.cpu_count ||
+                                 config.max_cpu_count > 128)) {
+        fprintf(stderr, "Error: --max-cpus must be between --cpus and 128\n");
+        return 1;
+    }
+    if (config.max_memory_mb && config.max_memory_mb < config.memory_mb) {
+        fprintf(stderr, "Error: --max-memory must be at least --memory\n");
+        return 1;
+    }
+    if (config.io_threads > kMaxIoThreads) {
+        fprintf(stderr, "Error: --io-threads must be at most %u\n", kMaxIoThreads);
+        return 1;
+    }
+    for (const auto& [device, index] : config.device_io_threads) {
+        if (index >= config.io_threads) {
+            fprintf(stderr, "Error: --io-thread %s=%u needs --io-threads %u or more\n",
+                    device.c_str(), index, index + 1);
+            return 1;
+        }
+    }
+    if (config.checkpoint_interval_s && config.checkpoint_path.empty()) {
+        fprintf(stderr, "Error: --checkpoint-interval needs --checkpoint\n");
+        return 1;
+    }
+    if (config.migrate_listen_port && !config.restore_path.empty()) {
+        fprintf(stderr, "Error: --migrate-listen and --restore are mutually exclusive\n");
+        return 1;
+    }
+
+    etw::RegisterVmmProvider();
+    ipc::etw::RegisterProvider();
+    struct EtwProviders {
+        ~EtwProviders() {
+            ipc::etw::UnregisterProvider();
+            etw::UnregisterVmmProvider();
+        }
+    } etw_providers;
 
     std::unique_ptr<RuntimeControlService> control;
     if (!control_endpoint.empty()) {
         control = std::make_unique<RuntimeControlService>(vm_id, control_endpoint);
+        control->SetDisplayFps(display_fps);
         if (!control->Start()) {
             fprintf(stderr, "Failed to start runtime control service\n");
             return 1;
@@ -169,6 +404,12 @@ int main(int argc, char* argv[]) {
     }
 
     auto vm = Vm::Create(config);
+    if (!vm && !config.restore_path.empty()) {
+        // A stale or mismatched snapshot should not keep the VM from booting.
+        LOG_WARN("Cannot resume from %s, booting instead", config.restore_path.c_str());
+        config.restore_path.clear();
+        vm = Vm::Create(config);
+    }
     if (!vm) {
         if (control) control->PublishState("crashed", 1);
         fprintf(stderr, "Failed to create VM\n");
@@ -182,6 +423,10 @@ int main(int argc, char* argv[]) {
     if (control) {
         if (wants_reboot) {
             control->PublishState("rebooting", 0);
+        } else if (vm->Suspended()) {
+            control->PublishState("suspended", 0);
+        } else if (vm->Migrated()) {
+            control->PublishState("migrated", 0);
         } else {
             control->PublishState(exit_code == 0 ? "stopped" : "crashed", exit_code);
         }
@@ -1,7 +1,10 @@
 #include "runtime/runtime_service.h"
 
+#include "core/guest_agent/guest_file_transfer.h"
 #include "core/vmm/types.h"
 #include "core/vmm/vm.h"
+#include "ipc/etw.h"
+#include "ipc/pipe_io.h"
 
 #include <windows.h>
 
@@ -19,6 +22,57 @@ HANDLE AsHandle(void* handle) {
     return reinterpret_cast<HANDLE>(handle);
 }
 
+// "vcpu|name|count|total_ns|max_ns|h0,h1,..." for runtime.stats.
+std::string FormatExitCounter(uint32_t vcpu, const std::string& name,
+                              const whvp::ExitCounter& c) {
+    std::string out = std::to_string(vcpu) + "|" + name + "|" +
+        std::to_string(c.count) + "|" + std::to_string(c.total_ns) + "|" +
+        std::to_string(c.max_ns) + "|";
+    for (size_t i = 0; i < whvp::ExitCounter::kBuckets; i++) {
+        if (i) out += ',';
+        out += std::to_string(c.histogram[i]);
+    }
+    return out;
+}
+
+// "passes|resident|stable|zero|duplicate|shared|combined", in pages.
+std::string FormatDedupStats(const PageDedupScanner::Stats& s) {
+    return std::to_string(s.passes) + "|" + std::to_string(s.resident_pages) + "|" +
+        std::to_string(s.stable_pages) + "|" + std::to_string(s.zero_pages) + "|" +
+        std::to_string(s.duplicate_pages) + "|" + std::to_string(s.shared_pages) + "|" +
+        std::to_string(s.combined_pages);
+}
+
+// Byte order of a virtio-gpu scanout format. Surfaces are all kept as
+// B,G,R,A; the format reported with them keeps only whether alpha is real.
+ipc::PixelOrder PixelOrderOf(uint32_t format) {
+    switch (format) {
+    case VIRTIO_GPU_FORMAT_A8R8G8B8_UNORM:
+    case VIRTIO_GPU_FORMAT_X8R8G8B8_UNORM:
+        return ipc::PixelOrder::kArgb;
+    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+    case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
+        return ipc::PixelOrder::kRgba;
+    case VIRTIO_GPU_FORMAT_A8B8G8R8_UNORM:
+    case VIRTIO_GPU_FORMAT_X8B8G8R8_UNORM:
+        return ipc::PixelOrder::kAbgr;
+    default:
+        return ipc::PixelOrder::kBgra;
+    }
+}
+
+uint32_t SurfaceFormatOf(uint32_t format) {
+    switch (format) {
+    case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
+    case VIRTIO_GPU_FORMAT_A8R8G8B8_UNORM:
+    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+    case VIRTIO_GPU_FORMAT_A8B8G8R8_UNORM:
+        return VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM;
+    default:
+        return VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+    }
+}
+
 }  // namespace
 
 void ManagedConsolePort::Write(const uint8_t* data, size_t size) {
@@ -79,6 +133,60 @@ void ManagedConsolePort::PushInput(const uint8_t* data, size_t size) {
 
 // ── ManagedInputPort ─────────────────────────────────────────────────
 
+ManagedInputPort::ManagedInputPort()
+    : wake_(CreateEventW(nullptr, FALSE, FALSE, nullptr)) {}
+
+ManagedInputPort::~ManagedInputPort() {
+    if (wake_) CloseHandle(AsHandle(wake_));
+}
+
+bool ManagedInputPort::CreateRing(const std::string& name) {
+    if (!ring_.Create(name)) {
+        LOG_WARN("Input ring %s unavailable, input goes over the pipe", name.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ManagedInputPort::WaitForInput(uint32_t timeout_ms) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!key_queue_.empty() || !pointer_queue_.empty()) return;
+    }
+    if (ring_.IsOpen()) {
+        ring_.Wait(timeout_ms, wake_);
+    } else {
+        WaitForSingleObject(AsHandle(wake_), timeout_ms);
+    }
+
+    // Ring events join the queues, so the poll order holds for both paths.
+    ipc::InputRingEvent ev;
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (ring_.Pop(&ev)) {
+        switch (ev.type) {
+        case ipc::InputRingEvent::kKey:
+            key_queue_.push_back({ev.key_code, ev.pressed != 0});
+            break;
+        case ipc::InputRingEvent::kPointer:
+            QueuePointerLocked({ev.x, ev.y, ev.buttons, 0});
+            break;
+        case ipc::InputRingEvent::kWheel: {
+            PointerEvent wheel = last_pointer_;
+            wheel.wheel_delta = ev.wheel_delta;
+            QueuePointerLocked(wheel);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+void ManagedInputPort::QueuePointerLocked(PointerEvent ev) {
+    if (!ev.wheel_delta) last_pointer_ = ev;
+    pointer_queue_.push_back(ev);
+}
+
 bool ManagedInputPort::PollKeyboard(KeyboardEvent* event) {
     std::lock_guard<std::mutex> lock(mutex_);
     if (key_queue_.empty()) return false;
@@ -96,13 +204,30 @@ bool ManagedInputPort::PollPointer(PointerEvent* event) {
 }
 
 void ManagedInputPort::PushKeyEvent(const KeyboardEvent& ev) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    key_queue_.push_back(ev);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        key_queue_.push_back(ev);
+    }
+    SetEvent(AsHandle(wake_));
 }
 
 void ManagedInputPort::PushPointerEvent(const PointerEvent& ev) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    pointer_queue_.push_back(ev);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        QueuePointerLocked(ev);
+    }
+    SetEvent(AsHandle(wake_));
+}
+
+void ManagedInputPort::PushWheelEvent(int32_t delta) {
+    if (!delta) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        PointerEvent wheel = last_pointer_;
+        wheel.wheel_delta = delta;
+        QueuePointerLocked(wheel);
+    }
+    SetEvent(AsHandle(wake_));
 }
 
 // ── ManagedDisplayPort ───────────────────────────────────────────────
@@ -137,16 +262,18 @@ void ManagedDisplayPort::SetCursorHandler(
     cursor_handler_ = std::move(handler);
 }
 
-void ManagedDisplayPort::SubmitScanoutState(bool active, uint32_t width, uint32_t height) {
-    std::function<void(bool, uint32_t, uint32_t)> handler;
+void ManagedDisplayPort::SubmitScanoutState(uint32_t scanout_id, bool active,
+                                            uint32_t width, uint32_t height) {
+    std::function<void(uint32_t, bool, uint32_t, uint32_t)> handler;
     {
         std::lock_guard<std::mutex> lock(mutex_);
         handler = state_handler_;
     }
-    if (handler) handler(active, width, height);
+    if (handler) handler(scanout_id, active, width, height);
 }
 
-void ManagedDisplayPort::SetStateHandler(std::function<void(bool, uint32_t, uint32_t)> handler) {
+void ManagedDisplayPort::SetStateHandler(
+    std::function<void(uint32_t, bool, uint32_t, uint32_t)> handler) {
     std::lock_guard<std::mutex> lock(mutex_);
     state_handler_ = std::move(handler);
 }
@@ -171,7 +298,23 @@ void ManagedClipboardPort::SetEventHandler(std::function<void(const ClipboardEve
 
 // ── ManagedAudioPort ──────────────────────────────────────────────────
 
+void ManagedAudioPort::CreateRings(const std::string& vm_id, uint32_t process_id) {
+    if (!playback_ring_.Create(ipc::PcmRingName(vm_id, process_id))) {
+        LOG_WARN("Audio ring unavailable, PCM goes over the pipe");
+    }
+    if (!capture_ring_.Create(ipc::CaptureRingName(vm_id, process_id))) {
+        LOG_WARN("Capture ring unavailable, the guest records silence");
+    }
+}
+
 void ManagedAudioPort::SubmitPcm(AudioChunk chunk) {
+    if (playback_ring_.IsOpen() && chunk.sample_rate == ipc::PcmRing::kSampleRate &&
+        chunk.channels == ipc::PcmRing::kChannels) {
+        // A full ring means the player is gone or stalled; late audio is
+        // worth nothing, so the overflow is dropped.
+        playback_ring_.Write(chunk.pcm.data(), chunk.pcm.size() / ipc::PcmRing::kChannels);
+        return;
+    }
     std::function<void(AudioChunk)> handler;
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -185,68 +328,81 @@ void ManagedAudioPort::SetPcmHandler(std::function<void(AudioChunk)> handler) {
     pcm_handler_ = std::move(handler);
 }
 
-std::string EncodeHex(const uint8_t* data, size_t size) {
-    static constexpr char kDigits[] = "0123456789abcdef";
-    std::string out;
-    out.resize(size * 2);
-    for (size_t i = 0; i < size; ++i) {
-        out[2 * i] = kDigits[(data[i] >> 4) & 0x0F];
-        out[2 * i + 1] = kDigits[data[i] & 0x0F];
+bool ManagedAudioPort::GetPlaybackClock(AudioClock* clock) {
+    // No target means no player has the ring.
+    uint32_t target = playback_ring_.TargetFrames();
+    if (!target) return false;
+    clock->target = target;
+    clock->played = playback_ring_.ReadPosition();
+    clock->queued = static_cast<uint32_t>(playback_ring_.Available());
+    return true;
+}
+
+void ManagedAudioPort::SetCaptureActive(bool active) {
+    // Whatever the microphone left in the ring since the last capture is stale.
+    if (active) capture_ring_.Skip(capture_ring_.Available());
+    std::function<void(bool)> handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        handler = capture_handler_;
     }
-    return out;
+    if (handler) handler(active);
 }
 
-std::vector<uint8_t> DecodeHex(const std::string& value) {
-    auto hex = [](char ch) -> int {
-        if (ch >= '0' && ch <= '9') return ch - '0';
-        if (ch >= 'a' && ch <= 'f') return 10 + (ch - 'a');
-        if (ch >= 'A' && ch <= 'F') return 10 + (ch - 'A');
-        return -1;
-    };
+bool ManagedAudioPort::GetCapturedFrames(size_t* frames) {
+    if (!capture_ring_.IsOpen()) return false;
+    *frames = capture_ring_.Available();
+    return true;
+}
 
-    if ((value.size() % 2) != 0) return {};
-    std::vector<uint8_t> out(value.size() / 2);
-    for (size_t i = 0; i < out.size(); ++i) {
-        int hi = hex(value[2 * i]);
-        int lo = hex(value[2 * i + 1]);
-        if (hi < 0 || lo < 0) return {};
-        out[i] = static_cast<uint8_t>((hi << 4) | lo);
-    }
-    return out;
+size_t ManagedAudioPort::ReadCapture(int16_t* samples, size_t frames) {
+    return capture_ring_.Read(samples, frames);
+}
+
+void ManagedAudioPort::SetCaptureHandler(std::function<void(bool)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capture_handler_ = std::move(handler);
 }
 
 RuntimeControlService::RuntimeControlService(std::string vm_id, std::string pipe_name)
-    : vm_id_(std::move(vm_id)), pipe_name_(std::move(pipe_name)) {
+    : vm_id_(std::move(vm_id)), pipe_name_(std::move(pipe_name)),
+      stop_event_(CreateEventW(nullptr, TRUE, FALSE, nullptr)) {
+    input_port_->CreateRing(ipc::InputRingName(vm_id_, GetCurrentProcessId()));
+    audio_port_->CreateRings(vm_id_, GetCurrentProcessId());
+    if (!metrics_.Create(ipc::MetricsBlockName(vm_id_, GetCurrentProcessId()))) {
+        LOG_WARN("Metrics block unavailable, the manager will show no metrics");
+    }
+
     console_port_->SetDataAvailableCallback([this]() {
         send_cv_.notify_one();
     });
 
     display_port_->SetFrameHandler([this](DisplayFrame frame) {
-        ipc::Message event;
-        event.kind = ipc::Kind::kEvent;
-        event.channel = ipc::Channel::kDisplay;
-        event.type = "display.frame";
-        event.vm_id = vm_id_;
-        event.request_id = next_event_id_++;
-        event.fields["width"] = std::to_string(frame.width);
-        event.fields["height"] = std::to_string(frame.height);
-        event.fields["stride"] = std::to_string(frame.stride);
-        event.fields["format"] = std::to_string(frame.format);
-        event.fields["resource_width"] = std::to_string(frame.resource_width);
-        event.fields["resource_height"] = std::to_string(frame.resource_height);
-        event.fields["dirty_x"] = std::to_string(frame.dirty_x);
-        event.fields["dirty_y"] = std::to_string(frame.dirty_y);
-        event.payload = std::move(frame.pixels);
-
-        std::string encoded = ipc::Encode(event);
+        if (frame.scanout_id >= kMaxDisplayScanouts) return;
+        uint32_t rw = frame.resource_width ? frame.resource_width : frame.width;
+        uint32_t rh = frame.resource_height ? frame.resource_height : frame.height;
         {
-            std::lock_guard<std::mutex> lock(send_queue_mutex_);
-            frame_queue_.push_back(std::move(encoded));
-            if (frame_queue_.size() > kMaxPendingFrames) {
-                frame_queue_.pop_front();
+            std::lock_guard<std::mutex> lock(fb_mutex_);
+            EnsureSurface(frame.scanout_id, rw, rh);
+            auto& scanout = scanouts_[frame.scanout_id];
+            // Converted here, once per dirty rectangle, so every reader of
+            // the surface sees the presenter's byte order.
+            scanout.format = SurfaceFormatOf(frame.format);
+            if (const uint8_t* src = frame.Row(0)) {
+                scanout.surface.WriteRect(frame.dirty_x, frame.dirty_y, frame.width,
+                                          frame.Rows(), src, frame.Pitch(),
+                                          PixelOrderOf(frame.format));
             }
+            scanout.damage.Add({frame.dirty_x, frame.dirty_y, frame.width, frame.height});
         }
-        send_cv_.notify_one();
+        bool was_pending;
+        {
+            std::lock_guard<std::mutex> lock(send_queue_mutex_);
+            was_pending = damage_pending_;
+            if (!was_pending) damage_since_ = std::chrono::steady_clock::now();
+            damage_pending_ = true;
+        }
+        if (!was_pending) send_cv_.notify_one();
     });
 
     display_port_->SetCursorHandler([this](const CursorInfo& cursor) {
@@ -256,38 +412,49 @@ RuntimeControlService::RuntimeControlService(std::string vm_id, std::string pipe
         event.type = "display.cursor";
         event.vm_id = vm_id_;
         event.request_id = next_event_id_++;
-        event.fields["x"] = std::to_string(cursor.x);
-        event.fields["y"] = std::to_string(cursor.y);
-        event.fields["hot_x"] = std::to_string(cursor.hot_x);
-        event.fields["hot_y"] = std::to_string(cursor.hot_y);
-        event.fields["width"] = std::to_string(cursor.width);
-        event.fields["height"] = std::to_string(cursor.height);
-        event.fields["visible"] = cursor.visible ? "1" : "0";
-        event.fields["image_updated"] = cursor.image_updated ? "1" : "0";
-        if (cursor.image_updated && !cursor.pixels.empty()) {
-            event.payload = cursor.pixels;
-        }
-
-        std::string encoded = ipc::Encode(event);
+        auto& body = event.body.emplace<ipc::DisplayCursorBody>();
+        body.scanout = cursor.scanout_id;
+        body.x = cursor.x;
+        body.y = cursor.y;
+        body.hot_x = cursor.hot_x;
+        body.hot_y = cursor.hot_y;
+        body.width = cursor.width;
+        body.height = cursor.height;
+        body.visible = cursor.visible;
+        body.image_updated = cursor.image_updated;
+        body.image_id = cursor.image_id;
+
         {
             std::lock_guard<std::mutex> lock(send_queue_mutex_);
-            console_queue_.push_back(std::move(encoded));
+            // Moves and images the manager has seen travel without pixels.
+            if (cursor.image_updated && cursor.image_id != 0 && !cursor.pixels.empty() &&
+                std::find(sent_cursor_images_.begin(), sent_cursor_images_.end(),
+                          cursor.image_id) == sent_cursor_images_.end()) {
+                event.payload = cursor.pixels;
+                sent_cursor_images_.push_back(cursor.image_id);
+                if (sent_cursor_images_.size() > kCursorImageCacheSize) {
+                    sent_cursor_images_.pop_front();
+                }
+            }
+            console_queue_.push_back(ipc::Encode(event, protocol_));
         }
         send_cv_.notify_one();
     });
 
-    display_port_->SetStateHandler([this](bool active, uint32_t width, uint32_t height) {
+    display_port_->SetStateHandler([this](uint32_t scanout_id, bool active,
+                                          uint32_t width, uint32_t height) {
         ipc::Message event;
         event.kind = ipc::Kind::kEvent;
         event.channel = ipc::Channel::kDisplay;
         event.type = "display.state";
         event.vm_id = vm_id_;
         event.request_id = next_event_id_++;
+        event.fields["scanout"] = std::to_string(scanout_id);
         event.fields["active"] = active ? "1" : "0";
         event.fields["width"] = std::to_string(width);
         event.fields["height"] = std::to_string(height);
 
-        std::string encoded = ipc::Encode(event);
+        std::string encoded = ipc::Encode(event, protocol_);
         {
             std::lock_guard<std::mutex> lock(send_queue_mutex_);
             console_queue_.push_back(std::move(encoded));
@@ -320,6 +487,8 @@ RuntimeControlService::RuntimeControlService(std::string vm_id, std::string pipe
             event.type = "clipboard.data";
             event.fields["selection"] = std::to_string(clip_event.selection);
             event.fields["data_type"] = std::to_string(clip_event.data_type);
+            event.fields["offset"] = std::to_string(clip_event.offset);
+            event.fields["total"] = std::to_string(clip_event.total_size);
             event.payload = clip_event.data;
             break;
 
@@ -335,7 +504,7 @@ RuntimeControlService::RuntimeControlService(std::string vm_id, std::string pipe
             break;
         }
 
-        std::string encoded = ipc::Encode(event);
+        std::string encoded = ipc::Encode(event, protocol_);
         {
             std::lock_guard<std::mutex> lock(send_queue_mutex_);
             console_queue_.push_back(std::move(encoded));
@@ -350,13 +519,14 @@ RuntimeControlService::RuntimeControlService(std::string vm_id, std::string pipe
         event.type = "audio.pcm";
         event.vm_id = vm_id_;
         event.request_id = next_event_id_++;
-        event.fields["sample_rate"] = std::to_string(chunk.sample_rate);
-        event.fields["channels"] = std::to_string(chunk.channels);
+        auto& body = event.body.emplace<ipc::AudioPcmBody>();
+        body.sample_rate = chunk.sample_rate;
+        body.channels = chunk.channels;
         size_t byte_len = chunk.pcm.size() * sizeof(int16_t);
         event.payload.resize(byte_len);
         std::memcpy(event.payload.data(), chunk.pcm.data(), byte_len);
 
-        std::string encoded = ipc::Encode(event);
+        std::string encoded = ipc::Encode(event, protocol_);
         {
             std::lock_guard<std::mutex> lock(send_queue_mutex_);
             audio_queue_.push_back(std::move(encoded));
@@ -366,10 +536,119 @@ RuntimeControlService::RuntimeControlService(std::string vm_id, std::string pipe
         }
         send_cv_.notify_one();
     });
+
+    audio_port_->SetCaptureHandler([this](bool active) {
+        ipc::Message event;
+        event.kind = ipc::Kind::kEvent;
+        event.channel = ipc::Channel::kAudio;
+        event.type = "audio.capture";
+        event.vm_id = vm_id_;
+        event.request_id = next_event_id_++;
+        event.fields["active"] = active ? "true" : "false";
+        std::string encoded = ipc::Encode(event, protocol_);
+        {
+            std::lock_guard<std::mutex> lock(send_queue_mutex_);
+            console_queue_.push_back(std::move(encoded));
+        }
+        send_cv_.notify_one();
+    });
 }
 
 RuntimeControlService::~RuntimeControlService() {
     Stop();
+    if (stop_event_) CloseHandle(AsHandle(stop_event_));
+}
+
+void RuntimeControlService::SetDisplayFps(uint32_t fps) {
+    fps = std::clamp<uint32_t>(fps, 1, 240);
+    frame_interval_ = std::chrono::microseconds(1000000 / fps);
+}
+
+void RuntimeControlService::EnsureSurface(uint32_t scanout_id, uint32_t width,
+                                          uint32_t height) {
+    auto& scanout = scanouts_[scanout_id];
+    auto& surface = scanout.surface;
+    if (surface.IsOpen() && surface.width() == width && surface.height() == height)
+        return;
+    // Damage against the old size means nothing on the new surface.
+    scanout.damage.Clear();
+    surface.Close();
+    // The manager may still hold a view of a section from before a resize
+    // or a reboot; skip over names that are taken.
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        if (surface.Create(ipc::SharedFramebufferName(vm_id_, scanout_id, ++fb_generation_),
+                           width, height)) {
+            return;
+        }
+    }
+    LOG_WARN("Shared framebuffer %u (%ux%u) unavailable, sending pixels over the pipe",
+             scanout_id, width, height);
+    surface.CreatePrivate(width, height);
+}
+
+void RuntimeControlService::ResendScreens() {
+    {
+        std::lock_guard<std::mutex> lock(fb_mutex_);
+        for (auto& scanout : scanouts_) {
+            if (scanout.surface.IsOpen()) {
+                scanout.damage.Add({0, 0, scanout.surface.width(), scanout.surface.height()});
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(send_queue_mutex_);
+        if (!damage_pending_) damage_since_ = std::chrono::steady_clock::now();
+        damage_pending_ = true;
+    }
+    send_cv_.notify_one();
+}
+
+void RuntimeControlService::ComposeFrames(std::vector<ipc::Message>* frames) {
+    for (uint32_t id = 0; id < kMaxDisplayScanouts; ++id) {
+        auto& scanout = scanouts_[id];
+        const auto& surface = scanout.surface;
+        if (!surface.IsOpen()) {
+            scanout.damage.Clear();
+            continue;
+        }
+        for (const auto& rect : scanout.damage.Take()) {
+            ipc::Message event;
+            event.kind = ipc::Kind::kEvent;
+            event.channel = ipc::Channel::kDisplay;
+            event.type = "display.frame";
+            event.vm_id = vm_id_;
+            event.request_id = next_event_id_++;
+            auto& body = event.body.emplace<ipc::DisplayFrameBody>();
+            body.scanout = id;
+            body.width = rect.width;
+            body.height = rect.height;
+            body.stride = rect.width * ipc::SharedFramebuffer::kBytesPerPixel;
+            body.format = scanout.format;
+            body.resource_width = surface.width();
+            body.resource_height = surface.height();
+            body.dirty_x = rect.x;
+            body.dirty_y = rect.y;
+            if (surface.IsShared() && share_surface_) {
+                event.fields["shm_name"] = surface.name();
+            } else {
+                event.payload.resize(static_cast<size_t>(rect.width) * rect.height *
+                                     ipc::SharedFramebuffer::kBytesPerPixel);
+                surface.ReadRect(rect.x, rect.y, rect.width, rect.height,
+                                 event.payload.data(), event.payload.size());
+            }
+            frames->push_back(std::move(event));
+        }
+    }
+}
+
+void RuntimeControlService::EncodeFramePayload(ipc::FrameEncoding encoding,
+                                               ipc::Message* frame) {
+    if (encoding == ipc::FrameEncoding::kRaw || frame->payload.empty()) return;
+    // Pixels that do not compress go out raw.
+    std::vector<uint8_t> coded;
+    if (!frame_codec_.Compress(frame->payload.data(), frame->payload.size(), &coded)) return;
+    frame->payload = std::move(coded);
+    std::get<ipc::DisplayFrameBody>(frame->body).encoding = static_cast<uint8_t>(encoding);
 }
 
 bool RuntimeControlService::Start() {
@@ -381,30 +660,41 @@ bool RuntimeControlService::Start() {
     running_ = true;
 
     send_thread_ = std::thread([this]() {
-        HANDLE h = AsHandle(pipe_handle_);
         constexpr auto kFlushInterval = std::chrono::milliseconds(20);
 
         while (running_) {
             std::string batch;
+            std::vector<ipc::Message> frames;
+            ipc::FrameEncoding encoding = ipc::FrameEncoding::kRaw;
+            std::chrono::steady_clock::time_point damage_since;
             {
                 std::unique_lock<std::mutex> lock(send_queue_mutex_);
 
-                // Determine wait duration based on whether console has pending data.
+                // Determine wait duration based on whether console has
+                // pending data or display damage is waiting for its frame.
+                auto ready = [this]() {
+                    return !running_ || !console_queue_.empty() ||
+                           !audio_queue_.empty() || console_port_->HasPending();
+                };
+                auto frame_due = [this]() {
+                    return damage_pending_ && viewer_attached_ &&
+                           frames_in_flight_ < kMaxFramesInFlight;
+                };
                 bool has_pending = console_port_->HasPending();
                 if (has_pending) {
                     send_cv_.wait_for(lock, kFlushInterval);
+                } else if (frame_due()) {
+                    send_cv_.wait_until(lock, next_frame_time_, ready);
                 } else {
-                    send_cv_.wait(lock, [this]() {
-                        return !running_ || !console_queue_.empty() ||
-                               !frame_queue_.empty() || !audio_queue_.empty() ||
-                               console_port_->HasPending();
-                    });
+                    send_cv_.wait(lock, [&]() { return ready() || frame_due(); });
                 }
 
                 if (!running_) {
                     break;
                 }
 
+                batch = TakeUrgentLocked();
+
                 // Flush any pending console output from the port.
                 std::string console_data = console_port_->FlushPending();
                 if (!console_data.empty()) {
@@ -414,67 +704,156 @@ bool RuntimeControlService::Start() {
                     event.type = "console.data";
                     event.vm_id = vm_id_;
                     event.request_id = next_event_id_++;
-                    event.fields["data_hex"] = EncodeHex(
-                        reinterpret_cast<const uint8_t*>(console_data.data()),
-                        console_data.size());
-                    batch += ipc::Encode(event);
-                }
-
-                // Send all queued high-priority messages (control responses, etc.).
-                while (!console_queue_.empty()) {
-                    batch += std::move(console_queue_.front());
-                    console_queue_.pop_front();
+                    event.payload.assign(console_data.begin(), console_data.end());
+                    batch += ipc::Encode(event, protocol_);
                 }
 
-                // Send audio PCM chunks (latency-sensitive).
-                size_t audio_to_send = audio_queue_.size();
-                while (audio_to_send-- > 0 && !audio_queue_.empty()) {
-                    batch += std::move(audio_queue_.front());
-                    audio_queue_.pop_front();
+                // Send the display damage gathered since the last frame.
+                auto now = std::chrono::steady_clock::now();
+                if (frame_due() && now >= next_frame_time_) {
+                    damage_pending_ = false;
+                    damage_since = damage_since_;
+                    next_frame_time_ = now + frame_interval_;
+                    std::lock_guard<std::mutex> fb_lock(fb_mutex_);
+                    ComposeFrames(&frames);
+                    encoding = frame_encoding_;
+                    frames_in_flight_ += static_cast<uint32_t>(frames.size());
+                    if (!frames.empty()) frames_sent_.fetch_add(1, std::memory_order_relaxed);
                 }
-
-                // Send display frames (bounded to avoid blocking too long).
-                size_t frames_to_send = frame_queue_.size();
-                while (frames_to_send-- > 0 && !frame_queue_.empty()) {
-                    batch += std::move(frame_queue_.front());
-                    frame_queue_.pop_front();
-                }
-            }
-
-            if (batch.empty()) {
-                continue;
-            }
-
-            std::lock_guard<std::mutex> send_lock(send_mutex_);
-            h = AsHandle(pipe_handle_);
-            if (!h || h == INVALID_HANDLE_VALUE) {
-                break;
             }
 
-            const char* data = batch.data();
-            size_t remaining = batch.size();
-            while (remaining > 0) {
-                DWORD written = 0;
-                if (!WriteFile(h, data, static_cast<DWORD>(remaining), &written, nullptr)) {
-                    break;
+            bool ok = batch.empty() || WritePipe(batch);
+
+            // Compression runs unlocked so flushes are not held up by it.
+            // Urgent traffic queued meanwhile goes ahead of the frame.
+            size_t sent = 0;
+            for (auto& frame : frames) {
+                if (!ok) break;
+                EncodeFramePayload(encoding, &frame);
+                {
+                    std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                    batch = TakeUrgentLocked();
                 }
-                if (written == 0) {
+                batch += ipc::Encode(frame, protocol_);
+                if (!WritePipe(batch)) {
+                    ok = false;
                     break;
                 }
-                data += written;
-                remaining -= written;
+                sent++;
+                if (ipc::etw::Enabled(ipc::etw::kKeywordDisplay)) {
+                    const auto& body = std::get<ipc::DisplayFrameBody>(frame.body);
+                    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - damage_since).count();
+                    ipc::etw::FrameSent(body.scanout, body.width, body.height, batch.size(),
+                                        static_cast<uint64_t>(us));
+                }
+            }
+            if (!ok) {
+                // Frames that never went out are never acked.
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                auto unsent = static_cast<uint32_t>(frames.size() - sent);
+                frames_in_flight_ -= (std::min)(unsent, frames_in_flight_);
+                break;
             }
         }
     });
 
     recv_thread_ = std::thread(&RuntimeControlService::RunLoop, this);
+    if (metrics_.IsOpen()) {
+        metrics_thread_ = std::thread(&RuntimeControlService::MetricsLoop, this);
+    }
+    return true;
+}
+
+void RuntimeControlService::MetricsLoop() {
+    uint32_t reported_cpus = 0;
+    uint64_t reported_memory_mb = 0;
+    while (WaitForSingleObject(AsHandle(stop_event_), ipc::MetricsBlock::kIntervalMs) ==
+           WAIT_TIMEOUT) {
+        Vm* vm = metrics_vm_.load(std::memory_order_acquire);
+        if (!vm) continue;
+
+        // The guest finishes a resize in its own time; the manager boots
+        // next with what it reached.
+        uint32_t cpus = vm->VCpuCount();
+        uint64_t memory_mb = vm->MemorySizeBytes() >> 20;
+        if (reported_cpus && (cpus != reported_cpus || memory_mb != reported_memory_mb)) {
+            ipc::Message event;
+            event.channel = ipc::Channel::kControl;
+            event.kind = ipc::Kind::kEvent;
+            event.type = "runtime.resources";
+            event.vm_id = vm_id_;
+            event.fields["cpu_count"] = std::to_string(cpus);
+            event.fields["memory_mb"] = std::to_string(memory_mb);
+            Send(event);
+        }
+        reported_cpus = cpus;
+        reported_memory_mb = memory_mb;
+
+        ipc::MetricsSample sample;
+        sample.sample_us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - started_).count());
+        sample.vcpu_count = vm->VCpuCount();
+        sample.memory_committed_bytes = vm->CommittedRamBytes();
+        sample.counters = vm->GetCounters();
+        sample.counters.display_frames = frames_sent_.load(std::memory_order_relaxed);
+        metrics_.Publish(sample);
+    }
+}
+
+std::string RuntimeControlService::TakeUrgentLocked() {
+    std::string out;
+    while (!console_queue_.empty()) {
+        out += std::move(console_queue_.front());
+        console_queue_.pop_front();
+    }
+    while (!audio_queue_.empty()) {
+        out += std::move(audio_queue_.front());
+        audio_queue_.pop_front();
+    }
+    return out;
+}
+
+bool RuntimeControlService::WritePipe(const std::string& data) {
+    std::lock_guard<std::mutex> send_lock(send_mutex_);
+    HANDLE h = AsHandle(pipe_handle_);
+    if (!h || h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // A manager that stops reading cannot hold up Stop().
+    if (!ipc::PipeWrite(h, data.data(), data.size(), stop_event_)) {
+        // The runtime serves one connection, so a broken pipe stays broken.
+        if (running_) LOG_WARN("RuntimeService: pipe write failed (%lu)", GetLastError());
+        return false;
+    }
     return true;
 }
 
 void RuntimeControlService::Stop() {
+    // Its result still goes out over the pipe.
+    if (migrate_thread_.joinable()) {
+        migrate_thread_.join();
+    }
     running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(transfers_mutex_);
+        transfers_.clear();
+    }
     send_cv_.notify_all();
+    if (stop_event_) SetEvent(AsHandle(stop_event_));
 
+    // The threads end their pipe waits on the stop event; the handle is
+    // closed once nothing uses it.
+    if (send_thread_.joinable()) {
+        send_thread_.join();
+    }
+    if (recv_thread_.joinable()) {
+        recv_thread_.join();
+    }
+    if (metrics_thread_.joinable()) {
+        metrics_thread_.join();
+    }
     HANDLE h = AsHandle(pipe_handle_);
     if (h && h != INVALID_HANDLE_VALUE) {
         CancelIoEx(h, nullptr);
@@ -482,16 +861,18 @@ void RuntimeControlService::Stop() {
         CloseHandle(h);
         pipe_handle_ = nullptr;
     }
-    if (send_thread_.joinable()) {
-        send_thread_.join();
-    }
-    if (recv_thread_.joinable()) {
-        recv_thread_.join();
-    }
 }
 
 void RuntimeControlService::AttachVm(Vm* vm) {
     vm_ = vm;
+    metrics_vm_.store(vm, std::memory_order_release);
+    bool viewer_attached;
+    {
+        std::lock_guard<std::mutex> lock(send_queue_mutex_);
+        viewer_attached = viewer_attached_;
+    }
+    // The manager may have said so before the VM was up.
+    if (vm_ && !viewer_attached) vm_->SetDisplayViewer(false);
 
     if (vm_ && vm_->GetGuestAgentHandler()) {
         vm_->GetGuestAgentHandler()->SetConnectedCallback([this](bool connected) {
@@ -506,6 +887,20 @@ void RuntimeControlService::AttachVm(Vm* vm) {
             LOG_INFO("RuntimeService: guest agent %s", connected ? "connected" : "disconnected");
         });
     }
+
+    // The manager decides from these when to combine pages host-wide.
+    if (vm_) {
+        vm_->SetPageDedupPassCallback([this](const PageDedupScanner::Stats& stats) {
+            ipc::Message event;
+            event.kind = ipc::Kind::kEvent;
+            event.channel = ipc::Channel::kControl;
+            event.type = "runtime.dedup_pass";
+            event.vm_id = vm_id_;
+            event.request_id = next_event_id_++;
+            event.fields["dedup"] = FormatDedupStats(stats);
+            Send(event);
+        });
+    }
 }
 
 void RuntimeControlService::PublishState(const std::string& state, int exit_code) {
@@ -517,6 +912,19 @@ void RuntimeControlService::PublishState(const std::string& state, int exit_code
     event.request_id = next_event_id_++;
     event.fields["state"] = state;
     event.fields["exit_code"] = std::to_string(exit_code);
+    event.fields["protocol"] = std::to_string(ipc::kProtocolVersion);
+    if (!input_port_->RingName().empty()) {
+        event.fields["input_ring"] = input_port_->RingName();
+    }
+    if (!audio_port_->PlaybackRingName().empty()) {
+        event.fields["audio_ring"] = audio_port_->PlaybackRingName();
+    }
+    if (!audio_port_->CaptureRingName().empty()) {
+        event.fields["capture_ring"] = audio_port_->CaptureRingName();
+    }
+    if (metrics_.IsOpen()) {
+        event.fields["metrics"] = metrics_.name();
+    }
     Send(event);
 }
 
@@ -529,7 +937,7 @@ bool RuntimeControlService::EnsureClientConnected() {
     std::string full_name = R"(\\.\pipe\)" + pipe_name_;
     h = CreateNamedPipeA(
         full_name.c_str(),
-        PIPE_ACCESS_DUPLEX,
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
         PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
         1,
         64 * 1024,
@@ -541,14 +949,19 @@ bool RuntimeControlService::EnsureClientConnected() {
         return false;
     }
 
-    BOOL connected = ConnectNamedPipe(h, nullptr);
-    if (!connected) {
+    // A client can open the pipe from here on, before the connect below.
+    HANDLE ready = OpenEventA(EVENT_MODIFY_STATE, FALSE,
+        ipc::RuntimeReadyEventName(vm_id_, GetCurrentProcessId()).c_str());
+    if (ready) {
+        SetEvent(ready);
+        CloseHandle(ready);
+    }
+
+    if (!ipc::PipeConnect(h, stop_event_)) {
         DWORD err = GetLastError();
-        if (err != ERROR_PIPE_CONNECTED) {
-            CloseHandle(h);
-            LOG_ERROR("ConnectNamedPipe failed: %lu", err);
-            return false;
-        }
+        CloseHandle(h);
+        LOG_ERROR("ConnectNamedPipe failed: %lu", err);
+        return false;
     }
 
     pipe_handle_ = h;
@@ -556,7 +969,7 @@ bool RuntimeControlService::EnsureClientConnected() {
 }
 
 bool RuntimeControlService::Send(const ipc::Message& message) {
-    std::string encoded = ipc::Encode(message);
+    std::string encoded = ipc::Encode(message, protocol_);
     {
         std::lock_guard<std::mutex> lock(send_queue_mutex_);
         console_queue_.push_back(std::move(encoded));
@@ -566,7 +979,7 @@ bool RuntimeControlService::Send(const ipc::Message& message) {
 }
 
 bool RuntimeControlService::SendWithPayload(const ipc::Message& message) {
-    std::string encoded = ipc::Encode(message);
+    std::string encoded = ipc::Encode(message, protocol_);
     {
         std::lock_guard<std::mutex> lock(send_queue_mutex_);
         console_queue_.push_back(std::move(encoded));
@@ -614,6 +1027,61 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
                 vm_->RequestStop();
                 resp.fields["note"] = "guest agent unavailable, performed stop";
             }
+        } else if (cmd == "suspend") {
+            // Blocks until the snapshot is written; the runtime then exits.
+            auto path = message.fields.find("path");
+            if (!vm_ || path == message.fields.end() || path->second.empty()) {
+                resp.fields["ok"] = "false";
+                resp.fields["error"] = "missing path";
+            } else if (!vm_->Suspend(path->second)) {
+                resp.fields["ok"] = "false";
+                resp.fields["error"] = "suspend failed";
+                // The guest carries on; tell the manager it is not stopping.
+                PublishState("running");
+            }
+        } else if (cmd == "checkpoint") {
+            // Blocks until written; without a path, the --checkpoint one.
+            auto path = message.fields.find("path");
+            if (!vm_ || !vm_->Checkpoint(path != message.fields.end() ? path->second
+                                                                      : std::string())) {
+                resp.fields["ok"] = "false";
+                resp.fields["error"] = "checkpoint failed";
+            }
+        } else if (cmd == "migrate") {
+            // Answered once the VM is on the target (the runtime then exits)
+            // or back to running here.
+            auto host = message.fields.find("host");
+            auto port = message.fields.find("port");
+            uint32_t port_num = port != message.fields.end()
+                ? static_cast<uint32_t>(std::strtoul(port->second.c_str(), nullptr, 10)) : 0;
+            if (!vm_ || host == message.fields.end() || host->second.empty() ||
+                !port_num || port_num > 65535) {
+                resp.fields["ok"] = "false";
+                resp.fields["error"] = "missing host or port";
+            } else if (migrating_.exchange(true)) {
+                resp.fields["ok"] = "false";
+                resp.fields["error"] = "migration in progress";
+            } else {
+                MigrationOptions options;
+                auto mirror = message.fields.find("mirror_disk");
+                options.mirror_disk = mirror != message.fields.end() && mirror->second == "true";
+                auto downtime = message.fields.find("max_downtime_ms");
+                if (downtime != message.fields.end()) {
+                    options.max_downtime_ms = static_cast<uint32_t>(
+                        std::strtoul(downtime->second.c_str(), nullptr, 10));
+                }
+                if (migrate_thread_.joinable()) migrate_thread_.join();
+                migrate_thread_ = std::thread(
+                    [this, resp, target = host->second, port_num, options]() mutable {
+                        if (!vm_->Migrate(target, static_cast<uint16_t>(port_num), options)) {
+                            resp.fields["ok"] = "false";
+                            resp.fields["error"] = "migration failed";
+                        }
+                        Send(resp);
+                        migrating_ = false;
+                    });
+                return;
+            }
         } else if (cmd == "start") {
             resp.fields["note"] = "runtime already started by process launch";
         } else {
@@ -668,11 +1136,185 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
             }
         }
 
+        auto it_rx = message.fields.find("rx_mbps");
+        auto it_tx = message.fields.find("tx_mbps");
+        if (it_rx != message.fields.end() || it_tx != message.fields.end()) {
+            auto value = [&message](const char* key) -> uint32_t {
+                auto it = message.fields.find(key);
+                return it == message.fields.end()
+                    ? 0 : static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10));
+            };
+            vm_->SetNetRateLimit({value("rx_mbps"), value("tx_mbps"), value("burst_kb")});
+        }
+
         resp.fields["ok"] = "true";
         Send(resp);
         return;
     }
 
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.combine_pages") {
+        ipc::Message resp;
+        resp.kind = ipc::Kind::kResponse;
+        resp.channel = ipc::Channel::kControl;
+        resp.type = "runtime.combine_pages.result";
+        resp.vm_id = vm_id_;
+        resp.request_id = message.request_id;
+
+        uint64_t combined = 0;
+        if (vm_ && vm_->CombineGuestPages(&combined)) {
+            resp.fields["ok"] = "true";
+            resp.fields["pages_combined"] = std::to_string(combined);
+        } else {
+            resp.fields["ok"] = "false";
+            resp.fields["error"] = vm_ ? "combining unavailable" : "vm not attached";
+        }
+        Send(resp);
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.set_balloon") {
+        ipc::Message resp;
+        resp.kind = ipc::Kind::kResponse;
+        resp.channel = ipc::Channel::kControl;
+        resp.type = "runtime.set_balloon.result";
+        resp.vm_id = vm_id_;
+        resp.request_id = message.request_id;
+
+        if (!vm_) {
+            resp.fields["ok"] = "false";
+            resp.fields["error"] = "vm not attached";
+            Send(resp);
+            return;
+        }
+
+        auto it_size = message.fields.find("size_mb");
+        if (it_size != message.fields.end()) {
+            vm_->SetBalloonSize(std::strtoull(it_size->second.c_str(), nullptr, 10));
+        }
+        auto it_hint = message.fields.find("hint_free_pages");
+        if (it_hint != message.fields.end() && it_hint->second == "true") {
+            vm_->RequestFreePageHints();
+        }
+
+        resp.fields["ok"] = "true";
+        Send(resp);
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.set_resources") {
+        ipc::Message resp;
+        resp.kind = ipc::Kind::kResponse;
+        resp.channel = ipc::Channel::kControl;
+        resp.type = "runtime.set_resources.result";
+        resp.vm_id = vm_id_;
+        resp.request_id = message.request_id;
+
+        if (!vm_) {
+            resp.fields["ok"] = "false";
+            resp.fields["error"] = "vm not attached";
+            Send(resp);
+            return;
+        }
+
+        // Either may be left out; both are tried so one failing does not
+        // hold the other back.
+        std::string error;
+        auto it_cpus = message.fields.find("cpu_count");
+        if (it_cpus != message.fields.end()) {
+            vm_->SetCpuCount(static_cast<uint32_t>(
+                std::strtoul(it_cpus->second.c_str(), nullptr, 10)), &error);
+        }
+        auto it_mem = message.fields.find("memory_mb");
+        if (it_mem != message.fields.end()) {
+            std::string mem_error;
+            if (!vm_->SetMemorySize(std::strtoull(it_mem->second.c_str(), nullptr, 10),
+                                    &mem_error)) {
+                error += (error.empty() ? "" : "; ") + mem_error;
+            }
+        }
+
+        resp.fields["ok"] = error.empty() ? "true" : "false";
+        if (!error.empty()) resp.fields["error"] = error;
+        resp.fields["cpu_count"] = std::to_string(vm_->VCpuCount());
+        resp.fields["memory_mb"] = std::to_string(vm_->MemorySizeBytes() >> 20);
+        Send(resp);
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.set_disk_limits") {
+        ipc::Message resp;
+        resp.kind = ipc::Kind::kResponse;
+        resp.channel = ipc::Channel::kControl;
+        resp.type = "runtime.set_disk_limits.result";
+        resp.vm_id = vm_id_;
+        resp.request_id = message.request_id;
+
+        auto field = [&message](const char* key) -> uint64_t {
+            auto it = message.fields.find(key);
+            return it == message.fields.end() ? 0 : std::strtoull(it->second.c_str(), nullptr, 10);
+        };
+        BlockThrottleLimits limits;
+        limits.iops = static_cast<uint32_t>(field("iops"));
+        limits.iops_burst = static_cast<uint32_t>(field("iops_burst"));
+        limits.bytes_per_sec = field("mbps") << 20;
+        limits.burst_bytes = field("burst_mb") << 20;
+        if (!vm_ || !vm_->SetDiskLimits(limits)) {
+            resp.fields["ok"] = "false";
+            resp.fields["error"] = vm_ ? "vm has no disk" : "vm not attached";
+        } else {
+            resp.fields["ok"] = "true";
+        }
+        Send(resp);
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.net_capture") {
+        ipc::Message resp;
+        resp.kind = ipc::Kind::kResponse;
+        resp.channel = ipc::Channel::kControl;
+        resp.type = "runtime.net_capture.result";
+        resp.vm_id = vm_id_;
+        resp.request_id = message.request_id;
+
+        auto field = [&message](const char* key) -> std::string {
+            auto it = message.fields.find(key);
+            return it == message.fields.end() ? std::string() : it->second;
+        };
+        std::string error;
+        bool ok = vm_ != nullptr;
+        if (!vm_) {
+            error = "vm not attached";
+        } else if (field("action") == "stop") {
+            vm_->StopNetCapture();
+        } else {
+            NetCaptureOptions options;
+            options.path = field("path");
+            options.snaplen = static_cast<uint32_t>(std::strtoul(field("snaplen").c_str(), nullptr, 10));
+            options.ring_mb = static_cast<uint32_t>(std::strtoul(field("ring_mb").c_str(), nullptr, 10));
+            options.filter = field("filter");
+            ok = !options.path.empty() && vm_->StartNetCapture(options, &error);
+            if (options.path.empty()) error = "missing path";
+        }
+        resp.fields["action"] = field("action") == "stop" ? "stop" : "start";
+        resp.fields["ok"] = ok ? "true" : "false";
+        if (!ok) {
+            resp.fields["error"] = error;
+            LOG_WARN("Net capture: %s", error.c_str());
+        }
+        Send(resp);
+        return;
+    }
+
     if (message.channel == ipc::Channel::kControl &&
         message.kind == ipc::Kind::kRequest &&
         message.type == "runtime.update_shared_folders") {
@@ -713,6 +1355,7 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
             std::string tag;
             std::string host_path;
             bool readonly;
+            bool writeback;
         };
         std::vector<FolderSpec> new_folders;
         new_folders.reserve(count);
@@ -730,7 +1373,10 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
             FolderSpec spec;
             spec.tag = val.substr(0, pos1);
             spec.host_path = val.substr(pos1 + 1, pos2 - pos1 - 1);
-            spec.readonly = (val.substr(pos2 + 1) == "1");
+            // tag|path|ro[|wb]
+            size_t pos3 = val.find('|', pos2 + 1);
+            spec.readonly = (val.substr(pos2 + 1, pos3 - pos2 - 1) == "1");
+            spec.writeback = pos3 != std::string::npos && val.substr(pos3 + 1) == "1";
             new_folders.push_back(std::move(spec));
         }
 
@@ -749,7 +1395,7 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
         std::unordered_set<std::string> current_set(current_tags.begin(), current_tags.end());
         for (const auto& f : new_folders) {
             if (current_set.find(f.tag) == current_set.end()) {
-                vm_->AddSharedFolder(f.tag, f.host_path, f.readonly);
+                vm_->AddSharedFolder(f.tag, f.host_path, f.readonly, f.writeback);
             }
         }
 
@@ -761,10 +1407,8 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
     if (message.channel == ipc::Channel::kConsole &&
         message.kind == ipc::Kind::kRequest &&
         message.type == "console.input") {
-        auto it = message.fields.find("data_hex");
-        if (it != message.fields.end()) {
-            auto bytes = DecodeHex(it->second);
-            console_port_->PushInput(bytes.data(), bytes.size());
+        if (!message.payload.empty()) {
+            console_port_->PushInput(message.payload.data(), message.payload.size());
         }
         return;
     }
@@ -772,12 +1416,10 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
     if (message.channel == ipc::Channel::kInput &&
         message.kind == ipc::Kind::kRequest &&
         message.type == "input.key_event") {
-        auto it_code = message.fields.find("key_code");
-        auto it_pressed = message.fields.find("pressed");
-        if (it_code != message.fields.end() && it_pressed != message.fields.end()) {
+        if (auto* body = std::get_if<ipc::KeyEventBody>(&message.body)) {
             KeyboardEvent ev;
-            ev.key_code = static_cast<uint32_t>(std::strtoul(it_code->second.c_str(), nullptr, 10));
-            ev.pressed = (it_pressed->second == "1" || it_pressed->second == "true");
+            ev.key_code = body->key_code;
+            ev.pressed = body->pressed != 0;
             input_port_->PushKeyEvent(ev);
         }
         return;
@@ -786,24 +1428,35 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
     if (message.channel == ipc::Channel::kInput &&
         message.kind == ipc::Kind::kRequest &&
         message.type == "input.pointer_event") {
-        PointerEvent ev;
-        auto it_x = message.fields.find("x");
-        auto it_y = message.fields.find("y");
-        auto it_btn = message.fields.find("buttons");
-        if (it_x != message.fields.end()) ev.x = std::atoi(it_x->second.c_str());
-        if (it_y != message.fields.end()) ev.y = std::atoi(it_y->second.c_str());
-        if (it_btn != message.fields.end()) ev.buttons = static_cast<uint32_t>(std::strtoul(it_btn->second.c_str(), nullptr, 10));
-        input_port_->PushPointerEvent(ev);
+        if (auto* body = std::get_if<ipc::PointerEventBody>(&message.body)) {
+            PointerEvent ev;
+            ev.x = body->x;
+            ev.y = body->y;
+            ev.buttons = body->buttons;
+            input_port_->PushPointerEvent(ev);
+        }
         return;
     }
 
     if (message.channel == ipc::Channel::kInput &&
         message.kind == ipc::Kind::kRequest &&
         message.type == "input.wheel_event") {
-        auto it_delta = message.fields.find("delta");
-        if (it_delta != message.fields.end() && vm_) {
-            int32_t delta = std::atoi(it_delta->second.c_str());
-            vm_->InjectWheelEvent(delta);
+        auto* body = std::get_if<ipc::WheelEventBody>(&message.body);
+        if (body) input_port_->PushWheelEvent(body->delta);
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kDisplay &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "display.ack") {
+        auto it = message.fields.find("frames");
+        if (it != message.fields.end()) {
+            auto frames = static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10));
+            {
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                frames_in_flight_ -= (std::min)(frames, frames_in_flight_);
+            }
+            send_cv_.notify_one();
         }
         return;
     }
@@ -813,10 +1466,274 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
         message.type == "display.set_size") {
         auto it_w = message.fields.find("width");
         auto it_h = message.fields.find("height");
+        auto it_s = message.fields.find("scanout");
         if (it_w != message.fields.end() && it_h != message.fields.end() && vm_) {
             uint32_t w = static_cast<uint32_t>(std::strtoul(it_w->second.c_str(), nullptr, 10));
             uint32_t h = static_cast<uint32_t>(std::strtoul(it_h->second.c_str(), nullptr, 10));
-            vm_->SetDisplaySize(w, h);
+            uint32_t scanout = it_s != message.fields.end()
+                ? static_cast<uint32_t>(std::strtoul(it_s->second.c_str(), nullptr, 10))
+                : 0;
+            vm_->SetDisplaySize(scanout, w, h);
+        }
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kDisplay &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "display.configure") {
+        auto it_shared = message.fields.find("shared_surface");
+        auto it_enc = message.fields.find("encodings");
+        {
+            std::lock_guard<std::mutex> lock(fb_mutex_);
+            if (it_shared != message.fields.end()) {
+                share_surface_ = it_shared->second != "0";
+            }
+            if (it_enc != message.fields.end()) {
+                // Comma-separated, most preferred first; take the first
+                // one we know.
+                frame_encoding_ = ipc::FrameEncoding::kRaw;
+                size_t pos = 0;
+                while (pos <= it_enc->second.size()) {
+                    size_t comma = it_enc->second.find(',', pos);
+                    if (comma == std::string::npos) comma = it_enc->second.size();
+                    auto parsed = ipc::FrameEncodingFromString(
+                        it_enc->second.substr(pos, comma - pos));
+                    if (parsed) {
+                        frame_encoding_ = *parsed;
+                        break;
+                    }
+                    pos = comma + 1;
+                }
+            }
+        }
+        // Resend every screen the new way.
+        ResendScreens();
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kDisplay &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "display.viewer") {
+        auto it = message.fields.find("attached");
+        bool attached = it == message.fields.end() || it->second != "0";
+        {
+            std::lock_guard<std::mutex> lock(send_queue_mutex_);
+            if (viewer_attached_ == attached) return;
+            viewer_attached_ = attached;
+        }
+        LOG_INFO("Display viewer %s", attached ? "attached" : "detached");
+        if (vm_) vm_->SetDisplayViewer(attached);
+        // What the manager kept may be long out of date.
+        if (attached) ResendScreens();
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.stats") {
+        ipc::Message resp;
+        resp.kind = ipc::Kind::kResponse;
+        resp.channel = ipc::Channel::kControl;
+        resp.type = "runtime.stats.result";
+        resp.vm_id = vm_id_;
+        resp.request_id = message.request_id;
+
+        if (!vm_) {
+            resp.fields["ok"] = "false";
+            resp.fields["error"] = "vm not attached";
+            Send(resp);
+            return;
+        }
+
+        auto vcpus = vm_->GetVCpuStats();
+        size_t count = 0;
+        auto add = [&](uint32_t vcpu, const std::string& name,
+                       const whvp::ExitCounter& c) {
+            if (!c.count) return;
+            resp.fields["stat_" + std::to_string(count++)] =
+                FormatExitCounter(vcpu, name, c);
+        };
+        for (uint32_t v = 0; v < vcpus.size(); v++) {
+            const auto& exits = vcpus[v].exits;
+            for (size_t i = 0; i < static_cast<size_t>(whvp::ExitKind::kCount); i++) {
+                add(v, whvp::ExitKindName(static_cast<whvp::ExitKind>(i)),
+                    exits.by_kind[i]);
+            }
+            char name[48];
+            for (const auto& [port, c] : exits.by_port) {
+                std::snprintf(name, sizeof(name), "port 0x%X", port);
+                add(v, name, c);
+            }
+            for (const auto& [base, c] : exits.by_mmio) {
+                const char* dev = Vm::MmioDeviceName(base);
+                if (dev) {
+                    std::snprintf(name, sizeof(name), "mmio %s", dev);
+                } else {
+                    std::snprintf(name, sizeof(name), "mmio 0x%llX",
+                                  static_cast<unsigned long long>(base));
+                }
+                add(v, name, c);
+            }
+            for (const auto& [msr, c] : exits.by_msr) {
+                std::snprintf(name, sizeof(name), "msr 0x%X", msr);
+                add(v, name, c);
+            }
+
+            const auto& h = vcpus[v].halt;
+            resp.fields["halt_" + std::to_string(v)] =
+                std::to_string(h.halts) + "|" + std::to_string(h.halted_ns) + "|" +
+                std::to_string(h.poll_wakeups) + "|" + std::to_string(h.poll_us);
+        }
+        resp.fields["vcpu_count"] = std::to_string(vcpus.size());
+        resp.fields["stat_count"] = std::to_string(count);
+
+        // host_port|guest_port|accepted|active|bytes_to_guest|bytes_to_host
+        auto forwards = vm_->GetPortForwardStats();
+        for (size_t i = 0; i < forwards.size(); i++) {
+            const auto& f = forwards[i];
+            resp.fields["pf_" + std::to_string(i)] =
+                std::to_string(f.host_port) + "|" + std::to_string(f.guest_port) + "|" +
+                std::to_string(f.accepted) + "|" + std::to_string(f.active) + "|" +
+                std::to_string(f.bytes_to_guest) + "|" + std::to_string(f.bytes_to_host);
+        }
+        resp.fields["pf_count"] = std::to_string(forwards.size());
+
+        if (vm_->GetPageDedupStats().passes) {
+            resp.fields["dedup"] = FormatDedupStats(vm_->GetPageDedupStats());
+        }
+
+        // target|actual|reported|hinted, in bytes
+        auto balloon = vm_->GetBalloonStats();
+        resp.fields["balloon"] =
+            std::to_string(balloon.target_pages << VIRTIO_BALLOON_PFN_SHIFT) + "|" +
+            std::to_string(balloon.actual_pages << VIRTIO_BALLOON_PFN_SHIFT) + "|" +
+            std::to_string(balloon.reported_bytes) + "|" +
+            std::to_string(balloon.hinted_bytes);
+
+        // tx_dropped|shaper_dropped, in frames
+        resp.fields["net_dropped"] =
+            std::to_string(vm_->GetNetTxDropped()) + "|" +
+            std::to_string(vm_->GetNetShaperDropped());
+
+        // name|count|errors|total_us|max_us|p50_us|p99_us
+        auto fs_ops = vm_->GetFsOpStats();
+        for (size_t i = 0; i < fs_ops.size(); i++) {
+            const auto& op = fs_ops[i];
+            resp.fields["fsop_" + std::to_string(i)] =
+                std::string(VirtioFsOpStats::OpcodeName(op.opcode)) + "|" +
+                std::to_string(op.count) + "|" + std::to_string(op.errors) + "|" +
+                std::to_string(op.total_us) + "|" + std::to_string(op.max_us) + "|" +
+                std::to_string(op.PercentileUs(0.5)) + "|" +
+                std::to_string(op.PercentileUs(0.99));
+        }
+        resp.fields["fsop_count"] = std::to_string(fs_ops.size());
+
+        // us|name, in the order the phases were reached
+        auto startup = vm_->GetStartupTrace();
+        for (size_t i = 0; i < startup.size(); i++) {
+            resp.fields["startup_" + std::to_string(i)] =
+                std::to_string(startup[i].us) + "|" + startup[i].name;
+        }
+        resp.fields["startup_count"] = std::to_string(startup.size());
+        resp.fields["ok"] = "true";
+        Send(resp);
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.file_transfer") {
+        ipc::Message resp;
+        resp.kind = ipc::Kind::kResponse;
+        resp.channel = ipc::Channel::kControl;
+        resp.type = "runtime.file_transfer.result";
+        resp.vm_id = vm_id_;
+        resp.request_id = message.request_id;
+
+        auto field = [&](const char* name) {
+            auto it = message.fields.find(name);
+            return it != message.fields.end() ? it->second : std::string();
+        };
+        std::string id = field("id");
+        std::string direction = field("direction");
+        std::string host_path = field("host_path");
+        std::string guest_path = field("guest_path");
+        resp.fields["id"] = id;
+
+        GuestAgentHandler* agent = vm_ ? vm_->GetGuestAgentHandler() : nullptr;
+        if (!agent || !agent->IsConnected()) {
+            resp.fields["ok"] = "false";
+            resp.fields["error"] = "guest agent not connected";
+        } else if (id.empty() || host_path.empty() || guest_path.empty() ||
+                   (direction != "push" && direction != "pull")) {
+            resp.fields["ok"] = "false";
+            resp.fields["error"] = "bad transfer request";
+        } else {
+            auto transfer = std::make_unique<GuestFileTransfer>(
+                agent,
+                direction == "push" ? GuestFileTransfer::Direction::kPush
+                                    : GuestFileTransfer::Direction::kPull,
+                host_path, guest_path);
+            transfer->Start(
+                [this, id](uint64_t bytes, uint64_t total) {
+                    ipc::Message event;
+                    event.kind = ipc::Kind::kEvent;
+                    event.channel = ipc::Channel::kControl;
+                    event.type = "runtime.file_transfer.progress";
+                    event.vm_id = vm_id_;
+                    event.request_id = next_event_id_++;
+                    event.fields["id"] = id;
+                    event.fields["bytes"] = std::to_string(bytes);
+                    event.fields["total"] = std::to_string(total);
+                    Send(event);
+                },
+                [this, id](bool ok, const std::string& error, uint64_t bytes) {
+                    ipc::Message event;
+                    event.kind = ipc::Kind::kEvent;
+                    event.channel = ipc::Channel::kControl;
+                    event.type = "runtime.file_transfer.done";
+                    event.vm_id = vm_id_;
+                    event.request_id = next_event_id_++;
+                    event.fields["id"] = id;
+                    event.fields["ok"] = ok ? "true" : "false";
+                    event.fields["bytes"] = std::to_string(bytes);
+                    if (!ok) event.fields["error"] = error;
+                    Send(event);
+                });
+
+            std::lock_guard<std::mutex> lock(transfers_mutex_);
+            // Finished ones are only reaped here; their threads have ended.
+            std::erase_if(transfers_, [](const auto& t) { return t.second->Finished(); });
+            transfers_[id] = std::move(transfer);
+            resp.fields["ok"] = "true";
+        }
+        Send(resp);
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.file_transfer.cancel") {
+        auto it = message.fields.find("id");
+        if (it != message.fields.end()) {
+            std::lock_guard<std::mutex> lock(transfers_mutex_);
+            auto t = transfers_.find(it->second);
+            if (t != transfers_.end()) t->second->Cancel();
+        }
+        return;
+    }
+
+    if (message.channel == ipc::Channel::kControl &&
+        message.kind == ipc::Kind::kRequest &&
+        message.type == "runtime.set_protocol") {
+        auto it = message.fields.find("version");
+        if (it != message.fields.end()) {
+            uint32_t version = static_cast<uint32_t>(std::strtoul(it->second.c_str(), nullptr, 10));
+            version = (std::min)(version, ipc::kProtocolVersion);
+            if (version >= ipc::kTextProtocolVersion) {
+                protocol_ = version;
+                LOG_INFO("IPC protocol version %u", version);
+            }
         }
         return;
     }
@@ -863,7 +1780,16 @@ void RuntimeControlService::HandleMessage(const ipc::Message& message) {
             auto it_type = message.fields.find("data_type");
             if (it_type != message.fields.end()) {
                 uint32_t data_type = static_cast<uint32_t>(std::strtoul(it_type->second.c_str(), nullptr, 10));
-                vm_->SendClipboardData(data_type, message.payload.data(), message.payload.size());
+                // Without offset and total the payload is all of it.
+                auto it_offset = message.fields.find("offset");
+                auto it_total = message.fields.find("total");
+                uint64_t offset = it_offset != message.fields.end()
+                    ? std::strtoull(it_offset->second.c_str(), nullptr, 10) : 0;
+                uint64_t total = it_total != message.fields.end()
+                    ? std::strtoull(it_total->second.c_str(), nullptr, 10)
+                    : message.payload.size();
+                vm_->SendClipboardData(data_type, offset, total,
+                                       message.payload.data(), message.payload.size());
             }
             return;
         }
@@ -891,69 +1817,24 @@ void RuntimeControlService::RunLoop() {
 
     HANDLE h = AsHandle(pipe_handle_);
     std::array<char, 65536> buf{};
-    std::string pending;
-    size_t payload_needed = 0;
-    ipc::Message pending_msg;
+    ipc::StreamDecoder decoder;
+    ipc::Message message;
 
     while (running_) {
-        DWORD available = 0;
-        if (!PeekNamedPipe(h, nullptr, 0, nullptr, &available, nullptr)) {
-            DWORD err = GetLastError();
-            if (err == ERROR_BROKEN_PIPE) {
-                break;
-            }
-            Sleep(1);
-            continue;
-        }
-        if (available == 0) {
-            Sleep(1);
-            continue;
-        }
-
-        DWORD to_read = (std::min)(available, static_cast<DWORD>(buf.size()));
-        DWORD read = 0;
-        if (!ReadFile(h, buf.data(), to_read, &read, nullptr)) {
-            DWORD err = GetLastError();
-            if (err == ERROR_BROKEN_PIPE || err == ERROR_OPERATION_ABORTED) {
-                break;
-            }
-            continue;
+        // Blocks until the manager sends something, the pipe breaks or
+        // Stop() is called.
+        uint32_t read = 0;
+        if (!ipc::PipeRead(h, buf.data(), static_cast<uint32_t>(buf.size()), &read,
+                           stop_event_)) {
+            break;
         }
         if (read == 0) {
             continue;
         }
 
-        pending.append(buf.data(), read);
-
-        while (!pending.empty()) {
-            if (payload_needed > 0) {
-                if (pending.size() < payload_needed) break;
-                pending_msg.payload.assign(
-                    reinterpret_cast<const uint8_t*>(pending.data()),
-                    reinterpret_cast<const uint8_t*>(pending.data()) + payload_needed);
-                pending.erase(0, payload_needed);
-                payload_needed = 0;
-                HandleMessage(pending_msg);
-                continue;
-            }
-
-            size_t nl = pending.find('\n');
-            if (nl == std::string::npos) break;
-            std::string line = pending.substr(0, nl + 1);
-            pending.erase(0, nl + 1);
-            auto decoded = ipc::Decode(line);
-            if (!decoded) continue;
-
-            auto ps_it = decoded->fields.find("payload_size");
-            if (ps_it != decoded->fields.end()) {
-                payload_needed = std::strtoull(ps_it->second.c_str(), nullptr, 10);
-                decoded->fields.erase(ps_it);
-                if (payload_needed > 0) {
-                    pending_msg = std::move(*decoded);
-                    continue;
-                }
-            }
-            HandleMessage(*decoded);
+        decoder.Append(buf.data(), read);
+        while (decoder.Next(&message)) {
+            HandleMessage(message);
         }
     }
 }
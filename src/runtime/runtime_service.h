@@ -1,7 +1,13 @@
 #pragma once
 
 #include "common/ports.h"
-#include "ipc/protocol_v1.h"
+#include "ipc/frame_codec.h"
+#include "ipc/input_ring.h"
+#include "ipc/metrics_block.h"
+#include "ipc/pcm_ring.h"
+#include "ipc/protocol_v2.h"
+#include "ipc/shared_framebuffer.h"
+#include "runtime/display_damage.h"
 
 #include <atomic>
 #include <chrono>
@@ -14,8 +20,10 @@
 #include <optional>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+class GuestFileTransfer;
 class Vm;
 
 class ManagedConsolePort final : public ConsolePort {
@@ -40,34 +48,54 @@ private:
     std::function<void()> data_available_callback_;
 };
 
+// Events come from the manager's shared input ring, or over the pipe
+// when the ring is unavailable or full. Wheel events are pointer events
+// at the last position with a wheel delta, so they stay in order.
 class ManagedInputPort final : public InputPort {
 public:
+    ManagedInputPort();
+    ~ManagedInputPort() override;
+
     bool PollKeyboard(KeyboardEvent* event) override;
     bool PollPointer(PointerEvent* event) override;
+    void WaitForInput(uint32_t timeout_ms) override;
 
     void PushKeyEvent(const KeyboardEvent& ev);
     void PushPointerEvent(const PointerEvent& ev);
+    void PushWheelEvent(int32_t delta);
+
+    // Creates the ring; call before anything waits for input.
+    bool CreateRing(const std::string& name);
+    const std::string& RingName() const { return ring_.name(); }
 
 private:
+    // Under mutex_.
+    void QueuePointerLocked(PointerEvent ev);
+
     std::mutex mutex_;
     std::deque<KeyboardEvent> key_queue_;
     std::deque<PointerEvent> pointer_queue_;
+    PointerEvent last_pointer_;  // under mutex_
+    ipc::InputRing ring_;
+    // Signaled by the Push calls, which do not go through the ring.
+    void* wake_ = nullptr;
 };
 
 class ManagedDisplayPort final : public DisplayPort {
 public:
     void SubmitFrame(DisplayFrame frame) override;
     void SubmitCursor(const CursorInfo& cursor) override;
-    void SubmitScanoutState(bool active, uint32_t width, uint32_t height) override;
+    void SubmitScanoutState(uint32_t scanout_id, bool active,
+                            uint32_t width, uint32_t height) override;
     void SetFrameHandler(std::function<void(DisplayFrame)> handler);
     void SetCursorHandler(std::function<void(const CursorInfo&)> handler);
-    void SetStateHandler(std::function<void(bool, uint32_t, uint32_t)> handler);
+    void SetStateHandler(std::function<void(uint32_t, bool, uint32_t, uint32_t)> handler);
 
 private:
     std::mutex mutex_;
     std::function<void(DisplayFrame)> frame_handler_;
     std::function<void(const CursorInfo&)> cursor_handler_;
-    std::function<void(bool, uint32_t, uint32_t)> state_handler_;
+    std::function<void(uint32_t, bool, uint32_t, uint32_t)> state_handler_;
 };
 
 class ManagedClipboardPort final : public ClipboardPort {
@@ -80,14 +108,34 @@ private:
     std::function<void(const ClipboardEvent&)> event_handler_;
 };
 
+// PCM goes through rings shared with the manager: playback for its audio
+// player, capture from its microphone. Playback in another format, or
+// without a ring, goes to the handler for the pipe.
 class ManagedAudioPort final : public AudioPort {
 public:
     void SubmitPcm(AudioChunk chunk) override;
+    bool GetPlaybackClock(AudioClock* clock) override;
+    void SetCaptureActive(bool active) override;
+    bool GetCapturedFrames(size_t* frames) override;
+    size_t ReadCapture(int16_t* samples, size_t frames) override;
+
     void SetPcmHandler(std::function<void(AudioChunk)> handler);
+    // Told when the guest starts or stops capturing.
+    void SetCaptureHandler(std::function<void(bool)> handler);
+
+    // Creates both rings; call before the VM starts.
+    void CreateRings(const std::string& vm_id, uint32_t process_id);
+    const std::string& PlaybackRingName() const { return playback_ring_.name(); }
+    const std::string& CaptureRingName() const { return capture_ring_.name(); }
 
 private:
     std::mutex mutex_;
     std::function<void(AudioChunk)> pcm_handler_;
+    std::function<void(bool)> capture_handler_;
+    // The device's playback thread is the one producer of the first, its
+    // capture thread the one consumer of the second.
+    ipc::PcmRing playback_ring_;
+    ipc::PcmRing capture_ring_;
 };
 
 class RuntimeControlService {
@@ -99,6 +147,8 @@ public:
     void Stop();
 
     void AttachVm(Vm* vm);
+    // Frame rate display damage is sent at; call before Start().
+    void SetDisplayFps(uint32_t fps);
     std::shared_ptr<ManagedConsolePort> ConsolePort() const { return console_port_; }
     std::shared_ptr<ManagedInputPort> GetInputPort() const { return input_port_; }
     std::shared_ptr<ManagedDisplayPort> GetDisplayPort() const { return display_port_; }
@@ -107,11 +157,35 @@ public:
     void PublishState(const std::string& state, int exit_code = 0);
 
 private:
+    // One guest monitor's pixels and the damage not yet sent of them.
+    struct ScanoutSurface {
+        ipc::SharedFramebuffer surface;
+        uint32_t format = 0;
+        DamageRegion damage;
+    };
+
     bool Send(const ipc::Message& message);
     bool SendWithPayload(const ipc::Message& message);
     void RunLoop();
     void HandleMessage(const ipc::Message& message);
     bool EnsureClientConnected();
+    // Under send_queue_mutex_. Takes the queued control messages, then the
+    // audio, which go out ahead of anything else.
+    std::string TakeUrgentLocked();
+    // Send thread. False once the pipe is gone.
+    bool WritePipe(const std::string& data);
+    // Under fb_mutex_. Recreates a scanout's surface when its size
+    // changes, falling back to a private one if no section can be made.
+    void EnsureSurface(uint32_t scanout_id, uint32_t width, uint32_t height);
+    // Under fb_mutex_. One display.frame per damaged rect of each scanout,
+    // appended to `frames` with raw pixels or the section name.
+    void ComposeFrames(std::vector<ipc::Message>* frames);
+    // Damages every open scanout whole, so the next frame resends them.
+    void ResendScreens();
+    // Send thread, outside the locks. Codes a frame's payload for the wire.
+    void EncodeFramePayload(ipc::FrameEncoding encoding, ipc::Message* frame);
+    // Metrics thread, until Stop().
+    void MetricsLoop();
 
     std::string vm_id_;
     std::string pipe_name_;
@@ -126,28 +200,77 @@ private:
     // Dedicated threads for sending and receiving IPC over the named pipe.
     std::thread send_thread_;
     std::thread recv_thread_;
+    // Publishes the VM's counters to metrics_ every MetricsBlock::kIntervalMs,
+    // and tells the manager when the guest's vCPU count or RAM changes.
+    std::thread metrics_thread_;
+    // Runs a "migrate" command, which takes as long as the copy does.
+    std::thread migrate_thread_;
+    std::atomic<bool> migrating_{false};
 
     // Protects pipe_handle_ and low-level WriteFile operations.
     std::mutex send_mutex_;
+    // Overlapped, so waits on it end with stop_event_.
     void* pipe_handle_ = nullptr;
+    // Manual-reset event Stop() signals to end pipe waits.
+    void* stop_event_ = nullptr;
     Vm* vm_ = nullptr;
+    // The metrics thread's view of vm_, set once the VM exists.
+    std::atomic<Vm*> metrics_vm_{nullptr};
+    ipc::MetricsBlock metrics_;
+    std::chrono::steady_clock::time_point started_ = std::chrono::steady_clock::now();
+    // Guest file copies by the manager's id, kept until the next one
+    // starts after they finish, or until Stop().
+    std::mutex transfers_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<GuestFileTransfer>> transfers_;
+    // Display frames sent, however many rects each carried.
+    std::atomic<uint64_t> frames_sent_{0};
     std::atomic<uint64_t> next_event_id_{1};
+    // Version messages are encoded as; raised by runtime.set_protocol.
+    std::atomic<uint32_t> protocol_{ipc::kTextProtocolVersion};
 
-    // High-priority queue for small, latency-sensitive messages
-    // (console output, control responses, etc.).
+    // High-priority queue for small, latency-sensitive messages (control
+    // responses, cursor, clipboard). The send thread writes, in order of
+    // priority: this queue, audio, console output, display frames. Each
+    // frame is written on its own, after whatever urgent traffic arrived
+    // while it was being coded.
     std::mutex send_queue_mutex_;
     std::condition_variable send_cv_;
     std::deque<std::string> console_queue_;
 
-    // Bounded queue for display frames. Preserves dirty-rect ordering
-    // but caps memory usage.
-    static constexpr size_t kMaxPendingFrames = 8;
-    std::deque<std::string> frame_queue_;
+    // Scanout pixels, normally shared with the manager, one surface per
+    // scanout. Flushes are written here as they come and their rects
+    // merged into that scanout's damage; the send thread turns the damage
+    // into display.frame events at most once per frame interval. Frames
+    // read the surface when sent, so no damage is lost however many
+    // flushes a frame absorbs.
+    std::mutex fb_mutex_;
+    ScanoutSurface scanouts_[kMaxDisplayScanouts];
+    uint32_t fb_generation_ = 0;
+    // As negotiated by display.configure. A manager that cannot map the
+    // section gets pixels in the payload, coded as it asked.
+    bool share_surface_ = true;
+    ipc::FrameEncoding frame_encoding_ = ipc::FrameEncoding::kRaw;
+    ipc::FrameCodec frame_codec_;  // send thread only
+    // Under send_queue_mutex_.
+    bool damage_pending_ = false;
+    // Cleared by display.viewer while the manager shows nothing of this VM;
+    // damage then waits, and the GPU stops producing it.
+    bool viewer_attached_ = true;
+    std::chrono::steady_clock::time_point damage_since_{};  // for the FrameSent event
+    std::chrono::steady_clock::time_point next_frame_time_{};
+    std::chrono::steady_clock::duration frame_interval_ =
+        std::chrono::microseconds(1000000 / 60);
+    // Cursor images whose pixels the manager already has, oldest first.
+    // Under send_queue_mutex_, so it matches the order they are sent in.
+    std::deque<uint64_t> sent_cursor_images_;
 
-    // Bounded queue for audio PCM chunks.
+    // Bounded queue for audio PCM chunks, used when the ring is not.
     static constexpr size_t kMaxPendingAudio = 32;
     std::deque<std::string> audio_queue_;
-};
 
-std::string EncodeHex(const uint8_t* data, size_t size);
-std::vector<uint8_t> DecodeHex(const std::string& value);
+    // display.frame events the manager has not acknowledged with
+    // display.ack. At the limit, damage keeps merging instead of frames
+    // piling up in the pipe ahead of other traffic.
+    static constexpr uint32_t kMaxFramesInFlight = 8;
+    uint32_t frames_in_flight_ = 0;  // under send_queue_mutex_
+};
@@ -0,0 +1,94 @@
+#include "ui/common/console_buffer.h"
+
+#include <algorithm>
+
+void ConsoleBuffer::Append(const char* data, size_t len) {
+    bool changed = false;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char ch = static_cast<unsigned char>(data[i]);
+        switch (ansi_) {
+        case AnsiPhase::kNormal:
+            if (ch == 0x1b) { ansi_ = AnsiPhase::kEsc; break; }
+            if (ch == '\n') { NewLine(); changed = true; break; }
+            if (ch == '\t') {
+                size_t col = lines_.empty() ? 0 : lines_.back().len;
+                size_t pad = kTabWidth - col % kTabWidth;
+                while (pad--) PushChar(' ');
+                changed = true;
+                break;
+            }
+            if (ch >= 0x20 && ch <= 0x7e) { PushChar(static_cast<char>(ch)); changed = true; }
+            break;
+        case AnsiPhase::kEsc:
+            ansi_ = (ch == '[') ? AnsiPhase::kCsi : AnsiPhase::kNormal;
+            break;
+        case AnsiPhase::kCsi:
+            if (ch >= 0x40 && ch <= 0x7e) ansi_ = AnsiPhase::kNormal;
+            break;
+        }
+    }
+    if (changed) ++revision_;
+}
+
+void ConsoleBuffer::Clear() {
+    lines_.clear();
+    head_ = 0;
+    dropped_lines_ = 0;
+    ansi_ = AnsiPhase::kNormal;
+    ++revision_;
+}
+
+void ConsoleBuffer::PushChar(char ch) {
+    if (ring_.empty()) ring_.resize(kCapacity);
+    if (lines_.empty()) lines_.push_back({head_, 0});
+    if (lines_.back().len >= kMaxLineLen) NewLine();
+    // The line being written is at most kMaxLineLen, so a full ring always
+    // has an older line to give up.
+    while (head_ - lines_.front().start >= kCapacity) DropFront();
+    ring_[head_ % kCapacity] = ch;
+    ++head_;
+    ++lines_.back().len;
+}
+
+void ConsoleBuffer::NewLine() {
+    if (lines_.empty()) lines_.push_back({head_, 0});
+    lines_.push_back({head_, 0});
+    if (lines_.size() > kMaxLines) DropFront();
+}
+
+void ConsoleBuffer::DropFront() {
+    lines_.pop_front();
+    ++dropped_lines_;
+}
+
+size_t ConsoleBuffer::LineLength(size_t index) const {
+    return index < lines_.size() ? lines_[index].len : 0;
+}
+
+void ConsoleBuffer::CopyOut(uint64_t start, size_t len, std::string* out) const {
+    size_t pos = static_cast<size_t>(start % kCapacity);
+    size_t first = std::min(len, kCapacity - pos);
+    out->append(ring_.data() + pos, first);
+    if (len > first) out->append(ring_.data(), len - first);
+}
+
+std::string ConsoleBuffer::Line(size_t index) const {
+    std::string out;
+    if (index < lines_.size()) CopyOut(lines_[index].start, lines_[index].len, &out);
+    return out;
+}
+
+std::string ConsoleBuffer::Text(size_t first, size_t first_col,
+                                size_t last, size_t last_col) const {
+    std::string out;
+    if (lines_.empty()) return out;
+    last = std::min(last, lines_.size() - 1);
+    for (size_t i = first; i <= last; ++i) {
+        size_t len = lines_[i].len;
+        size_t begin = (i == first) ? std::min(first_col, len) : 0;
+        size_t end = (i == last) ? std::min(last_col, len) : len;
+        if (begin < end) CopyOut(lines_[i].start + begin, end - begin, &out);
+        if (i != last) out += "\r\n";
+    }
+    return out;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Scrollback of one VM's console. Raw guest output is ANSI-filtered into a
+// fixed-size byte ring with an index of where each line starts, so appending
+// never moves kept text and costs the same however long the history is. When
+// the ring is full the oldest lines are dropped whole.
+class ConsoleBuffer {
+public:
+    static constexpr size_t kCapacity = 256 * 1024;
+    static constexpr size_t kMaxLines = 8192;
+    // Longer lines are broken, so a guest that never prints a newline
+    // cannot take over the whole ring with one line.
+    static constexpr size_t kMaxLineLen = 4096;
+    static constexpr size_t kTabWidth = 8;
+
+    // Strips escape sequences and control characters, expands tabs and
+    // starts a new line at each \n.
+    void Append(const char* data, size_t len);
+    void Clear();
+
+    // Never zero: the last line is the one being written, possibly empty.
+    size_t line_count() const { return lines_.empty() ? 1 : lines_.size(); }
+    size_t LineLength(size_t index) const;
+    // Text of line `index`, 0 being the oldest kept.
+    std::string Line(size_t index) const;
+    // Lines [first, last] joined with \r\n, starting at column `first_col`
+    // of the first line and stopping before column `last_col` of the last.
+    std::string Text(size_t first, size_t first_col, size_t last, size_t last_col) const;
+
+    // Lines dropped from the front since the last Clear(). Index i of the
+    // buffer is line number dropped_lines() + i of the whole output, which
+    // is what a scrolled view holds on to.
+    uint64_t dropped_lines() const { return dropped_lines_; }
+    // Changes on every Append() that kept something and on Clear().
+    uint64_t revision() const { return revision_; }
+
+private:
+    struct LineSpan {
+        uint64_t start = 0;  // absolute offset of the first byte
+        uint32_t len = 0;
+    };
+
+    void PushChar(char ch);
+    void NewLine();
+    void DropFront();
+    void CopyOut(uint64_t start, size_t len, std::string* out) const;
+
+    std::vector<char> ring_;  // allocated on first write
+    uint64_t head_ = 0;       // absolute offset of the next byte written
+    std::deque<LineSpan> lines_;
+    uint64_t dropped_lines_ = 0;
+    uint64_t revision_ = 0;
+    enum class AnsiPhase { kNormal, kEsc, kCsi } ansi_ = AnsiPhase::kNormal;
+};
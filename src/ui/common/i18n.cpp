@@ -22,6 +22,9 @@ static const char* kStringsEn[] = {
     "Stop",                              // kMenuStop
     "Reboot",                            // kMenuReboot
     "Shutdown",                          // kMenuShutdown
+    "Suspend",                           // kMenuSuspend
+    "Save as Template",                  // kMenuMakeTemplate
+    "Fork from Template",                // kMenuFork
     "New VM",                            // kToolbarNewVm
     "Edit",                              // kToolbarEdit
     "Delete",                            // kToolbarDelete
@@ -41,17 +44,24 @@ static const char* kStringsEn[] = {
     "Memory:",                           // kLabelMemory
     "vCPUs:",                            // kLabelVcpus
     "NAT:",                              // kLabelNat
+    "Exit stats:",                       // kLabelExitStats
+    "Available while the VM is running", // kStatsUnavailable
     "Running",                           // kStateRunning
     "Stopped",                           // kStateStopped
     "Starting",                          // kStateStarting
     "Stopping",                          // kStateStopping
     "Crashed",                           // kStateCrashed
+    "Suspended",                         // kStateSuspended
+    "Template",                          // kStateTemplate
     "%u VM(s) loaded",                   // kStatusVmsLoaded
     "Starting %s...",                    // kStatusStarting
     "%s started",                        // kStatusStarted
     "%s stopped",                       // kStatusStopped
     "%s rebooted",                       // kStatusRebooted
     "%s shutting down...",              // kStatusShuttingDown
+    "%s suspended",                      // kStatusSuspended
+    "%s saved as template",              // kStatusTemplateSaved
+    "%s forked and started",             // kStatusForked
     "VM deleted",                        // kStatusVmDeleted
     "%s updated",                        // kStatusVmUpdated
     "Error: ",                           // kStatusErrorPrefix
@@ -67,6 +77,7 @@ static const char* kStringsEn[] = {
     "vCPUs:",                            // kDlgLabelVcpus
     "Location:",                         // kDlgLabelLocation
     "Enable NAT networking",             // kDlgEnableNat
+    "Linked clone (share base disk)",    // kDlgLinkedClone
     "Create",                            // kDlgBtnCreate
     "Save",                              // kDlgBtnSave
     "Cancel",                            // kDlgBtnCancel
@@ -89,8 +100,10 @@ static const char* kStringsEn[] = {
     "CPU / Memory changes require VM to be stopped",  // kCpuMemoryChangeWarning
     "Full input capture (system keys) | Press Right Alt to release",  // kDisplayHintCaptured
     "Click to capture system keys",  // kDisplayHintNormal
+    "%s - Screen %u",                // kDisplayWindowTitle
     "View",                                 // kMenuView
     "Toolbar",                              // kMenuViewToolbar
+    "Metrics...",                           // kMenuViewMetrics
     "Help",                                 // kMenuHelp
     "Website",                               // kMenuWebsite
     "Check for Updates",                     // kMenuCheckUpdate
@@ -108,6 +121,38 @@ static const char* kStringsEn[] = {
     "Please select a shared folder to remove.",  // kSfNoSelection
     "Confirm Remove",                        // kSfConfirmRemoveTitle
     "Remove shared folder '%s'?",            // kSfConfirmRemoveMsg
+    "VM Metrics",                            // kDlgMetrics
+    "Name",                                  // kMetricsColName
+    "CPU %",                                 // kMetricsColCpu
+    "Exits/s",                               // kMetricsColExits
+    "Disk R/W IOPS",                         // kMetricsColDiskIops
+    "Disk R/W MB/s",                         // kMetricsColDiskMbs
+    "Net RX/TX pps",                         // kMetricsColNetPps
+    "Net RX/TX MB/s",                        // kMetricsColNetMbs
+    "FPS",                                   // kMetricsColFps
+    "Memory",                                // kMetricsColMemory
+    "Export...",                             // kMetricsBtnExport
+    "Cannot write %s.",                      // kMetricsExportFailed
+    "Send File to Guest...",                 // kMenuSendFile
+    "Copy File from Guest...",               // kMenuReceiveFile
+    "Cancel File Transfer",                  // kMenuCancelTransfer
+    "Guest File",                            // kDlgGuestFile
+    "Path in the guest:",                    // kDlgLabelGuestPath
+    "Copying %s... %.1f MB",                 // kStatusTransferProgress
+    "%s copied",                             // kStatusTransferDone
+    "Copying %s failed: %s",                 // kStatusTransferFailed
+    "OK",                                    // kDlgBtnOk
+    "Disk Limits...",                        // kMenuDiskLimits
+    "Disk Limits",                           // kDlgDiskLimits
+    "IOPS:",                                 // kDlgLabelDiskIops
+    "IOPS burst:",                           // kDlgLabelDiskIopsBurst
+    "MB/s:",                                 // kDlgLabelDiskMbps
+    "Burst MB:",                             // kDlgLabelDiskBurstMb
+    "0 = unlimited. A running VM applies them at once.", // kDlgDiskLimitsHint
+    "Start Network Capture...",              // kMenuStartNetCapture
+    "Stop Network Capture",                  // kMenuStopNetCapture
+    "Down Mbit/s:",                          // kDlgLabelNetRxMbps
+    "Up Mbit/s:",                            // kDlgLabelNetTxMbps
 };
 
 // Simplified Chinese strings; order must match enum S
@@ -123,6 +168,9 @@ static const char* kStringsZhCN[] = {
     "停止",                              // kMenuStop
     "重启",                              // kMenuReboot
     "关机",                              // kMenuShutdown
+    "挂起",                              // kMenuSuspend
+    "保存为模板",                        // kMenuMakeTemplate
+    "从模板派生",                        // kMenuFork
     "新建虚拟机",                        // kToolbarNewVm
     "编辑",                              // kToolbarEdit
     "删除",                              // kToolbarDelete
@@ -142,17 +190,24 @@ static const char* kStringsZhCN[] = {
     "内存:",                             // kLabelMemory
     "vCPU:",                           // kLabelVcpus
     "网络:",                             // kLabelNat
+    "退出统计:",                         // kLabelExitStats
+    "虚拟机运行时可用",                  // kStatsUnavailable
     "运行中",                            // kStateRunning
     "已停止",                            // kStateStopped
     "启动中",                            // kStateStarting
     "停止中",                            // kStateStopping
     "崩溃",                              // kStateCrashed
+    "已挂起",                            // kStateSuspended
+    "模板",                              // kStateTemplate
     "已加载 %u 个虚拟机",                // kStatusVmsLoaded
     "正在启动 %s...",                    // kStatusStarting
     "%s 已启动",                         // kStatusStarted
     "%s 已停止",                         // kStatusStopped
     "%s 已重启",                         // kStatusRebooted
     "%s 正在关机...",                    // kStatusShuttingDown
+    "%s 已挂起",                         // kStatusSuspended
+    "%s 已保存为模板",                   // kStatusTemplateSaved
+    "%s 已派生并启动",                   // kStatusForked
     "虚拟机已删除",                      // kStatusVmDeleted
     "%s 已更新",                         // kStatusVmUpdated
     "错误: ",                            // kStatusErrorPrefix
@@ -168,6 +223,7 @@ static const char* kStringsZhCN[] = {
     "vCPU:",                           // kDlgLabelVcpus
     "位置:",                             // kDlgLabelLocation
     "启用 NAT 网络",                     // kDlgEnableNat
+    "链接克隆（共享基础磁盘）",          // kDlgLinkedClone
     "创建",                              // kDlgBtnCreate
     "保存",                              // kDlgBtnSave
     "取消",                              // kDlgBtnCancel
@@ -190,8 +246,10 @@ static const char* kStringsZhCN[] = {
     "更改 CPU/内存需要先停止虚拟机",     // kCpuMemoryChangeWarning
     "已捕获全部输入（含系统键）| 按右 Alt 释放",  // kDisplayHintCaptured
     "点击以捕获系统键",                       // kDisplayHintNormal
+    "%s - 屏幕 %u",                          // kDisplayWindowTitle
     "视图",                                  // kMenuView
     "工具栏",                                // kMenuViewToolbar
+    "性能指标...",                           // kMenuViewMetrics
     "帮助",                                  // kMenuHelp
     "官方网站",                              // kMenuWebsite
     "检查更新",                              // kMenuCheckUpdate
@@ -209,6 +267,38 @@ static const char* kStringsZhCN[] = {
     "请先选择要移除的共享文件夹。",           // kSfNoSelection
     "确认移除",                              // kSfConfirmRemoveTitle
     "确认移除共享文件夹 '%s'？",             // kSfConfirmRemoveMsg
+    "虚拟机性能指标",                        // kDlgMetrics
+    "名称",                                  // kMetricsColName
+    "CPU %",                                 // kMetricsColCpu
+    "退出/秒",                               // kMetricsColExits
+    "磁盘读/写 IOPS",                        // kMetricsColDiskIops
+    "磁盘读/写 MB/s",                        // kMetricsColDiskMbs
+    "网络收/发 包/秒",                       // kMetricsColNetPps
+    "网络收/发 MB/s",                        // kMetricsColNetMbs
+    "帧率",                                  // kMetricsColFps
+    "内存",                                  // kMetricsColMemory
+    "导出...",                               // kMetricsBtnExport
+    "无法写入 %s。",                         // kMetricsExportFailed
+    "发送文件到虚拟机...",                   // kMenuSendFile
+    "从虚拟机复制文件...",                   // kMenuReceiveFile
+    "取消文件传输",                          // kMenuCancelTransfer
+    "虚拟机文件",                            // kDlgGuestFile
+    "虚拟机中的路径:",                       // kDlgLabelGuestPath
+    "正在复制 %s... %.1f MB",                // kStatusTransferProgress
+    "%s 已复制",                             // kStatusTransferDone
+    "复制 %s 失败: %s",                      // kStatusTransferFailed
+    "确定",                                  // kDlgBtnOk
+    "磁盘限速...",                           // kMenuDiskLimits
+    "磁盘限速",                              // kDlgDiskLimits
+    "IOPS:",                                 // kDlgLabelDiskIops
+    "IOPS 突发:",                            // kDlgLabelDiskIopsBurst
+    "MB/s:",                                 // kDlgLabelDiskMbps
+    "突发 MB:",                              // kDlgLabelDiskBurstMb
+    "0 = 不限制。运行中的虚拟机立即生效。",  // kDlgDiskLimitsHint
+    "开始网络抓包...",                       // kMenuStartNetCapture
+    "停止网络抓包",                          // kMenuStopNetCapture
+    "下行 Mbit/s:",                          // kDlgLabelNetRxMbps
+    "上行 Mbit/s:",                          // kDlgLabelNetTxMbps
 };
 
 void InitLanguage() {
@@ -41,6 +41,9 @@ enum class S {
     kMenuStop,
     kMenuReboot,
     kMenuShutdown,
+    kMenuSuspend,
+    kMenuMakeTemplate,
+    kMenuFork,
 
     // Toolbar
     kToolbarNewVm,
@@ -66,6 +69,8 @@ enum class S {
     kLabelMemory,
     kLabelVcpus,
     kLabelNat,
+    kLabelExitStats,
+    kStatsUnavailable,
 
     // VM states
     kStateRunning,
@@ -73,6 +78,8 @@ enum class S {
     kStateStarting,
     kStateStopping,
     kStateCrashed,
+    kStateSuspended,
+    kStateTemplate,
 
     // Status messages (format strings: use with snprintf)
     kStatusVmsLoaded,
@@ -81,6 +88,9 @@ enum class S {
     kStatusStopped,
     kStatusRebooted,
     kStatusShuttingDown,
+    kStatusSuspended,
+    kStatusTemplateSaved,
+    kStatusForked,
     kStatusVmDeleted,
     kStatusVmUpdated,
     kStatusErrorPrefix,
@@ -100,6 +110,7 @@ enum class S {
     kDlgLabelVcpus,
     kDlgLabelLocation,
     kDlgEnableNat,
+    kDlgLinkedClone,
     kDlgBtnCreate,
     kDlgBtnSave,
     kDlgBtnCancel,
@@ -128,10 +139,12 @@ enum class S {
     // Display panel hints
     kDisplayHintCaptured,
     kDisplayHintNormal,
+    kDisplayWindowTitle,
 
     // View menu
     kMenuView,
     kMenuViewToolbar,
+    kMenuViewMetrics,
 
     // Help menu
     kMenuHelp,
@@ -154,6 +167,42 @@ enum class S {
     kSfConfirmRemoveTitle,
     kSfConfirmRemoveMsg,
 
+    // Metrics dialog
+    kDlgMetrics,
+    kMetricsColName,
+    kMetricsColCpu,
+    kMetricsColExits,
+    kMetricsColDiskIops,
+    kMetricsColDiskMbs,
+    kMetricsColNetPps,
+    kMetricsColNetMbs,
+    kMetricsColFps,
+    kMetricsColMemory,
+    kMetricsBtnExport,
+    kMetricsExportFailed,
+
+    // File transfer
+    kMenuSendFile,
+    kMenuReceiveFile,
+    kMenuCancelTransfer,
+    kDlgGuestFile,
+    kDlgLabelGuestPath,
+    kStatusTransferProgress,
+    kStatusTransferDone,
+    kStatusTransferFailed,
+    kDlgBtnOk,
+    kMenuDiskLimits,
+    kDlgDiskLimits,
+    kDlgLabelDiskIops,
+    kDlgLabelDiskIopsBurst,
+    kDlgLabelDiskMbps,
+    kDlgLabelDiskBurstMb,
+    kDlgDiskLimitsHint,
+    kMenuStartNetCapture,
+    kMenuStopNetCapture,
+    kDlgLabelNetRxMbps,
+    kDlgLabelNetTxMbps,
+
     kCount  // Must be last
 };
 
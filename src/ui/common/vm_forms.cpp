@@ -15,6 +15,9 @@ bool SameForwards(const std::vector<PortForward>& a, const std::vector<PortForwa
 ValidationResult ValidateCreateRequest(const VmCreateRequest& req) {
     if (req.name.empty()) return {false, "name is required"};
     if (req.source_kernel.empty()) return {false, "kernel path is required"};
+    if (req.linked_clone && req.source_disk.empty()) {
+        return {false, "linked clone requires a disk image"};
+    }
     if (req.memory_mb < 16) return {false, "minimum memory is 16 MB"};
     if (req.cpu_count < 1 || req.cpu_count > 128) {
         return {false, "cpu_count must be in [1, 128]"};
@@ -33,7 +36,8 @@ ValidationResult ValidateEditForm(const VmEditForm& form, VmPowerState current_s
     const bool running = current_state == VmPowerState::kRunning ||
                          current_state == VmPowerState::kStarting;
     if (running && !form.apply_on_next_boot) {
-        return {true, "nat/port_forwards can apply online; cpu/memory requires power off"};
+        return {true, "nat/port_forwards/rate limit can apply online; cpu/memory requires power off "
+                      "unless the VM was started with room to hotplug them"};
     }
     return {true, ""};
 }
@@ -50,6 +54,9 @@ VmMutablePatch BuildVmPatch(const VmEditForm& form, const VmSpec& current_spec)
     if (!SameForwards(form.port_forwards, current_spec.port_forwards)) {
         patch.port_forwards = form.port_forwards;
     }
+    if (!(form.net_rate_limit == current_spec.net_rate_limit)) {
+        patch.net_rate_limit = form.net_rate_limit;
+    }
     if (form.memory_mb != current_spec.memory_mb) {
         patch.memory_mb = form.memory_mb;
     }
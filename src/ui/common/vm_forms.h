@@ -11,6 +11,7 @@ struct VmEditForm {
     std::string name;
     bool nat_enabled = false;
     std::vector<PortForward> port_forwards;
+    NetRateLimit net_rate_limit;
     uint64_t memory_mb = 4096;
     uint32_t cpu_count = 4;
     bool apply_on_next_boot = false;
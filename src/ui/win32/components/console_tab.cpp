@@ -2,17 +2,47 @@
 #include "ui/common/i18n.h"
 
 #include <commctrl.h>
+#include <windowsx.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+static const char* kConsoleViewClass = "TenBoxConsoleView";
+static bool g_class_registered = false;
+
+static void RegisterViewClass(HINSTANCE hinst, WNDPROC proc) {
+    if (g_class_registered) return;
+    WNDCLASSEXA wc{};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = proc;
+    wc.hInstance = hinst;
+    wc.hCursor = LoadCursor(nullptr, IDC_IBEAM);
+    wc.lpszClassName = kConsoleViewClass;
+    RegisterClassExA(&wc);
+    g_class_registered = true;
+}
 
 void ConsoleTab::Create(HWND parent, HINSTANCE hinst, HFONT mono_font, HFONT ui_font) {
-    console_ = CreateWindowExA(WS_EX_CLIENTEDGE, "EDIT", "",
-        WS_CHILD | WS_VISIBLE | WS_VSCROLL |
-        ES_MULTILINE | ES_READONLY | ES_AUTOVSCROLL,
+    RegisterViewClass(hinst, ViewProc);
+
+    // The view lays text out on a fixed grid, so it needs the cell size
+    // of the (monospace) console font up front.
+    mono_font_ = mono_font;
+    HDC dc = GetDC(parent);
+    HGDIOBJ old_font = SelectObject(dc, mono_font);
+    TEXTMETRICA tm{};
+    if (GetTextMetricsA(dc, &tm)) {
+        char_w_ = (std::max)(1, static_cast<int>(tm.tmAveCharWidth));
+        line_h_ = (std::max)(1, static_cast<int>(tm.tmHeight));
+    }
+    SelectObject(dc, old_font);
+    ReleaseDC(parent, dc);
+
+    console_ = CreateWindowExA(WS_EX_CLIENTEDGE, kConsoleViewClass, nullptr,
+        WS_CHILD | WS_VISIBLE | WS_VSCROLL | WS_TABSTOP,
         0, 0, 0, 0, parent,
-        reinterpret_cast<HMENU>(kConsoleId), hinst, nullptr);
-    SendMessage(console_, EM_SETLIMITTEXT,
-        static_cast<WPARAM>(kMaxLen * 2), 0);
-    SendMessage(console_, WM_SETFONT,
-        reinterpret_cast<WPARAM>(mono_font), FALSE);
+        reinterpret_cast<HMENU>(kConsoleId), hinst, this);
+    UpdateScrollBar();
 
     console_in_ = CreateWindowExA(WS_EX_CLIENTEDGE, "EDIT", "",
         WS_CHILD | WS_VISIBLE | ES_AUTOHSCROLL,
@@ -59,51 +89,405 @@ void ConsoleTab::SetEnabled(bool enabled) {
     EnableWindow(send_btn_, enabled);
 }
 
-void ConsoleTab::SetText(const char* text) {
-    SetWindowTextA(console_, text);
-}
-
-void ConsoleTab::AppendText(const std::string& text) {
-    int ctl_len = GetWindowTextLengthA(console_);
-    if (ctl_len > static_cast<int>(kTrimAt)) {
-        int cut = ctl_len / 2;
-        SendMessageA(console_, EM_SETSEL, 0, cut);
-        SendMessageA(console_, EM_REPLACESEL, FALSE,
-            reinterpret_cast<LPARAM>(""));
-        ctl_len = GetWindowTextLengthA(console_);
-    }
-    SendMessageA(console_, EM_SETSEL, ctl_len, ctl_len);
-    SendMessageA(console_, EM_REPLACESEL, FALSE,
-        reinterpret_cast<LPARAM>(text.c_str()));
-}
-
-std::string ConsoleTab::FilterAndAppend(TextState& state, const std::string& raw) {
-    std::string added;
-    for (unsigned char ch : raw) {
-        switch (state.ansi) {
-        case TextState::AnsiPhase::kNormal:
-            if (ch == 0x1b) { state.ansi = TextState::AnsiPhase::kEsc; break; }
-            if (ch == '\n') { state.text += "\r\n"; added += "\r\n"; break; }
-            if (ch == '\t') { state.text.push_back('\t'); added.push_back('\t'); break; }
-            if (ch >= 0x20 && ch <= 0x7e) { state.text.push_back(ch); added.push_back(ch); break; }
-            break;
-        case TextState::AnsiPhase::kEsc:
-            state.ansi = (ch == '[') ? TextState::AnsiPhase::kCsi : TextState::AnsiPhase::kNormal;
-            break;
-        case TextState::AnsiPhase::kCsi:
-            if (ch >= 0x40 && ch <= 0x7e) state.ansi = TextState::AnsiPhase::kNormal;
-            break;
+void ConsoleTab::SetBuffer(const ConsoleBuffer* buffer) {
+    buffer_ = buffer;
+    follow_tail_ = true;
+    selecting_ = false;
+    has_selection_ = false;
+    UpdateScrollBar();
+    InvalidateRect(console_, nullptr, FALSE);
+}
+
+void ConsoleTab::OnBufferChanged() {
+    // A chatty guest sends many chunks per frame; the timer folds them
+    // into one repaint.
+    if (repaint_pending_ || !console_) return;
+    repaint_pending_ = SetTimer(console_, kRepaintTimerId, kRepaintMs, nullptr) != 0;
+}
+
+// ── Layout on the character grid ──
+
+size_t ConsoleTab::Columns() const {
+    RECT rc{};
+    GetClientRect(console_, &rc);
+    return static_cast<size_t>((std::max)(1L, (rc.right - kMargin) / char_w_));
+}
+
+size_t ConsoleTab::VisibleRows() const {
+    RECT rc{};
+    GetClientRect(console_, &rc);
+    return static_cast<size_t>((std::max)(1L, rc.bottom / line_h_));
+}
+
+size_t ConsoleTab::RowsOf(size_t line_len, size_t cols) {
+    return line_len == 0 ? 1 : (line_len + cols - 1) / cols;
+}
+
+uint64_t ConsoleTab::TotalRows() const {
+    if (!buffer_) return 0;
+    size_t cols = Columns();
+    uint64_t rows = 0;
+    for (size_t i = 0; i < buffer_->line_count(); ++i) {
+        rows += RowsOf(buffer_->LineLength(i), cols);
+    }
+    return rows;
+}
+
+void ConsoleTab::FirstVisible(size_t* line, size_t* skip_rows) const {
+    *line = 0;
+    *skip_rows = 0;
+    if (!buffer_) return;
+    size_t cols = Columns();
+    size_t count = buffer_->line_count();
+
+    if (follow_tail_) {
+        // Walk up from the end only as far as the screen reaches.
+        size_t vis = VisibleRows();
+        size_t rows = 0;
+        size_t i = count;
+        while (i > 0 && rows < vis) {
+            --i;
+            rows += RowsOf(buffer_->LineLength(i), cols);
         }
+        *line = i;
+        *skip_rows = rows > vis ? rows - vis : 0;
+        return;
     }
-    if (state.text.size() > kMaxLen) {
-        state.text.erase(0, state.text.size() - kMaxLen);
+
+    // If the anchored text has been dropped, show the oldest that is left.
+    uint64_t dropped = buffer_->dropped_lines();
+    if (anchor_line_ < dropped) return;
+    *line = static_cast<size_t>((std::min)(anchor_line_ - dropped,
+                                         static_cast<uint64_t>(count - 1)));
+    *skip_rows = (std::min)(anchor_row_, RowsOf(buffer_->LineLength(*line), cols) - 1);
+}
+
+uint64_t ConsoleTab::TopRow() const {
+    if (!buffer_) return 0;
+    size_t line = 0;
+    size_t skip = 0;
+    FirstVisible(&line, &skip);
+    size_t cols = Columns();
+    uint64_t row = skip;
+    for (size_t i = 0; i < line; ++i) row += RowsOf(buffer_->LineLength(i), cols);
+    return row;
+}
+
+void ConsoleTab::ScrollTo(int64_t top_row) {
+    if (!buffer_) return;
+    uint64_t total = TotalRows();
+    uint64_t vis = VisibleRows();
+    uint64_t max_top = total > vis ? total - vis : 0;
+    if (top_row < 0) top_row = 0;
+
+    if (static_cast<uint64_t>(top_row) >= max_top) {
+        follow_tail_ = true;
+    } else {
+        follow_tail_ = false;
+        size_t cols = Columns();
+        uint64_t row = 0;
+        size_t i = 0;
+        for (; i < buffer_->line_count(); ++i) {
+            size_t rows = RowsOf(buffer_->LineLength(i), cols);
+            if (row + rows > static_cast<uint64_t>(top_row)) break;
+            row += rows;
+        }
+        anchor_line_ = buffer_->dropped_lines() + i;
+        anchor_row_ = static_cast<size_t>(top_row - row);
     }
-    return added;
+    UpdateScrollBar();
+    InvalidateRect(console_, nullptr, FALSE);
+}
+
+void ConsoleTab::UpdateScrollBar() {
+    uint64_t total = TotalRows();
+    SCROLLINFO si{};
+    si.cbSize = sizeof(si);
+    si.fMask = SIF_RANGE | SIF_PAGE | SIF_POS | SIF_DISABLENOSCROLL;
+    si.nMin = 0;
+    si.nMax = total > 0 ? static_cast<int>(total - 1) : 0;
+    si.nPage = static_cast<UINT>(VisibleRows());
+    si.nPos = static_cast<int>(TopRow());
+    SetScrollInfo(console_, SB_VERT, &si, TRUE);
 }
 
-void ConsoleTab::ResetState(TextState& state) {
-    state.text.clear();
-    state.ansi = TextState::AnsiPhase::kNormal;
+// ── Painting ──
+
+void ConsoleTab::OnPaint() {
+    PAINTSTRUCT ps;
+    HDC hdc = BeginPaint(console_, &ps);
+    RECT rc{};
+    GetClientRect(console_, &rc);
+    if (rc.right <= 0 || rc.bottom <= 0) {
+        EndPaint(console_, &ps);
+        return;
+    }
+
+    // Draw off screen so a repaint during a flood does not flicker.
+    HDC mem = CreateCompatibleDC(hdc);
+    HBITMAP bmp = CreateCompatibleBitmap(hdc, rc.right, rc.bottom);
+    HGDIOBJ old_bmp = SelectObject(mem, bmp);
+    HGDIOBJ old_font = SelectObject(mem, mono_font_);
+    FillRect(mem, &rc, GetSysColorBrush(COLOR_WINDOW));
+
+    if (buffer_) {
+        COLORREF fg = GetSysColor(COLOR_WINDOWTEXT);
+        COLORREF bg = GetSysColor(COLOR_WINDOW);
+        COLORREF sel_fg = GetSysColor(COLOR_HIGHLIGHTTEXT);
+        COLORREF sel_bg = GetSysColor(COLOR_HIGHLIGHT);
+
+        TextPos from = sel_from_;
+        TextPos to = sel_to_;
+        if (to.line < from.line || (to.line == from.line && to.col < from.col)) {
+            std::swap(from, to);
+        }
+
+        size_t cols = Columns();
+        size_t count = buffer_->line_count();
+        uint64_t dropped = buffer_->dropped_lines();
+        size_t line = 0;
+        size_t skip = 0;
+        FirstVisible(&line, &skip);
+
+        int y = 0;
+        for (; line < count && y < rc.bottom; ++line, skip = 0) {
+            std::string text = buffer_->Line(line);
+            uint64_t abs_line = dropped + line;
+            size_t sel_begin = 0;
+            size_t sel_end = 0;
+            if (has_selection_ && abs_line >= from.line && abs_line <= to.line) {
+                sel_begin = abs_line == from.line ? from.col : 0;
+                sel_end = abs_line == to.line ? to.col : text.size();
+            }
+
+            size_t rows = RowsOf(text.size(), cols);
+            for (size_t r = skip; r < rows && y < rc.bottom; ++r, y += line_h_) {
+                size_t begin = r * cols;
+                size_t end = (std::min)(text.size(), begin + cols);
+                if (end <= begin) continue;
+                SetTextColor(mem, fg);
+                SetBkColor(mem, bg);
+                ExtTextOutA(mem, kMargin, y, 0, nullptr, text.data() + begin,
+                            static_cast<UINT>(end - begin), nullptr);
+                size_t hl_begin = (std::max)(sel_begin, begin);
+                size_t hl_end = (std::min)(sel_end, end);
+                if (hl_begin < hl_end) {
+                    SetTextColor(mem, sel_fg);
+                    SetBkColor(mem, sel_bg);
+                    ExtTextOutA(mem, kMargin + static_cast<int>(hl_begin - begin) * char_w_, y,
+                                0, nullptr, text.data() + hl_begin,
+                                static_cast<UINT>(hl_end - hl_begin), nullptr);
+                }
+            }
+        }
+        shown_revision_ = buffer_->revision();
+    }
+
+    BitBlt(hdc, 0, 0, rc.right, rc.bottom, mem, 0, 0, SRCCOPY);
+    SelectObject(mem, old_font);
+    SelectObject(mem, old_bmp);
+    DeleteObject(bmp);
+    DeleteDC(mem);
+    EndPaint(console_, &ps);
+}
+
+// ── Input ──
+
+void ConsoleTab::OnScroll(WPARAM wp) {
+    int64_t top = static_cast<int64_t>(TopRow());
+    int64_t page = static_cast<int64_t>(VisibleRows());
+    switch (LOWORD(wp)) {
+    case SB_LINEUP:   top -= 1; break;
+    case SB_LINEDOWN: top += 1; break;
+    case SB_PAGEUP:   top -= page; break;
+    case SB_PAGEDOWN: top += page; break;
+    case SB_TOP:      top = 0; break;
+    case SB_BOTTOM:   top = INT64_MAX; break;
+    case SB_THUMBTRACK:
+    case SB_THUMBPOSITION: {
+        SCROLLINFO si{};
+        si.cbSize = sizeof(si);
+        si.fMask = SIF_TRACKPOS;
+        GetScrollInfo(console_, SB_VERT, &si);
+        top = si.nTrackPos;
+        break;
+    }
+    default:
+        return;
+    }
+    ScrollTo(top);
+}
+
+bool ConsoleTab::OnKey(WPARAM key) {
+    bool ctrl = GetKeyState(VK_CONTROL) < 0;
+    if (ctrl && key == 'C') {
+        CopySelection();
+        return true;
+    }
+    if (ctrl && key == 'A') {
+        if (!buffer_) return true;
+        size_t last = buffer_->line_count() - 1;
+        sel_from_ = {buffer_->dropped_lines(), 0};
+        sel_to_ = {buffer_->dropped_lines() + last, buffer_->LineLength(last)};
+        has_selection_ = true;
+        InvalidateRect(console_, nullptr, FALSE);
+        return true;
+    }
+    switch (key) {
+    case VK_UP:    OnScroll(SB_LINEUP); return true;
+    case VK_DOWN:  OnScroll(SB_LINEDOWN); return true;
+    case VK_PRIOR: OnScroll(SB_PAGEUP); return true;
+    case VK_NEXT:  OnScroll(SB_PAGEDOWN); return true;
+    case VK_HOME:  OnScroll(SB_TOP); return true;
+    case VK_END:   OnScroll(SB_BOTTOM); return true;
+    default:       return false;
+    }
+}
+
+bool ConsoleTab::HitTest(int x, int y, TextPos* pos) const {
+    if (!buffer_) return false;
+    RECT rc{};
+    GetClientRect(console_, &rc);
+    y = (std::max)(0, (std::min)(y, static_cast<int>(rc.bottom) - 1));
+
+    size_t cols = Columns();
+    size_t count = buffer_->line_count();
+    size_t line = 0;
+    size_t row = 0;
+    FirstVisible(&line, &row);
+    row += static_cast<size_t>(y / line_h_);
+    while (line < count) {
+        size_t rows = RowsOf(buffer_->LineLength(line), cols);
+        if (row < rows) break;
+        row -= rows;
+        ++line;
+    }
+
+    if (line >= count) {
+        line = count - 1;
+        pos->col = buffer_->LineLength(line);
+    } else {
+        // Round to the nearer cell edge, as an edit control does.
+        size_t cell = static_cast<size_t>((std::max)(0, x - kMargin + char_w_ / 2) / char_w_);
+        size_t len = buffer_->LineLength(line);
+        pos->col = (std::min)(row * cols + (std::min)(cell, cols), len);
+    }
+    pos->line = buffer_->dropped_lines() + line;
+    return true;
+}
+
+void ConsoleTab::CopySelection() {
+    if (!buffer_ || !has_selection_) return;
+    TextPos from = sel_from_;
+    TextPos to = sel_to_;
+    if (to.line < from.line || (to.line == from.line && to.col < from.col)) {
+        std::swap(from, to);
+    }
+    uint64_t dropped = buffer_->dropped_lines();
+    if (to.line < dropped) return;
+    if (from.line < dropped) from = {dropped, 0};
+
+    std::string text = buffer_->Text(static_cast<size_t>(from.line - dropped), from.col,
+                                     static_cast<size_t>(to.line - dropped), to.col);
+    if (text.empty() || !OpenClipboard(console_)) return;
+    EmptyClipboard();
+    HGLOBAL mem = GlobalAlloc(GMEM_MOVEABLE, text.size() + 1);
+    if (mem) {
+        memcpy(GlobalLock(mem), text.c_str(), text.size() + 1);
+        GlobalUnlock(mem);
+        if (!SetClipboardData(CF_TEXT, mem)) GlobalFree(mem);
+    }
+    CloseClipboard();
+}
+
+LRESULT CALLBACK ConsoleTab::ViewProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
+    ConsoleTab* self = nullptr;
+
+    if (msg == WM_NCCREATE) {
+        auto* cs = reinterpret_cast<CREATESTRUCTA*>(lp);
+        self = reinterpret_cast<ConsoleTab*>(cs->lpCreateParams);
+        self->console_ = hwnd;
+        SetWindowLongPtrA(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(self));
+    } else {
+        self = reinterpret_cast<ConsoleTab*>(
+            GetWindowLongPtrA(hwnd, GWLP_USERDATA));
+    }
+
+    if (!self) return DefWindowProcA(hwnd, msg, wp, lp);
+
+    switch (msg) {
+    case WM_PAINT:
+        self->OnPaint();
+        return 0;
+
+    case WM_ERASEBKGND:
+        return 1;
+
+    case WM_SIZE:
+        // Re-wrap at the new width, keeping the tail or the top line.
+        self->ScrollTo(self->follow_tail_ ? INT64_MAX
+                                          : static_cast<int64_t>(self->TopRow()));
+        return 0;
+
+    case WM_TIMER:
+        if (wp == kRepaintTimerId) {
+            KillTimer(hwnd, kRepaintTimerId);
+            self->repaint_pending_ = false;
+            if (self->buffer_ && self->buffer_->revision() != self->shown_revision_) {
+                self->UpdateScrollBar();
+                InvalidateRect(hwnd, nullptr, FALSE);
+            }
+            return 0;
+        }
+        break;
+
+    case WM_VSCROLL:
+        self->OnScroll(wp);
+        return 0;
+
+    case WM_MOUSEWHEEL: {
+        int notches = GET_WHEEL_DELTA_WPARAM(wp) / WHEEL_DELTA;
+        self->ScrollTo(static_cast<int64_t>(self->TopRow()) - notches * kWheelRows);
+        return 0;
+    }
+
+    case WM_LBUTTONDOWN: {
+        SetFocus(hwnd);
+        SetCapture(hwnd);
+        TextPos pos;
+        self->selecting_ = self->HitTest(GET_X_LPARAM(lp), GET_Y_LPARAM(lp), &pos);
+        self->sel_from_ = pos;
+        self->sel_to_ = pos;
+        self->has_selection_ = false;
+        InvalidateRect(hwnd, nullptr, FALSE);
+        return 0;
+    }
+
+    case WM_MOUSEMOVE:
+        if (self->selecting_) {
+            TextPos pos;
+            if (self->HitTest(GET_X_LPARAM(lp), GET_Y_LPARAM(lp), &pos)) {
+                self->sel_to_ = pos;
+                self->has_selection_ = pos.line != self->sel_from_.line ||
+                                       pos.col != self->sel_from_.col;
+                InvalidateRect(hwnd, nullptr, FALSE);
+            }
+        }
+        return 0;
+
+    case WM_LBUTTONUP:
+        if (self->selecting_) ReleaseCapture();
+        return 0;
+
+    case WM_CAPTURECHANGED:
+        self->selecting_ = false;
+        return 0;
+
+    case WM_KEYDOWN:
+        if (self->OnKey(wp)) return 0;
+        break;
+    }
+    return DefWindowProcA(hwnd, msg, wp, lp);
 }
 
 LRESULT CALLBACK ConsoleTab::InputSubclass(
@@ -4,11 +4,15 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+#include "ui/common/console_buffer.h"
+
 #include <cstdint>
 #include <string>
 
-// Console Tab component: output display, input field and send button.
-// Also manages per-VM ANSI-filtered text state.
+// Console Tab component: output view, input field and send button.
+// The output view draws only the rows on screen straight from a VM's
+// ConsoleBuffer, and repaints at most once per kRepaintMs however fast
+// the guest writes.
 class ConsoleTab {
 public:
     static constexpr UINT kConsoleId  = 2004;
@@ -25,33 +29,67 @@ public:
 
     HWND input_handle() const { return console_in_; }
 
-    // Set the full text in the output area (used when switching VMs).
-    void SetText(const char* text);
+    // Show `buffer` in the output area, scrolled to the end (used when
+    // switching VMs). Null shows nothing. The buffer must outlive its use
+    // here or be replaced first.
+    void SetBuffer(const ConsoleBuffer* buffer);
+    const ConsoleBuffer* buffer() const { return buffer_; }
 
-    // Append already-filtered text to the output control, trimming if needed.
-    void AppendText(const std::string& text);
+    // The shown buffer has new text; the repaint is batched.
+    void OnBufferChanged();
 
-    // ── Per-VM text state management ──
+private:
+    static constexpr UINT kRepaintTimerId = 1;
+    static constexpr UINT kRepaintMs = 33;
+    static constexpr int kWheelRows = 3;
+    static constexpr int kMargin = 2;
 
-    struct TextState {
-        std::string text;
-        enum class AnsiPhase { kNormal, kEsc, kCsi } ansi = AnsiPhase::kNormal;
+    // A spot in the output; `line` counts from the start of the whole
+    // output so it stays put as old lines are dropped.
+    struct TextPos {
+        uint64_t line = 0;
+        size_t col = 0;
     };
 
-    // Filter raw console data through ANSI stripper, append to state,
-    // and return the displayable portion that was added.
-    static std::string FilterAndAppend(TextState& state, const std::string& raw);
+    size_t Columns() const;
+    size_t VisibleRows() const;
+    static size_t RowsOf(size_t line_len, size_t cols);
+    uint64_t TotalRows() const;
+    uint64_t TopRow() const;
+    // Buffer line at the top of the view and how many of its wrapped
+    // rows are scrolled off.
+    void FirstVisible(size_t* line, size_t* skip_rows) const;
+    void ScrollTo(int64_t top_row);
+    void UpdateScrollBar();
+    void OnPaint();
+    void OnScroll(WPARAM wp);
+    bool OnKey(WPARAM key);
+    bool HitTest(int x, int y, TextPos* pos) const;
+    void CopySelection();
 
-    static void ResetState(TextState& state);
+    const ConsoleBuffer* buffer_ = nullptr;
+    uint64_t shown_revision_ = 0;
+    bool repaint_pending_ = false;
 
-private:
-    static constexpr size_t kMaxLen  = 32 * 1024;
-    static constexpr size_t kTrimAt  = 24 * 1024;
+    // Scroll position: the tail, or a row of a given line.
+    bool follow_tail_ = true;
+    uint64_t anchor_line_ = 0;
+    size_t anchor_row_ = 0;
+
+    bool selecting_ = false;
+    bool has_selection_ = false;
+    TextPos sel_from_;
+    TextPos sel_to_;
+
+    HFONT mono_font_ = nullptr;
+    int char_w_ = 8;
+    int line_h_ = 16;
 
     HWND console_    = nullptr;
     HWND console_in_ = nullptr;
     HWND send_btn_   = nullptr;
 
+    static LRESULT CALLBACK ViewProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp);
     static LRESULT CALLBACK InputSubclass(
         HWND hwnd, UINT msg, WPARAM wp, LPARAM lp,
         UINT_PTR id, DWORD_PTR ref);
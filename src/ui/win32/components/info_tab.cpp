@@ -2,9 +2,97 @@
 #include "common/vm_model.h"
 #include "ui/common/i18n.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 
-void InfoTab::Create(HWND parent, HINSTANCE hinst, HFONT ui_font) {
+namespace {
+
+std::string FormatNs(uint64_t ns) {
+    char buf[32];
+    if (ns < 1000) {
+        snprintf(buf, sizeof(buf), "%lluns", static_cast<unsigned long long>(ns));
+    } else if (ns < 1000000) {
+        snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    } else {
+        snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    }
+    return buf;
+}
+
+// Upper bound of the histogram bucket holding the q-th quantile.
+std::string Quantile(const VmExitStat& stat, double q) {
+    uint64_t target = static_cast<uint64_t>(stat.count * q);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < stat.histogram.size(); ++b) {
+        seen += stat.histogram[b];
+        if (seen > target) {
+            if (b + 1 == stat.histogram.size()) return ">" + FormatNs(128ull << b);
+            return "<" + FormatNs(256ull << b);
+        }
+    }
+    return "-";
+}
+
+std::string FormatStats(const VmRuntimeStats& stats) {
+    std::string out;
+    char line[256];
+    if (!stats.startup.empty()) {
+        out += "Startup:\r\n";
+        uint64_t prev = 0;
+        for (const auto& s : stats.startup) {
+            snprintf(line, sizeof(line), "  %-20s %8.1f ms  (+%.1f ms)\r\n", s.name.c_str(),
+                     s.us / 1e3, (s.us > prev ? s.us - prev : 0) / 1e3);
+            out += line;
+            prev = std::max(prev, s.us);
+        }
+    }
+    for (uint32_t v = 0; v < stats.halts.size(); ++v) {
+        const auto& h = stats.halts[v];
+        snprintf(line, sizeof(line),
+                 "vCPU %u: halted %.1f s in %llu halts (%llu polled), poll window %u us\r\n",
+                 v, h.halted_ns / 1e9, static_cast<unsigned long long>(h.halts),
+                 static_cast<unsigned long long>(h.poll_wakeups), h.poll_us);
+        out += line;
+        for (const auto& e : stats.exits) {
+            if (e.vcpu != v || e.count == 0) continue;
+            snprintf(line, sizeof(line),
+                     "  %-20s %10llu  avg %-8s p50 %-8s p99 %-8s max %s\r\n",
+                     e.name.c_str(), static_cast<unsigned long long>(e.count),
+                     FormatNs(e.total_ns / e.count).c_str(),
+                     Quantile(e, 0.5).c_str(), Quantile(e, 0.99).c_str(),
+                     FormatNs(e.max_ns).c_str());
+            out += line;
+        }
+    }
+    if (stats.net.tx_dropped || stats.net.shaper_dropped) {
+        snprintf(line, sizeof(line),
+                 "Network: %llu frames dropped, %llu by the rate limit\r\n",
+                 static_cast<unsigned long long>(stats.net.tx_dropped + stats.net.shaper_dropped),
+                 static_cast<unsigned long long>(stats.net.shaper_dropped));
+        out += line;
+    }
+    if (!stats.fs_ops.empty()) {
+        out += "Shared folders:\r\n";
+        for (const auto& op : stats.fs_ops) {
+            if (op.count == 0) continue;
+            snprintf(line, sizeof(line),
+                     "  %-20s %10llu  avg %-8s p50 %-8s p99 %-8s max %s  errors %llu\r\n",
+                     op.name.c_str(), static_cast<unsigned long long>(op.count),
+                     FormatNs(op.total_us / op.count * 1000).c_str(),
+                     ("<" + FormatNs(op.p50_us * 1000)).c_str(),
+                     ("<" + FormatNs(op.p99_us * 1000)).c_str(),
+                     FormatNs(op.max_us * 1000).c_str(),
+                     static_cast<unsigned long long>(op.errors));
+            out += line;
+        }
+    }
+    return out;
+}
+
+}  // namespace
+
+void InfoTab::Create(HWND parent, HINSTANCE hinst, HFONT ui_font, HFONT mono_font) {
     for (int i = 0; i < kDetailRows; ++i) {
         labels_[i] = CreateWindowExA(0, "STATIC", "",
             WS_CHILD | SS_RIGHT,
@@ -17,6 +105,18 @@ void InfoTab::Create(HWND parent, HINSTANCE hinst, HFONT ui_font) {
         SendMessage(values_[i], WM_SETFONT,
             reinterpret_cast<WPARAM>(ui_font), FALSE);
     }
+
+    stats_label_ = CreateWindowExA(0, "STATIC", "",
+        WS_CHILD | SS_RIGHT,
+        0, 0, 0, 0, parent, nullptr, hinst, nullptr);
+    stats_ = CreateWindowExA(0, "EDIT", "",
+        WS_CHILD | WS_VSCROLL | WS_HSCROLL | ES_MULTILINE | ES_READONLY |
+        ES_AUTOVSCROLL | ES_AUTOHSCROLL,
+        0, 0, 0, 0, parent, nullptr, hinst, nullptr);
+    SendMessage(stats_label_, WM_SETFONT,
+        reinterpret_cast<WPARAM>(ui_font), FALSE);
+    SendMessage(stats_, WM_SETFONT,
+        reinterpret_cast<WPARAM>(mono_font), FALSE);
 }
 
 void InfoTab::Show(bool visible) {
@@ -25,11 +125,11 @@ void InfoTab::Show(bool visible) {
         ShowWindow(labels_[i], cmd);
         ShowWindow(values_[i], cmd);
     }
+    ShowWindow(stats_label_, cmd);
+    ShowWindow(stats_, cmd);
 }
 
 void InfoTab::Layout(HWND hwnd, HFONT ui_font, int px, int py, int pw, int ph) {
-    (void)ph;
-
     HDC hdc = GetDC(hwnd);
     HFONT old_font = static_cast<HFONT>(SelectObject(hdc, ui_font));
     TEXTMETRICA tm{};
@@ -39,7 +139,7 @@ void InfoTab::Layout(HWND hwnd, HFONT ui_font, int px, int py, int pw, int ph) {
         i18n::tr(i18n::S::kLabelId), i18n::tr(i18n::S::kLabelLocation),
         i18n::tr(i18n::S::kLabelKernel), i18n::tr(i18n::S::kLabelDisk),
         i18n::tr(i18n::S::kLabelMemory), i18n::tr(i18n::S::kLabelVcpus),
-        i18n::tr(i18n::S::kLabelNat)
+        i18n::tr(i18n::S::kLabelNat), i18n::tr(i18n::S::kLabelExitStats)
     };
     int label_w = 0;
     for (const char* lbl : kLabels) {
@@ -63,6 +163,11 @@ void InfoTab::Layout(HWND hwnd, HFONT ui_font, int px, int py, int pw, int ph) {
         MoveWindow(values_[i], val_x, dy, val_w, row_h, TRUE);
         dy += row_gap;
     }
+
+    int stats_h = py + ph - 8 - dy;
+    if (stats_h < row_h) stats_h = row_h;
+    MoveWindow(stats_label_, px + 8, dy, label_w, row_h, TRUE);
+    MoveWindow(stats_, val_x, dy, val_w, stats_h, TRUE);
 }
 
 void InfoTab::Update(const VmSpec* spec) {
@@ -75,10 +180,12 @@ void InfoTab::Update(const VmSpec* spec) {
     };
     for (int i = 0; i < kDetailRows; ++i)
         SetWindowTextA(labels_[i], label_texts[i]);
+    SetWindowTextA(stats_label_, i18n::tr(S::kLabelExitStats));
 
     if (!spec) {
         for (int i = 0; i < kDetailRows; ++i)
             SetWindowTextA(values_[i], "");
+        SetWindowTextA(stats_, "");
         return;
     }
 
@@ -94,3 +201,14 @@ void InfoTab::Update(const VmSpec* spec) {
     SetWindowTextA(values_[5], cpu_str.c_str());
     SetWindowTextA(values_[6], spec->nat_enabled ? i18n::tr(S::kNatEnabled) : i18n::tr(S::kNatDisabled));
 }
+
+void InfoTab::SetStats(const VmRuntimeStats* stats) {
+    if (!stats) {
+        SetWindowTextA(stats_, i18n::tr(i18n::S::kStatsUnavailable));
+        return;
+    }
+    // Keep the reader's scroll position across refreshes.
+    int first_line = static_cast<int>(SendMessageA(stats_, EM_GETFIRSTVISIBLELINE, 0, 0));
+    SetWindowTextA(stats_, FormatStats(*stats).c_str());
+    SendMessageA(stats_, EM_LINESCROLL, 0, first_line);
+}
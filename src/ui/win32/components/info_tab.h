@@ -8,6 +8,7 @@
 #include <vector>
 
 struct VmSpec;
+struct VmRuntimeStats;
 
 // Info Tab component showing VM details (ID, location, kernel, disk, etc.)
 class InfoTab {
@@ -15,14 +16,18 @@ public:
     InfoTab() = default;
     ~InfoTab() = default;
 
-    void Create(HWND parent, HINSTANCE hinst, HFONT ui_font);
+    void Create(HWND parent, HINSTANCE hinst, HFONT ui_font, HFONT mono_font);
     void Show(bool visible);
     void Layout(HWND hwnd, HFONT ui_font, int px, int py, int pw, int ph);
     void Update(const VmSpec* spec);
+    // Exit profile of the selected VM; nullptr while it is not running.
+    void SetStats(const VmRuntimeStats* stats);
 
     static constexpr int kDetailRows = 7;
 
 private:
     HWND labels_[kDetailRows] = {};
     HWND values_[kDetailRows] = {};
+    HWND stats_label_ = nullptr;
+    HWND stats_ = nullptr;
 };
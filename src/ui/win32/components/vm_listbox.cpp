@@ -2,14 +2,19 @@
 #include "manager/manager_service.h"
 #include "ui/common/i18n.h"
 
-static const char* StateText(VmPowerState s) {
+#include <string>
+
+static const char* StateText(const VmRecord& rec) {
     using S = i18n::S;
-    switch (s) {
+    switch (rec.state) {
     case VmPowerState::kRunning:  return i18n::tr(S::kStateRunning);
     case VmPowerState::kStarting: return i18n::tr(S::kStateStarting);
     case VmPowerState::kStopping: return i18n::tr(S::kStateStopping);
     case VmPowerState::kCrashed:  return i18n::tr(S::kStateCrashed);
-    default:                      return i18n::tr(S::kStateStopped);
+    default:
+        if (!rec.spec.template_snapshot.empty()) return i18n::tr(S::kStateTemplate);
+        return i18n::tr(rec.spec.suspend_snapshot.empty() ? S::kStateStopped
+                                                          : S::kStateSuspended);
     }
 }
 
@@ -38,6 +43,38 @@ void VmListBox::Populate(const std::vector<VmRecord>& records, int selected_inde
     InvalidateRect(hwnd_, nullptr, TRUE);
 }
 
+void VmListBox::AppendItem(const VmRecord& rec) {
+    SendMessageA(hwnd_, LB_ADDSTRING, 0, reinterpret_cast<LPARAM>(rec.spec.name.c_str()));
+}
+
+void VmListBox::RemoveItem(int index) {
+    SendMessageA(hwnd_, LB_DELETESTRING, index, 0);
+}
+
+void VmListBox::UpdateItem(int index, const VmRecord& rec) {
+    // The string only serves keyboard search; replace it on renames alone.
+    int len = static_cast<int>(SendMessageA(hwnd_, LB_GETTEXTLEN, index, 0));
+    std::string text(len > 0 ? len : 0, '\0');
+    if (len > 0) SendMessageA(hwnd_, LB_GETTEXT, index, reinterpret_cast<LPARAM>(text.data()));
+    if (text != rec.spec.name) {
+        int sel = static_cast<int>(SendMessageA(hwnd_, LB_GETCURSEL, 0, 0));
+        SendMessageA(hwnd_, WM_SETREDRAW, FALSE, 0);
+        SendMessageA(hwnd_, LB_DELETESTRING, index, 0);
+        SendMessageA(hwnd_, LB_INSERTSTRING, index,
+            reinterpret_cast<LPARAM>(rec.spec.name.c_str()));
+        if (sel >= 0) SendMessageA(hwnd_, LB_SETCURSEL, sel, 0);
+        SendMessageA(hwnd_, WM_SETREDRAW, TRUE, 0);
+    }
+    RECT rc;
+    if (SendMessageA(hwnd_, LB_GETITEMRECT, index, reinterpret_cast<LPARAM>(&rc)) != LB_ERR) {
+        InvalidateRect(hwnd_, &rc, FALSE);
+    }
+}
+
+void VmListBox::SetSelection(int index) {
+    SendMessageA(hwnd_, LB_SETCURSEL, index, 0);
+}
+
 bool VmListBox::HandleMeasureItem(MEASUREITEMSTRUCT* mis) {
     if (mis->CtlID == kControlId) {
         mis->itemHeight = kItemHeight;
@@ -100,7 +137,7 @@ bool VmListBox::HandleDrawItem(DRAWITEMSTRUCT* dis, const std::vector<VmRecord>&
     GetTextExtentPoint32W(dis->hDC, name_w.c_str(),
         static_cast<int>(name_w.size()), &name_sz);
 
-    auto state_w = i18n::to_wide(StateText(rec.state));
+    auto state_w = i18n::to_wide(StateText(rec));
     COLORREF state_color;
     if (rec.state == VmPowerState::kRunning)
         state_color = RGB(0, 128, 0);
@@ -23,6 +23,13 @@ public:
     // Repopulate the list from the records vector.
     void Populate(const std::vector<VmRecord>& records, int selected_index);
 
+    // Single-row updates, for when few records changed. Rows are drawn
+    // from the records vector, so it must already match.
+    void AppendItem(const VmRecord& rec);
+    void RemoveItem(int index);
+    void UpdateItem(int index, const VmRecord& rec);
+    void SetSelection(int index);
+
     // Handle WM_MEASUREITEM. Returns true if handled.
     bool HandleMeasureItem(MEASUREITEMSTRUCT* mis);
 
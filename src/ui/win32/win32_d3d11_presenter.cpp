@@ -0,0 +1,270 @@
+#include "ui/win32/win32_d3d11_presenter.h"
+
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <dxgi1_2.h>
+
+#include <algorithm>
+#include <cstring>
+
+// Draws one triangle covering the viewport and samples the framebuffer
+// texture across it; the viewport is the destination rect.
+static const char kShaderSource[] = R"(
+struct VsOut {
+    float4 pos : SV_Position;
+    float2 uv : TEXCOORD0;
+};
+
+VsOut vs_main(uint id : SV_VertexID) {
+    VsOut o;
+    o.uv = float2((id << 1) & 2, id & 2);
+    o.pos = float4(o.uv * float2(2, -2) + float2(-1, 1), 0, 1);
+    return o;
+}
+
+Texture2D fb : register(t0);
+SamplerState smp : register(s0);
+
+float4 ps_main(VsOut i) : SV_Target {
+    return float4(fb.Sample(smp, i.uv).rgb, 1);
+}
+)";
+
+template <typename T>
+static void SafeRelease(T*& p) {
+    if (p) {
+        p->Release();
+        p = nullptr;
+    }
+}
+
+D3D11Presenter::~D3D11Presenter() {
+    Reset();
+}
+
+bool D3D11Presenter::Init(HWND hwnd) {
+    Reset();
+    hwnd_ = hwnd;
+
+    // Hardware only: on WARP the GDI path is cheaper.
+    static const D3D_FEATURE_LEVEL kLevels[] = {
+        D3D_FEATURE_LEVEL_11_0, D3D_FEATURE_LEVEL_10_1, D3D_FEATURE_LEVEL_10_0,
+    };
+    HRESULT hr = D3D11CreateDevice(
+        nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr,
+        D3D11_CREATE_DEVICE_BGRA_SUPPORT | D3D11_CREATE_DEVICE_SINGLETHREADED,
+        kLevels, ARRAYSIZE(kLevels), D3D11_SDK_VERSION,
+        &device_, nullptr, &context_);
+    if (FAILED(hr) || !CreateShaders()) {
+        Reset();
+        return false;
+    }
+
+    IDXGIDevice* dxgi_device = nullptr;
+    IDXGIAdapter* adapter = nullptr;
+    IDXGIFactory2* factory = nullptr;
+    if (SUCCEEDED(device_->QueryInterface(IID_PPV_ARGS(&dxgi_device))) &&
+        SUCCEEDED(dxgi_device->GetAdapter(&adapter))) {
+        adapter->GetParent(IID_PPV_ARGS(&factory));
+    }
+    SafeRelease(adapter);
+    SafeRelease(dxgi_device);
+    if (!factory) {
+        Reset();
+        return false;
+    }
+
+    // GDI-compatible so the capture hint keeps its GDI drawing code.
+    DXGI_SWAP_CHAIN_DESC1 desc{};
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+    desc.BufferCount = 2;
+    desc.Scaling = DXGI_SCALING_NONE;
+    desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+    desc.AlphaMode = DXGI_ALPHA_MODE_IGNORE;
+    desc.Flags = DXGI_SWAP_CHAIN_FLAG_GDI_COMPATIBLE;
+    hr = factory->CreateSwapChainForHwnd(device_, hwnd, &desc, nullptr, nullptr, &swap_chain_);
+    if (FAILED(hr)) {
+        // FLIP_DISCARD needs Windows 10.
+        desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+        hr = factory->CreateSwapChainForHwnd(device_, hwnd, &desc, nullptr, nullptr, &swap_chain_);
+    }
+    if (SUCCEEDED(hr)) {
+        factory->MakeWindowAssociation(hwnd, DXGI_MWA_NO_ALT_ENTER);
+    }
+    SafeRelease(factory);
+    if (FAILED(hr)) {
+        Reset();
+        return false;
+    }
+    swap_chain_flags_ = desc.Flags;
+
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    if (!ResizeBuffers(rc.right, rc.bottom)) {
+        Reset();
+        return false;
+    }
+    return true;
+}
+
+bool D3D11Presenter::CreateShaders() {
+    ID3DBlob* vs_blob = nullptr;
+    ID3DBlob* ps_blob = nullptr;
+    bool ok =
+        SUCCEEDED(D3DCompile(kShaderSource, sizeof(kShaderSource) - 1, nullptr, nullptr,
+                             nullptr, "vs_main", "vs_4_0", D3DCOMPILE_OPTIMIZATION_LEVEL3,
+                             0, &vs_blob, nullptr)) &&
+        SUCCEEDED(D3DCompile(kShaderSource, sizeof(kShaderSource) - 1, nullptr, nullptr,
+                             nullptr, "ps_main", "ps_4_0", D3DCOMPILE_OPTIMIZATION_LEVEL3,
+                             0, &ps_blob, nullptr)) &&
+        SUCCEEDED(device_->CreateVertexShader(vs_blob->GetBufferPointer(),
+                                              vs_blob->GetBufferSize(), nullptr, &vs_)) &&
+        SUCCEEDED(device_->CreatePixelShader(ps_blob->GetBufferPointer(),
+                                             ps_blob->GetBufferSize(), nullptr, &ps_));
+    SafeRelease(vs_blob);
+    SafeRelease(ps_blob);
+    if (!ok) return false;
+
+    // Point sampling keeps a 1:1 image exact; linear for scaled output.
+    D3D11_SAMPLER_DESC sd{};
+    sd.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+    sd.AddressU = sd.AddressV = sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    sd.MaxLOD = D3D11_FLOAT32_MAX;
+    if (FAILED(device_->CreateSamplerState(&sd, &point_sampler_))) return false;
+    sd.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    return SUCCEEDED(device_->CreateSamplerState(&sd, &linear_sampler_));
+}
+
+void D3D11Presenter::Reset() {
+    if (context_) context_->ClearState();
+    SafeRelease(texture_srv_);
+    SafeRelease(texture_);
+    SafeRelease(rtv_);
+    SafeRelease(swap_chain_);
+    SafeRelease(linear_sampler_);
+    SafeRelease(point_sampler_);
+    SafeRelease(ps_);
+    SafeRelease(vs_);
+    SafeRelease(context_);
+    SafeRelease(device_);
+    tex_width_ = 0;
+    tex_height_ = 0;
+    buffer_width_ = 0;
+    buffer_height_ = 0;
+}
+
+bool D3D11Presenter::ResizeBuffers(int cw, int ch) {
+    SafeRelease(rtv_);
+    if (cw <= 0 || ch <= 0) return true;
+    if (FAILED(swap_chain_->ResizeBuffers(0, cw, ch, DXGI_FORMAT_UNKNOWN, swap_chain_flags_)))
+        return false;
+    ID3D11Texture2D* back = nullptr;
+    if (FAILED(swap_chain_->GetBuffer(0, IID_PPV_ARGS(&back)))) return false;
+    HRESULT hr = device_->CreateRenderTargetView(back, nullptr, &rtv_);
+    back->Release();
+    if (FAILED(hr)) return false;
+    buffer_width_ = cw;
+    buffer_height_ = ch;
+    return true;
+}
+
+bool D3D11Presenter::EnsureTexture(uint32_t w, uint32_t h) {
+    if (!device_ || (texture_ && tex_width_ == w && tex_height_ == h)) return false;
+    SafeRelease(texture_srv_);
+    SafeRelease(texture_);
+    tex_width_ = 0;
+    tex_height_ = 0;
+    if (w == 0 || h == 0) return true;
+
+    D3D11_TEXTURE2D_DESC td{};
+    td.Width = w;
+    td.Height = h;
+    td.MipLevels = 1;
+    td.ArraySize = 1;
+    td.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    td.SampleDesc.Count = 1;
+    td.Usage = D3D11_USAGE_DEFAULT;
+    td.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    if (FAILED(device_->CreateTexture2D(&td, nullptr, &texture_)) ||
+        FAILED(device_->CreateShaderResourceView(texture_, nullptr, &texture_srv_))) {
+        SafeRelease(texture_);
+        return true;
+    }
+    tex_width_ = w;
+    tex_height_ = h;
+    return true;
+}
+
+void D3D11Presenter::Upload(const RECT& rect, const uint8_t* pixels, uint32_t stride) {
+    if (!texture_) return;
+    LONG left = (std::max)(rect.left, 0L);
+    LONG top = (std::max)(rect.top, 0L);
+    LONG right = (std::min)(rect.right, static_cast<LONG>(tex_width_));
+    LONG bottom = (std::min)(rect.bottom, static_cast<LONG>(tex_height_));
+    if (left >= right || top >= bottom) return;
+
+    D3D11_BOX box{};
+    box.left = static_cast<UINT>(left);
+    box.top = static_cast<UINT>(top);
+    box.right = static_cast<UINT>(right);
+    box.bottom = static_cast<UINT>(bottom);
+    box.back = 1;
+    context_->UpdateSubresource(texture_, 0, &box,
+                                pixels + static_cast<size_t>(top) * stride + left * 4,
+                                stride, 0);
+}
+
+bool D3D11Presenter::Present(int cw, int ch, const RECT& dst, const OverlayFn& overlay) {
+    if (!swap_chain_ || cw <= 0 || ch <= 0) return true;
+    if ((!rtv_ || cw != buffer_width_ || ch != buffer_height_) && !ResizeBuffers(cw, ch)) {
+        return false;
+    }
+
+    // Flip-model back buffers hold stale content, so redraw everything.
+    static const float kBlack[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    context_->OMSetRenderTargets(1, &rtv_, nullptr);
+    context_->ClearRenderTargetView(rtv_, kBlack);
+
+    int dw = dst.right - dst.left;
+    int dh = dst.bottom - dst.top;
+    if (texture_srv_ && dw > 0 && dh > 0) {
+        D3D11_VIEWPORT vp{};
+        vp.TopLeftX = static_cast<float>(dst.left);
+        vp.TopLeftY = static_cast<float>(dst.top);
+        vp.Width = static_cast<float>(dw);
+        vp.Height = static_cast<float>(dh);
+        vp.MaxDepth = 1.0f;
+        bool scaled = static_cast<uint32_t>(dw) != tex_width_ ||
+                      static_cast<uint32_t>(dh) != tex_height_;
+        ID3D11SamplerState* sampler = scaled ? linear_sampler_ : point_sampler_;
+
+        context_->RSSetViewports(1, &vp);
+        context_->IASetInputLayout(nullptr);
+        context_->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        context_->VSSetShader(vs_, nullptr, 0);
+        context_->PSSetShader(ps_, nullptr, 0);
+        context_->PSSetSamplers(0, 1, &sampler);
+        context_->PSSetShaderResources(0, 1, &texture_srv_);
+        context_->Draw(3, 0);
+    }
+
+    if (overlay) {
+        // GetDC needs the buffer unbound from the pipeline.
+        context_->OMSetRenderTargets(0, nullptr, nullptr);
+        IDXGISurface1* surface = nullptr;
+        if (SUCCEEDED(swap_chain_->GetBuffer(0, IID_PPV_ARGS(&surface)))) {
+            HDC hdc = nullptr;
+            if (SUCCEEDED(surface->GetDC(FALSE, &hdc))) {
+                overlay(hdc);
+                surface->ReleaseDC(nullptr);
+            }
+            surface->Release();
+        }
+    }
+
+    // No vsync wait on the UI thread; the compositor shows the newest frame.
+    HRESULT hr = swap_chain_->Present(0, 0);
+    return hr != DXGI_ERROR_DEVICE_REMOVED && hr != DXGI_ERROR_DEVICE_RESET;
+}
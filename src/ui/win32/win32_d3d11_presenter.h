@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+struct ID3D11Device;
+struct ID3D11DeviceContext;
+struct ID3D11Texture2D;
+struct ID3D11ShaderResourceView;
+struct ID3D11RenderTargetView;
+struct ID3D11VertexShader;
+struct ID3D11PixelShader;
+struct ID3D11SamplerState;
+struct IDXGISwapChain1;
+
+// Presents a 32bpp BGRX framebuffer into a window through a flip-model
+// swapchain. The framebuffer lives in a GPU texture that is updated one
+// dirty rect at a time; scaling happens when the texture is drawn.
+// UI thread only.
+class D3D11Presenter {
+public:
+    using OverlayFn = std::function<void(HDC hdc)>;
+
+    D3D11Presenter() = default;
+    ~D3D11Presenter();
+
+    D3D11Presenter(const D3D11Presenter&) = delete;
+    D3D11Presenter& operator=(const D3D11Presenter&) = delete;
+
+    // Creates the device and the swapchain for `hwnd`.
+    bool Init(HWND hwnd);
+    // Releases everything; Init may be called again afterwards.
+    void Reset();
+    bool IsReady() const { return swap_chain_ != nullptr; }
+
+    // Makes the texture `w` x `h`. Returns true when it was (re)created,
+    // in which case its contents are undefined until fully uploaded.
+    bool EnsureTexture(uint32_t w, uint32_t h);
+    // Copies `rect` of a `stride`-pitched framebuffer into the texture.
+    void Upload(const RECT& rect, const uint8_t* pixels, uint32_t stride);
+
+    // Draws the texture into `dst` of a `cw` x `ch` client area, black
+    // around it, then lets `overlay` paint over the result with GDI.
+    // Returns false if the device was lost; call Reset and Init again.
+    bool Present(int cw, int ch, const RECT& dst, const OverlayFn& overlay);
+
+private:
+    bool CreateShaders();
+    bool ResizeBuffers(int cw, int ch);
+
+    HWND hwnd_ = nullptr;
+    ID3D11Device* device_ = nullptr;
+    ID3D11DeviceContext* context_ = nullptr;
+    IDXGISwapChain1* swap_chain_ = nullptr;
+    ID3D11RenderTargetView* rtv_ = nullptr;
+    ID3D11VertexShader* vs_ = nullptr;
+    ID3D11PixelShader* ps_ = nullptr;
+    ID3D11SamplerState* point_sampler_ = nullptr;
+    ID3D11SamplerState* linear_sampler_ = nullptr;
+    ID3D11Texture2D* texture_ = nullptr;
+    ID3D11ShaderResourceView* texture_srv_ = nullptr;
+    uint32_t tex_width_ = 0;
+    uint32_t tex_height_ = 0;
+    int buffer_width_ = 0;
+    int buffer_height_ = 0;
+    uint32_t swap_chain_flags_ = 0;
+};
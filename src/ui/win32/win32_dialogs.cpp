@@ -3,6 +3,7 @@
 #include "ui/common/i18n.h"
 #include "manager/app_settings.h"
 #include "manager/manager_service.h"
+#include "manager/metrics_export.h"
 
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
@@ -15,6 +16,7 @@
 #include <algorithm>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -203,6 +205,7 @@ enum CreateDlgId {
     IDC_CR_BR_INITRD  = 109,
     IDC_CR_BR_DISK    = 110,
     IDC_CR_BR_LOC     = 111,
+    IDC_CR_LINKED     = 112,
     IDC_CR_OK         = IDOK,
     IDC_CR_CANCEL     = IDCANCEL,
 };
@@ -329,6 +332,7 @@ static INT_PTR CALLBACK CreateDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp)
             req.cpu_count     = (cpu_idx >= 0 && cpu_idx < kNumOptions)
                                     ? kCpuOptions[cpu_idx] : 4;
             req.nat_enabled   = IsDlgButtonChecked(dlg, IDC_CR_NAT) == BST_CHECKED;
+            req.linked_clone  = IsDlgButtonChecked(dlg, IDC_CR_LINKED) == BST_CHECKED;
 
             auto v = ValidateCreateRequest(req);
             if (!v.ok) {
@@ -361,7 +365,7 @@ static INT_PTR CALLBACK CreateDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp)
 bool ShowCreateVmDialog(HWND parent, ManagerService& mgr, std::string* error) {
     using S = i18n::S;
     DlgBuilder b;
-    int W = 260, H = 210;
+    int W = 260, H = 228;
     b.Begin(i18n::tr(S::kDlgCreateVm), 0, 0, W, H,
         WS_POPUP | WS_CAPTION | WS_SYSMENU | DS_CENTER);
 
@@ -386,6 +390,7 @@ bool ShowCreateVmDialog(HWND parent, ManagerService& mgr, std::string* error) {
     b.AddStatic(0,          i18n::tr(S::kDlgLabelVcpus),  lx, y, lw, rh);
     b.AddComboBox(IDC_CR_CPUS,          ex, y-2, ew, 100); y += sp;
     b.AddCheckBox(IDC_CR_NAT, i18n::tr(S::kDlgEnableNat), ex, y, ew, rh); y += sp;
+    b.AddCheckBox(IDC_CR_LINKED, i18n::tr(S::kDlgLinkedClone), ex, y, ew, rh); y += sp;
     b.AddStatic(0,          i18n::tr(S::kDlgLabelLocation), lx, y, lw, rh);
     b.AddEdit(IDC_CR_LOCATION,          ex, y-2, ew_br, rh);
     b.AddButton(IDC_CR_BR_LOC, i18n::tr(S::kDlgBtnBrowse), bx, y-2, bw, rh); y += sp + 4;
@@ -411,6 +416,8 @@ enum EditDlgId {
     IDC_ED_CPUS     = 202,
     IDC_ED_NAT      = 203,
     IDC_ED_WARN     = 204,
+    IDC_ED_NET_RX   = 205,
+    IDC_ED_NET_TX   = 206,
     IDC_ED_OK       = IDOK,
     IDC_ED_CANCEL   = IDCANCEL,
 };
@@ -422,6 +429,14 @@ struct EditDlgData {
     std::string error;
 };
 
+// The record's spec with the sizes the guest has while it runs.
+static VmSpec CurrentSizes(const VmRecord& rec, bool running) {
+    VmSpec spec = rec.spec;
+    if (running && rec.live_cpu_count) spec.cpu_count = rec.live_cpu_count;
+    if (running && rec.live_memory_mb) spec.memory_mb = rec.live_memory_mb;
+    return spec;
+}
+
 static INT_PTR CALLBACK EditDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp) {
     auto* data = reinterpret_cast<EditDlgData*>(GetWindowLongPtrA(dlg, DWLP_USER));
 
@@ -435,26 +450,33 @@ static INT_PTR CALLBACK EditDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp) {
 
         SetDlgItemTextA(dlg, IDC_ED_NAME, data->rec.spec.name.c_str());
 
+        bool running = data->rec.state == VmPowerState::kRunning ||
+                       data->rec.state == VmPowerState::kStarting;
+        // A running guest may have been resized live; its spec keeps the
+        // launch sizes.
+        const VmSpec current = CurrentSizes(data->rec, running);
+
         HWND mem_cb = GetDlgItem(dlg, IDC_ED_MEMORY);
         for (int i = 0; i < kNumOptions; ++i)
             SendMessageA(mem_cb, CB_ADDSTRING, 0, reinterpret_cast<LPARAM>(kMemoryLabels[i]));
         SendMessage(mem_cb, CB_SETCURSEL,
-            MemoryMbToIndex(static_cast<int>(data->rec.spec.memory_mb)), 0);
+            MemoryMbToIndex(static_cast<int>(current.memory_mb)), 0);
 
         HWND cpu_cb = GetDlgItem(dlg, IDC_ED_CPUS);
         for (int i = 0; i < kNumOptions; ++i)
             SendMessageA(cpu_cb, CB_ADDSTRING, 0, reinterpret_cast<LPARAM>(kCpuLabels[i]));
         SendMessage(cpu_cb, CB_SETCURSEL,
-            CpuCountToIndex(static_cast<int>(data->rec.spec.cpu_count)), 0);
+            CpuCountToIndex(static_cast<int>(current.cpu_count)), 0);
 
         CheckDlgButton(dlg, IDC_ED_NAT, data->rec.spec.nat_enabled ? BST_CHECKED : BST_UNCHECKED);
+        SetDlgItemInt(dlg, IDC_ED_NET_RX, data->rec.spec.net_rate_limit.rx_mbps, FALSE);
+        SetDlgItemInt(dlg, IDC_ED_NET_TX, data->rec.spec.net_rate_limit.tx_mbps, FALSE);
 
-        bool running = data->rec.state == VmPowerState::kRunning ||
-                       data->rec.state == VmPowerState::kStarting;
-        EnableWindow(mem_cb, !running);
-        EnableWindow(cpu_cb, !running);
+        // Launched with room to hotplug, the running guest resizes live.
+        EnableWindow(mem_cb, !running || data->rec.max_memory_mb);
+        EnableWindow(cpu_cb, !running || data->rec.max_cpu_count);
 
-        if (running) {
+        if (running && !data->rec.max_memory_mb && !data->rec.max_cpu_count) {
             SetDlgItemTextA(dlg, IDC_ED_WARN, i18n::tr(i18n::S::kCpuMemoryChangeWarning));
         }
 
@@ -478,9 +500,14 @@ static INT_PTR CALLBACK EditDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp) {
             form.cpu_count         = (cpu_idx >= 0 && cpu_idx < kNumOptions)
                                          ? kCpuOptions[cpu_idx] : 4;
             form.nat_enabled       = IsDlgButtonChecked(dlg, IDC_ED_NAT) == BST_CHECKED;
+            // The burst is not on the form; it follows the spec.
+            form.net_rate_limit    = data->rec.spec.net_rate_limit;
+            form.net_rate_limit.rx_mbps = GetDlgItemInt(dlg, IDC_ED_NET_RX, nullptr, FALSE);
+            form.net_rate_limit.tx_mbps = GetDlgItemInt(dlg, IDC_ED_NET_TX, nullptr, FALSE);
             form.apply_on_next_boot = running;
 
-            auto patch = BuildVmPatch(form, data->rec.spec);
+            auto patch = BuildVmPatch(form, CurrentSizes(data->rec, running));
+            if (running && ResizesLive(data->rec, patch)) patch.apply_on_next_boot = false;
             std::string error;
             if (data->mgr->EditVm(data->rec.spec.vm_id, patch, &error)) {
                 data->saved = true;
@@ -507,11 +534,11 @@ bool ShowEditVmDialog(HWND parent, ManagerService& mgr,
                       const VmRecord& rec, std::string* error) {
     using S = i18n::S;
     DlgBuilder b;
-    int W = 220, H = 148;
+    int W = 220, H = 184;
     b.Begin(i18n::tr(S::kDlgEditVm), 0, 0, W, H,
         WS_POPUP | WS_CAPTION | WS_SYSMENU | DS_CENTER);
 
-    int lx = 8, lw = 40, ex = 52, ew = W - 60, y = 8, rh = 14, sp = 18;
+    int lx = 8, lw = 48, ex = 60, ew = W - 68, y = 8, rh = 14, sp = 18;
 
     b.AddStatic(0,         i18n::tr(S::kDlgLabelName),   lx, y, lw, rh);
     b.AddEdit(IDC_ED_NAME,             ex, y-2, ew, rh); y += sp;
@@ -520,6 +547,10 @@ bool ShowEditVmDialog(HWND parent, ManagerService& mgr,
     b.AddStatic(0,         i18n::tr(S::kDlgLabelVcpus),  lx, y, lw, rh);
     b.AddComboBox(IDC_ED_CPUS,         ex, y-2, ew, 100); y += sp;
     b.AddCheckBox(IDC_ED_NAT, i18n::tr(S::kDlgEnableNat), ex, y, ew, rh); y += sp;
+    b.AddStatic(0,         i18n::tr(S::kDlgLabelNetRxMbps), lx, y, lw, rh);
+    b.AddEdit(IDC_ED_NET_RX,           ex, y-2, ew, rh, ES_NUMBER); y += sp;
+    b.AddStatic(0,         i18n::tr(S::kDlgLabelNetTxMbps), lx, y, lw, rh);
+    b.AddEdit(IDC_ED_NET_TX,           ex, y-2, ew, rh, ES_NUMBER); y += sp;
     b.AddStatic(IDC_ED_WARN, "",       lx, y, W - 16, rh); y += sp + 4;
 
     b.AddButton(IDCANCEL, i18n::tr(S::kDlgBtnCancel), W - 110, y, 48, 14);
@@ -711,3 +742,393 @@ void ShowSharedFoldersDialog(HWND parent, ManagerService& mgr, const std::string
     DialogBoxIndirectParamA(GetModuleHandle(nullptr), b.Build(), parent,
         SfDlgProc, reinterpret_cast<LPARAM>(&data));
 }
+
+// ════════════════════════════════════════════════════════════
+// Metrics Dialog
+// ════════════════════════════════════════════════════════════
+
+enum MxDlgId {
+    IDC_MX_LIST    = 400,
+    IDC_MX_EXPORT  = 401,
+    IDC_MX_CLOSE   = IDCANCEL,
+};
+
+static constexpr UINT_PTR kMxTimerId = 1;
+
+struct MxDlgData {
+    ManagerService* mgr;
+    HWND listview;
+};
+
+static void MxRefreshList(MxDlgData* data) {
+    HWND lv = data->listview;
+    auto metrics = data->mgr->CollectMetrics();
+    std::sort(metrics.begin(), metrics.end(),
+              [](const VmMetrics& a, const VmMetrics& b) { return a.name < b.name; });
+
+    SendMessageA(lv, WM_SETREDRAW, FALSE, 0);
+    ListView_DeleteAllItems(lv);
+    char buf[64];
+    for (size_t i = 0; i < metrics.size(); ++i) {
+        const auto& m = metrics[i];
+        LVITEMA item{};
+        item.mask = LVIF_TEXT;
+        item.iItem = static_cast<int>(i);
+        item.pszText = const_cast<char*>(m.name.c_str());
+        int idx = ListView_InsertItem(lv, &item);
+        auto set = [&](int col) { ListView_SetItemText(lv, idx, col, buf); };
+        snprintf(buf, sizeof(buf), "%.0f", m.vcpu_utilization * 100);
+        set(1);
+        snprintf(buf, sizeof(buf), "%.0f", m.exits_per_sec);
+        set(2);
+        snprintf(buf, sizeof(buf), "%.0f / %.0f", m.disk_read_iops, m.disk_write_iops);
+        set(3);
+        snprintf(buf, sizeof(buf), "%.1f / %.1f", m.disk_read_bytes_per_sec / 1e6,
+                 m.disk_write_bytes_per_sec / 1e6);
+        set(4);
+        snprintf(buf, sizeof(buf), "%.0f / %.0f", m.net_rx_pps, m.net_tx_pps);
+        set(5);
+        snprintf(buf, sizeof(buf), "%.1f / %.1f", m.net_rx_bytes_per_sec / 1e6,
+                 m.net_tx_bytes_per_sec / 1e6);
+        set(6);
+        snprintf(buf, sizeof(buf), "%.0f", m.display_fps);
+        set(7);
+        snprintf(buf, sizeof(buf), "%llu MB",
+                 static_cast<unsigned long long>(m.memory_committed_bytes >> 20));
+        set(8);
+    }
+    SendMessageA(lv, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(lv, nullptr, TRUE);
+}
+
+static void MxExport(HWND dlg, MxDlgData* data) {
+    char file_buf[MAX_PATH] = "tenbox-metrics.prom";
+    OPENFILENAMEA ofn{};
+    ofn.lStructSize  = sizeof(ofn);
+    ofn.hwndOwner    = dlg;
+    ofn.lpstrFilter  = "Prometheus (*.prom)\0*.prom\0CSV (*.csv)\0*.csv\0";
+    ofn.lpstrFile    = file_buf;
+    ofn.nMaxFile     = MAX_PATH;
+    ofn.lpstrDefExt  = "prom";
+    ofn.Flags        = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+    if (!GetSaveFileNameA(&ofn)) return;
+
+    // The extension decides, so a name typed with .csv gets CSV whatever
+    // the filter.
+    std::string path(file_buf);
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    auto metrics = data->mgr->CollectMetrics();
+    std::string text = ext == ".csv" ? FormatMetricsCsv(metrics)
+                                     : FormatMetricsPrometheus(metrics);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    if (!out) {
+        MessageBoxA(dlg, i18n::fmt(i18n::S::kMetricsExportFailed, path.c_str()).c_str(),
+            i18n::tr(i18n::S::kError), MB_OK | MB_ICONERROR);
+    }
+}
+
+static INT_PTR CALLBACK MxDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp) {
+    auto* data = reinterpret_cast<MxDlgData*>(GetWindowLongPtrA(dlg, DWLP_USER));
+
+    switch (msg) {
+    case WM_INITDIALOG: {
+        using S = i18n::S;
+        data = reinterpret_cast<MxDlgData*>(lp);
+        SetWindowLongPtrA(dlg, DWLP_USER, reinterpret_cast<LONG_PTR>(data));
+
+        RECT rc;
+        GetClientRect(dlg, &rc);
+        RECT du = {0, 0, 48, 14};
+        MapDialogRect(dlg, &du);
+        int btn_w = du.right, btn_h = du.bottom;
+        int gap = btn_h / 2;
+        // ListView above, buttons along the bottom right
+        int list_w = rc.right - gap * 2;
+        int list_h = rc.bottom - btn_h - gap * 3;
+
+        HWND lv = CreateWindowExA(WS_EX_CLIENTEDGE, WC_LISTVIEWA, "",
+            WS_CHILD | WS_VISIBLE | LVS_REPORT | LVS_SINGLESEL | LVS_NOSORTHEADER,
+            gap, gap, list_w, list_h,
+            dlg, reinterpret_cast<HMENU>(IDC_MX_LIST),
+            GetModuleHandle(nullptr), nullptr);
+        ListView_SetExtendedListViewStyle(lv,
+            LVS_EX_FULLROWSELECT | LVS_EX_GRIDLINES | LVS_EX_DOUBLEBUFFER);
+
+        struct Column { S text; int cx; };
+        const Column kColumns[] = {
+            {S::kMetricsColName, 120},   {S::kMetricsColCpu, 50},
+            {S::kMetricsColExits, 65},   {S::kMetricsColDiskIops, 90},
+            {S::kMetricsColDiskMbs, 95}, {S::kMetricsColNetPps, 95},
+            {S::kMetricsColNetMbs, 95},  {S::kMetricsColFps, 45},
+            {S::kMetricsColMemory, 75},
+        };
+        LVCOLUMNA col{};
+        col.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_FMT;
+        for (int i = 0; i < static_cast<int>(std::size(kColumns)); ++i) {
+            col.fmt = i ? LVCFMT_RIGHT : LVCFMT_LEFT;
+            col.cx = kColumns[i].cx;
+            col.pszText = const_cast<char*>(i18n::tr(kColumns[i].text));
+            ListView_InsertColumn(lv, i, &col);
+        }
+        data->listview = lv;
+
+        int btn_y = rc.bottom - gap - btn_h;
+        MoveWindow(GetDlgItem(dlg, IDC_MX_CLOSE),  rc.right - gap - btn_w, btn_y,
+                   btn_w, btn_h, FALSE);
+        MoveWindow(GetDlgItem(dlg, IDC_MX_EXPORT), rc.right - gap * 2 - btn_w * 2, btn_y,
+                   btn_w, btn_h, FALSE);
+
+        MxRefreshList(data);
+        SetTimer(dlg, kMxTimerId, ipc::MetricsBlock::kIntervalMs, nullptr);
+        return TRUE;
+    }
+
+    case WM_TIMER:
+        if (wp == kMxTimerId) MxRefreshList(data);
+        return TRUE;
+
+    case WM_COMMAND:
+        switch (LOWORD(wp)) {
+        case IDC_MX_EXPORT:
+            MxExport(dlg, data);
+            return TRUE;
+        case IDC_MX_CLOSE:
+            KillTimer(dlg, kMxTimerId);
+            EndDialog(dlg, IDCANCEL);
+            return TRUE;
+        }
+        break;
+
+    case WM_CLOSE:
+        KillTimer(dlg, kMxTimerId);
+        EndDialog(dlg, IDCANCEL);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void ShowMetricsDialog(HWND parent, ManagerService& mgr) {
+    using S = i18n::S;
+    DlgBuilder b;
+    int W = 500, H = 200;
+    b.Begin(i18n::tr(S::kDlgMetrics), 0, 0, W, H,
+        WS_POPUP | WS_CAPTION | WS_SYSMENU | DS_CENTER | DS_SETFONT);
+
+    // Placeholder buttons (positions will be set in WM_INITDIALOG)
+    int btn_h = 14, btn_w = 50;
+    b.AddButton(IDC_MX_EXPORT, i18n::tr(S::kMetricsBtnExport), 0, 0, btn_w, btn_h);
+    b.AddButton(IDC_MX_CLOSE,  i18n::tr(S::kDlgBtnClose),      0, 0, btn_w, btn_h);
+
+    MxDlgData data{&mgr, nullptr};
+    DialogBoxIndirectParamA(GetModuleHandle(nullptr), b.Build(), parent,
+        MxDlgProc, reinterpret_cast<LPARAM>(&data));
+}
+
+// ════════════════════════════════════════════════════════════
+// Disk Limits Dialog
+// ════════════════════════════════════════════════════════════
+
+enum DlDlgId {
+    IDC_DL_IOPS       = 450,
+    IDC_DL_IOPS_BURST = 451,
+    IDC_DL_MBPS       = 452,
+    IDC_DL_BURST_MB   = 453,
+};
+
+struct DlDlgData {
+    ManagerService* mgr;
+    VmRecord rec;
+    bool saved;
+};
+
+static INT_PTR CALLBACK DlDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp) {
+    auto* data = reinterpret_cast<DlDlgData*>(GetWindowLongPtrA(dlg, DWLP_USER));
+
+    switch (msg) {
+    case WM_INITDIALOG: {
+        data = reinterpret_cast<DlDlgData*>(lp);
+        SetWindowLongPtrA(dlg, DWLP_USER, reinterpret_cast<LONG_PTR>(data));
+
+        std::string title = std::string(i18n::tr(i18n::S::kDlgDiskLimits)) + " - " + data->rec.spec.name;
+        SetWindowTextA(dlg, title.c_str());
+
+        const VmSpec& spec = data->rec.spec;
+        SetDlgItemInt(dlg, IDC_DL_IOPS,       spec.disk_iops_limit, FALSE);
+        SetDlgItemInt(dlg, IDC_DL_IOPS_BURST, spec.disk_iops_burst, FALSE);
+        SetDlgItemInt(dlg, IDC_DL_MBPS,       spec.disk_mbps_limit, FALSE);
+        SetDlgItemInt(dlg, IDC_DL_BURST_MB,   spec.disk_burst_mb, FALSE);
+        return TRUE;
+    }
+
+    case WM_COMMAND:
+        switch (LOWORD(wp)) {
+        case IDOK: {
+            uint32_t iops       = GetDlgItemInt(dlg, IDC_DL_IOPS,       nullptr, FALSE);
+            uint32_t iops_burst = GetDlgItemInt(dlg, IDC_DL_IOPS_BURST, nullptr, FALSE);
+            uint32_t mbps       = GetDlgItemInt(dlg, IDC_DL_MBPS,       nullptr, FALSE);
+            uint32_t burst_mb   = GetDlgItemInt(dlg, IDC_DL_BURST_MB,   nullptr, FALSE);
+
+            std::string error;
+            if (data->mgr->SetDiskLimits(data->rec.spec.vm_id, iops, iops_burst,
+                                         mbps, burst_mb, &error)) {
+                data->saved = true;
+                EndDialog(dlg, IDOK);
+            } else {
+                MessageBoxA(dlg, error.c_str(), i18n::tr(i18n::S::kError), MB_OK | MB_ICONERROR);
+            }
+            return TRUE;
+        }
+        case IDCANCEL:
+            EndDialog(dlg, IDCANCEL);
+            return TRUE;
+        }
+        break;
+
+    case WM_CLOSE:
+        EndDialog(dlg, IDCANCEL);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+bool ShowDiskLimitsDialog(HWND parent, ManagerService& mgr, const VmRecord& rec) {
+    using S = i18n::S;
+    DlgBuilder b;
+    int W = 200, H = 130;
+    b.Begin(i18n::tr(S::kDlgDiskLimits), 0, 0, W, H,
+        WS_POPUP | WS_CAPTION | WS_SYSMENU | DS_CENTER);
+
+    int lx = 8, lw = 60, ex = 72, ew = W - 80, y = 8, rh = 14, sp = 18;
+
+    b.AddStatic(0, i18n::tr(S::kDlgLabelDiskIops),      lx, y, lw, rh);
+    b.AddEdit(IDC_DL_IOPS,       ex, y-2, ew, rh, ES_NUMBER); y += sp;
+    b.AddStatic(0, i18n::tr(S::kDlgLabelDiskIopsBurst), lx, y, lw, rh);
+    b.AddEdit(IDC_DL_IOPS_BURST, ex, y-2, ew, rh, ES_NUMBER); y += sp;
+    b.AddStatic(0, i18n::tr(S::kDlgLabelDiskMbps),      lx, y, lw, rh);
+    b.AddEdit(IDC_DL_MBPS,       ex, y-2, ew, rh, ES_NUMBER); y += sp;
+    b.AddStatic(0, i18n::tr(S::kDlgLabelDiskBurstMb),   lx, y, lw, rh);
+    b.AddEdit(IDC_DL_BURST_MB,   ex, y-2, ew, rh, ES_NUMBER); y += sp;
+    b.AddStatic(0, i18n::tr(S::kDlgDiskLimitsHint),     lx, y, W - 16, rh); y += sp + 4;
+
+    b.AddButton(IDCANCEL, i18n::tr(S::kDlgBtnCancel), W - 110, y, 48, 14);
+    b.AddDefButton(IDOK,  i18n::tr(S::kDlgBtnSave),  W - 56, y, 48, 14);
+
+    DlDlgData data{&mgr, rec, false};
+    DialogBoxIndirectParamA(GetModuleHandle(nullptr), b.Build(), parent,
+        DlDlgProc, reinterpret_cast<LPARAM>(&data));
+    return data.saved;
+}
+
+// ════════════════════════════════════════════════════════════
+// Guest File Transfer
+// ════════════════════════════════════════════════════════════
+
+enum GfDlgId {
+    IDC_GF_PATH = 500,
+};
+
+static INT_PTR CALLBACK GfDlgProc(HWND dlg, UINT msg, WPARAM wp, LPARAM lp) {
+    auto* path = reinterpret_cast<std::string*>(GetWindowLongPtrA(dlg, DWLP_USER));
+
+    switch (msg) {
+    case WM_INITDIALOG:
+        SetWindowLongPtrA(dlg, DWLP_USER, lp);
+        path = reinterpret_cast<std::string*>(lp);
+        SetDlgItemTextA(dlg, IDC_GF_PATH, path->c_str());
+        return TRUE;
+
+    case WM_COMMAND:
+        switch (LOWORD(wp)) {
+        case IDOK: {
+            std::string text = GetDlgText(dlg, IDC_GF_PATH);
+            if (text.empty()) return TRUE;
+            *path = text;
+            EndDialog(dlg, IDOK);
+            return TRUE;
+        }
+        case IDCANCEL:
+            EndDialog(dlg, IDCANCEL);
+            return TRUE;
+        }
+        break;
+
+    case WM_CLOSE:
+        EndDialog(dlg, IDCANCEL);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Asks for a path in the guest, starting from `path`.
+static bool AskGuestPath(HWND parent, std::string* path) {
+    using S = i18n::S;
+    DlgBuilder b;
+    int W = 260, H = 62;
+    b.Begin(i18n::tr(S::kDlgGuestFile), 0, 0, W, H,
+        WS_POPUP | WS_CAPTION | WS_SYSMENU | DS_CENTER);
+    b.AddStatic(0, i18n::tr(S::kDlgLabelGuestPath), 8, 8, W - 16, 10);
+    b.AddEdit(IDC_GF_PATH, 8, 20, W - 16, 14);
+    b.AddButton(IDCANCEL, i18n::tr(S::kDlgBtnCancel), W - 110, 42, 48, 14);
+    b.AddDefButton(IDOK,  i18n::tr(S::kDlgBtnOk),     W - 56, 42, 48, 14);
+    return DialogBoxIndirectParamA(GetModuleHandle(nullptr), b.Build(), parent,
+        GfDlgProc, reinterpret_cast<LPARAM>(path)) == IDOK;
+}
+
+bool ShowSendFileDialog(HWND parent, std::string* host_path, std::string* guest_path) {
+    char file_buf[MAX_PATH] = "";
+    OPENFILENAMEA ofn{};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner   = parent;
+    ofn.lpstrFilter = "All files (*.*)\0*.*\0";
+    ofn.lpstrFile   = file_buf;
+    ofn.nMaxFile    = MAX_PATH;
+    ofn.Flags       = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+    if (!GetOpenFileNameA(&ofn)) return false;
+
+    *host_path = file_buf;
+    *guest_path = std::string("/tmp/") + (file_buf + ofn.nFileOffset);
+    return AskGuestPath(parent, guest_path);
+}
+
+bool ShowReceiveFileDialog(HWND parent, std::string* guest_path, std::string* host_path) {
+    if (!AskGuestPath(parent, guest_path)) return false;
+
+    // The guest's name for the file, whichever separator it uses.
+    size_t sep = guest_path->find_last_of("/\\");
+    std::string name = sep == std::string::npos ? *guest_path : guest_path->substr(sep + 1);
+    char file_buf[MAX_PATH] = "";
+    strncpy_s(file_buf, name.c_str(), _TRUNCATE);
+    OPENFILENAMEA ofn{};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner   = parent;
+    ofn.lpstrFilter = "All files (*.*)\0*.*\0";
+    ofn.lpstrFile   = file_buf;
+    ofn.nMaxFile    = MAX_PATH;
+    ofn.Flags       = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+    if (!GetSaveFileNameA(&ofn)) return false;
+
+    *host_path = file_buf;
+    return true;
+}
+
+bool ShowNetCaptureFileDialog(HWND parent, const std::string& vm_name, std::string* path) {
+    char file_buf[MAX_PATH] = "";
+    std::string name = vm_name + ".pcapng";
+    strncpy_s(file_buf, name.c_str(), _TRUNCATE);
+    OPENFILENAMEA ofn{};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner   = parent;
+    ofn.lpstrFilter = "pcapng (*.pcapng)\0*.pcapng\0All files (*.*)\0*.*\0";
+    ofn.lpstrFile   = file_buf;
+    ofn.nMaxFile    = MAX_PATH;
+    ofn.lpstrDefExt = "pcapng";
+    ofn.Flags       = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+    if (!GetSaveFileNameA(&ofn)) return false;
+
+    *path = file_buf;
+    return true;
+}
@@ -14,5 +14,22 @@ bool ShowCreateVmDialog(HWND parent, ManagerService& mgr, std::string* error);
 bool ShowEditVmDialog(HWND parent, ManagerService& mgr,
                       const VmRecord& rec, std::string* error);
 
+// Modal dialog for a VM's disk throttling; a running VM applies the new
+// limits at once. True if they were saved.
+bool ShowDiskLimitsDialog(HWND parent, ManagerService& mgr, const VmRecord& rec);
+
 // Modal dialog for managing shared folders of a VM.
 void ShowSharedFoldersDialog(HWND parent, ManagerService& mgr, const std::string& vm_id);
+
+// Modal dialog with live metrics of all running VMs, refreshed every
+// second and exportable as Prometheus text or CSV.
+void ShowMetricsDialog(HWND parent, ManagerService& mgr);
+
+// Pick a host file and where it goes in the guest, or a guest file and
+// where it goes on the host. False if the user cancelled.
+bool ShowSendFileDialog(HWND parent, std::string* host_path, std::string* guest_path);
+bool ShowReceiveFileDialog(HWND parent, std::string* guest_path, std::string* host_path);
+
+// Pick the pcapng file a network capture of `vm_name` goes to. False if
+// the user cancelled.
+bool ShowNetCaptureFileDialog(HWND parent, const std::string& vm_name, std::string* path);
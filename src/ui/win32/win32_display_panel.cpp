@@ -18,8 +18,9 @@ DisplayPanel::DisplayPanel() = default;
 
 DisplayPanel::~DisplayPanel() {
     SetCaptured(false);
+    presenter_.Reset();
     if (hwnd_) DestroyWindow(hwnd_);
-    if (custom_cursor_) DestroyCursor(custom_cursor_);
+    for (auto& entry : cursor_cache_) DestroyCursor(entry.second);
 }
 
 static void RegisterPanelClass(HINSTANCE hinst) {
@@ -73,6 +74,7 @@ void DisplayPanel::UpdateFrame(const DisplayFrame& frame) {
         fb_width_ = rw;
         fb_height_ = rh;
         framebuffer_.resize(static_cast<size_t>(rw) * rh * 4, 0);
+        dirty_all_ = true;
     }
 
     // Blit dirty rectangle into framebuffer
@@ -80,17 +82,16 @@ void DisplayPanel::UpdateFrame(const DisplayFrame& frame) {
     uint32_t dy = frame.dirty_y;
     uint32_t dw = frame.width;
     uint32_t dh = frame.height;
-    uint32_t src_stride = dw * 4;
     uint32_t dst_stride = fb_width_ * 4;
 
     for (uint32_t row = 0; row < dh; ++row) {
-        uint32_t src_off = row * src_stride;
+        const uint8_t* src = frame.Row(row);
         uint32_t dst_off = (dy + row) * dst_stride + dx * 4;
-        if (src_off + src_stride > frame.pixels.size()) break;
+        if (!src) break;
         if (dst_off + dw * 4 > framebuffer_.size()) break;
-        std::memcpy(framebuffer_.data() + dst_off,
-                    frame.pixels.data() + src_off, dw * 4);
+        std::memcpy(framebuffer_.data() + dst_off, src, dw * 4);
     }
+    MarkDirty(dx, dy, dw, dh);
 
     if (hwnd_) {
         InvalidateRect(hwnd_, nullptr, FALSE);
@@ -108,6 +109,7 @@ void DisplayPanel::AdoptFramebuffer(uint32_t w, uint32_t h, const uint8_t* src,
         framebuffer_.resize(expected);
     }
     std::memcpy(framebuffer_.data(), src, expected);
+    dirty_all_ = true;
 
     if (hwnd_) {
         InvalidateRect(hwnd_, nullptr, FALSE);
@@ -119,6 +121,7 @@ void DisplayPanel::RestoreFramebuffer(uint32_t w, uint32_t h, const std::vector<
     fb_width_ = w;
     fb_height_ = h;
     framebuffer_ = pixels;
+    dirty_all_ = true;
     if (hwnd_) {
         InvalidateRect(hwnd_, nullptr, FALSE);
     }
@@ -130,135 +133,112 @@ void DisplayPanel::Clear() {
         fb_width_ = 0;
         fb_height_ = 0;
         framebuffer_.clear();
+        dirty_all_ = true;
     }
     {
         std::lock_guard<std::mutex> lock(cursor_mutex_);
-        if (custom_cursor_) {
-            DestroyCursor(custom_cursor_);
-            custom_cursor_ = nullptr;
-        }
+        custom_cursor_ = nullptr;
     }
     if (hwnd_) {
         InvalidateRect(hwnd_, nullptr, TRUE);
     }
 }
 
-void DisplayPanel::UpdateCursor(const CursorInfo& cursor) {
-    if (!cursor.image_updated || cursor.width == 0 || cursor.height == 0) {
+void DisplayPanel::MarkDirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    if (dirty_all_ || w == 0 || h == 0) return;
+    if (dirty_rects_.size() >= kMaxDirtyRects) {
+        dirty_all_ = true;
+        dirty_rects_.clear();
         return;
     }
+    dirty_rects_.push_back({static_cast<LONG>(x), static_cast<LONG>(y),
+                            static_cast<LONG>(x + w), static_cast<LONG>(y + h)});
+}
 
-    HCURSOR new_cursor = nullptr;
-    if (cursor.visible && !cursor.pixels.empty()) {
-        uint32_t w = cursor.width;
-        uint32_t h = cursor.height;
-
-        BITMAPV5HEADER bi{};
-        bi.bV5Size = sizeof(BITMAPV5HEADER);
-        bi.bV5Width = static_cast<LONG>(w);
-        bi.bV5Height = -static_cast<LONG>(h);  // Top-down
-        bi.bV5Planes = 1;
-        bi.bV5BitCount = 32;
-        bi.bV5Compression = BI_BITFIELDS;
-        bi.bV5RedMask = 0x00FF0000;
-        bi.bV5GreenMask = 0x0000FF00;
-        bi.bV5BlueMask = 0x000000FF;
-        bi.bV5AlphaMask = 0xFF000000;
-
-        HDC hdc = GetDC(nullptr);
-        void* bits = nullptr;
-        HBITMAP color_bmp = CreateDIBSection(hdc, reinterpret_cast<BITMAPINFO*>(&bi),
-            DIB_RGB_COLORS, &bits, nullptr, 0);
-        if (color_bmp && bits) {
-            std::memcpy(bits, cursor.pixels.data(),
-                (std::min)(cursor.pixels.size(), static_cast<size_t>(w * h * 4)));
-
-            HBITMAP mask_bmp = CreateBitmap(static_cast<int>(w), static_cast<int>(h), 1, 1, nullptr);
-
-            ICONINFO ii{};
-            ii.fIcon = FALSE;
-            ii.xHotspot = cursor.hot_x;
-            ii.yHotspot = cursor.hot_y;
-            ii.hbmMask = mask_bmp;
-            ii.hbmColor = color_bmp;
-            new_cursor = CreateIconIndirect(&ii);
-
-            DeleteObject(mask_bmp);
-            DeleteObject(color_bmp);
-        }
-        ReleaseDC(nullptr, hdc);
-    }
+static HCURSOR CreateCursorFromPixels(const CursorInfo& cursor,
+                                      const std::vector<uint8_t>& pixels) {
+    uint32_t w = cursor.width;
+    uint32_t h = cursor.height;
+
+    BITMAPV5HEADER bi{};
+    bi.bV5Size = sizeof(BITMAPV5HEADER);
+    bi.bV5Width = static_cast<LONG>(w);
+    bi.bV5Height = -static_cast<LONG>(h);  // Top-down
+    bi.bV5Planes = 1;
+    bi.bV5BitCount = 32;
+    bi.bV5Compression = BI_BITFIELDS;
+    bi.bV5RedMask = 0x00FF0000;
+    bi.bV5GreenMask = 0x0000FF00;
+    bi.bV5BlueMask = 0x000000FF;
+    bi.bV5AlphaMask = 0xFF000000;
+
+    HCURSOR result = nullptr;
+    HDC hdc = GetDC(nullptr);
+    void* bits = nullptr;
+    HBITMAP color_bmp = CreateDIBSection(hdc, reinterpret_cast<BITMAPINFO*>(&bi),
+        DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (color_bmp && bits) {
+        std::memcpy(bits, pixels.data(),
+            (std::min)(pixels.size(), static_cast<size_t>(w * h * 4)));
+
+        HBITMAP mask_bmp = CreateBitmap(static_cast<int>(w), static_cast<int>(h), 1, 1, nullptr);
+
+        ICONINFO ii{};
+        ii.fIcon = FALSE;
+        ii.xHotspot = cursor.hot_x;
+        ii.yHotspot = cursor.hot_y;
+        ii.hbmMask = mask_bmp;
+        ii.hbmColor = color_bmp;
+        result = CreateIconIndirect(&ii);
+
+        DeleteObject(mask_bmp);
+    }
+    if (color_bmp) DeleteObject(color_bmp);
+    ReleaseDC(nullptr, hdc);
+    return result;
+}
 
-    {
-        std::lock_guard<std::mutex> lock(cursor_mutex_);
-        if (custom_cursor_) {
-            DestroyCursor(custom_cursor_);
+void DisplayPanel::SetCursorImage(const CursorInfo& cursor, const std::vector<uint8_t>& pixels) {
+    std::lock_guard<std::mutex> lock(cursor_mutex_);
+    HCURSOR new_cursor = nullptr;
+    if (cursor.visible) {
+        auto it = cursor.image_id == 0 ? cursor_cache_.end() :
+            std::find_if(cursor_cache_.begin(), cursor_cache_.end(),
+                [&](const auto& entry) { return entry.first == cursor.image_id; });
+        if (it != cursor_cache_.end()) {
+            new_cursor = it->second;
+        } else if (!pixels.empty()) {
+            new_cursor = CreateCursorFromPixels(cursor, pixels);
+            if (new_cursor) {
+                cursor_cache_.emplace_back(cursor.image_id, new_cursor);
+                if (cursor_cache_.size() > kCursorImageCacheSize) {
+                    // Never the new one, so never custom_cursor_ after this.
+                    DestroyCursor(cursor_cache_.front().second);
+                    cursor_cache_.pop_front();
+                }
+            }
         }
-        custom_cursor_ = new_cursor;
     }
+    custom_cursor_ = new_cursor;
 
     if (hwnd_ && new_cursor) {
         SetCursor(new_cursor);
     }
 }
 
-void DisplayPanel::RestoreCursor(const CursorInfo& cursor, const std::vector<uint8_t>& pixels) {
-    if (cursor.width == 0 || cursor.height == 0 || pixels.empty()) {
+void DisplayPanel::UpdateCursor(const CursorInfo& cursor) {
+    // Moves need nothing here: the host pointer is the cursor.
+    if (!cursor.image_updated || cursor.width == 0 || cursor.height == 0) {
         return;
     }
+    SetCursorImage(cursor, cursor.pixels);
+}
 
-    HCURSOR new_cursor = nullptr;
-    if (cursor.visible) {
-        uint32_t w = cursor.width;
-        uint32_t h = cursor.height;
-
-        BITMAPV5HEADER bi{};
-        bi.bV5Size = sizeof(BITMAPV5HEADER);
-        bi.bV5Width = static_cast<LONG>(w);
-        bi.bV5Height = -static_cast<LONG>(h);
-        bi.bV5Planes = 1;
-        bi.bV5BitCount = 32;
-        bi.bV5Compression = BI_BITFIELDS;
-        bi.bV5RedMask = 0x00FF0000;
-        bi.bV5GreenMask = 0x0000FF00;
-        bi.bV5BlueMask = 0x000000FF;
-        bi.bV5AlphaMask = 0xFF000000;
-
-        HDC hdc = GetDC(nullptr);
-        void* bits = nullptr;
-        HBITMAP color_bmp = CreateDIBSection(hdc, reinterpret_cast<BITMAPINFO*>(&bi),
-            DIB_RGB_COLORS, &bits, nullptr, 0);
-        if (color_bmp && bits) {
-            std::memcpy(bits, pixels.data(),
-                (std::min)(pixels.size(), static_cast<size_t>(w * h * 4)));
-
-            HBITMAP mask_bmp = CreateBitmap(static_cast<int>(w), static_cast<int>(h), 1, 1, nullptr);
-
-            ICONINFO ii{};
-            ii.fIcon = FALSE;
-            ii.xHotspot = cursor.hot_x;
-            ii.yHotspot = cursor.hot_y;
-            ii.hbmMask = mask_bmp;
-            ii.hbmColor = color_bmp;
-            new_cursor = CreateIconIndirect(&ii);
-
-            DeleteObject(mask_bmp);
-            DeleteObject(color_bmp);
-        }
-        ReleaseDC(nullptr, hdc);
-    }
-
-    {
-        std::lock_guard<std::mutex> lock(cursor_mutex_);
-        if (custom_cursor_) {
-            DestroyCursor(custom_cursor_);
-        }
-        custom_cursor_ = new_cursor;
-    }
-
-    if (hwnd_ && new_cursor) {
-        SetCursor(new_cursor);
+void DisplayPanel::RestoreCursor(const CursorInfo& cursor, const std::vector<uint8_t>& pixels) {
+    if (cursor.width == 0 || cursor.height == 0 || pixels.empty()) {
+        return;
     }
+    SetCursorImage(cursor, pixels);
 }
 
 void DisplayPanel::SetBounds(int x, int y, int w, int h) {
@@ -276,6 +256,16 @@ void DisplayPanel::CalcDisplayRect(int cw, int ch, RECT* out) const {
     }
     int dw = static_cast<int>(fb_width_);
     int dh = static_cast<int>(fb_height_);
+    // Shrink a screen larger than the panel to fit, keeping its aspect.
+    if (dw > cw || dh > ch) {
+        if (static_cast<int64_t>(cw) * dh <= static_cast<int64_t>(ch) * dw) {
+            dh = (std::max)(1, static_cast<int>(static_cast<int64_t>(dh) * cw / dw));
+            dw = cw;
+        } else {
+            dw = (std::max)(1, static_cast<int>(static_cast<int64_t>(dw) * ch / dh));
+            dh = ch;
+        }
+    }
     int dx = (cw - dw) / 2;
     int dy = (ch - dh) / 2;
     if (dx < 0) dx = 0;
@@ -289,6 +279,57 @@ void DisplayPanel::OnPaint() {
 
     RECT rc;
     GetClientRect(hwnd_, &rc);
+    if (use_gdi_ || !PaintD3D(rc)) {
+        PaintGdi(hdc, rc);
+    }
+
+    EndPaint(hwnd_, &ps);
+}
+
+bool DisplayPanel::PaintD3D(const RECT& rc) {
+    if (!presenter_.IsReady()) {
+        if (!presenter_.Init(hwnd_)) {
+            use_gdi_ = true;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(fb_mutex_);
+        dirty_all_ = true;
+    }
+
+    RECT dst;
+    {
+        std::lock_guard<std::mutex> lock(fb_mutex_);
+        if (presenter_.EnsureTexture(fb_width_, fb_height_)) dirty_all_ = true;
+        uint32_t stride = fb_width_ * 4;
+        if (framebuffer_.size() >= static_cast<size_t>(stride) * fb_height_) {
+            if (dirty_all_) {
+                RECT all = {0, 0, static_cast<LONG>(fb_width_), static_cast<LONG>(fb_height_)};
+                presenter_.Upload(all, framebuffer_.data(), stride);
+            } else {
+                for (const RECT& r : dirty_rects_) {
+                    presenter_.Upload(r, framebuffer_.data(), stride);
+                }
+            }
+        }
+        dirty_all_ = false;
+        dirty_rects_.clear();
+        CalcDisplayRect(rc.right, rc.bottom, &dst);
+    }
+
+    D3D11Presenter::OverlayFn overlay;
+    if (captured_ && capture_hint_visible_) {
+        overlay = [this, &rc](HDC hdc) { DrawCaptureHint(hdc, rc); };
+    }
+    if (!presenter_.Present(rc.right, rc.bottom, dst, overlay)) {
+        // Device lost; GDI covers this paint and the next one rebuilds.
+        presenter_.Reset();
+        InvalidateRect(hwnd_, nullptr, FALSE);
+        return false;
+    }
+    return true;
+}
+
+void DisplayPanel::PaintGdi(HDC hdc, const RECT& rc) {
     int cw = rc.right;
     int ch = rc.bottom;
 
@@ -323,57 +364,70 @@ void DisplayPanel::OnPaint() {
             FillRect(hdc, &bar, black);
         }
 
-        SetDIBitsToDevice(hdc,
-            dst.left, dst.top,
-            fb_width_, fb_height_,
-            0, 0,
-            0, fb_height_,
-            framebuffer_.data(), &bmi, DIB_RGB_COLORS);
+        int dw = dst.right - dst.left;
+        int dh = dst.bottom - dst.top;
+        if (dw == static_cast<int>(fb_width_) && dh == static_cast<int>(fb_height_)) {
+            SetDIBitsToDevice(hdc,
+                dst.left, dst.top,
+                fb_width_, fb_height_,
+                0, 0,
+                0, fb_height_,
+                framebuffer_.data(), &bmi, DIB_RGB_COLORS);
+        } else {
+            SetStretchBltMode(hdc, HALFTONE);
+            SetBrushOrgEx(hdc, 0, 0, nullptr);
+            StretchDIBits(hdc,
+                dst.left, dst.top, dw, dh,
+                0, 0, fb_width_, fb_height_,
+                framebuffer_.data(), &bmi, DIB_RGB_COLORS, SRCCOPY);
+        }
     } else {
         HBRUSH black = reinterpret_cast<HBRUSH>(GetStockObject(BLACK_BRUSH));
         RECT fb_area = {0, 0, cw, ch};
         FillRect(hdc, &fb_area, black);
     }
 
-    // Overlay a compact hint pill at top-center
     if (captured_ && capture_hint_visible_) {
-        const char* hint = i18n::tr(i18n::S::kDisplayHintCaptured);
-        std::wstring hint_w = i18n::to_wide(hint);
-
-        HFONT font = static_cast<HFONT>(GetStockObject(DEFAULT_GUI_FONT));
-        HFONT old_font = static_cast<HFONT>(SelectObject(hdc, font));
-        SIZE text_sz{};
-        GetTextExtentPoint32W(hdc, hint_w.c_str(),
-            static_cast<int>(hint_w.size()), &text_sz);
-        SelectObject(hdc, old_font);
-
-        int pad_x = 12;
-        int pad_y = 4;
-        int pill_w = text_sz.cx + pad_x * 2;
-        int pill_h = text_sz.cy + pad_y * 2;
-        int pill_x = (rc.right - pill_w) / 2;
-        int pill_y = 6;
-
-        RECT pill_rc = {pill_x, pill_y, pill_x + pill_w, pill_y + pill_h};
-        HBRUSH bg_brush = CreateSolidBrush(RGB(48, 48, 48));
-        HPEN null_pen = static_cast<HPEN>(GetStockObject(NULL_PEN));
-        HBRUSH old_brush = static_cast<HBRUSH>(SelectObject(hdc, bg_brush));
-        HPEN old_pen = static_cast<HPEN>(SelectObject(hdc, null_pen));
-        RoundRect(hdc, pill_rc.left, pill_rc.top,
-            pill_rc.right + 1, pill_rc.bottom + 1, 8, 8);
-        SelectObject(hdc, old_brush);
-        SelectObject(hdc, old_pen);
-        DeleteObject(bg_brush);
-
-        SetBkMode(hdc, TRANSPARENT);
-        SetTextColor(hdc, RGB(255, 255, 255));
-        old_font = static_cast<HFONT>(SelectObject(hdc, font));
-        DrawTextW(hdc, hint_w.c_str(), -1, &pill_rc,
-            DT_CENTER | DT_VCENTER | DT_SINGLELINE);
-        SelectObject(hdc, old_font);
+        DrawCaptureHint(hdc, rc);
     }
+}
 
-    EndPaint(hwnd_, &ps);
+// Compact hint pill at top-center.
+void DisplayPanel::DrawCaptureHint(HDC hdc, const RECT& rc) {
+    const char* hint = i18n::tr(i18n::S::kDisplayHintCaptured);
+    std::wstring hint_w = i18n::to_wide(hint);
+
+    HFONT font = static_cast<HFONT>(GetStockObject(DEFAULT_GUI_FONT));
+    HFONT old_font = static_cast<HFONT>(SelectObject(hdc, font));
+    SIZE text_sz{};
+    GetTextExtentPoint32W(hdc, hint_w.c_str(),
+        static_cast<int>(hint_w.size()), &text_sz);
+    SelectObject(hdc, old_font);
+
+    int pad_x = 12;
+    int pad_y = 4;
+    int pill_w = text_sz.cx + pad_x * 2;
+    int pill_h = text_sz.cy + pad_y * 2;
+    int pill_x = (rc.right - pill_w) / 2;
+    int pill_y = 6;
+
+    RECT pill_rc = {pill_x, pill_y, pill_x + pill_w, pill_y + pill_h};
+    HBRUSH bg_brush = CreateSolidBrush(RGB(48, 48, 48));
+    HPEN null_pen = static_cast<HPEN>(GetStockObject(NULL_PEN));
+    HBRUSH old_brush = static_cast<HBRUSH>(SelectObject(hdc, bg_brush));
+    HPEN old_pen = static_cast<HPEN>(SelectObject(hdc, null_pen));
+    RoundRect(hdc, pill_rc.left, pill_rc.top,
+        pill_rc.right + 1, pill_rc.bottom + 1, 8, 8);
+    SelectObject(hdc, old_brush);
+    SelectObject(hdc, old_pen);
+    DeleteObject(bg_brush);
+
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, RGB(255, 255, 255));
+    old_font = static_cast<HFONT>(SelectObject(hdc, font));
+    DrawTextW(hdc, hint_w.c_str(), -1, &pill_rc,
+        DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    SelectObject(hdc, old_font);
 }
 
 void DisplayPanel::HandleKey(UINT msg, WPARAM wp, LPARAM lp) {
@@ -459,15 +513,6 @@ void DisplayPanel::HandleMouse(UINT msg, WPARAM wp, LPARAM lp) {
     if (!buttons_changed && abs_x == last_abs_x_ && abs_y == last_abs_y_)
         return;
 
-    // Throttle pure move events to avoid flooding the pipe.
-    // Button state changes are always sent immediately.
-    if (!buttons_changed) {
-        DWORD now = GetTickCount();
-        if (now - last_pointer_tick_ < kPointerMinIntervalMs)
-            return;
-        last_pointer_tick_ = now;
-    }
-
     last_abs_x_ = abs_x;
     last_abs_y_ = abs_y;
     last_sent_buttons_ = mouse_buttons_;
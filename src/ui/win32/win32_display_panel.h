@@ -1,7 +1,9 @@
 #pragma once
 
 #include "common/ports.h"
+#include "ui/win32/win32_d3d11_presenter.h"
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <string>
@@ -11,7 +13,8 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
-// A Win32 child window that renders a VM framebuffer 1:1 (centered).
+// A Win32 child window that renders a VM framebuffer centered, 1:1 or
+// shrunk to fit. Presents through Direct3D 11 when available, GDI otherwise.
 // When focused, captures keyboard and mouse input and forwards them to the VM.
 class DisplayPanel {
 public:
@@ -43,8 +46,8 @@ public:
     // Clear the framebuffer and cursor (e.g. when switching to a VM with no display).
     void Clear();
 
-    // Update the cursor image and/or position.
-    // Thread-safe; triggers InvalidateRect.
+    // Switch to the cursor image in `cursor` if it changed; moves are
+    // ignored. Thread-safe; never repaints the framebuffer.
     void UpdateCursor(const CursorInfo& cursor);
 
     // Restore cursor from cached state (e.g. when switching back to a VM).
@@ -63,9 +66,14 @@ public:
 
 private:
     void OnPaint();
+    bool PaintD3D(const RECT& rc);
+    void PaintGdi(HDC hdc, const RECT& rc);
+    void DrawCaptureHint(HDC hdc, const RECT& rc);
+    void MarkDirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
     void HandleKey(UINT msg, WPARAM wp, LPARAM lp);
     void HandleMouse(UINT msg, WPARAM wp, LPARAM lp);
     void CalcDisplayRect(int cw, int ch, RECT* out) const;
+    void SetCursorImage(const CursorInfo& cursor, const std::vector<uint8_t>& pixels);
 
     void SetCaptured(bool captured);
     void InstallKeyboardHook();
@@ -76,11 +84,9 @@ private:
     bool captured_ = false;
     uint32_t mouse_buttons_ = 0;
     HHOOK kb_hook_ = nullptr;
-    DWORD last_pointer_tick_ = 0;
     int32_t last_abs_x_ = -1;
     int32_t last_abs_y_ = -1;
     uint32_t last_sent_buttons_ = 0;
-    static constexpr DWORD kPointerMinIntervalMs = 20;
 
     // Capture hint: show once per process, auto-hide after 3 seconds
     DWORD capture_hint_start_ = 0;
@@ -94,9 +100,19 @@ private:
     uint32_t fb_width_ = 0;
     uint32_t fb_height_ = 0;
     std::vector<uint8_t> framebuffer_;
+    // Framebuffer areas not yet uploaded to the presenter's texture.
+    std::vector<RECT> dirty_rects_;
+    bool dirty_all_ = true;
+    static constexpr size_t kMaxDirtyRects = 16;
+
+    // Set for good once the presenter fails to initialize.
+    D3D11Presenter presenter_;
+    bool use_gdi_ = false;
 
-    // Cursor state
+    // Cursors built from guest images, keyed by CursorInfo::image_id and
+    // evicted oldest first. custom_cursor_ is one of them, or null.
     std::mutex cursor_mutex_;
+    std::deque<std::pair<uint64_t, HCURSOR>> cursor_cache_;
     HCURSOR custom_cursor_ = nullptr;
 
     KeyEventCallback key_cb_;
@@ -0,0 +1,142 @@
+#include "ui/win32/win32_display_window.h"
+#include "manager/resource.h"
+
+#include <algorithm>
+
+static const char* kDisplayWindowClass = "TenBoxDisplayWindow";
+static bool g_class_registered = false;
+
+static void RegisterWindowClass(HINSTANCE hinst) {
+    if (g_class_registered) return;
+    WNDCLASSEXA wc{};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = DisplayWindow::WndProc;
+    wc.hInstance = hinst;
+    wc.hCursor = LoadCursor(nullptr, IDC_ARROW);
+    wc.hbrBackground = reinterpret_cast<HBRUSH>(GetStockObject(BLACK_BRUSH));
+    wc.lpszClassName = kDisplayWindowClass;
+    wc.hIcon = static_cast<HICON>(LoadImageA(hinst, MAKEINTRESOURCEA(IDI_APP_ICON),
+                                             IMAGE_ICON, 0, 0, LR_DEFAULTSIZE | LR_SHARED));
+    RegisterClassExA(&wc);
+    g_class_registered = true;
+}
+
+DisplayWindow::~DisplayWindow() {
+    if (hwnd_) DestroyWindow(hwnd_);
+}
+
+bool DisplayWindow::Create(HINSTANCE hinst) {
+    RegisterWindowClass(hinst);
+    hwnd_ = CreateWindowExA(
+        0, kDisplayWindowClass, nullptr, WS_OVERLAPPEDWINDOW,
+        CW_USEDEFAULT, CW_USEDEFAULT, 800, 600,
+        nullptr, nullptr, hinst, this);
+    if (!hwnd_) return false;
+    RECT rc;
+    GetClientRect(hwnd_, &rc);
+    return panel_.Create(hwnd_, hinst, 0, 0, rc.right, rc.bottom);
+}
+
+void DisplayWindow::SetTitle(const std::string& title) {
+    if (hwnd_) SetWindowTextA(hwnd_, title.c_str());
+}
+
+void DisplayWindow::ShowForDisplay(uint32_t width, uint32_t height) {
+    if (!hwnd_ || width == 0 || height == 0) return;
+    last_width_ = width & ~7u;
+    last_height_ = height;
+
+    // The panel's client edge sits inside our client area.
+    int edge_w = GetSystemMetrics(SM_CXEDGE) * 2;
+    int edge_h = GetSystemMetrics(SM_CYEDGE) * 2;
+    RECT wr = {0, 0, static_cast<LONG>(width) + edge_w, static_cast<LONG>(height) + edge_h};
+    DWORD style = static_cast<DWORD>(GetWindowLongPtr(hwnd_, GWL_STYLE));
+    DWORD ex_style = static_cast<DWORD>(GetWindowLongPtr(hwnd_, GWL_EXSTYLE));
+    AdjustWindowRectEx(&wr, style, FALSE, ex_style);
+
+    HMONITOR hmon = MonitorFromWindow(hwnd_, MONITOR_DEFAULTTONEAREST);
+    MONITORINFO mi = {sizeof(mi)};
+    GetMonitorInfo(hmon, &mi);
+    int new_w = (std::min)(static_cast<int>(wr.right - wr.left),
+                           static_cast<int>(mi.rcWork.right - mi.rcWork.left));
+    int new_h = (std::min)(static_cast<int>(wr.bottom - wr.top),
+                           static_cast<int>(mi.rcWork.bottom - mi.rcWork.top));
+
+    sizing_ = true;
+    SetWindowPos(hwnd_, nullptr, 0, 0, new_w, new_h,
+                 SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+    sizing_ = false;
+    if (!IsWindowVisible(hwnd_)) {
+        ShowWindow(hwnd_, SW_SHOWNOACTIVATE);
+        if (visibility_cb_) visibility_cb_();
+    }
+}
+
+void DisplayWindow::Hide() {
+    if (!hwnd_) return;
+    KillTimer(hwnd_, kResizeTimerId);
+    if (!ShowWindow(hwnd_, SW_HIDE)) return;  // was hidden already
+    if (visibility_cb_) visibility_cb_();
+}
+
+void DisplayWindow::OnSize() {
+    RECT rc;
+    GetClientRect(hwnd_, &rc);
+    panel_.SetBounds(0, 0, rc.right, rc.bottom);
+    if (!sizing_ && !IsIconic(hwnd_)) {
+        SetTimer(hwnd_, kResizeTimerId, kResizeDebounceMs, nullptr);
+    }
+    bool iconic = IsIconic(hwnd_) != FALSE;
+    if (iconic != iconic_) {
+        iconic_ = iconic;
+        if (visibility_cb_) visibility_cb_();
+    }
+}
+
+LRESULT CALLBACK DisplayWindow::WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
+    DisplayWindow* self = nullptr;
+    if (msg == WM_NCCREATE) {
+        auto* cs = reinterpret_cast<CREATESTRUCTA*>(lp);
+        self = reinterpret_cast<DisplayWindow*>(cs->lpCreateParams);
+        SetWindowLongPtrA(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(self));
+    } else {
+        self = reinterpret_cast<DisplayWindow*>(GetWindowLongPtrA(hwnd, GWLP_USERDATA));
+    }
+
+    if (!self) return DefWindowProcA(hwnd, msg, wp, lp);
+
+    switch (msg) {
+    case WM_SIZE:
+        self->OnSize();
+        return 0;
+
+    case WM_TIMER:
+        if (wp == kResizeTimerId) {
+            KillTimer(hwnd, kResizeTimerId);
+            RECT rc;
+            GetClientRect(self->panel_.Handle(), &rc);
+            uint32_t w = rc.right > 0 ? (static_cast<uint32_t>(rc.right) & ~7u) : 0;
+            uint32_t h = rc.bottom > 0 ? static_cast<uint32_t>(rc.bottom) : 0;
+            if (w > 0 && h > 0 && (w != self->last_width_ || h != self->last_height_)) {
+                self->last_width_ = w;
+                self->last_height_ = h;
+                if (self->resize_cb_) self->resize_cb_(w, h);
+            }
+        }
+        return 0;
+
+    case WM_SETFOCUS:
+        if (self->panel_.Handle()) SetFocus(self->panel_.Handle());
+        return 0;
+
+    case WM_CLOSE:
+        self->Hide();
+        return 0;
+
+    case WM_DESTROY:
+        SetWindowLongPtrA(hwnd, GWLP_USERDATA, 0);
+        self->hwnd_ = nullptr;
+        return 0;
+    }
+    return DefWindowProcA(hwnd, msg, wp, lp);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ui/win32/win32_display_panel.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// A top-level window holding the DisplayPanel of one extra guest monitor.
+// Closing it only hides it; it comes back the next time the guest enables
+// that monitor.
+class DisplayWindow {
+public:
+    using ResizeCallback = std::function<void(uint32_t width, uint32_t height)>;
+    using VisibilityCallback = std::function<void()>;
+
+    DisplayWindow() = default;
+    ~DisplayWindow();
+
+    DisplayWindow(const DisplayWindow&) = delete;
+    DisplayWindow& operator=(const DisplayWindow&) = delete;
+
+    // Create the (hidden) window. Call once.
+    bool Create(HINSTANCE hinst);
+
+    // Called, debounced, with the new panel size after the user resizes.
+    void SetResizeCallback(ResizeCallback cb) { resize_cb_ = std::move(cb); }
+    // Called after the window is shown, hidden, minimized or restored.
+    void SetVisibilityCallback(VisibilityCallback cb) { visibility_cb_ = std::move(cb); }
+
+    DisplayPanel& panel() { return panel_; }
+    HWND Handle() const { return hwnd_; }
+
+    void SetTitle(const std::string& title);
+    // Show the window sized for a `width` x `height` guest monitor,
+    // within the work area of the monitor it is on.
+    void ShowForDisplay(uint32_t width, uint32_t height);
+    void Hide();
+
+    static LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
+
+private:
+    void OnSize();
+
+    HWND hwnd_ = nullptr;
+    DisplayPanel panel_;
+    ResizeCallback resize_cb_;
+    VisibilityCallback visibility_cb_;
+    bool iconic_ = false;
+    uint32_t last_width_ = 0;
+    uint32_t last_height_ = 0;
+    // ShowForDisplay sizes the window itself; that is no user resize.
+    bool sizing_ = false;
+    static constexpr UINT_PTR kResizeTimerId = 1;
+    static constexpr UINT kResizeDebounceMs = 500;
+};
@@ -1,6 +1,7 @@
 #include "ui/win32/win32_ui_shell.h"
 #include "ui/win32/win32_dialogs.h"
 #include "ui/win32/win32_display_panel.h"
+#include "ui/win32/win32_display_window.h"
 #include "ui/win32/components/info_tab.h"
 #include "ui/win32/components/console_tab.h"
 #include "ui/win32/components/vm_listbox.h"
@@ -19,9 +20,13 @@
 #pragma comment(lib, "comctl32.lib")
 
 #include "common/ports.h"
+#include "platform/windows/audio/wasapi_audio_capture.h"
 #include "platform/windows/audio/wasapi_audio_player.h"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <deque>
@@ -44,6 +49,16 @@ enum CmdId : UINT {
     IDM_DELETE        = 1015,
     IDM_SHARED_FOLDERS = 1016,
     IDM_VIEW_TOOLBAR   = 1017,
+    IDM_SUSPEND        = 1018,
+    IDM_MAKE_TEMPLATE  = 1019,
+    IDM_FORK           = 1023,
+    IDM_METRICS        = 1024,
+    IDM_SEND_FILE      = 1025,
+    IDM_RECEIVE_FILE   = 1026,
+    IDM_CANCEL_TRANSFER = 1027,
+    IDM_DISK_LIMITS    = 1028,
+    IDM_START_NET_CAPTURE = 1029,
+    IDM_STOP_NET_CAPTURE  = 1030,
     IDM_WEBSITE        = 1020,
     IDM_CHECK_UPDATE  = 1021,
     IDM_ABOUT         = 1022,
@@ -60,8 +75,14 @@ enum CtlId : UINT {
 // WM_APP range for cross-thread invoke
 static constexpr UINT WM_INVOKE = WM_APP + 100;
 
-// Track if we initiated the clipboard change (to avoid echo)
-static bool g_clipboard_from_vm = false;
+// A guest's clipboard text is offered with delayed rendering and only
+// fetched from the VM when something pastes it.
+static constexpr DWORD kClipboardRenderTimeoutMs = 5000;
+static std::mutex g_vm_clip_mutex;
+static std::condition_variable g_vm_clip_cv;
+static std::string g_vm_clip_owner;          // VM whose text is on offer
+static bool g_vm_clip_ready = false;
+static std::vector<uint8_t> g_vm_clip_data;  // UTF-8, once ready
 
 static constexpr int kLeftPaneWidth = 260;
 
@@ -88,14 +109,19 @@ static bool IsVmRunning(VmPowerState s) {
 
 // ── Per-VM UI state cache ──
 
+struct ScanoutUiState {
+    uint32_t fb_width = 0;
+    uint32_t fb_height = 0;
+    std::vector<uint8_t> framebuffer;
+};
+
 struct VmUiState {
     int current_tab = 0;
 
-    ConsoleTab::TextState console_state;
+    ConsoleBuffer console;
 
-    uint32_t fb_width = 0;
-    uint32_t fb_height = 0;
-    std::vector<uint8_t> framebuffer;
+    // Scanout 0 is shown in the Display tab, the others in their own windows.
+    std::array<ScanoutUiState, kMaxDisplayScanouts> scanouts;
 
     CursorInfo cursor;
     std::vector<uint8_t> cursor_pixels;
@@ -120,6 +146,8 @@ struct Win32UiShell::Impl {
     UINT_PTR resize_timer_id = 0;
     static constexpr UINT kResizeTimerId = 9001;
     static constexpr UINT kResizeDebounceMs = 500;
+    static constexpr UINT kStatsTimerId = 9002;
+    static constexpr UINT kStatsRefreshMs = 1000;
 
     HFONT ui_font     = nullptr;
     HFONT mono_font   = nullptr;
@@ -129,52 +157,97 @@ struct Win32UiShell::Impl {
     InfoTab info_tab;
     ConsoleTab console_tab;
     std::unique_ptr<DisplayPanel> display_panel;
+    // Windows for scanouts 1 and up of the selected VM, made on first
+    // use; slot 0 stays empty.
+    std::array<std::unique_ptr<DisplayWindow>, kMaxDisplayScanouts> display_windows;
 
     std::vector<VmRecord> records;
     int selected_index = -1;
+    // Manager revision `records` is up to date with.
+    uint64_t vm_list_revision = 0;
 
     std::unordered_map<std::string, VmUiState> vm_ui_states;
     std::unordered_map<std::string, std::unique_ptr<WasapiAudioPlayer>> audio_players;
+    // Only while the guest captures; UI thread.
+    std::unordered_map<std::string, std::unique_ptr<WasapiAudioCapture>> audio_captures;
 
     VmUiState& GetVmUiState(const std::string& vm_id) {
         return vm_ui_states[vm_id];
     }
 
+    // Console output from the manager thread, waiting for the UI thread.
+    // However many chunks arrive in between, one posted task drains them.
+    std::mutex console_mutex;
+    std::unordered_map<std::string, std::string> console_pending;
+    bool console_drain_posted = false;
+
+    uint32_t audio_latency_ms = WasapiAudioPlayer::kDefaultLatencyMs;
+
+    // The one guest file copy the UI runs at a time; id 0 when none.
+    std::string transfer_vm_id;
+    std::string transfer_name;
+    uint64_t transfer_id = 0;
+
     WasapiAudioPlayer& GetAudioPlayer(const std::string& vm_id) {
         auto& ptr = audio_players[vm_id];
-        if (!ptr) ptr = std::make_unique<WasapiAudioPlayer>();
+        if (!ptr) {
+            ptr = std::make_unique<WasapiAudioPlayer>();
+            ptr->SetTargetLatency(audio_latency_ms);
+        }
         return *ptr;
     }
 };
 
-// Blit incoming DisplayFrame into VmUiState framebuffer (for caching).
-static void BlitFrameToState(VmUiState& state, const DisplayFrame& frame) {
+// Blit incoming DisplayFrame into the cached scanout framebuffer.
+// Returns true if the framebuffer was reallocated for a new size.
+static bool BlitFrameToState(ScanoutUiState& state, const DisplayFrame& frame) {
     uint32_t rw = frame.resource_width;
     uint32_t rh = frame.resource_height;
     if (rw == 0) rw = frame.width;
     if (rh == 0) rh = frame.height;
 
+    bool resized = false;
     if (state.fb_width != rw || state.fb_height != rh) {
         state.fb_width = rw;
         state.fb_height = rh;
         state.framebuffer.resize(static_cast<size_t>(rw) * rh * 4, 0);
+        resized = true;
     }
 
     uint32_t dx = frame.dirty_x;
     uint32_t dy = frame.dirty_y;
     uint32_t dw = frame.width;
     uint32_t dh = frame.height;
-    uint32_t src_stride = dw * 4;
     uint32_t dst_stride = state.fb_width * 4;
 
     for (uint32_t row = 0; row < dh; ++row) {
-        uint32_t src_off = row * src_stride;
+        const uint8_t* src = frame.Row(row);
         uint32_t dst_off = (dy + row) * dst_stride + dx * 4;
-        if (src_off + src_stride > frame.pixels.size()) break;
+        if (!src) break;
         if (dst_off + dw * 4 > state.framebuffer.size()) break;
-        std::memcpy(state.framebuffer.data() + dst_off,
-                    frame.pixels.data() + src_off, dw * 4);
+        std::memcpy(state.framebuffer.data() + dst_off, src, dw * 4);
+    }
+    return resized;
+}
+
+// The guest is told its monitors sit side by side in scanout order and the
+// tablet spans all of them; maps a 0-32767 position on one scanout to the
+// whole desktop.
+static void MapPointerToDesktop(const VmUiState& state, uint32_t scanout_id,
+                                int32_t* x, int32_t* y) {
+    uint64_t offset = 0;
+    uint64_t total_w = 0;
+    uint32_t max_h = 0;
+    for (uint32_t i = 0; i < kMaxDisplayScanouts; ++i) {
+        const auto& s = state.scanouts[i];
+        if (i < scanout_id) offset += s.fb_width;
+        total_w += s.fb_width;
+        max_h = (std::max)(max_h, s.fb_height);
     }
+    const auto& s = state.scanouts[scanout_id];
+    if (total_w == 0 || max_h == 0 || s.fb_width == 0) return;
+    *x = static_cast<int32_t>((offset * 32767 + static_cast<uint64_t>(*x) * s.fb_width) / total_w);
+    *y = static_cast<int32_t>(static_cast<uint64_t>(*y) * s.fb_height / max_h);
 }
 
 // ── Window class registration ──
@@ -220,13 +293,25 @@ static HMENU BuildMenuBar(bool show_toolbar) {
     AppendMenuA(vm_menu, MF_STRING, IDM_STOP,     i18n::tr(S::kMenuStop));
     AppendMenuA(vm_menu, MF_STRING, IDM_REBOOT,   i18n::tr(S::kMenuReboot));
     AppendMenuA(vm_menu, MF_STRING, IDM_SHUTDOWN, i18n::tr(S::kMenuShutdown));
+    AppendMenuA(vm_menu, MF_STRING, IDM_SUSPEND,  i18n::tr(S::kMenuSuspend));
+    AppendMenuA(vm_menu, MF_SEPARATOR, 0, nullptr);
+    AppendMenuA(vm_menu, MF_STRING, IDM_MAKE_TEMPLATE, i18n::tr(S::kMenuMakeTemplate));
+    AppendMenuA(vm_menu, MF_STRING, IDM_FORK,     i18n::tr(S::kMenuFork));
     AppendMenuA(vm_menu, MF_SEPARATOR, 0, nullptr);
     AppendMenuA(vm_menu, MF_STRING, IDM_SHARED_FOLDERS, i18n::tr(S::kToolbarSharedFolders));
+    AppendMenuA(vm_menu, MF_STRING, IDM_DISK_LIMITS, i18n::tr(S::kMenuDiskLimits));
+    AppendMenuA(vm_menu, MF_STRING, IDM_SEND_FILE, i18n::tr(S::kMenuSendFile));
+    AppendMenuA(vm_menu, MF_STRING, IDM_RECEIVE_FILE, i18n::tr(S::kMenuReceiveFile));
+    AppendMenuA(vm_menu, MF_STRING, IDM_CANCEL_TRANSFER, i18n::tr(S::kMenuCancelTransfer));
+    AppendMenuA(vm_menu, MF_SEPARATOR, 0, nullptr);
+    AppendMenuA(vm_menu, MF_STRING, IDM_START_NET_CAPTURE, i18n::tr(S::kMenuStartNetCapture));
+    AppendMenuA(vm_menu, MF_STRING, IDM_STOP_NET_CAPTURE, i18n::tr(S::kMenuStopNetCapture));
     AppendMenuA(bar, MF_POPUP, reinterpret_cast<UINT_PTR>(vm_menu), i18n::tr(S::kMenuVm));
 
     HMENU view_menu = CreatePopupMenu();
     AppendMenuA(view_menu, MF_STRING | (show_toolbar ? MF_CHECKED : MF_UNCHECKED),
                IDM_VIEW_TOOLBAR, i18n::tr(S::kMenuViewToolbar));
+    AppendMenuA(view_menu, MF_STRING, IDM_METRICS, i18n::tr(S::kMenuViewMetrics));
     AppendMenuA(bar, MF_POPUP, reinterpret_cast<UINT_PTR>(view_menu), i18n::tr(S::kMenuView));
 
     HMENU help_menu = CreatePopupMenu();
@@ -475,6 +560,105 @@ static void LayoutControls(Impl* p) {
     }
 }
 
+// ── Extra display windows ──
+
+// Panel showing `scanout_id` of the selected VM, if there is one yet.
+static DisplayPanel* PanelForScanout(Impl* p, uint32_t scanout_id) {
+    if (scanout_id == 0) return p->display_panel.get();
+    if (scanout_id >= kMaxDisplayScanouts || !p->display_windows[scanout_id]) return nullptr;
+    return &p->display_windows[scanout_id]->panel();
+}
+
+// Only the selected VM can be on screen, in the Display tab or a display
+// window that is not minimized. The others' runtimes stop sending frames
+// and resend their screens whole once looked at again.
+static void UpdateDisplayViewers(Impl* p, ManagerService& manager) {
+    bool shown = !IsIconic(p->hwnd) &&
+                 SendMessage(p->tab, TCM_GETCURSEL, 0, 0) == kTabDisplay;
+    for (const auto& win : p->display_windows) {
+        if (win && IsWindowVisible(win->Handle()) && !IsIconic(win->Handle())) shown = true;
+    }
+    for (int i = 0; i < static_cast<int>(p->records.size()); ++i) {
+        manager.SetDisplayViewer(p->records[i].spec.vm_id, shown && i == p->selected_index);
+    }
+}
+
+static DisplayWindow* EnsureDisplayWindow(Impl* p, ManagerService& manager,
+                                          uint32_t scanout_id) {
+    if (scanout_id == 0 || scanout_id >= kMaxDisplayScanouts) return nullptr;
+    auto& win = p->display_windows[scanout_id];
+    if (win) return win.get();
+
+    auto hinst = reinterpret_cast<HINSTANCE>(GetWindowLongPtr(p->hwnd, GWLP_HINSTANCE));
+    win = std::make_unique<DisplayWindow>();
+    if (!win->Create(hinst)) {
+        win.reset();
+        return nullptr;
+    }
+    // Input always goes to whichever VM is selected, like the Display tab.
+    auto selected_vm = [p]() -> const std::string* {
+        if (p->selected_index < 0 || p->selected_index >= static_cast<int>(p->records.size()))
+            return nullptr;
+        return &p->records[p->selected_index].spec.vm_id;
+    };
+    win->panel().SetKeyCallback([&manager, selected_vm](uint32_t evdev_code, bool pressed) {
+        if (auto* vm_id = selected_vm()) manager.SendKeyEvent(*vm_id, evdev_code, pressed);
+    });
+    win->panel().SetPointerCallback(
+        [p, &manager, selected_vm, scanout_id](int32_t x, int32_t y, uint32_t buttons) {
+            auto* vm_id = selected_vm();
+            if (!vm_id) return;
+            MapPointerToDesktop(p->GetVmUiState(*vm_id), scanout_id, &x, &y);
+            manager.SendPointerEvent(*vm_id, x, y, buttons);
+        });
+    win->panel().SetWheelCallback([&manager, selected_vm](int32_t delta) {
+        if (auto* vm_id = selected_vm()) manager.SendWheelEvent(*vm_id, delta);
+    });
+    win->SetResizeCallback([&manager, selected_vm, scanout_id](uint32_t w, uint32_t h) {
+        if (auto* vm_id = selected_vm()) manager.SetDisplaySize(*vm_id, w, h, scanout_id);
+    });
+    win->SetVisibilityCallback([p, &manager]() { UpdateDisplayViewers(p, manager); });
+    return win.get();
+}
+
+static void ShowDisplayWindow(Impl* p, ManagerService& manager, uint32_t scanout_id,
+                              uint32_t width, uint32_t height) {
+    if (p->selected_index < 0 || p->selected_index >= static_cast<int>(p->records.size()))
+        return;
+    DisplayWindow* win = EnsureDisplayWindow(p, manager, scanout_id);
+    if (!win) return;
+    win->SetTitle(i18n::fmt(i18n::S::kDisplayWindowTitle,
+                            p->records[p->selected_index].spec.name.c_str(), scanout_id + 1));
+    win->ShowForDisplay(width, height);
+}
+
+static void HideDisplayWindows(Impl* p) {
+    for (auto& win : p->display_windows) {
+        if (!win) continue;
+        win->panel().Clear();
+        win->Hide();
+    }
+}
+
+// Brings the extra display windows in line with the selected VM's cache.
+static void RestoreDisplayWindows(Impl* p, ManagerService& manager, const VmUiState& state) {
+    for (uint32_t i = 1; i < kMaxDisplayScanouts; ++i) {
+        const auto& cache = state.scanouts[i];
+        if (cache.fb_width == 0 || cache.framebuffer.empty()) {
+            if (p->display_windows[i]) {
+                p->display_windows[i]->panel().Clear();
+                p->display_windows[i]->Hide();
+            }
+            continue;
+        }
+        ShowDisplayWindow(p, manager, i, cache.fb_width, cache.fb_height);
+        if (DisplayPanel* panel = PanelForScanout(p, i)) {
+            panel->RestoreFramebuffer(cache.fb_width, cache.fb_height, cache.framebuffer);
+            if (!state.cursor_pixels.empty()) panel->RestoreCursor(state.cursor, state.cursor_pixels);
+        }
+    }
+}
+
 // ── Update toolbar/menu enable state ──
 
 static void UpdateCommandStates(Impl* p) {
@@ -483,6 +667,14 @@ static void UpdateCommandStates(Impl* p) {
     bool running = has_sel && IsVmRunning(p->records[p->selected_index].state);
     bool stopping = has_sel && p->records[p->selected_index].state == VmPowerState::kStopping;
     bool ga_ok = has_sel && p->records[p->selected_index].guest_agent_connected;
+    bool capturing = has_sel && p->records[p->selected_index].net_capturing;
+    // A runtime that exits takes its file copy with it, unreported.
+    if (p->transfer_id) {
+        auto it = std::find_if(p->records.begin(), p->records.end(), [p](const VmRecord& r) {
+            return r.spec.vm_id == p->transfer_vm_id;
+        });
+        if (it == p->records.end() || it->state != VmPowerState::kRunning) p->transfer_id = 0;
+    }
 
     auto EnableCmd = [&](UINT id, bool en) {
         SendMessage(p->toolbar, TB_ENABLEBUTTON, id, MAKELONG(en ? TRUE : FALSE, 0));
@@ -492,19 +684,70 @@ static void UpdateCommandStates(Impl* p) {
         }
     };
 
-    EnableCmd(IDM_START,          has_sel && !running);
+    bool is_template = has_sel &&
+                       !p->records[p->selected_index].spec.template_snapshot.empty();
+    EnableCmd(IDM_START,          has_sel && !running && !is_template);
     EnableCmd(IDM_STOP,           has_sel && running);
     EnableCmd(IDM_REBOOT,         has_sel && running && !stopping && ga_ok);
     EnableCmd(IDM_SHUTDOWN,       has_sel && running && !stopping && ga_ok);
+    EnableCmd(IDM_SUSPEND,        has_sel && running && !stopping);
+    EnableCmd(IDM_MAKE_TEMPLATE,  has_sel && running && !stopping);
+    EnableCmd(IDM_FORK,           is_template);
     EnableCmd(IDM_EDIT,           has_sel);
     EnableCmd(IDM_DELETE,         has_sel && !running);
     EnableCmd(IDM_SHARED_FOLDERS, has_sel);
+    EnableCmd(IDM_DISK_LIMITS,    has_sel);
+    EnableCmd(IDM_SEND_FILE,      running && !stopping && ga_ok && !p->transfer_id);
+    EnableCmd(IDM_RECEIVE_FILE,   running && !stopping && ga_ok && !p->transfer_id);
+    EnableCmd(IDM_CANCEL_TRANSFER, p->transfer_id != 0);
+    EnableCmd(IDM_START_NET_CAPTURE, running && !stopping && !capturing);
+    EnableCmd(IDM_STOP_NET_CAPTURE,  running && capturing);
 
     p->console_tab.SetEnabled(running);
 }
 
 // ── WndProc ──
 
+// UI thread, while rendering: asks the owning VM for its text and
+// waits for it. The reply comes on the manager's pipe thread.
+static HGLOBAL RenderVmClipboard(ManagerService& manager) {
+    std::string owner;
+    {
+        std::lock_guard<std::mutex> lock(g_vm_clip_mutex);
+        owner = g_vm_clip_owner;
+        g_vm_clip_ready = false;
+        g_vm_clip_data.clear();
+    }
+    if (owner.empty() || !manager.SendClipboardRequest(owner, 1)) return nullptr;
+
+    std::vector<uint8_t> data;
+    {
+        std::unique_lock<std::mutex> lock(g_vm_clip_mutex);
+        if (!g_vm_clip_cv.wait_for(lock, std::chrono::milliseconds(kClipboardRenderTimeoutMs),
+                                   [] { return g_vm_clip_ready; })) {
+            return nullptr;
+        }
+        data.swap(g_vm_clip_data);
+    }
+
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<const char*>(data.data()),
+                                   static_cast<int>(data.size()), nullptr, 0);
+    HGLOBAL mem = GlobalAlloc(GMEM_MOVEABLE, (std::max)(wlen, 0) * sizeof(wchar_t) + sizeof(wchar_t));
+    if (!mem) return nullptr;
+    wchar_t* text = static_cast<wchar_t*>(GlobalLock(mem));
+    if (!text) {
+        GlobalFree(mem);
+        return nullptr;
+    }
+    if (wlen > 0) {
+        MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<const char*>(data.data()),
+                            static_cast<int>(data.size()), text, wlen);
+    }
+    text[(std::max)(wlen, 0)] = L'\0';
+    GlobalUnlock(mem);
+    return mem;
+}
+
 static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
     auto* shell = g_shell;
     if (!shell) return DefWindowProcA(hwnd, msg, wp, lp);
@@ -513,10 +756,27 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
 
     switch (msg) {
     case WM_SIZE:
-        if (p) LayoutControls(p);
+        if (p) {
+            LayoutControls(p);
+            UpdateDisplayViewers(p, shell->manager_);
+        }
         return 0;
 
     case WM_TIMER:
+        if (p && wp == Impl::kStatsTimerId) {
+            // Poll only what is on screen: the Info tab of a running VM.
+            int cur_tab = static_cast<int>(SendMessage(p->tab, TCM_GETCURSEL, 0, 0));
+            if (cur_tab == kTabInfo && p->selected_index >= 0 &&
+                p->selected_index < static_cast<int>(p->records.size())) {
+                const auto& rec = p->records[p->selected_index];
+                if (IsVmRunning(rec.state)) {
+                    shell->manager_.RequestRuntimeStats(rec.spec.vm_id);
+                } else {
+                    p->info_tab.SetStats(nullptr);
+                }
+            }
+            return 0;
+        }
         if (p && wp == Impl::kResizeTimerId) {
             KillTimer(hwnd, Impl::kResizeTimerId);
             p->resize_timer_id = 0;
@@ -554,24 +814,31 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
                 VmUiState& new_state = p->GetVmUiState(new_vm_id);
 
                 p->info_tab.Update(&p->records[sel].spec);
+                p->info_tab.SetStats(nullptr);
+                if (IsVmRunning(p->records[sel].state)) {
+                    shell->manager_.RequestRuntimeStats(new_vm_id);
+                }
                 UpdateCommandStates(p);
 
                 SendMessage(p->tab, TCM_SETCURSEL, new_state.current_tab, 0);
 
-                p->console_tab.SetText(new_state.console_state.text.c_str());
+                p->console_tab.SetBuffer(&new_state.console);
 
-                p->display_available = (new_state.fb_width > 0 && new_state.fb_height > 0);
-                if (p->display_available && !new_state.framebuffer.empty()) {
+                const ScanoutUiState& primary = new_state.scanouts[0];
+                p->display_available = (primary.fb_width > 0 && primary.fb_height > 0);
+                if (p->display_available && !primary.framebuffer.empty()) {
                     p->display_panel->RestoreFramebuffer(
-                        new_state.fb_width, new_state.fb_height, new_state.framebuffer);
+                        primary.fb_width, primary.fb_height, primary.framebuffer);
                     if (!new_state.cursor_pixels.empty()) {
                         p->display_panel->RestoreCursor(new_state.cursor, new_state.cursor_pixels);
                     }
                 } else {
                     p->display_panel->Clear();
                 }
+                RestoreDisplayWindows(p, shell->manager_, new_state);
 
                 LayoutControls(p);
+                UpdateDisplayViewers(p, shell->manager_);
             }
             return 0;
         }
@@ -620,16 +887,15 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
                 p->selected_index >= static_cast<int>(p->records.size()))
                 break;
             std::string vm_id = p->records[p->selected_index].spec.vm_id;
-            auto it = p->vm_ui_states.find(vm_id);
-            if (it != p->vm_ui_states.end()) {
-                ConsoleTab::ResetState(it->second.console_state);
-            }
             VmUiState& state = p->GetVmUiState(vm_id);
+            state.console.Clear();
             state.current_tab = kTabConsole;
-            p->console_tab.SetText("");
+            p->console_tab.SetBuffer(&state.console);
             p->display_available = false;
+            HideDisplayWindows(p);
             SendMessage(p->tab, TCM_SETCURSEL, kTabConsole, 0);
             LayoutControls(p);
+            UpdateDisplayViewers(p, shell->manager_);
             auto status = i18n::fmt(i18n::S::kStatusStarting, vm_id.c_str());
             SendMessageA(p->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(status.c_str()));
             std::string error;
@@ -685,6 +951,45 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             SendMessageA(p->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(status.c_str()));
             return 0;
         }
+        case IDM_SUSPEND: {
+            if (p->selected_index < 0 ||
+                p->selected_index >= static_cast<int>(p->records.size()))
+                break;
+            std::string vm_id = p->records[p->selected_index].spec.vm_id;
+            std::string error;
+            bool ok = shell->manager_.SuspendVm(vm_id, &error);
+            shell->RefreshVmList();
+            auto status = ok ? i18n::fmt(i18n::S::kStatusSuspended, vm_id.c_str())
+                             : (std::string(i18n::tr(i18n::S::kStatusErrorPrefix)) + error);
+            SendMessageA(p->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(status.c_str()));
+            return 0;
+        }
+        case IDM_MAKE_TEMPLATE: {
+            if (p->selected_index < 0 ||
+                p->selected_index >= static_cast<int>(p->records.size()))
+                break;
+            std::string vm_id = p->records[p->selected_index].spec.vm_id;
+            std::string error;
+            bool ok = shell->manager_.MakeTemplate(vm_id, &error);
+            shell->RefreshVmList();
+            auto status = ok ? i18n::fmt(i18n::S::kStatusTemplateSaved, vm_id.c_str())
+                             : (std::string(i18n::tr(i18n::S::kStatusErrorPrefix)) + error);
+            SendMessageA(p->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(status.c_str()));
+            return 0;
+        }
+        case IDM_FORK: {
+            if (p->selected_index < 0 ||
+                p->selected_index >= static_cast<int>(p->records.size()))
+                break;
+            std::string vm_id = p->records[p->selected_index].spec.vm_id;
+            std::string clone_id, error;
+            bool ok = shell->manager_.ForkVm(vm_id, &clone_id, &error);
+            shell->RefreshVmList();
+            auto status = ok ? i18n::fmt(i18n::S::kStatusForked, clone_id.c_str())
+                             : (std::string(i18n::tr(i18n::S::kStatusErrorPrefix)) + error);
+            SendMessageA(p->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(status.c_str()));
+            return 0;
+        }
         case IDM_SHARED_FOLDERS: {
             if (p->selected_index < 0 ||
                 p->selected_index >= static_cast<int>(p->records.size()))
@@ -706,6 +1011,38 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             LayoutControls(p);
             return 0;
         }
+        case IDM_METRICS:
+            ShowMetricsDialog(hwnd, shell->manager_);
+            return 0;
+        case IDM_SEND_FILE:
+        case IDM_RECEIVE_FILE: {
+            if (p->selected_index < 0 ||
+                p->selected_index >= static_cast<int>(p->records.size()) || p->transfer_id)
+                break;
+            std::string vm_id = p->records[p->selected_index].spec.vm_id;
+            bool push = LOWORD(wp) == IDM_SEND_FILE;
+            std::string host_path, guest_path;
+            bool picked = push ? ShowSendFileDialog(hwnd, &host_path, &guest_path)
+                               : ShowReceiveFileDialog(hwnd, &guest_path, &host_path);
+            if (!picked) return 0;
+            uint64_t id = 0;
+            std::string error;
+            if (!shell->manager_.StartFileTransfer(vm_id, push, host_path, guest_path, &id,
+                                                   &error)) {
+                MessageBoxA(hwnd, error.c_str(), i18n::tr(i18n::S::kError), MB_OK | MB_ICONERROR);
+                return 0;
+            }
+            p->transfer_vm_id = vm_id;
+            p->transfer_name = push ? host_path : guest_path;
+            p->transfer_id = id;
+            UpdateCommandStates(p);
+            return 0;
+        }
+        case IDM_CANCEL_TRANSFER:
+            if (p->transfer_id) {
+                shell->manager_.CancelFileTransfer(p->transfer_vm_id, p->transfer_id);
+            }
+            return 0;
         case IDM_EDIT: {
             if (p->selected_index < 0 ||
                 p->selected_index >= static_cast<int>(p->records.size()))
@@ -722,6 +1059,42 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             }
             return 0;
         }
+        case IDM_START_NET_CAPTURE: {
+            if (p->selected_index < 0 ||
+                p->selected_index >= static_cast<int>(p->records.size()))
+                break;
+            const VmRecord& rec = p->records[p->selected_index];
+            std::string vm_id = rec.spec.vm_id;
+            std::string path;
+            if (!ShowNetCaptureFileDialog(hwnd, rec.spec.name, &path)) return 0;
+            std::string error;
+            if (!shell->manager_.StartNetCapture(vm_id, path, 0, 0, "", &error)) {
+                MessageBoxA(hwnd, error.c_str(), i18n::tr(i18n::S::kError), MB_OK | MB_ICONERROR);
+            }
+            return 0;
+        }
+        case IDM_STOP_NET_CAPTURE: {
+            if (p->selected_index < 0 ||
+                p->selected_index >= static_cast<int>(p->records.size()))
+                break;
+            std::string error;
+            if (!shell->manager_.StopNetCapture(p->records[p->selected_index].spec.vm_id, &error)) {
+                MessageBoxA(hwnd, error.c_str(), i18n::tr(i18n::S::kError), MB_OK | MB_ICONERROR);
+            }
+            return 0;
+        }
+        case IDM_DISK_LIMITS: {
+            if (p->selected_index < 0 ||
+                p->selected_index >= static_cast<int>(p->records.size()))
+                break;
+            VmRecord rec = p->records[p->selected_index];
+            if (ShowDiskLimitsDialog(hwnd, shell->manager_, rec)) {
+                shell->RefreshVmList();
+                auto status = i18n::fmt(i18n::S::kStatusVmUpdated, rec.spec.name.c_str());
+                SendMessageA(p->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(status.c_str()));
+            }
+            return 0;
+        }
         case IDM_DELETE: {
             if (p->selected_index < 0 ||
                 p->selected_index >= static_cast<int>(p->records.size()))
@@ -733,6 +1106,7 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
                     MB_YESNO | MB_ICONWARNING | MB_DEFBUTTON2) == IDYES) {
                 std::string error;
                 if (shell->manager_.DeleteVm(vm_id, &error)) {
+                    p->console_tab.SetBuffer(nullptr);
                     p->vm_ui_states.erase(vm_id);
                     shell->RefreshVmList();
                     if (p->records.empty()) {
@@ -766,6 +1140,7 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
                 p->GetVmUiState(p->records[p->selected_index].spec.vm_id).current_tab = cur_tab;
             }
             LayoutControls(p);
+            UpdateDisplayViewers(p, shell->manager_);
         }
         break;
     }
@@ -834,7 +1209,8 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
     }
 
     case WM_CLIPBOARDUPDATE:
-        if (!g_clipboard_from_vm) {
+        // Our own offer of guest text is no host copy to echo back.
+        if (GetClipboardOwner() != hwnd) {
             auto vms = shell->manager_.ListVms();
             for (const auto& vm : vms) {
                 if (vm.state == VmPowerState::kRunning) {
@@ -842,11 +1218,34 @@ static LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
                     shell->manager_.SendClipboardGrab(vm.spec.vm_id, types);
                 }
             }
-        } else {
-            g_clipboard_from_vm = false;
         }
         return 0;
 
+    case WM_RENDERFORMAT:
+        if (wp == CF_UNICODETEXT) {
+            if (HGLOBAL mem = RenderVmClipboard(shell->manager_)) {
+                SetClipboardData(CF_UNICODETEXT, mem);
+            }
+        }
+        return 0;
+
+    case WM_RENDERALLFORMATS:
+        if (OpenClipboard(hwnd)) {
+            if (GetClipboardOwner() == hwnd) {
+                if (HGLOBAL mem = RenderVmClipboard(shell->manager_)) {
+                    SetClipboardData(CF_UNICODETEXT, mem);
+                }
+            }
+            CloseClipboard();
+        }
+        return 0;
+
+    case WM_DESTROYCLIPBOARD: {
+        std::lock_guard<std::mutex> lock(g_vm_clip_mutex);
+        g_vm_clip_owner.clear();
+        return 0;
+    }
+
     case WM_CLOSE:
         {
             auto vms = shell->manager_.ListVms();
@@ -945,7 +1344,7 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
 
     // Components
     impl_->vm_listbox.Create(impl_->hwnd, hinst, impl_->ui_font);
-    impl_->info_tab.Create(impl_->hwnd, hinst, impl_->ui_font);
+    impl_->info_tab.Create(impl_->hwnd, hinst, impl_->ui_font, impl_->mono_font);
     impl_->console_tab.Create(impl_->hwnd, hinst, impl_->mono_font, impl_->ui_font);
 
     // Tab control
@@ -991,6 +1390,7 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
                 impl_->selected_index >= static_cast<int>(impl_->records.size()))
                 return;
             const auto& vm_id = impl_->records[impl_->selected_index].spec.vm_id;
+            MapPointerToDesktop(impl_->GetVmUiState(vm_id), 0, &x, &y);
             manager_.SendPointerEvent(vm_id, x, y, buttons);
         });
     impl_->display_panel->SetWheelCallback(
@@ -1006,16 +1406,23 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
     manager_.SetDisplayCallback(
         [this](const std::string& vm_id, DisplayFrame frame) {
             InvokeOnUiThread([this, vm_id, frame = std::move(frame)]() {
-                VmUiState& state = impl_->GetVmUiState(vm_id);
-                BlitFrameToState(state, frame);
+                if (frame.scanout_id >= kMaxDisplayScanouts) return;
+                ScanoutUiState& state = impl_->GetVmUiState(vm_id).scanouts[frame.scanout_id];
+                bool resized = BlitFrameToState(state, frame);
 
                 bool is_current = (impl_->selected_index >= 0 &&
                     impl_->selected_index < static_cast<int>(impl_->records.size()) &&
                     impl_->records[impl_->selected_index].spec.vm_id == vm_id);
-                if (is_current) {
-                    impl_->display_panel->AdoptFramebuffer(
+                DisplayPanel* panel = is_current ? PanelForScanout(impl_.get(), frame.scanout_id)
+                                                 : nullptr;
+                if (panel && resized) {
+                    panel->AdoptFramebuffer(
                         state.fb_width, state.fb_height,
                         state.framebuffer.data(), state.framebuffer.size());
+                } else if (panel) {
+                    // Panel already mirrors the cached framebuffer; copy
+                    // only the damage.
+                    panel->UpdateFrame(frame);
                 }
             });
         });
@@ -1023,8 +1430,15 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
         [this](const std::string& vm_id, const CursorInfo& cursor) {
             InvokeOnUiThread([this, vm_id, cursor]() {
                 VmUiState& state = impl_->GetVmUiState(vm_id);
+                state.cursor.scanout_id = cursor.scanout_id;
+                state.cursor.x = cursor.x;
+                state.cursor.y = cursor.y;
+                // A move only carries coordinates; nothing to redraw.
+                if (!cursor.image_updated) return;
+
                 state.cursor = cursor;
-                if (cursor.image_updated && !cursor.pixels.empty()) {
+                state.cursor.pixels.clear();
+                if (!cursor.pixels.empty()) {
                     state.cursor_pixels = cursor.pixels;
                 }
 
@@ -1032,20 +1446,43 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
                     impl_->selected_index < static_cast<int>(impl_->records.size()) &&
                     impl_->records[impl_->selected_index].spec.vm_id == vm_id);
                 if (is_current) {
-                    impl_->display_panel->UpdateCursor(cursor);
+                    // One image for all panels; only the one under the
+                    // host pointer shows it.
+                    for (uint32_t i = 0; i < kMaxDisplayScanouts; ++i) {
+                        if (DisplayPanel* panel = PanelForScanout(impl_.get(), i)) {
+                            panel->UpdateCursor(cursor);
+                        }
+                    }
                 }
             });
         });
 
     manager_.SetDisplayStateCallback(
-        [this](const std::string& vm_id, bool active, uint32_t width, uint32_t height) {
-            InvokeOnUiThread([this, vm_id, active, width, height]() {
+        [this](const std::string& vm_id, uint32_t scanout_id, bool active,
+               uint32_t width, uint32_t height) {
+            InvokeOnUiThread([this, vm_id, scanout_id, active, width, height]() {
+                VmUiState& state = impl_->GetVmUiState(vm_id);
+                if (scanout_id != 0 && !active) {
+                    // Drop the monitor from the pointer layout too.
+                    state.scanouts[scanout_id] = {};
+                }
+
                 bool is_current = (impl_->selected_index >= 0 &&
                     impl_->selected_index < static_cast<int>(impl_->records.size()) &&
                     impl_->records[impl_->selected_index].spec.vm_id == vm_id);
                 if (!is_current) return;
 
-                VmUiState& state = impl_->GetVmUiState(vm_id);
+                if (scanout_id != 0) {
+                    if (active) {
+                        ShowDisplayWindow(impl_.get(), manager_, scanout_id, width, height);
+                    } else if (auto& win = impl_->display_windows[scanout_id]) {
+                        win->panel().Clear();
+                        win->Hide();
+                    }
+                    UpdateDisplayViewers(impl_.get(), manager_);
+                    return;
+                }
+
                 if (active) {
                     impl_->display_available = true;
                     state.current_tab = kTabDisplay;
@@ -1057,24 +1494,68 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
                     SendMessage(impl_->tab, TCM_SETCURSEL, kTabConsole, 0);
                 }
                 LayoutControls(impl_.get());
+                UpdateDisplayViewers(impl_.get(), manager_);
             });
         });
 
     manager_.SetConsoleCallback([this](const std::string& vm_id,
                                        const std::string& data) {
-        InvokeOnUiThread([this, vm_id, data]() {
-            VmUiState& state = impl_->GetVmUiState(vm_id);
-            std::string added = ConsoleTab::FilterAndAppend(state.console_state, data);
+        {
+            std::lock_guard<std::mutex> lock(impl_->console_mutex);
+            std::string& pending = impl_->console_pending[vm_id];
+            pending += data;
+            // Only the last ConsoleBuffer::kCapacity bytes could be kept
+            // anyway; cap what piles up while the UI thread is busy.
+            if (pending.size() > 2 * ConsoleBuffer::kCapacity) {
+                pending.erase(0, pending.size() - ConsoleBuffer::kCapacity);
+            }
+            if (impl_->console_drain_posted) return;
+            impl_->console_drain_posted = true;
+        }
+        InvokeOnUiThread([this]() {
+            std::unordered_map<std::string, std::string> pending;
+            {
+                std::lock_guard<std::mutex> lock(impl_->console_mutex);
+                pending.swap(impl_->console_pending);
+                impl_->console_drain_posted = false;
+            }
+            for (const auto& [vm_id, data] : pending) {
+                VmUiState& state = impl_->GetVmUiState(vm_id);
+                uint64_t revision = state.console.revision();
+                state.console.Append(data.data(), data.size());
 
-            bool is_current = (impl_->selected_index >= 0 &&
-                impl_->selected_index < static_cast<int>(impl_->records.size()) &&
-                impl_->records[impl_->selected_index].spec.vm_id == vm_id);
-            if (is_current && !added.empty()) {
-                impl_->console_tab.AppendText(added);
+                bool is_current = (impl_->selected_index >= 0 &&
+                    impl_->selected_index < static_cast<int>(impl_->records.size()) &&
+                    impl_->records[impl_->selected_index].spec.vm_id == vm_id);
+                if (!is_current || state.console.revision() == revision) continue;
+                if (impl_->console_tab.buffer() != &state.console) {
+                    impl_->console_tab.SetBuffer(&state.console);
+                } else {
+                    impl_->console_tab.OnBufferChanged();
+                }
             }
         });
     });
 
+    impl_->audio_latency_ms = manager_.app_settings().audio_latency_ms;
+    manager_.SetAudioRingCallback(
+        [this](const std::string& vm_id, std::shared_ptr<ipc::PcmRing> ring) {
+            impl_->GetAudioPlayer(vm_id).AttachRing(std::move(ring));
+        });
+
+    manager_.SetAudioCaptureCallback(
+        [this](const std::string& vm_id, std::shared_ptr<ipc::PcmRing> ring) {
+            InvokeOnUiThread([this, vm_id, ring]() {
+                if (!ring) {
+                    impl_->audio_captures.erase(vm_id);
+                    return;
+                }
+                auto& capture = impl_->audio_captures[vm_id];
+                if (!capture) capture = std::make_unique<WasapiAudioCapture>();
+                capture->Start(ring);
+            });
+        });
+
     manager_.SetAudioPcmCallback(
         [this](const std::string& vm_id, AudioChunk chunk) {
             if (chunk.pcm.empty()) return;
@@ -1094,11 +1575,10 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
             if (is_stopped) {
                 VmUiState& ui_state = impl_->GetVmUiState(vm_id);
                 ui_state.current_tab = kTabInfo;
-                ui_state.fb_width = 0;
-                ui_state.fb_height = 0;
-                ui_state.framebuffer.clear();
+                ui_state.scanouts = {};
                 ui_state.cursor_pixels.clear();
                 impl_->audio_players.erase(vm_id);
+                impl_->audio_captures.erase(vm_id);
             }
 
             bool is_current = (impl_->selected_index >= 0 &&
@@ -1106,6 +1586,7 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
                 impl_->records[impl_->selected_index].spec.vm_id == vm_id);
             if (is_current && is_stopped) {
                 impl_->display_available = false;
+                HideDisplayWindows(impl_.get());
                 SendMessage(impl_->tab, TCM_SETCURSEL, kTabInfo, 0);
                 LayoutControls(impl_.get());
             }
@@ -1120,6 +1601,43 @@ Win32UiShell::Win32UiShell(ManagerService& manager)
             });
         });
 
+    manager_.SetFileTransferCallback(
+        [this](const std::string& vm_id, const VmFileTransferStatus& status) {
+            InvokeOnUiThread([this, vm_id, status]() {
+                auto* p = impl_.get();
+                if (status.id != p->transfer_id || vm_id != p->transfer_vm_id) return;
+                using S = i18n::S;
+                std::string text;
+                if (!status.done) {
+                    text = i18n::fmt(S::kStatusTransferProgress, p->transfer_name.c_str(),
+                                     status.bytes / (1024.0 * 1024.0));
+                } else if (status.ok) {
+                    text = i18n::fmt(S::kStatusTransferDone, p->transfer_name.c_str());
+                } else {
+                    text = i18n::fmt(S::kStatusTransferFailed, p->transfer_name.c_str(),
+                                     status.error.c_str());
+                }
+                SendMessageA(p->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(text.c_str()));
+                if (status.done) {
+                    p->transfer_id = 0;
+                    UpdateCommandStates(p);
+                }
+            });
+        });
+
+    manager_.SetRuntimeStatsCallback(
+        [this](const std::string& vm_id, const VmRuntimeStats& stats) {
+            InvokeOnUiThread([this, vm_id, stats]() {
+                auto* p = impl_.get();
+                if (p->selected_index >= 0 &&
+                    p->selected_index < static_cast<int>(p->records.size()) &&
+                    p->records[p->selected_index].spec.vm_id == vm_id) {
+                    p->info_tab.SetStats(&stats);
+                }
+            });
+        });
+    SetTimer(impl_->hwnd, Impl::kStatsTimerId, Impl::kStatsRefreshMs, nullptr);
+
     RefreshVmList();
     LayoutControls(impl_.get());
 }
@@ -1152,7 +1670,9 @@ void Win32UiShell::Run() {
             int cur_tab = static_cast<int>(SendMessage(impl_->tab, TCM_GETCURSEL, 0, 0));
             if (cur_tab == kTabDisplay && impl_->display_available && impl_->display_panel) {
                 HWND panel_hwnd = impl_->display_panel->Handle();
-                if (msg.hwnd != panel_hwnd && msg.hwnd != impl_->console_tab.input_handle()) {
+                // Keys typed into an extra display window stay there.
+                if (msg.hwnd != panel_hwnd && msg.hwnd != impl_->console_tab.input_handle() &&
+                    GetAncestor(msg.hwnd, GA_ROOT) == impl_->hwnd) {
                     SendMessage(panel_hwnd, msg.message, msg.wParam, msg.lParam);
                     forwarded = true;
                 }
@@ -1180,21 +1700,64 @@ void Win32UiShell::Quit() {
 }
 
 void Win32UiShell::RefreshVmList() {
-    impl_->records = manager_.ListVms();
+    auto* p = impl_.get();
+    VmListDelta delta = manager_.GetVmChanges(p->vm_list_revision);
+    p->vm_list_revision = delta.revision;
+    if (!delta.reset && delta.changed.empty() && delta.removed.empty()) return;
+
+    auto index_of = [p](const std::string& vm_id) {
+        for (int i = 0; i < static_cast<int>(p->records.size()); ++i) {
+            if (p->records[i].spec.vm_id == vm_id) return i;
+        }
+        return -1;
+    };
 
-    if (impl_->selected_index >= static_cast<int>(impl_->records.size())) {
-        impl_->selected_index = static_cast<int>(impl_->records.size()) - 1;
+    // Rows keep their place; new VMs go at the end.
+    bool selected_changed = delta.reset;
+    if (delta.reset) {
+        p->records = std::move(delta.changed);
+        if (p->selected_index >= static_cast<int>(p->records.size())) {
+            p->selected_index = static_cast<int>(p->records.size()) - 1;
+        }
+        p->vm_listbox.Populate(p->records, p->selected_index);
+    } else {
+        for (const auto& vm_id : delta.removed) {
+            int i = index_of(vm_id);
+            if (i < 0) continue;
+            p->records.erase(p->records.begin() + i);
+            p->vm_listbox.RemoveItem(i);
+            if (i <= p->selected_index) {
+                selected_changed |= i == p->selected_index;
+                if (i < p->selected_index ||
+                    p->selected_index >= static_cast<int>(p->records.size())) {
+                    p->selected_index--;
+                }
+            }
+        }
+        for (auto& rec : delta.changed) {
+            int i = index_of(rec.spec.vm_id);
+            if (i < 0) {
+                p->records.push_back(std::move(rec));
+                p->vm_listbox.AppendItem(p->records.back());
+                continue;
+            }
+            p->records[i] = std::move(rec);
+            p->vm_listbox.UpdateItem(i, p->records[i]);
+            selected_changed |= i == p->selected_index;
+        }
+        if (!delta.removed.empty()) p->vm_listbox.SetSelection(p->selected_index);
     }
 
-    impl_->vm_listbox.Populate(impl_->records, impl_->selected_index);
-
-    const VmSpec* spec = nullptr;
-    if (impl_->selected_index >= 0 &&
-        impl_->selected_index < static_cast<int>(impl_->records.size())) {
-        spec = &impl_->records[impl_->selected_index].spec;
+    if (selected_changed) {
+        const VmSpec* spec = nullptr;
+        if (p->selected_index >= 0 &&
+            p->selected_index < static_cast<int>(p->records.size())) {
+            spec = &p->records[p->selected_index].spec;
+        }
+        p->info_tab.Update(spec);
     }
-    impl_->info_tab.Update(spec);
-    UpdateCommandStates(impl_.get());
+    UpdateCommandStates(p);
+    UpdateDisplayViewers(p, manager_);
 
     auto status = i18n::fmt(i18n::S::kStatusVmsLoaded, static_cast<unsigned>(impl_->records.size()));
     SendMessageA(impl_->statusbar, SB_SETTEXTA, 0, reinterpret_cast<LPARAM>(status.c_str()));
@@ -1210,6 +1773,25 @@ void Win32UiShell::InvokeOnUiThread(std::function<void()> fn) {
     }
 }
 
-void Win32UiShell::SetClipboardFromVm(bool value) {
-    g_clipboard_from_vm = value;
+void Win32UiShell::OfferVmClipboard(const std::string& vm_id) {
+    InvokeOnUiThread([vm_id]() {
+        if (!g_main_hwnd || !OpenClipboard(g_main_hwnd)) return;
+        EmptyClipboard();
+        {
+            std::lock_guard<std::mutex> lock(g_vm_clip_mutex);
+            g_vm_clip_owner = vm_id;
+        }
+        SetClipboardData(CF_UNICODETEXT, nullptr);
+        CloseClipboard();
+    });
+}
+
+void Win32UiShell::DeliverVmClipboard(const std::string& vm_id, std::vector<uint8_t> data) {
+    {
+        std::lock_guard<std::mutex> lock(g_vm_clip_mutex);
+        if (vm_id != g_vm_clip_owner) return;
+        g_vm_clip_data = std::move(data);
+        g_vm_clip_ready = true;
+    }
+    g_vm_clip_cv.notify_all();
 }
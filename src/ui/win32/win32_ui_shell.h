@@ -5,6 +5,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 class Win32UiShell {
 public:
@@ -18,7 +19,11 @@ public:
     void RefreshVmList();
 
     static void InvokeOnUiThread(std::function<void()> fn);
-    static void SetClipboardFromVm(bool value);
+    // A VM grabbed its clipboard with text: offers it to the host without
+    // fetching it. The text is requested when something pastes, and
+    // arrives through DeliverVmClipboard. Any thread.
+    static void OfferVmClipboard(const std::string& vm_id);
+    static void DeliverVmClipboard(const std::string& vm_id, std::vector<uint8_t> data);
 
     struct Impl;
     ManagerService& manager_;
@@ -0,0 +1,316 @@
+// Replays a block trace recorded with `tenbox-runtime --disk-trace` against
+// a disk image, either at the pace it was recorded or as fast as the
+// backend allows, and prints latency percentiles per request type next to
+// the ones the guest saw. Useful for comparing disk backends and cache
+// settings on a real workload without booting the guest.
+//
+// Writes change the image, so they are skipped unless --write is given;
+// point it at a copy.
+
+#include "core/device/virtio/block_trace.h"
+#include "core/device/virtio/disk_image.h"
+#include "core/device/virtio/virtio_blk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kMaxRequest = 4 * 1024 * 1024;
+constexpr size_t kBufferAlign = 4096;  // enough for --direct-io
+
+struct Options {
+    std::string trace;
+    std::string image;
+    uint32_t threads = 4;
+    bool max_speed = false;
+    bool write = false;
+    bool direct_io = false;
+    uint64_t l2_cache_mb = 0;
+    bool json = false;
+};
+
+enum Kind { kRead, kWrite, kFlush, kKinds };
+const char* const kKindNames[kKinds] = {"read", "write", "flush"};
+
+// Latencies in microseconds.
+struct Samples {
+    std::vector<uint32_t> replayed;
+    std::vector<uint32_t> recorded;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+};
+
+struct AlignedFree {
+    void operator()(uint8_t* p) const {
+        ::operator delete[](p, std::align_val_t(kBufferAlign));
+    }
+};
+using Buffer = std::unique_ptr<uint8_t[], AlignedFree>;
+
+Buffer AllocBuffer(size_t size) {
+    return Buffer(static_cast<uint8_t*>(::operator new[](size, std::align_val_t(kBufferAlign))));
+}
+
+bool KindOf(const BlockTraceRecord& rec, Kind* kind) {
+    switch (rec.type) {
+    case VIRTIO_BLK_T_IN: *kind = kRead; return true;
+    case VIRTIO_BLK_T_OUT: *kind = kWrite; return true;
+    case VIRTIO_BLK_T_FLUSH: *kind = kFlush; return true;
+    default: return false;
+    }
+}
+
+// Nearest rank; `v` must be sorted.
+uint32_t Percentile(const std::vector<uint32_t>& v, double p) {
+    if (v.empty()) return 0;
+    size_t rank = static_cast<size_t>(p / 100.0 * v.size());
+    return v[std::min(rank, v.size() - 1)];
+}
+
+double Average(const std::vector<uint32_t>& v) {
+    if (v.empty()) return 0;
+    double sum = 0;
+    for (uint32_t x : v) sum += x;
+    return sum / v.size();
+}
+
+void PrintKind(const Options& opt, const char* name, Samples& s, double secs) {
+    std::sort(s.replayed.begin(), s.replayed.end());
+    std::sort(s.recorded.begin(), s.recorded.end());
+    size_t n = s.replayed.size();
+    double iops = secs > 0 ? n / secs : 0;
+    double mib_s = secs > 0 ? s.bytes / secs / (1024.0 * 1024.0) : 0;
+    if (opt.json) {
+        printf("{\"type\":\"%s\",\"count\":%zu,\"errors\":%llu,\"iops\":%.0f,"
+               "\"mib_per_s\":%.1f,\"avg_us\":%.1f,\"p50_us\":%u,\"p90_us\":%u,"
+               "\"p99_us\":%u,\"max_us\":%u,\"recorded_avg_us\":%.1f,"
+               "\"recorded_p50_us\":%u,\"recorded_p99_us\":%u}\n",
+               name, n, static_cast<unsigned long long>(s.errors), iops, mib_s,
+               Average(s.replayed), Percentile(s.replayed, 50), Percentile(s.replayed, 90),
+               Percentile(s.replayed, 99), n ? s.replayed.back() : 0,
+               Average(s.recorded), Percentile(s.recorded, 50), Percentile(s.recorded, 99));
+        return;
+    }
+    printf("%-6s %9zu %9.0f %9.1f %9.1f %8u %8u %8u %9u |%9.1f %8u %8u\n",
+           name, n, iops, mib_s, Average(s.replayed),
+           Percentile(s.replayed, 50), Percentile(s.replayed, 90),
+           Percentile(s.replayed, 99), n ? s.replayed.back() : 0,
+           Average(s.recorded), Percentile(s.recorded, 50), Percentile(s.recorded, 99));
+    if (s.errors) printf("       %llu failed\n", static_cast<unsigned long long>(s.errors));
+}
+
+int Run(const Options& opt) {
+    BlockTrace trace;
+    std::string error;
+    if (!ReadBlockTrace(opt.trace, &trace, &error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    if (trace.written > trace.records.size()) {
+        fprintf(stderr, "Trace ring wrapped: replaying the last %zu of %llu requests\n",
+                trace.records.size(), static_cast<unsigned long long>(trace.written));
+    }
+
+    DiskImageOptions disk_options;
+    disk_options.direct_io = opt.direct_io;
+    disk_options.qcow2_l2_cache_bytes = opt.l2_cache_mb << 20;
+    disk_options.read_only = !opt.write;
+    auto disk = DiskImage::Create(opt.image, disk_options);
+    if (!disk) {
+        fprintf(stderr, "Cannot open %s\n", opt.image.c_str());
+        return 1;
+    }
+    uint64_t disk_size = disk->GetSize();
+    if (disk_size != trace.disk_size) {
+        fprintf(stderr, "Note: image is %llu MB, trace was recorded on %llu MB\n",
+                static_cast<unsigned long long>(disk_size >> 20),
+                static_cast<unsigned long long>(trace.disk_size >> 20));
+    }
+
+    // Pick what can be replayed up front so the workers only do I/O.
+    std::vector<const BlockTraceRecord*> plan;
+    plan.reserve(trace.records.size());
+    uint64_t skipped = 0;
+    for (const auto& rec : trace.records) {
+        Kind kind;
+        bool ok = KindOf(rec, &kind) && rec.status == VIRTIO_BLK_S_OK &&
+                  rec.length <= kMaxRequest &&
+                  rec.sector * 512 + rec.length <= disk_size &&
+                  (kind != kWrite || opt.write);
+        if (ok) plan.push_back(&rec);
+        else skipped++;
+    }
+    if (plan.empty()) {
+        fprintf(stderr, "Nothing to replay (%llu requests skipped)\n",
+                static_cast<unsigned long long>(skipped));
+        return 1;
+    }
+
+    // Same rule as the device: backends without positional I/O take one
+    // request at a time.
+    std::mutex disk_mutex;
+    bool serialize = !disk->SupportsConcurrentIo();
+    uint64_t first_us = plan.front()->start_us;
+
+    std::vector<std::vector<Samples>> per_thread(opt.threads, std::vector<Samples>(kKinds));
+    std::atomic<size_t> next{0};
+    auto begin = Clock::now();
+
+    auto worker = [&](uint32_t thread_idx) {
+        Buffer buf = AllocBuffer(kMaxRequest);
+        auto& samples = per_thread[thread_idx];
+        for (;;) {
+            size_t i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= plan.size()) break;
+            const BlockTraceRecord& rec = *plan[i];
+            if (!opt.max_speed) {
+                std::this_thread::sleep_until(
+                    begin + std::chrono::microseconds(rec.start_us - first_us));
+            }
+            Kind kind;
+            KindOf(rec, &kind);
+            uint64_t offset = rec.sector * 512;
+
+            auto start = Clock::now();
+            bool ok;
+            {
+                std::unique_lock<std::mutex> lock(disk_mutex, std::defer_lock);
+                if (serialize) lock.lock();
+                switch (kind) {
+                case kRead: ok = disk->Read(offset, buf.get(), rec.length); break;
+                case kWrite: ok = disk->Write(offset, buf.get(), rec.length); break;
+                default: ok = disk->Flush(); break;
+                }
+            }
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - start).count();
+
+            Samples& s = samples[kind];
+            if (!ok) {
+                s.errors++;
+                continue;
+            }
+            s.replayed.push_back(static_cast<uint32_t>(std::min<int64_t>(us, UINT32_MAX)));
+            s.recorded.push_back(rec.latency_us);
+            s.bytes += rec.length;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < opt.threads; t++) threads.emplace_back(worker, t);
+    for (auto& t : threads) t.join();
+    double secs = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    if (!opt.json) {
+        printf("Replayed %zu requests in %.2f s (%s, %u threads), skipped %llu\n\n",
+               plan.size(), secs, opt.max_speed ? "max speed" : "original timing",
+               opt.threads, static_cast<unsigned long long>(skipped));
+        printf("%-6s %9s %9s %9s %9s %8s %8s %8s %9s |%9s %8s %8s\n",
+               "type", "count", "iops", "MiB/s", "avg us", "p50", "p90", "p99", "max",
+               "rec avg", "rec p50", "rec p99");
+    }
+    uint64_t errors = 0;
+    for (int k = 0; k < kKinds; k++) {
+        Samples merged;
+        for (auto& samples : per_thread) {
+            Samples& s = samples[k];
+            merged.replayed.insert(merged.replayed.end(), s.replayed.begin(), s.replayed.end());
+            merged.recorded.insert(merged.recorded.end(), s.recorded.begin(), s.recorded.end());
+            merged.bytes += s.bytes;
+            merged.errors += s.errors;
+        }
+        errors += merged.errors;
+        if (merged.replayed.empty() && !merged.errors) continue;
+        PrintKind(opt, kKindNames[k], merged, secs);
+    }
+    return errors ? 1 : 0;
+}
+
+void PrintUsage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s --trace <path> --image <path> [options]\n"
+        "\n"
+        "Options:\n"
+        "  --trace <path>      Trace from tenbox-runtime --disk-trace\n"
+        "  --image <path>      Raw or qcow2 image to replay against\n"
+        "  --speed <mode>      original (default) or max\n"
+        "  --threads <N>       Requests in flight (default: 4)\n"
+        "  --write             Also replay writes; this modifies the image\n"
+        "  --direct-io         Bypass host page cache for raw images\n"
+        "  --qcow2-l2-cache <MB> qcow2 L2 table cache (default: whole image)\n"
+        "  --json              One JSON object per request type\n",
+        prog);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        auto Arg = [&](const char* flag) {
+            return std::strcmp(argv[i], flag) == 0;
+        };
+        auto NextArg = [&]() -> const char* {
+            if (i + 1 < argc) return argv[++i];
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return nullptr;
+        };
+
+        if (Arg("--trace")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.trace = v;
+        } else if (Arg("--image")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.image = v;
+        } else if (Arg("--speed")) {
+            auto v = NextArg(); if (!v) return 1;
+            if (std::strcmp(v, "max") == 0) {
+                opt.max_speed = true;
+            } else if (std::strcmp(v, "original") != 0) {
+                fprintf(stderr, "--speed must be original or max\n");
+                return 1;
+            }
+        } else if (Arg("--threads")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.threads = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--write")) {
+            opt.write = true;
+        } else if (Arg("--direct-io")) {
+            opt.direct_io = true;
+        } else if (Arg("--qcow2-l2-cache")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.l2_cache_mb = std::strtoull(v, nullptr, 10);
+        } else if (Arg("--json")) {
+            opt.json = true;
+        } else if (Arg("--help") || Arg("-h")) {
+            PrintUsage(argv[0]);
+            return 0;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.trace.empty() || opt.image.empty()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (opt.threads == 0 || opt.threads > 256) {
+        fprintf(stderr, "--threads must be 1..256\n");
+        return 1;
+    }
+    return Run(opt);
+}
@@ -0,0 +1,574 @@
+// Microbenchmarks for the device hot paths: virtqueue pop/walk/push, raw
+// and qcow2 disk I/O, NAT header rewriting, virtio-gpu transfer and flush,
+// and IPC message encoding. Everything runs against buffers in this
+// process (fake guest memory, scratch files in %TEMP%), so no hypervisor
+// is needed. Results are one JSON object per line on stdout, for diffing
+// between builds; --text prints a table instead.
+
+#include "core/device/virtio/virtqueue.h"
+#include "core/vmm/utf8.h"
+#include "core/device/virtio/virtio_gpu.h"
+#include "core/device/virtio/raw_image.h"
+#include "core/device/virtio/qcow2.h"
+#include "core/device/virtio/qcow2_create.h"
+#include "core/net/net_backend.h"
+#include "ipc/protocol_v2.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+namespace {
+
+struct Options {
+    uint32_t time_ms = 1000;       // per benchmark
+    uint64_t disk_size = 256ULL << 20;
+    std::string filter;            // substring of the names to run
+    std::string dir;
+    bool text = false;
+};
+
+Options g_opt;
+int g_errors = 0;
+
+void Report(const char* name, uint64_t ops, double secs, uint64_t bytes) {
+    if (secs <= 0) secs = 1e-9;
+    double ns_per_op = ops ? secs * 1e9 / ops : 0;
+    double mib_s = bytes / secs / (1024.0 * 1024.0);
+    if (g_opt.text) {
+        printf("%-32s %10llu ops %10.1f ns/op %12.0f ops/s", name,
+               static_cast<unsigned long long>(ops), ns_per_op, ops / secs);
+        if (bytes) printf(" %9.1f MiB/s", mib_s);
+        printf("\n");
+    } else {
+        printf("{\"name\":\"%s\",\"ops\":%llu,\"seconds\":%.6f,\"ns_per_op\":%.1f,"
+               "\"ops_per_s\":%.0f,\"bytes\":%llu,\"mib_per_s\":%.1f}\n",
+               name, static_cast<unsigned long long>(ops), secs, ns_per_op, ops / secs,
+               static_cast<unsigned long long>(bytes), mib_s);
+    }
+    fflush(stdout);
+}
+
+bool Selected(const char* name) {
+    return g_opt.filter.empty() || std::strstr(name, g_opt.filter.c_str());
+}
+
+// Runs `op` in batches of `batch` until the time budget is spent. `op`
+// returns false to stop early (an error, counted once).
+void Measure(const char* name, uint32_t batch, uint64_t bytes_per_op,
+             const std::function<bool()>& op) {
+    if (!Selected(name)) return;
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    auto budget = std::chrono::milliseconds(g_opt.time_ms);
+    uint64_t ops = 0;
+    bool failed = false;
+    while (!failed && Clock::now() - start < budget) {
+        for (uint32_t i = 0; i < batch; i++) {
+            if (!op()) {
+                failed = true;
+                break;
+            }
+            ops++;
+        }
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    if (failed) {
+        fprintf(stderr, "%s: failed after %llu ops\n", name,
+                static_cast<unsigned long long>(ops));
+        g_errors++;
+    }
+    Report(name, ops, secs, ops * bytes_per_op);
+}
+
+// Fake guest RAM holding one split virtqueue, filled the way a driver
+// fills it.
+class SplitRing {
+public:
+    static constexpr uint32_t kQueueSize = 256;
+    static constexpr uint64_t kDescGpa = 0x0;
+    static constexpr uint64_t kAvailGpa = 0x1000;
+    static constexpr uint64_t kUsedGpa = 0x2000;
+    static constexpr uint64_t kIndirectGpa = 0x4000;
+    static constexpr uint64_t kDataGpa = 0x100000;
+
+    explicit SplitRing(uint64_t mem_size) : buf_(mem_size) {
+        mem_.base = buf_.data();
+        mem_.alloc_size = mem_size;
+        mem_.low_size = mem_size;
+        vq_.Setup(kQueueSize, mem_);
+        vq_.SetDescAddr(kDescGpa);
+        vq_.SetDriverAddr(kAvailGpa);
+        vq_.SetDeviceAddr(kUsedGpa);
+        vq_.SetReady(true);
+    }
+
+    VirtQueue& vq() { return vq_; }
+    const GuestMemMap& mem() const { return mem_; }
+    uint8_t* At(uint64_t gpa) { return buf_.data() + gpa; }
+    VirtqDesc* Desc() { return reinterpret_cast<VirtqDesc*>(At(kDescGpa)); }
+
+    void Publish(uint16_t head) {
+        auto* avail = reinterpret_cast<VirtqAvail*>(At(kAvailGpa));
+        auto* ring = reinterpret_cast<uint16_t*>(avail + 1);
+        ring[avail->idx % kQueueSize] = head;
+        avail->idx++;
+    }
+
+    // A chain of `count` data descriptors from slot `head`, the last one
+    // device-writable, as a request/response pair would be.
+    void WriteChain(uint16_t head, uint32_t count, uint32_t len) {
+        VirtqDesc* desc = Desc();
+        for (uint32_t i = 0; i < count; i++) {
+            uint16_t idx = static_cast<uint16_t>(head + i);
+            bool last = i + 1 == count;
+            desc[idx] = {kDataGpa + static_cast<uint64_t>(idx) * len, len,
+                         static_cast<uint16_t>((last ? VIRTQ_DESC_F_WRITE : VIRTQ_DESC_F_NEXT)),
+                         static_cast<uint16_t>(last ? 0 : idx + 1)};
+        }
+    }
+
+private:
+    std::vector<uint8_t> buf_;
+    GuestMemMap mem_;
+    VirtQueue vq_;
+};
+
+void BenchVirtQueue() {
+    constexpr uint32_t kLen = 4096;
+    SplitRing ring(SplitRing::kDataGpa + SplitRing::kQueueSize * kLen);
+    VirtqChain chain;
+
+    auto Cycle = [&](uint32_t chains) {
+        for (uint32_t i = 0; i < chains; i++) ring.Publish(0);
+        uint16_t head;
+        uint32_t done = 0;
+        while (ring.vq().PopAvail(&head)) {
+            if (!ring.vq().WalkChain(head, &chain)) return false;
+            ring.vq().PushUsed(head, kLen);
+            done++;
+        }
+        ring.vq().ShouldNotify();
+        return done == chains;
+    };
+
+    ring.WriteChain(0, 1, kLen);
+    Measure("virtqueue.split.chain1", 1024, 0, [&] { return Cycle(1); });
+    ring.WriteChain(0, 4, kLen);
+    Measure("virtqueue.split.chain4", 1024, 0, [&] { return Cycle(1); });
+    // A burst the way a busy guest leaves one; reported per burst.
+    Measure("virtqueue.split.chain4.burst64", 64, 0, [&] { return Cycle(64); });
+
+    // One descriptor pointing at an indirect table of 16.
+    constexpr uint32_t kIndirect = 16;
+    auto* table = reinterpret_cast<VirtqDesc*>(ring.At(SplitRing::kIndirectGpa));
+    for (uint32_t i = 0; i < kIndirect; i++) {
+        bool last = i + 1 == kIndirect;
+        table[i] = {SplitRing::kDataGpa + static_cast<uint64_t>(i) * kLen, kLen,
+                    static_cast<uint16_t>(last ? VIRTQ_DESC_F_WRITE : VIRTQ_DESC_F_NEXT),
+                    static_cast<uint16_t>(last ? 0 : i + 1)};
+    }
+    ring.Desc()[0] = {SplitRing::kIndirectGpa,
+                      static_cast<uint32_t>(kIndirect * sizeof(VirtqDesc)),
+                      VIRTQ_DESC_F_INDIRECT, 0};
+    Measure("virtqueue.split.indirect16", 1024, 0, [&] { return Cycle(1); });
+}
+
+std::string ScratchPath(const wchar_t* name) {
+    std::wstring dir;
+    if (g_opt.dir.empty()) {
+        wchar_t tmp[MAX_PATH];
+        DWORD n = GetTempPathW(MAX_PATH, tmp);
+        if (!n || n > MAX_PATH) return {};
+        dir.assign(tmp, n);
+    } else {
+        dir = Utf8ToWide(g_opt.dir);
+        if (!dir.empty() && dir.back() != L'\\') dir.push_back(L'\\');
+    }
+    return WideToUtf8(dir + L"tenbox-bench-" + std::to_wstring(GetCurrentProcessId()) +
+                      L"-" + name);
+}
+
+// A raw image of `size` bytes with every block written once, so reads hit
+// allocated extents rather than holes.
+bool CreateRawFile(const std::string& path, uint64_t size) {
+    HANDLE file = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    std::vector<uint8_t> chunk(1 << 20, 0x5A);
+    bool ok = true;
+    for (uint64_t off = 0; ok && off < size; off += chunk.size()) {
+        DWORD len = static_cast<DWORD>(std::min<uint64_t>(chunk.size(), size - off));
+        DWORD written = 0;
+        ok = WriteFile(file, chunk.data(), len, &written, nullptr) && written == len;
+    }
+    CloseHandle(file);
+    return ok;
+}
+
+void BenchDiskOps(const char* prefix, DiskImage* disk) {
+    constexpr uint32_t kRandom = 4096;
+    constexpr uint32_t kSequential = 128 * 1024;
+    uint64_t size = disk->GetSize();
+    if (size < kSequential) return;
+    std::vector<uint8_t> buf(kSequential, 0xC3);
+    std::mt19937_64 rng(42);
+    uint64_t blocks = size / kRandom;
+    uint64_t seq = 0;
+    auto Next = [&] {
+        uint64_t off = seq;
+        seq += kSequential;
+        if (seq + kSequential > size) seq = 0;
+        return off;
+    };
+    std::string name;
+
+    name = std::string(prefix) + ".seqread.128k";
+    Measure(name.c_str(), 64, kSequential, [&] { return disk->Read(Next(), buf.data(), kSequential); });
+    name = std::string(prefix) + ".randread.4k";
+    Measure(name.c_str(), 256, kRandom, [&] {
+        return disk->Read((rng() % blocks) * kRandom, buf.data(), kRandom);
+    });
+    seq = 0;
+    name = std::string(prefix) + ".seqwrite.128k";
+    Measure(name.c_str(), 64, kSequential, [&] { return disk->Write(Next(), buf.data(), kSequential); });
+    name = std::string(prefix) + ".randwrite.4k";
+    Measure(name.c_str(), 256, kRandom, [&] {
+        return disk->Write((rng() % blocks) * kRandom, buf.data(), kRandom);
+    });
+    name = std::string(prefix) + ".flush";
+    Measure(name.c_str(), 1, 0, [&] { return disk->Flush(); });
+}
+
+void BenchDisk() {
+    if (!Selected("raw.") && !Selected("qcow2.")) return;
+    std::string raw_path = ScratchPath(L"disk.raw");
+    std::string qcow2_path = ScratchPath(L"overlay.qcow2");
+    if (raw_path.empty() || !CreateRawFile(raw_path, g_opt.disk_size)) {
+        fprintf(stderr, "Cannot create scratch disk %s\n", raw_path.c_str());
+        g_errors++;
+        return;
+    }
+
+    {
+        RawDiskImage raw;
+        if (raw.Open(raw_path, {})) {
+            BenchDiskOps("raw", &raw);
+        } else {
+            fprintf(stderr, "Cannot open %s\n", raw_path.c_str());
+            g_errors++;
+        }
+    }
+
+    // An overlay over the raw image: the first write to a cluster
+    // allocates it, reads of the rest fall through to the backing file.
+    std::string error;
+    if (Selected("qcow2.") && CreateQcow2Overlay(qcow2_path, raw_path, &error)) {
+        Qcow2DiskImage qcow2;
+        if (qcow2.Open(qcow2_path, {})) {
+            // One pass over the whole image, however long it takes.
+            if (Selected("qcow2.seqwrite.128k.alloc")) {
+                constexpr uint32_t kWrite = 128 * 1024;
+                std::vector<uint8_t> buf(kWrite, 0x3C);
+                auto start = std::chrono::steady_clock::now();
+                uint64_t ops = 0;
+                for (uint64_t off = 0; off + kWrite <= qcow2.GetSize(); off += kWrite, ops++) {
+                    if (!qcow2.Write(off, buf.data(), kWrite)) {
+                        fprintf(stderr, "qcow2.seqwrite.128k.alloc: failed at %llu\n",
+                                static_cast<unsigned long long>(off));
+                        g_errors++;
+                        break;
+                    }
+                }
+                Report("qcow2.seqwrite.128k.alloc", ops,
+                       std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                       ops * kWrite);
+            }
+            BenchDiskOps("qcow2", &qcow2);
+        } else {
+            fprintf(stderr, "Cannot open %s\n", qcow2_path.c_str());
+            g_errors++;
+        }
+    } else if (Selected("qcow2.")) {
+        fprintf(stderr, "Cannot create qcow2 overlay: %s\n", error.c_str());
+        g_errors++;
+    }
+
+    DeleteFileW(Utf8ToWide(qcow2_path).c_str());
+    DeleteFileW(Utf8ToWide(raw_path).c_str());
+}
+
+// An Ethernet + IPv4 + TCP or UDP header and a payload the rewrite never
+// touches. The checksums are arbitrary; the rewrite only patches them.
+std::vector<uint8_t> MakeFrame(uint8_t proto, uint32_t src_ip, uint32_t dst_ip) {
+    std::vector<uint8_t> frame(14 + 20 + 20 + 1024, 0);
+    frame[12] = 0x08;  // IPv4
+    uint8_t* ip = frame.data() + 14;
+    ip[0] = 0x45;
+    uint16_t total = static_cast<uint16_t>(frame.size() - 14);
+    ip[2] = static_cast<uint8_t>(total >> 8);
+    ip[3] = static_cast<uint8_t>(total);
+    ip[8] = 64;
+    ip[9] = proto;
+    for (int i = 0; i < 4; i++) {
+        ip[12 + i] = static_cast<uint8_t>(src_ip >> (24 - 8 * i));
+        ip[16 + i] = static_cast<uint8_t>(dst_ip >> (24 - 8 * i));
+    }
+    uint8_t* l4 = ip + 20;
+    l4[0] = 0xC0; l4[1] = 0x01;  // ports 49153 -> 443
+    l4[2] = 0x01; l4[3] = 0xBB;
+    if (proto == 6) {
+        l4[12] = 0x50;            // data offset 5
+        l4[16] = 0x12; l4[17] = 0x34;
+    } else {
+        l4[6] = 0x12; l4[7] = 0x34;
+    }
+    return frame;
+}
+
+void BenchNat() {
+    constexpr uint32_t kRemote = 0x5DB8D822;  // 93.184.216.34
+    for (uint8_t proto : {uint8_t(6), uint8_t(17)}) {
+        const char* l4 = proto == 6 ? "tcp" : "udp";
+        // Guest to host, then back, so every pass starts from the same frame.
+        auto frame = MakeFrame(proto, NetBackend::kGuestIp, kRemote);
+        std::string name = std::string("nat.rewrite.") + l4;
+        Measure(name.c_str(), 4096, 0, [&] {
+            NetBackend::RewriteDestination(frame.data(), NetBackend::kGatewayIp, 40000);
+            NetBackend::RewriteDestination(frame.data(), kRemote, 443);
+            return true;
+        });
+        auto reply = MakeFrame(proto, NetBackend::kGatewayIp, NetBackend::kGuestIp);
+        name = std::string("nat.reverse_rewrite.") + l4;
+        Measure(name.c_str(), 4096, 0, [&] {
+            NetBackend::RewriteSource(reply.data(), kRemote, 443);
+            NetBackend::RewriteSource(reply.data(), NetBackend::kGatewayIp, 40000);
+            return true;
+        });
+    }
+}
+
+// Drives VirtioGpuDevice's control queue without the worker thread, so
+// each command runs to completion inside OnQueueNotify().
+class GpuDriver {
+public:
+    static constexpr uint64_t kCmdGpa = 0x8000;
+    static constexpr uint64_t kRespGpa = 0xC000;
+    static constexpr uint64_t kFbGpa = 0x100000;
+
+    GpuDriver(VirtioGpuDevice* dev, uint64_t mem_size) : dev_(dev), ring_(mem_size) {
+        dev_->SetMemMap(ring_.mem());
+    }
+
+    uint8_t* At(uint64_t gpa) { return ring_.At(gpa); }
+
+    template <typename Cmd>
+    bool Call(const Cmd& cmd, const void* extra = nullptr, uint32_t extra_len = 0) {
+        std::memcpy(At(kCmdGpa), &cmd, sizeof(cmd));
+        if (extra_len) std::memcpy(At(kCmdGpa) + sizeof(cmd), extra, extra_len);
+        auto* resp = reinterpret_cast<VirtioGpuCtrlHdr*>(At(kRespGpa));
+        resp->type = 0;
+        VirtqDesc* desc = ring_.Desc();
+        desc[0] = {kCmdGpa, static_cast<uint32_t>(sizeof(cmd) + extra_len), VIRTQ_DESC_F_NEXT, 1};
+        desc[1] = {kRespGpa, 4096, VIRTQ_DESC_F_WRITE, 0};
+        ring_.Publish(0);
+        dev_->OnQueueNotify(0, ring_.vq());
+        return resp->type == VIRTIO_GPU_RESP_OK_NODATA;
+    }
+
+private:
+    VirtioGpuDevice* dev_;
+    SplitRing ring_;
+};
+
+void BenchGpu() {
+    if (!Selected("gpu.")) return;
+    constexpr uint32_t kWidth = 1920, kHeight = 1080, kPage = 4096;
+    constexpr uint32_t kResource = 1;
+    constexpr uint64_t kFbSize = static_cast<uint64_t>(kWidth) * kHeight * 4;
+    uint64_t frames = 0;
+    VirtioGpuDevice dev(kWidth, kHeight, 1);
+    dev.SetFrameCallback([&](DisplayFrame) { frames++; });
+    GpuDriver gpu(&dev, GpuDriver::kFbGpa + kFbSize + kPage);
+
+    VirtioGpuResourceCreate2d create = {};
+    create.hdr.type = VIRTIO_GPU_CMD_RESOURCE_CREATE_2D;
+    create.resource_id = kResource;
+    create.format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+    create.width = kWidth;
+    create.height = kHeight;
+
+    // Guest framebuffers are scattered pages; list them out of order so
+    // the device cannot treat the backing as one mapping.
+    uint32_t pages = static_cast<uint32_t>((kFbSize + kPage - 1) / kPage);
+    std::vector<VirtioGpuMemEntry> entries(pages);
+    for (uint32_t i = 0; i < pages; i++) {
+        uint32_t page = (i ^ 1) < pages ? (i ^ 1) : i;
+        entries[i] = {GpuDriver::kFbGpa + static_cast<uint64_t>(page) * kPage, kPage, 0};
+    }
+    VirtioGpuResourceAttachBacking attach = {};
+    attach.hdr.type = VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING;
+    attach.resource_id = kResource;
+    attach.nr_entries = pages;
+
+    VirtioGpuSetScanout scanout = {};
+    scanout.hdr.type = VIRTIO_GPU_CMD_SET_SCANOUT;
+    scanout.r = {0, 0, kWidth, kHeight};
+    scanout.resource_id = kResource;
+
+    if (!gpu.Call(create) ||
+        !gpu.Call(attach, entries.data(), static_cast<uint32_t>(pages * sizeof(entries[0]))) ||
+        !gpu.Call(scanout)) {
+        fprintf(stderr, "gpu: resource setup failed\n");
+        g_errors++;
+        return;
+    }
+
+    VirtioGpuTransferToHost2d transfer = {};
+    transfer.hdr.type = VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D;
+    transfer.r = {0, 0, kWidth, kHeight};
+    transfer.resource_id = kResource;
+    VirtioGpuResourceFlush flush = {};
+    flush.hdr.type = VIRTIO_GPU_CMD_RESOURCE_FLUSH;
+    flush.r = {0, 0, kWidth, kHeight};
+    flush.resource_id = kResource;
+
+    Measure("gpu.transfer.1080p", 8, kFbSize, [&] { return gpu.Call(transfer); });
+    // Nothing redrawn: the diff against the shadow drops every tile.
+    Measure("gpu.transfer_flush.1080p.unchanged", 8, kFbSize, [&] {
+        return gpu.Call(transfer) && gpu.Call(flush);
+    });
+    // A word changed on every page, so every tile row is sent.
+    uint32_t stamp = 0;
+    Measure("gpu.transfer_flush.1080p.changed", 8, kFbSize, [&] {
+        stamp++;
+        for (uint64_t off = 0; off < kFbSize; off += kPage) {
+            std::memcpy(gpu.At(GpuDriver::kFbGpa + off), &stamp, sizeof(stamp));
+        }
+        return gpu.Call(transfer) && gpu.Call(flush);
+    });
+    if (g_opt.text) printf("%-32s %10llu frames\n", "gpu.frames", static_cast<unsigned long long>(frames));
+}
+
+void BenchIpc() {
+    ipc::Message control;
+    control.channel = ipc::Channel::kControl;
+    control.kind = ipc::Kind::kEvent;
+    control.type = "runtime.state";
+    control.vm_id = "0b5e1c9a-2f44-4a7e-9d1b-6c3f0e8a7d21";
+    control.request_id = 1234;
+    control.fields["state"] = "running";
+    control.fields["exit_code"] = "0";
+    control.fields["protocol"] = "2";
+
+    ipc::Message pointer;
+    pointer.channel = ipc::Channel::kInput;
+    pointer.kind = ipc::Kind::kEvent;
+    pointer.type = "input.pointer_event";
+    pointer.vm_id = control.vm_id;
+    pointer.body = ipc::PointerEventBody{512, 384, 1};
+
+    ipc::Message frame;
+    frame.channel = ipc::Channel::kDisplay;
+    frame.kind = ipc::Kind::kEvent;
+    frame.type = "display.frame";
+    frame.vm_id = control.vm_id;
+    frame.body = ipc::DisplayFrameBody{0, 256, 256, 1024, 2, 1920, 1080, 0, 0, 0};
+    frame.payload.assign(256 * 1024, 0x7F);
+
+    struct Case { const char* name; const ipc::Message* message; };
+    const Case cases[] = {{"control", &control}, {"pointer", &pointer}, {"frame256k", &frame}};
+    for (const auto& c : cases) {
+        for (uint32_t version : {1u, 2u}) {
+            uint64_t bytes = c.message->payload.size();
+            std::string encoded = ipc::Encode(*c.message, version);
+            std::string name = std::string("ipc.encode.v") + std::to_string(version) + "." + c.name;
+            Measure(name.c_str(), 256, bytes, [&] {
+                return !ipc::Encode(*c.message, version).empty();
+            });
+
+            // Through the stream decoder, as the pipe reader sees it.
+            ipc::StreamDecoder decoder;
+            ipc::Message out;
+            name = std::string("ipc.decode.v") + std::to_string(version) + "." + c.name;
+            Measure(name.c_str(), 256, bytes, [&] {
+                decoder.Append(encoded.data(), encoded.size());
+                return decoder.Next(&out) && out.type == c.message->type;
+            });
+        }
+    }
+}
+
+void PrintUsage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  --time <MS>       Time spent on each benchmark (default: 1000)\n"
+        "  --disk-size <MB>  Scratch disk image size (default: 256)\n"
+        "  --filter <str>    Only run benchmarks whose name contains str\n"
+        "  --dir <path>      Where scratch disk images go (default: %%TEMP%%)\n"
+        "  --text            Print a table instead of JSON lines\n"
+        "\n"
+        "Benchmarks: virtqueue.*, raw.*, qcow2.*, nat.*, gpu.*, ipc.*\n",
+        prog);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        auto Arg = [&](const char* flag) {
+            return std::strcmp(argv[i], flag) == 0;
+        };
+        auto NextArg = [&]() -> const char* {
+            if (i + 1 < argc) return argv[++i];
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return nullptr;
+        };
+
+        if (Arg("--time")) {
+            auto v = NextArg(); if (!v) return 1;
+            g_opt.time_ms = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--disk-size")) {
+            auto v = NextArg(); if (!v) return 1;
+            g_opt.disk_size = std::strtoull(v, nullptr, 10) << 20;
+        } else if (Arg("--filter")) {
+            auto v = NextArg(); if (!v) return 1;
+            g_opt.filter = v;
+        } else if (Arg("--dir")) {
+            auto v = NextArg(); if (!v) return 1;
+            g_opt.dir = v;
+        } else if (Arg("--text")) {
+            g_opt.text = true;
+        } else if (Arg("--help") || Arg("-h")) {
+            PrintUsage(argv[0]);
+            return 0;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (g_opt.time_ms == 0 || g_opt.disk_size < (1ULL << 20)) {
+        fprintf(stderr, "--time must be nonzero and --disk-size at least 1\n");
+        return 1;
+    }
+
+    BenchVirtQueue();
+    BenchDisk();
+    BenchNat();
+    BenchGpu();
+    BenchIpc();
+
+    if (g_errors) fprintf(stderr, "%d benchmarks failed\n", g_errors);
+    return g_errors ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+// DamageRegion: overlapping rects merge, chains of overlaps fold into one,
+// disjoint ones stay apart up to kMaxRects, and past that the cheapest
+// pair merges. Whatever merges, every damaged pixel stays covered. Exits
+// nonzero on a mismatch.
+
+#include "runtime/display_damage.h"
+#include "expect.h"
+
+#include <vector>
+
+namespace {
+
+bool SameRect(const DamageRect& r, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    return r.x == x && r.y == y && r.width == w && r.height == h;
+}
+
+bool Contains(const DamageRect& outer, const DamageRect& inner) {
+    return inner.x >= outer.x && inner.y >= outer.y &&
+           inner.x + inner.width <= outer.x + outer.width &&
+           inner.y + inner.height <= outer.y + outer.height;
+}
+
+// Every pixel of every added rect lies in some rect of |out|.
+bool Covers(const std::vector<DamageRect>& out, const std::vector<DamageRect>& added) {
+    for (const auto& a : added) {
+        for (uint32_t y = a.y; y < a.y + a.height; y++) {
+            for (uint32_t x = a.x; x < a.x + a.width; x++) {
+                bool hit = false;
+                for (const auto& r : out) {
+                    if (Contains(r, {x, y, 1, 1})) {
+                        hit = true;
+                        break;
+                    }
+                }
+                if (!hit) return false;
+            }
+        }
+    }
+    return true;
+}
+
+void TestEmptyRectsIgnored() {
+    DamageRegion region;
+    region.Add({10, 10, 0, 5});
+    region.Add({10, 10, 5, 0});
+    EXPECT(region.empty());
+}
+
+void TestOverlapMerges() {
+    DamageRegion region;
+    region.Add({0, 0, 10, 10});
+    region.Add({5, 5, 10, 10});
+    auto rects = region.Take();
+    EXPECT(rects.size() == 1);
+    if (rects.size() == 1) EXPECT(SameRect(rects[0], 0, 0, 15, 15));
+    EXPECT(region.empty());
+}
+
+void TestTouchingStaysApart() {
+    // Edges that meet do not overlap.
+    DamageRegion region;
+    region.Add({0, 0, 10, 10});
+    region.Add({10, 0, 10, 10});
+    EXPECT(region.Take().size() == 2);
+}
+
+void TestChainFoldsIntoOne() {
+    // Two apart, then one that overlaps both: the union of the first merge
+    // must pick up the other.
+    DamageRegion region;
+    region.Add({0, 0, 10, 10});
+    region.Add({20, 0, 10, 10});
+    region.Add({8, 2, 14, 2});
+    auto rects = region.Take();
+    EXPECT(rects.size() == 1);
+    if (rects.size() == 1) EXPECT(SameRect(rects[0], 0, 0, 30, 10));
+}
+
+void TestContainedRect() {
+    DamageRegion region;
+    region.Add({0, 0, 100, 100});
+    region.Add({10, 10, 5, 5});
+    auto rects = region.Take();
+    EXPECT(rects.size() == 1);
+    if (rects.size() == 1) EXPECT(SameRect(rects[0], 0, 0, 100, 100));
+}
+
+void TestLimitMergesCheapestPair() {
+    // A row of far-apart squares and, past the limit, one right beside the
+    // first: merging those two wastes the least.
+    DamageRegion region;
+    std::vector<DamageRect> added;
+    for (uint32_t i = 0; i < DamageRegion::kMaxRects; i++) {
+        added.push_back({i * 100, 0, 10, 10});
+    }
+    added.push_back({12, 0, 10, 10});
+    for (const auto& r : added) region.Add(r);
+
+    auto rects = region.Take();
+    EXPECT(rects.size() == DamageRegion::kMaxRects);
+    bool merged_pair = false;
+    for (const auto& r : rects) {
+        if (SameRect(r, 0, 0, 22, 10)) merged_pair = true;
+    }
+    EXPECT(merged_pair);
+    EXPECT(Covers(rects, added));
+}
+
+void TestManyRectsStayCovered() {
+    DamageRegion region;
+    std::vector<DamageRect> added;
+    uint32_t seed = 12345;
+    auto next = [&seed] {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) & 0x7FFF;
+    };
+    for (int i = 0; i < 200; i++) {
+        DamageRect r{next() % 200, next() % 150, 1 + next() % 24, 1 + next() % 24};
+        added.push_back(r);
+        region.Add(r);
+        EXPECT(!region.empty());
+    }
+    auto rects = region.Take();
+    EXPECT(rects.size() <= DamageRegion::kMaxRects);
+    EXPECT(Covers(rects, added));
+}
+
+}  // namespace
+
+int main() {
+    TestEmptyRectsIgnored();
+    TestOverlapMerges();
+    TestTouchingStaysApart();
+    TestChainFoldsIntoOne();
+    TestContainedRect();
+    TestLimitMergesCheapestPair();
+    TestManyRectsStayCovered();
+    return test::TestResult("display_damage_test");
+}
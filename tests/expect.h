@@ -0,0 +1,30 @@
+#pragma once
+
+// Check macro for the unit tests. EXPECT prints each failed condition
+// with its file and line and carries on; main() returns TestResult().
+
+#include <cstdio>
+
+namespace test {
+
+inline int g_failures = 0;
+
+inline void Expect(bool ok, const char* what, const char* file, int line) {
+    if (ok) return;
+    std::fprintf(stderr, "%s:%d: %s\n", file, line, what);
+    g_failures++;
+}
+
+// Exit code for main(): nonzero if any check failed.
+inline int TestResult(const char* name) {
+    if (g_failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
+
+}  // namespace test
+
+#define EXPECT(cond) ::test::Expect((cond), #cond, __FILE__, __LINE__)
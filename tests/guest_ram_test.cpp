@@ -0,0 +1,71 @@
+// NodeGuestRam::Split: equal shares per host node, aligned down, with what
+// is left in the last piece. Prints each mismatch and exits nonzero if
+// there was one.
+
+#include "core/vmm/guest_ram.h"
+#include "expect.h"
+
+#include <vector>
+
+namespace {
+
+constexpr uint64_t kMiB = 1ULL << 20;
+constexpr uint64_t kGiB = 1ULL << 30;
+
+bool SamePiece(const NodeGuestRam::Piece& p, uint64_t offset, uint64_t size,
+               uint32_t host_node) {
+    return p.offset == offset && p.size == size && p.host_node == host_node;
+}
+
+void TestEvenSplit() {
+    auto pieces = NodeGuestRam::Split(8 * kGiB, {0, 1}, 2 * kMiB);
+    EXPECT(pieces.size() == 2);
+    if (pieces.size() != 2) return;
+    EXPECT(SamePiece(pieces[0], 0, 4 * kGiB, 0));
+    EXPECT(SamePiece(pieces[1], 4 * kGiB, 4 * kGiB, 1));
+}
+
+void TestRemainderInLastPiece() {
+    // 4102 MiB over three nodes: 1367.3 MiB each, aligned down to 1366.
+    auto pieces = NodeGuestRam::Split(4 * kGiB + 6 * kMiB, {3, 1, 2}, 2 * kMiB);
+    EXPECT(pieces.size() == 3);
+    if (pieces.size() != 3) return;
+    EXPECT(SamePiece(pieces[0], 0, 1366 * kMiB, 3));
+    EXPECT(SamePiece(pieces[1], 1366 * kMiB, 1366 * kMiB, 1));
+    EXPECT(SamePiece(pieces[2], 2732 * kMiB, 1370 * kMiB, 2));
+}
+
+void TestPiecesCoverRam() {
+    const uint64_t size = 3 * kGiB + 100 * kMiB + 4096;
+    const uint64_t align = 64 * 1024;
+    auto pieces = NodeGuestRam::Split(size, {0, 1, 2, 3}, align);
+    EXPECT(pieces.size() == 4);
+    uint64_t next = 0;
+    for (const auto& piece : pieces) {
+        EXPECT(piece.offset == next);
+        EXPECT(piece.offset % align == 0);
+        next = piece.offset + piece.size;
+    }
+    EXPECT(next == size);
+}
+
+void TestOneNode() {
+    auto pieces = NodeGuestRam::Split(5 * kGiB + 4096, {7}, 2 * kMiB);
+    EXPECT(pieces.size() == 1);
+    if (pieces.size() == 1) EXPECT(SamePiece(pieces[0], 0, 5 * kGiB + 4096, 7));
+}
+
+void TestNoNodes() {
+    EXPECT(NodeGuestRam::Split(4 * kGiB, {}, 2 * kMiB).empty());
+}
+
+}  // namespace
+
+int main() {
+    TestEvenSplit();
+    TestRemainderInLastPiece();
+    TestPiecesCoverRam();
+    TestOneNode();
+    TestNoNodes();
+    return test::TestResult("guest_ram_test");
+}
@@ -0,0 +1,370 @@
+// virtio-fs throughput benchmark. Drives VirtioFsDevice through a request
+// queue laid out in a fake guest memory buffer, the way the guest driver
+// does, against a scratch directory on the host. Requests complete inline
+// (no worker threads), so the numbers are per-request device cost.
+
+#include "core/device/virtio/virtio_fs.h"
+#include "core/vmm/utf8.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kQueueSize = 16;
+constexpr uint32_t kRequestQueue = 2;  // after hiprio and notification
+
+// Guest memory layout, one request in flight at a time.
+constexpr uint64_t kDescGpa = 0x0;
+constexpr uint64_t kAvailGpa = 0x1000;
+constexpr uint64_t kUsedGpa = 0x2000;
+constexpr uint64_t kRequestGpa = 0x10000;   // header and arguments
+constexpr uint64_t kPayloadGpa = 0x100000;  // WRITE data
+constexpr uint64_t kReplyGpa = 0x600000;    // reply header and data
+constexpr uint64_t kMaxIo = 4 * 1024 * 1024;
+constexpr uint64_t kMemSize = 0xC00000;
+
+constexpr uint32_t kLinuxRdOnly = 0;
+constexpr uint32_t kLinuxRdWr = 2;
+constexpr uint32_t kLinuxCreat = 0100;
+
+class FuseDriver {
+public:
+    explicit FuseDriver(VirtioFsDevice* dev) : dev_(dev), mem_buf_(kMemSize) {
+        mem_.base = mem_buf_.data();
+        mem_.alloc_size = kMemSize;
+        mem_.low_size = kMemSize;
+        vq_.Setup(kQueueSize, mem_);
+        vq_.SetDescAddr(kDescGpa);
+        vq_.SetDriverAddr(kAvailGpa);
+        vq_.SetDeviceAddr(kUsedGpa);
+        vq_.SetReady(true);
+    }
+
+    uint8_t* Payload() { return mem_buf_.data() + kPayloadGpa; }
+    const FuseOutHeader* ReplyHeader() const {
+        return reinterpret_cast<const FuseOutHeader*>(mem_buf_.data() + kReplyGpa);
+    }
+    const uint8_t* Reply() const {
+        return mem_buf_.data() + kReplyGpa + sizeof(FuseOutHeader);
+    }
+
+    // Sends one request and runs it to completion. Returns the FUSE error.
+    int32_t Call(uint32_t opcode, uint64_t nodeid, const void* args, size_t args_len,
+                 const std::string& name = {}, uint32_t payload_len = 0,
+                 uint32_t reply_len = 4096) {
+        uint8_t* req = mem_buf_.data() + kRequestGpa;
+        FuseInHeader hdr = {};
+        hdr.opcode = opcode;
+        hdr.unique = ++unique_;
+        hdr.nodeid = nodeid;
+        uint32_t req_len = static_cast<uint32_t>(sizeof(hdr) + args_len);
+        memcpy(req + sizeof(hdr), args, args_len);
+        if (!name.empty()) {
+            memcpy(req + req_len, name.c_str(), name.size() + 1);
+            req_len += static_cast<uint32_t>(name.size() + 1);
+        }
+        hdr.len = req_len + payload_len;
+        memcpy(req, &hdr, sizeof(hdr));
+
+        auto* desc = reinterpret_cast<VirtqDesc*>(mem_buf_.data() + kDescGpa);
+        uint16_t n = 0;
+        desc[n++] = {kRequestGpa, req_len, VIRTQ_DESC_F_NEXT, 1};
+        if (payload_len) desc[n++] = {kPayloadGpa, payload_len, VIRTQ_DESC_F_NEXT, 2};
+        desc[n] = {kReplyGpa, static_cast<uint32_t>(sizeof(FuseOutHeader) + reply_len),
+                   VIRTQ_DESC_F_WRITE, 0};
+
+        auto* avail = reinterpret_cast<VirtqAvail*>(mem_buf_.data() + kAvailGpa);
+        auto* ring = reinterpret_cast<uint16_t*>(avail + 1);
+        ring[avail->idx % kQueueSize] = 0;
+        avail->idx++;
+
+        auto* reply = reinterpret_cast<FuseOutHeader*>(mem_buf_.data() + kReplyGpa);
+        memset(reply, 0, sizeof(*reply));
+        dev_->OnQueueNotify(kRequestQueue, vq_);
+        if (reply->unique != hdr.unique) {
+            // FORGET gets no reply.
+            return opcode == FUSE_FORGET ? FUSE_OK : FUSE_EIO;
+        }
+        return reply->error;
+    }
+
+private:
+    VirtioFsDevice* dev_;
+    std::vector<uint8_t> mem_buf_;
+    GuestMemMap mem_;
+    VirtQueue vq_;
+    uint64_t unique_ = 0;
+};
+
+struct Options {
+    uint32_t files = 256;
+    uint64_t file_size = 1024 * 1024;
+    uint32_t io_size = 128 * 1024;
+    bool writeback = false;
+    size_t trace = 0;
+    std::string dir;
+};
+
+class Phase {
+public:
+    explicit Phase(const char* name) : name_(name), start_(std::chrono::steady_clock::now()) {}
+    void Done(uint64_t ops, uint64_t bytes) const {
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        if (secs <= 0) secs = 1e-9;
+        printf("%-8s %8llu ops %10.0f ops/s", name_, static_cast<unsigned long long>(ops), ops / secs);
+        if (bytes) printf(" %9.1f MiB/s", bytes / secs / (1024.0 * 1024.0));
+        printf("\n");
+    }
+
+private:
+    const char* name_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+std::string MakeScratchDir(const std::string& base) {
+    std::wstring dir;
+    if (base.empty()) {
+        wchar_t tmp[MAX_PATH];
+        DWORD n = GetTempPathW(MAX_PATH, tmp);
+        if (!n || n > MAX_PATH) return {};
+        dir.assign(tmp, n);
+    } else {
+        int len = MultiByteToWideChar(CP_UTF8, 0, base.c_str(), -1, nullptr, 0);
+        dir.resize(len > 0 ? len - 1 : 0);
+        MultiByteToWideChar(CP_UTF8, 0, base.c_str(), -1, dir.data(), len);
+        if (!dir.empty() && dir.back() != L'\\') dir.push_back(L'\\');
+    }
+    dir += L"tenbox-fs-bench-" + std::to_wstring(GetCurrentProcessId());
+    if (!CreateDirectoryW(dir.c_str(), nullptr)) return {};
+    return WideToUtf8(dir);
+}
+
+void PrintUsage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  --files <N>       Files to create (default: 256)\n"
+        "  --size <KB>       Size of each file (default: 1024)\n"
+        "  --io <KB>         READ/WRITE request size, max 4096 (default: 128)\n"
+        "  --writeback       Share in writeback mode\n"
+        "  --trace <N>       Print the last N requests\n"
+        "  --dir <path>      Parent of the scratch directory (default: %%TEMP%%)\n",
+        prog);
+}
+
+int Run(const Options& opt) {
+    std::string dir = MakeScratchDir(opt.dir);
+    if (dir.empty()) {
+        fprintf(stderr, "Cannot create scratch directory\n");
+        return 1;
+    }
+
+    VirtioFsDevice dev;
+    if (!dev.AddShare("bench", dir, false, opt.writeback)) return 1;
+    dev.op_stats().SetTraceCapacity(opt.trace);
+    FuseDriver fuse(&dev);
+
+    FuseInitIn init_in = {FUSE_KERNEL_VERSION, FUSE_KERNEL_MINOR_VERSION, 128 * 1024,
+                          FUSE_ASYNC_READ | FUSE_WRITEBACK_CACHE | FUSE_PARALLEL_DIROPS};
+    if (fuse.Call(FUSE_INIT, 0, &init_in, sizeof(init_in)) != FUSE_OK ||
+        fuse.Call(FUSE_LOOKUP, VirtioFsInodeTable::kRootInode, nullptr, 0, "bench") != FUSE_OK) {
+        fprintf(stderr, "INIT or share lookup failed\n");
+        return 1;
+    }
+    uint64_t root = reinterpret_cast<const FuseEntryOut*>(fuse.Reply())->nodeid;
+    dev.op_stats().Reset();
+
+    memset(fuse.Payload(), 0xA5, opt.io_size);
+    std::vector<uint64_t> nodes(opt.files);
+    int errors = 0;
+
+    {
+        Phase phase("create");
+        for (uint32_t i = 0; i < opt.files; i++) {
+            FuseCreateIn create_in = {kLinuxRdWr | kLinuxCreat, 0100644, 022, 0};
+            if (fuse.Call(FUSE_CREATE, root, &create_in, sizeof(create_in),
+                          "f" + std::to_string(i)) != FUSE_OK) {
+                errors++;
+                continue;
+            }
+            nodes[i] = reinterpret_cast<const FuseEntryOut*>(fuse.Reply())->nodeid;
+            uint64_t fh = reinterpret_cast<const FuseOpenOut*>(
+                fuse.Reply() + sizeof(FuseEntryOut))->fh;
+            for (uint64_t off = 0; off < opt.file_size; off += opt.io_size) {
+                uint32_t len = static_cast<uint32_t>(std::min<uint64_t>(opt.io_size, opt.file_size - off));
+                FuseWriteIn write_in = {fh, off, len, 0, 0, kLinuxRdWr, 0};
+                if (fuse.Call(FUSE_WRITE, nodes[i], &write_in, sizeof(write_in), {}, len,
+                              sizeof(FuseWriteOut)) != FUSE_OK) {
+                    errors++;
+                }
+            }
+            FuseReleaseIn release_in = {fh, kLinuxRdWr, 0, 0};
+            if (fuse.Call(FUSE_FLUSH, nodes[i], &release_in, sizeof(release_in)) != FUSE_OK) errors++;
+            fuse.Call(FUSE_RELEASE, nodes[i], &release_in, sizeof(release_in));
+        }
+        phase.Done(opt.files, opt.files * opt.file_size);
+    }
+
+    {
+        Phase phase("stat");
+        for (uint32_t i = 0; i < opt.files; i++) {
+            FuseGetAttrIn getattr_in = {};
+            if (fuse.Call(FUSE_LOOKUP, root, nullptr, 0, "f" + std::to_string(i)) != FUSE_OK ||
+                fuse.Call(FUSE_GETATTR, nodes[i], &getattr_in, sizeof(getattr_in)) != FUSE_OK) {
+                errors++;
+            }
+        }
+        phase.Done(opt.files * 2ULL, 0);
+    }
+
+    {
+        Phase phase("read");
+        for (uint32_t i = 0; i < opt.files; i++) {
+            FuseOpenIn open_in = {kLinuxRdOnly, 0};
+            if (fuse.Call(FUSE_OPEN, nodes[i], &open_in, sizeof(open_in)) != FUSE_OK) {
+                errors++;
+                continue;
+            }
+            uint64_t fh = reinterpret_cast<const FuseOpenOut*>(fuse.Reply())->fh;
+            for (uint64_t off = 0; off < opt.file_size; off += opt.io_size) {
+                FuseReadIn read_in = {fh, off, opt.io_size, 0, 0, kLinuxRdOnly, 0};
+                if (fuse.Call(FUSE_READ, nodes[i], &read_in, sizeof(read_in), {}, 0,
+                              opt.io_size) != FUSE_OK) {
+                    errors++;
+                }
+            }
+            FuseReleaseIn release_in = {fh, kLinuxRdOnly, 0, 0};
+            fuse.Call(FUSE_RELEASE, nodes[i], &release_in, sizeof(release_in));
+        }
+        phase.Done(opt.files, opt.files * opt.file_size);
+    }
+
+    {
+        Phase phase("readdir");
+        uint64_t listed = 0;
+        FuseOpenIn open_in = {kLinuxRdOnly, 0};
+        if (fuse.Call(FUSE_OPENDIR, root, &open_in, sizeof(open_in)) == FUSE_OK) {
+            uint64_t fh = reinterpret_cast<const FuseOpenOut*>(fuse.Reply())->fh;
+            uint64_t offset = 0;
+            while (true) {
+                constexpr uint32_t kReadDirSize = 64 * 1024;
+                FuseReadIn read_in = {fh, offset, kReadDirSize, 0, 0, 0, 0};
+                if (fuse.Call(FUSE_READDIRPLUS, root, &read_in, sizeof(read_in), {}, 0,
+                              kReadDirSize) != FUSE_OK) {
+                    errors++;
+                    break;
+                }
+                size_t len = fuse.ReplyHeader()->len - sizeof(FuseOutHeader);
+                if (len == 0) break;
+                for (size_t pos = 0; pos < len;) {
+                    auto* ent = reinterpret_cast<const FuseDirentplus*>(fuse.Reply() + pos);
+                    offset = ent->dirent.off;
+                    listed++;
+                    pos += (sizeof(FuseDirentplus) + ent->dirent.namelen + 7) & ~size_t(7);
+                }
+            }
+            FuseReleaseIn release_in = {fh, 0, 0, 0};
+            fuse.Call(FUSE_RELEASEDIR, root, &release_in, sizeof(release_in));
+        } else {
+            errors++;
+        }
+        phase.Done(listed, 0);
+    }
+
+    {
+        Phase phase("unlink");
+        for (uint32_t i = 0; i < opt.files; i++) {
+            if (fuse.Call(FUSE_UNLINK, root, nullptr, 0, "f" + std::to_string(i)) != FUSE_OK) {
+                errors++;
+            }
+        }
+        phase.Done(opt.files, 0);
+    }
+
+    printf("\n%-12s %8s %6s %8s %8s %8s %8s\n", "opcode", "count", "errors", "avg us",
+           "p50 us", "p99 us", "max us");
+    for (const auto& op : dev.op_stats().Snapshot()) {
+        printf("%-12s %8llu %6llu %8llu %8llu %8llu %8llu\n",
+               VirtioFsOpStats::OpcodeName(op.opcode),
+               static_cast<unsigned long long>(op.count),
+               static_cast<unsigned long long>(op.errors),
+               static_cast<unsigned long long>(op.total_us / op.count),
+               static_cast<unsigned long long>(op.PercentileUs(0.5)),
+               static_cast<unsigned long long>(op.PercentileUs(0.99)),
+               static_cast<unsigned long long>(op.max_us));
+    }
+    if (opt.trace) {
+        printf("\n%12s %8s %-12s %10s %8s %8s %6s\n", "start us", "lat us", "opcode", "nodeid",
+               "in", "out", "error");
+        for (const auto& rec : dev.op_stats().GetTrace()) {
+            printf("%12llu %8u %-12s %10llu %8u %8u %6d\n",
+                   static_cast<unsigned long long>(rec.start_us), rec.latency_us,
+                   VirtioFsOpStats::OpcodeName(rec.opcode),
+                   static_cast<unsigned long long>(rec.nodeid), rec.in_len, rec.out_len,
+                   rec.error);
+        }
+    }
+
+    dev.RemoveShare("bench");
+    int len = MultiByteToWideChar(CP_UTF8, 0, dir.c_str(), -1, nullptr, 0);
+    std::wstring wdir(len > 0 ? len - 1 : 0, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, dir.c_str(), -1, wdir.data(), len);
+    RemoveDirectoryW(wdir.c_str());
+
+    if (errors) fprintf(stderr, "%d requests failed\n", errors);
+    return errors ? 1 : 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        auto Arg = [&](const char* flag) {
+            return std::strcmp(argv[i], flag) == 0;
+        };
+        auto NextArg = [&]() -> const char* {
+            if (i + 1 < argc) return argv[++i];
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return nullptr;
+        };
+
+        if (Arg("--files")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.files = static_cast<uint32_t>(std::strtoul(v, nullptr, 10));
+        } else if (Arg("--size")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.file_size = std::strtoull(v, nullptr, 10) * 1024;
+        } else if (Arg("--io")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.io_size = static_cast<uint32_t>(std::strtoul(v, nullptr, 10) * 1024);
+        } else if (Arg("--writeback")) {
+            opt.writeback = true;
+        } else if (Arg("--trace")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.trace = std::strtoull(v, nullptr, 10);
+        } else if (Arg("--dir")) {
+            auto v = NextArg(); if (!v) return 1;
+            opt.dir = v;
+        } else if (Arg("--help") || Arg("-h")) {
+            PrintUsage(argv[0]);
+            return 0;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.io_size == 0 || opt.io_size > kMaxIo || opt.file_size == 0) {
+        fprintf(stderr, "--io must be 1..4096 KB and --size nonzero\n");
+        return 1;
+    }
+    return Run(opt);
+}